@@ -0,0 +1,302 @@
+#include "allocation_tracker.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+
+namespace
+{
+
+    // Constant-initialized, so that operator new can count into it before any dynamic
+    // initialization has run, including its own
+    constinit allocation_tracker tracker;
+
+    thread_local allocation_tag current_tag = allocation_tag::untagged;
+    thread_local bool in_frame = false;
+
+    std::string format_bytes(std::int64_t bytes)
+    {
+        std::ostringstream os;
+        os << std::fixed << std::setprecision(1);
+        if (bytes < 1024 * 1024)
+            os << bytes / 1024.0 << " KB";
+        else
+            os << bytes / (1024.0 * 1024.0) << " MB";
+        return os.str();
+    }
+
+}
+
+char const * allocation_tag_name(allocation_tag tag)
+{
+    switch (tag)
+    {
+    case allocation_tag::untagged: return "untagged";
+    case allocation_tag::loader: return "loader";
+    case allocation_tag::animation: return "animation";
+    case allocation_tag::culling: return "culling";
+    case allocation_tag::text: return "text";
+    case allocation_tag::count: break;
+    }
+    return "unknown";
+}
+
+allocation_tracker & allocation_tracker::global()
+{
+    return tracker;
+}
+
+allocation_counts allocation_tracker::counts(allocation_tag tag) const
+{
+    auto const & t = tags_[static_cast<std::size_t>(tag)];
+    allocation_counts result;
+    result.allocations = t.allocations.load(std::memory_order_relaxed);
+    result.allocated_bytes = t.allocated_bytes.load(std::memory_order_relaxed);
+    result.bytes = t.bytes.load(std::memory_order_relaxed);
+    result.peak_bytes = t.peak_bytes.load(std::memory_order_relaxed);
+    return result;
+}
+
+allocation_counts allocation_tracker::total() const
+{
+    allocation_counts result;
+    for (std::size_t i = 0; i < tag_count; ++i)
+    {
+        auto const c = counts(static_cast<allocation_tag>(i));
+        result.allocations += c.allocations;
+        result.allocated_bytes += c.allocated_bytes;
+        result.bytes += c.bytes;
+    }
+    return result;
+}
+
+void allocation_tracker::end_frame()
+{
+    last_frame_allocations_ = frame_allocations_.exchange(0, std::memory_order_relaxed);
+}
+
+void allocation_tracker::allocated(allocation_tag tag, std::size_t bytes)
+{
+    auto & t = tags_[static_cast<std::size_t>(tag)];
+    t.allocations.fetch_add(1, std::memory_order_relaxed);
+    t.allocated_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    std::int64_t const live = t.bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    std::int64_t peak = t.peak_bytes.load(std::memory_order_relaxed);
+    while (live > peak && !t.peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+        ;
+
+    if (in_frame)
+    {
+        frame_allocations_.fetch_add(1, std::memory_order_relaxed);
+        if (fail_on_frame_allocation())
+        {
+            // Nothing here may allocate, or this would recurse
+            std::fprintf(stderr, "Allocation of %zu bytes (%s) in the frame loop\n", bytes, allocation_tag_name(tag));
+            std::abort();
+        }
+    }
+}
+
+void allocation_tracker::freed(allocation_tag tag, std::size_t bytes)
+{
+    tags_[static_cast<std::size_t>(tag)].bytes.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+std::string allocation_tracker::overlay_text() const
+{
+    if (!enabled())
+        return {};
+
+    std::ostringstream os;
+    for (std::size_t i = 0; i < tag_count; ++i)
+    {
+        auto const tag = static_cast<allocation_tag>(i);
+        auto const c = counts(tag);
+        if (c.allocations == 0)
+            continue;
+        os << allocation_tag_name(tag) << ": " << format_bytes(c.bytes) << " (" << format_bytes(c.peak_bytes) << "), "
+            << c.allocations << " allocations\n";
+    }
+    os << "frame allocations: " << last_frame_allocations_;
+    return os.str();
+}
+
+void allocation_tracker::print_summary(std::ostream & os) const
+{
+    if (!enabled())
+        return;
+
+    os << "Heap allocations, live (peak), allocations made:\n";
+    for (std::size_t i = 0; i < tag_count; ++i)
+    {
+        auto const tag = static_cast<allocation_tag>(i);
+        auto const c = counts(tag);
+        if (c.allocations == 0)
+            continue;
+        os << "  " << allocation_tag_name(tag) << " " << format_bytes(c.bytes) << " (" << format_bytes(c.peak_bytes) << "), "
+            << c.allocations << "\n";
+    }
+    os << "  last frame " << last_frame_allocations_ << "\n";
+}
+
+allocation_scope::allocation_scope(allocation_tag tag)
+    : previous_(current_tag)
+{
+    current_tag = tag;
+}
+
+allocation_scope::~allocation_scope()
+{
+    current_tag = previous_;
+}
+
+allocation_tag allocation_scope::current()
+{
+    return current_tag;
+}
+
+frame_scope::frame_scope()
+    : previous_(in_frame)
+{
+    in_frame = true;
+}
+
+frame_scope::~frame_scope()
+{
+    in_frame = previous_;
+}
+
+bool frame_scope::active()
+{
+    return in_frame;
+}
+
+#ifdef ALLOCATION_TRACKING
+
+namespace
+{
+
+    // Right before every block handed out; offset is from the start of what malloc returned
+    struct block_header
+    {
+        std::size_t size;
+        std::uint32_t offset;
+        allocation_tag tag;
+    };
+
+    static_assert(sizeof(block_header) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+    block_header * header_of(void * p)
+    {
+        return reinterpret_cast<block_header *>(static_cast<std::byte *>(p) - sizeof(block_header));
+    }
+
+    void * tracked_allocate(std::size_t size, std::size_t alignment)
+    {
+        // The header takes a whole alignment unit in front of the block, keeping it aligned
+        alignment = std::max<std::size_t>(alignment, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+        std::size_t const total = size + alignment;
+
+        void * base;
+        if (alignment == __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+            base = std::malloc(total);
+        else
+#ifdef _WIN32
+            base = _aligned_malloc(total, alignment);
+#else
+            base = std::aligned_alloc(alignment, (total + alignment - 1) / alignment * alignment);
+#endif
+        if (!base)
+            return nullptr;
+
+        void * p = static_cast<std::byte *>(base) + alignment;
+        allocation_tag const tag = current_tag;
+        *header_of(p) = {size, static_cast<std::uint32_t>(alignment), tag};
+        tracker.allocated(tag, size);
+        return p;
+    }
+
+    void tracked_free(void * p)
+    {
+        if (!p)
+            return;
+
+        block_header const header = *header_of(p);
+        tracker.freed(header.tag, header.size);
+
+        void * base = static_cast<std::byte *>(p) - header.offset;
+#ifdef _WIN32
+        if (header.offset != __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+        {
+            _aligned_free(base);
+            return;
+        }
+#endif
+        std::free(base);
+    }
+
+    void * allocate_or_throw(std::size_t size, std::size_t alignment)
+    {
+        // Zero-sized requests still get a distinct block
+        if (size == 0)
+            size = 1;
+
+        while (true)
+        {
+            if (void * p = tracked_allocate(size, alignment))
+                return p;
+            if (auto handler = std::get_new_handler())
+                handler();
+            else
+                throw std::bad_alloc();
+        }
+    }
+
+}
+
+void * operator new(std::size_t size)
+{
+    return allocate_or_throw(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void * operator new[](std::size_t size)
+{
+    return allocate_or_throw(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void * operator new(std::size_t size, std::align_val_t alignment)
+{
+    return allocate_or_throw(size, static_cast<std::size_t>(alignment));
+}
+
+void * operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return allocate_or_throw(size, static_cast<std::size_t>(alignment));
+}
+
+void * operator new(std::size_t size, std::nothrow_t const &) noexcept
+{
+    try { return allocate_or_throw(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+    catch (...) { return nullptr; }
+}
+
+void * operator new[](std::size_t size, std::nothrow_t const &) noexcept
+{
+    try { return allocate_or_throw(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+    catch (...) { return nullptr; }
+}
+
+void operator delete(void * p) noexcept { tracked_free(p); }
+void operator delete[](void * p) noexcept { tracked_free(p); }
+void operator delete(void * p, std::size_t) noexcept { tracked_free(p); }
+void operator delete[](void * p, std::size_t) noexcept { tracked_free(p); }
+void operator delete(void * p, std::align_val_t) noexcept { tracked_free(p); }
+void operator delete[](void * p, std::align_val_t) noexcept { tracked_free(p); }
+void operator delete(void * p, std::size_t, std::align_val_t) noexcept { tracked_free(p); }
+void operator delete[](void * p, std::size_t, std::align_val_t) noexcept { tracked_free(p); }
+void operator delete(void * p, std::nothrow_t const &) noexcept { tracked_free(p); }
+void operator delete[](void * p, std::nothrow_t const &) noexcept { tracked_free(p); }
+
+#endif
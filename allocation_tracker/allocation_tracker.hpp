@@ -0,0 +1,166 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <ostream>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+
+enum class allocation_tag
+{
+    untagged,
+    loader,
+    animation,
+    culling,
+    text,
+    count,
+};
+
+char const * allocation_tag_name(allocation_tag tag);
+
+struct allocation_counts
+{
+    // Allocations made, whether freed since or not, and the bytes of all of them
+    std::uint64_t allocations = 0;
+    std::uint64_t allocated_bytes = 0;
+    // Live now, and the most that ever were at once
+    std::int64_t bytes = 0;
+    std::int64_t peak_bytes = 0;
+};
+
+// Heap allocations counted by the subsystem that made them. With ALLOCATION_TRACKING defined,
+// the library replaces the global operator new and delete: every block carries a small header
+// with its size and the tag of the allocation_scope it was made in, so that it is uncounted
+// from that tag whichever thread frees it. Without it the scopes still nest, but nothing is
+// counted, and the operators are the standard ones. The replacements are in the same object
+// file as global(), so a program links them in by using the tracker at all.
+//
+// A thread inside a frame_scope counts its allocations as frame allocations, which a steady
+// frame loop should have none of. With fail_on_frame_allocation set, the first of them aborts,
+// leaving a debugger at the call that allocated.
+struct allocation_tracker
+{
+    static constexpr std::size_t tag_count = static_cast<std::size_t>(allocation_tag::count);
+
+    static allocation_tracker & global();
+
+    // False when built without ALLOCATION_TRACKING, when all of this counts nothing
+    static constexpr bool enabled()
+    {
+#ifdef ALLOCATION_TRACKING
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    allocation_counts counts(allocation_tag tag) const;
+
+    // Of all tags together, with no peak, since the tags' peaks need not have come at once
+    allocation_counts total() const;
+
+    // Allocations made inside frame scopes since the last end_frame, then of the last frame
+    std::uint64_t current_frame_allocations() const { return frame_allocations_.load(std::memory_order_relaxed); }
+    std::uint64_t last_frame_allocations() const { return last_frame_allocations_; }
+
+    // Starts counting the next frame's allocations from zero; belongs to the thread that ends frames
+    void end_frame();
+
+    void set_fail_on_frame_allocation(bool fail) { fail_on_frame_allocation_.store(fail, std::memory_order_relaxed); }
+    bool fail_on_frame_allocation() const { return fail_on_frame_allocation_.load(std::memory_order_relaxed); }
+
+    // One "tag: live (peak), allocations" line per tag that allocated anything, and the frame
+    // allocations; empty without ALLOCATION_TRACKING
+    std::string overlay_text() const;
+    void print_summary(std::ostream & os) const;
+
+    // What the replaced operators call, with the tag of the block and its size
+    void allocated(allocation_tag tag, std::size_t bytes);
+    void freed(allocation_tag tag, std::size_t bytes);
+
+private:
+    struct tag_counts
+    {
+        std::atomic<std::uint64_t> allocations{0};
+        std::atomic<std::uint64_t> allocated_bytes{0};
+        std::atomic<std::int64_t> bytes{0};
+        std::atomic<std::int64_t> peak_bytes{0};
+    };
+
+    std::array<tag_counts, tag_count> tags_;
+    std::atomic<std::uint64_t> frame_allocations_{0};
+    std::uint64_t last_frame_allocations_ = 0;
+    std::atomic<bool> fail_on_frame_allocation_{false};
+};
+
+// Allocations of this thread made while the scope is alive are tagged with its tag; scopes
+// nest, the innermost one winning
+struct allocation_scope
+{
+    explicit allocation_scope(allocation_tag tag);
+    ~allocation_scope();
+
+    allocation_scope(allocation_scope const &) = delete;
+    allocation_scope & operator = (allocation_scope const &) = delete;
+
+    static allocation_tag current();
+
+private:
+    allocation_tag previous_;
+};
+
+// Marks the body of a frame loop on this thread, whose allocations are frame allocations
+struct frame_scope
+{
+    frame_scope();
+    ~frame_scope();
+
+    frame_scope(frame_scope const &) = delete;
+    frame_scope & operator = (frame_scope const &) = delete;
+
+    static bool active();
+
+private:
+    bool previous_;
+};
+
+// For containers whose memory belongs to a subsystem wherever they grow: allocates under the
+// allocator's tag instead of the scope's
+template <typename T, allocation_tag Tag>
+struct tagged_allocator
+{
+    using value_type = T;
+
+    template <typename U>
+    struct rebind
+    {
+        using other = tagged_allocator<U, Tag>;
+    };
+
+    tagged_allocator() = default;
+
+    template <typename U>
+    tagged_allocator(tagged_allocator<U, Tag> const &) {}
+
+    T * allocate(std::size_t n)
+    {
+        allocation_scope scope(Tag);
+        if constexpr (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+            return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t{alignof(T)}));
+        else
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T * p, std::size_t)
+    {
+        if constexpr (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+            ::operator delete(p, std::align_val_t{alignof(T)});
+        else
+            ::operator delete(p);
+    }
+
+    template <typename U>
+    bool operator == (tagged_allocator<U, Tag> const &) const { return true; }
+};
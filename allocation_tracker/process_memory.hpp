@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+
+// Starts measuring the peak resident set size again from what is resident now. Only Linux
+// allows it; elsewhere the peak only grows over the whole run.
+void reset_peak_rss();
+
+// The most memory the process has had resident at once, in bytes; 0 where it cannot be read
+std::size_t peak_rss();
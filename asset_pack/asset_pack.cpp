@@ -0,0 +1,200 @@
+#include "asset_pack.hpp"
+#include "lz_block.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <cstring>
+#include <tuple>
+
+namespace
+{
+
+    constexpr char pack_magic[8] = {'A', 'S', 'S', 'E', 'T', 'P', 'A', 'K'};
+    constexpr std::uint32_t pack_version = 1;
+
+    std::size_t align_up(std::size_t offset)
+    {
+        return (offset + asset_pack::alignment - 1) / asset_pack::alignment * asset_pack::alignment;
+    }
+
+    bool entry_less(asset_pack::entry const & e, std::uint64_t hash)
+    {
+        return e.hash < hash;
+    }
+
+}
+
+std::uint64_t asset_name_hash(std::string_view name)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    for (char c : name)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+std::string asset_name(std::filesystem::path const & relative_path)
+{
+    return relative_path.lexically_normal().generic_string();
+}
+
+asset_pack::asset_pack(std::filesystem::path const & path)
+    : file_(std::make_shared<mapped_file>(path))
+{
+    header h;
+    if (file_->size() < sizeof(h))
+        throw std::runtime_error("Asset pack is truncated: " + path.string());
+    std::memcpy(&h, file_->data(), sizeof(h));
+    check_header(h, path.string());
+
+    std::size_t const entries_end = sizeof(h) + std::size_t(h.entry_count) * sizeof(entry);
+    if (entries_end > file_->size() || h.names_offset + h.names_size > file_->size())
+        throw std::runtime_error("Asset pack table of contents is out of range in " + path.string());
+
+    // The header is 8-byte aligned in the mapping, and so is every entry after it
+    entries_ = {reinterpret_cast<entry const *>(file_->data() + sizeof(h)), h.entry_count};
+    names_ = {file_->data() + h.names_offset, h.names_size};
+
+    check_entries(entries_, names_, file_->size(), path.string());
+}
+
+void asset_pack::check_header(header const & h, std::string const & source)
+{
+    if (std::memcmp(h.magic, pack_magic, sizeof(pack_magic)) != 0)
+        throw std::runtime_error("Not an asset pack: " + source);
+    if (h.version != pack_version)
+        throw std::runtime_error("Unsupported asset pack version in " + source);
+    if (h.names_offset < sizeof(h) + std::uint64_t(h.entry_count) * sizeof(entry))
+        throw std::runtime_error("Asset pack table of contents is out of range in " + source);
+}
+
+void asset_pack::check_entries(std::span<entry const> entries, std::string_view names, std::uint64_t pack_size, std::string const & source)
+{
+    for (auto const & e : entries)
+    {
+        if (std::size_t(e.name_offset) + e.name_size > names.size() || e.offset + e.stored_size > pack_size)
+            throw std::runtime_error("Asset pack entry is out of range in " + source);
+        if (e.method != compression::none && e.method != compression::lz)
+            throw std::runtime_error("Unknown asset pack compression in " + source);
+    }
+}
+
+asset_pack::entry const * asset_pack::find(std::span<entry const> entries, std::string_view names, std::string_view name)
+{
+    std::uint64_t const hash = asset_name_hash(name);
+
+    // Colliding hashes are adjacent, so the names only need comparing within the run
+    for (auto it = std::lower_bound(entries.begin(), entries.end(), hash, entry_less); it != entries.end() && it->hash == hash; ++it)
+        if (names.substr(it->name_offset, it->name_size) == name)
+            return &*it;
+
+    return nullptr;
+}
+
+asset_pack::entry const * asset_pack::find(std::string_view name) const
+{
+    return find(entries_, names_, name);
+}
+
+std::string_view asset_pack::name(entry const & e) const
+{
+    return names_.substr(e.name_offset, e.name_size);
+}
+
+std::span<char const> asset_pack::stored(entry const & e) const
+{
+    return {file_->data() + e.offset, e.stored_size};
+}
+
+void write_asset_pack(std::filesystem::path const & path, std::filesystem::path const & root, std::vector<std::filesystem::path> const & files)
+{
+    struct item
+    {
+        std::string name;
+        std::vector<char> data;
+        asset_pack::entry e;
+    };
+
+    std::vector<item> items;
+    for (auto const & file : files)
+    {
+        auto & i = items.emplace_back();
+        i.name = asset_name(file);
+
+        std::ifstream input(root / file, std::ios::binary);
+        if (!input)
+            throw std::runtime_error("Failed to read " + (root / file).string());
+        i.data.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+
+        i.e = {asset_name_hash(i.name), 0, i.data.size(), i.data.size(), 0, static_cast<std::uint32_t>(i.name.size()), asset_pack::compression::none, 0};
+
+        // Images and other already compressed files stay as they are; the rest has to shrink
+        // by an eighth to be worth decoding on every load
+        auto const compressed = lz_compress(reinterpret_cast<std::uint8_t const *>(i.data.data()), i.data.size());
+        if (compressed.size() < i.data.size() - i.data.size() / 8)
+        {
+            i.data.assign(compressed.begin(), compressed.end());
+            i.e.stored_size = i.data.size();
+            i.e.method = asset_pack::compression::lz;
+        }
+    }
+
+    std::sort(items.begin(), items.end(), [](item const & a, item const & b)
+    {
+        return std::tie(a.e.hash, a.name) < std::tie(b.e.hash, b.name);
+    });
+
+    for (std::size_t i = 1; i < items.size(); ++i)
+        if (items[i].name == items[i - 1].name)
+            throw std::runtime_error("Asset pack lists " + items[i].name + " twice");
+
+    std::string names;
+    for (auto & i : items)
+    {
+        i.e.name_offset = names.size();
+        names += i.name;
+    }
+
+    asset_pack::header header;
+    std::memcpy(header.magic, pack_magic, sizeof(pack_magic));
+    header.version = pack_version;
+    header.entry_count = items.size();
+    header.names_offset = sizeof(header) + items.size() * sizeof(asset_pack::entry);
+    header.names_size = names.size();
+
+    std::size_t offset = align_up(header.names_offset + header.names_size);
+    for (auto & i : items)
+    {
+        i.e.offset = offset;
+        offset = align_up(offset + i.e.stored_size);
+    }
+
+    // Same temporary-then-rename scheme as the caches
+    auto temp_path = path;
+    temp_path += ".tmp";
+    {
+        std::ofstream output(temp_path, std::ios::binary);
+        output.write(reinterpret_cast<char const *>(&header), sizeof(header));
+        for (auto const & i : items)
+            output.write(reinterpret_cast<char const *>(&i.e), sizeof(i.e));
+        output.write(names.data(), names.size());
+
+        std::vector<char> const padding(asset_pack::alignment, 0);
+        std::size_t position = header.names_offset + header.names_size;
+        for (auto const & i : items)
+        {
+            output.write(padding.data(), i.e.offset - position);
+            output.write(i.data.data(), i.data.size());
+            position = i.e.offset + i.data.size();
+        }
+        output.write(padding.data(), align_up(position) - position);
+
+        if (!output)
+            throw std::runtime_error("Failed to write " + temp_path.string());
+    }
+    std::filesystem::rename(temp_path, path);
+}
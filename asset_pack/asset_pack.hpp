@@ -0,0 +1,97 @@
+#pragma once
+
+#include "mapped_file.hpp"
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <span>
+#include <cstdint>
+#include <cstddef>
+
+// The contents of an asset and whatever keeps them alive: the mapping of a loose file or of
+// the pack holding it, or a buffer for a file that had to be decompressed
+struct asset_data
+{
+    std::shared_ptr<void const> owner;
+    std::span<char const> data;
+
+    std::string_view view() const { return {data.data(), data.size()}; }
+};
+
+// Many asset files in one, so that loading them costs one open and one mapping instead of a
+// few syscalls each. A header and a table of contents sorted by path hash come first, then the
+// names, then the contents of every file starting on a 4 KB boundary, stored as is or
+// LZ-compressed when that saves enough to be worth decoding.
+struct asset_pack
+{
+    static constexpr std::size_t alignment = 4096;
+
+    enum class compression : std::uint32_t
+    {
+        none = 0,
+        lz = 1,
+    };
+
+    struct entry
+    {
+        std::uint64_t hash;
+        std::uint64_t offset;
+        // Sizes before and after compression, equal for stored files
+        std::uint64_t size;
+        std::uint64_t stored_size;
+        std::uint32_t name_offset;
+        std::uint32_t name_size;
+        compression method;
+        std::uint32_t padding;
+    };
+
+    // What a pack starts with; the entries follow right after it, then the names
+    struct header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t entry_count;
+        std::uint64_t names_offset;
+        std::uint64_t names_size;
+    };
+
+    explicit asset_pack(std::filesystem::path const & path);
+
+    // The checks the constructor makes, for a pack read some other way; source names it in the
+    // errors thrown
+    static void check_header(header const & h, std::string const & source);
+    static void check_entries(std::span<entry const> entries, std::string_view names, std::uint64_t pack_size, std::string const & source);
+
+    // Looks a name up in a table of contents as the pack stores it
+    static entry const * find(std::span<entry const> entries, std::string_view names, std::string_view name);
+
+    // Names are relative to the directory the pack was made from, '/'-separated; nullptr if
+    // the pack has no such file
+    entry const * find(std::string_view name) const;
+
+    std::span<entry const> entries() const { return entries_; }
+    std::string_view name(entry const & e) const;
+
+    // The bytes as they are in the pack, compressed or not
+    std::span<char const> stored(entry const & e) const;
+
+    // Keeps the mapping alive for whoever holds on to stored() bytes
+    std::shared_ptr<mapped_file const> file() const { return file_; }
+
+private:
+    std::shared_ptr<mapped_file const> file_;
+    std::span<entry const> entries_;
+    std::string_view names_;
+};
+
+// FNV-1a of the normalized, '/'-separated relative path
+std::uint64_t asset_name_hash(std::string_view name);
+
+// The form names take in a pack: lexically normal and '/'-separated
+std::string asset_name(std::filesystem::path const & relative_path);
+
+// Packs files given relative to root
+void write_asset_pack(std::filesystem::path const & path, std::filesystem::path const & root, std::vector<std::filesystem::path> const & files);
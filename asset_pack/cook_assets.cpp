@@ -0,0 +1,230 @@
+#include "asset_pack.hpp"
+#include "obj_cache.hpp"
+#include "mapped_file.hpp"
+#include "job_system.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <optional>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstdlib>
+
+namespace
+{
+
+    // Remembers the content hash each source had when its caches were last made, so that a
+    // source whose modification time changed without its contents changing (a checkout, a
+    // copy) gets its caches restamped instead of cooked again
+    struct manifest_record
+    {
+        std::uint64_t hash;
+        obj_cache_stamp stamp;
+    };
+
+    using manifest = std::map<std::string, manifest_record>;
+
+    char const manifest_name[] = ".cook_manifest";
+
+    // One record per line: hash, source size, source time, then the path to the end of the line
+    manifest read_manifest(std::filesystem::path const & path)
+    {
+        manifest result;
+
+        std::ifstream input(path);
+        std::string line;
+        while (std::getline(input, line))
+        {
+            std::istringstream fields(line);
+            manifest_record record;
+            std::string name;
+            if (!(fields >> std::hex >> record.hash >> std::dec >> record.stamp.source_size >> record.stamp.source_time))
+                continue;
+            fields >> std::ws;
+            if (std::getline(fields, name) && !name.empty())
+                result[name] = record;
+        }
+
+        return result;
+    }
+
+    void write_manifest(std::filesystem::path const & path, manifest const & records)
+    {
+        auto temp_path = path;
+        temp_path += ".tmp";
+        {
+            std::ofstream output(temp_path);
+            for (auto const & [name, record] : records)
+                output << std::hex << record.hash << std::dec << ' ' << record.stamp.source_size << ' ' << record.stamp.source_time << ' ' << name << '\n';
+            if (!output)
+                throw std::runtime_error("Failed to write " + temp_path.string());
+        }
+        std::filesystem::rename(temp_path, path);
+    }
+
+    // FNV-1a, same as the texture cache and the asset packs
+    std::uint64_t content_hash(std::filesystem::path const & path)
+    {
+        std::uint64_t hash = 14695981039346656037ull;
+        if (std::filesystem::file_size(path) == 0)
+            return hash;
+
+        mapped_file file(path);
+        for (char c : file.view())
+        {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    struct product
+    {
+        std::filesystem::path cache_path;
+        std::function<void()> cook;
+    };
+
+    enum class outcome
+    {
+        fresh,
+        restamped,
+        cooked,
+    };
+
+    struct cook_result
+    {
+        manifest_record record;
+        outcome result = outcome::fresh;
+    };
+
+    cook_result cook(std::filesystem::path const & path, std::vector<product> const & products, manifest_record const * previous)
+    {
+        auto const stamp = obj_source_stamp(path);
+
+        // Hashing reads the whole source, so it only happens once a cache turns out stale
+        std::optional<std::uint64_t> hash;
+        if (previous && previous->stamp == stamp)
+            hash = previous->hash;
+        auto const current_hash = [&]{
+            if (!hash)
+                hash = content_hash(path);
+            return *hash;
+        };
+
+        cook_result result;
+        for (auto const & p : products)
+        {
+            auto const cached = read_obj_cache_stamp(p.cache_path);
+            if (cached == stamp)
+                continue;
+
+            // Built from the contents the manifest hashed, which the source still has
+            if (cached && previous && previous->stamp == *cached && previous->hash == current_hash()
+                && write_obj_cache_stamp(p.cache_path, stamp))
+            {
+                result.result = std::max(result.result, outcome::restamped);
+                continue;
+            }
+
+            p.cook();
+            result.result = outcome::cooked;
+        }
+
+        result.record = {current_hash(), stamp};
+        return result;
+    }
+
+}
+
+// Usage: cook_assets <root> [--tangents] [--occlusion] [--no-lods]
+// Builds the caches the loaders look for next to every OBJ under root, in parallel, so that
+// no practice has to parse a model on its first run. Sources are tracked by content hash in
+// <root>/.cook_manifest, and only the ones whose contents changed are cooked again.
+int main(int argc, char ** argv) try
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <root> [--tangents] [--occlusion] [--no-lods]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::filesystem::path const root = argv[1];
+
+    bool tangents = false;
+    bool occlusion = false;
+    bool lods = true;
+    for (int i = 2; i < argc; ++i)
+    {
+        std::string const option = argv[i];
+        if (option == "--tangents")
+            tangents = true;
+        else if (option == "--occlusion")
+            occlusion = true;
+        else if (option == "--no-lods")
+            lods = false;
+        else
+            throw std::runtime_error("Unknown option " + option);
+    }
+
+    auto const start = std::chrono::steady_clock::now();
+
+    std::vector<std::filesystem::path> sources;
+    for (auto const & entry : std::filesystem::recursive_directory_iterator(root))
+        if (entry.is_regular_file() && entry.path().extension() == ".obj")
+            sources.push_back(entry.path());
+
+    auto const manifest_path = root / manifest_name;
+    auto const previous = read_manifest(manifest_path);
+
+    std::vector<std::string> names(sources.size());
+    std::vector<cook_result> results(sources.size());
+
+    job_system jobs;
+    jobs.parallel_for(sources.size(), [&](std::size_t i)
+    {
+        auto const & path = sources[i];
+        names[i] = asset_name(std::filesystem::relative(path, root));
+
+        // In this order, since the LOD chain starts from the plain cache
+        std::vector<product> products;
+        products.push_back({obj_cache_path(path), [&]{ load_obj_cached(path); }});
+        if (tangents)
+            products.push_back({obj_cache_path(path, true), [&]{ load_obj_cached(path, true); }});
+        if (occlusion)
+            products.push_back({obj_cache_path(path, false, true), [&]{ load_obj_cached(path, false, true); }});
+        if (lods)
+            products.push_back({obj_lods_cache_path(path), [&]{ load_obj_lods_cached(path); }});
+
+        auto const it = previous.find(names[i]);
+        results[i] = cook(path, products, it == previous.end() ? nullptr : &it->second);
+    });
+
+    // Records of sources that are gone are dropped along with them
+    manifest current;
+    std::size_t counts[3] = {};
+    for (std::size_t i = 0; i < sources.size(); ++i)
+    {
+        current[names[i]] = results[i].record;
+        ++counts[static_cast<int>(results[i].result)];
+
+        char const * const status[] = {"up to date", "restamped", "cooked"};
+        std::cout << names[i] << ": " << status[static_cast<int>(results[i].result)] << std::endl;
+    }
+    write_manifest(manifest_path, current);
+
+    auto const elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Cooked " << counts[2] << ", restamped " << counts[1] << ", " << counts[0] << " up to date in "
+        << elapsed << " ms on " << jobs.thread_count() << " threads" << std::endl;
+}
+catch (std::exception const & e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,122 @@
+#include "disk_cache.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+
+    constexpr char const * temporary_extension = ".tmp";
+
+}
+
+disk_cache::disk_cache(std::filesystem::path const & directory, std::uint64_t capacity)
+    : directory_(directory)
+    , capacity_(capacity)
+{
+    std::filesystem::create_directories(directory_);
+
+    struct found
+    {
+        std::filesystem::file_time_type time;
+        item i;
+    };
+
+    std::vector<found> files;
+    for (auto const & entry : std::filesystem::directory_iterator(directory_))
+    {
+        if (!entry.is_regular_file())
+            continue;
+
+        // Left by a run that stopped in the middle of a write
+        if (entry.path().extension() == temporary_extension)
+        {
+            std::error_code error;
+            std::filesystem::remove(entry.path(), error);
+            continue;
+        }
+
+        files.push_back({entry.last_write_time(), {entry.path().filename().string(), entry.file_size()}});
+    }
+
+    std::sort(files.begin(), files.end(), [](found const & a, found const & b){ return a.time > b.time; });
+    for (auto & f : files)
+    {
+        size_ += f.i.size;
+        items_.push_back(std::move(f.i));
+        index_[items_.back().key] = std::prev(items_.end());
+    }
+
+    evict();
+}
+
+bool disk_cache::contains(std::string const & key) const
+{
+    std::lock_guard lock(mutex_);
+    return index_.contains(key);
+}
+
+std::shared_ptr<mapped_file const> disk_cache::open(std::string const & key)
+{
+    std::lock_guard lock(mutex_);
+
+    auto const it = index_.find(key);
+    if (it == index_.end())
+        return nullptr;
+
+    items_.splice(items_.begin(), items_, it->second);
+
+    auto const path = directory_ / key;
+    std::error_code error;
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+
+    // Mapped under the lock, so that eviction cannot remove the file in between
+    return std::make_shared<mapped_file>(path);
+}
+
+std::filesystem::path disk_cache::temporary_path(std::string const & key)
+{
+    std::lock_guard lock(mutex_);
+    return directory_ / (key + "." + std::to_string(next_temporary_++) + temporary_extension);
+}
+
+void disk_cache::insert(std::string const & key, std::filesystem::path const & temporary, std::uint64_t size)
+{
+    std::lock_guard lock(mutex_);
+
+    std::filesystem::rename(temporary, directory_ / key);
+
+    if (auto const it = index_.find(key); it != index_.end())
+    {
+        size_ -= it->second->size;
+        items_.erase(it->second);
+    }
+
+    items_.push_front({key, size});
+    index_[key] = items_.begin();
+    size_ += size;
+
+    evict();
+}
+
+std::uint64_t disk_cache::size() const
+{
+    std::lock_guard lock(mutex_);
+    return size_;
+}
+
+void disk_cache::evict()
+{
+    while (size_ > capacity_ && items_.size() > 1)
+    {
+        auto const & oldest = items_.back();
+
+        // Files still mapped cannot be removed on Windows; they go on the next run instead
+        std::error_code error;
+        std::filesystem::remove(directory_ / oldest.key, error);
+
+        size_ -= oldest.size;
+        index_.erase(oldest.key);
+        items_.pop_back();
+    }
+}
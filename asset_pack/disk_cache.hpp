@@ -0,0 +1,57 @@
+#pragma once
+
+#include "mapped_file.hpp"
+
+#include <filesystem>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+// Files kept in one directory up to a total size, the least recently used ones removed first
+// to make room. Each is written to a temporary file and renamed into place once complete, so
+// an interrupted write never leaves a truncated file behind. The order of use survives between
+// runs through the files' modification times. Any thread.
+struct disk_cache
+{
+    disk_cache(std::filesystem::path const & directory, std::uint64_t capacity);
+
+    disk_cache(disk_cache const &) = delete;
+    disk_cache & operator = (disk_cache const &) = delete;
+
+    // Without counting as a use
+    bool contains(std::string const & key) const;
+
+    // nullptr if the key is not cached; otherwise it becomes the most recently used
+    std::shared_ptr<mapped_file const> open(std::string const & key);
+
+    // Where to write a file before inserting it; unique for every call
+    std::filesystem::path temporary_path(std::string const & key);
+
+    // Moves the temporary file into the cache under key, then removes the least recently used
+    // files until the cache fits its capacity again, never the one just inserted
+    void insert(std::string const & key, std::filesystem::path const & temporary, std::uint64_t size);
+
+    std::uint64_t size() const;
+
+private:
+    struct item
+    {
+        std::string key;
+        std::uint64_t size;
+    };
+
+    void evict();
+
+    std::filesystem::path directory_;
+    std::uint64_t capacity_;
+
+    mutable std::mutex mutex_;
+    // Most recently used first
+    std::list<item> items_;
+    std::unordered_map<std::string, std::list<item>::iterator> index_;
+    std::uint64_t size_ = 0;
+    std::uint64_t next_temporary_ = 0;
+};
@@ -0,0 +1,351 @@
+#include "http_range_client.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+#ifdef WIN32
+    using native_socket = SOCKET;
+    constexpr std::intptr_t invalid_socket = std::intptr_t(INVALID_SOCKET);
+
+    void close_socket(std::intptr_t socket)
+    {
+        closesocket(SOCKET(socket));
+    }
+
+    struct winsock
+    {
+        winsock()
+        {
+            WSADATA data;
+            if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+                throw std::runtime_error("WSAStartup failed");
+        }
+
+        ~winsock()
+        {
+            WSACleanup();
+        }
+    };
+#else
+    using native_socket = int;
+    constexpr std::intptr_t invalid_socket = -1;
+
+    void close_socket(std::intptr_t socket)
+    {
+        close(int(socket));
+    }
+#endif
+
+#if defined(__linux__)
+    constexpr int send_flags = MSG_NOSIGNAL;
+#else
+    constexpr int send_flags = 0;
+#endif
+
+    // A stalled server fails the fetch instead of hanging the loader
+    constexpr int timeout_seconds = 30;
+
+    void send_all(std::intptr_t socket, std::string_view data)
+    {
+        while (!data.empty())
+        {
+            auto const sent = ::send(native_socket(socket), data.data(), int(data.size()), send_flags);
+            if (sent <= 0)
+                throw std::runtime_error("Failed to send an HTTP request");
+            data.remove_prefix(sent);
+        }
+    }
+
+    // Zero once the server closed the connection
+    std::size_t receive(std::intptr_t socket, char * output, std::size_t size)
+    {
+        auto const received = ::recv(native_socket(socket), output, int(std::min<std::size_t>(size, 1 << 20)), 0);
+        if (received < 0)
+            throw std::runtime_error("Failed to receive an HTTP response");
+        return std::size_t(received);
+    }
+
+    bool equal_ignoring_case(std::string_view a, std::string_view b)
+    {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y)
+        {
+            return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+        });
+    }
+
+    std::string_view trim(std::string_view str)
+    {
+        while (!str.empty() && (str.front() == ' ' || str.front() == '\t'))
+            str.remove_prefix(1);
+        while (!str.empty() && (str.back() == ' ' || str.back() == '\t' || str.back() == '\r'))
+            str.remove_suffix(1);
+        return str;
+    }
+
+    std::uint64_t parse_number(std::string_view str)
+    {
+        std::uint64_t result = 0;
+        auto const [end, error] = std::from_chars(str.data(), str.data() + str.size(), result);
+        if (error != std::errc() || end != str.data() + str.size())
+            throw std::runtime_error("Malformed number in an HTTP response: " + std::string(str));
+        return result;
+    }
+
+}
+
+http_range_client::http_range_client(std::string const & url)
+    : url_(url)
+{
+#ifdef WIN32
+    static winsock const startup;
+#endif
+
+    std::string_view rest = url;
+    if (!rest.starts_with("http://"))
+        throw std::runtime_error("Only http:// URLs can be fetched: " + url);
+    rest.remove_prefix(7);
+
+    auto const path_start = rest.find('/');
+    std::string_view const authority = rest.substr(0, path_start);
+    path_ = path_start == std::string_view::npos ? "/" : std::string(rest.substr(path_start));
+
+    auto const colon = authority.rfind(':');
+    if (colon == std::string_view::npos)
+    {
+        host_ = authority;
+        port_ = "80";
+    }
+    else
+    {
+        host_ = authority.substr(0, colon);
+        port_ = authority.substr(colon + 1);
+    }
+
+    if (host_.empty())
+        throw std::runtime_error("No host in " + url);
+}
+
+http_range_client::~http_range_client()
+{
+    for (auto socket : idle_)
+        close_socket(socket);
+}
+
+http_range_client::socket_handle http_range_client::connect()
+{
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo * addresses = nullptr;
+    if (getaddrinfo(host_.c_str(), port_.c_str(), &hints, &addresses) != 0)
+        throw std::runtime_error("Failed to resolve " + host_);
+
+    socket_handle result = invalid_socket;
+    for (auto a = addresses; a && result == invalid_socket; a = a->ai_next)
+    {
+        native_socket const s = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (socket_handle(s) == invalid_socket)
+            continue;
+
+        if (::connect(s, a->ai_addr, int(a->ai_addrlen)) != 0)
+        {
+            close_socket(socket_handle(s));
+            continue;
+        }
+
+#ifdef WIN32
+        DWORD const timeout = timeout_seconds * 1000;
+#else
+        timeval const timeout{timeout_seconds, 0};
+#endif
+        setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<char const *>(&timeout), sizeof(timeout));
+        setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<char const *>(&timeout), sizeof(timeout));
+#ifdef SO_NOSIGPIPE
+        int const one = 1;
+        setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+        result = socket_handle(s);
+    }
+    freeaddrinfo(addresses);
+
+    if (result == invalid_socket)
+        throw std::runtime_error("Failed to connect to " + host_ + ":" + port_);
+    return result;
+}
+
+void http_range_client::release(socket_handle socket)
+{
+    std::lock_guard lock(idle_mutex_);
+    idle_.push_back(socket);
+}
+
+http_range_client::response http_range_client::fetch(std::uint64_t offset, std::size_t size, char * output)
+{
+    socket_handle socket = invalid_socket;
+    {
+        std::lock_guard lock(idle_mutex_);
+        if (!idle_.empty())
+        {
+            socket = idle_.back();
+            idle_.pop_back();
+        }
+    }
+
+    // A kept-alive connection may have been closed by the server meanwhile, which only shows
+    // once it is used; the fetch is then made once more on a new one
+    for (bool const reused : {socket != invalid_socket, false})
+    {
+        if (socket == invalid_socket)
+            socket = connect();
+
+        bool reusable = false;
+        try
+        {
+            auto result = fetch_on(socket, offset, size, output, reusable);
+            if (reusable)
+                release(socket);
+            else
+                close_socket(socket);
+            return result;
+        }
+        catch (...)
+        {
+            close_socket(socket);
+            socket = invalid_socket;
+            if (!reused)
+                throw;
+        }
+    }
+
+    return {};
+}
+
+http_range_client::response http_range_client::fetch_on(socket_handle socket, std::uint64_t offset, std::size_t size, char * output, bool & reusable)
+{
+    if (size == 0)
+        throw std::runtime_error("Empty range requested from " + url_);
+
+    send_all(socket, "GET " + path_ + " HTTP/1.1\r\nHost: " + host_ + "\r\nRange: bytes=" + std::to_string(offset) + "-"
+        + std::to_string(offset + size - 1) + "\r\nAccept-Encoding: identity\r\n\r\n");
+
+    // The headers, and whatever of the body came with them
+    std::string head;
+    std::size_t head_end;
+    while ((head_end = head.find("\r\n\r\n")) == std::string::npos)
+    {
+        if (head.size() > 64 * 1024)
+            throw std::runtime_error("HTTP response headers too long from " + url_);
+        char buffer[4096];
+        std::size_t const received = receive(socket, buffer, sizeof(buffer));
+        if (received == 0)
+            throw std::runtime_error("Connection closed before an HTTP response from " + url_);
+        head.append(buffer, received);
+    }
+
+    std::string_view headers(head.data(), head_end + 2);
+    auto next_line = [&]
+    {
+        auto const end = headers.find("\r\n");
+        auto const line = headers.substr(0, end);
+        headers.remove_prefix(end + 2);
+        return line;
+    };
+
+    auto const status_line = next_line();
+    auto const status_start = status_line.find(' ');
+    if (!status_line.starts_with("HTTP/1.") || status_start == std::string_view::npos)
+        throw std::runtime_error("Not an HTTP response from " + url_);
+    int const status = int(parse_number(status_line.substr(status_start + 1, 3)));
+
+    response result;
+    std::uint64_t content_length = 0;
+    bool has_length = false;
+    bool keep_alive = status_line.starts_with("HTTP/1.1");
+    std::uint64_t range_start = 0;
+
+    while (!headers.empty())
+    {
+        auto const line = next_line();
+        auto const colon = line.find(':');
+        if (colon == std::string_view::npos)
+            continue;
+        auto const name = trim(line.substr(0, colon));
+        auto const value = trim(line.substr(colon + 1));
+
+        if (equal_ignoring_case(name, "Content-Length"))
+        {
+            content_length = parse_number(value);
+            has_length = true;
+        }
+        else if (equal_ignoring_case(name, "Content-Range"))
+        {
+            // bytes first-last/total
+            auto const space = value.find(' ');
+            auto const dash = value.find('-');
+            auto const slash = value.find('/');
+            if (space == std::string_view::npos || dash == std::string_view::npos || slash == std::string_view::npos)
+                throw std::runtime_error("Malformed Content-Range from " + url_);
+            range_start = parse_number(value.substr(space + 1, dash - space - 1));
+            if (value.substr(slash + 1) != "*")
+                result.file_size = parse_number(value.substr(slash + 1));
+        }
+        else if (equal_ignoring_case(name, "ETag"))
+            result.etag = value;
+        else if (equal_ignoring_case(name, "Connection"))
+            keep_alive = equal_ignoring_case(value, "keep-alive") || (keep_alive && !equal_ignoring_case(value, "close"));
+        else if (equal_ignoring_case(name, "Transfer-Encoding") && !equal_ignoring_case(value, "identity"))
+            throw std::runtime_error("Chunked HTTP responses are not supported, from " + url_);
+    }
+
+    if (!has_length)
+        throw std::runtime_error("HTTP response without Content-Length from " + url_);
+
+    // A server that ignores ranges sends the whole file, which still serves a range at its start
+    if (status == 200)
+    {
+        result.file_size = content_length;
+        if (offset != 0)
+            throw std::runtime_error("Server does not support range requests: " + url_);
+    }
+    else if (status != 206)
+        throw std::runtime_error("HTTP status " + std::to_string(status) + " for " + url_);
+    else if (range_start != offset)
+        throw std::runtime_error("Server returned another range than requested from " + url_);
+
+    if (content_length < size)
+        throw std::runtime_error("HTTP response shorter than the range requested from " + url_);
+
+    std::size_t const buffered = std::min<std::size_t>(head.size() - head_end - 4, size);
+    std::memcpy(output, head.data() + head_end + 4, buffered);
+    for (std::size_t done = buffered; done < size;)
+    {
+        std::size_t const received = receive(socket, output + done, size - done);
+        if (received == 0)
+            throw std::runtime_error("Connection closed in the middle of a response from " + url_);
+        done += received;
+    }
+
+    // Whatever more a 200 response carries is never read, so the connection cannot be reused
+    reusable = keep_alive && content_length == size && head.size() - head_end - 4 <= size;
+    return result;
+}
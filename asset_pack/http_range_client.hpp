@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+// Reads byte ranges of one file over HTTP/1.1, as object storage serves them. Only plain
+// http:// URLs are understood; TLS endpoints need a gateway or proxy in front of them. Any
+// number of threads may fetch at once, each on a connection of its own; connections are kept
+// alive and reused by the next fetch.
+struct http_range_client
+{
+    explicit http_range_client(std::string const & url);
+    ~http_range_client();
+
+    http_range_client(http_range_client const &) = delete;
+    http_range_client & operator = (http_range_client const &) = delete;
+
+    struct response
+    {
+        // Of the whole file, from the Content-Range header
+        std::uint64_t file_size = 0;
+        // Empty if the server sends none
+        std::string etag;
+    };
+
+    // Fills output with size bytes of the file from offset; throws if the server does not
+    // return all of them
+    response fetch(std::uint64_t offset, std::size_t size, char * output);
+
+    std::string const & url() const { return url_; }
+
+private:
+    using socket_handle = std::intptr_t;
+
+    socket_handle connect();
+    void release(socket_handle socket);
+    response fetch_on(socket_handle socket, std::uint64_t offset, std::size_t size, char * output, bool & reusable);
+
+    std::string url_;
+    std::string host_;
+    std::string port_;
+    std::string path_;
+
+    std::mutex idle_mutex_;
+    std::vector<socket_handle> idle_;
+};
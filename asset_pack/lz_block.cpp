@@ -0,0 +1,161 @@
+#include "lz_block.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+
+    constexpr std::size_t min_match = 4;
+    constexpr std::size_t max_offset = 65535;
+    // The format requires the block to end with this many literals, and no match to start closer to the end
+    constexpr std::size_t last_literals = 5;
+    constexpr std::size_t match_guard = 12;
+
+    constexpr int hash_bits = 12;
+
+    std::uint32_t read32(std::uint8_t const * p)
+    {
+        std::uint32_t result;
+        std::memcpy(&result, p, sizeof(result));
+        return result;
+    }
+
+    std::uint32_t hash(std::uint32_t v)
+    {
+        return (v * 2654435761u) >> (32 - hash_bits);
+    }
+
+    void write_length(std::vector<std::uint8_t> & output, std::size_t length)
+    {
+        for (; length >= 255; length -= 255)
+            output.push_back(255);
+        output.push_back(length);
+    }
+
+    void write_sequence(std::vector<std::uint8_t> & output, std::uint8_t const * literals, std::size_t literal_count, std::size_t offset, std::size_t match_length)
+    {
+        std::size_t const extra_match = match_length - min_match;
+        output.push_back((std::min<std::size_t>(literal_count, 15) << 4) | std::min<std::size_t>(extra_match, 15));
+        if (literal_count >= 15)
+            write_length(output, literal_count - 15);
+        output.insert(output.end(), literals, literals + literal_count);
+
+        output.push_back(offset & 0xff);
+        output.push_back(offset >> 8);
+        if (extra_match >= 15)
+            write_length(output, extra_match - 15);
+    }
+
+    std::size_t read_length(std::uint8_t const * & in, std::uint8_t const * end, std::size_t length)
+    {
+        if (length != 15)
+            return length;
+
+        for (std::uint8_t byte = 255; byte == 255; length += byte)
+        {
+            if (in == end)
+                throw std::runtime_error("Truncated LZ block");
+            byte = *in++;
+        }
+        return length;
+    }
+
+}
+
+std::vector<std::uint8_t> lz_compress(std::uint8_t const * data, std::size_t size)
+{
+    std::vector<std::uint8_t> result;
+    result.reserve(size / 2 + 16);
+
+    // Positions are stored plus one, so zero means no candidate
+    std::vector<std::uint32_t> table(std::size_t(1) << hash_bits, 0);
+
+    std::size_t anchor = 0;
+    std::size_t position = 0;
+
+    if (size > match_guard)
+    {
+        std::size_t const match_limit = size - last_literals;
+
+        while (position + match_guard <= size)
+        {
+            std::uint32_t const value = read32(data + position);
+            auto & entry = table[hash(value)];
+            std::size_t const candidate = entry;
+            entry = position + 1;
+
+            if (candidate == 0 || position - (candidate - 1) > max_offset || read32(data + candidate - 1) != value)
+            {
+                ++position;
+                continue;
+            }
+
+            std::size_t const match = candidate - 1;
+            std::size_t length = min_match;
+            while (position + length < match_limit && data[match + length] == data[position + length])
+                ++length;
+
+            write_sequence(result, data + anchor, position - anchor, position - match, length);
+
+            position += length;
+            anchor = position;
+        }
+    }
+
+    std::size_t const literal_count = size - anchor;
+    result.push_back(std::min<std::size_t>(literal_count, 15) << 4);
+    if (literal_count >= 15)
+        write_length(result, literal_count - 15);
+    result.insert(result.end(), data + anchor, data + size);
+
+    return result;
+}
+
+void lz_decompress(std::uint8_t const * block, std::size_t block_size, std::uint8_t * output, std::size_t size)
+{
+    std::uint8_t const * in = block;
+    std::uint8_t const * const in_end = block + block_size;
+    std::uint8_t * out = output;
+    std::uint8_t * const out_end = output + size;
+
+    while (true)
+    {
+        if (in == in_end)
+            throw std::runtime_error("Truncated LZ block");
+        std::uint8_t const token = *in++;
+
+        std::size_t const literal_count = read_length(in, in_end, token >> 4);
+        if (std::size_t(in_end - in) < literal_count || std::size_t(out_end - out) < literal_count)
+            throw std::runtime_error("Corrupt LZ block");
+        std::memcpy(out, in, literal_count);
+        in += literal_count;
+        out += literal_count;
+
+        // The last sequence has literals only
+        if (in == in_end)
+            break;
+
+        if (in_end - in < 2)
+            throw std::runtime_error("Truncated LZ block");
+        std::size_t const offset = in[0] | (std::size_t(in[1]) << 8);
+        in += 2;
+
+        std::size_t const length = read_length(in, in_end, token & 15) + min_match;
+        if (offset == 0 || std::size_t(out - output) < offset || std::size_t(out_end - out) < length)
+            throw std::runtime_error("Corrupt LZ block");
+
+        std::uint8_t const * match = out - offset;
+        if (offset >= length)
+            std::memcpy(out, match, length);
+        else
+            // Overlapping matches repeat the last offset bytes
+            for (std::size_t i = 0; i < length; ++i)
+                out[i] = match[i];
+        out += length;
+    }
+
+    if (out != out_end)
+        throw std::runtime_error("LZ block decodes to a wrong size");
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Byte-oriented LZ77 in the LZ4 block layout: tokens of literal and match lengths,
+// 16-bit back offsets, no entropy coding. Decoding is little more than memcpy.
+std::vector<std::uint8_t> lz_compress(std::uint8_t const * data, std::size_t size);
+
+// Throws if the block is corrupt or does not decode to exactly size bytes
+void lz_decompress(std::uint8_t const * block, std::size_t block_size, std::uint8_t * output, std::size_t size);
@@ -0,0 +1,42 @@
+#include "asset_pack.hpp"
+
+#include <iostream>
+#include <string>
+#include <set>
+#include <cstdlib>
+
+// Usage: pack_assets <root> <output> [extension...]
+// Packs every file under root with one of the extensions, by default the ones the practices load
+int main(int argc, char ** argv) try
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <root> <output> [extension...]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::filesystem::path const root = argv[1];
+    std::filesystem::path const output = argv[2];
+
+    std::set<std::string> extensions{".obj", ".mtl", ".gltf", ".glb", ".bin", ".png", ".jpg", ".data", ".json"};
+    if (argc > 3)
+        extensions = std::set<std::string>(argv + 3, argv + argc);
+
+    std::vector<std::filesystem::path> files;
+    for (auto const & entry : std::filesystem::recursive_directory_iterator(root))
+    {
+        if (!entry.is_regular_file() || !extensions.contains(entry.path().extension().string()))
+            continue;
+        files.push_back(std::filesystem::relative(entry.path(), root));
+    }
+
+    write_asset_pack(output, root, files);
+
+    std::cout << "Packed " << files.size() << " files into " << output.string() << ", "
+        << std::filesystem::file_size(output) / 1024 << " KB" << std::endl;
+}
+catch (std::exception const & e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,228 @@
+#include "remote_pack.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+
+    std::string hex(std::uint64_t value)
+    {
+        char buffer[17];
+        std::snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(value));
+        return buffer;
+    }
+
+}
+
+remote_pack::remote_pack(std::string const & url, remote_pack_options const & options)
+    : options_(options)
+    , client_(url)
+    , cache_(options.cache_directory, options.cache_size)
+{
+    asset_pack::header header;
+    auto const response = client_.fetch(0, sizeof(header), reinterpret_cast<char *>(&header));
+    asset_pack::check_header(header, url);
+
+    // Everything from the entries to the end of the names, in one request
+    std::vector<char> contents(header.names_offset + header.names_size - sizeof(header));
+    if (!contents.empty())
+        client_.fetch(sizeof(header), contents.size(), contents.data());
+
+    entries_.resize(header.entry_count);
+    std::memcpy(entries_.data(), contents.data(), entries_.size() * sizeof(asset_pack::entry));
+    names_.assign(contents.data() + header.names_offset - sizeof(header), header.names_size);
+
+    asset_pack::check_entries(entries_, names_, response.file_size, url);
+
+    // Without an ETag, a pack rebuilt to the same size would be mistaken for the old one
+    pack_id_ = asset_name_hash(url + " " + response.etag + " " + std::to_string(response.file_size));
+
+    for (unsigned int i = 0; i < std::max(1u, options_.requests_in_flight); ++i)
+        threads_.emplace_back([this]{ work(); });
+}
+
+remote_pack::~remote_pack()
+{
+    {
+        std::lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+    queue_changed_.notify_all();
+
+    for (auto & thread : threads_)
+        thread.join();
+}
+
+asset_pack::entry const * remote_pack::find(std::string_view name) const
+{
+    return asset_pack::find(entries_, names_, name);
+}
+
+std::string_view remote_pack::name(asset_pack::entry const & e) const
+{
+    return std::string_view(names_).substr(e.name_offset, e.name_size);
+}
+
+void remote_pack::prefetch(asset_pack::entry const & e)
+{
+    if (e.stored_size > 0)
+        start(e, false);
+}
+
+asset_data remote_pack::stored(asset_pack::entry const & e)
+{
+    // An empty file shares its offset, and so its cache key, with the file after it
+    if (e.stored_size == 0)
+        return {};
+
+    auto const key = cache_key(e);
+
+    // Another read may evict the file between its fetch and its mapping, if the cache is too
+    // small for the two of them; it is then fetched once more
+    for (int attempt = 0; attempt < 3; ++attempt)
+    {
+        if (auto file = cache_.open(key))
+            return {file, {file->data(), file->size()}};
+
+        start(e, true).get();
+    }
+
+    throw std::runtime_error("Asset cache is too small to hold " + std::string(name(e)));
+}
+
+std::string remote_pack::cache_key(asset_pack::entry const & e) const
+{
+    return hex(pack_id_) + "-" + hex(e.offset);
+}
+
+std::shared_future<void> remote_pack::start(asset_pack::entry const & e, bool urgent)
+{
+    auto const key = cache_key(e);
+
+    std::unique_lock lock(mutex_);
+
+    if (auto it = in_flight_.find(key); it != in_flight_.end())
+    {
+        auto d = it->second;
+        if (urgent)
+            std::stable_partition(queue_.begin(), queue_.end(), [&](range_request const & r){ return r.target == d; });
+        return d->ready;
+    }
+
+    if (cache_.contains(key))
+    {
+        std::promise<void> cached;
+        cached.set_value();
+        return cached.get_future().share();
+    }
+
+    auto d = std::make_shared<download>();
+    d->key = key;
+    d->temporary = cache_.temporary_path(key);
+    d->size = e.stored_size;
+    d->ready = d->done.get_future().share();
+
+    // The ranges are written in place as they arrive, in whatever order that is
+    std::ofstream(d->temporary, std::ios::binary).close();
+    std::filesystem::resize_file(d->temporary, d->size);
+
+    std::size_t const request_size = std::max<std::size_t>(options_.request_size, 1);
+    d->ranges_left = (d->size + request_size - 1) / request_size;
+
+    std::vector<range_request> ranges;
+    for (std::uint64_t offset = 0; offset < d->size; offset += request_size)
+        ranges.push_back({d, e.offset + offset, offset, std::size_t(std::min<std::uint64_t>(request_size, d->size - offset))});
+
+    if (urgent)
+        queue_.insert(queue_.begin(), ranges.begin(), ranges.end());
+    else
+        queue_.insert(queue_.end(), ranges.begin(), ranges.end());
+
+    in_flight_[key] = d;
+    lock.unlock();
+    queue_changed_.notify_all();
+
+    return d->ready;
+}
+
+void remote_pack::finish_range(download & d, std::exception_ptr error)
+{
+    {
+        std::lock_guard lock(mutex_);
+        if (error && !d.error)
+            d.error = error;
+        if (--d.ranges_left > 0)
+            return;
+    }
+
+    // The last range of the file; the download stays in flight until the file is in the
+    // cache, so that a read meanwhile waits for it instead of starting another
+    if (!d.error)
+    {
+        try
+        {
+            cache_.insert(d.key, d.temporary, d.size);
+        }
+        catch (...)
+        {
+            d.error = std::current_exception();
+        }
+    }
+
+    if (d.error)
+    {
+        std::error_code ignored;
+        std::filesystem::remove(d.temporary, ignored);
+    }
+
+    {
+        std::lock_guard lock(mutex_);
+        in_flight_.erase(d.key);
+    }
+
+    if (d.error)
+        d.done.set_exception(d.error);
+    else
+        d.done.set_value();
+}
+
+void remote_pack::work()
+{
+    std::vector<char> buffer;
+
+    while (true)
+    {
+        range_request request;
+        {
+            std::unique_lock lock(mutex_);
+            queue_changed_.wait(lock, [this]{ return stopping_ || !queue_.empty(); });
+            if (stopping_)
+                return;
+            request = std::move(queue_.front());
+            queue_.pop_front();
+        }
+
+        std::exception_ptr error;
+        try
+        {
+            buffer.resize(request.size);
+            client_.fetch(request.pack_offset, request.size, buffer.data());
+
+            std::fstream output(request.target->temporary, std::ios::binary | std::ios::in | std::ios::out);
+            output.seekp(request.file_offset);
+            output.write(buffer.data(), buffer.size());
+            if (!output)
+                throw std::runtime_error("Failed to write " + request.target->temporary.string());
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        finish_range(*request.target, error);
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "asset_pack.hpp"
+#include "http_range_client.hpp"
+#include "disk_cache.hpp"
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <thread>
+#include <cstdint>
+
+struct remote_pack_options
+{
+    std::filesystem::path cache_directory;
+    std::uint64_t cache_size = std::uint64_t(2) << 30;
+
+    // Range requests running at once, each on a thread and a connection of its own
+    unsigned int requests_in_flight = 8;
+
+    // Larger files are fetched as several ranges of this size in parallel
+    std::size_t request_size = std::size_t(4) << 20;
+};
+
+// An asset pack served over HTTP, read without downloading all of it: the table of contents
+// is fetched when the pack is opened, and every file the first time it is read, into a disk
+// cache that later reads and runs map it from. Files are fetched on a pool of threads, so
+// prefetching the ones a loader will need lets them arrive in parallel while it is busy with
+// something else. The cache tells packs apart by URL and ETag, so a pack replaced on the
+// server is fetched anew.
+struct remote_pack
+{
+    remote_pack(std::string const & url, remote_pack_options const & options);
+    ~remote_pack();
+
+    remote_pack(remote_pack const &) = delete;
+    remote_pack & operator = (remote_pack const &) = delete;
+
+    // As with asset_pack
+    asset_pack::entry const * find(std::string_view name) const;
+    std::string_view name(asset_pack::entry const & e) const;
+
+    // Starts fetching the file unless it is cached or being fetched already
+    void prefetch(asset_pack::entry const & e);
+
+    // The bytes of the file as the pack stores them, compressed or not; waits for them to be
+    // fetched, and throws if they could not be
+    asset_data stored(asset_pack::entry const & e);
+
+private:
+    struct download
+    {
+        std::string key;
+        std::filesystem::path temporary;
+        std::uint64_t size;
+        std::size_t ranges_left;
+        std::exception_ptr error;
+        std::promise<void> done;
+        std::shared_future<void> ready;
+    };
+
+    struct range_request
+    {
+        std::shared_ptr<download> target;
+        std::uint64_t pack_offset;
+        std::uint64_t file_offset;
+        std::size_t size;
+    };
+
+    std::string cache_key(asset_pack::entry const & e) const;
+    // Urgent requests go ahead of the ones queued by prefetches
+    std::shared_future<void> start(asset_pack::entry const & e, bool urgent);
+    void finish_range(download & d, std::exception_ptr error);
+    void work();
+
+    remote_pack_options options_;
+    http_range_client client_;
+    disk_cache cache_;
+
+    std::uint64_t pack_id_ = 0;
+    std::vector<asset_pack::entry> entries_;
+    std::string names_;
+
+    std::mutex mutex_;
+    std::condition_variable queue_changed_;
+    std::deque<range_request> queue_;
+    // By cache key; removed once the file is in the cache
+    std::map<std::string, std::shared_ptr<download>> in_flight_;
+    bool stopping_ = false;
+
+    std::vector<std::thread> threads_;
+};
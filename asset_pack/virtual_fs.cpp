@@ -0,0 +1,70 @@
+#include "virtual_fs.hpp"
+#include "lz_block.hpp"
+
+#include <stdexcept>
+
+void virtual_fs::mount(std::filesystem::path const & pack_path, std::filesystem::path const & root)
+{
+    mounts_.push_back({root.lexically_normal(), std::make_shared<asset_pack>(pack_path), nullptr});
+}
+
+void virtual_fs::mount_remote(std::string const & url, std::filesystem::path const & root, remote_pack_options const & options)
+{
+    mounts_.push_back({root.lexically_normal(), nullptr, std::make_shared<remote_pack>(url, options)});
+}
+
+std::pair<virtual_fs::mount_point const *, asset_pack::entry const *> virtual_fs::find(std::filesystem::path const & path) const
+{
+    auto const normal = path.lexically_normal();
+
+    for (auto it = mounts_.rbegin(); it != mounts_.rend(); ++it)
+    {
+        auto const relative = normal.lexically_relative(it->root);
+        if (relative.empty() || *relative.begin() == "..")
+            continue;
+
+        auto const name = asset_name(relative);
+        if (auto e = it->pack ? it->pack->find(name) : it->remote->find(name))
+            return {&*it, e};
+    }
+
+    return {nullptr, nullptr};
+}
+
+bool virtual_fs::exists(std::filesystem::path const & path) const
+{
+    return find(path).second || std::filesystem::is_regular_file(path);
+}
+
+asset_data virtual_fs::read(std::filesystem::path const & path) const
+{
+    auto const [mount, e] = find(path);
+
+    if (!mount)
+    {
+        auto file = std::make_shared<mapped_file>(path);
+        std::span<char const> data{file->data(), file->size()};
+        return {std::move(file), data};
+    }
+
+    auto const stored = mount->pack ? asset_data{mount->pack->file(), mount->pack->stored(*e)} : mount->remote->stored(*e);
+    if (e->method == asset_pack::compression::none)
+        return stored;
+
+    auto buffer = std::make_shared<std::vector<char>>(e->size);
+    lz_decompress(reinterpret_cast<std::uint8_t const *>(stored.data.data()), stored.data.size(), reinterpret_cast<std::uint8_t *>(buffer->data()), buffer->size());
+    std::span<char const> data{buffer->data(), buffer->size()};
+    return {std::move(buffer), data};
+}
+
+void virtual_fs::prefetch(std::filesystem::path const & path) const
+{
+    if (auto const [mount, e] = find(path); mount && mount->remote)
+        mount->remote->prefetch(*e);
+}
+
+virtual_fs & asset_fs()
+{
+    static virtual_fs instance;
+    return instance;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "asset_pack.hpp"
+#include "remote_pack.hpp"
+
+#include <filesystem>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <span>
+
+// Where loaders get files from. Packs are mounted at the directory they were made from, so
+// the same paths work whether the assets are packed or loose: a path under a mount point is
+// looked up in its packs first, the most recently mounted first, and on disk otherwise.
+// A pack may also be remote, its files fetched over HTTP into a disk cache as they are read.
+// Mount everything before reading from several threads; reads are safe to run concurrently.
+struct virtual_fs
+{
+    void mount(std::filesystem::path const & pack_path, std::filesystem::path const & root);
+    void mount_remote(std::string const & url, std::filesystem::path const & root, remote_pack_options const & options);
+
+    bool exists(std::filesystem::path const & path) const;
+
+    // Throws if the file is neither in a pack nor on disk
+    asset_data read(std::filesystem::path const & path) const;
+
+    // Starts fetching a file of a remote pack in the background, for a read that follows;
+    // does nothing for any other file
+    void prefetch(std::filesystem::path const & path) const;
+
+private:
+    struct mount_point
+    {
+        std::filesystem::path root;
+        // One of the two
+        std::shared_ptr<asset_pack> pack;
+        std::shared_ptr<remote_pack> remote;
+    };
+
+    std::vector<mount_point> mounts_;
+
+    std::pair<mount_point const *, asset_pack::entry const *> find(std::filesystem::path const & path) const;
+};
+
+// Shared by all loaders of a program
+virtual_fs & asset_fs();
@@ -0,0 +1,402 @@
+#include "obj_parser.hpp"
+#include "gltf_loader.hpp"
+#include "aabb.hpp"
+#include "frustum.hpp"
+#include "intersect.hpp"
+#include "bezier.hpp"
+#include "sphere_mesh.hpp"
+#include "msdf_loader.hpp"
+#include "allocation_tracker.hpp"
+
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/ext/matrix_clip_space.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdlib>
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Times the kernels the samples spend their loading and frame time in, each on the same
+// inputs every run: the bundled assets, and random ones from fixed seeds. Everything runs on
+// this thread, pinned to one core, with the parallel paths of the loaders left off, so that
+// results of two builds are comparable. A kernel is called in batches until a batch takes long
+// enough to time; the best batch gives the time per call.
+
+namespace
+{
+
+    // Keeps the first core for this thread, so the scheduler does not move it mid-measurement
+    bool pin_thread(unsigned int core)
+    {
+#if defined(WIN32)
+        return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << core) != 0;
+#elif defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        // macOS only takes affinity hints
+        (void)core;
+        return false;
+#endif
+    }
+
+    std::uint64_t total_allocations()
+    {
+        std::uint64_t result = 0;
+        for (std::size_t i = 0; i < allocation_tracker::tag_count; ++i)
+            result += allocation_tracker::global().counts(static_cast<allocation_tag>(i)).allocations;
+        return result;
+    }
+
+    struct kernel
+    {
+        std::string name;
+        // Items and bytes one call works through, for the throughput; zero when not meaningful
+        double items;
+        double bytes;
+        // Returns something depending on the work, so that it is not optimized out
+        std::function<std::size_t()> run;
+    };
+
+    struct result
+    {
+        std::string name;
+        double ns_per_call;
+        double items_per_second;
+        double mb_per_second;
+        double allocations_per_call;
+        std::size_t checksum;
+    };
+
+    result measure(kernel const & k, double min_batch_seconds, int batches)
+    {
+        result r{k.name, std::numeric_limits<double>::infinity(), 0.0, 0.0, 0.0, 0};
+
+        // The first call warms the caches and sizes any buffers the kernel reuses, so that the
+        // second one counts what every call allocates
+        r.checksum = k.run();
+        std::uint64_t const allocations_before = total_allocations();
+        r.checksum += k.run();
+        r.allocations_per_call = double(total_allocations() - allocations_before);
+
+        std::size_t calls = 1;
+        for (int batch = 0; batch < batches;)
+        {
+            auto const start = std::chrono::high_resolution_clock::now();
+            for (std::size_t i = 0; i < calls; ++i)
+                r.checksum += k.run();
+            double const seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+            // Batches too short for the clock are grown and not counted
+            if (seconds < min_batch_seconds)
+            {
+                calls *= 2;
+                continue;
+            }
+
+            r.ns_per_call = std::min(r.ns_per_call, seconds * 1e9 / calls);
+            ++batch;
+        }
+
+        r.items_per_second = k.items * 1e9 / r.ns_per_call;
+        r.mb_per_second = k.bytes * 1e3 / r.ns_per_call;
+        return r;
+    }
+
+    std::string json_escape(std::string const & str)
+    {
+        std::string result;
+        for (char c : str)
+        {
+            if (c == '"' || c == '\\')
+                result.push_back('\\');
+            result.push_back(c);
+        }
+        return result;
+    }
+
+    void write_json(std::ostream & os, std::vector<result> const & results)
+    {
+        os << "[\n";
+        for (std::size_t i = 0; i < results.size(); ++i)
+        {
+            auto const & r = results[i];
+            os << "  {\"kernel\": \"" << json_escape(r.name) << "\""
+                << ", \"ns_per_call\": " << r.ns_per_call
+                << ", \"items_per_second\": " << r.items_per_second
+                << ", \"mb_per_second\": " << r.mb_per_second
+                << ", \"allocations_per_call\": " << r.allocations_per_call
+                << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        os << "]\n";
+    }
+
+    // The "metric value" lines perf_regression compares against a baseline
+    void write_results(std::ostream & os, std::vector<result> const & results)
+    {
+        for (auto const & r : results)
+        {
+            os << r.name << " ns_per_call " << r.ns_per_call << "\n";
+            os << r.name << " allocations_per_call " << r.allocations_per_call << "\n";
+        }
+    }
+
+    void add_obj_kernels(std::vector<kernel> & kernels, std::filesystem::path const & root)
+    {
+        for (auto const & asset : {"practice4/bunny.obj", "practice4/bunny_lowres.obj", "practice5/cow.obj",
+            "practice6/dragon.obj", "practice7/suzanne.obj", "practice8/buddha.obj"})
+        {
+            auto const path = root / asset;
+            if (!std::filesystem::exists(path))
+                continue;
+
+            double const vertices = parse_obj(path).vertices.size();
+            kernels.push_back({"parse_obj " + path.filename().string(), vertices, double(std::filesystem::file_size(path)),
+                [path]{ return parse_obj(path).vertices.size(); }});
+        }
+    }
+
+    void add_gltf_kernels(std::vector<kernel> & kernels, std::filesystem::path const & root)
+    {
+        auto const wolf_path = root / "practice13/wolf/Wolf-Blender-2.82a.gltf";
+
+        // Bytes of the document and its buffers that the loader reads
+        double const wolf_bytes = std::filesystem::file_size(wolf_path) + model_memory_bytes(load_gltf(wolf_path));
+        kernels.push_back({"load_gltf wolf", 0.0, wolf_bytes, [wolf_path]{ return load_gltf(wolf_path).nodes.size(); }});
+
+        // Every track of every clip, at times spread over the clip: random ones go through the
+        // binary search, the ordered ones through a cursor as playback does
+        auto const wolf = std::make_shared<gltf_model>(load_gltf(wolf_path));
+        std::size_t tracks = 0;
+        for (auto const & [name, animation] : wolf->animations)
+            tracks += animation.bones.size();
+
+        std::size_t const samples = 64;
+        auto times = std::make_shared<std::vector<float>>(samples);
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> unit(0.f, 1.f);
+        for (auto & t : *times)
+            t = unit(rng);
+
+        kernels.push_back({"spline random wolf", double(tracks * samples * 3), 0.0, [wolf, times]
+        {
+            std::size_t hits = 0;
+            for (auto const & [name, animation] : wolf->animations)
+                for (auto const & bone : animation.bones)
+                    for (float t : *times)
+                    {
+                        float const time = t * animation.max_time;
+                        hits += bone.translation(time).x > 0.f;
+                        hits += bone.rotation(time).w > 0.f;
+                        hits += bone.scale(time).x > 1.f;
+                    }
+            return hits;
+        }});
+
+        kernels.push_back({"spline playback wolf", double(tracks * samples * 3), 0.0, [wolf]
+        {
+            std::size_t hits = 0;
+            for (auto const & [name, animation] : wolf->animations)
+                for (auto const & bone : animation.bones)
+                {
+                    gltf_model::bone_cursor cursor;
+                    for (std::size_t i = 0; i < samples; ++i)
+                    {
+                        float const time = animation.max_time * i / samples;
+                        hits += bone.translation(time, cursor.translation).x > 0.f;
+                        hits += bone.rotation(time, cursor.rotation).w > 0.f;
+                        hits += bone.scale(time, cursor.scale).x > 1.f;
+                    }
+                }
+            return hits;
+        }});
+    }
+
+    void add_culling_kernels(std::vector<kernel> & kernels)
+    {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> position(-20.f, 20.f);
+        std::uniform_real_distribution<float> extent(0.1f, 4.f);
+        std::uniform_real_distribution<float> angle(-3.14159f, 3.14159f);
+
+        auto boxes = std::make_shared<std::vector<aabb>>();
+        for (int i = 0; i < 4096; ++i)
+        {
+            glm::vec3 const min(position(rng), position(rng), position(rng));
+            boxes->emplace_back(min, min + glm::vec3(extent(rng), extent(rng), extent(rng)));
+        }
+
+        auto frustums = std::make_shared<std::vector<frustum>>();
+        glm::mat4 const projection = glm::perspective(glm::radians(60.f), 16.f / 9.f, 0.1f, 30.f);
+        for (int i = 0; i < 32; ++i)
+        {
+            glm::mat4 view(1.f);
+            view = glm::rotate(view, angle(rng), glm::vec3(1.f, 0.f, 0.f));
+            view = glm::rotate(view, angle(rng), glm::vec3(0.f, 1.f, 0.f));
+            view = glm::translate(view, glm::vec3(position(rng), position(rng), position(rng)) * 0.5f);
+            frustums->emplace_back(projection * view);
+        }
+
+        kernels.push_back({"intersect frustum aabb", double(boxes->size() * frustums->size()), 0.0, [boxes, frustums]
+        {
+            std::size_t hits = 0;
+            for (auto const & f : *frustums)
+                for (auto const & b : *boxes)
+                    hits += intersect(f, b);
+            return hits;
+        }});
+    }
+
+    void add_bezier_kernels(std::vector<kernel> & kernels)
+    {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> coordinate(-100.f, 100.f);
+
+        for (std::size_t degree : {3, 8})
+        {
+            auto control_points = std::make_shared<std::vector<vec2>>(degree + 1);
+            for (auto & p : *control_points)
+                p = {coordinate(rng), coordinate(rng)};
+
+            std::size_t const count = 1024;
+            auto output = std::make_shared<std::vector<vec2>>();
+
+            kernels.push_back({"bezier tessellate degree " + std::to_string(degree), double(count), 0.0, [control_points, output]
+            {
+                bezier_curve curve(*control_points);
+                curve.tessellate(count, *output);
+                return std::size_t(output->back().x > 0.f);
+            }});
+
+            auto flattener = std::make_shared<bezier_flattener>();
+            kernels.push_back({"bezier flatten degree " + std::to_string(degree), double(count), 0.0, [control_points, flattener, output]
+            {
+                flattener->flatten(*control_points, 0.01f, count, *output);
+                return output->size();
+            }});
+        }
+    }
+
+    void add_sphere_kernels(std::vector<kernel> & kernels)
+    {
+        for (int quality : {16, 64})
+        {
+            double const vertices = generate_uv_sphere(quality).vertices.size();
+            kernels.push_back({"generate_uv_sphere " + std::to_string(quality), vertices, 0.0, [quality]
+                { return generate_uv_sphere(quality).vertices.size(); }});
+        }
+        for (int subdivisions : {3, 5})
+        {
+            double const vertices = generate_icosphere(subdivisions).vertices.size();
+            kernels.push_back({"generate_icosphere " + std::to_string(subdivisions), vertices, 0.0, [subdivisions]
+                { return generate_icosphere(subdivisions).vertices.size(); }});
+        }
+    }
+
+    void add_font_kernels(std::vector<kernel> & kernels, std::filesystem::path const & root)
+    {
+        auto const path = root / "practice15/font/font-msdf.json";
+        double const glyphs = load_msdf_font(path.string()).glyphs.size();
+        kernels.push_back({"load_msdf_font", glyphs, double(std::filesystem::file_size(path)), [path]
+            { return load_msdf_font(path.string()).glyphs.size(); }});
+    }
+
+}
+
+int main(int argc, char ** argv) try
+{
+    std::string filter;
+    std::string json_path;
+    std::string results_path;
+    int batches = 5;
+    double min_batch_seconds = 0.05;
+    unsigned int core = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc)
+            filter = argv[++i];
+        else if (arg == "--json" && i + 1 < argc)
+            json_path = argv[++i];
+        else if (arg == "--results" && i + 1 < argc)
+            results_path = argv[++i];
+        else if (arg == "--batches" && i + 1 < argc)
+            batches = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--min-batch-ms" && i + 1 < argc)
+            min_batch_seconds = std::max(1, std::atoi(argv[++i])) / 1000.0;
+        else if (arg == "--core" && i + 1 < argc)
+            core = std::atoi(argv[++i]);
+        else
+            throw std::runtime_error("Usage: kernel_benchmark [--filter substring] [--json path] [--results path] [--batches n] [--min-batch-ms ms] [--core index]");
+    }
+
+    if (!pin_thread(core))
+        std::cerr << "Could not pin the benchmark to core " << core << ", results may be noisier" << std::endl;
+
+    std::filesystem::path const root = REPO_ROOT;
+
+    std::vector<kernel> kernels;
+    add_obj_kernels(kernels, root);
+    add_gltf_kernels(kernels, root);
+    add_culling_kernels(kernels);
+    add_bezier_kernels(kernels);
+    add_sphere_kernels(kernels);
+    add_font_kernels(kernels, root);
+
+    std::vector<result> results;
+    for (auto const & k : kernels)
+    {
+        if (!filter.empty() && k.name.find(filter) == std::string::npos)
+            continue;
+
+        auto const r = measure(k, min_batch_seconds, batches);
+        std::cout << std::left << std::setw(32) << r.name << std::right << std::fixed << std::setprecision(1)
+            << std::setw(14) << r.ns_per_call << " ns/call";
+        if (k.items > 0.0)
+            std::cout << std::setw(10) << std::setprecision(2) << r.items_per_second / 1e6 << " M items/s";
+        if (k.bytes > 0.0)
+            std::cout << std::setw(10) << std::setprecision(1) << r.mb_per_second << " MB/s";
+        std::cout << std::setw(10) << std::setprecision(0) << r.allocations_per_call << " allocations" << std::endl;
+        results.push_back(r);
+    }
+
+    if (!json_path.empty())
+    {
+        std::ofstream json(json_path);
+        write_json(json, results);
+    }
+
+    if (!results_path.empty())
+    {
+        std::ofstream output(results_path);
+        write_results(output, results);
+    }
+}
+catch (std::exception const & e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,107 @@
+#include "async_readback.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+
+async_readback::async_readback(int width, int height, frame_callback on_frame, std::size_t buffer_count)
+    : width_(width)
+    , height_(height)
+    , on_frame_(std::move(on_frame))
+    , slots_(std::max<std::size_t>(buffer_count, 1))
+{
+    for (auto & s : slots_)
+    {
+        glGenBuffers(1, &s.buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, std::size_t(width) * height * 4, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+async_readback::~async_readback()
+{
+    for (auto & s : slots_)
+    {
+        if (s.fence)
+            glDeleteSync(s.fence);
+        glDeleteBuffers(1, &s.buffer);
+    }
+}
+
+void async_readback::read(GLuint framebuffer, std::uint64_t frame)
+{
+    if (in_flight_ == slots_.size())
+        deliver_oldest(true);
+
+    auto & s = slots_[next_];
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glReadBuffer(framebuffer ? GL_COLOR_ATTACHMENT0 : GL_BACK);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+    glReadPixels(0, 0, width_, height_, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    // Flushed, so that the fence signals even if nothing else is submitted before it is polled
+    s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    s.frame = frame;
+    glFlush();
+
+    next_ = (next_ + 1) % slots_.size();
+    ++in_flight_;
+}
+
+void async_readback::poll()
+{
+    while (in_flight_ > 0 && deliver_oldest(false));
+}
+
+void async_readback::finish()
+{
+    while (in_flight_ > 0)
+        deliver_oldest(true);
+}
+
+bool async_readback::deliver_oldest(bool wait)
+{
+    auto & s = slots_[(next_ + slots_.size() - in_flight_) % slots_.size()];
+
+    while (true)
+    {
+        GLenum const result = glClientWaitSync(s.fence, 0, wait ? 1000000000 : 0);
+        if (result == GL_WAIT_FAILED)
+            throw std::runtime_error("glClientWaitSync failed on a readback fence");
+        if (result != GL_TIMEOUT_EXPIRED)
+            break;
+        if (!wait)
+            return false;
+    }
+
+    glDeleteSync(s.fence);
+    s.fence = nullptr;
+    --in_flight_;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+    auto const pixels = static_cast<std::uint8_t const *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, std::size_t(width_) * height_ * 4, GL_MAP_READ_BIT));
+    if (!pixels)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        throw std::runtime_error("Failed to map a readback buffer");
+    }
+
+    try
+    {
+        on_frame_(s.frame, pixels, width_, height_);
+    }
+    catch (...)
+    {
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        throw;
+    }
+
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return true;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+// Reads RGBA8 frames back through a ring of pixel buffer objects. glReadPixels into a PBO
+// only queues the copy, and a fence tells when it is done, so the pixels are mapped a frame
+// or two later instead of stalling the pipeline on the frame just drawn. Rows are bottom up,
+// as GL reads them.
+struct async_readback
+{
+    // Gets the number read() was given with the frame, and the frame's pixels, which are only
+    // valid during the call
+    using frame_callback = std::function<void(std::uint64_t frame, std::uint8_t const * pixels, int width, int height)>;
+
+    async_readback(int width, int height, frame_callback on_frame, std::size_t buffer_count = 3);
+    ~async_readback();
+
+    async_readback(async_readback const &) = delete;
+    async_readback & operator = (async_readback const &) = delete;
+
+    // Starts reading color attachment 0 of framebuffer. When every buffer is still in use
+    // this first waits for the oldest and hands it over.
+    void read(GLuint framebuffer, std::uint64_t frame);
+
+    // Hands over the reads that are done, oldest first, without waiting
+    void poll();
+
+    // Waits for and hands over every read in flight
+    void finish();
+
+    // Reads that are queued and not handed over yet
+    std::size_t in_flight() const { return in_flight_; }
+
+private:
+    struct slot
+    {
+        GLuint buffer = 0;
+        GLsync fence = nullptr;
+        std::uint64_t frame = 0;
+    };
+
+    // Returns false if the oldest read is not done and wait is false
+    bool deliver_oldest(bool wait);
+
+    int width_;
+    int height_;
+    frame_callback on_frame_;
+
+    std::vector<slot> slots_;
+    std::size_t next_ = 0;
+    std::size_t in_flight_ = 0;
+};
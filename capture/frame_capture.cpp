@@ -0,0 +1,108 @@
+#include "frame_capture.hpp"
+
+frame_capture::frame_capture(int width, int height)
+    : width_(width)
+    , height_(height)
+{}
+
+void frame_capture::screenshot(std::filesystem::path directory)
+{
+    screenshot_directory_ = std::move(directory);
+}
+
+void frame_capture::start_recording(frame_encoder::settings const & settings)
+{
+    stop_recording();
+    recording_.emplace(settings, width_, height_);
+    recorded_ = 0;
+}
+
+frame_capture::recording_summary frame_capture::stop_recording()
+{
+    if (!recording_)
+        return {};
+
+    if (readback_)
+        readback_->finish();
+
+    recording_summary const summary{recorded_, recording_->dropped()};
+    // Drains the encoder's queue, so every frame it took is written
+    recording_.reset();
+    return summary;
+}
+
+void frame_capture::capture(GLuint framebuffer)
+{
+    if (readback_)
+        readback_->poll();
+
+    bool const screenshot = screenshot_directory_ && !screenshot_frame_;
+    if (!screenshot && !recording_)
+        return;
+
+    if (!copy_)
+    {
+        copy_.emplace(width_, height_);
+        readback_.emplace(width_, height_, [this](std::uint64_t frame, std::uint8_t const * pixels, int, int)
+        {
+            deliver(frame, pixels);
+        });
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, copy_->read_framebuffer());
+    glBlitFramebuffer(0, 0, width_, height_, 0, 0, width_, height_, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    if (screenshot)
+        screenshot_frame_ = frame_;
+    readback_->read(copy_->read_framebuffer(), frame_++);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+void frame_capture::resize(int width, int height)
+{
+    if (width == width_ && height == height_)
+        return;
+
+    if (readback_)
+        readback_->finish();
+    stop_recording();
+
+    readback_.reset();
+    copy_.reset();
+    screenshots_.reset();
+
+    width_ = width;
+    height_ = height;
+}
+
+void frame_capture::finish()
+{
+    if (readback_)
+        readback_->finish();
+    stop_recording();
+}
+
+void frame_capture::deliver(std::uint64_t frame, std::uint8_t const * pixels)
+{
+    if (recording_ && recording_->push(frame, pixels))
+        ++recorded_;
+
+    if (screenshot_frame_ == frame)
+    {
+        if (!screenshots_ || screenshots_output_ != *screenshot_directory_)
+        {
+            screenshots_.reset();
+            screenshots_output_ = *screenshot_directory_;
+            frame_encoder::settings settings;
+            settings.format = capture_format::png;
+            settings.output = *screenshot_directory_;
+            settings.wait_when_full = true;
+            screenshots_.emplace(settings, width_, height_);
+        }
+        screenshots_->push(frame, pixels);
+        screenshot_frame_.reset();
+        screenshot_directory_.reset();
+    }
+}
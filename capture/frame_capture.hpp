@@ -0,0 +1,63 @@
+#pragma once
+
+#include "offscreen_target.hpp"
+#include "async_readback.hpp"
+#include "frame_encoder.hpp"
+
+#include <optional>
+
+// Screenshots and recordings of what is drawn into a framebuffer, usually the window's.
+// A captured frame is blitted into a single-sample copy, which also resolves a multisampled
+// back buffer, read back asynchronously and handed to an encoder thread, so capturing costs
+// the frame a blit and a queued copy. Nothing is allocated until the first capture.
+struct frame_capture
+{
+    struct recording_summary
+    {
+        std::size_t frames = 0;
+        std::size_t dropped = 0;
+    };
+
+    frame_capture(int width, int height);
+
+    frame_capture(frame_capture const &) = delete;
+    frame_capture & operator = (frame_capture const &) = delete;
+
+    // Saves the next captured frame as a png in directory
+    void screenshot(std::filesystem::path directory);
+
+    // Every captured frame goes to the encoder until stop_recording(); frames the encoder
+    // has no room for are dropped rather than waited for
+    void start_recording(frame_encoder::settings const & settings);
+    recording_summary stop_recording();
+    bool recording() const { return recording_.has_value(); }
+
+    // Call after drawing a frame and before swapping; a no-op unless something is being
+    // captured. Leaves framebuffer bound.
+    void capture(GLuint framebuffer = 0);
+
+    // The framebuffer changed size; stops a recording, as its size is fixed
+    void resize(int width, int height);
+
+    // Hands every read in flight to the encoders and stops a recording; call while the GL
+    // context is still current, before the capture goes away
+    void finish();
+
+private:
+    void deliver(std::uint64_t frame, std::uint8_t const * pixels);
+
+    int width_;
+    int height_;
+
+    std::optional<std::filesystem::path> screenshot_directory_;
+    std::optional<std::uint64_t> screenshot_frame_;
+    std::uint64_t frame_ = 0;
+    std::size_t recorded_ = 0;
+    std::filesystem::path screenshots_output_;
+
+    // The encoders are declared before the readback, which feeds them, so that they outlive it
+    std::optional<frame_encoder> screenshots_;
+    std::optional<frame_encoder> recording_;
+    std::optional<offscreen_target> copy_;
+    std::optional<async_readback> readback_;
+};
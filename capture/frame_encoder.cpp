@@ -0,0 +1,261 @@
+#include "frame_encoder.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <array>
+#include <algorithm>
+#include <utility>
+
+#ifdef WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+namespace
+{
+
+    std::array<std::uint32_t, 256> make_crc_table()
+    {
+        std::array<std::uint32_t, 256> table;
+        for (std::uint32_t n = 0; n < 256; ++n)
+        {
+            std::uint32_t c = n;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return table;
+    }
+
+    std::uint32_t crc32(std::uint8_t const * data, std::size_t size, std::uint32_t crc = 0)
+    {
+        static auto const table = make_crc_table();
+        crc = ~crc;
+        for (std::size_t i = 0; i < size; ++i)
+            crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    void put_u32(std::vector<std::uint8_t> & out, std::uint32_t value)
+    {
+        out.insert(out.end(), {std::uint8_t(value >> 24), std::uint8_t(value >> 16), std::uint8_t(value >> 8), std::uint8_t(value)});
+    }
+
+    void put_chunk(std::vector<std::uint8_t> & out, char const (&type)[5], std::vector<std::uint8_t> const & data)
+    {
+        put_u32(out, data.size());
+        std::size_t const type_offset = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data.begin(), data.end());
+        put_u32(out, crc32(out.data() + type_offset, data.size() + 4));
+    }
+
+    // 8-bit RGBA, top-down rows, no filtering and stored deflate blocks
+    std::vector<std::uint8_t> encode_png(std::uint8_t const * pixels, int width, int height)
+    {
+        std::size_t const row_size = std::size_t(width) * 4;
+
+        std::vector<std::uint8_t> scanlines;
+        scanlines.reserve((row_size + 1) * height);
+        for (int y = 0; y < height; ++y)
+        {
+            scanlines.push_back(0);
+            scanlines.insert(scanlines.end(), pixels + y * row_size, pixels + (y + 1) * row_size);
+        }
+
+        std::vector<std::uint8_t> zlib = {0x78, 0x01};
+        zlib.reserve(scanlines.size() + scanlines.size() / 65535 * 5 + 16);
+        for (std::size_t offset = 0; offset < scanlines.size() || offset == 0;)
+        {
+            std::size_t const size = std::min<std::size_t>(scanlines.size() - offset, 65535);
+            bool const last = offset + size == scanlines.size();
+            zlib.insert(zlib.end(), {std::uint8_t(last ? 1 : 0), std::uint8_t(size), std::uint8_t(size >> 8), std::uint8_t(~size), std::uint8_t(~size >> 8)});
+            zlib.insert(zlib.end(), scanlines.begin() + offset, scanlines.begin() + offset + size);
+            offset += size;
+            if (last)
+                break;
+        }
+
+        std::uint32_t a = 1, b = 0;
+        for (std::uint8_t byte : scanlines)
+        {
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+        put_u32(zlib, (b << 16) | a);
+
+        std::vector<std::uint8_t> header;
+        put_u32(header, width);
+        put_u32(header, height);
+        header.insert(header.end(), {8, 6, 0, 0, 0});
+
+        std::vector<std::uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        put_chunk(png, "IHDR", header);
+        put_chunk(png, "IDAT", zlib);
+        put_chunk(png, "IEND", {});
+        return png;
+    }
+
+}
+
+frame_encoder::frame_encoder(settings const & settings, int width, int height)
+    : settings_(settings)
+    , width_(width)
+    , height_(height)
+{
+    switch (settings_.format)
+    {
+    case capture_format::png:
+        std::filesystem::create_directories(settings_.output);
+        break;
+    case capture_format::raw:
+        file_ = std::fopen(settings_.output.string().c_str(), "wb");
+        if (!file_)
+            throw std::runtime_error("Failed to open " + settings_.output.string());
+        break;
+    case capture_format::ffmpeg:
+        {
+            // Odd sizes are padded, as yuv420p needs even ones
+            std::ostringstream command;
+            command << "ffmpeg -loglevel error -y -f rawvideo -pix_fmt rgba -s " << width << "x" << height
+                << " -r " << settings_.frame_rate << " -i - -vf \"pad=ceil(iw/2)*2:ceil(ih/2)*2\" -pix_fmt yuv420p \""
+                << settings_.output.string() << "\"";
+#ifdef WIN32
+            file_ = popen(command.str().c_str(), "wb");
+#else
+            file_ = popen(command.str().c_str(), "w");
+#endif
+            if (!file_)
+                throw std::runtime_error("Failed to start ffmpeg");
+        }
+        break;
+    }
+
+    worker_ = std::thread([this]{ worker_loop(); });
+}
+
+frame_encoder::~frame_encoder()
+{
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    frame_ready_.notify_one();
+    worker_.join();
+
+    if (file_)
+    {
+        if (settings_.format == capture_format::ffmpeg)
+            pclose(file_);
+        else
+            std::fclose(file_);
+    }
+}
+
+bool frame_encoder::push(std::uint64_t frame, std::uint8_t const * pixels)
+{
+    std::vector<std::uint8_t> buffer;
+    {
+        std::unique_lock lock(mutex_);
+        if (error_)
+            std::rethrow_exception(std::exchange(error_, nullptr));
+
+        if (queue_.size() >= settings_.max_queued)
+        {
+            if (!settings_.wait_when_full)
+            {
+                ++dropped_;
+                return false;
+            }
+            frame_taken_.wait(lock, [this]{ return queue_.size() < settings_.max_queued; });
+        }
+
+        if (!free_buffers_.empty())
+        {
+            buffer = std::move(free_buffers_.back());
+            free_buffers_.pop_back();
+        }
+    }
+
+    buffer.assign(pixels, pixels + std::size_t(width_) * height_ * 4);
+
+    {
+        std::lock_guard lock(mutex_);
+        queue_.push_back({frame, std::move(buffer)});
+    }
+    frame_ready_.notify_one();
+    return true;
+}
+
+std::size_t frame_encoder::written() const
+{
+    std::lock_guard lock(mutex_);
+    return written_;
+}
+
+std::size_t frame_encoder::dropped() const
+{
+    std::lock_guard lock(mutex_);
+    return dropped_;
+}
+
+void frame_encoder::worker_loop()
+{
+    while (true)
+    {
+        queued_frame f;
+        {
+            std::unique_lock lock(mutex_);
+            frame_ready_.wait(lock, [this]{ return stop_ || !queue_.empty(); });
+            if (queue_.empty())
+                return;
+            f = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        frame_taken_.notify_one();
+
+        bool failed = false;
+        try
+        {
+            encode(f);
+        }
+        catch (...)
+        {
+            std::lock_guard lock(mutex_);
+            if (!error_)
+                error_ = std::current_exception();
+            failed = true;
+        }
+
+        std::lock_guard lock(mutex_);
+        if (!failed)
+            ++written_;
+        free_buffers_.push_back(std::move(f.pixels));
+    }
+}
+
+void frame_encoder::encode(queued_frame const & f)
+{
+    std::size_t const row_size = std::size_t(width_) * 4;
+    flipped_.resize(row_size * height_);
+    for (int y = 0; y < height_; ++y)
+        std::memcpy(flipped_.data() + y * row_size, f.pixels.data() + (height_ - 1 - y) * row_size, row_size);
+
+    if (settings_.format == capture_format::png)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "frame_%05d.png", int(f.frame));
+        auto const path = settings_.output / name;
+
+        auto const png = encode_png(flipped_.data(), width_, height_);
+        std::ofstream output(path, std::ios::binary);
+        if (!output.write(reinterpret_cast<char const *>(png.data()), png.size()))
+            throw std::runtime_error("Failed to write " + path.string());
+        return;
+    }
+
+    if (std::fwrite(flipped_.data(), 1, flipped_.size(), file_) != flipped_.size())
+        throw std::runtime_error(settings_.format == capture_format::ffmpeg ? "Failed to pipe a frame to ffmpeg" : "Failed to write " + settings_.output.string());
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <cstdio>
+#include <cstdint>
+
+enum class capture_format
+{
+    // One file per frame in the output directory; the deflate stream is stored, not
+    // compressed, which keeps encoding cheap and the files large
+    png,
+    // Every frame appended to the output file as top-down RGBA8 rows
+    raw,
+    // Frames piped as raw video to an ffmpeg process that writes the output file
+    ffmpeg,
+};
+
+// Writes RGBA8 frames on a thread of its own, so that encoding and disk writes never hold
+// up the GL thread. Frames are copied in with the bottom-up rows GL reads and flipped on
+// the encoder thread. Buffers are reused, so a steady recording allocates nothing.
+struct frame_encoder
+{
+    struct settings
+    {
+        capture_format format = capture_format::png;
+        // A directory for png, a file for raw and ffmpeg
+        std::filesystem::path output;
+        float frame_rate = 60.f;
+        // Frames waiting for the encoder beyond which push() drops frames, or waits when
+        // wait_when_full is set
+        std::size_t max_queued = 8;
+        bool wait_when_full = false;
+    };
+
+    frame_encoder(settings const & settings, int width, int height);
+    // Writes every queued frame first
+    ~frame_encoder();
+
+    frame_encoder(frame_encoder const &) = delete;
+    frame_encoder & operator = (frame_encoder const &) = delete;
+
+    // Queues a copy of the frame; false if it was dropped. Rethrows what the encoder threw.
+    bool push(std::uint64_t frame, std::uint8_t const * pixels);
+
+    std::size_t written() const;
+    std::size_t dropped() const;
+
+private:
+    struct queued_frame
+    {
+        std::uint64_t frame;
+        std::vector<std::uint8_t> pixels;
+    };
+
+    void worker_loop();
+    void encode(queued_frame const & f);
+
+    settings settings_;
+    int width_;
+    int height_;
+    std::FILE * file_ = nullptr;
+    // Top-down rows of the frame being encoded, touched by the worker only
+    std::vector<std::uint8_t> flipped_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable frame_ready_;
+    std::condition_variable frame_taken_;
+    std::deque<queued_frame> queue_;
+    std::vector<std::vector<std::uint8_t>> free_buffers_;
+    std::size_t written_ = 0;
+    std::size_t dropped_ = 0;
+    std::exception_ptr error_;
+    bool stop_ = false;
+
+    std::thread worker_;
+};
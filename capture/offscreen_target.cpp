@@ -0,0 +1,81 @@
+#include "offscreen_target.hpp"
+
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+
+    GLuint create_renderbuffer(GLenum format, int width, int height, int samples)
+    {
+        GLuint renderbuffer;
+        glGenRenderbuffers(1, &renderbuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+        if (samples > 1)
+            glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, format, width, height);
+        else
+            glRenderbufferStorage(GL_RENDERBUFFER, format, width, height);
+        return renderbuffer;
+    }
+
+    void check_framebuffer(GLenum target)
+    {
+        if (GLenum status = glCheckFramebufferStatus(target); status != GL_FRAMEBUFFER_COMPLETE)
+            throw std::runtime_error("Offscreen framebuffer is incomplete: " + std::to_string(status));
+    }
+
+}
+
+offscreen_target::offscreen_target(int width, int height, int samples)
+    : width_(width)
+    , height_(height)
+{
+    color_ = create_renderbuffer(GL_RGBA8, width, height, samples);
+    depth_ = create_renderbuffer(GL_DEPTH_COMPONENT24, width, height, samples);
+
+    glGenFramebuffers(1, &framebuffer_);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_);
+    check_framebuffer(GL_FRAMEBUFFER);
+
+    if (samples > 1)
+    {
+        resolve_color_ = create_renderbuffer(GL_RGBA8, width, height, 1);
+
+        glGenFramebuffers(1, &resolve_framebuffer_);
+        glBindFramebuffer(GL_FRAMEBUFFER, resolve_framebuffer_);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, resolve_color_);
+        check_framebuffer(GL_FRAMEBUFFER);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+}
+
+offscreen_target::~offscreen_target()
+{
+    GLuint const framebuffers[] = {framebuffer_, resolve_framebuffer_};
+    glDeleteFramebuffers(2, framebuffers);
+    GLuint const renderbuffers[] = {color_, depth_, resolve_color_};
+    glDeleteRenderbuffers(3, renderbuffers);
+}
+
+void offscreen_target::bind() const
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+    glViewport(0, 0, width_, height_);
+}
+
+void offscreen_target::resolve() const
+{
+    if (resolve_framebuffer_)
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer_);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolve_framebuffer_);
+        glBlitFramebuffer(0, 0, width_, height_, 0, 0, width_, height_, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, read_framebuffer());
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <GL/glew.h>
+
+// A framebuffer to render into without a window, of a fixed size: RGBA8 color and 24-bit
+// depth renderbuffers, multisampled when samples > 1 and then resolved into a single-sample
+// color renderbuffer for reading. Throws if the framebuffer is incomplete.
+struct offscreen_target
+{
+    offscreen_target(int width, int height, int samples = 1);
+    ~offscreen_target();
+
+    offscreen_target(offscreen_target const &) = delete;
+    offscreen_target & operator = (offscreen_target const &) = delete;
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    // Binds the framebuffer to draw into and sets the viewport to it
+    void bind() const;
+
+    // Where the finished image is read from after resolve()
+    GLuint read_framebuffer() const { return resolve_framebuffer_ ? resolve_framebuffer_ : framebuffer_; }
+
+    // Blits the samples into the single-sample color buffer; nothing to do when there is
+    // only one sample. Leaves read_framebuffer() bound for reading.
+    void resolve() const;
+
+private:
+    int width_;
+    int height_;
+
+    GLuint framebuffer_ = 0;
+    GLuint color_ = 0;
+    GLuint depth_ = 0;
+
+    GLuint resolve_framebuffer_ = 0;
+    GLuint resolve_color_ = 0;
+};
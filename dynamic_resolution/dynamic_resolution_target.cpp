@@ -0,0 +1,281 @@
+#include "dynamic_resolution_target.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+
+    const char fullscreen_vertex_shader_source[] =
+R"(#version 330 core
+
+void main()
+{
+    vec2 position = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 4.0 - 1.0;
+    gl_Position = vec4(position, 0.0, 1.0);
+}
+)";
+
+    const char upscale_fragment_shader_source[] =
+R"(#version 330 core
+
+uniform sampler2D source;
+uniform vec2 source_size;
+uniform vec2 scene_size;
+uniform vec2 output_size;
+uniform float sharpness;
+
+layout (location = 0) out vec4 out_color;
+
+// Clamped to the drawn part, so that the filter never reaches what was left from larger frames
+vec3 tap(vec2 position)
+{
+    position = clamp(position, vec2(0.5), scene_size - vec2(0.5));
+    return texture(source, position / source_size).rgb;
+}
+
+void main()
+{
+    // In scene pixels
+    vec2 position = gl_FragCoord.xy / output_size * scene_size;
+
+    vec3 center = tap(position);
+
+    if (sharpness <= 0.0)
+    {
+        out_color = vec4(center, 1.0);
+        return;
+    }
+
+    vec3 north = tap(position + vec2(0.0, 1.0));
+    vec3 south = tap(position - vec2(0.0, 1.0));
+    vec3 east = tap(position + vec2(1.0, 0.0));
+    vec3 west = tap(position - vec2(1.0, 0.0));
+
+    vec3 low = min(center, min(min(north, south), min(east, west)));
+    vec3 high = max(center, max(max(north, south), max(east, west)));
+
+    // Less sharpening the closer the neighbourhood already is to black or to white
+    vec3 amount = sqrt(clamp(min(low, 1.0 - high) / max(high, vec3(1e-4)), 0.0, 1.0));
+    vec3 weight = -amount * mix(1.0 / 8.0, 1.0 / 5.0, sharpness);
+
+    vec3 color = (center + weight * (north + south + east + west)) / (1.0 + 4.0 * weight);
+    out_color = vec4(clamp(color, 0.0, 1.0), 1.0);
+}
+)";
+
+    void check_framebuffer(GLenum target)
+    {
+        if (GLenum status = glCheckFramebufferStatus(target); status != GL_FRAMEBUFFER_COMPLETE)
+            throw std::runtime_error("Dynamic resolution framebuffer is incomplete: " + std::to_string(status));
+    }
+
+    GLuint create_color_texture()
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+
+}
+
+char const * to_string(upscale_filter filter)
+{
+    switch (filter)
+    {
+    case upscale_filter::bilinear: return "bilinear";
+    case upscale_filter::sharpen: return "sharpen";
+    }
+    return "unknown";
+}
+
+dynamic_resolution_target::dynamic_resolution_target(program_cache & programs, int width, int height, int samples, resolution_controller::settings const & settings)
+    : width_(width)
+    , height_(height)
+    , samples_(samples)
+    , controller_(settings)
+{
+    upscale_program_ = programs.get({{GL_VERTEX_SHADER, fullscreen_vertex_shader_source}, {GL_FRAGMENT_SHADER, upscale_fragment_shader_source}});
+
+    glGenVertexArrays(1, &fullscreen_vao_);
+
+    for (auto & t : timings_)
+        glGenQueries(t.queries.size(), t.queries.data());
+
+    glGenFramebuffers(1, &framebuffer_);
+    if (samples_ > 1)
+    {
+        glGenRenderbuffers(1, &color_);
+        glGenFramebuffers(1, &resolve_framebuffer_);
+        resolve_color_ = create_color_texture();
+    }
+    else
+        color_ = create_color_texture();
+    glGenRenderbuffers(1, &depth_);
+
+    allocate();
+}
+
+dynamic_resolution_target::~dynamic_resolution_target()
+{
+    glDeleteRenderbuffers(1, &depth_);
+    if (samples_ > 1)
+    {
+        glDeleteTextures(1, &resolve_color_);
+        glDeleteFramebuffers(1, &resolve_framebuffer_);
+        glDeleteRenderbuffers(1, &color_);
+    }
+    else
+        glDeleteTextures(1, &color_);
+    glDeleteFramebuffers(1, &framebuffer_);
+
+    for (auto & t : timings_)
+        glDeleteQueries(t.queries.size(), t.queries.data());
+
+    glDeleteVertexArrays(1, &fullscreen_vao_);
+}
+
+void dynamic_resolution_target::resize(int width, int height)
+{
+    width_ = width;
+    height_ = height;
+    allocate();
+}
+
+void dynamic_resolution_target::allocate()
+{
+    float const max_scale = controller_.current_settings().max_scale;
+    target_width_ = std::max(1, int(std::ceil(width_ * max_scale)));
+    target_height_ = std::max(1, int(std::ceil(height_ * max_scale)));
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_);
+    if (samples_ > 1)
+    {
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples_, GL_DEPTH_COMPONENT24, target_width_, target_height_);
+
+        glBindRenderbuffer(GL_RENDERBUFFER, color_);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples_, GL_RGBA8, target_width_, target_height_);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_);
+    }
+    else
+    {
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, target_width_, target_height_);
+
+        glBindTexture(GL_TEXTURE_2D, color_);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, target_width_, target_height_, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color_, 0);
+    }
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_);
+    check_framebuffer(GL_FRAMEBUFFER);
+
+    if (samples_ > 1)
+    {
+        glBindTexture(GL_TEXTURE_2D, resolve_color_);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, target_width_, target_height_, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, resolve_framebuffer_);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, resolve_color_, 0);
+        check_framebuffer(GL_FRAMEBUFFER);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+}
+
+void dynamic_resolution_target::collect_timings()
+{
+    // Oldest first, stopping at the first one the GPU is not done with
+    for (std::size_t i = 0; i < timings_.size(); ++i)
+    {
+        auto & t = timings_[(next_timing_ + i) % timings_.size()];
+        if (!t.pending)
+            continue;
+
+        GLint available = 0;
+        glGetQueryObjectiv(t.queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        GLuint64 begin, end;
+        glGetQueryObjectui64v(t.queries[0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(t.queries[1], GL_QUERY_RESULT, &end);
+        t.pending = false;
+
+        controller_.update((end - begin) * 1e-6f, t.scale);
+    }
+}
+
+void dynamic_resolution_target::begin_scene()
+{
+    collect_timings();
+
+    float const scale = controller_.scale();
+    scene_width_ = std::clamp(int(std::round(width_ * scale)), 1, target_width_);
+    scene_height_ = std::clamp(int(std::round(height_ * scale)), 1, target_height_);
+
+    bind_scene();
+
+    // With every timing still in flight this frame goes unmeasured rather than waiting
+    auto & t = timings_[next_timing_];
+    timing_ = !t.pending;
+    if (timing_)
+    {
+        t.scale = scale;
+        glQueryCounter(t.queries[0], GL_TIMESTAMP);
+    }
+}
+
+void dynamic_resolution_target::bind_scene() const
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+    glViewport(0, 0, scene_width_, scene_height_);
+}
+
+void dynamic_resolution_target::present(upscale_filter filter, float sharpness)
+{
+    GLuint source = color_;
+    if (samples_ > 1)
+    {
+        // A multisample resolve cannot scale, so it copies the drawn part as it is
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer_);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolve_framebuffer_);
+        glBlitFramebuffer(0, 0, scene_width_, scene_height_, 0, 0, scene_width_, scene_height_, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        source = resolve_color_;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, width_, height_);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glDisable(GL_CULL_FACE);
+
+    glUseProgram(upscale_program_);
+    glUniform1i(glGetUniformLocation(upscale_program_, "source"), 0);
+    glUniform2f(glGetUniformLocation(upscale_program_, "source_size"), target_width_, target_height_);
+    glUniform2f(glGetUniformLocation(upscale_program_, "scene_size"), scene_width_, scene_height_);
+    glUniform2f(glGetUniformLocation(upscale_program_, "output_size"), width_, height_);
+    glUniform1f(glGetUniformLocation(upscale_program_, "sharpness"), filter == upscale_filter::sharpen ? std::clamp(sharpness, 0.01f, 1.f) : 0.f);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, source);
+
+    glBindVertexArray(fullscreen_vao_);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    if (timing_)
+    {
+        auto & t = timings_[next_timing_];
+        glQueryCounter(t.queries[1], GL_TIMESTAMP);
+        t.pending = true;
+        next_timing_ = (next_timing_ + 1) % timings_.size();
+    }
+}
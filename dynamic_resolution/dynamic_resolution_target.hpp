@@ -0,0 +1,93 @@
+#pragma once
+
+#include "resolution_controller.hpp"
+#include "program_cache.hpp"
+
+#include <GL/glew.h>
+
+#include <array>
+
+enum class upscale_filter
+{
+    bilinear,
+    // Bilinear followed by a contrast-adaptive sharpen: each pixel is pushed away from its
+    // four neighbours by less where they already span much of the range, so that edges get
+    // back some of the crispness lost to the upscale without ringing
+    sharpen,
+};
+
+char const * to_string(upscale_filter filter);
+
+// A scene target allocated at the window size times the controller's max_scale, of which
+// only the bottom-left scale() fraction is drawn into each frame. The GPU time from
+// begin_scene() to the end of present() is measured with timestamp queries, read back a few
+// frames later so that nothing waits for them, and fed to the controller, which picks the
+// scale of the frames after. Throws if the framebuffer is incomplete.
+struct dynamic_resolution_target
+{
+    // The upscale program is owned by the cache
+    dynamic_resolution_target(program_cache & programs, int width, int height, int samples, resolution_controller::settings const & settings);
+    ~dynamic_resolution_target();
+
+    dynamic_resolution_target(dynamic_resolution_target const &) = delete;
+    dynamic_resolution_target & operator = (dynamic_resolution_target const &) = delete;
+
+    // The window size
+    void resize(int width, int height);
+
+    resolution_controller & controller() { return controller_; }
+    resolution_controller const & controller() const { return controller_; }
+
+    // Binds the target and sets the viewport to the part of it drawn this frame; clears are
+    // up to the caller. Starts the frame's timing.
+    void begin_scene();
+
+    // Binds the target and the viewport again, after passes that drew elsewhere
+    void bind_scene() const;
+
+    // The size of the part drawn into, fixed from begin_scene() to present()
+    int scene_width() const { return scene_width_; }
+    int scene_height() const { return scene_height_; }
+
+    // Resolves the samples and upscales the scene into the default framebuffer, changing the
+    // viewport, depth, blend and cull state; sharpness from 0 to 1 only matters for sharpen
+    void present(upscale_filter filter, float sharpness = 0.5f);
+
+private:
+    void allocate();
+    void collect_timings();
+
+    int width_;
+    int height_;
+    int samples_;
+    int target_width_ = 0;
+    int target_height_ = 0;
+    int scene_width_ = 0;
+    int scene_height_ = 0;
+
+    resolution_controller controller_;
+
+    GLuint framebuffer_ = 0;
+    // A texture when there is a single sample, a multisampled renderbuffer otherwise
+    GLuint color_ = 0;
+    GLuint depth_ = 0;
+
+    // What the samples are resolved into, unused with a single sample
+    GLuint resolve_framebuffer_ = 0;
+    GLuint resolve_color_ = 0;
+
+    struct timing
+    {
+        std::array<GLuint, 2> queries{};
+        float scale = 1.f;
+        bool pending = false;
+    };
+
+    std::array<timing, 4> timings_;
+    std::size_t next_timing_ = 0;
+    // Whether this frame got a free timing to start
+    bool timing_ = false;
+
+    GLuint upscale_program_ = 0;
+    GLuint fullscreen_vao_ = 0;
+};
@@ -0,0 +1,45 @@
+#include "resolution_controller.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+    constexpr float fall_rate = 0.5f;
+    constexpr float rise_rate = 0.05f;
+
+}
+
+resolution_controller::resolution_controller(settings const & settings)
+    : settings_(settings)
+    , target_scale_(settings.max_scale)
+    , scale_(settings.max_scale)
+{}
+
+void resolution_controller::set_enabled(bool enabled)
+{
+    enabled_ = enabled;
+    // Picks up from full resolution, rather than from whatever it left off at
+    target_scale_ = scale_ = settings_.max_scale;
+}
+
+void resolution_controller::update(float gpu_ms, float scale)
+{
+    last_gpu_ms_ = gpu_ms;
+
+    if (!enabled_ || gpu_ms <= 0.f)
+        return;
+
+    bool const over = gpu_ms > settings_.budget_ms;
+    bool const under = gpu_ms < settings_.budget_ms * (1.f - settings_.headroom);
+    if (!over && !under)
+        return;
+
+    float const wanted = std::clamp(scale * std::sqrt(settings_.budget_ms / gpu_ms), settings_.min_scale, settings_.max_scale);
+    target_scale_ += (wanted - target_scale_) * (over ? fall_rate : rise_rate);
+
+    // Rounded down when over the budget, so that even a small overrun gives up a step
+    float const steps = target_scale_ / settings_.scale_step;
+    scale_ = std::clamp((over ? std::floor(steps) : std::round(steps)) * settings_.scale_step, settings_.min_scale, settings_.max_scale);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+// Picks the fraction of the window resolution to render at from how long the GPU took for
+// frames drawn at a known scale. The cost of a frame is taken to grow with its pixel count,
+// so the scale that would meet the budget is the measured one times sqrt(budget / time).
+// The scale drops quickly when a frame runs over the budget and climbs back slowly once
+// frames fit with room to spare, and it moves in steps, so that a frame time hovering around
+// the budget does not change the resolution every frame.
+struct resolution_controller
+{
+    struct settings
+    {
+        float budget_ms = 14.f;
+        float min_scale = 0.5f;
+        float max_scale = 1.f;
+        float scale_step = 1.f / 16.f;
+        // Frames between budget * (1 - headroom) and the budget leave the scale alone
+        float headroom = 0.1f;
+    };
+
+    explicit resolution_controller(settings const & settings);
+
+    // A disabled controller keeps rendering at max_scale, while still taking measurements
+    void set_enabled(bool enabled);
+    bool enabled() const { return enabled_; }
+
+    // gpu_ms is how long a frame rendered at scale took
+    void update(float gpu_ms, float scale);
+
+    float scale() const { return enabled_ ? scale_ : settings_.max_scale; }
+
+    // Of the last update
+    float last_gpu_ms() const { return last_gpu_ms_; }
+
+    settings const & current_settings() const { return settings_; }
+
+private:
+    settings settings_;
+    bool enabled_ = true;
+
+    // Unquantized, so that the slow climbs add up across steps
+    float target_scale_;
+    float scale_;
+    float last_gpu_ms_ = 0.f;
+};
@@ -0,0 +1,199 @@
+#include "file_watcher.hpp"
+
+#include <stdexcept>
+#include <system_error>
+#include <algorithm>
+#include <cstring>
+
+#if defined(WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace
+{
+
+    std::filesystem::path normalized(std::filesystem::path const & path)
+    {
+        return std::filesystem::absolute(path).lexically_normal();
+    }
+
+}
+
+#if defined(WIN32)
+
+// One outstanding ReadDirectoryChangesW per directory, checked without waiting
+struct file_watcher::directory
+{
+    std::filesystem::path path;
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    OVERLAPPED overlapped{};
+    alignas(DWORD) char buffer[16384];
+
+    bool read()
+    {
+        return ReadDirectoryChangesW(handle, buffer, sizeof(buffer), FALSE,
+            FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME, nullptr, &overlapped, nullptr);
+    }
+
+    ~directory()
+    {
+        CancelIo(handle);
+        CloseHandle(handle);
+        CloseHandle(overlapped.hEvent);
+    }
+};
+
+file_watcher::file_watcher() = default;
+
+file_watcher::~file_watcher() = default;
+
+void file_watcher::watch(std::filesystem::path const & path)
+{
+    auto const file = normalized(path);
+    files_.insert(file);
+
+    auto const parent = file.parent_path();
+    if (std::any_of(directories_.begin(), directories_.end(), [&](auto const & d){ return d->path == parent; }))
+        return;
+
+    auto d = std::make_unique<directory>();
+    d->path = parent;
+    d->handle = CreateFileW(parent.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+    if (d->handle == INVALID_HANDLE_VALUE)
+        throw std::system_error(GetLastError(), std::system_category(), "Failed to watch " + parent.string());
+    d->overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!d->read())
+        throw std::system_error(GetLastError(), std::system_category(), "Failed to watch " + parent.string());
+
+    directories_.push_back(std::move(d));
+}
+
+std::vector<std::filesystem::path> file_watcher::poll()
+{
+    std::set<std::filesystem::path> changed;
+
+    for (auto & d : directories_)
+    {
+        DWORD size;
+        if (!GetOverlappedResult(d->handle, &d->overlapped, &size, FALSE))
+            continue;
+
+        // Zero means the buffer overflowed, so anything in the directory may have changed
+        if (size == 0)
+        {
+            for (auto const & file : files_)
+                if (file.parent_path() == d->path)
+                    changed.insert(file);
+        }
+
+        for (DWORD offset = 0; size != 0;)
+        {
+            auto const * info = reinterpret_cast<FILE_NOTIFY_INFORMATION const *>(d->buffer + offset);
+            auto const file = d->path / std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR));
+            if (files_.contains(file))
+                changed.insert(file);
+
+            if (info->NextEntryOffset == 0)
+                break;
+            offset += info->NextEntryOffset;
+        }
+
+        ResetEvent(d->overlapped.hEvent);
+        d->read();
+    }
+
+    return {changed.begin(), changed.end()};
+}
+
+#elif defined(__linux__)
+
+file_watcher::file_watcher()
+    : fd_(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+{
+    if (fd_ < 0)
+        throw std::system_error(errno, std::generic_category(), "inotify_init1");
+}
+
+file_watcher::~file_watcher()
+{
+    close(fd_);
+}
+
+void file_watcher::watch(std::filesystem::path const & path)
+{
+    auto const file = normalized(path);
+    files_.insert(file);
+
+    // Watching a directory twice gives back the same descriptor
+    auto const parent = file.parent_path();
+    int const wd = inotify_add_watch(fd_, parent.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB);
+    if (wd < 0)
+        throw std::system_error(errno, std::generic_category(), "Failed to watch " + parent.string());
+    directories_[wd] = parent;
+}
+
+std::vector<std::filesystem::path> file_watcher::poll()
+{
+    std::set<std::filesystem::path> changed;
+
+    alignas(inotify_event) char buffer[16384];
+    for (ssize_t size; (size = read(fd_, buffer, sizeof(buffer))) > 0;)
+    {
+        for (ssize_t offset = 0; offset < size;)
+        {
+            inotify_event event;
+            std::memcpy(&event, buffer + offset, sizeof(event));
+
+            auto const d = directories_.find(event.wd);
+            if (d != directories_.end() && event.len > 0)
+            {
+                auto const file = d->second / std::string(buffer + offset + sizeof(event));
+                if (files_.contains(file))
+                    changed.insert(file);
+            }
+
+            offset += sizeof(event) + event.len;
+        }
+    }
+
+    return {changed.begin(), changed.end()};
+}
+
+#else
+
+file_watcher::file_watcher() = default;
+
+file_watcher::~file_watcher() = default;
+
+void file_watcher::watch(std::filesystem::path const & path)
+{
+    auto const file = normalized(path);
+    files_.insert(file);
+
+    std::error_code error;
+    times_[file] = std::filesystem::last_write_time(file, error);
+}
+
+std::vector<std::filesystem::path> file_watcher::poll()
+{
+    std::vector<std::filesystem::path> changed;
+    for (auto & [file, time] : times_)
+    {
+        std::error_code error;
+        auto const current = std::filesystem::last_write_time(file, error);
+        if (error || current == time)
+            continue;
+        time = current;
+        changed.push_back(file);
+    }
+    return changed;
+}
+
+#endif
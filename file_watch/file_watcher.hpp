@@ -0,0 +1,40 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+#include <set>
+#include <map>
+#include <memory>
+
+// Tells which files changed on disk, for reloading them while the program runs. The
+// directories holding the files are watched rather than the files themselves, since many
+// editors save by writing a new file and renaming it over the old one. Uses inotify on
+// Linux and ReadDirectoryChangesW on Windows, and compares modification times elsewhere.
+struct file_watcher
+{
+    file_watcher();
+    ~file_watcher();
+
+    file_watcher(file_watcher const &) = delete;
+    file_watcher & operator = (file_watcher const &) = delete;
+
+    // The file does not have to exist yet, but its directory does
+    void watch(std::filesystem::path const & path);
+
+    // The watched files written since the last call, each once, as absolute paths; never blocks
+    std::vector<std::filesystem::path> poll();
+
+private:
+    std::set<std::filesystem::path> files_;
+
+#if defined(WIN32)
+    struct directory;
+    std::vector<std::unique_ptr<directory>> directories_;
+#elif defined(__linux__)
+    int fd_ = -1;
+    // By watch descriptor
+    std::map<int, std::filesystem::path> directories_;
+#else
+    std::map<std::filesystem::path, std::filesystem::file_time_type> times_;
+#endif
+};
@@ -0,0 +1,309 @@
+#include "frame_graph.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+
+    bool is_depth(GLenum internal_format)
+    {
+        switch (internal_format)
+        {
+        case GL_DEPTH_COMPONENT16:
+        case GL_DEPTH_COMPONENT24:
+        case GL_DEPTH_COMPONENT32:
+        case GL_DEPTH_COMPONENT32F:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    bool is_depth_stencil(GLenum internal_format)
+    {
+        return internal_format == GL_DEPTH24_STENCIL8 || internal_format == GL_DEPTH32F_STENCIL8;
+    }
+
+    std::size_t texel_size(GLenum internal_format)
+    {
+        switch (internal_format)
+        {
+        case GL_R8: return 1;
+        case GL_RG8: case GL_R16: case GL_R16F: case GL_DEPTH_COMPONENT16: return 2;
+        case GL_RGBA16: case GL_RGBA16F: case GL_RG32F: case GL_DEPTH32F_STENCIL8: return 8;
+        case GL_RGBA32F: return 16;
+        default: return 4;
+        }
+    }
+
+}
+
+render_target_pool::render_target_pool(int idle_frames)
+    : idle_frames_(idle_frames)
+{}
+
+render_target_pool::~render_target_pool()
+{
+    clear();
+}
+
+void render_target_pool::clear()
+{
+    for (auto const & [attachments, framebuffer] : framebuffers_)
+        glDeleteFramebuffers(1, &framebuffer);
+    framebuffers_.clear();
+
+    for (auto const & t : textures_)
+        glDeleteTextures(1, &t.name);
+    textures_.clear();
+}
+
+std::size_t render_target_pool::texture_bytes() const
+{
+    std::size_t result = 0;
+    for (auto const & t : textures_)
+        result += std::size_t(t.desc.width) * t.desc.height * texel_size(t.desc.internal_format);
+    return result;
+}
+
+GLuint render_target_pool::acquire(texture_desc const & desc)
+{
+    for (auto & t : textures_)
+    {
+        if (!t.in_use && t.desc == desc)
+        {
+            t.in_use = true;
+            t.last_used = frame_;
+            return t.name;
+        }
+    }
+
+    auto & t = textures_.emplace_back();
+    t.desc = desc;
+    t.last_used = frame_;
+    t.in_use = true;
+
+    glGenTextures(1, &t.name);
+    glBindTexture(GL_TEXTURE_2D, t.name);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // Nothing is uploaded, but the format still has to suit the internal format
+    if (is_depth(desc.internal_format))
+        glTexImage2D(GL_TEXTURE_2D, 0, desc.internal_format, desc.width, desc.height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    else if (is_depth_stencil(desc.internal_format))
+        glTexImage2D(GL_TEXTURE_2D, 0, desc.internal_format, desc.width, desc.height, 0, GL_DEPTH_STENCIL,
+            desc.internal_format == GL_DEPTH24_STENCIL8 ? GL_UNSIGNED_INT_24_8 : GL_FLOAT_32_UNSIGNED_INT_24_8_REV, nullptr);
+    else
+        glTexImage2D(GL_TEXTURE_2D, 0, desc.internal_format, desc.width, desc.height, 0, GL_RGBA, GL_FLOAT, nullptr);
+
+    return t.name;
+}
+
+void render_target_pool::release(GLuint name)
+{
+    for (auto & t : textures_)
+        if (t.name == name)
+            t.in_use = false;
+}
+
+GLuint render_target_pool::framebuffer(std::vector<GLuint> const & attachments)
+{
+    if (auto it = framebuffers_.find(attachments); it != framebuffers_.end())
+        return it->second;
+
+    GLuint result;
+    glGenFramebuffers(1, &result);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, result);
+
+    std::vector<GLenum> draw_buffers;
+    for (GLuint name : attachments)
+    {
+        auto const format = std::find_if(textures_.begin(), textures_.end(), [name](texture const & t){ return t.name == name; })->desc.internal_format;
+        if (is_depth(format))
+            glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, name, 0);
+        else if (is_depth_stencil(format))
+            glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, name, 0);
+        else
+        {
+            GLenum const attachment = GL_COLOR_ATTACHMENT0 + draw_buffers.size();
+            glFramebufferTexture(GL_DRAW_FRAMEBUFFER, attachment, name, 0);
+            draw_buffers.push_back(attachment);
+        }
+    }
+
+    if (draw_buffers.empty())
+        glDrawBuffer(GL_NONE);
+    else
+        glDrawBuffers(draw_buffers.size(), draw_buffers.data());
+
+    if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        throw std::runtime_error("Frame graph framebuffer is incomplete");
+
+    framebuffers_[attachments] = result;
+    return result;
+}
+
+void render_target_pool::end_frame()
+{
+    auto const idle = [this](texture const & t){ return frame_ - t.last_used > std::uint64_t(idle_frames_); };
+
+    for (auto it = framebuffers_.begin(); it != framebuffers_.end();)
+    {
+        bool const stale = std::any_of(it->first.begin(), it->first.end(), [&](GLuint name)
+        {
+            return idle(*std::find_if(textures_.begin(), textures_.end(), [name](texture const & t){ return t.name == name; }));
+        });
+        if (stale)
+        {
+            glDeleteFramebuffers(1, &it->second);
+            it = framebuffers_.erase(it);
+        }
+        else
+            ++it;
+    }
+
+    for (auto const & t : textures_)
+        if (idle(t))
+            glDeleteTextures(1, &t.name);
+    textures_.erase(std::remove_if(textures_.begin(), textures_.end(), idle), textures_.end());
+
+    ++frame_;
+}
+
+frame_graph::frame_graph(render_target_pool & pool, int backbuffer_width, int backbuffer_height)
+    : pool_(pool)
+    , backbuffer_width_(backbuffer_width)
+    , backbuffer_height_(backbuffer_height)
+{
+    resources_.push_back({"backbuffer", {backbuffer_width, backbuffer_height, GL_RGBA8}, 0, true});
+}
+
+frame_graph::resource frame_graph::create_texture(std::string name, texture_desc const & desc)
+{
+    resources_.push_back({std::move(name), desc, 0, false});
+    return resources_.size() - 1;
+}
+
+frame_graph::resource frame_graph::import_texture(std::string name, GLuint texture, texture_desc const & desc)
+{
+    resources_.push_back({std::move(name), desc, texture, true});
+    return resources_.size() - 1;
+}
+
+void frame_graph::add_pass(std::string name, std::initializer_list<resource> reads, std::initializer_list<resource> writes,
+    std::function<void(frame_graph const & graph)> execute)
+{
+    for (resource r : reads)
+        if (r >= resources_.size() || r == backbuffer)
+            throw std::runtime_error("Pass " + name + " reads an unknown resource");
+    for (resource r : writes)
+        if (r >= resources_.size())
+            throw std::runtime_error("Pass " + name + " writes an unknown resource");
+    if (writes.size() > 1 && std::find(writes.begin(), writes.end(), backbuffer) != writes.end())
+        throw std::runtime_error("Pass " + name + " writes the backbuffer along with other targets");
+
+    passes_.push_back({std::move(name), reads, writes, std::move(execute)});
+}
+
+void frame_graph::execute()
+{
+    if (executed_)
+        throw std::runtime_error("Frame graph executed twice");
+    executed_ = true;
+
+    // Backwards from the passes whose results are seen, keeping the writers of whatever a
+    // kept pass reads
+    std::vector<bool> needed(resources_.size(), false);
+    for (std::size_t i = passes_.size(); i-- > 0;)
+    {
+        auto & p = passes_[i];
+        p.kept = std::any_of(p.writes.begin(), p.writes.end(), [&](resource r){ return resources_[r].imported || needed[r]; });
+        if (!p.kept)
+        {
+            ++passes_culled_;
+            continue;
+        }
+        for (resource r : p.reads)
+            needed[r] = true;
+    }
+
+    for (std::size_t i = 0; i < passes_.size(); ++i)
+    {
+        if (!passes_[i].kept)
+            continue;
+        for (auto const * list : {&passes_[i].reads, &passes_[i].writes})
+        {
+            for (resource r : *list)
+            {
+                auto & e = resources_[r];
+                e.first_use = std::min(e.first_use, i);
+                e.last_use = std::max(e.last_use, i);
+            }
+        }
+    }
+
+    std::vector<GLuint> distinct;
+    for (auto const & e : resources_)
+        if (!e.imported && e.first_use != std::size_t(-1))
+            ++transient_count_;
+
+    for (std::size_t i = 0; i < passes_.size(); ++i)
+    {
+        auto const & p = passes_[i];
+        if (!p.kept)
+            continue;
+
+        for (auto & e : resources_)
+        {
+            if (!e.imported && e.first_use == i)
+            {
+                e.texture = pool_.acquire(e.desc);
+                if (std::find(distinct.begin(), distinct.end(), e.texture) == distinct.end())
+                    distinct.push_back(e.texture);
+            }
+        }
+
+        if (p.writes[0] == backbuffer)
+        {
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+            glViewport(0, 0, backbuffer_width_, backbuffer_height_);
+        }
+        else
+        {
+            std::vector<GLuint> attachments;
+            for (resource r : p.writes)
+                attachments.push_back(resources_[r].texture);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, pool_.framebuffer(attachments));
+            auto const & desc = resources_[p.writes[0]].desc;
+            glViewport(0, 0, desc.width, desc.height);
+        }
+
+        p.execute(*this);
+
+        for (auto & e : resources_)
+        {
+            if (!e.imported && e.last_use == i && e.texture != 0)
+            {
+                pool_.release(e.texture);
+                e.texture = 0;
+            }
+        }
+    }
+
+    textures_used_ = distinct.size();
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glViewport(0, 0, backbuffer_width_, backbuffer_height_);
+    pool_.end_frame();
+}
+
+GLuint frame_graph::texture(resource r) const
+{
+    if (r >= resources_.size() || resources_[r].texture == 0)
+        throw std::runtime_error("Frame graph resource is not available to this pass");
+    return resources_[r].texture;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <initializer_list>
+#include <cstdint>
+#include <compare>
+
+// A 2D render target as passes ask for it. Color formats must be normalized or floating
+// point; depth and depth-stencil formats are attached as such.
+struct texture_desc
+{
+    int width = 0;
+    int height = 0;
+    GLenum internal_format = GL_RGBA8;
+
+    auto operator <=> (texture_desc const &) const = default;
+};
+
+// The textures and framebuffers behind frame graphs, kept across frames. Textures of the
+// same description are handed out again every frame, so a steady frame allocates nothing;
+// those no graph asked for in idle_frames frames are deleted, and clear() drops them all,
+// which is what a resize calls for.
+struct render_target_pool
+{
+    explicit render_target_pool(int idle_frames = 60);
+    ~render_target_pool();
+
+    render_target_pool(render_target_pool const &) = delete;
+    render_target_pool & operator = (render_target_pool const &) = delete;
+
+    void clear();
+
+    std::size_t texture_count() const { return textures_.size(); }
+    // Sum of the sizes of the textures' texels, which is what drivers allocate at least
+    std::size_t texture_bytes() const;
+
+private:
+    friend struct frame_graph;
+
+    struct texture
+    {
+        texture_desc desc;
+        GLuint name = 0;
+        std::uint64_t last_used = 0;
+        bool in_use = false;
+    };
+
+    // Nearest filtering and clamping, the way passes read targets texel by texel
+    GLuint acquire(texture_desc const & desc);
+    void release(GLuint name);
+
+    // A complete framebuffer with the textures attached, the color ones as draw buffers in order
+    GLuint framebuffer(std::vector<GLuint> const & attachments);
+
+    // Deletes what has gone unused for too long
+    void end_frame();
+
+    int idle_frames_;
+    std::uint64_t frame_ = 0;
+    std::vector<texture> textures_;
+    std::map<std::vector<GLuint>, GLuint> framebuffers_;
+};
+
+// Passes of one frame, declared with the targets they read and write and run in the order
+// they were added. execute() leaves out every pass nothing visible depends on, where visible
+// is the default framebuffer and imported textures, and gives transient targets pooled
+// textures only from their first use to their last, so that targets whose lifetimes do not
+// overlap share one texture. A pass is run with a framebuffer of the textures it writes
+// bound, and its viewport covering them.
+struct frame_graph
+{
+    using resource = std::uint32_t;
+
+    // The default framebuffer; a pass writing it writes nothing else
+    static constexpr resource backbuffer = 0;
+
+    frame_graph(render_target_pool & pool, int backbuffer_width, int backbuffer_height);
+
+    frame_graph(frame_graph const &) = delete;
+    frame_graph & operator = (frame_graph const &) = delete;
+
+    // Lives within this frame; its contents are undefined until a pass writes it
+    resource create_texture(std::string name, texture_desc const & desc);
+
+    // Owned by the caller, so writing it keeps the pass
+    resource import_texture(std::string name, GLuint texture, texture_desc const & desc);
+
+    void add_pass(std::string name, std::initializer_list<resource> reads, std::initializer_list<resource> writes,
+        std::function<void(frame_graph const & graph)> execute);
+
+    // Culls, allocates and runs the passes; call once
+    void execute();
+
+    // Only from within a pass that reads or writes the resource
+    GLuint texture(resource r) const;
+
+    // After execute()
+    std::size_t passes_culled() const { return passes_culled_; }
+    // Transient targets, and the pooled textures they took
+    std::size_t transient_count() const { return transient_count_; }
+    std::size_t textures_used() const { return textures_used_; }
+
+private:
+    struct resource_entry
+    {
+        std::string name;
+        texture_desc desc;
+        GLuint texture = 0;
+        bool imported = false;
+        // Passes of the first and the last use among those kept
+        std::size_t first_use = -1;
+        std::size_t last_use = 0;
+    };
+
+    struct pass
+    {
+        std::string name;
+        std::vector<resource> reads;
+        std::vector<resource> writes;
+        std::function<void(frame_graph const & graph)> execute;
+        bool kept = false;
+    };
+
+    render_target_pool & pool_;
+    int backbuffer_width_;
+    int backbuffer_height_;
+
+    std::vector<resource_entry> resources_;
+    std::vector<pass> passes_;
+    bool executed_ = false;
+
+    std::size_t passes_culled_ = 0;
+    std::size_t transient_count_ = 0;
+    std::size_t textures_used_ = 0;
+};
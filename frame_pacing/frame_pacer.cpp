@@ -0,0 +1,188 @@
+#include "frame_pacer.hpp"
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <algorithm>
+#include <thread>
+#include <iomanip>
+
+namespace
+{
+
+    // Sleeps overshoot by up to about this much, so the rest of the wait spins
+    constexpr auto spin_time = std::chrono::milliseconds(1);
+
+    bool is_input(Uint32 type)
+    {
+        switch (type)
+        {
+        case SDL_KEYDOWN:
+        case SDL_KEYUP:
+        case SDL_TEXTINPUT:
+        case SDL_MOUSEMOTION:
+        case SDL_MOUSEBUTTONDOWN:
+        case SDL_MOUSEBUTTONUP:
+        case SDL_MOUSEWHEEL:
+        case SDL_CONTROLLERAXISMOTION:
+        case SDL_CONTROLLERBUTTONDOWN:
+        case SDL_CONTROLLERBUTTONUP:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    void print_percentiles(std::ostream & os, std::vector<float> & values)
+    {
+        std::sort(values.begin(), values.end());
+        auto const percentile = [&](float p){ return values[std::min<std::size_t>(values.size() * p, values.size() - 1)]; };
+        os << "p50 " << percentile(0.5f) << " p90 " << percentile(0.9f) << " p99 " << percentile(0.99f) << " max " << values.back();
+    }
+
+}
+
+char const * to_string(present_mode mode)
+{
+    switch (mode)
+    {
+    case present_mode::vsync: return "vsync";
+    case present_mode::adaptive_vsync: return "adaptive vsync";
+    case present_mode::uncapped: return "uncapped";
+    }
+    return "";
+}
+
+frame_pacer::frame_pacer(present_mode mode, float frame_limit)
+    : mode_(mode)
+    , frame_limit_(frame_limit)
+    , next_frame_(clock::now())
+{
+    set_mode(mode);
+    SDL_AddEventWatch(&frame_pacer::watch_event, this);
+}
+
+frame_pacer::~frame_pacer()
+{
+    SDL_DelEventWatch(&frame_pacer::watch_event, this);
+}
+
+void frame_pacer::set_mode(present_mode mode)
+{
+    mode_ = mode;
+
+    int interval = 1;
+    if (mode == present_mode::adaptive_vsync)
+        interval = -1;
+    else if (mode == present_mode::uncapped)
+        interval = 0;
+
+    if (SDL_GL_SetSwapInterval(interval) != 0 && mode == present_mode::adaptive_vsync)
+    {
+        SDL_GL_SetSwapInterval(1);
+        mode_ = present_mode::vsync;
+    }
+
+    next_frame_ = clock::now();
+}
+
+void frame_pacer::next_mode()
+{
+    switch (mode_)
+    {
+    case present_mode::vsync: set_mode(present_mode::adaptive_vsync); break;
+    case present_mode::adaptive_vsync: set_mode(present_mode::uncapped); break;
+    case present_mode::uncapped: set_mode(present_mode::vsync); break;
+    }
+}
+
+void frame_pacer::set_frame_limit(float frame_limit)
+{
+    frame_limit_ = frame_limit;
+    next_frame_ = clock::now();
+}
+
+void frame_pacer::begin_frame()
+{
+    if (mode_ != present_mode::uncapped || frame_limit_ <= 0.f)
+        return;
+
+    auto const period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(1.f / frame_limit_));
+
+    auto now = clock::now();
+    if (now < next_frame_)
+    {
+        if (next_frame_ - now > spin_time)
+            std::this_thread::sleep_for(next_frame_ - now - spin_time);
+        while ((now = clock::now()) < next_frame_)
+            std::this_thread::yield();
+    }
+
+    // Slots follow each other so the rate does not drift, unless a slow frame left us behind
+    next_frame_ += period;
+    if (next_frame_ < now)
+        next_frame_ = now + period;
+}
+
+void frame_pacer::present(SDL_Window * window)
+{
+    SDL_GL_SwapWindow(window);
+    auto const now = clock::now();
+
+    if (last_present_)
+        frame_times_.push_back(std::chrono::duration<float, std::milli>(now - *last_present_).count());
+    last_present_ = now;
+
+    std::lock_guard lock(input_mutex_);
+    if (oldest_input_)
+    {
+        latencies_.push_back(std::chrono::duration<float, std::milli>(now - *oldest_input_).count());
+        oldest_input_.reset();
+    }
+}
+
+void frame_pacer::print_summary(std::ostream & os)
+{
+    os << "Frames (" << to_string(mode_);
+    if (mode_ == present_mode::uncapped && frame_limit_ > 0.f)
+        os << ", limited to " << frame_limit_ << " fps";
+    os << ", ms):";
+
+    os << std::fixed << std::setprecision(2);
+    if (!frame_times_.empty())
+    {
+        os << "  frame time ";
+        print_percentiles(os, frame_times_);
+    }
+
+    std::lock_guard lock(input_mutex_);
+    if (!latencies_.empty())
+    {
+        os << "  input latency ";
+        print_percentiles(os, latencies_);
+    }
+    os << std::defaultfloat << std::endl;
+
+    frame_times_.clear();
+    latencies_.clear();
+}
+
+int frame_pacer::watch_event(void * user_data, SDL_Event * event)
+{
+    if (!is_input(event->type))
+        return 0;
+
+    auto & self = *static_cast<frame_pacer *>(user_data);
+
+    // SDL timestamps are SDL_GetTicks milliseconds; the age of the event moves it onto our clock
+    auto const age = std::chrono::milliseconds(SDL_GetTicks() - event->common.timestamp);
+    auto const time = clock::now() - age;
+
+    std::lock_guard lock(self.input_mutex_);
+    if (!self.oldest_input_ || time < *self.oldest_input_)
+        self.oldest_input_ = time;
+    return 0;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <mutex>
+#include <optional>
+#include <ostream>
+
+struct SDL_Window;
+union SDL_Event;
+
+enum class present_mode
+{
+    // Swap interval 1: SDL_GL_SwapWindow blocks until the next vertical blank
+    vsync,
+    // Swap interval -1: as vsync, but a frame that misses the blank is shown right away and
+    // tears instead of waiting for the next one; vsync where the driver does not support it
+    adaptive_vsync,
+    // Swap interval 0, paced by the frame limit if there is one
+    uncapped,
+};
+
+char const * to_string(present_mode mode);
+
+// Sets the swap interval for a present mode, limits the frame rate in uncapped mode, and
+// measures frame times and input latency. The limiter sleeps at the start of the frame,
+// before input is read, rather than after rendering, so that the wait does not add to the
+// latency of what the frame shows; it sleeps most of the way and spins the last
+// millisecond, as sleeps overshoot by about that much.
+// Input latency is from an input event's SDL timestamp to the first SDL_GL_SwapWindow that
+// returns after SDL queued it. The driver may still hold the frame back after that, so this
+// is a lower bound on what reaches the screen.
+struct frame_pacer
+{
+    // The GL context must be current; frame_limit is in frames per second, 0 for none
+    explicit frame_pacer(present_mode mode = present_mode::vsync, float frame_limit = 0.f);
+    ~frame_pacer();
+
+    frame_pacer(frame_pacer const &) = delete;
+    frame_pacer & operator = (frame_pacer const &) = delete;
+
+    // The mode in use, which is vsync if adaptive vsync was asked for but is not supported
+    present_mode mode() const { return mode_; }
+    void set_mode(present_mode mode);
+    // Cycles vsync, adaptive vsync, uncapped
+    void next_mode();
+
+    float frame_limit() const { return frame_limit_; }
+    void set_frame_limit(float frame_limit);
+
+    // Call before polling events: waits for the frame's slot in uncapped mode with a limit
+    void begin_frame();
+
+    // Swaps and records the frame's time and the latency of the input it handled
+    void present(SDL_Window * window);
+
+    // Percentiles of frame times and input latencies since the previous call
+    void print_summary(std::ostream & os);
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    static int watch_event(void * user_data, SDL_Event * event);
+
+    present_mode mode_;
+    float frame_limit_;
+
+    clock::time_point next_frame_;
+    std::optional<clock::time_point> last_present_;
+
+    // The event watch may run on another thread on some platforms
+    std::mutex input_mutex_;
+    std::optional<clock::time_point> oldest_input_;
+
+    std::vector<float> frame_times_;
+    std::vector<float> latencies_;
+};
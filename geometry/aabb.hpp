@@ -6,8 +6,13 @@
 
 struct aabb
 {
+	// Lets intersect() skip the vertices and the redundant axes
+	static constexpr bool axis_aligned = true;
+
 	aabb(glm::vec3 const & min, glm::vec3 const & max);
 
+	glm::vec3 min;
+	glm::vec3 max;
 	std::array<glm::vec3, 8> vertices;
 	static const std::array<glm::vec3, 3> face_normals;
 	static const std::array<glm::vec3, 3> edge_directions;
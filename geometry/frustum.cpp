@@ -0,0 +1,96 @@
+#include "frustum.hpp"
+
+#include "intersect.hpp"
+
+#include <glm/geometric.hpp>
+
+frustum::frustum(glm::mat4 const & view_projection)
+{
+	glm::mat4 m = glm::inverse(view_projection);
+	for (std::size_t i = 0; i < 8; ++i)
+	{
+		glm::vec4 v;
+		v.x = (i & 1) ? 1.f : -1.f;
+		v.y = (i & 2) ? 1.f : -1.f;
+		v.z = (i & 4) ? 1.f : -1.f;
+		v.w = 1.f;
+
+		v = m * v;
+		v = v / v.w;
+		vertices[i] = glm::vec3(v);
+	}
+
+	auto n = [&](std::size_t i0, std::size_t i1, std::size_t i2) -> glm::vec3
+	{
+		return glm::cross(vertices[i1] - vertices[i0], vertices[i2] - vertices[i0]);
+	};
+
+	face_normals = {
+		n(0, 1, 2),
+		n(4, 0, 2),
+		n(1, 5, 3),
+		n(0, 4, 1),
+		n(2, 3, 6),
+	};
+
+	auto e = [&](std::size_t i0, std::size_t i1) -> glm::vec3
+	{
+		return vertices[i1] - vertices[i0];
+	};
+
+	edge_directions = {
+		e(0, 1),
+		e(0, 2),
+		e(0, 4),
+		e(1, 5),
+		e(2, 6),
+		e(3, 7),
+	};
+
+	auto row = [&](int i)
+	{
+		return glm::vec4(view_projection[0][i], view_projection[1][i], view_projection[2][i], view_projection[3][i]);
+	};
+
+	planes = {
+		row(3) + row(0),
+		row(3) - row(0),
+		row(3) + row(1),
+		row(3) - row(1),
+		row(3) + row(2),
+		row(3) - row(2),
+	};
+
+	for (auto & p : planes)
+		p /= glm::length(glm::vec3(p));
+}
+
+containment frustum::classify(aabb const & box) const
+{
+	containment result = containment::inside;
+	for (auto const & p : planes)
+	{
+		glm::vec3 const n(p);
+		glm::vec3 const positive(n.x >= 0.f ? box.max.x : box.min.x, n.y >= 0.f ? box.max.y : box.min.y, n.z >= 0.f ? box.max.z : box.min.z);
+		glm::vec3 const negative(n.x >= 0.f ? box.min.x : box.max.x, n.y >= 0.f ? box.min.y : box.max.y, n.z >= 0.f ? box.min.z : box.max.z);
+
+		if (glm::dot(n, positive) + p.w < 0.f)
+			return containment::outside;
+		if (glm::dot(n, negative) + p.w < 0.f)
+			result = containment::intersecting;
+	}
+	return result;
+}
+
+bool frustum::intersects(aabb const & box, bool exact) const
+{
+	switch (classify(box))
+	{
+	case containment::outside:
+		return false;
+	case containment::inside:
+		return true;
+	default:
+		return !exact || intersect(*this, box);
+	}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#include "aabb.hpp"
+
+#include <array>
+
+enum class containment
+{
+	outside,
+	intersecting,
+	inside,
+};
+
+struct frustum
+{
+	std::array<glm::vec3, 8> vertices;
+	std::array<glm::vec3, 5> face_normals;
+	std::array<glm::vec3, 6> edge_directions;
+
+	// Normalized (n, d) with dot(n, p) + d >= 0 on the inside, in the order
+	// left, right, bottom, top, near, far; extracted straight from the matrix (Gribb & Hartmann)
+	std::array<glm::vec4, 6> planes;
+
+	frustum(glm::mat4 const & view_projection);
+
+	// Tests the box corners furthest along and against each plane normal. Conservative:
+	// a box outside the frustum near one of its edges may be reported as intersecting.
+	containment classify(aabb const & box) const;
+
+	// The plane test, refined with the exact separating axis test for boxes that straddle
+	// a plane if exact is set
+	bool intersects(aabb const & box, bool exact = false) const;
+};
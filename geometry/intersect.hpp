@@ -0,0 +1,141 @@
+#pragma once
+
+#include <glm/vec3.hpp>
+#include <glm/geometric.hpp>
+#include <glm/vector_relational.hpp>
+#include <glm/common.hpp>
+
+#include <limits>
+#include <utility>
+#include <cmath>
+
+// Bodies that declare axis_aligned are boxes with min and max; their face normals and edge
+// directions are all the coordinate axes
+template <typename Body>
+concept axis_aligned_body = Body::axis_aligned;
+
+// Cross products of parallel edges carry no information
+inline bool degenerate_axis(glm::vec3 const & n)
+{
+	return n == glm::vec3(0.f);
+}
+
+template <typename Body>
+std::pair<float, float> project(Body const & b, glm::vec3 const & n)
+{
+	if constexpr (axis_aligned_body<Body>)
+	{
+		// The corners furthest against and along n follow from the signs of n
+		glm::bvec3 const positive = glm::greaterThanEqual(n, glm::vec3(0.f));
+		return {glm::dot(glm::mix(b.max, b.min, positive), n), glm::dot(glm::mix(b.min, b.max, positive), n)};
+	}
+
+	static constexpr float inf = std::numeric_limits<float>::infinity();
+
+	float min = inf;
+	float max = -inf;
+
+	for (auto const & p : b.vertices)
+	{
+		float v = glm::dot(p, n);
+		min = std::min(min, v);
+		max = std::max(max, v);
+	}
+
+	return {min, max};
+}
+
+template <typename Body1, typename Body2>
+bool intersect_along(Body1 const & b1, Body2 const & b2, glm::vec3 const & n)
+{
+	auto [min1, max1] = project(b1, n);
+	auto [min2, max2] = project(b2, n);
+
+	return (min1 <= max2) && (min2 <= max1);
+}
+
+template <typename Body1, typename Body2>
+bool intersect(Body1 const & b1, Body2 const & b2)
+{
+	// Both normal sets are the coordinate axes, and every edge cross product is one of them
+	// or zero, so the three overlaps decide
+	if constexpr (axis_aligned_body<Body1> && axis_aligned_body<Body2>)
+		return glm::all(glm::lessThanEqual(b1.min, b2.max)) && glm::all(glm::lessThanEqual(b2.min, b1.max));
+
+	for (auto const & n : b1.face_normals)
+	{
+		if (!intersect_along(b1, b2, n))
+			return false;
+	}
+
+	for (auto const & n : b2.face_normals)
+	{
+		if (!intersect_along(b1, b2, n))
+			return false;
+	}
+
+	for (auto const & e1 : b1.edge_directions)
+	{
+		for (auto const & e2 : b2.edge_directions)
+		{
+			glm::vec3 n = glm::cross(e1, e2);
+			if (!degenerate_axis(n) && !intersect_along(b1, b2, n))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+// Index of an axis that separates the bodies, or -1 if they intersect. Axes are numbered
+// b1 face normals first, then b2 face normals, then edge cross products. The hint is
+// tried first, which pays off when the separating axis rarely changes between calls;
+// tests, if given, is increased by the number of projections done. Degenerate axes, and for
+// two axis-aligned boxes every axis past the first three, are skipped without a projection.
+template <typename Body1, typename Body2>
+int separating_axis(Body1 const & b1, Body2 const & b2, int hint = -1, std::size_t * tests = nullptr)
+{
+	std::size_t const n1 = b1.face_normals.size();
+	std::size_t const n2 = b2.face_normals.size();
+	std::size_t const e2 = b2.edge_directions.size();
+	std::size_t const count = n1 + n2 + b1.edge_directions.size() * e2;
+
+	auto axis = [&](std::size_t i) -> glm::vec3
+	{
+		if (i < n1)
+			return b1.face_normals[i];
+		i -= n1;
+		if (i < n2)
+			return b2.face_normals[i];
+		i -= n2;
+		return glm::cross(b1.edge_directions[i / e2], b2.edge_directions[i % e2]);
+	};
+
+	auto separates = [&](std::size_t i)
+	{
+		if constexpr (axis_aligned_body<Body1> && axis_aligned_body<Body2>)
+		{
+			if (i >= n1)
+				return false;
+		}
+
+		glm::vec3 const n = axis(i);
+		if (degenerate_axis(n))
+			return false;
+
+		if (tests)
+			++*tests;
+		return !intersect_along(b1, b2, n);
+	};
+
+	if (hint >= 0 && static_cast<std::size_t>(hint) < count && separates(hint))
+		return hint;
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		if (static_cast<int>(i) != hint && separates(i))
+			return i;
+	}
+
+	return -1;
+}
@@ -0,0 +1,117 @@
+#include "debug_output.hpp"
+
+namespace
+{
+
+    char const * type_name(GLenum type)
+    {
+        switch (type)
+        {
+        case GL_DEBUG_TYPE_ERROR: return "error";
+        case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated";
+        case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "undefined behavior";
+        case GL_DEBUG_TYPE_PORTABILITY: return "portability";
+        case GL_DEBUG_TYPE_PERFORMANCE: return "performance";
+        default: return "other";
+        }
+    }
+
+    char const * severity_name(GLenum severity)
+    {
+        switch (severity)
+        {
+        case GL_DEBUG_SEVERITY_HIGH: return "high";
+        case GL_DEBUG_SEVERITY_MEDIUM: return "medium";
+        case GL_DEBUG_SEVERITY_LOW: return "low";
+        default: return "notification";
+        }
+    }
+
+}
+
+bool debug_output_supported()
+{
+    return GLEW_VERSION_4_3 || GLEW_KHR_debug;
+}
+
+void label_object(GLenum identifier, GLuint name, std::string_view label)
+{
+    if (debug_output_supported())
+        glObjectLabel(identifier, name, label.size(), label.data());
+}
+
+void push_debug_group(std::string_view name)
+{
+    // The id only matters to message filters, which go by groups' names here
+    if (debug_output_supported())
+        glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, name.size(), name.data());
+}
+
+void pop_debug_group()
+{
+    if (debug_output_supported())
+        glPopDebugGroup();
+}
+
+debug_output::debug_output(std::ostream & log, std::size_t per_message_limit)
+    : log_(log)
+    , per_message_limit_(per_message_limit)
+{
+    if (!debug_output_supported())
+        return;
+
+    glEnable(GL_DEBUG_OUTPUT);
+    glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+    glDebugMessageCallback(callback, this);
+
+    // Everything but notifications, which some drivers send for every buffer they place, and
+    // the application's own groups, which would come back as messages too
+    glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, nullptr, GL_FALSE);
+    glDebugMessageControl(GL_DEBUG_SOURCE_APPLICATION, GL_DEBUG_TYPE_PUSH_GROUP, GL_DONT_CARE, 0, nullptr, GL_FALSE);
+    glDebugMessageControl(GL_DEBUG_SOURCE_APPLICATION, GL_DEBUG_TYPE_POP_GROUP, GL_DONT_CARE, 0, nullptr, GL_FALSE);
+    enabled_ = true;
+}
+
+debug_output::~debug_output()
+{
+    if (!enabled_)
+        return;
+
+    glDebugMessageCallback(nullptr, nullptr);
+    glDisable(GL_DEBUG_OUTPUT);
+}
+
+void debug_output::print_summary(std::ostream & os) const
+{
+    if (messages_.empty())
+        return;
+
+    os << "GL debug messages:" << std::endl;
+    for (auto const & [key, e] : messages_)
+        os << "  " << e.count << "x " << type_name(e.type) << ": " << e.message << std::endl;
+}
+
+void GLAPIENTRY debug_output::callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, GLchar const * message, void const * user)
+{
+    // A negative length means the message is null-terminated
+    std::string_view const text = length < 0 ? std::string_view(message) : std::string_view(message, length);
+    static_cast<debug_output *>(const_cast<void *>(user))->receive(source, type, id, severity, text);
+}
+
+void debug_output::receive(GLenum source, GLenum type, GLuint id, GLenum severity, std::string_view message)
+{
+    auto & e = messages_[{source, id}];
+    if (e.count++ == 0)
+    {
+        e.type = type;
+        e.message = std::string(message);
+    }
+
+    if (e.count <= per_message_limit_)
+    {
+        log_ << "GL " << type_name(type) << " (" << severity_name(severity) << "): " << message;
+        if (e.count == per_message_limit_)
+            log_ << " (further ones only counted)";
+        log_ << std::endl;
+    }
+}
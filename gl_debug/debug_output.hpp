@@ -0,0 +1,71 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <map>
+#include <string>
+#include <string_view>
+#include <ostream>
+#include <cstddef>
+
+// KHR_debug, core since GL 4.3; everything here does nothing without it
+bool debug_output_supported();
+
+// Names the object in driver messages and in debuggers like RenderDoc; identifier is GL_BUFFER,
+// GL_TEXTURE, GL_PROGRAM, GL_VERTEX_ARRAY, GL_FRAMEBUFFER and so on. Buffers and vertex arrays
+// have to have been bound once, glGen* alone does not create them.
+void label_object(GLenum identifier, GLuint name, std::string_view label);
+
+// Brackets commands in a named group, as debuggers and driver messages show them
+void push_debug_group(std::string_view name);
+void pop_debug_group();
+
+struct debug_group
+{
+    explicit debug_group(std::string_view name) { push_debug_group(name); }
+    ~debug_group() { pop_debug_group(); }
+
+    debug_group(debug_group const &) = delete;
+    debug_group & operator = (debug_group const &) = delete;
+};
+
+// Receives the driver's debug messages through glDebugMessageCallback: performance warnings,
+// such as a buffer reallocated while the GPU still uses it or an implicit synchronization,
+// and errors, undefined and deprecated behavior. Notifications are left out. Each distinct
+// message is logged the first per_message_limit times and then only counted, so one that
+// comes every frame does not flood the log; print_summary gives the counts. Drivers send
+// most of them only to debug contexts, which SDL gives with SDL_GL_CONTEXT_DEBUG_FLAG set in
+// SDL_GL_CONTEXT_FLAGS. Messages are synchronous, so they arrive on the thread that caused
+// them, within the call.
+struct debug_output
+{
+    // Needs the context current; log must outlive this
+    explicit debug_output(std::ostream & log, std::size_t per_message_limit = 5);
+    ~debug_output();
+
+    debug_output(debug_output const &) = delete;
+    debug_output & operator = (debug_output const &) = delete;
+
+    bool enabled() const { return enabled_; }
+
+    // Distinct messages and how many times each came, since the start
+    void print_summary(std::ostream & os) const;
+
+private:
+    struct entry
+    {
+        GLenum type;
+        std::string message;
+        std::size_t count = 0;
+    };
+
+    static void GLAPIENTRY callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, GLchar const * message, void const * user);
+    void receive(GLenum source, GLenum type, GLuint id, GLenum severity, std::string_view message);
+
+    std::ostream & log_;
+    std::size_t per_message_limit_;
+    bool enabled_ = false;
+
+    // By source and id, which drivers keep the same for a kind of message
+    std::map<std::pair<GLenum, GLuint>, entry> messages_;
+};
@@ -0,0 +1,91 @@
+#include "stream_buffer.hpp"
+#include "debug_output.hpp"
+
+#include <stdexcept>
+#include <cstring>
+
+stream_buffer::stream_buffer(GLenum target, std::size_t frame_size, std::size_t frame_count)
+    : target_(target)
+    , frame_size_(frame_size)
+    , frame_count_(frame_count)
+    , fences_(frame_count, nullptr)
+{
+    glGenBuffers(1, &buffer_);
+    glBindBuffer(target_, buffer_);
+
+    std::size_t const size = frame_size_ * frame_count_;
+    if (GLEW_ARB_buffer_storage)
+    {
+        GLbitfield const flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(target_, size, nullptr, flags);
+        mapped_ = static_cast<char *>(glMapBufferRange(target_, 0, size, flags));
+        if (!mapped_)
+            throw std::runtime_error("Failed to map stream buffer");
+    }
+    else
+        glBufferData(target_, size, nullptr, GL_STREAM_DRAW);
+
+    label_object(GL_BUFFER, buffer_, "stream buffer");
+}
+
+stream_buffer::~stream_buffer()
+{
+    for (auto fence : fences_)
+        if (fence)
+            glDeleteSync(fence);
+
+    if (mapped_)
+    {
+        glBindBuffer(target_, buffer_);
+        glUnmapBuffer(target_);
+    }
+    glDeleteBuffers(1, &buffer_);
+}
+
+void stream_buffer::begin_frame()
+{
+    offset_ = 0;
+
+    auto & fence = fences_[frame_];
+    if (!fence)
+        return;
+
+    // The first wait flushes, so that the fence is guaranteed to signal eventually
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    while (glClientWaitSync(fence, flags, 1000000) == GL_TIMEOUT_EXPIRED)
+        flags = 0;
+
+    glDeleteSync(fence);
+    fence = nullptr;
+}
+
+std::size_t stream_buffer::write(void const * data, std::size_t size, std::size_t alignment)
+{
+    std::size_t const offset = (offset_ + alignment - 1) / alignment * alignment;
+    if (offset + size > frame_size_)
+        throw std::runtime_error("Stream buffer frame region is full");
+    offset_ = offset + size;
+
+    std::size_t const buffer_offset = frame_ * frame_size_ + offset;
+
+    glBindBuffer(target_, buffer_);
+    if (mapped_)
+        std::memcpy(mapped_ + buffer_offset, data, size);
+    else if (size > 0)
+    {
+        // The fence already guarantees the GPU is not reading this range
+        void * pointer = glMapBufferRange(target_, buffer_offset, size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+        if (!pointer)
+            throw std::runtime_error("Failed to map stream buffer");
+        std::memcpy(pointer, data, size);
+        glUnmapBuffer(target_);
+    }
+
+    return buffer_offset;
+}
+
+void stream_buffer::end_frame()
+{
+    fences_[frame_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    frame_ = (frame_ + 1) % frame_count_;
+}
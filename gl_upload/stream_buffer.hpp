@@ -0,0 +1,43 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <vector>
+#include <cstddef>
+
+// A buffer for data that is rewritten every frame, split into frame_count regions used round-robin.
+// A fence marks when the GPU is done with a region, so writes never stall on draws that are still
+// in flight and the storage is allocated once. With ARB_buffer_storage the buffer stays
+// persistently mapped; otherwise each write maps its range unsynchronized.
+struct stream_buffer
+{
+    stream_buffer(GLenum target, std::size_t frame_size, std::size_t frame_count = 3);
+    ~stream_buffer();
+
+    stream_buffer(stream_buffer const &) = delete;
+    stream_buffer & operator = (stream_buffer const &) = delete;
+
+    GLuint buffer() const { return buffer_; }
+
+    // Waits for the GPU to finish with the region this frame reuses, which is normally long done
+    void begin_frame();
+
+    // Copies data into this frame's region and returns its offset in buffer().
+    // Leaves buffer() bound to the target. Throws if the region is full.
+    std::size_t write(void const * data, std::size_t size, std::size_t alignment = 16);
+
+    // Call after the last draw that reads this frame's data
+    void end_frame();
+
+private:
+    GLenum target_;
+    std::size_t frame_size_;
+    std::size_t frame_count_;
+
+    GLuint buffer_ = 0;
+    char * mapped_ = nullptr;
+
+    std::size_t frame_ = 0;
+    std::size_t offset_ = 0;
+    std::vector<GLsync> fences_;
+};
@@ -0,0 +1,207 @@
+#include "upload_thread.hpp"
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace
+{
+
+    // How long wait() blocks in one glClientWaitSync, in nanoseconds
+    constexpr GLuint64 wait_timeout = 1000000000;
+
+}
+
+upload_thread::upload_thread(SDL_Window * window, bool enabled)
+{
+    if (!enabled)
+        return;
+
+    SDL_GLContext const main_context = SDL_GL_GetCurrentContext();
+    if (!main_context)
+        throw std::runtime_error("upload_thread needs the render thread's context to be current");
+
+    window_ = SDL_CreateWindow("", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 1, 1, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+    if (!window_)
+        return;
+
+    // Same version and profile as the main context, from the attributes it was made with
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+    context_ = SDL_GL_CreateContext(window_);
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+
+    // Making a context also makes it current
+    SDL_GL_MakeCurrent(window, main_context);
+
+    if (!context_)
+    {
+        SDL_DestroyWindow(window_);
+        window_ = nullptr;
+        return;
+    }
+
+    thread_ = std::thread([this]{ thread_loop(); });
+}
+
+upload_thread::~upload_thread()
+{
+    // The thread runs what is queued before it exits
+    if (thread_.joinable())
+    {
+        {
+            std::lock_guard lock(mutex_);
+            stop_ = true;
+        }
+        task_ready_.notify_all();
+        thread_.join();
+    }
+
+    for (auto const & [t, r] : results_)
+        if (r.fence)
+            glDeleteSync(r.fence);
+
+    if (context_)
+        SDL_GL_DeleteContext(context_);
+    if (window_)
+        SDL_DestroyWindow(window_);
+}
+
+upload_thread::ticket upload_thread::submit(std::function<void()> upload)
+{
+    task t;
+    t.upload = std::move(upload);
+    {
+        std::lock_guard lock(mutex_);
+        t.t = next_ticket_++;
+        results_[t.t];
+    }
+
+    if (!threaded())
+    {
+        run(t);
+        return t.t;
+    }
+
+    ticket const result = t.t;
+    {
+        std::lock_guard lock(mutex_);
+        tasks_.push_back(std::move(t));
+    }
+    task_ready_.notify_one();
+    return result;
+}
+
+bool upload_thread::ready(ticket t)
+{
+    GLsync fence;
+    std::exception_ptr error;
+    {
+        std::lock_guard lock(mutex_);
+        auto it = results_.find(t);
+        if (it == results_.end())
+            throw std::runtime_error("Unknown upload ticket " + std::to_string(t));
+        if (!it->second.done)
+            return false;
+        fence = it->second.fence;
+        error = it->second.error;
+    }
+
+    // Done results change no more, and only this thread erases them
+    if (!error)
+    {
+        switch (glClientWaitSync(fence, 0, 0))
+        {
+        case GL_TIMEOUT_EXPIRED:
+            return false;
+        case GL_WAIT_FAILED:
+            error = std::make_exception_ptr(std::runtime_error("glClientWaitSync failed on an upload fence"));
+            break;
+        }
+    }
+
+    glDeleteSync(fence);
+    {
+        std::lock_guard lock(mutex_);
+        results_.erase(t);
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+    return true;
+}
+
+void upload_thread::wait(ticket t)
+{
+    GLsync fence;
+    {
+        std::unique_lock lock(mutex_);
+        auto it = results_.find(t);
+        if (it == results_.end())
+            throw std::runtime_error("Unknown upload ticket " + std::to_string(t));
+        result_ready_.wait(lock, [&]{ return it->second.done; });
+        fence = it->second.fence;
+    }
+
+    while (!ready(t))
+        glClientWaitSync(fence, 0, wait_timeout);
+}
+
+std::size_t upload_thread::pending() const
+{
+    std::lock_guard lock(mutex_);
+    return results_.size();
+}
+
+void upload_thread::thread_loop()
+{
+    SDL_GL_MakeCurrent(window_, context_);
+
+    for (;;)
+    {
+        task t;
+        {
+            std::unique_lock lock(mutex_);
+            task_ready_.wait(lock, [this]{ return stop_ || !tasks_.empty(); });
+            if (tasks_.empty())
+                break;
+            t = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        run(t);
+    }
+
+    SDL_GL_MakeCurrent(window_, nullptr);
+}
+
+void upload_thread::run(task & t)
+{
+    std::exception_ptr error;
+    try
+    {
+        t.upload();
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+
+    // Without the flush the fence could sit in this context's queue, and the render thread
+    // would poll it forever
+    GLsync const fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+
+    {
+        std::lock_guard lock(mutex_);
+        auto & r = results_[t.t];
+        r.fence = fence;
+        r.error = error;
+        r.done = true;
+    }
+    result_ready_.notify_all();
+}
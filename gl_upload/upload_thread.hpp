@@ -0,0 +1,91 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <cstdint>
+
+struct SDL_Window;
+
+// A second GL context in the share group of the render thread's, current on a thread of its
+// own, so that glBufferData, glTexImage* and mipmap generation of large assets run there
+// instead of stalling a frame. Buffers, textures and sync objects are shared between the two
+// contexts, vertex arrays and framebuffers are not, so uploads fill objects and the render
+// thread makes the containers that refer to them. Every upload ends with a fence, flushed so
+// that the render thread can poll it; once ready() says it has signaled, the objects it wrote
+// hold the new data for every command the render thread issues after binding them again.
+//
+// The upload context shares the function pointers glewInit loaded for the main one, which
+// holds as long as both come from the same driver and pixel format, and it binds buffers to
+// GL_COPY_WRITE_BUFFER only, as it has no vertex array to hold an element array binding.
+// Where the driver refuses a shared context, or when asked not to use one, uploads run on
+// the thread that submits them, in submit(), which then has to be the render thread.
+struct upload_thread
+{
+    using ticket = std::uint64_t;
+
+    // Call on the render thread, with its context current on window; that context is current
+    // again on return, and the hidden window the upload context draws to is made here too
+    explicit upload_thread(SDL_Window * window, bool enabled = true);
+    ~upload_thread();
+
+    upload_thread(upload_thread const &) = delete;
+    upload_thread & operator = (upload_thread const &) = delete;
+
+    // Whether uploads run on the upload thread rather than in submit()
+    bool threaded() const { return context_ != nullptr; }
+
+    // Queues upload to run with the upload context current, in the order of submission, and
+    // returns right away. Objects it writes, other than ones it creates, must not be used by
+    // the render thread until ready(). Can be called from any thread when threaded().
+    ticket submit(std::function<void()> upload);
+
+    // Render thread only. Whether the upload has run and the GPU has finished its commands,
+    // without blocking; true at most once per ticket, and an exception the upload threw is
+    // rethrown here instead.
+    bool ready(ticket t);
+
+    // Render thread only. Blocks until ready(t) would be true, throwing like it
+    void wait(ticket t);
+
+    // Submitted uploads that ready() has not returned true or thrown for yet
+    std::size_t pending() const;
+
+private:
+    struct task
+    {
+        ticket t;
+        std::function<void()> upload;
+    };
+
+    struct result
+    {
+        bool done = false;
+        GLsync fence = nullptr;
+        std::exception_ptr error;
+    };
+
+    void thread_loop();
+    // Runs the upload and fences it, on whichever thread has a context current
+    void run(task & t);
+
+    SDL_Window * window_ = nullptr;
+    // An SDL_GLContext; null when uploads run in submit()
+    void * context_ = nullptr;
+
+    std::thread thread_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable task_ready_;
+    std::condition_variable result_ready_;
+    std::deque<task> tasks_;
+    std::map<ticket, result> results_;
+    ticket next_ticket_ = 0;
+    bool stop_ = false;
+};
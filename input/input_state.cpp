@@ -0,0 +1,61 @@
+#include "input_state.hpp"
+
+input_state::input_state()
+    : keys_(SDL_GetKeyboardState(&key_count_))
+{}
+
+void input_state::begin_frame()
+{
+    edge_count_ = 0;
+}
+
+void input_state::handle_event(SDL_Event const & event)
+{
+    if (replaying_ || (event.type != SDL_KEYDOWN && event.type != SDL_KEYUP))
+        return;
+    if (event.key.repeat || edge_count_ == edges_.size())
+        return;
+
+    edges_[edge_count_++] = {event.key.keysym.scancode, event.type == SDL_KEYDOWN};
+}
+
+bool input_state::down(SDL_Scancode key) const
+{
+    return key < key_count_ && keys_[key];
+}
+
+bool input_state::pressed(SDL_Scancode key) const
+{
+    return has_edge(key, true);
+}
+
+bool input_state::released(SDL_Scancode key) const
+{
+    return has_edge(key, false);
+}
+
+void input_state::begin_replay()
+{
+    replaying_ = true;
+    edge_count_ = 0;
+    replayed_keys_.fill(0);
+    keys_ = replayed_keys_.data();
+    key_count_ = replayed_keys_.size();
+}
+
+void input_state::replay_edge(edge e)
+{
+    if (e.key < 0 || e.key >= key_count_)
+        return;
+    replayed_keys_[e.key] = e.down;
+    if (edge_count_ < edges_.size())
+        edges_[edge_count_++] = e;
+}
+
+bool input_state::has_edge(SDL_Scancode key, bool down) const
+{
+    for (std::size_t i = 0; i < edge_count_; ++i)
+        if (edges_[i].key == key && edges_[i].down == down)
+            return true;
+    return false;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#ifdef WIN32
+#include <SDL.h>
+#else
+#include <SDL2/SDL.h>
+#endif
+
+#include <array>
+#include <span>
+#include <cstddef>
+
+// Keyboard state for the render loop that allocates nothing: held keys are read straight from
+// SDL's scancode array, and the presses and releases of the current frame are kept in a fixed
+// buffer. Keys are scancodes, so WASD stays where it is on any layout.
+struct input_state
+{
+    struct edge
+    {
+        SDL_Scancode key;
+        bool down;
+    };
+
+    input_state();
+
+    // Forgets last frame's presses and releases; call before polling the frame's events
+    void begin_frame();
+
+    // Call for every polled event; only key events are looked at, and key repeats are not
+    // counted as presses
+    void handle_event(SDL_Event const & event);
+
+    bool down(SDL_Scancode key) const;
+
+    // Went down or up during this frame; presses beyond the buffer's size are lost
+    bool pressed(SDL_Scancode key) const;
+    bool released(SDL_Scancode key) const;
+
+    // This frame's presses and releases in the order they happened
+    std::span<edge const> edges() const { return {edges_.data(), edge_count_}; }
+
+    // From now on the keyboard is ignored, and keys only go down and up through replay_edge(),
+    // called after begin_frame()
+    void begin_replay();
+    void replay_edge(edge e);
+
+private:
+    bool has_edge(SDL_Scancode key, bool down) const;
+
+    Uint8 const * keys_;
+    int key_count_ = 0;
+
+    std::array<edge, 32> edges_;
+    std::size_t edge_count_ = 0;
+
+    bool replaying_ = false;
+    std::array<Uint8, SDL_NUM_SCANCODES> replayed_keys_{};
+};
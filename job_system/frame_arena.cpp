@@ -0,0 +1,95 @@
+#include "frame_arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+frame_arena::frame_arena(std::size_t block_size)
+    : block_size_(std::max<std::size_t>(block_size, 1))
+{
+    add_block(block_size_);
+}
+
+void frame_arena::reset()
+{
+    // The next frame is likely to need as much as this one did, so it gets that in one block
+    if (blocks_.size() > 1)
+    {
+        std::size_t const total = capacity();
+        blocks_.clear();
+        add_block(total);
+    }
+
+    offset_ = 0;
+    used_ = 0;
+}
+
+std::size_t frame_arena::capacity() const
+{
+    std::size_t result = 0;
+    for (auto const & b : blocks_)
+        result += b.size;
+    return result;
+}
+
+void * frame_arena::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+    auto align = [alignment](std::byte * base, std::size_t offset)
+    {
+        auto const address = reinterpret_cast<std::uintptr_t>(base) + offset;
+        return offset + (alignment - address % alignment) % alignment;
+    };
+
+    std::size_t start = align(blocks_.back().data.get(), offset_);
+    if (start + bytes > blocks_.back().size)
+    {
+        // The rest of the current block is wasted until the reset merges the blocks
+        used_ += blocks_.back().size - offset_;
+        add_block(std::max(block_size_, bytes + alignment));
+        start = align(blocks_.back().data.get(), 0);
+    }
+
+    used_ += start + bytes - offset_;
+    offset_ = start + bytes;
+    return blocks_.back().data.get() + start;
+}
+
+void frame_arena::add_block(std::size_t size)
+{
+    blocks_.push_back({std::make_unique_for_overwrite<std::byte[]>(size), size});
+    offset_ = 0;
+    ++upstream_allocations_;
+}
+
+frame_arenas::frame_arenas(job_system & jobs, std::size_t block_size)
+    : jobs_(jobs)
+{
+    for (std::size_t i = 0; i < jobs.thread_count(); ++i)
+        arenas_.push_back(std::make_unique<frame_arena>(block_size));
+}
+
+frame_arena & frame_arenas::local()
+{
+    return *arenas_[jobs_.current_thread()];
+}
+
+void frame_arenas::reset()
+{
+    for (auto & arena : arenas_)
+        arena->reset();
+}
+
+std::size_t frame_arenas::used() const
+{
+    std::size_t result = 0;
+    for (auto const & arena : arenas_)
+        result += arena->used();
+    return result;
+}
+
+std::size_t frame_arenas::upstream_allocations() const
+{
+    std::size_t result = 0;
+    for (auto const & arena : arenas_)
+        result += arena->upstream_allocations();
+    return result;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "job_system.hpp"
+
+#include <memory_resource>
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+// A bump allocator for data that lives for one frame. Allocating moves a pointer; deallocating
+// does nothing, and reset() frees everything at once. Blocks come from the heap only while the
+// arena grows: reset() replaces them with a single block as large as all of them together, so
+// once a frame's peak fits, later frames allocate nothing from the heap. Containers using
+// the arena must be gone before the reset. Not thread-safe; see frame_arenas.
+struct frame_arena final : std::pmr::memory_resource
+{
+    explicit frame_arena(std::size_t block_size = 64 * 1024);
+
+    frame_arena(frame_arena const &) = delete;
+    frame_arena & operator = (frame_arena const &) = delete;
+
+    void reset();
+
+    // Bytes handed out since the last reset, alignment padding included
+    std::size_t used() const { return used_; }
+    std::size_t capacity() const;
+
+    // Blocks taken from the heap since construction; stays put once the arena has grown enough
+    std::size_t upstream_allocations() const { return upstream_allocations_; }
+
+private:
+    struct block
+    {
+        std::unique_ptr<std::byte[]> data;
+        std::size_t size;
+    };
+
+    void * do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void *, std::size_t, std::size_t) override {}
+    bool do_is_equal(std::pmr::memory_resource const & other) const noexcept override { return this == &other; }
+
+    void add_block(std::size_t size);
+
+    std::size_t block_size_;
+    // Allocations come from the last block
+    std::vector<block> blocks_;
+    std::size_t offset_ = 0;
+    std::size_t used_ = 0;
+    std::size_t upstream_allocations_ = 0;
+};
+
+// One frame_arena per job_system thread, so that jobs get transient memory without locking
+// or sharing cache lines. Reset them all once a frame, when no job uses them.
+struct frame_arenas
+{
+    explicit frame_arenas(job_system & jobs, std::size_t block_size = 64 * 1024);
+
+    // The arena of the calling thread; threads outside the pool share the first one
+    frame_arena & local();
+
+    void reset();
+
+    std::size_t used() const;
+    std::size_t upstream_allocations() const;
+
+private:
+    job_system & jobs_;
+    std::vector<std::unique_ptr<frame_arena>> arenas_;
+};
+
+// A vector for one frame's data, made with the arena to take memory from: frame_vector<T> v(&arena)
+template <typename T>
+using frame_vector = std::pmr::vector<T>;
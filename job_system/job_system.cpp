@@ -0,0 +1,243 @@
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace
+{
+
+    // Which job system's worker the current thread is, if any
+    thread_local job_system const * current_system = nullptr;
+    thread_local unsigned int current_index = 0;
+
+    // Ranges per thread in parallel_for, so that a thread that finishes early has some to steal
+    constexpr std::size_t ranges_per_thread = 4;
+
+}
+
+job_system::job_system(unsigned int thread_count)
+{
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    for (unsigned int i = 0; i < thread_count; ++i)
+        queues_.push_back(std::make_unique<queue>());
+
+    for (unsigned int i = 1; i < thread_count; ++i)
+        workers_.emplace_back([this, i]{ worker_loop(i); });
+}
+
+job_system::~job_system()
+{
+    // Workers drain the queues before they exit
+    {
+        std::lock_guard lock(sleep_mutex_);
+        stop_ = true;
+    }
+    work_ready_.notify_all();
+
+    for (auto & worker : workers_)
+        worker.join();
+}
+
+void job_system::submit(std::function<void()> job, job_counter * done, char const * name)
+{
+    if (done)
+        done->pending_.fetch_add(1, std::memory_order_relaxed);
+
+    push({std::move(job), done, name});
+}
+
+void job_system::submit_after(job_counter & after, std::function<void()> job, job_counter * done, char const * name)
+{
+    if (done)
+        done->pending_.fetch_add(1, std::memory_order_relaxed);
+
+    {
+        // finish() decrements under this lock, so the job is either stored before the counter
+        // gets to zero or sees that it has
+        std::lock_guard lock(after.mutex_);
+        if (after.pending_.load(std::memory_order_acquire) != 0)
+        {
+            after.continuations_.push_back({std::move(job), done, name});
+            return;
+        }
+    }
+
+    push({std::move(job), done, name});
+}
+
+void job_system::wait(job_counter & counter)
+{
+    unsigned int const thread = current_thread();
+
+    while (!counter.done())
+    {
+        task t;
+        if (pop(thread, t))
+            run(thread, t);
+        else
+            std::this_thread::yield();
+    }
+
+    // Also waits for the last finish() to let go of the counter
+    std::exception_ptr error;
+    {
+        std::lock_guard lock(counter.mutex_);
+        error = std::exchange(counter.error_, nullptr);
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void job_system::parallel_for(std::size_t count, std::function<void(std::size_t)> const & job)
+{
+    parallel_for(count, 1, [&job](std::size_t begin, std::size_t end)
+    {
+        for (std::size_t i = begin; i < end; ++i)
+            job(i);
+    });
+}
+
+void job_system::parallel_for(std::size_t count, std::size_t grain, std::function<void(std::size_t begin, std::size_t end)> const & job,
+    char const * name)
+{
+    if (count == 0)
+        return;
+
+    grain = std::max<std::size_t>(grain, 1);
+    std::size_t const range_count = std::min((count + grain - 1) / grain, thread_count() * ranges_per_thread);
+
+    if (range_count == 1)
+    {
+        job(0, count);
+        return;
+    }
+
+    // Two words of captures fit in std::function's own storage, so submitting a range
+    // allocates nothing; the bounds are worked out in the job instead
+    struct split
+    {
+        std::function<void(std::size_t, std::size_t)> const & job;
+        std::size_t count;
+        std::size_t range_count;
+    } const s{job, count, range_count};
+
+    job_counter done;
+    for (std::size_t r = 0; r < range_count; ++r)
+        submit([&s, r]{ s.job((s.count * r) / s.range_count, (s.count * (r + 1)) / s.range_count); }, &done, name ? name : "parallel_for");
+
+    wait(done);
+}
+
+void job_system::worker_loop(unsigned int index)
+{
+    current_system = this;
+    current_index = index;
+
+    while (true)
+    {
+        task t;
+        if (pop(index, t))
+        {
+            run(index, t);
+            continue;
+        }
+
+        std::unique_lock lock(sleep_mutex_);
+        work_ready_.wait(lock, [this]{ return stop_ || queued_.load() > 0; });
+        if (stop_ && queued_.load() == 0)
+            return;
+    }
+}
+
+unsigned int job_system::current_thread() const
+{
+    return current_system == this ? current_index : 0;
+}
+
+void job_system::push(task t)
+{
+    auto & q = *queues_[current_thread()];
+    {
+        std::lock_guard lock(q.mutex);
+        q.tasks.push_back(std::move(t));
+    }
+
+    // Taking the sleep mutex orders this with a worker that is about to check queued_ and sleep
+    {
+        std::lock_guard lock(sleep_mutex_);
+        ++queued_;
+    }
+    work_ready_.notify_one();
+}
+
+bool job_system::pop(unsigned int thread, task & t)
+{
+    // The newest job of our own, then the oldest of anyone else's
+    for (std::size_t i = 0; i < queues_.size(); ++i)
+    {
+        auto & q = *queues_[(thread + i) % queues_.size()];
+        std::lock_guard lock(q.mutex);
+        if (q.tasks.empty())
+            continue;
+
+        if (i == 0)
+        {
+            t = std::move(q.tasks.back());
+            q.tasks.pop_back();
+        }
+        else
+        {
+            t = std::move(q.tasks.front());
+            q.tasks.pop_front();
+        }
+
+        --queued_;
+        return true;
+    }
+
+    return false;
+}
+
+void job_system::run(unsigned int thread, task & t)
+{
+    auto const begin = trace_ ? clock::now() : clock::time_point();
+
+    try
+    {
+        t.function();
+    }
+    catch (...)
+    {
+        if (t.done)
+        {
+            std::lock_guard lock(t.done->mutex_);
+            if (!t.done->error_)
+                t.done->error_ = std::current_exception();
+        }
+    }
+
+    if (trace_)
+        trace_(t.name ? t.name : "job", thread, begin, clock::now());
+
+    // Whatever the job captured goes before its counter says it is done
+    t.function = nullptr;
+
+    if (t.done)
+        finish(*t.done);
+}
+
+void job_system::finish(job_counter & counter)
+{
+    std::vector<job_counter::continuation> continuations;
+    {
+        std::lock_guard lock(counter.mutex_);
+        if (counter.pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            continuations.swap(counter.continuations_);
+    }
+
+    for (auto & c : continuations)
+        push({std::move(c.function), c.done, c.name});
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <chrono>
+#include <string_view>
+
+struct job_system;
+
+// Counts the unfinished jobs submitted with it. Jobs submitted to run after a counter start
+// once it reaches zero, and wait() helps with other jobs meanwhile. A counter can be reused
+// once it is done; it must outlive its jobs.
+struct job_counter
+{
+    job_counter() = default;
+
+    job_counter(job_counter const &) = delete;
+    job_counter & operator = (job_counter const &) = delete;
+
+    bool done() const { return pending_.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend struct job_system;
+
+    struct continuation
+    {
+        std::function<void()> function;
+        job_counter * done;
+        char const * name;
+    };
+
+    std::atomic<std::size_t> pending_{0};
+    std::mutex mutex_;
+    std::vector<continuation> continuations_;
+    std::exception_ptr error_;
+};
+
+// A fixed set of worker threads that stay alive between calls, shared by everything that
+// runs in parallel. Every worker has its own deque: it pushes and pops the jobs it spawns at
+// the back, and when it runs out it steals from the front of another's, so neighbouring work
+// stays on one thread and large chunks move. Threads outside the pool submit to a shared
+// deque that the workers steal from too. A thread waiting on a counter runs jobs meanwhile,
+// so jobs can wait on jobs they spawn.
+struct job_system
+{
+    using clock = std::chrono::steady_clock;
+
+    // Gets the job's name, the index of the thread that ran it (0 for threads outside the
+    // pool, 1 and up for workers) and when it ran. Called from every thread at once.
+    using trace_function = std::function<void(std::string_view name, unsigned int thread, clock::time_point begin, clock::time_point end)>;
+
+    // 0 means one thread per hardware thread, the calling thread included
+    explicit job_system(unsigned int thread_count = 0);
+    ~job_system();
+
+    job_system(job_system const &) = delete;
+    job_system & operator = (job_system const &) = delete;
+
+    std::size_t thread_count() const { return workers_.size() + 1; }
+
+    // Index of the calling thread, as passed to the trace function
+    unsigned int current_thread() const;
+
+    // Queues the job; done, if any, counts it until it returns. An exception it throws is
+    // rethrown by a wait() on done, or lost without one. name is for tracing and must live
+    // as long as the job system.
+    void submit(std::function<void()> job, job_counter * done = nullptr, char const * name = nullptr);
+
+    // Same, but the job is queued only once after is done
+    void submit_after(job_counter & after, std::function<void()> job, job_counter * done = nullptr, char const * name = nullptr);
+
+    // Runs jobs until the counter is done, then rethrows the first exception of its jobs
+    void wait(job_counter & counter);
+
+    // Calls job(i) for every i in [0, count) on all threads, the caller included,
+    // and returns once all of them are done; rethrows the first exception
+    void parallel_for(std::size_t count, std::function<void(std::size_t)> const & job);
+
+    // Same, but in ranges [begin, end) of at least grain indices, for jobs too small to
+    // be worth one job each
+    void parallel_for(std::size_t count, std::size_t grain, std::function<void(std::size_t begin, std::size_t end)> const & job,
+        char const * name = nullptr);
+
+    // Set before submitting anything; an empty function turns tracing off
+    void set_trace(trace_function trace) { trace_ = std::move(trace); }
+
+private:
+    struct task
+    {
+        std::function<void()> function;
+        job_counter * done;
+        char const * name;
+    };
+
+    struct queue
+    {
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    void worker_loop(unsigned int index);
+
+    void push(task t);
+    bool pop(unsigned int thread, task & t);
+    void run(unsigned int thread, task & t);
+    void finish(job_counter & counter);
+
+    std::vector<std::thread> workers_;
+    // Index 0 is shared by the threads outside the pool
+    std::vector<std::unique_ptr<queue>> queues_;
+    std::atomic<std::size_t> queued_{0};
+
+    std::mutex sleep_mutex_;
+    std::condition_variable work_ready_;
+    bool stop_ = false;
+
+    trace_function trace_;
+};
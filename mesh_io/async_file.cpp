@@ -0,0 +1,560 @@
+#include "async_file.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+namespace
+{
+
+    constexpr std::size_t buffer_alignment = 4096;
+
+#ifdef WIN32
+    constexpr async_io_backend native_backend = async_io_backend::overlapped;
+#elif defined(__linux__)
+    constexpr async_io_backend native_backend = async_io_backend::io_uring;
+#else
+    constexpr async_io_backend native_backend = async_io_backend::threads;
+#endif
+
+#ifdef __linux__
+
+    // The kernel's submission and completion rings, set up with raw system calls rather than
+    // through liburing, which is not always installed
+    struct uring
+    {
+        int fd = -1;
+
+        void * sq_ring = MAP_FAILED;
+        std::size_t sq_ring_size = 0;
+        void * cq_ring = MAP_FAILED;
+        std::size_t cq_ring_size = 0;
+        io_uring_sqe * sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+        std::size_t sqes_size = 0;
+
+        unsigned * sq_tail;
+        unsigned sq_mask;
+        unsigned * sq_array;
+        unsigned * cq_head;
+        unsigned * cq_tail;
+        unsigned cq_mask;
+        io_uring_cqe * cqes;
+
+        // Null when the kernel has no io_uring or the process may not use it
+        static std::unique_ptr<uring> create(unsigned entries)
+        {
+            io_uring_params params{};
+            int fd = syscall(__NR_io_uring_setup, entries, &params);
+            if (fd < 0)
+                return nullptr;
+
+            auto result = std::make_unique<uring>();
+            result->fd = fd;
+
+            result->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            result->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            bool const single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+            if (single_mmap)
+                result->sq_ring_size = result->cq_ring_size = std::max(result->sq_ring_size, result->cq_ring_size);
+
+            result->sq_ring = mmap(nullptr, result->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            if (result->sq_ring == MAP_FAILED)
+                return nullptr;
+
+            if (single_mmap)
+                result->cq_ring = result->sq_ring;
+            else
+            {
+                result->cq_ring = mmap(nullptr, result->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+                if (result->cq_ring == MAP_FAILED)
+                    return nullptr;
+            }
+
+            result->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+            result->sqes = static_cast<io_uring_sqe *>(mmap(nullptr, result->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+            if (result->sqes == MAP_FAILED)
+                return nullptr;
+
+            char * sq = static_cast<char *>(result->sq_ring);
+            result->sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+            result->sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+            result->sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+            char * cq = static_cast<char *>(result->cq_ring);
+            result->cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+            result->cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+            result->cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+            result->cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+            return result;
+        }
+
+        ~uring()
+        {
+            if (sqes != MAP_FAILED)
+                munmap(sqes, sqes_size);
+            if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+                munmap(cq_ring, cq_ring_size);
+            if (sq_ring != MAP_FAILED)
+                munmap(sq_ring, sq_ring_size);
+            if (fd >= 0)
+                close(fd);
+        }
+
+        // Queues a read, submitted with the next enter()
+        void queue_read(int file, iovec const * iov, std::uint64_t offset, std::uint64_t user_data)
+        {
+            // Only this thread moves the tail
+            unsigned const tail = *sq_tail;
+            unsigned const index = tail & sq_mask;
+
+            io_uring_sqe & sqe = sqes[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_READV;
+            sqe.fd = file;
+            sqe.addr = reinterpret_cast<std::uint64_t>(iov);
+            sqe.len = 1;
+            sqe.off = offset;
+            sqe.user_data = user_data;
+
+            sq_array[index] = index;
+            __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        }
+
+        // Submits the queued reads and waits for at least min_complete completions
+        void enter(unsigned to_submit, unsigned min_complete)
+        {
+            while (to_submit > 0 || min_complete > 0)
+            {
+                int const submitted = syscall(__NR_io_uring_enter, fd, to_submit, min_complete, min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+                if (submitted < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+                }
+                to_submit -= submitted;
+                min_complete = 0;
+            }
+        }
+
+        template <typename Function>
+        void reap(Function const & function)
+        {
+            unsigned head = *cq_head;
+            unsigned const tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head)
+            {
+                io_uring_cqe const & cqe = cqes[head & cq_mask];
+                function(cqe.user_data, cqe.res);
+            }
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        }
+    };
+
+#endif
+
+}
+
+char const * to_string(async_io_backend backend)
+{
+    switch (backend)
+    {
+    case async_io_backend::io_uring: return "io_uring";
+    case async_io_backend::overlapped: return "overlapped";
+    case async_io_backend::threads: return "threads";
+    }
+    return "unknown";
+}
+
+#ifdef WIN32
+
+struct async_file::backend_state
+{
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE port = nullptr;
+
+    ~backend_state()
+    {
+        if (port)
+            CloseHandle(port);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+    }
+};
+
+#else
+
+struct async_file::backend_state
+{
+    int fd = -1;
+#ifdef __linux__
+    std::unique_ptr<uring> ring;
+#endif
+
+    ~backend_state()
+    {
+#ifdef __linux__
+        ring.reset();
+#endif
+        if (fd >= 0)
+            close(fd);
+    }
+};
+
+#endif
+
+async_file::async_file(std::filesystem::path const & path, async_file_settings const & settings)
+    : path_(path)
+    , settings_(settings)
+    , backend_(settings.backend.value_or(native_backend))
+    , state_(std::make_unique<backend_state>())
+{
+    if (settings_.block_size == 0 || settings_.block_size % buffer_alignment != 0)
+        throw std::runtime_error("Async file blocks must be a non-zero multiple of " + std::to_string(buffer_alignment) + " bytes");
+    if (settings_.queue_depth == 0)
+        throw std::runtime_error("Async file queue depth must be at least one");
+
+#ifdef WIN32
+    if (backend_ == async_io_backend::io_uring)
+        throw std::runtime_error("io_uring is not available on Windows");
+    if (settings_.block_size > MAXDWORD)
+        throw std::runtime_error("Async file blocks must fit in a single ReadFile");
+
+    DWORD const flags = FILE_FLAG_SEQUENTIAL_SCAN | (backend_ == async_io_backend::overlapped ? FILE_FLAG_OVERLAPPED : 0);
+    state_->file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+    if (state_->file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Failed to open " + path.string());
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(state_->file, &size))
+        throw std::runtime_error("Failed to get size of " + path.string());
+    size_ = size.QuadPart;
+
+    if (backend_ == async_io_backend::overlapped)
+    {
+        state_->port = CreateIoCompletionPort(state_->file, nullptr, 0, 1);
+        if (!state_->port)
+            throw std::runtime_error("Failed to create a completion port for " + path.string());
+    }
+#else
+    if (backend_ == async_io_backend::overlapped)
+        throw std::runtime_error("Overlapped I/O is only available on Windows");
+
+    state_->fd = open(path.c_str(), O_RDONLY);
+    if (state_->fd < 0)
+        throw std::runtime_error("Failed to open " + path.string());
+
+    struct stat info;
+    if (fstat(state_->fd, &info) != 0)
+        throw std::runtime_error("Failed to get size of " + path.string());
+    size_ = info.st_size;
+
+    // The whole file is read once, front to back
+    posix_fadvise(state_->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+#ifdef __linux__
+    if (backend_ == async_io_backend::io_uring)
+    {
+        state_->ring = uring::create(settings_.queue_depth);
+        if (!state_->ring)
+        {
+            // Older kernels, seccomp filters in containers, or io_uring_disabled
+            if (settings.backend)
+                throw std::runtime_error("io_uring is not available to this process");
+            backend_ = async_io_backend::threads;
+        }
+    }
+#else
+    if (backend_ == async_io_backend::io_uring)
+        throw std::runtime_error("io_uring is only available on Linux");
+#endif
+#endif
+
+    data_ = static_cast<char *>(::operator new(std::max<std::size_t>(size_, 1), std::align_val_t{buffer_alignment}));
+}
+
+async_file::~async_file()
+{
+    ::operator delete(data_, std::align_val_t{buffer_alignment});
+}
+
+void async_file::read(std::function<void(std::size_t block)> const & on_block)
+{
+    std::size_t const count = block_count();
+    if (count == 0)
+        return;
+
+    auto const block_offset = [&](std::size_t block){ return block * settings_.block_size; };
+    auto const block_length = [&](std::size_t block){ return std::min(settings_.block_size, size_ - block_offset(block)); };
+
+    // Once anything fails no more reads are issued, the ones in flight still land in the buffer
+    std::exception_ptr error;
+    auto const fail = [&](std::string const & reason){
+        if (!error)
+            error = std::make_exception_ptr(std::runtime_error(reason + " " + path_.string()));
+    };
+    auto const complete = [&](std::size_t block){
+        if (error)
+            return;
+        try
+        {
+            on_block(block);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+    };
+
+    std::size_t const queue_depth = std::min(settings_.queue_depth, count);
+
+#ifdef __linux__
+    if (backend_ == async_io_backend::io_uring)
+    {
+        auto & ring = *state_->ring;
+
+        // Short reads are resubmitted for the rest of the block
+        std::vector<std::size_t> read_bytes(count, 0);
+        std::vector<iovec> iovs(count);
+
+        auto const queue = [&](std::size_t block){
+            std::size_t const offset = block_offset(block) + read_bytes[block];
+            iovs[block] = {data_ + offset, block_length(block) - read_bytes[block]};
+            ring.queue_read(state_->fd, &iovs[block], offset, block);
+        };
+
+        std::size_t next = 0;
+        std::size_t in_flight = 0;
+        unsigned queued = 0;
+        for (; next < queue_depth; ++next, ++in_flight, ++queued)
+            queue(next);
+
+        while (in_flight > 0)
+        {
+            ring.enter(queued, 1);
+            queued = 0;
+
+            ring.reap([&](std::uint64_t block, std::int32_t result){
+                if (result <= 0)
+                {
+                    --in_flight;
+                    fail(result < 0 ? std::string("Failed to read ") + std::strerror(-result) + " from" : "Unexpected end of");
+                    return;
+                }
+
+                read_bytes[block] += result;
+                if (read_bytes[block] < block_length(block) && !error)
+                {
+                    queue(block);
+                    ++queued;
+                    return;
+                }
+
+                --in_flight;
+                complete(block);
+
+                if (next < count && !error)
+                {
+                    queue(next++);
+                    ++in_flight;
+                    ++queued;
+                }
+            });
+        }
+
+        if (error)
+            std::rethrow_exception(error);
+        return;
+    }
+#endif
+
+#ifdef WIN32
+    if (backend_ == async_io_backend::overlapped)
+    {
+        struct slot
+        {
+            // First, so a completed OVERLAPPED pointer is the slot's
+            OVERLAPPED overlapped;
+            std::size_t block;
+        };
+        std::vector<slot> slots(queue_depth);
+
+        auto const issue = [&](slot & s, std::size_t block){
+            s.overlapped = {};
+            std::uint64_t const offset = block_offset(block);
+            s.overlapped.Offset = DWORD(offset);
+            s.overlapped.OffsetHigh = DWORD(offset >> 32);
+            s.block = block;
+            // Even reads that finish at once post their completion to the port
+            if (!ReadFile(state_->file, data_ + offset, DWORD(block_length(block)), nullptr, &s.overlapped) && GetLastError() != ERROR_IO_PENDING)
+            {
+                fail("Failed to read");
+                return false;
+            }
+            return true;
+        };
+
+        std::size_t next = 0;
+        std::size_t in_flight = 0;
+        for (; next < queue_depth && !error; ++next)
+            if (issue(slots[next], next))
+                ++in_flight;
+
+        while (in_flight > 0)
+        {
+            DWORD bytes = 0;
+            ULONG_PTR key;
+            OVERLAPPED * overlapped = nullptr;
+            BOOL const ok = GetQueuedCompletionStatus(state_->port, &bytes, &key, &overlapped, INFINITE);
+            if (!overlapped)
+                throw std::runtime_error("Failed to wait for reads of " + path_.string());
+            --in_flight;
+
+            slot & s = *reinterpret_cast<slot *>(overlapped);
+            // Files larger than their block count allows never return short reads but at the end
+            if (!ok || bytes != block_length(s.block))
+            {
+                fail(ok ? "Unexpected end of" : "Failed to read");
+                continue;
+            }
+
+            complete(s.block);
+
+            if (next < count && !error && issue(s, next++))
+                ++in_flight;
+        }
+
+        if (error)
+            std::rethrow_exception(error);
+        return;
+    }
+#endif
+
+    // Blocking reads on threads of their own, their completions passed back to this one
+    std::mutex mutex;
+    std::condition_variable completed_cv;
+    std::deque<std::size_t> completed;
+    std::size_t finished_threads = 0;
+    // Set by the reading threads, under the mutex, leaving error to this one
+    char const * read_failure = nullptr;
+    std::atomic<std::size_t> next{0};
+    std::atomic<bool> stop{false};
+
+    auto const work = [&]
+    {
+        for (;;)
+        {
+            std::size_t const block = next.fetch_add(1, std::memory_order_relaxed);
+            if (block >= count || stop.load(std::memory_order_relaxed))
+                break;
+
+            std::size_t const offset = block_offset(block);
+            std::size_t const length = block_length(block);
+            std::size_t done = 0;
+            char const * failure = nullptr;
+            while (done < length)
+            {
+#ifdef WIN32
+                OVERLAPPED overlapped{};
+                overlapped.Offset = DWORD(offset + done);
+                overlapped.OffsetHigh = DWORD(std::uint64_t(offset + done) >> 32);
+                DWORD bytes = 0;
+                if (!ReadFile(state_->file, data_ + offset + done, DWORD(length - done), &bytes, &overlapped))
+                {
+                    failure = "Failed to read";
+                    break;
+                }
+                auto const result = bytes;
+#else
+                auto const result = pread(state_->fd, data_ + offset + done, length - done, offset + done);
+                if (result < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    failure = "Failed to read";
+                    break;
+                }
+#endif
+                if (result == 0)
+                {
+                    failure = "Unexpected end of";
+                    break;
+                }
+                done += result;
+            }
+
+            std::lock_guard lock{mutex};
+            if (failure)
+            {
+                if (!read_failure)
+                    read_failure = failure;
+                stop = true;
+                break;
+            }
+            completed.push_back(block);
+            completed_cv.notify_one();
+        }
+
+        std::lock_guard lock{mutex};
+        ++finished_threads;
+        completed_cv.notify_one();
+    };
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < queue_depth; ++i)
+        threads.emplace_back(work);
+
+    std::unique_lock lock{mutex};
+    for (;;)
+    {
+        completed_cv.wait(lock, [&]{ return !completed.empty() || finished_threads == threads.size(); });
+        if (completed.empty())
+            break;
+
+        std::size_t const block = completed.front();
+        completed.pop_front();
+
+        lock.unlock();
+        complete(block);
+        if (error)
+            stop = true;
+        lock.lock();
+    }
+    lock.unlock();
+
+    for (auto & thread : threads)
+        thread.join();
+
+    if (read_failure)
+        fail(read_failure);
+    if (error)
+        std::rethrow_exception(error);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <string_view>
+#include <memory>
+#include <optional>
+#include <cstddef>
+
+enum class async_io_backend
+{
+    // Linux, when the kernel has it and lets the process use it
+    io_uring,
+    // Windows, reads on an I/O completion port
+    overlapped,
+    // Blocking reads on a few threads of its own, anywhere
+    threads,
+};
+
+char const * to_string(async_io_backend backend);
+
+struct async_file_settings
+{
+    // Bytes per read; every read but the last starts and ends on a multiple of it
+    std::size_t block_size = 1 << 20;
+    // Reads in flight at once
+    std::size_t queue_depth = 16;
+    // The platform's native backend by default, threads where it is unavailable
+    std::optional<async_io_backend> backend;
+};
+
+// A whole file read into memory in large blocks with many reads in flight at once, so that a
+// cold read from a slow disk keeps the device queue full instead of faulting pages in one at a
+// time as a parser walks a mapping. The buffer is page aligned, and each block can be used as
+// soon as its read completes, while the later ones are still on their way.
+struct async_file
+{
+    explicit async_file(std::filesystem::path const & path, async_file_settings const & settings = {});
+    ~async_file();
+
+    async_file(async_file const &) = delete;
+    async_file & operator = (async_file const &) = delete;
+
+    std::size_t size() const { return size_; }
+    char const * data() const { return data_; }
+    std::string_view view() const { return {data_, size_}; }
+
+    std::size_t block_size() const { return settings_.block_size; }
+    std::size_t block_count() const { return (size_ + settings_.block_size - 1) / settings_.block_size; }
+
+    async_io_backend backend() const { return backend_; }
+
+    // Reads every block, calling on_block with each block's index on the calling thread as its
+    // read completes, in order of completion; returns once all are done. Throws if a read fails,
+    // or what on_block throws, after the reads in flight have finished.
+    void read(std::function<void(std::size_t block)> const & on_block);
+
+private:
+    struct backend_state;
+
+    std::filesystem::path path_;
+    async_file_settings settings_;
+    async_io_backend backend_;
+    std::size_t size_ = 0;
+    char * data_ = nullptr;
+    std::unique_ptr<backend_state> state_;
+};
@@ -0,0 +1,170 @@
+#include "obj_parser.hpp"
+#include "obj_cache.hpp"
+#include "allocation_tracker.hpp"
+#include "process_memory.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <cstdlib>
+
+namespace
+{
+
+    struct loader
+    {
+        std::string name;
+        // Returns the number of vertices loaded
+        std::function<std::size_t(std::filesystem::path const &)> load;
+    };
+
+    struct result
+    {
+        std::string loader;
+        std::string asset;
+        std::size_t file_size;
+        std::size_t vertex_count;
+        double min_seconds;
+        double mean_seconds;
+        std::size_t peak_rss;
+        std::size_t allocations;
+        std::size_t allocated_bytes;
+    };
+
+    std::string json_escape(std::string const & str)
+    {
+        std::string result;
+        for (char c : str)
+        {
+            if (c == '"' || c == '\\')
+                result.push_back('\\');
+            result.push_back(c);
+        }
+        return result;
+    }
+
+    void write_json(std::ostream & os, std::vector<result> const & results)
+    {
+        os << "[\n";
+        for (std::size_t i = 0; i < results.size(); ++i)
+        {
+            auto const & r = results[i];
+            os << "  {\"loader\": \"" << json_escape(r.loader) << "\""
+                << ", \"asset\": \"" << json_escape(r.asset) << "\""
+                << ", \"file_size\": " << r.file_size
+                << ", \"vertices\": " << r.vertex_count
+                << ", \"min_seconds\": " << r.min_seconds
+                << ", \"mean_seconds\": " << r.mean_seconds
+                << ", \"mb_per_second\": " << r.file_size / r.min_seconds / 1e6
+                << ", \"vertices_per_second\": " << r.vertex_count / r.min_seconds
+                << ", \"peak_rss\": " << r.peak_rss
+                << ", \"allocations\": " << r.allocations
+                << ", \"allocated_bytes\": " << r.allocated_bytes
+                << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        os << "]\n";
+    }
+
+}
+
+int main(int argc, char ** argv) try
+{
+    int iterations = 5;
+    std::string json_path;
+    std::vector<std::filesystem::path> assets;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--iterations" && i + 1 < argc)
+            iterations = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--json" && i + 1 < argc)
+            json_path = argv[++i];
+        else
+            assets.push_back(argv[i]);
+    }
+
+    if (assets.empty())
+    {
+        std::filesystem::path root = REPO_ROOT;
+        for (auto const & asset : {"practice4/bunny.obj", "practice4/bunny_lowres.obj", "practice5/cow.obj",
+            "practice6/dragon.obj", "practice7/suzanne.obj", "practice8/buddha.obj"})
+            assets.push_back(root / asset);
+    }
+
+    std::vector<loader> loaders
+    {
+        {"parse_obj", [](auto const & path){ return parse_obj(path).vertices.size(); }},
+        {"parse_obj_mapped", [](auto const & path){ return parse_obj_mapped(path).vertices.size(); }},
+        {"parse_obj_parallel", [](auto const & path){ return parse_obj_parallel(path).vertices.size(); }},
+        {"parse_obj_async", [](auto const & path){ return parse_obj_async(path).vertices.size(); }},
+        {"stream_obj", [](auto const & path){
+            return stream_obj(path, 65536, [](obj_stream_info const &){}, [](obj_batch const &){}).vertex_count;
+        }},
+        {"load_obj_cached", [](auto const & path){ return load_obj_cached(path).vertices.size(); }},
+        {"load_obj_cached_tangents", [](auto const & path){ return load_obj_cached(path, true).vertices.size(); }},
+    };
+
+    std::vector<result> results;
+
+    for (auto const & asset : assets)
+    {
+        // Make sure the cached loader measures a cache hit
+        load_obj_cached(asset);
+        load_obj_cached(asset, true);
+
+        for (auto const & loader : loaders)
+        {
+            result r;
+            r.loader = loader.name;
+            r.asset = asset.filename().string();
+            r.file_size = std::filesystem::file_size(asset);
+            r.min_seconds = std::numeric_limits<double>::infinity();
+            r.mean_seconds = 0.0;
+
+            reset_peak_rss();
+
+            auto const allocations_before = allocation_tracker::global().total();
+
+            for (int i = 0; i < iterations; ++i)
+            {
+                auto start = std::chrono::high_resolution_clock::now();
+                r.vertex_count = loader.load(asset);
+                double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+                r.min_seconds = std::min(r.min_seconds, seconds);
+                r.mean_seconds += seconds / iterations;
+            }
+
+            r.peak_rss = peak_rss();
+            auto const allocations_after = allocation_tracker::global().total();
+            r.allocations = (allocations_after.allocations - allocations_before.allocations) / iterations;
+            r.allocated_bytes = (allocations_after.allocated_bytes - allocations_before.allocated_bytes) / iterations;
+
+            std::cout << r.asset << " " << r.loader << ": "
+                << r.file_size / r.min_seconds / 1e6 << " MB/s, "
+                << r.vertex_count / r.min_seconds / 1e6 << " M vertices/s, "
+                << r.allocations << " allocations, "
+                << r.peak_rss / (1024 * 1024) << " MB peak RSS" << std::endl;
+
+            results.push_back(r);
+        }
+    }
+
+    if (!json_path.empty())
+    {
+        std::ofstream json(json_path);
+        write_json(json, results);
+    }
+}
+catch (std::exception const & e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,272 @@
+#include "decompressing_reader.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <cstdint>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace
+{
+
+    char const * name(compression format)
+    {
+        switch (format)
+        {
+        case compression::none: return "uncompressed";
+        case compression::gzip: return "gzip";
+        case compression::zstd: return "zstd";
+        }
+        return "unknown";
+    }
+
+}
+
+compression detect_compression(std::filesystem::path const & path)
+{
+    std::ifstream is(path, std::ios::binary);
+    unsigned char magic[4] = {};
+    is.read(reinterpret_cast<char *>(magic), sizeof(magic));
+    std::size_t const size = is.gcount();
+
+    if (size >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+        return compression::gzip;
+    if (size >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+        return compression::zstd;
+    return compression::none;
+}
+
+bool compression_supported(compression format)
+{
+    switch (format)
+    {
+    case compression::none: return false;
+#ifdef HAVE_ZLIB
+    case compression::gzip: return true;
+#endif
+#ifdef HAVE_ZSTD
+    case compression::zstd: return true;
+#endif
+    default: return false;
+    }
+}
+
+decompressing_reader::decompressing_reader(std::filesystem::path const & path, std::size_t block_size, std::size_t block_count)
+    : path_(path)
+    , format_(detect_compression(path))
+    , file_(path)
+    , blocks_(std::max<std::size_t>(block_count, 2))
+{
+    if (format_ == compression::none)
+        throw std::runtime_error(path.string() + " is not compressed with gzip or zstd");
+    if (!compression_supported(format_))
+        throw std::runtime_error(path.string() + " is compressed with " + name(format_) + ", which this build cannot decompress");
+    if (block_size == 0)
+        throw std::runtime_error("Decompressed blocks must not be empty");
+
+    for (auto & b : blocks_)
+    {
+        b.data.resize(block_size);
+        free_.push_back(&b);
+    }
+
+    thread_ = std::thread([this]{ decompress(); });
+}
+
+decompressing_reader::~decompressing_reader()
+{
+    {
+        std::lock_guard lock{mutex_};
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+}
+
+std::string_view decompressing_reader::next()
+{
+    std::unique_lock lock{mutex_};
+
+    if (current_)
+    {
+        free_.push_back(current_);
+        current_ = nullptr;
+        cv_.notify_all();
+    }
+
+    cv_.wait(lock, [this]{ return !filled_.empty() || finished_; });
+    if (filled_.empty())
+    {
+        if (error_)
+            std::rethrow_exception(error_);
+        return {};
+    }
+
+    current_ = filled_.front();
+    filled_.pop_front();
+    return {current_->data.data(), current_->size};
+}
+
+decompressing_reader::block * decompressing_reader::acquire()
+{
+    std::unique_lock lock{mutex_};
+    cv_.wait(lock, [this]{ return !free_.empty() || stopping_; });
+    if (stopping_)
+        return nullptr;
+
+    block * result = free_.front();
+    free_.pop_front();
+    result->size = 0;
+    return result;
+}
+
+void decompressing_reader::publish(block * b)
+{
+    {
+        std::lock_guard lock{mutex_};
+        filled_.push_back(b);
+    }
+    cv_.notify_all();
+}
+
+void decompressing_reader::decompress()
+{
+    auto const input = reinterpret_cast<std::uint8_t const *>(file_.data());
+    std::size_t const input_size = file_.size();
+
+    try
+    {
+        block * output = nullptr;
+        // Hands the block over once full, true if there is another to fill
+        auto const flush = [&]{
+            if (output->size < output->data.size())
+                return true;
+            publish(output);
+            return (output = acquire()) != nullptr;
+        };
+
+        if (!(output = acquire()))
+            return;
+
+#ifdef HAVE_ZLIB
+        if (format_ == compression::gzip)
+        {
+            z_stream stream{};
+            // Gzip headers only
+            if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK)
+                throw std::runtime_error("Failed to start decompressing " + path_.string());
+
+            // zlib takes sizes as uInt
+            std::size_t consumed = 0;
+            try
+            {
+                for (;;)
+                {
+                    std::size_t const available = std::min<std::size_t>(input_size - consumed, 1u << 30);
+                    stream.next_in = const_cast<Bytef *>(input + consumed);
+                    stream.avail_in = available;
+                    stream.next_out = reinterpret_cast<Bytef *>(output->data.data() + output->size);
+                    stream.avail_out = output->data.size() - output->size;
+                    std::size_t const space = stream.avail_out;
+
+                    int const result = inflate(&stream, Z_NO_FLUSH);
+                    consumed += available - stream.avail_in;
+                    output->size += space - stream.avail_out;
+
+                    if (result == Z_STREAM_END)
+                    {
+                        // Concatenated members decompress to their concatenated contents
+                        if (consumed == input_size)
+                            break;
+                        inflateReset(&stream);
+                    }
+                    else if (result == Z_BUF_ERROR && consumed == input_size && stream.avail_out > 0)
+                        throw std::runtime_error(path_.string() + " ends in the middle of its compressed data");
+                    else if (result != Z_OK && result != Z_BUF_ERROR)
+                        throw std::runtime_error("Failed to decompress " + path_.string() + (stream.msg ? std::string(": ") + stream.msg : std::string()));
+
+                    if (!flush())
+                    {
+                        inflateEnd(&stream);
+                        return;
+                    }
+                }
+            }
+            catch (...)
+            {
+                inflateEnd(&stream);
+                throw;
+            }
+            inflateEnd(&stream);
+        }
+#endif
+
+#ifdef HAVE_ZSTD
+        if (format_ == compression::zstd)
+        {
+            ZSTD_DCtx * context = ZSTD_createDCtx();
+            if (!context)
+                throw std::runtime_error("Failed to start decompressing " + path_.string());
+
+            ZSTD_inBuffer in{input, input_size, 0};
+            // Nonzero while a frame is unfinished
+            std::size_t remaining = 0;
+            try
+            {
+                while (in.pos < in.size || remaining != 0)
+                {
+                    ZSTD_outBuffer out{output->data.data(), output->data.size(), output->size};
+                    std::size_t const in_pos = in.pos;
+                    remaining = ZSTD_decompressStream(context, &out, &in);
+                    if (ZSTD_isError(remaining))
+                        throw std::runtime_error("Failed to decompress " + path_.string() + ": " + ZSTD_getErrorName(remaining));
+
+                    bool const stalled = out.pos == output->size && in.pos == in_pos;
+                    output->size = out.pos;
+                    if (stalled && remaining != 0)
+                        throw std::runtime_error(path_.string() + " ends in the middle of its compressed data");
+
+                    if (!flush())
+                    {
+                        ZSTD_freeDCtx(context);
+                        return;
+                    }
+                }
+            }
+            catch (...)
+            {
+                ZSTD_freeDCtx(context);
+                throw;
+            }
+            ZSTD_freeDCtx(context);
+        }
+#endif
+
+        if (output->size > 0)
+            publish(output);
+        else
+        {
+            std::lock_guard lock{mutex_};
+            free_.push_back(output);
+        }
+    }
+    catch (...)
+    {
+        std::lock_guard lock{mutex_};
+        error_ = std::current_exception();
+    }
+
+    {
+        std::lock_guard lock{mutex_};
+        finished_ = true;
+    }
+    cv_.notify_all();
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "mapped_file.hpp"
+
+#include <filesystem>
+#include <string_view>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <cstddef>
+
+enum class compression
+{
+    none,
+    gzip,
+    zstd,
+};
+
+// From the file's first bytes rather than its extension
+compression detect_compression(std::filesystem::path const & path);
+
+// Whether this build can decompress it; zlib and zstd are optional
+bool compression_supported(compression format);
+
+// A gzip or zstd file decompressed on a thread of its own, a few blocks ahead of the reader,
+// which takes the blocks in order on another. The compressed file is mapped, and being a
+// fraction of the size of its contents it is the cheaper one to read from a slow disk.
+struct decompressing_reader
+{
+    // Throws if the file is not compressed in a format this build supports
+    explicit decompressing_reader(std::filesystem::path const & path, std::size_t block_size = 1 << 20, std::size_t block_count = 4);
+    ~decompressing_reader();
+
+    decompressing_reader(decompressing_reader const &) = delete;
+    decompressing_reader & operator = (decompressing_reader const &) = delete;
+
+    compression format() const { return format_; }
+
+    // The next block of decompressed data, valid until the following call; empty once it has all
+    // been read. Throws what decompression failed with.
+    std::string_view next();
+
+private:
+    struct block
+    {
+        std::vector<char> data;
+        std::size_t size = 0;
+    };
+
+    void decompress();
+    // The next free block to fill, null once the reader has gone away
+    block * acquire();
+    void publish(block * b);
+
+    std::filesystem::path path_;
+    compression format_;
+    mapped_file file_;
+
+    std::vector<block> blocks_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<block *> free_;
+    std::deque<block *> filled_;
+    // The one the reader holds until its next call
+    block * current_ = nullptr;
+    bool finished_ = false;
+    bool stopping_ = false;
+    std::exception_ptr error_;
+
+    std::thread thread_;
+};
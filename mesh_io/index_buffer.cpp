@@ -0,0 +1,82 @@
+#include "index_buffer.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <cstring>
+
+packed_indices pack_indices(std::span<std::uint32_t const> indices, std::size_t vertex_count, bool primitive_restart)
+{
+    packed_indices result;
+    result.count = indices.size();
+    result.index_size = (vertex_count <= (primitive_restart ? 0xffff : 0x10000)) ? 2 : 4;
+    result.data.resize(indices.size() * result.index_size);
+
+    if (result.index_size == 4)
+    {
+        std::memcpy(result.data.data(), indices.data(), result.data.size());
+        return result;
+    }
+
+    auto output = reinterpret_cast<std::uint16_t *>(result.data.data());
+    for (std::size_t i = 0; i < indices.size(); ++i)
+        output[i] = (primitive_restart && indices[i] == primitive_restart_index) ? 0xffff : std::uint16_t(indices[i]);
+
+    return result;
+}
+
+chunked_mesh split_for_16bit_indices(obj_data const & mesh, std::size_t max_vertices)
+{
+    max_vertices = std::clamp<std::size_t>(max_vertices, 3, 0x10000);
+
+    chunked_mesh result;
+    result.indices.reserve(mesh.indices.size());
+
+    auto const unused = std::numeric_limits<std::uint32_t>::max();
+    std::vector<std::uint32_t> local(mesh.vertices.size(), unused);
+    // Original indices of the current chunk's vertices, to reset local when it ends
+    std::vector<std::uint32_t> chunk_vertices;
+
+    chunked_mesh::chunk current{0, 0, 0, 0};
+
+    auto end_chunk = [&]
+    {
+        for (auto v : chunk_vertices)
+            local[v] = unused;
+        chunk_vertices.clear();
+
+        result.chunks.push_back(current);
+        current = {std::uint32_t(result.indices.size()), 0, std::uint32_t(result.vertices.size()), 0};
+    };
+
+    for (std::size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+    {
+        auto const a = mesh.indices[i], b = mesh.indices[i + 1], c = mesh.indices[i + 2];
+        std::size_t const new_vertices = (local[a] == unused)
+            + (local[b] == unused && b != a)
+            + (local[c] == unused && c != a && c != b);
+
+        if (current.vertex_count + new_vertices > max_vertices)
+            end_chunk();
+
+        for (auto v : {a, b, c})
+        {
+            if (local[v] == unused)
+            {
+                local[v] = current.vertex_count++;
+                chunk_vertices.push_back(v);
+                result.vertices.push_back(mesh.vertices[v]);
+                if (!mesh.tangents.empty())
+                    result.tangents.push_back(mesh.tangents[v]);
+                if (!mesh.occlusion.empty())
+                    result.occlusion.push_back(mesh.occlusion[v]);
+            }
+            result.indices.push_back(local[v]);
+        }
+        current.index_count += 3;
+    }
+
+    if (current.index_count > 0)
+        end_chunk();
+
+    return result;
+}
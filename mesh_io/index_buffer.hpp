@@ -0,0 +1,56 @@
+#pragma once
+
+#include "obj_parser.hpp"
+
+#include <vector>
+#include <span>
+#include <cstdint>
+
+// Marks a primitive restart in 32-bit input indices
+constexpr std::uint32_t primitive_restart_index = 0xffffffff;
+
+// Index data in the narrowest type that holds every index
+struct packed_indices
+{
+    // 2 or 4 bytes per index
+    std::size_t index_size;
+    std::size_t count;
+    std::vector<std::uint8_t> data;
+
+    // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    unsigned int gl_type() const { return index_size == 2 ? 0x1403 : 0x1405; }
+
+    // The largest value of the type, for glPrimitiveRestartIndex
+    std::uint32_t restart_index() const { return index_size == 2 ? 0xffff : 0xffffffff; }
+};
+
+// Picks 16-bit indices when vertex_count allows. With primitive_restart the largest 16-bit
+// value stays free, so at most 65535 vertices fit, and primitive_restart_index entries
+// become restart_index() of the result.
+packed_indices pack_indices(std::span<std::uint32_t const> indices, std::size_t vertex_count, bool primitive_restart = false);
+
+// The mesh cut into consecutive runs of triangles that use at most max_vertices vertices each,
+// every run with its own copy of them, so that all of it can be drawn with 16-bit indices and
+// glDrawElementsBaseVertex per chunk. The triangle order is kept, so index ranges like submeshes
+// and meshlets stay valid, though one crossing a chunk boundary has to be drawn per chunk.
+struct chunked_mesh
+{
+    struct chunk
+    {
+        std::uint32_t first_index;
+        std::uint32_t index_count;
+        // Indices are relative to it
+        std::uint32_t base_vertex;
+        std::uint32_t vertex_count;
+    };
+
+    std::vector<obj_data::vertex> vertices;
+    // Empty if the mesh had none
+    std::vector<std::array<float, 4>> tangents;
+    // Same
+    std::vector<std::uint8_t> occlusion;
+    std::vector<std::uint16_t> indices;
+    std::vector<chunk> chunks;
+};
+
+chunked_mesh split_for_16bit_indices(obj_data const & mesh, std::size_t max_vertices = 65536);
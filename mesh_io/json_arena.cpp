@@ -0,0 +1,28 @@
+#include "json_arena.hpp"
+
+#include <algorithm>
+
+char * json_arena::text(std::size_t size)
+{
+    text_.resize(size + 1);
+    text_[size] = '\0';
+    return text_.data();
+}
+
+std::span<char> json_arena::pool()
+{
+    if (pool_.size() < pool_needed_)
+        pool_.resize(pool_needed_);
+    return pool_;
+}
+
+void json_arena::record_pool_use(std::size_t capacity)
+{
+    pool_needed_ = std::max(pool_needed_, capacity);
+}
+
+json_arena & thread_json_arena()
+{
+    static thread_local json_arena arena;
+    return arena;
+}
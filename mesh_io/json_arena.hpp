@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <cstddef>
+
+// Scratch memory for JSON documents parsed in place, such as with rapidjson's ParseInsitu and
+// a MemoryPoolAllocator over pool(). Each thread reuses its own, so that loading many files of
+// a similar size stops allocating after the first.
+struct json_arena
+{
+    // Room for size bytes of JSON, which the caller fills, followed by the terminator
+    char * text(std::size_t size);
+
+    // As large as the biggest document parsed so far has needed
+    std::span<char> pool();
+
+    // Takes the allocator's capacity after parsing, so that the next document of this size
+    // fits entirely in the pool
+    void record_pool_use(std::size_t capacity);
+
+private:
+    std::vector<char> text_;
+    std::vector<char> pool_;
+    std::size_t pool_needed_ = 1 << 16;
+};
+
+// The calling thread's arena
+json_arena & thread_json_arena();
@@ -0,0 +1,163 @@
+#include "light_probes.hpp"
+#include "triangle_bvh.hpp"
+
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+
+namespace
+{
+
+    using vec3 = light_probe_grid::vec3;
+
+    // Probes a thread takes at a time; probes between objects traverse more of the tree than
+    // those out in the open
+    constexpr std::size_t batch_size = 16;
+
+    constexpr float pi = 3.14159265f;
+
+    // Real spherical harmonics up to band 2 for a unit direction
+    std::array<float, 9> sh_basis(vec3 const & d)
+    {
+        float const x = d[0], y = d[1], z = d[2];
+        return {
+            0.282095f,
+            0.488603f * y,
+            0.488603f * z,
+            0.488603f * x,
+            1.092548f * x * y,
+            1.092548f * y * z,
+            0.315392f * (3.f * z * z - 1.f),
+            1.092548f * x * z,
+            0.546274f * (x * x - y * y),
+        };
+    }
+
+    // The clamped cosine in spherical harmonics is pi, 2 pi / 3 and pi / 4 per band, Ramamoorthi
+    // and Hanrahan 2001, divided by pi here
+    constexpr float band_scale[9] = {1.f, 2.f / 3.f, 2.f / 3.f, 2.f / 3.f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f};
+
+    // A Fibonacci spiral covers the sphere evenly enough for every ray to weigh the same
+    std::vector<vec3> sphere_directions(std::uint32_t count)
+    {
+        float const golden_angle = pi * (3.f - std::sqrt(5.f));
+
+        std::vector<vec3> result(count);
+        for (std::uint32_t i = 0; i < count; ++i)
+        {
+            float const y = 1.f - (2.f * i + 1.f) / count;
+            float const r = std::sqrt(std::max(0.f, 1.f - y * y));
+            float const phi = golden_angle * i;
+            result[i] = {r * std::cos(phi), y, r * std::sin(phi)};
+        }
+        return result;
+    }
+
+    vec3 escaped_radiance(light_probe_settings const & settings, vec3 const & d)
+    {
+        if (d[1] < 0.f)
+            return settings.ground;
+
+        vec3 result;
+        for (int c = 0; c < 3; ++c)
+            result[c] = settings.sky_horizon[c] + (settings.sky_zenith[c] - settings.sky_horizon[c]) * d[1];
+        return result;
+    }
+
+    std::array<float, 27> bake_probe(triangle_bvh const & scene, vec3 const & origin, std::vector<vec3> const & directions,
+        std::vector<std::array<float, 9>> const & basis, light_probe_settings const & settings)
+    {
+        std::array<float, 27> result{};
+        for (std::size_t i = 0; i < directions.size(); ++i)
+        {
+            vec3 const radiance = scene.occluded(origin, directions[i]) ? settings.bounce : escaped_radiance(settings, directions[i]);
+            for (int k = 0; k < 9; ++k)
+                for (int c = 0; c < 3; ++c)
+                    result[k * 3 + c] += radiance[c] * basis[i][k];
+        }
+
+        float const weight = 4.f * pi / directions.size();
+        for (int k = 0; k < 9; ++k)
+            for (int c = 0; c < 3; ++c)
+                result[k * 3 + c] *= weight * band_scale[k];
+        return result;
+    }
+
+}
+
+std::vector<float> light_probe_grid::texels() const
+{
+    std::size_t const slab = std::size_t(resolution[0]) * resolution[1] * resolution[2];
+
+    std::vector<float> result(slab * 27);
+    for (std::size_t p = 0; p < slab; ++p)
+        for (int k = 0; k < 9; ++k)
+            for (int c = 0; c < 3; ++c)
+                result[(k * slab + p) * 3 + c] = coefficients[p][k * 3 + c];
+    return result;
+}
+
+light_probe_grid bake_light_probes(triangle_bvh const & scene, vec3 const & min, vec3 const & max,
+    light_probe_settings const & settings, unsigned int thread_count)
+{
+    for (auto r : settings.resolution)
+        if (r < 2)
+            throw std::runtime_error("Light probe grid needs at least 2 probes along each axis");
+    if (settings.ray_count == 0)
+        throw std::runtime_error("Light probes need at least one ray");
+
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    light_probe_grid result;
+    result.min = min;
+    result.max = max;
+    result.resolution = settings.resolution;
+    result.coefficients.resize(std::size_t(settings.resolution[0]) * settings.resolution[1] * settings.resolution[2]);
+
+    auto const directions = sphere_directions(settings.ray_count);
+    std::vector<std::array<float, 9>> basis;
+    for (auto const & d : directions)
+        basis.push_back(sh_basis(d));
+
+    auto probe_position = [&](std::size_t index)
+    {
+        std::size_t const cell[3] = {
+            index % settings.resolution[0],
+            index / settings.resolution[0] % settings.resolution[1],
+            index / settings.resolution[0] / settings.resolution[1],
+        };
+
+        vec3 result;
+        for (int i = 0; i < 3; ++i)
+            result[i] = min[i] + (max[i] - min[i]) * float(cell[i]) / float(settings.resolution[i] - 1);
+        return result;
+    };
+
+    std::atomic<std::size_t> next_batch{0};
+    auto work = [&]
+    {
+        for (;;)
+        {
+            std::size_t const begin = next_batch.fetch_add(batch_size, std::memory_order_relaxed);
+            if (begin >= result.coefficients.size())
+                return;
+            std::size_t const end = std::min(begin + batch_size, result.coefficients.size());
+            for (std::size_t i = begin; i < end; ++i)
+                result.coefficients[i] = bake_probe(scene, probe_position(i), directions, basis, settings);
+        }
+    };
+
+    std::size_t const batches = (result.coefficients.size() + batch_size - 1) / batch_size;
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < std::min<std::size_t>(thread_count, batches); ++i)
+        threads.emplace_back(work);
+    work();
+
+    for (auto & thread : threads)
+        thread.join();
+
+    return result;
+}
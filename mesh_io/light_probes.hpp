@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+struct triangle_bvh;
+
+struct light_probe_settings
+{
+    using vec3 = std::array<float, 3>;
+
+    // Probes along each axis, at least 2, the first and last on the grid bounds
+    std::array<std::uint32_t, 3> resolution = {8, 4, 8};
+    // Rays cast from every probe, spread evenly over the sphere
+    std::uint32_t ray_count = 256;
+
+    // Radiance of the rays that escape, +Y being up: the sky blends from the horizon to the
+    // zenith, everything below the horizon is ground
+    vec3 sky_zenith = {0.25f, 0.25f, 0.3f};
+    vec3 sky_horizon = {0.2f, 0.2f, 0.2f};
+    vec3 ground = {0.1f, 0.1f, 0.1f};
+    // Radiance of the rays that hit the scene, one bounce of ambient light off its surfaces
+    // taken to be the same everywhere
+    vec3 bounce = {0.05f, 0.05f, 0.05f};
+};
+
+// Indirect light baked into a regular grid of probes, each holding the irradiance around it as
+// nine L2 spherical harmonics coefficients per color channel. The coefficients are convolved
+// with the clamped cosine and divided by pi, so that evaluating them for a normal gives what
+// multiplies the albedo, the way a constant ambient light does.
+struct light_probe_grid
+{
+    using vec3 = std::array<float, 3>;
+
+    vec3 min;
+    vec3 max;
+    std::array<std::uint32_t, 3> resolution;
+
+    // Per probe, X fastest, then Y, then Z: the coefficients in the order Y00, Y1-1, Y10, Y11,
+    // Y2-2, Y2-1, Y20, Y21, Y22, each as RGB
+    std::vector<std::array<float, 27>> coefficients;
+
+    std::size_t probe_count() const { return coefficients.size(); }
+
+    // The whole grid as one RGB 3D texture of resolution X by Y by 9 Z: coefficient i is the
+    // slab of layers from i * Z on. A lookup clamped to the texel centers of a slab filters
+    // trilinearly between the probes of that coefficient without touching the next one.
+    std::vector<float> texels() const;
+};
+
+// Casts the rays of every probe against the scene on thread_count threads, 0 meaning all
+// hardware threads; probes take the same directions, so the result does not depend on the
+// thread count. Probes that end up inside geometry see only bounce light, so the shaders should
+// look the grid up a bit off the surface.
+light_probe_grid bake_light_probes(triangle_bvh const & scene, light_probe_grid::vec3 const & min, light_probe_grid::vec3 const & max,
+    light_probe_settings const & settings = {}, unsigned int thread_count = 0);
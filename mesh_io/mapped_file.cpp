@@ -0,0 +1,97 @@
+#include "mapped_file.hpp"
+
+#include <stdexcept>
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef WIN32
+
+mapped_file::mapped_file(std::filesystem::path const & path)
+{
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Failed to open " + path.string());
+    file_ = file;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size))
+    {
+        CloseHandle(file);
+        throw std::runtime_error("Failed to get size of " + path.string());
+    }
+    size_ = size.QuadPart;
+
+    if (size_ == 0)
+        return;
+
+    mapping_ = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_)
+        data_ = static_cast<char const *>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+
+    if (!data_)
+    {
+        if (mapping_)
+            CloseHandle(mapping_);
+        CloseHandle(file);
+        throw std::runtime_error("Failed to map " + path.string());
+    }
+}
+
+mapped_file::~mapped_file()
+{
+    if (data_)
+        UnmapViewOfFile(data_);
+    if (mapping_)
+        CloseHandle(mapping_);
+    if (file_)
+        CloseHandle(file_);
+}
+
+#else
+
+mapped_file::mapped_file(std::filesystem::path const & path)
+{
+    fd_ = open(path.c_str(), O_RDONLY);
+    if (fd_ < 0)
+        throw std::runtime_error("Failed to open " + path.string());
+
+    struct stat info;
+    if (fstat(fd_, &info) != 0)
+    {
+        close(fd_);
+        throw std::runtime_error("Failed to get size of " + path.string());
+    }
+    size_ = info.st_size;
+
+    if (size_ == 0)
+        return;
+
+    void * data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (data == MAP_FAILED)
+    {
+        close(fd_);
+        throw std::runtime_error("Failed to map " + path.string());
+    }
+
+    madvise(data, size_, MADV_SEQUENTIAL);
+    data_ = static_cast<char const *>(data);
+}
+
+mapped_file::~mapped_file()
+{
+    if (data_)
+        munmap(const_cast<char *>(data_), size_);
+    if (fd_ >= 0)
+        close(fd_);
+}
+
+#endif
@@ -0,0 +1,55 @@
+#include "mesh_lod.hpp"
+#include "mesh_simplifier.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+std::vector<mesh_lod> build_lod_chain(obj_data const & mesh, std::size_t level_count, float ratio)
+{
+    std::vector<mesh_lod> result;
+    result.push_back({mesh, 0.f});
+
+    float target = mesh.indices.size() / 3;
+    for (std::size_t level = 1; level < level_count; ++level)
+    {
+        target *= ratio;
+        auto simplified = simplify_mesh(mesh, static_cast<std::size_t>(target) * 3);
+
+        // Locked borders and seams can make a level stop short of its target
+        if (simplified.mesh.indices.size() >= result.back().mesh.indices.size())
+            break;
+
+        result.push_back({std::move(simplified.mesh), std::max(simplified.error, result.back().error)});
+    }
+
+    return result;
+}
+
+float pixels_per_unit(float viewport_height, float vertical_fov)
+{
+    return viewport_height / (2.f * std::tan(vertical_fov / 2.f));
+}
+
+std::size_t select_lod(std::span<float const> errors, float distance, float pixels_per_unit, std::size_t current,
+    lod_selection_settings const & settings)
+{
+    if (errors.empty())
+        return 0;
+
+    current = std::min(current, errors.size() - 1);
+    float const scale = pixels_per_unit / std::max(distance, 1e-6f);
+
+    auto coarsest_within = [&](float threshold)
+    {
+        std::size_t level = 0;
+        while (level + 1 < errors.size() && errors[level + 1] * scale <= threshold)
+            ++level;
+        return level;
+    };
+
+    // Too coarse: refine right away
+    if (errors[current] * scale > settings.threshold_pixels)
+        return coarsest_within(settings.threshold_pixels);
+
+    return std::max(current, coarsest_within(settings.threshold_pixels * (1.f - settings.hysteresis)));
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "obj_parser.hpp"
+
+#include <vector>
+#include <span>
+
+struct mesh_lod
+{
+    obj_data mesh;
+    // In mesh units, see simplified_mesh::error; zero for the original mesh
+    float error;
+};
+
+// Level 0 is the mesh itself, every next level keeps about ratio of the previous level's triangles.
+// Each level is simplified from the original mesh, and errors never decrease along the chain.
+std::vector<mesh_lod> build_lod_chain(obj_data const & mesh, std::size_t level_count = 4, float ratio = 0.5f);
+
+struct lod_selection_settings
+{
+    // Largest acceptable error on screen
+    float threshold_pixels = 1.f;
+    // Switching to a coarser level needs its error below threshold_pixels * (1 - hysteresis),
+    // so that an object near the boundary does not flicker between two levels
+    float hysteresis = 0.25f;
+};
+
+// Screen space size in pixels of one unit at distance one, for a perspective projection
+float pixels_per_unit(float viewport_height, float vertical_fov);
+
+// Returns the coarsest level whose projected error is acceptable, given the level the object used last frame
+std::size_t select_lod(std::span<float const> errors, float distance, float pixels_per_unit, std::size_t current,
+    lod_selection_settings const & settings = {});
@@ -0,0 +1,211 @@
+#include "mesh_normals.hpp"
+
+#include <thread>
+#include <numeric>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+    using vec3 = std::array<float, 3>;
+
+    vec3 operator - (vec3 const & a, vec3 const & b) { return {a[0] - b[0], a[1] - b[1], a[2] - b[2]}; }
+    vec3 operator * (vec3 const & a, float s) { return {a[0] * s, a[1] * s, a[2] * s}; }
+
+    float dot(vec3 const & a, vec3 const & b) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+
+    vec3 cross(vec3 const & a, vec3 const & b)
+    {
+        return {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+    }
+
+    // Zero stays zero
+    vec3 normalize(vec3 const & v)
+    {
+        float const length = std::sqrt(dot(v, v));
+        return length > 0.f ? v * (1.f / length) : vec3{0.f, 0.f, 0.f};
+    }
+
+    // Below this many items per thread the threads cost more than they save
+    constexpr std::size_t min_items_per_thread = 16384;
+
+    template <typename Function>
+    void parallel_ranges(std::size_t count, unsigned int thread_count, Function const & function)
+    {
+        std::size_t const ranges = std::clamp<std::size_t>(count / min_items_per_thread, 1, thread_count);
+
+        std::vector<std::thread> threads;
+        for (std::size_t i = 1; i < ranges; ++i)
+            threads.emplace_back([&, i]{ function(count * i / ranges, count * (i + 1) / ranges); });
+        function(0, count / ranges);
+
+        for (auto & thread : threads)
+            thread.join();
+    }
+
+    struct triangle_normal
+    {
+        // Unit, zero for degenerate triangles
+        vec3 normal;
+        float area;
+    };
+
+}
+
+generated_normals generate_normals(std::span<std::array<float, 3> const> positions, std::span<std::uint32_t> indices,
+    float crease_angle, unsigned int thread_count)
+{
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    std::size_t const triangle_count = indices.size() / 3;
+
+    std::vector<triangle_normal> triangles(triangle_count);
+    std::vector<float> corner_angles(indices.size());
+    parallel_ranges(triangle_count, thread_count, [&](std::size_t begin, std::size_t end)
+    {
+        for (std::size_t t = begin; t < end; ++t)
+        {
+            vec3 const & p0 = positions[indices[3 * t + 0]];
+            vec3 const & p1 = positions[indices[3 * t + 1]];
+            vec3 const & p2 = positions[indices[3 * t + 2]];
+
+            vec3 const n = cross(p1 - p0, p2 - p0);
+            float const length = std::sqrt(dot(n, n));
+            triangles[t] = {normalize(n), length / 2.f};
+
+            vec3 const corners[3] = {p0, p1, p2};
+            for (int k = 0; k < 3; ++k)
+            {
+                vec3 const a = normalize(corners[(k + 1) % 3] - corners[k]);
+                vec3 const b = normalize(corners[(k + 2) % 3] - corners[k]);
+                corner_angles[3 * t + k] = std::acos(std::clamp(dot(a, b), -1.f, 1.f));
+            }
+        }
+    });
+
+    // Vertices with equal positions share an id, so that seams in the texcoords, which the
+    // OBJ and glTF both split vertices at, do not show up as seams in the shading
+    std::vector<std::uint32_t> order(positions.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b){ return positions[a] < positions[b]; });
+
+    std::vector<std::uint32_t> position_ids(positions.size());
+    std::size_t position_count = 0;
+    for (std::size_t i = 0; i < order.size(); ++i)
+    {
+        if (i > 0 && positions[order[i]] != positions[order[i - 1]])
+            ++position_count;
+        position_ids[order[i]] = position_count;
+    }
+    if (!order.empty())
+        ++position_count;
+
+    // Corners of every position, so that each one sums its own without atomics
+    std::vector<std::uint32_t> corner_offsets(position_count + 1, 0);
+    for (auto index : indices)
+        ++corner_offsets[position_ids[index] + 1];
+    std::partial_sum(corner_offsets.begin(), corner_offsets.end(), corner_offsets.begin());
+
+    std::vector<std::uint32_t> corners(indices.size());
+    {
+        std::vector<std::uint32_t> cursor(corner_offsets.begin(), corner_offsets.end() - 1);
+        for (std::size_t i = 0; i < indices.size(); ++i)
+            corners[cursor[position_ids[indices[i]]]++] = i;
+    }
+
+    float const min_cos = std::cos(crease_angle);
+
+    std::vector<vec3> corner_normals(indices.size());
+    parallel_ranges(position_count, thread_count, [&](std::size_t begin, std::size_t end)
+    {
+        for (std::size_t p = begin; p < end; ++p)
+            for (std::uint32_t c = corner_offsets[p]; c < corner_offsets[p + 1]; ++c)
+            {
+                vec3 const & own = triangles[corners[c] / 3].normal;
+                // A degenerate triangle has no side of the crease to be on, so it takes everything
+                bool const degenerate = own == vec3{0.f, 0.f, 0.f};
+
+                vec3 sum{0.f, 0.f, 0.f};
+                for (std::uint32_t d = corner_offsets[p]; d < corner_offsets[p + 1]; ++d)
+                {
+                    auto const & other = triangles[corners[d] / 3];
+                    if (!degenerate && dot(own, other.normal) < min_cos)
+                        continue;
+
+                    float const weight = other.area * corner_angles[corners[d]];
+                    for (int k = 0; k < 3; ++k)
+                        sum[k] += other.normal[k] * weight;
+                }
+
+                vec3 normal = normalize(sum);
+                if (normal == vec3{0.f, 0.f, 0.f})
+                    normal = {0.f, 1.f, 0.f};
+                corner_normals[corners[c]] = normal;
+            }
+    });
+
+    // Corners summing the same triangles in the same order get bitwise equal normals, so
+    // exact comparison finds the ones that can share a vertex
+    generated_normals result;
+    result.normals.resize(positions.size(), vec3{0.f, 0.f, 0.f});
+
+    std::vector<bool> assigned(positions.size(), false);
+    // Next copy of the same original vertex, 0 for none; copies are never vertex 0
+    std::vector<std::uint32_t> next_copy(positions.size(), 0);
+
+    for (std::size_t i = 0; i < indices.size(); ++i)
+    {
+        std::uint32_t const original = indices[i];
+        vec3 const & normal = corner_normals[i];
+
+        if (!assigned[original])
+        {
+            assigned[original] = true;
+            result.normals[original] = normal;
+            continue;
+        }
+
+        std::uint32_t v = original;
+        while (result.normals[v] != normal && next_copy[v] != 0)
+            v = next_copy[v];
+
+        if (result.normals[v] != normal)
+        {
+            std::uint32_t const copy = result.normals.size();
+            result.normals.push_back(normal);
+            result.copies.push_back(original);
+            next_copy.push_back(0);
+            next_copy[v] = copy;
+            v = copy;
+        }
+
+        indices[i] = v;
+    }
+
+    return result;
+}
+
+bool has_normals(obj_data const & mesh)
+{
+    return std::any_of(mesh.vertices.begin(), mesh.vertices.end(), [](obj_data::vertex const & v)
+    {
+        return v.normal != vec3{0.f, 0.f, 0.f};
+    });
+}
+
+void generate_normals(obj_data & mesh, float crease_angle, unsigned int thread_count)
+{
+    std::vector<vec3> positions(mesh.vertices.size());
+    for (std::size_t v = 0; v < mesh.vertices.size(); ++v)
+        positions[v] = mesh.vertices[v].position;
+
+    auto generated = generate_normals(positions, mesh.indices, crease_angle, thread_count);
+
+    mesh.vertices.reserve(generated.normals.size());
+    for (auto original : generated.copies)
+        mesh.vertices.push_back(mesh.vertices[original]);
+    for (std::size_t v = 0; v < mesh.vertices.size(); ++v)
+        mesh.vertices[v].normal = generated.normals[v];
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "obj_parser.hpp"
+
+#include <array>
+#include <vector>
+#include <span>
+#include <cstdint>
+
+// Faces meeting at a sharper angle than this, in radians, keep a hard edge between them
+constexpr float default_crease_angle = 1.0471976f;
+
+struct generated_normals
+{
+    // One per vertex: the original vertices first, then the copies made to split them
+    std::vector<std::array<float, 3>> normals;
+    // The original vertex every copy duplicates, in order
+    std::vector<std::uint32_t> copies;
+};
+
+// Smooth normals for a triangle list that has none. Corners at the same position, whatever
+// vertex they use, average the normals of their triangles, each weighted by the triangle's
+// area and the corner's angle, but only across triangles within crease_angle of their own.
+// A vertex whose corners end up with different normals is split into one copy per normal,
+// and indices are rewritten to point at the copies.
+// Runs on thread_count threads, 0 meaning all hardware threads.
+generated_normals generate_normals(std::span<std::array<float, 3> const> positions, std::span<std::uint32_t> indices,
+    float crease_angle = default_crease_angle, unsigned int thread_count = 0);
+
+// False when every normal is zero, which is what parse_obj leaves without vn entries
+bool has_normals(obj_data const & mesh);
+
+// Replaces the normals of the whole mesh with generated ones, splitting vertices as above
+void generate_normals(obj_data & mesh, float crease_angle = default_crease_angle, unsigned int thread_count = 0);
@@ -0,0 +1,365 @@
+#include "mesh_optimizer.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+
+    constexpr std::size_t forsyth_cache_size = 32;
+
+    // Scores from "Linear-Speed Vertex Cache Optimisation" by Tom Forsyth
+    float forsyth_vertex_score(int cache_position, std::uint32_t remaining_triangles)
+    {
+        if (remaining_triangles == 0)
+            return -1.f;
+
+        float score = 0.f;
+        if (cache_position >= 0)
+        {
+            if (cache_position < 3)
+                score = 0.75f;
+            else
+                score = std::pow(1.f - float(cache_position - 3) / float(forsyth_cache_size - 3), 1.5f);
+        }
+
+        return score + 2.f / std::sqrt(float(remaining_triangles));
+    }
+
+    // Compressed lists of triangles adjacent to each vertex
+    struct vertex_adjacency
+    {
+        std::vector<std::uint32_t> offsets;
+        std::vector<std::uint32_t> counts;
+        std::vector<std::uint32_t> triangles;
+
+        vertex_adjacency(std::vector<std::uint32_t> const & indices, std::size_t vertex_count)
+            : offsets(vertex_count + 1, 0)
+            , counts(vertex_count, 0)
+            , triangles(indices.size())
+        {
+            for (auto index : indices)
+                ++counts[index];
+
+            std::partial_sum(counts.begin(), counts.end(), offsets.begin() + 1);
+
+            std::fill(counts.begin(), counts.end(), 0);
+            for (std::size_t i = 0; i < indices.size(); ++i)
+            {
+                auto index = indices[i];
+                triangles[offsets[index] + counts[index]++] = i / 3;
+            }
+        }
+
+        void remove(std::uint32_t vertex, std::uint32_t triangle)
+        {
+            auto begin = triangles.begin() + offsets[vertex];
+            auto end = begin + counts[vertex];
+            auto it = std::find(begin, end, triangle);
+            *it = *(end - 1);
+            --counts[vertex];
+        }
+    };
+
+    // Rewrites the index buffer with the triangles in the given order. Each submesh keeps its
+    // index range and gets its own triangles in the order they appear.
+    void reorder_triangles(obj_data & mesh, std::vector<std::uint32_t> const & order)
+    {
+        auto const & indices = mesh.indices;
+        std::vector<std::uint32_t> result(indices.size());
+
+        if (mesh.submeshes.size() <= 1)
+        {
+            for (std::size_t i = 0; i < order.size(); ++i)
+                std::copy_n(indices.begin() + 3 * order[i], 3, result.begin() + 3 * i);
+            mesh.indices = std::move(result);
+            return;
+        }
+
+        std::vector<std::uint32_t> triangle_submesh(order.size());
+        std::vector<std::size_t> cursor(mesh.submeshes.size());
+        for (std::size_t s = 0; s < mesh.submeshes.size(); ++s)
+        {
+            auto const & submesh = mesh.submeshes[s];
+            std::fill_n(triangle_submesh.begin() + submesh.first_index / 3, submesh.index_count / 3, s);
+            cursor[s] = submesh.first_index;
+        }
+
+        for (auto t : order)
+        {
+            auto & c = cursor[triangle_submesh[t]];
+            std::copy_n(indices.begin() + 3 * t, 3, result.begin() + c);
+            c += 3;
+        }
+
+        mesh.indices = std::move(result);
+    }
+
+}
+
+vertex_cache_stats analyze_vertex_cache(obj_data const & mesh, std::size_t cache_size)
+{
+    std::vector<std::size_t> cache_time(mesh.vertices.size(), 0);
+    std::vector<bool> used(mesh.vertices.size(), false);
+
+    // A vertex is in a FIFO cache if fewer than cache_size misses happened since it was loaded
+    std::size_t misses = 0;
+    std::size_t unique = 0;
+    for (auto index : mesh.indices)
+    {
+        if (!used[index])
+        {
+            used[index] = true;
+            ++unique;
+        }
+        else if (misses - cache_time[index] < cache_size)
+            continue;
+
+        ++misses;
+        cache_time[index] = misses;
+    }
+
+    std::size_t triangle_count = mesh.indices.size() / 3;
+    return vertex_cache_stats
+    {
+        triangle_count == 0 ? 0.f : float(misses) / float(triangle_count),
+        unique == 0 ? 0.f : float(misses) / float(unique),
+    };
+}
+
+void optimize_vertex_cache(obj_data & mesh)
+{
+    std::size_t const triangle_count = mesh.indices.size() / 3;
+    if (triangle_count == 0)
+        return;
+
+    auto const & indices = mesh.indices;
+    vertex_adjacency adjacency(indices, mesh.vertices.size());
+
+    std::vector<int> cache_position(mesh.vertices.size(), -1);
+    std::vector<float> vertex_score(mesh.vertices.size());
+    for (std::size_t v = 0; v < mesh.vertices.size(); ++v)
+        vertex_score[v] = forsyth_vertex_score(-1, adjacency.counts[v]);
+
+    std::vector<float> triangle_score(triangle_count);
+    for (std::size_t t = 0; t < triangle_count; ++t)
+        triangle_score[t] = vertex_score[indices[3 * t]] + vertex_score[indices[3 * t + 1]] + vertex_score[indices[3 * t + 2]];
+
+    std::vector<bool> emitted(triangle_count, false);
+    std::vector<std::uint32_t> order;
+    order.reserve(triangle_count);
+
+    // LRU cache with room for the three vertices pushed by the next triangle
+    std::vector<std::uint32_t> cache, new_cache;
+    cache.reserve(forsyth_cache_size + 3);
+    new_cache.reserve(forsyth_cache_size + 3);
+
+    std::size_t best = std::max_element(triangle_score.begin(), triangle_score.end()) - triangle_score.begin();
+    std::size_t scan_cursor = 0;
+
+    for (std::size_t emitted_count = 0; emitted_count < triangle_count; ++emitted_count)
+    {
+        if (best == triangle_count)
+        {
+            // Nothing in the cache has remaining triangles, continue from the next unused one
+            while (emitted[scan_cursor])
+                ++scan_cursor;
+            best = scan_cursor;
+        }
+
+        emitted[best] = true;
+        order.push_back(best);
+
+        new_cache.clear();
+        for (int k = 0; k < 3; ++k)
+        {
+            auto v = indices[3 * best + k];
+            new_cache.push_back(v);
+            adjacency.remove(v, best);
+        }
+
+        for (auto v : cache)
+            if (std::find(new_cache.begin(), new_cache.begin() + 3, v) == new_cache.begin() + 3)
+                new_cache.push_back(v);
+
+        for (std::size_t i = 0; i < new_cache.size(); ++i)
+        {
+            auto v = new_cache[i];
+            cache_position[v] = (i < forsyth_cache_size) ? int(i) : -1;
+            vertex_score[v] = forsyth_vertex_score(cache_position[v], adjacency.counts[v]);
+        }
+
+        // Only triangles touching the updated vertices change their score
+        best = triangle_count;
+        float best_score = std::numeric_limits<float>::lowest();
+        for (auto v : new_cache)
+        {
+            auto begin = adjacency.triangles.begin() + adjacency.offsets[v];
+            auto end = begin + adjacency.counts[v];
+            for (auto it = begin; it != end; ++it)
+            {
+                auto t = *it;
+                float score = vertex_score[indices[3 * t]] + vertex_score[indices[3 * t + 1]] + vertex_score[indices[3 * t + 2]];
+                triangle_score[t] = score;
+                if (score > best_score)
+                {
+                    best_score = score;
+                    best = t;
+                }
+            }
+        }
+
+        if (new_cache.size() > forsyth_cache_size)
+            new_cache.resize(forsyth_cache_size);
+        std::swap(cache, new_cache);
+    }
+
+    reorder_triangles(mesh, order);
+}
+
+void optimize_overdraw(obj_data & mesh, std::size_t cache_size)
+{
+    std::size_t const triangle_count = mesh.indices.size() / 3;
+    if (triangle_count == 0)
+        return;
+
+    auto const & indices = mesh.indices;
+
+    // Split the triangle order into clusters at points where the cache is fully
+    // reloaded; reordering whole clusters then barely affects the cache hit rate
+    std::vector<std::size_t> cluster_begin;
+    {
+        std::vector<std::size_t> cache_time(mesh.vertices.size(), 0);
+        std::vector<bool> used(mesh.vertices.size(), false);
+        std::size_t misses = 0;
+
+        for (std::size_t t = 0; t < triangle_count; ++t)
+        {
+            int triangle_misses = 0;
+            for (int k = 0; k < 3; ++k)
+            {
+                auto v = indices[3 * t + k];
+                if (used[v] && misses - cache_time[v] < cache_size)
+                    continue;
+
+                used[v] = true;
+                ++misses;
+                cache_time[v] = misses;
+                ++triangle_misses;
+            }
+
+            if (t == 0 || triangle_misses == 3)
+                cluster_begin.push_back(t);
+        }
+        cluster_begin.push_back(triangle_count);
+    }
+
+    auto position = [&](std::uint32_t index)
+    {
+        auto const & p = mesh.vertices[index].position;
+        return std::array<double, 3>{p[0], p[1], p[2]};
+    };
+
+    std::array<double, 3> mesh_center{0.0, 0.0, 0.0};
+    for (auto const & v : mesh.vertices)
+        for (int i = 0; i < 3; ++i)
+            mesh_center[i] += v.position[i];
+    for (int i = 0; i < 3; ++i)
+        mesh_center[i] /= double(mesh.vertices.size());
+
+    // Clusters facing away from the mesh center are likely to occlude the rest
+    std::size_t const cluster_count = cluster_begin.size() - 1;
+    std::vector<double> cluster_key(cluster_count);
+    for (std::size_t c = 0; c < cluster_count; ++c)
+    {
+        std::array<double, 3> center{0.0, 0.0, 0.0};
+        std::array<double, 3> normal{0.0, 0.0, 0.0};
+        double area_total = 0.0;
+
+        for (std::size_t t = cluster_begin[c]; t < cluster_begin[c + 1]; ++t)
+        {
+            auto p0 = position(indices[3 * t]);
+            auto p1 = position(indices[3 * t + 1]);
+            auto p2 = position(indices[3 * t + 2]);
+
+            std::array<double, 3> e1{p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+            std::array<double, 3> e2{p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+            std::array<double, 3> n
+            {
+                e1[1] * e2[2] - e1[2] * e2[1],
+                e1[2] * e2[0] - e1[0] * e2[2],
+                e1[0] * e2[1] - e1[1] * e2[0],
+            };
+
+            double area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (int i = 0; i < 3; ++i)
+            {
+                center[i] += (p0[i] + p1[i] + p2[i]) * area / 3.0;
+                normal[i] += n[i];
+            }
+            area_total += area;
+        }
+
+        double normal_length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (area_total == 0.0 || normal_length == 0.0)
+        {
+            cluster_key[c] = 0.0;
+            continue;
+        }
+
+        double key = 0.0;
+        for (int i = 0; i < 3; ++i)
+            key += (center[i] / area_total - mesh_center[i]) * normal[i] / normal_length;
+        cluster_key[c] = key;
+    }
+
+    std::vector<std::size_t> cluster_order(cluster_count);
+    std::iota(cluster_order.begin(), cluster_order.end(), 0);
+    std::stable_sort(cluster_order.begin(), cluster_order.end(), [&](std::size_t a, std::size_t b){
+        return cluster_key[a] > cluster_key[b];
+    });
+
+    std::vector<std::uint32_t> order;
+    order.reserve(triangle_count);
+    for (auto c : cluster_order)
+        for (std::size_t t = cluster_begin[c]; t < cluster_begin[c + 1]; ++t)
+            order.push_back(t);
+
+    reorder_triangles(mesh, order);
+}
+
+void optimize_vertex_fetch(obj_data & mesh)
+{
+    auto const unused = std::numeric_limits<std::uint32_t>::max();
+    std::vector<std::uint32_t> remap(mesh.vertices.size(), unused);
+
+    std::vector<obj_data::vertex> vertices;
+    vertices.reserve(mesh.vertices.size());
+
+    std::vector<std::array<float, 4>> tangents;
+    tangents.reserve(mesh.tangents.size());
+
+    std::vector<std::uint8_t> occlusion;
+    occlusion.reserve(mesh.occlusion.size());
+
+    for (auto & index : mesh.indices)
+    {
+        if (remap[index] == unused)
+        {
+            remap[index] = vertices.size();
+            vertices.push_back(mesh.vertices[index]);
+            if (!mesh.tangents.empty())
+                tangents.push_back(mesh.tangents[index]);
+            if (!mesh.occlusion.empty())
+                occlusion.push_back(mesh.occlusion[index]);
+        }
+        index = remap[index];
+    }
+
+    mesh.vertices = std::move(vertices);
+    mesh.tangents = std::move(tangents);
+    mesh.occlusion = std::move(occlusion);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "obj_parser.hpp"
+
+struct vertex_cache_stats
+{
+    // Average cache miss ratio, i.e. transformed vertices per triangle
+    float acmr;
+    // Average transformed vertex ratio, i.e. transformed vertices per unique vertex
+    float atvr;
+};
+
+// Simulates a FIFO post-transform cache of cache_size entries over the index buffer
+vertex_cache_stats analyze_vertex_cache(obj_data const & mesh, std::size_t cache_size = 16);
+
+// Reorders triangles for post-transform cache locality (Forsyth's linear-speed algorithm).
+// Like optimize_overdraw, moves triangles only within their submesh.
+void optimize_vertex_cache(obj_data & mesh);
+
+// Reorders clusters of triangles so that outward-facing ones are drawn first;
+// expects an index buffer already optimized for the vertex cache
+void optimize_overdraw(obj_data & mesh, std::size_t cache_size = 16);
+
+// Reorders vertices in order of first use so that vertex fetches are close to linear
+void optimize_vertex_fetch(obj_data & mesh);
@@ -0,0 +1,312 @@
+#include "mesh_simplifier.hpp"
+#include "mesh_optimizer.hpp"
+
+#include <vector>
+#include <array>
+#include <queue>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+namespace
+{
+
+    using vec3 = std::array<double, 3>;
+
+    vec3 position(obj_data::vertex const & vertex)
+    {
+        return {vertex.position[0], vertex.position[1], vertex.position[2]};
+    }
+
+    vec3 sub(vec3 const & a, vec3 const & b)
+    {
+        return {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+    }
+
+    vec3 cross(vec3 const & a, vec3 const & b)
+    {
+        return {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+    }
+
+    double dot(vec3 const & a, vec3 const & b)
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    // Sum of squared distances to a set of planes, stored as the upper triangle of a symmetric 4x4 matrix
+    struct quadric
+    {
+        std::array<double, 10> q{};
+
+        static quadric plane(vec3 const & n, double d)
+        {
+            quadric result;
+            result.q = {
+                n[0] * n[0], n[0] * n[1], n[0] * n[2], n[0] * d,
+                             n[1] * n[1], n[1] * n[2], n[1] * d,
+                                          n[2] * n[2], n[2] * d,
+                                                       d * d,
+            };
+            return result;
+        }
+
+        quadric & operator += (quadric const & other)
+        {
+            for (std::size_t i = 0; i < q.size(); ++i)
+                q[i] += other.q[i];
+            return *this;
+        }
+
+        double error(vec3 const & p) const
+        {
+            double const x = p[0], y = p[1], z = p[2];
+            return q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x
+                + q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y
+                + q[7] * z * z + 2.0 * q[8] * z
+                + q[9];
+        }
+    };
+
+    struct collapse
+    {
+        double cost;
+        std::uint32_t from;
+        std::uint32_t to;
+        std::uint32_t from_version;
+        std::uint32_t to_version;
+
+        bool operator > (collapse const & other) const { return cost > other.cost; }
+    };
+
+    std::uint64_t edge_key(std::uint32_t a, std::uint32_t b)
+    {
+        if (a > b) std::swap(a, b);
+        return (std::uint64_t(a) << 32) | b;
+    }
+
+}
+
+simplified_mesh simplify_mesh(obj_data const & mesh, std::size_t target_index_count, float max_error)
+{
+    std::size_t const vertex_count = mesh.vertices.size();
+    std::size_t const triangle_count = mesh.indices.size() / 3;
+
+    // Vertices split by normals or texture coordinates share a position; weld them to find seams
+    std::vector<std::uint32_t> welded(vertex_count);
+    std::vector<std::uint32_t> weld_count(vertex_count, 0);
+    {
+        struct position_hash
+        {
+            std::size_t operator()(std::array<float, 3> const & p) const
+            {
+                std::array<std::uint32_t, 3> bits;
+                std::memcpy(bits.data(), p.data(), sizeof(bits));
+                return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+            }
+        };
+
+        std::unordered_map<std::array<float, 3>, std::uint32_t, position_hash> first_vertex;
+        first_vertex.reserve(vertex_count);
+        for (std::uint32_t i = 0; i < vertex_count; ++i)
+        {
+            welded[i] = first_vertex.try_emplace(mesh.vertices[i].position, i).first->second;
+            ++weld_count[welded[i]];
+        }
+    }
+
+    std::vector<bool> locked(vertex_count, false);
+    for (std::uint32_t i = 0; i < vertex_count; ++i)
+        locked[i] = weld_count[welded[i]] > 1;
+
+    // Border edges belong to a single triangle
+    {
+        std::unordered_map<std::uint64_t, std::uint32_t> edge_use;
+        edge_use.reserve(mesh.indices.size());
+        for (std::size_t t = 0; t < triangle_count; ++t)
+            for (int e = 0; e < 3; ++e)
+                ++edge_use[edge_key(welded[mesh.indices[3 * t + e]], welded[mesh.indices[3 * t + (e + 1) % 3]])];
+
+        std::vector<bool> border(vertex_count, false);
+        for (auto const & [key, count] : edge_use)
+        {
+            if (count != 1) continue;
+            border[key >> 32] = true;
+            border[key & 0xffffffffu] = true;
+        }
+
+        for (std::uint32_t i = 0; i < vertex_count; ++i)
+            if (border[welded[i]])
+                locked[i] = true;
+    }
+
+    std::vector<std::array<std::uint32_t, 3>> triangles(triangle_count);
+    std::vector<bool> triangle_alive(triangle_count, true);
+    std::vector<quadric> quadrics(vertex_count);
+    std::vector<std::vector<std::uint32_t>> vertex_triangles(vertex_count);
+
+    for (std::uint32_t t = 0; t < triangle_count; ++t)
+    {
+        auto & triangle = triangles[t];
+        for (int k = 0; k < 3; ++k)
+            triangle[k] = mesh.indices[3 * t + k];
+
+        vec3 const p0 = position(mesh.vertices[triangle[0]]);
+        vec3 n = cross(sub(position(mesh.vertices[triangle[1]]), p0), sub(position(mesh.vertices[triangle[2]]), p0));
+        double const length = std::sqrt(dot(n, n));
+        if (length > 0.0)
+        {
+            n = {n[0] / length, n[1] / length, n[2] / length};
+            auto const plane = quadric::plane(n, -dot(n, p0));
+            for (auto v : triangle)
+                quadrics[v] += plane;
+        }
+
+        for (auto v : triangle)
+            vertex_triangles[v].push_back(t);
+    }
+
+    std::vector<bool> vertex_alive(vertex_count, true);
+    std::vector<std::uint32_t> version(vertex_count, 0);
+
+    std::priority_queue<collapse, std::vector<collapse>, std::greater<>> queue;
+
+    auto push = [&](std::uint32_t from, std::uint32_t to)
+    {
+        if (locked[from]) return;
+
+        quadric q = quadrics[from];
+        q += quadrics[to];
+        queue.push({q.error(position(mesh.vertices[to])), from, to, version[from], version[to]});
+    };
+
+    for (auto const & triangle : triangles)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            push(triangle[k], triangle[(k + 1) % 3]);
+            push(triangle[(k + 1) % 3], triangle[k]);
+        }
+    }
+
+    // Moving from onto to must keep every remaining triangle around from facing the same way
+    auto flips = [&](std::uint32_t from, std::uint32_t to)
+    {
+        vec3 const target = position(mesh.vertices[to]);
+        for (auto t : vertex_triangles[from])
+        {
+            if (!triangle_alive[t]) continue;
+
+            auto const & triangle = triangles[t];
+            if (std::find(triangle.begin(), triangle.end(), to) != triangle.end())
+                continue;
+
+            std::array<vec3, 3> before, after;
+            for (int k = 0; k < 3; ++k)
+            {
+                before[k] = position(mesh.vertices[triangle[k]]);
+                after[k] = (triangle[k] == from) ? target : before[k];
+            }
+
+            vec3 const n0 = cross(sub(before[1], before[0]), sub(before[2], before[0]));
+            vec3 const n1 = cross(sub(after[1], after[0]), sub(after[2], after[0]));
+            if (dot(n0, n1) <= 0.0)
+                return true;
+        }
+        return false;
+    };
+
+    std::size_t alive_triangles = triangle_count;
+    double largest_cost = 0.0;
+    double const max_cost = double(max_error) * double(max_error);
+
+    while (alive_triangles * 3 > target_index_count && !queue.empty())
+    {
+        auto const candidate = queue.top();
+        queue.pop();
+
+        auto const from = candidate.from;
+        auto const to = candidate.to;
+        if (!vertex_alive[from] || !vertex_alive[to])
+            continue;
+        if (version[from] != candidate.from_version || version[to] != candidate.to_version)
+            continue;
+        if (candidate.cost > max_cost)
+            break;
+        if (flips(from, to))
+            continue;
+
+        largest_cost = std::max(largest_cost, candidate.cost);
+
+        vertex_alive[from] = false;
+        quadrics[to] += quadrics[from];
+        ++version[to];
+
+        for (auto t : vertex_triangles[from])
+        {
+            if (!triangle_alive[t]) continue;
+
+            auto & triangle = triangles[t];
+            if (std::find(triangle.begin(), triangle.end(), to) != triangle.end())
+            {
+                triangle_alive[t] = false;
+                --alive_triangles;
+                continue;
+            }
+
+            std::replace(triangle.begin(), triangle.end(), from, to);
+            vertex_triangles[to].push_back(t);
+        }
+        vertex_triangles[from].clear();
+
+        // Drop dead triangles, so that heavily merged vertices stay cheap to visit
+        auto & around = vertex_triangles[to];
+        around.erase(std::remove_if(around.begin(), around.end(), [&](std::uint32_t t){ return !triangle_alive[t]; }), around.end());
+
+        for (auto t : around)
+        {
+            for (auto v : triangles[t])
+            {
+                if (v == to) continue;
+                push(to, v);
+                push(v, to);
+            }
+        }
+    }
+
+    simplified_mesh result;
+    result.error = std::sqrt(largest_cost);
+    result.mesh.vertices = mesh.vertices;
+    result.mesh.tangents = mesh.tangents;
+    result.mesh.occlusion = mesh.occlusion;
+    for (std::size_t t = 0; t < triangle_count; ++t)
+    {
+        if (!triangle_alive[t]) continue;
+        result.mesh.indices.insert(result.mesh.indices.end(), triangles[t].begin(), triangles[t].end());
+    }
+
+    // Surviving triangles keep their order, so every submesh shrinks in place
+    result.mesh.materials = mesh.materials;
+    result.mesh.material_libraries = mesh.material_libraries;
+    std::size_t first_index = 0;
+    for (auto submesh : mesh.submeshes)
+    {
+        std::size_t index_count = 0;
+        for (std::size_t t = submesh.first_index / 3; t < (submesh.first_index + submesh.index_count) / 3; ++t)
+            if (triangle_alive[t])
+                index_count += 3;
+
+        if (index_count == 0) continue;
+
+        submesh.first_index = first_index;
+        submesh.index_count = index_count;
+        result.mesh.submeshes.push_back(std::move(submesh));
+        first_index += index_count;
+    }
+
+    // Also drops the vertices no triangle uses anymore
+    optimize_vertex_fetch(result.mesh);
+    compute_submesh_bounds(result.mesh);
+
+    return result;
+}
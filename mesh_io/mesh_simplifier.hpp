@@ -0,0 +1,20 @@
+#pragma once
+
+#include "obj_parser.hpp"
+
+#include <limits>
+
+struct simplified_mesh
+{
+    obj_data mesh;
+    // Square root of the largest quadric error among the collapses made,
+    // roughly how far in mesh units the surface moved
+    float error;
+};
+
+// Collapses edges onto one of their endpoints in order of quadric error (Garland and Heckbert)
+// until at most target_index_count indices remain or every remaining collapse costs more than
+// max_error. Vertices on open borders and attribute seams never move, so the result does not
+// tear there, and collapses that would flip a triangle are skipped.
+simplified_mesh simplify_mesh(obj_data const & mesh, std::size_t target_index_count,
+    float max_error = std::numeric_limits<float>::infinity());
@@ -0,0 +1,232 @@
+#include "mesh_tangents.hpp"
+
+#include <vector>
+#include <span>
+#include <thread>
+#include <numeric>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+    using vec3 = std::array<float, 3>;
+
+    vec3 operator - (vec3 const & a, vec3 const & b) { return {a[0] - b[0], a[1] - b[1], a[2] - b[2]}; }
+    vec3 operator * (vec3 const & a, float s) { return {a[0] * s, a[1] * s, a[2] * s}; }
+
+    float dot(vec3 const & a, vec3 const & b) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+
+    vec3 cross(vec3 const & a, vec3 const & b)
+    {
+        return {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+    }
+
+    // Zero stays zero
+    vec3 normalize(vec3 const & v)
+    {
+        float const length = std::sqrt(dot(v, v));
+        return length > 0.f ? v * (1.f / length) : vec3{0.f, 0.f, 0.f};
+    }
+
+    vec3 project(vec3 const & v, vec3 const & n)
+    {
+        return v - n * dot(n, v);
+    }
+
+    // Below this many items per thread the threads cost more than they save
+    constexpr std::size_t min_items_per_thread = 16384;
+
+    template <typename Function>
+    void parallel_ranges(std::size_t count, unsigned int thread_count, Function const & function)
+    {
+        std::size_t const ranges = std::clamp<std::size_t>(count / min_items_per_thread, 1, thread_count);
+
+        std::vector<std::thread> threads;
+        for (std::size_t i = 1; i < ranges; ++i)
+            threads.emplace_back([&, i]{ function(count * i / ranges, count * (i + 1) / ranges); });
+        function(0, count / ranges);
+
+        for (auto & thread : threads)
+            thread.join();
+    }
+
+    struct triangle_tangent
+    {
+        // Unnormalized tangent along u, zero when the texcoords are degenerate
+        vec3 tangent;
+        // Whether the texcoords keep the winding, i.e. the bitangent sign
+        bool orientation_preserving;
+    };
+
+    template <typename Position, typename Texcoord>
+    std::vector<triangle_tangent> triangle_tangents(std::span<std::uint32_t const> indices, Position const & position, Texcoord const & texcoord,
+        unsigned int thread_count)
+    {
+        std::size_t const triangle_count = indices.size() / 3;
+
+        std::vector<triangle_tangent> triangles(triangle_count);
+        parallel_ranges(triangle_count, thread_count, [&](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t t = begin; t < end; ++t)
+            {
+                std::uint32_t const i0 = indices[3 * t + 0], i1 = indices[3 * t + 1], i2 = indices[3 * t + 2];
+
+                vec3 const e1 = position(i1) - position(i0);
+                vec3 const e2 = position(i2) - position(i0);
+                float const du1 = texcoord(i1)[0] - texcoord(i0)[0], dv1 = texcoord(i1)[1] - texcoord(i0)[1];
+                float const du2 = texcoord(i2)[0] - texcoord(i0)[0], dv2 = texcoord(i2)[1] - texcoord(i0)[1];
+
+                // Twice the signed texcoord area, as in MikkTSpace
+                float const area = du1 * dv2 - du2 * dv1;
+                vec3 tangent = e1 * dv2 - e2 * dv1;
+                if (area == 0.f)
+                    tangent = {0.f, 0.f, 0.f};
+                else if (area < 0.f)
+                    tangent = tangent * -1.f;
+
+                triangles[t] = {tangent, area >= 0.f};
+            }
+        });
+        return triangles;
+    }
+
+    // Sums the corners of every vertex whose triangles have the orientation of its sign
+    template <typename Position, typename Normal>
+    std::vector<std::array<float, 4>> vertex_tangents(std::span<std::uint32_t const> indices, std::vector<triangle_tangent> const & triangles,
+        std::vector<float> const & signs, Position const & position, Normal const & normal_of, unsigned int thread_count)
+    {
+        std::size_t const vertex_count = signs.size();
+
+        // Corners of every vertex, so that each vertex sums its own without atomics
+        std::vector<std::uint32_t> corner_offsets(vertex_count + 1, 0);
+        for (auto index : indices)
+            ++corner_offsets[index + 1];
+        std::partial_sum(corner_offsets.begin(), corner_offsets.end(), corner_offsets.begin());
+
+        std::vector<std::uint32_t> corners(indices.size());
+        {
+            std::vector<std::uint32_t> cursor(corner_offsets.begin(), corner_offsets.end() - 1);
+            for (std::size_t i = 0; i < indices.size(); ++i)
+                corners[cursor[indices[i]]++] = i;
+        }
+
+        std::vector<std::array<float, 4>> tangents(vertex_count);
+        parallel_ranges(vertex_count, thread_count, [&](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t v = begin; v < end; ++v)
+            {
+                vec3 const normal = normalize(normal_of(v));
+
+                vec3 sum{0.f, 0.f, 0.f};
+                for (std::uint32_t c = corner_offsets[v]; c < corner_offsets[v + 1]; ++c)
+                {
+                    std::size_t const corner = corners[c];
+                    std::size_t const t = corner / 3;
+                    if (triangles[t].orientation_preserving != (signs[v] > 0.f)) continue;
+                    vec3 const tangent = normalize(project(triangles[t].tangent, normal));
+                    if (tangent == vec3{0.f, 0.f, 0.f}) continue;
+
+                    auto const & p = position(indices[corner]);
+                    vec3 const a = normalize(project(position(indices[3 * t + (corner + 1) % 3]) - p, normal));
+                    vec3 const b = normalize(project(position(indices[3 * t + (corner + 2) % 3]) - p, normal));
+                    float const angle = std::acos(std::clamp(dot(a, b), -1.f, 1.f));
+
+                    for (int k = 0; k < 3; ++k)
+                        sum[k] += tangent[k] * angle;
+                }
+
+                vec3 tangent = normalize(project(sum, normal));
+                if (tangent == vec3{0.f, 0.f, 0.f})
+                {
+                    // Any direction in the normal's plane
+                    vec3 const axis = std::abs(normal[0]) < 0.9f ? vec3{1.f, 0.f, 0.f} : vec3{0.f, 1.f, 0.f};
+                    tangent = normalize(cross(normal, axis));
+                    if (tangent == vec3{0.f, 0.f, 0.f})
+                        tangent = {1.f, 0.f, 0.f};
+                }
+
+                tangents[v] = {tangent[0], tangent[1], tangent[2], signs[v]};
+            }
+        });
+        return tangents;
+    }
+
+}
+
+void generate_tangents(obj_data & mesh, unsigned int thread_count)
+{
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    auto const position = [&](std::size_t v) -> vec3 const & { return mesh.vertices[v].position; };
+    auto const texcoord = [&](std::size_t v) -> std::array<float, 2> const & { return mesh.vertices[v].texcoord; };
+    auto const normal = [&](std::size_t v) -> vec3 const & { return mesh.vertices[v].normal; };
+
+    auto const triangles = triangle_tangents(mesh.indices, position, texcoord, thread_count);
+
+    // Vertices used by triangles of both orientations get a copy for the mirrored ones.
+    // Triangles with degenerate texcoords follow whichever orientation the vertex has.
+    std::vector<std::uint8_t> orientations(mesh.vertices.size(), 0);
+    for (std::size_t i = 0; i < mesh.indices.size(); ++i)
+    {
+        auto const & triangle = triangles[i / 3];
+        if (triangle.tangent != vec3{0.f, 0.f, 0.f})
+            orientations[mesh.indices[i]] |= triangle.orientation_preserving ? 1 : 2;
+    }
+
+    std::vector<std::uint32_t> mirrored_copy(mesh.vertices.size(), 0);
+    std::size_t const original_vertex_count = mesh.vertices.size();
+    for (std::size_t v = 0; v < original_vertex_count; ++v)
+    {
+        if (orientations[v] != 3) continue;
+        mirrored_copy[v] = mesh.vertices.size();
+        mesh.vertices.push_back(mesh.vertices[v]);
+    }
+
+    for (std::size_t i = 0; i < mesh.indices.size(); ++i)
+    {
+        auto & index = mesh.indices[i];
+        if (orientations[index] == 3 && !triangles[i / 3].orientation_preserving)
+            index = mirrored_copy[index];
+    }
+
+    std::vector<float> signs(mesh.vertices.size(), 1.f);
+    for (std::size_t v = 0; v < original_vertex_count; ++v)
+    {
+        if (orientations[v] == 2)
+            signs[v] = -1.f;
+        else if (orientations[v] == 3)
+            signs[mirrored_copy[v]] = -1.f;
+    }
+
+    mesh.tangents = vertex_tangents(mesh.indices, triangles, signs, position, normal, thread_count);
+}
+
+std::vector<std::array<float, 4>> generate_tangents(std::span<std::array<float, 3> const> positions, std::span<std::array<float, 3> const> normals,
+    std::span<std::array<float, 2> const> texcoords, std::span<std::uint32_t const> indices, unsigned int thread_count)
+{
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    auto const position = [&](std::size_t v) -> vec3 const & { return positions[v]; };
+    auto const texcoord = [&](std::size_t v) -> std::array<float, 2> const & { return texcoords[v]; };
+    auto const normal = [&](std::size_t v) -> vec3 const & { return normals[v]; };
+
+    auto const triangles = triangle_tangents(indices, position, texcoord, thread_count);
+
+    // Corners of both orientations are counted; degenerate texcoords count for neither
+    std::vector<int> balance(positions.size(), 0);
+    for (std::size_t i = 0; i < indices.size(); ++i)
+    {
+        auto const & triangle = triangles[i / 3];
+        if (triangle.tangent != vec3{0.f, 0.f, 0.f})
+            balance[indices[i]] += triangle.orientation_preserving ? 1 : -1;
+    }
+
+    std::vector<float> signs(positions.size());
+    for (std::size_t v = 0; v < positions.size(); ++v)
+        signs[v] = balance[v] < 0 ? -1.f : 1.f;
+
+    return vertex_tangents(indices, triangles, signs, position, normal, thread_count);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "obj_parser.hpp"
+
+#include <array>
+#include <vector>
+#include <span>
+#include <cstdint>
+
+// Fills mesh.tangents the way MikkTSpace does, so that normal maps baked against it match:
+// every corner takes the tangent of its triangle projected onto the vertex normal's plane,
+// corners are weighted by their angle, and a vertex shared by triangles with mirrored
+// texcoords is split in two, one per bitangent sign. Vertices without a usable tangent,
+// like those of triangles with degenerate texcoords, get one perpendicular to the normal.
+// Runs on thread_count threads, 0 meaning all hardware threads.
+void generate_tangents(obj_data & mesh, unsigned int thread_count = 0);
+
+// The same tangents for a triangle list whose vertices cannot be split, like a glTF primitive
+// whose other attributes stay where they are in its buffers. A vertex shared by mirrored and
+// unmirrored triangles takes the sign of most of its corners and sums only theirs, so the
+// texels on the other side of the mirror seam are shaded with a flipped bitangent.
+std::vector<std::array<float, 4>> generate_tangents(std::span<std::array<float, 3> const> positions, std::span<std::array<float, 3> const> normals,
+    std::span<std::array<float, 2> const> texcoords, std::span<std::uint32_t const> indices, unsigned int thread_count = 0);
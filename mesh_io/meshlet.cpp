@@ -0,0 +1,155 @@
+#include "meshlet.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+
+    using vec3 = std::array<float, 3>;
+
+    vec3 sub(vec3 const & a, vec3 const & b)
+    {
+        return {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+    }
+
+    float dot(vec3 const & a, vec3 const & b)
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    vec3 normalize(vec3 const & v)
+    {
+        float const length = std::sqrt(dot(v, v));
+        if (length == 0.f)
+            return {0.f, 0.f, 0.f};
+        return {v[0] / length, v[1] / length, v[2] / length};
+    }
+
+    vec3 cross(vec3 const & a, vec3 const & b)
+    {
+        return {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+    }
+
+    void compute_bounds(obj_data const & mesh, meshlet & result)
+    {
+        auto const begin = mesh.indices.begin() + result.first_index;
+        auto const end = begin + result.index_count;
+
+        // Sphere around the box center, which is tight enough for clusters this small
+        vec3 min{std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity()};
+        vec3 max{-min[0], -min[1], -min[2]};
+        for (auto it = begin; it != end; ++it)
+        {
+            auto const & p = mesh.vertices[*it].position;
+            for (int k = 0; k < 3; ++k)
+            {
+                min[k] = std::min(min[k], p[k]);
+                max[k] = std::max(max[k], p[k]);
+            }
+        }
+
+        result.center = {(min[0] + max[0]) / 2.f, (min[1] + max[1]) / 2.f, (min[2] + max[2]) / 2.f};
+        result.radius = 0.f;
+        for (auto it = begin; it != end; ++it)
+        {
+            auto const d = sub(mesh.vertices[*it].position, result.center);
+            result.radius = std::max(result.radius, std::sqrt(dot(d, d)));
+        }
+
+        std::vector<vec3> normals;
+        vec3 axis{0.f, 0.f, 0.f};
+        for (auto it = begin; it != end; it += 3)
+        {
+            auto const & p0 = mesh.vertices[it[0]].position;
+            auto const n = normalize(cross(sub(mesh.vertices[it[1]].position, p0), sub(mesh.vertices[it[2]].position, p0)));
+            normals.push_back(n);
+            for (int k = 0; k < 3; ++k)
+                axis[k] += n[k];
+        }
+        axis = normalize(axis);
+        result.cone_axis = axis;
+
+        float min_dot = 1.f;
+        for (auto const & n : normals)
+            min_dot = std::min(min_dot, dot(n, axis));
+
+        // Normals spread over more than a hemisphere, or nearly so: the cone test could never pass
+        if (min_dot <= 0.1f)
+        {
+            result.cone_apex = result.center;
+            result.cone_cutoff = 2.f;
+            return;
+        }
+
+        // Move the apex back along the axis until it is behind every triangle's plane
+        float max_t = 0.f;
+        std::size_t triangle = 0;
+        for (auto it = begin; it != end; it += 3, ++triangle)
+        {
+            auto const & n = normals[triangle];
+            float const dc = dot(sub(result.center, mesh.vertices[it[0]].position), n);
+            float const dn = dot(axis, n);
+            max_t = std::max(max_t, dc / dn);
+        }
+
+        result.cone_apex = {result.center[0] - axis[0] * max_t, result.center[1] - axis[1] * max_t, result.center[2] - axis[2] * max_t};
+        result.cone_cutoff = std::sqrt(1.f - min_dot * min_dot);
+    }
+
+}
+
+std::vector<meshlet> build_meshlets(obj_data const & mesh, std::size_t max_vertices, std::size_t max_triangles)
+{
+    std::vector<meshlet> result;
+
+    // Meshlet that last used each vertex, to count distinct vertices without clearing a set
+    auto const none = std::numeric_limits<std::uint32_t>::max();
+    std::vector<std::uint32_t> used_by(mesh.vertices.size(), none);
+
+    meshlet current{};
+    auto finish = [&]
+    {
+        if (current.index_count == 0) return;
+        compute_bounds(mesh, current);
+        result.push_back(current);
+        current = meshlet{};
+    };
+
+    // Vertices of triangle i not yet used by the meshlet being built
+    auto new_vertex_count = [&](std::uint32_t i)
+    {
+        std::size_t count = 0;
+        for (std::uint32_t k = 0; k < 3; ++k)
+        {
+            auto const v = mesh.indices[i + k];
+            bool const repeated = (k > 0 && mesh.indices[i] == v) || (k > 1 && mesh.indices[i + 1] == v);
+            if (used_by[v] != result.size() && !repeated)
+                ++count;
+        }
+        return count;
+    };
+
+    for (std::uint32_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+    {
+        auto new_vertices = new_vertex_count(i);
+        if (current.index_count / 3 + 1 > max_triangles || current.vertex_count + new_vertices > max_vertices)
+        {
+            finish();
+            new_vertices = new_vertex_count(i);
+        }
+
+        if (current.index_count == 0)
+            current.first_index = i;
+
+        for (std::uint32_t k = 0; k < 3; ++k)
+            used_by[mesh.indices[i + k]] = result.size();
+
+        current.index_count += 3;
+        current.vertex_count += new_vertices;
+    }
+    finish();
+
+    return result;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "obj_parser.hpp"
+
+#include <vector>
+#include <array>
+#include <cstdint>
+
+// A small cluster of triangles with bounds for culling it as a whole
+struct meshlet
+{
+    // Range of the mesh index buffer
+    std::uint32_t first_index;
+    std::uint32_t index_count;
+    std::uint32_t vertex_count;
+
+    std::array<float, 3> center;
+    float radius;
+
+    // All triangles face away from a viewer at v if dot(normalize(cone_apex - v), cone_axis) >= cone_cutoff;
+    // a cutoff above 1 means the normals are too spread out for that to ever hold
+    std::array<float, 3> cone_apex;
+    std::array<float, 3> cone_axis;
+    float cone_cutoff;
+};
+
+// Splits the index buffer into consecutive runs of at most max_triangles triangles that use
+// at most max_vertices distinct vertices, so the index buffer is left as is. Meant to run after
+// optimize_vertex_cache, whose order already keeps neighbouring triangles together.
+std::vector<meshlet> build_meshlets(obj_data const & mesh, std::size_t max_vertices = 64, std::size_t max_triangles = 124);
@@ -0,0 +1,932 @@
+#include "obj_cache.hpp"
+#include "mapped_file.hpp"
+#include "mesh_tangents.hpp"
+#include "mesh_normals.hpp"
+#include "vertex_occlusion.hpp"
+#include "triangle_bvh.hpp"
+
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <system_error>
+#include <stdexcept>
+#include <memory>
+#include <algorithm>
+
+namespace
+{
+
+    // Bounds-checked reads from a mapped cache file
+    struct cache_reader
+    {
+        char const * p;
+        char const * end;
+
+        bool read(void * data, std::size_t size)
+        {
+            if (std::size_t(end - p) < size)
+                return false;
+            std::memcpy(data, p, size);
+            p += size;
+            return true;
+        }
+
+        template <typename T>
+        bool read_array(std::vector<T> & values, std::size_t count)
+        {
+            if (std::size_t(end - p) / sizeof(T) < count)
+                return false;
+            values.resize(count);
+            return read(values.data(), count * sizeof(T));
+        }
+
+        bool skip(std::size_t size)
+        {
+            if (std::size_t(end - p) < size)
+                return false;
+            p += size;
+            return true;
+        }
+
+        bool skip_string()
+        {
+            std::uint32_t size;
+            return read(&size, sizeof(size)) && skip(size);
+        }
+
+        bool skip_strings()
+        {
+            std::uint32_t count;
+            if (!read(&count, sizeof(count)))
+                return false;
+            for (std::uint32_t i = 0; i < count; ++i)
+                if (!skip_string())
+                    return false;
+            return true;
+        }
+
+        bool read_string(std::string & value)
+        {
+            std::uint32_t size;
+            if (!read(&size, sizeof(size)) || std::size_t(end - p) < size)
+                return false;
+            value.assign(p, size);
+            p += size;
+            return true;
+        }
+
+        bool read_strings(std::vector<std::string> & values)
+        {
+            std::uint32_t count;
+            if (!read(&count, sizeof(count)) || std::size_t(end - p) / sizeof(std::uint32_t) < count)
+                return false;
+            values.resize(count);
+            for (auto & value : values)
+                if (!read_string(value))
+                    return false;
+            return true;
+        }
+    };
+
+    void write_string(std::ostream & output, std::string const & value)
+    {
+        std::uint32_t const size = value.size();
+        output.write(reinterpret_cast<char const *>(&size), sizeof(size));
+        output.write(value.data(), value.size());
+    }
+
+    void write_strings(std::ostream & output, std::vector<std::string> const & values)
+    {
+        std::uint32_t const count = values.size();
+        output.write(reinterpret_cast<char const *>(&count), sizeof(count));
+        for (auto const & value : values)
+            write_string(output, value);
+    }
+
+    struct cache_submesh
+    {
+        std::uint32_t material;
+        std::uint32_t first_index;
+        std::uint32_t index_count;
+        std::array<float, 3> min;
+        std::array<float, 3> max;
+    };
+
+    // Submesh count, then every submesh with its object and group names, then the material
+    // and material library names
+    void write_submeshes(std::ostream & output, obj_data const & mesh)
+    {
+        std::uint32_t const count = mesh.submeshes.size();
+        output.write(reinterpret_cast<char const *>(&count), sizeof(count));
+        for (auto const & submesh : mesh.submeshes)
+        {
+            cache_submesh const record{submesh.material, submesh.first_index, submesh.index_count, submesh.min, submesh.max};
+            output.write(reinterpret_cast<char const *>(&record), sizeof(record));
+            write_string(output, submesh.object);
+            write_string(output, submesh.group);
+        }
+        write_strings(output, mesh.materials);
+        write_strings(output, mesh.material_libraries);
+    }
+
+    bool read_submeshes(cache_reader & reader, obj_data & mesh)
+    {
+        std::uint32_t count;
+        if (!reader.read(&count, sizeof(count)) || std::size_t(reader.end - reader.p) / sizeof(cache_submesh) < count)
+            return false;
+
+        mesh.submeshes.resize(count);
+        for (auto & submesh : mesh.submeshes)
+        {
+            cache_submesh record;
+            if (!reader.read(&record, sizeof(record))
+                || !reader.read_string(submesh.object)
+                || !reader.read_string(submesh.group))
+                return false;
+
+            submesh.material = record.material;
+            submesh.first_index = record.first_index;
+            submesh.index_count = record.index_count;
+            submesh.min = record.min;
+            submesh.max = record.max;
+
+            if (std::size_t(record.first_index) + record.index_count > mesh.indices.size())
+                return false;
+        }
+
+        if (!reader.read_strings(mesh.materials) || !reader.read_strings(mesh.material_libraries))
+            return false;
+
+        for (auto const & submesh : mesh.submeshes)
+            if (submesh.material != obj_data::no_material && submesh.material >= mesh.materials.size())
+                return false;
+
+        return true;
+    }
+
+    constexpr char cache_magic[4] = {'O', 'B', 'J', 'C'};
+    constexpr std::uint32_t cache_version = 5;
+
+    // The vertices are followed by as many tangents when tangent_size is not zero, then as
+    // many occlusion values when occlusion_size is not zero
+    struct cache_header
+    {
+        char magic[4];
+        std::uint32_t version;
+        std::uint32_t vertex_size;
+        std::uint32_t index_size;
+        std::uint32_t tangent_size;
+        std::uint32_t occlusion_size;
+        std::uint64_t source_size;
+        std::int64_t source_time;
+        std::uint64_t vertex_count;
+        std::uint64_t index_count;
+    };
+
+    cache_header make_header(std::filesystem::path const & path, bool tangents, bool occlusion)
+    {
+        cache_header header{};
+        std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+        header.version = cache_version;
+        header.vertex_size = sizeof(obj_data::vertex);
+        header.index_size = sizeof(std::uint32_t);
+        header.tangent_size = tangents ? sizeof(obj_data::tangents[0]) : 0;
+        header.occlusion_size = occlusion ? sizeof(obj_data::occlusion[0]) : 0;
+        header.source_size = std::filesystem::file_size(path);
+        header.source_time = std::filesystem::last_write_time(path).time_since_epoch().count();
+        return header;
+    }
+
+    bool read_cache(std::filesystem::path const & cache_path, cache_header const & expected, obj_data & result)
+    {
+        std::error_code error;
+        if (!std::filesystem::is_regular_file(cache_path, error))
+            return false;
+
+        mapped_file file(cache_path);
+        if (file.size() < sizeof(cache_header))
+            return false;
+
+        cache_header header;
+        std::memcpy(&header, file.data(), sizeof(header));
+
+        if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0
+            || header.version != expected.version
+            || header.vertex_size != expected.vertex_size
+            || header.index_size != expected.index_size
+            || header.tangent_size != expected.tangent_size
+            || header.occlusion_size != expected.occlusion_size
+            || header.source_size != expected.source_size
+            || header.source_time != expected.source_time)
+            return false;
+
+        cache_reader reader{file.data() + sizeof(header), file.data() + file.size()};
+        return reader.read_array(result.vertices, header.vertex_count)
+            && (header.tangent_size == 0 || reader.read_array(result.tangents, header.vertex_count))
+            && (header.occlusion_size == 0 || reader.read_array(result.occlusion, header.vertex_count))
+            && reader.read_array(result.indices, header.index_count)
+            && read_submeshes(reader, result)
+            && reader.p == reader.end;
+    }
+
+    // Steps over what write_submeshes wrote without reading it into a mesh
+    bool skip_submeshes(cache_reader & reader)
+    {
+        std::uint32_t count;
+        if (!reader.read(&count, sizeof(count)))
+            return false;
+        for (std::uint32_t i = 0; i < count; ++i)
+            if (!reader.skip(sizeof(cache_submesh)) || !reader.skip_string() || !reader.skip_string())
+                return false;
+        return reader.skip_strings() && reader.skip_strings();
+    }
+
+    void write_cache(std::filesystem::path const & cache_path, cache_header header, obj_data const & data)
+    {
+        header.vertex_count = data.vertices.size();
+        header.index_count = data.indices.size();
+
+        // Write to a temporary file first so that a concurrent reader never sees a partial cache
+        auto temp_path = cache_path;
+        temp_path += ".tmp";
+
+        {
+            std::ofstream output(temp_path, std::ios::binary);
+            output.write(reinterpret_cast<char const *>(&header), sizeof(header));
+            output.write(reinterpret_cast<char const *>(data.vertices.data()), data.vertices.size() * sizeof(data.vertices[0]));
+            if (header.tangent_size != 0)
+                output.write(reinterpret_cast<char const *>(data.tangents.data()), data.tangents.size() * sizeof(data.tangents[0]));
+            if (header.occlusion_size != 0)
+                output.write(reinterpret_cast<char const *>(data.occlusion.data()), data.occlusion.size() * sizeof(data.occlusion[0]));
+            output.write(reinterpret_cast<char const *>(data.indices.data()), data.indices.size() * sizeof(data.indices[0]));
+            write_submeshes(output, data);
+            if (!output)
+                return;
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temp_path, cache_path, error);
+        if (error)
+            std::filesystem::remove(temp_path, error);
+    }
+
+    constexpr char lods_cache_magic[4] = {'O', 'B', 'J', 'L'};
+    constexpr std::uint32_t lods_cache_version = 3;
+
+    // Followed by level_count level headers, then the vertices, indices and submeshes of every level in order
+    struct lods_cache_header
+    {
+        char magic[4];
+        std::uint32_t version;
+        std::uint32_t vertex_size;
+        std::uint32_t index_size;
+        std::uint64_t source_size;
+        std::int64_t source_time;
+        std::uint32_t requested_level_count;
+        float ratio;
+        std::uint64_t level_count;
+    };
+
+    struct lods_cache_level
+    {
+        std::uint64_t vertex_count;
+        std::uint64_t index_count;
+        float error;
+        std::uint32_t padding;
+    };
+
+    lods_cache_header make_lods_header(std::filesystem::path const & path, std::size_t level_count, float ratio)
+    {
+        lods_cache_header header{};
+        std::memcpy(header.magic, lods_cache_magic, sizeof(lods_cache_magic));
+        header.version = lods_cache_version;
+        header.vertex_size = sizeof(obj_data::vertex);
+        header.index_size = sizeof(std::uint32_t);
+        header.source_size = std::filesystem::file_size(path);
+        header.source_time = std::filesystem::last_write_time(path).time_since_epoch().count();
+        header.requested_level_count = level_count;
+        header.ratio = ratio;
+        return header;
+    }
+
+    // The level table of a fresh cache, leaving reader at the vertices of the first level
+    bool read_lods_levels(mapped_file const & file, lods_cache_header const & expected, cache_reader & reader, std::vector<lods_cache_level> & levels)
+    {
+        if (file.size() < sizeof(lods_cache_header))
+            return false;
+
+        lods_cache_header header;
+        std::memcpy(&header, file.data(), sizeof(header));
+
+        if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0
+            || header.version != expected.version
+            || header.vertex_size != expected.vertex_size
+            || header.index_size != expected.index_size
+            || header.source_size != expected.source_size
+            || header.source_time != expected.source_time
+            || header.requested_level_count != expected.requested_level_count
+            || header.ratio != expected.ratio)
+            return false;
+
+        if (header.level_count > header.requested_level_count)
+            return false;
+
+        reader = {file.data() + sizeof(header), file.data() + file.size()};
+        return reader.read_array(levels, header.level_count);
+    }
+
+    bool read_lods_cache(std::filesystem::path const & cache_path, lods_cache_header const & expected, std::vector<mesh_lod> & result)
+    {
+        std::error_code error;
+        if (!std::filesystem::is_regular_file(cache_path, error))
+            return false;
+
+        mapped_file file(cache_path);
+        cache_reader reader;
+        std::vector<lods_cache_level> levels;
+        if (!read_lods_levels(file, expected, reader, levels))
+            return false;
+
+        result.resize(levels.size());
+        for (std::size_t i = 0; i < levels.size(); ++i)
+        {
+            auto & mesh = result[i].mesh;
+            result[i].error = levels[i].error;
+
+            if (!reader.read_array(mesh.vertices, levels[i].vertex_count)
+                || !reader.read_array(mesh.indices, levels[i].index_count)
+                || !read_submeshes(reader, mesh))
+                return false;
+        }
+
+        return reader.p == reader.end;
+    }
+
+    void write_lods_cache(std::filesystem::path const & cache_path, lods_cache_header header, std::vector<mesh_lod> const & lods)
+    {
+        header.level_count = lods.size();
+
+        auto temp_path = cache_path;
+        temp_path += ".tmp";
+
+        {
+            std::ofstream output(temp_path, std::ios::binary);
+            output.write(reinterpret_cast<char const *>(&header), sizeof(header));
+            for (auto const & lod : lods)
+            {
+                lods_cache_level level{lod.mesh.vertices.size(), lod.mesh.indices.size(), lod.error, 0};
+                output.write(reinterpret_cast<char const *>(&level), sizeof(level));
+            }
+            for (auto const & lod : lods)
+            {
+                output.write(reinterpret_cast<char const *>(lod.mesh.vertices.data()), lod.mesh.vertices.size() * sizeof(lod.mesh.vertices[0]));
+                output.write(reinterpret_cast<char const *>(lod.mesh.indices.data()), lod.mesh.indices.size() * sizeof(lod.mesh.indices[0]));
+                write_submeshes(output, lod.mesh);
+            }
+            if (!output)
+                return;
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temp_path, cache_path, error);
+        if (error)
+            std::filesystem::remove(temp_path, error);
+    }
+
+    constexpr char batches_cache_magic[4] = {'S', 'B', 'A', 'T'};
+    constexpr std::uint32_t batches_cache_version = 1;
+
+    // Static batches have no source file, so the key hashes the sources instead of a stamp.
+    // Followed by batch_count batch headers, then the vertices, indices and chunks of every
+    // batch in order.
+    struct batches_cache_header
+    {
+        char magic[4];
+        std::uint32_t version;
+        std::uint32_t vertex_size;
+        std::uint32_t index_size;
+        std::uint64_t key;
+        std::uint64_t batch_count;
+    };
+
+    struct batches_cache_batch
+    {
+        std::uint64_t vertex_count;
+        std::uint64_t index_count;
+        std::uint32_t material;
+        std::uint32_t padding;
+    };
+
+    bool read_batches_cache(std::filesystem::path const & cache_path, std::uint64_t key, std::vector<static_batch> & result)
+    {
+        std::error_code error;
+        if (!std::filesystem::is_regular_file(cache_path, error))
+            return false;
+
+        mapped_file file(cache_path);
+        if (file.size() < sizeof(batches_cache_header))
+            return false;
+
+        batches_cache_header header;
+        std::memcpy(&header, file.data(), sizeof(header));
+
+        if (std::memcmp(header.magic, batches_cache_magic, sizeof(header.magic)) != 0
+            || header.version != batches_cache_version
+            || header.vertex_size != sizeof(obj_data::vertex)
+            || header.index_size != sizeof(std::uint32_t)
+            || header.key != key)
+            return false;
+
+        cache_reader reader{file.data() + sizeof(header), file.data() + file.size()};
+
+        std::vector<batches_cache_batch> batches;
+        if (!reader.read_array(batches, header.batch_count))
+            return false;
+
+        result.resize(batches.size());
+        for (std::size_t i = 0; i < batches.size(); ++i)
+        {
+            auto & mesh = result[i].mesh;
+            result[i].material = batches[i].material;
+
+            if (!reader.read_array(mesh.vertices, batches[i].vertex_count)
+                || !reader.read_array(mesh.indices, batches[i].index_count)
+                || !read_submeshes(reader, mesh))
+                return false;
+        }
+
+        return reader.p == reader.end;
+    }
+
+    void write_batches_cache(std::filesystem::path const & cache_path, std::uint64_t key, std::vector<static_batch> const & batches)
+    {
+        batches_cache_header header{};
+        std::memcpy(header.magic, batches_cache_magic, sizeof(batches_cache_magic));
+        header.version = batches_cache_version;
+        header.vertex_size = sizeof(obj_data::vertex);
+        header.index_size = sizeof(std::uint32_t);
+        header.key = key;
+        header.batch_count = batches.size();
+
+        auto temp_path = cache_path;
+        temp_path += ".tmp";
+
+        {
+            std::ofstream output(temp_path, std::ios::binary);
+            output.write(reinterpret_cast<char const *>(&header), sizeof(header));
+            for (auto const & batch : batches)
+            {
+                batches_cache_batch record{batch.mesh.vertices.size(), batch.mesh.indices.size(), batch.material, 0};
+                output.write(reinterpret_cast<char const *>(&record), sizeof(record));
+            }
+            for (auto const & batch : batches)
+            {
+                output.write(reinterpret_cast<char const *>(batch.mesh.vertices.data()), batch.mesh.vertices.size() * sizeof(batch.mesh.vertices[0]));
+                output.write(reinterpret_cast<char const *>(batch.mesh.indices.data()), batch.mesh.indices.size() * sizeof(batch.mesh.indices[0]));
+                write_submeshes(output, batch.mesh);
+            }
+            if (!output)
+                return;
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temp_path, cache_path, error);
+        if (error)
+            std::filesystem::remove(temp_path, error);
+    }
+
+    constexpr char visible_sets_cache_magic[4] = {'P', 'V', 'S', 'C'};
+    constexpr std::uint32_t visible_sets_cache_version = 1;
+
+    // Keyed by potentially_visible_sets_key, which hashes the occluders and objects the sets
+    // were baked from. Followed by the cell offsets, then the runs.
+    struct visible_sets_cache_header
+    {
+        char magic[4];
+        std::uint32_t version;
+        std::uint64_t key;
+        float min[3];
+        float max[3];
+        std::uint32_t resolution[3];
+        std::uint32_t object_count;
+        std::uint64_t run_bytes;
+    };
+
+    bool read_visible_sets_cache(std::filesystem::path const & cache_path, std::uint64_t key, potentially_visible_sets & result)
+    {
+        std::error_code error;
+        if (!std::filesystem::is_regular_file(cache_path, error))
+            return false;
+
+        mapped_file file(cache_path);
+        if (file.size() < sizeof(visible_sets_cache_header))
+            return false;
+
+        visible_sets_cache_header header;
+        std::memcpy(&header, file.data(), sizeof(header));
+
+        if (std::memcmp(header.magic, visible_sets_cache_magic, sizeof(header.magic)) != 0
+            || header.version != visible_sets_cache_version
+            || header.key != key)
+            return false;
+
+        std::copy(header.min, header.min + 3, result.min.begin());
+        std::copy(header.max, header.max + 3, result.max.begin());
+        std::copy(header.resolution, header.resolution + 3, result.resolution.begin());
+        result.object_count = header.object_count;
+
+        cache_reader reader{file.data() + sizeof(header), file.data() + file.size()};
+        if (!reader.read_array(result.cell_offsets, result.cell_count() + 1)
+            || !reader.read_array(result.runs, header.run_bytes))
+            return false;
+
+        return reader.p == reader.end && result.cell_offsets.back() == result.runs.size();
+    }
+
+    void write_visible_sets_cache(std::filesystem::path const & cache_path, std::uint64_t key, potentially_visible_sets const & sets)
+    {
+        visible_sets_cache_header header{};
+        std::memcpy(header.magic, visible_sets_cache_magic, sizeof(visible_sets_cache_magic));
+        header.version = visible_sets_cache_version;
+        header.key = key;
+        std::copy(sets.min.begin(), sets.min.end(), header.min);
+        std::copy(sets.max.begin(), sets.max.end(), header.max);
+        std::copy(sets.resolution.begin(), sets.resolution.end(), header.resolution);
+        header.object_count = sets.object_count;
+        header.run_bytes = sets.runs.size();
+
+        auto temp_path = cache_path;
+        temp_path += ".tmp";
+
+        {
+            std::ofstream output(temp_path, std::ios::binary);
+            output.write(reinterpret_cast<char const *>(&header), sizeof(header));
+            output.write(reinterpret_cast<char const *>(sets.cell_offsets.data()), sets.cell_offsets.size() * sizeof(sets.cell_offsets[0]));
+            output.write(reinterpret_cast<char const *>(sets.runs.data()), sets.runs.size());
+            if (!output)
+                return;
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temp_path, cache_path, error);
+        if (error)
+            std::filesystem::remove(temp_path, error);
+    }
+
+    constexpr char points_cache_magic[4] = {'O', 'B', 'J', 'P'};
+    constexpr std::uint32_t points_cache_version = 1;
+
+    // Followed by the node table, then the points. The header keeps the nodes 8-byte aligned
+    // in the mapping, so the tree is used where it lies
+    struct points_cache_header
+    {
+        char magic[4];
+        std::uint32_t version;
+        std::uint32_t point_size;
+        std::uint32_t node_size;
+        std::uint64_t source_size;
+        std::int64_t source_time;
+        std::uint32_t node_points;
+        std::uint32_t grid_resolution;
+        std::uint32_t max_depth;
+        std::uint32_t padding;
+        std::uint64_t node_count;
+        std::uint64_t point_count;
+    };
+
+    static_assert(sizeof(points_cache_header) % alignof(point_octree_node) == 0);
+
+    points_cache_header make_points_header(std::filesystem::path const & path, point_octree_settings const & settings)
+    {
+        points_cache_header header{};
+        std::memcpy(header.magic, points_cache_magic, sizeof(points_cache_magic));
+        header.version = points_cache_version;
+        header.point_size = sizeof(splat_point);
+        header.node_size = sizeof(point_octree_node);
+        header.source_size = std::filesystem::file_size(path);
+        header.source_time = std::filesystem::last_write_time(path).time_since_epoch().count();
+        header.node_points = settings.node_points;
+        header.grid_resolution = settings.grid_resolution;
+        header.max_depth = settings.max_depth;
+        return header;
+    }
+
+    std::optional<point_octree> read_points_cache(std::filesystem::path const & cache_path, points_cache_header const & expected)
+    {
+        std::error_code error;
+        if (!std::filesystem::is_regular_file(cache_path, error))
+            return std::nullopt;
+
+        auto file = std::make_shared<mapped_file>(cache_path);
+        if (file->size() < sizeof(points_cache_header))
+            return std::nullopt;
+
+        points_cache_header header;
+        std::memcpy(&header, file->data(), sizeof(header));
+
+        if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0
+            || header.version != expected.version
+            || header.point_size != expected.point_size
+            || header.node_size != expected.node_size
+            || header.source_size != expected.source_size
+            || header.source_time != expected.source_time
+            || header.node_points != expected.node_points
+            || header.grid_resolution != expected.grid_resolution
+            || header.max_depth != expected.max_depth)
+            return std::nullopt;
+
+        std::size_t const body_size = file->size() - sizeof(header);
+        if (header.node_count > body_size / sizeof(point_octree_node)
+            || header.point_count * sizeof(splat_point) != body_size - header.node_count * sizeof(point_octree_node))
+            return std::nullopt;
+
+        point_octree result;
+        result.nodes = {reinterpret_cast<point_octree_node const *>(file->data() + sizeof(header)), header.node_count};
+        result.points = {reinterpret_cast<splat_point const *>(result.nodes.data() + header.node_count), header.point_count};
+
+        for (auto const & node : result.nodes)
+            if (node.first_point + node.point_count > header.point_count || std::uint64_t(node.first_child) + node.child_count > header.node_count)
+                return std::nullopt;
+
+        result.owner = std::move(file);
+        return result;
+    }
+
+    bool write_points_cache(std::filesystem::path const & cache_path, points_cache_header header, point_octree_data const & tree)
+    {
+        header.node_count = tree.nodes.size();
+        header.point_count = tree.points.size();
+
+        auto temp_path = cache_path;
+        temp_path += ".tmp";
+
+        {
+            std::ofstream output(temp_path, std::ios::binary);
+            output.write(reinterpret_cast<char const *>(&header), sizeof(header));
+            output.write(reinterpret_cast<char const *>(tree.nodes.data()), tree.nodes.size() * sizeof(tree.nodes[0]));
+            output.write(reinterpret_cast<char const *>(tree.points.data()), tree.points.size() * sizeof(tree.points[0]));
+            if (!output)
+                return false;
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temp_path, cache_path, error);
+        if (error)
+            std::filesystem::remove(temp_path, error);
+        return !error;
+    }
+
+    // Where the stamp is in a cache with this magic, 0 if the magic is not one of ours
+    std::size_t stamp_offset(char const * magic)
+    {
+        if (std::memcmp(magic, cache_magic, sizeof(cache_magic)) == 0)
+            return offsetof(cache_header, source_size);
+        if (std::memcmp(magic, lods_cache_magic, sizeof(lods_cache_magic)) == 0)
+            return offsetof(lods_cache_header, source_size);
+        if (std::memcmp(magic, points_cache_magic, sizeof(points_cache_magic)) == 0)
+            return offsetof(points_cache_header, source_size);
+        return 0;
+    }
+
+    static_assert(offsetof(cache_header, source_time) == offsetof(cache_header, source_size) + sizeof(std::uint64_t));
+    static_assert(offsetof(lods_cache_header, source_time) == offsetof(lods_cache_header, source_size) + sizeof(std::uint64_t));
+    static_assert(offsetof(points_cache_header, source_time) == offsetof(points_cache_header, source_size) + sizeof(std::uint64_t));
+
+}
+
+std::filesystem::path obj_cache_path(std::filesystem::path const & path, bool tangents, bool occlusion)
+{
+    auto result = path;
+    result += ".";
+    if (tangents)
+        result += "t";
+    if (occlusion)
+        result += "a";
+    result += "cache";
+    return result;
+}
+
+obj_data load_obj_cached(std::filesystem::path const & path, bool tangents, bool occlusion)
+{
+    auto const header = make_header(path, tangents, occlusion);
+    auto const cache_path = obj_cache_path(path, tangents, occlusion);
+
+    obj_data result;
+    if (read_cache(cache_path, header, result))
+        return result;
+
+    // A cache miss is usually a cold read of a large file, where reads in flight beat page faults
+    result = parse_obj_async(path);
+    if (!has_normals(result))
+        generate_normals(result);
+    if (tangents)
+        generate_tangents(result);
+    // Last, since the other two may add vertices
+    if (occlusion)
+        bake_occlusion(result);
+
+    // The cache is only an optimization, so failing to write it is not an error
+    write_cache(cache_path, header, result);
+
+    return result;
+}
+
+std::filesystem::path obj_lods_cache_path(std::filesystem::path const & path)
+{
+    auto result = path;
+    result += ".lods";
+    return result;
+}
+
+std::vector<mesh_lod> load_obj_lods_cached(std::filesystem::path const & path, std::size_t level_count, float ratio)
+{
+    auto const header = make_lods_header(path, level_count, ratio);
+    auto const cache_path = obj_lods_cache_path(path);
+
+    std::vector<mesh_lod> result;
+    if (read_lods_cache(cache_path, header, result))
+        return result;
+
+    // Level 0 goes through the plain cache, so both caches agree on it
+    result = build_lod_chain(load_obj_cached(path), level_count, ratio);
+
+    write_lods_cache(cache_path, header, result);
+
+    return result;
+}
+
+mesh_lod mesh_lod_stream::read(std::size_t level) const
+{
+    if (memory_)
+        return memory_->at(level);
+
+    auto const & info = levels_.at(level);
+    cache_reader reader{file_->data() + offsets_[level], file_->data() + file_->size()};
+
+    mesh_lod result;
+    result.error = info.error;
+    if (!reader.read_array(result.mesh.vertices, info.vertex_count)
+        || !reader.read_array(result.mesh.indices, info.index_count)
+        || !read_submeshes(reader, result.mesh))
+        throw std::runtime_error("Failed to read LOD " + std::to_string(level) + " from " + cache_path_.string());
+    return result;
+}
+
+mesh_lod_stream load_obj_lods_streamed(std::filesystem::path const & path, std::size_t level_count, float ratio)
+{
+    auto const header = make_lods_header(path, level_count, ratio);
+    auto const cache_path = obj_lods_cache_path(path);
+
+    auto open_cache = [&]() -> std::optional<mesh_lod_stream>
+    {
+        std::error_code error;
+        if (!std::filesystem::is_regular_file(cache_path, error))
+            return std::nullopt;
+
+        auto file = std::make_shared<mapped_file>(cache_path);
+        cache_reader reader;
+        std::vector<lods_cache_level> levels;
+        if (!read_lods_levels(*file, header, reader, levels))
+            return std::nullopt;
+
+        mesh_lod_stream result;
+        for (auto const & level : levels)
+        {
+            result.levels_.push_back({level.vertex_count, level.index_count, level.error});
+            result.offsets_.push_back(reader.p - file->data());
+            if (!reader.skip(level.vertex_count * sizeof(obj_data::vertex))
+                || !reader.skip(level.index_count * sizeof(std::uint32_t))
+                || !skip_submeshes(reader))
+                return std::nullopt;
+        }
+        if (reader.p != reader.end)
+            return std::nullopt;
+
+        result.cache_path_ = cache_path;
+        result.file_ = std::move(file);
+        return result;
+    };
+
+    if (auto result = open_cache())
+        return std::move(*result);
+
+    auto lods = std::make_shared<std::vector<mesh_lod>>(load_obj_lods_cached(path, level_count, ratio));
+    if (auto result = open_cache())
+        return std::move(*result);
+
+    // The cache could not be written, so the chain stays in memory
+    mesh_lod_stream result;
+    for (auto const & lod : *lods)
+        result.levels_.push_back({lod.mesh.vertices.size(), lod.mesh.indices.size(), lod.error});
+    result.memory_ = std::move(lods);
+    return result;
+}
+
+std::filesystem::path obj_points_cache_path(std::filesystem::path const & path)
+{
+    auto result = path;
+    result += ".points";
+    return result;
+}
+
+point_octree load_point_octree_cached(std::filesystem::path const & path, point_octree_settings const & settings)
+{
+    auto const header = make_points_header(path, settings);
+    auto const cache_path = obj_points_cache_path(path);
+
+    if (auto result = read_points_cache(cache_path, header))
+        return std::move(*result);
+
+    auto tree = std::make_shared<point_octree_data>(build_point_octree(make_splat_points(load_obj_cached(path).vertices), settings));
+
+    // Mapped back from the cache, so the points are paged in as they are drawn rather than
+    // held in memory; without a cache they stay in memory
+    if (write_points_cache(cache_path, header, *tree))
+        if (auto result = read_points_cache(cache_path, header))
+            return std::move(*result);
+
+    point_octree result;
+    result.nodes = tree->nodes;
+    result.points = tree->points;
+    result.owner = std::move(tree);
+    return result;
+}
+
+obj_cache_stamp obj_source_stamp(std::filesystem::path const & path)
+{
+    return {std::filesystem::file_size(path), std::filesystem::last_write_time(path).time_since_epoch().count()};
+}
+
+std::optional<obj_cache_stamp> read_obj_cache_stamp(std::filesystem::path const & cache_path)
+{
+    std::ifstream input(cache_path, std::ios::binary);
+
+    // The smaller header holds the stamps of every kind
+    char header[sizeof(lods_cache_header)];
+    static_assert(offsetof(cache_header, source_time) + sizeof(std::int64_t) <= sizeof(header));
+    static_assert(offsetof(points_cache_header, source_time) + sizeof(std::int64_t) <= sizeof(header));
+    if (!input.read(header, sizeof(header)))
+        return std::nullopt;
+
+    auto const offset = stamp_offset(header);
+    if (offset == 0)
+        return std::nullopt;
+
+    obj_cache_stamp stamp;
+    std::memcpy(&stamp.source_size, header + offset, sizeof(stamp.source_size));
+    std::memcpy(&stamp.source_time, header + offset + sizeof(stamp.source_size), sizeof(stamp.source_time));
+    return stamp;
+}
+
+bool write_obj_cache_stamp(std::filesystem::path const & cache_path, obj_cache_stamp const & stamp)
+{
+    std::fstream file(cache_path, std::ios::binary | std::ios::in | std::ios::out);
+
+    char magic[4];
+    if (!file.read(magic, sizeof(magic)))
+        return false;
+
+    auto const offset = stamp_offset(magic);
+    if (offset == 0)
+        return false;
+
+    file.seekp(offset);
+    file.write(reinterpret_cast<char const *>(&stamp.source_size), sizeof(stamp.source_size));
+    file.write(reinterpret_cast<char const *>(&stamp.source_time), sizeof(stamp.source_time));
+    return bool(file);
+}
+
+std::vector<static_batch> load_static_batches_cached(std::filesystem::path const & cache_path, std::span<static_batch_source const> sources,
+    static_batch_settings const & settings)
+{
+    auto const key = static_batch_key(sources, settings);
+
+    std::vector<static_batch> result;
+    if (read_batches_cache(cache_path, key, result))
+        return result;
+
+    result = build_static_batches(sources, settings);
+
+    write_batches_cache(cache_path, key, result);
+
+    return result;
+}
+
+potentially_visible_sets load_potentially_visible_sets_cached(std::filesystem::path const & cache_path, obj_data const & occluders,
+    std::span<potentially_visible_sets::box const> objects, potentially_visible_sets::vec3 const & min, potentially_visible_sets::vec3 const & max,
+    potentially_visible_settings const & settings)
+{
+    auto const key = potentially_visible_sets_key(occluders, objects, min, max, settings);
+
+    potentially_visible_sets result;
+    if (read_visible_sets_cache(cache_path, key, result))
+        return result;
+
+    result = bake_potentially_visible_sets(triangle_bvh(occluders), objects, min, max, settings);
+
+    write_visible_sets_cache(cache_path, key, result);
+
+    return result;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "obj_parser.hpp"
+#include "mesh_lod.hpp"
+#include "static_batch.hpp"
+#include "point_octree.hpp"
+#include "potentially_visible_sets.hpp"
+#include "mapped_file.hpp"
+
+#include <optional>
+#include <memory>
+#include <cstdint>
+
+// Loads the mesh from a binary cache stored next to the OBJ file (<name>.obj.cache),
+// parsing the OBJ and writing the cache if it is missing or out of date.
+// Meshes without any vn entries get normals from generate_normals, so they are cached too.
+// With tangents, generate_tangents runs before caching, which may add vertices, so
+// such meshes live in a cache of their own (<name>.obj.tcache).
+// With occlusion, bake_occlusion runs last; the bake takes seconds on large meshes, which is
+// what the cache is for. Those live in <name>.obj.acache, or <name>.obj.tacache with tangents.
+obj_data load_obj_cached(std::filesystem::path const & path, bool tangents = false, bool occlusion = false);
+
+std::filesystem::path obj_cache_path(std::filesystem::path const & path, bool tangents = false, bool occlusion = false);
+
+// Same for a whole LOD chain, stored in <name>.obj.lods; level_count and ratio are part of
+// the cache key, so changing them regenerates the chain
+std::vector<mesh_lod> load_obj_lods_cached(std::filesystem::path const & path, std::size_t level_count = 4, float ratio = 0.5f);
+
+std::filesystem::path obj_lods_cache_path(std::filesystem::path const & path);
+
+// The same chain read one level at a time, for streaming: opening it maps the cache and reads
+// only the table of levels, and read() copies a single level out of the mapping, so the pages
+// of the levels never asked for are never touched. read() may run on any thread.
+struct mesh_lod_stream
+{
+    struct level_info
+    {
+        std::uint64_t vertex_count;
+        std::uint64_t index_count;
+        float error;
+    };
+
+    std::vector<level_info> const & levels() const { return levels_; }
+
+    // Throws if the cache changed under the mapping in a way that makes the level unreadable
+    mesh_lod read(std::size_t level) const;
+
+private:
+    friend mesh_lod_stream load_obj_lods_streamed(std::filesystem::path const & path, std::size_t level_count, float ratio);
+
+    std::vector<level_info> levels_;
+    // Where the vertices of every level start in the mapping
+    std::vector<std::size_t> offsets_;
+    std::filesystem::path cache_path_;
+    std::shared_ptr<mapped_file const> file_;
+    // The chain itself if it could not be cached, held in memory as load_obj_lods_cached does
+    std::shared_ptr<std::vector<mesh_lod> const> memory_;
+};
+
+// Builds and caches the chain first if the cache is missing or out of date, which needs the
+// whole mesh in memory once; every later run streams
+mesh_lod_stream load_obj_lods_streamed(std::filesystem::path const & path, std::size_t level_count = 4, float ratio = 0.5f);
+
+// Same for static batches, stored at cache_path. There is no source file to stamp, so the
+// cache is keyed by static_batch_key, which hashes the sources; that is still much cheaper
+// than sorting and chunking them again.
+std::vector<static_batch> load_static_batches_cached(std::filesystem::path const & cache_path, std::span<static_batch_source const> sources,
+    static_batch_settings const & settings = {});
+
+// Same for potentially visible sets, keyed by potentially_visible_sets_key. The bake casts
+// rays from every cell to every object, so it can take a while; the occluder BVH is only built
+// when it runs.
+potentially_visible_sets load_potentially_visible_sets_cached(std::filesystem::path const & cache_path, obj_data const & occluders,
+    std::span<potentially_visible_sets::box const> objects, potentially_visible_sets::vec3 const & min, potentially_visible_sets::vec3 const & max,
+    potentially_visible_settings const & settings = {});
+
+// The vertices as a point octree, stored in <name>.obj.points and used in place: the result
+// maps the cache, so only the nodes that are read get paged in. The settings are part of the
+// cache key.
+point_octree load_point_octree_cached(std::filesystem::path const & path, point_octree_settings const & settings = {});
+
+std::filesystem::path obj_points_cache_path(std::filesystem::path const & path);
+
+// What the caches record about their source to tell whether they are fresh
+struct obj_cache_stamp
+{
+    std::uint64_t source_size;
+    std::int64_t source_time;
+
+    friend bool operator == (obj_cache_stamp const &, obj_cache_stamp const &) = default;
+};
+
+obj_cache_stamp obj_source_stamp(std::filesystem::path const & path);
+
+// The stamp of any of the caches above, nullopt if the file is missing or is not such a cache
+std::optional<obj_cache_stamp> read_obj_cache_stamp(std::filesystem::path const & cache_path);
+
+// Rewrites the stamp of an existing cache in place, so that it is taken as fresh for a source
+// that was touched without changing; the caller must know the contents are the same
+bool write_obj_cache_stamp(std::filesystem::path const & cache_path, obj_cache_stamp const & stamp);
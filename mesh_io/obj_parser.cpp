@@ -0,0 +1,1370 @@
+#include "obj_parser.hpp"
+#include "mapped_file.hpp"
+#include "async_file.hpp"
+#include "decompressing_reader.hpp"
+
+#include <string>
+#include <string_view>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <optional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+
+namespace
+{
+
+    template <typename ... Args>
+    std::string to_string(Args const & ... args)
+    {
+        std::ostringstream os;
+        (os << ... << args);
+        return os.str();
+    }
+
+    struct obj_error
+        : std::runtime_error
+    {
+        std::size_t line;
+        std::string reason;
+
+        obj_error(std::size_t line, std::string reason)
+            : std::runtime_error(to_string("Error parsing OBJ data, line ", line, ": ", reason))
+            , line(line)
+            , reason(std::move(reason))
+        {}
+    };
+
+    template <typename ... Args>
+    [[noreturn]] void throw_obj_error(std::size_t line, Args const & ... args)
+    {
+        throw obj_error(line, to_string(args...));
+    }
+
+    // Open-addressing hash map from (position, texcoord, normal) index triples to vertex indices
+    struct vertex_index_map
+    {
+        struct entry
+        {
+            std::array<std::int32_t, 3> key;
+            std::uint32_t value;
+        };
+
+        static constexpr std::int32_t empty = -1;
+
+        std::vector<entry> entries;
+        std::size_t count = 0;
+
+        static std::size_t hash(std::array<std::int32_t, 3> const & key)
+        {
+            std::uint64_t h = static_cast<std::uint32_t>(key[0]);
+            h = (h * 0x9e3779b97f4a7c15ull) ^ static_cast<std::uint32_t>(key[1]);
+            h = (h * 0x9e3779b97f4a7c15ull) ^ static_cast<std::uint32_t>(key[2]);
+            h *= 0x9e3779b97f4a7c15ull;
+            return h ^ (h >> 32);
+        }
+
+        void reserve(std::size_t size)
+        {
+            std::size_t capacity = 16;
+            while (capacity * 3 < size * 4)
+                capacity *= 2;
+
+            if (capacity > entries.size())
+                rehash(capacity);
+        }
+
+        void rehash(std::size_t capacity)
+        {
+            auto old_entries = std::move(entries);
+            entries.assign(capacity, entry{{empty, 0, 0}, 0});
+
+            std::size_t const mask = capacity - 1;
+            for (auto const & e : old_entries)
+            {
+                if (e.key[0] == empty) continue;
+
+                std::size_t i = hash(e.key) & mask;
+                while (entries[i].key[0] != empty)
+                    i = (i + 1) & mask;
+                entries[i] = e;
+            }
+        }
+
+        // Returns the index stored for the key and whether it was inserted just now
+        std::pair<std::uint32_t, bool> insert(std::array<std::int32_t, 3> const & key, std::uint32_t value)
+        {
+            if ((count + 1) * 4 > entries.size() * 3)
+                rehash(std::max<std::size_t>(16, entries.size() * 2));
+
+            std::size_t const mask = entries.size() - 1;
+            for (std::size_t i = hash(key) & mask;; i = (i + 1) & mask)
+            {
+                auto & e = entries[i];
+                if (e.key[0] == empty)
+                {
+                    e = {key, value};
+                    ++count;
+                    return {value, true};
+                }
+                if (e.key == key)
+                    return {e.value, false};
+            }
+        }
+    };
+
+    using attribute_counts = std::array<std::size_t, 3>;
+
+    // Converts 1-based and relative OBJ indices into 0-based ones, -1 marking a missing attribute;
+    // counts are the numbers of positions, texcoords and normals defined so far
+    std::array<std::int32_t, 3> resolve_corner(std::array<std::int32_t, 3> index, bool has_texcoord, bool has_normal,
+        attribute_counts const & counts, std::size_t line)
+    {
+        if (index[0] > 0)
+            --index[0];
+        else
+            index[0] = counts[0] + index[0];
+
+        if (has_texcoord)
+        {
+            if (index[1] > 0)
+                --index[1];
+            else
+                index[1] = counts[1] + index[1];
+        }
+        else
+            index[1] = -1;
+
+        if (has_normal)
+        {
+            if (index[2] > 0)
+                --index[2];
+            else
+                index[2] = counts[2] + index[2];
+        }
+        else
+            index[2] = -1;
+
+        if (index[0] >= counts[0])
+            throw_obj_error(line, "bad position index (", index[0], ")");
+
+        if (index[1] != -1 && index[1] >= counts[1])
+            throw_obj_error(line, "bad texcoord index (", index[1], ")");
+
+        if (index[2] != -1 && index[2] >= counts[2])
+            throw_obj_error(line, "bad normal index (", index[2], ")");
+
+        return index;
+    }
+
+    obj_data::vertex make_vertex(std::array<std::int32_t, 3> const & index,
+        std::vector<std::array<float, 3>> const & positions,
+        std::vector<std::array<float, 2>> const & texcoords,
+        std::vector<std::array<float, 3>> const & normals)
+    {
+        obj_data::vertex v;
+
+        v.position = positions[index[0]];
+
+        if (index[1] != -1)
+            v.texcoord = texcoords[index[1]];
+        else
+            v.texcoord = {0.f, 0.f};
+
+        if (index[2] != -1)
+            v.normal = normals[index[2]];
+        else
+            v.normal = {0.f, 0.f, 0.f};
+
+        return v;
+    }
+
+    void triangulate(std::vector<std::uint32_t> const & face, std::vector<std::uint32_t> & indices)
+    {
+        for (std::size_t i = 1; i + 1 < face.size(); ++i)
+        {
+            indices.push_back(face[0]);
+            indices.push_back(face[i]);
+            indices.push_back(face[i + 1]);
+        }
+    }
+
+    // Keeps the submeshes in file order: a change of object, group or material starts a new
+    // submesh at the given index position, or renames the current one if it has no faces yet
+    struct submesh_tracker
+    {
+        enum class tag
+        {
+            object,
+            group,
+            material,
+            material_library,
+        };
+
+        std::vector<obj_data::submesh> submeshes{{{}, {}, obj_data::no_material, 0, 0, {}, {}}};
+        std::vector<std::string> materials;
+        std::vector<std::string> material_libraries;
+
+        void change(tag t, std::string_view name, std::size_t index_position)
+        {
+            if (t == tag::material_library)
+            {
+                material_libraries.emplace_back(name);
+                return;
+            }
+
+            if (submeshes.back().first_index != index_position)
+            {
+                auto next = submeshes.back();
+                next.first_index = index_position;
+                submeshes.push_back(std::move(next));
+            }
+
+            auto & current = submeshes.back();
+            switch (t)
+            {
+            case tag::object:
+                current.object = name;
+                break;
+            case tag::group:
+                current.group = name;
+                break;
+            default:
+                {
+                    auto it = std::find(materials.begin(), materials.end(), name);
+                    current.material = it - materials.begin();
+                    if (it == materials.end())
+                        materials.emplace_back(name);
+                }
+                break;
+            }
+        }
+
+        // Drops the submeshes without faces and computes the bounds of the rest
+        void finish(obj_data & result)
+        {
+            for (std::size_t i = 0; i < submeshes.size(); ++i)
+            {
+                std::size_t const end = (i + 1 < submeshes.size()) ? submeshes[i + 1].first_index : result.indices.size();
+                submeshes[i].index_count = end - submeshes[i].first_index;
+            }
+            std::erase_if(submeshes, [](auto const & submesh){ return submesh.index_count == 0; });
+
+            result.submeshes = std::move(submeshes);
+            result.materials = std::move(materials);
+            result.material_libraries = std::move(material_libraries);
+            compute_submesh_bounds(result);
+        }
+    };
+
+    struct obj_builder
+    {
+        std::vector<std::array<float, 3>> positions;
+        std::vector<std::array<float, 3>> normals;
+        std::vector<std::array<float, 2>> texcoords;
+
+        vertex_index_map index_map;
+
+        std::vector<std::uint32_t> face;
+
+        obj_data result;
+        submesh_tracker submeshes;
+
+        // Vertices already handed out and removed from the result when streaming
+        std::size_t flushed_vertex_count = 0;
+
+        void reserve_faces(std::size_t face_count)
+        {
+            index_map.reserve(face_count);
+            result.indices.reserve(face_count * 3);
+        }
+
+        std::array<float, 3> & add_position() { return positions.emplace_back(); }
+        std::array<float, 3> & add_normal() { return normals.emplace_back(); }
+        std::array<float, 2> & add_texcoord() { return texcoords.emplace_back(); }
+
+        void add_corner(std::array<std::int32_t, 3> index, bool has_texcoord, bool has_normal, std::size_t line)
+        {
+            index = resolve_corner(index, has_texcoord, has_normal, {positions.size(), texcoords.size(), normals.size()}, line);
+
+            auto [vertex_index, inserted] = index_map.insert(index, flushed_vertex_count + result.vertices.size());
+            if (inserted)
+                result.vertices.push_back(make_vertex(index, positions, texcoords, normals));
+
+            face.push_back(vertex_index);
+        }
+
+        void end_face()
+        {
+            triangulate(face, result.indices);
+            face.clear();
+        }
+
+        void change_submesh(submesh_tracker::tag tag, std::string_view name)
+        {
+            submeshes.change(tag, name, result.indices.size());
+        }
+
+        obj_data finish()
+        {
+            submeshes.finish(result);
+            return std::move(result);
+        }
+    };
+
+    struct obj_stream_builder
+        : obj_builder
+    {
+        std::size_t batch_size;
+        std::function<void(obj_batch const &)> const & on_batch;
+
+        std::size_t flushed_index_count = 0;
+
+        obj_stream_builder(std::size_t batch_size, std::function<void(obj_batch const &)> const & on_batch)
+            : batch_size(batch_size)
+            , on_batch(on_batch)
+        {
+            result.vertices.reserve(batch_size);
+            result.indices.reserve(batch_size * 3);
+        }
+
+        void end_face()
+        {
+            obj_builder::end_face();
+
+            if (result.vertices.size() >= batch_size || result.indices.size() >= batch_size * 3)
+                flush();
+        }
+
+        // Submeshes are not reported when streaming
+        void change_submesh(submesh_tracker::tag, std::string_view) {}
+
+        void flush()
+        {
+            if (result.vertices.empty() && result.indices.empty())
+                return;
+
+            on_batch({flushed_vertex_count, flushed_index_count, result.vertices, result.indices});
+
+            flushed_vertex_count += result.vertices.size();
+            flushed_index_count += result.indices.size();
+            result.vertices.clear();
+            result.indices.clear();
+        }
+    };
+
+    // Part of the file between two line breaks, parsed independently of the others
+    struct obj_chunk
+    {
+        struct corner
+        {
+            std::array<std::int32_t, 3> index;
+            bool has_texcoord;
+            bool has_normal;
+        };
+
+        struct face
+        {
+            std::size_t corner_end;
+            std::size_t line;
+            attribute_counts counts;
+        };
+
+        struct submesh_change
+        {
+            submesh_tracker::tag tag;
+            std::string name;
+            // Number of faces before the change, an index position after resolve()
+            std::size_t position;
+        };
+
+        std::vector<std::array<float, 3>> positions;
+        std::vector<std::array<float, 3>> normals;
+        std::vector<std::array<float, 2>> texcoords;
+
+        std::vector<corner> corners;
+        std::vector<face> faces;
+        std::vector<submesh_change> submesh_changes;
+        std::size_t face_line = 0;
+
+        std::size_t line_count = 0;
+        std::optional<obj_error> error;
+
+        // Unique resolved corners in order of first use, and indices into them
+        std::vector<std::array<std::int32_t, 3>> vertices;
+        std::vector<std::uint32_t> indices;
+        std::vector<std::uint32_t> vertex_remap;
+
+        std::array<float, 3> & add_position() { return positions.emplace_back(); }
+        std::array<float, 3> & add_normal() { return normals.emplace_back(); }
+        std::array<float, 2> & add_texcoord() { return texcoords.emplace_back(); }
+
+        void add_corner(std::array<std::int32_t, 3> index, bool has_texcoord, bool has_normal, std::size_t line)
+        {
+            corners.push_back({index, has_texcoord, has_normal});
+            face_line = line;
+        }
+
+        void end_face()
+        {
+            if (!faces.empty() && faces.back().corner_end == corners.size())
+                return;
+
+            faces.push_back({corners.size(), face_line, {positions.size(), texcoords.size(), normals.size()}});
+        }
+
+        void change_submesh(submesh_tracker::tag tag, std::string_view name)
+        {
+            submesh_changes.push_back({tag, std::string(name), faces.size()});
+        }
+
+        // base holds the numbers of attributes defined in all previous chunks
+        void resolve(attribute_counts const & base)
+        {
+            vertex_index_map index_map;
+            index_map.reserve(faces.size());
+
+            std::vector<std::uint32_t> face_vertices;
+
+            auto change = submesh_changes.begin();
+            std::size_t c = 0;
+            for (std::size_t i = 0; i < faces.size(); ++i)
+            {
+                auto const & f = faces[i];
+
+                for (; change != submesh_changes.end() && change->position == i; ++change)
+                    change->position = indices.size();
+
+                attribute_counts const counts{base[0] + f.counts[0], base[1] + f.counts[1], base[2] + f.counts[2]};
+
+                face_vertices.clear();
+                for (; c < f.corner_end; ++c)
+                {
+                    auto index = resolve_corner(corners[c].index, corners[c].has_texcoord, corners[c].has_normal, counts, f.line);
+
+                    auto [vertex_index, inserted] = index_map.insert(index, vertices.size());
+                    if (inserted)
+                        vertices.push_back(index);
+
+                    face_vertices.push_back(vertex_index);
+                }
+
+                triangulate(face_vertices, indices);
+            }
+
+            for (; change != submesh_changes.end(); ++change)
+                change->position = indices.size();
+
+            corners = {};
+            faces = {};
+        }
+    };
+
+    // Runs function(i) for every i < count on up to thread_count threads
+    template <typename Function>
+    void parallel_for(std::size_t count, Function const & function, std::size_t thread_count = std::size_t(-1))
+    {
+        std::vector<std::exception_ptr> errors(count);
+        std::atomic<std::size_t> next{0};
+
+        auto task = [&]
+        {
+            for (std::size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;)
+            {
+                try
+                {
+                    function(i);
+                }
+                catch (...)
+                {
+                    errors[i] = std::current_exception();
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (std::size_t i = 1; i < std::min(count, thread_count); ++i)
+            threads.emplace_back(task);
+        task();
+
+        for (auto & thread : threads)
+            thread.join();
+
+        for (auto const & error : errors)
+            if (error)
+                std::rethrow_exception(error);
+    }
+
+    bool is_blank(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    bool is_digit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    std::size_t count_face_lines(char const * p, char const * end)
+    {
+        std::size_t count = 0;
+        while (p != end)
+        {
+            while (p != end && (is_blank(*p) || *p == '\n'))
+                ++p;
+
+            if (end - p >= 2 && p[0] == 'f' && is_blank(p[1]))
+                ++count;
+
+            p = static_cast<char const *>(std::memchr(p, '\n', end - p));
+            if (!p)
+                break;
+        }
+        return count;
+    }
+
+    // Powers of ten that are exactly representable as float
+    constexpr float exact_powers_of_10[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+    struct line_scanner
+    {
+        char const * p;
+        char const * end;
+
+        bool at_end() const
+        {
+            return p == end;
+        }
+
+        bool at_blank() const
+        {
+            return p == end || is_blank(*p);
+        }
+
+        void skip_blanks()
+        {
+            while (p != end && is_blank(*p))
+                ++p;
+        }
+
+        // The rest of the line without surrounding blanks
+        std::string_view rest()
+        {
+            skip_blanks();
+            char const * last = end;
+            while (last != p && is_blank(last[-1]))
+                --last;
+            std::string_view result(p, last - p);
+            p = end;
+            return result;
+        }
+
+        std::string_view token()
+        {
+            skip_blanks();
+            char const * begin = p;
+            while (p != end && !is_blank(*p))
+                ++p;
+            return {begin, static_cast<std::size_t>(p - begin)};
+        }
+
+        bool read_int(std::int32_t & value)
+        {
+            skip_blanks();
+
+            char const * q = p;
+            bool negative = false;
+            if (q != end && (*q == '+' || *q == '-'))
+                negative = (*q++ == '-');
+
+            if (q == end || !is_digit(*q))
+                return false;
+
+            std::int64_t result = 0;
+            for (; q != end && is_digit(*q); ++q)
+            {
+                result = result * 10 + (*q - '0');
+                if (result > std::numeric_limits<std::int32_t>::max() + std::int64_t(1))
+                    return false;
+            }
+
+            if (negative)
+                result = -result;
+
+            if (result > std::numeric_limits<std::int32_t>::max() || result < std::numeric_limits<std::int32_t>::min())
+                return false;
+
+            value = result;
+            p = q;
+            return true;
+        }
+
+        bool read_float(float & value)
+        {
+            skip_blanks();
+
+            char const * q = p;
+            bool negative = false;
+            if (q != end && (*q == '+' || *q == '-'))
+                negative = (*q++ == '-');
+
+            std::uint32_t mantissa = 0;
+            int exponent = 0;
+            bool has_digits = false;
+            bool exact = true;
+
+            auto add_digit = [&](char c)
+            {
+                has_digits = true;
+                if (mantissa < (1u << 24) / 10)
+                    mantissa = mantissa * 10 + (c - '0');
+                else
+                    exact = false;
+            };
+
+            for (; q != end && is_digit(*q); ++q)
+                add_digit(*q);
+
+            if (q != end && *q == '.')
+            {
+                for (++q; q != end && is_digit(*q); ++q)
+                {
+                    add_digit(*q);
+                    --exponent;
+                }
+            }
+
+            if (q != end && (*q == 'e' || *q == 'E'))
+                exact = false;
+
+            // A 24-bit mantissa and a power of ten up to 1e10 are both exact floats,
+            // so a single correctly rounded division gives the same result as strtof
+            if (has_digits && exact && exponent >= -10)
+            {
+                value = static_cast<float>(mantissa) / exact_powers_of_10[-exponent];
+                if (negative)
+                    value = -value;
+                p = q;
+                return true;
+            }
+
+            return read_float_slow(value);
+        }
+
+        bool read_float_slow(float & value)
+        {
+            char const * q = p;
+            while (q != end && (is_digit(*q) || *q == '+' || *q == '-' || *q == '.' || *q == 'e' || *q == 'E'))
+                ++q;
+
+            std::string number(p, q);
+            char * number_end;
+            float result = std::strtof(number.c_str(), &number_end);
+            if (number_end == number.c_str())
+                return false;
+
+            value = result;
+            p += (number_end - number.c_str());
+            return true;
+        }
+    };
+
+    // Upper bounds on the vertex and index counts (every corner is a new vertex)
+    // and the bounding box of the positions; malformed lines are left to the parser
+    obj_stream_info scan_obj(char const * p, char const * end)
+    {
+        obj_stream_info result;
+        result.max_counts = {0, 0};
+        result.position_min.fill(std::numeric_limits<float>::infinity());
+        result.position_max.fill(-std::numeric_limits<float>::infinity());
+        while (p != end)
+        {
+            while (p != end && (is_blank(*p) || *p == '\n'))
+                ++p;
+
+            char const * line_end = static_cast<char const *>(std::memchr(p, '\n', end - p));
+            if (!line_end)
+                line_end = end;
+
+            if (line_end - p >= 2 && p[0] == 'f' && is_blank(p[1]))
+            {
+                std::size_t corners = 0;
+                for (char const * q = p + 1; q != line_end;)
+                {
+                    while (q != line_end && is_blank(*q))
+                        ++q;
+                    if (q == line_end)
+                        break;
+                    ++corners;
+                    while (q != line_end && !is_blank(*q))
+                        ++q;
+                }
+
+                result.max_counts.vertex_count += corners;
+                if (corners >= 3)
+                    result.max_counts.index_count += (corners - 2) * 3;
+            }
+            else if (line_end - p >= 2 && p[0] == 'v' && is_blank(p[1]))
+            {
+                line_scanner scanner{p + 1, line_end};
+                std::array<float, 3> position;
+                if (scanner.read_float(position[0]) && scanner.read_float(position[1]) && scanner.read_float(position[2]))
+                {
+                    for (int i = 0; i < 3; ++i)
+                    {
+                        result.position_min[i] = std::min(result.position_min[i], position[i]);
+                        result.position_max[i] = std::max(result.position_max[i], position[i]);
+                    }
+                }
+            }
+
+            p = line_end;
+        }
+        return result;
+    }
+
+    // Parses [begin, end) and returns the number of non-blank lines in it,
+    // like std::getline(is >> std::ws, ...) in parse_obj blank lines are not counted
+    template <typename Sink>
+    std::size_t parse_lines(char const * begin, char const * end, Sink & sink)
+    {
+        std::size_t line_count = 0;
+
+        auto fail = [&](auto const & ... args){
+            throw_obj_error(line_count, args...);
+        };
+
+        char const * p = begin;
+        while (p != end)
+        {
+            if (is_blank(*p) || *p == '\n')
+            {
+                ++p;
+                continue;
+            }
+
+            char const * line_end = static_cast<char const *>(std::memchr(p, '\n', end - p));
+            if (!line_end)
+                line_end = end;
+
+            line_scanner ls{p, line_end};
+            p = line_end;
+
+            ++line_count;
+
+            if (*ls.p == '#') continue;
+
+            auto tag = ls.token();
+
+            if (tag == "v")
+            {
+                auto & v = sink.add_position();
+                ls.read_float(v[0]) && ls.read_float(v[1]) && ls.read_float(v[2]);
+            }
+            else if (tag == "vn")
+            {
+                auto & n = sink.add_normal();
+                ls.read_float(n[0]) && ls.read_float(n[1]) && ls.read_float(n[2]);
+            }
+            else if (tag == "vt")
+            {
+                auto & t = sink.add_texcoord();
+                ls.read_float(t[0]) && ls.read_float(t[1]);
+            }
+            else if (tag == "f")
+            {
+                while (true)
+                {
+                    ls.skip_blanks();
+                    if (ls.at_end()) break;
+
+                    std::array<std::int32_t, 3> index{0, 0, 0};
+                    bool has_texcoord = false;
+                    bool has_normal = false;
+
+                    if (!ls.read_int(index[0]))
+                        fail("expected position index");
+
+                    if (!ls.at_blank())
+                    {
+                        if (*ls.p++ != '/')
+                            fail("expected '/'");
+
+                        if (ls.at_end() || *ls.p != '/')
+                        {
+                            if (!ls.read_int(index[1]))
+                                fail("expected texcoord index");
+                            has_texcoord = true;
+
+                            if (!ls.at_blank())
+                            {
+                                if (*ls.p++ != '/')
+                                    fail("expected '/'");
+
+                                if (!ls.read_int(index[2]))
+                                    fail("expected normal index");
+                                has_normal = true;
+                            }
+                        }
+                        else
+                        {
+                            ++ls.p;
+
+                            if (!ls.read_int(index[2]))
+                                fail("expected normal index");
+                            has_normal = true;
+                        }
+                    }
+
+                    sink.add_corner(index, has_texcoord, has_normal, line_count);
+                }
+
+                sink.end_face();
+            }
+            else if (tag == "o")
+                sink.change_submesh(submesh_tracker::tag::object, ls.rest());
+            else if (tag == "g")
+                sink.change_submesh(submesh_tracker::tag::group, ls.rest());
+            else if (tag == "usemtl")
+                sink.change_submesh(submesh_tracker::tag::material, ls.rest());
+            else if (tag == "mtllib")
+                sink.change_submesh(submesh_tracker::tag::material_library, ls.rest());
+        }
+
+        return line_count;
+    }
+
+    // Splits [begin, end) into up to count pieces ending at line breaks
+    std::vector<std::pair<char const *, char const *>> split_lines(char const * begin, char const * end, std::size_t count)
+    {
+        std::vector<std::pair<char const *, char const *>> result;
+
+        char const * p = begin;
+        for (std::size_t i = 1; i <= count && p != end; ++i)
+        {
+            char const * split = (i == count) ? end : begin + (end - begin) * i / count;
+            if (split < p)
+                split = p;
+
+            if (split != end)
+            {
+                split = static_cast<char const *>(std::memchr(split, '\n', end - split));
+                split = split ? split + 1 : end;
+            }
+
+            result.push_back({p, split});
+            p = split;
+        }
+
+        return result;
+    }
+
+    // Resolves the chunks, parsed in file order, against the attributes of the ones before them,
+    // then joins them into one mesh with the same vertices and indices as a sequential parse
+    obj_data merge_chunks(std::vector<obj_chunk> & chunks, std::size_t thread_count)
+    {
+        std::vector<attribute_counts> bases(chunks.size());
+        for (std::size_t i = 1; i < chunks.size(); ++i)
+        {
+            bases[i][0] = bases[i - 1][0] + chunks[i - 1].positions.size();
+            bases[i][1] = bases[i - 1][1] + chunks[i - 1].texcoords.size();
+            bases[i][2] = bases[i - 1][2] + chunks[i - 1].normals.size();
+        }
+
+        parallel_for(chunks.size(), [&](std::size_t i){
+            try
+            {
+                chunks[i].resolve(bases[i]);
+            }
+            catch (obj_error const & e)
+            {
+                // Always precedes a syntax error found in the same chunk
+                chunks[i].error = e;
+            }
+        }, thread_count);
+
+        std::size_t line_offset = 0;
+        for (auto const & chunk : chunks)
+        {
+            if (chunk.error)
+                throw obj_error(line_offset + chunk.error->line, chunk.error->reason);
+            line_offset += chunk.line_count;
+        }
+
+        std::vector<std::array<float, 3>> positions;
+        std::vector<std::array<float, 3>> normals;
+        std::vector<std::array<float, 2>> texcoords;
+
+        std::size_t vertex_upper_bound = 0;
+        std::size_t index_count = 0;
+        for (auto const & chunk : chunks)
+        {
+            positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+            normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+            texcoords.insert(texcoords.end(), chunk.texcoords.begin(), chunk.texcoords.end());
+            vertex_upper_bound += chunk.vertices.size();
+            index_count += chunk.indices.size();
+        }
+
+        // Merging unique vertices chunk by chunk in order of first use
+        // gives the same vertex order as parsing the whole file sequentially
+        obj_data result;
+        result.vertices.reserve(vertex_upper_bound);
+
+        vertex_index_map index_map;
+        index_map.reserve(vertex_upper_bound);
+
+        for (auto & chunk : chunks)
+        {
+            chunk.vertex_remap.resize(chunk.vertices.size());
+            for (std::size_t i = 0; i < chunk.vertices.size(); ++i)
+            {
+                auto [vertex_index, inserted] = index_map.insert(chunk.vertices[i], result.vertices.size());
+                if (inserted)
+                    result.vertices.push_back(make_vertex(chunk.vertices[i], positions, texcoords, normals));
+                chunk.vertex_remap[i] = vertex_index;
+            }
+        }
+
+        result.indices.resize(index_count);
+
+        std::vector<std::size_t> index_offsets(chunks.size(), 0);
+        for (std::size_t i = 1; i < chunks.size(); ++i)
+            index_offsets[i] = index_offsets[i - 1] + chunks[i - 1].indices.size();
+
+        parallel_for(chunks.size(), [&](std::size_t i){
+            auto const & chunk = chunks[i];
+            std::uint32_t * output = result.indices.data() + index_offsets[i];
+            for (std::uint32_t index : chunk.indices)
+                *output++ = chunk.vertex_remap[index];
+        }, thread_count);
+
+        // The object, group and material in effect carry over from one chunk to the next
+        submesh_tracker submeshes;
+        for (std::size_t i = 0; i < chunks.size(); ++i)
+            for (auto const & change : chunks[i].submesh_changes)
+                submeshes.change(change.tag, change.name, index_offsets[i] + change.position);
+        submeshes.finish(result);
+
+        return result;
+    }
+
+}
+
+void compute_submesh_bounds(obj_data & mesh)
+{
+    for (auto & submesh : mesh.submeshes)
+    {
+        submesh.min.fill(std::numeric_limits<float>::infinity());
+        submesh.max.fill(-std::numeric_limits<float>::infinity());
+
+        for (std::size_t i = submesh.first_index; i < submesh.first_index + submesh.index_count; ++i)
+        {
+            auto const & position = mesh.vertices[mesh.indices[i]].position;
+            for (int k = 0; k < 3; ++k)
+            {
+                submesh.min[k] = std::min(submesh.min[k], position[k]);
+                submesh.max[k] = std::max(submesh.max[k], position[k]);
+            }
+        }
+    }
+}
+
+obj_data parse_obj(std::filesystem::path const & path)
+{
+    std::ifstream is(path);
+
+    obj_builder builder;
+
+    std::string line;
+    std::size_t line_count = 0;
+
+    auto fail = [&](auto const & ... args){
+        throw_obj_error(line_count, args...);
+    };
+
+    while (std::getline(is >> std::ws, line))
+    {
+        ++line_count;
+
+        if (line.empty()) continue;
+
+        if (line[0] == '#') continue;
+
+        std::istringstream ls(std::move(line));
+
+        std::string tag;
+        ls >> tag;
+
+        if (tag == "v")
+        {
+            auto & p = builder.add_position();
+            ls >> p[0] >> p[1] >> p[2];
+        }
+        else if (tag == "vn")
+        {
+            auto & n = builder.add_normal();
+            ls >> n[0] >> n[1] >> n[2];
+        }
+        else if (tag == "vt")
+        {
+            auto & t = builder.add_texcoord();
+            ls >> t[0] >> t[1];
+        }
+        else if (tag == "f")
+        {
+            while (ls)
+            {
+                std::array<std::int32_t, 3> index{0, 0, 0};
+                bool has_texcoord = false;
+                bool has_normal = false;
+
+                // Reading the last index of the line can reach its end too, so the end is
+                // checked for before the index rather than after it
+                if (!(ls >> std::ws) || ls.eof())
+                    break;
+
+                ls >> index[0];
+                if (!ls)
+                    fail("expected position index");
+
+                if (!std::isspace(ls.peek()) && !ls.eof())
+                {
+                    if (ls.get() != '/')
+                        fail("expected '/'");
+
+                    if (ls.peek() != '/')
+                    {
+                        ls >> index[1];
+                        if (!ls)
+                            fail("expected texcoord index");
+                        has_texcoord = true;
+
+                        if (!std::isspace(ls.peek()) && !ls.eof())
+                        {
+                            if (ls.get() != '/')
+                                fail("expected '/'");
+
+                            ls >> index[2];
+                            if (!ls)
+                                fail("expected normal index");
+                            has_normal = true;
+                        }
+                    }
+                    else
+                    {
+                        ls.get();
+
+                        ls >> index[2];
+                        if (!ls)
+                            fail("expected normal index");
+                        has_normal = true;
+                    }
+                }
+
+                builder.add_corner(index, has_texcoord, has_normal, line_count);
+            }
+
+            builder.end_face();
+        }
+        else if (tag == "o" || tag == "g" || tag == "usemtl" || tag == "mtllib")
+        {
+            std::string name;
+            std::getline(ls >> std::ws, name);
+            while (!name.empty() && is_blank(name.back()))
+                name.pop_back();
+
+            auto const submesh_tag = (tag == "o") ? submesh_tracker::tag::object
+                : (tag == "g") ? submesh_tracker::tag::group
+                : (tag == "usemtl") ? submesh_tracker::tag::material
+                : submesh_tracker::tag::material_library;
+            builder.change_submesh(submesh_tag, name);
+        }
+    }
+
+    return builder.finish();
+}
+
+
+obj_data parse_obj_mapped(std::filesystem::path const & path)
+{
+    mapped_file file(path);
+
+    char const * begin = file.data();
+    char const * end = begin + file.size();
+
+    obj_builder builder;
+    builder.reserve_faces(count_face_lines(begin, end));
+
+    parse_lines(begin, end, builder);
+
+    return builder.finish();
+}
+
+obj_data parse_obj_parallel(std::filesystem::path const & path, unsigned int thread_count)
+{
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    mapped_file file(path);
+
+    char const * begin = file.data();
+    char const * end = begin + file.size();
+
+    // Small files are not worth the threads
+    std::size_t const min_chunk_size = 1 << 20;
+    std::size_t const chunk_count = std::clamp<std::size_t>(file.size() / min_chunk_size, 1, thread_count);
+
+    auto const ranges = split_lines(begin, end, chunk_count);
+    std::vector<obj_chunk> chunks(ranges.size());
+
+    parallel_for(chunks.size(), [&](std::size_t i){
+        try
+        {
+            chunks[i].line_count = parse_lines(ranges[i].first, ranges[i].second, chunks[i]);
+        }
+        catch (obj_error const & e)
+        {
+            chunks[i].error = e;
+        }
+    });
+
+    return merge_chunks(chunks, chunks.size());
+}
+
+obj_data parse_obj_compressed(std::filesystem::path const & path)
+{
+    decompressing_reader reader(path);
+
+    obj_builder builder;
+    std::size_t line_offset = 0;
+
+    auto const parse = [&](char const * begin, char const * end){
+        try
+        {
+            line_offset += parse_lines(begin, end, builder);
+        }
+        catch (obj_error const & e)
+        {
+            throw obj_error(line_offset + e.line, e.reason);
+        }
+    };
+
+    // The line a block ends in the middle of, completed by the blocks after it
+    std::string partial;
+
+    for (std::string_view block; !(block = reader.next()).empty();)
+    {
+        char const * begin = block.data();
+        char const * end = begin + block.size();
+
+        char const * first_break = static_cast<char const *>(std::memchr(begin, '\n', end - begin));
+        if (!first_break)
+        {
+            partial.append(begin, end);
+            continue;
+        }
+
+        if (!partial.empty())
+        {
+            partial.append(begin, first_break + 1);
+            parse(partial.data(), partial.data() + partial.size());
+            partial.clear();
+            begin = first_break + 1;
+        }
+
+        char const * last_break = end;
+        while (last_break[-1] != '\n')
+            --last_break;
+
+        parse(begin, last_break);
+        partial.assign(last_break, end);
+    }
+
+    parse(partial.data(), partial.data() + partial.size());
+
+    return builder.finish();
+}
+
+obj_data parse_obj_async(std::filesystem::path const & path, unsigned int thread_count)
+{
+    // Whatever is compressed is only ever read once, front to back
+    if (detect_compression(path) != compression::none)
+        return parse_obj_compressed(path);
+
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    async_file file(path);
+
+    char const * data = file.data();
+    std::size_t const size = file.size();
+    std::size_t const block_size = file.block_size();
+
+    // Chunk i holds the lines starting in block i, it can be parsed once the blocks up to the end
+    // of its last line have arrived; an empty file still makes one empty chunk
+    std::size_t const chunk_count = std::max<std::size_t>(1, file.block_count());
+    std::vector<obj_chunk> chunks(chunk_count);
+    std::vector<std::exception_ptr> errors(chunk_count);
+
+    std::vector<bool> arrived(file.block_count(), false);
+    std::vector<std::optional<std::size_t>> line_starts(chunk_count + 1);
+    std::size_t dispatched = 0;
+    std::vector<bool> chunk_dispatched(chunk_count, false);
+
+    // The first line start at or after the start of block k, unknown until every block between
+    // it and the line break before it has arrived
+    auto const line_start = [&](std::size_t k) -> std::optional<std::size_t> {
+        if (line_starts[k])
+            return line_starts[k];
+        std::size_t const begin = k * block_size;
+        if (k == 0 || begin >= size)
+            return line_starts[k] = std::min(begin, size);
+
+        for (std::size_t p = begin - 1; p < size;)
+        {
+            std::size_t const block = p / block_size;
+            if (!arrived[block])
+                return std::nullopt;
+            std::size_t const block_end = std::min(size, (block + 1) * block_size);
+            if (auto found = static_cast<char const *>(std::memchr(data + p, '\n', block_end - p)))
+                return line_starts[k] = found - data + 1;
+            p = block_end;
+        }
+        return line_starts[k] = size;
+    };
+
+    std::mutex mutex;
+    std::condition_variable ready_cv;
+    std::deque<std::size_t> ready;
+    bool reading = true;
+
+    auto const work = [&]
+    {
+        for (;;)
+        {
+            std::unique_lock lock{mutex};
+            ready_cv.wait(lock, [&]{ return !ready.empty() || !reading; });
+            if (ready.empty())
+                return;
+            std::size_t const i = ready.front();
+            ready.pop_front();
+            lock.unlock();
+
+            try
+            {
+                chunks[i].line_count = parse_lines(data + *line_starts[i], data + *line_starts[i + 1], chunks[i]);
+            }
+            catch (obj_error const & e)
+            {
+                chunks[i].error = e;
+            }
+            catch (...)
+            {
+                errors[i] = std::current_exception();
+            }
+        }
+    };
+
+    // Whether every block holding a byte of [begin, end) has arrived
+    auto const filled = [&](std::size_t begin, std::size_t end)
+    {
+        for (std::size_t block = begin / block_size; block * block_size < end; ++block)
+            if (!arrived[block])
+                return false;
+        return true;
+    };
+
+    // Only this thread finds line starts, the workers read the ones of the chunks handed to them.
+    // A block can complete the chunks on either side of it, or further back across a long line.
+    // Finding the line starts of a chunk is not enough to parse it: those of the first chunk and
+    // past the end of the file are known before anything has been read.
+    std::size_t first_pending = 0;
+    auto const dispatch = [&]
+    {
+        for (std::size_t i = first_pending; i < chunk_count; ++i)
+        {
+            if (chunk_dispatched[i] || !line_start(i) || !line_start(i + 1) || !filled(*line_starts[i], *line_starts[i + 1]))
+                continue;
+            chunk_dispatched[i] = true;
+            ++dispatched;
+
+            std::lock_guard lock{mutex};
+            ready.push_back(i);
+            ready_cv.notify_one();
+        }
+        while (first_pending < chunk_count && chunk_dispatched[first_pending])
+            ++first_pending;
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < thread_count; ++i)
+        threads.emplace_back(work);
+
+    auto const stop = [&]
+    {
+        {
+            std::lock_guard lock{mutex};
+            reading = false;
+        }
+        ready_cv.notify_all();
+        for (auto & thread : threads)
+            thread.join();
+    };
+
+    try
+    {
+        // An empty file has no blocks to wait for
+        if (size == 0)
+            dispatch();
+        file.read([&](std::size_t block){
+            arrived[block] = true;
+            dispatch();
+        });
+    }
+    catch (...)
+    {
+        stop();
+        throw;
+    }
+    stop();
+
+    if (dispatched != chunk_count)
+        throw std::runtime_error("Not all of " + path.string() + " was parsed");
+    for (auto const & error : errors)
+        if (error)
+            std::rethrow_exception(error);
+
+    return merge_chunks(chunks, thread_count);
+}
+
+obj_counts stream_obj(std::filesystem::path const & path, std::size_t batch_size,
+    std::function<void(obj_stream_info const &)> const & on_begin,
+    std::function<void(obj_batch const &)> const & on_batch)
+{
+    mapped_file file(path);
+
+    char const * begin = file.data();
+    char const * end = begin + file.size();
+
+    auto const info = scan_obj(begin, end);
+    on_begin(info);
+
+    obj_stream_builder builder(batch_size, on_batch);
+    builder.index_map.reserve(info.max_counts.index_count / 3);
+
+    parse_lines(begin, end, builder);
+    builder.flush();
+
+    return {builder.flushed_vertex_count, builder.flushed_index_count};
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <span>
+
+struct obj_data
+{
+    struct vertex
+    {
+        std::array<float, 3> position;
+        std::array<float, 3> normal;
+        std::array<float, 2> texcoord;
+    };
+
+    // A run of faces sharing the object (o), group (g) and material (usemtl) in effect,
+    // in file order. Together the submeshes cover the index buffer without gaps.
+    struct submesh
+    {
+        std::string object;
+        std::string group;
+        // Index into materials, or no_material for faces before any usemtl
+        std::uint32_t material;
+        std::uint32_t first_index;
+        std::uint32_t index_count;
+        std::array<float, 3> min;
+        std::array<float, 3> max;
+    };
+
+    static constexpr std::uint32_t no_material = -1;
+
+    std::vector<vertex> vertices;
+    std::vector<std::uint32_t> indices;
+
+    // Empty unless generate_tangents ran, one per vertex otherwise: the unit tangent along
+    // increasing u and, in w, the sign such that bitangent = w * cross(normal, tangent)
+    std::vector<std::array<float, 4>> tangents;
+
+    // Empty unless bake_occlusion ran, one per vertex otherwise: 255 for a fully open hemisphere
+    std::vector<std::uint8_t> occlusion;
+
+    std::vector<submesh> submeshes;
+    // Names given to usemtl, in order of first use
+    std::vector<std::string> materials;
+    // Files named by mtllib, as written; they are not read
+    std::vector<std::string> material_libraries;
+};
+
+// Recomputes the bounding box of every submesh from the vertices its indices use
+void compute_submesh_bounds(obj_data & mesh);
+
+obj_data parse_obj(std::filesystem::path const & path);
+
+obj_data parse_obj_mapped(std::filesystem::path const & path);
+
+// Parses the file in chunks on thread_count threads, 0 meaning all hardware threads
+obj_data parse_obj_parallel(std::filesystem::path const & path, unsigned int thread_count = 0);
+
+// Reads the file with many large reads in flight through async_file and parses each block's
+// lines on thread_count threads as soon as they have arrived, rather than after the whole file
+// or as page faults bring it in; the result is the same as parse_obj_parallel's. A gzip or zstd
+// file goes to parse_obj_compressed instead.
+obj_data parse_obj_async(std::filesystem::path const & path, unsigned int thread_count = 0);
+
+// Parses a .obj.gz or .obj.zst without decompressing it to disk: one thread decompresses it in
+// blocks while this one parses the lines of the blocks before
+obj_data parse_obj_compressed(std::filesystem::path const & path);
+
+struct obj_counts
+{
+    std::size_t vertex_count;
+    std::size_t index_count;
+};
+
+struct obj_stream_info
+{
+    // Upper bounds on the final counts
+    obj_counts max_counts;
+    std::array<float, 3> position_min;
+    std::array<float, 3> position_max;
+};
+
+struct obj_batch
+{
+    // Positions of this batch within the whole vertex and index arrays
+    std::size_t vertex_offset;
+    std::size_t index_offset;
+
+    std::span<obj_data::vertex const> vertices;
+    std::span<std::uint32_t const> indices;
+};
+
+// Parses the file without keeping the whole mesh in memory: on_begin receives upper bounds
+// on the vertex and index counts and the position bounding box, then finished vertices
+// and indices are handed to on_batch about batch_size vertices at a time.
+// Returns the actual counts. Objects, groups and materials are not reported.
+obj_counts stream_obj(std::filesystem::path const & path, std::size_t batch_size,
+    std::function<void(obj_stream_info const &)> const & on_begin,
+    std::function<void(obj_batch const &)> const & on_batch);
@@ -0,0 +1,101 @@
+#include "obj_parser.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+
+// Parses small OBJ files with each entry point and checks that they all give what parse_obj
+// does, and that none of them loses a corner at the end of a line. The files fit in one read block, whose chunk is ready to be parsed as soon as the
+// read completes, so parse_obj_async is run many times over to catch it parsing too early.
+
+namespace
+{
+
+    int failures = 0;
+
+    void check(bool condition, std::string const & what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED: " << what << std::endl;
+            ++failures;
+        }
+    }
+
+    bool same(obj_data const & a, obj_data const & b)
+    {
+        if (a.vertices.size() != b.vertices.size() || a.indices != b.indices || a.submeshes.size() != b.submeshes.size())
+            return false;
+        for (std::size_t i = 0; i < a.vertices.size(); ++i)
+            if (a.vertices[i].position != b.vertices[i].position
+                || a.vertices[i].normal != b.vertices[i].normal
+                || a.vertices[i].texcoord != b.vertices[i].texcoord)
+                return false;
+        for (std::size_t i = 0; i < a.submeshes.size(); ++i)
+            if (a.submeshes[i].first_index != b.submeshes[i].first_index || a.submeshes[i].index_count != b.submeshes[i].index_count)
+                return false;
+        return a.materials == b.materials;
+    }
+
+    std::filesystem::path write_file(std::filesystem::path const & directory, std::string const & name, std::string const & contents)
+    {
+        auto const path = directory / name;
+        std::ofstream(path, std::ios::binary) << contents;
+        return path;
+    }
+
+}
+
+int main()
+{
+    auto const directory = std::filesystem::temp_directory_path() / "obj_parser_check";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+
+    std::string const quad =
+        "v 0 0 0\n"
+        "v 1 0 0\n"
+        "v 1 1 0\n"
+        "v 0 1 0\n"
+        "vt 0 0\n"
+        "vt 1 1\n"
+        "vn 0 0 1\n"
+        "usemtl a\n"
+        "f 1/1/1 2/1/1 3/2/1\n"
+        "usemtl b\n"
+        "f 1/1/1 3/2/1 4/2/1\n";
+
+    auto const files = {
+        write_file(directory, "quad.obj", quad),
+        // Without the line break at the end
+        write_file(directory, "unterminated.obj", quad.substr(0, quad.size() - 1)),
+        // Positions only, with and without whitespace after the last corner of a line
+        write_file(directory, "unslashed.obj", "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nf 1 2 3 \t\nf 1 3 4"),
+    };
+
+    for (auto const & path : files)
+    {
+        auto const name = path.filename().string();
+        auto const reference = parse_obj(path);
+        check(reference.indices.size() == 6, name + " has both triangles");
+
+        check(same(parse_obj_mapped(path), reference), name + ": parse_obj_mapped matches parse_obj");
+        check(same(parse_obj_parallel(path), reference), name + ": parse_obj_parallel matches parse_obj");
+
+        int const runs = 20000;
+        int mismatches = 0;
+        for (int run = 0; run < runs; ++run)
+            if (!same(parse_obj_async(path), reference))
+                ++mismatches;
+        check(mismatches == 0, name + ": parse_obj_async matches parse_obj on every run, not on " + std::to_string(mismatches) + " of " + std::to_string(runs));
+    }
+
+    check(parse_obj_async(write_file(directory, "empty.obj", "")).vertices.empty(), "an empty file parses to nothing");
+
+    std::filesystem::remove_all(directory);
+
+    if (failures == 0)
+        std::cout << "obj parser checks passed" << std::endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,160 @@
+#include "point_octree.hpp"
+#include "vertex_quantization.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <deque>
+
+namespace
+{
+
+    struct pending_node
+    {
+        std::array<float, 3> min;
+        float size;
+        float parent_spacing;
+        std::uint32_t depth;
+        // The points of the whole subtree
+        std::size_t begin;
+        std::size_t end;
+    };
+
+}
+
+point_octree_data build_point_octree(std::vector<splat_point> points, point_octree_settings const & settings)
+{
+    point_octree_data result;
+    if (points.empty())
+        return result;
+
+    std::array<float, 3> min, max;
+    min.fill(std::numeric_limits<float>::infinity());
+    max.fill(-std::numeric_limits<float>::infinity());
+    for (auto const & p : points)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            min[i] = std::min(min[i], p.position[i]);
+            max[i] = std::max(max[i], p.position[i]);
+        }
+    }
+
+    // Slightly larger than the bounds, so that points on the far faces still fall inside
+    float size = std::max({max[0] - min[0], max[1] - min[1], max[2] - min[2]});
+    size = std::max(size * 1.0001f, std::numeric_limits<float>::min());
+
+    std::uint32_t const resolution = std::max<std::uint32_t>(1, settings.grid_resolution);
+    std::uint32_t const node_points = std::max<std::uint32_t>(1, settings.node_points);
+
+    std::vector<std::uint8_t> occupied(std::size_t(resolution) * resolution * resolution);
+    std::vector<std::uint8_t> octants;
+    std::vector<splat_point> scratch;
+
+    // Children are numbered as they are queued, so the queue order is the node order
+    std::deque<pending_node> queue;
+    queue.push_back({min, size, std::numeric_limits<float>::infinity(), 0, 0, points.size()});
+    result.nodes.emplace_back();
+
+    for (std::uint32_t index = 0; !queue.empty(); ++index)
+    {
+        auto const pending = queue.front();
+        queue.pop_front();
+
+        std::size_t const count = pending.end - pending.begin;
+        std::size_t kept = count;
+        std::array<std::size_t, 8> child_counts{};
+
+        if (count > node_points && pending.depth < settings.max_depth)
+        {
+            // The first point in a cell stays, as long as the node has room
+            std::fill(occupied.begin(), occupied.end(), 0);
+            octants.resize(count);
+            kept = 0;
+            float const cell_scale = resolution / pending.size;
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                auto const & p = points[pending.begin + i];
+
+                std::array<std::uint32_t, 3> cell;
+                for (int k = 0; k < 3; ++k)
+                    cell[k] = std::min(resolution - 1, static_cast<std::uint32_t>(std::max(0.f, (p.position[k] - pending.min[k]) * cell_scale)));
+
+                auto & slot = occupied[(std::size_t(cell[2]) * resolution + cell[1]) * resolution + cell[0]];
+                if (!slot && kept < node_points)
+                {
+                    slot = 1;
+                    octants[i] = 8;
+                    ++kept;
+                    continue;
+                }
+
+                std::uint8_t octant = 0;
+                for (int k = 0; k < 3; ++k)
+                    if (p.position[k] >= pending.min[k] + pending.size / 2.f)
+                        octant |= 1 << k;
+                octants[i] = octant;
+                ++child_counts[octant];
+            }
+
+            // The kept points first, then every child's in octant order
+            std::array<std::size_t, 9> offsets;
+            offsets[8] = 0;
+            std::size_t offset = kept;
+            for (int o = 0; o < 8; ++o)
+            {
+                offsets[o] = offset;
+                offset += child_counts[o];
+            }
+
+            scratch.resize(count);
+            for (std::size_t i = 0; i < count; ++i)
+                scratch[offsets[octants[i]]++] = points[pending.begin + i];
+            std::copy(scratch.begin(), scratch.end(), points.begin() + pending.begin);
+        }
+        else
+            kept = std::min<std::size_t>(count, node_points);
+
+        // Densities add up: this node's points are spread over about size^2 of surface
+        float const parent_density = std::isinf(pending.parent_spacing) ? 0.f : 1.f / (pending.parent_spacing * pending.parent_spacing);
+        float const spacing = 1.f / std::sqrt(parent_density + kept / (pending.size * pending.size));
+
+        auto & node = result.nodes[index];
+        node.min = pending.min;
+        node.size = pending.size;
+        node.spacing = spacing;
+        node.point_count = kept;
+        node.first_point = pending.begin;
+        node.first_child = result.nodes.size();
+        node.child_count = 0;
+
+        std::size_t child_begin = pending.begin + kept;
+        for (int o = 0; o < 8; ++o)
+        {
+            if (child_counts[o] == 0)
+                continue;
+
+            float const half = pending.size / 2.f;
+            std::array<float, 3> child_min = pending.min;
+            for (int k = 0; k < 3; ++k)
+                if (o & (1 << k))
+                    child_min[k] += half;
+
+            queue.push_back({child_min, half, spacing, pending.depth + 1, child_begin, child_begin + child_counts[o]});
+            child_begin += child_counts[o];
+            ++result.nodes[index].child_count;
+            result.nodes.emplace_back();
+        }
+    }
+
+    result.points = std::move(points);
+    return result;
+}
+
+std::vector<splat_point> make_splat_points(std::span<obj_data::vertex const> vertices)
+{
+    std::vector<splat_point> result(vertices.size());
+    for (std::size_t i = 0; i < vertices.size(); ++i)
+        result[i] = {vertices[i].position, encode_octahedral(vertices[i].normal)};
+    return result;
+}
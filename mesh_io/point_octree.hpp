@@ -0,0 +1,72 @@
+#pragma once
+
+#include "obj_parser.hpp"
+
+#include <array>
+#include <vector>
+#include <span>
+#include <memory>
+#include <cstdint>
+
+// A point of a scan: its position and its octahedral normal, as encode_octahedral makes it; 16 bytes
+struct splat_point
+{
+    std::array<float, 3> position;
+    std::array<std::int16_t, 2> normal;
+};
+
+struct point_octree_node
+{
+    // The cube [min, min + size]
+    std::array<float, 3> min;
+    float size;
+    // About the distance between neighbouring points once this node and all its ancestors
+    // are drawn, which is what its splats are sized by
+    float spacing;
+    std::uint32_t point_count;
+    std::uint64_t first_point;
+    // Children are consecutive in the node table; leaves have none
+    std::uint32_t first_child;
+    std::uint32_t child_count;
+};
+
+struct point_octree_settings
+{
+    // Most points one node holds, so that a node always fits a slot of this size
+    std::uint32_t node_points = 8192;
+    // A node thins its points on a grid of this many cells per axis, keeping one per cell
+    // and handing the rest down to its children
+    std::uint32_t grid_resolution = 64;
+    // Nodes this deep keep node_points of what reaches them and drop the rest
+    std::uint32_t max_depth = 16;
+};
+
+// Nodes in breadth-first order, the root first, each holding a contiguous range of points
+struct point_octree_data
+{
+    std::vector<point_octree_node> nodes;
+    std::vector<splat_point> points;
+};
+
+// Every node holds an evenly thinned sample of what its subtree covers, finer with every
+// level, so any cut through the tree is a cloud that is denser where the cut is deeper.
+// The points are reordered, not copied.
+point_octree_data build_point_octree(std::vector<splat_point> points, point_octree_settings const & settings = {});
+
+// One point per vertex; the triangles are ignored
+std::vector<splat_point> make_splat_points(std::span<obj_data::vertex const> vertices);
+
+// A tree read in place, normally out of a mapped cache, so that only the points of nodes
+// that are used ever get paged in
+struct point_octree
+{
+    // Whatever the spans point into
+    std::shared_ptr<void const> owner;
+    std::span<point_octree_node const> nodes;
+    std::span<splat_point const> points;
+
+    std::span<splat_point const> node_points(point_octree_node const & node) const
+    {
+        return points.subspan(node.first_point, node.point_count);
+    }
+};
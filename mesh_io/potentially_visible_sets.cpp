@@ -0,0 +1,310 @@
+#include "potentially_visible_sets.hpp"
+#include "triangle_bvh.hpp"
+
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+
+    using vec3 = potentially_visible_sets::vec3;
+    using box = potentially_visible_sets::box;
+
+    // Radical inverse of index in a prime base; six of them, three for the cell's point and
+    // three for the object's, spread the segments over both boxes without clustering
+    float halton(std::uint32_t index, std::uint32_t base)
+    {
+        float result = 0.f;
+        float f = 1.f / base;
+        for (; index > 0; index /= base, f /= base)
+            result += f * (index % base);
+        return result;
+    }
+
+    constexpr std::uint32_t bases[6] = {2, 3, 5, 7, 11, 13};
+
+    vec3 point_in(box const & b, std::uint32_t index, std::uint32_t const * point_bases)
+    {
+        vec3 result;
+        for (int i = 0; i < 3; ++i)
+            result[i] = b.min[i] + (b.max[i] - b.min[i]) * halton(index, point_bases[i]);
+        return result;
+    }
+
+    float box_distance(box const & a, box const & b)
+    {
+        float squared = 0.f;
+        for (int i = 0; i < 3; ++i)
+        {
+            float const gap = std::max({0.f, a.min[i] - b.max[i], b.min[i] - a.max[i]});
+            squared += gap * gap;
+        }
+        return std::sqrt(squared);
+    }
+
+    bool visible_from(triangle_bvh const & occluders, box const & cell, box const & object, std::uint32_t ray_count)
+    {
+        // Index 0 would put both points at the min corners
+        for (std::uint32_t r = 1; r <= ray_count; ++r)
+        {
+            vec3 const from = point_in(cell, r, bases);
+            vec3 const to = point_in(object, r, bases + 3);
+            vec3 const direction = {to[0] - from[0], to[1] - from[1], to[2] - from[2]};
+            if (!occluders.occluded(from, direction, 1.f))
+                return true;
+        }
+        return false;
+    }
+
+    constexpr std::uint32_t cluster_size = 64;
+
+    struct cluster
+    {
+        box bounds;
+        // Into the objects sorted along the curve
+        std::uint32_t first;
+        std::uint32_t count;
+    };
+
+    // Spreads the low 10 bits of v to every third bit
+    std::uint32_t spread_bits(std::uint32_t v)
+    {
+        v &= 0x3ff;
+        v = (v | (v << 16)) & 0x030000ff;
+        v = (v | (v << 8)) & 0x0300f00f;
+        v = (v | (v << 4)) & 0x030c30c3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    }
+
+    // Orders the objects along a Morton curve of their box centers
+    void sort_along_curve(std::span<box const> objects, std::vector<std::uint32_t> & order)
+    {
+        vec3 min, max;
+        min.fill(std::numeric_limits<float>::infinity());
+        max.fill(-std::numeric_limits<float>::infinity());
+        for (auto const & o : objects)
+            for (int k = 0; k < 3; ++k)
+            {
+                min[k] = std::min(min[k], o.min[k] + o.max[k]);
+                max[k] = std::max(max[k], o.min[k] + o.max[k]);
+            }
+
+        std::vector<std::uint32_t> codes(objects.size());
+        for (std::size_t i = 0; i < objects.size(); ++i)
+        {
+            std::uint32_t code = 0;
+            for (int k = 0; k < 3; ++k)
+            {
+                float const extent = max[k] - min[k];
+                float const t = extent > 0.f ? (objects[i].min[k] + objects[i].max[k] - min[k]) / extent : 0.f;
+                code |= spread_bits(std::uint32_t(t * 1023.f)) << k;
+            }
+            codes[i] = code;
+        }
+
+        std::stable_sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b){ return codes[a] < codes[b]; });
+    }
+
+    void write_varint(std::vector<std::uint8_t> & output, std::uint32_t value)
+    {
+        for (; value >= 0x80; value >>= 7)
+            output.push_back(std::uint8_t(value | 0x80));
+        output.push_back(std::uint8_t(value));
+    }
+
+    std::uint32_t read_varint(std::uint8_t const *& p)
+    {
+        std::uint32_t result = 0;
+        for (int shift = 0;; shift += 7)
+        {
+            std::uint8_t const byte = *p++;
+            result |= std::uint32_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return result;
+        }
+    }
+
+}
+
+std::optional<std::uint32_t> potentially_visible_sets::cell(vec3 const & point) const
+{
+    std::uint32_t index[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        float const t = (point[i] - min[i]) / (max[i] - min[i]);
+        if (!(t >= 0.f && t <= 1.f))
+            return std::nullopt;
+        index[i] = std::min(resolution[i] - 1, std::uint32_t(t * resolution[i]));
+    }
+    return index[0] + resolution[0] * (index[1] + resolution[1] * index[2]);
+}
+
+void potentially_visible_sets::decode(std::uint32_t cell, std::vector<std::uint32_t> & visible) const
+{
+    std::uint8_t const * p = runs.data() + cell_offsets[cell];
+    std::uint8_t const * end = runs.data() + cell_offsets[cell + 1];
+
+    std::uint32_t object = 0;
+    while (p != end)
+    {
+        object += read_varint(p);
+        if (p == end)
+            break;
+        std::uint32_t const visible_end = object + read_varint(p);
+        for (; object < visible_end; ++object)
+            visible.push_back(object);
+    }
+}
+
+potentially_visible_sets bake_potentially_visible_sets(triangle_bvh const & occluders, std::span<box const> objects,
+    vec3 const & min, vec3 const & max, potentially_visible_settings const & settings, unsigned int thread_count)
+{
+    for (auto r : settings.resolution)
+        if (r == 0)
+            throw std::runtime_error("Potentially visible sets need at least one cell along each axis");
+    if (settings.ray_count == 0)
+        throw std::runtime_error("Potentially visible sets need at least one ray");
+
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    potentially_visible_sets result;
+    result.min = min;
+    result.max = max;
+    result.resolution = settings.resolution;
+    result.object_count = objects.size();
+
+    auto cell_box = [&](std::size_t index)
+    {
+        std::size_t const cell[3] = {
+            index % settings.resolution[0],
+            index / settings.resolution[0] % settings.resolution[1],
+            index / settings.resolution[0] / settings.resolution[1],
+        };
+
+        box b;
+        for (int i = 0; i < 3; ++i)
+        {
+            float const size = (max[i] - min[i]) / settings.resolution[i];
+            b.min[i] = min[i] + size * cell[i];
+            b.max[i] = b.min[i] + size;
+        }
+        return b;
+    };
+
+    // Every cell is encoded on its own, then they are concatenated in order
+    std::vector<std::vector<std::uint8_t>> cell_runs(result.cell_count());
+
+    // Objects that are near each other go into clusters, and a cluster hidden from a cell hides
+    // all of its objects, so the occluded majority costs a cluster's rays rather than an object's
+    std::vector<std::uint32_t> order(objects.size());
+    for (std::uint32_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    sort_along_curve(objects, order);
+
+    std::vector<cluster> clusters;
+    for (std::uint32_t first = 0; first < order.size(); first += cluster_size)
+    {
+        cluster & c = clusters.emplace_back(cluster{objects[order[first]], first, std::min<std::uint32_t>(cluster_size, order.size() - first)});
+        for (std::uint32_t i = first + 1; i < first + c.count; ++i)
+            for (int k = 0; k < 3; ++k)
+            {
+                c.bounds.min[k] = std::min(c.bounds.min[k], objects[order[i]].min[k]);
+                c.bounds.max[k] = std::max(c.bounds.max[k], objects[order[i]].max[k]);
+            }
+    }
+
+    std::atomic<std::size_t> next_cell{0};
+    auto work = [&]
+    {
+        std::vector<std::uint8_t> visible(objects.size());
+        for (;;)
+        {
+            std::size_t const index = next_cell.fetch_add(1, std::memory_order_relaxed);
+            if (index >= cell_runs.size())
+                return;
+
+            box const cell = cell_box(index);
+            auto & output = cell_runs[index];
+
+            std::fill(visible.begin(), visible.end(), 0);
+            for (auto const & c : clusters)
+            {
+                if (box_distance(cell, c.bounds) > settings.max_distance || !visible_from(occluders, cell, c.bounds, settings.ray_count))
+                    continue;
+
+                for (std::uint32_t i = c.first; i < c.first + c.count; ++i)
+                {
+                    std::uint32_t const object = order[i];
+                    if (box_distance(cell, objects[object]) <= settings.max_distance && visible_from(occluders, cell, objects[object], settings.ray_count))
+                        visible[object] = 1;
+                }
+            }
+
+            std::uint32_t run_start = 0;
+            bool run_visible = false;
+            for (std::uint32_t object = 0; object <= objects.size(); ++object)
+            {
+                // The end of the objects closes a visible run, a trailing hidden one is left out
+                if (object < objects.size() ? bool(visible[object]) == run_visible : !run_visible)
+                    continue;
+
+                write_varint(output, object - run_start);
+                run_start = object;
+                run_visible = !run_visible;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < std::min<std::size_t>(thread_count, cell_runs.size()); ++i)
+        threads.emplace_back(work);
+    work();
+
+    for (auto & thread : threads)
+        thread.join();
+
+    result.cell_offsets.push_back(0);
+    for (auto const & r : cell_runs)
+    {
+        result.runs.insert(result.runs.end(), r.begin(), r.end());
+        result.cell_offsets.push_back(result.runs.size());
+    }
+
+    return result;
+}
+
+std::uint64_t potentially_visible_sets_key(obj_data const & occluders, std::span<box const> objects,
+    vec3 const & min, vec3 const & max, potentially_visible_settings const & settings)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    auto const add = [&](void const * data, std::size_t size)
+    {
+        for (auto p = static_cast<unsigned char const *>(data), end = p + size; p != end; ++p)
+        {
+            hash ^= *p;
+            hash *= 1099511628211ull;
+        }
+    };
+
+    add(settings.resolution.data(), sizeof(settings.resolution));
+    add(&settings.ray_count, sizeof(settings.ray_count));
+    add(&settings.max_distance, sizeof(settings.max_distance));
+    add(min.data(), sizeof(min));
+    add(max.data(), sizeof(max));
+
+    for (auto const & v : occluders.vertices)
+        add(v.position.data(), sizeof(v.position));
+    add(occluders.indices.data(), occluders.indices.size() * sizeof(occluders.indices[0]));
+
+    std::uint64_t const object_count = objects.size();
+    add(&object_count, sizeof(object_count));
+    add(objects.data(), objects.size_bytes());
+
+    return hash;
+}
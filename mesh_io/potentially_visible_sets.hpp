@@ -0,0 +1,69 @@
+#pragma once
+
+#include "obj_parser.hpp"
+
+#include <array>
+#include <vector>
+#include <span>
+#include <optional>
+#include <limits>
+#include <cstdint>
+
+struct triangle_bvh;
+
+struct potentially_visible_settings
+{
+    // Cells along each axis of the navigable box
+    std::array<std::uint32_t, 3> resolution = {32, 2, 32};
+    // Segments between points of a cell and points of an object that must all be blocked for
+    // the object to count as hidden from the cell. The points are sampled, so a gap narrower
+    // than their spacing may be missed.
+    std::uint32_t ray_count = 32;
+    // Objects further than this from every point of a cell are hidden from it; the far plane
+    float max_distance = std::numeric_limits<float>::infinity();
+};
+
+// Which objects can be seen from where: the navigable space cut into a regular grid of cells,
+// and for every cell the set of objects visible from some point in it, as a bitset over the
+// objects. Neighbouring objects tend to be visible together, so each bitset is stored as the
+// lengths of its alternating runs of hidden and visible objects, LEB128 varints, starting with
+// a run of hidden ones that may be empty.
+struct potentially_visible_sets
+{
+    using vec3 = std::array<float, 3>;
+
+    struct box
+    {
+        vec3 min;
+        vec3 max;
+    };
+
+    vec3 min;
+    vec3 max;
+    std::array<std::uint32_t, 3> resolution;
+    std::uint32_t object_count;
+
+    // Per cell, X fastest, then Y, then Z: where its runs start; one more than there are cells
+    std::vector<std::uint32_t> cell_offsets;
+    std::vector<std::uint8_t> runs;
+
+    std::size_t cell_count() const { return std::size_t(resolution[0]) * resolution[1] * resolution[2]; }
+
+    // The cell a point is in, nothing outside the grid
+    std::optional<std::uint32_t> cell(vec3 const & point) const;
+
+    // Appends the objects visible from a cell in increasing order
+    void decode(std::uint32_t cell, std::vector<std::uint32_t> & visible) const;
+};
+
+// Casts segments from every cell to every object against the occluders on thread_count
+// threads, 0 meaning all hardware threads; the points along them do not depend on the thread
+// count, and neither does the result. Objects do not occlude each other, only the occluders do.
+potentially_visible_sets bake_potentially_visible_sets(triangle_bvh const & occluders, std::span<potentially_visible_sets::box const> objects,
+    potentially_visible_sets::vec3 const & min, potentially_visible_sets::vec3 const & max,
+    potentially_visible_settings const & settings = {}, unsigned int thread_count = 0);
+
+// FNV-1a over everything the bake reads, for telling whether cached sets are still current
+std::uint64_t potentially_visible_sets_key(obj_data const & occluders, std::span<potentially_visible_sets::box const> objects,
+    potentially_visible_sets::vec3 const & min, potentially_visible_sets::vec3 const & max,
+    potentially_visible_settings const & settings = {});
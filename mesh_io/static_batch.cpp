@@ -0,0 +1,199 @@
+#include "static_batch.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <cmath>
+
+namespace
+{
+
+    std::array<float, 3> transform_point(std::array<float, 16> const & m, std::array<float, 3> const & p)
+    {
+        return {
+            m[0] * p[0] + m[4] * p[1] + m[8] * p[2] + m[12],
+            m[1] * p[0] + m[5] * p[1] + m[9] * p[2] + m[13],
+            m[2] * p[0] + m[6] * p[1] + m[10] * p[2] + m[14],
+        };
+    }
+
+    // Cofactors of the upper 3x3, row-major
+    std::array<float, 9> normal_matrix(std::array<float, 16> const & m)
+    {
+        auto const a = [&](int row, int column){ return m[column * 4 + row]; };
+        std::array<float, 9> result;
+        for (int r = 0; r < 3; ++r)
+            for (int c = 0; c < 3; ++c)
+            {
+                int const r1 = (r + 1) % 3, r2 = (r + 2) % 3;
+                int const c1 = (c + 1) % 3, c2 = (c + 2) % 3;
+                result[r * 3 + c] = a(r1, c1) * a(r2, c2) - a(r1, c2) * a(r2, c1);
+            }
+        return result;
+    }
+
+    std::array<float, 3> transform_normal(std::array<float, 9> const & n, std::array<float, 3> const & v)
+    {
+        std::array<float, 3> result{
+            n[0] * v[0] + n[1] * v[1] + n[2] * v[2],
+            n[3] * v[0] + n[4] * v[1] + n[5] * v[2],
+            n[6] * v[0] + n[7] * v[1] + n[8] * v[2],
+        };
+        float const length = std::sqrt(result[0] * result[0] + result[1] * result[1] + result[2] * result[2]);
+        if (length > 0.f)
+            for (auto & x : result)
+                x /= length;
+        return result;
+    }
+
+    // Interleaves the low 10 bits of v with two zero bits between each
+    std::uint32_t spread_bits(std::uint32_t v)
+    {
+        v &= 0x3ff;
+        v = (v | (v << 16)) & 0x030000ff;
+        v = (v | (v << 8)) & 0x0300f00f;
+        v = (v | (v << 4)) & 0x030c30c3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    }
+
+    // The triangles in chunk order, with vertices renumbered in order of first use so that
+    // every chunk reads a compact range
+    void build_chunks(obj_data & mesh, std::size_t chunk_triangles)
+    {
+        std::size_t const triangle_count = mesh.indices.size() / 3;
+
+        std::array<float, 3> min, max;
+        min.fill(std::numeric_limits<float>::infinity());
+        max.fill(-std::numeric_limits<float>::infinity());
+        for (auto const & v : mesh.vertices)
+            for (int i = 0; i < 3; ++i)
+            {
+                min[i] = std::min(min[i], v.position[i]);
+                max[i] = std::max(max[i], v.position[i]);
+            }
+
+        std::vector<std::uint32_t> codes(triangle_count);
+        for (std::size_t t = 0; t < triangle_count; ++t)
+        {
+            std::uint32_t code = 0;
+            for (int i = 0; i < 3; ++i)
+            {
+                float centroid = 0.f;
+                for (int k = 0; k < 3; ++k)
+                    centroid += mesh.vertices[mesh.indices[3 * t + k]].position[i] / 3.f;
+                float const extent = max[i] - min[i];
+                float const u = extent > 0.f ? (centroid - min[i]) / extent : 0.f;
+                code |= spread_bits(static_cast<std::uint32_t>(std::clamp(u, 0.f, 1.f) * 1023.f)) << i;
+            }
+            codes[t] = code;
+        }
+
+        std::vector<std::uint32_t> order(triangle_count);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b){ return codes[a] < codes[b]; });
+
+        std::vector<std::uint32_t> remap(mesh.vertices.size(), -1);
+        std::vector<obj_data::vertex> vertices;
+        vertices.reserve(mesh.vertices.size());
+        std::vector<std::uint32_t> indices;
+        indices.reserve(mesh.indices.size());
+        for (auto t : order)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                auto & index = remap[mesh.indices[3 * t + k]];
+                if (index == -1u)
+                {
+                    index = vertices.size();
+                    vertices.push_back(mesh.vertices[mesh.indices[3 * t + k]]);
+                }
+                indices.push_back(index);
+            }
+        }
+        mesh.vertices = std::move(vertices);
+        mesh.indices = std::move(indices);
+
+        chunk_triangles = std::max<std::size_t>(chunk_triangles, 1);
+        for (std::size_t first = 0; first < triangle_count; first += chunk_triangles)
+        {
+            auto & submesh = mesh.submeshes.emplace_back();
+            submesh.material = obj_data::no_material;
+            submesh.first_index = 3 * first;
+            submesh.index_count = 3 * std::min(chunk_triangles, triangle_count - first);
+        }
+        compute_submesh_bounds(mesh);
+    }
+
+}
+
+std::vector<static_batch> build_static_batches(std::span<static_batch_source const> sources, static_batch_settings const & settings)
+{
+    std::vector<static_batch> batches;
+
+    for (auto const & source : sources)
+    {
+        auto it = std::find_if(batches.begin(), batches.end(), [&](auto const & b){ return b.material == source.material; });
+        if (it == batches.end())
+        {
+            batches.push_back({source.material, {}});
+            it = std::prev(batches.end());
+        }
+
+        // The cofactors are the inverse transpose times the determinant, whose sign has to go
+        auto const & m = source.transform;
+        auto normals = normal_matrix(m);
+        float const determinant = m[0] * normals[0] + m[1] * normals[3] + m[2] * normals[6];
+        if (determinant < 0.f)
+            for (auto & x : normals)
+                x = -x;
+
+        auto & mesh = it->mesh;
+        std::uint32_t const base = mesh.vertices.size();
+        for (auto v : source.vertices)
+        {
+            v.position = transform_point(m, v.position);
+            v.normal = transform_normal(normals, v.normal);
+            mesh.vertices.push_back(v);
+        }
+
+        // A mirroring transform turns the winding around, so it is flipped back
+        for (std::size_t i = 0; i + 2 < source.indices.size(); i += 3)
+        {
+            mesh.indices.push_back(base + source.indices[i]);
+            mesh.indices.push_back(base + source.indices[determinant < 0.f ? i + 2 : i + 1]);
+            mesh.indices.push_back(base + source.indices[determinant < 0.f ? i + 1 : i + 2]);
+        }
+    }
+
+    for (auto & batch : batches)
+        build_chunks(batch.mesh, settings.chunk_triangles);
+
+    return batches;
+}
+
+std::uint64_t static_batch_key(std::span<static_batch_source const> sources, static_batch_settings const & settings)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    auto const add = [&](void const * data, std::size_t size)
+    {
+        for (auto p = static_cast<unsigned char const *>(data), end = p + size; p != end; ++p)
+        {
+            hash ^= *p;
+            hash *= 1099511628211ull;
+        }
+    };
+
+    std::uint64_t const chunk_triangles = settings.chunk_triangles;
+    add(&chunk_triangles, sizeof(chunk_triangles));
+    for (auto const & source : sources)
+    {
+        std::uint64_t const counts[2] = {source.vertices.size(), source.indices.size()};
+        add(counts, sizeof(counts));
+        add(source.vertices.data(), source.vertices.size_bytes());
+        add(source.indices.data(), source.indices.size_bytes());
+        add(source.transform.data(), sizeof(source.transform));
+        add(&source.material, sizeof(source.material));
+    }
+    return hash;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "obj_parser.hpp"
+
+#include <array>
+#include <vector>
+#include <span>
+#include <cstdint>
+
+// One piece of static geometry placed in the world
+struct static_batch_source
+{
+    std::span<obj_data::vertex const> vertices;
+    std::span<std::uint32_t const> indices;
+    // Column-major, like a glm::mat4
+    std::array<float, 16> transform;
+    // Sources with the same key end up in the same batch, so it should tell apart everything
+    // that forces a separate draw: the program and the material
+    std::uint32_t material;
+};
+
+// All sources with one material key merged into a single mesh in world space. The triangles
+// are ordered along a Morton curve of their centroids and cut into chunks, one submesh
+// each, whose bounds are tight enough to cull; submesh materials are no_material.
+struct static_batch
+{
+    std::uint32_t material;
+    obj_data mesh;
+};
+
+struct static_batch_settings
+{
+    // Triangles per chunk, the last chunk of a batch takes what is left
+    std::size_t chunk_triangles = 1024;
+};
+
+// Batches in order of the first source with their key
+std::vector<static_batch> build_static_batches(std::span<static_batch_source const> sources, static_batch_settings const & settings = {});
+
+// FNV-1a over everything build_static_batches reads, for telling whether cached batches
+// were built from the same sources
+std::uint64_t static_batch_key(std::span<static_batch_source const> sources, static_batch_settings const & settings = {});
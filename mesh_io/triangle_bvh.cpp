@@ -0,0 +1,454 @@
+#include "triangle_bvh.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <exception>
+#include <cstring>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BVH_SSE
+#endif
+
+namespace
+{
+
+    using vec3 = std::array<float, 3>;
+
+    constexpr float inf = std::numeric_limits<float>::infinity();
+
+    // Split candidates per axis, leaves the heuristic may keep, and leaves it must split
+    constexpr int bin_count = 16;
+    constexpr std::uint32_t max_leaf_size = 16;
+    // Below this many triangles a subtree is built on the thread that got there
+    constexpr std::uint32_t parallel_threshold = 16 * 1024;
+
+    vec3 sub(vec3 const & a, vec3 const & b)
+    {
+        return {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+    }
+
+    float dot(vec3 const & a, vec3 const & b)
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    vec3 cross(vec3 const & a, vec3 const & b)
+    {
+        return {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+    }
+
+    struct bounds
+    {
+        vec3 min{inf, inf, inf};
+        vec3 max{-inf, -inf, -inf};
+
+        void grow(vec3 const & p)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                min[k] = std::min(min[k], p[k]);
+                max[k] = std::max(max[k], p[k]);
+            }
+        }
+
+        void grow(bounds const & b)
+        {
+            grow(b.min);
+            grow(b.max);
+        }
+
+        float half_area() const
+        {
+            vec3 const d = sub(max, min);
+            if (d[0] < 0.f)
+                return 0.f;
+            return d[0] * d[1] + d[1] * d[2] + d[2] * d[0];
+        }
+    };
+
+    struct build_context
+    {
+        std::vector<bounds> boxes;
+        std::vector<vec3> centroids;
+        // Triangle ids, partitioned in place; subtrees on different threads own disjoint ranges
+        std::vector<std::uint32_t> order;
+    };
+
+    void build(build_context & context, std::uint32_t begin, std::uint32_t end, std::vector<triangle_bvh::node> & nodes, int parallel_depth)
+    {
+        std::size_t const index = nodes.size();
+        nodes.emplace_back();
+
+        bounds box, centroid_box;
+        for (std::uint32_t i = begin; i < end; ++i)
+        {
+            box.grow(context.boxes[context.order[i]]);
+            centroid_box.grow(context.centroids[context.order[i]]);
+        }
+        nodes[index].min = box.min;
+        nodes[index].max = box.max;
+
+        auto make_leaf = [&]
+        {
+            nodes[index].offset = begin;
+            nodes[index].count = end - begin;
+        };
+
+        std::uint32_t const count = end - begin;
+        if (count <= 2)
+            return make_leaf();
+
+        // Cost of a split relative to intersecting one triangle, with a node visit costing the same
+        float best_cost = inf;
+        int best_axis = -1;
+        int best_bin = 0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float const extent = centroid_box.max[axis] - centroid_box.min[axis];
+            if (extent <= 0.f)
+                continue;
+
+            std::array<bounds, bin_count> bin_boxes;
+            std::array<std::uint32_t, bin_count> bin_counts{};
+            float const scale = bin_count / extent;
+            for (std::uint32_t i = begin; i < end; ++i)
+            {
+                std::uint32_t const t = context.order[i];
+                int const bin = std::min(bin_count - 1, int((context.centroids[t][axis] - centroid_box.min[axis]) * scale));
+                bin_boxes[bin].grow(context.boxes[t]);
+                ++bin_counts[bin];
+            }
+
+            std::array<float, bin_count> right_cost;
+            bounds right;
+            std::uint32_t right_count = 0;
+            for (int bin = bin_count - 1; bin > 0; --bin)
+            {
+                right.grow(bin_boxes[bin]);
+                right_count += bin_counts[bin];
+                right_cost[bin] = right.half_area() * right_count;
+            }
+
+            bounds left;
+            std::uint32_t left_count = 0;
+            for (int bin = 0; bin + 1 < bin_count; ++bin)
+            {
+                left.grow(bin_boxes[bin]);
+                left_count += bin_counts[bin];
+                if (left_count == 0 || left_count == count)
+                    continue;
+
+                float const cost = left.half_area() * left_count + right_cost[bin + 1];
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = bin;
+                }
+            }
+        }
+
+        float const area = box.half_area();
+        float const leaf_cost = count;
+        if (area > 0.f)
+            best_cost = 1.f + best_cost / area;
+
+        std::uint32_t middle;
+        if (best_axis < 0)
+        {
+            // Every centroid in one spot: any split is as good as another
+            if (count <= max_leaf_size)
+                return make_leaf();
+            middle = begin + count / 2;
+        }
+        else
+        {
+            if (best_cost >= leaf_cost && count <= max_leaf_size)
+                return make_leaf();
+
+            float const scale = bin_count / (centroid_box.max[best_axis] - centroid_box.min[best_axis]);
+            auto const split = std::partition(context.order.begin() + begin, context.order.begin() + end, [&](std::uint32_t t)
+            {
+                return std::min(bin_count - 1, int((context.centroids[t][best_axis] - centroid_box.min[best_axis]) * scale)) <= best_bin;
+            });
+            middle = split - context.order.begin();
+        }
+
+        if (parallel_depth > 0 && count >= parallel_threshold)
+        {
+            // The second subtree goes to its own thread and node array, which is appended with
+            // its child indices shifted once both are done
+            std::vector<triangle_bvh::node> second;
+            std::exception_ptr error;
+            std::thread worker([&]
+            {
+                try
+                {
+                    build(context, middle, end, second, parallel_depth - 1);
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+            });
+            try
+            {
+                build(context, begin, middle, nodes, parallel_depth - 1);
+            }
+            catch (...)
+            {
+                worker.join();
+                throw;
+            }
+            worker.join();
+            if (error)
+                std::rethrow_exception(error);
+
+            std::uint32_t const base = nodes.size();
+            for (auto & n : second)
+                if (n.count == 0)
+                    n.offset += base;
+            nodes[index].offset = base;
+            nodes[index].count = 0;
+            nodes.insert(nodes.end(), second.begin(), second.end());
+        }
+        else
+        {
+            build(context, begin, middle, nodes, 0);
+            nodes[index].offset = nodes.size();
+            nodes[index].count = 0;
+            build(context, middle, end, nodes, 0);
+        }
+    }
+
+    struct ray
+    {
+        vec3 origin;
+        vec3 direction;
+#ifdef BVH_SSE
+        __m128 origin4;
+        __m128 inverse_direction4;
+#else
+        vec3 inverse_direction;
+#endif
+
+        ray(vec3 const & origin, vec3 const & direction)
+            : origin(origin)
+            , direction(direction)
+        {
+            vec3 const inverse{1.f / direction[0], 1.f / direction[1], 1.f / direction[2]};
+#ifdef BVH_SSE
+            origin4 = _mm_setr_ps(origin[0], origin[1], origin[2], 0.f);
+            // The fourth lane meets the node's offset or count, which the zero cancels
+            inverse_direction4 = _mm_setr_ps(inverse[0], inverse[1], inverse[2], 0.f);
+#else
+            inverse_direction = inverse;
+#endif
+        }
+    };
+
+    // Distance at which the ray enters the box, or infinity if it misses it before max_distance
+    float entry_distance(ray const & r, triangle_bvh::node const & n, float max_distance)
+    {
+#ifdef BVH_SSE
+        // Slabs on all three axes at once; the node's halves are min and offset, max and count
+        float const * data = reinterpret_cast<float const *>(&n);
+        __m128 const t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(data), r.origin4), r.inverse_direction4);
+        __m128 const t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(data + 4), r.origin4), r.inverse_direction4);
+        __m128 const lower = _mm_min_ps(t0, t1);
+        __m128 const upper = _mm_max_ps(t0, t1);
+
+        __m128 enter = _mm_max_ss(lower, _mm_shuffle_ps(lower, lower, _MM_SHUFFLE(1, 1, 1, 1)));
+        enter = _mm_max_ss(enter, _mm_shuffle_ps(lower, lower, _MM_SHUFFLE(2, 2, 2, 2)));
+        enter = _mm_max_ss(enter, _mm_setzero_ps());
+        __m128 exit = _mm_min_ss(upper, _mm_shuffle_ps(upper, upper, _MM_SHUFFLE(1, 1, 1, 1)));
+        exit = _mm_min_ss(exit, _mm_shuffle_ps(upper, upper, _MM_SHUFFLE(2, 2, 2, 2)));
+        exit = _mm_min_ss(exit, _mm_set_ss(max_distance));
+
+        float const t_enter = _mm_cvtss_f32(enter);
+        return t_enter <= _mm_cvtss_f32(exit) ? t_enter : inf;
+#else
+        float t_enter = 0.f;
+        float t_exit = max_distance;
+        for (int k = 0; k < 3; ++k)
+        {
+            float const t0 = (n.min[k] - r.origin[k]) * r.inverse_direction[k];
+            float const t1 = (n.max[k] - r.origin[k]) * r.inverse_direction[k];
+            t_enter = std::max(t_enter, std::min(t0, t1));
+            t_exit = std::min(t_exit, std::max(t0, t1));
+        }
+        return t_enter <= t_exit ? t_enter : inf;
+#endif
+    }
+
+}
+
+triangle_bvh::triangle_bvh(void const * positions, std::size_t stride, std::span<std::uint32_t const> indices, unsigned int thread_count)
+{
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    auto const position = [&](std::uint32_t vertex)
+    {
+        vec3 p;
+        std::memcpy(p.data(), static_cast<char const *>(positions) + vertex * stride, sizeof(p));
+        return p;
+    };
+
+    std::size_t const count = indices.size() / 3;
+    build_context context;
+    context.boxes.resize(count);
+    context.centroids.resize(count);
+    context.order.resize(count);
+    triangles_.resize(count);
+    for (std::size_t t = 0; t < count; ++t)
+    {
+        vec3 const v0 = position(indices[3 * t]);
+        vec3 const v1 = position(indices[3 * t + 1]);
+        vec3 const v2 = position(indices[3 * t + 2]);
+
+        bounds & box = context.boxes[t];
+        box.grow(v0);
+        box.grow(v1);
+        box.grow(v2);
+        for (int k = 0; k < 3; ++k)
+            context.centroids[t][k] = (box.min[k] + box.max[k]) * 0.5f;
+        context.order[t] = t;
+
+        triangles_[t] = {v0, sub(v1, v0), sub(v2, v0)};
+    }
+
+    if (count == 0)
+        return;
+
+    // Each level below the root doubles the subtrees in flight
+    int parallel_depth = 0;
+    while ((1u << parallel_depth) < thread_count)
+        ++parallel_depth;
+
+    build(context, 0, count, nodes_, parallel_depth);
+
+    std::vector<triangle> ordered(count);
+    for (std::size_t i = 0; i < count; ++i)
+        ordered[i] = triangles_[context.order[i]];
+    triangles_ = std::move(ordered);
+    triangle_ids_ = std::move(context.order);
+}
+
+triangle_bvh::triangle_bvh(obj_data const & mesh, unsigned int thread_count)
+    : triangle_bvh(mesh.vertices.empty() ? nullptr : mesh.vertices[0].position.data(), sizeof(obj_data::vertex), mesh.indices, thread_count)
+{}
+
+std::optional<triangle_bvh::hit> triangle_bvh::intersect(vec3 const & origin, vec3 const & direction, float max_distance) const
+{
+    hit result;
+    if (traverse<false>(origin, direction, max_distance, &result))
+        return result;
+    return std::nullopt;
+}
+
+bool triangle_bvh::occluded(vec3 const & origin, vec3 const & direction, float max_distance) const
+{
+    return traverse<true>(origin, direction, max_distance, nullptr);
+}
+
+template <bool any_hit>
+bool triangle_bvh::traverse(vec3 const & origin, vec3 const & direction, float max_distance, hit * result) const
+{
+    if (nodes_.empty())
+        return false;
+
+    ray const r(origin, direction);
+
+    float closest = max_distance;
+    bool found = false;
+
+    // Möller-Trumbore, two-sided
+    auto const intersect_leaf = [&](node const & n)
+    {
+        for (std::uint32_t i = n.offset; i < n.offset + n.count; ++i)
+        {
+            triangle const & tri = triangles_[i];
+            vec3 const p = cross(r.direction, tri.e2);
+            float const det = dot(tri.e1, p);
+            if (det == 0.f)
+                continue;
+            float const inverse_det = 1.f / det;
+
+            vec3 const s = sub(r.origin, tri.v0);
+            float const u = dot(s, p) * inverse_det;
+            if (u < 0.f || u > 1.f)
+                continue;
+
+            vec3 const q = cross(s, tri.e1);
+            float const v = dot(r.direction, q) * inverse_det;
+            if (v < 0.f || u + v > 1.f)
+                continue;
+
+            float const t = dot(tri.e2, q) * inverse_det;
+            if (t < 0.f || t >= closest)
+                continue;
+
+            found = true;
+            if constexpr (any_hit)
+                return;
+            closest = t;
+            *result = {t, triangle_ids_[i], u, v};
+        }
+    };
+
+    struct entry
+    {
+        std::uint32_t node;
+        float distance;
+    };
+    // A subtree's depth stays well within this for any triangle count a float mesh can have
+    std::array<entry, 64> stack;
+    std::size_t stack_size = 0;
+
+    if (entry_distance(r, nodes_[0], closest) == inf)
+        return false;
+
+    std::uint32_t current = 0;
+    while (true)
+    {
+        node const & n = nodes_[current];
+        if (n.count > 0)
+        {
+            intersect_leaf(n);
+            if (any_hit && found)
+                return true;
+        }
+        else
+        {
+            std::uint32_t closer = current + 1;
+            std::uint32_t further = n.offset;
+            float closer_distance = entry_distance(r, nodes_[closer], closest);
+            float further_distance = entry_distance(r, nodes_[further], closest);
+            if (further_distance < closer_distance)
+            {
+                std::swap(closer, further);
+                std::swap(closer_distance, further_distance);
+            }
+
+            if (closer_distance != inf)
+            {
+                if (further_distance != inf && stack_size < stack.size())
+                    stack[stack_size++] = {further, further_distance};
+                current = closer;
+                continue;
+            }
+        }
+
+        // Subtrees that start beyond the closest hit so far are skipped
+        while (stack_size > 0 && stack[stack_size - 1].distance >= closest)
+            --stack_size;
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size].node;
+    }
+
+    return found;
+}
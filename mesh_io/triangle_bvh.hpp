@@ -0,0 +1,74 @@
+#pragma once
+
+#include "obj_parser.hpp"
+
+#include <array>
+#include <vector>
+#include <span>
+#include <optional>
+#include <limits>
+#include <cstdint>
+
+// Bounding volume hierarchy over a triangle mesh for CPU ray casts: picking, visibility and
+// occlusion queries. Built top-down with a binned surface area heuristic, the upper levels
+// on several threads. Nodes are 32 bytes, two to a cache line, with the first child stored
+// right after its parent, and the triangles are copied in leaf order, so a traversal reads
+// memory mostly forwards. Ray/box tests use SSE where available.
+struct triangle_bvh
+{
+    using vec3 = std::array<float, 3>;
+
+    struct hit
+    {
+        float distance;
+        // Index into the mesh's triangles, i.e. indices[3 * triangle]
+        std::uint32_t triangle;
+        // Barycentric coordinates of the second and third vertex
+        float u;
+        float v;
+    };
+
+    // positions points at the first vertex position, the next one being stride bytes further,
+    // so that interleaved vertices and plain float arrays both work; thread_count 0 means all
+    // hardware threads
+    triangle_bvh(void const * positions, std::size_t stride, std::span<std::uint32_t const> indices, unsigned int thread_count = 0);
+    explicit triangle_bvh(obj_data const & mesh, unsigned int thread_count = 0);
+
+    // Closest hit along origin + t * direction with t in [0, max_distance); direction need not
+    // be normalized, distances are in its units. Triangles are hit from either side.
+    std::optional<hit> intersect(vec3 const & origin, vec3 const & direction, float max_distance = std::numeric_limits<float>::infinity()) const;
+
+    // Whether anything is hit, stopping at the first triangle found
+    bool occluded(vec3 const & origin, vec3 const & direction, float max_distance = std::numeric_limits<float>::infinity()) const;
+
+    std::size_t node_count() const { return nodes_.size(); }
+    std::size_t triangle_count() const { return triangles_.size(); }
+
+    struct node
+    {
+        vec3 min;
+        // Interior nodes: index of the second child, the first one follows the node;
+        // leaves: first triangle
+        std::uint32_t offset;
+        vec3 max;
+        // Triangles in a leaf, 0 for interior nodes
+        std::uint32_t count;
+    };
+
+private:
+    struct triangle
+    {
+        vec3 v0;
+        vec3 e1;
+        vec3 e2;
+    };
+
+    template <bool any_hit>
+    bool traverse(vec3 const & origin, vec3 const & direction, float max_distance, hit * result) const;
+
+    std::vector<node> nodes_;
+    std::vector<triangle> triangles_;
+    std::vector<std::uint32_t> triangle_ids_;
+};
+
+static_assert(sizeof(triangle_bvh::node) == 32);
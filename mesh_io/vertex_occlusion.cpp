@@ -0,0 +1,154 @@
+#include "vertex_occlusion.hpp"
+#include "triangle_bvh.hpp"
+
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+    using vec3 = std::array<float, 3>;
+
+    // Vertices a thread takes at a time; rays near concave parts of the mesh traverse much
+    // more of the tree than the others, so threads take batches as they go rather than a
+    // fixed range each
+    constexpr std::size_t batch_size = 256;
+
+    float dot(vec3 const & a, vec3 const & b) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+
+    // Van der Corput sequence in base 2
+    float radical_inverse(std::uint32_t i)
+    {
+        i = (i << 16) | (i >> 16);
+        i = ((i & 0x55555555u) << 1) | ((i & 0xaaaaaaaau) >> 1);
+        i = ((i & 0x33333333u) << 2) | ((i & 0xccccccccu) >> 2);
+        i = ((i & 0x0f0f0f0fu) << 4) | ((i & 0xf0f0f0f0u) >> 4);
+        i = ((i & 0x00ff00ffu) << 8) | ((i & 0xff00ff00u) >> 8);
+        return float(i) * 0x1p-32f;
+    }
+
+    std::uint32_t hash(std::uint32_t x)
+    {
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    float fract(float x)
+    {
+        return x - std::floor(x);
+    }
+
+    // Orthonormal basis around a unit normal without branching on its direction, Duff et al. 2017
+    void make_basis(vec3 const & n, vec3 & t, vec3 & b)
+    {
+        float const sign = std::copysign(1.f, n[2]);
+        float const a = -1.f / (sign + n[2]);
+        float const c = n[0] * n[1] * a;
+        t = {1.f + sign * n[0] * n[0] * a, sign * c, -sign * n[0]};
+        b = {c, sign + n[1] * n[1] * a, -n[1]};
+    }
+
+    std::uint8_t vertex_occlusion(triangle_bvh const & bvh, obj_data::vertex const & vertex, std::uint32_t index,
+        vertex_occlusion_settings const & settings, float max_distance, float bias)
+    {
+        float const length = std::sqrt(dot(vertex.normal, vertex.normal));
+        if (!(length > 0.f))
+            return 255;
+
+        vec3 const n{vertex.normal[0] / length, vertex.normal[1] / length, vertex.normal[2] / length};
+        vec3 t, b;
+        make_basis(n, t, b);
+
+        vec3 const origin{vertex.position[0] + n[0] * bias, vertex.position[1] + n[1] * bias, vertex.position[2] + n[2] * bias};
+
+        std::uint32_t const rotation = hash(index);
+        float const rotation_u = float(rotation & 0xffffu) / 65536.f;
+        float const rotation_v = float(rotation >> 16) / 65536.f;
+
+        std::uint32_t escaped = 0;
+        for (std::uint32_t i = 0; i < settings.ray_count; ++i)
+        {
+            // Uniform over the unit disk, projected up onto the hemisphere, is cosine weighted
+            float const u = fract((i + 0.5f) / settings.ray_count + rotation_u);
+            float const v = fract(radical_inverse(i) + rotation_v);
+            float const r = std::sqrt(u);
+            float const phi = 6.2831853f * v;
+            float const x = r * std::cos(phi);
+            float const y = r * std::sin(phi);
+            float const z = std::sqrt(std::max(0.f, 1.f - u));
+
+            vec3 const direction{
+                t[0] * x + b[0] * y + n[0] * z,
+                t[1] * x + b[1] * y + n[1] * z,
+                t[2] * x + b[2] * y + n[2] * z,
+            };
+
+            if (!bvh.occluded(origin, direction, max_distance))
+                ++escaped;
+        }
+
+        return std::uint8_t((escaped * 255 + settings.ray_count / 2) / settings.ray_count);
+    }
+
+}
+
+std::vector<std::uint8_t> bake_vertex_occlusion(obj_data const & mesh, vertex_occlusion_settings const & settings, unsigned int thread_count)
+{
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::uint8_t> result(mesh.vertices.size(), 255);
+    if (mesh.vertices.empty() || mesh.indices.empty() || settings.ray_count == 0)
+        return result;
+
+    vec3 min = mesh.vertices[0].position;
+    vec3 max = min;
+    for (auto const & vertex : mesh.vertices)
+        for (int i = 0; i < 3; ++i)
+        {
+            min[i] = std::min(min[i], vertex.position[i]);
+            max[i] = std::max(max[i], vertex.position[i]);
+        }
+    vec3 const extent{max[0] - min[0], max[1] - min[1], max[2] - min[2]};
+    float const diagonal = std::sqrt(dot(extent, extent));
+    float const max_distance = settings.max_distance * diagonal;
+    float const bias = settings.bias * diagonal;
+
+    triangle_bvh const bvh(mesh, thread_count);
+
+    std::atomic<std::size_t> next_batch{0};
+    auto work = [&]
+    {
+        for (;;)
+        {
+            std::size_t const begin = next_batch.fetch_add(batch_size, std::memory_order_relaxed);
+            if (begin >= mesh.vertices.size())
+                return;
+            std::size_t const end = std::min(begin + batch_size, mesh.vertices.size());
+            for (std::size_t i = begin; i < end; ++i)
+                result[i] = vertex_occlusion(bvh, mesh.vertices[i], i, settings, max_distance, bias);
+        }
+    };
+
+    std::size_t const batches = (mesh.vertices.size() + batch_size - 1) / batch_size;
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < std::min<std::size_t>(thread_count, batches); ++i)
+        threads.emplace_back(work);
+    work();
+
+    for (auto & thread : threads)
+        thread.join();
+
+    return result;
+}
+
+void bake_occlusion(obj_data & mesh, vertex_occlusion_settings const & settings, unsigned int thread_count)
+{
+    mesh.occlusion = bake_vertex_occlusion(mesh, settings, thread_count);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "obj_parser.hpp"
+
+#include <vector>
+#include <cstdint>
+
+struct vertex_occlusion_settings
+{
+    // Rays cast from every vertex
+    std::uint32_t ray_count = 64;
+    // How far a ray looks for an occluder, as a fraction of the bounding box diagonal; farther
+    // geometry is taken to be lit ambient
+    float max_distance = 0.1f;
+    // Rays start this far off the surface along the normal, same units, so that the triangles
+    // around the vertex do not hit it
+    float bias = 1e-4f;
+};
+
+// Ambient occlusion baked into every vertex of a static mesh: the fraction of cosine weighted
+// rays over the hemisphere around the vertex normal that escape within max_distance, found with
+// a triangle_bvh. 255 means unoccluded. The rays of every vertex follow the same Hammersley set,
+// rotated by a hash of the vertex index, so that the error is noise rather than banding and
+// the result does not depend on the thread count.
+// Runs on thread_count threads, 0 meaning all hardware threads.
+std::vector<std::uint8_t> bake_vertex_occlusion(obj_data const & mesh, vertex_occlusion_settings const & settings = {},
+    unsigned int thread_count = 0);
+
+// Fills mesh.occlusion
+void bake_occlusion(obj_data & mesh, vertex_occlusion_settings const & settings = {}, unsigned int thread_count = 0);
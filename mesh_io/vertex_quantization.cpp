@@ -0,0 +1,275 @@
+#include "vertex_quantization.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <cmath>
+#include <unordered_map>
+
+namespace
+{
+
+    std::uint16_t quantize_unorm16(float value)
+    {
+        return static_cast<std::uint16_t>(std::lround(std::clamp(value, 0.f, 1.f) * 65535.f));
+    }
+
+    std::int16_t quantize_snorm16(float value)
+    {
+        return static_cast<std::int16_t>(std::lround(std::clamp(value, -1.f, 1.f) * 32767.f));
+    }
+
+    // Round-to-nearest-even conversion to IEEE 754 binary16
+    std::uint16_t float_to_half(float value)
+    {
+        std::uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+
+        std::uint32_t sign = (bits >> 16) & 0x8000u;
+        std::uint32_t float_exponent = (bits >> 23) & 0xffu;
+        std::uint32_t mantissa = bits & 0x7fffffu;
+
+        if (float_exponent == 0xffu)
+            return sign | 0x7c00u | (mantissa ? 0x200u : 0u);
+
+        int exponent = int(float_exponent) - 127 + 15;
+        if (exponent >= 31)
+            return sign | 0x7c00u;
+
+        if (exponent <= 0)
+        {
+            if (exponent < -10)
+                return sign;
+
+            mantissa |= 0x800000u;
+            int shift = 14 - exponent;
+            std::uint32_t half = mantissa >> shift;
+            std::uint32_t remainder = mantissa & ((1u << shift) - 1u);
+            std::uint32_t halfway = 1u << (shift - 1);
+            if (remainder > halfway || (remainder == halfway && (half & 1u)))
+                ++half;
+            return sign | half;
+        }
+
+        // A carry out of the mantissa correctly bumps the exponent, up to infinity
+        std::uint32_t half = (std::uint32_t(exponent) << 10) | (mantissa >> 13);
+        std::uint32_t remainder = mantissa & 0x1fffu;
+        if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1u)))
+            ++half;
+        return sign | half;
+    }
+
+}
+
+std::array<std::int16_t, 2> encode_octahedral(std::array<float, 3> const & n)
+{
+    float length = std::abs(n[0]) + std::abs(n[1]) + std::abs(n[2]);
+    if (length == 0.f)
+        return {0, 0};
+
+    float x = n[0] / length;
+    float y = n[1] / length;
+
+    // Fold the lower hemisphere over the diagonals
+    if (n[2] < 0.f)
+    {
+        float fx = (1.f - std::abs(y)) * (x >= 0.f ? 1.f : -1.f);
+        float fy = (1.f - std::abs(x)) * (y >= 0.f ? 1.f : -1.f);
+        x = fx;
+        y = fy;
+    }
+
+    return {quantize_snorm16(x), quantize_snorm16(y)};
+}
+
+vertex_quantization make_vertex_quantization(std::array<float, 3> const & min, std::array<float, 3> const & max)
+{
+    vertex_quantization result;
+    for (int i = 0; i < 3; ++i)
+    {
+        result.offset[i] = min[i];
+        result.scale[i] = (max[i] > min[i]) ? (max[i] - min[i]) : 1.f;
+    }
+    return result;
+}
+
+vertex_quantization make_vertex_quantization(std::span<obj_data::vertex const> vertices)
+{
+    std::array<float, 3> min, max;
+    min.fill(std::numeric_limits<float>::infinity());
+    max.fill(-std::numeric_limits<float>::infinity());
+
+    for (auto const & vertex : vertices)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            min[i] = std::min(min[i], vertex.position[i]);
+            max[i] = std::max(max[i], vertex.position[i]);
+        }
+    }
+
+    if (vertices.empty())
+    {
+        min.fill(0.f);
+        max.fill(0.f);
+    }
+
+    return make_vertex_quantization(min, max);
+}
+
+quantized_vertex quantize_vertex(obj_data::vertex const & vertex, vertex_quantization const & quantization)
+{
+    quantized_vertex result;
+
+    for (int i = 0; i < 3; ++i)
+        result.position[i] = quantize_unorm16((vertex.position[i] - quantization.offset[i]) / quantization.scale[i]);
+    result.position[3] = 0;
+
+    result.normal = encode_octahedral(vertex.normal);
+
+    for (int i = 0; i < 2; ++i)
+        result.texcoord[i] = float_to_half(vertex.texcoord[i]);
+
+    return result;
+}
+
+std::vector<quantized_vertex> quantize_vertices(std::span<obj_data::vertex const> vertices, vertex_quantization const & quantization)
+{
+    std::vector<quantized_vertex> result;
+    result.reserve(vertices.size());
+    for (auto const & vertex : vertices)
+        result.push_back(quantize_vertex(vertex, quantization));
+    return result;
+}
+
+std::vector<quantized_vertex> quantize_vertices(std::span<obj_data::vertex const> vertices, std::span<std::uint8_t const> occlusion,
+    vertex_quantization const & quantization)
+{
+    std::vector<quantized_vertex> result;
+    result.reserve(vertices.size());
+    for (std::size_t i = 0; i < vertices.size(); ++i)
+    {
+        result.push_back(quantize_vertex(vertices[i], quantization));
+        // 257 takes 255 to 65535
+        result.back().position[3] = occlusion[i] * 257;
+    }
+    return result;
+}
+
+std::array<std::int16_t, 4> encode_qtangent(std::array<float, 3> const & normal, std::array<float, 4> const & tangent)
+{
+    auto normalized = [](std::array<float, 3> v)
+    {
+        float const length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        if (length > 0.f)
+            for (auto & c : v)
+                c /= length;
+        return v;
+    };
+
+    auto const n = normalized(normal);
+    auto const t = normalized({tangent[0], tangent[1], tangent[2]});
+    std::array<float, 3> const b{n[1] * t[2] - n[2] * t[1], n[2] * t[0] - n[0] * t[2], n[0] * t[1] - n[1] * t[0]};
+
+    // Columns t, b, n of a right-handed rotation matrix, m[row][column]
+    float const m[3][3] = {{t[0], b[0], n[0]}, {t[1], b[1], n[1]}, {t[2], b[2], n[2]}};
+
+    std::array<float, 4> q;
+    float const trace = m[0][0] + m[1][1] + m[2][2];
+    if (trace > 0.f)
+    {
+        float const s = std::sqrt(trace + 1.f) * 2.f;
+        q = {(m[2][1] - m[1][2]) / s, (m[0][2] - m[2][0]) / s, (m[1][0] - m[0][1]) / s, 0.25f * s};
+    }
+    else if (m[0][0] > m[1][1] && m[0][0] > m[2][2])
+    {
+        float const s = std::sqrt(1.f + m[0][0] - m[1][1] - m[2][2]) * 2.f;
+        q = {0.25f * s, (m[0][1] + m[1][0]) / s, (m[0][2] + m[2][0]) / s, (m[2][1] - m[1][2]) / s};
+    }
+    else if (m[1][1] > m[2][2])
+    {
+        float const s = std::sqrt(1.f + m[1][1] - m[0][0] - m[2][2]) * 2.f;
+        q = {(m[0][1] + m[1][0]) / s, 0.25f * s, (m[1][2] + m[2][1]) / s, (m[0][2] - m[2][0]) / s};
+    }
+    else
+    {
+        float const s = std::sqrt(1.f + m[2][2] - m[0][0] - m[1][1]) * 2.f;
+        q = {(m[0][2] + m[2][0]) / s, (m[1][2] + m[2][1]) / s, 0.25f * s, (m[1][0] - m[0][1]) / s};
+    }
+
+    // q and -q are the same rotation, which frees the sign of w for the bitangent sign,
+    // as long as w does not round to zero
+    if (q[3] < 0.f)
+        for (auto & c : q)
+            c = -c;
+
+    float const min_w = 1.f / 32767.f;
+    if (q[3] < min_w)
+    {
+        float const xyz_length = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2]);
+        float const xyz_scale = xyz_length > 0.f ? std::sqrt(1.f - min_w * min_w) / xyz_length : 0.f;
+        q = {q[0] * xyz_scale, q[1] * xyz_scale, q[2] * xyz_scale, min_w};
+    }
+
+    if (tangent[3] < 0.f)
+        for (auto & c : q)
+            c = -c;
+
+    return {quantize_snorm16(q[0]), quantize_snorm16(q[1]), quantize_snorm16(q[2]), quantize_snorm16(q[3])};
+}
+
+void decode_qtangent(std::array<std::int16_t, 4> const & qtangent, std::array<float, 3> & normal, std::array<float, 4> & tangent)
+{
+    std::array<float, 4> q;
+    float length = 0.f;
+    for (int i = 0; i < 4; ++i)
+    {
+        q[i] = std::max(qtangent[i] / 32767.f, -1.f);
+        length += q[i] * q[i];
+    }
+    length = std::sqrt(length);
+    for (auto & c : q)
+        c /= length;
+
+    auto const [x, y, z, w] = q;
+    normal = {2.f * (x * z + w * y), 2.f * (y * z - w * x), 1.f - 2.f * (x * x + y * y)};
+    tangent = {1.f - 2.f * (y * y + z * z), 2.f * (x * y + w * z), 2.f * (x * z - w * y), qtangent[3] < 0 ? -1.f : 1.f};
+}
+
+std::vector<qtangent_vertex> quantize_vertices(std::span<obj_data::vertex const> vertices, std::span<std::array<float, 4> const> tangents,
+    vertex_quantization const & quantization)
+{
+    std::vector<qtangent_vertex> result;
+    result.reserve(vertices.size());
+    for (std::size_t i = 0; i < vertices.size(); ++i)
+    {
+        auto const quantized = quantize_vertex(vertices[i], quantization);
+        result.push_back({quantized.position, encode_qtangent(vertices[i].normal, tangents[i]), quantized.texcoord});
+    }
+    return result;
+}
+
+position_stream make_position_stream(std::span<quantized_vertex const> vertices, std::span<std::uint32_t const> indices)
+{
+    position_stream result;
+
+    std::vector<std::uint32_t> remap(vertices.size());
+    std::unordered_map<std::uint64_t, std::uint32_t> first_vertex;
+    first_vertex.reserve(vertices.size());
+
+    for (std::size_t i = 0; i < vertices.size(); ++i)
+    {
+        auto const & p = vertices[i].position;
+        std::uint64_t const key = std::uint64_t(p[0]) | (std::uint64_t(p[1]) << 16) | (std::uint64_t(p[2]) << 32);
+        auto const [it, inserted] = first_vertex.try_emplace(key, result.positions.size());
+        if (inserted)
+            result.positions.push_back({p[0], p[1], p[2], 0});
+        remap[i] = it->second;
+    }
+
+    result.indices.reserve(indices.size());
+    for (auto index : indices)
+        result.indices.push_back(remap[index]);
+
+    return result;
+}
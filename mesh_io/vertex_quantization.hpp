@@ -0,0 +1,72 @@
+#pragma once
+
+#include "obj_parser.hpp"
+
+#include <span>
+
+// Packed 16-byte alternative to obj_data::vertex
+struct quantized_vertex
+{
+    // Normalized within the mesh bounding box; the fourth component is padding, or the baked
+    // occlusion when quantized with it
+    std::array<std::uint16_t, 4> position;
+    // Octahedral-encoded unit normal as two normalized signed shorts
+    std::array<std::int16_t, 2> normal;
+    // Half floats
+    std::array<std::uint16_t, 2> texcoord;
+};
+
+// 20-byte alternative to obj_data::vertex plus its tangent, for normal mapped meshes
+struct qtangent_vertex
+{
+    // As in quantized_vertex
+    std::array<std::uint16_t, 4> position;
+    // Normal, tangent and bitangent sign as one quaternion, see encode_qtangent
+    std::array<std::int16_t, 4> qtangent;
+    std::array<std::uint16_t, 2> texcoord;
+};
+
+// Original position = offset + scale * normalized position
+struct vertex_quantization
+{
+    std::array<float, 3> offset;
+    std::array<float, 3> scale;
+};
+
+// The normal of quantized_vertex; the lower hemisphere is folded over the diagonals, and a
+// zero vector gives zero
+std::array<std::int16_t, 2> encode_octahedral(std::array<float, 3> const & n);
+
+vertex_quantization make_vertex_quantization(std::array<float, 3> const & min, std::array<float, 3> const & max);
+vertex_quantization make_vertex_quantization(std::span<obj_data::vertex const> vertices);
+
+quantized_vertex quantize_vertex(obj_data::vertex const & vertex, vertex_quantization const & quantization);
+std::vector<quantized_vertex> quantize_vertices(std::span<obj_data::vertex const> vertices, vertex_quantization const & quantization);
+
+// Same, with one occlusion value per vertex, as bake_occlusion leaves in obj_data::occlusion,
+// in the fourth position component; normalized, the shader reads it back as a fraction
+std::vector<quantized_vertex> quantize_vertices(std::span<obj_data::vertex const> vertices, std::span<std::uint8_t const> occlusion,
+    vertex_quantization const & quantization);
+
+// The rotation taking x, y and z to tangent, cross(normal, tangent) and normal, as four normalized
+// shorts (x, y, z, w). w is kept away from zero and its sign is the bitangent sign, so a shader
+// gets normal = rotate(q, z), tangent = rotate(q, x) and bitangent = sign(q.w) * cross(normal, tangent).
+// The tangent is expected to be perpendicular to the normal, as generate_tangents makes it.
+std::array<std::int16_t, 4> encode_qtangent(std::array<float, 3> const & normal, std::array<float, 4> const & tangent);
+void decode_qtangent(std::array<std::int16_t, 4> const & qtangent, std::array<float, 3> & normal, std::array<float, 4> & tangent);
+
+// One tangent per vertex is expected, as generate_tangents leaves in obj_data::tangents
+std::vector<qtangent_vertex> quantize_vertices(std::span<obj_data::vertex const> vertices, std::span<std::array<float, 4> const> tangents,
+    vertex_quantization const & quantization);
+
+// Depth-only passes need nothing but positions. Vertices that differ only in their other
+// attributes are merged, which also lets the post-transform cache hit across UV and
+// normal seams; the triangle order, and so any index range, stays the same.
+struct position_stream
+{
+    // The quantized position of quantized_vertex, 8 bytes
+    std::vector<std::array<std::uint16_t, 4>> positions;
+    std::vector<std::uint32_t> indices;
+};
+
+position_stream make_position_stream(std::span<quantized_vertex const> vertices, std::span<std::uint32_t const> indices);
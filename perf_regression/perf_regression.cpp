@@ -0,0 +1,252 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+// Runs every entry of a suite, compares its metrics with the ones stored for this machine, and
+// fails if any got worse by more than the tolerance. The suite file has one entry per line:
+//   replay NAME EXECUTABLE RECORDING FRAMES   a sample replaying a recorded camera path, hidden
+//   kernels NAME EXECUTABLE                   kernel_benchmark, or anything with its --results
+// with paths relative to the suite file, and # starting a comment. Every metric is a time or
+// an amount of memory, so larger is worse. Baselines are "entry metric value" lines, one file
+// per machine; --update writes this run's metrics into it instead of comparing.
+//
+// Exits with 0 if nothing regressed, 1 if something did, 2 if an entry could not be run.
+
+namespace
+{
+
+    struct entry
+    {
+        std::string kind;
+        std::string name;
+        std::filesystem::path executable;
+        std::filesystem::path recording;
+        int frames = 0;
+    };
+
+    // Keyed by "entry metric"
+    using metrics = std::map<std::string, double>;
+
+    std::string machine_name()
+    {
+#ifdef WIN32
+        char name[MAX_COMPUTERNAME_LENGTH + 1];
+        DWORD size = sizeof(name);
+        if (GetComputerNameA(name, &size))
+            return name;
+#else
+        char name[256];
+        if (gethostname(name, sizeof(name)) == 0)
+            return std::string(name, strnlen(name, sizeof(name)));
+#endif
+        return "unknown";
+    }
+
+    std::string quote(std::filesystem::path const & path)
+    {
+        return "\"" + path.string() + "\"";
+    }
+
+    std::vector<entry> read_suite(std::filesystem::path const & path)
+    {
+        std::ifstream input(path);
+        if (!input)
+            throw std::runtime_error("Failed to open " + path.string());
+
+        auto const directory = path.parent_path();
+
+        std::vector<entry> result;
+        for (std::string line; std::getline(input, line);)
+        {
+            line = line.substr(0, line.find('#'));
+            std::istringstream fields(line);
+
+            entry e;
+            std::string executable;
+            if (!(fields >> e.kind))
+                continue;
+            if (!(fields >> e.name >> executable))
+                throw std::runtime_error("Incomplete suite entry: " + line);
+            e.executable = directory / executable;
+
+            if (e.kind == "replay")
+            {
+                std::string recording;
+                if (!(fields >> recording >> e.frames))
+                    throw std::runtime_error("A replay entry needs a recording and a frame count: " + line);
+                e.recording = directory / recording;
+            }
+            else if (e.kind != "kernels")
+                throw std::runtime_error("Unknown suite entry kind " + e.kind);
+
+            result.push_back(std::move(e));
+        }
+        return result;
+    }
+
+    // Lines of "metric value", where the metric may contain spaces
+    void read_metrics(std::filesystem::path const & path, std::string const & prefix, metrics & result)
+    {
+        std::ifstream input(path);
+        if (!input)
+            throw std::runtime_error("Failed to open " + path.string());
+
+        for (std::string line; std::getline(input, line);)
+        {
+            auto const split = line.find_last_of(' ');
+            if (split == std::string::npos)
+                continue;
+            result[prefix + line.substr(0, split)] = std::stod(line.substr(split + 1));
+        }
+    }
+
+    void write_metrics(std::filesystem::path const & path, metrics const & values)
+    {
+        std::filesystem::create_directories(path.parent_path());
+        std::ofstream output(path);
+        output << std::setprecision(9);
+        for (auto const & [metric, value] : values)
+            output << metric << " " << value << "\n";
+        if (!output)
+            throw std::runtime_error("Failed to write " + path.string());
+    }
+
+    // Adds the entry's metrics, prefixed by its name. An entry that is not built or recorded on
+    // this machine is skipped; false if it ran and failed.
+    bool run(entry const & e, std::filesystem::path const & results_path, metrics & result)
+    {
+        if (!std::filesystem::exists(e.executable))
+        {
+            std::cout << e.name << ": skipped, " << e.executable.string() << " is not built" << std::endl;
+            return true;
+        }
+        if (e.kind == "replay" && !std::filesystem::exists(e.recording))
+        {
+            std::cout << e.name << ": skipped, record " << e.recording.string() << " with --record first" << std::endl;
+            return true;
+        }
+
+        std::filesystem::remove(results_path);
+
+        std::string command = quote(e.executable) + " --results " + quote(results_path);
+        if (e.kind == "replay")
+            command += " --replay " + quote(e.recording) + " --frames " + std::to_string(e.frames) + " --hidden";
+
+        std::cout << e.name << ": " << command << std::endl;
+#ifdef WIN32
+        // cmd strips the outer quotes of a command line starting with one
+        command = "\"" + command + "\"";
+#endif
+        if (int const status = std::system(command.c_str()); status != 0)
+        {
+            std::cout << e.name << ": failed with status " << status << std::endl;
+            return false;
+        }
+
+        read_metrics(results_path, e.name + " ", result);
+        return true;
+    }
+
+}
+
+int main(int argc, char ** argv) try
+{
+    std::filesystem::path suite_path = std::filesystem::path(PROJECT_ROOT) / "suite.txt";
+    std::filesystem::path baseline_directory = std::filesystem::path(PROJECT_ROOT) / "baselines";
+    std::string machine = machine_name();
+    std::string filter;
+    double tolerance = 0.1;
+    bool update = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--suite" && i + 1 < argc)
+            suite_path = argv[++i];
+        else if (arg == "--baselines" && i + 1 < argc)
+            baseline_directory = argv[++i];
+        else if (arg == "--machine" && i + 1 < argc)
+            machine = argv[++i];
+        else if (arg == "--filter" && i + 1 < argc)
+            filter = argv[++i];
+        else if (arg == "--tolerance" && i + 1 < argc)
+            tolerance = std::atof(argv[++i]);
+        else if (arg == "--update")
+            update = true;
+        else
+            throw std::runtime_error("Usage: perf_regression [--suite file] [--baselines directory] [--machine name] [--filter substring] [--tolerance fraction] [--update]");
+    }
+
+    auto const suite = read_suite(suite_path);
+    auto const baseline_path = baseline_directory / (machine + ".txt");
+    auto const results_path = std::filesystem::temp_directory_path() / "perf_regression_results.txt";
+
+    metrics current;
+    bool failed = false;
+    for (auto const & e : suite)
+        if (filter.empty() || e.name.find(filter) != std::string::npos)
+            failed |= !run(e, results_path, current);
+    std::filesystem::remove(results_path);
+
+    metrics baseline;
+    if (std::filesystem::exists(baseline_path))
+        read_metrics(baseline_path, "", baseline);
+
+    if (update || baseline.empty())
+    {
+        // Metrics of entries not run this time are kept
+        for (auto const & [metric, value] : current)
+            baseline[metric] = value;
+        write_metrics(baseline_path, baseline);
+        std::cout << "Baseline for " << machine << " written to " << baseline_path.string() << std::endl;
+        return failed ? 2 : 0;
+    }
+
+    std::size_t regressions = 0;
+    std::cout << std::endl << "Against the baseline for " << machine << ", tolerance " << tolerance * 100.0 << "%:" << std::endl;
+    for (auto const & [metric, value] : current)
+    {
+        auto const it = baseline.find(metric);
+        if (it == baseline.end())
+        {
+            std::cout << "  new        " << metric << " " << value << std::endl;
+            continue;
+        }
+
+        double const change = it->second > 0.0 ? value / it->second - 1.0 : 0.0;
+        bool const regressed = change > tolerance;
+        regressions += regressed;
+        if (regressed || change < -tolerance)
+            std::cout << "  " << std::left << std::setw(11) << (regressed ? "REGRESSED" : "improved") << std::right
+                << metric << " " << it->second << " -> " << value << " (" << std::showpos << std::fixed << std::setprecision(1)
+                << change * 100.0 << "%)" << std::noshowpos << std::defaultfloat << std::endl;
+    }
+    std::cout << regressions << " of " << current.size() << " metrics regressed" << std::endl;
+
+    if (failed)
+        return 2;
+    return regressions == 0 ? 0 : 1;
+}
+catch (std::exception const & e)
+{
+    std::cerr << e.what() << std::endl;
+    return 2;
+}
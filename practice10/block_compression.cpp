@@ -0,0 +1,197 @@
+#include "block_compression.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace
+{
+
+    using block = std::array<std::array<std::uint8_t, 4>, 16>;
+
+    block fetch_block(std::uint8_t const * rgba, int width, int height, int bx, int by)
+    {
+        block result;
+        for (int y = 0; y < 4; ++y)
+            for (int x = 0; x < 4; ++x)
+            {
+                int const sx = std::min(bx * 4 + x, width - 1);
+                int const sy = std::min(by * 4 + y, height - 1);
+                auto const * p = rgba + 4 * (static_cast<std::size_t>(sy) * width + sx);
+                result[y * 4 + x] = {p[0], p[1], p[2], p[3]};
+            }
+        return result;
+    }
+
+    void put16(std::vector<std::uint8_t> & out, std::uint16_t value)
+    {
+        out.push_back(value & 0xff);
+        out.push_back(value >> 8);
+    }
+
+    std::uint16_t to_565(int r, int g, int b)
+    {
+        return ((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255);
+    }
+
+    std::array<int, 3> from_565(std::uint16_t c)
+    {
+        int const r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+        return {(r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2)};
+    }
+
+    void encode_color(block const & texels, std::vector<std::uint8_t> & out)
+    {
+        std::array<int, 3> lo{255, 255, 255}, hi{0, 0, 0};
+        for (auto const & t : texels)
+            for (int c = 0; c < 3; ++c)
+            {
+                lo[c] = std::min<int>(lo[c], t[c]);
+                hi[c] = std::max<int>(hi[c], t[c]);
+            }
+
+        // Pulling the endpoints in by 1/16 of the range trades a little contrast for less error inside it
+        for (int c = 0; c < 3; ++c)
+        {
+            int const inset = (hi[c] - lo[c]) / 16;
+            lo[c] += inset;
+            hi[c] -= inset;
+        }
+
+        // The bounding box diagonal is the axis, flipped in the channels that fall as the widest one rises
+        int dominant = 0;
+        for (int c = 1; c < 3; ++c)
+            if (hi[c] - lo[c] > hi[dominant] - lo[dominant])
+                dominant = c;
+
+        for (int c = 0; c < 3; ++c)
+        {
+            if (c == dominant)
+                continue;
+
+            int covariance = 0;
+            for (auto const & t : texels)
+                covariance += (t[dominant] - (lo[dominant] + hi[dominant]) / 2) * (t[c] - (lo[c] + hi[c]) / 2);
+            if (covariance < 0)
+                std::swap(lo[c], hi[c]);
+        }
+
+        std::uint16_t c0 = to_565(hi[0], hi[1], hi[2]);
+        std::uint16_t c1 = to_565(lo[0], lo[1], lo[2]);
+        if (c0 < c1)
+            std::swap(c0, c1);
+
+        put16(out, c0);
+        put16(out, c1);
+
+        std::uint32_t indices = 0;
+        if (c0 != c1)
+        {
+            auto const p0 = from_565(c0), p1 = from_565(c1);
+            std::array<std::array<int, 3>, 4> palette;
+            palette[0] = p0;
+            palette[1] = p1;
+            for (int c = 0; c < 3; ++c)
+            {
+                palette[2][c] = (2 * p0[c] + p1[c]) / 3;
+                palette[3][c] = (p0[c] + 2 * p1[c]) / 3;
+            }
+
+            for (int i = 0; i < 16; ++i)
+            {
+                int best = 0, best_error = 1 << 30;
+                for (int j = 0; j < 4; ++j)
+                {
+                    int error = 0;
+                    for (int c = 0; c < 3; ++c)
+                        error += (texels[i][c] - palette[j][c]) * (texels[i][c] - palette[j][c]);
+                    if (error < best_error)
+                    {
+                        best = j;
+                        best_error = error;
+                    }
+                }
+                indices |= std::uint32_t(best) << (2 * i);
+            }
+        }
+
+        for (int i = 0; i < 4; ++i)
+            out.push_back((indices >> (8 * i)) & 0xff);
+    }
+
+    void encode_channel(block const & texels, int channel, std::vector<std::uint8_t> & out)
+    {
+        int lo = 255, hi = 0;
+        for (auto const & t : texels)
+        {
+            lo = std::min<int>(lo, t[channel]);
+            hi = std::max<int>(hi, t[channel]);
+        }
+
+        // hi > lo selects the mode with six interpolated values between the endpoints
+        out.push_back(hi);
+        out.push_back(lo);
+
+        std::uint64_t indices = 0;
+        if (hi != lo)
+        {
+            int palette[8] = {hi, lo};
+            for (int j = 1; j < 7; ++j)
+                palette[j + 1] = ((7 - j) * hi + j * lo) / 7;
+
+            for (int i = 0; i < 16; ++i)
+            {
+                int best = 0;
+                for (int j = 1; j < 8; ++j)
+                    if (std::abs(texels[i][channel] - palette[j]) < std::abs(texels[i][channel] - palette[best]))
+                        best = j;
+                indices |= std::uint64_t(best) << (3 * i);
+            }
+        }
+
+        for (int i = 0; i < 6; ++i)
+            out.push_back((indices >> (8 * i)) & 0xff);
+    }
+
+    template <typename Encode>
+    std::vector<std::uint8_t> compress(std::uint8_t const * rgba, int width, int height, std::size_t block_size, Encode const & encode)
+    {
+        int const blocks_x = (width + 3) / 4;
+        int const blocks_y = (height + 3) / 4;
+
+        std::vector<std::uint8_t> result;
+        result.reserve(static_cast<std::size_t>(blocks_x) * blocks_y * block_size);
+        for (int by = 0; by < blocks_y; ++by)
+            for (int bx = 0; bx < blocks_x; ++bx)
+                encode(fetch_block(rgba, width, height, bx, by), result);
+        return result;
+    }
+
+}
+
+std::vector<std::uint8_t> compress_bc1(std::uint8_t const * rgba, int width, int height)
+{
+    return compress(rgba, width, height, 8, [](block const & b, std::vector<std::uint8_t> & out){ encode_color(b, out); });
+}
+
+std::vector<std::uint8_t> compress_bc3(std::uint8_t const * rgba, int width, int height)
+{
+    return compress(rgba, width, height, 16, [](block const & b, std::vector<std::uint8_t> & out)
+    {
+        encode_channel(b, 3, out);
+        encode_color(b, out);
+    });
+}
+
+std::vector<std::uint8_t> compress_bc4(std::uint8_t const * rgba, int width, int height)
+{
+    return compress(rgba, width, height, 8, [](block const & b, std::vector<std::uint8_t> & out){ encode_channel(b, 0, out); });
+}
+
+std::vector<std::uint8_t> compress_bc5(std::uint8_t const * rgba, int width, int height)
+{
+    return compress(rgba, width, height, 16, [](block const & b, std::vector<std::uint8_t> & out)
+    {
+        encode_channel(b, 0, out);
+        encode_channel(b, 1, out);
+    });
+}
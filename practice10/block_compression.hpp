@@ -0,0 +1,21 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+// Block-compression encoders for 4x4 texel blocks, from RGBA8 pixels with rows top to
+// bottom. Partial blocks at the right and bottom edges repeat the last column and row.
+// The encoders pick endpoints from per-block bounds and the nearest palette entry per
+// texel, which is fast and good enough for offline conversion of course assets.
+
+// 8 bytes per block, RGB only
+std::vector<std::uint8_t> compress_bc1(std::uint8_t const * rgba, int width, int height);
+
+// 16 bytes per block: BC1 color plus BC4-style alpha
+std::vector<std::uint8_t> compress_bc3(std::uint8_t const * rgba, int width, int height);
+
+// 8 bytes per block, the red channel only
+std::vector<std::uint8_t> compress_bc4(std::uint8_t const * rgba, int width, int height);
+
+// 16 bytes per block, red and green as two BC4 blocks; meant for normal map XY
+std::vector<std::uint8_t> compress_bc5(std::uint8_t const * rgba, int width, int height);
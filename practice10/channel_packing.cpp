@@ -0,0 +1,169 @@
+#include "channel_packing.hpp"
+#include "image_decoder.hpp"
+
+#include <map>
+#include <memory>
+#include <stdexcept>
+
+namespace
+{
+
+    // Where a channel of an image decoded with its own channel count is stored: grey images
+    // have one colour channel, and images without alpha are opaque (-1)
+    int stored_channel(int channel, int channels)
+    {
+        bool const grey = channels <= 2;
+        bool const alpha = channels == 2 || channels == 4;
+        if (channel == 3)
+            return alpha ? channels - 1 : -1;
+        return grey ? 0 : channel;
+    }
+
+}
+
+int packed_components(std::vector<channel_source> const & sources, channel_swizzle * swizzle)
+{
+    if (sources.empty() || sources.size() > 4)
+        throw std::runtime_error("Can only pack 1 to 4 channels");
+
+    // Channels past the sources read like those a texture of fewer components lacks
+    channel_swizzle result = {swizzle_zero, swizzle_zero, swizzle_zero, swizzle_one};
+    int stored = 0;
+    for (std::size_t c = 0; c < sources.size(); ++c)
+    {
+        auto const & source = sources[c];
+        if (source.path.empty() && source.constant == 0)
+            result[c] = swizzle_zero;
+        else if (source.path.empty() && source.constant == 255)
+            result[c] = swizzle_one;
+        else
+            result[c] = stored++;
+    }
+
+    if (swizzle)
+        *swizzle = result;
+    return stored == 3 ? 4 : stored;
+}
+
+packed_image pack_channels(std::vector<channel_source> const & sources)
+{
+    std::map<std::string, decoded_image> images;
+
+    packed_image result;
+    result.components = packed_components(sources, &result.swizzle);
+
+    for (auto const & source : sources)
+    {
+        if (source.path.empty() || images.contains(source.path))
+            continue;
+
+        decoded_image image;
+        try
+        {
+            image = decode_image_file(source.path);
+        }
+        catch (std::exception const & e)
+        {
+            throw std::runtime_error("Failed to load " + source.path + ": " + e.what());
+        }
+
+        if (result.width == 0)
+        {
+            result.width = image.info.width;
+            result.height = image.info.height;
+        }
+        else if (image.info.width != result.width || image.info.height != result.height)
+            throw std::runtime_error(source.path + " does not match the size of the other packed channels");
+
+        images.emplace(source.path, std::move(image));
+    }
+
+    if (result.width == 0)
+        throw std::runtime_error("Packed texture has no image sources");
+
+    std::size_t const texels = static_cast<std::size_t>(result.width) * result.height;
+    result.pixels.assign(texels * result.components, 255);
+
+    for (std::size_t c = 0; c < sources.size(); ++c)
+    {
+        auto const & source = sources[c];
+        if (result.swizzle[c] < 0)
+            continue;
+
+        std::uint8_t * out = result.pixels.data() + result.swizzle[c];
+
+        if (source.path.empty())
+        {
+            for (std::size_t i = 0; i < texels; ++i)
+                out[i * result.components] = source.constant;
+            continue;
+        }
+
+        auto const & in = images.at(source.path);
+        int const channels = in.info.channels;
+        int const channel = stored_channel(source.channel, channels);
+        if (channel < 0)
+            continue;
+
+        std::uint8_t const * data = in.pixels.data() + channel;
+        for (std::size_t i = 0; i < texels; ++i)
+            out[i * result.components] = data[i * channels];
+    }
+
+    return result;
+}
+
+int image_components(std::uint8_t const * pixels, std::size_t texels, int channels)
+{
+    bool const has_alpha = channels == 2 || channels == 4;
+    bool opaque = true;
+    for (std::size_t i = 0; i < texels; ++i)
+    {
+        std::uint8_t const * texel = pixels + i * channels;
+        if (channels >= 3 && (texel[0] != texel[1] || texel[1] != texel[2]))
+            return 4;
+        if (has_alpha && texel[channels - 1] != 255)
+            opaque = false;
+    }
+    return opaque ? 1 : 2;
+}
+
+std::vector<std::uint8_t> convert_components(std::uint8_t const * pixels, std::size_t texels, int channels, int components)
+{
+    bool const has_alpha = channels == 2 || channels == 4;
+
+    std::vector<std::uint8_t> result(texels * components);
+    for (std::size_t i = 0; i < texels; ++i)
+    {
+        std::uint8_t const * in = pixels + i * channels;
+        std::uint8_t * out = result.data() + i * components;
+        std::uint8_t const alpha = has_alpha ? in[channels - 1] : 255;
+
+        switch (components)
+        {
+        case 1:
+            out[0] = in[0];
+            break;
+        case 2:
+            out[0] = in[0];
+            out[1] = alpha;
+            break;
+        default:
+            for (int c = 0; c < 3; ++c)
+                out[c] = in[channels >= 3 ? c : 0];
+            out[3] = alpha;
+            break;
+        }
+    }
+    return result;
+}
+
+channel_swizzle image_swizzle(int components)
+{
+    switch (components)
+    {
+    case 1: return {0, 0, 0, swizzle_one};
+    case 2: return {0, 0, 0, 1};
+    default: return default_swizzle;
+    }
+}
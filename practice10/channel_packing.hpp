@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// One channel of a packed texture: a channel of an image file, or a constant when the
+// path is empty (e.g. metallic for a material that has no metallic map)
+struct channel_source
+{
+    std::string path;
+    int channel = 0;
+    std::uint8_t constant = 0;
+};
+
+// Channels a texture reads but does not store, supplied by its swizzle instead
+constexpr int swizzle_zero = -1;
+constexpr int swizzle_one = -2;
+
+// For each of r, g, b and a, the stored component it reads, or swizzle_zero / swizzle_one;
+// the default is what sampling a texture of fewer components gives anyway
+using channel_swizzle = std::array<int, 4>;
+constexpr channel_swizzle default_swizzle = {0, 1, 2, 3};
+
+struct packed_image
+{
+    int width = 0;
+    int height = 0;
+    // 1, 2 or 4; three stored channels are padded with an opaque alpha to keep rows 4-byte texels
+    int components = 0;
+    std::vector<std::uint8_t> pixels;
+    channel_swizzle swizzle = default_swizzle;
+};
+
+// Components that pack_channels stores for these sources and where each source lands:
+// constants of 0 and 255 cost no memory, as the swizzle gives them
+int packed_components(std::vector<channel_source> const & sources, channel_swizzle * swizzle = nullptr);
+
+// Combines channels of several images of the same size into one, decoding each file once
+// with the channels it has; throws if a file fails to load or the sizes differ
+packed_image pack_channels(std::vector<channel_source> const & sources);
+
+// Components a texture needs for an image decoded with its own channel count: 1 for grey,
+// which includes RGB whose channels are equal everywhere (JPEG files keep grey images as
+// colour), 2 for grey with alpha, 4 otherwise; alpha that is 255 everywhere is dropped
+int image_components(std::uint8_t const * pixels, std::size_t texels, int channels);
+
+// The image with channels turned into components: 1 and 2 keep grey and alpha, 4 spreads
+// grey over the colour channels and adds an opaque alpha where there is none
+std::vector<std::uint8_t> convert_components(std::uint8_t const * pixels, std::size_t texels, int channels, int components);
+
+// How a texture of image_components shows grey as colour
+channel_swizzle image_swizzle(int components);
@@ -0,0 +1,206 @@
+#include "dds.hpp"
+
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+namespace
+{
+
+    constexpr std::uint32_t four_cc(char a, char b, char c, char d)
+    {
+        return std::uint32_t(a) | std::uint32_t(b) << 8 | std::uint32_t(c) << 16 | std::uint32_t(d) << 24;
+    }
+
+    constexpr std::uint32_t dds_magic = four_cc('D', 'D', 'S', ' ');
+
+    constexpr std::uint32_t ddsd_caps = 0x1, ddsd_height = 0x2, ddsd_width = 0x4, ddsd_pixelformat = 0x1000,
+        ddsd_mipmapcount = 0x20000, ddsd_linearsize = 0x80000;
+    constexpr std::uint32_t ddpf_fourcc = 0x4;
+    constexpr std::uint32_t ddscaps_complex = 0x8, ddscaps_texture = 0x1000, ddscaps_mipmap = 0x400000;
+
+    // DXGI_FORMAT values of the DX10 header
+    constexpr std::uint32_t dxgi_bc1 = 71, dxgi_bc3 = 77, dxgi_bc4 = 80, dxgi_bc5 = 83, dxgi_bc7 = 98;
+    constexpr std::uint32_t d3d10_resource_dimension_texture2d = 3;
+
+    struct dds_pixel_format
+    {
+        std::uint32_t size;
+        std::uint32_t flags;
+        std::uint32_t four_cc;
+        std::uint32_t rgb_bit_count;
+        std::uint32_t bit_masks[4];
+    };
+
+    struct dds_header
+    {
+        std::uint32_t size;
+        std::uint32_t flags;
+        std::uint32_t height;
+        std::uint32_t width;
+        std::uint32_t pitch_or_linear_size;
+        std::uint32_t depth;
+        std::uint32_t mip_map_count;
+        std::uint32_t reserved1[11];
+        dds_pixel_format pixel_format;
+        std::uint32_t caps[4];
+        std::uint32_t reserved2;
+    };
+
+    struct dds_header_dx10
+    {
+        std::uint32_t dxgi_format;
+        std::uint32_t resource_dimension;
+        std::uint32_t misc_flag;
+        std::uint32_t array_size;
+        std::uint32_t misc_flags2;
+    };
+
+    static_assert(sizeof(dds_header) == 124);
+
+    struct parsed_header
+    {
+        dds_header header;
+        block_format format;
+        std::size_t data_offset;
+    };
+
+    block_format format_from_dxgi(std::uint32_t dxgi)
+    {
+        switch (dxgi)
+        {
+        case dxgi_bc1: return block_format::bc1;
+        case dxgi_bc3: return block_format::bc3;
+        case dxgi_bc4: return block_format::bc4;
+        case dxgi_bc5: return block_format::bc5;
+        case dxgi_bc7: return block_format::bc7;
+        }
+        throw std::runtime_error("Unsupported DXGI format " + std::to_string(dxgi));
+    }
+
+    parsed_header read_header(std::istream & input, std::filesystem::path const & path)
+    {
+        std::uint32_t magic;
+        parsed_header result;
+        if (!input.read(reinterpret_cast<char *>(&magic), sizeof(magic)) || magic != dds_magic
+            || !input.read(reinterpret_cast<char *>(&result.header), sizeof(result.header)) || result.header.size != sizeof(dds_header))
+            throw std::runtime_error(path.string() + " is not a DDS file");
+
+        result.data_offset = sizeof(magic) + sizeof(dds_header);
+
+        auto const & pf = result.header.pixel_format;
+        if (!(pf.flags & ddpf_fourcc))
+            throw std::runtime_error(path.string() + " is not block-compressed");
+
+        switch (pf.four_cc)
+        {
+        case four_cc('D', 'X', 'T', '1'): result.format = block_format::bc1; break;
+        case four_cc('D', 'X', 'T', '5'): result.format = block_format::bc3; break;
+        case four_cc('A', 'T', 'I', '1'): case four_cc('B', 'C', '4', 'U'): result.format = block_format::bc4; break;
+        case four_cc('A', 'T', 'I', '2'): case four_cc('B', 'C', '5', 'U'): result.format = block_format::bc5; break;
+        case four_cc('D', 'X', '1', '0'):
+            {
+                dds_header_dx10 dx10;
+                if (!input.read(reinterpret_cast<char *>(&dx10), sizeof(dx10)))
+                    throw std::runtime_error(path.string() + " has a truncated DX10 header");
+                if (dx10.resource_dimension != d3d10_resource_dimension_texture2d || dx10.array_size > 1)
+                    throw std::runtime_error(path.string() + " is not a single 2D texture");
+                result.format = format_from_dxgi(dx10.dxgi_format);
+                result.data_offset += sizeof(dx10);
+            }
+            break;
+        default:
+            throw std::runtime_error(path.string() + " has an unsupported FourCC");
+        }
+
+        return result;
+    }
+
+}
+
+std::size_t block_size(block_format format)
+{
+    return (format == block_format::bc1 || format == block_format::bc4) ? 8 : 16;
+}
+
+dds_info read_dds_info(std::filesystem::path const & path)
+{
+    std::ifstream input(path, std::ios::binary);
+    if (!input)
+        throw std::runtime_error("Failed to open " + path.string());
+
+    auto const parsed = read_header(input, path);
+    int const level_count = (parsed.header.flags & ddsd_mipmapcount) ? std::max<std::uint32_t>(1, parsed.header.mip_map_count) : 1;
+    return {parsed.format, static_cast<int>(parsed.header.width), static_cast<int>(parsed.header.height), level_count};
+}
+
+compressed_image read_dds(std::filesystem::path const & path)
+{
+    std::ifstream input(path, std::ios::binary);
+    if (!input)
+        throw std::runtime_error("Failed to open " + path.string());
+
+    auto const parsed = read_header(input, path);
+
+    compressed_image result;
+    result.format = parsed.format;
+
+    int width = parsed.header.width;
+    int height = parsed.header.height;
+    int const level_count = (parsed.header.flags & ddsd_mipmapcount) ? std::max<std::uint32_t>(1, parsed.header.mip_map_count) : 1;
+    if (level_count > 1 && (1 << (level_count - 1)) > std::max(width, height))
+        throw std::runtime_error(path.string() + " has more mip levels than its size allows");
+
+    std::size_t offset = 0;
+    for (int i = 0; i < level_count; ++i)
+    {
+        std::size_t const size = static_cast<std::size_t>((width + 3) / 4) * ((height + 3) / 4) * block_size(result.format);
+        result.levels.push_back({width, height, offset, size});
+        offset += size;
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+    }
+
+    result.data.resize(offset);
+    if (!input.read(reinterpret_cast<char *>(result.data.data()), result.data.size()))
+        throw std::runtime_error(path.string() + " is truncated");
+
+    return result;
+}
+
+void write_dds(std::filesystem::path const & path, compressed_image const & image)
+{
+    dds_header header{};
+    header.size = sizeof(header);
+    header.flags = ddsd_caps | ddsd_height | ddsd_width | ddsd_pixelformat | ddsd_mipmapcount | ddsd_linearsize;
+    header.width = image.levels.front().width;
+    header.height = image.levels.front().height;
+    header.pitch_or_linear_size = image.levels.front().size;
+    header.mip_map_count = image.levels.size();
+    header.pixel_format.size = sizeof(dds_pixel_format);
+    header.pixel_format.flags = ddpf_fourcc;
+    header.caps[0] = ddscaps_texture | (image.levels.size() > 1 ? ddscaps_complex | ddscaps_mipmap : 0);
+
+    dds_header_dx10 dx10{};
+    switch (image.format)
+    {
+    case block_format::bc1: header.pixel_format.four_cc = four_cc('D', 'X', 'T', '1'); break;
+    case block_format::bc3: header.pixel_format.four_cc = four_cc('D', 'X', 'T', '5'); break;
+    case block_format::bc4: header.pixel_format.four_cc = four_cc('A', 'T', 'I', '1'); break;
+    case block_format::bc5: header.pixel_format.four_cc = four_cc('A', 'T', 'I', '2'); break;
+    case block_format::bc7:
+        header.pixel_format.four_cc = four_cc('D', 'X', '1', '0');
+        dx10 = {dxgi_bc7, d3d10_resource_dimension_texture2d, 0, 1, 0};
+        break;
+    }
+
+    std::ofstream output(path, std::ios::binary);
+    output.write(reinterpret_cast<char const *>(&dds_magic), sizeof(dds_magic));
+    output.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    if (image.format == block_format::bc7)
+        output.write(reinterpret_cast<char const *>(&dx10), sizeof(dx10));
+    output.write(reinterpret_cast<char const *>(image.data.data()), image.data.size());
+    if (!output)
+        throw std::runtime_error("Failed to write " + path.string());
+}
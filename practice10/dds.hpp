@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+
+enum class block_format
+{
+    bc1,
+    bc3,
+    bc4,
+    bc5,
+    bc7,
+};
+
+// Bytes per 4x4 block
+std::size_t block_size(block_format format);
+
+// A block-compressed 2D texture with its whole mip chain, as stored in a DDS file
+struct compressed_image
+{
+    struct level
+    {
+        int width;
+        int height;
+        std::size_t offset;
+        std::size_t size;
+    };
+
+    block_format format;
+    std::vector<level> levels;
+    std::vector<std::uint8_t> data;
+};
+
+// Reads the legacy DXT1/DXT5/ATI1/ATI2 FourCCs and the DX10 extended header, which is the
+// only way BC7 is stored; throws on anything else
+compressed_image read_dds(std::filesystem::path const & path);
+
+struct dds_info
+{
+    block_format format;
+    int width;
+    int height;
+    int level_count;
+};
+
+// Only reads the header, to decide whether the format is usable before loading the file
+dds_info read_dds_info(std::filesystem::path const & path);
+
+// Legacy FourCCs where there is one, the DX10 header for BC7
+void write_dds(std::filesystem::path const & path, compressed_image const & image);
@@ -0,0 +1,431 @@
+#include "environment_lighting.hpp"
+#include "image_decoder.hpp"
+#include "job_system.hpp"
+
+#include <glm/geometric.hpp>
+#include <glm/ext/scalar_constants.hpp>
+
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+
+namespace
+{
+
+    // Resolutions of the working copy of the source, the prefiltered faces and the BRDF table
+    constexpr int source_width = 1024;
+    constexpr int prefiltered_face_size = 256;
+    constexpr int prefiltered_level_count = 6;
+    constexpr int lut_size = 64;
+
+    constexpr int prefilter_sample_count = 64;
+    constexpr int lut_sample_count = 256;
+
+    constexpr float pi = glm::pi<float>();
+
+    struct image
+    {
+        int width = 0;
+        int height = 0;
+        std::vector<glm::vec3> pixels;
+
+        glm::vec3 const & at(int x, int y) const { return pixels[y * width + x]; }
+    };
+
+    image downsample(image const & source)
+    {
+        image result;
+        result.width = std::max(1, source.width / 2);
+        result.height = std::max(1, source.height / 2);
+        result.pixels.resize(result.width * result.height);
+        for (int y = 0; y < result.height; ++y)
+            for (int x = 0; x < result.width; ++x)
+            {
+                int const x0 = std::min(2 * x, source.width - 1), x1 = std::min(2 * x + 1, source.width - 1);
+                int const y0 = std::min(2 * y, source.height - 1), y1 = std::min(2 * y + 1, source.height - 1);
+                result.pixels[y * result.width + x] = (source.at(x0, y0) + source.at(x1, y0) + source.at(x0, y1) + source.at(x1, y1)) * 0.25f;
+            }
+        return result;
+    }
+
+    // Box-filters the decoded image straight down to source_width, so the full-size float copy never exists
+    image load_source(std::filesystem::path const & path)
+    {
+        decoded_image decoded;
+        try
+        {
+            decoded = decode_image_file(path, 3);
+        }
+        catch (std::exception const & e)
+        {
+            throw std::runtime_error("Failed to load " + path.string() + ": " + e.what());
+        }
+
+        int const width = decoded.info.width;
+        int const height = decoded.info.height;
+        auto const * pixels = decoded.pixels.data();
+
+        int const factor = std::max(1, width / source_width);
+
+        image result;
+        result.width = width / factor;
+        result.height = height / factor;
+        result.pixels.assign(result.width * result.height, glm::vec3(0.f));
+
+        for (int y = 0; y < result.height * factor; ++y)
+            for (int x = 0; x < result.width * factor; ++x)
+            {
+                auto const * p = pixels + 3 * (static_cast<std::size_t>(y) * width + x);
+                result.pixels[(y / factor) * result.width + x / factor] += glm::vec3(p[0], p[1], p[2]);
+            }
+
+        float const scale = 1.f / (255.f * factor * factor);
+        for (auto & p : result.pixels)
+            p *= scale;
+
+        return result;
+    }
+
+    glm::vec3 texel_direction(int x, int y, int width, int height)
+    {
+        float const longitude = ((x + 0.5f) / width - 0.5f) * 2.f * pi;
+        float const latitude = ((y + 0.5f) / height - 0.5f) * pi;
+        return {std::cos(latitude) * std::cos(longitude), std::sin(latitude), std::cos(latitude) * std::sin(longitude)};
+    }
+
+    // Center of texel (x, y) of a size x size cube map face, as GL picks faces and their
+    // s and t: +X and -X look along +-x with s along -+z, +Y and -Y along +-y with s along +x,
+    // +Z and -Z along +-z with s along +-x, and t runs down the sides and along +-z on the caps
+    glm::vec3 cube_texel_direction(int face, int x, int y, int size)
+    {
+        float const s = 2.f * (x + 0.5f) / size - 1.f;
+        float const t = 2.f * (y + 0.5f) / size - 1.f;
+
+        glm::vec3 direction;
+        switch (face)
+        {
+        case 0: direction = { 1.f,  -t,  -s}; break;
+        case 1: direction = {-1.f,  -t,   s}; break;
+        case 2: direction = {   s, 1.f,   t}; break;
+        case 3: direction = {   s, -1.f, -t}; break;
+        case 4: direction = {   s,  -t, 1.f}; break;
+        default: direction = { -s,  -t, -1.f}; break;
+        }
+        return glm::normalize(direction);
+    }
+
+    // Bilinear, wrapping around in longitude
+    glm::vec3 sample(image const & source, glm::vec3 const & direction)
+    {
+        float const u = std::atan2(direction.z, direction.x) / (2.f * pi) + 0.5f;
+        float const v = std::asin(std::clamp(direction.y, -1.f, 1.f)) / pi + 0.5f;
+
+        float const fx = u * source.width - 0.5f;
+        float const fy = std::clamp(v * source.height - 0.5f, 0.f, source.height - 1.f);
+        int const x0 = static_cast<int>(std::floor(fx));
+        int const y0 = static_cast<int>(std::floor(fy));
+        float const tx = fx - x0, ty = fy - y0;
+
+        int const xa = (x0 % source.width + source.width) % source.width;
+        int const xb = (xa + 1) % source.width;
+        int const ya = y0, yb = std::min(y0 + 1, source.height - 1);
+
+        return (source.at(xa, ya) * (1.f - tx) + source.at(xb, ya) * tx) * (1.f - ty)
+            + (source.at(xa, yb) * (1.f - tx) + source.at(xb, yb) * tx) * ty;
+    }
+
+    // Real SH basis up to band 2, in the order the shader expects
+    std::array<float, 9> sh_basis(glm::vec3 const & d)
+    {
+        return {
+            0.282095f,
+            0.488603f * d.y, 0.488603f * d.z, 0.488603f * d.x,
+            1.092548f * d.x * d.y, 1.092548f * d.y * d.z, 0.315392f * (3.f * d.z * d.z - 1.f),
+            1.092548f * d.x * d.z, 0.546274f * (d.x * d.x - d.y * d.y),
+        };
+    }
+
+    std::array<glm::vec3, 9> project_irradiance(image const & source)
+    {
+        std::array<glm::vec3, 9> result{};
+        for (int y = 0; y < source.height; ++y)
+        {
+            // Texels near the poles cover less of the sphere
+            float const latitude = ((y + 0.5f) / source.height - 0.5f) * pi;
+            float const solid_angle = std::cos(latitude) * (2.f * pi / source.width) * (pi / source.height);
+
+            for (int x = 0; x < source.width; ++x)
+            {
+                auto const basis = sh_basis(texel_direction(x, y, source.width, source.height));
+                glm::vec3 const radiance = source.at(x, y) * solid_angle;
+                for (int i = 0; i < 9; ++i)
+                    result[i] += radiance * basis[i];
+            }
+        }
+
+        // Convolution with the clamped cosine, per band
+        float const band_scale[3] = {pi, 2.f * pi / 3.f, pi / 4.f};
+        for (int i = 0; i < 9; ++i)
+            result[i] *= band_scale[i == 0 ? 0 : (i < 4 ? 1 : 2)];
+        return result;
+    }
+
+    glm::vec2 hammersley(std::uint32_t i, std::uint32_t count)
+    {
+        std::uint32_t bits = i;
+        bits = (bits << 16u) | (bits >> 16u);
+        bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+        bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+        bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+        bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+        return {(i + 0.5f) / count, bits * 2.3283064365386963e-10f};
+    }
+
+    // Half vector distributed as GGX around n
+    glm::vec3 sample_ggx(glm::vec2 const & xi, glm::vec3 const & n, float roughness)
+    {
+        float const a = roughness * roughness;
+        float const phi = 2.f * pi * xi.x;
+        float const cos_theta = std::sqrt((1.f - xi.y) / (1.f + (a * a - 1.f) * xi.y));
+        float const sin_theta = std::sqrt(1.f - cos_theta * cos_theta);
+
+        glm::vec3 const up = std::abs(n.y) < 0.999f ? glm::vec3(0.f, 1.f, 0.f) : glm::vec3(1.f, 0.f, 0.f);
+        glm::vec3 const tangent = glm::normalize(glm::cross(up, n));
+        glm::vec3 const bitangent = glm::cross(n, tangent);
+        return glm::normalize(tangent * (sin_theta * std::cos(phi)) + bitangent * (sin_theta * std::sin(phi)) + n * cos_theta);
+    }
+
+    float ggx_distribution(float n_dot_h, float roughness)
+    {
+        float const a2 = roughness * roughness * roughness * roughness;
+        float const d = n_dot_h * n_dot_h * (a2 - 1.f) + 1.f;
+        return a2 / (pi * d * d);
+    }
+
+    // Assumes the view direction equals the normal, as the split sum does. Each sample reads
+    // the source mip whose texels match the solid angle the sample stands for, which keeps
+    // bright spots from turning into noise with this few samples.
+    glm::vec3 prefilter_texel(std::vector<image> const & source_mips, glm::vec3 const & n, float roughness)
+    {
+        float const source_texel_solid_angle = 4.f * pi / (source_mips[0].width * source_mips[0].height);
+
+        glm::vec3 sum(0.f);
+        float weight = 0.f;
+        for (int i = 0; i < prefilter_sample_count; ++i)
+        {
+            glm::vec3 const h = sample_ggx(hammersley(i, prefilter_sample_count), n, roughness);
+            float const n_dot_h = std::max(glm::dot(n, h), 0.f);
+            glm::vec3 const l = 2.f * n_dot_h * h - n;
+            float const n_dot_l = glm::dot(n, l);
+            if (n_dot_l <= 0.f)
+                continue;
+
+            float const pdf = ggx_distribution(n_dot_h, roughness) / 4.f;
+            float const sample_solid_angle = 1.f / (prefilter_sample_count * pdf + 1e-4f);
+            float const mip = std::clamp(0.5f * std::log2(sample_solid_angle / source_texel_solid_angle) + 1.f, 0.f, source_mips.size() - 1.f);
+
+            sum += sample(source_mips[static_cast<std::size_t>(std::round(mip))], l) * n_dot_l;
+            weight += n_dot_l;
+        }
+        return weight > 0.f ? sum / weight : glm::vec3(0.f);
+    }
+
+    // Scale and bias to F0 of the specular response integrated over the hemisphere
+    glm::vec2 integrate_brdf(float n_dot_v, float roughness)
+    {
+        glm::vec3 const v(std::sqrt(1.f - n_dot_v * n_dot_v), 0.f, n_dot_v);
+        glm::vec3 const n(0.f, 0.f, 1.f);
+
+        // Smith-Schlick geometry term with the image-based lighting k
+        float const k = roughness * roughness / 2.f;
+        auto g1 = [k](float x){ return x / (x * (1.f - k) + k); };
+
+        glm::vec2 result(0.f);
+        for (int i = 0; i < lut_sample_count; ++i)
+        {
+            glm::vec3 const h = sample_ggx(hammersley(i, lut_sample_count), n, roughness);
+            glm::vec3 const l = 2.f * glm::dot(v, h) * h - v;
+
+            float const n_dot_l = std::max(l.z, 0.f);
+            float const n_dot_h = std::max(h.z, 0.f);
+            float const v_dot_h = std::max(glm::dot(v, h), 0.f);
+            if (n_dot_l <= 0.f)
+                continue;
+
+            float const visibility = g1(n_dot_l) * g1(n_dot_v) * v_dot_h / (n_dot_h * n_dot_v);
+            float const fresnel = std::pow(1.f - v_dot_h, 5.f);
+            result += glm::vec2((1.f - fresnel) * visibility, fresnel * visibility);
+        }
+        return result / float(lut_sample_count);
+    }
+
+    constexpr char cache_magic[4] = {'I', 'B', 'L', 'C'};
+    constexpr std::uint32_t cache_version = 2;
+
+    // Followed by the SH coefficients, every prefiltered level in order and the BRDF table
+    struct cache_header
+    {
+        char magic[4];
+        std::uint32_t version;
+        std::uint64_t source_size;
+        std::int64_t source_time;
+        std::int32_t face_size;
+        std::int32_t padding;
+        std::int32_t level_count;
+        std::int32_t brdf_lut_size;
+    };
+
+    cache_header make_header(std::filesystem::path const & path)
+    {
+        cache_header header{};
+        std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+        header.version = cache_version;
+        header.source_size = std::filesystem::file_size(path);
+        header.source_time = std::filesystem::last_write_time(path).time_since_epoch().count();
+        return header;
+    }
+
+    std::size_t level_texel_count(int face_size, int level)
+    {
+        std::size_t const size = std::max(1, face_size >> level);
+        return 6 * size * size;
+    }
+
+    bool read_cache(std::filesystem::path const & cache_path, cache_header const & expected, environment_lighting & result)
+    {
+        std::ifstream input(cache_path, std::ios::binary);
+        if (!input)
+            return false;
+
+        cache_header header;
+        if (!input.read(reinterpret_cast<char *>(&header), sizeof(header)))
+            return false;
+
+        if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0
+            || header.version != expected.version
+            || header.source_size != expected.source_size
+            || header.source_time != expected.source_time
+            || header.level_count <= 0 || header.level_count > 16
+            || header.face_size <= 0 || header.brdf_lut_size <= 0)
+            return false;
+
+        result.face_size = header.face_size;
+        result.brdf_lut_size = header.brdf_lut_size;
+
+        input.read(reinterpret_cast<char *>(result.irradiance_sh.data()), sizeof(result.irradiance_sh));
+
+        result.prefiltered_levels.resize(header.level_count);
+        for (int level = 0; level < header.level_count; ++level)
+        {
+            auto & pixels = result.prefiltered_levels[level];
+            pixels.resize(level_texel_count(header.face_size, level));
+            input.read(reinterpret_cast<char *>(pixels.data()), pixels.size() * sizeof(pixels[0]));
+        }
+
+        result.brdf_lut.resize(static_cast<std::size_t>(header.brdf_lut_size) * header.brdf_lut_size);
+        input.read(reinterpret_cast<char *>(result.brdf_lut.data()), result.brdf_lut.size() * sizeof(result.brdf_lut[0]));
+
+        // Anything short or trailing means the cache is not what this version writes
+        return input && input.peek() == std::ifstream::traits_type::eof();
+    }
+
+    void write_cache(std::filesystem::path const & cache_path, cache_header header, environment_lighting const & lighting)
+    {
+        header.face_size = lighting.face_size;
+        header.level_count = lighting.prefiltered_levels.size();
+        header.brdf_lut_size = lighting.brdf_lut_size;
+
+        // Write to a temporary file first so that a concurrent reader never sees a partial cache
+        auto temp_path = cache_path;
+        temp_path += ".tmp";
+
+        {
+            std::ofstream output(temp_path, std::ios::binary);
+            output.write(reinterpret_cast<char const *>(&header), sizeof(header));
+            output.write(reinterpret_cast<char const *>(lighting.irradiance_sh.data()), sizeof(lighting.irradiance_sh));
+            for (auto const & pixels : lighting.prefiltered_levels)
+                output.write(reinterpret_cast<char const *>(pixels.data()), pixels.size() * sizeof(pixels[0]));
+            output.write(reinterpret_cast<char const *>(lighting.brdf_lut.data()), lighting.brdf_lut.size() * sizeof(lighting.brdf_lut[0]));
+            if (!output)
+                return;
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temp_path, cache_path, error);
+        if (error)
+            std::filesystem::remove(temp_path, error);
+    }
+
+}
+
+environment_lighting prefilter_environment(std::filesystem::path const & image_path, job_system & jobs)
+{
+    std::vector<image> source_mips{load_source(image_path)};
+    while (source_mips.back().width > 4)
+        source_mips.push_back(downsample(source_mips.back()));
+
+    environment_lighting result;
+    result.irradiance_sh = project_irradiance(source_mips[0]);
+
+    // A face spans a quarter of the source's longitude
+    result.face_size = std::max(1, std::min(prefiltered_face_size, source_mips[0].width / 4));
+
+    // A mirror only needs the source resampled; rougher levels get blurrier and smaller
+    result.prefiltered_levels.resize(prefiltered_level_count);
+    for (int level = 0; level < prefiltered_level_count; ++level)
+    {
+        int const size = std::max(1, result.face_size >> level);
+        float const roughness = level / float(prefiltered_level_count - 1);
+
+        auto & pixels = result.prefiltered_levels[level];
+        pixels.resize(level_texel_count(result.face_size, level));
+
+        // One row of one face per index, so rough levels with few rows still spread
+        jobs.parallel_for(6 * size, 1, [&](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t row = begin; row < end; ++row)
+            {
+                int const face = row / size;
+                int const y = row % size;
+                for (int x = 0; x < size; ++x)
+                {
+                    glm::vec3 const n = cube_texel_direction(face, x, y, size);
+                    pixels[row * size + x] = (level == 0) ? sample(source_mips[0], n) : prefilter_texel(source_mips, n, roughness);
+                }
+            }
+        }, "prefilter environment");
+    }
+
+    result.brdf_lut_size = lut_size;
+    result.brdf_lut.resize(lut_size * lut_size);
+    for (int y = 0; y < lut_size; ++y)
+        for (int x = 0; x < lut_size; ++x)
+            result.brdf_lut[y * lut_size + x] = integrate_brdf((x + 0.5f) / lut_size, (y + 0.5f) / lut_size);
+
+    return result;
+}
+
+std::filesystem::path environment_lighting_cache_path(std::filesystem::path const & image_path)
+{
+    auto result = image_path;
+    result += ".ibl";
+    return result;
+}
+
+environment_lighting load_environment_lighting_cached(std::filesystem::path const & image_path, job_system & jobs)
+{
+    auto const cache_path = environment_lighting_cache_path(image_path);
+    auto const header = make_header(image_path);
+
+    environment_lighting result;
+    if (read_cache(cache_path, header, result))
+        return result;
+
+    result = prefilter_environment(image_path, jobs);
+    write_cache(cache_path, header, result);
+    return result;
+}
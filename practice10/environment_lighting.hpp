@@ -0,0 +1,40 @@
+#pragma once
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include <array>
+#include <vector>
+#include <filesystem>
+
+struct job_system;
+
+// Image-based lighting precomputed from an equirectangular environment map, whose texel
+// (u, v) looks along longitude (u - 0.5) 2pi and latitude (v - 0.5) pi, y up.
+// Diffuse light becomes 9 spherical harmonic coefficients, specular light a cube map mip
+// chain whose level i is the environment convolved with GGX of roughness i / (level count - 1),
+// and the rest of the split-sum approximation a table of scale and bias to F0.
+struct environment_lighting
+{
+    // Irradiance around a normal is the sum of these times the corresponding SH basis
+    // functions, with the cosine lobe already applied; divide by pi for diffuse radiance
+    std::array<glm::vec3, 9> irradiance_sh;
+
+    // Every level holds the six faces in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order, rows
+    // from t = -1 as glTexImage2D takes them. Faces of level 0 are face_size squared,
+    // each next level half of that.
+    int face_size = 0;
+    std::vector<std::vector<glm::vec3>> prefiltered_levels;
+
+    // Indexed by (NdotV, roughness), NdotV fastest
+    int brdf_lut_size = 0;
+    std::vector<glm::vec2> brdf_lut;
+};
+
+// Rows of the prefiltered faces run in parallel on jobs
+environment_lighting prefilter_environment(std::filesystem::path const & image_path, job_system & jobs);
+
+// Reads <image>.ibl next to the image, prefiltering and writing it if it is missing or out of date
+environment_lighting load_environment_lighting_cached(std::filesystem::path const & image_path, job_system & jobs);
+
+std::filesystem::path environment_lighting_cache_path(std::filesystem::path const & image_path);
@@ -0,0 +1,64 @@
+#include "gl_resources.hpp"
+
+#include <cstdint>
+
+bool direct_state_access_supported()
+{
+    return GLEW_VERSION_4_5 || GLEW_ARB_direct_state_access;
+}
+
+GLuint create_static_buffer(void const * data, std::size_t size)
+{
+    GLuint buffer;
+
+    if (direct_state_access_supported())
+    {
+        glCreateBuffers(1, &buffer);
+        glNamedBufferStorage(buffer, size, data, 0);
+        return buffer;
+    }
+
+    // Bound to the copy target, so that no VAO's element buffer is replaced
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    if (GLEW_ARB_buffer_storage)
+        glBufferStorage(GL_COPY_WRITE_BUFFER, size, data, 0);
+    else
+        glBufferData(GL_COPY_WRITE_BUFFER, size, data, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return buffer;
+}
+
+GLuint create_vertex_array(GLuint vertex_buffer, GLsizei stride, std::vector<vertex_attribute> const & attributes, GLuint index_buffer)
+{
+    GLuint vao;
+
+    if (direct_state_access_supported())
+    {
+        glCreateVertexArrays(1, &vao);
+        glVertexArrayVertexBuffer(vao, 0, vertex_buffer, 0, stride);
+        for (auto const & a : attributes)
+        {
+            glEnableVertexArrayAttrib(vao, a.location);
+            glVertexArrayAttribFormat(vao, a.location, a.size, a.type, a.normalized, a.offset);
+            glVertexArrayAttribBinding(vao, a.location, 0);
+        }
+        if (index_buffer)
+            glVertexArrayElementBuffer(vao, index_buffer);
+        return vao;
+    }
+
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+    for (auto const & a : attributes)
+    {
+        glEnableVertexAttribArray(a.location);
+        glVertexAttribPointer(a.location, a.size, a.type, a.normalized, stride, reinterpret_cast<void const *>(std::uintptr_t(a.offset)));
+    }
+    if (index_buffer)
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return vao;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <vector>
+#include <cstddef>
+
+// Creation of static GPU resources, through GL 4.5 direct state access where it is available
+// and through bind-to-edit otherwise. Static data gets immutable storage (glNamedBufferStorage,
+// or glBufferStorage with ARB_buffer_storage), which the driver can place where it likes since
+// it is never reallocated. With DSA nothing here changes the current bindings; without it the
+// buffer targets it uses and the vertex array binding are reset to 0 afterwards.
+
+bool direct_state_access_supported();
+
+// Never written again after creation
+GLuint create_static_buffer(void const * data, std::size_t size);
+
+template <typename T>
+GLuint create_static_buffer(std::vector<T> const & data)
+{
+    return create_static_buffer(data.data(), data.size() * sizeof(T));
+}
+
+// One float attribute read from the vertex buffer at offset; integer types are converted,
+// normalized or not
+struct vertex_attribute
+{
+    GLuint location;
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    GLuint offset;
+};
+
+// All attributes read one interleaved vertex buffer; index_buffer may be 0
+GLuint create_vertex_array(GLuint vertex_buffer, GLsizei stride, std::vector<vertex_attribute> const & attributes, GLuint index_buffer);
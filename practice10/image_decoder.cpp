@@ -0,0 +1,235 @@
+#include "image_decoder.hpp"
+#include "stb_image.h"
+
+#ifdef HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+#ifdef HAVE_SPNG
+#include <spng.h>
+#endif
+
+#include <array>
+#include <memory>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <algorithm>
+
+namespace
+{
+
+    bool starts_with(std::span<std::uint8_t const> file, std::initializer_list<std::uint8_t> signature)
+    {
+        return file.size() >= signature.size() && std::equal(signature.begin(), signature.end(), file.begin());
+    }
+
+    bool is_jpeg(std::span<std::uint8_t const> file)
+    {
+        return starts_with(file, {0xFF, 0xD8, 0xFF});
+    }
+
+    bool is_png(std::span<std::uint8_t const> file)
+    {
+        return starts_with(file, {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'});
+    }
+
+    // Copies texels of one channel count to rows of another, the way stb_image converts:
+    // grey spreads over the colour channels, and colour becomes grey by its luma
+    void convert_rows(std::uint8_t const * in, int in_channels, int width, int height, int channels,
+        std::uint8_t * out, std::size_t row_pitch)
+    {
+        for (int y = 0; y < height; ++y)
+        {
+            std::uint8_t const * src = in + std::size_t(y) * width * in_channels;
+            std::uint8_t * dst = out + y * row_pitch;
+            if (in_channels == channels)
+            {
+                std::memcpy(dst, src, std::size_t(width) * channels);
+                continue;
+            }
+
+            for (int x = 0; x < width; ++x, src += in_channels, dst += channels)
+            {
+                bool const in_grey = in_channels <= 2;
+                std::uint8_t const alpha = (in_channels == 2 || in_channels == 4) ? src[in_channels - 1] : 255;
+                std::uint8_t const grey = in_grey ? src[0] : static_cast<std::uint8_t>((src[0] * 77 + src[1] * 150 + src[2] * 29) >> 8);
+
+                if (channels <= 2)
+                    dst[0] = grey;
+                else
+                    for (int c = 0; c < 3; ++c)
+                        dst[c] = in_grey ? src[0] : src[c];
+                if (channels == 2 || channels == 4)
+                    dst[channels - 1] = alpha;
+            }
+        }
+    }
+
+    bool accepts_any(std::span<std::uint8_t const>)
+    {
+        return true;
+    }
+
+    bool stb_info(std::span<std::uint8_t const> file, image_info & info)
+    {
+        return stbi_info_from_memory(file.data(), file.size(), &info.width, &info.height, &info.channels) != 0;
+    }
+
+    void stb_decode(std::span<std::uint8_t const> file, int channels, std::uint8_t * out, std::size_t row_pitch)
+    {
+        image_info info;
+        std::unique_ptr<stbi_uc, void (*)(void *)> pixels{
+            stbi_load_from_memory(file.data(), file.size(), &info.width, &info.height, &info.channels, channels), stbi_image_free};
+        if (!pixels)
+            throw std::runtime_error(stbi_failure_reason());
+
+        int const stored = channels ? channels : info.channels;
+        convert_rows(pixels.get(), stored, info.width, info.height, stored, out, row_pitch);
+    }
+
+#ifdef HAVE_TURBOJPEG
+
+    using turbojpeg_handle = std::unique_ptr<void, int (*)(tjhandle)>;
+
+    bool turbojpeg_info(std::span<std::uint8_t const> file, image_info & info)
+    {
+        turbojpeg_handle handle{tjInitDecompress(), tjDestroy};
+        int subsampling, colorspace;
+        if (!handle || tjDecompressHeader3(handle.get(), file.data(), file.size(), &info.width, &info.height, &subsampling, &colorspace) != 0)
+            return false;
+        info.channels = colorspace == TJCS_GRAY ? 1 : 3;
+        return colorspace != TJCS_CMYK && colorspace != TJCS_YCCK;
+    }
+
+    void turbojpeg_decode(std::span<std::uint8_t const> file, int channels, std::uint8_t * out, std::size_t row_pitch)
+    {
+        image_info info;
+        if (!turbojpeg_info(file, info))
+            throw std::runtime_error("Not a JPEG file TurboJPEG can read");
+        if (channels == 0)
+            channels = info.channels;
+
+        // JPEG has no alpha, so grey with alpha goes through grey
+        int const decoded = channels == 2 ? 1 : channels;
+        std::vector<std::uint8_t> scratch;
+        std::uint8_t * target = out;
+        std::size_t pitch = row_pitch;
+        if (decoded != channels)
+        {
+            scratch.resize(std::size_t(info.width) * info.height * decoded);
+            target = scratch.data();
+            pitch = std::size_t(info.width) * decoded;
+        }
+
+        TJPF const format = decoded == 1 ? TJPF_GRAY : decoded == 3 ? TJPF_RGB : TJPF_RGBA;
+        turbojpeg_handle handle{tjInitDecompress(), tjDestroy};
+        if (tjDecompress2(handle.get(), file.data(), file.size(), target, info.width, pitch, info.height, format, 0) != 0)
+            throw std::runtime_error(tjGetErrorStr2(handle.get()));
+
+        if (decoded != channels)
+            convert_rows(scratch.data(), decoded, info.width, info.height, channels, out, row_pitch);
+    }
+
+#endif
+
+#ifdef HAVE_SPNG
+
+    using spng_context = std::unique_ptr<spng_ctx, void (*)(spng_ctx *)>;
+
+    spng_context open_png(std::span<std::uint8_t const> file, spng_ihdr & header)
+    {
+        spng_context context{spng_ctx_new(0), spng_ctx_free};
+        if (!context || spng_set_png_buffer(context.get(), file.data(), file.size()) != 0 || spng_get_ihdr(context.get(), &header) != 0)
+            return {nullptr, spng_ctx_free};
+        return context;
+    }
+
+    bool spng_info(std::span<std::uint8_t const> file, image_info & info)
+    {
+        spng_ihdr header;
+        auto context = open_png(file, header);
+        if (!context)
+            return false;
+
+        info.width = header.width;
+        info.height = header.height;
+        spng_trns transparency;
+        bool const has_transparency = spng_get_trns(context.get(), &transparency) == 0;
+        switch (header.color_type)
+        {
+        case SPNG_COLOR_TYPE_GRAYSCALE: info.channels = has_transparency ? 2 : 1; break;
+        case SPNG_COLOR_TYPE_GRAYSCALE_ALPHA: info.channels = 2; break;
+        case SPNG_COLOR_TYPE_TRUECOLOR_ALPHA: info.channels = 4; break;
+        default: info.channels = has_transparency ? 4 : 3; break;
+        }
+        return true;
+    }
+
+    void spng_decode(std::span<std::uint8_t const> file, int channels, std::uint8_t * out, std::size_t row_pitch)
+    {
+        image_info info;
+        if (!spng_info(file, info))
+            throw std::runtime_error("Not a PNG file libspng can read");
+        if (channels == 0)
+            channels = info.channels;
+
+        // RGB8 and RGBA8 are the outputs every PNG can decode to, fewer channels are taken from them
+        int const decoded = channels == 3 ? 3 : 4;
+        std::vector<std::uint8_t> scratch(std::size_t(info.width) * info.height * decoded);
+
+        spng_ihdr header;
+        auto context = open_png(file, header);
+        int const format = decoded == 3 ? SPNG_FMT_RGB8 : SPNG_FMT_RGBA8;
+        if (int const error = spng_decode_image(context.get(), scratch.data(), scratch.size(), format, SPNG_DECODE_TRNS); error != 0)
+            throw std::runtime_error(spng_strerror(error));
+
+        convert_rows(scratch.data(), decoded, info.width, info.height, channels, out, row_pitch);
+    }
+
+#endif
+
+    std::array const decoders = {
+#ifdef HAVE_TURBOJPEG
+        image_decoder{"turbojpeg", is_jpeg, turbojpeg_info, turbojpeg_decode},
+#endif
+#ifdef HAVE_SPNG
+        image_decoder{"spng", is_png, spng_info, spng_decode},
+#endif
+        image_decoder{"stb_image", accepts_any, stb_info, stb_decode},
+    };
+
+}
+
+std::span<image_decoder const> image_decoders()
+{
+    return decoders;
+}
+
+image_decoder const & find_image_decoder(std::span<std::uint8_t const> file, image_info & info)
+{
+    // A backend can still refuse a file of its format, like TurboJPEG does CMYK ones
+    for (auto const & decoder : decoders)
+        if (decoder.accepts(file) && decoder.info(file, info))
+            return decoder;
+    throw std::runtime_error(stbi_failure_reason());
+}
+
+decoded_image decode_image_file(std::filesystem::path const & path, int channels)
+{
+    std::ifstream input(path, std::ios::binary);
+    if (!input)
+        throw std::runtime_error("cannot open the file");
+    std::vector<std::uint8_t> const file{std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
+
+    decoded_image result;
+    auto const & decoder = find_image_decoder(file, result.info);
+    if (channels != 0)
+        result.info.channels = channels;
+
+    std::size_t const row_pitch = std::size_t(result.info.width) * result.info.channels;
+    result.pixels.resize(row_pitch * result.info.height);
+    decoder.decode(file, channels, result.pixels.data(), row_pitch);
+    return result;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+struct image_info
+{
+    int width = 0;
+    int height = 0;
+    // As stored in the file: 1 grey, 2 grey and alpha, 3 RGB, 4 RGBA
+    int channels = 0;
+};
+
+// One way to decode 8-bit images from files in memory. JPEG goes to libjpeg-turbo and PNG to
+// libspng when the build finds them (HAVE_TURBOJPEG, HAVE_SPNG), as their SIMD IDCT, colour
+// conversion, filters and inflate decode large textures several times faster than stb_image,
+// which stays as the fallback for those and everything else. The functions are called from
+// any thread at once.
+struct image_decoder
+{
+    char const * name;
+    // From the first bytes of the file
+    bool (*accepts)(std::span<std::uint8_t const> file);
+    // False if the file cannot be read, by this backend at least
+    bool (*info)(std::span<std::uint8_t const> file, image_info & info);
+    // Writes rows of info.width texels of channels bytes, or of the channels stored when it is
+    // 0, row_pitch bytes apart, so that out can be a mapped pixel buffer; throws on failure
+    void (*decode)(std::span<std::uint8_t const> file, int channels, std::uint8_t * out, std::size_t row_pitch);
+};
+
+// Those of this build, stb last
+std::span<image_decoder const> image_decoders();
+
+// The first that accepts the file and reads its header into info; throws if none does
+image_decoder const & find_image_decoder(std::span<std::uint8_t const> file, image_info & info);
+
+struct decoded_image
+{
+    image_info info;
+    // Rows are tightly packed, info.channels bytes per texel
+    std::vector<std::uint8_t> pixels;
+};
+
+// Reads and decodes the whole file; channels 0 keeps the channels stored, and info.channels
+// is what the pixels have either way. Throws if the file cannot be read or decoded, with a
+// message that leaves naming the file to the caller.
+decoded_image decode_image_file(std::filesystem::path const & path, int channels = 0);
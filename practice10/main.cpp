@@ -12,8 +12,12 @@
 #include <iostream>
 #include <chrono>
 #include <vector>
-#include <map>
+#include <optional>
 #include <cmath>
+#include <algorithm>
+#include <filesystem>
+#include <cstring>
+#include <cstdio>
 
 #define GLM_FORCE_SWIZZLE
 #define GLM_ENABLE_EXPERIMENTAL
@@ -25,7 +29,25 @@
 #include <glm/gtx/string_cast.hpp>
 
 #include "obj_parser.hpp"
-#include "stb_image.h"
+#include "profiler.hpp"
+#include "render_stats.hpp"
+#include "environment_lighting.hpp"
+#include "texture_loader.hpp"
+#include "image_decoder.hpp"
+#include "procedural_mesh.hpp"
+#include "render_commands.hpp"
+#include "job_system.hpp"
+#include "frame_arena.hpp"
+#include "allocation_tracker.hpp"
+#include "frame_pacer.hpp"
+#include "offscreen_target.hpp"
+#include "async_readback.hpp"
+#include "frame_encoder.hpp"
+#include "frame_capture.hpp"
+#include "dynamic_resolution_target.hpp"
+#include "program_cache.hpp"
+#include "input_state.hpp"
+#include "replay_session.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -59,6 +81,9 @@ out vec3 tangent;
 out vec3 normal;
 out vec2 texcoord;
 
+// The depth prepass computes gl_Position the same way and relies on matching depth exactly
+invariant gl_Position;
+
 void main()
 {
     position = (model * vec4(in_position, 1.0)).xyz;
@@ -76,6 +101,15 @@ uniform vec3 light_direction;
 uniform vec3 camera_position;
 
 uniform sampler2D albedo_texture;
+uniform sampler2D normal_texture;
+// Occlusion, roughness, metallic
+uniform sampler2D orm_texture;
+
+// Precomputed by environment_lighting
+uniform vec3 irradiance_sh[9];
+uniform samplerCube prefiltered_texture;
+uniform float prefiltered_max_level;
+uniform sampler2D brdf_lut;
 
 in vec3 position;
 in vec3 tangent;
@@ -86,15 +120,72 @@ layout (location = 0) out vec4 out_color;
 
 const float PI = 3.141592653589793;
 
-void main()
+vec3 irradiance(vec3 n)
 {
-    float ambient_light = 0.2;
+    vec3 result = irradiance_sh[0] * 0.282095
+        + (irradiance_sh[1] * n.y + irradiance_sh[2] * n.z + irradiance_sh[3] * n.x) * 0.488603
+        + (irradiance_sh[4] * n.x * n.y + irradiance_sh[5] * n.y * n.z + irradiance_sh[7] * n.x * n.z) * 1.092548
+        + irradiance_sh[6] * (3.0 * n.z * n.z - 1.0) * 0.315392
+        + irradiance_sh[8] * (n.x * n.x - n.y * n.y) * 0.546274;
+    return max(result, vec3(0.0));
+}
 
-    float lightness = ambient_light + max(0.0, dot(normalize(normal), light_direction));
+void main()
+{
+    vec3 n = normalize(normal);
+    vec3 t = normalize(tangent - n * dot(n, tangent));
+    vec3 b = cross(n, t);
+    // Only xy is read, so that BC5 normal maps (which have no z) work the same as RGB ones
+    vec3 tangent_normal;
+    tangent_normal.xy = texture(normal_texture, texcoord).rg * 2.0 - vec2(1.0);
+    tangent_normal.z = sqrt(max(0.0, 1.0 - dot(tangent_normal.xy, tangent_normal.xy)));
+    n = normalize(mat3(t, b, n) * tangent_normal);
 
     vec3 albedo = texture(albedo_texture, texcoord).rgb;
+    vec3 orm = texture(orm_texture, texcoord).rgb;
+    float ao = orm.r;
+    float roughness = orm.g;
+    float metallic = orm.b;
+
+    vec3 diffuse = albedo * (irradiance(n) / PI * ao + vec3(max(0.0, dot(n, light_direction))));
+
+    // Split-sum specular: one fetch from the prefiltered chain and one from the BRDF table
+    vec3 view_direction = normalize(camera_position - position);
+    vec3 reflected = reflect(-view_direction, n);
+    float n_dot_v = max(dot(n, view_direction), 1e-4);
+    vec3 prefiltered = textureLod(prefiltered_texture, reflected, roughness * prefiltered_max_level).rgb;
+    vec2 brdf = texture(brdf_lut, vec2(n_dot_v, roughness)).rg;
+    vec3 f0 = mix(vec3(0.04), albedo, metallic);
+    vec3 specular = prefiltered * (f0 * brdf.x + brdf.y) * ao;
+
+    out_color = vec4(diffuse * (1.0 - f0) * (1.0 - metallic) + specular, 1.0);
+}
+)";
+
+// Depth only, from the position stream; the color pass then shades just the visible samples
+const char prepass_vertex_shader_source[] =
+R"(#version 330 core
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+layout (location = 0) in vec3 in_position;
+
+invariant gl_Position;
+
+void main()
+{
+    vec3 position = (model * vec4(in_position, 1.0)).xyz;
+    gl_Position = projection * view * vec4(position, 1.0);
+}
+)";
 
-    out_color = vec4(lightness * albedo, 1.0);
+const char prepass_fragment_shader_source[] =
+R"(#version 330 core
+
+void main()
+{
 }
 )";
 
@@ -137,72 +228,65 @@ GLuint create_program(GLuint vertex_shader, GLuint fragment_shader)
     return result;
 }
 
-struct vertex
+// <name>.dds made by the compressed_textures target, if it exists and the context can
+// sample its format
+std::optional<std::string> compressed_texture_path(std::string const & name)
 {
-    glm::vec3 position;
-    glm::vec3 tangent;
-    glm::vec3 normal;
-    glm::vec2 texcoords;
-};
-
-std::pair<std::vector<vertex>, std::vector<std::uint32_t>> generate_sphere(float radius, int quality)
-{
-    std::vector<vertex> vertices;
+    std::string const path = name + ".dds";
+    std::error_code error;
+    if (!std::filesystem::exists(path, error))
+        return std::nullopt;
 
-    for (int latitude = -quality; latitude <= quality; ++latitude)
+    try
     {
-        for (int longitude = 0; longitude <= 4 * quality; ++longitude)
-        {
-            float lat = (latitude * glm::pi<float>()) / (2.f * quality);
-            float lon = (longitude * glm::pi<float>()) / (2.f * quality);
-
-            auto & vertex = vertices.emplace_back();
-            vertex.normal = {std::cos(lat) * std::cos(lon), std::sin(lat), std::cos(lat) * std::sin(lon)};
-            vertex.position = vertex.normal * radius;
-            vertex.tangent = {-std::cos(lat) * std::sin(lon), 0.f, std::cos(lat) * std::cos(lon)};
-            vertex.texcoords.x = (longitude * 1.f) / (4.f * quality);
-            vertex.texcoords.y = (latitude * 1.f) / (2.f * quality) + 0.5f;
-        }
+        if (block_format_supported(read_dds_info(path).format))
+            return path;
     }
-
-    std::vector<std::uint32_t> indices;
-
-    for (int latitude = 0; latitude < 2 * quality; ++latitude)
+    catch (std::exception const & e)
     {
-        for (int longitude = 0; longitude < 4 * quality; ++longitude)
-        {
-            std::uint32_t i0 = (latitude + 0) * (4 * quality + 1) + (longitude + 0);
-            std::uint32_t i1 = (latitude + 1) * (4 * quality + 1) + (longitude + 0);
-            std::uint32_t i2 = (latitude + 0) * (4 * quality + 1) + (longitude + 1);
-            std::uint32_t i3 = (latitude + 1) * (4 * quality + 1) + (longitude + 1);
-
-            indices.insert(indices.end(), {i0, i1, i2, i2, i1, i3});
-        }
+        std::cerr << e.what() << std::endl;
     }
-
-    return {std::move(vertices), std::move(indices)};
+    return std::nullopt;
 }
 
-GLuint load_texture(std::string const & path)
+// Renders a fixed number of frames into an offscreen framebuffer in a hidden window, with
+// a fixed time step, optionally writing them out as png files, and reports the throughput:
+//   practice10 --headless WIDTHxHEIGHT [--frames N] [--output DIRECTORY]
+struct headless_settings
 {
-    int width, height, channels;
-    auto pixels = stbi_load(path.data(), &width, &height, &channels, 4);
-
-    GLuint result;
-    glGenTextures(1, &result);
-    glBindTexture(GL_TEXTURE_2D, result);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    int width = 512;
+    int height = 512;
+    int frames = 100;
+    std::optional<std::filesystem::path> output;
+};
 
-    stbi_image_free(pixels);
+std::optional<headless_settings> parse_headless(int argc, char ** argv)
+{
+    if (argc < 2 || std::strcmp(argv[1], "--headless") != 0)
+        return std::nullopt;
 
-    return result;
+    headless_settings settings;
+    if (argc < 3 || std::sscanf(argv[2], "%dx%d", &settings.width, &settings.height) != 2 || settings.width <= 0 || settings.height <= 0)
+        throw std::runtime_error("usage: practice10 --headless WIDTHxHEIGHT [--frames N] [--output DIRECTORY]");
+
+    for (int i = 3; i + 1 < argc; i += 2)
+    {
+        if (std::strcmp(argv[i], "--frames") == 0)
+            settings.frames = std::max(1, std::atoi(argv[i + 1]));
+        else if (std::strcmp(argv[i], "--output") == 0)
+            settings.output = argv[i + 1];
+        else
+            throw std::runtime_error(std::string("Unknown option ") + argv[i]);
+    }
+
+    return settings;
 }
 
-int main() try
+int main(int argc, char ** argv) try
 {
+    auto const headless = parse_headless(argc, argv);
+    replay_session replay(argc, argv);
+
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
         sdl2_fail("SDL_Init: ");
 
@@ -210,18 +294,17 @@ int main() try
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
     SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
-    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 1);
-    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 4);
     SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
 
+    // Headless frames never reach the window, which only provides the context
     SDL_Window * window = SDL_CreateWindow("Graphics course practice 5",
         SDL_WINDOWPOS_CENTERED,
         SDL_WINDOWPOS_CENTERED,
         800, 600,
-        SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_MAXIMIZED);
+        headless ? SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN : SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_MAXIMIZED);
 
     if (!window)
         sdl2_fail("SDL_CreateWindow: ");
@@ -251,49 +334,179 @@ int main() try
     GLuint light_direction_location = glGetUniformLocation(program, "light_direction");
     GLuint camera_position_location = glGetUniformLocation(program, "camera_position");
     GLuint albedo_texture_location = glGetUniformLocation(program, "albedo_texture");
+    GLuint normal_texture_location = glGetUniformLocation(program, "normal_texture");
+    GLuint orm_texture_location = glGetUniformLocation(program, "orm_texture");
+    GLuint irradiance_sh_location = glGetUniformLocation(program, "irradiance_sh");
+    GLuint prefiltered_texture_location = glGetUniformLocation(program, "prefiltered_texture");
+    GLuint prefiltered_max_level_location = glGetUniformLocation(program, "prefiltered_max_level");
+    GLuint brdf_lut_location = glGetUniformLocation(program, "brdf_lut");
+
+    auto prepass_vertex_shader = create_shader(GL_VERTEX_SHADER, prepass_vertex_shader_source);
+    auto prepass_fragment_shader = create_shader(GL_FRAGMENT_SHADER, prepass_fragment_shader_source);
+    auto prepass_program = create_program(prepass_vertex_shader, prepass_fragment_shader);
+
+    GLuint prepass_model_location = glGetUniformLocation(prepass_program, "model");
+    GLuint prepass_view_location = glGetUniformLocation(prepass_program, "view");
+    GLuint prepass_projection_location = glGetUniformLocation(prepass_program, "projection");
+
+    // Both at about the same triangle count; the icosphere spreads them evenly
+    mesh_cache meshes;
+    mesh_shape sphere_shape = mesh_shape::uv_sphere;
+    auto const sphere_quality = [&]{ return sphere_shape == mesh_shape::icosphere ? 4 : 16; };
+    float const sphere_radius = 1.f;
+
+    std::string project_root = PROJECT_ROOT;
+
+    // Declared before the job system, which traces into it until every job is done
+    profiler frame_profiler;
+
+    // Texture decoding and draw recording share these threads
+    job_system jobs;
+    jobs.set_trace([&frame_profiler](std::string_view name, unsigned int thread, auto begin, auto end){ frame_profiler.job(name, thread, begin, end); });
+
+    // Placeholders are neutral values: grey albedo, a flat normal, no occlusion, fairly rough, not metallic
+    auto const loading_start = std::chrono::high_resolution_clock::now();
+    // Enough for everything at full resolution when compressed, not quite from the JPEGs
+    std::size_t const texture_memory_budget = 12 << 20;
+    texture_loader textures(jobs, 4 << 20, texture_memory_budget);
+    if (auto const memory = query_driver_memory(); memory.total_mb)
+        std::cout << "Video memory: " << *memory.total_mb << " MB" << std::endl;
+
+    std::cout << "Image decoders:";
+    for (auto const & decoder : image_decoders())
+        std::cout << " " << decoder.name;
+    std::cout << std::endl;
+    std::string const brick = project_root + "/textures/brick_";
+
+    GLuint albedo_texture = textures.load(compressed_texture_path(brick + "albedo").value_or(brick + "albedo.jpg"), {128, 128, 128, 255}, true);
+
+    // Normal xy in two channels, and occlusion/roughness/metallic in one texture; packed at
+    // import time by compressed_textures, or else from the source maps while loading
+    auto const normal_path = compressed_texture_path(brick + "normal");
+    GLuint normal_texture = normal_path
+        ? textures.load(*normal_path, {128, 128, 255, 255})
+        : textures.load_packed({{brick + "normal.jpg", 0}, {brick + "normal.jpg", 1}}, {128, 128, 255, 255});
+    auto const orm_path = compressed_texture_path(brick + "orm");
+    GLuint orm_texture = orm_path
+        ? textures.load(*orm_path, {255, 192, 0, 255})
+        : textures.load_packed({{brick + "ao.jpg", 0}, {brick + "roughness.jpg", 0}, {"", 0, 0}}, {255, 192, 0, 255});
+    int loading_frames = 0;
+    bool textures_loaded = false;
+
+    auto const environment = load_environment_lighting_cached(project_root + "/textures/environment_map.jpg", jobs);
+
+    // Rough levels are only a few texels wide, so without seamless filtering their face edges would show
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+    GLuint prefiltered_texture;
+    glGenTextures(1, &prefiltered_texture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, prefiltered_texture);
+    for (std::size_t level = 0; level < environment.prefiltered_levels.size(); ++level)
+    {
+        int const size = std::max(1, environment.face_size >> level);
+        for (int face = 0; face < 6; ++face)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGB16F, size, size, 0,
+                GL_RGB, GL_FLOAT, environment.prefiltered_levels[level].data() + static_cast<std::size_t>(face) * size * size);
+        RENDER_STATS_GPU_MEMORY("environment", std::int64_t(6) * size * size * 6);
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, environment.prefiltered_levels.size() - 1);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    GLuint brdf_lut_texture;
+    glGenTextures(1, &brdf_lut_texture);
+    glBindTexture(GL_TEXTURE_2D, brdf_lut_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, environment.brdf_lut_size, environment.brdf_lut_size, 0, GL_RG, GL_FLOAT, environment.brdf_lut.data());
+    RENDER_STATS_GPU_MEMORY("environment", std::int64_t(environment.brdf_lut_size) * environment.brdf_lut_size * 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // Rows of spheres that hide each other, so that shading every fragment wastes work
+    std::vector<glm::vec3> sphere_offsets;
+    for (int x = -2; x <= 2; ++x)
+        for (int z = -2; z <= 2; ++z)
+            sphere_offsets.push_back({x * 2.5f, 0.f, z * 2.5f});
 
-    GLuint sphere_vao, sphere_vbo, sphere_ebo;
-    glGenVertexArrays(1, &sphere_vao);
-    glBindVertexArray(sphere_vao);
-    glGenBuffers(1, &sphere_vbo);
-    glGenBuffers(1, &sphere_ebo);
-    GLuint sphere_index_count;
+    float profile_print_time = 0.f;
+
+    bool depth_prepass = true;
+
+    // Transient per-frame data of every thread, reset at the start of each frame
+    frame_arenas arenas(jobs);
+
+    command_recorder recorder(jobs, arenas);
+
+    // P cycles vsync, adaptive vsync and uncapped; headless runs never swap
+    frame_pacer pacer(headless || replay.replaying() ? present_mode::uncapped : present_mode::vsync);
+
+    // Headless frames are drawn into their own 4x multisampled framebuffer, like windowed ones,
+    // and read back a couple of frames later so that the GPU never waits for the readback;
+    // the encoder waits rather than drops, so that every frame is written
+    std::optional<offscreen_target> offscreen;
+    std::optional<frame_encoder> encoder;
+    std::optional<async_readback> readback;
+    int headless_frames = 0;
+    std::chrono::high_resolution_clock::time_point headless_start;
+    if (headless)
     {
-        auto [vertices, indices] = generate_sphere(1.f, 16);
+        width = headless->width;
+        height = headless->height;
+        offscreen.emplace(width, height, 4);
 
-        glBindBuffer(GL_ARRAY_BUFFER, sphere_vbo);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vertices[0]), vertices.data(), GL_STATIC_DRAW);
+        if (headless->output)
+        {
+            frame_encoder::settings settings;
+            settings.output = *headless->output;
+            settings.wait_when_full = true;
+            encoder.emplace(settings, width, height);
+        }
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphere_ebo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(indices[0]), indices.data(), GL_STATIC_DRAW);
+        readback.emplace(width, height, [&encoder](std::uint64_t frame, std::uint8_t const * pixels, int, int)
+        {
+            if (encoder)
+                encoder->push(frame, pixels);
+        });
+    }
 
-        sphere_index_count = indices.size();
+    // Windowed frames are drawn into a 4x multisampled target at a fraction of the window
+    // resolution that keeps the GPU time of a frame within the budget, and upscaled to the
+    // window; R cycles sharpened, bilinear and always full resolution
+    program_cache programs(project_root + "/.program_binaries");
+    std::optional<dynamic_resolution_target> dynamic_resolution;
+    upscale_filter dynamic_resolution_filter = upscale_filter::sharpen;
+    if (!headless)
+    {
+        resolution_controller::settings settings;
+        settings.budget_ms = 14.f;
+        settings.min_scale = 0.5f;
+        dynamic_resolution.emplace(programs, width, height, 4, settings);
     }
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)offsetof(vertex, position));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)offsetof(vertex, tangent));
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)offsetof(vertex, normal));
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)offsetof(vertex, texcoords));
 
-    std::string project_root = PROJECT_ROOT;
-    GLuint albedo_texture = load_texture(project_root + "/textures/brick_albedo.jpg");
+    // C saves a screenshot and V starts or stops an ffmpeg recording, both into captures/
+    frame_capture capture(width, height);
+    std::filesystem::path const captures = project_root + "/captures";
+    int recording_index = 0;
 
     auto last_frame_start = std::chrono::high_resolution_clock::now();
 
     float time = 0.f;
 
-    std::map<SDL_Keycode, bool> button_down;
+    input_state input;
 
     float view_elevation = glm::radians(30.f);
     float view_azimuth = 0.f;
-    float camera_distance = 2.f;
+    float camera_distance = 8.f;
 
     bool running = true;
     while (running)
     {
+        pacer.begin_frame();
+        input.begin_frame();
+
         for (SDL_Event event; SDL_PollEvent(&event);) switch (event.type)
         {
         case SDL_QUIT:
@@ -305,35 +518,154 @@ int main() try
                 width = event.window.data1;
                 height = event.window.data2;
                 glViewport(0, 0, width, height);
+                if (dynamic_resolution)
+                    dynamic_resolution->resize(width, height);
+                if (capture.recording())
+                    std::cout << "Recording stopped by the resize" << std::endl;
+                capture.resize(width, height);
                 break;
             }
             break;
         case SDL_KEYDOWN:
-            button_down[event.key.keysym.sym] = true;
-            break;
         case SDL_KEYUP:
-            button_down[event.key.keysym.sym] = false;
+            input.handle_event(event);
             break;
         }
 
         if (!running)
             break;
 
+        if (!replay.update(input))
+            break;
+
+        // Key repeats do not toggle anything
+        if (input.pressed(SDL_SCANCODE_Z))
+            depth_prepass = !depth_prepass;
+        if (input.pressed(SDL_SCANCODE_P))
+            pacer.next_mode();
+        if (input.pressed(SDL_SCANCODE_R) && dynamic_resolution)
+        {
+            auto & controller = dynamic_resolution->controller();
+            if (!controller.enabled())
+            {
+                controller.set_enabled(true);
+                dynamic_resolution_filter = upscale_filter::sharpen;
+            }
+            else if (dynamic_resolution_filter == upscale_filter::sharpen)
+                dynamic_resolution_filter = upscale_filter::bilinear;
+            else
+                controller.set_enabled(false);
+            if (controller.enabled())
+                std::cout << "dynamic resolution, " << to_string(dynamic_resolution_filter) << " upscale" << std::endl;
+            else
+                std::cout << "full resolution" << std::endl;
+        }
+        if (input.pressed(SDL_SCANCODE_C))
+            capture.screenshot(captures / "screenshots");
+        if (input.pressed(SDL_SCANCODE_V))
+        {
+            if (capture.recording())
+            {
+                auto const summary = capture.stop_recording();
+                std::cout << "Recorded " << summary.frames << " frames, dropped " << summary.dropped << std::endl;
+            }
+            else
+            {
+                std::filesystem::create_directories(captures);
+                frame_encoder::settings settings;
+                settings.format = capture_format::ffmpeg;
+                settings.output = captures / ("recording_" + std::to_string(recording_index++) + ".mp4");
+                capture.start_recording(settings);
+                std::cout << "Recording to " << settings.output.string() << std::endl;
+            }
+        }
+        if (input.pressed(SDL_SCANCODE_I))
+        {
+            sphere_shape = sphere_shape == mesh_shape::icosphere ? mesh_shape::uv_sphere : mesh_shape::icosphere;
+            auto const & mesh = meshes.get(sphere_shape, sphere_quality());
+            std::cout << (sphere_shape == mesh_shape::icosphere ? "icosphere: " : "uv sphere: ")
+                << mesh.vertex_count << " vertices, " << mesh.index_count / 3 << " triangles" << std::endl;
+        }
+
+        frame_profiler.begin_frame();
+
+        frame_profiler.counter("frame arena KB", arenas.used() / 1024.0);
+        arenas.reset();
+
+        {
+            profiler::cpu_scope scope(frame_profiler, "texture upload");
+            textures.update();
+            frame_profiler.counter("texture MB", textures.resident_bytes() / 1024.0 / 1024.0);
+
+            if (!textures_loaded)
+            {
+                ++loading_frames;
+                if (textures.pending() == 0)
+                {
+                    textures_loaded = true;
+                    std::cout << "Textures loaded in " << std::chrono::duration_cast<std::chrono::duration<float>>(
+                        std::chrono::high_resolution_clock::now() - loading_start).count() * 1000.f << " ms over " << loading_frames << " frames" << std::endl;
+                }
+            }
+        }
+
+        // Without the prepass the color pass would have shaded every sample that passed the prepass
+        if (auto tested = frame_profiler.collected("prepass samples"))
+            if (auto shaded = frame_profiler.collected("shaded samples"))
+                frame_profiler.counter("samples saved %", 100.0 * (*tested - *shaded) / std::max(*tested, 1.0));
+
+        // Fragments shaded per pixel of the scene, 1 without overdraw, from pipeline statistics
+        if (auto fragments = frame_profiler.collected("color fragments"))
+        {
+            double const pixels = offscreen ? double(width) * height : double(dynamic_resolution->scene_width()) * dynamic_resolution->scene_height();
+            frame_profiler.counter("color overdraw", *fragments / std::max(pixels, 1.0));
+        }
+
+        // What the samples allocated next to what the driver has left
+        for (auto const & [category, bytes] : render_stats::global().gpu_memory())
+            frame_profiler.counter("gpu " + category + " MB", bytes / 1024.0 / 1024.0);
+        if (auto const memory = query_driver_memory(); memory.available_mb)
+            frame_profiler.counter("driver available MB", *memory.available_mb);
+
         auto now = std::chrono::high_resolution_clock::now();
-        float dt = std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count();
+        float dt = replay.frame_time(std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count());
         last_frame_start = now;
+        // Headless frames are the same on every run and every machine
+        if (headless)
+            dt = 1.f / 60.f;
         time += dt;
 
-        if (button_down[SDLK_UP])
+        profile_print_time += dt;
+        if (profile_print_time >= 1.f)
+        {
+            std::cout << "depth prepass " << (depth_prepass ? "on" : "off") << std::endl;
+            frame_profiler.print_summary(std::cout);
+            pacer.print_summary(std::cout);
+            if (dynamic_resolution)
+            {
+                auto const & controller = dynamic_resolution->controller();
+                std::cout << "resolution " << dynamic_resolution->scene_width() << "x" << dynamic_resolution->scene_height()
+                    << " (" << int(controller.scale() * 100.f + 0.5f) << "%), " << controller.last_gpu_ms() << " ms gpu of "
+                    << controller.current_settings().budget_ms << " ms budget" << std::endl;
+            }
+            profile_print_time = 0.f;
+        }
+
+        if (input.down(SDL_SCANCODE_UP))
             camera_distance -= 4.f * dt;
-        if (button_down[SDLK_DOWN])
+        if (input.down(SDL_SCANCODE_DOWN))
             camera_distance += 4.f * dt;
 
-        if (button_down[SDLK_LEFT])
+        if (input.down(SDL_SCANCODE_LEFT))
             view_azimuth -= 2.f * dt;
-        if (button_down[SDLK_RIGHT])
+        if (input.down(SDL_SCANCODE_RIGHT))
             view_azimuth += 2.f * dt;
 
+        if (offscreen)
+            offscreen->bind();
+        else
+            dynamic_resolution->begin_scene();
+
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         glEnable(GL_DEPTH_TEST);
@@ -352,29 +684,166 @@ int main() try
         view = glm::rotate(view, view_azimuth, {0.f, 1.f, 0.f});
 
         glm::mat4 projection = glm::mat4(1.f);
-        projection = glm::perspective(glm::pi<float>() / 2.f, (1.f * width) / height, near, far);
+        float const fov_y = glm::pi<float>() / 2.f;
+        projection = glm::perspective(fov_y, (1.f * width) / height, near, far);
 
         glm::vec3 light_direction = glm::normalize(glm::vec3(1.f, 2.f, 3.f));
 
         glm::vec3 camera_position = (glm::inverse(view) * glm::vec4(0.f, 0.f, 0.f, 1.f)).xyz();
 
-        glUseProgram(program);
-        glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
-        glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
-        glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
-        glUniform3fv(light_direction_location, 1, reinterpret_cast<float *>(&light_direction));
-        glUniform3fv(camera_position_location, 1, reinterpret_cast<float *>(&camera_position));
-        glUniform1i(albedo_texture_location, 0);
+        // Texture streaming from a screen-size estimate: u wraps once around the equator, so
+        // the nearest sphere's circumference in pixels is what the textures have to cover
+        {
+            float nearest = far;
+            for (auto const & offset : sphere_offsets)
+                nearest = std::min(nearest, glm::length(offset - camera_position) - sphere_radius);
+            int const scene_height = offscreen ? height : dynamic_resolution->scene_height();
+            float const pixels_per_unit = scene_height / (2.f * std::tan(fov_y / 2.f) * std::max(nearest, near));
+            float const screen_pixels = 2.f * glm::pi<float>() * sphere_radius * pixels_per_unit;
+
+            for (GLuint texture : {albedo_texture, normal_texture, orm_texture})
+                textures.request(texture, screen_pixels);
+        }
+
+        auto const & sphere = meshes.get(sphere_shape, sphere_quality());
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, albedo_texture);
+        // Planes of the view frustum, pointing inwards, for the workers to cull against
+        glm::vec4 frustum_planes[6];
+        {
+            glm::mat4 const m = glm::transpose(projection * view);
+            for (int i = 0; i < 3; ++i)
+            {
+                frustum_planes[2 * i + 0] = m[3] + m[i];
+                frustum_planes[2 * i + 1] = m[3] - m[i];
+            }
+            for (auto & plane : frustum_planes)
+                plane /= glm::length(glm::vec3(plane));
+        }
 
-        glBindVertexArray(sphere_vao);
-        glDrawElements(GL_TRIANGLES, sphere_index_count, GL_UNSIGNED_INT, nullptr);
+        // From recording to the last replay nothing should touch the heap once the first
+        // frames have grown the command lists and the arenas
+        std::uint64_t const draw_allocations_start = allocation_tracker::global().total().allocations;
 
-        SDL_GL_SwapWindow(window);
+        // By reference, so that record_function does not allocate a copy of all the captures
+        auto const record_spheres = [&](command_list & list, std::size_t begin, std::size_t end)
+        {
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                glm::vec3 const & offset = sphere_offsets[i];
+
+                bool visible = true;
+                for (auto const & plane : frustum_planes)
+                    visible = visible && glm::dot(glm::vec3(plane), offset) + plane.w >= -sphere_radius;
+                if (!visible)
+                    continue;
+
+                float const depth = glm::length(offset - camera_position);
+                glm::mat4 const sphere_model = glm::translate(glm::mat4(1.f), offset) * model * glm::scale(glm::mat4(1.f), glm::vec3(sphere_radius));
+
+                if (depth_prepass)
+                    list.draw(0, depth, prepass_program, sphere.depth_vao, prepass_model_location, sphere.index_count, sphere_model);
+                list.draw(1, depth, program, sphere.vao, model_location, sphere.index_count, sphere_model);
+            }
+        };
+        recorder.record(sphere_offsets.size(), std::ref(record_spheres));
+
+        if (depth_prepass)
+        {
+            profiler::gpu_scope scope(frame_profiler, "prepass");
+            frame_profiler.begin_samples("prepass samples");
+
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+            glUseProgram(prepass_program);
+            glUniformMatrix4fv(prepass_view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
+            glUniformMatrix4fv(prepass_projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
+
+            recorder.replay(0);
+
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+            // Only the nearest sample at each pixel is still equal to the depth buffer
+            glDepthFunc(GL_EQUAL);
+            glDepthMask(GL_FALSE);
+
+            frame_profiler.end_samples();
+        }
+
+        {
+            profiler::gpu_scope scope(frame_profiler, "color");
+            frame_profiler.begin_samples("shaded samples");
+
+            glUseProgram(program);
+            glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
+            glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
+            glUniform3fv(light_direction_location, 1, reinterpret_cast<float *>(&light_direction));
+            glUniform3fv(camera_position_location, 1, reinterpret_cast<float *>(&camera_position));
+            glUniform1i(albedo_texture_location, 0);
+            glUniform1i(normal_texture_location, 1);
+            glUniform1i(orm_texture_location, 2);
+            glUniform1i(prefiltered_texture_location, 3);
+            glUniform1i(brdf_lut_location, 4);
+            glUniform3fv(irradiance_sh_location, 9, reinterpret_cast<float const *>(environment.irradiance_sh.data()));
+            glUniform1f(prefiltered_max_level_location, environment.prefiltered_levels.size() - 1.f);
+
+            GLuint const textures[] = {albedo_texture, normal_texture, orm_texture, prefiltered_texture, brdf_lut_texture};
+            for (int i = 0; i < 5; ++i)
+            {
+                glActiveTexture(GL_TEXTURE0 + i);
+                glBindTexture(textures[i] == prefiltered_texture ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D, textures[i]);
+            }
+
+            recorder.replay(1);
+
+            frame_profiler.end_samples();
+        }
+
+        if (allocation_tracker::enabled())
+            frame_profiler.counter("draw heap allocations", allocation_tracker::global().total().allocations - draw_allocations_start);
+
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+
+        if (dynamic_resolution)
+            dynamic_resolution->present(dynamic_resolution_filter);
+
+        replay.end_frame();
+
+        if (headless)
+        {
+            // Frames only count once the textures are in, so that every one is final
+            if (textures_loaded)
+            {
+                if (headless_frames == 0)
+                    headless_start = std::chrono::high_resolution_clock::now();
+
+                offscreen->resolve();
+                readback->read(offscreen->read_framebuffer(), headless_frames);
+                readback->poll();
+
+                if (++headless_frames == headless->frames)
+                {
+                    readback->finish();
+                    float const seconds = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - headless_start).count();
+                    std::cout << headless_frames << " frames at " << width << "x" << height << " in " << seconds << " s: "
+                        << headless_frames / seconds << " fps" << std::endl;
+                    running = false;
+                }
+            }
+        }
+        else
+        {
+            capture.capture();
+            pacer.present(window);
+        }
+
+        frame_profiler.end_frame();
+        render_stats::global().end_frame();
     }
 
+    replay.finish();
+    capture.finish();
+
     SDL_GL_DeleteContext(gl_context);
     SDL_DestroyWindow(window);
 }
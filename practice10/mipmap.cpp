@@ -0,0 +1,168 @@
+#include "mipmap.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIPMAP_SSE
+#endif
+
+namespace
+{
+
+    // Linear values are quantized to 12 bits on the way back, which is finer than
+    // the darkest step between two sRGB codes
+    constexpr int linear_steps = 4096;
+
+    struct srgb_tables
+    {
+        std::array<float, 256> to_linear;
+        std::array<std::uint8_t, linear_steps> from_linear;
+
+        srgb_tables()
+        {
+            for (int i = 0; i < 256; ++i)
+            {
+                float const c = i / 255.f;
+                to_linear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+            for (int i = 0; i < linear_steps; ++i)
+            {
+                float const l = i / (linear_steps - 1.f);
+                float const c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.f / 2.4f) - 0.055f;
+                from_linear[i] = std::lround(std::clamp(c, 0.f, 1.f) * 255.f);
+            }
+        }
+    };
+
+    srgb_tables const & tables()
+    {
+        static srgb_tables const result;
+        return result;
+    }
+
+    bool is_color(int channel, int components, bool srgb)
+    {
+        bool const alpha = (components == 4 && channel == 3) || (components == 2 && channel == 1);
+        return srgb && !alpha;
+    }
+
+    // Averages 2x2 texels of a float image; a dimension of 1 repeats its single row or column
+    void downsample(float const * in, int width, int height, int components, float * out)
+    {
+        int const w = std::max(1, width / 2);
+        int const h = std::max(1, height / 2);
+        std::size_t const in_row = static_cast<std::size_t>(width) * components;
+        std::size_t const out_row = static_cast<std::size_t>(w) * components;
+
+        for (int y = 0; y < h; ++y)
+        {
+            float const * r0 = in + std::min(2 * y, height - 1) * in_row;
+            float const * r1 = in + std::min(2 * y + 1, height - 1) * in_row;
+            float * o = out + y * out_row;
+
+            if (width == 1)
+            {
+                for (int c = 0; c < components; ++c)
+                    o[c] = (r0[c] + r1[c]) * 0.5f;
+                continue;
+            }
+
+            int x = 0;
+#if defined(MIPMAP_SSE)
+            __m128 const quarter = _mm_set1_ps(0.25f);
+            if (components == 4)
+            {
+                // One texel per register
+                for (; x < w; ++x)
+                {
+                    __m128 const a = _mm_add_ps(_mm_loadu_ps(r0 + 8 * x), _mm_loadu_ps(r0 + 8 * x + 4));
+                    __m128 const b = _mm_add_ps(_mm_loadu_ps(r1 + 8 * x), _mm_loadu_ps(r1 + 8 * x + 4));
+                    _mm_storeu_ps(o + 4 * x, _mm_mul_ps(_mm_add_ps(a, b), quarter));
+                }
+            }
+            else if (components == 2)
+            {
+                // Two output texels from four input ones per step
+                for (; x + 2 <= w; x += 2)
+                {
+                    __m128 const a = _mm_add_ps(_mm_loadu_ps(r0 + 2 * x * 2), _mm_loadu_ps(r1 + 2 * x * 2));
+                    __m128 const b = _mm_add_ps(_mm_loadu_ps(r0 + 2 * x * 2 + 4), _mm_loadu_ps(r1 + 2 * x * 2 + 4));
+                    __m128 const sum = _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 1, 0)), _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 2, 3, 2)));
+                    _mm_storeu_ps(o + 2 * x, _mm_mul_ps(sum, quarter));
+                }
+            }
+            else if (components == 1)
+            {
+                // Four output texels from eight input ones per step
+                for (; x + 4 <= w; x += 4)
+                {
+                    __m128 const a = _mm_add_ps(_mm_loadu_ps(r0 + 2 * x), _mm_loadu_ps(r1 + 2 * x));
+                    __m128 const b = _mm_add_ps(_mm_loadu_ps(r0 + 2 * x + 4), _mm_loadu_ps(r1 + 2 * x + 4));
+                    __m128 const sum = _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+                    _mm_storeu_ps(o + x, _mm_mul_ps(sum, quarter));
+                }
+            }
+#endif
+            for (; x < w; ++x)
+                for (int c = 0; c < components; ++c)
+                {
+                    std::size_t const i0 = 2 * x * components + c;
+                    std::size_t const i1 = i0 + components;
+                    o[x * components + c] = (r0[i0] + r0[i1] + r1[i0] + r1[i1]) * 0.25f;
+                }
+        }
+    }
+
+    void append_level(std::vector<float> const & level, int width, int height, int components, bool srgb, mip_chain_data & chain)
+    {
+        auto const & t = tables();
+
+        std::size_t const offset = chain.data.size();
+        chain.levels.push_back({width, height, offset, level.size()});
+        chain.data.resize(offset + level.size());
+
+        std::uint8_t * out = chain.data.data() + offset;
+        for (std::size_t i = 0; i < level.size(); ++i)
+        {
+            float const v = std::clamp(level[i], 0.f, 1.f);
+            out[i] = is_color(i % components, components, srgb)
+                ? t.from_linear[static_cast<int>(v * (linear_steps - 1) + 0.5f)]
+                : static_cast<std::uint8_t>(v * 255.f + 0.5f);
+        }
+    }
+
+}
+
+mip_chain_data generate_mip_chain(std::uint8_t const * pixels, int width, int height, int components, bool srgb)
+{
+    auto const & t = tables();
+
+    // The whole chain is filtered from floats, so rounding does not add up level by level
+    std::vector<float> level(static_cast<std::size_t>(width) * height * components);
+    for (std::size_t i = 0; i < level.size(); ++i)
+        level[i] = is_color(i % components, components, srgb) ? t.to_linear[pixels[i]] : pixels[i] / 255.f;
+
+    mip_chain_data chain;
+    chain.levels.push_back({width, height, 0, level.size()});
+    chain.data.assign(pixels, pixels + level.size());
+
+    std::vector<float> next;
+    while (width > 1 || height > 1)
+    {
+        int const w = std::max(1, width / 2);
+        int const h = std::max(1, height / 2);
+        next.resize(static_cast<std::size_t>(w) * h * components);
+        downsample(level.data(), width, height, components, next.data());
+
+        append_level(next, w, h, components, srgb, chain);
+
+        std::swap(level, next);
+        width = w;
+        height = h;
+    }
+
+    return chain;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "dds.hpp"
+
+// Box-filtered mip chain of an 8-bit image with 1, 2 or 4 components, down to 1x1, finest
+// level first. Filtering is done in floats; with srgb the color channels are converted to
+// linear first and back after, so that mips of color textures do not darken (alpha, the
+// last of 2 or 4 components, is always linear). Data that is not color, like normals or roughness, must not set srgb.
+struct mip_chain_data
+{
+    std::vector<compressed_image::level> levels;
+    std::vector<std::uint8_t> data;
+};
+
+mip_chain_data generate_mip_chain(std::uint8_t const * pixels, int width, int height, int components, bool srgb);
@@ -0,0 +1,61 @@
+#include "procedural_mesh.hpp"
+#include "gl_resources.hpp"
+#include "render_stats.hpp"
+
+#include <cstddef>
+
+namespace
+{
+
+    // Vertices, their positions for the depth prepass, and indices
+    std::int64_t buffer_bytes(gpu_mesh const & mesh)
+    {
+        return std::int64_t(mesh.vertex_count) * (sizeof(vertex) + sizeof(glm::vec3)) + std::int64_t(mesh.index_count) * sizeof(std::uint32_t);
+    }
+
+}
+
+mesh_cache::~mesh_cache()
+{
+    for (auto & [key, mesh] : meshes_)
+    {
+        GLuint const buffers[] = {mesh.vbo, mesh.position_vbo, mesh.ebo};
+        glDeleteBuffers(3, buffers);
+        RENDER_STATS_GPU_MEMORY("mesh", -buffer_bytes(mesh));
+        GLuint const arrays[] = {mesh.vao, mesh.depth_vao};
+        glDeleteVertexArrays(2, arrays);
+    }
+}
+
+gpu_mesh const & mesh_cache::get(mesh_shape shape, int quality)
+{
+    auto [it, inserted] = meshes_.try_emplace({shape, quality});
+    auto & mesh = it->second;
+    if (!inserted)
+        return mesh;
+
+    auto const data = (shape == mesh_shape::icosphere) ? generate_icosphere(quality) : generate_uv_sphere(quality);
+
+    std::vector<glm::vec3> positions;
+    positions.reserve(data.vertices.size());
+    for (auto const & v : data.vertices)
+        positions.push_back(v.position);
+
+    mesh.vertex_count = data.vertices.size();
+    mesh.index_count = data.indices.size();
+
+    mesh.vbo = create_static_buffer(data.vertices);
+    mesh.position_vbo = create_static_buffer(positions);
+    mesh.ebo = create_static_buffer(data.indices);
+    RENDER_STATS_GPU_MEMORY("mesh", buffer_bytes(mesh));
+
+    mesh.vao = create_vertex_array(mesh.vbo, sizeof(vertex), {
+        {0, 3, GL_FLOAT, GL_FALSE, offsetof(vertex, position)},
+        {1, 3, GL_FLOAT, GL_FALSE, offsetof(vertex, tangent)},
+        {2, 3, GL_FLOAT, GL_FALSE, offsetof(vertex, normal)},
+        {3, 2, GL_FLOAT, GL_FALSE, offsetof(vertex, texcoords)},
+    }, mesh.ebo);
+    mesh.depth_vao = create_vertex_array(mesh.position_vbo, sizeof(glm::vec3), {{0, 3, GL_FLOAT, GL_FALSE, 0}}, mesh.ebo);
+
+    return mesh;
+}
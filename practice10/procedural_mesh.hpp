@@ -0,0 +1,46 @@
+#pragma once
+
+#include "sphere_mesh.hpp"
+
+#include <GL/glew.h>
+
+#include <vector>
+#include <map>
+#include <utility>
+#include <cstdint>
+
+enum class mesh_shape
+{
+    uv_sphere,
+    icosphere,
+};
+
+struct gpu_mesh
+{
+    // Every attribute of vertex at locations 0 to 3
+    GLuint vao = 0;
+    // Positions alone at location 0, so that a depth prepass fetches 12 bytes per vertex instead of 44
+    GLuint depth_vao = 0;
+    GLuint vbo = 0;
+    GLuint position_vbo = 0;
+    GLuint ebo = 0;
+    GLsizei vertex_count = 0;
+    GLsizei index_count = 0;
+};
+
+// Meshes are generated and uploaded once per shape and quality, and every object drawn
+// with one shares its buffers, sized and placed by the model matrix
+struct mesh_cache
+{
+    mesh_cache() = default;
+    ~mesh_cache();
+
+    mesh_cache(mesh_cache const &) = delete;
+    mesh_cache & operator = (mesh_cache const &) = delete;
+
+    // Quality is the generator's argument; the reference stays valid as long as the cache
+    gpu_mesh const & get(mesh_shape shape, int quality);
+
+private:
+    std::map<std::pair<mesh_shape, int>, gpu_mesh> meshes_;
+};
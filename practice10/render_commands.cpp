@@ -0,0 +1,104 @@
+#include "render_commands.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <bit>
+
+void command_list::clear()
+{
+    commands.clear();
+    models.clear();
+}
+
+void command_list::draw(std::uint8_t pass, float depth, GLuint program, GLuint vertex_array, GLint model_location,
+    GLsizei index_count, glm::mat4 const & model)
+{
+    // Non-negative floats sort the same as their bits; names only need to group, so 12 bits
+    // of each are enough
+    std::uint64_t key = std::uint64_t(pass) << 56;
+    key |= std::uint64_t(program & 0xfffu) << 44;
+    key |= std::uint64_t(vertex_array & 0xfffu) << 32;
+    key |= std::bit_cast<std::uint32_t>(std::max(depth, 0.f));
+
+    commands.push_back({key, program, vertex_array, model_location, index_count, std::uint32_t(models.size())});
+    models.push_back(model);
+}
+
+command_recorder::command_recorder(job_system & jobs, frame_arenas & arenas)
+    : jobs_(jobs)
+    , arenas_(arenas)
+    , lists_(jobs.thread_count())
+{}
+
+void command_recorder::record(std::size_t count, record_function const & record)
+{
+    // Passed by reference, since a std::function holding all the captures would be allocated
+    auto const record_list = [&](std::size_t index)
+    {
+        auto & list = lists_[index];
+        list.clear();
+
+        std::size_t const begin = (count * index) / lists_.size();
+        std::size_t const end = (count * (index + 1)) / lists_.size();
+        if (begin < end)
+            record(list, begin, end);
+
+        std::sort(list.commands.begin(), list.commands.end(), [](auto const & a, auto const & b){ return a.key < b.key; });
+    };
+    jobs_.parallel_for(lists_.size(), std::ref(record_list));
+}
+
+void command_recorder::replay(std::uint8_t pass)
+{
+    struct cursor
+    {
+        command_list const * list;
+        std::vector<draw_command>::const_iterator current, end;
+    };
+
+    // Each sorted list holds the pass as one contiguous range
+    frame_vector<cursor> cursors(&arenas_.local());
+    cursors.reserve(lists_.size());
+    for (auto const & list : lists_)
+    {
+        auto const first = std::partition_point(list.commands.begin(), list.commands.end(), [pass](auto const & c){ return (c.key >> 56) < pass; });
+        auto const last = std::partition_point(first, list.commands.end(), [pass](auto const & c){ return (c.key >> 56) == pass; });
+        if (first != last)
+            cursors.push_back({&list, first, last});
+    }
+
+    GLuint current_program = 0;
+    GLuint current_vertex_array = 0;
+
+    while (!cursors.empty())
+    {
+        // There are only as many lists as threads, so a linear scan is the cheapest merge
+        auto next = std::min_element(cursors.begin(), cursors.end(), [](auto const & a, auto const & b){ return a.current->key < b.current->key; });
+        auto const & command = *next->current;
+
+        if (command.program != current_program)
+        {
+            glUseProgram(command.program);
+            current_program = command.program;
+        }
+        if (command.vertex_array != current_vertex_array)
+        {
+            glBindVertexArray(command.vertex_array);
+            current_vertex_array = command.vertex_array;
+        }
+
+        glUniformMatrix4fv(command.model_location, 1, GL_FALSE, reinterpret_cast<float const *>(&next->list->models[command.model]));
+        glDrawElements(GL_TRIANGLES, command.index_count, GL_UNSIGNED_INT, nullptr);
+
+        if (++next->current == next->end)
+            cursors.erase(next);
+    }
+}
+
+std::size_t command_recorder::size() const
+{
+    std::size_t result = 0;
+    for (auto const & list : lists_)
+        result += list.commands.size();
+    return result;
+}
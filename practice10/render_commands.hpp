@@ -0,0 +1,70 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm/mat4x4.hpp>
+
+#include "job_system.hpp"
+#include "frame_arena.hpp"
+
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+// One recorded draw: everything replay() needs, with the model matrix stored in the
+// recording list's arena rather than in the command
+struct draw_command
+{
+    // Pass in the top 8 bits, then program and vertex array, then depth, so that sorting
+    // groups state changes and draws each group front to back
+    std::uint64_t key;
+    GLuint program;
+    GLuint vertex_array;
+    GLint model_location;
+    GLsizei index_count;
+    std::uint32_t model;
+};
+
+// The draws one thread recorded this frame. Storage is kept from frame to frame, so once
+// it has grown recording allocates nothing.
+struct command_list
+{
+    void clear();
+
+    void draw(std::uint8_t pass, float depth, GLuint program, GLuint vertex_array, GLint model_location,
+        GLsizei index_count, glm::mat4 const & model);
+
+    std::vector<draw_command> commands;
+    std::vector<glm::mat4> models;
+};
+
+// Records a frame's draws on the job system's threads, one command_list per thread, and
+// replays them into GL on the calling thread. Visibility, matrices and sorting all happen
+// in jobs; the GL thread only walks the sorted lists, merging them by key and skipping binds
+// that would not change anything. Scratch memory for replaying comes from the frame arenas.
+struct command_recorder
+{
+    command_recorder(job_system & jobs, frame_arenas & arenas);
+
+    command_recorder(command_recorder const &) = delete;
+    command_recorder & operator = (command_recorder const &) = delete;
+
+    // Called with [begin, end) ranges that split [0, count) between the threads
+    using record_function = std::function<void(command_list & list, std::size_t begin, std::size_t end)>;
+
+    // Clears the previous frame's commands and records new ones, returning once every list
+    // is recorded and sorted. Rethrows what a call of record threw.
+    void record(std::size_t count, record_function const & record);
+
+    // Issues the recorded draws of one pass; the pipeline state and the uniforms other than
+    // the model matrix are the caller's to set. Leaves the last program and vertex array bound.
+    void replay(std::uint8_t pass);
+
+    // Draws recorded this frame, in all passes
+    std::size_t size() const;
+
+private:
+    job_system & jobs_;
+    frame_arenas & arenas_;
+    std::vector<command_list> lists_;
+};
@@ -0,0 +1,207 @@
+#include "sphere_mesh.hpp"
+
+#include <glm/geometric.hpp>
+#include <glm/ext/scalar_constants.hpp>
+
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+    // At the poles the tangent along u has no length, so it is taken from u alone
+    glm::vec3 pole_tangent(float u)
+    {
+        float const lon = 2.f * glm::pi<float>() * u;
+        return {-std::sin(lon), 0.f, std::cos(lon)};
+    }
+
+}
+
+mesh_data generate_uv_sphere(int quality)
+{
+    mesh_data result;
+
+    int const rows = 2 * quality + 1;
+    int const columns = 4 * quality + 1;
+
+    // Every vertex is a product of one latitude's and one longitude's sines and cosines
+    std::vector<float> cos_lon(columns), sin_lon(columns);
+    for (int longitude = 0; longitude < columns; ++longitude)
+    {
+        float const lon = (longitude * glm::pi<float>()) / (2.f * quality);
+        cos_lon[longitude] = std::cos(lon);
+        sin_lon[longitude] = std::sin(lon);
+    }
+
+    result.vertices.reserve(rows * columns);
+    for (int latitude = -quality; latitude <= quality; ++latitude)
+    {
+        float const lat = (latitude * glm::pi<float>()) / (2.f * quality);
+        float const cos_lat = std::abs(latitude) == quality ? 0.f : std::cos(lat);
+        float const sin_lat = std::sin(lat);
+
+        for (int longitude = 0; longitude < columns; ++longitude)
+        {
+            auto & vertex = result.vertices.emplace_back();
+            vertex.normal = {cos_lat * cos_lon[longitude], sin_lat, cos_lat * sin_lon[longitude]};
+            vertex.position = vertex.normal;
+            vertex.texcoords.x = (longitude * 1.f) / (4.f * quality);
+            vertex.texcoords.y = (latitude * 1.f) / (2.f * quality) + 0.5f;
+            vertex.tangent = cos_lat == 0.f
+                ? pole_tangent(vertex.texcoords.x)
+                : glm::vec3(-cos_lat * sin_lon[longitude], 0.f, cos_lat * cos_lon[longitude]);
+        }
+    }
+
+    result.indices.reserve((rows - 1) * (columns - 1) * 6);
+    for (int latitude = 0; latitude + 1 < rows; ++latitude)
+    {
+        for (int longitude = 0; longitude + 1 < columns; ++longitude)
+        {
+            std::uint32_t i0 = (latitude + 0) * columns + (longitude + 0);
+            std::uint32_t i1 = (latitude + 1) * columns + (longitude + 0);
+            std::uint32_t i2 = (latitude + 0) * columns + (longitude + 1);
+            std::uint32_t i3 = (latitude + 1) * columns + (longitude + 1);
+
+            // i0 and i2 are the same point in the bottom row, i1 and i3 in the top one
+            if (latitude > 0)
+                result.indices.insert(result.indices.end(), {i0, i1, i2});
+            if (latitude + 2 < rows)
+                result.indices.insert(result.indices.end(), {i2, i1, i3});
+        }
+    }
+
+    return result;
+}
+
+mesh_data generate_icosphere(int subdivisions)
+{
+    float const t = (1.f + std::sqrt(5.f)) / 2.f;
+
+    std::vector<glm::vec3> positions =
+    {
+        {-1.f, t, 0.f}, {1.f, t, 0.f}, {-1.f, -t, 0.f}, {1.f, -t, 0.f},
+        {0.f, -1.f, t}, {0.f, 1.f, t}, {0.f, -1.f, -t}, {0.f, 1.f, -t},
+        {t, 0.f, -1.f}, {t, 0.f, 1.f}, {-t, 0.f, -1.f}, {-t, 0.f, 1.f},
+    };
+    for (auto & p : positions)
+        p = glm::normalize(p);
+
+    std::vector<std::uint32_t> indices =
+    {
+        0, 11, 5, 0, 5, 1, 0, 1, 7, 0, 7, 10, 0, 10, 11,
+        1, 5, 9, 5, 11, 4, 11, 10, 2, 10, 7, 6, 7, 1, 8,
+        3, 9, 4, 3, 4, 2, 3, 2, 6, 3, 6, 8, 3, 8, 9,
+        4, 9, 5, 2, 4, 11, 6, 2, 10, 8, 6, 7, 9, 8, 1,
+    };
+
+    // An edge's midpoint is shared by the two triangles on either side of it
+    std::unordered_map<std::uint64_t, std::uint32_t> midpoints;
+    auto midpoint = [&](std::uint32_t a, std::uint32_t b)
+    {
+        std::uint64_t const key = (std::uint64_t(std::min(a, b)) << 32) | std::max(a, b);
+        auto [it, inserted] = midpoints.try_emplace(key, positions.size());
+        if (inserted)
+            positions.push_back(glm::normalize(positions[a] + positions[b]));
+        return it->second;
+    };
+
+    std::vector<std::uint32_t> subdivided;
+    for (int level = 0; level < subdivisions; ++level)
+    {
+        midpoints.clear();
+        subdivided.clear();
+        subdivided.reserve(indices.size() * 4);
+
+        for (std::size_t i = 0; i < indices.size(); i += 3)
+        {
+            std::uint32_t const a = indices[i + 0];
+            std::uint32_t const b = indices[i + 1];
+            std::uint32_t const c = indices[i + 2];
+            std::uint32_t const ab = midpoint(a, b);
+            std::uint32_t const bc = midpoint(b, c);
+            std::uint32_t const ca = midpoint(c, a);
+
+            subdivided.insert(subdivided.end(), {a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca});
+        }
+
+        indices.swap(subdivided);
+    }
+
+    mesh_data result;
+    result.vertices.reserve(positions.size() + positions.size() / 16);
+
+    for (auto const & p : positions)
+    {
+        auto & vertex = result.vertices.emplace_back();
+        vertex.position = p;
+        vertex.normal = p;
+        vertex.tangent = {-p.z, 0.f, p.x};
+        float u = std::atan2(p.z, p.x) / (2.f * glm::pi<float>());
+        vertex.texcoords = {u < 0.f ? u + 1.f : u, std::asin(std::clamp(p.y, -1.f, 1.f)) / glm::pi<float>() + 0.5f};
+    }
+
+    auto const is_pole = [&](std::uint32_t i)
+    {
+        glm::vec3 const & p = result.vertices[i].position;
+        return p.x * p.x + p.z * p.z < 1e-12f;
+    };
+
+    // Triangles across the seam take copies of their vertices on the u < 0.5 side with u + 1,
+    // one copy per vertex shared by all of them; a pole vertex is copied for every
+    // triangle, with u in the middle of its other two vertices'
+    std::vector<std::uint32_t> wrapped(positions.size(), std::uint32_t(-1));
+
+    result.indices.reserve(indices.size());
+    for (std::size_t i = 0; i < indices.size(); i += 3)
+    {
+        std::uint32_t * triangle = indices.data() + i;
+
+        float u_min = 1.f, u_max = 0.f;
+        for (int k = 0; k < 3; ++k)
+        {
+            if (is_pole(triangle[k]))
+                continue;
+            u_min = std::min(u_min, result.vertices[triangle[k]].texcoords.x);
+            u_max = std::max(u_max, result.vertices[triangle[k]].texcoords.x);
+        }
+
+        if (u_max - u_min > 0.5f)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                std::uint32_t const v = triangle[k];
+                if (is_pole(v) || result.vertices[v].texcoords.x >= 0.5f)
+                    continue;
+
+                if (wrapped[v] == std::uint32_t(-1))
+                {
+                    wrapped[v] = result.vertices.size();
+                    vertex copy = result.vertices[v];
+                    copy.texcoords.x += 1.f;
+                    result.vertices.push_back(copy);
+                }
+                triangle[k] = wrapped[v];
+            }
+        }
+
+        for (int k = 0; k < 3; ++k)
+        {
+            if (!is_pole(triangle[k]))
+                continue;
+
+            float const u = (result.vertices[triangle[(k + 1) % 3]].texcoords.x + result.vertices[triangle[(k + 2) % 3]].texcoords.x) * 0.5f;
+            vertex copy = result.vertices[triangle[k]];
+            copy.texcoords.x = u;
+            copy.tangent = pole_tangent(u);
+            triangle[k] = result.vertices.size();
+            result.vertices.push_back(copy);
+        }
+
+        result.indices.insert(result.indices.end(), triangle, triangle + 3);
+    }
+
+    return result;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include <vector>
+#include <cstdint>
+
+struct vertex
+{
+    glm::vec3 position;
+    glm::vec3 tangent;
+    glm::vec3 normal;
+    glm::vec2 texcoords;
+};
+
+struct mesh_data
+{
+    std::vector<vertex> vertices;
+    std::vector<std::uint32_t> indices;
+};
+
+// Both spheres have radius 1 and the same texture mapping, u = atan(z, x) / 2pi and
+// v = asin(y) / pi + 0.5, with the tangent along u. Vertices on the u = 0 seam and at the
+// poles are only duplicated where the texcoords differ.
+
+// Latitude/longitude grid of 2 * quality x 4 * quality quads; the triangles that would
+// be degenerate at the poles are left out
+mesh_data generate_uv_sphere(int quality);
+
+// Icosahedron with every triangle split in four subdivisions times, so that triangles
+// are about the same size everywhere instead of crowding at the poles
+mesh_data generate_icosphere(int subdivisions);
@@ -0,0 +1,146 @@
+#include "block_compression.hpp"
+#include "dds.hpp"
+#include "channel_packing.hpp"
+#include "mipmap.hpp"
+#include "image_decoder.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <stdexcept>
+#include <memory>
+#include <cstring>
+
+// Offline converter from any image stb_image reads to a DDS with the full mip chain:
+//     texture_compressor [--srgb] bc1|bc3|bc4|bc5 <output.dds> <input>
+//     texture_compressor [--srgb] bc1|bc3|bc4|bc5 <output.dds> <channel>...
+// --srgb marks color data, whose mips are then filtered in linear space.
+// bc1 for color, bc3 for color with alpha, bc4 for single-channel maps (red is used),
+// bc5 for normal maps (x and y are kept, z is rebuilt in the shader).
+// The second form packs channels of several images into one texture, each given as
+// <path>:r|g|b|a or as a constant =<0..255>, e.g. occlusion/roughness/metallic:
+//     texture_compressor bc1 orm.dds ao.jpg:r roughness.jpg:r =0
+
+namespace
+{
+
+    channel_source parse_channel(std::string const & argument)
+    {
+        if (argument.starts_with('='))
+            return {"", 0, static_cast<std::uint8_t>(std::stoi(argument.substr(1)))};
+
+        auto const separator = argument.rfind(':');
+        if (separator == std::string::npos || separator + 2 != argument.size())
+            throw std::runtime_error("Expected <path>:r|g|b|a or =<value>, got " + argument);
+
+        auto const channel = std::string("rgba").find(argument.back());
+        if (channel == std::string::npos)
+            throw std::runtime_error("Unknown channel in " + argument);
+
+        return {argument.substr(0, separator), static_cast<int>(channel)};
+    }
+
+}
+
+int main(int argc, char ** argv)
+try
+{
+    bool const srgb = argc > 1 && std::strcmp(argv[1], "--srgb") == 0;
+    if (srgb)
+    {
+        --argc;
+        ++argv;
+    }
+
+    if (argc < 4 || argc > 7)
+    {
+        std::cerr << "Usage: texture_compressor [--srgb] bc1|bc3|bc4|bc5 <output.dds> <input> | <channel>..." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string const format_name = argv[1];
+
+    block_format format;
+    std::vector<std::uint8_t> (*compress)(std::uint8_t const *, int, int);
+    if (format_name == "bc1")
+    {
+        format = block_format::bc1;
+        compress = compress_bc1;
+    }
+    else if (format_name == "bc3")
+    {
+        format = block_format::bc3;
+        compress = compress_bc3;
+    }
+    else if (format_name == "bc4")
+    {
+        format = block_format::bc4;
+        compress = compress_bc4;
+    }
+    else if (format_name == "bc5")
+    {
+        format = block_format::bc5;
+        compress = compress_bc5;
+    }
+    else
+        throw std::runtime_error("Unknown format " + format_name);
+
+    int width, height;
+    std::vector<std::uint8_t> level;
+
+    std::string const first_input = argv[3];
+    if (argc == 4 && !first_input.starts_with('=') && first_input.find(':') == std::string::npos)
+    {
+        decoded_image image;
+        try
+        {
+            image = decode_image_file(argv[3], 4);
+        }
+        catch (std::exception const & e)
+        {
+            throw std::runtime_error(std::string("Failed to load ") + argv[3] + ": " + e.what());
+        }
+        width = image.info.width;
+        height = image.info.height;
+        level = std::move(image.pixels);
+    }
+    else
+    {
+        std::vector<channel_source> sources;
+        for (int i = 3; i < argc; ++i)
+            sources.push_back(parse_channel(argv[i]));
+
+        // The encoders take RGBA8, and block formats have no swizzle, so constants the pack
+        // left out are written back; channels past the packed ones stay zero
+        auto const packed = pack_channels(sources);
+        width = packed.width;
+        height = packed.height;
+        int const channels = std::max<int>(sources.size(), packed.components);
+        level.assign(static_cast<std::size_t>(width) * height * 4, 0);
+        for (std::size_t i = 0; i < level.size() / 4; ++i)
+            for (int c = 0; c < channels; ++c)
+            {
+                int const component = packed.swizzle[c];
+                level[i * 4 + c] = component >= 0 ? packed.pixels[i * packed.components + component] : (component == swizzle_one ? 255 : 0);
+            }
+    }
+
+    compressed_image image;
+    image.format = format;
+
+    auto const mips = generate_mip_chain(level.data(), width, height, 4, srgb);
+    for (auto const & mip : mips.levels)
+    {
+        auto const blocks = compress(mips.data.data() + mip.offset, mip.width, mip.height);
+        image.levels.push_back({mip.width, mip.height, image.data.size(), blocks.size()});
+        image.data.insert(image.data.end(), blocks.begin(), blocks.end());
+    }
+
+    write_dds(argv[2], image);
+    std::cout << argv[2] << ": " << image.levels.size() << " levels, " << image.data.size() << " bytes" << std::endl;
+}
+catch (std::exception const & e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
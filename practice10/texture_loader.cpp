@@ -0,0 +1,535 @@
+#include "texture_loader.hpp"
+#include "stb_image.h"
+#include "image_decoder.hpp"
+#include "mipmap.hpp"
+#include "render_stats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <filesystem>
+
+namespace
+{
+
+    GLenum pixel_format(int components)
+    {
+        switch (components)
+        {
+        case 1: return GL_RED;
+        case 2: return GL_RG;
+        default: return GL_RGBA;
+        }
+    }
+
+    GLenum internal_format(int components)
+    {
+        switch (components)
+        {
+        case 1: return GL_R8;
+        case 2: return GL_RG8;
+        default: return GL_RGBA8;
+        }
+    }
+
+    GLint swizzle_value(int component)
+    {
+        switch (component)
+        {
+        case swizzle_zero: return GL_ZERO;
+        case swizzle_one: return GL_ONE;
+        case 0: return GL_RED;
+        case 1: return GL_GREEN;
+        case 2: return GL_BLUE;
+        default: return GL_ALPHA;
+        }
+    }
+
+    // On the texture bound to GL_TEXTURE_2D
+    void apply_swizzle(channel_swizzle const & swizzle)
+    {
+        GLint const values[4] = {swizzle_value(swizzle[0]), swizzle_value(swizzle[1]), swizzle_value(swizzle[2]), swizzle_value(swizzle[3])};
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, values);
+    }
+
+    int full_level_count(int width, int height)
+    {
+        return 1 + static_cast<int>(std::log2(std::max(width, height)));
+    }
+
+}
+
+texture_loader::texture_loader(job_system & jobs, std::size_t upload_budget, std::size_t memory_budget)
+    : upload_budget_(upload_budget)
+    , memory_budget_(memory_budget)
+    , sparse_supported_(GLEW_ARB_sparse_texture && GLEW_ARB_texture_storage)
+    , jobs_(jobs)
+{
+    glGenBuffers(1, &pixel_buffer_);
+}
+
+texture_loader::~texture_loader()
+{
+    // Decode failures are already reported through update()
+    jobs_.wait(decodes_);
+
+    glDeleteBuffers(1, &pixel_buffer_);
+}
+
+GLuint texture_loader::load(std::string path, glm::u8vec4 const & placeholder, bool srgb)
+{
+    GLuint texture;
+
+    // The header is enough to size sparse storage, but not to tell grey JPEG files, which
+    // store three channels, from colour ones; compressed files keep the plain path
+    int width, height, channels;
+    int storage_components = 0;
+    if (sparse_supported_ && std::filesystem::path(path).extension() != ".dds"
+        && stbi_info(path.c_str(), &width, &height, &channels))
+    {
+        glGenTextures(1, &texture);
+        storage_components = channels <= 2 ? channels : 4;
+        if (create_sparse(texture, width, height, storage_components, placeholder))
+            apply_swizzle(image_swizzle(storage_components));
+        else
+        {
+            glDeleteTextures(1, &texture);
+            texture = create_placeholder(placeholder);
+            storage_components = 0;
+        }
+    }
+    else
+        texture = create_placeholder(placeholder);
+
+    jobs_.submit([this, j = job{texture, std::move(path), {}, srgb, storage_components}]{ decode(j); }, &decodes_, "decode texture");
+
+    ++decoding_;
+    return texture;
+}
+
+GLuint texture_loader::load_packed(std::vector<channel_source> sources, glm::u8vec4 const & placeholder)
+{
+    GLuint texture;
+
+    auto const image_source = std::find_if(sources.begin(), sources.end(), [](auto const & source){ return !source.path.empty(); });
+    channel_swizzle swizzle;
+    int const components = packed_components(sources, &swizzle);
+
+    int width, height, channels;
+    if (sparse_supported_ && image_source != sources.end() && stbi_info(image_source->path.c_str(), &width, &height, &channels))
+    {
+        // The tail holds the placeholder in stored components, which the swizzle reorders
+        glm::u8vec4 stored_placeholder = placeholder;
+        for (int c = 0; c < 4; ++c)
+            if (swizzle[c] >= 0)
+                stored_placeholder[swizzle[c]] = placeholder[c];
+
+        glGenTextures(1, &texture);
+        if (create_sparse(texture, width, height, components, stored_placeholder))
+            apply_swizzle(swizzle);
+        else
+        {
+            glDeleteTextures(1, &texture);
+            texture = create_placeholder(placeholder);
+        }
+    }
+    else
+        texture = create_placeholder(placeholder);
+
+    std::string path = image_source != sources.end() ? image_source->path : std::string();
+    jobs_.submit([this, j = job{texture, std::move(path), std::move(sources), false}]{ decode(j); }, &decodes_, "decode texture");
+
+    ++decoding_;
+    return texture;
+}
+
+GLuint texture_loader::create_placeholder(glm::u8vec4 const & placeholder)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &placeholder);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return texture;
+}
+
+bool texture_loader::create_sparse(GLuint texture, int width, int height, int components, glm::u8vec4 const & placeholder)
+{
+    GLenum const format = internal_format(components);
+
+    GLint page_sizes = 0, page_width = 0, page_height = 0;
+    glGetInternalformativ(GL_TEXTURE_2D, format, GL_NUM_VIRTUAL_PAGE_SIZES_ARB, 1, &page_sizes);
+    if (page_sizes == 0)
+        return false;
+    glGetInternalformativ(GL_TEXTURE_2D, format, GL_VIRTUAL_PAGE_SIZE_X_ARB, 1, &page_width);
+    glGetInternalformativ(GL_TEXTURE_2D, format, GL_VIRTUAL_PAGE_SIZE_Y_ARB, 1, &page_height);
+
+    // Sparse storage has to be a whole number of pages
+    if (page_width <= 0 || page_height <= 0 || width % page_width != 0 || height % page_height != 0)
+        return false;
+
+    int const level_count = full_level_count(width, height);
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SPARSE_ARB, GL_TRUE);
+    glTexStorage2D(GL_TEXTURE_2D, level_count, format, width, height);
+
+    GLint tail = level_count;
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_NUM_SPARSE_LEVELS_ARB, &tail);
+    tail = std::clamp(tail, 0, level_count);
+
+    // The tail is committed as a whole and never dropped; it shows the placeholder until
+    // the real levels arrive
+    std::vector<std::uint8_t> fill;
+    for (int level = tail; level < level_count; ++level)
+    {
+        int const w = std::max(1, width >> level);
+        int const h = std::max(1, height >> level);
+        if (level == tail)
+            glTexPageCommitmentARB(GL_TEXTURE_2D, level, 0, 0, 0, w, h, 1, GL_TRUE);
+
+        fill.resize(static_cast<std::size_t>(w) * h * components);
+        for (std::size_t i = 0; i < fill.size(); ++i)
+            fill[i] = placeholder[i % components];
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, w, h, pixel_format(components), GL_UNSIGNED_BYTE, fill.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        resident_bytes_ += fill.size();
+        RENDER_STATS_GPU_MEMORY("texture", fill.size());
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, std::min<int>(tail, level_count - 1));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    sparse_tails_[texture] = tail;
+    return true;
+}
+
+void texture_loader::request(GLuint texture, float screen_pixels)
+{
+    auto & pixels = screen_pixels_[texture];
+    pixels = std::max(pixels, screen_pixels);
+}
+
+std::size_t texture_loader::pending() const
+{
+    std::size_t result = decoding_;
+    for (auto const & [texture, s] : streamed_)
+        if (s.resident > s.wanted && !s.blocked)
+            ++result;
+    return result;
+}
+
+void texture_loader::update()
+{
+    {
+        std::lock_guard lock(mutex_);
+        for (auto & d : decoded_)
+        {
+            --decoding_;
+            if (!d.error.empty())
+                throw std::runtime_error("Failed to load " + d.path + ": " + d.error);
+
+            int const level_count = d.chain.levels.size();
+
+            streamed s;
+            s.tail = level_count;
+            if (auto it = sparse_tails_.find(d.texture); it != sparse_tails_.end())
+            {
+                auto const & top = d.chain.levels.front();
+                if (full_level_count(top.width, top.height) != level_count)
+                    throw std::runtime_error("Size of " + d.path + " changed while loading");
+                s.tail = it->second;
+                sparse_tails_.erase(it);
+            }
+            s.resident = level_count;
+            s.chain = std::move(d.chain);
+            streamed_.emplace(d.texture, std::move(s));
+        }
+        decoded_.clear();
+    }
+
+    // The finest level worth sampling has about one texel per pixel
+    for (auto & [texture, s] : streamed_)
+    {
+        s.priority = 0.f;
+        if (auto it = screen_pixels_.find(texture); it != screen_pixels_.end())
+        {
+            int const level_count = s.chain.levels.size();
+            float const texels = s.chain.levels.front().width;
+            s.wanted = std::clamp<int>(std::floor(std::log2(texels / std::max(it->second, 1.f))), 0, level_count - 1);
+            s.priority = it->second;
+        }
+    }
+    screen_pixels_.clear();
+
+    // The most visible textures get the upload budget first
+    std::vector<std::pair<GLuint, streamed *>> wanting;
+    for (auto & [texture, s] : streamed_)
+        if (s.resident > s.wanted)
+            wanting.push_back({texture, &s});
+    std::sort(wanting.begin(), wanting.end(), [](auto const & a, auto const & b){ return a.second->priority > b.second->priority; });
+
+    std::size_t budget = upload_budget_;
+    for (auto const & [texture, s] : wanting)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        s->blocked = false;
+        while (budget > 0 && s->resident > s->wanted)
+        {
+            int const level = s->resident - 1;
+            if (!s->allocated && level < s->tail)
+            {
+                s->blocked = !make_room(s->chain.levels[level].size, *s);
+                if (s->blocked)
+                    break;
+                allocate_level(texture, *s, level, true);
+            }
+            budget -= std::min(budget, upload(*s, budget));
+        }
+        if (budget == 0)
+            break;
+    }
+}
+
+std::size_t texture_loader::upload(streamed & s, std::size_t budget)
+{
+    int const level = s.resident - 1;
+    auto const & info = s.chain.levels[level];
+
+    // Strips go through the same orphaned buffer, so the driver never waits for the previous one;
+    // block-compressed levels go whole, at least one level per update
+    std::size_t offset = info.offset, size = info.size;
+    int rows = info.height;
+    if (!s.chain.format)
+    {
+        std::size_t const row_size = static_cast<std::size_t>(info.width) * s.chain.components;
+        // At least one row, so that images wider than the budget still progress
+        rows = std::clamp<int>(budget / row_size, 1, info.height - s.next_row);
+        offset += s.next_row * row_size;
+        size = rows * row_size;
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer_);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    RENDER_STATS_ADD(bytes_uploaded, size);
+    if (void * mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT))
+    {
+        std::memcpy(mapped, s.chain.data.data() + offset, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+
+    if (s.chain.format)
+    {
+        // Specifying the level is its allocation too, unless it is in the sparse tail
+        if (s.allocated || level >= s.tail)
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, info.width, info.height, gl_internal_format(*s.chain.format), size, nullptr);
+        else
+        {
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, gl_internal_format(*s.chain.format), info.width, info.height, 0, size, nullptr);
+            resident_bytes_ += size;
+            RENDER_STATS_GPU_MEMORY("texture", size);
+        }
+    }
+    else
+    {
+        // Rows of one- and two-component images need not be 4-byte aligned
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, s.next_row, info.width, rows, pixel_format(s.chain.components), GL_UNSIGNED_BYTE, nullptr);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    s.next_row += rows;
+    if (s.next_row == info.height)
+    {
+        s.resident = level;
+        s.allocated = false;
+        s.next_row = 0;
+        update_base_level(s);
+    }
+
+    return size;
+}
+
+void texture_loader::allocate_level(GLuint texture, streamed & s, int level, bool commit)
+{
+    auto const & info = s.chain.levels[level];
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+    if (s.tail < static_cast<int>(s.chain.levels.size()))
+        glTexPageCommitmentARB(GL_TEXTURE_2D, level, 0, 0, 0, info.width, info.height, 1, commit);
+    else if (s.chain.format)
+    {
+        // Block-compressed levels are specified along with their data in upload()
+        if (commit)
+            return;
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, gl_internal_format(*s.chain.format), 0, 0, 0, 0, nullptr);
+    }
+    else if (commit)
+        glTexImage2D(GL_TEXTURE_2D, level, internal_format(s.chain.components), info.width, info.height, 0, pixel_format(s.chain.components), GL_UNSIGNED_BYTE, nullptr);
+    else
+        // An empty image gives the level's memory back
+        glTexImage2D(GL_TEXTURE_2D, level, internal_format(s.chain.components), 0, 0, 0, pixel_format(s.chain.components), GL_UNSIGNED_BYTE, nullptr);
+
+    if (commit)
+    {
+        resident_bytes_ += info.size;
+        RENDER_STATS_GPU_MEMORY("texture", info.size);
+        s.allocated = !s.chain.format || s.tail < static_cast<int>(s.chain.levels.size());
+    }
+    else
+    {
+        resident_bytes_ -= info.size;
+        RENDER_STATS_GPU_MEMORY("texture", -std::int64_t(info.size));
+    }
+}
+
+void texture_loader::update_base_level(streamed const & s)
+{
+    int const level_count = s.chain.levels.size();
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, std::min({s.resident, s.tail, level_count - 1}));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level_count - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+    // Left alone while an RGBA placeholder is all there is to sample; sparse storage has
+    // its swizzle from the start
+    if (s.resident < level_count)
+        apply_swizzle(s.chain.swizzle);
+}
+
+bool texture_loader::evictable(streamed const & s) const
+{
+    int const level_count = s.chain.levels.size();
+    // A level being uploaded, or a resident one above the tail and the coarsest level
+    return s.allocated || s.resident < std::min(s.tail, level_count - 1);
+}
+
+bool texture_loader::make_room(std::size_t bytes, streamed const & requester)
+{
+    // Levels finer than their texture wants go first, then those of less visible textures
+    auto const importance = [](streamed const & s){ return s.resident < s.wanted ? -1.f : s.priority; };
+
+    while (resident_bytes_ + bytes > memory_budget_)
+    {
+        GLuint victim = 0;
+        streamed * victim_state = nullptr;
+        for (auto & [texture, s] : streamed_)
+            if (&s != &requester && evictable(s) && importance(s) < importance(requester)
+                && (!victim_state || importance(s) < importance(*victim_state)))
+            {
+                victim = texture;
+                victim_state = &s;
+            }
+
+        if (!victim_state)
+            return false;
+        evict(victim, *victim_state);
+    }
+    return true;
+}
+
+void texture_loader::evict(GLuint texture, streamed & s)
+{
+    if (s.allocated)
+    {
+        allocate_level(texture, s, s.resident - 1, false);
+        s.allocated = false;
+        s.next_row = 0;
+        return;
+    }
+
+    // The base level moves up first, so the level is never sampled once it is gone
+    ++s.resident;
+    glBindTexture(GL_TEXTURE_2D, texture);
+    update_base_level(s);
+    allocate_level(texture, s, s.resident - 1, false);
+}
+
+void texture_loader::decode(job const & j)
+{
+    decoded d;
+    d.texture = j.texture;
+    d.path = j.path;
+
+    try
+    {
+        if (!j.sources.empty())
+        {
+            auto const packed = pack_channels(j.sources);
+            auto chain = generate_mip_chain(packed.pixels.data(), packed.width, packed.height, packed.components, false);
+            d.chain.components = packed.components;
+            d.chain.swizzle = packed.swizzle;
+            d.chain.levels = std::move(chain.levels);
+            d.chain.data = std::move(chain.data);
+        }
+        else if (std::filesystem::path(d.path).extension() == ".dds")
+        {
+            auto image = read_dds(d.path);
+            d.chain.format = image.format;
+            d.chain.levels = std::move(image.levels);
+            d.chain.data = std::move(image.data);
+        }
+        else
+        {
+            auto const image = decode_image_file(d.path);
+            int const width = image.info.width;
+            int const height = image.info.height;
+            int const channels = image.info.channels;
+
+            std::size_t const texels = static_cast<std::size_t>(width) * height;
+            int const components = j.components ? j.components : image_components(image.pixels.data(), texels, channels);
+            std::vector<std::uint8_t> converted;
+            if (components != channels)
+                converted = convert_components(image.pixels.data(), texels, channels, components);
+
+            auto chain = generate_mip_chain(converted.empty() ? image.pixels.data() : converted.data(), width, height, components, j.srgb);
+            d.chain.components = components;
+            d.chain.swizzle = image_swizzle(components);
+            d.chain.levels = std::move(chain.levels);
+            d.chain.data = std::move(chain.data);
+        }
+    }
+    catch (std::exception const & e)
+    {
+        d.error = e.what();
+    }
+
+    std::lock_guard lock(mutex_);
+    decoded_.push_back(std::move(d));
+}
+
+GLenum gl_internal_format(block_format format)
+{
+    switch (format)
+    {
+    case block_format::bc1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case block_format::bc3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case block_format::bc4: return GL_COMPRESSED_RED_RGTC1;
+    case block_format::bc5: return GL_COMPRESSED_RG_RGTC2;
+    case block_format::bc7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    }
+    return GL_NONE;
+}
+
+bool block_format_supported(block_format format)
+{
+    switch (format)
+    {
+    case block_format::bc1:
+    case block_format::bc3:
+        return GLEW_EXT_texture_compression_s3tc;
+    case block_format::bc4:
+    case block_format::bc5:
+        return true;
+    case block_format::bc7:
+        return GLEW_ARB_texture_compression_bptc;
+    }
+    return false;
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm/vec4.hpp>
+
+#include "dds.hpp"
+#include "channel_packing.hpp"
+#include "job_system.hpp"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <optional>
+#include <mutex>
+#include <limits>
+#include <cstdint>
+
+// Decodes images in jobs while the textures they go to already exist with a
+// 1x1 placeholder, so that the first frames render instead of waiting for stbi_load.
+// Every image becomes a full mip chain in system memory, read from the .dds file or
+// filtered on the worker (see generate_mip_chain), and levels go to the GPU coarsest first through a pixel
+// buffer object, at most upload_budget bytes per update(). The texture is complete after
+// every level and only gets sharper, so a large image does not stall a single frame.
+// Levels finer than a texture needs (see request()) are not uploaded, and when the resident
+// size would go over memory_budget the finest levels of less important textures are
+// dropped; they stream back in from the system memory copy when needed again.
+// With ARB_sparse_texture uncompressed textures commit and decommit each level's pages,
+// otherwise a dropped level is respecified as empty to give its memory back.
+struct texture_loader
+{
+    explicit texture_loader(job_system & jobs, std::size_t upload_budget = 4 << 20,
+        std::size_t memory_budget = std::numeric_limits<std::size_t>::max());
+    ~texture_loader();
+
+    texture_loader(texture_loader const &) = delete;
+    texture_loader & operator = (texture_loader const &) = delete;
+
+    // Returns the texture right away, filled with the placeholder color until the image has
+    // been uploaded; .dds files are uploaded as they are, their formats are not converted.
+    // Other images keep the channels they have: grey ones, JPEG files whose colour channels
+    // are all equal included, become R8 or RG8 with alpha, shown as grey by the swizzle.
+    // srgb is for color images, whose mips are then filtered in linear space.
+    GLuint load(std::string path, glm::u8vec4 const & placeholder, bool srgb = false);
+
+    // Same, but the texture is packed from channels of several images on the worker (see
+    // pack_channels) and gets one to four components, constants of 0 and 255 coming from
+    // the swizzle; the fallback when no packed file was made at import time
+    GLuint load_packed(std::vector<channel_source> sources, glm::u8vec4 const & placeholder);
+
+    // The texture's [0, 1] texcoord range covers about this many pixels on screen this
+    // frame, which picks the finest level worth having and is the texture's priority when
+    // memory is short. Textures never requested stream to full resolution; ones not
+    // requested since the last update() keep their levels but are the first to lose them.
+    void request(GLuint texture, float screen_pixels);
+
+    // Uploads what the workers have decoded so far and what requests need, within the
+    // budgets; call every frame on the GL thread. Throws if an image failed to decode.
+    void update();
+
+    // Textures not decoded yet or still short of the level they need, unless the memory
+    // budget is what holds them back
+    std::size_t pending() const;
+
+    // Bytes of GPU memory taken by uploaded levels
+    std::size_t resident_bytes() const { return resident_bytes_; }
+
+private:
+    // Finest level first; uncompressed R8, RG8 or RGBA8 by the number of components when
+    // there is no block format, read through the swizzle
+    struct mip_chain
+    {
+        std::optional<block_format> format;
+        int components = 4;
+        channel_swizzle swizzle = default_swizzle;
+        std::vector<compressed_image::level> levels;
+        std::vector<std::uint8_t> data;
+    };
+
+    struct job
+    {
+        GLuint texture;
+        std::string path;
+        // Packed instead of loading path when not empty
+        std::vector<channel_source> sources;
+        bool srgb;
+        // Of sparse storage made before the image was decoded, which it is converted to;
+        // 0 lets the image choose
+        int components = 0;
+    };
+
+    struct decoded
+    {
+        GLuint texture;
+        std::string path;
+        mip_chain chain;
+        std::string error;
+    };
+
+    struct streamed
+    {
+        mip_chain chain;
+        // Levels from tail on are always committed (the sparse mip tail); the level count
+        // for textures that are not sparse
+        int tail;
+        // Finest level holding its data, the level count before the first one lands
+        int resident;
+        // Whether level resident - 1 has its memory and is being uploaded, and its rows done
+        bool allocated = false;
+        int next_row = 0;
+
+        int wanted = 0;
+        float priority = 0.f;
+        // The last update could not make room for the next level
+        bool blocked = false;
+    };
+
+    GLuint create_placeholder(glm::u8vec4 const & placeholder);
+    // Creates sparse storage with the mip tail committed and filled, if the format and size allow
+    bool create_sparse(GLuint texture, int width, int height, int components, glm::u8vec4 const & placeholder);
+    void decode(job const & j);
+
+    // Returns the bytes uploaded
+    std::size_t upload(streamed & s, std::size_t budget);
+    bool make_room(std::size_t bytes, streamed const & requester);
+    bool evictable(streamed const & s) const;
+    void evict(GLuint texture, streamed & s);
+    void allocate_level(GLuint texture, streamed & s, int level, bool commit);
+    void update_base_level(streamed const & s);
+
+    std::size_t upload_budget_;
+    std::size_t memory_budget_;
+    std::size_t resident_bytes_ = 0;
+    std::size_t decoding_ = 0;
+    GLuint pixel_buffer_ = 0;
+    bool sparse_supported_ = false;
+
+    job_system & jobs_;
+    // Decode jobs still running, waited for on destruction
+    job_counter decodes_;
+    std::mutex mutex_;
+    std::deque<decoded> decoded_;
+
+    // Everything below is only touched by the GL thread
+    std::map<GLuint, int> sparse_tails_;
+    std::map<GLuint, streamed> streamed_;
+    std::map<GLuint, float> screen_pixels_;
+};
+
+// GL internal format of a block format, and whether this context can sample it: BC4/BC5 are
+// core since 3.0, BC1/BC3 need EXT_texture_compression_s3tc and BC7 ARB_texture_compression_bptc
+GLenum gl_internal_format(block_format format);
+bool block_format_supported(block_format format);
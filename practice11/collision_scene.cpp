@@ -0,0 +1,178 @@
+#include "collision_scene.hpp"
+#include "debug_output.hpp"
+
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+
+    // Must match the size of models in the vertex shader
+    constexpr int max_boxes = 8;
+
+    // A unit cube from gl_VertexID alone, six corners per face, one instance per box
+    const char vertex_shader_source[] =
+R"(#version 330 core
+
+uniform mat4 view_projection;
+uniform mat4 models[8];
+
+out vec3 normal;
+
+const vec2 corners[6] = vec2[6](vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(1.0, 1.0), vec2(0.0, 0.0), vec2(1.0, 1.0), vec2(0.0, 1.0));
+
+void main()
+{
+    int face = gl_VertexID / 6;
+    int axis = face / 2;
+
+    vec3 n = vec3(0.0);
+    n[axis] = (face % 2 == 0) ? 1.0 : -1.0;
+    vec3 u = vec3(0.0);
+    u[(axis + 1) % 3] = 1.0;
+    vec3 v = vec3(0.0);
+    v[(axis + 2) % 3] = 1.0;
+
+    vec2 corner = corners[gl_VertexID % 6] * 2.0 - 1.0;
+    vec3 position = 0.5 * (n + corner.x * u + corner.y * v);
+
+    mat4 model = models[gl_InstanceID];
+    gl_Position = view_projection * model * vec4(position, 1.0);
+    normal = transpose(inverse(mat3(model))) * n;
+}
+)";
+
+    // The collision target only has the second output
+    const char fragment_shader_source[] =
+R"(#version 330 core
+
+in vec3 normal;
+
+layout (location = 0) out vec4 out_color;
+layout (location = 1) out vec4 out_normal;
+
+void main()
+{
+    vec3 n = normalize(normal);
+    float light = 0.3 + 0.7 * max(0.0, dot(n, normalize(vec3(1.0, 2.0, 3.0))));
+    out_color = vec4(vec3(0.5) * light, 1.0);
+    out_normal = vec4(n * 0.5 + 0.5, 1.0);
+}
+)";
+
+    glm::mat4 box(glm::vec3 center, glm::vec3 size, float tilt = 0.f)
+    {
+        glm::mat4 result = glm::translate(glm::mat4(1.f), center);
+        result = glm::rotate(result, tilt, {0.f, 0.f, 1.f});
+        return glm::scale(result, size);
+    }
+
+}
+
+collision_scene::collision_scene(program_cache & programs, int width, int height)
+{
+    // Where the fountain comes down: a tilted slab over one side, a block and a low wall on the ground
+    boxes_.push_back(box({0.5f, 0.45f, 0.f}, {0.7f, 0.04f, 0.8f}, 0.35f));
+    boxes_.push_back(box({-0.45f, 0.15f, 0.f}, {0.3f, 0.3f, 0.3f}));
+    boxes_.push_back(box({0.f, 0.1f, -0.55f}, {0.6f, 0.2f, 0.1f}));
+    if (boxes_.size() > max_boxes)
+        throw std::runtime_error("Too many collision boxes");
+
+    program_ = programs.get({{GL_VERTEX_SHADER, vertex_shader_source}, {GL_FRAGMENT_SHADER, fragment_shader_source}});
+    view_projection_location_ = glGetUniformLocation(program_, "view_projection");
+    models_location_ = glGetUniformLocation(program_, "models");
+
+    glGenVertexArrays(1, &vao_);
+
+    glGenTextures(1, &depth_texture_);
+    glGenTextures(1, &normal_texture_);
+    for (GLuint texture : {depth_texture_, normal_texture_})
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    glGenFramebuffers(1, &fbo_);
+
+    resize(width, height);
+
+    // Everything has been bound once by now
+    label_object(GL_PROGRAM, program_, "collision boxes");
+    label_object(GL_VERTEX_ARRAY, vao_, "collision boxes");
+    label_object(GL_TEXTURE, depth_texture_, "collision depth");
+    label_object(GL_TEXTURE, normal_texture_, "collision normals");
+    label_object(GL_FRAMEBUFFER, fbo_, "collision target");
+}
+
+collision_scene::~collision_scene()
+{
+    glDeleteFramebuffers(1, &fbo_);
+    glDeleteTextures(1, &normal_texture_);
+    glDeleteTextures(1, &depth_texture_);
+    glDeleteVertexArrays(1, &vao_);
+}
+
+void collision_scene::resize(int width, int height)
+{
+    width_ = width;
+    height_ = height;
+
+    glBindTexture(GL_TEXTURE_2D, depth_texture_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width_, height_, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, normal_texture_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width_, height_, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo_);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_texture_, 0);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, normal_texture_, 0);
+    GLenum const draw_buffers[] = {GL_NONE, GL_COLOR_ATTACHMENT0};
+    glDrawBuffers(2, draw_buffers);
+    if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        throw std::runtime_error("Collision framebuffer is incomplete");
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+    // What the old target held was seen at the old size
+    has_collision_ = false;
+}
+
+void collision_scene::draw(glm::mat4 const & view, glm::mat4 const & projection)
+{
+    debug_group group("collision boxes");
+    draw_boxes(projection * view);
+}
+
+void collision_scene::draw_collision(glm::mat4 const & view, glm::mat4 const & projection)
+{
+    debug_group group("collision target");
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo_);
+    glViewport(0, 0, width_, height_);
+
+    // Nothing there is a surface at the far plane, which no particle gets behind
+    float const no_normal[4] = {0.5f, 1.f, 0.5f, 0.f};
+    glClearBufferfv(GL_COLOR, 1, no_normal);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    collision_view_projection_ = projection * view;
+    draw_boxes(collision_view_projection_);
+    has_collision_ = true;
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+void collision_scene::draw_boxes(glm::mat4 const & view_projection)
+{
+    glEnable(GL_DEPTH_TEST);
+
+    glUseProgram(program_);
+    glUniformMatrix4fv(view_projection_location_, 1, GL_FALSE, glm::value_ptr(view_projection));
+    glUniformMatrix4fv(models_location_, boxes_.size(), GL_FALSE, glm::value_ptr(boxes_[0]));
+
+    glBindVertexArray(vao_);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 36, boxes_.size());
+}
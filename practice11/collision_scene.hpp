@@ -0,0 +1,59 @@
+#pragma once
+
+#include "program_cache.hpp"
+
+#include <GL/glew.h>
+
+#include <glm/mat4x4.hpp>
+
+#include <vector>
+
+// A few boxes for the GPU particles to hit. Besides being drawn shaded, they are drawn into a
+// target of their own, depth and world-space normals, which the next particle update collides
+// with. The particles only know what that camera saw, so anything hidden or off screen does not
+// stop them.
+struct collision_scene
+{
+    // The program is owned by the cache
+    collision_scene(program_cache & programs, int width, int height);
+    ~collision_scene();
+
+    collision_scene(collision_scene const &) = delete;
+    collision_scene & operator = (collision_scene const &) = delete;
+
+    void resize(int width, int height);
+
+    // Into the bound framebuffer
+    void draw(glm::mat4 const & view, glm::mat4 const & projection);
+
+    // Into the collision target, remembering the camera; binds the default framebuffer after
+    void draw_collision(glm::mat4 const & view, glm::mat4 const & projection);
+
+    // False until draw_collision() has run
+    bool has_collision() const { return has_collision_; }
+
+    GLuint depth_texture() const { return depth_texture_; }
+    GLuint normal_texture() const { return normal_texture_; }
+    // The camera of the last draw_collision()
+    glm::mat4 const & collision_view_projection() const { return collision_view_projection_; }
+
+private:
+    void draw_boxes(glm::mat4 const & view_projection);
+
+    int width_ = 0;
+    int height_ = 0;
+
+    std::vector<glm::mat4> boxes_;
+
+    GLuint program_ = 0;
+    GLint view_projection_location_ = -1;
+    GLint models_location_ = -1;
+    GLuint vao_ = 0;
+
+    GLuint fbo_ = 0;
+    GLuint depth_texture_ = 0;
+    GLuint normal_texture_ = 0;
+
+    bool has_collision_ = false;
+    glm::mat4 collision_view_projection_{1.f};
+};
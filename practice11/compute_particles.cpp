@@ -0,0 +1,587 @@
+#include "compute_particles.hpp"
+#include "debug_output.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <vector>
+#include <numeric>
+#include <iterator>
+#include <algorithm>
+#include <string>
+#include <cmath>
+
+namespace
+{
+
+    constexpr std::size_t group_size = 64;
+
+    // Buckets of the spatial hash; must match grid_buffer and the scan in the shaders
+    constexpr std::size_t table_size = 1 << 16;
+
+    // Offsets into the indirect buffer, as laid out in the shaders
+    constexpr std::size_t emit_dispatch_offset = 0;
+    constexpr std::size_t simulate_dispatch_offset = 3 * sizeof(GLuint);
+    constexpr std::size_t draw_offset = 6 * sizeof(GLuint);
+    constexpr std::size_t indirect_size = 10 * sizeof(GLuint);
+
+    struct particle
+    {
+        glm::vec4 position_age;
+        glm::vec4 velocity_lifetime;
+    };
+
+    struct counters
+    {
+        GLuint dead_count;
+        GLuint dead_base;
+        GLuint emit_count;
+        GLuint alive_count[2];
+    };
+
+    // std140, as emitter_block in the shaders
+    struct emitter_block
+    {
+        glm::vec3 origin;
+        GLuint requested;
+        glm::vec3 velocity;
+        float spread;
+        float lifetime;
+        float gravity;
+        float dt;
+        GLuint seed;
+        GLuint current;
+        GLuint capacity;
+        GLuint live;
+        GLuint neighbors;
+        float cell_size;
+        float strength;
+        GLuint padding[2];
+    };
+
+    static_assert(sizeof(emitter_block) == 80);
+
+    // Shared by every pass; the alive lists are two halves of one buffer, capacity each
+    const char common_source[] =
+R"(#version 430 core
+
+struct particle
+{
+    vec4 position_age;
+    vec4 velocity_lifetime;
+};
+
+layout (std430, binding = 0) buffer particle_buffer { particle particles[]; };
+layout (std430, binding = 1) buffer dead_buffer { uint dead[]; };
+layout (std430, binding = 2) buffer alive_buffer { uint alive[]; };
+
+layout (std430, binding = 3) buffer counter_buffer
+{
+    uint dead_count;
+    // Where this frame's emitted slots start in the dead list, and how many there are
+    uint dead_base;
+    uint emit_count;
+    uint alive_count[2];
+};
+
+layout (std430, binding = 4) buffer indirect_buffer
+{
+    uint emit_dispatch[3];
+    uint simulate_dispatch[3];
+    // DrawArraysIndirectCommand
+    uint draw_count;
+    uint draw_instance_count;
+    uint draw_first;
+    uint draw_base_instance;
+};
+
+layout (std430, binding = 5) buffer grid_buffer
+{
+    uint cell_count[65536];
+    // Cell c holds sorted_particles[cell_start[c], cell_start[c + 1])
+    uint cell_start[65537];
+};
+
+// Per survivor: its cell and its place among the particles of the cell
+layout (std430, binding = 6) buffer cell_buffer { uvec2 cells[]; };
+
+struct sorted_particle
+{
+    vec3 position;
+    uint slot;
+};
+
+layout (std430, binding = 7) buffer sorted_buffer { sorted_particle sorted_particles[]; };
+
+layout (std140, binding = 0) uniform emitter_block
+{
+    vec3 origin;
+    uint requested;
+    vec3 velocity;
+    float spread;
+    float lifetime;
+    float gravity;
+    float dt;
+    uint seed;
+    // The alive list this frame starts from; survivors go to the other one
+    uint current;
+    uint capacity;
+    // The alive list the survivors end up in
+    uint live;
+    // Whether to push apart particles closer than cell_size, as of the last grid
+    uint neighbors;
+    float cell_size;
+    float strength;
+};
+
+ivec3 cell_of(vec3 position)
+{
+    return ivec3(floor(position / cell_size));
+}
+
+// The same hash as spatial_hash's
+uint cell_hash(ivec3 cell)
+{
+    uvec3 c = uvec3(cell);
+    return ((c.x * 73856093u) ^ (c.y * 19349663u) ^ (c.z * 83492791u)) & 65535u;
+}
+
+)";
+
+    const char prepare_source[] =
+R"(
+layout (local_size_x = 1) in;
+
+void main()
+{
+    uint emit = min(requested, dead_count);
+    emit_count = emit;
+    dead_base = dead_count - emit;
+    dead_count = dead_base;
+
+    emit_dispatch[0] = (emit + 63u) / 64u;
+    emit_dispatch[1] = 1u;
+    emit_dispatch[2] = 1u;
+
+    simulate_dispatch[0] = (alive_count[current] + emit + 63u) / 64u;
+    simulate_dispatch[1] = 1u;
+    simulate_dispatch[2] = 1u;
+
+    alive_count[1u - current] = 0u;
+}
+)";
+
+    const char emit_source[] =
+R"(
+layout (local_size_x = 64) in;
+
+uint hash(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+float random(inout uint state)
+{
+    state = hash(state);
+    return float(state) / 4294967295.0;
+}
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= emit_count)
+        return;
+
+    uint slot = dead[dead_base + i];
+
+    uint state = hash(i ^ hash(seed));
+    float angle = 6.283185307179586 * random(state);
+    float radius = spread * sqrt(random(state));
+    vec3 v = velocity * (0.9 + 0.2 * random(state)) + vec3(cos(angle), 0.0, sin(angle)) * radius;
+
+    // Emitted over the frame rather than all at its start, so that they do not come out in sheets
+    float age = dt * random(state);
+    particles[slot].position_age = vec4(origin + v * age, age);
+    particles[slot].velocity_lifetime = vec4(v, lifetime * (0.75 + 0.25 * random(state)));
+
+    alive[current * capacity + atomicAdd(alive_count[current], 1u)] = slot;
+}
+)";
+
+    const char simulate_source[] =
+R"(
+layout (local_size_x = 64) in;
+
+// Looks at no more than 32 neighbors, which bounds the cost where particles bunch up
+vec3 separation(vec3 position, uint slot)
+{
+    ivec3 base = cell_of(position);
+    vec3 push = vec3(0.0);
+    uint found = 0u;
+
+    for (int dz = -1; dz <= 1; ++dz)
+    for (int dy = -1; dy <= 1; ++dy)
+    for (int dx = -1; dx <= 1; ++dx)
+    {
+        uint cell = cell_hash(base + ivec3(dx, dy, dz));
+        uint end = cell_start[cell + 1u];
+        for (uint j = cell_start[cell]; j < end && found < 32u; ++j)
+        {
+            sorted_particle other = sorted_particles[j];
+            vec3 offset = position - other.position;
+            float distance = length(offset);
+            if (other.slot != slot && distance > 0.0 && distance < cell_size)
+            {
+                push += offset * ((1.0 - distance / cell_size) / distance);
+                ++found;
+            }
+        }
+    }
+
+    return push * strength;
+}
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= alive_count[current])
+        return;
+
+    uint slot = alive[current * capacity + i];
+    particle p = particles[slot];
+
+    float age = p.position_age.w + dt;
+    if (age >= p.velocity_lifetime.w)
+    {
+        dead[atomicAdd(dead_count, 1u)] = slot;
+        return;
+    }
+
+    vec3 v = p.velocity_lifetime.xyz - vec3(0.0, gravity * dt, 0.0);
+    if (neighbors != 0u)
+        v += separation(p.position_age.xyz, slot) * dt;
+    vec3 position = p.position_age.xyz + v * dt;
+    if (position.y < 0.0)
+    {
+        position.y = -position.y;
+        v.y = -0.5 * v.y;
+    }
+
+    particles[slot].position_age = vec4(position, age);
+    particles[slot].velocity_lifetime.xyz = v;
+
+    uint next = 1u - current;
+    alive[next * capacity + atomicAdd(alive_count[next], 1u)] = slot;
+}
+)";
+
+    // The grid passes run over the survivors, in the list the simulation appended them to
+    const char count_source[] =
+R"(
+layout (local_size_x = 64) in;
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    uint next = 1u - current;
+    if (i >= alive_count[next])
+        return;
+
+    uint slot = alive[next * capacity + i];
+    uint cell = cell_hash(cell_of(particles[slot].position_age.xyz));
+    cells[i] = uvec2(cell, atomicAdd(cell_count[cell], 1u));
+}
+)";
+
+    // One workgroup: every invocation sums 64 cells, the sums are scanned in shared memory,
+    // and every invocation writes where its cells start
+    const char scan_source[] =
+R"(
+layout (local_size_x = 1024) in;
+
+shared uint sums[1024];
+
+void main()
+{
+    uint t = gl_LocalInvocationID.x;
+    uint first = t * 64u;
+
+    uint sum = 0u;
+    for (uint c = first; c < first + 64u; ++c)
+        sum += cell_count[c];
+    sums[t] = sum;
+    barrier();
+
+    for (uint offset = 1u; offset < 1024u; offset *= 2u)
+    {
+        uint value = sums[t];
+        if (t >= offset)
+            value += sums[t - offset];
+        barrier();
+        sums[t] = value;
+        barrier();
+    }
+
+    uint start = sums[t] - sum;
+    for (uint c = first; c < first + 64u; ++c)
+    {
+        cell_start[c] = start;
+        start += cell_count[c];
+        // So that the next build counts from zero
+        cell_count[c] = 0u;
+    }
+
+    if (t == 1023u)
+    {
+        cell_start[65536] = start;
+        alive_count[current] = alive_count[1u - current];
+    }
+}
+)";
+
+    // Back into the list this frame started from, which the simulation is done with
+    const char scatter_source[] =
+R"(
+layout (local_size_x = 64) in;
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    uint next = 1u - current;
+    if (i >= alive_count[next])
+        return;
+
+    uint slot = alive[next * capacity + i];
+    uvec2 cell = cells[i];
+    uint sorted = cell_start[cell.x] + cell.y;
+
+    alive[current * capacity + sorted] = slot;
+    sorted_particles[sorted] = sorted_particle(particles[slot].position_age.xyz, slot);
+}
+)";
+
+    const char finish_source[] =
+R"(
+layout (local_size_x = 1) in;
+
+void main()
+{
+    draw_count = alive_count[1u - current];
+    draw_instance_count = 1u;
+    draw_first = 0u;
+    draw_base_instance = 0u;
+}
+)";
+
+    const char draw_vertex_source[] =
+R"(
+uniform mat4 view_projection;
+
+out float life;
+
+void main()
+{
+    particle p = particles[alive[live * capacity + uint(gl_VertexID)]];
+    gl_Position = view_projection * vec4(p.position_age.xyz, 1.0);
+    life = 1.0 - p.position_age.w / p.velocity_lifetime.w;
+}
+)";
+
+    const char draw_fragment_source[] =
+R"(#version 430 core
+
+in float life;
+
+layout (location = 0) out vec4 out_color;
+
+void main()
+{
+    out_color = vec4(1.0, 0.6 * life, 0.2 * life, 1.0);
+}
+)";
+
+    GLuint compute_program(program_cache & programs, char const * source)
+    {
+        return programs.get({{GL_COMPUTE_SHADER, std::string(common_source) + source}});
+    }
+
+}
+
+compute_particles::compute_particles(program_cache & programs, std::size_t capacity)
+    : capacity_(capacity)
+{
+    prepare_program_ = compute_program(programs, prepare_source);
+    emit_program_ = compute_program(programs, emit_source);
+    simulate_program_ = compute_program(programs, simulate_source);
+    finish_program_ = compute_program(programs, finish_source);
+    count_program_ = compute_program(programs, count_source);
+    scan_program_ = compute_program(programs, scan_source);
+    scatter_program_ = compute_program(programs, scatter_source);
+    draw_program_ = programs.get({
+        {GL_VERTEX_SHADER, std::string(common_source) + draw_vertex_source},
+        {GL_FRAGMENT_SHADER, draw_fragment_source}});
+    draw_view_projection_location_ = glGetUniformLocation(draw_program_, "view_projection");
+
+    // Every slot starts out dead; these are the only uploads besides the emitter block
+    std::vector<GLuint> dead(capacity_);
+    std::iota(dead.rbegin(), dead.rend(), 0u);
+    counters const initial_counters{static_cast<GLuint>(capacity_), 0, 0, {0, 0}};
+
+    glGenBuffers(1, &particle_buffer_);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, particle_buffer_);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, capacity_ * sizeof(particle), nullptr, GL_DYNAMIC_COPY);
+
+    glGenBuffers(1, &dead_buffer_);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, dead_buffer_);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, dead.size() * sizeof(dead[0]), dead.data(), GL_DYNAMIC_COPY);
+
+    glGenBuffers(1, &alive_buffer_);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, alive_buffer_);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * capacity_ * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+    glGenBuffers(1, &counter_buffer_);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, counter_buffer_);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(initial_counters), &initial_counters, GL_DYNAMIC_COPY);
+
+    // Zeroes draw nothing until the first update
+    std::vector<GLuint> const no_commands(indirect_size / sizeof(GLuint), 0);
+    glGenBuffers(1, &indirect_buffer_);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, indirect_buffer_);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, indirect_size, no_commands.data(), GL_DYNAMIC_COPY);
+
+    glGenBuffers(1, &emitter_buffer_);
+    glBindBuffer(GL_UNIFORM_BUFFER, emitter_buffer_);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(emitter_block), nullptr, GL_DYNAMIC_DRAW);
+
+    // Empty cells, and counts from zero
+    std::vector<GLuint> const empty_grid(2 * table_size + 1, 0);
+    glGenBuffers(1, &grid_buffer_);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, grid_buffer_);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, empty_grid.size() * sizeof(GLuint), empty_grid.data(), GL_DYNAMIC_COPY);
+
+    glGenBuffers(1, &cell_buffer_);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cell_buffer_);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, capacity_ * 2 * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+    // vec3 and uint, 16 bytes in std430
+    glGenBuffers(1, &sorted_buffer_);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, sorted_buffer_);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, capacity_ * 4 * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+    // Points are pulled from the buffers by gl_VertexID
+    glGenVertexArrays(1, &vao_);
+    glBindVertexArray(vao_);
+    glBindVertexArray(0);
+
+    std::pair<GLuint, char const *> const buffers[] = {
+        {particle_buffer_, "compute particles"}, {dead_buffer_, "compute particles dead"}, {alive_buffer_, "compute particles alive"},
+        {counter_buffer_, "compute particles counters"}, {indirect_buffer_, "compute particles indirect"}, {emitter_buffer_, "compute particles emitter"},
+        {grid_buffer_, "compute particles grid"}, {cell_buffer_, "compute particles cells"}, {sorted_buffer_, "compute particles sorted"}};
+    for (auto const & [buffer, label] : buffers)
+        label_object(GL_BUFFER, buffer, label);
+
+    std::pair<GLuint, char const *> const program_labels[] = {
+        {prepare_program_, "compute particles prepare"}, {emit_program_, "compute particles emit"}, {simulate_program_, "compute particles simulate"},
+        {finish_program_, "compute particles finish"}, {count_program_, "compute particles count"}, {scan_program_, "compute particles scan"},
+        {scatter_program_, "compute particles scatter"}, {draw_program_, "compute particles draw"}};
+    for (auto const & [program, label] : program_labels)
+        label_object(GL_PROGRAM, program, label);
+    label_object(GL_VERTEX_ARRAY, vao_, "compute particles");
+}
+
+compute_particles::~compute_particles()
+{
+    glDeleteVertexArrays(1, &vao_);
+    GLuint const buffers[] = {particle_buffer_, dead_buffer_, alive_buffer_, counter_buffer_, indirect_buffer_, emitter_buffer_, grid_buffer_, cell_buffer_, sorted_buffer_};
+    glDeleteBuffers(std::size(buffers), buffers);
+}
+
+void compute_particles::update(emitter const & emitter, float dt, float time, interaction const * interaction)
+{
+    // A grid of other cells would find the wrong neighbors
+    bool const neighbors = interaction && grid_built_ && grid_radius_ == interaction->radius;
+
+    float const wanted = emitter.rate * dt + emit_remainder_;
+    float const requested = std::min(std::floor(wanted), static_cast<float>(capacity_));
+    emit_remainder_ = std::min(wanted - requested, 1.f);
+
+    emitter_block const block{
+        emitter.origin, static_cast<GLuint>(requested),
+        emitter.velocity, emitter.spread,
+        emitter.lifetime, emitter.gravity, dt, static_cast<GLuint>(time * 1000.f),
+        static_cast<GLuint>(current_), static_cast<GLuint>(capacity_),
+        static_cast<GLuint>(interaction ? current_ : 1 - current_), neighbors,
+        interaction ? interaction->radius : 1.f, interaction ? interaction->strength : 0.f, {0, 0},
+    };
+    glBindBuffer(GL_UNIFORM_BUFFER, emitter_buffer_);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, emitter_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particle_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, dead_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, alive_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, counter_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, indirect_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, grid_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, cell_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, sorted_buffer_);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, indirect_buffer_);
+
+    glUseProgram(prepare_program_);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+    glUseProgram(emit_program_);
+    glDispatchComputeIndirect(emit_dispatch_offset);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glUseProgram(simulate_program_);
+    glDispatchComputeIndirect(simulate_dispatch_offset);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // Sized for every particle the simulation went through, which is at least the survivors
+    if (interaction)
+    {
+        glUseProgram(count_program_);
+        glDispatchComputeIndirect(simulate_dispatch_offset);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glUseProgram(scan_program_);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glUseProgram(scatter_program_);
+        glDispatchComputeIndirect(simulate_dispatch_offset);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    glUseProgram(finish_program_);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+    // Sorting moves the survivors back into the list this frame started from
+    grid_built_ = interaction != nullptr;
+    if (grid_built_)
+        grid_radius_ = interaction->radius;
+    else
+        current_ = 1 - current_;
+}
+
+void compute_particles::draw(glm::mat4 const & view_projection)
+{
+    glUseProgram(draw_program_);
+    glUniformMatrix4fv(draw_view_projection_location_, 1, GL_FALSE, glm::value_ptr(view_projection));
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, emitter_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, particle_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, alive_buffer_);
+
+    glBindVertexArray(vao_);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer_);
+    glDrawArraysIndirect(GL_POINTS, reinterpret_cast<void *>(draw_offset));
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
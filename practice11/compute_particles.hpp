@@ -0,0 +1,97 @@
+#pragma once
+
+#include "program_cache.hpp"
+
+#include <GL/glew.h>
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+// Particles that are emitted, simulated and killed by compute shaders (GL 4.3), without the
+// CPU ever seeing how many are alive. Free slots are a dead list and live ones an alive list,
+// both grown and shrunk with atomic counters: each frame a single-invocation pass takes as
+// many slots off the dead list as the emitter asks for and there are, and writes the indirect
+// dispatch sizes of the emit and simulate passes. Simulation appends survivors to the other
+// alive list and the dead back to the dead list, and a last single-invocation pass turns the
+// survivor count into the indirect draw. The CPU only updates the emitter's uniform block.
+//
+// With an interaction, the survivors are also sorted into a spatial hash: they count
+// themselves into their cells with atomics, one workgroup scans the table into where every
+// cell starts, and they scatter into the alive list they came from, now ordered by cell, with
+// a copy of their positions alongside. The next simulation walks that order, so neighboring
+// invocations touch neighboring particles, and finds each particle's neighbors in the cells
+// around it.
+struct compute_particles
+{
+    struct emitter
+    {
+        glm::vec3 origin{0.f};
+        // Particles per second, as many as have free slots
+        float rate = 250000.f;
+        // Mean velocity, and how far the velocity's direction spreads off it
+        glm::vec3 velocity{0.f, 1.35f, 0.f};
+        float spread = 0.2f;
+        float lifetime = 4.f;
+        float gravity = 1.f;
+    };
+
+    // Particles closer than radius push each other apart, harder the closer they are
+    struct interaction
+    {
+        // Also the size of the grid's cells
+        float radius = 0.02f;
+        float strength = 2.f;
+    };
+
+    static bool supported() { return GLEW_VERSION_4_3; }
+
+    // The programs are owned by the cache
+    compute_particles(program_cache & programs, std::size_t capacity);
+    ~compute_particles();
+
+    compute_particles(compute_particles const &) = delete;
+    compute_particles & operator = (compute_particles const &) = delete;
+
+    std::size_t capacity() const { return capacity_; }
+
+    // Particles push each other apart as of the grid the last update built, if it had an
+    // interaction too
+    void update(emitter const & emitter, float dt, float time, interaction const * interaction = nullptr);
+
+    // Every live particle as a point, with one indirect draw
+    void draw(glm::mat4 const & view_projection);
+
+private:
+    std::size_t capacity_;
+    // Which alive list holds the live particles; update() fills the other and swaps
+    int current_ = 0;
+    // Whether the last update left a grid behind, and with which cell size
+    bool grid_built_ = false;
+    float grid_radius_ = 0.f;
+    // Fractions of a particle left over from the frames before
+    float emit_remainder_ = 0.f;
+
+    GLuint prepare_program_ = 0;
+    GLuint emit_program_ = 0;
+    GLuint simulate_program_ = 0;
+    GLuint finish_program_ = 0;
+    GLuint count_program_ = 0;
+    GLuint scan_program_ = 0;
+    GLuint scatter_program_ = 0;
+    GLuint draw_program_ = 0;
+    GLint draw_view_projection_location_ = -1;
+
+    GLuint particle_buffer_ = 0;
+    GLuint dead_buffer_ = 0;
+    GLuint alive_buffer_ = 0;
+    GLuint counter_buffer_ = 0;
+    GLuint indirect_buffer_ = 0;
+    GLuint emitter_buffer_ = 0;
+    GLuint grid_buffer_ = 0;
+    GLuint cell_buffer_ = 0;
+    GLuint sorted_buffer_ = 0;
+    GLuint vao_ = 0;
+};
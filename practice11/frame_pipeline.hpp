@@ -0,0 +1,101 @@
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <utility>
+
+// Runs the next frame's simulation on its own thread while the current frame is rendered.
+// There are two snapshots: the simulation writes one while the renderer reads the other, and
+// advance() swaps them once the simulation is done, so what is drawn is always one frame old.
+// Nothing else may touch the state the simulation works on while it runs.
+template <typename Snapshot>
+struct frame_pipeline
+{
+    frame_pipeline()
+        : worker_([this]{ worker_loop(); })
+    {}
+
+    ~frame_pipeline()
+    {
+        {
+            std::lock_guard lock(mutex_);
+            stop_ = true;
+        }
+        start_.notify_one();
+        worker_.join();
+    }
+
+    frame_pipeline(frame_pipeline const &) = delete;
+    frame_pipeline & operator = (frame_pipeline const &) = delete;
+
+    // Waits for the previous simulation, starts simulate on the snapshot the renderer is done
+    // with and returns the one just simulated, which stays valid until the next call. The
+    // first call returns a default-constructed snapshot. Rethrows what simulate threw.
+    Snapshot const & advance(std::function<void(Snapshot &)> simulate)
+    {
+        wait();
+        std::swap(front_, back_);
+
+        {
+            std::lock_guard lock(mutex_);
+            simulate_ = std::move(simulate);
+        }
+        start_.notify_one();
+
+        return snapshots_[front_];
+    }
+
+    // Waits for the running simulation, if any, without starting another
+    void wait()
+    {
+        std::unique_lock lock(mutex_);
+        done_.wait(lock, [this]{ return !simulate_; });
+
+        if (error_)
+            std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+
+private:
+    void worker_loop()
+    {
+        std::unique_lock lock(mutex_);
+        while (true)
+        {
+            // A simulation started before the destructor still runs, since it may hold references
+            start_.wait(lock, [this]{ return stop_ || simulate_; });
+            if (!simulate_)
+                return;
+
+            lock.unlock();
+            try
+            {
+                simulate_(snapshots_[back_]);
+            }
+            catch (...)
+            {
+                error_ = std::current_exception();
+            }
+            lock.lock();
+
+            simulate_ = nullptr;
+            done_.notify_one();
+        }
+    }
+
+    Snapshot snapshots_[2];
+    int front_ = 0;
+    int back_ = 1;
+
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    std::function<void(Snapshot &)> simulate_;
+    std::exception_ptr error_;
+    bool stop_ = false;
+
+    // Last, so that it starts after everything above is constructed
+    std::thread worker_;
+};
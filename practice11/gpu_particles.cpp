@@ -0,0 +1,211 @@
+#include "gpu_particles.hpp"
+#include "debug_output.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <string>
+#include <cstddef>
+
+namespace
+{
+
+    const char update_shader_source[] =
+R"(#version 330 core
+
+uniform float dt;
+uniform float time;
+uniform bool reset;
+
+uniform bool collide;
+uniform sampler2D collision_depth;
+uniform sampler2D collision_normals;
+uniform mat4 collision_view_projection;
+uniform vec2 collision_near_far;
+
+layout (location = 0) in vec3 in_position;
+layout (location = 1) in vec3 in_velocity;
+layout (location = 2) in float in_age;
+
+out vec3 position;
+out vec3 velocity;
+out float age;
+
+const float lifetime = 4.0;
+const float gravity = 1.0;
+const float pi = 3.141592653589793;
+
+// How far behind the surface a particle can step and still be touching it, in view depth
+const float collision_thickness = 0.05;
+const float restitution = 0.5;
+
+uint hash(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+float random(inout uint seed)
+{
+    seed = hash(seed);
+    return float(seed) / 4294967295.0;
+}
+
+void spawn(inout uint seed)
+{
+    float angle = 2.0 * pi * random(seed);
+    float spread = 0.2 * sqrt(random(seed));
+    position = vec3(0.0, 0.0, 0.0);
+    velocity = vec3(spread * cos(angle), 1.2 + 0.3 * random(seed), spread * sin(angle));
+}
+
+// The view depth of a point, -1 where it is off the collision camera's screen, and the view
+// depth of the surface that camera saw in its direction
+vec2 collision_depths(vec3 point, out vec2 texcoord)
+{
+    vec4 clip = collision_view_projection * vec4(point, 1.0);
+    texcoord = (clip.xy / clip.w) * 0.5 + 0.5;
+    if (clip.w <= collision_near_far.x || any(lessThan(texcoord, vec2(0.0))) || any(greaterThan(texcoord, vec2(1.0))))
+        return vec2(-1.0);
+
+    float z_near = collision_near_far.x;
+    float z_far = collision_near_far.y;
+    float depth = textureLod(collision_depth, texcoord, 0.0).r;
+    return vec2(clip.w, z_near * z_far / (z_far - depth * (z_far - z_near)));
+}
+
+void main()
+{
+    uint seed = hash(uint(gl_VertexID)) ^ floatBitsToUint(time);
+
+    // The buffers start out uninitialized; spread the first ages so the particles don't all respawn together
+    if (reset)
+    {
+        spawn(seed);
+        age = lifetime * random(seed);
+        return;
+    }
+
+    velocity = in_velocity - vec3(0.0, gravity * dt, 0.0);
+    position = in_position + velocity * dt;
+    age = in_age + dt;
+
+    if (position.y < 0.0)
+    {
+        position.y = -position.y;
+        velocity.y = -0.5 * velocity.y;
+    }
+
+    if (collide)
+    {
+        vec2 texcoord, previous_texcoord;
+        vec2 depths = collision_depths(position, texcoord);
+        vec2 previous_depths = collision_depths(in_position, previous_texcoord);
+
+        if (depths.x > depths.y && previous_depths.x >= 0.0 && previous_depths.x <= previous_depths.y)
+        {
+            if (depths.x - depths.y < collision_thickness)
+            {
+                // Steps back to where it was in front and loses the velocity into the surface
+                vec3 normal = normalize(textureLod(collision_normals, texcoord, 0.0).xyz * 2.0 - 1.0);
+                float into = dot(velocity, normal);
+                if (into < 0.0)
+                    velocity -= (1.0 + restitution) * into * normal;
+                position = in_position;
+            }
+            else
+                age = lifetime;
+        }
+    }
+
+    if (age >= lifetime)
+    {
+        spawn(seed);
+        age = 0.0;
+    }
+}
+)";
+
+}
+
+gpu_particles::gpu_particles(program_cache & programs, std::size_t count)
+    : count_(count)
+{
+    // Captured in the order of gpu_particles::state
+    program_ = programs.get({{GL_VERTEX_SHADER, update_shader_source}}, {"position", "velocity", "age"});
+    dt_location_ = glGetUniformLocation(program_, "dt");
+    time_location_ = glGetUniformLocation(program_, "time");
+    reset_location_ = glGetUniformLocation(program_, "reset");
+    collide_location_ = glGetUniformLocation(program_, "collide");
+    collision_depth_location_ = glGetUniformLocation(program_, "collision_depth");
+    collision_normals_location_ = glGetUniformLocation(program_, "collision_normals");
+    collision_view_projection_location_ = glGetUniformLocation(program_, "collision_view_projection");
+    collision_near_far_location_ = glGetUniformLocation(program_, "collision_near_far");
+
+    glGenBuffers(2, vbo_);
+    glGenVertexArrays(2, vao_);
+    for (int i = 0; i < 2; ++i)
+    {
+        glBindVertexArray(vao_[i]);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_[i]);
+        glBufferData(GL_ARRAY_BUFFER, count_ * sizeof(state), nullptr, GL_DYNAMIC_COPY);
+
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(state), reinterpret_cast<void *>(offsetof(state, position)));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(state), reinterpret_cast<void *>(offsetof(state, velocity)));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(state), reinterpret_cast<void *>(offsetof(state, age)));
+
+        auto const label = "gpu particles " + std::to_string(i);
+        label_object(GL_BUFFER, vbo_[i], label);
+        label_object(GL_VERTEX_ARRAY, vao_[i], label);
+    }
+    label_object(GL_PROGRAM, program_, "gpu particles update");
+}
+
+gpu_particles::~gpu_particles()
+{
+    glDeleteVertexArrays(2, vao_);
+    glDeleteBuffers(2, vbo_);
+}
+
+void gpu_particles::update(float dt, float time, collision const * collision)
+{
+    int const next = 1 - current_;
+
+    glUseProgram(program_);
+    glUniform1f(dt_location_, dt);
+    glUniform1f(time_location_, time);
+    glUniform1i(reset_location_, initialized_ ? 0 : 1);
+
+    glUniform1i(collide_location_, collision ? 1 : 0);
+    if (collision)
+    {
+        glUniform1i(collision_depth_location_, 0);
+        glUniform1i(collision_normals_location_, 1);
+        glUniformMatrix4fv(collision_view_projection_location_, 1, GL_FALSE, glm::value_ptr(collision->view_projection));
+        glUniform2f(collision_near_far_location_, collision->near, collision->far);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, collision->depth_texture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, collision->normal_texture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(vao_[current_]);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, vbo_[next]);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, count_);
+    glEndTransformFeedback();
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glDisable(GL_RASTERIZER_DISCARD);
+
+    current_ = next;
+    initialized_ = true;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "program_cache.hpp"
+
+#include <GL/glew.h>
+
+#include <glm/mat4x4.hpp>
+
+#include <cstddef>
+
+// Particles that live entirely in GPU memory: each update() runs a vertex shader over one
+// buffer and captures the new state into the other with transform feedback, so the CPU only
+// sets uniforms. Particles that outlive their lifetime respawn at the emitter.
+//
+// They can also collide with what a camera saw, its depth and normals, usually those of the
+// last frame. A particle that steps from in front of that depth to just behind it bounces off
+// the surface there; one that steps from in front to far behind went through something
+// without touching it at this step size, and respawns instead.
+struct gpu_particles
+{
+    // Layout of a particle in the state buffers
+    struct state
+    {
+        float position[3];
+        float velocity[3];
+        float age;
+    };
+
+    // The program is owned by the cache
+    gpu_particles(program_cache & programs, std::size_t count);
+    ~gpu_particles();
+
+    gpu_particles(gpu_particles const &) = delete;
+    gpu_particles & operator = (gpu_particles const &) = delete;
+
+    std::size_t size() const { return count_; }
+
+    struct collision
+    {
+        GLuint depth_texture;
+        // World-space, encoded as n * 0.5 + 0.5
+        GLuint normal_texture;
+        glm::mat4 view_projection;
+        // Of the projection, to make the depth linear
+        float near;
+        float far;
+    };
+
+    // Binds texture units 0 and 1 when colliding
+    void update(float dt, float time, collision const * collision = nullptr);
+
+    // Has the position at attribute 0, velocity at 1 and age at 2
+    GLuint vao() const { return vao_[current_]; }
+
+private:
+    std::size_t count_;
+    int current_ = 0;
+    bool initialized_ = false;
+
+    GLuint program_ = 0;
+    GLuint vbo_[2] = {0, 0};
+    GLuint vao_[2] = {0, 0};
+
+    GLint dt_location_ = -1;
+    GLint time_location_ = -1;
+    GLint reset_location_ = -1;
+    GLint collide_location_ = -1;
+    GLint collision_depth_location_ = -1;
+    GLint collision_normals_location_ = -1;
+    GLint collision_view_projection_location_ = -1;
+    GLint collision_near_far_location_ = -1;
+};
@@ -13,8 +13,9 @@
 #include <chrono>
 #include <vector>
 #include <random>
-#include <map>
 #include <cmath>
+#include <optional>
+#include <algorithm>
 
 #define GLM_FORCE_SWIZZLE
 #define GLM_ENABLE_EXPERIMENTAL
@@ -28,6 +29,21 @@
 
 #include "obj_parser.hpp"
 #include "stb_image.h"
+#include "gpu_particles.hpp"
+#include "collision_scene.hpp"
+#include "compute_particles.hpp"
+#include "program_cache.hpp"
+#include "stream_buffer.hpp"
+#include "particle_pool.hpp"
+#include "particle_sort.hpp"
+#include "particle_budget.hpp"
+#include "spatial_hash.hpp"
+#include "offscreen_particles.hpp"
+#include "job_system.hpp"
+#include "frame_pipeline.hpp"
+#include "input_state.hpp"
+#include "replay_session.hpp"
+#include "debug_output.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -55,6 +71,41 @@ void main()
 }
 )";
 
+// One instanced 4-vertex strip per particle, expanded in view space without a geometry shader
+const char billboard_vertex_shader_source[] =
+R"(#version 330 core
+
+uniform mat4 view;
+uniform mat4 projection;
+
+layout (location = 0) in vec4 in_particle;
+
+out vec2 texcoord;
+
+void main()
+{
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    vec4 center = view * vec4(in_particle.xyz, 1.0);
+    gl_Position = projection * (center + vec4((corner * 2.0 - 1.0) * in_particle.w, 0.0, 0.0));
+    texcoord = corner;
+}
+)";
+
+const char billboard_fragment_shader_source[] =
+R"(#version 330 core
+
+uniform sampler2D particle_texture;
+
+in vec2 texcoord;
+
+layout (location = 0) out vec4 out_color;
+
+void main()
+{
+    out_color = vec4(1.0, 0.6, 0.3, 0.5) * texture(particle_texture, texcoord);
+}
+)";
+
 const char geometry_shader_source[] =
 R"(#version 330 core
 
@@ -131,8 +182,11 @@ struct particle
     glm::vec3 position;
 };
 
-int main() try
+int main(int argc, char ** argv) try
 {
+    replay_session replay(argc, argv);
+    bool const gl_debug = std::any_of(argv + 1, argv + argc, [](char const * arg){ return std::string_view(arg) == "--gl-debug"; });
+
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
         sdl2_fail("SDL_Init: ");
 
@@ -144,6 +198,9 @@ int main() try
     SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
+    // Drivers send most of their performance warnings to debug contexts only
+    if (gl_debug)
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
 
     SDL_Window * window = SDL_CreateWindow("Graphics course practice 11",
         SDL_WINDOWPOS_CENTERED,
@@ -167,6 +224,15 @@ int main() try
     if (!GLEW_VERSION_3_3)
         throw std::runtime_error("OpenGL 3.3 is not supported");
 
+    // With --gl-debug, driver warnings go to the log as they come and are summed up on exit
+    std::optional<debug_output> debug;
+    if (gl_debug)
+    {
+        debug.emplace(std::cerr);
+        if (!debug->enabled())
+            std::cout << "KHR_debug is not supported, --gl-debug does nothing" << std::endl;
+    }
+
     glClearColor(0.f, 0.f, 0.f, 0.f);
 
     auto vertex_shader = create_shader(GL_VERTEX_SHADER, vertex_shader_source);
@@ -179,6 +245,17 @@ int main() try
     GLuint projection_location = glGetUniformLocation(program, "projection");
     GLuint camera_position_location = glGetUniformLocation(program, "camera_position");
 
+    auto billboard_vertex_shader = create_shader(GL_VERTEX_SHADER, billboard_vertex_shader_source);
+    auto billboard_fragment_shader = create_shader(GL_FRAGMENT_SHADER, billboard_fragment_shader_source);
+    auto billboard_program = create_program(billboard_vertex_shader, billboard_fragment_shader);
+
+    label_object(GL_PROGRAM, program, "particle points");
+    label_object(GL_PROGRAM, billboard_program, "particle billboards");
+
+    GLuint billboard_view_location = glGetUniformLocation(billboard_program, "view");
+    GLuint billboard_projection_location = glGetUniformLocation(billboard_program, "projection");
+    GLuint billboard_texture_location = glGetUniformLocation(billboard_program, "particle_texture");
+
     std::default_random_engine rng;
 
     std::vector<particle> particles(256);
@@ -189,26 +266,124 @@ int main() try
         p.position.z = std::uniform_real_distribution<float>{-1.f, 1.f}(rng);
     }
 
-    GLuint vao, vbo;
+    // Particles are rewritten every frame, so they go through a stream buffer instead of reallocating a VBO
+    stream_buffer particle_stream(GL_ARRAY_BUFFER, 1 << 24);
+
+    GLuint vao;
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
+    glEnableVertexAttribArray(0);
+    label_object(GL_VERTEX_ARRAY, vao, "particle points");
 
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    const std::string project_root = PROJECT_ROOT;
 
+    // Programs of the particle and scene passes
+    program_cache programs(project_root + "/.program_binaries");
+
+    // G switches to these; their state never leaves the GPU
+    gpu_particles simulated_particles(programs, 1 << 20);
+
+    // K switches to these where there are compute shaders: emitted, simulated and killed on
+    // the GPU, which also decides how many to draw
+    std::optional<compute_particles> emitted_particles;
+    compute_particles::emitter particle_emitter;
+    if (compute_particles::supported())
+        emitted_particles.emplace(programs, 1 << 20);
+
+    // Drawn with them, and what they collide with unless C turns it off
+    collision_scene scene(programs, width, height);
+    bool collisions = true;
+
+    // E switches to CPU emitters, each updated as one job: 16 fountains that run forever
+    // and short bursts spawned all the time, all sharing one particle budget
+    job_system jobs;
+    particle_budget budget(particle_budget::settings{});
+    for (int i = 0; i < 4; ++i)
+        for (int j = 0; j < 4; ++j)
+            budget.spawn(emitter_settings{glm::vec3{i - 1.5f, 0.f, j - 1.5f}, 1600.f, 2.5f, 1.5f}, glm::vec3(0.f));
+
+    float burst_time = 0.f;
+    // Every fourth burst throws sparks, which stay at full resolution
+    std::size_t burst_count = 0;
+
+    // N makes emitter and compute particles push each other apart, finding their neighbors
+    // through a spatial hash rebuilt every frame
+    bool separate_particles = false;
+    spatial_hash particle_grid(0.03f);
+    compute_particles::interaction const particle_interaction;
+
+    // Emitter particles are drawn as alpha-blended billboards, sorted back to front unless S turns it off
+    bool sort_billboards = true;
+
+    // L cycles the billboards between full, half and quarter resolution; large ones covering the
+    // screen are bound by fill rate, and blurry smoke loses little at a quarter of the pixels
+    offscreen_particles particle_target(programs, width, height);
+    particle_target.set_divisor(1);
+
+    // What a frame of emitters draws: each snapshot sorts into its own billboard_sorter, so the
+    // instances of one stay put while the other is being simulated
+    struct emitter_snapshot
+    {
+        billboard_sorter billboards;
+        std::vector<billboard_sorter::instance> const * instances = nullptr;
+        std::size_t low_resolution_count = 0;
+        glm::mat4 view{1.f};
+        glm::mat4 projection{1.f};
+        particle_budget::frame_stats stats;
+        float update_time = 0.f;
+        float separate_time = 0.f;
+        float sort_time = 0.f;
+    };
+
+    // Emitters, bursts and sorting for frame N + 1 run on their own thread while frame N is drawn;
+    // once it starts nothing but the pipeline touches budget, burst_time, burst_count, rng, particle_grid or jobs
+    frame_pipeline<emitter_snapshot> emitter_pipeline;
+
+    GLuint billboard_vao;
+    glGenVertexArrays(1, &billboard_vao);
+    glBindVertexArray(billboard_vao);
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(particle), (void*)(0));
+    glVertexAttribDivisor(0, 1);
+    label_object(GL_VERTEX_ARRAY, billboard_vao, "particle billboards");
+
+    enum class particle_mode
+    {
+        cpu,
+        gpu,
+        compute,
+        emitters,
+    };
+
+    particle_mode mode = particle_mode::cpu;
+    float print_time = 0.f;
 
-    const std::string project_root = PROJECT_ROOT;
     const std::string particle_texture_path = project_root + "/particle.png";
 
+    GLuint particle_texture;
+    {
+        int texture_width, texture_height, channels;
+        auto pixels = stbi_load(particle_texture_path.c_str(), &texture_width, &texture_height, &channels, 4);
+        if (!pixels)
+            throw std::runtime_error("Failed to load " + particle_texture_path);
+
+        glGenTextures(1, &particle_texture);
+        glBindTexture(GL_TEXTURE_2D, particle_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, texture_width, texture_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        label_object(GL_TEXTURE, particle_texture, "particle.png");
+
+        stbi_image_free(pixels);
+    }
+
     glPointSize(5.f);
 
     auto last_frame_start = std::chrono::high_resolution_clock::now();
 
     float time = 0.f;
 
-    std::map<SDL_Keycode, bool> button_down;
+    input_state input;
 
     float view_angle = 0.f;
     float camera_distance = 2.f;
@@ -221,6 +396,8 @@ int main() try
     bool running = true;
     while (running)
     {
+        input.begin_frame();
+
         for (SDL_Event event; SDL_PollEvent(&event);) switch (event.type)
         {
         case SDL_QUIT:
@@ -232,35 +409,63 @@ int main() try
                 width = event.window.data1;
                 height = event.window.data2;
                 glViewport(0, 0, width, height);
+                scene.resize(width, height);
+                particle_target.resize(width, height);
                 break;
             }
             break;
         case SDL_KEYDOWN:
-            button_down[event.key.keysym.sym] = true;
+            input.handle_event(event);
             if (event.key.keysym.sym == SDLK_SPACE)
                 paused = !paused;
+            if (event.key.keysym.sym == SDLK_g)
+                mode = (mode == particle_mode::gpu) ? particle_mode::cpu : particle_mode::gpu;
+            if (event.key.keysym.sym == SDLK_s)
+                sort_billboards = !sort_billboards;
+            if (event.key.keysym.sym == SDLK_c)
+            {
+                collisions = !collisions;
+                std::cout << "Particle collisions " << (collisions ? "on" : "off") << std::endl;
+            }
+            if (event.key.keysym.sym == SDLK_e)
+                mode = (mode == particle_mode::emitters) ? particle_mode::cpu : particle_mode::emitters;
+            if (event.key.keysym.sym == SDLK_k && emitted_particles)
+                mode = (mode == particle_mode::compute) ? particle_mode::cpu : particle_mode::compute;
+            if (event.key.keysym.sym == SDLK_l)
+            {
+                particle_target.set_divisor(particle_target.divisor() == 4 ? 1 : particle_target.divisor() * 2);
+                std::cout << "Billboards at 1/" << particle_target.divisor() << " resolution" << std::endl;
+            }
+            if (event.key.keysym.sym == SDLK_n)
+            {
+                separate_particles = !separate_particles;
+                std::cout << "Particle separation " << (separate_particles ? "on" : "off") << std::endl;
+            }
             break;
         case SDL_KEYUP:
-            button_down[event.key.keysym.sym] = false;
+            input.handle_event(event);
             break;
         }
 
         if (!running)
             break;
 
+        if (!replay.update(input))
+            break;
+
         auto now = std::chrono::high_resolution_clock::now();
-        float dt = std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count();
+        float dt = replay.frame_time(std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count());
         last_frame_start = now;
         time += dt;
 
-        if (button_down[SDLK_UP])
+        if (input.down(SDL_SCANCODE_UP))
             camera_distance -= 3.f * dt;
-        if (button_down[SDLK_DOWN])
+        if (input.down(SDL_SCANCODE_DOWN))
             camera_distance += 3.f * dt;
 
-        if (button_down[SDLK_LEFT])
+        if (input.down(SDL_SCANCODE_LEFT))
             camera_rotation -= 3.f * dt;
-        if (button_down[SDLK_RIGHT])
+        if (input.down(SDL_SCANCODE_RIGHT))
             camera_rotation += 3.f * dt;
 
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -280,22 +485,182 @@ int main() try
 
         glm::vec3 camera_position = (glm::inverse(view) * glm::vec4(0.f, 0.f, 0.f, 1.f)).xyz();
 
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, particles.size() * sizeof(particle), particles.data(), GL_STATIC_DRAW);
+        if (mode == particle_mode::gpu)
+        {
+            debug_group group("gpu particles");
+
+            // Against what the last frame saw, which this one has yet to draw
+            gpu_particles::collision const collision{scene.depth_texture(), scene.normal_texture(), scene.collision_view_projection(), near, far};
+            if (!paused)
+                simulated_particles.update(dt, time, (collisions && scene.has_collision()) ? &collision : nullptr);
+
+            scene.draw(view, projection);
+
+            glUseProgram(program);
+
+            glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
+            glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
+            glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
+            glUniform3fv(camera_position_location, 1, reinterpret_cast<float *>(&camera_position));
+
+            glBindVertexArray(simulated_particles.vao());
+            glDrawArrays(GL_POINTS, 0, simulated_particles.size());
+
+            scene.draw_collision(view, projection);
+        }
+        else if (mode == particle_mode::compute)
+        {
+            debug_group group("compute particles");
+
+            if (!paused)
+                emitted_particles->update(particle_emitter, dt, time, separate_particles ? &particle_interaction : nullptr);
 
-        glUseProgram(program);
+            emitted_particles->draw(projection * view);
+        }
+        else if (mode == particle_mode::emitters)
+        {
+            auto const & frame = emitter_pipeline.advance([&budget, &jobs, &rng, &burst_time, &burst_count, &particle_grid, dt, paused, separate = separate_particles, sort = sort_billboards, view, projection, camera_position](emitter_snapshot & snapshot)
+            {
+                snapshot.update_time = 0.f;
+                snapshot.separate_time = 0.f;
+                if (!paused)
+                {
+                    for (burst_time += dt; burst_time >= 0.01f; burst_time -= 0.01f)
+                    {
+                        emitter_settings burst{
+                            {std::uniform_real_distribution<float>{-4.f, 4.f}(rng), 0.f, std::uniform_real_distribution<float>{-4.f, 4.f}(rng)},
+                            4000.f, 1.f, 1.f,
+                            std::uniform_real_distribution<float>{0.5f, 1.5f}(rng),
+                            std::uniform_real_distribution<float>{0.5f, 2.f}(rng),
+                        };
+                        burst.full_resolution = (++burst_count % 4 == 0);
+                        budget.spawn(burst, camera_position);
+                    }
+
+                    auto const update_start = std::chrono::high_resolution_clock::now();
+                    budget.update(jobs, dt, 1.f, camera_position);
+                    snapshot.update_time = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - update_start).count();
+
+                    if (separate)
+                    {
+                        auto const separate_start = std::chrono::high_resolution_clock::now();
+                        budget.separate(jobs, particle_grid, 1.f, dt);
+                        snapshot.separate_time = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - separate_start).count();
+                    }
+                }
+
+                auto const sort_start = std::chrono::high_resolution_clock::now();
+                // A zero view matrix gives every particle the same depth, which leaves them in emitter order
+                snapshot.instances = &snapshot.billboards.sort(jobs, sort ? view : glm::mat4(0.f), budget.emitters());
+                snapshot.low_resolution_count = snapshot.billboards.low_resolution_count();
+                snapshot.sort_time = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - sort_start).count();
+
+                // Drawn with the camera it was sorted for
+                snapshot.view = view;
+                snapshot.projection = projection;
+                snapshot.stats = budget.stats();
+            });
+
+            // The first snapshot has not been simulated
+            std::vector<billboard_sorter::instance> const no_instances;
+            auto const & instances = frame.instances ? *frame.instances : no_instances;
+            std::size_t const particle_count = instances.size();
+
+            view = frame.view;
+            projection = frame.projection;
+
+            debug_group group("emitter billboards");
+
+            // The boxes give the billboards something to be hidden behind
+            bool const offscreen = particle_target.divisor() > 1;
+            if (offscreen)
+                particle_target.begin_scene();
+            scene.draw(view, projection);
+
+            particle_stream.begin_frame();
+            auto offset = particle_stream.write(instances.data(), instances.size() * sizeof(instances[0]));
+
+            glBindVertexArray(billboard_vao);
+            glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(instances[0]), reinterpret_cast<void *>(offset));
+
+            glUseProgram(billboard_program);
+            glUniformMatrix4fv(billboard_view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
+            glUniformMatrix4fv(billboard_projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
+            glUniform1i(billboard_texture_location, 0);
+
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, particle_texture);
+
+            // Full-resolution ones go after the composite, over the low-resolution ones whatever their depth
+            std::size_t const low_resolution_count = offscreen ? frame.low_resolution_count : 0;
+            if (low_resolution_count > 0)
+            {
+                particle_target.begin_particles();
+                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, low_resolution_count);
+                particle_target.composite(near, far);
+
+                glBindVertexArray(billboard_vao);
+                glUseProgram(billboard_program);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, particle_texture);
+                glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(instances[0]), reinterpret_cast<void *>(offset + low_resolution_count * sizeof(instances[0])));
+            }
+
+            // Blended particles are tested against the depth buffer but don't write to it
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            glDepthMask(GL_FALSE);
+
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, particle_count - low_resolution_count);
+
+            glDepthMask(GL_TRUE);
+            glDisable(GL_BLEND);
+
+            if (offscreen)
+                particle_target.present();
+            particle_stream.end_frame();
+
+            print_time += dt;
+            if (print_time >= 1.f)
+            {
+                auto const & stats = frame.stats;
+                std::cout << "particles: " << particle_count << ", emitters: " << stats.live_emitters
+                    << " (" << stats.throttled_emitters << " throttled, " << stats.dropped_emitters << " dropped, "
+                    << stats.recycled_emitters << " recycled this frame), update " << frame.update_time << " ms, separate " << frame.separate_time << " ms, sort " << frame.sort_time << " ms" << std::endl;
+                print_time = 0.f;
+            }
+        }
+        else
+        {
+            debug_group group("cpu particles");
+
+            particle_stream.begin_frame();
+            auto offset = particle_stream.write(particles.data(), particles.size() * sizeof(particle));
 
-        glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
-        glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
-        glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
-        glUniform3fv(camera_position_location, 1, reinterpret_cast<float *>(&camera_position));
+            // The data lands at a different offset every frame
+            glBindVertexArray(vao);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(particle), reinterpret_cast<void *>(offset));
 
-        glBindVertexArray(vao);
-        glDrawArrays(GL_POINTS, 0, particles.size());
+            glUseProgram(program);
+
+            glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
+            glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
+            glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
+            glUniform3fv(camera_position_location, 1, reinterpret_cast<float *>(&camera_position));
+
+            glDrawArrays(GL_POINTS, 0, particles.size());
+            particle_stream.end_frame();
+        }
+
+        replay.end_frame();
 
         SDL_GL_SwapWindow(window);
     }
 
+    replay.finish();
+    if (debug)
+        debug->print_summary(std::cout);
+
     SDL_GL_DeleteContext(gl_context);
     SDL_DestroyWindow(window);
 }
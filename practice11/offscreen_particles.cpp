@@ -0,0 +1,296 @@
+#include "offscreen_particles.hpp"
+#include "debug_output.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+
+    // One triangle over the whole target
+    const char fullscreen_vertex_shader_source[] =
+R"(#version 330 core
+
+void main()
+{
+    vec2 position = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 4.0 - 1.0;
+    gl_Position = vec4(position, 0.0, 1.0);
+}
+)";
+
+    // The furthest depth of each block: a particle behind only part of the block still shows
+    // over the rest, and the composite keeps it off the nearer part
+    const char downsample_fragment_shader_source[] =
+R"(#version 330 core
+
+uniform sampler2D scene_depth;
+uniform int divisor;
+
+void main()
+{
+    ivec2 base = ivec2(gl_FragCoord.xy) * divisor;
+    ivec2 last = textureSize(scene_depth, 0) - 1;
+
+    float depth = 0.0;
+    for (int y = 0; y < divisor; ++y)
+        for (int x = 0; x < divisor; ++x)
+            depth = max(depth, texelFetch(scene_depth, min(base + ivec2(x, y), last), 0).r);
+
+    gl_FragDepth = depth;
+}
+)";
+
+    const char composite_fragment_shader_source[] =
+R"(#version 330 core
+
+uniform sampler2D particle_color;
+uniform sampler2D particle_depth;
+uniform sampler2D scene_depth;
+uniform int divisor;
+uniform float near;
+uniform float far;
+
+layout (location = 0) out vec4 out_color;
+
+float linear_depth(float depth)
+{
+    float z = depth * 2.0 - 1.0;
+    return 2.0 * near * far / (far + near - z * (far - near));
+}
+
+void main()
+{
+    float depth = linear_depth(texelFetch(scene_depth, ivec2(gl_FragCoord.xy), 0).r);
+
+    // The four low-resolution texels around this pixel, as bilinear filtering would take them
+    vec2 position = gl_FragCoord.xy / float(divisor) - 0.5;
+    ivec2 base = ivec2(floor(position));
+    vec2 f = position - vec2(base);
+    ivec2 last = textureSize(particle_color, 0) - 1;
+
+    vec4 bilinear = vec4(0.0);
+    vec4 nearest = vec4(0.0, 0.0, 0.0, 1.0);
+    float nearest_difference = 1e30;
+    bool continuous = true;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 texel = clamp(base + offset, ivec2(0), last);
+        vec4 color = texelFetch(particle_color, texel, 0);
+        float difference = abs(linear_depth(texelFetch(particle_depth, texel, 0).r) - depth);
+
+        vec2 weights = mix(1.0 - f, f, vec2(offset));
+        bilinear += weights.x * weights.y * color;
+
+        if (difference < nearest_difference)
+        {
+            nearest_difference = difference;
+            nearest = color;
+        }
+        // A tenth of the distance is a different surface
+        if (difference > 0.1 * depth)
+            continuous = false;
+    }
+
+    out_color = continuous ? bilinear : nearest;
+}
+)";
+
+    void set_nearest(GLuint texture)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+}
+
+offscreen_particles::offscreen_particles(program_cache & programs, int width, int height)
+{
+    downsample_program_ = programs.get({{GL_VERTEX_SHADER, fullscreen_vertex_shader_source}, {GL_FRAGMENT_SHADER, downsample_fragment_shader_source}});
+    downsample_divisor_location_ = glGetUniformLocation(downsample_program_, "divisor");
+    glUseProgram(downsample_program_);
+    glUniform1i(glGetUniformLocation(downsample_program_, "scene_depth"), 0);
+
+    composite_program_ = programs.get({{GL_VERTEX_SHADER, fullscreen_vertex_shader_source}, {GL_FRAGMENT_SHADER, composite_fragment_shader_source}});
+    composite_divisor_location_ = glGetUniformLocation(composite_program_, "divisor");
+    composite_near_location_ = glGetUniformLocation(composite_program_, "near");
+    composite_far_location_ = glGetUniformLocation(composite_program_, "far");
+    glUseProgram(composite_program_);
+    glUniform1i(glGetUniformLocation(composite_program_, "particle_color"), 0);
+    glUniform1i(glGetUniformLocation(composite_program_, "particle_depth"), 1);
+    glUniform1i(glGetUniformLocation(composite_program_, "scene_depth"), 2);
+
+    glGenVertexArrays(1, &vao_);
+
+    glGenTextures(1, &scene_color_);
+    glGenTextures(1, &scene_depth_);
+    glGenTextures(1, &particle_color_);
+    glGenTextures(1, &particle_depth_);
+    for (GLuint texture : {scene_color_, scene_depth_, particle_color_, particle_depth_})
+        set_nearest(texture);
+
+    glGenFramebuffers(1, &scene_fbo_);
+    glGenFramebuffers(1, &particle_fbo_);
+
+    resize(width, height);
+
+    // Everything has been bound once by now
+    label_object(GL_PROGRAM, downsample_program_, "particle depth downsample");
+    label_object(GL_PROGRAM, composite_program_, "particle composite");
+    label_object(GL_TEXTURE, scene_color_, "particle scene color");
+    label_object(GL_TEXTURE, scene_depth_, "particle scene depth");
+    label_object(GL_TEXTURE, particle_color_, "low resolution particles");
+    label_object(GL_TEXTURE, particle_depth_, "low resolution particle depth");
+    label_object(GL_FRAMEBUFFER, scene_fbo_, "particle scene target");
+    label_object(GL_FRAMEBUFFER, particle_fbo_, "low resolution particle target");
+}
+
+offscreen_particles::~offscreen_particles()
+{
+    glDeleteFramebuffers(1, &particle_fbo_);
+    glDeleteFramebuffers(1, &scene_fbo_);
+    glDeleteTextures(1, &particle_depth_);
+    glDeleteTextures(1, &particle_color_);
+    glDeleteTextures(1, &scene_depth_);
+    glDeleteTextures(1, &scene_color_);
+    glDeleteVertexArrays(1, &vao_);
+}
+
+void offscreen_particles::resize(int width, int height)
+{
+    width_ = width;
+    height_ = height;
+
+    glBindTexture(GL_TEXTURE_2D, scene_color_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width_, height_, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, scene_depth_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width_, height_, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, scene_fbo_);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, scene_color_, 0);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, scene_depth_, 0);
+    if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        throw std::runtime_error("Particle scene framebuffer is incomplete");
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+    create_low_resolution_target();
+}
+
+void offscreen_particles::set_divisor(int divisor)
+{
+    if (divisor != 1 && divisor != 2 && divisor != 4)
+        throw std::runtime_error("Particles can only be drawn at full, half or quarter resolution");
+
+    divisor_ = divisor;
+    create_low_resolution_target();
+}
+
+void offscreen_particles::create_low_resolution_target()
+{
+    // Rounded up, so the last low-resolution texel covers the pixels left over
+    int const width = std::max(1, (width_ + divisor_ - 1) / divisor_);
+    int const height = std::max(1, (height_ + divisor_ - 1) / divisor_);
+
+    // Sums of premultiplied color that may go past 1 before the composite
+    glBindTexture(GL_TEXTURE_2D, particle_color_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, particle_depth_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, particle_fbo_);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, particle_color_, 0);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, particle_depth_, 0);
+    if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        throw std::runtime_error("Low resolution particle framebuffer is incomplete");
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+void offscreen_particles::begin_scene()
+{
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, scene_fbo_);
+    glViewport(0, 0, width_, height_);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void offscreen_particles::begin_particles()
+{
+    int const width = std::max(1, (width_ + divisor_ - 1) / divisor_);
+    int const height = std::max(1, (height_ + divisor_ - 1) / divisor_);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, particle_fbo_);
+    glViewport(0, 0, width, height);
+
+    {
+        debug_group group("particle depth downsample");
+
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_ALWAYS);
+        glDepthMask(GL_TRUE);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+        glUseProgram(downsample_program_);
+        glUniform1i(downsample_divisor_location_, divisor_);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, scene_depth_);
+
+        glBindVertexArray(vao_);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthFunc(GL_LESS);
+    }
+
+    // Nothing in front of the scene yet: no color, all of it let through
+    float const clear[4] = {0.f, 0.f, 0.f, 1.f};
+    glClearBufferfv(GL_COLOR, 0, clear);
+
+    // Color gathers a * color back to front as usual, alpha the product of every 1 - a
+    glDepthMask(GL_FALSE);
+    glEnable(GL_BLEND);
+    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+void offscreen_particles::composite(float near, float far)
+{
+    debug_group group("particle composite");
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, scene_fbo_);
+    glViewport(0, 0, width_, height_);
+
+    // Particles over the scene: their color plus what they let through of it
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_SRC_ALPHA);
+
+    glUseProgram(composite_program_);
+    glUniform1i(composite_divisor_location_, divisor_);
+    glUniform1f(composite_near_location_, near);
+    glUniform1f(composite_far_location_, far);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, particle_color_);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, particle_depth_);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, scene_depth_);
+    glActiveTexture(GL_TEXTURE0);
+
+    glBindVertexArray(vao_);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+}
+
+void offscreen_particles::present()
+{
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, scene_fbo_);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, width_, height_, 0, 0, width_, height_, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
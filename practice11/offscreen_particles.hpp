@@ -0,0 +1,69 @@
+#pragma once
+
+#include "program_cache.hpp"
+
+#include <GL/glew.h>
+
+// Blended particles at half or quarter resolution. The opaque scene is drawn into a target of
+// its own, whose depth is downsampled, keeping the furthest of each block of texels, for the
+// particles to be tested against at the lower resolution. They accumulate premultiplied color
+// and the transmittance of everything in front of the scene, and the composite lays that over
+// the scene, upsampling bilinearly where the four nearest low-resolution texels all lie at the
+// depth of the full-resolution one and taking the closest of them in depth where they do not,
+// so particles neither bleed over nor pull back from the edges of the geometry in front of them.
+struct offscreen_particles
+{
+    // The programs are owned by the cache
+    offscreen_particles(program_cache & programs, int width, int height);
+    ~offscreen_particles();
+
+    offscreen_particles(offscreen_particles const &) = delete;
+    offscreen_particles & operator = (offscreen_particles const &) = delete;
+
+    void resize(int width, int height);
+
+    // 1 leaves the particles to be drawn straight into the frame, 2 and 4 draw them at half and
+    // quarter resolution
+    int divisor() const { return divisor_; }
+    void set_divisor(int divisor);
+
+    // Binds and clears the full-resolution scene target
+    void begin_scene();
+
+    // Downsamples the scene depth, then binds and clears the low-resolution target with depth
+    // testing against it, no depth writes and the blending the accumulation needs
+    void begin_particles();
+
+    // Lays the particles over the scene target and leaves it bound at full resolution, with
+    // blending off, for anything drawn after them
+    void composite(float near, float far);
+
+    // Copies the scene target's color into the default framebuffer and binds it
+    void present();
+
+private:
+    void create_low_resolution_target();
+
+    int width_ = 0;
+    int height_ = 0;
+    int divisor_ = 2;
+
+    GLuint scene_fbo_ = 0;
+    GLuint scene_color_ = 0;
+    GLuint scene_depth_ = 0;
+
+    GLuint particle_fbo_ = 0;
+    GLuint particle_color_ = 0;
+    GLuint particle_depth_ = 0;
+
+    // Drawn from gl_VertexID alone
+    GLuint vao_ = 0;
+
+    GLuint downsample_program_ = 0;
+    GLint downsample_divisor_location_ = -1;
+
+    GLuint composite_program_ = 0;
+    GLint composite_divisor_location_ = -1;
+    GLint composite_near_location_ = -1;
+    GLint composite_far_location_ = -1;
+};
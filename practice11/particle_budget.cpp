@@ -0,0 +1,163 @@
+#include "particle_budget.hpp"
+
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+
+namespace
+{
+
+    // Bounds the cost of a query where particles bunch up, as they do where they are emitted
+    constexpr std::size_t max_neighbors = 32;
+
+    std::size_t round_up(std::size_t value, std::size_t multiple)
+    {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+}
+
+particle_budget::particle_budget(settings const & settings)
+    : settings_(settings)
+    , storage_(settings.slot_count * round_up(settings.slot_capacity, 8))
+{
+    settings_.slot_capacity = round_up(settings.slot_capacity, 8);
+
+    emitters_.reserve(settings_.slot_count);
+    for (std::size_t i = 0; i < settings_.slot_count; ++i)
+        emitters_.emplace_back(emitter_settings{}, particle_pool(storage_, i * settings_.slot_capacity, settings_.slot_capacity), 0);
+
+    live_.reserve(settings_.slot_count);
+    importance_.resize(settings_.slot_count);
+
+    // Reversed so that low slots are handed out first
+    for (std::size_t i = settings_.slot_count; i-- > 0;)
+        free_.push_back(i);
+}
+
+float particle_budget::importance(emitter_settings const & settings, glm::vec3 const & camera_position) const
+{
+    return settings.priority / std::max(1.f, glm::distance(settings.position, camera_position));
+}
+
+void particle_budget::release(handle slot)
+{
+    emitters_[slot].pool.clear();
+    free_.push_back(slot);
+}
+
+std::optional<particle_budget::handle> particle_budget::spawn(emitter_settings const & settings, glm::vec3 const & camera_position)
+{
+    if (free_.empty())
+    {
+        float const new_importance = importance(settings, camera_position);
+
+        std::optional<handle> victim;
+        float victim_importance = new_importance;
+        for (auto slot : live_)
+        {
+            float const value = importance(emitters_[slot].settings, camera_position);
+            if (value < victim_importance)
+            {
+                victim = slot;
+                victim_importance = value;
+            }
+        }
+
+        if (!victim)
+            return std::nullopt;
+
+        release(*victim);
+        std::erase(live_, *victim);
+        ++pending_stats_.dropped_emitters;
+    }
+
+    handle const slot = free_.back();
+    free_.pop_back();
+
+    auto & emitter = emitters_[slot];
+    emitter.settings = settings;
+    emitter.rng.seed(next_seed_++);
+    emitter.pending = 0.f;
+    emitter.elapsed = 0.f;
+    emitter.emission_scale = 1.f;
+    emitter.pool.clear();
+
+    live_.push_back(slot);
+
+    return slot;
+}
+
+void particle_budget::update(job_system & jobs, float dt, float gravity, glm::vec3 const & camera_position)
+{
+    for (auto slot : live_)
+        importance_[slot] = importance(emitters_[slot].settings, camera_position);
+    std::sort(live_.begin(), live_.end(), [this](handle a, handle b){ return importance_[a] > importance_[b]; });
+
+    // Hand out the budget by importance. An emitter running at full rate settles at rate * lifetime
+    // particles, or fewer if it stops emitting before then.
+    std::size_t throttled = 0;
+    float remaining = settings_.max_live_particles;
+    for (auto slot : live_)
+    {
+        auto & emitter = emitters_[slot];
+        float const emit_time = std::clamp(emitter.settings.duration - emitter.elapsed, 0.f, emitter.settings.lifetime);
+        float const expected = std::min<float>(std::max<float>(emitter.settings.rate * emit_time, emitter.pool.count()), settings_.slot_capacity);
+        emitter.emission_scale = (expected > 0.f) ? std::clamp(remaining / expected, 0.f, 1.f) : 1.f;
+        remaining = std::max(0.f, remaining - expected);
+        if (emitter.emission_scale < 1.f)
+            ++throttled;
+    }
+
+    jobs.parallel_for(live_.size(), [&](std::size_t i){ emitters_[live_[i]].update(dt, gravity); });
+
+    stats_ = pending_stats_;
+    pending_stats_ = {};
+    stats_.throttled_emitters = throttled;
+
+    std::erase_if(live_, [&](handle slot)
+    {
+        if (!emitters_[slot].finished())
+            return false;
+        release(slot);
+        ++stats_.recycled_emitters;
+        return true;
+    });
+
+    stats_.live_emitters = live_.size();
+    for (auto slot : live_)
+        stats_.live_particles += emitters_[slot].pool.count();
+}
+
+void particle_budget::separate(job_system & jobs, spatial_hash & grid, float strength, float dt)
+{
+    grid.build(jobs, emitters_);
+
+    // Walking the grid's order keeps neighboring queries on neighboring memory. Every particle
+    // is in it once, so each of them writes only its own velocity.
+    auto const & points = grid.points();
+    float const radius = grid.cell_size();
+    jobs.parallel_for(points.size(), 1024, [&](std::size_t begin, std::size_t end)
+    {
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            auto const & p = points[i];
+            glm::vec3 const position{p.x, p.y, p.z};
+
+            glm::vec3 push{0.f};
+            grid.for_each_neighbor(position, radius, max_neighbors, [&](spatial_hash::point const & q)
+            {
+                glm::vec3 const offset = position - glm::vec3{q.x, q.y, q.z};
+                float const distance = glm::length(offset);
+                // Which also skips the particle itself
+                if (distance > 0.f)
+                    push += offset * ((1.f - distance / radius) / distance);
+            });
+
+            auto const & pool = emitters_[p.emitter].pool;
+            pool.vx[p.particle] += push.x * strength * dt;
+            pool.vy[p.particle] += push.y * strength * dt;
+            pool.vz[p.particle] += push.z * strength * dt;
+        }
+    }, "separate");
+}
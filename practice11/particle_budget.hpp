@@ -0,0 +1,69 @@
+#pragma once
+
+#include "particle_pool.hpp"
+#include "spatial_hash.hpp"
+#include "job_system.hpp"
+
+#include <glm/vec3.hpp>
+
+#include <vector>
+#include <optional>
+#include <cstdint>
+
+// Hands out fixed-size slices of one preallocated particle_storage to short-lived emitters,
+// so spawning an effect never allocates. Finished emitters go back to a free list. Emitters
+// are ranked by priority over camera distance: when all slots are taken a more important
+// emitter evicts the least important one, and when their steady-state particle counts would
+// exceed the live budget the least important ones emit less or not at all.
+struct particle_budget
+{
+    struct settings
+    {
+        std::size_t slot_count = 256;
+        // Rounded up to a multiple of 8 particles
+        std::size_t slot_capacity = 4096;
+        std::size_t max_live_particles = 1 << 18;
+    };
+
+    struct frame_stats
+    {
+        std::size_t live_particles = 0;
+        std::size_t live_emitters = 0;
+        std::size_t throttled_emitters = 0;
+        std::size_t dropped_emitters = 0;
+        std::size_t recycled_emitters = 0;
+    };
+
+    using handle = std::uint32_t;
+
+    explicit particle_budget(settings const & settings);
+
+    // Returns nothing if every slot holds an emitter at least as important as this one
+    std::optional<handle> spawn(emitter_settings const & settings, glm::vec3 const & camera_position);
+
+    void update(job_system & jobs, float dt, float gravity, glm::vec3 const & camera_position);
+
+    // Rebuilds the grid over the live particles and pushes apart those closer than its cell
+    // size, harder the closer they are, as a cheap stand-in for the pressure of a fluid
+    void separate(job_system & jobs, spatial_hash & grid, float strength, float dt);
+
+    // Includes free slots, whose pools are empty
+    std::vector<particle_emitter> const & emitters() const { return emitters_; }
+
+    // Counts since the previous update(), live counts as of its end
+    frame_stats const & stats() const { return stats_; }
+
+private:
+    settings settings_;
+    particle_storage storage_;
+    std::vector<particle_emitter> emitters_;
+    std::vector<handle> free_;
+    std::vector<handle> live_;
+    std::vector<float> importance_;
+    unsigned int next_seed_ = 0;
+    frame_stats stats_;
+    frame_stats pending_stats_;
+
+    float importance(emitter_settings const & settings, glm::vec3 const & camera_position) const;
+    void release(handle slot);
+};
@@ -0,0 +1,182 @@
+#include "particle_pool.hpp"
+
+#include <glm/ext/scalar_constants.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define PARTICLES_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PARTICLES_SSE
+#endif
+
+namespace
+{
+
+    constexpr float bounce = 0.5f;
+    constexpr float growth = 0.02f;
+
+}
+
+particle_storage::particle_storage(std::size_t capacity)
+    : x(capacity), y(capacity), z(capacity)
+    , vx(capacity), vy(capacity), vz(capacity)
+    , age(capacity), size(capacity)
+{}
+
+particle_pool::particle_pool(particle_storage & storage, std::size_t first, std::size_t capacity)
+    : x(storage.x.data() + first), y(storage.y.data() + first), z(storage.z.data() + first)
+    , vx(storage.vx.data() + first), vy(storage.vy.data() + first), vz(storage.vz.data() + first)
+    , age(storage.age.data() + first), size(storage.size.data() + first)
+    , capacity_(capacity)
+{
+    if (first % 8 != 0 || first + capacity > storage.capacity())
+        throw std::runtime_error("Particle pool slice is misaligned or out of range");
+}
+
+void particle_pool::emit(std::size_t count, glm::vec3 const & origin, float speed, std::default_random_engine & rng)
+{
+    count = std::min(count, capacity() - count_);
+
+    std::uniform_real_distribution<float> angle_distribution{0.f, 2.f * glm::pi<float>()};
+    std::uniform_real_distribution<float> unit_distribution{0.f, 1.f};
+
+    for (std::size_t i = count_; i < count_ + count; ++i)
+    {
+        float const angle = angle_distribution(rng);
+        float const spread = 0.2f * std::sqrt(unit_distribution(rng));
+
+        x[i] = origin.x;
+        y[i] = origin.y;
+        z[i] = origin.z;
+        vx[i] = speed * spread * std::cos(angle);
+        vy[i] = speed * (1.f + 0.25f * unit_distribution(rng));
+        vz[i] = speed * spread * std::sin(angle);
+        age[i] = 0.f;
+        size[i] = 0.01f + 0.01f * unit_distribution(rng);
+    }
+
+    count_ += count;
+}
+
+void particle_pool::integrate(float dt, float gravity)
+{
+    std::size_t i = 0;
+
+#if defined(PARTICLES_AVX)
+    __m256 const dt8 = _mm256_set1_ps(dt);
+    __m256 const dv8 = _mm256_set1_ps(gravity * dt);
+    __m256 const growth8 = _mm256_set1_ps(growth * dt);
+    __m256 const bounce8 = _mm256_set1_ps(-bounce);
+    __m256 const zero = _mm256_setzero_ps();
+
+    for (; i + 8 <= count_; i += 8)
+    {
+        __m256 const vx8 = _mm256_load_ps(vx + i);
+        __m256 vy8 = _mm256_sub_ps(_mm256_load_ps(vy + i), dv8);
+        __m256 const vz8 = _mm256_load_ps(vz + i);
+
+        __m256 y8 = _mm256_add_ps(_mm256_load_ps(y + i), _mm256_mul_ps(vy8, dt8));
+
+        // Reflect the particles that went below the ground, losing some speed
+        __m256 const below = _mm256_cmp_ps(y8, zero, _CMP_LT_OQ);
+        y8 = _mm256_blendv_ps(y8, _mm256_sub_ps(zero, y8), below);
+        vy8 = _mm256_blendv_ps(vy8, _mm256_mul_ps(vy8, bounce8), below);
+
+        _mm256_store_ps(x + i, _mm256_add_ps(_mm256_load_ps(x + i), _mm256_mul_ps(vx8, dt8)));
+        _mm256_store_ps(y + i, y8);
+        _mm256_store_ps(z + i, _mm256_add_ps(_mm256_load_ps(z + i), _mm256_mul_ps(vz8, dt8)));
+        _mm256_store_ps(vy + i, vy8);
+        _mm256_store_ps(age + i, _mm256_add_ps(_mm256_load_ps(age + i), dt8));
+        _mm256_store_ps(size + i, _mm256_add_ps(_mm256_load_ps(size + i), growth8));
+    }
+#elif defined(PARTICLES_SSE)
+    __m128 const dt4 = _mm_set1_ps(dt);
+    __m128 const dv4 = _mm_set1_ps(gravity * dt);
+    __m128 const growth4 = _mm_set1_ps(growth * dt);
+    __m128 const bounce4 = _mm_set1_ps(-bounce);
+    __m128 const zero = _mm_setzero_ps();
+
+    for (; i + 4 <= count_; i += 4)
+    {
+        __m128 const vx4 = _mm_load_ps(vx + i);
+        __m128 vy4 = _mm_sub_ps(_mm_load_ps(vy + i), dv4);
+        __m128 const vz4 = _mm_load_ps(vz + i);
+
+        __m128 y4 = _mm_add_ps(_mm_load_ps(y + i), _mm_mul_ps(vy4, dt4));
+
+        // SSE2 has no blend, so select with masks
+        __m128 const below = _mm_cmplt_ps(y4, zero);
+        y4 = _mm_or_ps(_mm_andnot_ps(below, y4), _mm_and_ps(below, _mm_sub_ps(zero, y4)));
+        vy4 = _mm_or_ps(_mm_andnot_ps(below, vy4), _mm_and_ps(below, _mm_mul_ps(vy4, bounce4)));
+
+        _mm_store_ps(x + i, _mm_add_ps(_mm_load_ps(x + i), _mm_mul_ps(vx4, dt4)));
+        _mm_store_ps(y + i, y4);
+        _mm_store_ps(z + i, _mm_add_ps(_mm_load_ps(z + i), _mm_mul_ps(vz4, dt4)));
+        _mm_store_ps(vy + i, vy4);
+        _mm_store_ps(age + i, _mm_add_ps(_mm_load_ps(age + i), dt4));
+        _mm_store_ps(size + i, _mm_add_ps(_mm_load_ps(size + i), growth4));
+    }
+#endif
+
+    for (; i < count_; ++i)
+    {
+        vy[i] -= gravity * dt;
+        x[i] += vx[i] * dt;
+        y[i] += vy[i] * dt;
+        z[i] += vz[i] * dt;
+        if (y[i] < 0.f)
+        {
+            y[i] = -y[i];
+            vy[i] *= -bounce;
+        }
+        age[i] += dt;
+        size[i] += growth * dt;
+    }
+}
+
+void particle_pool::remove(std::size_t i)
+{
+    std::size_t const last = --count_;
+    x[i] = x[last];
+    y[i] = y[last];
+    z[i] = z[last];
+    vx[i] = vx[last];
+    vy[i] = vy[last];
+    vz[i] = vz[last];
+    age[i] = age[last];
+    size[i] = size[last];
+}
+
+void particle_pool::kill(float lifetime)
+{
+    // Walking backwards means a particle moved into slot i has already been checked
+    for (std::size_t i = count_; i-- > 0;)
+        if (age[i] >= lifetime)
+            remove(i);
+}
+
+particle_emitter::particle_emitter(emitter_settings const & settings, particle_pool const & pool, unsigned int seed)
+    : settings(settings)
+    , pool(pool)
+    , rng(seed)
+{}
+
+void particle_emitter::update(float dt, float gravity)
+{
+    pool.integrate(dt, gravity);
+    pool.kill(settings.lifetime);
+
+    elapsed += dt;
+    if (elapsed >= settings.duration)
+        return;
+
+    pending += settings.rate * emission_scale * dt;
+    auto const count = static_cast<std::size_t>(pending);
+    pending -= count;
+    pool.emit(count, settings.position, settings.speed, rng);
+}
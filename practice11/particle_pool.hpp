@@ -0,0 +1,107 @@
+#pragma once
+
+#include <glm/vec3.hpp>
+
+#include <vector>
+#include <random>
+#include <new>
+#include <limits>
+#include <cstddef>
+
+// Keeps vector storage on 32-byte boundaries so that AVX loads are aligned
+template <typename T>
+struct aligned_allocator
+{
+    using value_type = T;
+
+    static constexpr std::align_val_t alignment{32};
+
+    aligned_allocator() = default;
+
+    template <typename U>
+    aligned_allocator(aligned_allocator<U> const &) {}
+
+    T * allocate(std::size_t n) { return static_cast<T *>(::operator new(n * sizeof(T), alignment)); }
+    void deallocate(T * p, std::size_t) { ::operator delete(p, alignment); }
+
+    template <typename U>
+    bool operator == (aligned_allocator<U> const &) const { return true; }
+};
+
+using aligned_floats = std::vector<float, aligned_allocator<float>>;
+
+// SoA storage for particles: one array per component, all allocated up front
+struct particle_storage
+{
+    aligned_floats x, y, z;
+    aligned_floats vx, vy, vz;
+    aligned_floats age;
+    aligned_floats size;
+
+    explicit particle_storage(std::size_t capacity);
+
+    std::size_t capacity() const { return age.size(); }
+};
+
+// A slice of a particle_storage with the live particles packed at its front. The slice
+// has to start at a multiple of 8 particles so that SIMD loads stay aligned.
+struct particle_pool
+{
+    float * x, * y, * z;
+    float * vx, * vy, * vz;
+    float * age;
+    float * size;
+
+    particle_pool(particle_storage & storage, std::size_t first, std::size_t capacity);
+
+    std::size_t capacity() const { return capacity_; }
+    std::size_t count() const { return count_; }
+
+    void clear() { count_ = 0; }
+
+    // Adds up to count particles at origin, fewer if the pool is full
+    void emit(std::size_t count, glm::vec3 const & origin, float speed, std::default_random_engine & rng);
+
+    // Applies gravity, bounces particles off the y = 0 plane and ages them
+    void integrate(float dt, float gravity);
+
+    // Removes particles at least lifetime old by moving the last live particle into their slot
+    void kill(float lifetime);
+
+private:
+    std::size_t capacity_;
+    std::size_t count_ = 0;
+
+    void remove(std::size_t i);
+};
+
+struct emitter_settings
+{
+    glm::vec3 position;
+    float rate;
+    float lifetime;
+    float speed;
+    // Emits for this long, then lives on until its last particle expires
+    float duration = std::numeric_limits<float>::infinity();
+    float priority = 1.f;
+    // Drawn at full resolution even when the rest of the particles are not, for sharp sparks
+    bool full_resolution = false;
+};
+
+struct particle_emitter
+{
+    emitter_settings settings;
+    particle_pool pool;
+    std::default_random_engine rng;
+
+    float pending = 0.f;
+    float elapsed = 0.f;
+    // Fraction of settings.rate actually emitted, lowered when over the particle budget
+    float emission_scale = 1.f;
+
+    particle_emitter(emitter_settings const & settings, particle_pool const & pool, unsigned int seed);
+
+    bool finished() const { return elapsed >= settings.duration && pool.count() == 0; }
+
+    void update(float dt, float gravity);
+};
@@ -0,0 +1,145 @@
+#include "particle_sort.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <utility>
+
+namespace
+{
+
+    // Small arrays are not worth waking the other threads
+    constexpr std::size_t min_chunk_size = 4096;
+
+    // Maps floats to unsigned integers with the same order
+    std::uint32_t sortable_bits(float value)
+    {
+        auto const bits = std::bit_cast<std::uint32_t>(value);
+        return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+    }
+
+}
+
+void parallel_radix_sorter::sort(job_system & jobs, std::vector<std::uint32_t> & keys, std::vector<std::uint32_t> & values)
+{
+    std::size_t const count = keys.size();
+    std::size_t const chunk_count = std::clamp<std::size_t>(count / min_chunk_size, 1, jobs.thread_count());
+    std::size_t const chunk_size = (count + chunk_count - 1) / chunk_count;
+
+    keys_scratch_.resize(count);
+    values_scratch_.resize(count);
+    histograms_.resize(chunk_count);
+
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        jobs.parallel_for(chunk_count, [&](std::size_t chunk)
+        {
+            auto & histogram = histograms_[chunk];
+            histogram.fill(0);
+            std::size_t const end = std::min(count, (chunk + 1) * chunk_size);
+            for (std::size_t i = chunk * chunk_size; i < end; ++i)
+                ++histogram[(keys[i] >> shift) & 0xFF];
+        });
+
+        // Turn the counts into output offsets, digits major and chunks minor, so the sort stays stable
+        bool uniform = false;
+        std::uint32_t offset = 0;
+        for (std::size_t digit = 0; digit < 256; ++digit)
+        {
+            std::uint32_t digit_count = 0;
+            for (auto & histogram : histograms_)
+            {
+                auto const n = histogram[digit];
+                histogram[digit] = offset;
+                offset += n;
+                digit_count += n;
+            }
+            if (digit_count == count)
+                uniform = true;
+        }
+
+        if (uniform)
+            continue;
+
+        jobs.parallel_for(chunk_count, [&](std::size_t chunk)
+        {
+            auto & histogram = histograms_[chunk];
+            std::size_t const end = std::min(count, (chunk + 1) * chunk_size);
+            for (std::size_t i = chunk * chunk_size; i < end; ++i)
+            {
+                auto const position = histogram[(keys[i] >> shift) & 0xFF]++;
+                keys_scratch_[position] = keys[i];
+                values_scratch_[position] = values[i];
+            }
+        });
+
+        std::swap(keys, keys_scratch_);
+        std::swap(values, values_scratch_);
+    }
+}
+
+std::vector<billboard_sorter::instance> const & billboard_sorter::sort(job_system & jobs, glm::mat4 const & view, std::vector<particle_emitter> const & emitters)
+{
+    unsorted_.clear();
+    full_resolution_.clear();
+    for (auto const & emitter : emitters)
+    {
+        auto const & pool = emitter.pool;
+        for (std::size_t i = 0; i < pool.count(); ++i)
+            unsorted_.push_back({pool.x[i], pool.y[i], pool.z[i], pool.size[i]});
+        full_resolution_.insert(full_resolution_.end(), pool.count(), emitter.settings.full_resolution);
+    }
+
+    std::size_t const count = unsorted_.size();
+    std::size_t const chunk_count = std::clamp<std::size_t>(count / min_chunk_size, 1, jobs.thread_count());
+    std::size_t const chunk_size = (count + chunk_count - 1) / chunk_count;
+
+    keys_.resize(count);
+    order_.resize(count);
+    sorted_.resize(count);
+
+    // View space z is negative in front of the camera, so ascending z is back to front
+    glm::vec4 const row{view[0][2], view[1][2], view[2][2], view[3][2]};
+    jobs.parallel_for(chunk_count, [&](std::size_t chunk)
+    {
+        std::size_t const end = std::min(count, (chunk + 1) * chunk_size);
+        for (std::size_t i = chunk * chunk_size; i < end; ++i)
+        {
+            auto const & p = unsorted_[i];
+            keys_[i] = sortable_bits(row.x * p.x + row.y * p.y + row.z * p.z + row.w);
+            order_[i] = i;
+        }
+    });
+
+    sorter_.sort(jobs, keys_, order_);
+
+    // Splitting stably keeps both groups back to front: chunks count their full-resolution
+    // particles, a prefix sum gives every chunk its ranges in both groups, and chunks scatter
+    chunk_offsets_.resize(chunk_count);
+    jobs.parallel_for(chunk_count, [&](std::size_t chunk)
+    {
+        std::size_t const end = std::min(count, (chunk + 1) * chunk_size);
+        std::size_t full_resolution = 0;
+        for (std::size_t i = chunk * chunk_size; i < end; ++i)
+            full_resolution += full_resolution_[order_[i]];
+        chunk_offsets_[chunk] = {end - std::min(end, chunk * chunk_size) - full_resolution, full_resolution};
+    });
+
+    low_resolution_count_ = 0;
+    for (auto const & offsets : chunk_offsets_)
+        low_resolution_count_ += offsets[0];
+
+    std::array<std::size_t, 2> offset{0, low_resolution_count_};
+    for (auto & offsets : chunk_offsets_)
+        for (int group = 0; group < 2; ++group)
+            offset[group] += std::exchange(offsets[group], offset[group]);
+
+    jobs.parallel_for(chunk_count, [&](std::size_t chunk)
+    {
+        auto offsets = chunk_offsets_[chunk];
+        std::size_t const end = std::min(count, (chunk + 1) * chunk_size);
+        for (std::size_t i = chunk * chunk_size; i < end; ++i)
+            sorted_[offsets[full_resolution_[order_[i]]]++] = unsorted_[order_[i]];
+    });
+
+    return sorted_;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "particle_pool.hpp"
+#include "job_system.hpp"
+
+#include <glm/mat4x4.hpp>
+
+#include <vector>
+#include <array>
+#include <cstdint>
+
+// Sorts (key, value) pairs by key with an LSD radix sort, 8 bits per pass. Each pass is split
+// into one chunk per thread: chunks count their digits in parallel, a prefix sum over
+// (digit, chunk) gives every chunk its own output ranges, and chunks scatter in parallel.
+// Passes where every key has the same digit are skipped. Scratch memory is kept between calls.
+struct parallel_radix_sorter
+{
+    void sort(job_system & jobs, std::vector<std::uint32_t> & keys, std::vector<std::uint32_t> & values);
+
+private:
+    std::vector<std::uint32_t> keys_scratch_;
+    std::vector<std::uint32_t> values_scratch_;
+    std::vector<std::array<std::uint32_t, 256>> histograms_;
+};
+
+// Gathers the particles of all emitters into one instance array ordered back to front,
+// as alpha blending needs. The particles of emitters that stay at full resolution come after
+// the rest, back to front among themselves.
+struct billboard_sorter
+{
+    struct instance
+    {
+        float x, y, z;
+        float size;
+    };
+
+    std::vector<instance> const & sort(job_system & jobs, glm::mat4 const & view, std::vector<particle_emitter> const & emitters);
+
+    // Where the full-resolution particles of the last sort start
+    std::size_t low_resolution_count() const { return low_resolution_count_; }
+
+private:
+    parallel_radix_sorter sorter_;
+    std::vector<std::uint32_t> keys_;
+    std::vector<std::uint32_t> order_;
+    std::vector<instance> unsorted_;
+    std::vector<instance> sorted_;
+    std::vector<std::uint8_t> full_resolution_;
+    // Per chunk, where its low- and full-resolution particles go
+    std::vector<std::array<std::size_t, 2>> chunk_offsets_;
+    std::size_t low_resolution_count_ = 0;
+};
@@ -0,0 +1,58 @@
+#include "spatial_hash.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <atomic>
+#include <bit>
+
+spatial_hash::spatial_hash(float cell_size, std::size_t table_size)
+    : cell_size_(cell_size)
+    , inverse_cell_size_(1.f / cell_size)
+    , table_mask_(static_cast<std::uint32_t>(std::bit_ceil(table_size) - 1))
+    , cell_start_(table_mask_ + 2, 0)
+{}
+
+void spatial_hash::build(job_system & jobs, std::vector<particle_emitter> const & emitters)
+{
+    // Emitters are gathered in order, each at its own offset
+    emitter_offsets_.resize(emitters.size() + 1);
+    emitter_offsets_[0] = 0;
+    for (std::size_t e = 0; e < emitters.size(); ++e)
+        emitter_offsets_[e + 1] = emitter_offsets_[e] + emitters[e].pool.count();
+
+    std::size_t const count = emitter_offsets_.back();
+    buckets_.resize(count);
+    sorted_.resize(count);
+
+    // Bucket b counts into cell_start_[b + 1], so that the inclusive scan leaves cell_start_[b]
+    // at the first particle of b
+    std::fill(cell_start_.begin(), cell_start_.end(), 0);
+
+    jobs.parallel_for(emitters.size(), [&](std::size_t e)
+    {
+        auto const & pool = emitters[e].pool;
+        auto * buckets = buckets_.data() + emitter_offsets_[e];
+        for (std::size_t i = 0; i < pool.count(); ++i)
+        {
+            auto const bucket = hash(cell_coordinate(pool.x[i]), cell_coordinate(pool.y[i]), cell_coordinate(pool.z[i]));
+            buckets[i] = bucket;
+            std::atomic_ref<std::uint32_t>(cell_start_[bucket + 1]).fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+
+    // The table is small next to the particles, so it is scanned on this thread alone
+    std::inclusive_scan(cell_start_.begin(), cell_start_.end(), cell_start_.begin());
+    cell_cursor_.assign(cell_start_.begin(), cell_start_.end() - 1);
+
+    // Particles of one bucket land in whatever order the threads get to them
+    jobs.parallel_for(emitters.size(), [&](std::size_t e)
+    {
+        auto const & pool = emitters[e].pool;
+        auto const * buckets = buckets_.data() + emitter_offsets_[e];
+        for (std::size_t i = 0; i < pool.count(); ++i)
+        {
+            auto const position = std::atomic_ref<std::uint32_t>(cell_cursor_[buckets[i]]).fetch_add(1, std::memory_order_relaxed);
+            sorted_[position] = {pool.x[i], pool.y[i], pool.z[i], static_cast<std::uint32_t>(e), static_cast<std::uint32_t>(i)};
+        }
+    });
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "particle_pool.hpp"
+#include "job_system.hpp"
+
+#include <glm/vec3.hpp>
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+
+// A uniform grid over the particles of all emitters, hashed into a fixed table so that it
+// has no bounds. It is rebuilt from scratch every frame with a counting sort: particles count
+// themselves into their cells with atomic increments in parallel, a prefix sum over the table
+// turns the counts into where every cell starts, and particles scatter into a copy of their
+// positions ordered by cell, again in parallel. A neighbor query then reads the particles of
+// the 27 cells around a point from contiguous memory. Distinct cells can share a bucket, so
+// queries still check distances. Scratch memory is kept between builds.
+struct spatial_hash
+{
+    // Where a particle came from, so that results can be written back
+    struct point
+    {
+        float x, y, z;
+        std::uint32_t emitter;
+        std::uint32_t particle;
+    };
+
+    // Rounded up to a power of two
+    explicit spatial_hash(float cell_size, std::size_t table_size = 1 << 16);
+
+    float cell_size() const { return cell_size_; }
+
+    void build(job_system & jobs, std::vector<particle_emitter> const & emitters);
+
+    // Every particle of the last build, ordered by bucket
+    std::vector<point> const & points() const { return sorted_; }
+
+    // Calls visit(point) for at most max_count particles within radius of position, which must
+    // not exceed the cell size; the particle at position itself is visited too, and in the rare
+    // case that two of the cells around position share a bucket its particles are visited twice
+    template <typename Visit>
+    void for_each_neighbor(glm::vec3 const & position, float radius, std::size_t max_count, Visit && visit) const
+    {
+        int const cx = cell_coordinate(position.x);
+        int const cy = cell_coordinate(position.y);
+        int const cz = cell_coordinate(position.z);
+        float const radius2 = radius * radius;
+
+        for (int dz = -1; dz <= 1; ++dz)
+        for (int dy = -1; dy <= 1; ++dy)
+        for (int dx = -1; dx <= 1; ++dx)
+        {
+            auto const bucket = hash(cx + dx, cy + dy, cz + dz);
+            for (auto i = cell_start_[bucket]; i < cell_start_[bucket + 1]; ++i)
+            {
+                auto const & p = sorted_[i];
+                float const ox = p.x - position.x;
+                float const oy = p.y - position.y;
+                float const oz = p.z - position.z;
+                if (ox * ox + oy * oy + oz * oz > radius2)
+                    continue;
+                visit(p);
+                if (--max_count == 0)
+                    return;
+            }
+        }
+    }
+
+private:
+    float cell_size_;
+    float inverse_cell_size_;
+    std::uint32_t table_mask_;
+
+    // table size + 1 entries: bucket b holds sorted_[cell_start_[b], cell_start_[b + 1])
+    std::vector<std::uint32_t> cell_start_;
+    std::vector<std::uint32_t> cell_cursor_;
+    std::vector<std::uint32_t> buckets_;
+    std::vector<std::size_t> emitter_offsets_;
+    std::vector<point> sorted_;
+
+    int cell_coordinate(float value) const
+    {
+        return static_cast<int>(std::floor(value * inverse_cell_size_));
+    }
+
+    // The usual three large primes; wrapping signed coordinates to unsigned is intended
+    std::uint32_t hash(int x, int y, int z) const
+    {
+        return ((static_cast<std::uint32_t>(x) * 73856093u) ^ (static_cast<std::uint32_t>(y) * 19349663u) ^ (static_cast<std::uint32_t>(z) * 83492791u)) & table_mask_;
+    }
+};
@@ -0,0 +1,134 @@
+#include "ambient_volume.hpp"
+#include "light_volume.hpp"
+#include "compressed_volume.hpp"
+
+#include <glm/common.hpp>
+
+#include <cmath>
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+namespace
+{
+
+    constexpr char ambient_magic[4] = {'V', 'O', 'L', 'A'};
+    constexpr std::uint32_t ambient_version = 1;
+
+    // Followed by the voxels
+    struct ambient_header
+    {
+        char magic[4];
+        std::uint32_t version;
+        std::uint64_t source_size;
+        std::int64_t source_time;
+        std::int32_t size[3];
+        std::int32_t direction_count;
+        float voxel_size;
+        float absorption;
+    };
+
+    ambient_header make_header(std::filesystem::path const & dense_path, glm::ivec3 const & size, float voxel_size, float absorption, int direction_count)
+    {
+        auto const source = volume_source_path(dense_path);
+
+        ambient_header header{};
+        std::memcpy(header.magic, ambient_magic, sizeof(ambient_magic));
+        header.version = ambient_version;
+        header.source_size = std::filesystem::file_size(source);
+        header.source_time = std::filesystem::last_write_time(source).time_since_epoch().count();
+        for (int i = 0; i < 3; ++i)
+            header.size[i] = size[i];
+        header.direction_count = direction_count;
+        header.voxel_size = voxel_size;
+        header.absorption = absorption;
+        return header;
+    }
+
+    bool read_ambient(std::filesystem::path const & path, ambient_header const & expected, std::vector<std::uint8_t> & result)
+    {
+        std::error_code error;
+        if (!std::filesystem::is_regular_file(path, error))
+            return false;
+
+        std::ifstream input(path, std::ios::binary);
+        ambient_header header;
+        if (!input.read(reinterpret_cast<char *>(&header), sizeof(header)) || std::memcmp(&header, &expected, sizeof(header)) != 0)
+            return false;
+
+        result.resize(std::size_t(header.size[0]) * header.size[1] * header.size[2]);
+        if (!input.read(reinterpret_cast<char *>(result.data()), result.size()) || input.peek() != std::ifstream::traits_type::eof())
+            return false;
+        return true;
+    }
+
+}
+
+std::vector<std::uint8_t> build_ambient_volume(std::vector<float> const & density, glm::ivec3 const & size, float voxel_size, float absorption,
+    job_system & jobs, int direction_count)
+{
+    light_volume sweep(density, size, voxel_size, absorption);
+    std::vector<float> sum(density.size(), 0.f);
+
+    // A Fibonacci spiral from the zenith down to the horizon, equal solid angle per direction
+    float const golden_angle = 3.14159265f * (3.f - std::sqrt(5.f));
+    for (int i = 0; i < direction_count; ++i)
+    {
+        float const y = 1.f - (i + 0.5f) / direction_count;
+        float const r = std::sqrt(1.f - y * y);
+        float const phi = golden_angle * i;
+        sweep.build(jobs, glm::vec3(r * std::cos(phi), y, r * std::sin(phi)));
+
+        auto const & transmittance = sweep.transmittance();
+        jobs.parallel_for(size.z, [&](std::size_t z)
+        {
+            std::size_t const slice = std::size_t(size.x) * size.y;
+            for (std::size_t j = z * slice; j < (z + 1) * slice; ++j)
+                sum[j] += transmittance[j];
+        });
+    }
+
+    std::vector<std::uint8_t> result(density.size());
+    for (std::size_t i = 0; i < result.size(); ++i)
+        result[i] = std::uint8_t(glm::clamp(sum[i] / direction_count, 0.f, 1.f) * 255.f + 0.5f);
+    return result;
+}
+
+std::filesystem::path ambient_volume_path(std::filesystem::path const & dense_path)
+{
+    auto result = dense_path;
+    result += ".ambient";
+    return result;
+}
+
+std::vector<std::uint8_t> build_ambient_volume_cached(std::filesystem::path const & dense_path, std::vector<float> const & density,
+    glm::ivec3 const & size, float voxel_size, float absorption, job_system & jobs, int direction_count)
+{
+    auto const header = make_header(dense_path, size, voxel_size, absorption, direction_count);
+    auto const path = ambient_volume_path(dense_path);
+
+    std::vector<std::uint8_t> result;
+    if (read_ambient(path, header, result))
+        return result;
+
+    result = build_ambient_volume(density, size, voxel_size, absorption, jobs, direction_count);
+
+    // Same temporary-then-rename scheme as the sparse volume; the cache only saves time, so
+    // failing to write it is not an error
+    auto temp_path = path;
+    temp_path += ".tmp";
+    {
+        std::ofstream output(temp_path, std::ios::binary);
+        output.write(reinterpret_cast<char const *>(&header), sizeof(header));
+        output.write(reinterpret_cast<char const *>(result.data()), result.size());
+        if (!output)
+            return result;
+    }
+    std::error_code error;
+    std::filesystem::rename(temp_path, path, error);
+    if (error)
+        std::filesystem::remove(temp_path, error);
+
+    return result;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "job_system.hpp"
+
+#include <glm/vec3.hpp>
+
+#include <filesystem>
+#include <vector>
+#include <cstdint>
+
+// How much of the sky every voxel sees through the cloud: transmittance averaged over
+// direction_count directions spread evenly over the upper hemisphere. Every direction is one
+// light_volume sweep, linear in the voxel count, so even a few dozen directions over the
+// downsampled density take a fraction of a second. density is as downsample_density makes it;
+// voxel_size and absorption as for light_volume. In [0, 255], x fastest.
+std::vector<std::uint8_t> build_ambient_volume(std::vector<float> const & density, glm::ivec3 const & size, float voxel_size, float absorption,
+    job_system & jobs, int direction_count = 32);
+
+// Path of the ambient volume kept next to a dense .data volume
+std::filesystem::path ambient_volume_path(std::filesystem::path const & dense_path);
+
+// Reads the ambient volume of a dense .data volume, first building and writing it if it is
+// missing, or was built from another version of the source or with other parameters. Editing
+// the density only costs a rebuild at the next start, with no offline step. Without the .data
+// file its .data.lz copy stands in as the source.
+std::vector<std::uint8_t> build_ambient_volume_cached(std::filesystem::path const & dense_path, std::vector<float> const & density,
+    glm::ivec3 const & size, float voxel_size, float absorption, job_system & jobs, int direction_count = 32);
@@ -0,0 +1,143 @@
+#include "brick_cache.hpp"
+
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+brick_cache::brick_cache(sparse_volume const & volume, glm::ivec3 const & slot_grid)
+    : volume_(volume)
+    , slot_grid_(slot_grid)
+    , slots_(std::size_t(slot_grid.x) * slot_grid.y * slot_grid.z)
+    , brick_slots_(volume.brick_count(), -1)
+    , brick_cells_(volume.brick_count())
+{
+    auto const grid = volume_.grid_size();
+    page_table_.resize(std::size_t(grid.x) * grid.y * grid.z * 4, 0);
+    for (int z = 0; z < grid.z; ++z)
+        for (int y = 0; y < grid.y; ++y)
+            for (int x = 0; x < grid.x; ++x)
+                if (auto brick = volume_.brick_at({x, y, z}); brick != sparse_volume::empty_brick)
+                {
+                    brick_cells_[brick] = {x, y, z};
+                    set_page({x, y, z}, glm::ivec3(0), page_missing);
+                }
+
+    glm::ivec3 const atlas = atlas_size();
+    glGenTextures(1, &atlas_texture_);
+    glBindTexture(GL_TEXTURE_3D, atlas_texture_);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, atlas.x, atlas.y, atlas.z, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+
+    glGenTextures(1, &page_table_texture_);
+    glBindTexture(GL_TEXTURE_3D, page_table_texture_);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8UI, grid.x, grid.y, grid.z, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, page_table_.data());
+
+    glGenBuffers(1, &pixel_buffer_);
+}
+
+brick_cache::~brick_cache()
+{
+    glDeleteTextures(1, &atlas_texture_);
+    glDeleteTextures(1, &page_table_texture_);
+    glDeleteBuffers(1, &pixel_buffer_);
+}
+
+void brick_cache::set_page(glm::ivec3 const & cell, glm::ivec3 const & slot, page_state state)
+{
+    auto const grid = volume_.grid_size();
+    auto * entry = page_table_.data() + ((std::size_t(cell.z) * grid.y + cell.y) * grid.x + cell.x) * 4;
+    entry[0] = slot.x;
+    entry[1] = slot.y;
+    entry[2] = slot.z;
+    entry[3] = state;
+}
+
+void brick_cache::update(glm::vec3 const & camera_voxel, std::size_t max_uploads)
+{
+    ++frame_;
+
+    // The nearest bricks that fit are the ones wanted this frame
+    float const brick_size = volume_.brick_size();
+    by_distance_.resize(volume_.brick_count());
+    for (std::size_t i = 0; i < by_distance_.size(); ++i)
+        by_distance_[i] = i;
+    auto distance = [&](std::int32_t brick){ return glm::distance((glm::vec3(brick_cells_[brick]) + 0.5f) * brick_size, camera_voxel); };
+    std::sort(by_distance_.begin(), by_distance_.end(), [&](auto a, auto b){ return distance(a) < distance(b); });
+    by_distance_.resize(std::min(by_distance_.size(), slots_.size()));
+
+    for (auto brick : by_distance_)
+        if (auto s = brick_slots_[brick]; s >= 0)
+            slots_[s].last_used = frame_;
+
+    std::size_t const stored = volume_.stored_brick_size();
+    uploads_.clear();
+
+    for (auto brick : by_distance_)
+    {
+        if (uploads_.size() == max_uploads)
+            break;
+        if (brick_slots_[brick] >= 0)
+            continue;
+
+        // Free slots have never been used, so they come first as the least recent
+        auto victim = std::min_element(slots_.begin(), slots_.end(), [](slot const & a, slot const & b){ return a.last_used < b.last_used; });
+        if (victim->last_used == frame_)
+            break;
+
+        std::int32_t const index = victim - slots_.begin();
+        glm::ivec3 const slot_position{index % slot_grid_.x, index / slot_grid_.x % slot_grid_.y, index / (slot_grid_.x * slot_grid_.y)};
+
+        if (victim->brick != sparse_volume::empty_brick)
+        {
+            brick_slots_[victim->brick] = -1;
+            set_page(brick_cells_[victim->brick], glm::ivec3(0), page_missing);
+            --resident_count_;
+        }
+
+        uploads_.push_back({brick, slot_position * int(stored)});
+
+        victim->brick = brick;
+        victim->last_used = frame_;
+        brick_slots_[brick] = index;
+        set_page(brick_cells_[brick], slot_position, page_resident);
+        ++resident_count_;
+    }
+
+    if (uploads_.empty())
+        return;
+
+    // All of this frame's bricks share one orphaned buffer, so the driver never waits for the
+    // previous frame's copies; the bricks are read from the mapped file only by this memcpy
+    std::size_t const brick_bytes = stored * stored * stored;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer_);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, uploads_.size() * brick_bytes, nullptr, GL_STREAM_DRAW);
+    if (auto * mapped = static_cast<std::uint8_t *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, uploads_.size() * brick_bytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT)))
+    {
+        for (std::size_t i = 0; i < uploads_.size(); ++i)
+            std::memcpy(mapped + i * brick_bytes, volume_.brick_data(uploads_[i].brick), brick_bytes);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_3D, atlas_texture_);
+    for (std::size_t i = 0; i < uploads_.size(); ++i)
+    {
+        auto const & offset = uploads_[i].offset;
+        glTexSubImage3D(GL_TEXTURE_3D, 0, offset.x, offset.y, offset.z, stored, stored, stored, GL_RED, GL_UNSIGNED_BYTE,
+            reinterpret_cast<void const *>(i * brick_bytes));
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    // The page table is a few hundred bytes, so it is simplest to upload it whole
+    auto const grid = volume_.grid_size();
+    glBindTexture(GL_TEXTURE_3D, page_table_texture_);
+    glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, grid.x, grid.y, grid.z, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, page_table_.data());
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "sparse_volume.hpp"
+
+#include <GL/glew.h>
+
+#include <glm/vec3.hpp>
+
+#include <vector>
+#include <cstdint>
+
+// Keeps the bricks of a sparse_volume nearest to the camera in a fixed-size 3D texture atlas
+// of slot_grid slots, evicting the least recently wanted ones. A page table texture maps each
+// brick cell to its slot: rgb is the slot, a is one of the page_state values.
+// Bricks go from the memory-mapped file straight into a pixel unpack buffer and from there
+// to the atlas, so the driver copies them to the GPU without the frame waiting on it.
+struct brick_cache
+{
+    enum page_state : std::uint8_t
+    {
+        page_empty = 0,
+        page_missing = 1,
+        page_resident = 2,
+    };
+
+    brick_cache(sparse_volume const & volume, glm::ivec3 const & slot_grid = {4, 4, 2});
+    ~brick_cache();
+
+    brick_cache(brick_cache const &) = delete;
+    brick_cache & operator = (brick_cache const &) = delete;
+
+    // camera_voxel is the camera position in voxel coordinates of the volume.
+    // Uploads at most max_uploads missing bricks, so streaming is spread over frames.
+    void update(glm::vec3 const & camera_voxel, std::size_t max_uploads = 4);
+
+    GLuint atlas_texture() const { return atlas_texture_; }
+    GLuint page_table_texture() const { return page_table_texture_; }
+    glm::ivec3 atlas_size() const { return slot_grid_ * int(volume_.stored_brick_size()); }
+
+    std::size_t slot_count() const { return slots_.size(); }
+    std::size_t resident_count() const { return resident_count_; }
+
+private:
+    struct slot
+    {
+        std::int32_t brick = sparse_volume::empty_brick;
+        std::uint64_t last_used = 0;
+    };
+
+    struct upload
+    {
+        std::int32_t brick;
+        glm::ivec3 offset;
+    };
+
+    sparse_volume const & volume_;
+    glm::ivec3 slot_grid_;
+
+    std::vector<slot> slots_;
+    // Slot of every stored brick, or -1
+    std::vector<std::int32_t> brick_slots_;
+    // Cell of every stored brick
+    std::vector<glm::ivec3> brick_cells_;
+    std::vector<std::int32_t> by_distance_;
+    std::vector<std::uint8_t> page_table_;
+    std::vector<upload> uploads_;
+    std::size_t resident_count_ = 0;
+    std::uint64_t frame_ = 0;
+
+    GLuint atlas_texture_ = 0;
+    GLuint page_table_texture_ = 0;
+    GLuint pixel_buffer_ = 0;
+
+    void set_page(glm::ivec3 const & cell, glm::ivec3 const & slot, page_state state);
+};
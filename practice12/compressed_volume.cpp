@@ -0,0 +1,267 @@
+#include "compressed_volume.hpp"
+#include "lz_block.hpp"
+
+#include <glm/common.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+namespace
+{
+
+    constexpr char volume_magic[4] = {'V', 'O', 'L', 'Z'};
+    constexpr std::uint32_t volume_version = 1;
+
+    // Followed by one record per brick, x fastest, then the brick payloads
+    struct volume_header
+    {
+        char magic[4];
+        std::uint32_t version;
+        std::uint64_t source_size;
+        std::int64_t source_time;
+        std::int32_t volume_size[3];
+        std::int32_t brick_size;
+        std::uint64_t payload_size;
+    };
+
+    glm::ivec3 grid_size(glm::ivec3 const & volume_size, int brick_size)
+    {
+        return (volume_size + brick_size - 1) / brick_size;
+    }
+
+    // Bricks at the far edges are cut to the volume
+    glm::ivec3 brick_extent(glm::ivec3 const & cell, glm::ivec3 const & volume_size, int brick_size)
+    {
+        return glm::min(volume_size - cell * brick_size, glm::ivec3(brick_size));
+    }
+
+    volume_header read_header(mapped_file const & file, std::filesystem::path const & path)
+    {
+        volume_header header;
+        if (file.size() < sizeof(header))
+            throw std::runtime_error("Bad compressed volume " + path.string());
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, volume_magic, sizeof(volume_magic)) != 0 || header.version != volume_version || header.brick_size <= 0)
+            throw std::runtime_error("Bad compressed volume " + path.string());
+        return header;
+    }
+
+    void set_source(volume_header & header, std::filesystem::path const & dense_path)
+    {
+        header.source_size = std::filesystem::file_size(dense_path);
+        header.source_time = std::filesystem::last_write_time(dense_path).time_since_epoch().count();
+    }
+
+    bool is_current(std::filesystem::path const & path, std::filesystem::path const & dense_path, glm::ivec3 const & volume_size)
+    {
+        std::error_code error;
+        if (!std::filesystem::is_regular_file(path, error))
+            return false;
+
+        mapped_file file(path);
+        if (file.size() < sizeof(volume_header))
+            return false;
+
+        volume_header header;
+        std::memcpy(&header, file.data(), sizeof(header));
+
+        volume_header expected{};
+        set_source(expected, dense_path);
+
+        return std::memcmp(header.magic, volume_magic, sizeof(volume_magic)) == 0
+            && header.version == volume_version
+            && header.source_size == expected.source_size
+            && header.source_time == expected.source_time
+            && glm::ivec3(header.volume_size[0], header.volume_size[1], header.volume_size[2]) == volume_size;
+    }
+
+    void write_volume(std::filesystem::path const & path, volume_header header, std::vector<std::uint8_t> const & density, glm::ivec3 const & volume_size, int brick_size)
+    {
+        if (density.size() != std::size_t(volume_size.x) * volume_size.y * volume_size.z)
+            throw std::runtime_error("Volume size does not match its data");
+
+        std::memcpy(header.magic, volume_magic, sizeof(volume_magic));
+        header.version = volume_version;
+        for (int i = 0; i < 3; ++i)
+            header.volume_size[i] = volume_size[i];
+        header.brick_size = brick_size;
+
+        glm::ivec3 const grid = grid_size(volume_size, brick_size);
+
+        std::vector<compressed_volume::brick_record> records;
+        std::vector<std::uint8_t> payload;
+        std::vector<std::uint8_t> brick;
+
+        for (int bz = 0; bz < grid.z; ++bz)
+            for (int by = 0; by < grid.y; ++by)
+                for (int bx = 0; bx < grid.x; ++bx)
+                {
+                    glm::ivec3 const cell{bx, by, bz};
+                    glm::ivec3 const origin = cell * brick_size;
+                    glm::ivec3 const extent = brick_extent(cell, volume_size, brick_size);
+
+                    brick.clear();
+                    for (int z = 0; z < extent.z; ++z)
+                        for (int y = 0; y < extent.y; ++y)
+                        {
+                            auto const row = density.begin() + (std::size_t(origin.z + z) * volume_size.y + origin.y + y) * volume_size.x + origin.x;
+                            brick.insert(brick.end(), row, row + extent.x);
+                        }
+
+                    auto const [min, max] = std::minmax_element(brick.begin(), brick.end());
+                    compressed_volume::brick_record r{std::uint32_t(payload.size()), 0, *min, *max, 0};
+
+                    if (r.min != r.max)
+                    {
+                        // Relative values take fewer distinct bytes than the originals, which the LZ stage likes
+                        for (auto & value : brick)
+                            value -= r.min;
+
+                        auto const compressed = lz_compress(brick.data(), brick.size());
+                        auto const & stored = (compressed.size() < brick.size()) ? compressed : brick;
+                        r.size = stored.size();
+                        payload.insert(payload.end(), stored.begin(), stored.end());
+                    }
+
+                    records.push_back(r);
+                }
+
+        header.payload_size = payload.size();
+
+        // Same temporary-then-rename scheme as the other caches
+        auto temp_path = path;
+        temp_path += ".tmp";
+        {
+            std::ofstream output(temp_path, std::ios::binary);
+            output.write(reinterpret_cast<char const *>(&header), sizeof(header));
+            output.write(reinterpret_cast<char const *>(records.data()), records.size() * sizeof(records[0]));
+            output.write(reinterpret_cast<char const *>(payload.data()), payload.size());
+            if (!output)
+                throw std::runtime_error("Failed to write " + temp_path.string());
+        }
+        std::filesystem::rename(temp_path, path);
+    }
+
+}
+
+compressed_volume::compressed_volume(std::filesystem::path const & path)
+    : file_(path)
+{
+    auto const header = read_header(file_, path);
+
+    volume_size_ = {header.volume_size[0], header.volume_size[1], header.volume_size[2]};
+    brick_size_ = header.brick_size;
+    grid_size_ = grid_size(volume_size_, brick_size_);
+    payload_size_ = header.payload_size;
+
+    std::size_t const record_count = std::size_t(grid_size_.x) * grid_size_.y * grid_size_.z;
+    if (file_.size() != sizeof(header) + record_count * sizeof(brick_record) + payload_size_)
+        throw std::runtime_error("Bad compressed volume " + path.string());
+
+    // The header and records are multiples of 4 bytes, so the records are aligned
+    bricks_ = reinterpret_cast<brick_record const *>(file_.data() + sizeof(header));
+    payload_ = reinterpret_cast<std::uint8_t const *>(file_.data() + sizeof(header) + record_count * sizeof(brick_record));
+
+    for (std::size_t i = 0; i < record_count; ++i)
+        if (bricks_[i].offset > payload_size_ || bricks_[i].size > payload_size_ - bricks_[i].offset)
+            throw std::runtime_error("Bad compressed volume " + path.string());
+}
+
+std::vector<std::uint8_t> compressed_volume::decode(job_system & jobs) const
+{
+    std::vector<std::uint8_t> result(std::size_t(volume_size_.x) * volume_size_.y * volume_size_.z);
+
+    // One job per z-slab of bricks, so each job's output is one contiguous range and the
+    // mapped payload is read roughly in order
+    jobs.parallel_for(grid_size_.z, [&](std::size_t bz)
+    {
+        std::vector<std::uint8_t> brick(std::size_t(brick_size_) * brick_size_ * brick_size_);
+
+        for (int by = 0; by < grid_size_.y; ++by)
+            for (int bx = 0; bx < grid_size_.x; ++bx)
+            {
+                glm::ivec3 const cell{bx, by, int(bz)};
+                glm::ivec3 const origin = cell * brick_size_;
+                glm::ivec3 const extent = brick_extent(cell, volume_size_, brick_size_);
+                std::size_t const size = std::size_t(extent.x) * extent.y * extent.z;
+                auto const & record = bricks_[(std::size_t(cell.z) * grid_size_.y + cell.y) * grid_size_.x + cell.x];
+
+                if (record.size == 0)
+                {
+                    for (int z = 0; z < extent.z; ++z)
+                        for (int y = 0; y < extent.y; ++y)
+                            std::memset(result.data() + (std::size_t(origin.z + z) * volume_size_.y + origin.y + y) * volume_size_.x + origin.x, record.min, extent.x);
+                    continue;
+                }
+
+                std::uint8_t const * values = payload_ + record.offset;
+                if (record.size != size)
+                {
+                    lz_decompress(values, record.size, brick.data(), size);
+                    values = brick.data();
+                }
+
+                for (int z = 0; z < extent.z; ++z)
+                    for (int y = 0; y < extent.y; ++y)
+                    {
+                        std::uint8_t * row = result.data() + (std::size_t(origin.z + z) * volume_size_.y + origin.y + y) * volume_size_.x + origin.x;
+                        if (record.min == 0)
+                            std::memcpy(row, values, extent.x);
+                        else
+                            for (int x = 0; x < extent.x; ++x)
+                                row[x] = values[x] + record.min;
+                        values += extent.x;
+                    }
+            }
+    });
+
+    return result;
+}
+
+void write_compressed_volume(std::filesystem::path const & path, std::vector<std::uint8_t> const & density, glm::ivec3 const & volume_size, int brick_size)
+{
+    write_volume(path, volume_header{}, density, volume_size, brick_size);
+}
+
+std::filesystem::path compressed_volume_path(std::filesystem::path const & dense_path)
+{
+    auto result = dense_path;
+    result += ".lz";
+    return result;
+}
+
+std::filesystem::path volume_source_path(std::filesystem::path const & dense_path)
+{
+    std::error_code error;
+    return std::filesystem::is_regular_file(dense_path, error) ? dense_path : compressed_volume_path(dense_path);
+}
+
+std::vector<std::uint8_t> load_volume_compressed_cached(std::filesystem::path const & dense_path, glm::ivec3 const & volume_size, job_system & jobs)
+{
+    auto const path = compressed_volume_path(dense_path);
+
+    std::error_code error;
+    if (std::filesystem::is_regular_file(dense_path, error) && !is_current(path, dense_path, volume_size))
+    {
+        std::vector<std::uint8_t> density(std::size_t(volume_size.x) * volume_size.y * volume_size.z);
+        {
+            std::ifstream input(dense_path, std::ios::binary);
+            input.read(reinterpret_cast<char *>(density.data()), density.size());
+            if (!input)
+                throw std::runtime_error("Failed to read " + dense_path.string());
+        }
+
+        volume_header header{};
+        set_source(header, dense_path);
+        write_volume(path, header, density, volume_size, 32);
+        return density;
+    }
+
+    compressed_volume const volume(path);
+    if (volume.volume_size() != volume_size)
+        throw std::runtime_error("Unexpected size of " + path.string());
+    return volume.decode(jobs);
+}
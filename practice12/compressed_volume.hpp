@@ -0,0 +1,61 @@
+#pragma once
+
+#include "job_system.hpp"
+#include "mapped_file.hpp"
+
+#include <glm/vec3.hpp>
+
+#include <filesystem>
+#include <vector>
+#include <cstdint>
+
+// An 8-bit density volume split into bricks that are compressed independently, so they
+// decode in parallel. Each brick stores its value range and the values relative to the
+// range minimum, LZ-compressed; uniform bricks, like the empty ones, store nothing else.
+struct compressed_volume
+{
+    explicit compressed_volume(std::filesystem::path const & path);
+
+    glm::ivec3 volume_size() const { return volume_size_; }
+    int brick_size() const { return brick_size_; }
+
+    // Bytes on disk, header included
+    std::size_t compressed_size() const { return file_.size(); }
+
+    struct brick_record
+    {
+        std::uint32_t offset;
+        // 0 for a uniform brick, the raw size if compression did not pay off
+        std::uint32_t size;
+        std::uint8_t min;
+        std::uint8_t max;
+        std::uint16_t padding;
+    };
+
+    // The whole volume, x fastest, ready for glTexImage3D
+    std::vector<std::uint8_t> decode(job_system & jobs) const;
+
+private:
+    mapped_file file_;
+    glm::ivec3 volume_size_;
+    glm::ivec3 grid_size_;
+    int brick_size_;
+    brick_record const * bricks_;
+    std::uint8_t const * payload_;
+    std::size_t payload_size_;
+};
+
+// Compresses a dense volume, x fastest
+void write_compressed_volume(std::filesystem::path const & path, std::vector<std::uint8_t> const & density, glm::ivec3 const & volume_size, int brick_size = 32);
+
+// Path of the compressed file kept next to a dense .data volume
+std::filesystem::path compressed_volume_path(std::filesystem::path const & dense_path);
+
+// The file a volume is read from: the dense one, or without it the compressed copy that
+// load_volume_compressed_cached then reads instead. Caches built from the volume are stamped
+// with its size and time.
+std::filesystem::path volume_source_path(std::filesystem::path const & dense_path);
+
+// Decodes the compressed version of a dense volume, first writing it if it is missing or
+// older than the dense file. Without the dense file, the compressed one is used as is.
+std::vector<std::uint8_t> load_volume_compressed_cached(std::filesystem::path const & dense_path, glm::ivec3 const & volume_size, job_system & jobs);
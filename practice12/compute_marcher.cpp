@@ -0,0 +1,369 @@
+#include "compute_marcher.hpp"
+
+#include <glm/matrix.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <string>
+
+namespace
+{
+
+    constexpr int tile_size = 8;
+    // Queued rays a group of the later segments marches
+    constexpr int queue_group_size = 64;
+    // Steps a ray takes in every segment but the last, and the number of segments; a ray
+    // crossing the whole bbox takes step_count (256) base steps at most
+    constexpr int segment_steps = 32;
+    constexpr int segment_count = 8;
+
+    // Queue header, matches the buffers below: the indirect dispatch arguments, then the count
+    constexpr std::size_t queue_header_size = 4 * sizeof(GLuint);
+    // Pixel, distance, cloud distance, and color and transmittance as four halves
+    constexpr std::size_t queued_ray_size = 5 * sizeof(GLuint);
+
+    const char cull_shader_source[] =
+R"(#version 430 core
+
+layout (local_size_x = 4, local_size_y = 4, local_size_z = 4) in;
+
+uniform sampler3D occupancy_texture;
+uniform mat4 view_projection;
+uniform vec3 bbox_min;
+uniform vec3 bbox_max;
+uniform ivec3 volume_size;
+uniform int brick_size;
+uniform ivec2 march_size;
+
+layout (std430, binding = 0) buffer tile_buffer
+{
+    uint all_tiles;
+    uint tile_mask[];
+};
+
+void main()
+{
+    ivec3 cell = ivec3(gl_GlobalInvocationID);
+    if (any(greaterThanEqual(cell, textureSize(occupancy_texture, 0))))
+        return;
+    if (texelFetch(occupancy_texture, cell, 0).r == 0.0)
+        return;
+
+    // Occupancy covers the voxels next to the brick too, so its box is the brick's own
+    vec3 brick_extent = (bbox_max - bbox_min) * float(brick_size) / vec3(volume_size);
+    vec3 box_min = bbox_min + vec3(cell) * brick_extent;
+    vec3 box_max = min(box_min + brick_extent, bbox_max);
+
+    vec2 screen_min = vec2(1e30);
+    vec2 screen_max = vec2(-1e30);
+    for (int i = 0; i < 8; ++i)
+    {
+        vec3 corner = mix(box_min, box_max, vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+        vec4 clip = view_projection * vec4(corner, 1.0);
+        // Behind the camera the rectangle is unbounded
+        if (clip.w <= 1e-4)
+        {
+            all_tiles = 1u;
+            return;
+        }
+        vec2 pixel = (clip.xy / clip.w * 0.5 + 0.5) * vec2(march_size);
+        screen_min = min(screen_min, pixel);
+        screen_max = max(screen_max, pixel);
+    }
+
+    if (any(lessThan(screen_max, vec2(0.0))) || any(greaterThanEqual(screen_min, vec2(march_size))))
+        return;
+
+    ivec2 tiles = (march_size + 7) / 8;
+    ivec2 first = clamp(ivec2(floor(screen_min)) / 8, ivec2(0), tiles - 1);
+    ivec2 last = clamp(ivec2(floor(screen_max)) / 8, ivec2(0), tiles - 1);
+    for (int y = first.y; y <= last.y; ++y)
+        for (int x = first.x; x <= last.x; ++x)
+            tile_mask[y * tiles.x + x] = 1u;
+}
+)";
+
+    const char march_shader_source[] =
+R"(
+layout (local_size_x = 8, local_size_y = 8) in;
+
+uniform mat4 inverse_view_projection;
+uniform ivec2 march_size;
+// Segment 0 starts the rays of every tile, the others go on with the queued ones
+uniform int segment;
+uniform int step_budget;
+
+layout (binding = 0, rgba16f) writeonly uniform image2D color_image;
+layout (binding = 1, rg32f) writeonly uniform image2D depth_image;
+
+layout (std430, binding = 0) readonly buffer tile_buffer
+{
+    uint all_tiles;
+    uint tile_mask[];
+};
+
+struct queued_ray
+{
+    uint pixel;
+    float s;
+    float cloud_distance;
+    uint color_rg;
+    uint color_b_transmittance;
+};
+
+layout (std430, binding = 1) readonly buffer input_queue
+{
+    uint input_groups_x, input_groups_y, input_groups_z;
+    uint input_count;
+    queued_ray input_rays[];
+};
+
+layout (std430, binding = 2) buffer output_queue
+{
+    uint output_groups_x, output_groups_y, output_groups_z;
+    uint output_count;
+    queued_ray output_rays[];
+};
+
+vec3 ray_direction(ivec2 pixel)
+{
+    vec2 ndc = (vec2(pixel) + 0.5) / vec2(march_size) * 2.0 - 1.0;
+    vec4 far_point = inverse_view_projection * vec4(ndc, 1.0, 1.0);
+    return normalize(far_point.xyz / far_point.w - camera_position);
+}
+
+void store(ivec2 pixel, vec4 color, vec2 depth)
+{
+    imageStore(color_image, pixel, color);
+    imageStore(depth_image, pixel, vec4(depth, 0.0, 0.0));
+}
+
+void main()
+{
+    ivec2 pixel;
+    march_state state;
+    if (segment == 0)
+    {
+        pixel = ivec2(gl_GlobalInvocationID.xy);
+        if (any(greaterThanEqual(pixel, march_size)))
+            return;
+    }
+    else
+    {
+        uint index = gl_WorkGroupID.x * 64u + gl_LocalInvocationIndex;
+        if (index >= input_count)
+            return;
+        queued_ray ray = input_rays[index];
+        pixel = ivec2(ray.pixel & 0xffffu, ray.pixel >> 16);
+        vec2 rg = unpackHalf2x16(ray.color_rg);
+        vec2 ba = unpackHalf2x16(ray.color_b_transmittance);
+        state = march_state(ray.s, ba.y, vec3(rg, ba.x), ray.cloud_distance);
+    }
+
+    vec3 direction = ray_direction(pixel);
+    vec2 t = march_range(direction);
+
+    if (segment == 0)
+    {
+        // What the rasterized cube leaves: nothing where it is not drawn, and an empty march
+        // where no ray sample has any density
+        if (t.x >= t.y)
+        {
+            store(pixel, vec4(0.0), vec2(0.0));
+            return;
+        }
+        ivec2 tiles = (march_size + 7) / 8;
+        if (all_tiles == 0u && tile_mask[(pixel.y / 8) * tiles.x + pixel.x / 8] == 0u)
+        {
+            store(pixel, vec4(0.0), vec2(0.0, t.x));
+            return;
+        }
+        state = start_march(t, vec2(pixel) + 0.5);
+    }
+
+    if (march(state, direction, t.y, step_budget))
+    {
+        vec4 color;
+        vec2 depth;
+        finish_march(state, t.x, color, depth);
+        store(pixel, color, depth);
+        return;
+    }
+
+    uint index = atomicAdd(output_count, 1u);
+    output_rays[index] = queued_ray(uint(pixel.x) | (uint(pixel.y) << 16), state.s, state.cloud_distance,
+        packHalf2x16(state.color.rg), packHalf2x16(vec2(state.color.b, state.transmittance)));
+}
+)";
+
+    // Turns the rays appended to the output queue into its dispatch, and empties the input
+    // queue for the segment after next
+    const char queue_shader_source[] =
+R"(#version 430 core
+
+layout (local_size_x = 1) in;
+
+layout (std430, binding = 1) buffer input_queue
+{
+    uint input_groups_x, input_groups_y, input_groups_z;
+    uint input_count;
+};
+
+layout (std430, binding = 2) buffer output_queue
+{
+    uint output_groups_x, output_groups_y, output_groups_z;
+    uint output_count;
+};
+
+void main()
+{
+    output_groups_x = (output_count + 63u) / 64u;
+    output_groups_y = 1u;
+    output_groups_z = 1u;
+    input_count = 0u;
+}
+)";
+
+    const char fullscreen_vertex_shader_source[] =
+R"(#version 330 core
+
+const vec2 vertices[3] = vec2[3](vec2(-1.0, -1.0), vec2(3.0, -1.0), vec2(-1.0, 3.0));
+
+void main()
+{
+    gl_Position = vec4(vertices[gl_VertexID], 0.0, 1.0);
+}
+)";
+
+    const char blend_fragment_shader_source[] =
+R"(#version 330 core
+
+uniform sampler2D volume_color;
+
+layout (location = 0) out vec4 out_color;
+
+void main()
+{
+    out_color = texelFetch(volume_color, ivec2(gl_FragCoord.xy), 0);
+}
+)";
+
+}
+
+compute_marcher::compute_marcher(program_cache & programs, char const * march_source)
+{
+    cull_program_ = programs.get({{GL_COMPUTE_SHADER, cull_shader_source}});
+    march_program_ = programs.get({{GL_COMPUTE_SHADER, std::string("#version 430 core\n") + march_source + march_shader_source}});
+    queue_program_ = programs.get({{GL_COMPUTE_SHADER, queue_shader_source}});
+    blend_program_ = programs.get({{GL_VERTEX_SHADER, fullscreen_vertex_shader_source}, {GL_FRAGMENT_SHADER, blend_fragment_shader_source}});
+
+    glGenBuffers(1, &tile_buffer_);
+    glGenBuffers(2, queue_buffers_);
+    glGenVertexArrays(1, &fullscreen_vao_);
+}
+
+compute_marcher::~compute_marcher()
+{
+    glDeleteVertexArrays(1, &fullscreen_vao_);
+    glDeleteBuffers(2, queue_buffers_);
+    glDeleteBuffers(1, &tile_buffer_);
+}
+
+void compute_marcher::resize(glm::ivec2 const & size)
+{
+    size_ = size;
+    tiles_ = (size + tile_size - 1) / tile_size;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, tile_buffer_);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (1 + std::size_t(tiles_.x) * tiles_.y) * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+    // Every ray may be left after the first segment; the queues start and end every frame empty
+    GLuint const empty_header[4] = {0, 1, 1, 0};
+    for (GLuint buffer : queue_buffers_)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, queue_header_size + std::size_t(size.x) * size.y * queued_ray_size, nullptr, GL_DYNAMIC_COPY);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(empty_header), empty_header);
+    }
+}
+
+void compute_marcher::march(glm::ivec2 const & size, GLuint color_texture, GLuint depth_texture, glm::mat4 const & view_projection,
+    GLuint occupancy_texture, glm::vec3 const & bbox_min, glm::vec3 const & bbox_max, glm::ivec3 const & volume_size, int brick_size)
+{
+    if (size != size_)
+        resize(size);
+
+    glm::ivec3 const grid_size = (volume_size + brick_size - 1) / brick_size;
+
+    GLuint const zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, tile_buffer_);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, tile_buffer_);
+
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_3D, occupancy_texture);
+
+    glUseProgram(cull_program_);
+    glUniform1i(glGetUniformLocation(cull_program_, "occupancy_texture"), 6);
+    glUniformMatrix4fv(glGetUniformLocation(cull_program_, "view_projection"), 1, GL_FALSE, glm::value_ptr(view_projection));
+    glUniform3fv(glGetUniformLocation(cull_program_, "bbox_min"), 1, glm::value_ptr(bbox_min));
+    glUniform3fv(glGetUniformLocation(cull_program_, "bbox_max"), 1, glm::value_ptr(bbox_max));
+    glUniform3iv(glGetUniformLocation(cull_program_, "volume_size"), 1, glm::value_ptr(volume_size));
+    glUniform1i(glGetUniformLocation(cull_program_, "brick_size"), brick_size);
+    glUniform2iv(glGetUniformLocation(cull_program_, "march_size"), 1, glm::value_ptr(size));
+    glDispatchCompute((grid_size.x + 3) / 4, (grid_size.y + 3) / 4, (grid_size.z + 3) / 4);
+
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glBindImageTexture(0, color_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    glBindImageTexture(1, depth_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG32F);
+
+    glm::mat4 const inverse_view_projection = glm::inverse(view_projection);
+    glUseProgram(march_program_);
+    glUniformMatrix4fv(glGetUniformLocation(march_program_, "inverse_view_projection"), 1, GL_FALSE, glm::value_ptr(inverse_view_projection));
+    glUniform2iv(glGetUniformLocation(march_program_, "march_size"), 1, glm::value_ptr(size));
+    GLint const segment_location = glGetUniformLocation(march_program_, "segment");
+    GLint const step_budget_location = glGetUniformLocation(march_program_, "step_budget");
+
+    int input = 1;
+    for (int segment = 0; segment < segment_count; ++segment)
+    {
+        int const output = 1 - input;
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, queue_buffers_[input]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, queue_buffers_[output]);
+
+        glUseProgram(march_program_);
+        glUniform1i(segment_location, segment);
+        glUniform1i(step_budget_location, (segment + 1 < segment_count) ? segment_steps : -1);
+        if (segment == 0)
+            glDispatchCompute(tiles_.x, tiles_.y, 1);
+        else
+        {
+            glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, queue_buffers_[input]);
+            glDispatchComputeIndirect(0);
+        }
+
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        glUseProgram(queue_program_);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+        input = output;
+    }
+
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void compute_marcher::blend(GLuint color_texture)
+{
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glDisable(GL_CULL_FACE);
+
+    glUseProgram(blend_program_);
+    glUniform1i(glGetUniformLocation(blend_program_, "volume_color"), 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, color_texture);
+
+    glBindVertexArray(fullscreen_vao_);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "program_cache.hpp"
+
+#include <GL/glew.h>
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+// Marches the volume in compute shaders instead of over the rasterized bounding cube, so that
+// rays which are done stop taking up lanes next to the ones that are not:
+//  - every occupied brick of the occupancy grid marks the 8x8 tiles its screen rectangle covers,
+//  - every tile marches its pixels for one segment of steps, or just writes the empty result
+//    when no brick covers it,
+//  - rays that are neither opaque nor out of the volume after a segment are appended to a
+//    queue, which the next segment marches densely packed, 64 rays to a group, dispatched
+//    indirectly with as many groups as there are rays left.
+// The last segment marches what is left to the end. Needs GL 4.3.
+struct compute_marcher
+{
+    static bool supported() { return GLEW_VERSION_4_3; }
+
+    // march_source is the shared march code and its uniforms, without a #version line.
+    // The programs are owned by the cache
+    compute_marcher(program_cache & programs, char const * march_source);
+    ~compute_marcher();
+
+    compute_marcher(compute_marcher const &) = delete;
+    compute_marcher & operator = (compute_marcher const &) = delete;
+
+    // The march uniforms of march_source are set on this one before march()
+    GLuint march_program() const { return march_program_; }
+
+    // Writes premultiplied color into color_texture (RGBA16F) and the two depth channels into
+    // depth_texture (RG32F), size texels each, as temporal_volume's march framebuffer holds
+    // them. view_projection includes the jitter of this frame. Uses the textures bound for
+    // march_source, plus unit 6 for culling, and ends with the barrier for sampling the results.
+    void march(glm::ivec2 const & size, GLuint color_texture, GLuint depth_texture, glm::mat4 const & view_projection,
+        GLuint occupancy_texture, glm::vec3 const & bbox_min, glm::vec3 const & bbox_max, glm::ivec3 const & volume_size, int brick_size);
+
+    // Blends a march over the bound framebuffer with premultiplied alpha, texel for pixel, for
+    // marching at the full resolution
+    void blend(GLuint color_texture);
+
+private:
+    void resize(glm::ivec2 const & size);
+
+    glm::ivec2 size_{0};
+    glm::ivec2 tiles_{0};
+
+    GLuint cull_program_ = 0;
+    GLuint march_program_ = 0;
+    GLuint queue_program_ = 0;
+    GLuint blend_program_ = 0;
+
+    // A flag for the whole screen, then one per tile
+    GLuint tile_buffer_ = 0;
+    // Ping-pong: a segment reads one and appends to the other
+    GLuint queue_buffers_[2] = {0, 0};
+
+    GLuint fullscreen_vao_ = 0;
+};
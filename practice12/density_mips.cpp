@@ -0,0 +1,60 @@
+#include "density_mips.hpp"
+#include "light_volume.hpp"
+
+#include <glm/common.hpp>
+
+#include <algorithm>
+
+namespace
+{
+
+    // Children of target texel i along an axis of size child_size; the last texel also takes
+    // the odd one out, since the halved size rounds down
+    int child_begin(int i) { return 2 * i; }
+    int child_end(int i, int size, int child_size) { return (i + 1 == size) ? child_size : 2 * i + 2; }
+
+    std::vector<float> halve(std::vector<float> const & source, glm::ivec3 const & source_size, glm::ivec3 const & size, job_system & jobs)
+    {
+        std::vector<float> result(std::size_t(size.x) * size.y * size.z);
+
+        jobs.parallel_for(size.z, [&](std::size_t z)
+        {
+            for (int y = 0; y < size.y; ++y)
+                for (int x = 0; x < size.x; ++x)
+                {
+                    float sum = 0.f;
+                    int count = 0;
+                    for (int sz = child_begin(z); sz < child_end(z, size.z, source_size.z); ++sz)
+                        for (int sy = child_begin(y); sy < child_end(y, size.y, source_size.y); ++sy)
+                            for (int sx = child_begin(x); sx < child_end(x, size.x, source_size.x); ++sx)
+                            {
+                                sum += source[(std::size_t(sz) * source_size.y + sy) * source_size.x + sx];
+                                ++count;
+                            }
+                    result[(z * size.y + y) * size.x + x] = sum / count;
+                }
+        });
+
+        return result;
+    }
+
+}
+
+density_mips build_density_mips(sparse_volume const & volume, job_system & jobs)
+{
+    density_mips result;
+
+    glm::ivec3 size;
+    result.levels.push_back(downsample_density(volume, 2, size, jobs));
+    result.sizes.push_back(size);
+
+    while (size != glm::ivec3(1))
+    {
+        glm::ivec3 const next = glm::max(size / 2, glm::ivec3(1));
+        result.levels.push_back(halve(result.levels.back(), size, next, jobs));
+        result.sizes.push_back(next);
+        size = next;
+    }
+
+    return result;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "sparse_volume.hpp"
+#include "job_system.hpp"
+
+#include <glm/vec3.hpp>
+
+#include <vector>
+
+// Lower resolutions of a sparse_volume's density for samples too far away to resolve single
+// voxels, laid out as the levels of one mipmapped 3D texture. Level 0 averages 2^3 voxel
+// blocks and every next level averages 2^3 blocks of the previous one, with sizes halved
+// (rounding down, as GL expects) until every axis is one voxel. Averaging, unlike the maximum
+// the occupancy grid keeps, leaves the optical depth of a step about what the full-resolution
+// voxels it covers would give.
+struct density_mips
+{
+    std::vector<glm::ivec3> sizes;
+    // In [0, 1], x fastest
+    std::vector<std::vector<float>> levels;
+};
+
+// Every level is split into slices across the job system
+density_mips build_density_mips(sparse_volume const & volume, job_system & jobs);
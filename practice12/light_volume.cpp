@@ -0,0 +1,124 @@
+#include "light_volume.hpp"
+
+#include <glm/common.hpp>
+
+#include <cmath>
+#include <utility>
+#include <algorithm>
+
+std::vector<float> downsample_density(sparse_volume const & volume, int factor, glm::ivec3 & size, job_system & jobs)
+{
+    auto const volume_size = volume.volume_size();
+    size = (volume_size + factor - 1) / factor;
+
+    std::vector<float> result(std::size_t(size.x) * size.y * size.z, 0.f);
+    std::vector<int> counts(result.size(), 0);
+
+    int const brick_size = volume.brick_size();
+    std::size_t const stored = volume.stored_brick_size();
+
+    // Every target slice only reads its own factor source slices, so slices don't share targets
+    jobs.parallel_for(size.z, [&](std::size_t target_z)
+    {
+        int const z_end = std::min<int>((target_z + 1) * factor, volume_size.z);
+        for (int z = target_z * factor; z < z_end; ++z)
+            for (int y = 0; y < volume_size.y; ++y)
+                for (int x = 0; x < volume_size.x; ++x)
+                {
+                    std::size_t const target = (target_z * size.y + y / factor) * size.x + x / factor;
+                    ++counts[target];
+
+                    glm::ivec3 const voxel{x, y, z};
+                    glm::ivec3 const cell = voxel / brick_size;
+                    auto const brick = volume.brick_at(cell);
+                    if (brick == sparse_volume::empty_brick)
+                        continue;
+
+                    glm::ivec3 const local = voxel - cell * brick_size + sparse_volume::apron;
+                    result[target] += volume.brick_data(brick)[(local.z * stored + local.y) * stored + local.x] / 255.f;
+                }
+    });
+
+    for (std::size_t i = 0; i < result.size(); ++i)
+        result[i] /= counts[i];
+
+    return result;
+}
+
+light_volume::light_volume(std::vector<float> density, glm::ivec3 const & size, float voxel_size, float absorption)
+    : density_(std::move(density))
+    , size_(size)
+    , voxel_size_(voxel_size)
+    , absorption_(absorption)
+    , transmittance_(density_.size(), 1.f)
+{}
+
+void light_volume::build(job_system & jobs, glm::vec3 const & light_direction)
+{
+    // a is the axis the sweep goes along, b and c span the slices
+    int a = 0;
+    for (int i = 1; i < 3; ++i)
+        if (std::abs(light_direction[i]) > std::abs(light_direction[a]))
+            a = i;
+    int const b = (a + 1) % 3;
+    int const c = (a + 2) % 3;
+
+    float const la = std::abs(light_direction[a]);
+    int const toward_light = (light_direction[a] > 0.f) ? 1 : -1;
+
+    // Moving one slice towards the light shifts b and c by this much, in voxels
+    float const shift_b = light_direction[b] / la;
+    float const shift_c = light_direction[c] / la;
+    float const step_optical_depth = absorption_ * voxel_size_ / la;
+
+    glm::ivec3 stride{1, size_.x, size_.x * size_.y};
+
+    auto at = [&](std::vector<float> const & values, int k, int i, int j)
+    {
+        return values[std::size_t(k) * stride[a] + std::size_t(i) * stride[b] + std::size_t(j) * stride[c]];
+    };
+
+    // Bilinear lookup in slice k; outside the volume nothing is in the way of the light
+    auto sample = [&](std::vector<float> const & values, int k, float i, float j, float outside)
+    {
+        int const i0 = std::floor(i);
+        int const j0 = std::floor(j);
+        float const fi = i - i0;
+        float const fj = j - j0;
+
+        auto fetch = [&](int ii, int jj)
+        {
+            if (ii < 0 || jj < 0 || ii >= size_[b] || jj >= size_[c])
+                return outside;
+            return at(values, k, ii, jj);
+        };
+
+        return glm::mix(glm::mix(fetch(i0, j0), fetch(i0 + 1, j0), fi), glm::mix(fetch(i0, j0 + 1), fetch(i0 + 1, j0 + 1), fi), fj);
+    };
+
+    int const first = (toward_light > 0) ? size_[a] - 1 : 0;
+    for (int k = first; k >= 0 && k < size_[a]; k -= toward_light)
+    {
+        int const previous = k + toward_light;
+        bool const has_previous = previous >= 0 && previous < size_[a];
+
+        jobs.parallel_for(size_[b], [&](std::size_t i)
+        {
+            for (int j = 0; j < size_[c]; ++j)
+            {
+                std::size_t const index = std::size_t(k) * stride[a] + i * stride[b] + std::size_t(j) * stride[c];
+
+                float upstream_transmittance = 1.f;
+                float upstream_density = 0.f;
+                if (has_previous)
+                {
+                    upstream_transmittance = sample(transmittance_, previous, i + shift_b, j + shift_c, 1.f);
+                    upstream_density = sample(density_, previous, i + shift_b, j + shift_c, 0.f);
+                }
+
+                float const density = (density_[index] + upstream_density) * 0.5f;
+                transmittance_[index] = upstream_transmittance * std::exp(-step_optical_depth * density);
+            }
+        });
+    }
+}
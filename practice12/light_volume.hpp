@@ -0,0 +1,37 @@
+#pragma once
+
+#include "sparse_volume.hpp"
+#include "job_system.hpp"
+
+#include <glm/vec3.hpp>
+
+#include <vector>
+
+// Density averaged over factor^3 voxel blocks, in [0, 1], x fastest. Light varies slowly
+// through a cloud, so the light volume doesn't need the full resolution. Slices are split
+// across the job system.
+std::vector<float> downsample_density(sparse_volume const & volume, int factor, glm::ivec3 & size, job_system & jobs);
+
+// Transmittance from every voxel towards a directional light, for a density grid whose
+// voxels are voxel_size world units wide. Rather than marching from every voxel, it sweeps
+// slices along the light's dominant axis: each voxel takes the interpolated transmittance
+// one slice closer to the light and attenuates it by the density in between, which is
+// linear in the voxel count. Slices are split into rows across the job system.
+struct light_volume
+{
+    light_volume(std::vector<float> density, glm::ivec3 const & size, float voxel_size, float absorption);
+
+    glm::ivec3 size() const { return size_; }
+
+    // light_direction points towards the light
+    void build(job_system & jobs, glm::vec3 const & light_direction);
+
+    std::vector<float> const & transmittance() const { return transmittance_; }
+
+private:
+    std::vector<float> density_;
+    glm::ivec3 size_;
+    float voxel_size_;
+    float absorption_;
+    std::vector<float> transmittance_;
+};
@@ -14,8 +14,10 @@
 #include <chrono>
 #include <vector>
 #include <random>
-#include <map>
 #include <cmath>
+#include <algorithm>
+#include <memory>
+#include <limits>
 
 #define GLM_FORCE_SWIZZLE
 #define GLM_ENABLE_EXPERIMENTAL
@@ -29,6 +31,19 @@
 
 #include "obj_parser.hpp"
 #include "stb_image.h"
+#include "occupancy_grid.hpp"
+#include "sparse_volume.hpp"
+#include "brick_cache.hpp"
+#include "light_volume.hpp"
+#include "ambient_volume.hpp"
+#include "compute_marcher.hpp"
+#include "temporal_volume.hpp"
+#include "density_mips.hpp"
+#include "volume_set.hpp"
+#include "dynamic_resolution_target.hpp"
+#include "program_cache.hpp"
+#include "input_state.hpp"
+#include "replay_session.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -65,15 +80,32 @@ void main()
 }
 )";
 
-const char fragment_shader_source[] =
-R"(#version 330 core
-
+// The march shared by the fragment shader and the compute marcher, without a #version line
+// so that either can put its own in front
+const char march_source[] =
+R"(
 uniform vec3 camera_position;
 uniform vec3 light_direction;
 uniform vec3 bbox_min;
 uniform vec3 bbox_max;
 
-layout (location = 0) out vec4 out_color;
+uniform sampler3D atlas_texture;
+uniform usampler3D page_table;
+uniform ivec3 atlas_size;
+uniform int page_brick_size;
+uniform sampler3D occupancy_texture;
+uniform sampler3D light_texture;
+uniform sampler3D ambient_texture;
+uniform bool ambient_occlusion;
+uniform ivec3 volume_size;
+uniform int brick_size;
+uniform bool skip_empty;
+uniform int frame;
+// Averaged mips of the density, level 0 at half resolution
+uniform sampler3D mips_texture;
+uniform float mips_max_level;
+// Angle one march pixel spans; zero marches everything at full resolution
+uniform float pixel_angle;
 
 void sort(inout float x, inout float y)
 {
@@ -109,18 +141,372 @@ vec2 intersect_bbox(vec3 origin, vec3 direction)
 
 const float PI = 3.1415926535;
 
+const float absorption = 10.0;
+const float step_count = 256.0;
+// Steps grow with the level of detail, up to this many times the base step
+const float max_step_scale = 8.0;
+// Level of detail added on top of the distance one once the ray is fully opaque: what lies
+// behind dense cloud is seen through little transmittance, so coarser samples do there
+const float opacity_lod_bias = 2.0;
+const vec3 light_color = vec3(16.0);
+const vec3 ambient_light = vec3(0.6, 0.8, 1.0);
+
+// Bricks that are empty or not streamed in yet read as zero
+float atlas_density_at(vec3 p)
+{
+    vec3 voxel = (p - bbox_min) / (bbox_max - bbox_min) * vec3(volume_size);
+    ivec3 page_grid_size = textureSize(page_table, 0);
+    ivec3 cell = clamp(ivec3(floor(voxel / float(page_brick_size))), ivec3(0), page_grid_size - 1);
+
+    uvec4 page = texelFetch(page_table, cell, 0);
+    if (page.a != 2u)
+        return 0.0;
+
+    // Slots store their brick with a one-voxel apron
+    vec3 atlas_voxel = vec3(page.xyz) * float(page_brick_size + 2) + 1.0 + (voxel - vec3(cell * page_brick_size));
+    return textureLod(atlas_texture, atlas_voxel / vec3(atlas_size), 0.0).r;
+}
+
+// lod 0 is full resolution from the atlas, lod 1 + i is mip i, and between 0 and 1 the two
+// are blended. The mips cover every brick, streamed or not.
+float density_at(vec3 p, float lod)
+{
+    if (lod >= 1.0)
+        return textureLod(mips_texture, (p - bbox_min) / (bbox_max - bbox_min), min(lod - 1.0, mips_max_level)).r;
+
+    float density = atlas_density_at(p);
+    if (lod > 0.0)
+        density = mix(density, textureLod(mips_texture, (p - bbox_min) / (bbox_max - bbox_min), 0.0).r, lod);
+    return density;
+}
+
+// Where a ray from the camera is inside the bbox, empty when x >= y
+vec2 march_range(vec3 direction)
+{
+    vec2 t = intersect_bbox(camera_position, direction);
+    t.x = max(t.x, 0.0);
+    return t;
+}
+
+float march_base_step()
+{
+    return length(bbox_max - bbox_min) / step_count;
+}
+
+// Jittering the start trades banding for noise; changing it every frame lets the temporal pass average it away
+float march_jitter(vec2 frag_coord)
+{
+    return fract(sin(dot(frag_coord, vec2(12.9898, 78.233))) * 43758.5453 + float(frame) * 0.618034);
+}
+
+struct march_state
+{
+    // Distance of the next sample along the ray
+    float s;
+    float transmittance;
+    vec3 color;
+    // Transmittance-weighted, divided by the opacity at the end
+    float cloud_distance;
+};
+
+march_state start_march(vec2 t, vec2 frag_coord)
+{
+    return march_state(t.x + march_jitter(frag_coord) * march_base_step(), 1.0, vec3(0.0), 0.0);
+}
+
+// Takes at most step_budget steps, a negative one meaning no limit, and tells whether the ray
+// is done, i.e. has left the bbox or become opaque; otherwise it can go on from state later
+bool march(inout march_state state, vec3 direction, float t_exit, int step_budget)
+{
+    vec3 extent = bbox_max - bbox_min;
+    vec3 brick_extent = extent * float(brick_size) / vec3(volume_size);
+    ivec3 grid_size = (volume_size + brick_size - 1) / brick_size;
+
+    float base_dt = march_base_step();
+    float voxel_extent = extent.x / float(volume_size.x);
+
+    float dt = base_dt;
+    for (; state.s < t_exit; state.s += dt)
+    {
+        if (step_budget-- == 0)
+            return false;
+
+        float s = state.s;
+        vec3 p = camera_position + s * direction;
+
+        // The level where a voxel covers about one pixel, coarser behind what is already opaque
+        float lod = 0.0;
+        if (pixel_angle > 0.0)
+            lod = max(0.0, log2(s * pixel_angle / voxel_extent)) + opacity_lod_bias * (1.0 - state.transmittance);
+        dt = base_dt * min(exp2(lod), max_step_scale);
+
+        if (skip_empty)
+        {
+            ivec3 brick = clamp(ivec3((p - bbox_min) / brick_extent), ivec3(0), grid_size - 1);
+            if (texelFetch(occupancy_texture, brick, 0).r == 0.0)
+            {
+                // Jump to the last step before the brick exit, staying on the same sample grid,
+                // so the image is exactly the one without skipping (as long as the step is fixed)
+                vec3 brick_min = bbox_min + vec3(brick) * brick_extent;
+                vec3 tmin = (brick_min - camera_position) / direction;
+                vec3 tmax = (brick_min + brick_extent - camera_position) / direction;
+                float exit = vmin(max(tmin, tmax));
+                state.s += max(0.0, ceil((exit - s) / dt) - 1.0) * dt;
+                continue;
+            }
+        }
+
+        float density = density_at(p, lod);
+        if (density == 0.0)
+            continue;
+
+        float light_transmittance = textureLod(light_texture, (p - bbox_min) / extent, 0.0).r;
+        float sky_visibility = ambient_occlusion ? textureLod(ambient_texture, (p - bbox_min) / extent, 0.0).r : 1.0;
+        vec3 in_light = light_color * light_transmittance / (4.0 * PI) + ambient_light * sky_visibility;
+
+        float step_transmittance = exp(-absorption * density * dt);
+        state.color += state.transmittance * (1.0 - step_transmittance) * in_light;
+        state.cloud_distance += state.transmittance * (1.0 - step_transmittance) * s;
+        state.transmittance *= step_transmittance;
+
+        // Anything further contributes too little to see
+        if (state.transmittance < 0.01)
+            return true;
+    }
+    return true;
+}
+
+// Premultiplied color, and the march's two depth channels
+void finish_march(march_state state, float t_entry, out vec4 color, out vec2 depth)
+{
+    float alpha = 1.0 - state.transmittance;
+    color = vec4(state.color, alpha);
+    depth = vec2(alpha > 1e-4 ? state.cloud_distance / alpha : 0.0, t_entry);
+}
+)";
+
+const char fragment_shader_source[] =
+R"(
 in vec3 position;
 
+// Premultiplied, so that reduced-resolution results can be filtered and blended
+layout (location = 0) out vec4 out_color;
+// Transmittance-weighted distance of the cloud and where the ray enters the bbox, for reprojection and upsampling
+layout (location = 1) out vec2 out_depth;
+
+void main()
+{
+    vec3 direction = normalize(position - camera_position);
+    vec2 t = march_range(direction);
+
+    march_state state = start_march(t, gl_FragCoord.xy);
+    march(state, direction, t.y, -1);
+    finish_march(state, t.x, out_color, out_depth);
+}
+)";
+
+const char volumes_vertex_shader_source[] =
+R"(#version 330 core
+
+uniform mat4 view;
+uniform mat4 projection;
+
+uniform vec3 volumes_min;
+uniform vec3 volumes_max;
+
+layout (location = 0) in vec3 in_position;
+
+out vec3 position;
+
 void main()
 {
-    out_color = vec4(1.0, 0.5, 0.5, 1.0);
+    position = volumes_min + in_position * (volumes_max - volumes_min);
+    gl_Position = projection * view * vec4(position, 1.0);
 }
 )";
 
-GLuint create_shader(GLenum type, const char * source)
+// Every instance of a volume_set along the ray in one march, after march_source: the BVH gives
+// the intervals where the ray is inside each instance, sorted by entry, and the march steps
+// through them front to back, adding up the density of the instances it is in and jumping
+// over the gaps, with one transmittance and one early exit for the lot. Instances sample the
+// volume at bbox_min..bbox_max stretched over their own box; light and sky visibility come
+// from the volume's own textures, so instances do not shadow each other.
+const char volumes_fragment_shader_source[] =
+R"(
+uniform samplerBuffer volume_nodes;
+uniform samplerBuffer volume_instances;
+uniform vec3 volumes_min;
+uniform vec3 volumes_max;
+
+in vec3 position;
+
+layout (location = 0) out vec4 out_color;
+layout (location = 1) out vec2 out_depth;
+
+// Instances a ray marches through at most; the farthest ones past this are dropped
+const int MAX_RAY_VOLUMES = 16;
+const int BVH_STACK_SIZE = 16;
+
+int ray_volume_count = 0;
+// Entry, exit and instance
+vec3 ray_volumes[MAX_RAY_VOLUMES];
+
+vec2 intersect_box(vec3 box_min, vec3 box_max, vec3 origin, vec3 inverse_direction)
+{
+    vec3 t0 = (box_min - origin) * inverse_direction;
+    vec3 t1 = (box_max - origin) * inverse_direction;
+    return vec2(max(vmax(min(t0, t1)), 0.0), vmin(max(t0, t1)));
+}
+
+void add_ray_volume(vec3 interval)
+{
+    // Insertion by entry, the arrays being short
+    int i = min(ray_volume_count, MAX_RAY_VOLUMES - 1);
+    if (ray_volume_count == MAX_RAY_VOLUMES && interval.x >= ray_volumes[i].x)
+        return;
+    for (; i > 0 && ray_volumes[i - 1].x > interval.x; --i)
+        ray_volumes[i] = ray_volumes[i - 1];
+    ray_volumes[i] = interval;
+    ray_volume_count = min(ray_volume_count + 1, MAX_RAY_VOLUMES);
+}
+
+void gather_ray_volumes(vec3 origin, vec3 direction)
+{
+    vec3 inverse_direction = 1.0 / direction;
+
+    int stack[BVH_STACK_SIZE];
+    int stack_size = 0;
+    int node = 0;
+    for (;;)
+    {
+        vec4 node_min = texelFetch(volume_nodes, node * 2);
+        vec4 node_max = texelFetch(volume_nodes, node * 2 + 1);
+        vec2 t = intersect_box(node_min.xyz, node_max.xyz, origin, inverse_direction);
+        if (t.x < t.y)
+        {
+            int count = int(node_max.w);
+            if (count == 0 && stack_size < BVH_STACK_SIZE)
+            {
+                stack[stack_size++] = int(node_min.w);
+                ++node;
+                continue;
+            }
+            for (int i = 0; i < count; ++i)
+            {
+                int instance = int(node_min.w) + i;
+                vec2 ti = intersect_box(texelFetch(volume_instances, instance * 2).xyz, texelFetch(volume_instances, instance * 2 + 1).xyz,
+                    origin, inverse_direction);
+                if (ti.x < ti.y)
+                    add_ray_volume(vec3(ti, float(instance)));
+            }
+        }
+        if (stack_size == 0)
+            break;
+        node = stack[--stack_size];
+    }
+}
+
+void main()
+{
+    vec3 direction = normalize(position - camera_position);
+    gather_ray_volumes(camera_position, direction);
+
+    vec2 t_bounds = intersect_box(volumes_min, volumes_max, camera_position, 1.0 / direction);
+    if (ray_volume_count == 0)
+    {
+        out_color = vec4(0.0);
+        out_depth = vec2(0.0, t_bounds.x);
+        return;
+    }
+
+    // The smallest instance on the ray sets the step and the voxel size for the level of detail
+    vec3 extent = bbox_max - bbox_min;
+    float t_exit = 0.0;
+    float scale = 1e30;
+    for (int i = 0; i < ray_volume_count; ++i)
+    {
+        int instance = int(ray_volumes[i].z);
+        vec3 instance_extent = texelFetch(volume_instances, instance * 2 + 1).xyz - texelFetch(volume_instances, instance * 2).xyz;
+        scale = min(scale, vmin(instance_extent / extent));
+        t_exit = max(t_exit, ray_volumes[i].y);
+    }
+    float base_dt = march_base_step() * scale;
+    float voxel_extent = extent.x / float(volume_size.x) * scale;
+
+    march_state state = march_state(ray_volumes[0].x + march_jitter(gl_FragCoord.xy) * base_dt, 1.0, vec3(0.0), 0.0);
+
+    float dt = base_dt;
+    for (; state.s < t_exit; state.s += dt)
+    {
+        float s = state.s;
+        vec3 p = camera_position + s * direction;
+
+        float lod = 0.0;
+        if (pixel_angle > 0.0)
+            lod = max(0.0, log2(s * pixel_angle / voxel_extent)) + opacity_lod_bias * (1.0 - state.transmittance);
+        dt = base_dt * min(exp2(lod), max_step_scale);
+
+        float density = 0.0;
+        vec3 in_light = vec3(0.0);
+        bool inside = false;
+        float next_entry = t_exit;
+        for (int i = 0; i < ray_volume_count; ++i)
+        {
+            vec3 interval = ray_volumes[i];
+            if (s < interval.x)
+            {
+                next_entry = interval.x;
+                break;
+            }
+            if (s >= interval.y)
+                continue;
+            inside = true;
+
+            int instance = int(interval.z);
+            vec4 instance_min = texelFetch(volume_instances, instance * 2);
+            vec3 instance_max = texelFetch(volume_instances, instance * 2 + 1).xyz;
+            vec3 local = (p - instance_min.xyz) / (instance_max - instance_min.xyz);
+
+            float d = density_at(bbox_min + local * extent, lod) * instance_min.w;
+            if (d == 0.0)
+                continue;
+
+            float light_transmittance = textureLod(light_texture, local, 0.0).r;
+            float sky_visibility = ambient_occlusion ? textureLod(ambient_texture, local, 0.0).r : 1.0;
+            density += d;
+            in_light += d * (light_color * light_transmittance / (4.0 * PI) + ambient_light * sky_visibility);
+        }
+
+        if (!inside)
+        {
+            // To the last step before the next instance, on the same sample grid
+            state.s += max(0.0, ceil((next_entry - s) / dt) - 1.0) * dt;
+            continue;
+        }
+        if (density == 0.0)
+            continue;
+
+        float step_transmittance = exp(-absorption * density * dt);
+        state.color += state.transmittance * (1.0 - step_transmittance) * in_light / density;
+        state.cloud_distance += state.transmittance * (1.0 - step_transmittance) * s;
+        state.transmittance *= step_transmittance;
+
+        if (state.transmittance < 0.01)
+            break;
+    }
+
+    // The entry distance is the one into the bounds of the whole set, which is the box the
+    // temporal composite is given
+    finish_march(state, t_bounds.x, out_color, out_depth);
+}
+)";
+
+// The sources are concatenated in order
+GLuint create_shader(GLenum type, std::initializer_list<const char *> sources)
 {
     GLuint result = glCreateShader(type);
-    glShaderSource(result, 1, &source, nullptr);
+    std::vector<const char *> const strings(sources);
+    glShaderSource(result, strings.size(), strings.data(), nullptr);
     glCompileShader(result);
     GLint status;
     glGetShaderiv(result, GL_COMPILE_STATUS, &status);
@@ -190,8 +576,10 @@ static std::uint32_t cube_indices[]
 	5, 3, 7,
 };
 
-int main() try
+int main(int argc, char ** argv) try
 {
+    replay_session replay(argc, argv);
+
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
         sdl2_fail("SDL_Init: ");
 
@@ -226,16 +614,73 @@ int main() try
     if (!GLEW_VERSION_3_3)
         throw std::runtime_error("OpenGL 3.3 is not supported");
 
-    auto vertex_shader = create_shader(GL_VERTEX_SHADER, vertex_shader_source);
-    auto fragment_shader = create_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
+    const std::string project_root = PROJECT_ROOT;
+
+    // Programs of the volume passes
+    program_cache programs(project_root + "/.program_binaries");
+
+    auto vertex_shader = create_shader(GL_VERTEX_SHADER, {vertex_shader_source});
+    auto fragment_shader = create_shader(GL_FRAGMENT_SHADER, {"#version 330 core\n", march_source, fragment_shader_source});
     auto program = create_program(vertex_shader, fragment_shader);
 
     GLuint view_location = glGetUniformLocation(program, "view");
     GLuint projection_location = glGetUniformLocation(program, "projection");
-    GLuint bbox_min_location = glGetUniformLocation(program, "bbox_min");
-    GLuint bbox_max_location = glGetUniformLocation(program, "bbox_max");
-    GLuint camera_position_location = glGetUniformLocation(program, "camera_position");
-    GLuint light_direction_location = glGetUniformLocation(program, "light_direction");
+
+    auto volumes_vertex_shader = create_shader(GL_VERTEX_SHADER, {volumes_vertex_shader_source});
+    auto volumes_fragment_shader = create_shader(GL_FRAGMENT_SHADER, {"#version 330 core\n", march_source, volumes_fragment_shader_source});
+    auto volumes_program = create_program(volumes_vertex_shader, volumes_fragment_shader);
+
+    GLuint volumes_view_location = glGetUniformLocation(volumes_program, "view");
+    GLuint volumes_projection_location = glGetUniformLocation(volumes_program, "projection");
+    GLuint volumes_min_location = glGetUniformLocation(volumes_program, "volumes_min");
+    GLuint volumes_max_location = glGetUniformLocation(volumes_program, "volumes_max");
+    GLuint volume_nodes_location = glGetUniformLocation(volumes_program, "volume_nodes");
+    GLuint volume_instances_location = glGetUniformLocation(volumes_program, "volume_instances");
+
+    // C toggles marching in compute shaders, tile by tile, instead of over the rasterized cube
+    std::unique_ptr<compute_marcher> cloud_compute;
+    if (compute_marcher::supported())
+        cloud_compute = std::make_unique<compute_marcher>(programs, march_source);
+    else
+        std::cout << "No GL 4.3, the volume is marched in the fragment shader only" << std::endl;
+    bool compute_march = bool(cloud_compute);
+
+    // Locations of march_source's uniforms, in either program
+    struct march_uniforms
+    {
+        GLint bbox_min, bbox_max, camera_position, light_direction, atlas_texture, page_table, atlas_size, page_brick_size;
+        GLint occupancy_texture, volume_size, brick_size, skip_empty, light_texture, ambient_texture, ambient_occlusion;
+        GLint frame, mips_texture, mips_max_level, pixel_angle;
+    };
+
+    auto get_march_uniforms = [](GLuint program) -> march_uniforms
+    {
+        return {
+            glGetUniformLocation(program, "bbox_min"),
+            glGetUniformLocation(program, "bbox_max"),
+            glGetUniformLocation(program, "camera_position"),
+            glGetUniformLocation(program, "light_direction"),
+            glGetUniformLocation(program, "atlas_texture"),
+            glGetUniformLocation(program, "page_table"),
+            glGetUniformLocation(program, "atlas_size"),
+            glGetUniformLocation(program, "page_brick_size"),
+            glGetUniformLocation(program, "occupancy_texture"),
+            glGetUniformLocation(program, "volume_size"),
+            glGetUniformLocation(program, "brick_size"),
+            glGetUniformLocation(program, "skip_empty"),
+            glGetUniformLocation(program, "light_texture"),
+            glGetUniformLocation(program, "ambient_texture"),
+            glGetUniformLocation(program, "ambient_occlusion"),
+            glGetUniformLocation(program, "frame"),
+            glGetUniformLocation(program, "mips_texture"),
+            glGetUniformLocation(program, "mips_max_level"),
+            glGetUniformLocation(program, "pixel_angle"),
+        };
+    };
+
+    march_uniforms const raster_uniforms = get_march_uniforms(program);
+    march_uniforms const volumes_uniforms = get_march_uniforms(volumes_program);
+    march_uniforms const compute_uniforms = cloud_compute ? get_march_uniforms(cloud_compute->march_program()) : march_uniforms{};
 
     GLuint vao, vbo, ebo;
     glGenVertexArrays(1, &vao);
@@ -252,7 +697,6 @@ int main() try
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
 
-    const std::string project_root = PROJECT_ROOT;
     const std::string cloud_data_path = project_root + "/disney_cloud.data";
 
     const glm::ivec3 cloud_texture_size { 126, 86, 154 };
@@ -260,11 +704,125 @@ int main() try
     const glm::vec3 cloud_bbox_max = glm::vec3(cloud_texture_size) / 100.f;
     const glm::vec3 cloud_bbox_min = - cloud_bbox_max;
 
+    job_system jobs;
+
+    // The dense file is only read, through its compressed copy, to build the bricked one next to it
+    sparse_volume const cloud(build_sparse_volume_cached(cloud_data_path, cloud_texture_size, jobs));
+    brick_cache cloud_bricks(cloud);
+    std::cout << "Stored bricks: " << cloud.brick_count() << " of " << cloud.grid_size().x * cloud.grid_size().y * cloud.grid_size().z
+        << ", atlas slots: " << cloud_bricks.slot_count() << std::endl;
+
+    // K toggles jumping over the bricks this marks empty
+    auto const & cloud_occupancy = cloud.occupancy();
+    bool skip_empty = true;
+
+    GLuint occupancy_texture;
+    glGenTextures(1, &occupancy_texture);
+    glBindTexture(GL_TEXTURE_3D, occupancy_texture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, cloud_occupancy.size.x, cloud_occupancy.size.y, cloud_occupancy.size.z, 0, GL_RED, GL_UNSIGNED_BYTE, cloud_occupancy.max_density.data());
+
+    // Transmittance towards the light at half resolution, rebuilt when the light has turned noticeably
+    int const light_volume_factor = 2;
+    glm::ivec3 light_volume_size;
+    auto light_density = downsample_density(cloud, light_volume_factor, light_volume_size, jobs);
+    float const light_voxel_size = light_volume_factor * (cloud_bbox_max.x - cloud_bbox_min.x) / cloud_texture_size.x;
+    float const light_absorption = 10.f;
+
+    // O toggles darkening the ambient light by how much sky every voxel sees, swept over many
+    // directions at the light volume's resolution when the density changes, cached otherwise
+    auto const ambient_start = std::chrono::high_resolution_clock::now();
+    auto const cloud_ambient = build_ambient_volume_cached(cloud_data_path, light_density, light_volume_size, light_voxel_size, light_absorption, jobs);
+    std::cout << "Ambient volume: " << std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - ambient_start).count()
+        << " ms" << std::endl;
+    bool ambient_occlusion = true;
+
+    GLuint ambient_texture;
+    glGenTextures(1, &ambient_texture);
+    glBindTexture(GL_TEXTURE_3D, ambient_texture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, light_volume_size.x, light_volume_size.y, light_volume_size.z, 0, GL_RED, GL_UNSIGNED_BYTE, cloud_ambient.data());
+
+    light_volume cloud_light(std::move(light_density), light_volume_size, light_voxel_size, light_absorption);
+    glm::vec3 built_light_direction(0.f);
+
+    GLuint light_texture;
+    glGenTextures(1, &light_texture);
+    glBindTexture(GL_TEXTURE_3D, light_texture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_R16F, light_volume_size.x, light_volume_size.y, light_volume_size.z, 0, GL_RED, GL_FLOAT, nullptr);
+
+    // L toggles sampling these and taking longer steps where voxels get smaller than pixels
+    auto const cloud_mips = build_density_mips(cloud, jobs);
+    bool distance_lod = true;
+
+    GLuint mips_texture;
+    glGenTextures(1, &mips_texture);
+    glBindTexture(GL_TEXTURE_3D, mips_texture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, cloud_mips.levels.size() - 1);
+    for (std::size_t level = 0; level < cloud_mips.levels.size(); ++level)
+    {
+        auto const & size = cloud_mips.sizes[level];
+        glTexImage3D(GL_TEXTURE_3D, level, GL_R8, size.x, size.y, size.z, 0, GL_RED, GL_FLOAT, cloud_mips.levels[level].data());
+    }
+
+    // M switches to a sky of overlapping copies of the cloud, all marched in one pass
+    volume_set clouds;
+    {
+        std::default_random_engine rng(136);
+        std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+        std::vector<volume_set::instance> instances;
+        for (int i = 0; i < 32; ++i)
+        {
+            float const scale = 0.3f + 0.7f * unit(rng);
+            glm::vec3 const center{(unit(rng) * 2.f - 1.f) * 5.f, unit(rng) * 1.5f - 0.5f, (unit(rng) * 2.f - 1.f) * 5.f};
+            instances.push_back({center + cloud_bbox_min * scale, center + cloud_bbox_max * scale, 0.6f + 0.6f * unit(rng)});
+        }
+        clouds.set(std::move(instances));
+    }
+    std::cout << "Cloud set: " << clouds.instances().size() << " instances, " << clouds.node_count() << " BVH nodes" << std::endl;
+    bool multiple_volumes = false;
+
+    std::size_t empty_bricks = std::count(cloud_occupancy.max_density.begin(), cloud_occupancy.max_density.end(), 0);
+    std::cout << "Empty bricks: " << empty_bricks << " of " << cloud_occupancy.max_density.size() << std::endl;
+
+    // H cycles between marching every window pixel and marching at 1/2 or 1/4 of the resolution,
+    // accumulated over frames with jittered rays
+    int volume_scale = 2;
+    temporal_volume cloud_temporal(programs, width, height, volume_scale);
+
+    // The frame is drawn at a fraction of the window resolution that keeps its GPU time within
+    // the budget, and upscaled to the window; R cycles sharpened, bilinear and always full
+    // resolution. The volume follows the scene size, restarting its history at every step
+    resolution_controller::settings dynamic_resolution_settings;
+    dynamic_resolution_settings.budget_ms = 14.f;
+    dynamic_resolution_settings.min_scale = 0.5f;
+    dynamic_resolution_target dynamic_resolution(programs, width, height, 1, dynamic_resolution_settings);
+    upscale_filter dynamic_resolution_filter = upscale_filter::sharpen;
+    glm::ivec2 volume_size(width, height);
+    float resolution_print_time = 0.f;
+
     auto last_frame_start = std::chrono::high_resolution_clock::now();
 
     float time = 0.f;
 
-    std::map<SDL_Keycode, bool> button_down;
+    input_state input;
 
     float view_angle = glm::pi<float>() / 12.f;
     float camera_distance = 2.5f;
@@ -276,6 +834,8 @@ int main() try
     bool running = true;
     while (running)
     {
+        input.begin_frame();
+
         for (SDL_Event event; SDL_PollEvent(&event);) switch (event.type)
         {
         case SDL_QUIT:
@@ -287,54 +847,115 @@ int main() try
                 width = event.window.data1;
                 height = event.window.data2;
                 glViewport(0, 0, width, height);
+                dynamic_resolution.resize(width, height);
                 break;
             }
             break;
         case SDL_KEYDOWN:
-            button_down[event.key.keysym.sym] = true;
+            input.handle_event(event);
             if (event.key.keysym.sym == SDLK_SPACE)
                 paused = !paused;
+            if (event.key.keysym.sym == SDLK_k)
+                skip_empty = !skip_empty;
+            if (event.key.keysym.sym == SDLK_m)
+            {
+                multiple_volumes = !multiple_volumes;
+                camera_distance = multiple_volumes ? 10.f : 2.5f;
+                std::cout << "Volumes: " << (multiple_volumes ? "cloud set" : "single") << std::endl;
+            }
+            if (event.key.keysym.sym == SDLK_c && cloud_compute)
+            {
+                compute_march = !compute_march;
+                std::cout << "March: " << (compute_march ? "compute" : "fragment") << std::endl;
+            }
+            if (event.key.keysym.sym == SDLK_o)
+            {
+                ambient_occlusion = !ambient_occlusion;
+                std::cout << "Ambient occlusion: " << (ambient_occlusion ? "on" : "off") << std::endl;
+            }
+            if (event.key.keysym.sym == SDLK_l)
+            {
+                distance_lod = !distance_lod;
+                std::cout << "Distance LOD: " << (distance_lod ? "on" : "off") << std::endl;
+            }
+            if (event.key.keysym.sym == SDLK_h)
+            {
+                volume_scale = (volume_scale == 4) ? 1 : volume_scale * 2;
+                cloud_temporal.resize(volume_size.x, volume_size.y, volume_scale);
+                std::cout << "Volume resolution: 1/" << volume_scale << std::endl;
+            }
+            if (event.key.keysym.sym == SDLK_r)
+            {
+                auto & controller = dynamic_resolution.controller();
+                if (!controller.enabled())
+                {
+                    controller.set_enabled(true);
+                    dynamic_resolution_filter = upscale_filter::sharpen;
+                }
+                else if (dynamic_resolution_filter == upscale_filter::sharpen)
+                    dynamic_resolution_filter = upscale_filter::bilinear;
+                else
+                    controller.set_enabled(false);
+                if (controller.enabled())
+                    std::cout << "Dynamic resolution, " << to_string(dynamic_resolution_filter) << " upscale" << std::endl;
+                else
+                    std::cout << "Full resolution" << std::endl;
+            }
             break;
         case SDL_KEYUP:
-            button_down[event.key.keysym.sym] = false;
+            input.handle_event(event);
             break;
         }
 
         if (!running)
             break;
 
+        if (!replay.update(input))
+            break;
+
         auto now = std::chrono::high_resolution_clock::now();
-        float dt = std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count();
+        float dt = replay.frame_time(std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count());
         last_frame_start = now;
 
         if (!paused)
             time += dt;
 
-        if (button_down[SDLK_UP])
+        resolution_print_time += dt;
+        if (resolution_print_time >= 1.f)
+        {
+            auto const & controller = dynamic_resolution.controller();
+            std::cout << "Resolution " << dynamic_resolution.scene_width() << "x" << dynamic_resolution.scene_height()
+                << " (" << int(controller.scale() * 100.f + 0.5f) << "%), " << controller.last_gpu_ms() << " ms gpu of "
+                << controller.current_settings().budget_ms << " ms budget" << std::endl;
+            resolution_print_time = 0.f;
+        }
+
+        if (input.down(SDL_SCANCODE_UP))
             camera_distance -= 3.f * dt;
-        if (button_down[SDLK_DOWN])
+        if (input.down(SDL_SCANCODE_DOWN))
             camera_distance += 3.f * dt;
 
-        if (button_down[SDLK_a])
+        if (input.down(SDL_SCANCODE_A))
             camera_rotation -= 2.f * dt;
-        if (button_down[SDLK_d])
+        if (input.down(SDL_SCANCODE_D))
             camera_rotation += 2.f * dt;
 
-        if (button_down[SDLK_w])
+        if (input.down(SDL_SCANCODE_W))
             view_angle -= 2.f * dt;
-        if (button_down[SDLK_s])
+        if (input.down(SDL_SCANCODE_S))
             view_angle += 2.f * dt;
 
-        glClearColor(0.6f, 0.8f, 1.0f, 0.f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        glEnable(GL_DEPTH_TEST);
+        dynamic_resolution.begin_scene();
 
-        glEnable(GL_CULL_FACE);
-        glCullFace(GL_FRONT);
+        glm::ivec2 const scene_size(dynamic_resolution.scene_width(), dynamic_resolution.scene_height());
+        if (scene_size != volume_size)
+        {
+            volume_size = scene_size;
+            cloud_temporal.resize(volume_size.x, volume_size.y, volume_scale);
+        }
 
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glClearColor(0.6f, 0.8f, 1.0f, 0.f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         float near = 0.1f;
         float far = 100.f;
@@ -346,26 +967,153 @@ int main() try
         view = glm::rotate(view, view_angle, {1.f, 0.f, 0.f});
         view = glm::rotate(view, camera_rotation, {0.f, 1.f, 0.f});
 
-        glm::mat4 projection = glm::perspective(glm::pi<float>() / 2.f, (1.f * width) / height, near, far);
+        float const fov = glm::pi<float>() / 2.f;
+        glm::mat4 projection = glm::perspective(fov, (1.f * width) / height, near, far);
 
         glm::vec3 camera_position = (glm::inverse(view) * glm::vec4(0.f, 0.f, 0.f, 1.f)).xyz();
 
+        bool const temporal = (volume_scale > 1);
+        glm::mat4 const view_projection = projection * view;
+        glm::mat4 march_projection = projection;
+        if (temporal)
+            march_projection = glm::translate(glm::mat4(1.f), glm::vec3(cloud_temporal.jitter(), 0.f)) * projection;
+
         glm::vec3 light_direction = glm::normalize(glm::vec3(std::cos(time), 1.f, std::sin(time)));
 
-        glUseProgram(program);
-        glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
-        glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
-        glUniform3fv(bbox_min_location, 1, reinterpret_cast<const float *>(&cloud_bbox_min));
-        glUniform3fv(bbox_max_location, 1, reinterpret_cast<const float *>(&cloud_bbox_max));
-        glUniform3fv(camera_position_location, 1, reinterpret_cast<float *>(&camera_position));
-        glUniform3fv(light_direction_location, 1, reinterpret_cast<float *>(&light_direction));
+        if (glm::dot(light_direction, built_light_direction) < 0.9999f)
+        {
+            cloud_light.build(jobs, light_direction);
+            glBindTexture(GL_TEXTURE_3D, light_texture);
+            glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, light_volume_size.x, light_volume_size.y, light_volume_size.z, GL_RED, GL_FLOAT, cloud_light.transmittance().data());
+            built_light_direction = light_direction;
+        }
+
+        // Instances share the bricks, streamed around the camera as seen from the nearest one
+        glm::vec3 camera_local = (camera_position - cloud_bbox_min) / (cloud_bbox_max - cloud_bbox_min);
+        if (multiple_volumes)
+        {
+            float nearest = std::numeric_limits<float>::infinity();
+            for (auto const & i : clouds.instances())
+            {
+                float const distance = glm::distance(camera_position, glm::clamp(camera_position, i.min, i.max));
+                if (distance < nearest)
+                {
+                    nearest = distance;
+                    camera_local = (camera_position - i.min) / (i.max - i.min);
+                }
+            }
+        }
+        cloud_bricks.update(camera_local * glm::vec3(cloud_texture_size));
+
+        // The cloud set is marched over its rasterized bounds only
+        bool const compute = compute_march && !multiple_volumes;
+        auto const & uniforms = multiple_volumes ? volumes_uniforms : (compute ? compute_uniforms : raster_uniforms);
+        glUseProgram(multiple_volumes ? volumes_program : (compute ? cloud_compute->march_program() : program));
+        glUniform3fv(uniforms.bbox_min, 1, reinterpret_cast<const float *>(&cloud_bbox_min));
+        glUniform3fv(uniforms.bbox_max, 1, reinterpret_cast<const float *>(&cloud_bbox_max));
+        glUniform3fv(uniforms.camera_position, 1, reinterpret_cast<float *>(&camera_position));
+        glUniform3fv(uniforms.light_direction, 1, reinterpret_cast<float *>(&light_direction));
+        glUniform1i(uniforms.atlas_texture, 0);
+        glUniform1i(uniforms.occupancy_texture, 1);
+        glUniform1i(uniforms.page_table, 2);
+        glUniform1i(uniforms.light_texture, 3);
+        glUniform1i(uniforms.ambient_texture, 5);
+        glUniform1i(uniforms.ambient_occlusion, ambient_occlusion ? 1 : 0);
+        auto atlas_size = cloud_bricks.atlas_size();
+        glUniform3iv(uniforms.atlas_size, 1, reinterpret_cast<const int *>(&atlas_size));
+        glUniform1i(uniforms.page_brick_size, cloud.brick_size());
+        glUniform3iv(uniforms.volume_size, 1, reinterpret_cast<const int *>(&cloud_texture_size));
+        glUniform1i(uniforms.brick_size, cloud_occupancy.brick_size);
+        glUniform1i(uniforms.skip_empty, skip_empty ? 1 : 0);
+        glUniform1i(uniforms.frame, temporal ? cloud_temporal.frame() : 0);
+        glUniform1i(uniforms.mips_texture, 4);
+        glUniform1f(uniforms.mips_max_level, cloud_mips.levels.size() - 1.f);
+        int const march_height = temporal ? cloud_temporal.march_size().y : volume_size.y;
+        glUniform1f(uniforms.pixel_angle, distance_lod ? 2.f * std::tan(fov / 2.f) / march_height : 0.f);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_3D, cloud_bricks.atlas_texture());
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_3D, occupancy_texture);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_3D, cloud_bricks.page_table_texture());
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_3D, light_texture);
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_3D, mips_texture);
+        glActiveTexture(GL_TEXTURE5);
+        glBindTexture(GL_TEXTURE_3D, ambient_texture);
+
+        glm::vec3 const volumes_min = clouds.bounds_min();
+        glm::vec3 const volumes_max = clouds.bounds_max();
+        if (multiple_volumes)
+        {
+            glUniform3fv(volumes_min_location, 1, reinterpret_cast<float const *>(&volumes_min));
+            glUniform3fv(volumes_max_location, 1, reinterpret_cast<float const *>(&volumes_max));
+            glUniform1i(volume_nodes_location, 6);
+            glUniform1i(volume_instances_location, 7);
+            glActiveTexture(GL_TEXTURE6);
+            glBindTexture(GL_TEXTURE_BUFFER, clouds.node_texture());
+            glActiveTexture(GL_TEXTURE7);
+            glBindTexture(GL_TEXTURE_BUFFER, clouds.instance_texture());
+        }
+
+        if (compute)
+        {
+            // Without the temporal pass the march target is at the scene resolution and is
+            // blended over it as is
+            cloud_compute->march(cloud_temporal.march_size(), cloud_temporal.march_color_texture(), cloud_temporal.march_depth_texture(),
+                march_projection * view, occupancy_texture, cloud_bbox_min, cloud_bbox_max, cloud_texture_size, cloud_occupancy.brick_size);
+            if (!temporal)
+                cloud_compute->blend(cloud_temporal.march_color_texture());
+        }
+        else
+        {
+            glUniformMatrix4fv(multiple_volumes ? volumes_view_location : view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
+            glUniformMatrix4fv(multiple_volumes ? volumes_projection_location : projection_location, 1, GL_FALSE,
+                reinterpret_cast<float *>(&march_projection));
+
+            glEnable(GL_CULL_FACE);
+            glCullFace(GL_FRONT);
 
-        glBindVertexArray(vao);
-        glDrawElements(GL_TRIANGLES, std::size(cube_indices), GL_UNSIGNED_INT, nullptr);
+            if (temporal)
+            {
+                // Every pixel is covered by at most one back face, so the march target needs no blending
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, cloud_temporal.march_framebuffer());
+                glViewport(0, 0, cloud_temporal.march_size().x, cloud_temporal.march_size().y);
+                glClearColor(0.f, 0.f, 0.f, 0.f);
+                glClear(GL_COLOR_BUFFER_BIT);
+                glDisable(GL_BLEND);
+            }
+            else
+            {
+                glEnable(GL_BLEND);
+                glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+            }
+
+            glBindVertexArray(vao);
+            glDrawElements(GL_TRIANGLES, std::size(cube_indices), GL_UNSIGNED_INT, nullptr);
+        }
+
+        if (temporal)
+        {
+            cloud_temporal.resolve(view_projection, camera_position);
+            dynamic_resolution.bind_scene();
+            if (multiple_volumes)
+                cloud_temporal.composite(view_projection, camera_position, volumes_min, volumes_max);
+            else
+                cloud_temporal.composite(view_projection, camera_position, cloud_bbox_min, cloud_bbox_max);
+        }
+
+        dynamic_resolution.present(dynamic_resolution_filter);
+
+        replay.end_frame();
 
         SDL_GL_SwapWindow(window);
     }
 
+    replay.finish();
+
     SDL_GL_DeleteContext(gl_context);
     SDL_DestroyWindow(window);
 }
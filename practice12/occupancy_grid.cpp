@@ -0,0 +1,41 @@
+#include "occupancy_grid.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <glm/common.hpp>
+
+occupancy_grid build_occupancy_grid(std::vector<std::uint8_t> const & density, glm::ivec3 const & volume_size, int brick_size)
+{
+    if (density.size() != std::size_t(volume_size.x) * volume_size.y * volume_size.z)
+        throw std::runtime_error("Volume data does not match its size");
+
+    occupancy_grid result;
+    result.size = (volume_size + brick_size - 1) / brick_size;
+    result.brick_size = brick_size;
+    result.max_density.assign(std::size_t(result.size.x) * result.size.y * result.size.z, 0);
+
+    // Scatter every voxel into the bricks whose one-voxel border contains it
+    for (int z = 0; z < volume_size.z; ++z)
+        for (int y = 0; y < volume_size.y; ++y)
+            for (int x = 0; x < volume_size.x; ++x)
+            {
+                auto const value = density[(std::size_t(z) * volume_size.y + y) * volume_size.x + x];
+                if (value == 0)
+                    continue;
+
+                glm::ivec3 const voxel{x, y, z};
+                glm::ivec3 const first = glm::max((voxel - 1) / brick_size, glm::ivec3(0));
+                glm::ivec3 const last = glm::min((voxel + 1) / brick_size, result.size - 1);
+
+                for (int bz = first.z; bz <= last.z; ++bz)
+                    for (int by = first.y; by <= last.y; ++by)
+                        for (int bx = first.x; bx <= last.x; ++bx)
+                        {
+                            auto & brick = result.max_density[(std::size_t(bz) * result.size.y + by) * result.size.x + bx];
+                            brick = std::max(brick, value);
+                        }
+            }
+
+    return result;
+}
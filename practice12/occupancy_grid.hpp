@@ -0,0 +1,19 @@
+#pragma once
+
+#include <glm/vec3.hpp>
+
+#include <vector>
+#include <cstdint>
+
+// Maximum density of each brick_size^3 brick of a volume. The maximum also covers the voxels
+// next to the brick, since linear filtering inside the brick reads them, so a zero brick
+// means every sample inside it is zero and a ray marcher can jump over it.
+struct occupancy_grid
+{
+    glm::ivec3 size;
+    int brick_size;
+    std::vector<std::uint8_t> max_density;
+};
+
+// density holds volume_size.x * volume_size.y * volume_size.z voxels, x fastest
+occupancy_grid build_occupancy_grid(std::vector<std::uint8_t> const & density, glm::ivec3 const & volume_size, int brick_size = 8);
@@ -0,0 +1,200 @@
+#include "sparse_volume.hpp"
+#include "compressed_volume.hpp"
+
+#include <glm/common.hpp>
+
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+namespace
+{
+
+    constexpr char volume_magic[4] = {'V', 'O', 'L', 'B'};
+    constexpr std::uint32_t volume_version = 1;
+
+    // Followed by the page table, the occupancy grid and the bricks
+    struct volume_header
+    {
+        char magic[4];
+        std::uint32_t version;
+        std::uint64_t source_size;
+        std::int64_t source_time;
+        std::int32_t volume_size[3];
+        std::int32_t brick_size;
+        std::int32_t grid_size[3];
+        std::int32_t occupancy_brick_size;
+        std::int32_t occupancy_size[3];
+        std::uint32_t brick_count;
+    };
+
+    volume_header make_header(std::filesystem::path const & dense_path, glm::ivec3 const & volume_size, int brick_size)
+    {
+        auto const source = volume_source_path(dense_path);
+
+        volume_header header{};
+        std::memcpy(header.magic, volume_magic, sizeof(volume_magic));
+        header.version = volume_version;
+        header.source_size = std::filesystem::file_size(source);
+        header.source_time = std::filesystem::last_write_time(source).time_since_epoch().count();
+        for (int i = 0; i < 3; ++i)
+            header.volume_size[i] = volume_size[i];
+        header.brick_size = brick_size;
+        return header;
+    }
+
+    std::size_t cell_count(std::int32_t const (& size)[3])
+    {
+        return std::size_t(size[0]) * size[1] * size[2];
+    }
+
+    std::size_t file_size(volume_header const & header)
+    {
+        std::size_t const stored = header.brick_size + 2 * sparse_volume::apron;
+        return sizeof(header)
+            + cell_count(header.grid_size) * sizeof(std::int32_t)
+            + cell_count(header.occupancy_size)
+            + header.brick_count * stored * stored * stored;
+    }
+
+    bool is_current(std::filesystem::path const & path, volume_header const & expected)
+    {
+        std::error_code error;
+        if (!std::filesystem::is_regular_file(path, error))
+            return false;
+
+        mapped_file file(path);
+        if (file.size() < sizeof(volume_header))
+            return false;
+
+        volume_header header;
+        std::memcpy(&header, file.data(), sizeof(header));
+
+        return std::memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0
+            && header.version == expected.version
+            && header.source_size == expected.source_size
+            && header.source_time == expected.source_time
+            && std::memcmp(header.volume_size, expected.volume_size, sizeof(header.volume_size)) == 0
+            && header.brick_size == expected.brick_size
+            && file.size() == file_size(header);
+    }
+
+}
+
+sparse_volume::sparse_volume(std::filesystem::path const & path)
+    : file_(path)
+{
+    volume_header header;
+    if (file_.size() < sizeof(header))
+        throw std::runtime_error("Bad sparse volume " + path.string());
+    std::memcpy(&header, file_.data(), sizeof(header));
+
+    if (std::memcmp(header.magic, volume_magic, sizeof(volume_magic)) != 0 || header.version != volume_version || file_.size() != file_size(header))
+        throw std::runtime_error("Bad sparse volume " + path.string());
+
+    volume_size_ = {header.volume_size[0], header.volume_size[1], header.volume_size[2]};
+    grid_size_ = {header.grid_size[0], header.grid_size[1], header.grid_size[2]};
+    brick_size_ = header.brick_size;
+    brick_count_ = header.brick_count;
+
+    // The header size is a multiple of 4, so the page table is aligned
+    char const * data = file_.data() + sizeof(header);
+    page_table_ = reinterpret_cast<std::int32_t const *>(data);
+    data += cell_count(header.grid_size) * sizeof(std::int32_t);
+
+    occupancy_.size = {header.occupancy_size[0], header.occupancy_size[1], header.occupancy_size[2]};
+    occupancy_.brick_size = header.occupancy_brick_size;
+    occupancy_.max_density.assign(data, data + cell_count(header.occupancy_size));
+    data += occupancy_.max_density.size();
+
+    bricks_ = reinterpret_cast<std::uint8_t const *>(data);
+}
+
+std::uint8_t const * sparse_volume::brick_data(std::int32_t brick) const
+{
+    std::size_t const stored = stored_brick_size();
+    return bricks_ + brick * stored * stored * stored;
+}
+
+std::int32_t sparse_volume::brick_at(glm::ivec3 const & cell) const
+{
+    return page_table_[(std::size_t(cell.z) * grid_size_.y + cell.y) * grid_size_.x + cell.x];
+}
+
+std::filesystem::path sparse_volume_path(std::filesystem::path const & dense_path)
+{
+    auto result = dense_path;
+    result += ".bricks";
+    return result;
+}
+
+std::filesystem::path build_sparse_volume_cached(std::filesystem::path const & dense_path, glm::ivec3 const & volume_size, job_system & jobs, int brick_size)
+{
+    auto header = make_header(dense_path, volume_size, brick_size);
+    auto const path = sparse_volume_path(dense_path);
+    if (is_current(path, header))
+        return path;
+
+    auto const density = load_volume_compressed_cached(dense_path, volume_size, jobs);
+
+    auto const occupancy = build_occupancy_grid(density, volume_size);
+
+    glm::ivec3 const grid_size = (volume_size + brick_size - 1) / brick_size;
+    int const stored = brick_size + 2 * sparse_volume::apron;
+
+    std::vector<std::int32_t> page_table;
+    std::vector<std::uint8_t> bricks;
+    std::vector<std::uint8_t> brick(std::size_t(stored) * stored * stored);
+
+    for (int bz = 0; bz < grid_size.z; ++bz)
+        for (int by = 0; by < grid_size.y; ++by)
+            for (int bx = 0; bx < grid_size.x; ++bx)
+            {
+                // Voxels outside the volume repeat the edge, as GL_CLAMP_TO_EDGE would
+                glm::ivec3 const origin = glm::ivec3{bx, by, bz} * brick_size - sparse_volume::apron;
+                bool empty = true;
+                auto out = brick.begin();
+                for (int z = 0; z < stored; ++z)
+                    for (int y = 0; y < stored; ++y)
+                        for (int x = 0; x < stored; ++x)
+                        {
+                            auto const voxel = glm::clamp(origin + glm::ivec3{x, y, z}, glm::ivec3(0), volume_size - 1);
+                            *out = density[(std::size_t(voxel.z) * volume_size.y + voxel.y) * volume_size.x + voxel.x];
+                            empty = empty && (*out == 0);
+                            ++out;
+                        }
+
+                if (empty)
+                    page_table.push_back(sparse_volume::empty_brick);
+                else
+                {
+                    page_table.push_back(bricks.size() / brick.size());
+                    bricks.insert(bricks.end(), brick.begin(), brick.end());
+                }
+            }
+
+    for (int i = 0; i < 3; ++i)
+    {
+        header.grid_size[i] = grid_size[i];
+        header.occupancy_size[i] = occupancy.size[i];
+    }
+    header.occupancy_brick_size = occupancy.brick_size;
+    header.brick_count = bricks.size() / brick.size();
+
+    // Same temporary-then-rename scheme as the OBJ cache
+    auto temp_path = path;
+    temp_path += ".tmp";
+    {
+        std::ofstream output(temp_path, std::ios::binary);
+        output.write(reinterpret_cast<char const *>(&header), sizeof(header));
+        output.write(reinterpret_cast<char const *>(page_table.data()), page_table.size() * sizeof(page_table[0]));
+        output.write(reinterpret_cast<char const *>(occupancy.max_density.data()), occupancy.max_density.size());
+        output.write(reinterpret_cast<char const *>(bricks.data()), bricks.size());
+        if (!output)
+            throw std::runtime_error("Failed to write " + temp_path.string());
+    }
+    std::filesystem::rename(temp_path, path);
+
+    return path;
+}
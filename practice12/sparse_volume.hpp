@@ -0,0 +1,56 @@
+#pragma once
+
+#include "occupancy_grid.hpp"
+#include "mapped_file.hpp"
+#include "job_system.hpp"
+
+#include <glm/vec3.hpp>
+
+#include <filesystem>
+#include <vector>
+#include <cstdint>
+
+// A density volume stored as brick_size^3 bricks, where only bricks with data are kept.
+// Every stored brick carries a one-voxel apron copied from its neighbours (clamped at the
+// volume edges), so it can be filtered on its own. The file also keeps the volume's
+// occupancy grid. It is memory-mapped, so bricks are only read from disk when asked for.
+struct sparse_volume
+{
+    static constexpr int apron = 1;
+    static constexpr std::int32_t empty_brick = -1;
+
+    explicit sparse_volume(std::filesystem::path const & path);
+
+    glm::ivec3 volume_size() const { return volume_size_; }
+    glm::ivec3 grid_size() const { return grid_size_; }
+    int brick_size() const { return brick_size_; }
+
+    // Stored bricks of brick_size + 2 * apron voxels per side, x fastest
+    std::size_t brick_count() const { return brick_count_; }
+    std::size_t stored_brick_size() const { return brick_size_ + 2 * apron; }
+    std::uint8_t const * brick_data(std::int32_t brick) const;
+
+    // Index of the brick covering a grid cell, or empty_brick
+    std::int32_t brick_at(glm::ivec3 const & cell) const;
+
+    occupancy_grid const & occupancy() const { return occupancy_; }
+
+private:
+    mapped_file file_;
+    glm::ivec3 volume_size_;
+    glm::ivec3 grid_size_;
+    int brick_size_;
+    std::size_t brick_count_;
+    std::int32_t const * page_table_;
+    std::uint8_t const * bricks_;
+    occupancy_grid occupancy_;
+};
+
+// Path of the sparse file kept next to a dense .data volume
+std::filesystem::path sparse_volume_path(std::filesystem::path const & dense_path);
+
+// Writes the sparse version of a dense volume, x fastest, to sparse_volume_path(dense_path)
+// unless one built from the same source file and brick size already exists; returns its path.
+// The dense data is read through load_volume_compressed_cached, so the .data file may be
+// missing as long as its .data.lz copy is there, which then stands in as the source file.
+std::filesystem::path build_sparse_volume_cached(std::filesystem::path const & dense_path, glm::ivec3 const & volume_size, job_system & jobs, int brick_size = 32);
@@ -0,0 +1,96 @@
+#include "sparse_volume.hpp"
+#include "compressed_volume.hpp"
+#include "ambient_volume.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+
+// Builds the sparse volume of a small synthetic .data file, then again with only its .data.lz
+// copy left, as a build that ships the compressed volumes alone would, and checks that both
+// give the same bricks and that the second one is reused rather than rebuilt. The ambient
+// volume cache is stamped the same way.
+
+namespace
+{
+
+    int failures = 0;
+
+    void check(bool condition, char const * what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED: " << what << std::endl;
+            ++failures;
+        }
+    }
+
+    std::vector<std::uint8_t> bricks_of(sparse_volume const & volume)
+    {
+        std::size_t const stored = volume.stored_brick_size();
+        std::size_t const size = volume.brick_count() * stored * stored * stored;
+        std::vector<std::uint8_t> result(size);
+        if (size > 0)
+            std::memcpy(result.data(), volume.brick_data(0), size);
+        return result;
+    }
+
+}
+
+int main()
+{
+    auto const directory = std::filesystem::temp_directory_path() / "sparse_volume_check";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+
+    // A sphere in one corner, so some bricks are empty and some are not
+    glm::ivec3 const volume_size{70, 40, 50};
+    std::vector<std::uint8_t> density(std::size_t(volume_size.x) * volume_size.y * volume_size.z, 0);
+    for (int z = 0; z < volume_size.z; ++z)
+        for (int y = 0; y < volume_size.y; ++y)
+            for (int x = 0; x < volume_size.x; ++x)
+                if ((x - 20) * (x - 20) + (y - 20) * (y - 20) + (z - 20) * (z - 20) < 15 * 15)
+                    density[(std::size_t(z) * volume_size.y + y) * volume_size.x + x] = 1 + (x + y + z) % 200;
+
+    auto const dense_path = directory / "sphere.data";
+    {
+        std::ofstream output(dense_path, std::ios::binary);
+        output.write(reinterpret_cast<char const *>(density.data()), density.size());
+    }
+
+    job_system jobs;
+
+    auto const path = build_sparse_volume_cached(dense_path, volume_size, jobs, 16);
+    check(std::filesystem::exists(compressed_volume_path(dense_path)), "the compressed copy is written next to the dense file");
+    auto const from_dense = bricks_of(sparse_volume(path));
+    check(!from_dense.empty(), "the sphere fills some bricks");
+
+    std::filesystem::remove(dense_path);
+    std::filesystem::remove(path);
+
+    check(build_sparse_volume_cached(dense_path, volume_size, jobs, 16) == path, "the sparse volume builds from the .data.lz alone");
+    sparse_volume const from_compressed(path);
+    check(from_compressed.volume_size() == volume_size, "the volume size survives");
+    check(bricks_of(from_compressed) == from_dense, "the bricks match those built from the dense file");
+
+    auto const built = std::filesystem::last_write_time(path);
+    build_sparse_volume_cached(dense_path, volume_size, jobs, 16);
+    check(std::filesystem::last_write_time(path) == built, "the sparse volume stamped from the .data.lz is reused");
+
+    // The ambient volume only needs the density it is given, not the dense file
+    glm::ivec3 const ambient_size{8, 8, 8};
+    std::vector<float> const ambient_density(std::size_t(ambient_size.x) * ambient_size.y * ambient_size.z, 0.5f);
+    auto const ambient = build_ambient_volume_cached(dense_path, ambient_density, ambient_size, 1.f, 1.f, jobs, 4);
+    check(ambient.size() == ambient_density.size(), "the ambient volume builds from the .data.lz alone");
+    auto const ambient_built = std::filesystem::last_write_time(ambient_volume_path(dense_path));
+    check(build_ambient_volume_cached(dense_path, ambient_density, ambient_size, 1.f, 1.f, jobs, 4) == ambient, "the cached ambient volume matches");
+    check(std::filesystem::last_write_time(ambient_volume_path(dense_path)) == ambient_built, "the ambient volume stamped from the .data.lz is reused");
+
+    std::filesystem::remove_all(directory);
+
+    if (failures == 0)
+        std::cout << "sparse volume checks passed" << std::endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,301 @@
+#include "temporal_volume.hpp"
+
+#include <glm/matrix.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+
+    const char fullscreen_vertex_shader_source[] =
+R"(#version 330 core
+
+out vec2 texcoord;
+
+void main()
+{
+    vec2 position = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 4.0 - 1.0;
+    texcoord = position * 0.5 + 0.5;
+    gl_Position = vec4(position, 0.0, 1.0);
+}
+)";
+
+    const char resolve_fragment_shader_source[] =
+R"(#version 330 core
+
+uniform sampler2D current_color;
+uniform sampler2D current_depth;
+uniform sampler2D history_color;
+uniform bool history_valid;
+uniform mat4 inverse_view_projection;
+uniform mat4 previous_view_projection;
+uniform vec3 camera_position;
+
+const float current_weight = 0.1;
+// Distance assumed for pixels where the volume is empty, so they reproject like a sky
+const float empty_distance = 1000.0;
+
+in vec2 texcoord;
+
+layout (location = 0) out vec4 out_color;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    ivec2 size = textureSize(current_color, 0);
+
+    vec4 current = texelFetch(current_color, pixel, 0);
+
+    // The history is clamped to what this frame's neighbourhood could produce, which
+    // drops stale history where the volume changed instead of ghosting
+    vec4 low = current;
+    vec4 high = current;
+    for (int y = -1; y <= 1; ++y)
+        for (int x = -1; x <= 1; ++x)
+        {
+            vec4 neighbour = texelFetch(current_color, clamp(pixel + ivec2(x, y), ivec2(0), size - 1), 0);
+            low = min(low, neighbour);
+            high = max(high, neighbour);
+        }
+
+    if (!history_valid)
+    {
+        out_color = current;
+        return;
+    }
+
+    float cloud_distance = texelFetch(current_depth, pixel, 0).r;
+    if (cloud_distance <= 0.0)
+        cloud_distance = empty_distance;
+
+    vec4 far_point = inverse_view_projection * vec4(texcoord * 2.0 - 1.0, 1.0, 1.0);
+    vec3 direction = normalize(far_point.xyz / far_point.w - camera_position);
+    vec4 previous = previous_view_projection * vec4(camera_position + direction * cloud_distance, 1.0);
+    vec2 previous_texcoord = previous.xy / previous.w * 0.5 + 0.5;
+
+    if (previous.w <= 0.0 || any(lessThan(previous_texcoord, vec2(0.0))) || any(greaterThan(previous_texcoord, vec2(1.0))))
+    {
+        out_color = current;
+        return;
+    }
+
+    vec4 history = clamp(texture(history_color, previous_texcoord), low, high);
+    out_color = mix(history, current, current_weight);
+}
+)";
+
+    const char composite_fragment_shader_source[] =
+R"(#version 330 core
+
+uniform sampler2D volume_color;
+uniform sampler2D volume_depth;
+uniform mat4 inverse_view_projection;
+uniform vec3 camera_position;
+uniform vec3 bbox_min;
+uniform vec3 bbox_max;
+
+const float depth_sigma = 0.05;
+
+in vec2 texcoord;
+
+layout (location = 0) out vec4 out_color;
+
+float entry_distance(vec3 direction)
+{
+    vec3 t0 = (bbox_min - camera_position) / direction;
+    vec3 t1 = (bbox_max - camera_position) / direction;
+    vec3 tmin = min(t0, t1);
+    vec3 tmax = max(t0, t1);
+    float t_near = max(max(tmin.x, tmin.y), tmin.z);
+    float t_far = min(min(tmax.x, tmax.y), tmax.z);
+    return (t_near <= t_far && t_far >= 0.0) ? max(t_near, 0.0) : 0.0;
+}
+
+void main()
+{
+    vec4 far_point = inverse_view_projection * vec4(texcoord * 2.0 - 1.0, 1.0, 1.0);
+    float entry = entry_distance(normalize(far_point.xyz / far_point.w - camera_position));
+
+    ivec2 size = textureSize(volume_color, 0);
+    vec2 position = texcoord * vec2(size) - 0.5;
+    ivec2 base = ivec2(floor(position));
+    vec2 f = position - vec2(base);
+
+    vec4 sum = vec4(0.0);
+    float total = 0.0;
+    vec4 bilinear = vec4(0.0);
+    for (int y = 0; y <= 1; ++y)
+        for (int x = 0; x <= 1; ++x)
+        {
+            ivec2 texel = clamp(base + ivec2(x, y), ivec2(0), size - 1);
+            float weight = (x == 1 ? f.x : 1.0 - f.x) * (y == 1 ? f.y : 1.0 - f.y);
+            vec4 color = texelFetch(volume_color, texel, 0);
+            float texel_entry = texelFetch(volume_depth, texel, 0).g;
+
+            bilinear += weight * color;
+            weight *= exp(-abs(texel_entry - entry) / depth_sigma);
+            sum += weight * color;
+            total += weight;
+        }
+
+    // No texel was close in depth, e.g. on a one-pixel feature; plain bilinear is the best guess
+    out_color = (total > 1e-4) ? sum / total : bilinear;
+}
+)";
+
+    void setup_texture(GLuint texture, GLenum internal_format, GLenum format, glm::ivec2 const & size)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, internal_format, size.x, size.y, 0, format, GL_FLOAT, nullptr);
+    }
+
+    float halton(int index, int base)
+    {
+        float result = 0.f;
+        float f = 1.f;
+        for (; index > 0; index /= base)
+        {
+            f /= base;
+            result += f * (index % base);
+        }
+        return result;
+    }
+
+    constexpr int jitter_period = 16;
+
+}
+
+temporal_volume::temporal_volume(program_cache & programs, int width, int height, int scale)
+{
+    resolve_program_ = programs.get({{GL_VERTEX_SHADER, fullscreen_vertex_shader_source}, {GL_FRAGMENT_SHADER, resolve_fragment_shader_source}});
+    composite_program_ = programs.get({{GL_VERTEX_SHADER, fullscreen_vertex_shader_source}, {GL_FRAGMENT_SHADER, composite_fragment_shader_source}});
+
+    glGenVertexArrays(1, &fullscreen_vao_);
+
+    glGenFramebuffers(1, &march_fbo_);
+    glGenTextures(1, &march_color_);
+    glGenTextures(1, &march_depth_);
+    glGenFramebuffers(2, history_fbo_);
+    glGenTextures(2, history_color_);
+
+    resize(width, height, scale);
+}
+
+temporal_volume::~temporal_volume()
+{
+    glDeleteFramebuffers(1, &march_fbo_);
+    glDeleteTextures(1, &march_color_);
+    glDeleteTextures(1, &march_depth_);
+    glDeleteFramebuffers(2, history_fbo_);
+    glDeleteTextures(2, history_color_);
+    glDeleteVertexArrays(1, &fullscreen_vao_);
+}
+
+void temporal_volume::resize(int width, int height, int scale)
+{
+    size_ = {std::max(1, width), std::max(1, height)};
+    march_size_ = glm::max((size_ + scale - 1) / scale, glm::ivec2(1));
+    history_valid_ = false;
+
+    setup_texture(march_color_, GL_RGBA16F, GL_RGBA, march_size_);
+    // The depth channels are read with texelFetch only
+    setup_texture(march_depth_, GL_RG32F, GL_RG, march_size_);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, march_fbo_);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, march_color_, 0);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, march_depth_, 0);
+    GLenum const draw_buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, draw_buffers);
+    if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        throw std::runtime_error("Incomplete volume march framebuffer");
+
+    for (int i = 0; i < 2; ++i)
+    {
+        setup_texture(history_color_[i], GL_RGBA16F, GL_RGBA, march_size_);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, history_fbo_[i]);
+        glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, history_color_[i], 0);
+        if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            throw std::runtime_error("Incomplete volume history framebuffer");
+    }
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+glm::vec2 temporal_volume::jitter() const
+{
+    // Halton (2, 3) points in [-0.5, 0.5] pixels, converted to clip units of the march target
+    glm::vec2 const offset{halton(frame_ + 1, 2) - 0.5f, halton(frame_ + 1, 3) - 0.5f};
+    return offset * 2.f / glm::vec2(march_size_);
+}
+
+void temporal_volume::resolve(glm::mat4 const & view_projection, glm::vec3 const & camera_position)
+{
+    int const next = 1 - current_history_;
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, history_fbo_[next]);
+    glViewport(0, 0, march_size_.x, march_size_.y);
+    glDisable(GL_BLEND);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+
+    auto const inverse_view_projection = glm::inverse(view_projection);
+
+    glUseProgram(resolve_program_);
+    glUniform1i(glGetUniformLocation(resolve_program_, "current_color"), 0);
+    glUniform1i(glGetUniformLocation(resolve_program_, "current_depth"), 1);
+    glUniform1i(glGetUniformLocation(resolve_program_, "history_color"), 2);
+    glUniform1i(glGetUniformLocation(resolve_program_, "history_valid"), history_valid_ ? 1 : 0);
+    glUniformMatrix4fv(glGetUniformLocation(resolve_program_, "inverse_view_projection"), 1, GL_FALSE, reinterpret_cast<float const *>(&inverse_view_projection));
+    glUniformMatrix4fv(glGetUniformLocation(resolve_program_, "previous_view_projection"), 1, GL_FALSE, reinterpret_cast<float const *>(&previous_view_projection_));
+    glUniform3fv(glGetUniformLocation(resolve_program_, "camera_position"), 1, reinterpret_cast<float const *>(&camera_position));
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, march_color_);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, march_depth_);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, history_color_[current_history_]);
+
+    glBindVertexArray(fullscreen_vao_);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+    current_history_ = next;
+    history_valid_ = true;
+    previous_view_projection_ = view_projection;
+    frame_ = (frame_ + 1) % jitter_period;
+}
+
+void temporal_volume::composite(glm::mat4 const & view_projection, glm::vec3 const & camera_position, glm::vec3 const & bbox_min, glm::vec3 const & bbox_max)
+{
+    glViewport(0, 0, size_.x, size_.y);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    auto const inverse_view_projection = glm::inverse(view_projection);
+
+    glUseProgram(composite_program_);
+    glUniform1i(glGetUniformLocation(composite_program_, "volume_color"), 0);
+    glUniform1i(glGetUniformLocation(composite_program_, "volume_depth"), 1);
+    glUniformMatrix4fv(glGetUniformLocation(composite_program_, "inverse_view_projection"), 1, GL_FALSE, reinterpret_cast<float const *>(&inverse_view_projection));
+    glUniform3fv(glGetUniformLocation(composite_program_, "camera_position"), 1, reinterpret_cast<float const *>(&camera_position));
+    glUniform3fv(glGetUniformLocation(composite_program_, "bbox_min"), 1, reinterpret_cast<float const *>(&bbox_min));
+    glUniform3fv(glGetUniformLocation(composite_program_, "bbox_max"), 1, reinterpret_cast<float const *>(&bbox_max));
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, history_color_[current_history_]);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, march_depth_);
+
+    glBindVertexArray(fullscreen_vao_);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "program_cache.hpp"
+
+#include <GL/glew.h>
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+// Renders a ray-marched volume at 1/scale of the window resolution and hides the lost
+// resolution over time: every frame marches with a different subpixel jitter, resolve()
+// blends the result into a history reprojected from the previous frame, and composite()
+// upsamples the history to the window, weighting low-resolution texels by how close their
+// ray's volume entry distance is to the full-resolution one.
+struct temporal_volume
+{
+    // The programs are owned by the cache
+    temporal_volume(program_cache & programs, int width, int height, int scale);
+    ~temporal_volume();
+
+    temporal_volume(temporal_volume const &) = delete;
+    temporal_volume & operator = (temporal_volume const &) = delete;
+
+    // Also drops the history
+    void resize(int width, int height, int scale);
+
+    // The march writes premultiplied color to attachment 0, and to attachment 1 its
+    // transmittance-weighted distance and the distance where the ray enters the volume
+    GLuint march_framebuffer() const { return march_fbo_; }
+    glm::ivec2 march_size() const { return march_size_; }
+    // The same attachments, for marching into them some other way
+    GLuint march_color_texture() const { return march_color_; }
+    GLuint march_depth_texture() const { return march_depth_; }
+
+    // Translation to apply to the projection this frame, in clip space
+    glm::vec2 jitter() const;
+
+    // Index of this frame in the jitter sequence, for varying the march offsets as well
+    int frame() const { return frame_; }
+
+    // view_projection is the unjittered matrix of this frame
+    void resolve(glm::mat4 const & view_projection, glm::vec3 const & camera_position);
+
+    // Blends over the bound framebuffer with premultiplied alpha
+    void composite(glm::mat4 const & view_projection, glm::vec3 const & camera_position, glm::vec3 const & bbox_min, glm::vec3 const & bbox_max);
+
+private:
+    glm::ivec2 size_;
+    glm::ivec2 march_size_;
+    int frame_ = 0;
+
+    GLuint march_fbo_ = 0;
+    GLuint march_color_ = 0;
+    GLuint march_depth_ = 0;
+
+    // Ping-pong history: resolve reads one and writes the other
+    GLuint history_fbo_[2] = {0, 0};
+    GLuint history_color_[2] = {0, 0};
+    int current_history_ = 0;
+    bool history_valid_ = false;
+    glm::mat4 previous_view_projection_{1.f};
+
+    GLuint resolve_program_ = 0;
+    GLuint composite_program_ = 0;
+    GLuint fullscreen_vao_ = 0;
+};
@@ -0,0 +1,104 @@
+#include "volume_set.hpp"
+
+#include <glm/vec4.hpp>
+#include <glm/common.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+
+    // Few enough for a leaf that testing them all beats descending further
+    constexpr std::size_t max_leaf_size = 2;
+
+    // Appends the node over [begin, end) and its subtree, splitting at the median along the
+    // longest axis of the centers
+    void build_node(std::vector<volume_set::instance> & instances, std::size_t begin, std::size_t end, std::vector<glm::vec4> & nodes)
+    {
+        glm::vec3 min = instances[begin].min;
+        glm::vec3 max = instances[begin].max;
+        glm::vec3 center_min = (min + max) * 0.5f;
+        glm::vec3 center_max = center_min;
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            min = glm::min(min, instances[i].min);
+            max = glm::max(max, instances[i].max);
+            glm::vec3 const center = (instances[i].min + instances[i].max) * 0.5f;
+            center_min = glm::min(center_min, center);
+            center_max = glm::max(center_max, center);
+        }
+
+        std::size_t const node = nodes.size() / 2;
+        nodes.push_back(glm::vec4(min, 0.f));
+        nodes.push_back(glm::vec4(max, 0.f));
+
+        if (end - begin <= max_leaf_size)
+        {
+            nodes[node * 2].w = begin;
+            nodes[node * 2 + 1].w = end - begin;
+            return;
+        }
+
+        glm::vec3 const extent = center_max - center_min;
+        int const axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+        std::size_t const middle = begin + (end - begin) / 2;
+        std::nth_element(instances.begin() + begin, instances.begin() + middle, instances.begin() + end,
+            [axis](volume_set::instance const & a, volume_set::instance const & b)
+            {
+                return a.min[axis] + a.max[axis] < b.min[axis] + b.max[axis];
+            });
+
+        build_node(instances, begin, middle, nodes);
+        nodes[node * 2].w = nodes.size() / 2;
+        build_node(instances, middle, end, nodes);
+    }
+
+}
+
+volume_set::volume_set()
+{
+    glGenBuffers(1, &node_buffer_);
+    glGenTextures(1, &node_texture_);
+    glGenBuffers(1, &instance_buffer_);
+    glGenTextures(1, &instance_texture_);
+}
+
+volume_set::~volume_set()
+{
+    glDeleteTextures(1, &instance_texture_);
+    glDeleteBuffers(1, &instance_buffer_);
+    glDeleteTextures(1, &node_texture_);
+    glDeleteBuffers(1, &node_buffer_);
+}
+
+void volume_set::set(std::vector<instance> instances)
+{
+    if (instances.empty())
+        throw std::runtime_error("A volume set needs at least one instance");
+
+    instances_ = std::move(instances);
+
+    std::vector<glm::vec4> nodes;
+    build_node(instances_, 0, instances_.size(), nodes);
+    node_count_ = nodes.size() / 2;
+    bounds_min_ = glm::vec3(nodes[0]);
+    bounds_max_ = glm::vec3(nodes[1]);
+
+    std::vector<glm::vec4> instance_texels;
+    for (auto const & i : instances_)
+    {
+        instance_texels.push_back(glm::vec4(i.min, i.density_scale));
+        instance_texels.push_back(glm::vec4(i.max, 0.f));
+    }
+
+    glBindBuffer(GL_TEXTURE_BUFFER, node_buffer_);
+    glBufferData(GL_TEXTURE_BUFFER, nodes.size() * sizeof(nodes[0]), nodes.data(), GL_STATIC_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, node_texture_);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, node_buffer_);
+
+    glBindBuffer(GL_TEXTURE_BUFFER, instance_buffer_);
+    glBufferData(GL_TEXTURE_BUFFER, instance_texels.size() * sizeof(instance_texels[0]), instance_texels.data(), GL_STATIC_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, instance_texture_);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, instance_buffer_);
+}
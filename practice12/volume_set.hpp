@@ -0,0 +1,51 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm/vec3.hpp>
+
+#include <vector>
+
+// Many copies of the volume, each stretched over its own world box, for marching all of them
+// along a ray at once. The boxes go into a small bounding volume hierarchy, two texels per
+// node in a texture buffer: (min, offset) and (max, count), the first child following its
+// parent and offset pointing at the second one, or for leaves count instances from offset on.
+// The instances are in a second buffer in leaf order, as (min, density scale) and (max, 0).
+struct volume_set
+{
+    struct instance
+    {
+        glm::vec3 min;
+        glm::vec3 max;
+        float density_scale = 1.f;
+    };
+
+    volume_set();
+    ~volume_set();
+
+    volume_set(volume_set const &) = delete;
+    volume_set & operator = (volume_set const &) = delete;
+
+    void set(std::vector<instance> instances);
+
+    // In leaf order
+    std::vector<instance> const & instances() const { return instances_; }
+    std::size_t node_count() const { return node_count_; }
+
+    glm::vec3 bounds_min() const { return bounds_min_; }
+    glm::vec3 bounds_max() const { return bounds_max_; }
+
+    GLuint node_texture() const { return node_texture_; }
+    GLuint instance_texture() const { return instance_texture_; }
+
+private:
+    std::vector<instance> instances_;
+    std::size_t node_count_ = 0;
+    glm::vec3 bounds_min_{0.f};
+    glm::vec3 bounds_max_{0.f};
+
+    GLuint node_buffer_ = 0;
+    GLuint node_texture_ = 0;
+    GLuint instance_buffer_ = 0;
+    GLuint instance_texture_ = 0;
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "gltf_loader.hpp"
+
+#include <vector>
+#include <span>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <memory>
+#include <cstdint>
+
+struct compressed_tracks;
+
+// Animation resampled at a fixed rate. Every component of every channel is a separate
+// array holding one value per (frame, bone), with bones contiguous within a frame and
+// padded to a multiple of bone_batch, so evaluating a pose is a few linear passes
+struct baked_clip
+{
+    static constexpr std::size_t bone_batch = 8;
+
+    float sample_rate = 0.f;
+    float duration = 0.f;
+    std::size_t frame_count = 0;
+    std::size_t bone_count = 0;
+    // Bone count rounded up to a multiple of bone_batch
+    std::size_t stride = 0;
+
+    std::vector<float> translation[3];
+    // Consecutive frames of a bone are kept in the same hemisphere, so nlerp needs no sign check
+    std::vector<float> rotation[4];
+    std::vector<float> scale[3];
+
+    // Set by compress_clip, which leaves only the first frame in the arrays above
+    std::shared_ptr<compressed_tracks const> compressed;
+};
+
+// Local bone transforms in the same structure-of-arrays layout, stride values per component
+struct baked_pose
+{
+    std::size_t bone_count = 0;
+
+    std::vector<float> translation[3];
+    std::vector<float> rotation[4];
+    std::vector<float> scale[3];
+
+    glm::mat4 local_transform(std::size_t bone) const;
+};
+
+// Bones without a channel keep the identity transform
+baked_clip bake_animation(gltf_model::animation const & animation, float sample_rate = 30.f);
+
+// Interpolates all bones at once, time is clamped to the clip duration
+void evaluate_pose(baked_clip const & clip, float time, baked_pose & pose);
+
+// Wraps time into [0, duration) for looping playback
+float wrap_clip_time(baked_clip const & clip, float time);
+
+struct clip_handle
+{
+    std::uint32_t index;
+};
+
+// All animations of a model baked once; clips are looked up by name when setting
+// things up and referred to by handle afterwards
+struct clip_library
+{
+    explicit clip_library(gltf_model::animation_map const & animations, float sample_rate = 30.f);
+
+    // Reduces and quantizes the keys of every clip, see compress_clip
+    void compress(std::span<gltf_model::bone const> bones, float position_tolerance);
+
+    std::optional<clip_handle> find(std::string_view name) const;
+
+    baked_clip const & operator[](clip_handle handle) const { return clips_[handle.index]; }
+
+    std::size_t size() const { return clips_.size(); }
+
+private:
+    // Sorted by name
+    std::vector<std::string> names_;
+    std::vector<baked_clip> clips_;
+};
@@ -0,0 +1,316 @@
+#include "animation_compression.hpp"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+packed_quat pack_quat(glm::quat const & q)
+{
+    float v[4] = {q.x, q.y, q.z, q.w};
+
+    int largest = 0;
+    for (int c = 1; c < 4; ++c)
+        if (std::abs(v[c]) > std::abs(v[largest]))
+            largest = c;
+
+    float const sign = (v[largest] < 0.f) ? -1.f : 1.f;
+
+    packed_quat result;
+    for (int c = 0, i = 0; c < 4; ++c)
+    {
+        if (c == largest)
+            continue;
+        float const u = std::clamp(v[c] * sign * float(M_SQRT1_2) + 0.5f, 0.f, 1.f);
+        result[i++] = static_cast<std::uint16_t>(std::lround(u * 32767.f));
+    }
+
+    result[0] |= (largest & 1) << 15;
+    result[1] |= (largest >> 1) << 15;
+    return result;
+}
+
+glm::quat unpack_quat(packed_quat const & p)
+{
+    int const largest = (p[0] >> 15) | ((p[1] >> 15) << 1);
+
+    float v[4];
+    float sum = 0.f;
+    for (int c = 0, i = 0; c < 4; ++c)
+    {
+        if (c == largest)
+            continue;
+        v[c] = ((p[i++] & 0x7fff) / 32767.f - 0.5f) * float(M_SQRT2);
+        sum += v[c] * v[c];
+    }
+    v[largest] = std::sqrt(std::max(0.f, 1.f - sum));
+
+    return glm::quat(v[3], v[0], v[1], v[2]);
+}
+
+namespace
+{
+
+    // Distance from every joint to its farthest descendant joint in the bind pose
+    std::vector<float> bone_reach(std::span<gltf_model::bone const> bones)
+    {
+        std::vector<glm::vec3> positions(bones.size());
+        for (std::size_t i = 0; i < bones.size(); ++i)
+            positions[i] = glm::vec3(glm::inverse(bones[i].inverse_bind_matrix)[3]);
+
+        std::vector<float> reach(bones.size(), 0.f);
+        for (std::size_t i = 0; i < bones.size(); ++i)
+            for (unsigned int a = bones[i].parent; a != -1u; a = bones[a].parent)
+                reach[a] = std::max(reach[a], glm::distance(positions[i], positions[a]));
+
+        // Leaf joints still move the skin around them
+        float const longest = reach.empty() ? 0.f : *std::max_element(reach.begin(), reach.end());
+        for (auto & r : reach)
+            r = std::max(r, longest * 0.1f);
+
+        return reach;
+    }
+
+    // Greedily extends every segment while all frames inside it stay within tolerance
+    // of the interpolation between its ends; error(frame0, frame1, t, frame) measures that
+    template <typename Error>
+    std::vector<std::uint16_t> reduce_keys(std::size_t frame_count, Error const & error)
+    {
+        auto fits = [&](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t frame = begin + 1; frame < end; ++frame)
+                if (!error(begin, end, float(frame - begin) / float(end - begin), frame))
+                    return false;
+            return true;
+        };
+
+        std::vector<std::uint16_t> keys{0};
+
+        bool constant = true;
+        for (std::size_t frame = 1; frame < frame_count && constant; ++frame)
+            constant = error(0, 0, 0.f, frame);
+        if (constant)
+            return keys;
+
+        std::size_t begin = 0;
+        while (begin + 1 < frame_count)
+        {
+            std::size_t end = begin + 1;
+            while (end + 1 < frame_count && fits(begin, end + 1))
+                ++end;
+            keys.push_back(static_cast<std::uint16_t>(end));
+            begin = end;
+        }
+
+        return keys;
+    }
+
+    // Places position between two keys of a track
+    struct key_pair
+    {
+        std::uint32_t key0;
+        std::uint32_t key1;
+        float t;
+    };
+
+    key_pair find_keys(compressed_tracks::track const & track, std::vector<std::uint16_t> const & frames, float position)
+    {
+        auto const begin = frames.begin() + track.first;
+        auto const end = begin + track.count;
+
+        auto it = std::upper_bound(begin + 1, end, position, [](float p, std::uint16_t frame){ return p < frame; });
+        std::uint32_t const key1 = std::min<std::uint32_t>(it - frames.begin(), track.first + track.count - 1);
+        std::uint32_t const key0 = (it - frames.begin()) - 1;
+
+        if (key0 == key1)
+            return {key0, key1, 0.f};
+        return {key0, key1, std::clamp((position - frames[key0]) / float(frames[key1] - frames[key0]), 0.f, 1.f)};
+    }
+
+    struct decode_scratch
+    {
+        std::vector<float> translation[3];
+        std::vector<float> rotation[4];
+        std::vector<float> scale[3];
+        std::vector<float> translation_t;
+        std::vector<float> rotation_t;
+        std::vector<float> scale_t;
+    };
+
+    // Like lerp_track, but with a separate parameter for every bone
+    void lerp_track(float * a, float const * b, float const * t, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+            a[i] += (b[i] - a[i]) * t[i];
+    }
+
+}
+
+void compress_clip(baked_clip & clip, std::span<gltf_model::bone const> bones, float position_tolerance)
+{
+    if (clip.frame_count == 0 || clip.compressed)
+        return;
+    if (clip.frame_count > std::numeric_limits<std::uint16_t>::max() + 1)
+        throw std::runtime_error("Clip is too long to compress");
+
+    auto const reach = bone_reach(bones);
+    float const longest = reach.empty() ? 1.f : *std::max_element(reach.begin(), reach.end());
+
+    auto tracks = std::make_shared<compressed_tracks>();
+
+    for (std::size_t bone = 0; bone < clip.bone_count; ++bone)
+    {
+        float const bone_reach = (bone < reach.size()) ? reach[bone] : longest;
+
+        auto vec = [&](std::vector<float> const (&channel)[3], std::size_t frame)
+        {
+            std::size_t const i = frame * clip.stride + bone;
+            return glm::vec3(channel[0][i], channel[1][i], channel[2][i]);
+        };
+
+        auto quat = [&](std::size_t frame)
+        {
+            std::size_t const i = frame * clip.stride + bone;
+            return glm::quat(clip.rotation[3][i], clip.rotation[0][i], clip.rotation[1][i], clip.rotation[2][i]);
+        };
+
+        auto add_track = [&](auto & channel, std::vector<std::uint16_t> const & keys, auto const & value)
+        {
+            channel.tracks.push_back({static_cast<std::uint32_t>(channel.frames.size()), static_cast<std::uint32_t>(keys.size())});
+            for (auto frame : keys)
+            {
+                channel.frames.push_back(frame);
+                channel.values.push_back(value(frame));
+            }
+        };
+
+        auto translation_keys = reduce_keys(clip.frame_count, [&](std::size_t frame0, std::size_t frame1, float t, std::size_t frame)
+        {
+            return glm::distance(glm::mix(vec(clip.translation, frame0), vec(clip.translation, frame1), t), vec(clip.translation, frame)) <= position_tolerance;
+        });
+        add_track(tracks->translation, translation_keys, [&](std::size_t frame){ return vec(clip.translation, frame); });
+
+        // A rotation by angle a moves a point at distance r by 2 r sin(a/2), and the
+        // sine of the half angle is sqrt(1 - d^2) for the dot product d of the quaternions
+        auto rotation_keys = reduce_keys(clip.frame_count, [&](std::size_t frame0, std::size_t frame1, float t, std::size_t frame)
+        {
+            glm::quat const q = glm::normalize(quat(frame0) * (1.f - t) + quat(frame1) * t);
+            float const d = std::min(std::abs(glm::dot(q, quat(frame))), 1.f);
+            return 2.f * bone_reach * std::sqrt(1.f - d * d) <= position_tolerance;
+        });
+        add_track(tracks->rotation, rotation_keys, [&](std::size_t frame){ return pack_quat(quat(frame)); });
+
+        auto scale_keys = reduce_keys(clip.frame_count, [&](std::size_t frame0, std::size_t frame1, float t, std::size_t frame)
+        {
+            return bone_reach * glm::distance(glm::mix(vec(clip.scale, frame0), vec(clip.scale, frame1), t), vec(clip.scale, frame)) <= position_tolerance;
+        });
+        add_track(tracks->scale, scale_keys, [&](std::size_t frame){ return vec(clip.scale, frame); });
+    }
+
+    auto keep_first_frame = [&](std::vector<float> & c)
+    {
+        c.resize(clip.stride);
+        c.shrink_to_fit();
+    };
+    for (auto & c : clip.translation)
+        keep_first_frame(c);
+    for (auto & c : clip.rotation)
+        keep_first_frame(c);
+    for (auto & c : clip.scale)
+        keep_first_frame(c);
+
+    clip.compressed = std::move(tracks);
+}
+
+void decode_pose(baked_clip const & clip, float position, baked_pose & pose)
+{
+    thread_local decode_scratch scratch;
+
+    auto const & tracks = *clip.compressed;
+
+    // Padding bones keep the identity from the first frame, with both ends equal
+    for (int c = 0; c < 3; ++c)
+    {
+        std::copy(clip.translation[c].begin(), clip.translation[c].end(), pose.translation[c].begin());
+        scratch.translation[c].assign(clip.translation[c].begin(), clip.translation[c].end());
+        std::copy(clip.scale[c].begin(), clip.scale[c].end(), pose.scale[c].begin());
+        scratch.scale[c].assign(clip.scale[c].begin(), clip.scale[c].end());
+    }
+    for (int c = 0; c < 4; ++c)
+    {
+        std::copy(clip.rotation[c].begin(), clip.rotation[c].end(), pose.rotation[c].begin());
+        scratch.rotation[c].assign(clip.rotation[c].begin(), clip.rotation[c].end());
+    }
+    scratch.translation_t.assign(clip.stride, 0.f);
+    scratch.rotation_t.assign(clip.stride, 0.f);
+    scratch.scale_t.assign(clip.stride, 0.f);
+
+    // Gather the keys around position for every bone, then interpolate all of them in linear passes
+    for (std::size_t bone = 0; bone < clip.bone_count; ++bone)
+    {
+        auto const translation = find_keys(tracks.translation.tracks[bone], tracks.translation.frames, position);
+        auto const rotation = find_keys(tracks.rotation.tracks[bone], tracks.rotation.frames, position);
+        auto const scale = find_keys(tracks.scale.tracks[bone], tracks.scale.frames, position);
+
+        for (int c = 0; c < 3; ++c)
+        {
+            pose.translation[c][bone] = tracks.translation.values[translation.key0][c];
+            scratch.translation[c][bone] = tracks.translation.values[translation.key1][c];
+            pose.scale[c][bone] = tracks.scale.values[scale.key0][c];
+            scratch.scale[c][bone] = tracks.scale.values[scale.key1][c];
+        }
+
+        glm::quat const r0 = unpack_quat(tracks.rotation.values[rotation.key0]);
+        glm::quat r1 = unpack_quat(tracks.rotation.values[rotation.key1]);
+        // Packing picks the hemisphere, so neighbouring keys may have opposite signs
+        if (glm::dot(r0, r1) < 0.f)
+            r1 = -r1;
+
+        pose.rotation[0][bone] = r0.x;
+        pose.rotation[1][bone] = r0.y;
+        pose.rotation[2][bone] = r0.z;
+        pose.rotation[3][bone] = r0.w;
+        scratch.rotation[0][bone] = r1.x;
+        scratch.rotation[1][bone] = r1.y;
+        scratch.rotation[2][bone] = r1.z;
+        scratch.rotation[3][bone] = r1.w;
+
+        scratch.translation_t[bone] = translation.t;
+        scratch.rotation_t[bone] = rotation.t;
+        scratch.scale_t[bone] = scale.t;
+    }
+
+    for (int c = 0; c < 3; ++c)
+    {
+        lerp_track(pose.translation[c].data(), scratch.translation[c].data(), scratch.translation_t.data(), clip.stride);
+        lerp_track(pose.scale[c].data(), scratch.scale[c].data(), scratch.scale_t.data(), clip.stride);
+    }
+    for (int c = 0; c < 4; ++c)
+        lerp_track(pose.rotation[c].data(), scratch.rotation[c].data(), scratch.rotation_t.data(), clip.stride);
+}
+
+std::size_t clip_memory_bytes(baked_clip const & clip)
+{
+    std::size_t result = 0;
+    for (auto const & c : clip.translation)
+        result += c.size() * sizeof(float);
+    for (auto const & c : clip.rotation)
+        result += c.size() * sizeof(float);
+    for (auto const & c : clip.scale)
+        result += c.size() * sizeof(float);
+
+    if (clip.compressed)
+    {
+        auto add = [&](auto const & channel)
+        {
+            result += channel.tracks.size() * sizeof(channel.tracks[0])
+                + channel.frames.size() * sizeof(channel.frames[0])
+                + channel.values.size() * sizeof(channel.values[0]);
+        };
+        add(clip.compressed->translation);
+        add(clip.compressed->rotation);
+        add(clip.compressed->scale);
+    }
+
+    return result;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "animation_clip.hpp"
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+#include <glm/gtc/quaternion.hpp>
+
+// Smallest-three encoding in 48 bits: the largest component is dropped (and made positive by
+// flipping the sign of the whole quaternion), the other three lie in [-1/sqrt(2), 1/sqrt(2)]
+// and get 15 bits each, and the index of the dropped one goes into the two spare top bits
+using packed_quat = std::array<std::uint16_t, 3>;
+
+packed_quat pack_quat(glm::quat const & q);
+glm::quat unpack_quat(packed_quat const & p);
+
+// Keys that survived reduction, on the frame grid of the clip they were taken from.
+// Every bone has a track per channel holding at least the first frame, and also the
+// last one unless the channel is constant within tolerance
+struct compressed_tracks
+{
+    struct track
+    {
+        std::uint32_t first = 0;
+        std::uint32_t count = 0;
+    };
+
+    template <typename Value>
+    struct channel
+    {
+        std::vector<track> tracks;
+        std::vector<std::uint16_t> frames;
+        std::vector<Value> values;
+    };
+
+    channel<glm::vec3> translation;
+    channel<packed_quat> rotation;
+    channel<glm::vec3> scale;
+};
+
+// Removes keys that linear interpolation of their neighbours reconstructs within tolerance.
+// The error is measured where it is visible: as the displacement of the farthest descendant
+// joint in the bind pose, so a wobble in the hips counts for more than the same one in a finger.
+// Afterwards the dense arrays of the clip only keep the first frame, which additive layers
+// use as their reference pose
+void compress_clip(baked_clip & clip, std::span<gltf_model::bone const> bones, float position_tolerance);
+
+// Interpolates the keys around position (in frames) into the pose, leaving rotations unnormalized
+void decode_pose(baked_clip const & clip, float position, baked_pose & pose);
+
+// Size of the animation data of a clip, dense or compressed
+std::size_t clip_memory_bytes(baked_clip const & clip);
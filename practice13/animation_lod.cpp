@@ -0,0 +1,104 @@
+#include "animation_lod.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+
+animation_lod::animation_lod(std::span<gltf_model::bone const> bones, std::size_t instance_count, animation_lod_settings settings)
+    : settings(settings)
+    , bones_(bones)
+    , leaf_bones_(bones.size(), 1)
+    , states_(instance_count)
+    , palette_(instance_count * bones.size())
+    , from_palette_(instance_count * bones.size())
+    , to_palette_(instance_count * bones.size())
+{
+    for (auto const & bone : bones)
+        if (bone.parent != -1u)
+            leaf_bones_[bone.parent] = 0;
+}
+
+animation_lod_stats animation_lod::update(std::span<skinned_instance const> instances, std::span<float const> screen_size,
+    float dt, job_system & jobs, std::size_t batch_size)
+{
+    if (instances.size() != states_.size() || screen_size.size() != states_.size())
+        throw std::runtime_error("Animation LOD instance count mismatch");
+
+    batch_size = std::max<std::size_t>(1, batch_size);
+    std::size_t const batch_count = (instances.size() + batch_size - 1) / batch_size;
+
+    jobs.parallel_for(batch_count, [&](std::size_t batch)
+    {
+        std::size_t const end = std::min(instances.size(), (batch + 1) * batch_size);
+        for (std::size_t i = batch * batch_size; i < end; ++i)
+            update_instance(i, instances[i], screen_size[i], dt);
+    });
+
+    animation_lod_stats stats;
+    for (std::size_t i = 0; i < states_.size(); ++i)
+    {
+        if (screen_size[i] < 0.f)
+            ++stats.frozen;
+        else if (states_[i].interval > 1)
+            ++stats.interpolated;
+        else
+            ++stats.evaluated;
+    }
+    return stats;
+}
+
+void animation_lod::update_instance(std::size_t i, skinned_instance const & instance, float screen_size, float dt)
+{
+    auto & state = states_[i];
+
+    // The pose of a culled instance is stale once it becomes visible again
+    if (screen_size < 0.f)
+    {
+        state.keys_valid = false;
+        return;
+    }
+
+    std::uint32_t const interval = (screen_size >= settings.half_rate_size) ? 1
+        : (screen_size >= settings.quarter_rate_size) ? 2 : 4;
+    bool const skip_leaves = screen_size < settings.leaf_skip_size;
+
+    std::span<std::uint8_t const> collapse;
+    if (skip_leaves)
+        collapse = leaf_bones_;
+
+    std::size_t const bone_count = bones_.size();
+    glm::mat4x3 * output = palette_.data() + i * bone_count;
+
+    if (interval == 1)
+    {
+        skin_instance(bones_, instance, 0.f, output, collapse);
+        state.interval = interval;
+        state.keys_valid = false;
+        return;
+    }
+
+    glm::mat4x3 * from = from_palette_.data() + i * bone_count;
+    glm::mat4x3 * to = to_palette_.data() + i * bone_count;
+
+    if (!state.keys_valid || state.interval != interval || state.skip_leaves != skip_leaves)
+    {
+        // Start in the middle of an interval so that instances don't all update on the same frame
+        state.step = i % interval;
+        skin_instance(bones_, instance, -(state.step * dt), from, collapse);
+        skin_instance(bones_, instance, (interval - state.step) * dt, to, collapse);
+        state.interval = interval;
+        state.skip_leaves = skip_leaves;
+        state.keys_valid = true;
+    }
+    else if (state.step == interval)
+    {
+        std::copy(to, to + bone_count, from);
+        skin_instance(bones_, instance, interval * dt, to, collapse);
+        state.step = 0;
+    }
+
+    float const t = static_cast<float>(state.step) / interval;
+    for (std::size_t b = 0; b < bone_count; ++b)
+        output[b] = from[b] * (1.f - t) + to[b] * t;
+
+    ++state.step;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "skinning.hpp"
+
+#include <vector>
+#include <span>
+#include <cstdint>
+
+struct animation_lod_settings
+{
+    // Projected instance height, as a fraction of the viewport height, below which
+    // the pose is evaluated every 2nd and every 4th frame
+    float half_rate_size = 0.25f;
+    float quarter_rate_size = 0.1f;
+
+    // Below this size bones without children reuse their parent's matrix
+    float leaf_skip_size = 0.15f;
+};
+
+struct animation_lod_stats
+{
+    std::size_t evaluated = 0;
+    std::size_t interpolated = 0;
+    std::size_t frozen = 0;
+};
+
+// Keeps a palette for every instance and decides per instance how much work its
+// pose gets this frame:
+//  - instances updated at a reduced rate evaluate two key poses an update interval
+//    apart and blend between them in the frames in between, staggered by instance
+//  - small instances collapse leaf bones into their parents
+//  - culled instances keep their last palette and are not evaluated at all
+struct animation_lod
+{
+    animation_lod(std::span<gltf_model::bone const> bones, std::size_t instance_count, animation_lod_settings settings = {});
+
+    // screen_size[i] is the projected height of instance i, or a negative value if it is culled;
+    // dt is the frame time, used to place the next key pose of throttled instances
+    animation_lod_stats update(std::span<skinned_instance const> instances, std::span<float const> screen_size,
+        float dt, job_system & jobs, std::size_t batch_size = 16);
+
+    std::span<glm::mat4x3 const> palette(std::size_t instance) const
+    {
+        return {palette_.data() + instance * bones_.size(), bones_.size()};
+    }
+
+    animation_lod_settings settings;
+
+private:
+    struct instance_state
+    {
+        std::uint32_t interval = 0;
+        std::uint32_t step = 0;
+        bool skip_leaves = false;
+        bool keys_valid = false;
+    };
+
+    void update_instance(std::size_t i, skinned_instance const & instance, float screen_size, float dt);
+
+    std::span<gltf_model::bone const> bones_;
+    std::vector<std::uint8_t> leaf_bones_;
+    std::vector<instance_state> states_;
+
+    std::vector<glm::mat4x3> palette_;
+    std::vector<glm::mat4x3> from_palette_;
+    std::vector<glm::mat4x3> to_palette_;
+};
@@ -0,0 +1,53 @@
+#include "animation_texture.hpp"
+#include "skinning.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+glm::vec3 animation_texture::sample(clip_handle clip, float time) const
+{
+    auto const & rows = clips[clip.index];
+    if (rows.frame_count == 0)
+        return glm::vec3(rows.first_row, rows.first_row, 0.f);
+
+    float looped = rows.duration > 0.f ? std::fmod(time, rows.duration) : 0.f;
+    if (looped < 0.f)
+        looped += rows.duration;
+
+    float const position = looped * rows.sample_rate;
+    std::size_t const frame0 = std::min(static_cast<std::size_t>(position), rows.frame_count - 1);
+    std::size_t const frame1 = std::min(frame0 + 1, rows.frame_count - 1);
+    float const t = std::min(position - frame0, 1.f);
+
+    return glm::vec3(rows.first_row + frame0, rows.first_row + frame1, t);
+}
+
+animation_texture bake_animation_texture(std::span<gltf_model::bone const> bones, clip_library const & clips, job_system & jobs)
+{
+    animation_texture result;
+    result.bone_count = bones.size();
+
+    std::size_t & row_count = result.row_count;
+    for (std::uint32_t i = 0; i < clips.size(); ++i)
+    {
+        auto const & clip = clips[clip_handle{i}];
+        result.clips.push_back({row_count, clip.frame_count, clip.sample_rate, clip.duration});
+        row_count += clip.frame_count;
+    }
+
+    result.palettes.resize(row_count * bones.size());
+
+    for (std::uint32_t i = 0; i < clips.size(); ++i)
+    {
+        auto const & clip = clips[clip_handle{i}];
+        auto const & rows = result.clips[i];
+
+        jobs.parallel_for(rows.frame_count, [&](std::size_t frame)
+        {
+            skinned_instance const instance{&clip, frame / clip.sample_rate};
+            skin_instance(bones, instance, 0.f, result.palettes.data() + (rows.first_row + frame) * bones.size());
+        });
+    }
+
+    return result;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "animation_clip.hpp"
+#include "job_system.hpp"
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x3.hpp>
+
+#include <vector>
+
+// Bone palettes of every frame of every clip of a library, skinned ahead of time so that
+// instances far enough away to get away with it play clips without any pose evaluation:
+// each row is the palette of one frame, bone_count matrices packed as 3 RGBA texels each
+// (the layout the vertex shader already reads palettes in), and clips take consecutive rows.
+struct animation_texture
+{
+    std::size_t bone_count = 0;
+    std::size_t row_count = 0;
+    // Empty once released after upload; the rows and clips below stay valid
+    std::vector<glm::mat4x3> palettes;
+
+    struct clip_rows
+    {
+        std::size_t first_row;
+        std::size_t frame_count;
+        float sample_rate;
+        float duration;
+    };
+
+    // Indexed by clip_handle::index
+    std::vector<clip_rows> clips;
+
+    std::size_t width() const { return bone_count * 3; }
+    std::size_t height() const { return row_count; }
+
+    // The two rows to blend and the weight of the second for a clip at time, which wraps
+    // around the clip's duration; the frames are the ones evaluate_pose would pick
+    glm::vec3 sample(clip_handle clip, float time) const;
+};
+
+// Frames are skinned in parallel on the job system
+animation_texture bake_animation_texture(std::span<gltf_model::bone const> bones, clip_library const & clips, job_system & jobs);
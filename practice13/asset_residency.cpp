@@ -0,0 +1,67 @@
+#include "asset_residency.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string_view>
+
+residency_policy parse_residency_policy(int argc, char ** argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::string_view(argv[i]) != "--residency")
+            continue;
+        if (i + 1 == argc)
+            throw std::runtime_error("--residency needs a value");
+
+        std::string_view const value = argv[i + 1];
+        for (auto policy : {residency_policy::keep, residency_policy::release, residency_policy::reload})
+            if (value == residency_policy_name(policy))
+                return policy;
+        throw std::runtime_error("Unknown residency policy " + std::string(value));
+    }
+
+    return residency_policy::release;
+}
+
+char const * residency_policy_name(residency_policy policy)
+{
+    switch (policy)
+    {
+    case residency_policy::keep: return "keep";
+    case residency_policy::release: return "release";
+    case residency_policy::reload: return "reload";
+    }
+    return "unknown";
+}
+
+void residency_report::loaded(std::string const & asset, std::size_t bytes)
+{
+    auto & r = find(asset);
+    r.loaded = bytes;
+    r.resident = bytes;
+}
+
+void residency_report::resident(std::string const & asset, std::size_t bytes)
+{
+    find(asset).resident = bytes;
+}
+
+void residency_report::print(std::ostream & out) const
+{
+    std::size_t loaded = 0, resident = 0;
+    for (auto const & r : records_)
+    {
+        out << "    " << r.asset << ": " << r.resident / 1024 << " KB of " << r.loaded / 1024 << " KB" << std::endl;
+        loaded += r.loaded;
+        resident += r.resident;
+    }
+    out << "    total: " << resident / 1024 << " KB of " << loaded / 1024 << " KB" << std::endl;
+}
+
+residency_report::record & residency_report::find(std::string const & asset)
+{
+    auto it = std::find_if(records_.begin(), records_.end(), [&](record const & r){ return r.asset == asset; });
+    if (it == records_.end())
+        it = records_.insert(it, {asset});
+    return *it;
+}
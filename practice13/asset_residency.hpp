@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstddef>
+
+// What happens to the CPU copy of an asset once it is uploaded to the GPU
+enum class residency_policy
+{
+    // Stays for the whole run
+    keep,
+    // Freed; only what the CPU still reads every frame (bones, clips, ranges) remains
+    release,
+    // Freed like with release, but loaded again from the source files when asked for
+    reload,
+};
+
+// From --residency keep|release|reload, release without it
+residency_policy parse_residency_policy(int argc, char ** argv);
+
+char const * residency_policy_name(residency_policy policy);
+
+// CPU memory held by each asset when it was loaded and now
+struct residency_report
+{
+    void loaded(std::string const & asset, std::size_t bytes);
+    void resident(std::string const & asset, std::size_t bytes);
+
+    void print(std::ostream & out) const;
+
+private:
+    struct record
+    {
+        std::string asset;
+        std::size_t loaded = 0;
+        std::size_t resident = 0;
+    };
+
+    std::vector<record> records_;
+
+    record & find(std::string const & asset);
+};
@@ -0,0 +1,165 @@
+#include "blend_tree.hpp"
+
+#include <stdexcept>
+#include <utility>
+#include <cmath>
+
+#include <glm/gtc/quaternion.hpp>
+
+std::size_t blend_tree::add_clip(baked_clip const & clip, float time)
+{
+    nodes.push_back({node::kind_type::clip, &clip, time, 0.f});
+    return nodes.size() - 1;
+}
+
+std::size_t blend_tree::add_crossfade(float weight)
+{
+    nodes.push_back({node::kind_type::crossfade, nullptr, 0.f, weight});
+    return nodes.size() - 1;
+}
+
+std::size_t blend_tree::add_additive(baked_clip const & reference, float weight)
+{
+    nodes.push_back({node::kind_type::additive, &reference, 0.f, weight});
+    return nodes.size() - 1;
+}
+
+namespace
+{
+
+    // Per-thread stack of intermediate poses, reused from call to call
+    thread_local std::vector<baked_pose> pose_stack;
+
+    void crossfade_poses(baked_pose & a, baked_pose const & b, std::size_t stride, float weight)
+    {
+        float const s = 1.f - weight;
+
+        for (int c = 0; c < 3; ++c)
+        {
+            float * at = a.translation[c].data();
+            float * as = a.scale[c].data();
+            float const * bt = b.translation[c].data();
+            float const * bs = b.scale[c].data();
+            for (std::size_t i = 0; i < stride; ++i)
+            {
+                at[i] = at[i] * s + bt[i] * weight;
+                as[i] = as[i] * s + bs[i] * weight;
+            }
+        }
+
+        float * x = a.rotation[0].data();
+        float * y = a.rotation[1].data();
+        float * z = a.rotation[2].data();
+        float * w = a.rotation[3].data();
+        for (std::size_t i = 0; i < stride; ++i)
+        {
+            float const bx = b.rotation[0][i];
+            float const by = b.rotation[1][i];
+            float const bz = b.rotation[2][i];
+            float const bw = b.rotation[3][i];
+
+            // Unlike consecutive frames of a clip, two clips may use opposite hemispheres
+            float const t = (x[i] * bx + y[i] * by + z[i] * bz + w[i] * bw < 0.f) ? -weight : weight;
+
+            float rx = x[i] * s + bx * t;
+            float ry = y[i] * s + by * t;
+            float rz = z[i] * s + bz * t;
+            float rw = w[i] * s + bw * t;
+
+            float const inverse_length = 1.f / std::sqrt(rx * rx + ry * ry + rz * rz + rw * rw);
+            x[i] = rx * inverse_length;
+            y[i] = ry * inverse_length;
+            z[i] = rz * inverse_length;
+            w[i] = rw * inverse_length;
+        }
+    }
+
+    void add_pose(baked_pose & base, baked_pose const & layer, baked_clip const & reference, std::size_t stride, float weight)
+    {
+        // The reference pose is the first frame of the reference clip
+        for (int c = 0; c < 3; ++c)
+        {
+            for (std::size_t i = 0; i < stride; ++i)
+            {
+                base.translation[c][i] += (layer.translation[c][i] - reference.translation[c][i]) * weight;
+                base.scale[c][i] *= 1.f + (layer.scale[c][i] / reference.scale[c][i] - 1.f) * weight;
+            }
+        }
+
+        for (std::size_t i = 0; i < stride; ++i)
+        {
+            glm::quat b(base.rotation[3][i], base.rotation[0][i], base.rotation[1][i], base.rotation[2][i]);
+            glm::quat l(layer.rotation[3][i], layer.rotation[0][i], layer.rotation[1][i], layer.rotation[2][i]);
+            glm::quat r(reference.rotation[3][i], reference.rotation[0][i], reference.rotation[1][i], reference.rotation[2][i]);
+
+            glm::quat delta = l * glm::conjugate(r);
+            if (delta.w < 0.f)
+                delta = -delta;
+
+            glm::quat identity(1.f, 0.f, 0.f, 0.f);
+            glm::quat result = glm::normalize(identity * (1.f - weight) + delta * weight) * b;
+
+            base.rotation[0][i] = result.x;
+            base.rotation[1][i] = result.y;
+            base.rotation[2][i] = result.z;
+            base.rotation[3][i] = result.w;
+        }
+    }
+
+}
+
+void evaluate_blend_tree(blend_tree const & tree, float time_offset, baked_pose & pose)
+{
+    std::size_t top = 0;
+    std::size_t stride = 0;
+
+    auto check_stride = [&](baked_clip const & clip)
+    {
+        if (stride == 0)
+            stride = clip.stride;
+        else if (clip.stride != stride)
+            throw std::runtime_error("Blend tree mixes clips of different skeletons");
+    };
+
+    for (auto const & node : tree.nodes)
+    {
+        switch (node.kind)
+        {
+        case blend_tree::node::kind_type::clip:
+            check_stride(*node.clip);
+            if (top == pose_stack.size())
+                pose_stack.emplace_back();
+            evaluate_pose(*node.clip, wrap_clip_time(*node.clip, node.time + time_offset), pose_stack[top++]);
+            break;
+        case blend_tree::node::kind_type::crossfade:
+            if (top < 2)
+                throw std::runtime_error("Blend tree crossfade needs two inputs");
+            --top;
+            crossfade_poses(pose_stack[top - 1], pose_stack[top], stride, node.weight);
+            break;
+        case blend_tree::node::kind_type::additive:
+            if (top < 2)
+                throw std::runtime_error("Blend tree additive layer needs two inputs");
+            check_stride(*node.clip);
+            if (node.clip->frame_count == 0)
+                throw std::runtime_error("Blend tree additive reference clip is empty");
+            --top;
+            add_pose(pose_stack[top - 1], pose_stack[top], *node.clip, stride, node.weight);
+            break;
+        }
+    }
+
+    if (top != 1)
+        throw std::runtime_error("Blend tree must produce exactly one pose");
+
+    // Hand the result over without copying; the caller's buffers become scratch
+    auto & result = pose_stack[0];
+    for (int c = 0; c < 3; ++c)
+    {
+        std::swap(pose.translation[c], result.translation[c]);
+        std::swap(pose.scale[c], result.scale[c]);
+    }
+    for (int c = 0; c < 4; ++c)
+        std::swap(pose.rotation[c], result.rotation[c]);
+    pose.bone_count = result.bone_count;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "animation_clip.hpp"
+
+#include <vector>
+
+// A pose blend written in post-order: every node consumes the poses produced by the
+// nodes before it, so evaluation is a single pass over a stack of poses
+struct blend_tree
+{
+    struct node
+    {
+        enum class kind_type
+        {
+            clip,
+            crossfade,
+            additive,
+        };
+
+        kind_type kind;
+        // The sampled clip, or the clip whose first frame is the additive reference pose
+        baked_clip const * clip = nullptr;
+        float time = 0.f;
+        // Crossfade: weight of the second pose; additive: weight of the layer
+        float weight = 0.f;
+    };
+
+    std::vector<node> nodes;
+
+    // Pushes the clip sampled at time, returns the node index
+    std::size_t add_clip(baked_clip const & clip, float time);
+
+    // Pops two poses and pushes their blend, weight 0 giving the first one
+    std::size_t add_crossfade(float weight);
+
+    // Pops a base and a layer pose and pushes the base with the layer's difference
+    // from the first frame of reference, scaled by weight, applied on top
+    std::size_t add_additive(baked_clip const & reference, float weight);
+};
+
+// time_offset is added to the time of every clip, which is then wrapped to its duration.
+// Intermediate poses live in per-thread scratch memory, so after the first few calls
+// evaluation does not allocate
+void evaluate_blend_tree(blend_tree const & tree, float time_offset, baked_pose & pose);
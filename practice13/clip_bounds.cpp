@@ -0,0 +1,114 @@
+#include "clip_bounds.hpp"
+#include "skinning.hpp"
+
+#include <glm/common.hpp>
+#include <glm/mat4x3.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+namespace
+{
+
+    // Of the extent of a segment, on every side
+    constexpr float interpolation_margin = 0.05f;
+
+}
+
+bone_bounds compute_bone_bounds(merged_geometry const & geometry, std::size_t bone_count)
+{
+    bone_bounds result;
+    result.min.assign(bone_count, glm::vec3(std::numeric_limits<float>::infinity()));
+    result.max.assign(bone_count, glm::vec3(-std::numeric_limits<float>::infinity()));
+
+    for (std::size_t v = 0; v < geometry.vertices.size(); ++v)
+    {
+        auto const & vertex = geometry.vertices[v];
+        for (int c = 0; c < 4; ++c)
+        {
+            if (vertex.weights[c] == 0)
+                continue;
+
+            std::size_t const bone = geometry.wide_joints.empty() ? vertex.joints[c] : geometry.wide_joints[v][c];
+            if (bone >= bone_count)
+                continue;
+            result.min[bone] = glm::min(result.min[bone], vertex.position);
+            result.max[bone] = glm::max(result.max[bone], vertex.position);
+        }
+    }
+
+    return result;
+}
+
+std::pair<glm::vec3, glm::vec3> clip_bounds::at(baked_clip const & clip, float time) const
+{
+    float const frame = wrap_clip_time(clip, time) * sample_rate;
+    std::size_t const segment = std::min(static_cast<std::size_t>(frame) / frames_per_segment, min.size() - 1);
+    return {min[segment], max[segment]};
+}
+
+clip_bounds compute_clip_bounds(std::span<gltf_model::bone const> bones, bone_bounds const & bone_boxes, baked_clip const & clip,
+    std::size_t frames_per_segment)
+{
+    clip_bounds result;
+    result.sample_rate = clip.sample_rate;
+    result.frames_per_segment = std::max<std::size_t>(frames_per_segment, 1);
+
+    std::size_t const frame_count = std::max<std::size_t>(clip.frame_count, 1);
+    std::size_t const segment_count = (frame_count + result.frames_per_segment - 1) / result.frames_per_segment;
+    result.min.assign(segment_count, glm::vec3(std::numeric_limits<float>::infinity()));
+    result.max.assign(segment_count, glm::vec3(-std::numeric_limits<float>::infinity()));
+
+    std::vector<glm::mat4x3> palette(bones.size());
+    std::vector<glm::vec3> frame_min(frame_count);
+    std::vector<glm::vec3> frame_max(frame_count);
+
+    for (std::size_t frame = 0; frame < frame_count; ++frame)
+    {
+        float const time = std::min(frame / clip.sample_rate, clip.duration);
+        skin_instance(bones, skinned_instance{&clip, time}, 0.f, palette.data());
+
+        frame_min[frame] = glm::vec3(std::numeric_limits<float>::infinity());
+        frame_max[frame] = glm::vec3(-std::numeric_limits<float>::infinity());
+        for (std::size_t b = 0; b < bones.size() && b < bone_boxes.min.size(); ++b)
+        {
+            if (bone_boxes.min[b].x > bone_boxes.max[b].x)
+                continue;
+
+            auto const & matrix = palette[b];
+            glm::vec3 const center = matrix * glm::vec4((bone_boxes.min[b] + bone_boxes.max[b]) / 2.f, 1.f);
+            glm::vec3 const half_size = (bone_boxes.max[b] - bone_boxes.min[b]) / 2.f;
+            glm::vec3 extent(0.f);
+            for (int axis = 0; axis < 3; ++axis)
+                extent += glm::abs(matrix[axis]) * half_size[axis];
+
+            frame_min[frame] = glm::min(frame_min[frame], center - extent);
+            frame_max[frame] = glm::max(frame_max[frame], center + extent);
+        }
+    }
+
+    // A segment also takes the first frame of the next, since poses in between blend the two
+    for (std::size_t segment = 0; segment < segment_count; ++segment)
+    {
+        std::size_t const first = segment * result.frames_per_segment;
+        std::size_t const last = std::min(first + result.frames_per_segment, frame_count - 1);
+        for (std::size_t frame = first; frame <= last; ++frame)
+        {
+            result.min[segment] = glm::min(result.min[segment], frame_min[frame]);
+            result.max[segment] = glm::max(result.max[segment], frame_max[frame]);
+        }
+
+        if (result.min[segment].x > result.max[segment].x)
+        {
+            result.min[segment] = result.max[segment] = glm::vec3(0.f);
+            continue;
+        }
+
+        glm::vec3 const margin = (result.max[segment] - result.min[segment]) * interpolation_margin;
+        result.min[segment] -= margin;
+        result.max[segment] += margin;
+    }
+
+    return result;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "gltf_loader.hpp"
+#include "animation_clip.hpp"
+#include "merged_geometry.hpp"
+
+#include <glm/vec3.hpp>
+
+#include <vector>
+#include <utility>
+
+// Box of the bind-pose vertices that every bone has weight on, in the space the bone matrices
+// map from; min is above max for bones that move no vertex
+struct bone_bounds
+{
+    std::vector<glm::vec3> min;
+    std::vector<glm::vec3> max;
+};
+
+bone_bounds compute_bone_bounds(merged_geometry const & geometry, std::size_t bone_count);
+
+// Bounds of the skin over every stretch of a clip, in the space of the node the skeleton hangs
+// from, so that an animated instance can be culled without evaluating its pose. A vertex blends
+// the places its bones move it to, so it stays inside their boxes moved by the bone matrices;
+// the union of those over the baked frames of a segment bounds the skin over the segment. Poses
+// in between frames, and crossfades between clips, interpolate rotations and can leave that
+// union by a little, which a margin covers.
+struct clip_bounds
+{
+    float sample_rate = 0.f;
+    std::size_t frames_per_segment = 0;
+    std::vector<glm::vec3> min;
+    std::vector<glm::vec3> max;
+
+    // At time, wrapped to the clip's duration as when playing it looped
+    std::pair<glm::vec3, glm::vec3> at(baked_clip const & clip, float time) const;
+};
+
+clip_bounds compute_clip_bounds(std::span<gltf_model::bone const> bones, bone_bounds const & bone_boxes, baked_clip const & clip,
+    std::size_t frames_per_segment = 15);
@@ -0,0 +1,81 @@
+#include "gl_state_cache.hpp"
+
+#include <stdexcept>
+
+void gl_state_cache::invalidate()
+{
+    *this = gl_state_cache{};
+}
+
+bool gl_state_cache::changed(bool differs)
+{
+    ++(differs ? issued_ : skipped_);
+    return differs;
+}
+
+void gl_state_cache::set_enabled(GLenum capability, bool enabled)
+{
+    std::optional<bool> * cached = nullptr;
+    switch (capability)
+    {
+    case GL_CULL_FACE: cached = &cull_face_; break;
+    case GL_BLEND: cached = &blend_; break;
+    case GL_DEPTH_TEST: cached = &depth_test_; break;
+    default: throw std::runtime_error("Capability is not tracked by the state cache");
+    }
+
+    if (!changed(*cached != enabled))
+        return;
+
+    *cached = enabled;
+    if (enabled)
+        glEnable(capability);
+    else
+        glDisable(capability);
+}
+
+void gl_state_cache::depth_mask(bool enabled)
+{
+    if (!changed(depth_mask_ != enabled))
+        return;
+
+    depth_mask_ = enabled;
+    glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+}
+
+void gl_state_cache::use_program(GLuint program)
+{
+    if (!changed(program_ != program))
+        return;
+
+    program_ = program;
+    glUseProgram(program);
+}
+
+void gl_state_cache::bind_vertex_array(GLuint vao)
+{
+    if (!changed(vao_ != vao))
+        return;
+
+    vao_ = vao;
+    glBindVertexArray(vao);
+}
+
+// Assumes one target per unit, which is how the renderer uses them
+void gl_state_cache::bind_texture(GLuint unit, GLenum target, GLuint texture)
+{
+    if (unit >= texture_units)
+        throw std::runtime_error("Texture unit is not tracked by the state cache");
+
+    if (!changed(textures_[unit] != texture))
+        return;
+
+    if (active_unit_ != unit)
+    {
+        active_unit_ = unit;
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    textures_[unit] = texture;
+    glBindTexture(target, texture);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <array>
+#include <optional>
+#include <cstddef>
+
+// Shadow copy of the GL state the renderer touches, so that setting a value that is
+// already current costs no GL call. Anything changed behind its back must be followed
+// by invalidate().
+struct gl_state_cache
+{
+    static constexpr std::size_t texture_units = 8;
+
+    void invalidate();
+
+    void set_enabled(GLenum capability, bool enabled);
+    void depth_mask(bool enabled);
+    void use_program(GLuint program);
+    void bind_vertex_array(GLuint vao);
+    void bind_texture(GLuint unit, GLenum target, GLuint texture);
+
+    std::size_t issued() const { return issued_; }
+    std::size_t skipped() const { return skipped_; }
+    void reset_counters() { issued_ = skipped_ = 0; }
+
+private:
+    bool changed(bool differs);
+
+    std::optional<bool> cull_face_;
+    std::optional<bool> blend_;
+    std::optional<bool> depth_test_;
+    std::optional<bool> depth_mask_;
+    std::optional<GLuint> program_;
+    std::optional<GLuint> vao_;
+    std::optional<GLuint> active_unit_;
+    std::array<std::optional<GLuint>, texture_units> textures_;
+
+    std::size_t issued_ = 0;
+    std::size_t skipped_ = 0;
+};
@@ -1,10 +1,18 @@
 #include "gltf_loader.hpp"
+#include "meshopt_decoder.hpp"
+#include "virtual_fs.hpp"
+#include "job_system.hpp"
+#include "json_arena.hpp"
+#include "mesh_tangents.hpp"
 
 #include <rapidjson/document.h>
-#include <rapidjson/istreamwrapper.h>
 
-#include <fstream>
+#include <glm/gtx/matrix_decompose.hpp>
+
 #include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <unordered_map>
 
 static unsigned int attribute_type_to_size(std::string const & type)
 {
@@ -12,56 +20,485 @@ static unsigned int attribute_type_to_size(std::string const & type)
     if (type == "VEC2") return 2;
     if (type == "VEC3") return 3;
     if (type == "VEC4") return 4;
-    return 0;
+    if (type == "MAT4") return 16;
     throw std::runtime_error("Unknown attribute type: " + type);
 }
 
-gltf_model load_gltf(std::filesystem::path const & path)
+static std::uint32_t read_uint32(char const * data)
+{
+    std::uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+struct glb_chunks
+{
+    std::span<char const> json;
+    std::span<char const> bin;
+};
+
+// Splits a binary glTF container into its JSON and BIN chunks, see
+// https://registry.khronos.org/glTF/specs/2.0/glTF-2.0.html#binary-gltf-layout
+static std::optional<glb_chunks> parse_glb(std::span<char const> data)
+{
+    if (data.size() < 12 || std::memcmp(data.data(), "glTF", 4) != 0)
+        return std::nullopt;
+
+    if (read_uint32(data.data() + 4) != 2)
+        throw std::runtime_error("Unsupported GLB version");
+
+    std::size_t const length = std::min<std::size_t>(read_uint32(data.data() + 8), data.size());
+
+    glb_chunks result;
+    for (std::size_t offset = 12; offset + 8 <= length;)
+    {
+        std::size_t const chunk_length = read_uint32(data.data() + offset);
+        std::uint32_t const chunk_type = read_uint32(data.data() + offset + 4);
+        offset += 8;
+
+        if (offset + chunk_length > length)
+            throw std::runtime_error("Truncated GLB chunk");
+
+        if (chunk_type == 0x4E4F534A && result.json.empty()) // JSON
+            result.json = data.subspan(offset, chunk_length);
+        else if (chunk_type == 0x004E4942 && result.bin.empty()) // BIN
+            result.bin = data.subspan(offset, chunk_length);
+
+        offset += chunk_length;
+    }
+
+    if (result.json.empty())
+        throw std::runtime_error("GLB has no JSON chunk");
+
+    return result;
+}
+
+static std::size_t component_size(unsigned int type)
+{
+    switch (type)
+    {
+    case 0x1400: // GL_BYTE
+    case 0x1401: // GL_UNSIGNED_BYTE
+        return 1;
+    case 0x1402: // GL_SHORT
+    case 0x1403: // GL_UNSIGNED_SHORT
+        return 2;
+    case 0x1405: // GL_UNSIGNED_INT
+    case 0x1406: // GL_FLOAT
+        return 4;
+    }
+    throw std::runtime_error("Unsupported accessor component type " + std::to_string(type));
+}
+
+static char const * element(gltf_model const & model, gltf_model::accessor const & accessor, std::size_t i)
+{
+    std::size_t const size = component_size(accessor.type) * accessor.size;
+    std::size_t const stride = accessor.view.stride ? accessor.view.stride : size;
+    if (i >= accessor.count || accessor.offset + i * stride + size > accessor.view.size)
+        throw std::runtime_error("Accessor is out of its buffer view bounds");
+
+    return model.buffers[accessor.view.buffer].data.data() + accessor.buffer_offset() + i * stride;
+}
+
+glm::vec4 read_accessor(gltf_model const & model, gltf_model::accessor const & accessor, std::size_t i)
+{
+    std::size_t const size = component_size(accessor.type);
+    char const * data = element(model, accessor, i);
+
+    glm::vec4 result(0.f);
+    for (unsigned int c = 0; c < std::min(accessor.size, 4u); ++c, data += size)
+    {
+        switch (accessor.type)
+        {
+        case 0x1400:
+            {
+                std::int8_t value;
+                std::memcpy(&value, data, 1);
+                result[c] = accessor.normalized ? std::max(value / 127.f, -1.f) : value;
+            }
+            break;
+        case 0x1401:
+            {
+                std::uint8_t value;
+                std::memcpy(&value, data, 1);
+                result[c] = accessor.normalized ? value / 255.f : value;
+            }
+            break;
+        case 0x1402:
+            {
+                std::int16_t value;
+                std::memcpy(&value, data, 2);
+                result[c] = accessor.normalized ? std::max(value / 32767.f, -1.f) : value;
+            }
+            break;
+        case 0x1403:
+            {
+                std::uint16_t value;
+                std::memcpy(&value, data, 2);
+                result[c] = accessor.normalized ? value / 65535.f : value;
+            }
+            break;
+        case 0x1405:
+            {
+                std::uint32_t value;
+                std::memcpy(&value, data, 4);
+                result[c] = value;
+            }
+            break;
+        case 0x1406:
+            std::memcpy(&result[c], data, 4);
+            break;
+        }
+    }
+    return result;
+}
+
+std::uint32_t read_index(gltf_model const & model, gltf_model::accessor const & accessor, std::size_t i)
+{
+    char const * data = element(model, accessor, i);
+    switch (accessor.type)
+    {
+    case 0x1401: // GL_UNSIGNED_BYTE
+        return static_cast<std::uint8_t>(*data);
+    case 0x1403: // GL_UNSIGNED_SHORT
+        {
+            std::uint16_t value;
+            std::memcpy(&value, data, 2);
+            return value;
+        }
+    case 0x1405: // GL_UNSIGNED_INT
+        {
+            std::uint32_t value;
+            std::memcpy(&value, data, 4);
+            return value;
+        }
+    }
+    throw std::runtime_error("Unsupported index type " + std::to_string(accessor.type));
+}
+
+// What a monotonic arena hands out for count objects of type T, with room to align them
+template <typename T>
+static std::size_t array_bytes(std::size_t count)
+{
+    return count == 0 ? 0 : count * sizeof(T) + alignof(std::max_align_t);
+}
+
+// Strings too long for the string object itself take their length and a terminator; counting
+// every one errs on the generous side
+static std::size_t string_bytes(std::size_t length)
 {
-    rapidjson::Document document;
+    return length + 1 + alignof(std::max_align_t);
+}
+
+static std::size_t string_bytes(rapidjson::Value const & object, char const * name)
+{
+    return object.HasMember(name) ? string_bytes(object[name].GetStringLength()) : 0;
+}
+
+gltf_model::gltf_model(std::size_t arena_bytes, std::size_t animation_arena_bytes)
+    // The arenas take their first chunk when first allocated from, so an empty model costs nothing
+    : arena(std::make_unique<std::pmr::monotonic_buffer_resource>(std::max<std::size_t>(arena_bytes, 1024)))
+    , animation_arena(std::make_unique<std::pmr::monotonic_buffer_resource>(std::max<std::size_t>(animation_arena_bytes, 1024)))
+    , buffers(arena.get())
+    , meshes(arena.get())
+    , nodes(arena.get())
+    , bones(arena.get())
+    , skins(arena.get())
+    , animations(arena.get())
+{}
+
+gltf_model load_gltf(std::filesystem::path const & path, gltf_load_options const & options)
+{
+    auto & arena = thread_json_arena();
+    auto const pool = arena.pool();
+    rapidjson::MemoryPoolAllocator<> allocator(pool.data(), pool.size());
+    rapidjson::Document document(&allocator);
+
+    auto const file = asset_fs().read(path);
+    auto const glb = parse_glb(file.data);
 
     {
-        std::ifstream input(path, std::ios::binary);
-        rapidjson::IStreamWrapper stream(input);
-        document.ParseStream(stream);
+        // Parsing in place writes into the text, so it is copied out of the read-only file data
+        auto const json = glb ? glb->json : file.data;
+        char * const text = arena.text(json.size());
+        std::copy(json.begin(), json.end(), text);
+
+        document.ParseInsitu(text);
+        if (document.HasParseError())
+            throw std::runtime_error("Failed to parse " + path.string());
+
+        arena.record_pool_use(allocator.Capacity());
+    }
+
+    auto array_member = [&](char const * name)
+    {
+        static rapidjson::Value const empty(rapidjson::kArrayType);
+        rapidjson::Value const & value = document.HasMember(name) ? document[name] : empty;
+        return value.GetArray();
+    };
+
+    auto element = [&](char const * name, unsigned int index) -> rapidjson::Value const &
+    {
+        auto array = array_member(name);
+        if (index >= array.Size())
+            throw std::runtime_error(std::string("Invalid ") + name + " index in " + path.string());
+        return array[index];
+    };
+
+    // Draco needs a whole geometry decoder, so such files are rejected up front
+    for (auto const & extension : array_member("extensionsRequired"))
+    {
+        std::string const name = extension.GetString();
+        if (name != "EXT_meshopt_compression" && name != "KHR_mesh_quantization")
+            throw std::runtime_error("Unsupported required extension " + name + " in " + path.string());
+    }
+
+    // Buffers and images of a remote pack start downloading now, in parallel, instead of one
+    // at a time as the parsing below and the texture decoding reach them
+    for (char const * name : {"buffers", "images"})
+        for (auto const & external : array_member(name))
+            if (external.HasMember("uri"))
+                asset_fs().prefetch(path.parent_path() / external["uri"].GetString());
+
+    auto const is_compressed = [](rapidjson::Value const & view)
+    {
+        return view.HasMember("extensions") && view["extensions"].HasMember("EXT_meshopt_compression");
+    };
+
+    // Triangles with a normal and texcoords to build the frame from, but none in the file
+    auto const needs_tangents = [](rapidjson::Value const & primitive)
+    {
+        auto const & attributes = primitive["attributes"];
+        bool const triangles = !primitive.HasMember("mode") || primitive["mode"].GetUint() == 4;
+        return triangles && attributes.HasMember("NORMAL") && attributes.HasMember("TEXCOORD_0") && !attributes.HasMember("TANGENT");
+    };
+
+    // First pass: everything but the animation keys, from the counts in the JSON. Every array
+    // is reserved at its final size below, so that none of them grows into a second block.
+    std::size_t arena_bytes = 0;
+    std::size_t buffer_count = array_member("buffers").Size();
+    for (auto const & view : array_member("bufferViews"))
+        if (is_compressed(view))
+            ++buffer_count;
+    for (auto const & mesh : array_member("meshes"))
+        for (auto const & primitive : mesh["primitives"].GetArray())
+            if (needs_tangents(primitive))
+                ++buffer_count;
+    arena_bytes += array_bytes<gltf_model::buffer>(buffer_count);
+
+    std::size_t longest_image_uri = 0;
+    for (auto const & image : array_member("images"))
+        if (image.HasMember("uri"))
+            longest_image_uri = std::max<std::size_t>(longest_image_uri, image["uri"].GetStringLength());
+
+    arena_bytes += array_bytes<gltf_model::mesh>(array_member("meshes").Size());
+    for (auto const & mesh : array_member("meshes"))
+    {
+        auto const primitives = mesh["primitives"].GetArray();
+        arena_bytes += string_bytes(mesh, "name") + array_bytes<gltf_model::primitive>(primitives.Size());
+        for (auto const & primitive : primitives)
+            arena_bytes += string_bytes(longest_image_uri)
+                + array_bytes<gltf_model::morph_target>(primitive.HasMember("targets") ? primitive["targets"].Size() : 0);
+        std::size_t const weights = mesh.HasMember("weights") ? mesh["weights"].Size()
+            : (primitives.Size() > 0 && primitives[0].HasMember("targets") ? primitives[0]["targets"].Size() : 0);
+        arena_bytes += array_bytes<float>(weights);
     }
 
-    gltf_model result;
+    arena_bytes += array_bytes<gltf_model::node>(array_member("nodes").Size());
+    for (auto const & node : array_member("nodes"))
+        arena_bytes += string_bytes(node, "name");
+
+    std::size_t joint_count = 0;
+    arena_bytes += array_bytes<gltf_model::skin>(array_member("skins").Size());
+    for (auto const & skin : array_member("skins"))
+    {
+        auto const joints = skin["joints"].GetArray();
+        arena_bytes += string_bytes(skin, "name") + array_bytes<unsigned int>(joints.Size());
+        for (auto const & joint : joints)
+            if (joint.GetUint() < array_member("nodes").Size())
+                arena_bytes += string_bytes(array_member("nodes")[joint.GetUint()], "name");
+        joint_count += joints.Size();
+    }
+    arena_bytes += array_bytes<gltf_model::bone>(joint_count);
+
+    // Names, map nodes, and buckets for twice as many animations as there are
+    std::size_t const animation_count = array_member("animations").Size();
+    for (auto const & animation : array_member("animations"))
+        arena_bytes += animation.HasMember("name") ? string_bytes(animation, "name") : string_bytes(32);
+    arena_bytes += array_bytes<std::pair<std::pmr::string const, gltf_model::animation>>(animation_count)
+        + animation_count * (2 * sizeof(void *) + alignof(std::max_align_t)) + array_bytes<void *>(2 * animation_count + 16);
+
+    gltf_model result(arena_bytes);
+    auto * const memory = result.arena.get();
+
+    auto const buffers = array_member("buffers");
+    result.buffers.reserve(buffer_count);
+    result.buffers.resize(buffers.Size());
+
+    // Vertex data is used straight from the mapping without copying it
+    auto map_buffer = [&](unsigned int index) -> gltf_model::buffer const &
+    {
+        auto & buffer = result.buffers.at(index);
+        if (buffer.owner)
+            return buffer;
+
+        auto const & description = element("buffers", index);
+        if (description.HasMember("uri"))
+        {
+            auto const buffer_path = path.parent_path() / description["uri"].GetString();
+            auto data = asset_fs().read(buffer_path);
+            buffer.owner = std::move(data.owner);
+            buffer.data = data.data;
+        }
+        else
+        {
+            // Only the first buffer may refer to the GLB binary chunk
+            if (!glb || index != 0)
+                throw std::runtime_error("Buffer without uri outside of a GLB file");
+            buffer.owner = file.owner;
+            buffer.data = glb->bin;
+        }
+
+        if (description["byteLength"].GetUint() > buffer.data.size())
+            throw std::runtime_error("Buffer is shorter than its byteLength in " + path.string());
 
+        return buffer;
+    };
+
+    // Compressed buffer views are all decoded before anything reads them, each into a buffer
+    // of its own that the view is redirected to. The buffer the view itself names is usually
+    // an uncompressed fallback that isn't stored anywhere.
+    std::unordered_map<unsigned int, gltf_model::buffer_view> decoded_views;
     {
-        auto buffers = document["buffers"].GetArray();
-        assert(buffers.Size() == 1);
+        struct compressed_view
+        {
+            std::span<char const> source;
+            std::span<char> destination;
+            std::size_t count;
+            std::size_t stride;
+            meshopt_mode mode;
+            meshopt_filter filter;
+        };
+
+        std::vector<compressed_view> compressed;
+
+        auto const views = array_member("bufferViews");
+        for (unsigned int i = 0; i < views.Size(); ++i)
+        {
+            auto const & view = views[i];
+            if (!is_compressed(view))
+                continue;
+
+            auto const & extension = view["extensions"]["EXT_meshopt_compression"];
+
+            auto const source_offset = extension.HasMember("byteOffset") ? extension["byteOffset"].GetUint() : 0u;
+            auto const source_size = extension["byteLength"].GetUint();
+            auto const & source_buffer = map_buffer(extension["buffer"].GetUint());
+            if (std::size_t(source_offset) + source_size > source_buffer.data.size())
+                throw std::runtime_error("Compressed buffer view out of range in " + path.string());
+
+            compressed_view item;
+            item.source = source_buffer.data.subspan(source_offset, source_size);
+            item.count = extension["count"].GetUint();
+            item.stride = extension["byteStride"].GetUint();
+
+            std::string const mode = extension["mode"].GetString();
+            if (mode == "ATTRIBUTES")
+                item.mode = meshopt_mode::attributes;
+            else if (mode == "TRIANGLES")
+                item.mode = meshopt_mode::triangles;
+            else if (mode == "INDICES")
+                item.mode = meshopt_mode::indices;
+            else
+                throw std::runtime_error("Unknown meshopt mode " + mode + " in " + path.string());
+
+            std::string const filter = extension.HasMember("filter") ? extension["filter"].GetString() : "NONE";
+            if (filter == "NONE")
+                item.filter = meshopt_filter::none;
+            else if (filter == "OCTAHEDRAL")
+                item.filter = meshopt_filter::octahedral;
+            else if (filter == "QUATERNION")
+                item.filter = meshopt_filter::quaternion;
+            else if (filter == "EXPONENTIAL")
+                item.filter = meshopt_filter::exponential;
+            else
+                throw std::runtime_error("Unknown meshopt filter " + filter + " in " + path.string());
+
+            auto & buffer = result.buffers.emplace_back();
+            auto decoded = std::make_shared<std::vector<char>>(item.count * item.stride);
+            buffer.data = {decoded->data(), decoded->size()};
+            item.destination = *decoded;
+            buffer.owner = std::move(decoded);
 
-        auto const buffer_uri = buffers[0]["uri"].GetString();
+            decoded_views[i] = {
+                static_cast<unsigned int>(result.buffers.size() - 1),
+                0u,
+                static_cast<unsigned int>(buffer.data.size()),
+                view.HasMember("byteStride") ? view["byteStride"].GetUint() : 0u,
+            };
+
+            compressed.push_back(item);
+        }
 
-        auto const buffer_path = path.parent_path() / buffer_uri;
+        auto decode = [&](std::size_t i)
+        {
+            auto const & item = compressed[i];
+            meshopt_decode(item.destination, item.count, item.stride, item.mode, item.filter, item.source);
+        };
 
-        result.buffer.resize(std::filesystem::file_size(buffer_path));
-        std::ifstream buffer(buffer_path, std::ios::binary);
-        buffer.read(result.buffer.data(), result.buffer.size());
+        if (options.jobs)
+            options.jobs->parallel_for(compressed.size(), decode);
+        else
+            for (std::size_t i = 0; i < compressed.size(); ++i)
+                decode(i);
     }
 
-    auto parse_buffer_view = [&](int index) -> gltf_model::buffer_view
+    auto parse_buffer_view = [&](unsigned int index) -> gltf_model::buffer_view
     {
-        auto view = document["bufferViews"].GetArray()[index].GetObject();
-        return {view["byteOffset"].GetUint(), view["byteLength"].GetUint()};
+        if (auto it = decoded_views.find(index); it != decoded_views.end())
+            return it->second;
+
+        auto const & view = element("bufferViews", index);
+        gltf_model::buffer_view result_view{
+            view["buffer"].GetUint(),
+            view.HasMember("byteOffset") ? view["byteOffset"].GetUint() : 0u,
+            view["byteLength"].GetUint(),
+            view.HasMember("byteStride") ? view["byteStride"].GetUint() : 0u,
+        };
+
+        if (result_view.offset + result_view.size > map_buffer(result_view.buffer).data.size())
+            throw std::runtime_error("Buffer view out of range in " + path.string());
+
+        return result_view;
     };
 
-    auto parse_accessor = [&](int index) -> gltf_model::accessor
+    auto parse_accessor = [&](unsigned int index) -> gltf_model::accessor
     {
-        auto accessor = document["accessors"].GetArray()[index].GetObject();
+        auto const & accessor = element("accessors", index);
+        if (!accessor.HasMember("bufferView"))
+            throw std::runtime_error("Accessors without a buffer view are not supported");
+
         return {
-            parse_buffer_view(accessor["bufferView"].GetInt()),
+            parse_buffer_view(accessor["bufferView"].GetUint()),
             accessor["componentType"].GetUint(),
             attribute_type_to_size(accessor["type"].GetString()),
             accessor["count"].GetUint(),
+            accessor.HasMember("byteOffset") ? accessor["byteOffset"].GetUint() : 0u,
+            accessor.HasMember("normalized") && accessor["normalized"].GetBool(),
         };
     };
 
-    auto parse_texture = [&](int index) -> std::string
+    auto parse_optional_accessor = [&](rapidjson::Value const & object, char const * name) -> std::optional<gltf_model::accessor>
+    {
+        if (!object.HasMember(name))
+            return std::nullopt;
+        return parse_accessor(object[name].GetUint());
+    };
+
+    auto parse_texture = [&](unsigned int index) -> char const *
     {
-        auto const source_index = document["textures"].GetArray()[index]["source"].GetInt();
-        return document["images"].GetArray()[source_index]["uri"].GetString();
+        auto const source_index = element("textures", index)["source"].GetUint();
+        return element("images", source_index)["uri"].GetString();
     };
 
     auto parse_color = [&](auto const & array)
@@ -74,149 +511,529 @@ gltf_model load_gltf(std::filesystem::path const & path)
         };
     };
 
-    for (auto const & mesh : document["meshes"].GetArray())
+    // MikkTSpace tangents for a primitive exported without them, in a buffer of their own
+    auto generate_tangent_accessor = [&](gltf_model::primitive const & primitive) -> gltf_model::accessor
     {
-        auto & result_mesh = result.meshes.emplace_back();
-        result_mesh.name = mesh["name"].GetString();
+        std::size_t const vertex_count = primitive.position.count;
+        std::vector<std::array<float, 3>> positions(vertex_count), normals(vertex_count);
+        std::vector<std::array<float, 2>> texcoords(vertex_count);
+        for (std::size_t i = 0; i < vertex_count; ++i)
+        {
+            glm::vec4 const position = read_accessor(result, primitive.position, i);
+            glm::vec4 const normal = read_accessor(result, *primitive.normal, i);
+            glm::vec4 const texcoord = read_accessor(result, *primitive.texcoord, i);
+            positions[i] = {position.x, position.y, position.z};
+            normals[i] = {normal.x, normal.y, normal.z};
+            texcoords[i] = {texcoord.x, texcoord.y};
+        }
 
+        std::vector<std::uint32_t> indices(primitive.indices ? primitive.indices->count : vertex_count);
+        for (std::size_t i = 0; i < indices.size(); ++i)
+        {
+            indices[i] = primitive.indices ? read_index(result, *primitive.indices, i) : i;
+            if (indices[i] >= vertex_count)
+                throw std::runtime_error("Index out of the vertex range in " + path.string());
+        }
+
+        auto tangents = std::make_shared<std::vector<std::array<float, 4>>>(generate_tangents(positions, normals, texcoords, indices));
+
+        auto & buffer = result.buffers.emplace_back();
+        buffer.data = {reinterpret_cast<char const *>(tangents->data()), tangents->size() * sizeof(std::array<float, 4>)};
+        buffer.owner = std::move(tangents);
+
+        return {
+            {static_cast<unsigned int>(result.buffers.size() - 1), 0u, static_cast<unsigned int>(buffer.data.size()), 0u},
+            0x1406, // GL_FLOAT
+            4,
+            static_cast<unsigned int>(vertex_count),
+            0u,
+            false,
+        };
+    };
+
+    result.meshes.reserve(array_member("meshes").Size());
+    for (auto const & mesh : array_member("meshes"))
+    {
+        auto & result_mesh = result.meshes.emplace_back(memory);
+        if (mesh.HasMember("name"))
+            result_mesh.name = mesh["name"].GetString();
+
+        result_mesh.primitives.reserve(mesh["primitives"].Size());
         for (auto const & primitive : mesh["primitives"].GetArray())
         {
-            auto & result_primitive = result_mesh.primitives.emplace_back();
+            auto & result_primitive = result_mesh.primitives.emplace_back(memory);
 
             auto const & attributes = primitive["attributes"];
+            if (!attributes.HasMember("POSITION"))
+                throw std::runtime_error("Primitive without POSITION in " + path.string());
 
-            result_primitive.indices = parse_accessor(primitive["indices"].GetInt());
-            result_primitive.position = parse_accessor(attributes["POSITION"].GetInt());
-            result_primitive.normal = parse_accessor(attributes["NORMAL"].GetInt());
-            result_primitive.texcoord = parse_accessor(attributes["TEXCOORD_0"].GetInt());
-            result_primitive.joints = parse_accessor(attributes["JOINTS_0"].GetInt());
-            result_primitive.weights = parse_accessor(attributes["WEIGHTS_0"].GetInt());
+            result_primitive.indices = parse_optional_accessor(primitive, "indices");
+            result_primitive.position = parse_accessor(attributes["POSITION"].GetUint());
+            result_primitive.normal = parse_optional_accessor(attributes, "NORMAL");
+            result_primitive.texcoord = parse_optional_accessor(attributes, "TEXCOORD_0");
+            result_primitive.joints = parse_optional_accessor(attributes, "JOINTS_0");
+            result_primitive.weights = parse_optional_accessor(attributes, "WEIGHTS_0");
+            result_primitive.tangent = needs_tangents(primitive)
+                ? generate_tangent_accessor(result_primitive)
+                : parse_optional_accessor(attributes, "TANGENT");
 
-            auto const & material = document["materials"].GetArray()[primitive["material"].GetInt()];
+            if (primitive.HasMember("targets"))
+            {
+                result_primitive.targets.reserve(primitive["targets"].Size());
+                for (auto const & target : primitive["targets"].GetArray())
+                    result_primitive.targets.push_back({parse_optional_accessor(target, "POSITION"), parse_optional_accessor(target, "NORMAL")});
+            }
+
+            // Without a material the glTF default is an opaque white surface
+            if (!primitive.HasMember("material"))
+            {
+                result_primitive.material.color = glm::vec4(1.f);
+                continue;
+            }
+
+            auto const & material = element("materials", primitive["material"].GetUint());
 
             result_primitive.material.two_sided = material.HasMember("doubleSided") && material["doubleSided"].GetBool();
             result_primitive.material.transparent = material.HasMember("alphaMode") && (material["alphaMode"].GetString() == std::string("BLEND"));
+            if (material.HasMember("alphaMode") && material["alphaMode"].GetString() == std::string("MASK"))
+                result_primitive.material.alpha_cutoff = material.HasMember("alphaCutoff") ? material["alphaCutoff"].GetFloat() : 0.5f;
+
+            result_primitive.material.color = glm::vec4(1.f);
+            if (material.HasMember("pbrMetallicRoughness"))
+            {
+                auto const & pbr = material["pbrMetallicRoughness"];
+                if (pbr.HasMember("baseColorTexture"))
+                {
+                    result_primitive.material.texture_path.emplace(parse_texture(pbr["baseColorTexture"]["index"].GetUint()), memory);
+                    result_primitive.material.color = std::nullopt;
+                }
+                else if (pbr.HasMember("baseColorFactor"))
+                    result_primitive.material.color = parse_color(pbr["baseColorFactor"].GetArray());
+            }
+        }
 
-            auto const & pbr = material["pbrMetallicRoughness"];
-            if (pbr.HasMember("baseColorTexture"))
-                result_primitive.material.texture_path = parse_texture(pbr["baseColorTexture"]["index"].GetInt());
-            else if (pbr.HasMember("baseColorFactor"))
-                result_primitive.material.color = parse_color(pbr["baseColorFactor"].GetArray());
+        // Weights default to zero when the mesh lists none
+        if (mesh.HasMember("weights"))
+        {
+            result_mesh.weights.reserve(mesh["weights"].Size());
+            for (auto const & weight : mesh["weights"].GetArray())
+                result_mesh.weights.push_back(weight.GetFloat());
         }
+        else if (!result_mesh.primitives.empty())
+            result_mesh.weights.resize(result_mesh.primitives[0].targets.size(), 0.f);
+
+        for (auto const & primitive : result_mesh.primitives)
+            if (primitive.targets.size() != result_mesh.weights.size())
+                throw std::runtime_error("Primitive morph targets do not match the mesh weights in " + path.string());
     }
 
-    auto skins = document["skins"].GetArray();
-    assert(skins.Size() == 1);
+    auto const nodes = array_member("nodes");
 
+    for (auto const & node : nodes)
     {
-        auto fill_buffer = [&](auto & vector, gltf_model::accessor const & accessor)
+        if (node.HasMember("mesh") && node.HasMember("skin"))
         {
-            assert(accessor.type == 0x1406); // GL_FLOAT
-            using value_type = std::decay_t<decltype(vector[0])>;
-            auto begin = reinterpret_cast<value_type const *>(result.buffer.data() + accessor.view.offset);
-            vector.assign(begin, begin + accessor.count);
-        };
+            auto & mesh = result.meshes.at(node["mesh"].GetUint());
+            if (!mesh.skin)
+                mesh.skin = node["skin"].GetUint();
+        }
+    }
+
+    std::vector<unsigned int> node_parent(nodes.Size(), -1);
+    for (unsigned int i = 0; i < nodes.Size(); ++i)
+    {
+        if (!nodes[i].HasMember("children")) continue;
+
+        for (auto const & child : nodes[i]["children"].GetArray())
+            node_parent.at(child.GetUint()) = i;
+    }
+
+    // Same stable depth-first ordering as the bones below
+    std::vector<unsigned int> node_index(nodes.Size());
+    {
+        std::vector<unsigned int> node_order;
+        std::vector<std::uint8_t> state(nodes.Size(), 0);
+        for (unsigned int i = 0; i < nodes.Size(); ++i)
+        {
+            std::vector<unsigned int> chain;
+            for (unsigned int n = i; n != -1u && state[n] == 0; n = node_parent[n])
+            {
+                state[n] = 1;
+                chain.push_back(n);
+            }
+            for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+                node_order.push_back(*it);
+        }
+
+        for (unsigned int i = 0; i < node_order.size(); ++i)
+            node_index[node_order[i]] = i;
 
-        auto fix_rotations = [](std::vector<glm::quat> & rotations)
+        auto read_vec3 = [](auto const & array)
         {
-            for (auto & r : rotations)
-                r = glm::quat(r.z, r.w, r.x, r.y);
+            return glm::vec3(array[0].GetFloat(), array[1].GetFloat(), array[2].GetFloat());
         };
 
-        auto joints = skins[0]["joints"].GetArray();
+        result.nodes.reserve(node_order.size());
+        for (unsigned int id : node_order)
+        {
+            auto const & node = nodes[id];
+            auto & result_node = result.nodes.emplace_back(memory);
+
+            if (node_parent[id] != -1u)
+                result_node.parent = node_index[node_parent[id]];
+            if (node.HasMember("name"))
+                result_node.name = node["name"].GetString();
+            if (node.HasMember("mesh"))
+                result_node.mesh = node["mesh"].GetUint();
+            if (node.HasMember("skin"))
+                result_node.skin = node["skin"].GetUint();
+
+            if (node.HasMember("matrix"))
+            {
+                auto const matrix = node["matrix"].GetArray();
+                glm::mat4 m;
+                for (int i = 0; i < 16; ++i)
+                    m[i / 4][i % 4] = matrix[i].GetFloat();
+
+                glm::vec3 skew;
+                glm::vec4 perspective;
+                if (!glm::decompose(m, result_node.scale, result_node.rotation, result_node.translation, skew, perspective))
+                    throw std::runtime_error("Node matrix is not a transform in " + path.string());
+                continue;
+            }
+
+            if (node.HasMember("translation"))
+                result_node.translation = read_vec3(node["translation"].GetArray());
+            if (node.HasMember("rotation"))
+            {
+                auto const r = node["rotation"].GetArray();
+                result_node.rotation = glm::quat(r[3].GetFloat(), r[0].GetFloat(), r[1].GetFloat(), r[2].GetFloat());
+            }
+            if (node.HasMember("scale"))
+                result_node.scale = read_vec3(node["scale"].GetArray());
+        }
+    }
+
+    auto fill_buffer = [&](auto & vector, gltf_model::accessor const & accessor)
+    {
+        if (accessor.type != 0x1406) // GL_FLOAT
+            throw std::runtime_error("Only float animation and skin data is supported");
+
+        using value_type = std::decay_t<decltype(vector[0])>;
+        auto const stride = accessor.view.stride ? accessor.view.stride : sizeof(value_type);
+        if (accessor.count > 0 && accessor.offset + (accessor.count - 1) * stride + sizeof(value_type) > accessor.view.size)
+            throw std::runtime_error("Accessor out of range in " + path.string());
 
-        std::vector<glm::mat4> inverse_bind_matrices(joints.Size());
-        fill_buffer(inverse_bind_matrices, parse_accessor(skins[0]["inverseBindMatrices"].GetInt()));
+        auto const data = result.buffers[accessor.view.buffer].data.data() + accessor.buffer_offset();
+        vector.resize(accessor.count);
+        for (std::size_t i = 0; i < accessor.count; ++i)
+            std::memcpy(&vector[i], data + i * stride, sizeof(value_type));
+    };
+
+    // Bones of all skins in file order, sorted below so that parents come first
+    std::vector<gltf_model::bone> bones;
+    std::vector<unsigned int> bone_node;
+    std::vector<unsigned int> bone_skin;
 
-        result.bones.resize(joints.Size());
+    auto const skins = array_member("skins");
+    result.skins.reserve(skins.Size());
+    bones.reserve(joint_count);
+    for (unsigned int s = 0; s < skins.Size(); ++s)
+    {
+        auto const & skin = skins[s];
+        auto joints = skin["joints"].GetArray();
 
-        std::unordered_map<int, int> bone_node_to_index;
-        for (int i = 0; i < joints.Size(); ++i)
+        std::vector<glm::mat4> inverse_bind_matrices(joints.Size(), glm::mat4(1.f));
+        if (skin.HasMember("inverseBindMatrices"))
         {
-            int const node_id = joints[i].GetInt();
-            bone_node_to_index[node_id] = i;
-            result.bones[i].name = document["nodes"].GetArray()[node_id]["name"].GetString();
-            result.bones[i].inverse_bind_matrix = inverse_bind_matrices[i];
+            fill_buffer(inverse_bind_matrices, parse_accessor(skin["inverseBindMatrices"].GetUint()));
+            if (inverse_bind_matrices.size() < joints.Size())
+                throw std::runtime_error("Too few inverse bind matrices in " + path.string());
         }
 
-        auto nodes = document["nodes"].GetArray();
+        auto & result_skin = result.skins.emplace_back(memory);
+        if (skin.HasMember("name"))
+            result_skin.name = skin["name"].GetString();
+        result_skin.joints.reserve(joints.Size());
 
-        for (int i = 0; i < nodes.Size(); ++i)
+        std::unordered_map<unsigned int, unsigned int> node_to_bone;
+        for (unsigned int j = 0; j < joints.Size(); ++j)
         {
-            if (!bone_node_to_index.contains(i)) continue;
+            unsigned int const node_id = joints[j].GetUint();
+            if (node_id >= nodes.Size())
+                throw std::runtime_error("Invalid joint node in " + path.string());
 
-            auto const & node = nodes[i];
+            node_to_bone[node_id] = bones.size();
+            result_skin.joints.push_back(bones.size());
 
-            if (!node.HasMember("children")) continue;
+            auto & bone = bones.emplace_back(memory);
+            if (nodes[node_id].HasMember("name"))
+                bone.name = nodes[node_id]["name"].GetString();
+            bone.inverse_bind_matrix = inverse_bind_matrices[j];
+            bone_node.push_back(node_id);
+            bone_skin.push_back(s);
+        }
 
-            for (auto const & child : node["children"].GetArray())
+        // The parent is the nearest ancestor that is a joint of the same skin
+        for (unsigned int j : result_skin.joints)
+        {
+            for (unsigned int node_id = node_parent[bone_node[j]]; node_id != -1u; node_id = node_parent[node_id])
             {
-                int child_id = child.GetInt();
-                if (bone_node_to_index.contains(child_id))
-                    result.bones[bone_node_to_index.at(child_id)].parent = bone_node_to_index.at(i);
+                if (auto it = node_to_bone.find(node_id); it != node_to_bone.end())
+                {
+                    bones[j].parent = it->second;
+                    break;
+                }
             }
         }
+    }
 
-        for (int i = 0; i < result.bones.size(); ++i)
-            assert(result.bones[i].parent == -1 || result.bones[i].parent < i);
+    // Stable depth-first ordering, files that already list parents first keep their order
+    std::vector<unsigned int> bone_order;
+    {
+        std::vector<std::uint8_t> state(bones.size(), 0);
+        for (unsigned int i = 0; i < bones.size(); ++i)
+        {
+            std::vector<unsigned int> chain;
+            for (unsigned int b = i; b != -1u && state[b] == 0; b = bones[b].parent)
+            {
+                state[b] = 1;
+                chain.push_back(b);
+            }
+            for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+                bone_order.push_back(*it);
+        }
+    }
+
+    std::vector<unsigned int> bone_index(bones.size());
+    for (unsigned int i = 0; i < bone_order.size(); ++i)
+        bone_index[bone_order[i]] = i;
 
-        for (auto const & animation : document["animations"].GetArray())
+    std::unordered_multimap<unsigned int, unsigned int> node_to_bones;
+    result.bones.reserve(bone_order.size());
+    for (unsigned int i = 0; i < bone_order.size(); ++i)
+    {
+        auto & bone = result.bones.emplace_back(std::move(bones[bone_order[i]]));
+        if (bone.parent != -1u)
+            bone.parent = bone_index[bone.parent];
+        node_to_bones.emplace(bone_node[bone_order[i]], i);
+    }
+
+    for (auto & skin : result.skins)
+    {
+        for (auto & joint : skin.joints)
+            joint = bone_index[joint];
+
+        for (unsigned int joint : skin.joints)
         {
-            std::string name = animation["name"].GetString();
+            if (result.bones[joint].parent != -1u)
+                continue;
+            if (unsigned int const parent = node_parent[bone_node[bone_order[joint]]]; parent != -1u)
+                skin.skeleton_parent = node_index[parent];
+            break;
+        }
+    }
 
-            auto samplers = animation["samplers"].GetArray();
+    auto fix_rotations = [](std::pmr::vector<glm::quat> & rotations)
+    {
+        for (auto & r : rotations)
+            r = glm::quat(r.z, r.w, r.x, r.y);
+    };
 
-            gltf_model::animation result_animation;
-            result_animation.bones.resize(result.bones.size());
+    auto channel_path = [](rapidjson::Value const & channel) -> std::string_view
+    {
+        std::string_view const path = channel["target"]["path"].GetString();
+        return (path == "translation" || path == "rotation" || path == "scale") ? path : std::string_view{};
+    };
 
-            for (auto const & channel : animation["channels"].GetArray())
+    // Second pass, over the channels now that the bones they drive are known: every copy of a
+    // channel gets its timestamps and values, cubic ones their tangents too, and resampled
+    // ones the keys they are resampled into
+    auto const animations = array_member("animations");
+    std::size_t animation_bytes = 0;
+    for (auto const & animation : animations)
+    {
+        animation_bytes += array_bytes<gltf_model::bone_animation>(result.bones.size());
+
+        auto samplers = animation["samplers"].GetArray();
+        for (auto const & channel : animation["channels"].GetArray())
+        {
+            if (!channel["target"].HasMember("node") || channel_path(channel).empty())
+                continue;
+            std::size_t const copies = node_to_bones.count(channel["target"]["node"].GetUint());
+            if (copies == 0 || channel["sampler"].GetUint() >= samplers.Size())
+                continue;
+
+            auto const & sampler = samplers[channel["sampler"].GetUint()];
+            auto const & input = element("accessors", sampler["input"].GetUint());
+            std::size_t const keys = input["count"].GetUint();
+            std::size_t const outputs = element("accessors", sampler["output"].GetUint())["count"].GetUint();
+            std::size_t const value_size = channel_path(channel) == "rotation" ? sizeof(glm::quat) : sizeof(glm::vec3);
+            bool const cubic = sampler.HasMember("interpolation") && sampler["interpolation"].GetString() == std::string_view("CUBICSPLINE");
+
+            std::size_t bytes = array_bytes<float>(keys) + outputs * value_size + alignof(std::max_align_t);
+            if (cubic)
+                bytes += 2 * (keys * value_size + alignof(std::max_align_t));
+            if (cubic && options.cubic_resample_rate > 0.f && input.HasMember("min") && input.HasMember("max"))
             {
-                int node_id = channel["target"]["node"].GetInt();
-                if (!bone_node_to_index.contains(node_id)) continue;
+                float const duration = input["max"][0].GetFloat() - input["min"][0].GetFloat();
+                std::size_t const resampled = static_cast<std::size_t>(std::ceil(std::max(duration, 0.f) * options.cubic_resample_rate)) + 1;
+                bytes += array_bytes<float>(resampled) + resampled * value_size + alignof(std::max_align_t);
+            }
+            animation_bytes += copies * bytes;
+        }
+    }
 
-                auto & bone = result_animation.bones[bone_node_to_index.at(node_id)];
+    result.animation_arena = std::make_unique<std::pmr::monotonic_buffer_resource>(std::max<std::size_t>(animation_bytes, 1024));
+    auto * const animation_memory = result.animation_arena.get();
+    result.animations.reserve(animations.Size());
 
-                std::string path = channel["target"]["path"].GetString();
+    for (unsigned int a = 0; a < animations.Size(); ++a)
+    {
+        auto const & animation = animations[a];
+        std::pmr::string name(animation.HasMember("name") ? animation["name"].GetString() : "animation_" + std::to_string(a), memory);
 
-                auto const & sampler = samplers[channel["sampler"].GetInt()];
+        auto samplers = animation["samplers"].GetArray();
 
-                auto input = parse_accessor(sampler["input"].GetInt());
-                auto output = parse_accessor(sampler["output"].GetInt());
+        gltf_model::animation result_animation(animation_memory);
+        result_animation.bones.reserve(result.bones.size());
+        for (std::size_t b = 0; b < result.bones.size(); ++b)
+            result_animation.bones.emplace_back(animation_memory);
 
-                if (path == "translation")
-                {
-                    fill_buffer(bone.translation.timestamps, input);
-                    fill_buffer(bone.translation.values, output);
-                }
-                else if (path == "rotation")
-                {
-                    fill_buffer(bone.rotation.timestamps, input);
-                    fill_buffer(bone.rotation.values, output);
-                    fix_rotations(bone.rotation.values);
-                }
-                else if (path == "scale")
-                {
-                    fill_buffer(bone.scale.timestamps, input);
-                    fill_buffer(bone.scale.values, output);
-                }
+        for (auto const & channel : animation["channels"].GetArray())
+        {
+            if (!channel["target"].HasMember("node")) continue;
+
+            unsigned int node_id = channel["target"]["node"].GetUint();
+            auto [begin, end] = node_to_bones.equal_range(node_id);
+            if (begin == end) continue;
+
+            std::string_view const target = channel_path(channel);
+            if (target.empty()) continue;
+
+            auto const & sampler = samplers[channel["sampler"].GetUint()];
+
+            auto input = parse_accessor(sampler["input"].GetUint());
+            auto output = parse_accessor(sampler["output"].GetUint());
+
+            auto mode = gltf_model::interpolation::linear;
+            if (sampler.HasMember("interpolation"))
+            {
+                std::string const interpolation = sampler["interpolation"].GetString();
+                if (interpolation == "STEP")
+                    mode = gltf_model::interpolation::step;
+                else if (interpolation == "CUBICSPLINE")
+                    mode = gltf_model::interpolation::cubic;
+                else if (interpolation != "LINEAR")
+                    throw std::runtime_error("Unknown animation interpolation " + interpolation + " in " + path.string());
             }
 
-            auto update_max_time = [&](std::vector<float> const & timestamps)
+            auto fill_spline = [&](auto & spline)
             {
-                for (float t : timestamps)
-                    result_animation.max_time = std::max(result_animation.max_time, t);
+                spline.mode = mode;
+                fill_buffer(spline.timestamps, input);
+                fill_buffer(spline.values, output);
+
+                if (mode != gltf_model::interpolation::cubic)
+                    return;
+
+                // Cubic outputs hold an in-tangent, a value and an out-tangent per key
+                if (spline.values.size() != 3 * spline.timestamps.size())
+                    throw std::runtime_error("Cubic spline output count mismatch in " + path.string());
+
+                auto const keys = spline.timestamps.size();
+                spline.in_tangents.resize(keys);
+                spline.out_tangents.resize(keys);
+                for (std::size_t k = 0; k < keys; ++k)
+                {
+                    spline.in_tangents[k] = spline.values[3 * k];
+                    spline.out_tangents[k] = spline.values[3 * k + 2];
+                    spline.values[k] = spline.values[3 * k + 1];
+                }
+                spline.values.resize(keys);
             };
 
-            for (auto const & bone : result_animation.bones)
+            // One bone of the node reads the data, its copies in other skins get the same channels
+            auto & bone = result_animation.bones[begin->second];
+
+            if (target == "translation")
+            {
+                fill_spline(bone.translation);
+            }
+            else if (target == "rotation")
             {
-                update_max_time(bone.translation.timestamps);
-                update_max_time(bone.rotation.timestamps);
-                update_max_time(bone.scale.timestamps);
+                fill_spline(bone.rotation);
+                fix_rotations(bone.rotation.values);
+                fix_rotations(bone.rotation.in_tangents);
+                fix_rotations(bone.rotation.out_tangents);
+            }
+            else if (target == "scale")
+            {
+                fill_spline(bone.scale);
             }
 
-            result.animations[std::move(name)] = std::move(result_animation);
+            if (options.cubic_resample_rate > 0.f)
+            {
+                bone.translation.resample_linear(options.cubic_resample_rate);
+                bone.rotation.resample_linear(options.cubic_resample_rate);
+                bone.scale.resample_linear(options.cubic_resample_rate);
+            }
+
+            for (auto it = std::next(begin); it != end; ++it)
+                result_animation.bones[it->second] = bone;
+        }
+
+        auto update_max_time = [&](std::pmr::vector<float> const & timestamps)
+        {
+            for (float t : timestamps)
+                result_animation.max_time = std::max(result_animation.max_time, t);
+        };
+
+        for (auto const & bone : result_animation.bones)
+        {
+            update_max_time(bone.translation.timestamps);
+            update_max_time(bone.rotation.timestamps);
+            update_max_time(bone.scale.timestamps);
         }
+
+        // Moved rather than assigned, so that the keys stay in the animation arena
+        result.animations.insert_or_assign(std::move(name), std::move(result_animation));
     }
 
     return result;
 }
+
+namespace
+{
+
+    template <typename T>
+    std::size_t spline_bytes(gltf_model::spline<T> const & spline)
+    {
+        return spline.timestamps.capacity() * sizeof(float)
+            + (spline.values.capacity() + spline.in_tangents.capacity() + spline.out_tangents.capacity()) * sizeof(T);
+    }
+
+}
+
+std::size_t model_memory_bytes(gltf_model const & model)
+{
+    std::size_t result = 0;
+    for (auto const & buffer : model.buffers)
+        if (buffer.owner)
+            result += buffer.data.size();
+
+    for (auto const & [name, animation] : model.animations)
+        for (auto const & bone : animation.bones)
+            result += spline_bytes(bone.translation) + spline_bytes(bone.rotation) + spline_bytes(bone.scale);
+
+    return result;
+}
+
+void release_model_data(gltf_model & model)
+{
+    // Buffers sharing a mapping release it with the last of them
+    for (auto & buffer : model.buffers)
+        buffer = {};
+    model.animations.clear();
+    model.animation_arena->release();
+}
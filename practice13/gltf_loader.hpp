@@ -6,20 +6,56 @@
 #include <optional>
 #include <unordered_map>
 #include <algorithm>
+#include <cassert>
+#include <memory>
+#include <span>
+#include <cmath>
+#include <type_traits>
+#include <memory_resource>
+#include <cstdint>
 
-#define GLM_FORCE_SWIZZLE
-#define GLM_ENABLE_EXPERIMENTAL
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
 #include <glm/mat4x4.hpp>
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtx/compatibility.hpp>
 
+// Everything a model owns, from its strings to its animation keys, is allocated from two
+// monotonic arenas that load_gltf sizes from a first pass over the JSON, so that a model is a
+// couple of allocations to build and to destroy rather than one per array. The animation keys
+// have the second arena to themselves, for release_model_data to drop them on their own. The
+// nested types take the arena on construction and default to the global heap; copies of them
+// do go to the heap, moves stay in the arena they came from.
 struct gltf_model
 {
+    // Declared before the containers, which are destroyed before them
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> arena;
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> animation_arena;
+
+    // What the arenas give out at first; anything past these comes from further, larger chunks
+    explicit gltf_model(std::size_t arena_bytes = 0, std::size_t animation_arena_bytes = 0);
+
+    // Containers moved into an existing model would keep its arena and copy, so models are
+    // only ever move-constructed
+    gltf_model(gltf_model &&) = default;
+    gltf_model & operator = (gltf_model &&) = delete;
+
+    // A buffer is only mapped if some accessor the loader reads points into it
+    struct buffer
+    {
+        // Keeps data alive: the mapping of the .bin file or the whole .glb (or of the asset
+        // pack holding them), or the decoded bytes of an EXT_meshopt_compression buffer view
+        std::shared_ptr<void const> owner;
+        std::span<char const> data;
+    };
+
     struct buffer_view
     {
+        unsigned int buffer;
         unsigned int offset;
         unsigned int size;
+        // 0 means tightly packed
+        unsigned int stride;
     };
 
     struct accessor
@@ -28,103 +64,379 @@ struct gltf_model
         unsigned int type;
         unsigned int size;
         unsigned int count;
+        // Relative to the start of the buffer view
+        unsigned int offset;
+        bool normalized;
+
+        // Relative to the start of the buffer
+        unsigned int buffer_offset() const { return view.offset + offset; }
     };
 
     struct material
     {
-        bool two_sided;
-        bool transparent;
-        std::optional<std::string> texture_path;
+        bool two_sided = false;
+        bool transparent = false;
+        // Set for alphaMode MASK: fragments with less alpha than this are discarded
+        std::optional<float> alpha_cutoff;
+        std::optional<std::pmr::string> texture_path;
         std::optional<glm::vec4> color;
     };
 
+    // One bone per joint of every skin, so a node used by two skins becomes two bones
+    // with their own inverse bind matrices. Parents always precede their children.
     struct bone
     {
+        explicit bone(std::pmr::memory_resource * memory = std::pmr::get_default_resource())
+            : name(memory)
+        {}
+
         unsigned int parent = -1;
-        std::string name;
-        glm::mat4 inverse_bind_matrix;
+        std::pmr::string name;
+        glm::mat4 inverse_bind_matrix{1.f};
+    };
+
+    struct skin
+    {
+        explicit skin(std::pmr::memory_resource * memory = std::pmr::get_default_resource())
+            : name(memory)
+            , joints(memory)
+        {}
+
+        std::pmr::string name;
+        // Bone index of every joint, in the order JOINTS_0 refers to them
+        std::pmr::vector<unsigned int> joints;
+        // Node that the skeleton hangs from, the parent of its first root joint, or -1 if that
+        // joint is a root node. Joint transforms, and so skinned vertices, are relative to it.
+        unsigned int skeleton_parent = -1;
+    };
+
+    // Every node of the file, parents before children, with its local transform; a matrix
+    // is decomposed into translation, rotation and scale
+    struct node
+    {
+        explicit node(std::pmr::memory_resource * memory = std::pmr::get_default_resource())
+            : name(memory)
+        {}
+
+        unsigned int parent = -1;
+        std::pmr::string name;
+        glm::vec3 translation{0.f};
+        glm::quat rotation{1.f, 0.f, 0.f, 0.f};
+        glm::vec3 scale{1.f};
+        std::optional<unsigned int> mesh;
+        std::optional<unsigned int> skin;
+    };
+
+    // The three glTF sampler modes: STEP, LINEAR and CUBICSPLINE
+    enum class interpolation
+    {
+        step,
+        linear,
+        cubic,
     };
 
     template <typename T>
     struct spline
     {
-        std::vector<float> timestamps;
-        std::vector<T> values;
+        explicit spline(std::pmr::memory_resource * memory = std::pmr::get_default_resource())
+            : timestamps(memory)
+            , values(memory)
+            , in_tangents(memory)
+            , out_tangents(memory)
+        {}
+
+        interpolation mode = interpolation::linear;
+        std::pmr::vector<float> timestamps;
+        std::pmr::vector<T> values;
+        // Hermite tangents of every key, per second; only filled for cubic splines
+        std::pmr::vector<T> in_tangents;
+        std::pmr::vector<T> out_tangents;
 
         T operator()(float time) const;
+
+        // Same result as operator()(time), but the keyframe search starts from cursor
+        // and updates it, so playing forward costs O(1) per sample instead of a binary search
+        T operator()(float time, std::size_t & cursor) const;
+
+        // Same as above with the mode fixed at compile time, for loops over many samples
+        template <interpolation Mode>
+        T evaluate(float time, std::size_t & cursor) const;
+
+        template <interpolation Mode>
+        T sample(std::size_t key, float time) const;
+
+        // Calls f once with std::integral_constant<interpolation, mode>, so that
+        // whatever loop f runs is specialized instead of branching on every key
+        template <typename F>
+        decltype(auto) visit(F && f) const;
+
+        // Replaces a cubic spline with a linear one sampled at the given rate, in the same arena
+        void resample_linear(float sample_rate);
     };
 
     struct bone_animation
     {
+        explicit bone_animation(std::pmr::memory_resource * memory = std::pmr::get_default_resource())
+            : translation(memory)
+            , rotation(memory)
+            , scale(memory)
+        {}
+
         spline<glm::vec3> translation;
         spline<glm::quat> rotation;
         spline<glm::vec3> scale;
     };
 
+    // Keyframe cursors of one bone, kept per animated instance
+    struct bone_cursor
+    {
+        std::size_t translation = 0;
+        std::size_t rotation = 0;
+        std::size_t scale = 0;
+    };
+
     struct animation
     {
-        std::vector<bone_animation> bones;
+        explicit animation(std::pmr::memory_resource * memory = std::pmr::get_default_resource())
+            : bones(memory)
+        {}
+
+        std::pmr::vector<bone_animation> bones;
         float max_time = 0.f;
     };
 
+    // Displacements of every vertex of a primitive, mixed in by the mesh's target weights
+    struct morph_target
+    {
+        std::optional<accessor> position;
+        std::optional<accessor> normal;
+    };
+
     struct primitive
     {
+        explicit primitive(std::pmr::memory_resource * memory = std::pmr::get_default_resource())
+            : targets(memory)
+        {}
+
         struct material material;
 
-        accessor indices;
+        // Missing for non-indexed primitives
+        std::optional<accessor> indices;
 
         accessor position;
-        accessor normal;
-        accessor texcoord;
-        accessor joints;
-        accessor weights;
+        std::optional<accessor> normal;
+        std::optional<accessor> texcoord;
+        std::optional<accessor> joints;
+        std::optional<accessor> weights;
+        // From TANGENT, or generated when the file has none but there are normals and texcoords
+        std::optional<accessor> tangent;
+
+        // Every primitive of a mesh has as many as the mesh has weights
+        std::pmr::vector<morph_target> targets;
     };
 
     struct mesh
     {
-        std::string name;
+        explicit mesh(std::pmr::memory_resource * memory = std::pmr::get_default_resource())
+            : name(memory)
+            , primitives(memory)
+            , weights(memory)
+        {}
+
+        std::pmr::string name;
+
+        std::pmr::vector<primitive> primitives;
+
+        // Default weight of every morph target
+        std::pmr::vector<float> weights;
 
-        std::vector<primitive> primitives;
+        // The skin of the first node that instantiates this mesh
+        std::optional<unsigned int> skin;
     };
 
-    std::vector<char> buffer;
-    std::vector<mesh> meshes;
-    std::vector<bone> bones;
-    std::unordered_map<std::string, animation> animations;
+    // The map and its names are in the first arena, the animations' keys in the second
+    using animation_map = std::pmr::unordered_map<std::pmr::string, animation>;
+
+    std::pmr::vector<buffer> buffers;
+
+    std::pmr::vector<mesh> meshes;
+    std::pmr::vector<node> nodes;
+    std::pmr::vector<bone> bones;
+    std::pmr::vector<skin> skins;
+    animation_map animations;
 };
 
-gltf_model load_gltf(std::filesystem::path const & path);
+struct job_system;
 
-template <>
-inline glm::vec3 gltf_model::spline<glm::vec3>::operator()(float time) const
+struct gltf_load_options
+{
+    // Cubic splines cost a Hermite evaluation per sample; when this is positive they are
+    // resampled into linear ones at this many keys per second while loading
+    float cubic_resample_rate = 0.f;
+
+    // Decodes compressed buffer views in parallel when set
+    job_system * jobs = nullptr;
+};
+
+// Accepts both .gltf with an external .bin buffer and binary .glb containers, with buffer
+// views optionally compressed with EXT_meshopt_compression
+gltf_model load_gltf(std::filesystem::path const & path, gltf_load_options const & options = {});
+
+// Element i of an accessor as up to four components, normalized ones mapped to their range
+glm::vec4 read_accessor(gltf_model const & model, gltf_model::accessor const & accessor, std::size_t i);
+
+// Kept apart from read_accessor, since 32-bit indices do not fit into a float
+std::uint32_t read_index(gltf_model const & model, gltf_model::accessor const & accessor, std::size_t i);
+
+// CPU memory held by the buffers (mapped or decoded) and the animation keys of a model
+std::size_t model_memory_bytes(gltf_model const & model);
+
+// Drops the buffers and animations, and with them the animation arena, once everything that
+// reads accessors or keys is done with them; meshes, bones and skins stay, but their accessors
+// must not be read afterwards
+void release_model_data(gltf_model & model);
+
+inline glm::vec3 spline_interpolate(glm::vec3 const & a, glm::vec3 const & b, float t)
+{
+    return glm::lerp(a, b, t);
+}
+
+inline glm::quat spline_interpolate(glm::quat const & a, glm::quat const & b, float t)
+{
+    return glm::slerp(a, b, t);
+}
+
+// Tangents are already scaled by the key interval
+inline glm::vec3 spline_hermite(glm::vec3 const & p0, glm::vec3 const & m0, glm::vec3 const & p1, glm::vec3 const & m1, float t)
+{
+    float const t2 = t * t;
+    float const t3 = t2 * t;
+    return (2.f * t3 - 3.f * t2 + 1.f) * p0 + (t3 - 2.f * t2 + t) * m0 + (-2.f * t3 + 3.f * t2) * p1 + (t3 - t2) * m1;
+}
+
+// The glTF spec interpolates quaternion components independently and normalizes the result
+inline glm::quat spline_hermite(glm::quat const & p0, glm::quat const & m0, glm::quat const & p1, glm::quat const & m1, float t)
+{
+    float const t2 = t * t;
+    float const t3 = t2 * t;
+    return glm::normalize(p0 * (2.f * t3 - 3.f * t2 + 1.f) + m0 * (t3 - 2.f * t2 + t) + p1 * (-2.f * t3 + 3.f * t2) + m1 * (t3 - t2));
+}
+
+// key is the index of the first timestamp not less than time
+template <typename T>
+template <gltf_model::interpolation Mode>
+T gltf_model::spline<T>::sample(std::size_t key, float time) const
 {
     assert(!values.empty());
 
-    auto it = std::lower_bound(timestamps.begin(), timestamps.end(), time);
-    if (it == timestamps.begin())
+    if (key == 0)
         return values.back();
-    if (it == timestamps.end())
+    if (key == timestamps.size())
         return values.back();
 
-    int i = it - timestamps.begin();
+    if constexpr (Mode == interpolation::step)
+    {
+        return (time < timestamps[key]) ? values[key - 1] : values[key];
+    }
+    else
+    {
+        float const dt = timestamps[key] - timestamps[key - 1];
+        float const t = (time - timestamps[key - 1]) / dt;
 
-    float t = (time - timestamps[i - 1]) / (timestamps[i] - timestamps[i - 1]);
-    return glm::lerp(values[i - 1], values[i], t);
+        if constexpr (Mode == interpolation::linear)
+            return spline_interpolate(values[key - 1], values[key], t);
+        else
+            return spline_hermite(values[key - 1], out_tangents[key - 1] * dt, values[key], in_tangents[key] * dt, t);
+    }
 }
 
-template <>
-inline glm::quat gltf_model::spline<glm::quat>::operator()(float time) const
+template <typename T>
+template <typename F>
+decltype(auto) gltf_model::spline<T>::visit(F && f) const
 {
-    assert(!values.empty());
+    switch (mode)
+    {
+    case interpolation::step:
+        return f(std::integral_constant<interpolation, interpolation::step>{});
+    case interpolation::cubic:
+        return f(std::integral_constant<interpolation, interpolation::cubic>{});
+    default:
+        return f(std::integral_constant<interpolation, interpolation::linear>{});
+    }
+}
 
+template <typename T>
+T gltf_model::spline<T>::operator()(float time) const
+{
     auto it = std::lower_bound(timestamps.begin(), timestamps.end(), time);
-    if (it == timestamps.begin())
-        return values.back();
-    if (it == timestamps.end())
-        return values.back();
+    return visit([&](auto mode){ return sample<decltype(mode)::value>(it - timestamps.begin(), time); });
+}
+
+template <typename T>
+T gltf_model::spline<T>::operator()(float time, std::size_t & cursor) const
+{
+    return visit([&](auto mode){ return evaluate<decltype(mode)::value>(time, cursor); });
+}
+
+template <typename T>
+template <gltf_model::interpolation Mode>
+T gltf_model::spline<T>::evaluate(float time, std::size_t & cursor) const
+{
+    // Animation time usually moves a key or two forward per frame; anything
+    // else (seeking, looping back to the start) falls back to a binary search
+    constexpr std::size_t max_linear_steps = 4;
+
+    std::size_t key = std::min(cursor, timestamps.size());
+    bool const past_start = (key == 0) || (timestamps[key - 1] < time);
+
+    if (past_start)
+    {
+        std::size_t steps = 0;
+        while (key < timestamps.size() && timestamps[key] < time && steps < max_linear_steps)
+        {
+            ++key;
+            ++steps;
+        }
+    }
+
+    if (!past_start || (key < timestamps.size() && timestamps[key] < time))
+        key = std::lower_bound(timestamps.begin(), timestamps.end(), time) - timestamps.begin();
+
+    cursor = key;
+    return sample<Mode>(key, time);
+}
+
+template <typename T>
+void gltf_model::spline<T>::resample_linear(float sample_rate)
+{
+    if (mode != interpolation::cubic)
+        return;
+
+    std::pmr::vector<float> new_timestamps(timestamps.get_allocator());
+    std::pmr::vector<T> new_values(values.get_allocator());
+
+    if (!timestamps.empty())
+    {
+        float const begin = timestamps.front();
+        float const end = timestamps.back();
+        std::size_t const count = static_cast<std::size_t>(std::ceil((end - begin) * sample_rate)) + 1;
+        new_timestamps.reserve(count);
+        new_values.reserve(count);
 
-    int i = it - timestamps.begin();
+        std::size_t cursor = 0;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            float const time = std::min(begin + i / sample_rate, end);
+            new_timestamps.push_back(time);
+            new_values.push_back(evaluate<interpolation::cubic>(time, cursor));
+        }
+        // sample returns the last key at or before the first timestamp
+        new_values.front() = values.front();
+    }
 
-    float t = (time - timestamps[i - 1]) / (timestamps[i] - timestamps[i - 1]);
-    return glm::slerp(values[i - 1], values[i], t);
+    mode = interpolation::linear;
+    timestamps = std::move(new_timestamps);
+    values = std::move(new_values);
+    in_tangents.clear();
+    out_tangents.clear();
 }
@@ -0,0 +1,382 @@
+#include "gpu_skinning.hpp"
+#include "shader_permutations.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+
+    using vertex = merged_geometry::vertex;
+
+    // The merged vertices are read as 32-bit words, since their vec3 members have no std430 layout
+    static_assert(sizeof(vertex) % 4 == 0);
+    static_assert(offsetof(vertex, position) % 4 == 0 && offsetof(vertex, normal) % 4 == 0);
+    static_assert(offsetof(vertex, joints) % 4 == 0 && offsetof(vertex, weights) % 4 == 0);
+    static_assert(offsetof(vertex, primitive) % 4 == 0);
+
+    // Read as a uvec4: the slot, then the six 16-bit halves in order
+    static_assert(sizeof(merged_geometry::morph_delta) == 16);
+
+    // Morph sums are 32-bit integers with this many steps per unit, since there are no float atomics
+    constexpr float morph_fixed_point = 4096.f;
+
+    // Smaller weights move nothing visibly, so their targets are not dispatched
+    constexpr float min_morph_weight = 1e-3f;
+
+    // Every word of a wide joint holds two bone indices, as the joint bytes of a vertex hold four
+    std::string const vertex_layout_defines =
+        "#define VERTEX_WORDS " + std::to_string(sizeof(vertex) / 4) + "\n"
+        "#define POSITION_WORD " + std::to_string(offsetof(vertex, position) / 4) + "\n"
+        "#define NORMAL_WORD " + std::to_string(offsetof(vertex, normal) / 4) + "\n"
+        "#define JOINTS_WORD " + std::to_string(offsetof(vertex, joints) / 4) + "\n"
+        "#define WEIGHTS_WORD " + std::to_string(offsetof(vertex, weights) / 4) + "\n"
+        "#define PRIMITIVE_WORD " + std::to_string(offsetof(vertex, primitive) / 4) + "\n"
+        "#define MORPH_FIXED_POINT " + std::to_string(morph_fixed_point) + "\n";
+
+    const char skinning_shader_source[] =
+R"(
+layout (local_size_x = 64) in;
+
+// Bone matrices of all instances, bone_count per instance, each a mat4x3 packed into 3 texels
+uniform samplerBuffer bone_palette;
+uniform int bone_count;
+uniform int vertex_count;
+
+layout (std430, binding = 0) readonly buffer source_vertices
+{
+    uint source[];
+};
+
+struct skinned_vertex
+{
+    vec4 position;
+    vec4 normal;
+};
+
+#ifdef WIDE_JOINTS
+layout (std430, binding = 2) readonly buffer source_joints
+{
+    uvec2 wide_joints[];
+};
+#endif
+
+#ifdef MORPH_TARGETS
+uniform int morph_vertex_count;
+
+// Per primitive: where its vertices start in morph_vertices, and how many there are
+layout (std430, binding = 3) readonly buffer morph_range_buffer
+{
+    uvec2 morph_ranges[];
+};
+
+layout (std430, binding = 4) readonly buffer morph_vertex_buffer
+{
+    uint morph_vertices[];
+};
+
+// Six per instance and morph vertex: the position and normal displacements
+layout (std430, binding = 5) buffer morph_sum_buffer
+{
+    int morph_sums[];
+};
+#endif
+
+layout (std430, binding = 1) writeonly buffer skinned_vertices
+{
+    skinned_vertex skinned[];
+};
+
+mat4x3 bone(int instance, int index)
+{
+    int base = (instance * bone_count + index) * 3;
+    vec4 t0 = texelFetch(bone_palette, base);
+    vec4 t1 = texelFetch(bone_palette, base + 1);
+    vec4 t2 = texelFetch(bone_palette, base + 2);
+    return mat4x3(t0.xyz, vec3(t0.w, t1.xy), vec3(t1.zw, t2.x), t2.yzw);
+}
+
+vec3 read_vec3(int base)
+{
+    return uintBitsToFloat(uvec3(source[base], source[base + 1], source[base + 2]));
+}
+
+void main()
+{
+    int v = int(gl_GlobalInvocationID.x);
+    if (v >= vertex_count)
+        return;
+
+    int instance = int(gl_WorkGroupID.y);
+    int base = v * VERTEX_WORDS;
+
+    vec3 position = read_vec3(base + POSITION_WORD);
+    vec3 normal = read_vec3(base + NORMAL_WORD);
+    vec4 weights = unpackUnorm4x8(source[base + WEIGHTS_WORD]);
+
+#ifdef MORPH_TARGETS
+    // Binary search for the vertex among those of its primitive that targets move
+    uvec2 range = morph_ranges[source[base + PRIMITIVE_WORD]];
+    uint first = range.x;
+    uint count = range.y;
+    while (count > 0u)
+    {
+        uint middle = count / 2u;
+        if (morph_vertices[first + middle] < uint(v))
+        {
+            first += middle + 1u;
+            count -= middle + 1u;
+        }
+        else
+            count = middle;
+    }
+
+    if (first < range.x + range.y && morph_vertices[first] == uint(v))
+    {
+        int sum = (instance * morph_vertex_count + int(first)) * 6;
+        position += vec3(morph_sums[sum], morph_sums[sum + 1], morph_sums[sum + 2]) / MORPH_FIXED_POINT;
+        normal += vec3(morph_sums[sum + 3], morph_sums[sum + 4], morph_sums[sum + 5]) / MORPH_FIXED_POINT;
+        // Nothing else reads them, and the next frame adds up from zero
+        for (int c = 0; c < 6; ++c)
+            morph_sums[sum + c] = 0;
+    }
+#endif
+
+    mat4x3 bone_matrix = mat4x3(1.0);
+    // Vertices of unskinned primitives have zero weights
+    if (weights != vec4(0.0))
+    {
+#ifdef WIDE_JOINTS
+        uvec2 j = wide_joints[v];
+        ivec4 joints = ivec4(j.x & 0xffffu, j.x >> 16, j.y & 0xffffu, j.y >> 16);
+#else
+        uint j = source[base + JOINTS_WORD];
+        ivec4 joints = ivec4(j & 0xffu, (j >> 8) & 0xffu, (j >> 16) & 0xffu, j >> 24);
+#endif
+
+        bone_matrix = weights.x * bone(instance, joints.x)
+            + weights.y * bone(instance, joints.y)
+            + weights.z * bone(instance, joints.z)
+            + weights.w * bone(instance, joints.w);
+    }
+
+    skinned[instance * vertex_count + v] = skinned_vertex(vec4(bone_matrix * vec4(position, 1.0), 1.0), vec4(bone_matrix * vec4(normal, 0.0), 0.0));
+}
+)";
+
+    // One workgroup row per active target, one invocation per delta
+    const char morph_shader_source[] =
+R"(
+layout (local_size_x = 64) in;
+
+uniform int morph_vertex_count;
+uniform int first_row;
+
+struct active_target
+{
+    uint instance;
+    uint first_delta;
+    uint delta_count;
+    float position_scale;
+    float normal_scale;
+};
+
+layout (std430, binding = 5) buffer morph_sum_buffer
+{
+    int morph_sums[];
+};
+
+layout (std430, binding = 6) readonly buffer morph_delta_buffer
+{
+    uvec4 morph_deltas[];
+};
+
+layout (std430, binding = 7) readonly buffer active_target_buffer
+{
+    active_target active_targets[];
+};
+
+void main()
+{
+    active_target target = active_targets[first_row + int(gl_WorkGroupID.y)];
+    uint d = gl_GlobalInvocationID.x;
+    if (d >= target.delta_count)
+        return;
+
+    // Shifting left then arithmetically right sign-extends the low half
+    uvec4 delta = morph_deltas[target.first_delta + d];
+    vec3 position = vec3(int(delta.y << 16) >> 16, int(delta.y) >> 16, int(delta.z << 16) >> 16) * target.position_scale;
+    vec3 normal = vec3(int(delta.z) >> 16, int(delta.w << 16) >> 16, int(delta.w) >> 16) * target.normal_scale;
+
+    int sum = int(target.instance * uint(morph_vertex_count) + delta.x) * 6;
+    atomicAdd(morph_sums[sum], int(round(position.x)));
+    atomicAdd(morph_sums[sum + 1], int(round(position.y)));
+    atomicAdd(morph_sums[sum + 2], int(round(position.z)));
+    atomicAdd(morph_sums[sum + 3], int(round(normal.x)));
+    atomicAdd(morph_sums[sum + 4], int(round(normal.y)));
+    atomicAdd(morph_sums[sum + 5], int(round(normal.z)));
+}
+)";
+
+    constexpr int group_size = 64;
+
+    // The morph and skinning passes read the vertices with the same layout
+    std::string compute_source(char const * source)
+    {
+        return "#version 430 core\n" + vertex_layout_defines + source;
+    }
+
+}
+
+gpu_skinning::gpu_skinning(program_cache & programs, merged_geometry const & geometry, GLuint vertex_buffer, GLuint wide_joint_buffer)
+    : vertex_buffer_(vertex_buffer)
+    , wide_joint_buffer_(wide_joint_buffer)
+    , vertex_count_(geometry.vertices.size())
+{
+    if (!geometry.wide_joints.empty() && !wide_joint_buffer_)
+        throw std::runtime_error("Wide joints need a buffer of their own");
+
+    bool const morphs = !geometry.morph_vertices.empty();
+    shader_permutations::features const features = (wide_joint_buffer_ ? 1 : 0) | (morphs ? 2 : 0);
+
+    program_ = programs.get({{GL_COMPUTE_SHADER, define_features(compute_source(skinning_shader_source), {"WIDE_JOINTS", "MORPH_TARGETS"}, features)}});
+    bone_palette_location_ = glGetUniformLocation(program_, "bone_palette");
+    bone_count_location_ = glGetUniformLocation(program_, "bone_count");
+    vertex_count_location_ = glGetUniformLocation(program_, "vertex_count");
+
+    glGenBuffers(1, &output_buffer_);
+
+    if (!morphs)
+        return;
+
+    // The targets stay on this side, to turn weights into dispatches
+    morph_targets_ = geometry.morph_targets;
+    morph_vertex_count_ = geometry.morph_vertices.size();
+
+    morph_program_ = programs.get({{GL_COMPUTE_SHADER, compute_source(morph_shader_source)}});
+    morph_vertex_count_location_ = glGetUniformLocation(program_, "morph_vertex_count");
+    morph_pass_vertex_count_location_ = glGetUniformLocation(morph_program_, "morph_vertex_count");
+    morph_first_row_location_ = glGetUniformLocation(morph_program_, "first_row");
+
+    std::vector<glm::uvec2> ranges;
+    for (auto const & range : geometry.primitives)
+        ranges.push_back({range.first_morph_vertex, range.morph_vertex_count});
+
+    glGenBuffers(1, &morph_range_buffer_);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, morph_range_buffer_);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, ranges.size() * sizeof(ranges[0]), ranges.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &morph_vertex_buffer_);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, morph_vertex_buffer_);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, geometry.morph_vertices.size() * sizeof(geometry.morph_vertices[0]), geometry.morph_vertices.data(), GL_STATIC_DRAW);
+
+    // Never empty, since a vertex is only a morph vertex when some delta moves it
+    glGenBuffers(1, &morph_delta_buffer_);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, morph_delta_buffer_);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, geometry.morph_deltas.size() * sizeof(geometry.morph_deltas[0]), geometry.morph_deltas.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &active_target_buffer_);
+    glGenBuffers(1, &morph_sum_buffer_);
+}
+
+gpu_skinning::~gpu_skinning()
+{
+    glDeleteBuffers(1, &output_buffer_);
+    if (morph_program_)
+    {
+        GLuint const buffers[] = {morph_range_buffer_, morph_vertex_buffer_, morph_delta_buffer_, active_target_buffer_, morph_sum_buffer_};
+        glDeleteBuffers(std::size(buffers), buffers);
+    }
+}
+
+void gpu_skinning::update(GLuint bone_palette, int bone_count, std::size_t instance_count, std::span<morph_weight const> morph_weights)
+{
+    if (instance_count == 0 || vertex_count_ == 0)
+        return;
+
+    // Only ever grows; every pass reads just the first instance_count instances
+    if (instance_count > instance_capacity_)
+    {
+        instance_capacity_ = instance_count;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, output_buffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, instance_capacity_ * vertex_count_ * sizeof(skinned_vertex), nullptr, GL_DYNAMIC_COPY);
+
+        // Sums start out zero, and skinning leaves them zero after reading them
+        if (morph_program_)
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, morph_sum_buffer_);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, instance_capacity_ * morph_vertex_count_ * 6 * sizeof(GLint), nullptr, GL_DYNAMIC_COPY);
+            GLint const zero = 0;
+            glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32I, GL_RED_INTEGER, GL_INT, &zero);
+        }
+    }
+
+    if (morph_program_)
+        apply_morph_targets(instance_count, morph_weights);
+
+    glUseProgram(program_);
+    glUniform1i(bone_palette_location_, 0);
+    glUniform1i(bone_count_location_, bone_count);
+    glUniform1i(vertex_count_location_, vertex_count_);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, bone_palette);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vertex_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, output_buffer_);
+    if (wide_joint_buffer_)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, wide_joint_buffer_);
+    if (morph_program_)
+    {
+        glUniform1i(morph_vertex_count_location_, morph_vertex_count_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, morph_range_buffer_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, morph_vertex_buffer_);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, morph_sum_buffer_);
+    }
+
+    glDispatchCompute((vertex_count_ + group_size - 1) / group_size, instance_count, 1);
+
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void gpu_skinning::apply_morph_targets(std::size_t instance_count, std::span<morph_weight const> morph_weights)
+{
+    active_targets_.clear();
+    std::uint32_t max_delta_count = 0;
+    for (auto const & entry : morph_weights)
+    {
+        if (entry.instance >= instance_count || entry.target >= morph_targets_.size() || std::abs(entry.weight) < min_morph_weight)
+            continue;
+
+        auto const & target = morph_targets_[entry.target];
+        if (target.delta_count == 0)
+            continue;
+
+        float const scale = entry.weight * morph_fixed_point;
+        active_targets_.push_back({entry.instance, target.first_delta, target.delta_count, target.position_scale * scale, target.normal_scale * scale});
+        max_delta_count = std::max(max_delta_count, target.delta_count);
+    }
+
+    if (active_targets_.empty())
+        return;
+
+    // Only the deltas of targets in use are read at all
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, active_target_buffer_);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, active_targets_.size() * sizeof(active_target), active_targets_.data(), GL_STREAM_DRAW);
+
+    glUseProgram(morph_program_);
+    glUniform1i(morph_pass_vertex_count_location_, morph_vertex_count_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, morph_sum_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, morph_delta_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, active_target_buffer_);
+
+    // Rows past 65535, the least every implementation allows, wait for the next dispatch
+    for (std::size_t first = 0; first < active_targets_.size(); first += 65535)
+    {
+        std::size_t const rows = std::min<std::size_t>(active_targets_.size() - first, 65535);
+        glUniform1i(morph_first_row_location_, first);
+        glDispatchCompute((max_delta_count + group_size - 1) / group_size, rows, 1);
+    }
+
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
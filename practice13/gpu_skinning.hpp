@@ -0,0 +1,100 @@
+#pragma once
+
+#include "merged_geometry.hpp"
+#include "program_cache.hpp"
+
+#include <GL/glew.h>
+
+#include <vector>
+#include <span>
+#include <cstddef>
+#include <cstdint>
+
+// Skins every vertex of every instance once per frame in a compute shader (GL 4.3), so that
+// however many draws and passes read an instance's vertices, none of them blends bones again.
+// Instance i's vertices go to output_buffer() at i * vertex_count(), each a skinned_vertex, in
+// the same order as the merged vertex array; a vertex shader fetches them with gl_VertexID,
+// which already includes the draw's base vertex.
+//
+// Morph targets are mixed in before skinning, and cost in proportion to the vertices they
+// move: a pass goes over the deltas of only the targets with a weight on some instance this
+// frame, adding them up with integer atomics into sums kept per instance for just the vertices
+// that targets move. Skinning finds a vertex among those of its primitive by binary search,
+// adds its sums and clears them for the next frame.
+struct gpu_skinning
+{
+    // Skinned, still in the space the bone matrices map to
+    struct skinned_vertex
+    {
+        glm::vec4 position;
+        glm::vec4 normal;
+    };
+
+    // How much of one of the geometry's morph targets an instance of this update takes
+    struct morph_weight
+    {
+        std::uint32_t instance;
+        std::uint32_t target;
+        float weight;
+    };
+
+    static bool supported() { return GLEW_VERSION_4_3; }
+
+    // vertex_buffer holds geometry.vertices as merged_geometry::vertex, and wide_joint_buffer
+    // geometry.wide_joints if it has any. The programs are owned by the cache.
+    gpu_skinning(program_cache & programs, merged_geometry const & geometry, GLuint vertex_buffer, GLuint wide_joint_buffer = 0);
+    ~gpu_skinning();
+
+    gpu_skinning(gpu_skinning const &) = delete;
+    gpu_skinning & operator = (gpu_skinning const &) = delete;
+
+    // bone_palette is the buffer texture of instance_count palettes of bone_count matrices,
+    // packed as the vertex shader reads them. Grows the output when there are more instances
+    // than before, and ends with the barrier that makes the output visible to vertex shaders.
+    void update(GLuint bone_palette, int bone_count, std::size_t instance_count, std::span<morph_weight const> morph_weights = {});
+
+    GLuint output_buffer() const { return output_buffer_; }
+    std::size_t vertex_count() const { return vertex_count_; }
+
+private:
+    GLuint vertex_buffer_;
+    GLuint wide_joint_buffer_;
+    std::size_t vertex_count_;
+    std::size_t instance_capacity_ = 0;
+
+    GLuint program_ = 0;
+    GLuint output_buffer_ = 0;
+
+    GLint bone_palette_location_;
+    GLint bone_count_location_;
+    GLint vertex_count_location_;
+
+    // As the morph pass reads them
+    struct active_target
+    {
+        std::uint32_t instance;
+        std::uint32_t first_delta;
+        std::uint32_t delta_count;
+        // Including the weight and the fixed point
+        float position_scale;
+        float normal_scale;
+    };
+
+    std::vector<merged_geometry::morph_target> morph_targets_;
+    std::size_t morph_vertex_count_ = 0;
+    std::vector<active_target> active_targets_;
+
+    // All zero without morph targets
+    GLuint morph_program_ = 0;
+    GLuint morph_range_buffer_ = 0;
+    GLuint morph_vertex_buffer_ = 0;
+    GLuint morph_delta_buffer_ = 0;
+    GLuint active_target_buffer_ = 0;
+    GLuint morph_sum_buffer_ = 0;
+
+    GLint morph_vertex_count_location_ = -1;
+    GLint morph_pass_vertex_count_location_ = -1;
+    GLint morph_first_row_location_ = -1;
+
+    void apply_morph_targets(std::size_t instance_count, std::span<morph_weight const> morph_weights);
+};
@@ -15,11 +15,15 @@
 #include <vector>
 #include <random>
 #include <map>
+#include <optional>
 #include <cmath>
+#include <limits>
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
 
-#define GLM_FORCE_SWIZZLE
-#define GLM_ENABLE_EXPERIMENTAL
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
 #include <glm/mat4x4.hpp>
 #include <glm/ext/matrix_transform.hpp>
 #include <glm/ext/matrix_clip_space.hpp>
@@ -28,7 +32,31 @@
 #include <glm/gtx/string_cast.hpp>
 
 #include "gltf_loader.hpp"
-#include "stb_image.h"
+#include "virtual_fs.hpp"
+#include "merged_geometry.hpp"
+#include "render_queue.hpp"
+#include "scene_graph.hpp"
+#include "gl_state_cache.hpp"
+#include "animation_clip.hpp"
+#include "animation_compression.hpp"
+#include "skinning.hpp"
+#include "clip_bounds.hpp"
+#include "gpu_skinning.hpp"
+#include "weighted_oit.hpp"
+#include "animation_texture.hpp"
+#include "animation_lod.hpp"
+#include "blend_tree.hpp"
+#include "aabb.hpp"
+#include "frustum.hpp"
+#include "intersect.hpp"
+#include "texture_cache.hpp"
+#include "asset_residency.hpp"
+#include "input_state.hpp"
+#include "replay_session.hpp"
+#include "program_cache.hpp"
+#include "shader_permutations.hpp"
+#include "upload_thread.hpp"
+#include "allocation_tracker.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -48,97 +76,364 @@ void glew_fail(std::string_view message, GLenum error)
 const char vertex_shader_source[] =
 R"(#version 330 core
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+// Bone matrices of all instances, bone_count per instance, each a mat4x3 packed into 3 texels
+uniform samplerBuffer bone_palette;
+uniform int bone_count;
+
 layout (location = 0) in vec3 in_position;
 layout (location = 1) in vec3 in_normal;
 layout (location = 2) in vec2 in_texcoord;
+layout (location = 3) in ivec4 in_joints;
+layout (location = 4) in vec4 in_weights;
+layout (location = 6) in uint in_primitive;
+
+// World matrices of the visible instances, sorted front to back, each a mat4x3 packed into
+// 3 texels; transparent draws walk them in reverse
+uniform samplerBuffer instance_models;
+uniform int instance_count;
+uniform int reverse_instances;
+
+mat4x3 instance_model(int instance)
+{
+    vec4 t0 = texelFetch(instance_models, instance * 3);
+    vec4 t1 = texelFetch(instance_models, instance * 3 + 1);
+    vec4 t2 = texelFetch(instance_models, instance * 3 + 2);
+    return mat4x3(t0.xyz, vec3(t0.w, t1.xy), vec3(t1.zw, t2.x), t2.yzw);
+}
+
+int instance;
 
 out vec3 normal;
 out vec2 texcoord;
+flat out uint primitive;
+
+mat4x3 bone(int index)
+{
+    int base = (instance * bone_count + index) * 3;
+    vec4 t0 = texelFetch(bone_palette, base);
+    vec4 t1 = texelFetch(bone_palette, base + 1);
+    vec4 t2 = texelFetch(bone_palette, base + 2);
+    return mat4x3(t0.xyz, vec3(t0.w, t1.xy), vec3(t1.zw, t2.x), t2.yzw);
+}
 
 void main()
 {
+    instance = (reverse_instances == 1) ? instance_count - 1 - gl_InstanceID : gl_InstanceID;
+
+    // Only primitives whose vertices have weights are drawn with SKINNING
+#ifdef SKINNING
+    mat4x3 bone_matrix = in_weights.x * bone(in_joints.x)
+        + in_weights.y * bone(in_joints.y)
+        + in_weights.z * bone(in_joints.z)
+        + in_weights.w * bone(in_joints.w);
+#else
+    mat4x3 bone_matrix = mat4x3(1.0);
+#endif
+
+    vec3 position = bone_matrix * vec4(in_position, 1.0);
 
-    gl_Position = projection * view * model * vec4(in_position, 1.0);
-    normal = mat3(model) * in_normal;
+    mat4x3 model = instance_model(instance);
+    gl_Position = projection * view * vec4(model * vec4(position, 1.0), 1.0);
+    normal = mat3(model) * (bone_matrix * vec4(in_normal, 0.0));
     texcoord = in_texcoord;
+    primitive = in_primitive;
+}
+)";
+
+// Same as the palette one, but bones come from the frames baked into an animation_texture:
+// every instance blends two frames of each of the two clips it crossfades between
+const char baked_vertex_shader_source[] =
+R"(#version 330 core
+
+uniform mat4 view;
+uniform mat4 projection;
+
+// One row per clip frame, bone matrices packed into 3 texels each as in the palette
+uniform sampler2D animation_frames;
+// Two texels per visible instance, one per clip: its two rows, the weight of the second,
+// and in the first texel's w the weight of the second clip
+uniform samplerBuffer instance_clips;
+
+layout (location = 0) in vec3 in_position;
+layout (location = 1) in vec3 in_normal;
+layout (location = 2) in vec2 in_texcoord;
+layout (location = 3) in ivec4 in_joints;
+layout (location = 4) in vec4 in_weights;
+layout (location = 6) in uint in_primitive;
+
+// World matrices of the visible instances, sorted front to back, each a mat4x3 packed into
+// 3 texels; transparent draws walk them in reverse
+uniform samplerBuffer instance_models;
+uniform int instance_count;
+uniform int reverse_instances;
+
+mat4x3 instance_model(int instance)
+{
+    vec4 t0 = texelFetch(instance_models, instance * 3);
+    vec4 t1 = texelFetch(instance_models, instance * 3 + 1);
+    vec4 t2 = texelFetch(instance_models, instance * 3 + 2);
+    return mat4x3(t0.xyz, vec3(t0.w, t1.xy), vec3(t1.zw, t2.x), t2.yzw);
+}
+
+vec4 clip_a;
+vec4 clip_b;
+
+out vec3 normal;
+out vec2 texcoord;
+flat out uint primitive;
+
+mat4x3 frame_bone(float row, int index)
+{
+    ivec2 base = ivec2(index * 3, int(row));
+    vec4 t0 = texelFetch(animation_frames, base, 0);
+    vec4 t1 = texelFetch(animation_frames, base + ivec2(1, 0), 0);
+    vec4 t2 = texelFetch(animation_frames, base + ivec2(2, 0), 0);
+    return mat4x3(t0.xyz, vec3(t0.w, t1.xy), vec3(t1.zw, t2.x), t2.yzw);
+}
+
+mat4x3 clip_bone(vec4 clip, int index)
+{
+    return frame_bone(clip.x, index) * (1.0 - clip.z) + frame_bone(clip.y, index) * clip.z;
+}
+
+mat4x3 bone(int index)
+{
+    mat4x3 result = clip_bone(clip_a, index);
+    if (clip_a.w > 0.0)
+        result = result * (1.0 - clip_a.w) + clip_bone(clip_b, index) * clip_a.w;
+    return result;
+}
+
+void main()
+{
+    int instance = (reverse_instances == 1) ? instance_count - 1 - gl_InstanceID : gl_InstanceID;
+
+    // Only primitives whose vertices have weights are drawn with SKINNING
+#ifdef SKINNING
+    clip_a = texelFetch(instance_clips, instance * 2);
+    clip_b = texelFetch(instance_clips, instance * 2 + 1);
+
+    mat4x3 bone_matrix = in_weights.x * bone(in_joints.x)
+        + in_weights.y * bone(in_joints.y)
+        + in_weights.z * bone(in_joints.z)
+        + in_weights.w * bone(in_joints.w);
+#else
+    mat4x3 bone_matrix = mat4x3(1.0);
+#endif
+
+    vec3 position = bone_matrix * vec4(in_position, 1.0);
+
+    mat4x3 model = instance_model(instance);
+    gl_Position = projection * view * vec4(model * vec4(position, 1.0), 1.0);
+    normal = mat3(model) * (bone_matrix * vec4(in_normal, 0.0));
+    texcoord = in_texcoord;
+    primitive = in_primitive;
+}
+)";
+
+// Same output, but positions and normals come skinned from gpu_skinning instead of being
+// blended from the bone palette here
+const char skinned_vertex_shader_source[] =
+R"(#version 430 core
+
+uniform mat4 view;
+uniform mat4 projection;
+
+layout (location = 2) in vec2 in_texcoord;
+layout (location = 6) in uint in_primitive;
+
+// World matrices of the visible instances, sorted front to back, each a mat4x3 packed into
+// 3 texels; transparent draws walk them in reverse
+uniform samplerBuffer instance_models;
+uniform int instance_count;
+uniform int reverse_instances;
+
+mat4x3 instance_model(int instance)
+{
+    vec4 t0 = texelFetch(instance_models, instance * 3);
+    vec4 t1 = texelFetch(instance_models, instance * 3 + 1);
+    vec4 t2 = texelFetch(instance_models, instance * 3 + 2);
+    return mat4x3(t0.xyz, vec3(t0.w, t1.xy), vec3(t1.zw, t2.x), t2.yzw);
+}
+
+// Vertices per instance in the skinned buffer
+uniform int vertex_count;
+
+struct skinned_vertex
+{
+    vec4 position;
+    vec4 normal;
+};
+
+layout (std430, binding = 1) readonly buffer skinned_vertices
+{
+    skinned_vertex skinned[];
+};
+
+out vec3 normal;
+out vec2 texcoord;
+flat out uint primitive;
+
+void main()
+{
+    int instance = (reverse_instances == 1) ? instance_count - 1 - gl_InstanceID : gl_InstanceID;
+
+    // gl_VertexID includes the base vertex, so it indexes the merged vertex array
+    skinned_vertex v = skinned[instance * vertex_count + gl_VertexID];
+
+    mat4x3 model = instance_model(instance);
+    gl_Position = projection * view * vec4(model * v.position, 1.0);
+    normal = mat3(model) * v.normal.xyz;
+    texcoord = in_texcoord;
+    primitive = in_primitive;
 }
 )";
 
 const char fragment_shader_source[] =
 R"(#version 330 core
 
-uniform sampler2D albedo;
-uniform vec4 color;
-uniform int use_texture;
+uniform sampler2DArray albedo;
+
+// Two texels per primitive: its color, then its albedo layer in x and its alpha cutoff in y
+uniform samplerBuffer materials;
 
 uniform vec3 light_direction;
 
 layout (location = 0) out vec4 out_color;
+layout (location = 1) out float out_weight;
 
 in vec3 normal;
 in vec2 texcoord;
+flat in uint primitive;
 
 void main()
 {
-    vec4 albedo_color;
+    vec4 parameters = texelFetch(materials, int(primitive) * 2 + 1);
 
-    if (use_texture == 1)
-        albedo_color = texture(albedo, texcoord);
-    else
-        albedo_color = color;
+#ifdef ALBEDO_TEXTURE
+    vec4 albedo_color = texture(albedo, vec3(texcoord, parameters.x));
+#else
+    vec4 albedo_color = texelFetch(materials, int(primitive) * 2);
+#endif
+
+#ifdef ALPHA_TEST
+    if (albedo_color.a < parameters.y)
+        discard;
+#endif
 
     float ambient = 0.4;
     float diffuse = max(0.0, dot(normalize(normal), light_direction));
 
-    out_color = vec4(albedo_color.rgb * (ambient + diffuse), albedo_color.a);
+    vec4 shaded = vec4(albedo_color.rgb * (ambient + diffuse), albedo_color.a);
+
+    // For the transparent draws into a weighted_oit accumulation target
+#ifdef WEIGHTED_BLENDED
+    // Nearer layers weigh more, so that they still come out in front when many overlap
+    float weight = clamp(3e3 * pow(1.0 - gl_FragCoord.z, 3.0), 1e-2, 3e3);
+    out_color = vec4(shaded.rgb * shaded.a * weight, shaded.a);
+    out_weight = shaded.a * weight;
+#else
+    out_color = shaded;
+#endif
 }
 )";
 
-GLuint create_shader(GLenum type, const char * source)
+// Same shading, but each primitive samples its own array through a bindless handle, so
+// draw groups no longer split by texture array and nothing is bound between them
+const char bindless_fragment_shader_source[] =
+R"(#version 330 core
+#extension GL_ARB_bindless_texture : require
+
+// One per primitive with its albedo array's handle in xy; 1024 of them fit in the smallest
+// uniform block a driver may offer
+layout (std140) uniform bindless_materials
 {
-    GLuint result = glCreateShader(type);
-    glShaderSource(result, 1, &source, nullptr);
-    glCompileShader(result);
-    GLint status;
-    glGetShaderiv(result, GL_COMPILE_STATUS, &status);
-    if (status != GL_TRUE)
-    {
-        GLint info_log_length;
-        glGetShaderiv(result, GL_INFO_LOG_LENGTH, &info_log_length);
-        std::string info_log(info_log_length, '\0');
-        glGetShaderInfoLog(result, info_log.size(), nullptr, info_log.data());
-        throw std::runtime_error("Shader compilation failed: " + info_log);
-    }
-    return result;
+    uvec4 albedo_handles[1024];
+};
+
+// Two texels per primitive: its color, then its albedo layer in x and its alpha cutoff in y
+uniform samplerBuffer materials;
+
+uniform vec3 light_direction;
+
+layout (location = 0) out vec4 out_color;
+layout (location = 1) out float out_weight;
+
+in vec3 normal;
+in vec2 texcoord;
+flat in uint primitive;
+
+void main()
+{
+    vec4 parameters = texelFetch(materials, int(primitive) * 2 + 1);
+
+#ifdef ALBEDO_TEXTURE
+    vec4 albedo_color = texture(sampler2DArray(albedo_handles[primitive].xy), vec3(texcoord, parameters.x));
+#else
+    vec4 albedo_color = texelFetch(materials, int(primitive) * 2);
+#endif
+
+#ifdef ALPHA_TEST
+    if (albedo_color.a < parameters.y)
+        discard;
+#endif
+
+    float ambient = 0.4;
+    float diffuse = max(0.0, dot(normalize(normal), light_direction));
+
+    vec4 shaded = vec4(albedo_color.rgb * (ambient + diffuse), albedo_color.a);
+
+    // For the transparent draws into a weighted_oit accumulation target
+#ifdef WEIGHTED_BLENDED
+    // Nearer layers weigh more, so that they still come out in front when many overlap
+    float weight = clamp(3e3 * pow(1.0 - gl_FragCoord.z, 3.0), 1e-2, 3e3);
+    out_color = vec4(shaded.rgb * shaded.a * weight, shaded.a);
+    out_weight = shaded.a * weight;
+#else
+    out_color = shaded;
+#endif
 }
+)";
 
-template <typename ... Shaders>
-GLuint create_program(Shaders ... shaders)
+// Bits of a material key, each the #define of the same name in the scene programs, so that
+// what a primitive does not use costs nothing in its shaders
+namespace material_feature
 {
-    GLuint result = glCreateProgram();
-    (glAttachShader(result, shaders), ...);
-    glLinkProgram(result);
 
-    GLint status;
-    glGetProgramiv(result, GL_LINK_STATUS, &status);
-    if (status != GL_TRUE)
-    {
-        GLint info_log_length;
-        glGetProgramiv(result, GL_INFO_LOG_LENGTH, &info_log_length);
-        std::string info_log(info_log_length, '\0');
-        glGetProgramInfoLog(result, info_log.size(), nullptr, info_log.data());
-        throw std::runtime_error("Program linkage failed: " + info_log);
-    }
+    constexpr shader_permutations::features albedo_texture = 1 << 0;
+    constexpr shader_permutations::features skinning = 1 << 1;
+    constexpr shader_permutations::features alpha_test = 1 << 2;
+    // Added to transparent draws into the weighted_oit accumulation target
+    constexpr shader_permutations::features weighted_blended = 1 << 3;
 
+    std::vector<std::string> const names = {"ALBEDO_TEXTURE", "SKINNING", "ALPHA_TEST", "WEIGHTED_BLENDED"};
+
+}
+
+shader_permutations::features material_features(gltf_model::material const & material, bool skinned)
+{
+    shader_permutations::features result = 0;
+    if (material.texture_path)
+        result |= material_feature::albedo_texture;
+    if (skinned)
+        result |= material_feature::skinning;
+    if (material.alpha_cutoff)
+        result |= material_feature::alpha_test;
     return result;
 }
 
-int main() try
+int main(int argc, char ** argv) try
 {
+    replay_session replay(argc, argv);
+    auto const residency = parse_residency_policy(argc, argv);
+    bool const threaded_uploads = std::none_of(argv + 1, argv + argc, [](char const * arg){ return std::string_view(arg) == "--no-upload-thread"; });
+    // Aborts on the first heap allocation of a frame after the first one, which sizes the scratch
+    // storage; only does anything in a build with ALLOCATION_TRACKING
+    bool const fail_on_frame_allocation = std::any_of(argv + 1, argv + argc, [](char const * arg){ return std::string_view(arg) == "--fail-on-frame-allocation"; });
+
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
         sdl2_fail("SDL_Init: ");
 
@@ -175,95 +470,601 @@ int main() try
     if (!GLEW_VERSION_3_3)
         throw std::runtime_error("OpenGL 3.3 is not supported");
 
-    auto vertex_shader = create_shader(GL_VERTEX_SHADER, vertex_shader_source);
-    auto fragment_shader = create_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
-    auto program = create_program(vertex_shader, fragment_shader);
-
-    GLuint model_location = glGetUniformLocation(program, "model");
-    GLuint view_location = glGetUniformLocation(program, "view");
-    GLuint projection_location = glGetUniformLocation(program, "projection");
-    GLuint albedo_location = glGetUniformLocation(program, "albedo");
-    GLuint color_location = glGetUniformLocation(program, "color");
-    GLuint use_texture_location = glGetUniformLocation(program, "use_texture");
-    GLuint light_direction_location = glGetUniformLocation(program, "light_direction");
+    // Buffers and textures are filled on a second context unless --no-upload-thread is given,
+    // so that this thread compiles shaders and builds draw groups meanwhile
+    upload_thread uploads(window, threaded_uploads);
+    std::cout << "Uploads " << (uploads.threaded() ? "on a shared context" : "on the render thread") << std::endl;
 
     const std::string project_root = PROJECT_ROOT;
     const std::string model_path = project_root + "/dancing/dancing.gltf";
 
-    auto const input_model = load_gltf(model_path);
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, input_model.buffer.size(), input_model.buffer.data(), GL_STATIC_DRAW);
+    // Made with pack_assets from the asset_pack directory; loose files are used without it.
+    // --remote-pack URL reads the same pack from an HTTP server instead, caching what it fetches.
+    const std::string pack_path = project_root + "/practice13.pack";
+    if (auto remote = std::find(argv + 1, argv + argc, std::string_view("--remote-pack")); remote + 1 < argv + argc)
+    {
+        remote_pack_options remote_options;
+        remote_options.cache_directory = project_root + "/.asset_cache";
+        asset_fs().mount_remote(remote[1], project_root, remote_options);
+        std::cout << "Assets from " << remote[1] << std::endl;
+    }
+    else if (std::filesystem::exists(pack_path))
+    {
+        asset_fs().mount(pack_path, project_root);
+        std::cout << "Assets from " << pack_path << std::endl;
+    }
+
+    auto const load_start = std::chrono::high_resolution_clock::now();
+
+    job_system jobs;
 
-    struct mesh
+    gltf_load_options load_options;
+    load_options.jobs = &jobs;
+    auto input_model = [&]
     {
-        GLuint vao;
-        gltf_model::accessor indices;
-        gltf_model::material material;
+        allocation_scope scope(allocation_tag::loader);
+        return load_gltf(model_path, load_options);
+    }();
+
+    // CPU copies are dropped as soon as their upload is done, unless --residency keep says
+    // otherwise; what did stay is reported once loading is over
+    residency_report residency_memory;
+    residency_memory.loaded("model", model_memory_bytes(input_model));
+    std::cout << "Asset residency: " << residency_policy_name(residency) << std::endl;
+
+    // The rest of the loading that needs no GL context runs on the workers, each step once
+    // the ones it depends on are done, while this thread compiles shaders and uploads every
+    // result as soon as it waits for it:
+    //   model -> merged geometry -> vertex and index buffers
+    //   model -> decoded images -> texture arrays and mipmaps
+    //   model -> baked and compressed clips -> animation texture
+    //   merged geometry and clips -> skin bounds of every clip
+    job_counter geometry_ready, images_ready, clips_ready, frames_ready, bounds_ready;
+
+    // Every primitive in one vertex and index buffer, drawn from a single vertex array. The
+    // boxes of the vertices on every bone are taken before the vertices can be released.
+    merged_geometry merged;
+    bone_bounds bone_boxes;
+    jobs.submit([&]
+    {
+        merged = merge_primitives(input_model);
+        bone_boxes = compute_bone_bounds(merged, input_model.bones.size());
+    }, &geometry_ready, "merge primitives");
+
+    std::vector<std::string> texture_names;
+    std::vector<std::filesystem::path> texture_paths;
+    for (auto const & mesh : input_model.meshes)
+        for (auto const & primitive : mesh.primitives)
+        {
+            auto const & texture_path = primitive.material.texture_path;
+            if (!texture_path) continue;
+            if (std::find(texture_names.begin(), texture_names.end(), std::string_view(*texture_path)) != texture_names.end()) continue;
+
+            texture_names.emplace_back(*texture_path);
+            texture_paths.push_back(std::filesystem::path(model_path).parent_path() / *texture_path);
+        }
+
+    std::vector<texture_cache::loaded_image> loaded_images;
+    jobs.submit([&]{ loaded_images = texture_cache::load(texture_paths, &jobs); }, &images_ready, "decode textures");
+
+    std::optional<clip_library> clip_storage;
+    std::size_t dense_clip_bytes = 0, compressed_clip_bytes = 0;
+    jobs.submit([&]
+    {
+        auto & clips = clip_storage.emplace(input_model.animations);
+
+        for (std::uint32_t i = 0; i < clips.size(); ++i)
+            dense_clip_bytes += clip_memory_bytes(clips[clip_handle{i}]);
+        // Half a millimetre at the farthest joint, the model is in centimetres
+        clips.compress(input_model.bones, 0.05f);
+        for (std::uint32_t i = 0; i < clips.size(); ++i)
+            compressed_clip_bytes += clip_memory_bytes(clips[clip_handle{i}]);
+    }, &clips_ready, "bake clips");
+
+    animation_texture frames_storage;
+    jobs.submit_after(clips_ready, [&]{ frames_storage = bake_animation_texture(input_model.bones, *clip_storage, jobs); }, &frames_ready, "bake animation texture");
+
+    // Indexed by clip handle; instances are culled by these, never by their poses
+    std::vector<clip_bounds> skin_bounds;
+    jobs.submit_after(clips_ready, [&]
+    {
+        jobs.wait(geometry_ready);
+        skin_bounds.resize(clip_storage->size());
+        jobs.parallel_for(skin_bounds.size(), [&](std::size_t i)
+        {
+            skin_bounds[i] = compute_clip_bounds(input_model.bones, bone_boxes, (*clip_storage)[clip_handle{static_cast<std::uint32_t>(i)}]);
+        });
+    }, &bounds_ready, "bound clips");
+
+    // merge_primitives makes one range per primitive
+    std::size_t primitive_count = 0;
+    for (auto const & mesh : input_model.meshes)
+        primitive_count += mesh.primitives.size();
+
+    // Bindless albedo where the driver has it and the primitives fit the handle block
+    bool const bindless = GLEW_ARB_bindless_texture && primitive_count <= 1024;
+    std::cout << "Albedo textures " << (bindless ? "bindless" : "bound per draw group") << std::endl;
+
+    // Skinned once per frame in a compute shader where GL 4.3 is there, in the vertex shader otherwise
+    bool const compute_skinning = gpu_skinning::supported();
+    std::cout << "Skinning " << (compute_skinning ? "in a compute pass" : "in the vertex shader") << std::endl;
+
+    // A variant of the scene program per material key, and the same for baked animation.
+    // Every key the model's primitives use is submitted here, compiled by the driver while the
+    // workers load, and waited for once the rest is uploaded.
+    program_cache programs(project_root + "/.program_binaries");
+    char const * const scene_fragment_source = bindless ? bindless_fragment_shader_source : fragment_shader_source;
+    shader_permutations scene_programs(programs, {
+        {GL_VERTEX_SHADER, compute_skinning ? skinned_vertex_shader_source : vertex_shader_source},
+        {GL_FRAGMENT_SHADER, scene_fragment_source}}, material_feature::names);
+    shader_permutations baked_programs(programs, {
+        {GL_VERTEX_SHADER, baked_vertex_shader_source},
+        {GL_FRAGMENT_SHADER, scene_fragment_source}}, material_feature::names);
+
+    for (auto const & mesh : input_model.meshes)
+        for (auto const & primitive : mesh.primitives)
+        {
+            auto key = material_features(primitive.material, mesh.skin && primitive.joints && primitive.weights);
+            if (primitive.material.transparent)
+                key |= material_feature::weighted_blended;
+            for (auto permutations : {&scene_programs, &baked_programs})
+            {
+                permutations->submit(key);
+                // Sorted transparency draws them without the bit
+                permutations->submit(key & ~material_feature::weighted_blended);
+            }
+        }
+
+    // Every variant takes the same uniforms apart from where the bones come from; the ones a
+    // program lacks are -1, which glUniform ignores
+    struct program_uniforms
+    {
+        GLint view, projection, albedo, materials, instance_models, instance_count, reverse_instances, light_direction;
+        GLint bone_palette, bone_count, vertex_count;
+        GLint animation_frames, instance_clips;
     };
 
-    auto setup_attribute = [](int index, gltf_model::accessor const & accessor, bool integer = false)
+    auto get_uniforms = [](GLuint program) -> program_uniforms
     {
-        glEnableVertexAttribArray(index);
-        if (integer)
-            glVertexAttribIPointer(index, accessor.size, accessor.type, 0, reinterpret_cast<void *>(accessor.view.offset));
-        else
-            glVertexAttribPointer(index, accessor.size, accessor.type, GL_FALSE, 0, reinterpret_cast<void *>(accessor.view.offset));
+        return {
+            glGetUniformLocation(program, "view"),
+            glGetUniformLocation(program, "projection"),
+            glGetUniformLocation(program, "albedo"),
+            glGetUniformLocation(program, "materials"),
+            glGetUniformLocation(program, "instance_models"),
+            glGetUniformLocation(program, "instance_count"),
+            glGetUniformLocation(program, "reverse_instances"),
+            glGetUniformLocation(program, "light_direction"),
+            glGetUniformLocation(program, "bone_palette"),
+            glGetUniformLocation(program, "bone_count"),
+            glGetUniformLocation(program, "vertex_count"),
+            glGetUniformLocation(program, "animation_frames"),
+            glGetUniformLocation(program, "instance_clips"),
+        };
     };
 
-    std::vector<mesh> meshes;
-    for (auto const & mesh : input_model.meshes)
+    // Uniforms are set once per frame in every variant the frame uses, when it first does
+    struct program_variant
     {
-        for (auto const & primitive : mesh.primitives)
+        program_uniforms uniforms;
+        std::uint64_t frame = -1;
+        std::optional<bool> reversed;
+    };
+    std::map<GLuint, program_variant> program_variants;
+
+    // A grid of dancers, each with its own clip and phase
+    int const crowd_size = 16;
+    float const crowd_spacing = 1.5f;
+
+    // Every dancer is a root node with the model's nodes under it; the skinned mesh is placed
+    // by the node its skeleton hangs from, in this model an Armature node scaled by 0.01
+    scene_graph scene;
+    std::vector<unsigned int> instance_nodes;
+    unsigned int const skeleton_parent = input_model.skins.empty() ? -1u : input_model.skins[0].skeleton_parent;
+    for (int z = 0; z < crowd_size; ++z)
+    {
+        for (int x = 0; x < crowd_size; ++x)
+        {
+            auto const root = scene.add(scene_graph::no_parent, glm::vec3(x - (crowd_size - 1) / 2.f, 0.f, z - (crowd_size - 1) / 2.f) * crowd_spacing);
+            auto const first = scene.add(input_model, root);
+            instance_nodes.push_back(skeleton_parent == -1u ? root : first + skeleton_parent);
+        }
+    }
+    scene.update();
+
+    jobs.wait(geometry_ready);
+    auto const & geometry = merged;
+    residency_memory.loaded("geometry", geometry_memory_bytes(geometry));
+
+    // Named here and filled by the upload thread; the vertex array, which is not shared
+    // between contexts, is made once they are
+    GLuint vbo, ebo;
+    glGenBuffers(1, &vbo);
+    glGenBuffers(1, &ebo);
+
+    // Bone indices are bytes in the vertices, unless there are too many bones for that
+    GLuint wide_joint_vbo = 0;
+    if (!geometry.wide_joints.empty())
+        glGenBuffers(1, &wide_joint_vbo);
+
+    auto const geometry_upload = uploads.submit([&]
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+        glBufferData(GL_COPY_WRITE_BUFFER, geometry.vertices.size() * sizeof(geometry.vertices[0]), geometry.vertices.data(), GL_STATIC_DRAW);
+        if (wide_joint_vbo)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, wide_joint_vbo);
+            glBufferData(GL_COPY_WRITE_BUFFER, geometry.wide_joints.size() * sizeof(geometry.wide_joints[0]), geometry.wide_joints.data(), GL_STATIC_DRAW);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, ebo);
+        glBufferData(GL_COPY_WRITE_BUFFER, geometry.indices.size() * sizeof(geometry.indices[0]), geometry.indices.data(), GL_STATIC_DRAW);
+    });
+
+    // Albedo textures go into one array per texture size, so that primitives
+    // with different textures can still be drawn together; the cache shares them
+    // with any other model that uses the same files. It is left to the upload thread
+    // until the arrays are filled.
+    texture_cache textures;
+
+    std::vector<texture_cache::handle> texture_handles;
+    jobs.wait(images_ready);
+    auto const textures_upload = uploads.submit([&]{ texture_handles = textures.acquire(std::move(loaded_images)); });
+
+    uploads.wait(geometry_upload);
+
+    GLuint vao;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+
+    using vertex = merged_geometry::vertex;
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), reinterpret_cast<void *>(offsetof(vertex, position)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), reinterpret_cast<void *>(offsetof(vertex, normal)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), reinterpret_cast<void *>(offsetof(vertex, texcoord)));
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(vertex), reinterpret_cast<void *>(offsetof(vertex, weights)));
+    glEnableVertexAttribArray(6);
+    glVertexAttribIPointer(6, 1, GL_UNSIGNED_INT, sizeof(vertex), reinterpret_cast<void *>(offsetof(vertex, primitive)));
+
+    glEnableVertexAttribArray(3);
+    if (!wide_joint_vbo)
+        glVertexAttribIPointer(3, 4, GL_UNSIGNED_BYTE, sizeof(vertex), reinterpret_cast<void *>(offsetof(vertex, joints)));
+    else
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, wide_joint_vbo);
+        glVertexAttribIPointer(3, 4, GL_UNSIGNED_SHORT, 0, nullptr);
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+
+    std::optional<gpu_skinning> skinning;
+    if (compute_skinning)
+        skinning.emplace(programs, geometry, vbo, wide_joint_vbo);
+
+    if (residency != residency_policy::keep)
+    {
+        release_vertex_data(merged);
+        residency_memory.resident("geometry", geometry_memory_bytes(geometry));
+    }
+
+    std::map<std::string, texture_cache::handle> texture_layers;
+    std::vector<GLuint> texture_arrays;
+    {
+        uploads.wait(textures_upload);
+        auto const & handles = texture_handles;
+        for (std::size_t i = 0; i < texture_names.size(); ++i)
         {
-            auto & result = meshes.emplace_back();
-            glGenVertexArrays(1, &result.vao);
-            glBindVertexArray(result.vao);
+            texture_layers[texture_names[i]] = handles[i];
+            if (std::find(texture_arrays.begin(), texture_arrays.end(), handles[i].array) == texture_arrays.end())
+                texture_arrays.push_back(handles[i].array);
+        }
 
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
-            result.indices = primitive.indices;
+        std::cout << "Textures: " << textures.misses() << " loaded, " << textures.hits() << " shared, "
+            << textures.resident_bytes() / 1024 / 1024 << " MB resident" << std::endl;
+    }
 
-            setup_attribute(0, primitive.position);
-            setup_attribute(1, primitive.normal);
-            setup_attribute(2, primitive.texcoord);
-            setup_attribute(3, primitive.joints, true);
-            setup_attribute(4, primitive.weights);
+    std::vector<glm::vec4> material_texels;
+    for (auto const & primitive : geometry.primitives)
+    {
+        auto const & material = primitive.material;
+        material_texels.push_back(material.color.value_or(glm::vec4(1.f)));
+        material_texels.push_back(glm::vec4(material.texture_path ? texture_layers[std::string(*material.texture_path)].layer : -1.f, material.alpha_cutoff.value_or(0.f), 0.f, 0.f));
+    }
+
+    GLuint materials_buffer;
+    glGenBuffers(1, &materials_buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, materials_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, material_texels.size() * sizeof(material_texels[0]), material_texels.data(), GL_STATIC_DRAW);
 
-            result.material = primitive.material;
+    GLuint materials_texture;
+    glGenTextures(1, &materials_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, materials_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, materials_buffer);
+
+    // Layout fixed by glMultiDrawElementsIndirect
+    struct draw_elements_indirect_command
+    {
+        GLuint count;
+        GLuint instance_count;
+        GLuint first_index;
+        GLint base_vertex;
+        GLuint base_instance;
+    };
+
+    // Handles are made once per array and stay resident while the program runs; the cache
+    // never evicts arrays that are still referenced
+    GLuint bindless_materials_buffer = 0;
+    if (bindless)
+    {
+        std::map<GLuint, GLuint64> handles;
+        for (GLuint array : texture_arrays)
+        {
+            GLuint64 handle = glGetTextureHandleARB(array);
+            glMakeTextureHandleResidentARB(handle);
+            handles[array] = handle;
         }
+
+        // Sized for the whole block, which the binding has to cover
+        std::vector<glm::uvec4> handle_texels(1024, glm::uvec4(0));
+        for (std::size_t i = 0; i < geometry.primitives.size(); ++i)
+            if (auto const & texture_path = geometry.primitives[i].material.texture_path)
+            {
+                GLuint64 handle = handles[texture_layers[std::string(*texture_path)].array];
+                handle_texels[i] = {static_cast<GLuint>(handle), static_cast<GLuint>(handle >> 32), 0, 0};
+            }
+
+        glGenBuffers(1, &bindless_materials_buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, bindless_materials_buffer);
+        glBufferData(GL_UNIFORM_BUFFER, handle_texels.size() * sizeof(handle_texels[0]), handle_texels.data(), GL_STATIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, 0, bindless_materials_buffer);
     }
 
-    std::map<std::string, GLuint> textures;
-    for (auto const & mesh : meshes)
+    // Primitives sharing blending, face culling, material key and texture array (unless
+    // bindless), drawn with one multi-draw
+    struct draw_group
+    {
+        bool transparent;
+        bool two_sided;
+        shader_permutations::features features;
+        GLuint texture_array;
+        // Position in texture_arrays plus one, zero without a texture; used in sort keys
+        std::uint32_t texture_index;
+        std::vector<draw_elements_indirect_command> commands;
+        std::size_t first_command = 0;
+    };
+
+    std::vector<draw_group> draw_groups;
+    for (auto const & primitive : geometry.primitives)
     {
-        if (!mesh.material.texture_path) continue;
-        if (textures.contains(*mesh.material.texture_path)) continue;
+        auto const & material = primitive.material;
+        if (!material.texture_path && !material.color)
+            continue;
+
+        GLuint const texture_array = (material.texture_path && !bindless) ? texture_layers[std::string(*material.texture_path)].array : 0;
+        auto const features = material_features(material, primitive.skinned);
+
+        auto group = std::find_if(draw_groups.begin(), draw_groups.end(), [&](draw_group const & group)
+        {
+            return group.transparent == material.transparent && group.two_sided == material.two_sided
+                && group.features == features && group.texture_array == texture_array;
+        });
+        if (group == draw_groups.end())
+        {
+            std::uint32_t const texture_index = texture_array ? std::find(texture_arrays.begin(), texture_arrays.end(), texture_array) - texture_arrays.begin() + 1 : 0;
+            group = draw_groups.insert(group, {material.transparent, material.two_sided, features, texture_array, texture_index, {}});
+        }
+
+        group->commands.push_back({primitive.index_count, 0, primitive.first_index, static_cast<GLint>(primitive.base_vertex), 0});
+    }
+
+    // Without GL 4.3 or the extension, the same commands are issued one by one
+    bool const multi_draw_indirect = GLEW_ARB_multi_draw_indirect;
+
+    std::vector<draw_elements_indirect_command> draw_commands;
+    GLuint draw_commands_buffer;
+    glGenBuffers(1, &draw_commands_buffer);
 
-        auto path = std::filesystem::path(model_path).parent_path() / *mesh.material.texture_path;
+    render_queue queue;
+    gl_state_cache state;
 
-        int width, height, channels;
-        auto data = stbi_load(path.c_str(), &width, &height, &channels, 4);
-        assert(data);
+    // O switches transparent groups between weighted blended OIT, drawn in any order, and
+    // blending over each other with their instances back to front
+    weighted_oit transparency(programs, width, height);
+    bool order_independent = true;
 
-        GLuint texture;
-        glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+    jobs.wait(clips_ready);
+    auto const & clips = *clip_storage;
+    residency_memory.loaded("clips", compressed_clip_bytes);
 
-        stbi_image_free(data);
+    // Geometry and clips are made by now, and the frames only need the bones, which stay
+    if (residency != residency_policy::keep)
+    {
+        release_model_data(input_model);
+        residency_memory.resident("model", model_memory_bytes(input_model));
+    }
+    std::cout << "Animation clips: " << dense_clip_bytes / 1024 << " KB baked, " << compressed_clip_bytes / 1024 << " KB compressed" << std::endl;
 
-        textures[*mesh.material.texture_path] = texture;
+    // Resolved once here rather than looked up by name every frame
+    std::vector<clip_handle> dance_clips;
+    for (auto const & name : {"flair", "hip-hop", "rumba"})
+    {
+        auto handle = clips.find(name);
+        if (!handle)
+            throw std::runtime_error(std::string("Animation not found: ") + name);
+        dance_clips.push_back(*handle);
+    }
+
+    // Every dancer plays each clip for a while, then crossfades into the next one
+    float const dance_length = 8.f;
+    float const crossfade_length = 1.f;
+
+    std::vector<skinned_instance> instances(instance_nodes.size());
+    std::vector<blend_tree> instance_blends(instances.size());
+    std::vector<float> instance_phases(instances.size());
+    std::vector<float> instance_screen_size(instances.size());
+
+    std::default_random_engine rng;
+    for (std::size_t i = 0; i < instances.size(); ++i)
+    {
+        instances[i].blend = &instance_blends[i];
+        instance_phases[i] = std::uniform_real_distribution<float>(0.f, dance_length * dance_clips.size())(rng);
     }
 
+    animation_lod lod(input_model.bones, instances.size());
+
+    jobs.wait(bounds_ready);
+
+    // World bounds of an instance: those of the skin in the segments of the clips it is
+    // playing, both of them while it crossfades
+    auto const instance_bounds = [&](std::size_t i, clip_handle from, clip_handle to, float time, float fade)
+    {
+        auto [local_min, local_max] = skin_bounds[from.index].at(clips[from], time);
+        if (fade > 0.f)
+        {
+            auto const to_bounds = skin_bounds[to.index].at(clips[to], time);
+            local_min = glm::min(local_min, to_bounds.first);
+            local_max = glm::max(local_max, to_bounds.second);
+        }
+
+        glm::mat4 const & world = scene.world(instance_nodes[i]);
+        glm::vec3 const center = world * glm::vec4((local_min + local_max) / 2.f, 1.f);
+        glm::vec3 const local_extent = (local_max - local_min) / 2.f;
+        glm::vec3 extent(0.f);
+        for (int axis = 0; axis < 3; ++axis)
+            extent += glm::abs(glm::vec3(world[axis])) * local_extent[axis];
+        return std::pair{center - extent, center + extent};
+    };
+
+    // Palettes and world matrices of the visible instances only, front to back, uploaded once
+    // per frame
+    std::vector<std::pair<float, std::size_t>> visible_instances;
+    std::vector<glm::mat4x3> visible_palette;
+    std::vector<glm::mat4x3> visible_models;
+
+    // Morph targets every dancer mixes in, at their meshes' default weights, and the same for
+    // each visible instance; only compute skinning applies them
+    std::vector<gpu_skinning::morph_weight> instance_morphs;
+    for (auto const & range : merged.primitives)
+        for (std::uint32_t t = 0; t < range.target_count; ++t)
+            if (float const weight = input_model.meshes[range.mesh].weights[t]; weight != 0.f)
+                instance_morphs.push_back({0, range.first_target + t, weight});
+    std::vector<gpu_skinning::morph_weight> visible_morphs;
+    GLuint bone_palette_buffer;
+    glGenBuffers(1, &bone_palette_buffer);
+
+    GLuint bone_palette_texture;
+    glGenTextures(1, &bone_palette_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, bone_palette_texture);
+    glBindBuffer(GL_TEXTURE_BUFFER, bone_palette_buffer);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, bone_palette_buffer);
+
+    GLuint instance_models_buffer;
+    glGenBuffers(1, &instance_models_buffer);
+
+    GLuint instance_models_texture;
+    glGenTextures(1, &instance_models_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, instance_models_texture);
+    glBindBuffer(GL_TEXTURE_BUFFER, instance_models_buffer);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, instance_models_buffer);
+
+    // V switches the crowd to palettes baked per clip frame, so no pose is evaluated on the CPU
+    jobs.wait(frames_ready);
+    auto const & baked_frames = frames_storage;
+    bool baked_animation = false;
+
+    GLuint animation_frames_texture;
+    glGenTextures(1, &animation_frames_texture);
+    auto const frames_upload = uploads.submit([&]
+    {
+        glBindTexture(GL_TEXTURE_2D, animation_frames_texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, baked_frames.width(), baked_frames.height(), 0, GL_RGBA, GL_FLOAT, baked_frames.palettes.data());
+    });
+    std::cout << "Baked animation: " << baked_frames.height() << " frames, "
+        << baked_frames.palettes.size() * sizeof(baked_frames.palettes[0]) / 1024 << " KB" << std::endl;
+    residency_memory.loaded("animation frames", baked_frames.palettes.capacity() * sizeof(baked_frames.palettes[0]));
+
+    std::vector<glm::vec4> visible_clips;
+    GLuint instance_clips_buffer;
+    glGenBuffers(1, &instance_clips_buffer);
+
+    GLuint instance_clips_texture;
+    glGenTextures(1, &instance_clips_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, instance_clips_texture);
+    glBindBuffer(GL_TEXTURE_BUFFER, instance_clips_buffer);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, instance_clips_buffer);
+
     auto last_frame_start = std::chrono::high_resolution_clock::now();
 
+    auto milliseconds_since = [](auto start)
+    {
+        return std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+
+    uploads.wait(frames_upload);
+    if (residency != residency_policy::keep)
+    {
+        frames_storage.palettes = {};
+        residency_memory.resident("animation frames", 0);
+    }
+
+    programs.wait();
+    std::cout << "Scene programs: " << scene_programs.size() + baked_programs.size() << " variants, "
+        << programs.loaded() << " loaded, " << programs.compiled() << " compiled" << std::endl;
+
+    std::cout << "Loaded in " << milliseconds_since(load_start) << " ms" << std::endl;
+    std::cout << "CPU memory resident after upload:" << std::endl;
+    residency_memory.print(std::cout);
+    allocation_tracker::global().print_summary(std::cout);
+
+    // G uploads the geometry again, as after losing the context: from the copy kept in
+    // memory, from the files reloaded for it, or not at all once the copy is released. The
+    // reload and the upload both run on the upload thread, and the frames drawn meanwhile read
+    // the buffers as they were, which hold the same data.
+    std::optional<upload_thread::ticket> geometry_rebuild;
+    auto rebuild_start = std::chrono::high_resolution_clock::now();
+    auto rebuild_geometry = [&]
+    {
+        if (residency == residency_policy::release)
+        {
+            std::cout << "Geometry was released after upload, run with --residency reload to rebuild it" << std::endl;
+            return;
+        }
+        if (geometry_rebuild)
+            return;
+
+        rebuild_start = std::chrono::high_resolution_clock::now();
+        geometry_rebuild = uploads.submit([&]
+        {
+            if (residency == residency_policy::reload)
+            {
+                allocation_scope scope(allocation_tag::loader);
+                merged = merge_primitives(load_gltf(model_path, load_options));
+            }
+
+            glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, 0, geometry.vertices.size() * sizeof(geometry.vertices[0]), geometry.vertices.data());
+            if (wide_joint_vbo)
+            {
+                glBindBuffer(GL_COPY_WRITE_BUFFER, wide_joint_vbo);
+                glBufferSubData(GL_COPY_WRITE_BUFFER, 0, geometry.wide_joints.size() * sizeof(geometry.wide_joints[0]), geometry.wide_joints.data());
+            }
+            glBindBuffer(GL_COPY_WRITE_BUFFER, ebo);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, 0, geometry.indices.size() * sizeof(geometry.indices[0]), geometry.indices.data());
+
+            if (residency == residency_policy::reload)
+                release_vertex_data(merged);
+        });
+    };
+    bool first_frame = true;
+
     float time = 0.f;
 
-    std::map<SDL_Keycode, bool> button_down;
+    input_state input;
 
     float view_angle = 0.f;
     float camera_distance = 1.5f;
@@ -273,9 +1074,15 @@ int main() try
 
     bool paused = false;
 
+    std::uint64_t frame = 0;
+
     bool running = true;
-    while (running)
+    for (; running; ++frame)
     {
+        frame_scope frame_allocations;
+
+        input.begin_frame();
+
         for (SDL_Event event; SDL_PollEvent(&event);) switch (event.type)
         {
         case SDL_QUIT:
@@ -287,56 +1094,114 @@ int main() try
                 width = event.window.data1;
                 height = event.window.data2;
                 glViewport(0, 0, width, height);
+                transparency.resize(width, height);
                 break;
             }
             break;
         case SDL_KEYDOWN:
-            button_down[event.key.keysym.sym] = true;
+            input.handle_event(event);
             if (event.key.keysym.sym == SDLK_SPACE)
                 paused = !paused;
+            if (event.key.keysym.sym == SDLK_o)
+            {
+                order_independent = !order_independent;
+                std::cout << "Transparency: " << (order_independent ? "weighted blended" : "sorted") << std::endl;
+            }
+            if (event.key.keysym.sym == SDLK_g)
+                rebuild_geometry();
+            if (event.key.keysym.sym == SDLK_v)
+            {
+                baked_animation = !baked_animation;
+                std::cout << "Animation: " << (baked_animation ? "baked" : "evaluated") << std::endl;
+            }
             break;
         case SDL_KEYUP:
-            button_down[event.key.keysym.sym] = false;
+            input.handle_event(event);
             break;
         }
 
         if (!running)
             break;
 
+        if (!replay.update(input))
+            break;
+
+        // The new contents show only in what is bound after the fence, so the vertex array and
+        // its buffers are bound here with the state cache made to forget them
+        if (geometry_rebuild && uploads.ready(*geometry_rebuild))
+        {
+            glBindVertexArray(vao);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+            state.invalidate();
+            geometry_rebuild.reset();
+            std::cout << "Geometry rebuilt in " << milliseconds_since(rebuild_start) << " ms" << std::endl;
+        }
+
         auto now = std::chrono::high_resolution_clock::now();
-        float dt = std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count();
+        float dt = replay.frame_time(std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count());
         last_frame_start = now;
 
         if (!paused)
             time += dt;
 
-        if (button_down[SDLK_UP])
+        if (input.down(SDL_SCANCODE_UP))
             camera_distance -= 3.f * dt;
-        if (button_down[SDLK_DOWN])
+        if (input.down(SDL_SCANCODE_DOWN))
             camera_distance += 3.f * dt;
 
-        if (button_down[SDLK_a])
+        if (input.down(SDL_SCANCODE_A))
             camera_rotation -= 2.f * dt;
-        if (button_down[SDLK_d])
+        if (input.down(SDL_SCANCODE_D))
             camera_rotation += 2.f * dt;
 
-        if (button_down[SDLK_w])
+        if (input.down(SDL_SCANCODE_W))
             view_angle -= 2.f * dt;
-        if (button_down[SDLK_s])
+        if (input.down(SDL_SCANCODE_S))
             view_angle += 2.f * dt;
 
+        // The clip a dancer is in, the one it fades into and how far, at its own time
+        struct dance_state
+        {
+            float time;
+            clip_handle from;
+            clip_handle to;
+            float fade;
+        };
+
+        auto dance_at = [&](std::size_t i) -> dance_state
+        {
+            float const dancer_time = time + instance_phases[i];
+            std::size_t const segment = static_cast<std::size_t>(dancer_time / dance_length);
+            float const fade = std::clamp((dancer_time - segment * dance_length - (dance_length - crossfade_length)) / crossfade_length, 0.f, 1.f);
+            return {dancer_time, dance_clips[segment % dance_clips.size()], dance_clips[(segment + 1) % dance_clips.size()], fade};
+        };
+
+        {
+            allocation_scope scope(allocation_tag::animation);
+            if (!baked_animation) for (std::size_t i = 0; i < instances.size(); ++i)
+            {
+                auto const dance = dance_at(i);
+
+                // Rebuilt every frame; the node storage is reused
+                auto & blend = instance_blends[i];
+                blend.nodes.clear();
+                blend.add_clip(clips[dance.from], dance.time);
+                blend.add_clip(clips[dance.to], dance.time);
+                blend.add_crossfade(dance.fade);
+            }
+        }
+
         glClearColor(0.8f, 0.8f, 1.f, 0.f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glEnable(GL_DEPTH_TEST);
+        state.set_enabled(GL_DEPTH_TEST, true);
 
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
         float near = 0.1f;
         float far = 100.f;
 
-        glm::mat4 model = glm::scale(glm::mat4(1.f), glm::vec3(1.f));
-
         glm::mat4 view(1.f);
         view = glm::translate(view, {0.f, 0.f, -camera_distance});
         view = glm::rotate(view, view_angle, {1.f, 0.f, 0.f});
@@ -347,57 +1212,261 @@ int main() try
 
         glm::vec3 camera_position = (glm::inverse(view) * glm::vec4(0.f, 0.f, 0.f, 1.f)).xyz();
 
-        glm::vec3 light_direction = glm::normalize(glm::vec3(1.f, 2.f, 3.f));
+        frustum view_frustum(projection * view);
+        float const tan_half_fov = std::tan(glm::pi<float>() / 4.f);
 
-        glUseProgram(program);
-        glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
-        glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
-        glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
-        glUniform3fv(light_direction_location, 1, reinterpret_cast<float *>(&light_direction));
+        // Only subtrees moved since the last frame are recomputed
+        scene.update();
 
-        auto draw_meshes = [&](bool transparent)
         {
-            for (auto const & mesh : meshes)
+            allocation_scope scope(allocation_tag::culling);
+            visible_instances.clear();
+            for (std::size_t i = 0; i < instances.size(); ++i)
             {
-                if (mesh.material.transparent != transparent)
+                auto const dance = dance_at(i);
+                auto const [min, max] = instance_bounds(i, dance.from, dance.to, dance.time, dance.fade);
+                if (!intersect(view_frustum, aabb(min, max)))
+                {
+                    instance_screen_size[i] = -1.f;
                     continue;
+                }
 
-                if (mesh.material.two_sided)
-                    glDisable(GL_CULL_FACE);
-                else
-                    glEnable(GL_CULL_FACE);
+                float const distance = std::max(near, glm::distance(camera_position, (min + max) / 2.f));
+                instance_screen_size[i] = glm::length(max - min) / 2.f / (distance * tan_half_fov);
+                visible_instances.push_back({distance, i});
+            }
 
-                if (transparent)
-                    glEnable(GL_BLEND);
-                else
-                    glDisable(GL_BLEND);
+            std::sort(visible_instances.begin(), visible_instances.end());
+        }
 
-                if (mesh.material.texture_path)
+        {
+            allocation_scope scope(allocation_tag::animation);
+            visible_palette.clear();
+            visible_clips.clear();
+            visible_models.clear();
+            if (baked_animation)
+            {
+                for (auto const & [distance, i] : visible_instances)
                 {
-                    glBindTexture(GL_TEXTURE_2D, textures[*mesh.material.texture_path]);
-                    glUniform1i(use_texture_location, 1);
+                    auto const dance = dance_at(i);
+                    visible_clips.push_back(glm::vec4(baked_frames.sample(dance.from, dance.time), dance.fade));
+                    visible_clips.push_back(glm::vec4(baked_frames.sample(dance.to, dance.time), 0.f));
+                    visible_models.push_back(glm::mat4x3(scene.world(instance_nodes[i])));
                 }
-                else if (mesh.material.color)
+            }
+            else
+            {
+                lod.update(instances, instance_screen_size, dt, jobs);
+
+                for (auto const & [distance, i] : visible_instances)
                 {
-                    glUniform1i(use_texture_location, 0);
-                    glUniform4fv(color_location, 1, reinterpret_cast<const float *>(&(*mesh.material.color)));
+                    auto palette = lod.palette(i);
+                    visible_palette.insert(visible_palette.end(), palette.begin(), palette.end());
+                    visible_models.push_back(glm::mat4x3(scene.world(instance_nodes[i])));
                 }
-                else
-                    continue;
+            }
+        }
 
-                glBindVertexArray(mesh.vao);
-                glDrawElements(GL_TRIANGLES, mesh.indices.count, mesh.indices.type, reinterpret_cast<void *>(mesh.indices.view.offset));
+        // Orphan the previous frame's storage instead of waiting for draws that still read it
+        if (baked_animation)
+        {
+            glBindBuffer(GL_TEXTURE_BUFFER, instance_clips_buffer);
+            glBufferData(GL_TEXTURE_BUFFER, visible_clips.size() * sizeof(visible_clips[0]), visible_clips.data(), GL_STREAM_DRAW);
+        }
+        else
+        {
+            glBindBuffer(GL_TEXTURE_BUFFER, bone_palette_buffer);
+            glBufferData(GL_TEXTURE_BUFFER, visible_palette.size() * sizeof(visible_palette[0]), visible_palette.data(), GL_STREAM_DRAW);
+        }
+
+        glBindBuffer(GL_TEXTURE_BUFFER, instance_models_buffer);
+        glBufferData(GL_TEXTURE_BUFFER, visible_models.size() * sizeof(visible_models[0]), visible_models.data(), GL_STREAM_DRAW);
+
+        if (skinning && !baked_animation)
+        {
+            visible_morphs.clear();
+            for (std::uint32_t i = 0; i < visible_models.size(); ++i)
+                for (auto morph : instance_morphs)
+                {
+                    morph.instance = i;
+                    visible_morphs.push_back(morph);
+                }
+
+            skinning->update(bone_palette_texture, input_model.bones.size(), visible_models.size(), visible_morphs);
+            // It binds its own program and textures
+            state.invalidate();
+        }
+
+        glm::vec3 light_direction = glm::normalize(glm::vec3(1.f, 2.f, 3.f));
+
+        auto & permutations = baked_animation ? baked_programs : scene_programs;
+        auto use_variant = [&](shader_permutations::features features) -> program_variant &
+        {
+            GLuint const program = permutations.get(features);
+            state.use_program(program);
+
+            auto [found, added] = program_variants.try_emplace(program);
+            auto & variant = found->second;
+            if (added)
+            {
+                variant.uniforms = get_uniforms(program);
+                if (bindless)
+                    glUniformBlockBinding(program, glGetUniformBlockIndex(program, "bindless_materials"), 0);
             }
+
+            if (variant.frame != frame)
+            {
+                auto const & uniforms = variant.uniforms;
+                glUniformMatrix4fv(uniforms.view, 1, GL_FALSE, reinterpret_cast<float *>(&view));
+                glUniformMatrix4fv(uniforms.projection, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
+                glUniform3fv(uniforms.light_direction, 1, reinterpret_cast<float *>(&light_direction));
+                glUniform1i(uniforms.albedo, 0);
+                glUniform1i(uniforms.bone_palette, 1);
+                glUniform1i(uniforms.bone_count, input_model.bones.size());
+                glUniform1i(uniforms.materials, 2);
+                glUniform1i(uniforms.instance_models, 3);
+                glUniform1i(uniforms.instance_count, visible_models.size());
+                glUniform1i(uniforms.animation_frames, 4);
+                glUniform1i(uniforms.instance_clips, 5);
+                if (skinning)
+                    glUniform1i(uniforms.vertex_count, skinning->vertex_count());
+
+                variant.frame = frame;
+                variant.reversed = std::nullopt;
+            }
+            return variant;
         };
 
-        draw_meshes(false);
-        glDepthMask(GL_FALSE);
-        draw_meshes(true);
-        glDepthMask(GL_TRUE);
+        state.bind_texture(1, GL_TEXTURE_BUFFER, bone_palette_texture);
+        state.bind_texture(2, GL_TEXTURE_BUFFER, materials_texture);
+        state.bind_texture(3, GL_TEXTURE_BUFFER, instance_models_texture);
+        if (baked_animation)
+        {
+            state.bind_texture(4, GL_TEXTURE_2D, animation_frames_texture);
+            state.bind_texture(5, GL_TEXTURE_BUFFER, instance_clips_texture);
+        }
+
+        // Only the instance counts change from frame to frame
+        draw_commands.clear();
+        for (auto & group : draw_groups)
+        {
+            group.first_command = draw_commands.size();
+            for (auto command : group.commands)
+            {
+                command.instance_count = visible_models.size();
+                draw_commands.push_back(command);
+            }
+        }
+
+        if (multi_draw_indirect)
+        {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, draw_commands_buffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, draw_commands.size() * sizeof(draw_commands[0]), draw_commands.data(), GL_STREAM_DRAW);
+        }
+
+        state.bind_vertex_array(vao);
+
+        // Opaque groups by state, then by their nearest instance; transparent ones by their farthest
+        float const nearest = visible_instances.empty() ? 0.f : visible_instances.front().first;
+        float const farthest = visible_instances.empty() ? 0.f : visible_instances.back().first;
+
+        queue.clear();
+        for (std::size_t i = 0; i < draw_groups.size(); ++i)
+        {
+            auto const & group = draw_groups[i];
+            queue.push(make_sort_key({
+                group.transparent ? render_pass::transparent : render_pass::opaque,
+                group.transparent,
+                group.two_sided,
+                group.features,
+                group.texture_index,
+                (group.transparent ? farthest : nearest) / far,
+            }), i);
+        }
+        queue.sort();
+
+        auto draw = [&](draw_group const & group, bool accumulating)
+        {
+            auto & variant = use_variant(group.features | (accumulating ? material_feature::weighted_blended : 0));
+
+            state.set_enabled(GL_CULL_FACE, !group.two_sided);
+
+            if (group.texture_array)
+                state.bind_texture(0, GL_TEXTURE_2D_ARRAY, group.texture_array);
+
+            // Back to front for sorted blending, front to back for early depth rejection
+            bool const reverse = group.transparent && !order_independent;
+            if (variant.reversed != reverse)
+            {
+                variant.reversed = reverse;
+                glUniform1i(variant.uniforms.reverse_instances, reverse ? 1 : 0);
+            }
+
+            if (multi_draw_indirect)
+            {
+                glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                    reinterpret_cast<void *>(group.first_command * sizeof(draw_commands[0])), group.commands.size(), 0);
+            }
+            else for (std::size_t i = 0; i < group.commands.size(); ++i)
+            {
+                auto const & command = draw_commands[group.first_command + i];
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+                    reinterpret_cast<void *>(command.first_index * sizeof(std::uint32_t)), command.instance_count, command.base_vertex);
+            }
+        };
+
+        // The transparent pass sorts after every opaque one
+        auto const items = queue.items();
+        bool accumulating = false;
+        for (std::size_t i = 0; i < items.size(); ++i)
+        {
+            auto const & group = draw_groups[items[i].draw];
+
+            if (group.transparent && order_independent && !accumulating)
+            {
+                // The accumulation target's depth has to hold the opaque surfaces too
+                state.set_enabled(GL_BLEND, false);
+                state.depth_mask(true);
+                transparency.begin_depth();
+                for (std::size_t j = 0; j < i; ++j)
+                    draw(draw_groups[items[j].draw], false);
+
+                transparency.begin_accumulation();
+                accumulating = true;
+            }
+
+            state.set_enabled(GL_BLEND, group.transparent);
+            state.depth_mask(!group.transparent);
+            draw(group, accumulating);
+        }
+
+        if (accumulating)
+        {
+            transparency.composite();
+            state.invalidate();
+        }
+
+        // The next frame's clear only touches depth if writes are enabled
+        state.depth_mask(true);
+
+        replay.end_frame();
 
         SDL_GL_SwapWindow(window);
+
+        allocation_tracker::global().end_frame();
+
+        if (first_frame)
+        {
+            std::cout << "First frame after " << milliseconds_since(load_start) << " ms" << std::endl;
+            first_frame = false;
+            allocation_tracker::global().set_fail_on_frame_allocation(fail_on_frame_allocation);
+        }
     }
 
+    allocation_tracker::global().print_summary(std::cout);
+
+    replay.finish();
+
     SDL_GL_DeleteContext(gl_context);
     SDL_DestroyWindow(window);
 }
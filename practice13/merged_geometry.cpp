@@ -0,0 +1,258 @@
+#include "merged_geometry.hpp"
+#include "mesh_normals.hpp"
+
+#include <glm/common.hpp>
+
+#include <stdexcept>
+#include <algorithm>
+#include <span>
+#include <cmath>
+
+namespace
+{
+
+    // Renormalized and rounded to bytes, with the rounding error going to the largest weight so
+    // that the bytes add up to exactly 255 and the bones keep blending to a rigid transform
+    glm::u8vec4 quantize_weights(glm::vec4 const & weights)
+    {
+        glm::vec4 const positive = glm::max(weights, glm::vec4(0.f));
+        float const sum = positive.x + positive.y + positive.z + positive.w;
+        if (sum <= 0.f)
+            return glm::u8vec4(0);
+
+        int quantized[4];
+        int total = 0;
+        int largest = 0;
+        for (int c = 0; c < 4; ++c)
+        {
+            quantized[c] = static_cast<int>(std::round(positive[c] / sum * 255.f));
+            total += quantized[c];
+            if (positive[c] > positive[largest])
+                largest = c;
+        }
+        quantized[largest] += 255 - total;
+
+        return glm::u8vec4(quantized[0], quantized[1], quantized[2], quantized[3]);
+    }
+
+    // For the vertices from range.base_vertex on, which are all the range's; returns the
+    // original vertex of every copy appended to them
+    std::vector<std::uint32_t> generate_range_normals(merged_geometry & geometry, merged_geometry::range const & range)
+    {
+        std::vector<std::array<float, 3>> positions(geometry.vertices.size() - range.base_vertex);
+        for (std::size_t i = 0; i < positions.size(); ++i)
+        {
+            auto const & p = geometry.vertices[range.base_vertex + i].position;
+            positions[i] = {p.x, p.y, p.z};
+        }
+
+        auto const generated = generate_normals(positions, std::span<std::uint32_t>(geometry.indices.data() + range.first_index, range.index_count));
+
+        geometry.vertices.reserve(range.base_vertex + generated.normals.size());
+        for (auto original : generated.copies)
+            geometry.vertices.push_back(geometry.vertices[range.base_vertex + original]);
+        if (!geometry.wide_joints.empty())
+        {
+            geometry.wide_joints.reserve(range.base_vertex + generated.normals.size());
+            for (auto original : generated.copies)
+                geometry.wide_joints.push_back(geometry.wide_joints[range.base_vertex + original]);
+        }
+        for (std::size_t i = 0; i < generated.normals.size(); ++i)
+        {
+            auto const & n = generated.normals[i];
+            geometry.vertices[range.base_vertex + i].normal = glm::vec3(n[0], n[1], n[2]);
+        }
+
+        return generated.copies;
+    }
+
+    // Keeps only the vertices a target moves. Copies made by normal generation move with the
+    // vertex they copy.
+    void merge_morph_targets(gltf_model const & model, gltf_model::primitive const & primitive, std::span<std::uint32_t const> copies,
+        merged_geometry & geometry, merged_geometry::range & range)
+    {
+        std::size_t const vertex_count = primitive.position.count;
+        std::size_t const range_vertex_count = vertex_count + copies.size();
+        auto original = [&](std::size_t i) { return (i < vertex_count) ? i : copies[i - vertex_count]; };
+
+        auto read_delta = [&](std::optional<gltf_model::accessor> const & accessor, std::size_t i)
+        {
+            return accessor ? glm::vec3(read_accessor(model, *accessor, original(i))) : glm::vec3(0.f);
+        };
+
+        std::uint32_t const no_slot = -1;
+        std::vector<std::uint32_t> slots(range_vertex_count, no_slot);
+        for (auto const & target : primitive.targets)
+            for (std::size_t i = 0; i < range_vertex_count; ++i)
+                if (read_delta(target.position, i) != glm::vec3(0.f) || read_delta(target.normal, i) != glm::vec3(0.f))
+                    slots[i] = 0;
+
+        range.first_morph_vertex = geometry.morph_vertices.size();
+        for (std::size_t i = 0; i < range_vertex_count; ++i)
+        {
+            if (slots[i] == no_slot)
+                continue;
+            slots[i] = geometry.morph_vertices.size();
+            geometry.morph_vertices.push_back(range.base_vertex + i);
+        }
+        range.morph_vertex_count = geometry.morph_vertices.size() - range.first_morph_vertex;
+
+        range.first_target = geometry.morph_targets.size();
+        range.target_count = primitive.targets.size();
+        for (auto const & target : primitive.targets)
+        {
+            float max_position = 0.f;
+            float max_normal = 0.f;
+            for (std::size_t i = 0; i < range_vertex_count; ++i)
+            {
+                if (slots[i] == no_slot)
+                    continue;
+                glm::vec3 const position = glm::abs(read_delta(target.position, i));
+                glm::vec3 const normal = glm::abs(read_delta(target.normal, i));
+                max_position = std::max({max_position, position.x, position.y, position.z});
+                max_normal = std::max({max_normal, normal.x, normal.y, normal.z});
+            }
+
+            auto & result = geometry.morph_targets.emplace_back();
+            result.first_delta = geometry.morph_deltas.size();
+            result.position_scale = max_position / 32767.f;
+            result.normal_scale = max_normal / 32767.f;
+
+            auto quantize = [](float value, float scale) -> std::int16_t
+            {
+                return (scale > 0.f) ? static_cast<std::int16_t>(std::round(value / scale)) : 0;
+            };
+
+            for (std::size_t i = 0; i < range_vertex_count; ++i)
+            {
+                if (slots[i] == no_slot)
+                    continue;
+                glm::vec3 const position = read_delta(target.position, i);
+                glm::vec3 const normal = read_delta(target.normal, i);
+                if (position == glm::vec3(0.f) && normal == glm::vec3(0.f))
+                    continue;
+
+                auto & delta = geometry.morph_deltas.emplace_back();
+                delta.slot = slots[i];
+                for (int c = 0; c < 3; ++c)
+                {
+                    delta.position[c] = quantize(position[c], result.position_scale);
+                    delta.normal[c] = quantize(normal[c], result.normal_scale);
+                }
+            }
+            result.delta_count = geometry.morph_deltas.size() - result.first_delta;
+        }
+    }
+
+}
+
+merged_geometry merge_primitives(gltf_model const & model)
+{
+    merged_geometry result;
+
+    // A byte per bone index is enough unless some skin has more bones than that
+    bool wide_joints = false;
+    for (auto const & skin : model.skins)
+        for (unsigned int bone : skin.joints)
+            wide_joints = wide_joints || bone > 255;
+
+    for (std::uint32_t mesh_index = 0; mesh_index < model.meshes.size(); ++mesh_index)
+    {
+        auto const & mesh = model.meshes[mesh_index];
+        for (auto const & primitive : mesh.primitives)
+        {
+            auto & range = result.primitives.emplace_back();
+            range.mesh = mesh_index;
+            range.first_index = result.indices.size();
+            range.base_vertex = result.vertices.size();
+            range.material = primitive.material;
+
+            std::uint32_t const primitive_index = result.primitives.size() - 1;
+            std::size_t const vertex_count = primitive.position.count;
+
+            gltf_model::skin const * skin = nullptr;
+            if (mesh.skin && primitive.joints && primitive.weights)
+                skin = &model.skins.at(*mesh.skin);
+            range.skinned = skin != nullptr;
+
+            for (std::size_t i = 0; i < vertex_count; ++i)
+            {
+                auto & vertex = result.vertices.emplace_back();
+                vertex.position = read_accessor(model, primitive.position, i);
+                if (primitive.normal)
+                    vertex.normal = read_accessor(model, *primitive.normal, i);
+                if (primitive.texcoord)
+                    vertex.texcoord = read_accessor(model, *primitive.texcoord, i);
+                vertex.primitive = primitive_index;
+
+                glm::u16vec4 bones{0};
+                if (skin)
+                {
+                    glm::vec4 const joints = read_accessor(model, *primitive.joints, i);
+                    for (int c = 0; c < 4; ++c)
+                    {
+                        std::size_t const joint = joints[c];
+                        if (joint >= skin->joints.size())
+                            throw std::runtime_error("Joint index is out of the skin bounds");
+                        bones[c] = skin->joints[joint];
+                    }
+                    vertex.weights = quantize_weights(read_accessor(model, *primitive.weights, i));
+                }
+
+                if (wide_joints)
+                    result.wide_joints.push_back(bones);
+                else
+                    vertex.joints = glm::u8vec4(bones);
+            }
+
+            if (primitive.indices)
+            {
+                for (std::size_t i = 0; i < primitive.indices->count; ++i)
+                {
+                    std::uint32_t const index = read_index(model, *primitive.indices, i);
+                    if (index >= vertex_count)
+                        throw std::runtime_error("Vertex index is out of bounds");
+                    result.indices.push_back(index);
+                }
+            }
+            else
+            {
+                for (std::uint32_t i = 0; i < vertex_count; ++i)
+                    result.indices.push_back(i);
+            }
+
+            range.index_count = result.indices.size() - range.first_index;
+
+            // The spec asks for flat normals here; smooth ones with creases look the same on
+            // hard surfaces and far better on scans, which often come without normals
+            std::vector<std::uint32_t> copies;
+            if (!primitive.normal)
+                copies = generate_range_normals(result, range);
+
+            if (!primitive.targets.empty())
+                merge_morph_targets(model, primitive, copies, result, range);
+        }
+    }
+
+    return result;
+}
+
+std::size_t geometry_memory_bytes(merged_geometry const & geometry)
+{
+    return geometry.vertices.capacity() * sizeof(geometry.vertices[0])
+        + geometry.wide_joints.capacity() * sizeof(geometry.wide_joints[0])
+        + geometry.indices.capacity() * sizeof(geometry.indices[0])
+        + geometry.primitives.capacity() * sizeof(geometry.primitives[0])
+        + geometry.morph_vertices.capacity() * sizeof(geometry.morph_vertices[0])
+        + geometry.morph_targets.capacity() * sizeof(geometry.morph_targets[0])
+        + geometry.morph_deltas.capacity() * sizeof(geometry.morph_deltas[0]);
+}
+
+void release_vertex_data(merged_geometry & geometry)
+{
+    geometry.vertices = {};
+    geometry.wide_joints = {};
+    geometry.morph_vertices = {};
+    geometry.morph_deltas = {};
+    geometry.indices = {};
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "gltf_loader.hpp"
+
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+#include <glm/gtc/type_precision.hpp>
+
+#include <vector>
+#include <cstdint>
+
+// Every primitive of a model converted to a single vertex format and appended to shared
+// vertex and index arrays, so that all of them can be drawn from one vertex array with
+// base vertex and first index offsets
+struct merged_geometry
+{
+    struct vertex
+    {
+        glm::vec3 position;
+        glm::vec3 normal{0.f, 1.f, 0.f};
+        glm::vec2 texcoord{0.f};
+        // Bone indices, already mapped through the skin of the primitive's mesh; unused when
+        // the geometry has wide_joints
+        glm::u8vec4 joints{0};
+        // Normalized bytes that add up to exactly 255, all zero for vertices that are not skinned
+        glm::u8vec4 weights{0};
+        // Index into primitives, so that shaders can find per-primitive data without a draw id
+        std::uint32_t primitive = 0;
+    };
+
+    struct range
+    {
+        std::uint32_t first_index;
+        std::uint32_t index_count;
+        // Indices are relative to it
+        std::uint32_t base_vertex;
+        gltf_model::material material;
+        // Whether its vertices have bone weights
+        bool skinned = false;
+
+        // Index of the model mesh it came from, whose weights mix its morph targets
+        std::uint32_t mesh = 0;
+        // Its morph targets in morph_targets, in the order of the mesh weights, and the
+        // vertices any of them moves in morph_vertices
+        std::uint32_t first_target = 0;
+        std::uint32_t target_count = 0;
+        std::uint32_t first_morph_vertex = 0;
+        std::uint32_t morph_vertex_count = 0;
+    };
+
+    // A displacement of one vertex by one target; both halves are quantized per target
+    struct morph_delta
+    {
+        // Index into morph_vertices
+        std::uint32_t slot;
+        std::int16_t position[3];
+        std::int16_t normal[3];
+    };
+
+    // Only the vertices a target moves have deltas; a delta component is its value times
+    // the scale
+    struct morph_target
+    {
+        std::uint32_t first_delta;
+        std::uint32_t delta_count;
+        float position_scale;
+        float normal_scale;
+    };
+
+    std::vector<vertex> vertices;
+    // Bone indices of every vertex in place of their joints, when some skin has bones past
+    // 255; empty otherwise
+    std::vector<glm::u16vec4> wide_joints;
+    std::vector<std::uint32_t> indices;
+    std::vector<range> primitives;
+
+    // Sorted within every range, as indices into vertices
+    std::vector<std::uint32_t> morph_vertices;
+    std::vector<morph_target> morph_targets;
+    std::vector<morph_delta> morph_deltas;
+};
+
+// Non-indexed primitives get sequential indices, and primitives without normals get smooth
+// ones from generate_normals
+merged_geometry merge_primitives(gltf_model const & model);
+
+std::size_t geometry_memory_bytes(merged_geometry const & geometry);
+
+// Frees the vertices, indices and morph deltas once they are uploaded; the primitive ranges
+// and their materials stay, since draw groups are built from them, and so do the morph
+// targets, which are small
+void release_vertex_data(merged_geometry & geometry);
@@ -0,0 +1,493 @@
+#include "meshopt_decoder.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+namespace
+{
+
+    using byte = unsigned char;
+
+    void fail()
+    {
+        throw std::runtime_error("Malformed meshopt compressed buffer view");
+    }
+
+    // Attribute data is split into blocks of up to 256 vertices; within a block every byte
+    // of the vertex is a separate stream of deltas from the previous vertex, zigzag coded
+    // and stored in groups of 16 with 0, 2, 4 or 8 bits per delta
+    constexpr std::size_t byte_group_size = 16;
+    constexpr std::size_t vertex_block_size_bytes = 8192;
+    constexpr std::size_t vertex_block_max_size = 256;
+
+    std::size_t vertex_block_size(std::size_t stride)
+    {
+        std::size_t const result = (vertex_block_size_bytes / stride) & ~(byte_group_size - 1);
+        return std::min(result, vertex_block_max_size);
+    }
+
+    // Values equal to all ones in the packed bits are escapes to a full byte stored after them
+    template <int Bits>
+    byte const * decode_bytes_group(byte const * data, byte const * end, byte * out)
+    {
+        constexpr std::size_t packed_size = byte_group_size * Bits / 8;
+        constexpr unsigned int escape = (1u << Bits) - 1;
+
+        if (std::size_t(end - data) < packed_size)
+            fail();
+
+        byte const * extra = data + packed_size;
+        for (std::size_t i = 0; i < byte_group_size; i += 8 / Bits)
+        {
+            unsigned int packed = *data++;
+            for (int j = 0; j < 8 / Bits; ++j)
+            {
+                unsigned int const value = (packed >> (8 - Bits)) & escape;
+                packed <<= Bits;
+
+                if (value == escape)
+                {
+                    if (extra == end)
+                        fail();
+                    out[i + j] = *extra++;
+                }
+                else
+                    out[i + j] = static_cast<byte>(value);
+            }
+        }
+        return extra;
+    }
+
+    byte const * decode_bytes(byte const * data, byte const * end, byte * out, std::size_t size)
+    {
+        // Two bits per group select its width
+        std::size_t const header_size = (size / byte_group_size + 3) / 4;
+        if (std::size_t(end - data) < header_size)
+            fail();
+
+        byte const * header = data;
+        data += header_size;
+
+        for (std::size_t i = 0; i < size; i += byte_group_size)
+        {
+            std::size_t const group = i / byte_group_size;
+            int const bits_log2 = (header[group / 4] >> ((group % 4) * 2)) & 3;
+
+            switch (bits_log2)
+            {
+            case 0:
+                std::fill(out + i, out + i + byte_group_size, byte(0));
+                break;
+            case 1:
+                data = decode_bytes_group<2>(data, end, out + i);
+                break;
+            case 2:
+                data = decode_bytes_group<4>(data, end, out + i);
+                break;
+            case 3:
+                if (std::size_t(end - data) < byte_group_size)
+                    fail();
+                std::copy(data, data + byte_group_size, out + i);
+                data += byte_group_size;
+                break;
+            }
+        }
+
+        return data;
+    }
+
+    void decode_vertex_buffer(byte * out, std::size_t count, std::size_t stride, byte const * data, std::size_t size)
+    {
+        if (stride == 0 || stride > 256 || stride % 4 != 0)
+            fail();
+
+        std::size_t const tail_size = std::max<std::size_t>(stride, 32);
+        if (size < 1 + tail_size || data[0] != 0xa0)
+            fail();
+
+        byte const * end = data + size;
+        ++data;
+
+        // The tail holds the vertex the first block is delta coded against
+        byte last_vertex[256];
+        std::copy(end - stride, end, last_vertex);
+
+        std::size_t const block_size = vertex_block_size(stride);
+
+        byte deltas[vertex_block_max_size];
+        for (std::size_t offset = 0; offset < count; offset += block_size)
+        {
+            std::size_t const block_count = std::min(block_size, count - offset);
+            std::size_t const aligned_count = (block_count + byte_group_size - 1) & ~(byte_group_size - 1);
+
+            byte * block = out + offset * stride;
+            for (std::size_t k = 0; k < stride; ++k)
+            {
+                data = decode_bytes(data, end - tail_size, deltas, aligned_count);
+
+                byte previous = last_vertex[k];
+                for (std::size_t i = 0; i < block_count; ++i)
+                {
+                    byte const delta = deltas[i];
+                    byte const value = static_cast<byte>(((delta >> 1) ^ -(delta & 1)) + previous);
+                    block[i * stride + k] = value;
+                    previous = value;
+                }
+            }
+
+            std::copy(block + (block_count - 1) * stride, block + block_count * stride, last_vertex);
+        }
+
+        if (data != end - tail_size)
+            fail();
+    }
+
+    std::uint32_t decode_vbyte(byte const * & data, byte const * end)
+    {
+        if (data == end)
+            fail();
+
+        byte const lead = *data++;
+        if (lead < 128)
+            return lead;
+
+        std::uint32_t result = lead & 127;
+        for (unsigned int shift = 7; shift < 35; shift += 7)
+        {
+            if (data == end)
+                fail();
+            byte const group = *data++;
+            result |= std::uint32_t(group & 127) << shift;
+            if (group < 128)
+                break;
+        }
+        return result;
+    }
+
+    // Free indices are zigzag coded deltas from the previous free index
+    std::uint32_t decode_index(byte const * & data, byte const * end, std::uint32_t last)
+    {
+        std::uint32_t const v = decode_vbyte(data, end);
+        return last + ((v >> 1) ^ -(v & 1));
+    }
+
+    void write_index(byte * out, std::size_t index_size, std::size_t i, std::uint32_t value)
+    {
+        if (index_size == 2)
+        {
+            std::uint16_t const v = static_cast<std::uint16_t>(value);
+            std::memcpy(out + i * 2, &v, 2);
+        }
+        else
+            std::memcpy(out + i * 4, &value, 4);
+    }
+
+    struct triangle_fifos
+    {
+        std::uint32_t edges[16][2];
+        std::uint32_t vertices[16];
+        std::size_t edge_offset = 0;
+        std::size_t vertex_offset = 0;
+
+        triangle_fifos()
+        {
+            std::memset(edges, -1, sizeof(edges));
+            std::memset(vertices, -1, sizeof(vertices));
+        }
+
+        void push_edge(std::uint32_t a, std::uint32_t b)
+        {
+            edges[edge_offset][0] = a;
+            edges[edge_offset][1] = b;
+            edge_offset = (edge_offset + 1) & 15;
+        }
+
+        void push_vertex(std::uint32_t v, bool condition = true)
+        {
+            vertices[vertex_offset] = v;
+            vertex_offset = (vertex_offset + (condition ? 1 : 0)) & 15;
+        }
+    };
+
+    // Every triangle is a code byte: either an edge from the edge fifo plus a new, cached or
+    // free third vertex, or a combination of new and cached vertices looked up in a 16 byte
+    // table at the end of the stream
+    void decode_triangles(byte * out, std::size_t count, std::size_t index_size, byte const * data, std::size_t size)
+    {
+        if (count % 3 != 0 || (index_size != 2 && index_size != 4))
+            fail();
+        if (size < 1 + count / 3 + 16 || (data[0] & 0xf0) != 0xe0)
+            fail();
+
+        int const version = data[0] & 0x0f;
+        if (version > 1)
+            fail();
+
+        byte const * code = data + 1;
+        byte const * extra = code + count / 3;
+        byte const * safe_end = data + size - 16;
+        byte const * codeaux_table = safe_end;
+
+        // Version 1 uses codes 13 and 14 for free indices one less or more than the previous one
+        int const fec_max = (version >= 1) ? 13 : 15;
+
+        triangle_fifos fifo;
+        std::uint32_t next = 0;
+        std::uint32_t last = 0;
+
+        for (std::size_t i = 0; i < count; i += 3)
+        {
+            if (extra > safe_end)
+                fail();
+
+            byte const codetri = *code++;
+            std::uint32_t a, b, c;
+
+            if (codetri < 0xf0)
+            {
+                int const fe = codetri >> 4;
+                a = fifo.edges[(fifo.edge_offset - 1 - fe) & 15][0];
+                b = fifo.edges[(fifo.edge_offset - 1 - fe) & 15][1];
+
+                int const fec = codetri & 15;
+                if (fec < fec_max)
+                {
+                    c = (fec == 0) ? next : fifo.vertices[(fifo.vertex_offset - 1 - fec) & 15];
+                    next += (fec == 0);
+                    fifo.push_vertex(c, fec == 0);
+                }
+                else
+                {
+                    c = last = (fec != 15) ? last + (fec - (fec ^ 3)) : decode_index(extra, safe_end, last);
+                    fifo.push_vertex(c);
+                }
+
+                fifo.push_edge(c, b);
+                fifo.push_edge(a, c);
+            }
+            else
+            {
+                int fea, feb, fec;
+                if (codetri < 0xfe)
+                {
+                    byte const codeaux = codeaux_table[codetri & 15];
+                    fea = 0;
+                    feb = codeaux >> 4;
+                    fec = codeaux & 15;
+                }
+                else
+                {
+                    if (extra == safe_end)
+                        fail();
+                    byte const codeaux = *extra++;
+                    fea = (codetri == 0xfe) ? 0 : 15;
+                    feb = codeaux >> 4;
+                    fec = codeaux & 15;
+
+                    // Restarts vertex numbering
+                    if (codeaux == 0)
+                        next = 0;
+                }
+
+                // next advances for all three vertices before any free index is read, like the encoder does
+                a = (fea == 0) ? next++ : 0;
+                b = (feb == 0) ? next++ : fifo.vertices[(fifo.vertex_offset - feb) & 15];
+                c = (fec == 0) ? next++ : fifo.vertices[(fifo.vertex_offset - fec) & 15];
+
+                if (fea == 15)
+                    last = a = decode_index(extra, safe_end, last);
+                if (feb == 15)
+                    last = b = decode_index(extra, safe_end, last);
+                if (fec == 15)
+                    last = c = decode_index(extra, safe_end, last);
+
+                fifo.push_vertex(a);
+                fifo.push_vertex(b, feb == 0 || feb == 15);
+                fifo.push_vertex(c, fec == 0 || fec == 15);
+
+                fifo.push_edge(b, a);
+                fifo.push_edge(c, b);
+                fifo.push_edge(a, c);
+            }
+
+            write_index(out, index_size, i + 0, a);
+            write_index(out, index_size, i + 1, b);
+            write_index(out, index_size, i + 2, c);
+        }
+
+        if (extra != safe_end)
+            fail();
+    }
+
+    // Each index is a delta from one of two running baselines, chosen by its lowest bit
+    void decode_index_sequence(byte * out, std::size_t count, std::size_t index_size, byte const * data, std::size_t size)
+    {
+        if (index_size != 2 && index_size != 4)
+            fail();
+        if (size < 1 + 4 || data[0] != 0xd0)
+            fail();
+
+        byte const * safe_end = data + size - 4;
+        ++data;
+
+        std::uint32_t last[2] = {0, 0};
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            if (data >= safe_end)
+                fail();
+
+            std::uint32_t v = decode_vbyte(data, safe_end);
+            std::uint32_t const baseline = v & 1;
+            v >>= 1;
+
+            std::uint32_t const index = last[baseline] + ((v >> 1) ^ -(v & 1));
+            last[baseline] = index;
+            write_index(out, index_size, i, index);
+        }
+
+        if (data != safe_end)
+            fail();
+    }
+
+    float round_away(float x)
+    {
+        return x + (x >= 0.f ? 0.5f : -0.5f);
+    }
+
+    // Normals and tangents stored as octahedral x, y and a z that encodes one at the same precision
+    template <typename T>
+    void filter_octahedral(T * data, std::size_t count)
+    {
+        float const max = float((1 << (sizeof(T) * 8 - 1)) - 1);
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            float x = float(data[i * 4 + 0]);
+            float y = float(data[i * 4 + 1]);
+            float const z = float(data[i * 4 + 2]) - std::abs(x) - std::abs(y);
+
+            // Unfold the lower hemisphere
+            float const t = std::min(z, 0.f);
+            x += (x >= 0.f) ? t : -t;
+            y += (y >= 0.f) ? t : -t;
+
+            float const s = max / std::sqrt(x * x + y * y + z * z);
+            data[i * 4 + 0] = T(int(round_away(x * s)));
+            data[i * 4 + 1] = T(int(round_away(y * s)));
+            data[i * 4 + 2] = T(int(round_away(z * s)));
+        }
+    }
+
+    // Smallest-three quaternions; the fourth component holds the dropped index and the scale
+    void filter_quaternion(std::int16_t * data, std::size_t count)
+    {
+        float const scale = 1.f / std::sqrt(2.f);
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            int const sf = data[i * 4 + 3] | 3;
+            float const ss = scale / float(sf);
+
+            float const x = float(data[i * 4 + 0]) * ss;
+            float const y = float(data[i * 4 + 1]) * ss;
+            float const z = float(data[i * 4 + 2]) * ss;
+            float const w = std::sqrt(std::max(0.f, 1.f - x * x - y * y - z * z));
+
+            int const qc = data[i * 4 + 3] & 3;
+            data[i * 4 + ((qc + 1) & 3)] = std::int16_t(int(round_away(x * 32767.f)));
+            data[i * 4 + ((qc + 2) & 3)] = std::int16_t(int(round_away(y * 32767.f)));
+            data[i * 4 + ((qc + 3) & 3)] = std::int16_t(int(round_away(z * 32767.f)));
+            data[i * 4 + ((qc + 0) & 3)] = std::int16_t(int(w * 32767.f + 0.5f));
+        }
+    }
+
+    // 24-bit signed mantissa and 8-bit signed exponent per float
+    void filter_exponential(std::uint32_t * data, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            std::int32_t const m = std::int32_t(data[i] << 8) >> 8;
+            std::int32_t const e = std::int32_t(data[i]) >> 24;
+
+            float const value = std::ldexp(float(m), e);
+            std::memcpy(&data[i], &value, sizeof(value));
+        }
+    }
+
+}
+
+void meshopt_decode(std::span<char> destination, std::size_t count, std::size_t stride,
+    meshopt_mode mode, meshopt_filter filter, std::span<char const> source)
+{
+    if (destination.size() != count * stride)
+        throw std::runtime_error("Meshopt destination size mismatch");
+
+    auto out = reinterpret_cast<byte *>(destination.data());
+    auto data = reinterpret_cast<byte const *>(source.data());
+
+    switch (mode)
+    {
+    case meshopt_mode::attributes:
+        decode_vertex_buffer(out, count, stride, data, source.size());
+        break;
+    case meshopt_mode::triangles:
+        decode_triangles(out, count, stride, data, source.size());
+        break;
+    case meshopt_mode::indices:
+        decode_index_sequence(out, count, stride, data, source.size());
+        break;
+    }
+
+    if (filter == meshopt_filter::none)
+        return;
+    if (mode != meshopt_mode::attributes)
+        fail();
+
+    // The filters work in place on properly aligned copies of the elements
+    switch (filter)
+    {
+    case meshopt_filter::octahedral:
+        if (stride == 4)
+            filter_octahedral(reinterpret_cast<std::int8_t *>(out), count);
+        else if (stride == 8)
+        {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                std::int16_t v[4];
+                std::memcpy(v, out + i * 8, 8);
+                filter_octahedral(v, 1);
+                std::memcpy(out + i * 8, v, 8);
+            }
+        }
+        else
+            fail();
+        break;
+    case meshopt_filter::quaternion:
+        if (stride != 8)
+            fail();
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            std::int16_t v[4];
+            std::memcpy(v, out + i * 8, 8);
+            filter_quaternion(v, 1);
+            std::memcpy(out + i * 8, v, 8);
+        }
+        break;
+    case meshopt_filter::exponential:
+        if (stride % 4 != 0)
+            fail();
+        for (std::size_t i = 0; i < count * stride / 4; ++i)
+        {
+            std::uint32_t v;
+            std::memcpy(&v, out + i * 4, 4);
+            filter_exponential(&v, 1);
+            std::memcpy(out + i * 4, &v, 4);
+        }
+        break;
+    default:
+        break;
+    }
+}
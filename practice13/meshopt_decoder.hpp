@@ -0,0 +1,31 @@
+#pragma once
+
+#include <span>
+#include <cstddef>
+
+// Decoders for the buffer view encodings of EXT_meshopt_compression, see
+// https://github.com/KhronosGroup/glTF/tree/main/extensions/2.0/Vendor/EXT_meshopt_compression
+
+enum class meshopt_mode
+{
+    // Byte-wise delta coded vertex attributes
+    attributes,
+    // Triangle lists coded against edge and vertex caches
+    triangles,
+    // Index sequences without triangle structure
+    indices,
+};
+
+// Applied to attribute data after decoding
+enum class meshopt_filter
+{
+    none,
+    octahedral,
+    quaternion,
+    exponential,
+};
+
+// Decodes count elements of stride bytes into destination, which must hold exactly that many;
+// throws std::runtime_error on malformed data
+void meshopt_decode(std::span<char> destination, std::size_t count, std::size_t stride,
+    meshopt_mode mode, meshopt_filter filter, std::span<char const> source);
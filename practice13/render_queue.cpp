@@ -0,0 +1,45 @@
+#include "render_queue.hpp"
+
+#include <algorithm>
+#include <array>
+#include <utility>
+
+std::uint64_t make_sort_key(sort_key_fields const & fields)
+{
+    std::uint64_t const depth = static_cast<std::uint64_t>(std::clamp(fields.depth, 0.f, 1.f) * 0xffffffu);
+    std::uint64_t const state = (std::uint64_t(fields.blend) << 21)
+        | (std::uint64_t(fields.two_sided) << 20)
+        | (std::uint64_t(fields.program & 0xffu) << 12)
+        | std::uint64_t(fields.texture & 0xfffu);
+
+    std::uint64_t key = std::uint64_t(fields.pass) << 62;
+    if (fields.pass == render_pass::transparent)
+        key |= ((0xffffffu - depth) << 22) | state;
+    else
+        key |= (state << 24) | depth;
+    return key;
+}
+
+void render_queue::sort()
+{
+    scratch_.resize(items_.size());
+
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        std::array<std::size_t, 256> offsets{};
+        for (auto const & item : items_)
+            ++offsets[(item.key >> shift) & 0xffu];
+
+        if (std::find(offsets.begin(), offsets.end(), items_.size()) != offsets.end())
+            continue;
+
+        std::size_t total = 0;
+        for (auto & offset : offsets)
+            total += std::exchange(offset, total);
+
+        for (auto const & item : items_)
+            scratch_[offsets[(item.key >> shift) & 0xffu]++] = item;
+
+        items_.swap(scratch_);
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <cstdint>
+
+enum class render_pass : std::uint8_t
+{
+    opaque,
+    transparent,
+};
+
+struct sort_key_fields
+{
+    render_pass pass = render_pass::opaque;
+    bool blend = false;
+    bool two_sided = false;
+    // Small indices chosen by the caller rather than GL names: 8 bits of program, 12 of texture
+    std::uint32_t program = 0;
+    std::uint32_t texture = 0;
+    // Normalized to [0, 1], quantized to 24 bits
+    float depth = 0.f;
+};
+
+// Pass goes first. Opaque items are ordered by state, then front to back; transparent
+// items back to front, with state only breaking ties between equal depths.
+std::uint64_t make_sort_key(sort_key_fields const & fields);
+
+// Draws collected during the frame and ordered by their 64-bit keys
+struct render_queue
+{
+    struct item
+    {
+        std::uint64_t key;
+        // Whatever the caller needs to find the draw again
+        std::uint32_t draw;
+    };
+
+    void clear() { items_.clear(); }
+    void push(std::uint64_t key, std::uint32_t draw) { items_.push_back({key, draw}); }
+
+    // LSD radix sort, 8 bits per pass; passes where all keys share the byte are skipped,
+    // so sparse keys cost only as many passes as they have varying bytes. Stable.
+    void sort();
+
+    std::span<item const> items() const { return items_; }
+
+private:
+    std::vector<item> items_;
+    std::vector<item> scratch_;
+};
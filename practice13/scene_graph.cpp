@@ -0,0 +1,78 @@
+#include "scene_graph.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cassert>
+
+unsigned int scene_graph::add(unsigned int parent, glm::vec3 const & translation, glm::quat const & rotation, glm::vec3 const & scale)
+{
+    assert(parent == no_parent || parent < size());
+
+    unsigned int const node = size();
+    parents_.push_back(parent);
+    translations_.push_back(translation);
+    rotations_.push_back(rotation);
+    scales_.push_back(scale);
+    worlds_.emplace_back(1.f);
+    dirty_.push_back(0);
+    mark_dirty(node);
+    return node;
+}
+
+unsigned int scene_graph::add(gltf_model const & model, unsigned int parent)
+{
+    unsigned int const first = size();
+    for (auto const & node : model.nodes)
+        add(node.parent == -1u ? parent : first + node.parent, node.translation, node.rotation, node.scale);
+    return first;
+}
+
+void scene_graph::set_translation(unsigned int node, glm::vec3 const & translation)
+{
+    translations_[node] = translation;
+    mark_dirty(node);
+}
+
+void scene_graph::set_rotation(unsigned int node, glm::quat const & rotation)
+{
+    rotations_[node] = rotation;
+    mark_dirty(node);
+}
+
+void scene_graph::set_scale(unsigned int node, glm::vec3 const & scale)
+{
+    scales_[node] = scale;
+    mark_dirty(node);
+}
+
+std::size_t scene_graph::update()
+{
+    std::size_t updated = 0;
+
+    // A parent comes before its children, so its flag is final by the time they look at it;
+    // the flags are only cleared once the pass is over
+    for (std::size_t i = first_dirty_; i < size(); ++i)
+    {
+        unsigned int const parent = parents_[i];
+        if (parent != no_parent && dirty_[parent])
+            dirty_[i] = 1;
+        if (!dirty_[i])
+            continue;
+
+        glm::mat4 const local = glm::translate(glm::mat4(1.f), translations_[i]) * glm::toMat4(rotations_[i]) * glm::scale(glm::mat4(1.f), scales_[i]);
+        worlds_[i] = (parent == no_parent) ? local : worlds_[parent] * local;
+        ++updated;
+    }
+
+    std::fill(dirty_.begin() + std::min(first_dirty_, dirty_.size()), dirty_.end(), 0);
+    first_dirty_ = size();
+
+    return updated;
+}
+
+void scene_graph::mark_dirty(unsigned int node)
+{
+    dirty_[node] = 1;
+    first_dirty_ = std::min<std::size_t>(first_dirty_, node);
+}
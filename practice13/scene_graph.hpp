@@ -0,0 +1,56 @@
+#pragma once
+
+#include "gltf_loader.hpp"
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include <vector>
+#include <cstdint>
+
+// Node transforms flattened into arrays in parent-before-child order, so that a single pass
+// front to back updates every world matrix. Setting a local transform marks the node
+// dirty; update() recomputes the dirty nodes and their descendants and leaves the rest.
+struct scene_graph
+{
+    static constexpr unsigned int no_parent = -1;
+
+    // parent must be no_parent or a node added before
+    unsigned int add(unsigned int parent, glm::vec3 const & translation = glm::vec3(0.f),
+        glm::quat const & rotation = glm::quat(1.f, 0.f, 0.f, 0.f), glm::vec3 const & scale = glm::vec3(1.f));
+
+    // Adds all nodes of the model under parent, in the model's order; node i of the model
+    // becomes the returned index plus i
+    unsigned int add(gltf_model const & model, unsigned int parent = no_parent);
+
+    std::size_t size() const { return parents_.size(); }
+
+    unsigned int parent(unsigned int node) const { return parents_[node]; }
+    glm::vec3 const & translation(unsigned int node) const { return translations_[node]; }
+    glm::quat const & rotation(unsigned int node) const { return rotations_[node]; }
+    glm::vec3 const & scale(unsigned int node) const { return scales_[node]; }
+
+    void set_translation(unsigned int node, glm::vec3 const & translation);
+    void set_rotation(unsigned int node, glm::quat const & rotation);
+    void set_scale(unsigned int node, glm::vec3 const & scale);
+
+    // As of the last update()
+    glm::mat4 const & world(unsigned int node) const { return worlds_[node]; }
+
+    // Returns how many world matrices were recomputed
+    std::size_t update();
+
+private:
+    std::vector<unsigned int> parents_;
+    std::vector<glm::vec3> translations_;
+    std::vector<glm::quat> rotations_;
+    std::vector<glm::vec3> scales_;
+    std::vector<glm::mat4> worlds_;
+    std::vector<std::uint8_t> dirty_;
+
+    // Nothing before it is dirty, so update() starts there
+    std::size_t first_dirty_ = 0;
+
+    void mark_dirty(unsigned int node);
+};
@@ -0,0 +1,62 @@
+#include "skinning.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+
+namespace
+{
+
+    // Per-thread scratch memory, reused from frame to frame
+    struct skinning_scratch
+    {
+        baked_pose pose;
+        std::vector<glm::mat4> global_transforms;
+    };
+
+    thread_local skinning_scratch scratch;
+
+}
+
+void skin_instance(std::span<gltf_model::bone const> bones, skinned_instance const & instance, float time_offset,
+    glm::mat4x3 * palette, std::span<std::uint8_t const> collapse)
+{
+    if (instance.blend)
+        evaluate_blend_tree(*instance.blend, time_offset, scratch.pose);
+    else
+        evaluate_pose(*instance.clip, wrap_clip_time(*instance.clip, instance.time + time_offset), scratch.pose);
+
+    auto & global = scratch.global_transforms;
+    global.resize(bones.size());
+
+    // Parents always precede their children, see load_gltf
+    for (std::size_t i = 0; i < bones.size(); ++i)
+    {
+        if (!collapse.empty() && collapse[i] && bones[i].parent != -1u)
+        {
+            global[i] = global[bones[i].parent];
+            palette[i] = palette[bones[i].parent];
+            continue;
+        }
+
+        auto local = scratch.pose.local_transform(i);
+        global[i] = (bones[i].parent == -1u) ? local : global[bones[i].parent] * local;
+        palette[i] = glm::mat4x3(global[i] * bones[i].inverse_bind_matrix);
+    }
+}
+
+void compute_skinning(std::span<gltf_model::bone const> bones, std::span<skinned_instance const> instances,
+    std::span<glm::mat4x3> palette, job_system & jobs, std::size_t batch_size)
+{
+    if (palette.size() < instances.size() * bones.size())
+        throw std::runtime_error("Skinning palette is too small");
+
+    batch_size = std::max<std::size_t>(1, batch_size);
+    std::size_t const batch_count = (instances.size() + batch_size - 1) / batch_size;
+
+    jobs.parallel_for(batch_count, [&](std::size_t batch)
+    {
+        std::size_t const end = std::min(instances.size(), (batch + 1) * batch_size);
+        for (std::size_t i = batch * batch_size; i < end; ++i)
+            skin_instance(bones, instances[i], 0.f, palette.data() + i * bones.size());
+    });
+}
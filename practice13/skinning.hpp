@@ -0,0 +1,29 @@
+#pragma once
+
+#include "gltf_loader.hpp"
+#include "animation_clip.hpp"
+#include "blend_tree.hpp"
+#include "job_system.hpp"
+
+#include <span>
+#include <cstdint>
+
+struct skinned_instance
+{
+    baked_clip const * clip = nullptr;
+    float time = 0.f;
+    // When set, the pose comes from the blend tree and clip and time are ignored
+    blend_tree const * blend = nullptr;
+};
+
+// Computes the palette of a single instance time_offset seconds after its current time,
+// looping its clips. Bones with a nonzero collapse entry reuse their parent's matrix;
+// the mask should also cover their children.
+void skin_instance(std::span<gltf_model::bone const> bones, skinned_instance const & instance, float time_offset,
+    glm::mat4x3 * palette, std::span<std::uint8_t const> collapse = {});
+
+// Computes bone_matrix = global_transform * inverse_bind_matrix for every bone of every
+// instance, writing bones.size() matrices per instance into palette in instance order.
+// Instances are split into batches of batch_size and spread over the job system.
+void compute_skinning(std::span<gltf_model::bone const> bones, std::span<skinned_instance const> instances,
+    std::span<glm::mat4x3> palette, job_system & jobs, std::size_t batch_size = 16);
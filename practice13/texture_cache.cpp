@@ -0,0 +1,205 @@
+#include "texture_cache.hpp"
+#include "stb_image.h"
+#include "job_system.hpp"
+#include "virtual_fs.hpp"
+
+#include <memory>
+#include <span>
+#include <bit>
+#include <stdexcept>
+
+namespace
+{
+
+    // FNV-1a; only has to tell files apart, not resist anyone
+    std::uint64_t content_hash(std::span<char const> data)
+    {
+        std::uint64_t hash = 14695981039346656037ull;
+        for (char c : data)
+        {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    asset_data read_file(std::filesystem::path const & path)
+    {
+        if (!asset_fs().exists(path))
+            throw std::runtime_error("Failed to load texture " + path.string());
+        return asset_fs().read(path);
+    }
+
+}
+
+texture_cache::texture_cache(std::size_t budget)
+    : budget_(budget)
+{}
+
+texture_cache::~texture_cache()
+{
+    for (auto const & [array, entry] : arrays_)
+        glDeleteTextures(1, &array);
+}
+
+std::vector<texture_cache::loaded_image> texture_cache::load(std::vector<std::filesystem::path> const & paths, job_system * jobs)
+{
+    std::vector<loaded_image> result(paths.size());
+
+    // Images that turn out to be resident already are decoded for nothing, but telling them
+    // apart needs the file contents anyway
+    auto load_one = [&](std::size_t i)
+    {
+        auto const file = read_file(paths[i]);
+
+        auto & image = result[i];
+        // Packed files need not exist on disk, so only the part of the path that does is resolved
+        image.canonical_path = std::filesystem::weakly_canonical(paths[i]).string();
+        image.hash = content_hash(file.data);
+
+        int channels;
+        stbi_uc * data = stbi_load_from_memory(reinterpret_cast<stbi_uc const *>(file.data.data()), file.data.size(), &image.width, &image.height, &channels, 4);
+        if (!data)
+            throw std::runtime_error("Failed to load texture " + paths[i].string() + ": " + stbi_failure_reason());
+        image.data = {data, stbi_image_free};
+    };
+
+    if (jobs)
+        jobs->parallel_for(paths.size(), load_one);
+    else
+        for (std::size_t i = 0; i < paths.size(); ++i)
+            load_one(i);
+
+    return result;
+}
+
+std::vector<texture_cache::handle> texture_cache::acquire(std::vector<loaded_image> images)
+{
+    std::vector<handle> result(images.size());
+    std::map<std::pair<int, int>, std::vector<pending_image>> images_by_size;
+    std::map<key, std::pair<int, int>> pending;
+
+    for (std::size_t i = 0; i < images.size(); ++i)
+    {
+        key k{std::move(images[i].canonical_path), images[i].hash};
+
+        if (auto it = layers_.find(k); it != layers_.end())
+        {
+            auto & entry = arrays_.at(it->second.array);
+            if (entry.references++ == 0)
+                unused_.erase(entry.unused);
+            result[i] = it->second;
+            ++hits_;
+            continue;
+        }
+
+        if (auto it = pending.find(k); it != pending.end())
+        {
+            for (auto & image : images_by_size[it->second])
+                if (image.k == k)
+                    image.users.push_back(i);
+            ++hits_;
+            continue;
+        }
+
+        int const width = images[i].width;
+        int const height = images[i].height;
+
+        pending[k] = {width, height};
+        auto & image = images_by_size[{width, height}].emplace_back();
+        image.k = std::move(k);
+        image.data = std::move(images[i].data);
+        image.users.push_back(i);
+        ++misses_;
+    }
+
+    for (auto const & [size, images] : images_by_size)
+    {
+        std::size_t next_image = 0;
+
+        // Spare layers of arrays of the same size come first, so that textures of models
+        // loaded at different times still end up in one array and one draw group
+        for (auto & [texture, entry] : arrays_)
+        {
+            if (next_image == images.size())
+                break;
+            if (entry.width != size.first || entry.height != size.second || entry.layers.size() == entry.capacity)
+                continue;
+
+            glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+            if (entry.references == 0)
+                unused_.erase(entry.unused);
+            while (next_image < images.size() && entry.layers.size() < entry.capacity)
+                add_layer(texture, entry, images[next_image++], result);
+            glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        }
+
+        if (next_image == images.size())
+            continue;
+
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+        // Rounded up to a power of two, which at most doubles the array and leaves room
+        // for the textures of the next models
+        auto & entry = arrays_[texture];
+        entry.width = size.first;
+        entry.height = size.second;
+        entry.capacity = std::bit_ceil(images.size() - next_image);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, size.first, size.second, entry.capacity, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+        // The mip chain adds a third
+        entry.bytes = std::size_t(size.first) * size.second * 4 * entry.capacity * 4 / 3;
+        resident_bytes_ += entry.bytes;
+
+        while (next_image < images.size())
+            add_layer(texture, entry, images[next_image++], result);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    }
+
+    evict();
+    return result;
+}
+
+void texture_cache::add_layer(GLuint texture, array_entry & entry, pending_image const & image, std::vector<handle> & result)
+{
+    int const layer = entry.layers.size();
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, entry.width, entry.height, 1, GL_RGBA, GL_UNSIGNED_BYTE, image.data.get());
+
+    layers_[image.k] = {texture, layer};
+    entry.layers.push_back(image.k);
+    entry.references += image.users.size();
+    for (auto i : image.users)
+        result[i] = {texture, layer};
+}
+
+void texture_cache::release(handle const & h)
+{
+    auto & entry = arrays_.at(h.array);
+    if (--entry.references == 0)
+    {
+        entry.unused = unused_.insert(unused_.end(), h.array);
+        evict();
+    }
+}
+
+void texture_cache::evict()
+{
+    // Referenced arrays stay even over the budget, there is nothing else to draw with
+    while (resident_bytes_ > budget_ && !unused_.empty())
+    {
+        GLuint array = unused_.front();
+        unused_.pop_front();
+
+        auto const & entry = arrays_.at(array);
+        for (auto const & k : entry.layers)
+            layers_.erase(k);
+        resident_bytes_ -= entry.bytes;
+        arrays_.erase(array);
+
+        glDeleteTextures(1, &array);
+    }
+}
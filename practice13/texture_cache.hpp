@@ -0,0 +1,103 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <map>
+#include <list>
+#include <memory>
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <cstdint>
+#include <cstddef>
+
+struct job_system;
+
+// Albedo textures shared by every model in the scene. Images are keyed by canonical path
+// and content hash, so two models referring to the same file (or a file reached through
+// different relative paths) get the same layer; a changed file gets a new one.
+// Images of the same size go into one texture array, filling the spare layers of an
+// existing one before a new one is made, and the array is the unit of residency: it is freed
+// only once none of its layers is referenced, least recently released first, when the
+// resident size exceeds the budget.
+struct texture_cache
+{
+    struct handle
+    {
+        GLuint array;
+        int layer;
+    };
+
+    explicit texture_cache(std::size_t budget = std::size_t(256) << 20);
+    ~texture_cache();
+
+    texture_cache(texture_cache const &) = delete;
+    texture_cache & operator = (texture_cache const &) = delete;
+
+    // An image file read, hashed and decoded to RGBA8
+    struct loaded_image
+    {
+        std::string canonical_path;
+        std::uint64_t hash;
+        int width;
+        int height;
+        std::unique_ptr<std::uint8_t, void (*)(void *)> data{nullptr, nullptr};
+    };
+
+    // Touches neither GL nor the cache, so it can run on any thread, decoding the files in
+    // parallel when jobs is set; throws if an image cannot be loaded
+    static std::vector<loaded_image> load(std::vector<std::filesystem::path> const & paths, job_system * jobs = nullptr);
+
+    // One handle per image, each holding a reference until release()
+    std::vector<handle> acquire(std::vector<loaded_image> images);
+
+    std::vector<handle> acquire(std::vector<std::filesystem::path> const & paths) { return acquire(load(paths)); }
+    void release(handle const & h);
+
+    // Bytes of all resident arrays, mipmaps included
+    std::size_t resident_bytes() const { return resident_bytes_; }
+    std::size_t hits() const { return hits_; }
+    std::size_t misses() const { return misses_; }
+
+private:
+    struct key
+    {
+        std::string path;
+        std::uint64_t hash;
+
+        auto operator <=> (key const &) const = default;
+    };
+
+    struct array_entry
+    {
+        int width;
+        int height;
+        std::size_t capacity;
+        std::size_t bytes;
+        std::vector<key> layers;
+        std::size_t references = 0;
+        // In unused_ while references is zero
+        std::list<GLuint>::iterator unused;
+    };
+
+    struct pending_image
+    {
+        key k;
+        std::unique_ptr<std::uint8_t, void (*)(void *)> data{nullptr, nullptr};
+        // Positions in the result waiting for this image
+        std::vector<std::size_t> users;
+    };
+
+    void add_layer(GLuint texture, array_entry & entry, pending_image const & image, std::vector<handle> & result);
+    void evict();
+
+    std::size_t budget_;
+    std::size_t resident_bytes_ = 0;
+    std::size_t hits_ = 0;
+    std::size_t misses_ = 0;
+
+    std::map<key, handle> layers_;
+    std::map<GLuint, array_entry> arrays_;
+    // Unreferenced arrays, least recently released first
+    std::list<GLuint> unused_;
+};
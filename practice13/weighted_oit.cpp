@@ -0,0 +1,142 @@
+#include "weighted_oit.hpp"
+
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+
+    const char fullscreen_vertex_shader_source[] =
+R"(#version 330 core
+
+void main()
+{
+    vec2 position = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 4.0 - 1.0;
+    gl_Position = vec4(position, 0.0, 1.0);
+}
+)";
+
+    const char composite_fragment_shader_source[] =
+R"(#version 330 core
+
+uniform sampler2D accumulation;
+uniform sampler2D weights;
+
+layout (location = 0) out vec4 out_color;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec4 sum = texelFetch(accumulation, pixel, 0);
+
+    float revealage = sum.a;
+    if (revealage >= 1.0)
+        discard;
+
+    // Clamped, since enough weighted layers can overflow half floats
+    vec3 color = min(sum.rgb, vec3(65000.0)) / max(texelFetch(weights, pixel, 0).r, 1e-5);
+    out_color = vec4(color, revealage);
+}
+)";
+
+    void set_nearest_clamped(GLuint texture)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+}
+
+weighted_oit::weighted_oit(program_cache & programs, int width, int height)
+{
+    composite_program_ = programs.get({{GL_VERTEX_SHADER, fullscreen_vertex_shader_source}, {GL_FRAGMENT_SHADER, composite_fragment_shader_source}});
+
+    glGenVertexArrays(1, &fullscreen_vao_);
+
+    glGenTextures(1, &accumulation_texture_);
+    set_nearest_clamped(accumulation_texture_);
+    glGenTextures(1, &weight_texture_);
+    set_nearest_clamped(weight_texture_);
+    glGenRenderbuffers(1, &depth_renderbuffer_);
+    glGenFramebuffers(1, &framebuffer_);
+
+    resize(width, height);
+}
+
+weighted_oit::~weighted_oit()
+{
+    glDeleteFramebuffers(1, &framebuffer_);
+    glDeleteRenderbuffers(1, &depth_renderbuffer_);
+    glDeleteTextures(1, &weight_texture_);
+    glDeleteTextures(1, &accumulation_texture_);
+    glDeleteVertexArrays(1, &fullscreen_vao_);
+}
+
+void weighted_oit::resize(int width, int height)
+{
+    width_ = width;
+    height_ = height;
+
+    glBindTexture(GL_TEXTURE_2D, accumulation_texture_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width_, height_, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, weight_texture_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, width_, height_, 0, GL_RED, GL_FLOAT, nullptr);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_renderbuffer_);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width_, height_);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer_);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, accumulation_texture_, 0);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, weight_texture_, 0);
+    glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_renderbuffer_);
+    GLenum const draw_buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, draw_buffers);
+    if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        throw std::runtime_error("Transparency accumulation framebuffer is incomplete");
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+void weighted_oit::begin_depth()
+{
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer_);
+    glViewport(0, 0, width_, height_);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void weighted_oit::begin_accumulation()
+{
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    float const no_sum[4] = {0.f, 0.f, 0.f, 1.f};
+    float const no_weight[4] = {0.f, 0.f, 0.f, 0.f};
+    glClearBufferfv(GL_COLOR, 0, no_sum);
+    glClearBufferfv(GL_COLOR, 1, no_weight);
+
+    // Color and weights add up, revealage in the first alpha multiplies by (1 - alpha)
+    glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+void weighted_oit::composite()
+{
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glViewport(0, 0, width_, height_);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+
+    glUseProgram(composite_program_);
+    glUniform1i(glGetUniformLocation(composite_program_, "accumulation"), 0);
+    glUniform1i(glGetUniformLocation(composite_program_, "weights"), 1);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, accumulation_texture_);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, weight_texture_);
+
+    glBindVertexArray(fullscreen_vao_);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
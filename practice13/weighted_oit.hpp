@@ -0,0 +1,53 @@
+#pragma once
+
+#include "program_cache.hpp"
+
+#include <GL/glew.h>
+
+// Weighted blended order-independent transparency (McGuire and Bavoil): transparent
+// fragments are summed into an accumulation target instead of being blended over each
+// other, each weighted by its coverage and a falloff with depth, so that they can be drawn
+// in any order. Attachment 0 sums premultiplied color times weight in rgb, and in alpha the
+// product of (1 - alpha), the revealage of what is behind; attachment 1 sums alpha times
+// weight. Both take the same blend function, so this works on GL 3.3 without per-buffer
+// blending. The composite divides the sums and blends the average over the bound
+// framebuffer by the revealage.
+//
+// The accumulation depth is its own single-sampled buffer that the opaque draws are
+// repeated into, so that the multisampled window keeps its own; transparent edges are
+// therefore not antialiased.
+struct weighted_oit
+{
+    // The composite program is owned by the cache
+    weighted_oit(program_cache & programs, int width, int height);
+    ~weighted_oit();
+
+    weighted_oit(weighted_oit const &) = delete;
+    weighted_oit & operator = (weighted_oit const &) = delete;
+
+    void resize(int width, int height);
+
+    // Binds the accumulation target with color writes off and clears its depth, for the
+    // opaque draws to fill in; depth writes have to be on already
+    void begin_depth();
+
+    // Turns color writes back on, clears the sums and sets the blend function; the caller
+    // keeps blending enabled and depth writes off for the transparent draws
+    void begin_accumulation();
+
+    // Into the default framebuffer, changing the program, vertex array, texture units 0 and
+    // 1, and the blend and depth state
+    void composite();
+
+private:
+    int width_ = 0;
+    int height_ = 0;
+
+    GLuint framebuffer_ = 0;
+    GLuint accumulation_texture_ = 0;
+    GLuint weight_texture_ = 0;
+    GLuint depth_renderbuffer_ = 0;
+
+    GLuint composite_program_ = 0;
+    GLuint fullscreen_vao_ = 0;
+};
@@ -0,0 +1,394 @@
+#include "antialiasing.hpp"
+
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+
+namespace
+{
+
+	const char fullscreen_vertex_shader_source[] =
+R"(#version 330 core
+
+void main()
+{
+	vec2 position = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 4.0 - 1.0;
+	gl_Position = vec4(position, 0.0, 1.0);
+}
+)";
+
+	const char copy_fragment_shader_source[] =
+R"(#version 330 core
+
+uniform sampler2D source;
+
+layout (location = 0) out vec4 out_color;
+
+void main()
+{
+	out_color = vec4(texelFetch(source, ivec2(gl_FragCoord.xy), 0).rgb, 1.0);
+}
+)";
+
+	// The classic FXAA: blends along the edge direction found from the luma gradient of the
+	// four diagonal neighbours, and falls back to the narrower blend when the wider one
+	// brings in a luma from outside the neighbourhood
+	const char fxaa_fragment_shader_source[] =
+R"(#version 330 core
+
+uniform sampler2D color;
+
+layout (location = 0) out vec4 out_color;
+
+const float SPAN_MAX = 8.0;
+const float REDUCE_MUL = 1.0 / 8.0;
+const float REDUCE_MIN = 1.0 / 128.0;
+
+float luma(vec3 c)
+{
+	return dot(c, vec3(0.299, 0.587, 0.114));
+}
+
+void main()
+{
+	vec2 texel_size = 1.0 / vec2(textureSize(color, 0));
+	vec2 uv = gl_FragCoord.xy * texel_size;
+
+	float luma_nw = luma(texture(color, uv + vec2(-1.0, -1.0) * texel_size).rgb);
+	float luma_ne = luma(texture(color, uv + vec2( 1.0, -1.0) * texel_size).rgb);
+	float luma_sw = luma(texture(color, uv + vec2(-1.0,  1.0) * texel_size).rgb);
+	float luma_se = luma(texture(color, uv + vec2( 1.0,  1.0) * texel_size).rgb);
+	float luma_m = luma(texelFetch(color, ivec2(gl_FragCoord.xy), 0).rgb);
+
+	float luma_min = min(luma_m, min(min(luma_nw, luma_ne), min(luma_sw, luma_se)));
+	float luma_max = max(luma_m, max(max(luma_nw, luma_ne), max(luma_sw, luma_se)));
+
+	vec2 direction = vec2(-((luma_nw + luma_ne) - (luma_sw + luma_se)), (luma_nw + luma_sw) - (luma_ne + luma_se));
+	float reduce = max((luma_nw + luma_ne + luma_sw + luma_se) * 0.25 * REDUCE_MUL, REDUCE_MIN);
+	float scale = 1.0 / (min(abs(direction.x), abs(direction.y)) + reduce);
+	direction = clamp(direction * scale, vec2(-SPAN_MAX), vec2(SPAN_MAX)) * texel_size;
+
+	vec3 narrow = 0.5 * (texture(color, uv + direction * (1.0 / 3.0 - 0.5)).rgb + texture(color, uv + direction * (2.0 / 3.0 - 0.5)).rgb);
+	vec3 wide = 0.5 * narrow + 0.25 * (texture(color, uv - direction * 0.5).rgb + texture(color, uv + direction * 0.5).rgb);
+
+	float luma_wide = luma(wide);
+	out_color = vec4((luma_wide < luma_min || luma_wide > luma_max) ? narrow : wide, 1.0);
+}
+)";
+
+	const char taa_fragment_shader_source[] =
+R"(#version 330 core
+
+uniform sampler2D color;
+uniform sampler2D depth;
+uniform sampler2D motion;
+uniform sampler2D history;
+
+// From this frame's NDC to last frame's clip space, both without jitter
+uniform mat4 reprojection;
+uniform vec2 jitter;
+uniform bool history_valid;
+
+layout (location = 0) out vec4 out_color;
+
+const float HISTORY_WEIGHT = 0.9;
+
+vec3 to_ycocg(vec3 c)
+{
+	return vec3(dot(c, vec3(0.25, 0.5, 0.25)), dot(c, vec3(0.5, 0.0, -0.5)), dot(c, vec3(-0.25, 0.5, -0.25)));
+}
+
+vec3 from_ycocg(vec3 c)
+{
+	return vec3(c.x + c.y - c.z, c.x + c.z, c.x - c.y - c.z);
+}
+
+// Catmull-Rom filtering of the history in five bilinear taps, which keeps it from blurring
+// a little more with every frame the way bilinear filtering alone would
+vec3 sample_history(vec2 uv)
+{
+	vec2 size = vec2(textureSize(history, 0));
+	vec2 position = uv * size;
+	vec2 center = floor(position - 0.5) + 0.5;
+	vec2 f = position - center;
+
+	vec2 w0 = f * (-0.5 + f * (1.0 - 0.5 * f));
+	vec2 w1 = 1.0 + f * f * (-2.5 + 1.5 * f);
+	vec2 w2 = f * (0.5 + f * (2.0 - 1.5 * f));
+	vec2 w3 = f * f * (-0.5 + 0.5 * f);
+
+	vec2 w12 = w1 + w2;
+	vec2 t0 = (center - 1.0) / size;
+	vec2 t3 = (center + 2.0) / size;
+	vec2 t12 = (center + w2 / w12) / size;
+
+	vec3 result = texture(history, vec2(t12.x, t0.y)).rgb * w12.x * w0.y
+		+ texture(history, vec2(t0.x, t12.y)).rgb * w0.x * w12.y
+		+ texture(history, t12).rgb * w12.x * w12.y
+		+ texture(history, vec2(t3.x, t12.y)).rgb * w3.x * w12.y
+		+ texture(history, vec2(t12.x, t3.y)).rgb * w12.x * w3.y;
+	float weight = w12.x * w0.y + w0.x * w12.y + w12.x * w12.y + w3.x * w12.y + w12.x * w3.y;
+	return max(result / weight, vec3(0.0));
+}
+
+void main()
+{
+	ivec2 size = textureSize(color, 0);
+	ivec2 p = ivec2(gl_FragCoord.xy);
+	vec2 uv = gl_FragCoord.xy / vec2(size);
+
+	// Neighbourhood bounds, and the nearest pixel of the 3x3, whose motion is taken so that
+	// edges move with the object in front rather than with what is behind
+	vec3 current = to_ycocg(texelFetch(color, p, 0).rgb);
+	vec3 neighbourhood_min = current;
+	vec3 neighbourhood_max = current;
+	ivec2 nearest = p;
+	float nearest_depth = texelFetch(depth, p, 0).r;
+	for (int i = 0; i < 9; ++i)
+	{
+		ivec2 q = clamp(p + ivec2(i % 3 - 1, i / 3 - 1), ivec2(0), size - 1);
+		vec3 c = to_ycocg(texelFetch(color, q, 0).rgb);
+		neighbourhood_min = min(neighbourhood_min, c);
+		neighbourhood_max = max(neighbourhood_max, c);
+
+		float d = texelFetch(depth, q, 0).r;
+		if (d < nearest_depth)
+		{
+			nearest_depth = d;
+			nearest = q;
+		}
+	}
+
+	vec2 ndc = (vec2(nearest) + 0.5) / vec2(size) * 2.0 - 1.0 - jitter;
+	vec4 previous = reprojection * vec4(ndc, nearest_depth * 2.0 - 1.0, 1.0);
+	vec2 velocity = (previous.xy / previous.w - ndc) * 0.5 + texelFetch(motion, nearest, 0).xy;
+	vec2 history_uv = uv + velocity;
+
+	vec3 result = current;
+	if (history_valid && all(greaterThanEqual(history_uv, vec2(0.0))) && all(lessThanEqual(history_uv, vec2(1.0))))
+	{
+		vec3 previous_color = clamp(to_ycocg(sample_history(history_uv)), neighbourhood_min, neighbourhood_max);
+		result = mix(current, previous_color, HISTORY_WEIGHT);
+	}
+
+	out_color = vec4(from_ycocg(result), 1.0);
+}
+)";
+
+	float halton(int index, int base)
+	{
+		float result = 0.f;
+		float f = 1.f;
+		for (; index > 0; index /= base)
+		{
+			f /= base;
+			result += f * (index % base);
+		}
+		return result;
+	}
+
+	void set_filtering(GLuint texture, GLenum filter)
+	{
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+
+	// Jitter offsets repeat after this many frames
+	constexpr int jitter_frames = 8;
+
+}
+
+std::optional<antialiasing_mode> parse_antialiasing_mode(std::string_view name)
+{
+	for (auto mode : {antialiasing_mode::none, antialiasing_mode::msaa, antialiasing_mode::fxaa, antialiasing_mode::taa})
+		if (name == to_string(mode))
+			return mode;
+	return std::nullopt;
+}
+
+char const * to_string(antialiasing_mode mode)
+{
+	switch (mode)
+	{
+	case antialiasing_mode::none: return "none";
+	case antialiasing_mode::msaa: return "msaa";
+	case antialiasing_mode::fxaa: return "fxaa";
+	case antialiasing_mode::taa: return "taa";
+	}
+	return "";
+}
+
+antialiasing_pass::antialiasing_pass(program_cache & programs, int width, int height)
+{
+	copy_program_ = programs.get({{GL_VERTEX_SHADER, fullscreen_vertex_shader_source}, {GL_FRAGMENT_SHADER, copy_fragment_shader_source}});
+	fxaa_program_ = programs.get({{GL_VERTEX_SHADER, fullscreen_vertex_shader_source}, {GL_FRAGMENT_SHADER, fxaa_fragment_shader_source}});
+	taa_program_ = programs.get({{GL_VERTEX_SHADER, fullscreen_vertex_shader_source}, {GL_FRAGMENT_SHADER, taa_fragment_shader_source}});
+
+	glGenVertexArrays(1, &fullscreen_vao_);
+
+	glGenTextures(1, &color_texture_);
+	glGenTextures(1, &motion_texture_);
+	glGenTextures(1, &depth_texture_);
+	glGenTextures(history_textures_.size(), history_textures_.data());
+	glGenFramebuffers(1, &scene_fbo_);
+	glGenFramebuffers(history_fbos_.size(), history_fbos_.data());
+
+	// FXAA and the history taps filter linearly between texels, everything else is fetched
+	set_filtering(color_texture_, GL_LINEAR);
+	set_filtering(motion_texture_, GL_NEAREST);
+	set_filtering(depth_texture_, GL_NEAREST);
+	for (GLuint texture : history_textures_)
+		set_filtering(texture, GL_LINEAR);
+
+	resize(width, height);
+}
+
+antialiasing_pass::~antialiasing_pass()
+{
+	glDeleteFramebuffers(history_fbos_.size(), history_fbos_.data());
+	glDeleteFramebuffers(1, &scene_fbo_);
+	glDeleteTextures(history_textures_.size(), history_textures_.data());
+	glDeleteTextures(1, &depth_texture_);
+	glDeleteTextures(1, &motion_texture_);
+	glDeleteTextures(1, &color_texture_);
+	glDeleteVertexArrays(1, &fullscreen_vao_);
+}
+
+void antialiasing_pass::resize(int width, int height)
+{
+	width_ = std::max(1, width);
+	height_ = std::max(1, height);
+
+	glBindTexture(GL_TEXTURE_2D, color_texture_);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width_, height_, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glBindTexture(GL_TEXTURE_2D, motion_texture_);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, width_, height_, 0, GL_RG, GL_FLOAT, nullptr);
+	glBindTexture(GL_TEXTURE_2D, depth_texture_);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width_, height_, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, scene_fbo_);
+	glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color_texture_, 0);
+	glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, motion_texture_, 0);
+	glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_texture_, 0);
+	if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		throw std::runtime_error("Incomplete antialiasing scene framebuffer");
+
+	// Half floats, so that blending in a little of every frame does not band
+	for (std::size_t i = 0; i < history_textures_.size(); ++i)
+	{
+		glBindTexture(GL_TEXTURE_2D, history_textures_[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width_, height_, 0, GL_RGBA, GL_FLOAT, nullptr);
+
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, history_fbos_[i]);
+		glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, history_textures_[i], 0);
+		if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			throw std::runtime_error("Incomplete TAA history framebuffer");
+	}
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	history_valid_ = false;
+}
+
+glm::vec2 antialiasing_pass::next_jitter()
+{
+	// Halton (2, 3) points are spread evenly over the pixel however many frames in a row are taken
+	frame_ = (frame_ + 1) % jitter_frames;
+	glm::vec2 const offset{halton(frame_ + 1, 2) - 0.5f, halton(frame_ + 1, 3) - 0.5f};
+	return offset * 2.f / glm::vec2(width_, height_);
+}
+
+glm::mat4 antialiasing_pass::jittered(glm::mat4 const & projection, glm::vec2 jitter)
+{
+	// The third column is multiplied by view z, which is -w for a perspective projection
+	glm::mat4 result = projection;
+	result[2][0] -= jitter.x;
+	result[2][1] -= jitter.y;
+	return result;
+}
+
+void antialiasing_pass::begin_scene()
+{
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, scene_fbo_);
+	glViewport(0, 0, width_, height_);
+
+	float const no_motion[4] = {0.f, 0.f, 0.f, 0.f};
+	write_motion(true);
+	glClearBufferfv(GL_COLOR, 1, no_motion);
+	write_motion(false);
+}
+
+void antialiasing_pass::write_motion(bool enabled)
+{
+	GLenum const buffers[] = {GL_COLOR_ATTACHMENT0, GLenum(enabled ? GL_COLOR_ATTACHMENT1 : GL_NONE)};
+	glDrawBuffers(2, buffers);
+}
+
+void antialiasing_pass::resolve_fxaa()
+{
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glViewport(0, 0, width_, height_);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+
+	glUseProgram(fxaa_program_);
+	glUniform1i(glGetUniformLocation(fxaa_program_, "color"), 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, color_texture_);
+
+	glBindVertexArray(fullscreen_vao_);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	// The TAA history goes stale while it is not being resolved
+	history_valid_ = false;
+}
+
+void antialiasing_pass::resolve_taa(glm::mat4 const & view_projection, glm::mat4 const & previous_view_projection, glm::vec2 jitter)
+{
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	glBindVertexArray(fullscreen_vao_);
+
+	int const next = 1 - history_index_;
+	glm::mat4 const reprojection = previous_view_projection * glm::inverse(view_projection);
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, history_fbos_[next]);
+	glViewport(0, 0, width_, height_);
+
+	glUseProgram(taa_program_);
+	glUniform1i(glGetUniformLocation(taa_program_, "color"), 0);
+	glUniform1i(glGetUniformLocation(taa_program_, "depth"), 1);
+	glUniform1i(glGetUniformLocation(taa_program_, "motion"), 2);
+	glUniform1i(glGetUniformLocation(taa_program_, "history"), 3);
+	glUniformMatrix4fv(glGetUniformLocation(taa_program_, "reprojection"), 1, GL_FALSE, reinterpret_cast<float const *>(&reprojection));
+	glUniform2f(glGetUniformLocation(taa_program_, "jitter"), jitter.x, jitter.y);
+	glUniform1i(glGetUniformLocation(taa_program_, "history_valid"), history_valid_);
+
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, history_textures_[history_index_]);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, motion_texture_);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, depth_texture_);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, color_texture_);
+
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	// The resolve is the next frame's history, so it is drawn into that and copied out
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glUseProgram(copy_program_);
+	glUniform1i(glGetUniformLocation(copy_program_, "source"), 0);
+	glBindTexture(GL_TEXTURE_2D, history_textures_[next]);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	history_index_ = next;
+	history_valid_ = true;
+}
+
+void antialiasing_pass::reset_history()
+{
+	history_valid_ = false;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "program_cache.hpp"
+
+#include <GL/glew.h>
+
+#include <glm/vec2.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <array>
+#include <optional>
+#include <string_view>
+
+// MSAA is decided when the window is created, since it is the default framebuffer that is
+// multisampled; the other modes render the scene into a target of their own and resolve it.
+enum class antialiasing_mode
+{
+	none,
+	msaa,
+	fxaa,
+	taa,
+};
+
+std::optional<antialiasing_mode> parse_antialiasing_mode(std::string_view name);
+char const * to_string(antialiasing_mode mode);
+
+// The scene target of the post-process modes and their resolves into the default framebuffer.
+//
+// FXAA blends across the edges it finds in the luma of the frame. TAA spreads the samples of
+// many frames over each pixel: the projection is offset by a different sub-pixel jitter every
+// frame, and the frame is blended into a history reprojected from the last one, clamped to the
+// colors around the pixel so that what the history saw behind a moving edge does not ghost.
+// Reprojection follows the camera through the depth buffer; objects that move on their own
+// also write, into the motion target, the screen-space offset of where they were last frame
+// compared to where the last camera would have seen them now.
+struct antialiasing_pass
+{
+	// The programs are owned by the cache
+	antialiasing_pass(program_cache & programs, int width, int height);
+	~antialiasing_pass();
+
+	antialiasing_pass(antialiasing_pass const &) = delete;
+	antialiasing_pass & operator = (antialiasing_pass const &) = delete;
+
+	void resize(int width, int height);
+
+	// Steps through the jitter sequence; the offset of this frame's projection, in NDC
+	glm::vec2 next_jitter();
+
+	// Shifts a projection by a jitter in NDC
+	static glm::mat4 jittered(glm::mat4 const & projection, glm::vec2 jitter);
+
+	// Clears and binds the scene target, color, motion and depth, with its viewport. Motion is
+	// written only by draws between write_motion(true) and write_motion(false); draws whose
+	// shaders have no motion output have to be outside
+	void begin_scene();
+	void write_motion(bool enabled);
+
+	// Both draw into the default framebuffer, changing the depth and blend state
+	void resolve_fxaa();
+	// The view projections are without jitter
+	void resolve_taa(glm::mat4 const & view_projection, glm::mat4 const & previous_view_projection, glm::vec2 jitter);
+
+	// The next TAA resolve starts over from its frame alone, e.g. after a switch of modes
+	void reset_history();
+
+private:
+	int width_ = 0;
+	int height_ = 0;
+	int frame_ = 0;
+
+	GLuint scene_fbo_ = 0;
+	GLuint color_texture_ = 0;
+	GLuint motion_texture_ = 0;
+	GLuint depth_texture_ = 0;
+
+	// Written and read in turns
+	std::array<GLuint, 2> history_textures_{};
+	std::array<GLuint, 2> history_fbos_{};
+	int history_index_ = 0;
+	bool history_valid_ = false;
+
+	GLuint fxaa_program_ = 0;
+	GLuint taa_program_ = 0;
+	GLuint copy_program_ = 0;
+
+	GLuint fullscreen_vao_ = 0;
+};
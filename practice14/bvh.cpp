@@ -0,0 +1,413 @@
+#include "bvh.hpp"
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <functional>
+#include <bit>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define BVH_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BVH_SSE
+#endif
+
+namespace
+{
+
+	glm::vec3 box_min(aabb_soa const & bounds, std::uint32_t i)
+	{
+		return {bounds.min_x[i], bounds.min_y[i], bounds.min_z[i]};
+	}
+
+	glm::vec3 box_max(aabb_soa const & bounds, std::uint32_t i)
+	{
+		return {bounds.max_x[i], bounds.max_y[i], bounds.max_z[i]};
+	}
+
+	constexpr std::uint32_t all_planes = (1u << 6) - 1;
+
+	// Clears the bits of planes the box is entirely inside of; returns false if
+	// the box is entirely outside one of the planes
+	bool test_box(std::array<glm::vec4, 6> const & planes, glm::vec3 const & min, glm::vec3 const & max, std::uint32_t & mask)
+	{
+		for (std::uint32_t p = 0; p < 6; ++p)
+		{
+			if (!(mask & (1u << p)))
+				continue;
+
+			glm::vec3 const n = glm::vec3(planes[p]);
+			glm::vec3 const positive = glm::mix(min, max, glm::greaterThanEqual(n, glm::vec3(0.f)));
+			glm::vec3 const negative = glm::mix(max, min, glm::greaterThanEqual(n, glm::vec3(0.f)));
+
+			if (glm::dot(n, positive) + planes[p].w < 0.f)
+				return false;
+			if (glm::dot(n, negative) + planes[p].w >= 0.f)
+				mask &= ~(1u << p);
+		}
+		return true;
+	}
+
+	// The planes of all views transposed, so that a register loads the same plane of consecutive
+	// views. With the box as center and extent, |n| gives how far it reaches along each normal
+	// without picking a corner per view.
+	struct view_planes
+	{
+		alignas(32) float nx[6][bvh::max_views];
+		alignas(32) float ny[6][bvh::max_views];
+		alignas(32) float nz[6][bvh::max_views];
+		alignas(32) float d[6][bvh::max_views];
+		alignas(32) float ax[6][bvh::max_views];
+		alignas(32) float ay[6][bvh::max_views];
+		alignas(32) float az[6][bvh::max_views];
+	};
+
+	// Views past the end get planes that everything is inside of
+	void transpose_views(std::span<std::array<glm::vec4, 6> const> views, view_planes & result)
+	{
+		for (std::size_t p = 0; p < 6; ++p)
+			for (std::size_t v = 0; v < bvh::max_views; ++v)
+			{
+				glm::vec4 const plane = v < views.size() ? views[v][p] : glm::vec4(0.f, 0.f, 0.f, 1.f);
+				result.nx[p][v] = plane.x;
+				result.ny[p][v] = plane.y;
+				result.nz[p][v] = plane.z;
+				result.d[p][v] = plane.w;
+				result.ax[p][v] = std::abs(plane.x);
+				result.ay[p][v] = std::abs(plane.y);
+				result.az[p][v] = std::abs(plane.z);
+			}
+	}
+
+	// Returns which of the views the box is not entirely outside of; inside gets which of them it
+	// is entirely inside of
+	std::uint32_t test_views(view_planes const & planes, std::uint32_t views, glm::vec3 const & min, glm::vec3 const & max, std::uint32_t & inside)
+	{
+		glm::vec3 const c = (min + max) * 0.5f;
+		glm::vec3 const e = (max - min) * 0.5f;
+
+		std::uint32_t visible = 0;
+		inside = 0;
+
+#if defined(BVH_AVX)
+		__m256 const cx = _mm256_set1_ps(c.x), cy = _mm256_set1_ps(c.y), cz = _mm256_set1_ps(c.z);
+		__m256 const ex = _mm256_set1_ps(e.x), ey = _mm256_set1_ps(e.y), ez = _mm256_set1_ps(e.z);
+		__m256 const zero = _mm256_setzero_ps();
+
+		for (std::size_t first = 0; first < bvh::max_views; first += 8)
+		{
+			if (((views >> first) & 0xFF) == 0)
+				continue;
+
+			__m256 outside = zero;
+			__m256 straddles = zero;
+			for (std::size_t p = 0; p < 6; ++p)
+			{
+				__m256 const distance = _mm256_add_ps(
+					_mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(planes.nx[p] + first), cx), _mm256_mul_ps(_mm256_load_ps(planes.ny[p] + first), cy)),
+					_mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(planes.nz[p] + first), cz), _mm256_load_ps(planes.d[p] + first)));
+				__m256 const reach = _mm256_add_ps(
+					_mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(planes.ax[p] + first), ex), _mm256_mul_ps(_mm256_load_ps(planes.ay[p] + first), ey)),
+					_mm256_mul_ps(_mm256_load_ps(planes.az[p] + first), ez));
+				outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), zero, _CMP_LT_OQ));
+				straddles = _mm256_or_ps(straddles, _mm256_cmp_ps(_mm256_sub_ps(distance, reach), zero, _CMP_LT_OQ));
+			}
+
+			std::uint32_t const outside_mask = _mm256_movemask_ps(outside);
+			std::uint32_t const straddle_mask = _mm256_movemask_ps(straddles);
+			visible |= (~outside_mask & 0xFF) << first;
+			inside |= (~(outside_mask | straddle_mask) & 0xFF) << first;
+		}
+#elif defined(BVH_SSE)
+		__m128 const cx = _mm_set1_ps(c.x), cy = _mm_set1_ps(c.y), cz = _mm_set1_ps(c.z);
+		__m128 const ex = _mm_set1_ps(e.x), ey = _mm_set1_ps(e.y), ez = _mm_set1_ps(e.z);
+		__m128 const zero = _mm_setzero_ps();
+
+		for (std::size_t first = 0; first < bvh::max_views; first += 4)
+		{
+			if (((views >> first) & 0xF) == 0)
+				continue;
+
+			__m128 outside = zero;
+			__m128 straddles = zero;
+			for (std::size_t p = 0; p < 6; ++p)
+			{
+				__m128 const distance = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(_mm_load_ps(planes.nx[p] + first), cx), _mm_mul_ps(_mm_load_ps(planes.ny[p] + first), cy)),
+					_mm_add_ps(_mm_mul_ps(_mm_load_ps(planes.nz[p] + first), cz), _mm_load_ps(planes.d[p] + first)));
+				__m128 const reach = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(_mm_load_ps(planes.ax[p] + first), ex), _mm_mul_ps(_mm_load_ps(planes.ay[p] + first), ey)),
+					_mm_mul_ps(_mm_load_ps(planes.az[p] + first), ez));
+				outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, reach), zero));
+				straddles = _mm_or_ps(straddles, _mm_cmplt_ps(_mm_sub_ps(distance, reach), zero));
+			}
+
+			std::uint32_t const outside_mask = _mm_movemask_ps(outside);
+			std::uint32_t const straddle_mask = _mm_movemask_ps(straddles);
+			visible |= (~outside_mask & 0xF) << first;
+			inside |= (~(outside_mask | straddle_mask) & 0xF) << first;
+		}
+#else
+		for (std::size_t v = 0; v < bvh::max_views; ++v)
+		{
+			if (!(views & (1u << v)))
+				continue;
+
+			bool outside = false;
+			bool straddles = false;
+			for (std::size_t p = 0; p < 6; ++p)
+			{
+				float const distance = planes.nx[p][v] * c.x + planes.ny[p][v] * c.y + planes.nz[p][v] * c.z + planes.d[p][v];
+				float const reach = planes.ax[p][v] * e.x + planes.ay[p][v] * e.y + planes.az[p][v] * e.z;
+				outside = outside || distance + reach < 0.f;
+				straddles = straddles || distance - reach < 0.f;
+			}
+
+			if (!outside)
+				visible |= 1u << v;
+			if (!outside && !straddles)
+				inside |= 1u << v;
+		}
+#endif
+
+		inside &= views;
+		return visible & views;
+	}
+
+}
+
+void bvh::build(aabb_soa const & bounds, std::size_t leaf_size)
+{
+	nodes.clear();
+	objects.resize(bounds.size());
+	for (std::uint32_t i = 0; i < objects.size(); ++i)
+		objects[i] = i;
+
+	object_leaf_.assign(bounds.size(), 0);
+
+	if (objects.empty())
+		return;
+
+	leaf_size = std::max<std::size_t>(1, leaf_size);
+
+	auto center = [&](std::uint32_t i)
+	{
+		return (box_min(bounds, i) + box_max(bounds, i)) * 0.5f;
+	};
+
+	nodes.push_back({glm::vec3(0.f), glm::vec3(0.f), 0, static_cast<std::uint32_t>(objects.size()), 0, 0});
+
+	// Children are always created after their parent, so that refit can sweep backwards
+	std::vector<std::uint32_t> stack{0};
+	while (!stack.empty())
+	{
+		std::uint32_t const index = stack.back();
+		stack.pop_back();
+
+		std::uint32_t const first = nodes[index].first;
+		std::uint32_t const count = nodes[index].count;
+
+		if (count <= leaf_size)
+		{
+			for (std::uint32_t i = first; i < first + count; ++i)
+				object_leaf_[objects[i]] = index;
+			continue;
+		}
+
+		glm::vec3 center_min(std::numeric_limits<float>::infinity());
+		glm::vec3 center_max(-std::numeric_limits<float>::infinity());
+		for (std::uint32_t i = first; i < first + count; ++i)
+		{
+			center_min = glm::min(center_min, center(objects[i]));
+			center_max = glm::max(center_max, center(objects[i]));
+		}
+
+		glm::vec3 const extent = center_max - center_min;
+		int const axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z) ? 1 : 2;
+
+		std::uint32_t const half = count / 2;
+		std::nth_element(objects.begin() + first, objects.begin() + first + half, objects.begin() + first + count,
+			[&](std::uint32_t a, std::uint32_t b){ return center(a)[axis] < center(b)[axis]; });
+
+		std::uint32_t const left = nodes.size();
+		nodes[index].left = left;
+		nodes.push_back({glm::vec3(0.f), glm::vec3(0.f), first, half, 0, index});
+		nodes.push_back({glm::vec3(0.f), glm::vec3(0.f), first + half, count - half, 0, index});
+
+		stack.push_back(left);
+		stack.push_back(left + 1);
+	}
+
+	refit(bounds);
+}
+
+void bvh::refit_node(std::uint32_t index, aabb_soa const & bounds)
+{
+	auto & node = nodes[index];
+	if (node.left != 0)
+	{
+		node.min = glm::min(nodes[node.left].min, nodes[node.left + 1].min);
+		node.max = glm::max(nodes[node.left].max, nodes[node.left + 1].max);
+		return;
+	}
+
+	node.min = glm::vec3(std::numeric_limits<float>::infinity());
+	node.max = glm::vec3(-std::numeric_limits<float>::infinity());
+	for (std::uint32_t i = node.first; i < node.first + node.count; ++i)
+	{
+		node.min = glm::min(node.min, box_min(bounds, objects[i]));
+		node.max = glm::max(node.max, box_max(bounds, objects[i]));
+	}
+}
+
+void bvh::refit(aabb_soa const & bounds)
+{
+	for (std::size_t i = nodes.size(); i-- > 0;)
+		refit_node(i, bounds);
+}
+
+void bvh::refit(aabb_soa const & bounds, std::span<std::uint32_t const> moved)
+{
+	if (dirty_flags_.size() != nodes.size())
+		dirty_flags_.assign(nodes.size(), 0);
+
+	// Collect the affected nodes, stopping at ancestors that are already collected
+	dirty_.clear();
+	for (auto object : moved)
+	{
+		for (std::uint32_t index = object_leaf_[object]; !dirty_flags_[index]; index = nodes[index].parent)
+		{
+			dirty_flags_[index] = 1;
+			dirty_.push_back(index);
+			if (index == 0)
+				break;
+		}
+	}
+
+	// Children have larger indices than their parents; with many dirty nodes a linear
+	// sweep over the flags is cheaper than sorting the list
+	if (dirty_.size() * 16 < nodes.size())
+	{
+		std::sort(dirty_.begin(), dirty_.end(), std::greater<>{});
+		for (auto index : dirty_)
+		{
+			refit_node(index, bounds);
+			dirty_flags_[index] = 0;
+		}
+	}
+	else
+	{
+		for (std::size_t index = nodes.size(); index-- > 0;)
+		{
+			if (!dirty_flags_[index]) continue;
+			refit_node(index, bounds);
+			dirty_flags_[index] = 0;
+		}
+	}
+}
+
+void bvh::cull(std::array<glm::vec4, 6> const & planes, aabb_soa const & bounds, std::vector<std::uint32_t> & visible) const
+{
+	if (nodes.empty())
+		return;
+
+	struct entry
+	{
+		std::uint32_t index;
+		std::uint32_t mask;
+	};
+
+	// A median split keeps the depth logarithmic, so 64 entries are plenty
+	std::array<entry, 64> stack;
+	std::size_t top = 0;
+
+	stack[top++] = {0, all_planes};
+	while (top > 0)
+	{
+		auto [index, mask] = stack[--top];
+		auto const & node = nodes[index];
+
+		if (!test_box(planes, node.min, node.max, mask))
+			continue;
+
+		if (mask == 0)
+		{
+			visible.insert(visible.end(), objects.begin() + node.first, objects.begin() + node.first + node.count);
+			continue;
+		}
+
+		if (node.left != 0)
+		{
+			stack[top++] = {node.left + 1, mask};
+			stack[top++] = {node.left, mask};
+			continue;
+		}
+
+		for (std::uint32_t i = node.first; i < node.first + node.count; ++i)
+		{
+			std::uint32_t object_mask = mask;
+			if (test_box(planes, box_min(bounds, objects[i]), box_max(bounds, objects[i]), object_mask))
+				visible.push_back(objects[i]);
+		}
+	}
+}
+
+void bvh::cull(std::span<std::array<glm::vec4, 6> const> views, aabb_soa const & bounds, std::span<std::vector<std::uint32_t>> visible) const
+{
+	if (nodes.empty() || views.empty())
+		return;
+
+	std::size_t const view_count = std::min(views.size(), max_views);
+	view_planes planes;
+	transpose_views(views.first(view_count), planes);
+
+	struct entry
+	{
+		std::uint32_t index;
+		// Views the node's parent was partly inside of
+		std::uint32_t views;
+	};
+
+	std::array<entry, 64> stack;
+	std::size_t top = 0;
+
+	stack[top++] = {0, (1u << view_count) - 1};
+	while (top > 0)
+	{
+		auto const [index, views_in] = stack[--top];
+		auto const & node = nodes[index];
+
+		std::uint32_t inside;
+		std::uint32_t const in_view = test_views(planes, views_in, node.min, node.max, inside);
+
+		for (std::uint32_t mask = inside; mask != 0; mask &= mask - 1)
+		{
+			auto & list = visible[std::countr_zero(mask)];
+			list.insert(list.end(), objects.begin() + node.first, objects.begin() + node.first + node.count);
+		}
+
+		std::uint32_t const partial = in_view & ~inside;
+		if (partial == 0)
+			continue;
+
+		if (node.left != 0)
+		{
+			stack[top++] = {node.left + 1, partial};
+			stack[top++] = {node.left, partial};
+			continue;
+		}
+
+		for (std::uint32_t i = node.first; i < node.first + node.count; ++i)
+		{
+			std::uint32_t const object = objects[i];
+			std::uint32_t object_inside;
+			for (std::uint32_t mask = test_views(planes, partial, box_min(bounds, object), box_max(bounds, object), object_inside); mask != 0; mask &= mask - 1)
+				visible[std::countr_zero(mask)].push_back(object);
+		}
+	}
+}
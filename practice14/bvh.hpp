@@ -0,0 +1,57 @@
+#pragma once
+
+#include "culling.hpp"
+
+#include <vector>
+#include <array>
+#include <span>
+#include <cstdint>
+
+// Bounding volume hierarchy over object boxes, culled top-down against frustum planes
+struct bvh
+{
+	// Views a single traversal can cull at once
+	static constexpr std::size_t max_views = 16;
+
+	struct node
+	{
+		glm::vec3 min;
+		glm::vec3 max;
+		// Objects of the whole subtree are objects[first, first + count)
+		std::uint32_t first;
+		std::uint32_t count;
+		// Children are left and left + 1; 0 for leaves, since the root is never a child
+		std::uint32_t left;
+		std::uint32_t parent;
+	};
+
+	std::vector<node> nodes;
+	// Object indices in leaf order
+	std::vector<std::uint32_t> objects;
+
+	// Median split along the longest axis of the box centers
+	void build(aabb_soa const & bounds, std::size_t leaf_size = 4);
+
+	// Recomputes all node boxes from the current object bounds, keeping the topology
+	void refit(aabb_soa const & bounds);
+
+	// Recomputes only the leaves of the moved objects and their ancestors
+	void refit(aabb_soa const & bounds, std::span<std::uint32_t const> moved);
+
+	// Appends visible object indices, planes as in frustum::planes. Planes a node is entirely inside of are not tested
+	// for its children, and nodes inside all planes accept their objects without tests.
+	void cull(std::array<glm::vec4, 6> const & planes, aabb_soa const & bounds, std::vector<std::uint32_t> & visible) const;
+
+	// Culls up to max_views frustums in one traversal, appending the objects visible in views[v] to visible[v]. Every
+	// node is tested against all views still partly inside it at once, one plane of 8 views per AVX test or 4 with
+	// SSE; views a node is entirely inside of take its objects and drop out of its subtree, and so does any view
+	// it is outside of. Conservative in the same way as cull_aabbs.
+	void cull(std::span<std::array<glm::vec4, 6> const> views, aabb_soa const & bounds, std::span<std::vector<std::uint32_t>> visible) const;
+
+private:
+	void refit_node(std::uint32_t index, aabb_soa const & bounds);
+
+	std::vector<std::uint32_t> object_leaf_;
+	std::vector<std::uint32_t> dirty_;
+	std::vector<std::uint8_t> dirty_flags_;
+};
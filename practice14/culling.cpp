@@ -0,0 +1,149 @@
+#include "culling.hpp"
+
+#include <bit>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define CULLING_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CULLING_SSE
+#endif
+
+void aabb_soa::push_back(glm::vec3 const & min, glm::vec3 const & max)
+{
+	min_x.push_back(min.x);
+	min_y.push_back(min.y);
+	min_z.push_back(min.z);
+	max_x.push_back(max.x);
+	max_y.push_back(max.y);
+	max_z.push_back(max.z);
+}
+
+void aabb_soa::set(std::size_t i, glm::vec3 const & min, glm::vec3 const & max)
+{
+	min_x[i] = min.x;
+	min_y[i] = min.y;
+	min_z[i] = min.z;
+	max_x[i] = max.x;
+	max_y[i] = max.y;
+	max_z[i] = max.z;
+}
+
+namespace
+{
+
+	// Only the box corner furthest along the plane normal (the p-vertex) needs testing,
+	// and which corner that is depends only on the signs of the normal
+	struct plane_test
+	{
+		float const * x;
+		float const * y;
+		float const * z;
+		glm::vec4 plane;
+	};
+
+	std::array<plane_test, 6> setup_plane_tests(std::array<glm::vec4, 6> const & planes, aabb_soa const & boxes)
+	{
+		std::array<plane_test, 6> result;
+		for (std::size_t i = 0; i < 6; ++i)
+		{
+			auto const & p = planes[i];
+			result[i] = {
+				(p.x >= 0.f ? boxes.max_x : boxes.min_x).data(),
+				(p.y >= 0.f ? boxes.max_y : boxes.min_y).data(),
+				(p.z >= 0.f ? boxes.max_z : boxes.min_z).data(),
+				p,
+			};
+		}
+		return result;
+	}
+
+	void append_visible(unsigned int mask, std::size_t base, std::vector<std::uint32_t> & visible)
+	{
+		for (; mask != 0; mask &= mask - 1)
+			visible.push_back(base + std::countr_zero(mask));
+	}
+
+}
+
+void cull_aabbs(std::array<glm::vec4, 6> const & planes, aabb_soa const & boxes, std::vector<std::uint32_t> & visible)
+{
+	auto const tests = setup_plane_tests(planes, boxes);
+	std::size_t const count = boxes.size();
+	std::size_t i = 0;
+
+#if defined(CULLING_AVX)
+	__m256 nx[6], ny[6], nz[6], d[6];
+	for (std::size_t p = 0; p < 6; ++p)
+	{
+		nx[p] = _mm256_set1_ps(tests[p].plane.x);
+		ny[p] = _mm256_set1_ps(tests[p].plane.y);
+		nz[p] = _mm256_set1_ps(tests[p].plane.z);
+		d[p] = _mm256_set1_ps(tests[p].plane.w);
+	}
+
+	for (; i + 8 <= count; i += 8)
+	{
+		int outside = 0;
+		for (std::size_t p = 0; p < 6 && outside != 0xFF; ++p)
+		{
+			__m256 distance = _mm256_add_ps(
+				_mm256_add_ps(_mm256_mul_ps(nx[p], _mm256_loadu_ps(tests[p].x + i)), _mm256_mul_ps(ny[p], _mm256_loadu_ps(tests[p].y + i))),
+				_mm256_add_ps(_mm256_mul_ps(nz[p], _mm256_loadu_ps(tests[p].z + i)), d[p]));
+			outside |= _mm256_movemask_ps(_mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_LT_OQ));
+		}
+		append_visible(~outside & 0xFF, i, visible);
+	}
+#elif defined(CULLING_SSE)
+	__m128 nx[6], ny[6], nz[6], d[6];
+	for (std::size_t p = 0; p < 6; ++p)
+	{
+		nx[p] = _mm_set1_ps(tests[p].plane.x);
+		ny[p] = _mm_set1_ps(tests[p].plane.y);
+		nz[p] = _mm_set1_ps(tests[p].plane.z);
+		d[p] = _mm_set1_ps(tests[p].plane.w);
+	}
+
+	for (; i + 4 <= count; i += 4)
+	{
+		int outside = 0;
+		for (std::size_t p = 0; p < 6 && outside != 0xF; ++p)
+		{
+			__m128 distance = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(nx[p], _mm_loadu_ps(tests[p].x + i)), _mm_mul_ps(ny[p], _mm_loadu_ps(tests[p].y + i))),
+				_mm_add_ps(_mm_mul_ps(nz[p], _mm_loadu_ps(tests[p].z + i)), d[p]));
+			outside |= _mm_movemask_ps(_mm_cmplt_ps(distance, _mm_setzero_ps()));
+		}
+		append_visible(~outside & 0xF, i, visible);
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		bool outside = false;
+		for (std::size_t p = 0; p < 6 && !outside; ++p)
+		{
+			auto const & t = tests[p];
+			outside = t.plane.x * t.x[i] + t.plane.y * t.y[i] + t.plane.z * t.z[i] + t.plane.w < 0.f;
+		}
+		if (!outside)
+			visible.push_back(i);
+	}
+}
+
+void cull_aabbs(std::array<glm::vec4, 6> const & planes, aabb_soa const & boxes, std::span<std::uint32_t const> candidates, std::vector<std::uint32_t> & visible)
+{
+	auto const tests = setup_plane_tests(planes, boxes);
+	for (auto i : candidates)
+	{
+		bool outside = false;
+		for (std::size_t p = 0; p < 6 && !outside; ++p)
+		{
+			auto const & t = tests[p];
+			outside = t.plane.x * t.x[i] + t.plane.y * t.y[i] + t.plane.z * t.z[i] + t.plane.w < 0.f;
+		}
+		if (!outside)
+			visible.push_back(i);
+	}
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include <vector>
+#include <span>
+#include <array>
+#include <cstdint>
+
+// Bounding boxes of many objects with one array per coordinate, so that
+// several boxes fit into a SIMD register at once
+struct aabb_soa
+{
+	std::vector<float> min_x, min_y, min_z;
+	std::vector<float> max_x, max_y, max_z;
+
+	std::size_t size() const { return min_x.size(); }
+
+	void push_back(glm::vec3 const & min, glm::vec3 const & max);
+	void set(std::size_t i, glm::vec3 const & min, glm::vec3 const & max);
+};
+
+// Planes as in frustum::planes. Appends the indices of boxes that are not entirely behind any plane, 8 boxes
+// at a time with AVX or 4 with SSE. Conservative: a box outside the frustum
+// near one of its edges may still be reported visible.
+void cull_aabbs(std::array<glm::vec4, 6> const & planes, aabb_soa const & boxes, std::vector<std::uint32_t> & visible);
+
+// Same, testing only the candidates, which are appended in their order
+void cull_aabbs(std::array<glm::vec4, 6> const & planes, aabb_soa const & boxes, std::span<std::uint32_t const> candidates, std::vector<std::uint32_t> & visible);
@@ -0,0 +1,204 @@
+#include "dirty_range_buffer.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+namespace
+{
+
+	constexpr GLuint group_size = 64;
+
+	const char scatter_shader_source[] =
+R"(#version 430 core
+
+layout (local_size_x = 64) in;
+
+uniform uint texel_count;
+uniform uint record_texels;
+
+layout (std430, binding = 0) writeonly buffer target_buffer { vec4 target[]; };
+layout (std430, binding = 1) readonly buffer staging_buffer { vec4 staged[]; };
+layout (std430, binding = 2) readonly buffer index_buffer { uint records[]; };
+
+void main()
+{
+	uint i = gl_GlobalInvocationID.x;
+	if (i >= texel_count)
+		return;
+
+	uint record = i / record_texels;
+	target[records[record] * record_texels + i % record_texels] = staged[i];
+}
+)";
+
+}
+
+bool dirty_range_buffer::scatter_supported()
+{
+	return GLEW_VERSION_4_3;
+}
+
+dirty_range_buffer::dirty_range_buffer(program_cache & programs, std::size_t record_size, std::size_t record_count, void const * records, GLenum usage, settings const & s)
+	: record_size_(record_size)
+	, record_count_(record_count)
+	, usage_(usage)
+	, settings_(s)
+	, marked_(record_count, 0)
+{
+	if (record_size % 16 != 0)
+		throw std::runtime_error("Dirty range buffer records must be a multiple of 16 bytes");
+	if (settings_.max_ranges == 0)
+		throw std::runtime_error("Dirty range buffer needs at least one range");
+
+	glGenBuffers(1, &buffer_);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_);
+	glBufferData(GL_COPY_WRITE_BUFFER, record_size * record_count, records, usage);
+
+	if (scatter_supported())
+	{
+		scatter_program_ = programs.get({{GL_COMPUTE_SHADER, scatter_shader_source}});
+		texel_count_location_ = glGetUniformLocation(scatter_program_, "texel_count");
+		record_texels_location_ = glGetUniformLocation(scatter_program_, "record_texels");
+		glGenBuffers(1, &staging_buffer_);
+		glGenBuffers(1, &index_buffer_);
+	}
+}
+
+dirty_range_buffer::~dirty_range_buffer()
+{
+	glDeleteBuffers(1, &buffer_);
+	if (scatter_program_)
+	{
+		glDeleteBuffers(1, &staging_buffer_);
+		glDeleteBuffers(1, &index_buffer_);
+	}
+}
+
+void dirty_range_buffer::mark(std::size_t index)
+{
+	if (marked_[index])
+		return;
+	marked_[index] = 1;
+	dirty_.push_back(index);
+}
+
+dirty_range_buffer::stats dirty_range_buffer::flush(void const * records)
+{
+	stats result;
+	if (dirty_.empty())
+		return result;
+
+	std::sort(dirty_.begin(), dirty_.end());
+	result.records = dirty_.size();
+
+	ranges_.clear();
+	for (auto index : dirty_)
+	{
+		if (!ranges_.empty() && index <= ranges_.back().end + settings_.merge_gap)
+			ranges_.back().end = index + 1;
+		else
+			ranges_.push_back({index, std::size_t(index) + 1});
+	}
+
+	if (ranges_.size() > settings_.max_ranges)
+	{
+		if (scatter_program_)
+			return scatter(records);
+
+		// Only the widest gaps still split ranges
+		gaps_.clear();
+		for (std::size_t i = 1; i < ranges_.size(); ++i)
+			gaps_.push_back(ranges_[i].first - ranges_[i - 1].end);
+		auto const split = gaps_.end() - (settings_.max_ranges - 1);
+		std::nth_element(gaps_.begin(), split, gaps_.end());
+		std::size_t const min_gap = (split == gaps_.end()) ? std::size_t(-1) : *split;
+
+		// Ties at min_gap may leave a few more than max_ranges
+		std::size_t merged = 0;
+		for (std::size_t i = 1; i < ranges_.size(); ++i)
+		{
+			if (ranges_[i].first - ranges_[merged].end < min_gap)
+				ranges_[merged].end = ranges_[i].end;
+			else
+				ranges_[++merged] = ranges_[i];
+		}
+		ranges_.resize(merged + 1);
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_);
+	for (auto const & r : ranges_)
+	{
+		std::size_t const offset = r.first * record_size_;
+		std::size_t const size = (r.end - r.first) * record_size_;
+		glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, static_cast<char const *>(records) + offset);
+		result.bytes += size;
+	}
+	result.ranges = ranges_.size();
+
+	for (auto index : dirty_)
+		marked_[index] = 0;
+	dirty_.clear();
+
+	return result;
+}
+
+dirty_range_buffer::stats dirty_range_buffer::upload_all(void const * records)
+{
+	// Orphaned, since last frame's draws may still read it
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_);
+	glBufferData(GL_COPY_WRITE_BUFFER, record_size_ * record_count_, records, usage_);
+
+	stats result;
+	result.records = record_count_;
+	result.ranges = 1;
+	result.bytes = record_size_ * record_count_;
+
+	for (auto index : dirty_)
+		marked_[index] = 0;
+	dirty_.clear();
+
+	return result;
+}
+
+dirty_range_buffer::stats dirty_range_buffer::scatter(void const * records)
+{
+	staged_.resize(dirty_.size() * record_size_);
+	for (std::size_t i = 0; i < dirty_.size(); ++i)
+		std::memcpy(staged_.data() + i * record_size_, static_cast<char const *>(records) + dirty_[i] * record_size_, record_size_);
+
+	// Orphaned, since last frame's scatter may still read them
+	staging_capacity_ = std::max(staging_capacity_, dirty_.size());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, staging_buffer_);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, staging_capacity_ * record_size_, nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, staged_.size(), staged_.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, index_buffer_);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, staging_capacity_ * sizeof(std::uint32_t), nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, dirty_.size() * sizeof(std::uint32_t), dirty_.data());
+
+	GLuint const record_texels = record_size_ / 16;
+	GLuint const texel_count = dirty_.size() * record_texels;
+
+	glUseProgram(scatter_program_);
+	glUniform1ui(texel_count_location_, texel_count);
+	glUniform1ui(record_texels_location_, record_texels);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffer_);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, staging_buffer_);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, index_buffer_);
+	glDispatchCompute((texel_count + group_size - 1) / group_size, 1, 1);
+
+	// Whatever reads the records next: texel fetches, instanced attributes or buffer copies
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+	stats result;
+	result.records = dirty_.size();
+	result.ranges = ranges_.size();
+	result.bytes = staged_.size() + dirty_.size() * sizeof(std::uint32_t);
+	result.scattered = true;
+
+	for (auto index : dirty_)
+		marked_[index] = 0;
+	dirty_.clear();
+
+	return result;
+}
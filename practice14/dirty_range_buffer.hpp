@@ -0,0 +1,86 @@
+#pragma once
+
+#include "program_cache.hpp"
+
+#include <GL/glew.h>
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// A GL buffer of fixed-size records mirroring an array on the CPU, which only sends the records
+// that changed. The ones marked since the last flush are sorted and coalesced into ranges, a
+// range running on over a few clean records rather than starting another call, and each range
+// goes up with glBufferSubData. Updates scattered too thinly for that, past max_ranges, are
+// packed into a staging buffer instead and a compute pass moves them into place, with OpenGL
+// 4.3; without it the closest ranges merge until there are max_ranges of them.
+struct dirty_range_buffer
+{
+	struct settings
+	{
+		// Clean records between two dirty ones that are uploaded along with them
+		std::size_t merge_gap = 4;
+		std::size_t max_ranges = 64;
+	};
+
+	struct stats
+	{
+		std::size_t records = 0;
+		std::size_t ranges = 0;
+		// Including the clean records inside merged ranges, and the record indices the scatter
+		// pass reads
+		std::size_t bytes = 0;
+		bool scattered = false;
+	};
+
+	static bool scatter_supported();
+
+	// record_size must be a multiple of 16, the scatter pass moves vec4s. Its program is owned
+	// by the cache.
+	dirty_range_buffer(program_cache & programs, std::size_t record_size, std::size_t record_count, void const * records, GLenum usage, settings const & s);
+	~dirty_range_buffer();
+
+	dirty_range_buffer(dirty_range_buffer const &) = delete;
+	dirty_range_buffer & operator = (dirty_range_buffer const &) = delete;
+
+	GLuint buffer() const { return buffer_; }
+
+	// The record at index changed in the CPU array
+	void mark(std::size_t index);
+
+	// Uploads the marked records from the CPU array, laid out as the one given on construction
+	stats flush(void const * records);
+
+	// Orphans the buffer and uploads every record, marked or not
+	stats upload_all(void const * records);
+
+private:
+	struct range
+	{
+		std::size_t first;
+		std::size_t end;
+	};
+
+	stats scatter(void const * records);
+
+	std::size_t record_size_;
+	std::size_t record_count_;
+	GLenum usage_;
+	settings settings_;
+
+	GLuint buffer_ = 0;
+
+	std::vector<std::uint8_t> marked_;
+	std::vector<std::uint32_t> dirty_;
+	std::vector<range> ranges_;
+	std::vector<std::size_t> gaps_;
+
+	// Only created with OpenGL 4.3
+	GLuint scatter_program_ = 0;
+	GLuint staging_buffer_ = 0;
+	GLuint index_buffer_ = 0;
+	std::size_t staging_capacity_ = 0;
+	std::vector<char> staged_;
+	GLint texel_count_location_ = -1;
+	GLint record_texels_location_ = -1;
+};
@@ -1,10 +1,13 @@
 #include "gltf_loader.hpp"
+#include "mesh_tangents.hpp"
+#include "json_arena.hpp"
 
 #include <rapidjson/document.h>
-#include <rapidjson/istreamwrapper.h>
 
 #include <fstream>
 #include <stdexcept>
+#include <cstring>
+#include <cstdint>
 
 static unsigned int attribute_type_to_size(std::string const & type)
 {
@@ -15,14 +18,96 @@ static unsigned int attribute_type_to_size(std::string const & type)
     return 0;
 }
 
+template <typename T>
+static T read_element(std::vector<char> const & buffer, gltf_model::accessor const & accessor, std::size_t i)
+{
+    std::size_t const stride = accessor.view.stride ? accessor.view.stride : sizeof(T);
+    std::size_t const offset = accessor.buffer_offset() + i * stride;
+    if (offset + sizeof(T) > buffer.size())
+        throw std::runtime_error("Accessor is out of the buffer bounds");
+
+    T value;
+    std::memcpy(&value, buffer.data() + offset, sizeof(T));
+    return value;
+}
+
+static std::uint32_t read_index(std::vector<char> const & buffer, gltf_model::accessor const & accessor, std::size_t i)
+{
+    switch (accessor.type)
+    {
+    case 0x1401: // GL_UNSIGNED_BYTE
+        return read_element<std::uint8_t>(buffer, accessor, i);
+    case 0x1403: // GL_UNSIGNED_SHORT
+        return read_element<std::uint16_t>(buffer, accessor, i);
+    case 0x1405: // GL_UNSIGNED_INT
+        return read_element<std::uint32_t>(buffer, accessor, i);
+    }
+    throw std::runtime_error("Unsupported index type " + std::to_string(accessor.type));
+}
+
+// MikkTSpace tangents for a mesh exported without them, appended to the buffer so that they
+// are uploaded along with the rest of it
+static gltf_model::accessor generate_tangent_accessor(gltf_model & model, gltf_model::mesh const & mesh)
+{
+    for (auto const * accessor : {&mesh.position, &mesh.normal, &mesh.texcoord})
+        if (accessor->type != 0x1406) // GL_FLOAT
+            throw std::runtime_error("Tangents can only be generated for float attributes");
+
+    std::size_t const vertex_count = mesh.position.count;
+    std::vector<std::array<float, 3>> positions(vertex_count), normals(vertex_count);
+    std::vector<std::array<float, 2>> texcoords(vertex_count);
+    for (std::size_t i = 0; i < vertex_count; ++i)
+    {
+        positions[i] = read_element<std::array<float, 3>>(model.buffer, mesh.position, i);
+        normals[i] = read_element<std::array<float, 3>>(model.buffer, mesh.normal, i);
+        texcoords[i] = read_element<std::array<float, 2>>(model.buffer, mesh.texcoord, i);
+    }
+
+    std::vector<std::uint32_t> indices(mesh.indices.count);
+    for (std::size_t i = 0; i < indices.size(); ++i)
+        if ((indices[i] = read_index(model.buffer, mesh.indices, i)) >= vertex_count)
+            throw std::runtime_error("Index out of the vertex range");
+
+    auto const tangents = generate_tangents(positions, normals, texcoords, indices);
+
+    // Float attributes want 4-byte alignment
+    std::size_t const offset = (model.buffer.size() + 3) & ~std::size_t(3);
+    std::size_t const size = tangents.size() * sizeof(tangents[0]);
+    model.buffer.resize(offset + size);
+    std::memcpy(model.buffer.data() + offset, tangents.data(), size);
+
+    return {
+        {static_cast<unsigned int>(offset), static_cast<unsigned int>(size), 0u},
+        0x1406, // GL_FLOAT
+        4,
+        static_cast<unsigned int>(tangents.size()),
+        0u,
+        false,
+    };
+}
+
 gltf_model load_gltf(std::filesystem::path const & path)
 {
-    rapidjson::Document document;
+    auto & arena = thread_json_arena();
+    auto const pool = arena.pool();
+    rapidjson::MemoryPoolAllocator<> allocator(pool.data(), pool.size());
+    rapidjson::Document document(&allocator);
 
     {
         std::ifstream input(path, std::ios::binary);
-        rapidjson::IStreamWrapper stream(input);
-        document.ParseStream(stream);
+        if (!input)
+            throw std::runtime_error("Failed to open " + path.string());
+
+        // Read in one go straight into the buffer it is parsed in
+        auto const size = std::filesystem::file_size(path);
+        char * const text = arena.text(size);
+        input.read(text, size);
+
+        document.ParseInsitu(text);
+        if (document.HasParseError())
+            throw std::runtime_error("Failed to parse " + path.string());
+
+        arena.record_pool_use(allocator.Capacity());
     }
 
     gltf_model result;
@@ -43,7 +128,11 @@ gltf_model load_gltf(std::filesystem::path const & path)
     auto parse_buffer_view = [&](int index) -> gltf_model::buffer_view
     {
         auto view = document["bufferViews"].GetArray()[index].GetObject();
-        return {view["byteOffset"].GetUint(), view["byteLength"].GetUint()};
+        return {
+            view.HasMember("byteOffset") ? view["byteOffset"].GetUint() : 0u,
+            view["byteLength"].GetUint(),
+            view.HasMember("byteStride") ? view["byteStride"].GetUint() : 0u,
+        };
     };
 
     auto parse_accessor = [&](int index) -> gltf_model::accessor
@@ -54,6 +143,8 @@ gltf_model load_gltf(std::filesystem::path const & path)
             accessor["componentType"].GetUint(),
             attribute_type_to_size(accessor["type"].GetString()),
             accessor["count"].GetUint(),
+            accessor.HasMember("byteOffset") ? accessor["byteOffset"].GetUint() : 0u,
+            accessor.HasMember("normalized") && accessor["normalized"].GetBool(),
         };
     };
 
@@ -105,6 +196,9 @@ gltf_model load_gltf(std::filesystem::path const & path)
         result_mesh.position = parse_accessor(attributes["POSITION"].GetInt());
         result_mesh.normal = parse_accessor(attributes["NORMAL"].GetInt());
         result_mesh.texcoord = parse_accessor(attributes["TEXCOORD_0"].GetInt());
+        result_mesh.tangent = attributes.HasMember("TANGENT")
+            ? parse_accessor(attributes["TANGENT"].GetInt())
+            : generate_tangent_accessor(result, result_mesh);
 
         std::tie(result_mesh.min, result_mesh.max) = parse_bounds(attributes["POSITION"].GetInt());
 
@@ -18,6 +18,8 @@ struct gltf_model
     {
         unsigned int offset;
         unsigned int size;
+        // 0 means tightly packed
+        unsigned int stride;
     };
 
     struct accessor
@@ -26,6 +28,11 @@ struct gltf_model
         unsigned int type;
         unsigned int size;
         unsigned int count;
+        // Relative to the start of the buffer view
+        unsigned int offset;
+        bool normalized;
+
+        unsigned int buffer_offset() const { return view.offset + offset; }
     };
 
     struct material
@@ -46,6 +53,8 @@ struct gltf_model
         accessor position;
         accessor normal;
         accessor texcoord;
+        // Generated into the end of the buffer when the file has no TANGENT
+        accessor tangent;
 
         glm::vec3 min;
         glm::vec3 max;
@@ -0,0 +1,210 @@
+#include "gpu_culling.hpp"
+
+#include <stdexcept>
+#include <string>
+#include <cstddef>
+
+namespace
+{
+
+	constexpr GLuint group_size = 64;
+
+	// The layout glMultiDrawElementsIndirect reads, 20 bytes with no padding in std430 too
+	struct indirect_command
+	{
+		GLuint count;
+		GLuint instance_count;
+		GLuint first_index;
+		GLint base_vertex;
+		GLuint base_instance;
+	};
+
+	static_assert(sizeof(indirect_command) == 20);
+	static_assert(sizeof(gpu_culler::box) == 32);
+
+	const char box_declarations[] =
+R"(#version 430 core
+
+layout (local_size_x = 64) in;
+
+struct box
+{
+	vec3 min;
+	uint command;
+	vec3 max;
+	uint object;
+};
+)";
+
+	// The box corner furthest along each plane normal decides, as in cull_aabbs()
+	const char cull_shader_source[] =
+R"(
+struct draw_command
+{
+	uint count;
+	uint instance_count;
+	uint first_index;
+	int base_vertex;
+	uint base_instance;
+};
+
+uniform vec4 planes[6];
+uniform uint box_count;
+
+layout (std430, binding = 0) readonly buffer boxes_buffer { box boxes[]; };
+layout (std430, binding = 1) buffer commands_buffer { draw_command commands[]; };
+layout (std430, binding = 2) writeonly buffer visible_buffer { uint visible[]; };
+
+void main()
+{
+	uint i = gl_GlobalInvocationID.x;
+	if (i >= box_count)
+		return;
+
+	box b = boxes[i];
+	for (int p = 0; p < 6; ++p)
+	{
+		vec3 furthest = mix(b.min, b.max, greaterThanEqual(planes[p].xyz, vec3(0.0)));
+		if (dot(planes[p].xyz, furthest) + planes[p].w < 0.0)
+			return;
+	}
+
+	uint slot = atomicAdd(commands[b.command].instance_count, 1u);
+	visible[commands[b.command].base_instance + slot] = b.object;
+}
+)";
+
+	const char scatter_shader_source[] =
+R"(
+uniform uint update_count;
+
+layout (std430, binding = 0) writeonly buffer boxes_buffer { box boxes[]; };
+layout (std430, binding = 1) readonly buffer updates_buffer { box updates[]; };
+
+void main()
+{
+	uint i = gl_GlobalInvocationID.x;
+	if (i < update_count)
+		boxes[updates[i].object] = updates[i];
+}
+)";
+
+	GLuint group_count(std::size_t invocations)
+	{
+		return (invocations + group_size - 1) / group_size;
+	}
+
+}
+
+bool gpu_culler::supported()
+{
+	return GLEW_VERSION_4_3;
+}
+
+gpu_culler::gpu_culler(program_cache & programs)
+{
+	if (!supported())
+		throw std::runtime_error("GPU culling needs OpenGL 4.3");
+
+	cull_program_ = programs.get({{GL_COMPUTE_SHADER, std::string(box_declarations) + cull_shader_source}});
+	scatter_program_ = programs.get({{GL_COMPUTE_SHADER, std::string(box_declarations) + scatter_shader_source}});
+
+	planes_location_ = glGetUniformLocation(cull_program_, "planes");
+	box_count_location_ = glGetUniformLocation(cull_program_, "box_count");
+	update_count_location_ = glGetUniformLocation(scatter_program_, "update_count");
+
+	glGenBuffers(1, &box_buffer_);
+	glGenBuffers(1, &update_buffer_);
+	glGenBuffers(1, &command_template_buffer_);
+	glGenBuffers(1, &command_buffer_);
+}
+
+gpu_culler::~gpu_culler()
+{
+	glDeleteBuffers(1, &box_buffer_);
+	glDeleteBuffers(1, &update_buffer_);
+	glDeleteBuffers(1, &command_template_buffer_);
+	glDeleteBuffers(1, &command_buffer_);
+}
+
+void gpu_culler::set_boxes(std::vector<command> const & commands, std::vector<box> const & boxes)
+{
+	// Each command gets room for all of its boxes, so the atomics never overflow its range
+	std::vector<indirect_command> indirect(commands.size());
+	for (std::size_t i = 0; i < commands.size(); ++i)
+		indirect[i] = {commands[i].index_count, 0, commands[i].first_index, commands[i].base_vertex, 0};
+	for (std::size_t i = 0; i < boxes.size(); ++i)
+	{
+		if (boxes[i].command >= commands.size() || boxes[i].object != i)
+			throw std::runtime_error("Box " + std::to_string(i) + " has an invalid command or object");
+		++indirect[boxes[i].command].instance_count;
+	}
+
+	GLuint first_instance = 0;
+	for (auto & c : indirect)
+	{
+		c.base_instance = first_instance;
+		first_instance += c.instance_count;
+		c.instance_count = 0;
+	}
+
+	box_count_ = boxes.size();
+	command_count_ = commands.size();
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, box_buffer_);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, boxes.size() * sizeof(box), boxes.data(), GL_DYNAMIC_DRAW);
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, command_template_buffer_);
+	glBufferData(GL_COPY_WRITE_BUFFER, indirect.size() * sizeof(indirect_command), indirect.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, command_buffer_);
+	glBufferData(GL_COPY_WRITE_BUFFER, indirect.size() * sizeof(indirect_command), indirect.data(), GL_DYNAMIC_COPY);
+}
+
+void gpu_culler::update(std::vector<box> const & changed)
+{
+	if (changed.empty())
+		return;
+
+	// Orphaned, since last frame's scatter may still read it
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, update_buffer_);
+	if (changed.size() > update_capacity_)
+		update_capacity_ = changed.size();
+	glBufferData(GL_SHADER_STORAGE_BUFFER, update_capacity_ * sizeof(box), nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, changed.size() * sizeof(box), changed.data());
+
+	glUseProgram(scatter_program_);
+	glUniform1ui(update_count_location_, changed.size());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, box_buffer_);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, update_buffer_);
+	glDispatchCompute(group_count(changed.size()), 1, 1);
+
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void gpu_culler::cull(std::array<glm::vec4, 6> const & planes, GLuint output)
+{
+	glBindBuffer(GL_COPY_READ_BUFFER, command_template_buffer_);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, command_buffer_);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, command_count_ * sizeof(indirect_command));
+
+	if (box_count_ == 0)
+		return;
+
+	glUseProgram(cull_program_);
+	glUniform4fv(planes_location_, planes.size(), reinterpret_cast<float const *>(planes.data()));
+	glUniform1ui(box_count_location_, box_count_);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, box_buffer_);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, command_buffer_);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, output);
+	glDispatchCompute(group_count(box_count_), 1, 1);
+
+	// The draws read the commands as indirect parameters and the output as instanced attributes
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+void gpu_culler::draw(std::size_t first, std::size_t count, GLenum index_type) const
+{
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer_);
+	glMultiDrawElementsIndirect(GL_TRIANGLES, index_type, reinterpret_cast<void const *>(first * sizeof(indirect_command)), count, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "program_cache.hpp"
+
+#include <GL/glew.h>
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+// Frustum culling done entirely on the GPU: a compute shader tests every box against the
+// planes and appends the survivors of each draw command with atomics, building the
+// DrawElementsIndirectCommand records the draws read their instance counts from, so the
+// CPU never learns the visible set. Needs OpenGL 4.3.
+struct gpu_culler
+{
+	// One indirect draw: the instances of the boxes with this command index
+	struct command
+	{
+		// In indices, not bytes
+		GLuint index_count;
+		GLuint first_index;
+		GLint base_vertex;
+	};
+
+	// Boxes are indexed by object, and object is what the output gets for the visible ones
+	struct box
+	{
+		glm::vec3 min;
+		std::uint32_t command;
+		glm::vec3 max;
+		std::uint32_t object;
+	};
+
+	static bool supported();
+
+	// The programs are owned by the cache
+	explicit gpu_culler(program_cache & programs);
+	~gpu_culler();
+
+	gpu_culler(gpu_culler const &) = delete;
+	gpu_culler & operator = (gpu_culler const &) = delete;
+
+	// Replaces all of the boxes. Each command's visible objects go to the output from its
+	// first instance on, the commands one after another in order.
+	void set_boxes(std::vector<command> const & commands, std::vector<box> const & boxes);
+
+	// Scatters the boxes over the ones of the same objects on the GPU
+	void update(std::vector<box> const & changed);
+
+	// Planes as in frustum::planes. output must hold as many indices as there are boxes
+	void cull(std::array<glm::vec4, 6> const & planes, GLuint output);
+
+	// With a VAO bound whose instanced attribute reads the output of cull(); one call for
+	// count consecutive commands, usually of the same material
+	void draw(std::size_t first, std::size_t count, GLenum index_type) const;
+
+private:
+	std::size_t box_count_ = 0;
+	std::size_t command_count_ = 0;
+	std::size_t update_capacity_ = 0;
+
+	GLuint cull_program_ = 0;
+	GLuint scatter_program_ = 0;
+
+	GLuint box_buffer_ = 0;
+	GLuint update_buffer_ = 0;
+	// Commands with zero instances, copied over the live ones before each cull
+	GLuint command_template_buffer_ = 0;
+	GLuint command_buffer_ = 0;
+
+	GLint planes_location_ = -1;
+	GLint box_count_location_ = -1;
+	GLint update_count_location_ = -1;
+};
@@ -0,0 +1,355 @@
+#include "hiz.hpp"
+
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+namespace
+{
+
+	const char fullscreen_vertex_shader_source[] =
+R"(#version 330 core
+
+void main()
+{
+	vec2 position = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 4.0 - 1.0;
+	gl_Position = vec4(position, 0.0, 1.0);
+}
+)";
+
+	const char copy_fragment_shader_source[] =
+R"(#version 330 core
+
+uniform sampler2D depth;
+
+layout (location = 0) out float out_depth;
+
+void main()
+{
+	out_depth = texelFetch(depth, ivec2(gl_FragCoord.xy), 0).r;
+}
+)";
+
+	// Odd sizes fold the last row or column into the previous texel, so every
+	// source texel is covered by some texel of the next level
+	const char reduce_fragment_shader_source[] =
+R"(#version 330 core
+
+uniform sampler2D source;
+uniform int source_level;
+uniform ivec2 source_size;
+
+layout (location = 0) out float out_depth;
+
+float fetch(ivec2 p)
+{
+	return texelFetch(source, min(p, source_size - 1), source_level).r;
+}
+
+void main()
+{
+	ivec2 p = ivec2(gl_FragCoord.xy) * 2;
+
+	float depth = max(max(fetch(p), fetch(p + ivec2(1, 0))), max(fetch(p + ivec2(0, 1)), fetch(p + ivec2(1, 1))));
+
+	bool extra_column = (source_size.x & 1) == 1 && p.x + 3 == source_size.x;
+	bool extra_row = (source_size.y & 1) == 1 && p.y + 3 == source_size.y;
+
+	if (extra_column)
+		depth = max(depth, max(fetch(p + ivec2(2, 0)), fetch(p + ivec2(2, 1))));
+	if (extra_row)
+		depth = max(depth, max(fetch(p + ivec2(0, 2)), fetch(p + ivec2(1, 2))));
+	if (extra_column && extra_row)
+		depth = max(depth, fetch(p + ivec2(2, 2)));
+
+	out_depth = depth;
+}
+)";
+
+	const char test_vertex_shader_source[] =
+R"(#version 330 core
+
+layout (location = 0) in vec3 in_min;
+layout (location = 1) in vec3 in_max;
+layout (location = 2) in uint in_object;
+
+out vec3 box_min;
+out vec3 box_max;
+flat out uint box_object;
+
+void main()
+{
+	box_min = in_min;
+	box_max = in_max;
+	box_object = in_object;
+}
+)";
+
+	// Picks the pyramid level where the projected box spans at most two texels
+	// in each direction, so the four texels under its corners cover it
+	const char test_geometry_shader_source[] =
+R"(#version 330 core
+
+layout (points) in;
+layout (points, max_vertices = 1) out;
+
+uniform mat4 view_projection;
+uniform sampler2D pyramid;
+uniform vec2 viewport_size;
+uniform int level_count;
+
+in vec3 box_min[];
+in vec3 box_max[];
+flat in uint box_object[];
+
+flat out uint visible_object;
+
+void main()
+{
+	vec2 rect_min = vec2(1.0);
+	vec2 rect_max = vec2(-1.0);
+	float nearest = 1.0;
+	bool visible = false;
+
+	for (int i = 0; i < 8; ++i)
+	{
+		vec3 corner = mix(box_min[0], box_max[0], vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+		vec4 p = view_projection * vec4(corner, 1.0);
+
+		// Boxes crossing the near plane are kept
+		if (p.w <= 0.0)
+		{
+			visible = true;
+			break;
+		}
+
+		vec3 ndc = p.xyz / p.w;
+		rect_min = min(rect_min, ndc.xy);
+		rect_max = max(rect_max, ndc.xy);
+		nearest = min(nearest, ndc.z * 0.5 + 0.5);
+	}
+
+	if (!visible)
+	{
+		rect_min = clamp(rect_min * 0.5 + 0.5, 0.0, 1.0);
+		rect_max = clamp(rect_max * 0.5 + 0.5, 0.0, 1.0);
+
+		vec2 size = (rect_max - rect_min) * viewport_size;
+		float level = clamp(ceil(log2(max(max(size.x, size.y), 1.0))), 0.0, float(level_count - 1));
+
+		float farthest = max(
+			max(textureLod(pyramid, rect_min, level).r, textureLod(pyramid, vec2(rect_max.x, rect_min.y), level).r),
+			max(textureLod(pyramid, vec2(rect_min.x, rect_max.y), level).r, textureLod(pyramid, rect_max, level).r));
+
+		visible = nearest <= farthest;
+	}
+
+	if (visible)
+	{
+		visible_object = box_object[0];
+		EmitVertex();
+		EndPrimitive();
+	}
+}
+)";
+
+}
+
+hiz_culler::hiz_culler(program_cache & programs, int width, int height)
+{
+	copy_program_ = programs.get({{GL_VERTEX_SHADER, fullscreen_vertex_shader_source}, {GL_FRAGMENT_SHADER, copy_fragment_shader_source}});
+	reduce_program_ = programs.get({{GL_VERTEX_SHADER, fullscreen_vertex_shader_source}, {GL_FRAGMENT_SHADER, reduce_fragment_shader_source}});
+	test_program_ = programs.get({
+		{GL_VERTEX_SHADER, test_vertex_shader_source},
+		{GL_GEOMETRY_SHADER, test_geometry_shader_source},
+	}, {"visible_object"});
+
+	glGenVertexArrays(1, &fullscreen_vao_);
+
+	glGenBuffers(1, &candidate_vbo_);
+	glGenVertexArrays(1, &candidate_vao_);
+	glBindVertexArray(candidate_vao_);
+	glBindBuffer(GL_ARRAY_BUFFER, candidate_vbo_);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(candidate), reinterpret_cast<void *>(offsetof(candidate, min)));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(candidate), reinterpret_cast<void *>(offsetof(candidate, max)));
+	glEnableVertexAttribArray(2);
+	glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(candidate), reinterpret_cast<void *>(offsetof(candidate, object)));
+
+	for (auto & result : results_)
+	{
+		glGenBuffers(1, &result.buffer);
+		glGenQueries(1, &result.query);
+	}
+
+	glGenFramebuffers(1, &depth_fbo_);
+	glGenFramebuffers(1, &pyramid_fbo_);
+	glGenTextures(1, &depth_texture_);
+	glGenTextures(1, &pyramid_texture_);
+
+	resize(width, height);
+}
+
+void hiz_culler::resize(int width, int height)
+{
+	width_ = std::max(1, width);
+	height_ = std::max(1, height);
+	level_count_ = 1 + static_cast<int>(std::floor(std::log2(std::max(width_, height_))));
+
+	glBindTexture(GL_TEXTURE_2D, depth_texture_);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width_, height_, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depth_fbo_);
+	glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_texture_, 0);
+	glDrawBuffer(GL_NONE);
+	if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		throw std::runtime_error("Incomplete Hi-Z depth framebuffer");
+
+	glBindTexture(GL_TEXTURE_2D, pyramid_texture_);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level_count_ - 1);
+	for (int level = 0; level < level_count_; ++level)
+		glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, std::max(1, width_ >> level), std::max(1, height_ >> level), 0, GL_RED, GL_FLOAT, nullptr);
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+void hiz_culler::build_pyramid()
+{
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	glDisable(GL_CULL_FACE);
+
+	glBindVertexArray(fullscreen_vao_);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, pyramid_fbo_);
+	glActiveTexture(GL_TEXTURE0);
+
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramid_texture_, 0);
+	glViewport(0, 0, width_, height_);
+	glUseProgram(copy_program_);
+	glUniform1i(glGetUniformLocation(copy_program_, "depth"), 0);
+	glBindTexture(GL_TEXTURE_2D, depth_texture_);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	glUseProgram(reduce_program_);
+	glUniform1i(glGetUniformLocation(reduce_program_, "source"), 0);
+	GLint const source_level_location = glGetUniformLocation(reduce_program_, "source_level");
+	GLint const source_size_location = glGetUniformLocation(reduce_program_, "source_size");
+	glBindTexture(GL_TEXTURE_2D, pyramid_texture_);
+
+	for (int level = 1; level < level_count_; ++level)
+	{
+		// Restrict sampling to the source level, so reading and writing never overlap
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+
+		int const w = std::max(1, width_ >> level);
+		int const h = std::max(1, height_ >> level);
+
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramid_texture_, level);
+		glViewport(0, 0, w, h);
+		glUniform1i(source_level_location, level - 1);
+		glUniform2i(source_size_location, std::max(1, width_ >> (level - 1)), std::max(1, height_ >> (level - 1)));
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level_count_ - 1);
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glViewport(0, 0, width_, height_);
+}
+
+std::size_t hiz_culler::cull(glm::mat4 const & view_projection, std::vector<candidate> const & candidates, GLuint output)
+{
+	if (candidates.empty())
+		return 0;
+
+	glBindBuffer(GL_ARRAY_BUFFER, candidate_vbo_);
+	glBufferData(GL_ARRAY_BUFFER, candidates.size() * sizeof(candidate), candidates.data(), GL_STREAM_DRAW);
+
+	glUseProgram(test_program_);
+	glUniformMatrix4fv(glGetUniformLocation(test_program_, "view_projection"), 1, GL_FALSE, reinterpret_cast<float const *>(&view_projection));
+	glUniform1i(glGetUniformLocation(test_program_, "pyramid"), 0);
+	glUniform2f(glGetUniformLocation(test_program_, "viewport_size"), width_, height_);
+	glUniform1i(glGetUniformLocation(test_program_, "level_count"), level_count_);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, pyramid_texture_);
+
+	// The slot written now is the oldest; it is only still pending if the GPU is a whole ring behind
+	auto & current = results_[next_result_];
+	if (current.pending)
+		read_result(next_result_);
+
+	if (current.capacity < candidates.size())
+	{
+		current.capacity = candidates.size();
+		glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, current.buffer);
+		glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, current.capacity * sizeof(std::uint32_t), nullptr, GL_DYNAMIC_COPY);
+	}
+
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, current.buffer);
+	glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, current.query);
+	glBeginTransformFeedback(GL_POINTS);
+
+	glBindVertexArray(candidate_vao_);
+	glDrawArrays(GL_POINTS, 0, candidates.size());
+
+	glEndTransformFeedback();
+	glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	glDisable(GL_RASTERIZER_DISCARD);
+
+	current.pending = true;
+	std::size_t const submitted = next_result_;
+	next_result_ = (next_result_ + 1) % results_.size();
+
+	// Oldest first, so the newest finished test wins
+	for (std::size_t i = 0; i < results_.size(); ++i)
+	{
+		std::size_t const slot = (next_result_ + i) % results_.size();
+		if (!results_[slot].pending)
+			continue;
+
+		GLuint available = GL_FALSE;
+		glGetQueryObjectuiv(results_[slot].query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available != GL_TRUE)
+			break;
+		read_result(slot);
+	}
+
+	// Nothing older to fall back on: this is the first test, or the GPU was a whole ring behind
+	// and the result read before reusing the slot has just been overwritten
+	if (!latest_result_ || (*latest_result_ == submitted && current.pending))
+		read_result(submitted);
+
+	auto const & latest = results_[*latest_result_];
+	if (latest.written > 0)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, latest.buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, output);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, latest.written * sizeof(std::uint32_t));
+	}
+	return latest.written;
+}
+
+void hiz_culler::read_result(std::size_t slot)
+{
+	auto & result = results_[slot];
+	GLuint written = 0;
+	glGetQueryObjectuiv(result.query, GL_QUERY_RESULT, &written);
+	result.written = written;
+	result.pending = false;
+	latest_result_ = slot;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "program_cache.hpp"
+
+#include <GL/glew.h>
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <array>
+#include <optional>
+#include <vector>
+#include <cstdint>
+
+// Occlusion culling against a hierarchical depth buffer, done on the GPU: the caller
+// renders occluder depth into depth_framebuffer(), build_pyramid() reduces it into a
+// mip chain of farthest depths, and cull() tests boxes against that chain with
+// transform feedback, writing the object indices of the boxes that pass into an instance buffer.
+// The number written is read back a frame or two later, when its query is available, so the
+// test results reach the instance buffer that much late instead of stalling the CPU on the GPU.
+struct hiz_culler
+{
+	struct candidate
+	{
+		glm::vec3 min;
+		glm::vec3 max;
+		std::uint32_t object;
+	};
+
+	// The programs are owned by the cache
+	hiz_culler(program_cache & programs, int width, int height);
+
+	hiz_culler(hiz_culler const &) = delete;
+	hiz_culler & operator = (hiz_culler const &) = delete;
+
+	void resize(int width, int height);
+
+	// Depth only, same size as the viewport
+	GLuint depth_framebuffer() const { return depth_fbo_; }
+
+	void build_pyramid();
+
+	// Copies into output the indices of the newest test whose result is available, which is
+	// this one only if the GPU has caught up, and returns how many there are. output must hold
+	// as many indices as there were candidates in the last few calls. Waits for the GPU only on
+	// the first call, or when the newest result is a whole ring of calls old.
+	std::size_t cull(glm::mat4 const & view_projection, std::vector<candidate> const & candidates, GLuint output);
+
+private:
+	// One test in flight: its indices and the query counting them
+	struct result
+	{
+		GLuint buffer = 0;
+		GLuint query = 0;
+		std::size_t capacity = 0;
+		std::size_t written = 0;
+		bool pending = false;
+	};
+
+	// Waits for the slot's query if it is not available yet
+	void read_result(std::size_t slot);
+
+	int width_ = 0;
+	int height_ = 0;
+	int level_count_ = 0;
+
+	GLuint depth_fbo_ = 0;
+	GLuint depth_texture_ = 0;
+
+	GLuint pyramid_fbo_ = 0;
+	GLuint pyramid_texture_ = 0;
+
+	GLuint copy_program_ = 0;
+	GLuint reduce_program_ = 0;
+	GLuint test_program_ = 0;
+
+	GLuint fullscreen_vao_ = 0;
+	GLuint candidate_vao_ = 0;
+	GLuint candidate_vbo_ = 0;
+
+	std::array<result, 3> results_;
+	std::size_t next_result_ = 0;
+	std::optional<std::size_t> latest_result_;
+};
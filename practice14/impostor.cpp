@@ -0,0 +1,413 @@
+#include "impostor.hpp"
+
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+#include <cmath>
+
+#include <glm/geometric.hpp>
+
+namespace
+{
+
+	// Shared by every impostor shader, so the bake and the draw agree on where each view looks from
+	const char common_shader_source[] =
+R"(#version 330 core
+
+// Six texels per object: its model matrix as a mat4x3, then its normal matrix
+uniform samplerBuffer object_transforms;
+
+mat4x3 object_model(int object)
+{
+	int base = object * 6;
+	vec4 t0 = texelFetch(object_transforms, base);
+	vec4 t1 = texelFetch(object_transforms, base + 1);
+	vec4 t2 = texelFetch(object_transforms, base + 2);
+	return mat4x3(t0.xyz, vec3(t0.w, t1.xy), vec3(t1.zw, t2.x), t2.yzw);
+}
+
+mat3 object_normal_matrix(int object)
+{
+	int base = object * 6;
+	return mat3(
+		texelFetch(object_transforms, base + 3).xyz,
+		texelFetch(object_transforms, base + 4).xyz,
+		texelFetch(object_transforms, base + 5).xyz);
+}
+
+vec2 sign_not_zero(vec2 v)
+{
+	return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// The octahedral map with +y in the middle of the square and -y folded out to its corners
+vec3 octahedral_direction(vec2 p)
+{
+	vec3 d = vec3(p.x, 1.0 - abs(p.x) - abs(p.y), p.y);
+	if (d.y < 0.0)
+		d.xz = (1.0 - abs(d.zx)) * sign_not_zero(d.xz);
+	return normalize(d);
+}
+
+vec2 octahedral_point(vec3 d)
+{
+	d /= abs(d.x) + abs(d.y) + abs(d.z);
+	vec2 p = d.xz;
+	if (d.y < 0.0)
+		p = (1.0 - abs(p.yx)) * sign_not_zero(p);
+	return p;
+}
+
+// From the mesh towards the camera that baked the cell
+vec3 cell_direction(ivec2 cell, int grid_size)
+{
+	return octahedral_direction((vec2(cell) + 0.5) / float(grid_size) * 2.0 - 1.0);
+}
+
+// Image axes of a view looking back along direction; right, up and direction are right-handed
+void view_axes(vec3 direction, out vec3 right, out vec3 up)
+{
+	vec3 reference = abs(direction.y) < 0.999 ? vec3(0.0, 1.0, 0.0) : vec3(0.0, 0.0, 1.0);
+	right = normalize(cross(reference, direction));
+	up = cross(direction, right);
+}
+)";
+
+	const char bake_vertex_shader_source[] =
+R"(
+uniform vec3 center;
+uniform float radius;
+uniform ivec2 cell;
+uniform int grid_size;
+
+layout (location = 0) in vec3 in_position;
+layout (location = 1) in vec3 in_normal;
+layout (location = 2) in vec2 in_texcoord;
+
+out vec3 normal;
+out vec2 texcoord;
+out float depth;
+
+// Orthographic over the bounding sphere, depth 0 where the sphere is nearest to the camera
+void main()
+{
+	vec3 direction = cell_direction(cell, grid_size);
+	vec3 right, up;
+	view_axes(direction, right, up);
+
+	vec3 p = in_position - center;
+	depth = (radius - dot(p, direction)) / (2.0 * radius);
+	gl_Position = vec4(dot(p, right) / radius, dot(p, up) / radius, depth * 2.0 - 1.0, 1.0);
+
+	normal = in_normal;
+	texcoord = in_texcoord;
+}
+)";
+
+	// Both targets are cleared to zero, so after filtering everything is premultiplied by coverage
+	const char bake_fragment_shader_source[] =
+R"(
+uniform sampler2D albedo;
+
+layout (location = 0) out vec4 out_albedo;
+layout (location = 1) out vec4 out_normal_depth;
+
+in vec3 normal;
+in vec2 texcoord;
+in float depth;
+
+void main()
+{
+	out_albedo = vec4(texture(albedo, texcoord).rgb, 1.0);
+	out_normal_depth = vec4(normalize(normal), depth);
+}
+)";
+
+	// The quad is built in object space, where the sphere and the rays from the camera are
+	// what they were at bake time, and is sized to cover the sphere's silhouette in perspective.
+	// The three views are the corners of the grid triangle that the camera direction falls in
+	const char draw_vertex_shader_source[] =
+R"(
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 camera_position;
+
+uniform vec3 center;
+uniform float radius;
+uniform int grid_size;
+
+uniform float fade_start;
+uniform float fade_end;
+
+layout (location = 0) in uint in_object;
+
+out vec3 position;
+flat out vec3 object_camera;
+flat out ivec2 cell0;
+flat out ivec2 cell1;
+flat out ivec2 cell2;
+flat out vec3 weights;
+flat out int object;
+flat out float fade;
+
+void main()
+{
+	object = int(in_object);
+	mat4x3 model = object_model(object);
+	object_camera = (inverse(mat4(model)) * vec4(camera_position, 1.0)).xyz;
+
+	vec3 to_camera = normalize(object_camera - center);
+	vec2 g = (octahedral_point(to_camera) * 0.5 + 0.5) * float(grid_size) - 0.5;
+	ivec2 base = ivec2(floor(g));
+	vec2 f = g - vec2(base);
+	if (f.x + f.y < 1.0)
+	{
+		cell0 = base;
+		cell1 = base + ivec2(1, 0);
+		cell2 = base + ivec2(0, 1);
+		weights = vec3(1.0 - f.x - f.y, f.x, f.y);
+	}
+	else
+	{
+		cell0 = base + ivec2(1, 1);
+		cell1 = base + ivec2(0, 1);
+		cell2 = base + ivec2(1, 0);
+		weights = vec3(f.x + f.y - 1.0, 1.0 - f.x, 1.0 - f.y);
+	}
+	cell0 = clamp(cell0, ivec2(0), ivec2(grid_size - 1));
+	cell1 = clamp(cell1, ivec2(0), ivec2(grid_size - 1));
+	cell2 = clamp(cell2, ivec2(0), ivec2(grid_size - 1));
+
+	float camera_distance = distance(object_camera, center);
+	float extent = radius * inversesqrt(max(1.0 - radius * radius / (camera_distance * camera_distance), 1e-4));
+
+	vec3 right, up;
+	view_axes(to_camera, right, up);
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+	position = center + (right * corner.x + up * corner.y) * extent;
+
+	vec3 world_center = model * vec4(center, 1.0);
+	fade = clamp((distance(camera_position, world_center) - fade_start) / max(fade_end - fade_start, 1e-4), 0.0, 1.0);
+
+	gl_Position = projection * view * vec4(model * vec4(position, 1.0), 1.0);
+}
+)";
+
+	// Each view is sampled where the ray through the fragment crosses its image plane, which
+	// keeps the parallax between views small; the depth it stores then puts the fragment back
+	// on the surface, so impostors intersect each other and the walls like meshes would
+	const char draw_fragment_shader_source[] =
+R"(
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 light_direction;
+
+uniform sampler2D albedo_atlas;
+uniform sampler2D normal_depth_atlas;
+
+uniform vec3 center;
+uniform float radius;
+uniform int grid_size;
+
+layout (location = 0) out vec4 out_color;
+
+in vec3 position;
+flat in vec3 object_camera;
+flat in ivec2 cell0;
+flat in ivec2 cell1;
+flat in ivec2 cell2;
+flat in vec3 weights;
+flat in int object;
+flat in float fade;
+
+vec4 albedo = vec4(0.0);
+vec3 normal = vec3(0.0);
+vec3 surface = vec3(0.0);
+
+// Interleaved gradient noise, the same pattern the mesh shader dissolves with
+float screen_door_noise()
+{
+	return fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+}
+
+void sample_view(ivec2 cell, float weight, vec3 ray)
+{
+	vec3 direction = cell_direction(cell, grid_size);
+	vec3 right, up;
+	view_axes(direction, right, up);
+
+	vec3 p = object_camera + ray * (dot(center - object_camera, direction) / dot(ray, direction)) - center;
+	vec2 uv = clamp(vec2(dot(p, right), dot(p, up)) / (2.0 * radius) + 0.5, 0.0, 1.0);
+	vec2 atlas_uv = (vec2(cell) + uv) / float(grid_size);
+
+	vec4 a = texture(albedo_atlas, atlas_uv);
+	vec4 n = texture(normal_depth_atlas, atlas_uv);
+
+	albedo += weight * a;
+	normal += weight * n.xyz;
+	surface += weight * (a.a * (center + p + direction * radius) - n.w * 2.0 * radius * direction);
+}
+
+void main()
+{
+	if (screen_door_noise() >= fade)
+		discard;
+
+	vec3 ray = position - object_camera;
+	sample_view(cell0, weights.x, ray);
+	sample_view(cell1, weights.y, ray);
+	sample_view(cell2, weights.z, ray);
+
+	if (albedo.a < 0.5)
+		discard;
+
+	vec4 clip = projection * view * vec4(object_model(object) * vec4(surface / albedo.a, 1.0), 1.0);
+	gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+
+	float ambient = 0.4;
+	float diffuse = max(0.0, dot(normalize(object_normal_matrix(object) * normal), light_direction));
+
+	out_color = vec4(albedo.rgb / albedo.a * (ambient + diffuse), 1.0);
+}
+)";
+
+	// Every stage starts with the common source, #version line included
+	shader_source with_common(GLenum type, const char * source)
+	{
+		return {type, std::string(common_shader_source) + source};
+	}
+
+	// Mips stop at one texel per cell, so filtering never mixes neighbouring views
+	GLuint create_atlas_texture(GLint internal_format, int size, int level_count)
+	{
+		GLuint result;
+		glGenTextures(1, &result);
+		glBindTexture(GL_TEXTURE_2D, result);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level_count - 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, internal_format, size, size, 0, GL_RGBA, GL_FLOAT, nullptr);
+		return result;
+	}
+
+}
+
+impostor_atlas::impostor_atlas(program_cache & programs, mesh_source const & mesh, int grid_size, int cell_size)
+	: grid_size_(grid_size)
+	, center_((mesh.min + mesh.max) / 2.f)
+	, radius_(std::max(1e-4f, glm::length(mesh.max - mesh.min) / 2.f))
+{
+	int const size = grid_size * cell_size;
+	int const level_count = 1 + static_cast<int>(std::floor(std::log2(cell_size)));
+
+	albedo_texture_ = create_atlas_texture(GL_RGBA8, size, level_count);
+	normal_depth_texture_ = create_atlas_texture(GL_RGBA16F, size, level_count);
+
+	GLuint depth_renderbuffer;
+	glGenRenderbuffers(1, &depth_renderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depth_renderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+
+	GLuint fbo;
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+	glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, albedo_texture_, 0);
+	glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, normal_depth_texture_, 0);
+	glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_renderbuffer);
+	GLenum const draw_buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+	glDrawBuffers(2, draw_buffers);
+	if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		throw std::runtime_error("Incomplete impostor bake framebuffer");
+
+	GLuint const bake_program = programs.get({
+		with_common(GL_VERTEX_SHADER, bake_vertex_shader_source),
+		with_common(GL_FRAGMENT_SHADER, bake_fragment_shader_source)});
+
+	glViewport(0, 0, size, size);
+	glClearColor(0.f, 0.f, 0.f, 0.f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	glEnable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	glDisable(GL_CULL_FACE);
+
+	glUseProgram(bake_program);
+	glUniform3fv(glGetUniformLocation(bake_program, "center"), 1, &center_[0]);
+	glUniform1f(glGetUniformLocation(bake_program, "radius"), radius_);
+	glUniform1i(glGetUniformLocation(bake_program, "grid_size"), grid_size_);
+	glUniform1i(glGetUniformLocation(bake_program, "albedo"), 0);
+	GLint const cell_location = glGetUniformLocation(bake_program, "cell");
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, mesh.albedo);
+	glBindVertexArray(mesh.vao);
+
+	for (int y = 0; y < grid_size_; ++y)
+	{
+		for (int x = 0; x < grid_size_; ++x)
+		{
+			glViewport(x * cell_size, y * cell_size, cell_size, cell_size);
+			glUniform2i(cell_location, x, y);
+			glDrawElements(GL_TRIANGLES, mesh.index_count, mesh.index_type, reinterpret_cast<void const *>(mesh.index_offset));
+		}
+	}
+
+	for (GLuint texture : {albedo_texture_, normal_depth_texture_})
+	{
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteRenderbuffers(1, &depth_renderbuffer);
+
+	draw_program_ = programs.get({
+		with_common(GL_VERTEX_SHADER, draw_vertex_shader_source),
+		with_common(GL_FRAGMENT_SHADER, draw_fragment_shader_source)});
+
+	glGenBuffers(1, &instance_vbo_);
+	glGenVertexArrays(1, &instance_vao_);
+	glBindVertexArray(instance_vao_);
+	glBindBuffer(GL_ARRAY_BUFFER, instance_vbo_);
+	glEnableVertexAttribArray(0);
+	glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, 0, nullptr);
+	glVertexAttribDivisor(0, 1);
+}
+
+void impostor_atlas::draw(glm::mat4 const & view, glm::mat4 const & projection, glm::vec3 const & camera_position, glm::vec3 const & light_direction,
+	GLuint object_transforms, std::vector<std::uint32_t> const & objects, float fade_start, float fade_end)
+{
+	if (objects.empty())
+		return;
+
+	glBindBuffer(GL_ARRAY_BUFFER, instance_vbo_);
+	glBufferData(GL_ARRAY_BUFFER, objects.size() * sizeof(objects[0]), objects.data(), GL_STREAM_DRAW);
+
+	glUseProgram(draw_program_);
+	glUniformMatrix4fv(glGetUniformLocation(draw_program_, "view"), 1, GL_FALSE, reinterpret_cast<float const *>(&view));
+	glUniformMatrix4fv(glGetUniformLocation(draw_program_, "projection"), 1, GL_FALSE, reinterpret_cast<float const *>(&projection));
+	glUniform3fv(glGetUniformLocation(draw_program_, "camera_position"), 1, &camera_position[0]);
+	glUniform3fv(glGetUniformLocation(draw_program_, "light_direction"), 1, &light_direction[0]);
+	glUniform3fv(glGetUniformLocation(draw_program_, "center"), 1, &center_[0]);
+	glUniform1f(glGetUniformLocation(draw_program_, "radius"), radius_);
+	glUniform1i(glGetUniformLocation(draw_program_, "grid_size"), grid_size_);
+	glUniform1f(glGetUniformLocation(draw_program_, "fade_start"), fade_start);
+	glUniform1f(glGetUniformLocation(draw_program_, "fade_end"), fade_end);
+	glUniform1i(glGetUniformLocation(draw_program_, "albedo_atlas"), 0);
+	glUniform1i(glGetUniformLocation(draw_program_, "normal_depth_atlas"), 1);
+	glUniform1i(glGetUniformLocation(draw_program_, "object_transforms"), 2);
+
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_BUFFER, object_transforms);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, normal_depth_texture_);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, albedo_texture_);
+
+	glBindVertexArray(instance_vao_);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, objects.size());
+}
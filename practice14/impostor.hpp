@@ -0,0 +1,61 @@
+#pragma once
+
+#include "program_cache.hpp"
+
+#include <GL/glew.h>
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <vector>
+#include <cstdint>
+
+// Octahedral impostors of one mesh. The mesh is rendered once, from grid_size x grid_size
+// directions spread over the sphere by an octahedral map, each view an orthographic square
+// around its bounding sphere, into an atlas of albedo with coverage and of object space
+// normals with depth. A distant instance is then one quad facing the camera that blends the
+// three views nearest to the direction it is seen from, lit and depth tested like the mesh.
+struct impostor_atlas
+{
+	// Attributes 0, 1 and 2 of vao are position, normal and texcoord, as the mesh is drawn
+	struct mesh_source
+	{
+		GLuint vao;
+		GLsizei index_count;
+		GLenum index_type;
+		std::size_t index_offset;
+		GLuint albedo;
+		glm::vec3 min;
+		glm::vec3 max;
+	};
+
+	// Bakes right away; leaves the default framebuffer bound and the viewport to the caller.
+	// The programs are owned by the cache
+	impostor_atlas(program_cache & programs, mesh_source const & mesh, int grid_size = 12, int cell_size = 128);
+
+	impostor_atlas(impostor_atlas const &) = delete;
+	impostor_atlas & operator = (impostor_atlas const &) = delete;
+
+	GLuint albedo_texture() const { return albedo_texture_; }
+	GLuint normal_depth_texture() const { return normal_depth_texture_; }
+
+	// Objects index object_transforms, laid out as for the mesh: six texels per object, the
+	// model matrix as a mat4x3, then the normal matrix. Between fade_start and fade_end from
+	// the camera an impostor dissolves in where the mesh dissolves out, with the same
+	// screen-door pattern, so the two cover each pixel exactly once
+	void draw(glm::mat4 const & view, glm::mat4 const & projection, glm::vec3 const & camera_position, glm::vec3 const & light_direction,
+		GLuint object_transforms, std::vector<std::uint32_t> const & objects, float fade_start, float fade_end);
+
+private:
+	int grid_size_ = 0;
+	glm::vec3 center_{0.f};
+	float radius_ = 0.f;
+
+	GLuint albedo_texture_ = 0;
+	GLuint normal_depth_texture_ = 0;
+
+	GLuint draw_program_ = 0;
+	GLuint instance_vao_ = 0;
+	GLuint instance_vbo_ = 0;
+	std::size_t instance_capacity_ = 0;
+};
@@ -14,8 +14,10 @@
 #include <chrono>
 #include <vector>
 #include <random>
-#include <map>
 #include <cmath>
+#include <algorithm>
+#include <optional>
+#include <cstring>
 
 #include <glm/vec3.hpp>
 #include <glm/mat4x4.hpp>
@@ -30,6 +32,21 @@
 #include "aabb.hpp"
 #include "frustum.hpp"
 #include "intersect.hpp"
+#include "culling.hpp"
+#include "bvh.hpp"
+#include "visibility_cache.hpp"
+#include "profiler.hpp"
+#include "hiz.hpp"
+#include "gpu_culling.hpp"
+#include "software_occlusion.hpp"
+#include "job_system.hpp"
+#include "impostor.hpp"
+#include "antialiasing.hpp"
+#include "dirty_range_buffer.hpp"
+#include "program_cache.hpp"
+#include "input_state.hpp"
+#include "replay_session.hpp"
+#include "obj_cache.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -49,22 +66,67 @@ void glew_fail(std::string_view message, GLenum error)
 const char vertex_shader_source[] =
 R"(#version 330 core
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+// Six texels per object: its model matrix as a mat4x3, then its normal matrix
+uniform samplerBuffer object_transforms;
+
+// For TAA: last frame's transforms and camera, to tell where a moving object was
+uniform bool write_motion;
+uniform samplerBuffer previous_object_transforms;
+uniform mat4 previous_view_projection;
+
 layout (location = 0) in vec3 in_position;
 layout (location = 1) in vec3 in_normal;
 layout (location = 2) in vec2 in_texcoord;
+layout (location = 3) in uint in_object;
+
+// Past fade_start from the camera the mesh dissolves into its impostor, gone by fade_end
+uniform vec3 camera_position;
+uniform vec3 center;
+uniform float fade_start;
+uniform float fade_end;
 
 out vec3 normal;
 out vec2 texcoord;
+flat out float fade;
+// Last frame's clip space position, and this frame's position seen by last frame's camera
+out vec4 previous_position;
+out vec4 unmoved_position;
+
+mat4x3 object_model(samplerBuffer transforms, int base)
+{
+    vec4 t0 = texelFetch(transforms, base);
+    vec4 t1 = texelFetch(transforms, base + 1);
+    vec4 t2 = texelFetch(transforms, base + 2);
+    return mat4x3(t0.xyz, vec3(t0.w, t1.xy), vec3(t1.zw, t2.x), t2.yzw);
+}
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(in_position, 1.0);
-    normal = mat3(model) * in_normal;
+    int base = int(in_object) * 6;
+    mat4x3 model = object_model(object_transforms, base);
+    mat3 normal_matrix = mat3(
+        texelFetch(object_transforms, base + 3).xyz,
+        texelFetch(object_transforms, base + 4).xyz,
+        texelFetch(object_transforms, base + 5).xyz);
+
+    vec4 world_position = vec4(model * vec4(in_position, 1.0), 1.0);
+    gl_Position = projection * view * world_position;
+    normal = normal_matrix * in_normal;
+
+    unmoved_position = vec4(0.0, 0.0, 0.0, 1.0);
+    previous_position = unmoved_position;
+    if (write_motion)
+    {
+        unmoved_position = previous_view_projection * world_position;
+        previous_position = previous_view_projection * vec4(object_model(previous_object_transforms, base) * vec4(in_position, 1.0), 1.0);
+    }
     texcoord = in_texcoord;
+
+    vec3 world_center = model * vec4(center, 1.0);
+    fade = clamp((distance(camera_position, world_center) - fade_start) / max(fade_end - fade_start, 1e-4), 0.0, 1.0);
 }
 )";
 
@@ -76,18 +138,73 @@ uniform sampler2D albedo;
 uniform vec3 light_direction;
 
 layout (location = 0) out vec4 out_color;
+// What the object moved on its own since last frame, in texture coordinates; the camera's
+// motion is left to TAA to reproject from depth
+layout (location = 1) out vec2 out_motion;
 
 in vec3 normal;
 in vec2 texcoord;
+flat in float fade;
+in vec4 previous_position;
+in vec4 unmoved_position;
+
+// Interleaved gradient noise, as in impostor.cpp: the mesh keeps the pixels its impostor drops
+float screen_door_noise()
+{
+    return fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+}
 
 void main()
 {
+    if (screen_door_noise() < fade)
+        discard;
+
     vec3 albedo_color = texture(albedo, texcoord).rgb;
 
     float ambient = 0.4;
     float diffuse = max(0.0, dot(normalize(normal), light_direction));
 
     out_color = vec4(albedo_color * (ambient + diffuse), 1.0);
+    out_motion = (previous_position.xy / previous_position.w - unmoved_position.xy / unmoved_position.w) * 0.5;
+}
+)";
+
+// Walls are lit with face normals taken from screen space derivatives; they come in world
+// space from the static batch
+const char wall_vertex_shader_source[] =
+R"(#version 330 core
+
+uniform mat4 view;
+uniform mat4 projection;
+
+layout (location = 0) in vec3 in_position;
+
+out vec3 position;
+
+void main()
+{
+    position = in_position;
+    gl_Position = projection * view * vec4(position, 1.0);
+}
+)";
+
+const char wall_fragment_shader_source[] =
+R"(#version 330 core
+
+uniform vec3 light_direction;
+
+layout (location = 0) out vec4 out_color;
+
+in vec3 position;
+
+void main()
+{
+    vec3 normal = normalize(cross(dFdx(position), dFdy(position)));
+
+    float ambient = 0.4;
+    float diffuse = max(0.0, dot(normal, light_direction));
+
+    out_color = vec4(vec3(0.6, 0.5, 0.4) * (ambient + diffuse), 1.0);
 }
 )";
 
@@ -130,8 +247,10 @@ GLuint create_program(Shaders ... shaders)
     return result;
 }
 
-int main() try
+int main(int argc, char ** argv) try
 {
+    replay_session replay(argc, argv);
+
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
         sdl2_fail("SDL_Init: ");
 
@@ -139,8 +258,25 @@ int main() try
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
     SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
-    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 1);
-    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 16);
+    // --aa none|msaa|fxaa|taa picks the antialiasing, MSAA by default. Only an MSAA window
+    // pays for a 16x multisampled framebuffer, and only it can switch back to MSAA with T
+    antialiasing_mode aa_mode = antialiasing_mode::msaa;
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (std::string_view(argv[i]) != "--aa")
+            continue;
+        auto const mode = parse_antialiasing_mode(argv[i + 1]);
+        if (!mode)
+            throw std::runtime_error(std::string("Unknown antialiasing mode ") + argv[i + 1]);
+        aa_mode = *mode;
+    }
+
+    bool const multisampled = (aa_mode == antialiasing_mode::msaa);
+    if (multisampled)
+    {
+        SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 1);
+        SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 16);
+    }
     SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8);
@@ -172,27 +308,265 @@ int main() try
     auto fragment_shader = create_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
     auto program = create_program(vertex_shader, fragment_shader);
 
-    GLuint model_location = glGetUniformLocation(program, "model");
     GLuint view_location = glGetUniformLocation(program, "view");
     GLuint projection_location = glGetUniformLocation(program, "projection");
     GLuint albedo_location = glGetUniformLocation(program, "albedo");
+    GLuint object_transforms_location = glGetUniformLocation(program, "object_transforms");
     GLuint color_location = glGetUniformLocation(program, "color");
     GLuint use_texture_location = glGetUniformLocation(program, "use_texture");
     GLuint light_direction_location = glGetUniformLocation(program, "light_direction");
     GLuint bones_location = glGetUniformLocation(program, "bones");
+    GLuint camera_position_location = glGetUniformLocation(program, "camera_position");
+    GLuint center_location = glGetUniformLocation(program, "center");
+    GLuint fade_start_location = glGetUniformLocation(program, "fade_start");
+    GLuint fade_end_location = glGetUniformLocation(program, "fade_end");
+    GLuint write_motion_location = glGetUniformLocation(program, "write_motion");
+    GLuint previous_object_transforms_location = glGetUniformLocation(program, "previous_object_transforms");
+    GLuint previous_view_projection_location = glGetUniformLocation(program, "previous_view_projection");
+
+    auto wall_program = create_program(
+        create_shader(GL_VERTEX_SHADER, wall_vertex_shader_source),
+        create_shader(GL_FRAGMENT_SHADER, wall_fragment_shader_source));
+
+    GLuint wall_view_location = glGetUniformLocation(wall_program, "view");
+    GLuint wall_projection_location = glGetUniformLocation(wall_program, "projection");
+    GLuint wall_light_direction_location = glGetUniformLocation(wall_program, "light_direction");
 
     const std::string project_root = PROJECT_ROOT;
     const std::string model_path = project_root + "/bunny/bunny.gltf";
 
-    auto const input_model = load_gltf(model_path);
+    // Programs of the culling, impostor and antialiasing passes
+    program_cache programs(project_root + "/.program_binaries");
+
+    auto input_model = load_gltf(model_path);
     GLuint vbo;
     glGenBuffers(1, &vbo);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
     glBufferData(GL_ARRAY_BUFFER, input_model.buffer.size(), input_model.buffer.data(), GL_STATIC_DRAW);
 
-    std::vector<GLuint> vaos;
-    for (int i = 0; i < input_model.meshes.size(); ++i)
+    // Culling only needs the mesh bounds and drawing the accessor offsets, so the CPU copy
+    // of the buffer goes as soon as it is uploaded
+    std::cout << "Model buffer: " << input_model.buffer.size() / 1024 << " KB released after upload" << std::endl;
+    input_model.buffer = {};
+
+    // World space bounds of the mesh bounds transformed by model
+    auto transform_bounds = [&](glm::mat4 const & model)
+    {
+        glm::vec3 const center = (input_model.meshes[0].min + input_model.meshes[0].max) / 2.f;
+        glm::vec3 const extent = (input_model.meshes[0].max - input_model.meshes[0].min) / 2.f;
+
+        glm::vec3 const world_center = model * glm::vec4(center, 1.f);
+        glm::vec3 world_extent(0.f);
+        for (int i = 0; i < 3; ++i)
+            world_extent += glm::abs(glm::vec3(model[i])) * extent[i];
+
+        return std::pair{world_center - world_extent, world_center + world_extent};
+    };
+
+    // A large field of bunnies, each turned and scaled on its own, culled against the view frustum every frame
+    int const grid_size = 200;
+    float const grid_spacing = 1.5f;
+
+    std::vector<glm::mat4> object_models;
+    aabb_soa object_bounds;
+    {
+        std::default_random_engine rng;
+        std::uniform_real_distribution<float> angle(0.f, 2.f * glm::pi<float>());
+        std::uniform_real_distribution<float> scale(0.7f, 1.3f);
+
+        for (int z = 0; z < grid_size; ++z)
+        {
+            for (int x = 0; x < grid_size; ++x)
+            {
+                glm::vec3 offset = glm::vec3(x - (grid_size - 1) / 2.f, 0.f, -z) * grid_spacing;
+                glm::mat4 model = glm::translate(glm::mat4(1.f), offset);
+                model = glm::rotate(model, angle(rng), {0.f, 1.f, 0.f});
+                model = glm::scale(model, {scale(rng), scale(rng), scale(rng)});
+
+                auto const [min, max] = transform_bounds(model);
+                object_models.push_back(model);
+                object_bounds.push_back(min, max);
+            }
+        }
+    }
+
+    // Transforms of all objects, indexed by the culling output in the shader
+    std::vector<glm::vec4> object_transform_texels(object_models.size() * 6);
+    auto write_object_transform = [&](std::size_t i)
+    {
+        glm::vec4 * texels = object_transform_texels.data() + i * 6;
+        glm::mat4x3 const model(object_models[i]);
+        std::memcpy(texels, &model, sizeof(model));
+
+        glm::mat3 const normal_matrix = glm::transpose(glm::inverse(glm::mat3(object_models[i])));
+        for (int c = 0; c < 3; ++c)
+            texels[3 + c] = glm::vec4(normal_matrix[c], 0.f);
+    };
+    for (std::size_t i = 0; i < object_models.size(); ++i)
+        write_object_transform(i);
+
+    // Only the bunnies that hop change their transforms, so only theirs are uploaded; every
+    // 7th object is too scattered for ranges, and with OpenGL 4.3 a compute pass places them.
+    // U switches to re-uploading all of the transforms every frame, for comparison
+    dirty_range_buffer object_transforms(programs, 6 * sizeof(glm::vec4), object_models.size(), object_transform_texels.data(), GL_DYNAMIC_DRAW, {});
+    GLuint const object_transforms_buffer = object_transforms.buffer();
+    bool dirty_uploads = true;
+
+    GLuint object_transforms_texture;
+    glGenTextures(1, &object_transforms_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, object_transforms_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, object_transforms_buffer);
+
+    // Last frame's transforms, copied on the GPU before they are replaced; only TAA reads them
+    GLuint previous_object_transforms_buffer;
+    glGenBuffers(1, &previous_object_transforms_buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, previous_object_transforms_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, object_transform_texels.size() * sizeof(object_transform_texels[0]), object_transform_texels.data(), GL_DYNAMIC_COPY);
+
+    GLuint previous_object_transforms_texture;
+    glGenTextures(1, &previous_object_transforms_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, previous_object_transforms_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, previous_object_transforms_buffer);
+
+    bvh scene_bvh;
+    scene_bvh.build(object_bounds);
+
+    // Every 7th bunny hops, so its bounds move and the hierarchy is refit
+    std::vector<std::uint32_t> hopping_objects;
+    for (std::uint32_t i = 0; i < object_models.size(); i += 7)
+        hopping_objects.push_back(i);
+
+    // Rows of walls with gaps between them, occluding most of the field behind them
+    std::vector<glm::mat4> walls;
+    for (int row = 0; row < 10; ++row)
+    {
+        for (int segment = 0; segment < 6; ++segment)
+        {
+            glm::vec3 const center{-125.f + 50.f * segment, 1.5f, -15.f - 30.f * row};
+            walls.push_back(glm::scale(glm::translate(glm::mat4(1.f), center), {40.f, 3.f, 0.5f}));
+        }
+    }
+
+    // The walls share a program and a material, so they are merged into one static batch in
+    // world space, cut into chunks of about a row's triangles that are culled on their own
+    static_batch walls_batch;
+    // The same boxes, rasterized on the CPU by the software occlusion culler
+    std::vector<software_occlusion::occluder> wall_occluders;
+    {
+        std::vector<obj_data::vertex> cube;
+        std::vector<std::uint32_t> cube_indices;
+        int const faces[6][4] = {{0, 2, 3, 1}, {4, 5, 7, 6}, {0, 1, 5, 4}, {2, 6, 7, 3}, {0, 4, 6, 2}, {1, 3, 7, 5}};
+        for (auto const & face : faces)
+        {
+            std::uint32_t const base = cube.size();
+            for (int i = 0; i < 4; ++i)
+            {
+                auto const corner = glm::vec3(face[i] & 1, (face[i] >> 1) & 1, (face[i] >> 2) & 1) - 0.5f;
+                cube.push_back({{corner.x, corner.y, corner.z}, {0.f, 0.f, 0.f}, {0.f, 0.f}});
+            }
+            for (int i : {0, 1, 2, 0, 2, 3})
+                cube_indices.push_back(base + i);
+        }
+
+        std::vector<static_batch_source> sources;
+        for (auto const & wall : walls)
+        {
+            auto & source = sources.emplace_back(static_batch_source{cube, cube_indices, {}, 0});
+            std::memcpy(source.transform.data(), &wall, sizeof(wall));
+
+            auto & occluder = wall_occluders.emplace_back();
+            occluder.indices = cube_indices;
+            occluder.min = glm::vec3(std::numeric_limits<float>::infinity());
+            occluder.max = glm::vec3(-std::numeric_limits<float>::infinity());
+            for (auto const & v : cube)
+            {
+                glm::vec3 const p = wall * glm::vec4(v.position[0], v.position[1], v.position[2], 1.f);
+                occluder.vertices.push_back(p);
+                occluder.min = glm::min(occluder.min, p);
+                occluder.max = glm::max(occluder.max, p);
+            }
+        }
+
+        static_batch_settings settings;
+        settings.chunk_triangles = 72;
+
+        auto batches = load_static_batches_cached(project_root + "/walls.batches", sources, settings);
+        walls_batch = std::move(batches.at(0));
+    }
+
+    // Which bunnies each cell of the space the camera moves in can see past the walls, baked on
+    // all cores the first time and cached next to the batches. A hopping bunny's box reaches up
+    // to the top of its hop, and bunnies past the far plane from a cell are left out of its set.
+    potentially_visible_sets field_visibility;
     {
+        std::vector<potentially_visible_sets::box> boxes;
+        for (std::size_t i = 0; i < object_bounds.size(); ++i)
+        {
+            boxes.push_back({
+                {object_bounds.min_x[i], object_bounds.min_y[i], object_bounds.min_z[i]},
+                {object_bounds.max_x[i], object_bounds.max_y[i], object_bounds.max_z[i]},
+            });
+        }
+        for (auto i : hopping_objects)
+            boxes[i].max[1] += 0.5f;
+
+        potentially_visible_settings settings;
+        settings.resolution = {32, 1, 32};
+        settings.ray_count = 16;
+        settings.max_distance = 100.f;
+
+        auto const start = std::chrono::high_resolution_clock::now();
+        field_visibility = load_potentially_visible_sets_cached(project_root + "/field.pvs", walls_batch.mesh, boxes,
+            {-160.f, 0.5f, -310.f}, {160.f, 4.5f, 10.f}, settings);
+        auto const end = std::chrono::high_resolution_clock::now();
+
+        std::cout << "Potentially visible sets: " << field_visibility.cell_count() << " cells, " << field_visibility.runs.size() / 1024 << " KB of runs for "
+            << field_visibility.cell_count() * field_visibility.object_count / 8 / 1024 << " KB of bitsets, loaded in "
+            << std::chrono::duration<double>(end - start).count() << " s" << std::endl;
+    }
+
+    aabb_soa wall_chunk_bounds;
+    for (auto const & chunk : walls_batch.mesh.submeshes)
+        wall_chunk_bounds.push_back(glm::vec3(chunk.min[0], chunk.min[1], chunk.min[2]), glm::vec3(chunk.max[0], chunk.max[1], chunk.max[2]));
+    std::vector<std::uint32_t> visible_wall_chunks;
+    std::vector<GLsizei> wall_draw_counts;
+    std::vector<void const *> wall_draw_offsets;
+
+    GLuint wall_vao, wall_vbo, wall_ebo;
+    glGenVertexArrays(1, &wall_vao);
+    glBindVertexArray(wall_vao);
+    glGenBuffers(1, &wall_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, wall_vbo);
+    glBufferData(GL_ARRAY_BUFFER, walls_batch.mesh.vertices.size() * sizeof(obj_data::vertex), walls_batch.mesh.vertices.data(), GL_STATIC_DRAW);
+    glGenBuffers(1, &wall_ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, wall_ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, walls_batch.mesh.indices.size() * sizeof(std::uint32_t), walls_batch.mesh.indices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), (void *)offsetof(obj_data::vertex, position));
+
+    // Indices of the objects to draw, one per instance
+    GLuint instance_vbo;
+    glGenBuffers(1, &instance_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, object_models.size() * sizeof(std::uint32_t), nullptr, GL_DYNAMIC_DRAW);
+
+    // What survived occlusion culling last frame, drawn as occluders this frame
+    GLuint previous_instance_vbo;
+    glGenBuffers(1, &previous_instance_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, previous_instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, object_models.size() * sizeof(std::uint32_t), nullptr, GL_DYNAMIC_COPY);
+    std::size_t previous_visible_count = 0;
+
+    std::vector<std::uint32_t> visible_objects;
+    std::vector<hiz_culler::candidate> occlusion_candidates;
+
+    // The same meshes with object indices read from either instance buffer
+    std::vector<GLuint> vaos, previous_vaos;
+    for (int i = 0; i < 2 * input_model.meshes.size(); ++i)
+    {
+        bool const previous = (i >= input_model.meshes.size());
+        auto const & mesh = input_model.meshes[i % input_model.meshes.size()];
+
         GLuint vao;
         glGenVertexArrays(1, &vao);
         glBindVertexArray(vao);
@@ -202,15 +576,20 @@ int main() try
         auto setup_attribute = [](int index, gltf_model::accessor const & accessor)
         {
             glEnableVertexAttribArray(index);
-            glVertexAttribPointer(index, accessor.size, accessor.type, GL_FALSE, 0, reinterpret_cast<void *>(accessor.view.offset));
+            glVertexAttribPointer(index, accessor.size, accessor.type, accessor.normalized ? GL_TRUE : GL_FALSE, accessor.view.stride, reinterpret_cast<void *>(accessor.buffer_offset()));
         };
 
         glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        setup_attribute(0, input_model.meshes[i].position);
-        setup_attribute(1, input_model.meshes[i].normal);
-        setup_attribute(2, input_model.meshes[i].texcoord);
+        setup_attribute(0, mesh.position);
+        setup_attribute(1, mesh.normal);
+        setup_attribute(2, mesh.texcoord);
+
+        glBindBuffer(GL_ARRAY_BUFFER, previous ? previous_instance_vbo : instance_vbo);
+        glEnableVertexAttribArray(3);
+        glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, 0, nullptr);
+        glVertexAttribDivisor(3, 1);
 
-        vaos.push_back(vao);
+        (previous ? previous_vaos : vaos).push_back(vao);
     }
 
     GLuint texture;
@@ -233,20 +612,112 @@ int main() try
         stbi_image_free(data);
     }
 
+    glm::vec3 const mesh_center = (input_model.meshes[0].min + input_model.meshes[0].max) / 2.f;
+
+    // Baked from the same VAO the bunnies are drawn with; the instance attribute goes unused
+    impostor_atlas bunny_impostor(programs, {
+        vaos[0],
+        static_cast<GLsizei>(input_model.meshes[0].indices.count),
+        input_model.meshes[0].indices.type,
+        input_model.meshes[0].indices.buffer_offset(),
+        texture,
+        input_model.meshes[0].min,
+        input_model.meshes[0].max,
+    });
+    glViewport(0, 0, width, height);
+
     auto last_frame_start = std::chrono::high_resolution_clock::now();
 
     float time = 0.f;
 
-    std::map<SDL_Keycode, bool> button_down;
+    input_state input;
 
     glm::vec3 camera_position{0.f, 1.5f, 3.f};
     float camera_rotation = 0.f;
 
     bool paused = false;
 
+    // B cycles through the culling methods. The GPU one, with OpenGL 4.3 only, draws every
+    // frustum culling survivor as a mesh: nothing on the CPU knows which they are, so it has
+    // no occlusion culling and no impostors
+    enum class culling_method
+    {
+        flat,
+        bvh,
+        coherent,
+        gpu,
+    };
+    culling_method method = culling_method::bvh;
+
+    std::optional<gpu_culler> compute_culler;
+    std::vector<gpu_culler::box> compute_culler_updates;
+    if (gpu_culler::supported())
+    {
+        auto const & mesh = input_model.meshes[0];
+        GLuint const index_size = mesh.indices.type == GL_UNSIGNED_INT ? 4 : mesh.indices.type == GL_UNSIGNED_SHORT ? 2 : 1;
+
+        std::vector<gpu_culler::box> boxes;
+        for (std::uint32_t i = 0; i < object_models.size(); ++i)
+        {
+            boxes.push_back({
+                {object_bounds.min_x[i], object_bounds.min_y[i], object_bounds.min_z[i]}, 0,
+                {object_bounds.max_x[i], object_bounds.max_y[i], object_bounds.max_z[i]}, i,
+            });
+        }
+
+        compute_culler.emplace(programs);
+        compute_culler->set_boxes({{static_cast<GLuint>(mesh.indices.count), static_cast<GLuint>(mesh.indices.buffer_offset() / index_size), 0}}, boxes);
+    }
+
+    visibility_cache coherent_culler;
+
+    // K cycles how many shadow cascades of the sun are culled along with the camera: none, 4 or
+    // 8, their visible lists only counted for now. With the BVH method M switches between one
+    // traversal for all of the views and one per view
+    int shadow_cascades = 4;
+    bool multi_view_culling = true;
+    std::vector<std::array<glm::vec4, 6>> cull_views;
+    std::vector<std::vector<std::uint32_t>> view_visible;
+
+    // O cycles occlusion culling of the frustum culling survivors: against last frame's
+    // survivors and the walls in a GPU depth pyramid, against the walls rasterized on the CPU
+    // this frame, by the potentially visible set of the camera's cell, or none. The set is
+    // taken before frustum culling, which then only tests its bunnies; outside the grid of cells
+    // nothing is occluded.
+    enum class occlusion_method
+    {
+        hiz,
+        software,
+        pvs,
+        none,
+    };
+    occlusion_method occlusion = occlusion_method::hiz;
+    std::optional<std::uint32_t> pvs_cell;
+    std::vector<std::uint32_t> pvs_objects;
+    hiz_culler occlusion_culler(programs, width, height);
+    software_occlusion software_occluder;
+    job_system jobs;
+
+    // I toggles impostors: bunnies past impostor_fade_start are drawn as impostors, and the
+    // mesh is kept until impostor_fade_end, crossfading in between
+    bool impostors = true;
+    float const impostor_fade_start = 25.f;
+    float const impostor_fade_end = 30.f;
+    std::vector<std::uint32_t> impostor_objects;
+
+    // T steps through the antialiasing modes
+    antialiasing_pass antialiasing(programs, width, height);
+    glm::mat4 previous_view_projection(1.f);
+    std::cout << "Antialiasing: " << to_string(aa_mode) << std::endl;
+
+    profiler frame_profiler;
+    float profile_print_time = 0.f;
+
     bool running = true;
     while (running)
     {
+        input.begin_frame();
+
         for (SDL_Event event; SDL_PollEvent(&event);) switch (event.type)
         {
         case SDL_QUIT:
@@ -258,93 +729,480 @@ int main() try
                 width = event.window.data1;
                 height = event.window.data2;
                 glViewport(0, 0, width, height);
+                occlusion_culler.resize(width, height);
+                antialiasing.resize(width, height);
                 break;
             }
             break;
         case SDL_KEYDOWN:
-            button_down[event.key.keysym.sym] = true;
+            input.handle_event(event);
             if (event.key.keysym.sym == SDLK_SPACE)
                 paused = !paused;
+            if (event.key.keysym.sym == SDLK_b)
+            {
+                method = static_cast<culling_method>((static_cast<int>(method) + 1) % (compute_culler ? 4 : 3));
+                previous_visible_count = 0;
+            }
+            if (event.key.keysym.sym == SDLK_o)
+            {
+                occlusion = static_cast<occlusion_method>((static_cast<int>(occlusion) + 1) % 4);
+                previous_visible_count = 0;
+            }
+            if (event.key.keysym.sym == SDLK_i)
+                impostors = !impostors;
+            if (event.key.keysym.sym == SDLK_u)
+            {
+                dirty_uploads = !dirty_uploads;
+                std::cout << "Transform uploads: " << (dirty_uploads ? "changed only" : "all") << std::endl;
+            }
+            if (event.key.keysym.sym == SDLK_k)
+            {
+                shadow_cascades = (shadow_cascades == 8) ? 0 : shadow_cascades + 4;
+                std::cout << "Shadow cascades culled: " << shadow_cascades << std::endl;
+            }
+            if (event.key.keysym.sym == SDLK_m)
+            {
+                multi_view_culling = !multi_view_culling;
+                std::cout << "Views culled in " << (multi_view_culling ? "one traversal" : "a traversal each") << std::endl;
+            }
+            if (event.key.keysym.sym == SDLK_t)
+            {
+                do
+                    aa_mode = static_cast<antialiasing_mode>((static_cast<int>(aa_mode) + 1) % 4);
+                while (aa_mode == antialiasing_mode::msaa && !multisampled);
+                antialiasing.reset_history();
+                std::cout << "Antialiasing: " << to_string(aa_mode) << std::endl;
+            }
             break;
         case SDL_KEYUP:
-            button_down[event.key.keysym.sym] = false;
+            input.handle_event(event);
             break;
         }
 
         if (!running)
             break;
 
+        if (!replay.update(input))
+            break;
+
+        frame_profiler.begin_frame();
+
         auto now = std::chrono::high_resolution_clock::now();
-        float dt = std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count();
+        float dt = replay.frame_time(std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count());
         last_frame_start = now;
 
         if (!paused)
             time += dt;
 
+        profile_print_time += dt;
+        if (profile_print_time >= 1.f)
+        {
+            frame_profiler.print_summary(std::cout);
+            profile_print_time = 0.f;
+        }
+
         float camera_move_forward = 0.f;
         float camera_move_sideways = 0.f;
 
-        if (button_down[SDLK_w])
+        if (input.down(SDL_SCANCODE_W))
             camera_move_forward -= 3.f * dt;
-        if (button_down[SDLK_s])
+        if (input.down(SDL_SCANCODE_S))
             camera_move_forward += 3.f * dt;
-        if (button_down[SDLK_a])
+        if (input.down(SDL_SCANCODE_A))
             camera_move_sideways -= 3.f * dt;
-        if (button_down[SDLK_d])
+        if (input.down(SDL_SCANCODE_D))
             camera_move_sideways += 3.f * dt;
 
-        if (button_down[SDLK_LEFT])
+        if (input.down(SDL_SCANCODE_LEFT))
             camera_rotation -= 3.f * dt;
-        if (button_down[SDLK_RIGHT])
+        if (input.down(SDL_SCANCODE_RIGHT))
             camera_rotation += 3.f * dt;
 
-        if (button_down[SDLK_DOWN])
+        if (input.down(SDL_SCANCODE_DOWN))
             camera_position.y -= 3.f * dt;
-        if (button_down[SDLK_UP])
+        if (input.down(SDL_SCANCODE_UP))
             camera_position.y += 3.f * dt;
 
         camera_position += camera_move_forward * glm::vec3(-std::sin(camera_rotation), 0.f, std::cos(camera_rotation));
         camera_position += camera_move_sideways * glm::vec3(std::cos(camera_rotation), 0.f, std::sin(camera_rotation));
 
-        glClearColor(0.8f, 0.8f, 1.f, 0.f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        glEnable(GL_DEPTH_TEST);
-
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
         float near = 0.1f;
         float far = 100.f;
 
-        glm::mat4 model(1.f);
-
         glm::mat4 view(1.f);
         view = glm::rotate(view, camera_rotation, {0.f, 1.f, 0.f});
         view = glm::translate(view, -camera_position);
 
         glm::mat4 projection = glm::perspective(glm::pi<float>() / 2.f, (1.f * width) / height, near, far);
 
+        // Culling and occlusion keep the plain projection, only the frame itself is jittered
+        bool const taa = (aa_mode == antialiasing_mode::taa);
+        glm::vec2 const jitter = taa ? antialiasing.next_jitter() : glm::vec2(0.f);
+        glm::mat4 const jittered_projection = antialiasing_pass::jittered(projection, jitter);
+
         glm::vec3 camera_position = (glm::inverse(view) * glm::vec4(0.f, 0.f, 0.f, 1.f)).xyz();
 
         glm::vec3 light_direction = glm::normalize(glm::vec3(1.f, 2.f, 3.f));
 
-        glUseProgram(program);
-        glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
-        glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
-        glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
-        glUniform3fv(light_direction_location, 1, reinterpret_cast<float *>(&light_direction));
+        for (auto i : hopping_objects)
+        {
+            object_models[i][3].y = std::abs(std::sin(3.f * time + i)) * 0.5f;
+            auto const [min, max] = transform_bounds(object_models[i]);
+            object_bounds.set(i, min, max);
+            write_object_transform(i);
+            object_transforms.mark(i);
+        }
+        scene_bvh.refit(object_bounds, hopping_objects);
 
-        glBindTexture(GL_TEXTURE_2D, texture);
+        // Kept current whichever method culls, so that switching to the GPU one needs no upload
+        if (compute_culler)
+        {
+            compute_culler_updates.clear();
+            for (auto i : hopping_objects)
+            {
+                compute_culler_updates.push_back({
+                    {object_bounds.min_x[i], object_bounds.min_y[i], object_bounds.min_z[i]}, 0,
+                    {object_bounds.max_x[i], object_bounds.max_y[i], object_bounds.max_z[i]}, i,
+                });
+            }
+            compute_culler->update(compute_culler_updates);
+        }
 
+        if (taa)
         {
-            auto const & mesh = input_model.meshes[0];
-            glBindVertexArray(vaos[0]);
-            glDrawElements(GL_TRIANGLES, mesh.indices.count, mesh.indices.type, reinterpret_cast<void *>(mesh.indices.view.offset));
+            glBindBuffer(GL_COPY_READ_BUFFER, object_transforms_buffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, previous_object_transforms_buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, object_transform_texels.size() * sizeof(object_transform_texels[0]));
         }
 
+        auto const transform_upload = dirty_uploads
+            ? object_transforms.flush(object_transform_texels.data())
+            : object_transforms.upload_all(object_transform_texels.data());
+        frame_profiler.counter("transform upload KB", transform_upload.bytes / 1024.0);
+        frame_profiler.counter("transform upload ranges", transform_upload.ranges);
+
+        frustum const view_frustum(projection * view);
+
+        // Cascades split the view distance between uniform and logarithmic, and each one is the
+        // sun's box around its slice of the camera frustum, reaching back towards the sun for casters
+        cull_views.assign(1, view_frustum.planes);
+        if (shadow_cascades > 0)
+        {
+            float const shadow_distance = 60.f;
+            float const caster_reach = 20.f;
+            glm::mat4 const light_view = glm::lookAt(glm::vec3(0.f), -light_direction, glm::vec3(0.f, 1.f, 0.f));
+
+            auto split = [&](int i)
+            {
+                float const t = float(i) / shadow_cascades;
+                return glm::mix(near + (shadow_distance - near) * t, near * std::pow(shadow_distance / near, t), 0.75f);
+            };
+
+            for (int c = 0; c < shadow_cascades; ++c)
+            {
+                glm::mat4 const to_light = light_view * glm::inverse(glm::perspective(glm::pi<float>() / 2.f, (1.f * width) / height, split(c), split(c + 1)) * view);
+
+                glm::vec3 min(std::numeric_limits<float>::infinity());
+                glm::vec3 max(-std::numeric_limits<float>::infinity());
+                for (int corner = 0; corner < 8; ++corner)
+                {
+                    glm::vec4 const p = to_light * glm::vec4(corner & 1 ? 1.f : -1.f, corner & 2 ? 1.f : -1.f, corner & 4 ? 1.f : -1.f, 1.f);
+                    min = glm::min(min, glm::vec3(p) / p.w);
+                    max = glm::max(max, glm::vec3(p) / p.w);
+                }
+
+                glm::mat4 const light_projection = glm::ortho(min.x, max.x, min.y, max.y, -max.z - caster_reach, -min.z);
+                cull_views.push_back(frustum(light_projection * light_view).planes);
+            }
+        }
+
+        visible_objects.clear();
+        view_visible.resize(cull_views.size());
+        for (auto & list : view_visible)
+            list.clear();
+
+        bool const gpu_culling = (method == culling_method::gpu);
+
+        auto const camera_cell = field_visibility.cell({camera_position.x, camera_position.y, camera_position.z});
+        bool const use_pvs = (occlusion == occlusion_method::pvs) && !gpu_culling && camera_cell;
+        if (use_pvs && camera_cell != pvs_cell)
+        {
+            pvs_objects.clear();
+            field_visibility.decode(*camera_cell, pvs_objects);
+            pvs_cell = camera_cell;
+        }
+
+        frame_profiler.begin_cpu("cull");
+        if (gpu_culling)
+        {
+            for (std::size_t v = 1; v < cull_views.size(); ++v)
+                scene_bvh.cull(cull_views[v], object_bounds, view_visible[v]);
+        }
+        else if (use_pvs)
+        {
+            cull_aabbs(view_frustum.planes, object_bounds, pvs_objects, visible_objects);
+            for (std::size_t v = 1; v < cull_views.size(); ++v)
+                scene_bvh.cull(cull_views[v], object_bounds, view_visible[v]);
+        }
+        else if (method == culling_method::bvh && multi_view_culling)
+        {
+            // The camera is view 0
+            std::swap(visible_objects, view_visible[0]);
+            scene_bvh.cull(cull_views, object_bounds, view_visible);
+            std::swap(visible_objects, view_visible[0]);
+        }
+        else
+        {
+            switch (method)
+            {
+            case culling_method::flat:
+                cull_aabbs(view_frustum.planes, object_bounds, visible_objects);
+                break;
+            case culling_method::bvh:
+                scene_bvh.cull(view_frustum.planes, object_bounds, visible_objects);
+                break;
+            case culling_method::gpu:
+                break;
+            case culling_method::coherent:
+                {
+                    auto const stats = coherent_culler.cull(view_frustum, object_bounds, visible_objects);
+                    frame_profiler.counter("plane tests", stats.plane_tests);
+                    frame_profiler.counter("axis tests", stats.axis_tests);
+                    frame_profiler.counter("rejected %", 100.0 * stats.rejected / std::max<std::size_t>(1, stats.objects));
+                    frame_profiler.counter("rejected first try %", 100.0 * stats.rejected_first_try / std::max<std::size_t>(1, stats.rejected));
+                }
+                break;
+            }
+
+            for (std::size_t v = 1; v < cull_views.size(); ++v)
+                scene_bvh.cull(cull_views[v], object_bounds, view_visible[v]);
+        }
+        frame_profiler.end_cpu();
+        if (use_pvs)
+            frame_profiler.counter("pvs", pvs_objects.size());
+        if (!gpu_culling)
+            frame_profiler.counter("visible", visible_objects.size());
+        if (shadow_cascades > 0)
+        {
+            std::size_t cascade_visible = 0;
+            for (std::size_t v = 1; v < view_visible.size(); ++v)
+                cascade_visible += view_visible[v].size();
+            frame_profiler.counter("cascade visible", cascade_visible);
+        }
+
+        if (occlusion == occlusion_method::software && !gpu_culling)
+        {
+            frame_profiler.begin_cpu("software occlusion");
+            auto const stats = software_occluder.render(projection * view, wall_occluders, jobs);
+            software_occluder.cull(object_bounds, visible_objects);
+            frame_profiler.end_cpu();
+            frame_profiler.counter("occluders", stats.occluders);
+            frame_profiler.counter("occlusion visible", visible_objects.size());
+        }
+
+        // Bunnies in the crossfade band go to both lists; distances are to the bounds center,
+        // which is where the shaders measure the fade from. Without impostors the band starts
+        // past the far plane, so no mesh ever fades
+        bool const use_impostors = impostors && !gpu_culling;
+        float const fade_start = use_impostors ? impostor_fade_start : 2.f * far;
+        float const fade_end = use_impostors ? impostor_fade_end : 2.f * far;
+        impostor_objects.clear();
+        if (use_impostors)
+        {
+            auto near_end = visible_objects.begin();
+            for (auto i : visible_objects)
+            {
+                glm::vec3 const center{
+                    (object_bounds.min_x[i] + object_bounds.max_x[i]) / 2.f,
+                    (object_bounds.min_y[i] + object_bounds.max_y[i]) / 2.f,
+                    (object_bounds.min_z[i] + object_bounds.max_z[i]) / 2.f,
+                };
+                float const distance = glm::distance(center, camera_position);
+                if (distance > fade_start)
+                    impostor_objects.push_back(i);
+                if (distance < fade_end)
+                    *near_end++ = i;
+            }
+            visible_objects.erase(near_end, visible_objects.end());
+        }
+        frame_profiler.counter("impostors", impostor_objects.size());
+
+        visible_wall_chunks.clear();
+        cull_aabbs(view_frustum.planes, wall_chunk_bounds, visible_wall_chunks);
+        wall_draw_counts.clear();
+        wall_draw_offsets.clear();
+        for (std::size_t i = 0; i < visible_wall_chunks.size(); ++i)
+        {
+            auto const & chunk = walls_batch.mesh.submeshes[visible_wall_chunks[i]];
+            if (i > 0 && visible_wall_chunks[i] == visible_wall_chunks[i - 1] + 1)
+            {
+                wall_draw_counts.back() += chunk.index_count;
+                continue;
+            }
+            wall_draw_counts.push_back(chunk.index_count);
+            wall_draw_offsets.push_back(reinterpret_cast<void const *>(chunk.first_index * sizeof(std::uint32_t)));
+        }
+        frame_profiler.counter("wall chunks", visible_wall_chunks.size());
+
+        auto const & mesh = input_model.meshes[0];
+
+        auto draw_walls = [&](glm::mat4 const & pass_projection)
+        {
+            glUseProgram(wall_program);
+            glUniformMatrix4fv(wall_view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
+            glUniformMatrix4fv(wall_projection_location, 1, GL_FALSE, reinterpret_cast<float const *>(&pass_projection));
+            glUniform3fv(wall_light_direction_location, 1, reinterpret_cast<float *>(&light_direction));
+
+            // One call for all visible chunks, adjacent ones merged into a single range
+            glBindVertexArray(wall_vao);
+            glMultiDrawElements(GL_TRIANGLES, wall_draw_counts.data(), GL_UNSIGNED_INT, wall_draw_offsets.data(), wall_draw_counts.size());
+        };
+
+        auto use_bunny_program = [&](glm::mat4 const & pass_projection)
+        {
+            glUseProgram(program);
+            glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
+            glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float const *>(&pass_projection));
+            glUniform3fv(light_direction_location, 1, reinterpret_cast<float *>(&light_direction));
+            glUniform3fv(camera_position_location, 1, reinterpret_cast<float *>(&camera_position));
+            glUniform3fv(center_location, 1, reinterpret_cast<float const *>(&mesh_center));
+            glUniform1f(fade_start_location, fade_start);
+            glUniform1f(fade_end_location, fade_end);
+
+            glUniform1i(write_motion_location, taa);
+            glUniformMatrix4fv(previous_view_projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&previous_view_projection));
+
+            glUniform1i(albedo_location, 0);
+            glUniform1i(object_transforms_location, 1);
+            glUniform1i(previous_object_transforms_location, 2);
+
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_BUFFER, previous_object_transforms_texture);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_BUFFER, object_transforms_texture);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, texture);
+        };
+
+        auto draw_bunnies = [&](GLuint vao, std::size_t count, glm::mat4 const & pass_projection)
+        {
+            use_bunny_program(pass_projection);
+            glBindVertexArray(vao);
+            glDrawElementsInstanced(GL_TRIANGLES, mesh.indices.count, mesh.indices.type, reinterpret_cast<void *>(mesh.indices.buffer_offset()), count);
+        };
+
+        std::size_t visible_count = visible_objects.size();
+
+        if (gpu_culling)
+        {
+            profiler::gpu_scope cull_scope(frame_profiler, "gpu cull");
+            compute_culler->cull(view_frustum.planes, instance_vbo);
+        }
+        else if (occlusion == occlusion_method::hiz)
+        {
+            profiler::gpu_scope occlusion_scope(frame_profiler, "occlusion");
+
+            // Depth of the walls and of last frame's survivors seen from the current camera
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, occlusion_culler.depth_framebuffer());
+            glViewport(0, 0, width, height);
+            glEnable(GL_DEPTH_TEST);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            draw_walls(projection);
+            if (previous_visible_count > 0)
+                draw_bunnies(previous_vaos[0], previous_visible_count, projection);
+
+            occlusion_culler.build_pyramid();
+
+            occlusion_candidates.clear();
+            for (auto i : visible_objects)
+            {
+                occlusion_candidates.push_back({
+                    {object_bounds.min_x[i], object_bounds.min_y[i], object_bounds.min_z[i]},
+                    {object_bounds.max_x[i], object_bounds.max_y[i], object_bounds.max_z[i]},
+                    i,
+                });
+            }
+
+            visible_count = occlusion_culler.cull(projection * view, occlusion_candidates, instance_vbo);
+
+            glBindBuffer(GL_COPY_READ_BUFFER, instance_vbo);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, previous_instance_vbo);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, visible_count * sizeof(std::uint32_t));
+            previous_visible_count = visible_count;
+
+            frame_profiler.counter("occlusion visible", visible_count);
+        }
+        else
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, visible_objects.size() * sizeof(visible_objects[0]), visible_objects.data());
+        }
+
+        bool const post_process = (aa_mode == antialiasing_mode::fxaa || taa);
+        if (post_process)
+            antialiasing.begin_scene();
+        else
+        {
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+            glViewport(0, 0, width, height);
+        }
+
+        if (multisampled)
+        {
+            if (aa_mode == antialiasing_mode::msaa)
+                glEnable(GL_MULTISAMPLE);
+            else
+                glDisable(GL_MULTISAMPLE);
+        }
+
+        glClearColor(0.8f, 0.8f, 1.f, 0.f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        glEnable(GL_DEPTH_TEST);
+
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        {
+            profiler::gpu_scope draw_scope(frame_profiler, "draw");
+            draw_walls(jittered_projection);
+            // Only the meshes write motion; walls stand still, and the few impostors that
+            // hop are left to the neighbourhood clamp
+            if (post_process)
+                antialiasing.write_motion(true);
+            if (gpu_culling)
+            {
+                use_bunny_program(jittered_projection);
+                glBindVertexArray(vaos[0]);
+                compute_culler->draw(0, 1, mesh.indices.type);
+            }
+            else if (visible_count > 0)
+                draw_bunnies(vaos[0], visible_count, jittered_projection);
+            if (post_process)
+                antialiasing.write_motion(false);
+            bunny_impostor.draw(view, jittered_projection, camera_position, light_direction, object_transforms_texture, impostor_objects, fade_start, fade_end);
+        }
+
+        if (post_process)
+        {
+            profiler::gpu_scope antialiasing_scope(frame_profiler, "antialiasing");
+            if (taa)
+                antialiasing.resolve_taa(projection * view, previous_view_projection, jitter);
+            else
+                antialiasing.resolve_fxaa();
+        }
+        previous_view_projection = projection * view;
+
+        replay.end_frame();
+
         SDL_GL_SwapWindow(window);
+
+        frame_profiler.end_frame();
     }
 
+    frame_profiler.write_chrome_trace("practice14_trace.json");
+
+    replay.finish();
+
     SDL_GL_DeleteContext(gl_context);
     SDL_DestroyWindow(window);
 }
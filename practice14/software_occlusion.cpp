@@ -0,0 +1,311 @@
+#include "software_occlusion.hpp"
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SOFTWARE_OCCLUSION_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOFTWARE_OCCLUSION_SSE
+#endif
+
+namespace
+{
+
+#if defined(SOFTWARE_OCCLUSION_AVX)
+	constexpr int simd_width = 8;
+#elif defined(SOFTWARE_OCCLUSION_SSE)
+	constexpr int simd_width = 4;
+#else
+	constexpr int simd_width = 1;
+#endif
+
+	// Rows rasterized by one job
+	constexpr int band_height = 16;
+
+	constexpr float infinity = std::numeric_limits<float>::infinity();
+
+	std::array<glm::vec4, 8> box_corners(glm::mat4 const & view_projection, glm::vec3 const & min, glm::vec3 const & max)
+	{
+		std::array<glm::vec4, 8> result;
+		for (int i = 0; i < 8; ++i)
+			result[i] = view_projection * glm::vec4(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z, 1.f);
+		return result;
+	}
+
+	// In front of the near plane, -w <= z
+	bool in_front(glm::vec4 const & clip)
+	{
+		return clip.z + clip.w > 0.f;
+	}
+
+}
+
+software_occlusion::software_occlusion(int width, int height)
+	: width_(width)
+	, height_(height)
+	, stride_((width + simd_width - 1) / simd_width * simd_width)
+	, depth_(std::size_t(stride_) * height, 1.f)
+{}
+
+software_occlusion::stats software_occlusion::render(glm::mat4 const & view_projection, std::vector<occluder> const & occluders, job_system & jobs,
+	std::size_t max_occluders, float min_area)
+{
+	view_projection_ = view_projection;
+
+	// Ranked by the screen area of their bounds; ones the near plane cuts are likely the
+	// closest, and go first
+	ranked_.clear();
+	for (std::size_t i = 0; i < occluders.size(); ++i)
+	{
+		auto const corners = box_corners(view_projection, occluders[i].min, occluders[i].max);
+		if (std::none_of(corners.begin(), corners.end(), in_front))
+			continue;
+
+		float area = infinity;
+		if (std::all_of(corners.begin(), corners.end(), in_front))
+		{
+			glm::vec2 min(infinity), max(-infinity);
+			for (auto const & c : corners)
+			{
+				glm::vec2 const p = glm::vec2(c) / c.w;
+				min = glm::min(min, p);
+				max = glm::max(max, p);
+			}
+			min = glm::clamp(min, -1.f, 1.f);
+			max = glm::clamp(max, -1.f, 1.f);
+			area = (max.x - min.x) * (max.y - min.y) * width_ * height_ / 4.f;
+		}
+
+		if (area >= min_area)
+			ranked_.push_back({area, i});
+	}
+
+	std::size_t const count = std::min(max_occluders, ranked_.size());
+	std::partial_sort(ranked_.begin(), ranked_.begin() + count, ranked_.end(), [](auto const & a, auto const & b){ return a.first > b.first; });
+
+	triangles_.clear();
+	for (std::size_t r = 0; r < count; ++r)
+	{
+		auto const & o = occluders[ranked_[r].second];
+		for (std::size_t i = 0; i + 2 < o.indices.size(); i += 3)
+		{
+			glm::vec4 const clip[3] = {
+				view_projection * glm::vec4(o.vertices[o.indices[i]], 1.f),
+				view_projection * glm::vec4(o.vertices[o.indices[i + 1]], 1.f),
+				view_projection * glm::vec4(o.vertices[o.indices[i + 2]], 1.f),
+			};
+			clip_and_add(clip);
+		}
+	}
+
+	// Each band clears its rows and rasterizes the triangles over them, so no two jobs
+	// ever write the same pixel
+	int const band_count = (height_ + band_height - 1) / band_height;
+	jobs.parallel_for(band_count, [this](std::size_t band)
+	{
+		int const begin = band * band_height;
+		int const end = std::min(height_, begin + band_height);
+		std::fill(depth_.begin() + std::size_t(begin) * stride_, depth_.begin() + std::size_t(end) * stride_, 1.f);
+
+		for (auto const & t : triangles_)
+			if (t.max_y >= begin && t.min_y < end)
+				rasterize(t, begin, end);
+	});
+
+	return {count, triangles_.size()};
+}
+
+bool software_occlusion::visible(glm::vec3 const & min, glm::vec3 const & max) const
+{
+	auto const corners = box_corners(view_projection_, min, max);
+
+	glm::vec2 rect_min(infinity), rect_max(-infinity);
+	float nearest = infinity;
+	for (auto const & c : corners)
+	{
+		if (!in_front(c) || c.w <= 0.f)
+			return true;
+		glm::vec3 const ndc = glm::vec3(c) / c.w;
+		rect_min = glm::min(rect_min, glm::vec2(ndc));
+		rect_max = glm::max(rect_max, glm::vec2(ndc));
+		nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+	}
+
+	// Every pixel the rectangle touches, not only those whose centers it covers
+	rect_min = glm::clamp(rect_min, -1.f, 1.f);
+	rect_max = glm::clamp(rect_max, -1.f, 1.f);
+	int const x0 = std::max(0, static_cast<int>(std::floor((rect_min.x * 0.5f + 0.5f) * width_)));
+	int const x1 = std::min(width_, static_cast<int>(std::ceil((rect_max.x * 0.5f + 0.5f) * width_)));
+	int const y0 = std::max(0, static_cast<int>(std::floor((rect_min.y * 0.5f + 0.5f) * height_)));
+	int const y1 = std::min(height_, static_cast<int>(std::ceil((rect_max.y * 0.5f + 0.5f) * height_)));
+
+	// Visible as soon as any pixel of the rectangle is not nearer than the box
+	for (int y = y0; y < y1; ++y)
+	{
+		float const * row = depth_.data() + std::size_t(y) * stride_;
+		int x = x0;
+#if defined(SOFTWARE_OCCLUSION_AVX)
+		__m256 const box_depth = _mm256_set1_ps(nearest);
+		for (; x + 8 <= x1; x += 8)
+			if (_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(row + x), box_depth, _CMP_GE_OQ)) != 0)
+				return true;
+#elif defined(SOFTWARE_OCCLUSION_SSE)
+		__m128 const box_depth = _mm_set1_ps(nearest);
+		for (; x + 4 <= x1; x += 4)
+			if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), box_depth)) != 0)
+				return true;
+#endif
+		for (; x < x1; ++x)
+			if (row[x] >= nearest)
+				return true;
+	}
+
+	return false;
+}
+
+void software_occlusion::cull(aabb_soa const & boxes, std::vector<std::uint32_t> & indices) const
+{
+	auto const occluded = [&](std::uint32_t i)
+	{
+		return !visible({boxes.min_x[i], boxes.min_y[i], boxes.min_z[i]}, {boxes.max_x[i], boxes.max_y[i], boxes.max_z[i]});
+	};
+	indices.erase(std::remove_if(indices.begin(), indices.end(), occluded), indices.end());
+}
+
+void software_occlusion::clip_and_add(glm::vec4 const (& clip)[3])
+{
+	// Against the near plane only; the rest is left to the bounds of the rasterizer
+	glm::vec4 polygon[4];
+	int size = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		glm::vec4 const & a = clip[i];
+		glm::vec4 const & b = clip[(i + 1) % 3];
+		float const da = a.z + a.w;
+		float const db = b.z + b.w;
+		if (da >= 0.f)
+			polygon[size++] = a;
+		if ((da >= 0.f) != (db >= 0.f))
+			polygon[size++] = glm::mix(a, b, da / (da - db));
+	}
+
+	for (int i = 1; i + 1 < size; ++i)
+	{
+		triangle t;
+		t.depth = 0.f;
+		glm::vec2 min(infinity), max(-infinity);
+		for (int j = 0; j < 3; ++j)
+		{
+			glm::vec4 const & c = polygon[j == 0 ? 0 : i + j - 1];
+			if (c.w <= 0.f)
+				return;
+			glm::vec3 const ndc = glm::vec3(c) / c.w;
+			t.v[j] = {(ndc.x * 0.5f + 0.5f) * width_, (ndc.y * 0.5f + 0.5f) * height_};
+			t.depth = std::max(t.depth, ndc.z * 0.5f + 0.5f);
+			min = glm::min(min, t.v[j]);
+			max = glm::max(max, t.v[j]);
+		}
+
+		// Counter-clockwise, so that the inside is where all edge functions are positive
+		float const area = (t.v[1].x - t.v[0].x) * (t.v[2].y - t.v[0].y) - (t.v[1].y - t.v[0].y) * (t.v[2].x - t.v[0].x);
+		if (area == 0.f)
+			continue;
+		if (area < 0.f)
+			std::swap(t.v[1], t.v[2]);
+
+		// Rows and columns whose pixel centers the bounds cover
+		min = glm::clamp(min, glm::vec2(0.f), glm::vec2(width_, height_));
+		max = glm::clamp(max, glm::vec2(0.f), glm::vec2(width_, height_));
+		t.min_x = std::max(0, static_cast<int>(std::ceil(min.x - 0.5f)));
+		t.max_x = std::min(width_ - 1, static_cast<int>(std::floor(max.x - 0.5f)));
+		t.min_y = std::max(0, static_cast<int>(std::ceil(min.y - 0.5f)));
+		t.max_y = std::min(height_ - 1, static_cast<int>(std::floor(max.y - 0.5f)));
+		if (t.min_x > t.max_x || t.min_y > t.max_y || t.depth > 1.f)
+			continue;
+
+		triangles_.push_back(t);
+	}
+}
+
+void software_occlusion::rasterize(triangle const & t, int band_begin, int band_end)
+{
+	// Edge function e(x, y) = a x + b y + c of each edge, positive on the inside
+	float a[3], b[3], c[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		glm::vec2 const & p = t.v[i];
+		glm::vec2 const & q = t.v[(i + 1) % 3];
+		a[i] = p.y - q.y;
+		b[i] = q.x - p.x;
+		c[i] = -(a[i] * p.x + b[i] * p.y);
+	}
+
+	// Whole vectors from an aligned column; the padding past the row end takes what spills over
+	int const x_begin = t.min_x / simd_width * simd_width;
+	int const y_begin = std::max(band_begin, t.min_y);
+	int const y_end = std::min(band_end, t.max_y + 1);
+
+	for (int y = y_begin; y < y_end; ++y)
+	{
+		float * row = depth_.data() + std::size_t(y) * stride_;
+		float const py = y + 0.5f;
+		float e[3];
+		for (int i = 0; i < 3; ++i)
+			e[i] = a[i] * (x_begin + 0.5f) + b[i] * py + c[i];
+
+#if defined(SOFTWARE_OCCLUSION_AVX)
+		__m256 const offsets = _mm256_set_ps(7.f, 6.f, 5.f, 4.f, 3.f, 2.f, 1.f, 0.f);
+		__m256 const depth = _mm256_set1_ps(t.depth);
+		__m256 edge[3], step[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			edge[i] = _mm256_add_ps(_mm256_set1_ps(e[i]), _mm256_mul_ps(_mm256_set1_ps(a[i]), offsets));
+			step[i] = _mm256_set1_ps(8.f * a[i]);
+		}
+		for (int x = x_begin; x <= t.max_x; x += 8)
+		{
+			__m256 const inside = _mm256_and_ps(_mm256_and_ps(
+				_mm256_cmp_ps(edge[0], _mm256_setzero_ps(), _CMP_GE_OQ),
+				_mm256_cmp_ps(edge[1], _mm256_setzero_ps(), _CMP_GE_OQ)),
+				_mm256_cmp_ps(edge[2], _mm256_setzero_ps(), _CMP_GE_OQ));
+			__m256 const old = _mm256_loadu_ps(row + x);
+			_mm256_storeu_ps(row + x, _mm256_blendv_ps(old, _mm256_min_ps(old, depth), inside));
+			for (int i = 0; i < 3; ++i)
+				edge[i] = _mm256_add_ps(edge[i], step[i]);
+		}
+#elif defined(SOFTWARE_OCCLUSION_SSE)
+		__m128 const offsets = _mm_set_ps(3.f, 2.f, 1.f, 0.f);
+		__m128 const depth = _mm_set1_ps(t.depth);
+		__m128 edge[3], step[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			edge[i] = _mm_add_ps(_mm_set1_ps(e[i]), _mm_mul_ps(_mm_set1_ps(a[i]), offsets));
+			step[i] = _mm_set1_ps(4.f * a[i]);
+		}
+		for (int x = x_begin; x <= t.max_x; x += 4)
+		{
+			__m128 const inside = _mm_and_ps(_mm_and_ps(
+				_mm_cmpge_ps(edge[0], _mm_setzero_ps()),
+				_mm_cmpge_ps(edge[1], _mm_setzero_ps())),
+				_mm_cmpge_ps(edge[2], _mm_setzero_ps()));
+			__m128 const old = _mm_loadu_ps(row + x);
+			_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, _mm_min_ps(old, depth)), _mm_andnot_ps(inside, old)));
+			for (int i = 0; i < 3; ++i)
+				edge[i] = _mm_add_ps(edge[i], step[i]);
+		}
+#else
+		for (int x = x_begin; x <= t.max_x; ++x)
+		{
+			if (e[0] >= 0.f && e[1] >= 0.f && e[2] >= 0.f)
+				row[x] = std::min(row[x], t.depth);
+			for (int i = 0; i < 3; ++i)
+				e[i] += a[i];
+		}
+#endif
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#include "culling.hpp"
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+struct job_system;
+
+// Occlusion culling on the CPU within the frame, without the frame of latency of the Hi-Z
+// culler: the largest occluders on screen are rasterized into a small depth buffer, in bands
+// of rows on the job system's threads and 8 pixels at a time with AVX or 4 with SSE, and
+// boxes are then tested against it before they are drawn. Each occluder triangle writes the
+// depth of its farthest vertex, so depth errs towards visible, but coverage is sampled at
+// pixel centers, and a box may be culled while less than a pixel of it peeks out.
+struct software_occlusion
+{
+	// Triangles in world space, for occluders that are solid inside their bounds
+	struct occluder
+	{
+		std::vector<glm::vec3> vertices;
+		std::vector<std::uint32_t> indices;
+		glm::vec3 min;
+		glm::vec3 max;
+	};
+
+	struct stats
+	{
+		std::size_t occluders = 0;
+		std::size_t triangles = 0;
+	};
+
+	software_occlusion(int width = 320, int height = 192);
+
+	// Clears the depth buffer and rasterizes the occluders whose bounds cover the most of
+	// the screen, up to max_occluders of them and none covering less than min_area pixels
+	stats render(glm::mat4 const & view_projection, std::vector<occluder> const & occluders, job_system & jobs,
+		std::size_t max_occluders = 32, float min_area = 16.f);
+
+	// Against the depth of the last render(); boxes crossing the near plane are visible
+	bool visible(glm::vec3 const & min, glm::vec3 const & max) const;
+
+	// Keeps the indices of the boxes that are visible, in order
+	void cull(aabb_soa const & boxes, std::vector<std::uint32_t> & indices) const;
+
+private:
+	struct triangle
+	{
+		// Pixel coordinates
+		glm::vec2 v[3];
+		float depth;
+		int min_x, max_x;
+		int min_y, max_y;
+	};
+
+	int width_;
+	int height_;
+	// Rows padded to whole SIMD vectors
+	int stride_;
+	glm::mat4 view_projection_{1.f};
+	std::vector<float> depth_;
+
+	std::vector<std::pair<float, std::size_t>> ranked_;
+	std::vector<triangle> triangles_;
+
+	void clip_and_add(glm::vec4 const (& clip)[3]);
+	void rasterize(triangle const & t, int band_begin, int band_end);
+};
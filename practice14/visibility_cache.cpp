@@ -0,0 +1,78 @@
+#include "visibility_cache.hpp"
+#include "intersect.hpp"
+
+#include <glm/geometric.hpp>
+
+visibility_cache::stats visibility_cache::cull(frustum const & view_frustum, aabb_soa const & boxes, std::vector<std::uint32_t> & visible, bool exact)
+{
+	stats result;
+	result.objects = boxes.size();
+
+	// Objects added since the last call start without a hint
+	entries_.resize(boxes.size());
+
+	for (std::uint32_t i = 0; i < boxes.size(); ++i)
+	{
+		auto & e = entries_[i];
+
+		glm::vec3 const min(boxes.min_x[i], boxes.min_y[i], boxes.min_z[i]);
+		glm::vec3 const max(boxes.max_x[i], boxes.max_y[i], boxes.max_z[i]);
+
+		bool straddles = false;
+		auto outside = [&](int p)
+		{
+			++result.plane_tests;
+			auto const & plane = view_frustum.planes[p];
+			glm::vec3 const n(plane);
+			glm::vec3 const positive(n.x >= 0.f ? max.x : min.x, n.y >= 0.f ? max.y : min.y, n.z >= 0.f ? max.z : min.z);
+			glm::vec3 const negative(n.x >= 0.f ? min.x : max.x, n.y >= 0.f ? min.y : max.y, n.z >= 0.f ? min.z : max.z);
+
+			if (glm::dot(n, positive) + plane.w < 0.f)
+				return true;
+			if (glm::dot(n, negative) + plane.w < 0.f)
+				straddles = true;
+			return false;
+		};
+
+		if (outside(e.plane))
+		{
+			++result.rejected;
+			++result.rejected_first_try;
+			continue;
+		}
+
+		int rejecting_plane = -1;
+		for (int p = 0; p < 6 && rejecting_plane == -1; ++p)
+		{
+			if (p != e.plane && outside(p))
+				rejecting_plane = p;
+		}
+
+		if (rejecting_plane != -1)
+		{
+			e.plane = rejecting_plane;
+			++result.rejected;
+			continue;
+		}
+
+		if (exact && straddles)
+		{
+			std::size_t tests = 0;
+			int const axis = separating_axis(view_frustum, aabb(min, max), e.axis, &tests);
+			result.axis_tests += tests;
+
+			if (axis != -1)
+			{
+				if (axis == e.axis && tests == 1)
+					++result.rejected_first_try;
+				e.axis = axis;
+				++result.rejected;
+				continue;
+			}
+		}
+
+		visible.push_back(i);
+	}
+
+	return result;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "culling.hpp"
+#include "frustum.hpp"
+
+#include <vector>
+#include <cstdint>
+
+// Per-object memory of what rejected the object the last time it was tested. Objects
+// mostly keep their visibility from frame to frame, so trying that plane or separating
+// axis first usually rejects an invisible object with a single test.
+struct visibility_cache
+{
+	struct stats
+	{
+		std::size_t objects = 0;
+		std::size_t plane_tests = 0;
+		// Separating axis projections, each of them projecting all vertices of both bodies
+		std::size_t axis_tests = 0;
+		std::size_t rejected = 0;
+		// Rejected by the cached plane, or by the cached axis on its first projection
+		std::size_t rejected_first_try = 0;
+	};
+
+	// Appends the indices of visible boxes. With exact set, boxes that straddle a plane
+	// are refined with the separating axis test, so the result matches intersect().
+	stats cull(frustum const & view_frustum, aabb_soa const & boxes, std::vector<std::uint32_t> & visible, bool exact = true);
+
+private:
+	struct entry
+	{
+		std::int8_t plane = 0;
+		std::int8_t axis = -1;
+	};
+
+	std::vector<entry> entries_;
+};
@@ -0,0 +1,306 @@
+#include "glyph_atlas.hpp"
+#include "stb_image.h"
+#include "render_stats.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+glyph_atlas::glyph_atlas(msdf_font font, generator generate, int page_size, int page_count)
+    : font_(std::move(font))
+    , generate_(std::move(generate))
+    , page_size_(std::max({page_size, font_.page_width, font_.page_height}))
+    , baked_pages_(font_.texture_paths.size())
+{
+    if (page_count > 32)
+        throw std::runtime_error("Glyph atlas can't have more than 32 pages");
+    page_count = std::max(page_count, baked_pages_);
+
+    glGenTextures(1, &texture_);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture_);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, page_size_, page_size_, page_count, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+    for (int i = 0; i < baked_pages_; ++i)
+    {
+        auto const & path = font_.texture_paths[i];
+
+        int width, height, channels;
+        auto data = stbi_load(path.c_str(), &width, &height, &channels, 4);
+        if (!data)
+            throw std::runtime_error("Failed to load " + path);
+
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, data);
+        stbi_image_free(data);
+    }
+
+    pages_.resize(page_count - baked_pages_);
+    for (auto & p : pages_)
+    {
+        p.pixels.assign(page_size_ * page_size_ * 4, 0);
+        p.dirty_x0 = p.dirty_y0 = page_size_;
+        p.dirty_x1 = p.dirty_y1 = 0;
+    }
+
+    metrics_.resize(max_glyphs);
+    dirty_slot_begin_ = max_glyphs;
+    dirty_slot_end_ = 0;
+
+    int slot = 0;
+    font_.glyphs.for_each([&](char32_t, msdf_font::glyph & glyph)
+    {
+        if (slot == max_glyphs)
+            throw std::runtime_error("Font has more than " + std::to_string(max_glyphs) + " glyphs");
+        glyph.slot = slot++;
+        write_metrics(glyph);
+    });
+
+    for (int i = max_glyphs; i-- > slot;)
+        free_slots_.push_back(i);
+
+    glGenBuffers(1, &metrics_buffer_);
+    glBindBuffer(GL_UNIFORM_BUFFER, metrics_buffer_);
+    glBufferData(GL_UNIFORM_BUFFER, metrics_.size() * sizeof(metrics_[0]), metrics_.data(), GL_DYNAMIC_DRAW);
+    dirty_slot_begin_ = max_glyphs;
+    dirty_slot_end_ = 0;
+
+    if (generate_ && !pages_.empty())
+        worker_ = std::thread([this]{ worker_loop(); });
+}
+
+glyph_atlas::~glyph_atlas()
+{
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    jobs_ready_.notify_all();
+
+    if (worker_.joinable())
+        worker_.join();
+
+    glDeleteBuffers(1, &metrics_buffer_);
+    glDeleteTextures(1, &texture_);
+}
+
+msdf_font::glyph const * glyph_atlas::find(char32_t code)
+{
+    if (auto glyph = font_.glyphs.find(code))
+        return glyph;
+
+    if (worker_.joinable() && !failed_.contains(code) && queued_.insert(code).second)
+    {
+        {
+            std::lock_guard lock(mutex_);
+            jobs_.push_back(code);
+        }
+        jobs_ready_.notify_one();
+    }
+
+    return nullptr;
+}
+
+void glyph_atlas::touch(std::uint32_t pages)
+{
+    for (int i = 0; i < static_cast<int>(pages_.size()); ++i)
+        if ((pages >> (baked_pages_ + i)) & 1)
+            pages_[i].last_used = frame_;
+}
+
+glyph_atlas::changes glyph_atlas::update()
+{
+    changes result;
+
+    std::deque<generated> done;
+    {
+        std::lock_guard lock(mutex_);
+        done.swap(generated_);
+    }
+
+    for (auto & g : done)
+    {
+        queued_.erase(g.code);
+
+        if (!g.error.empty())
+            throw std::runtime_error(g.error);
+
+        // One texel of border around every glyph keeps filtering from reading its neighbours
+        if (!g.bitmap || g.bitmap->width + 2 > page_size_ || g.bitmap->height + 2 > page_size_)
+        {
+            failed_.insert(g.code);
+            continue;
+        }
+
+        auto const & bitmap = *g.bitmap;
+
+        int page_index, x, y;
+        if (free_slots_.empty() || !pack(bitmap, page_index, x, y))
+        {
+            auto lru = std::min_element(pages_.begin(), pages_.end(), [](page const & a, page const & b){ return a.last_used < b.last_used; });
+            evict(lru - pages_.begin(), result);
+
+            // Only when the slots are all taken by other pages; find() asks again later
+            if (free_slots_.empty() || !pack(bitmap, page_index, x, y))
+                continue;
+        }
+
+        auto & p = pages_[page_index];
+
+        int const w = bitmap.width + 2;
+        int const h = bitmap.height + 2;
+        for (int row = 0; row < h; ++row)
+        {
+            auto dst = p.pixels.data() + ((y + row) * page_size_ + x) * 4;
+            std::memset(dst, 0, w * 4);
+            if (row > 0 && row <= bitmap.height)
+                std::memcpy(dst + 4, bitmap.pixels.data() + (row - 1) * bitmap.width * 4, bitmap.width * 4);
+        }
+
+        p.dirty_x0 = std::min(p.dirty_x0, x);
+        p.dirty_y0 = std::min(p.dirty_y0, y);
+        p.dirty_x1 = std::max(p.dirty_x1, x + w);
+        p.dirty_y1 = std::max(p.dirty_y1, y + h);
+
+        auto & glyph = font_.glyphs.insert(g.code);
+        glyph = {x + 1, y + 1, bitmap.width, bitmap.height, bitmap.xoffset, bitmap.yoffset,
+            bitmap.advance, baked_pages_ + page_index, free_slots_.back()};
+        free_slots_.pop_back();
+        write_metrics(glyph);
+        p.codes.push_back(g.code);
+        result.added = true;
+    }
+
+    if (result.added)
+    {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture_);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, page_size_);
+        RENDER_STATS_ADD(texture_binds, 1);
+        RENDER_STATS_ADD(state_changes, 2);
+
+        for (int i = 0; i < static_cast<int>(pages_.size()); ++i)
+        {
+            auto & p = pages_[i];
+            if (p.dirty_x0 >= p.dirty_x1)
+                continue;
+
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, p.dirty_x0, p.dirty_y0, baked_pages_ + i,
+                p.dirty_x1 - p.dirty_x0, p.dirty_y1 - p.dirty_y0, 1, GL_RGBA, GL_UNSIGNED_BYTE,
+                p.pixels.data() + (p.dirty_y0 * page_size_ + p.dirty_x0) * 4);
+            RENDER_STATS_ADD(bytes_uploaded, std::uint64_t(p.dirty_x1 - p.dirty_x0) * (p.dirty_y1 - p.dirty_y0) * 4);
+
+            p.dirty_x0 = p.dirty_y0 = page_size_;
+            p.dirty_x1 = p.dirty_y1 = 0;
+        }
+
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+
+    if (dirty_slot_begin_ < dirty_slot_end_)
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, metrics_buffer_);
+        glBufferSubData(GL_UNIFORM_BUFFER, dirty_slot_begin_ * sizeof(metrics_[0]),
+            (dirty_slot_end_ - dirty_slot_begin_) * sizeof(metrics_[0]), metrics_.data() + dirty_slot_begin_);
+        RENDER_STATS_ADD(bytes_uploaded, (dirty_slot_end_ - dirty_slot_begin_) * sizeof(metrics_[0]));
+        dirty_slot_begin_ = max_glyphs;
+        dirty_slot_end_ = 0;
+    }
+
+    ++frame_;
+    return result;
+}
+
+bool glyph_atlas::pack(glyph_bitmap const & bitmap, int & page_index, int & x, int & y)
+{
+    int const w = bitmap.width + 2;
+    int const h = bitmap.height + 2;
+
+    for (page_index = 0; page_index < static_cast<int>(pages_.size()); ++page_index)
+    {
+        auto & shelves = pages_[page_index].shelves;
+
+        // Shelves much taller than the glyph are left for taller glyphs
+        for (auto & s : shelves)
+        {
+            if (s.height >= h && s.height <= h + h / 2 && s.x + w <= page_size_)
+            {
+                x = s.x;
+                y = s.y;
+                s.x += w;
+                return true;
+            }
+        }
+
+        int top = shelves.empty() ? 0 : shelves.back().y + shelves.back().height;
+        if (top + h <= page_size_)
+        {
+            shelves.push_back({top, h, w});
+            x = 0;
+            y = top;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void glyph_atlas::write_metrics(msdf_font::glyph const & glyph)
+{
+    metrics_[glyph.slot] = glm::uvec4(
+        glyph.x | (glyph.y << 16),
+        glyph.width | (glyph.height << 16),
+        (glyph.xoffset + 32768) | ((glyph.yoffset + 32768) << 16),
+        glyph.page);
+
+    dirty_slot_begin_ = std::min(dirty_slot_begin_, glyph.slot);
+    dirty_slot_end_ = std::max(dirty_slot_end_, glyph.slot + 1);
+}
+
+void glyph_atlas::evict(int page_index, changes & result)
+{
+    auto & p = pages_[page_index];
+
+    for (auto code : p.codes)
+    {
+        free_slots_.push_back(font_.glyphs.find(code)->slot);
+        font_.glyphs.erase(code);
+    }
+
+    p.codes.clear();
+    p.shelves.clear();
+    result.evicted |= 1u << (baked_pages_ + page_index);
+}
+
+void glyph_atlas::worker_loop()
+{
+    while (true)
+    {
+        char32_t code;
+        {
+            std::unique_lock lock(mutex_);
+            jobs_ready_.wait(lock, [this]{ return stop_ || !jobs_.empty(); });
+            if (stop_)
+                return;
+            code = jobs_.front();
+            jobs_.pop_front();
+        }
+
+        generated g;
+        g.code = code;
+        try
+        {
+            g.bitmap = generate_(code);
+            if (g.bitmap && g.bitmap->pixels.size() != std::size_t(g.bitmap->width) * g.bitmap->height * 4)
+                g.error = "Generated glyph " + std::to_string(code) + " has the wrong size";
+        }
+        catch (std::exception const & e)
+        {
+            g.error = e.what();
+        }
+
+        std::lock_guard lock(mutex_);
+        generated_.push_back(std::move(g));
+    }
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm/vec4.hpp>
+
+#include "msdf_loader.hpp"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <optional>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+// MSDF glyphs of one font in the layers of a texture array. The font's prebaked pages take
+// the first layers and stay there; glyphs the font does not have are made by a generator
+// on a worker thread and shelf packed into the remaining pages. When those are full the
+// least recently used page is emptied and its glyphs are generated again when next needed.
+// Only the rectangle each update() wrote to is uploaded with glTexSubImage3D.
+// Every glyph has a slot in a uniform buffer of max_glyphs metrics, that shaders expand
+// glyph quads from: the atlas rectangle in texels (x | y << 16, width | height << 16),
+// the offset ((xoffset + 32768) | (yoffset + 32768) << 16) and the page.
+struct glyph_atlas
+{
+    static constexpr int max_glyphs = 1024;
+
+    // RGBA8 distance field in the font's units and distance range, metrics as in msdf_font
+    struct glyph_bitmap
+    {
+        int width, height;
+        int xoffset, yoffset;
+        int advance;
+        std::vector<std::uint8_t> pixels;
+    };
+
+    // Runs on the worker thread; nothing means the code point has no glyph
+    using generator = std::function<std::optional<glyph_bitmap>(char32_t)>;
+
+    // Pages are at least as large as the font's, at most 32 of them in total
+    glyph_atlas(msdf_font font, generator generate, int page_size = 512, int page_count = 8);
+    ~glyph_atlas();
+
+    glyph_atlas(glyph_atlas const &) = delete;
+    glyph_atlas & operator = (glyph_atlas const &) = delete;
+
+    msdf_font const & font() const { return font_; }
+    GLuint texture() const { return texture_; }
+    GLuint metrics_buffer() const { return metrics_buffer_; }
+    int page_size() const { return page_size_; }
+
+    // Nothing while the glyph is being generated or when there is none; missing glyphs
+    // are queued for generation
+    msdf_font::glyph const * find(char32_t code);
+
+    // Whether a glyph find() did not have is still being generated
+    bool pending(char32_t code) const { return queued_.contains(code); }
+
+    // Whether any glyph is still being generated; the next update() may bring it in
+    bool generating() const { return !queued_.empty(); }
+
+    // Marks the pages in the mask, one bit per layer, as used this frame; a full atlas
+    // evicts the page used least recently
+    void touch(std::uint32_t pages);
+
+    struct changes
+    {
+        // Some glyphs that find() did not have are there now
+        bool added = false;
+        // Pages whose glyphs are gone; anything laid out with them must be laid out again
+        std::uint32_t evicted = 0;
+    };
+
+    // Packs and uploads the glyphs the worker has finished; call every frame on the GL thread.
+    // Throws if the generator did.
+    changes update();
+
+private:
+    struct shelf
+    {
+        int y;
+        int height;
+        int x = 0;
+    };
+
+    struct page
+    {
+        std::vector<shelf> shelves;
+        std::vector<char32_t> codes;
+        std::uint64_t last_used = 0;
+
+        // System memory copy, and the part of it not uploaded yet
+        std::vector<std::uint8_t> pixels;
+        int dirty_x0, dirty_y0, dirty_x1, dirty_y1;
+    };
+
+    struct generated
+    {
+        char32_t code;
+        std::optional<glyph_bitmap> bitmap;
+        std::string error;
+    };
+
+    // Returns false if no page has room without evicting
+    bool pack(glyph_bitmap const & bitmap, int & page_index, int & x, int & y);
+    void write_metrics(msdf_font::glyph const & glyph);
+    void evict(int page_index, changes & result);
+    void worker_loop();
+
+    msdf_font font_;
+    generator generate_;
+    int page_size_;
+    int baked_pages_;
+    GLuint texture_ = 0;
+
+    GLuint metrics_buffer_ = 0;
+    std::vector<glm::uvec4> metrics_;
+    std::vector<int> free_slots_;
+    int dirty_slot_begin_, dirty_slot_end_;
+
+    // Runtime pages only, page_[i] is layer baked_pages_ + i
+    std::vector<page> pages_;
+    std::uint64_t frame_ = 0;
+
+    // Codes queued or found to have no glyph
+    std::set<char32_t> queued_;
+    std::set<char32_t> failed_;
+
+    std::thread worker_;
+    std::mutex mutex_;
+    std::condition_variable jobs_ready_;
+    std::deque<char32_t> jobs_;
+    std::deque<generated> generated_;
+    bool stop_ = false;
+};
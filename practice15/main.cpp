@@ -15,7 +15,9 @@
 #include <vector>
 #include <random>
 #include <map>
+#include <optional>
 #include <cmath>
+#include <algorithm>
 
 #include <glm/vec3.hpp>
 #include <glm/mat4x4.hpp>
@@ -26,7 +28,11 @@
 #include <glm/gtx/string_cast.hpp>
 
 #include "msdf_loader.hpp"
-#include "stb_image.h"
+#include "text_renderer.hpp"
+#include "text_view.hpp"
+#include "job_system.hpp"
+#include "render_stats.hpp"
+#include "allocation_tracker.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -43,68 +49,47 @@ void glew_fail(std::string_view message, GLenum error)
     throw std::runtime_error(to_string(message) + reinterpret_cast<const char *>(glewGetErrorString(error)));
 }
 
-const char msdf_vertex_shader_source[] =
-R"(#version 330 core
-
-uniform mat4 transform;
-
-void main()
+// Stands in for an outline rasterizer, which this project has no font files for: every
+// printable code point the prebaked atlas lacks gets a box outline of the same metrics
+std::optional<glyph_atlas::glyph_bitmap> box_glyph(msdf_font const & font, char32_t code)
 {
-    gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
-}
-)";
+    if (code < 0x20 || (code >= 0x7f && code < 0xa0))
+        return std::nullopt;
 
-const char msdf_fragment_shader_source[] =
-R"(#version 330 core
+    float const stroke = font.size * 0.06f;
+    float const padding = std::ceil(font.sdf_scale);
 
-layout (location = 0) out vec4 out_color;
+    glm::vec2 const half(font.size * 0.25f, font.size * 0.33f);
+    glm::vec2 const center(half.x + padding + stroke, font.base - half.y);
 
-void main()
-{
-    out_color = vec4(0.0);
-}
-)";
-
-GLuint create_shader(GLenum type, const char * source)
-{
-    GLuint result = glCreateShader(type);
-    glShaderSource(result, 1, &source, nullptr);
-    glCompileShader(result);
-    GLint status;
-    glGetShaderiv(result, GL_COMPILE_STATUS, &status);
-    if (status != GL_TRUE)
-    {
-        GLint info_log_length;
-        glGetShaderiv(result, GL_INFO_LOG_LENGTH, &info_log_length);
-        std::string info_log(info_log_length, '\0');
-        glGetShaderInfoLog(result, info_log.size(), nullptr, info_log.data());
-        throw std::runtime_error("Shader compilation failed: " + info_log);
-    }
-    return result;
-}
-
-template <typename ... Shaders>
-GLuint create_program(Shaders ... shaders)
-{
-    GLuint result = glCreateProgram();
-    (glAttachShader(result, shaders), ...);
-    glLinkProgram(result);
+    glyph_atlas::glyph_bitmap result;
+    result.width = std::ceil((half.x + stroke + padding) * 2.f);
+    result.height = std::ceil((half.y + stroke + padding) * 2.f);
+    result.xoffset = std::round(font.size * 0.05f - padding);
+    result.yoffset = std::round(center.y - result.height * 0.5f);
+    result.advance = std::round(half.x * 2.f + font.size * 0.2f);
+    result.pixels.resize(result.width * result.height * 4);
 
-    GLint status;
-    glGetProgramiv(result, GL_LINK_STATUS, &status);
-    if (status != GL_TRUE)
+    for (int y = 0; y < result.height; ++y)
     {
-        GLint info_log_length;
-        glGetProgramiv(result, GL_INFO_LOG_LENGTH, &info_log_length);
-        std::string info_log(info_log_length, '\0');
-        glGetProgramInfoLog(result, info_log.size(), nullptr, info_log.data());
-        throw std::runtime_error("Program linkage failed: " + info_log);
+        for (int x = 0; x < result.width; ++x)
+        {
+            // Signed distance to the rectangle, then to the stroke along it, negative inside
+            glm::vec2 p = glm::abs(glm::vec2(x + 0.5f, y + 0.5f) - glm::vec2(result.width, result.height) * 0.5f) - half;
+            float box = glm::length(glm::max(p, 0.f)) + std::min(std::max(p.x, p.y), 0.f);
+            float sdf = std::abs(box) - stroke * 0.5f;
+
+            auto value = static_cast<std::uint8_t>(std::clamp(0.5f - sdf / font.sdf_scale, 0.f, 1.f) * 255.f + 0.5f);
+            auto pixel = result.pixels.data() + (y * result.width + x) * 4;
+            pixel[0] = pixel[1] = pixel[2] = value;
+            pixel[3] = 255;
+        }
     }
 
     return result;
 }
 
-int main() try
+int main(int argc, char ** argv) try
 {
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
         sdl2_fail("SDL_Init: ");
@@ -140,49 +125,74 @@ int main() try
     if (!GLEW_VERSION_3_3)
         throw std::runtime_error("OpenGL 3.3 is not supported");
 
-    auto msdf_vertex_shader = create_shader(GL_VERTEX_SHADER, msdf_vertex_shader_source);
-    auto msdf_fragment_shader = create_shader(GL_FRAGMENT_SHADER, msdf_fragment_shader_source);
-    auto msdf_program = create_program(msdf_vertex_shader, msdf_fragment_shader);
-
-    GLuint transform_location = glGetUniformLocation(msdf_program, "transform");
-
     const std::string project_root = PROJECT_ROOT;
     const std::string font_path = project_root + "/font/font-msdf.json";
 
-    auto const font = load_msdf_font(font_path);
+    allocation_scope text_allocations(allocation_tag::text);
+
+    // The generator runs on the atlas worker, so it reads its own copy of the font
+    auto font = load_msdf_font(font_path);
+    auto const font_metrics = font;
+
+    program_cache programs(project_root + "/.program_binaries");
+
+    glyph_atlas atlas(std::move(font), [&font_metrics](char32_t code){ return box_glyph(font_metrics, code); });
+    text_renderer text_renderer(programs, atlas);
 
-    GLuint texture;
-    int texture_width, texture_height;
+    std::string text = "Hello, world!";
+    bool text_changed = true;
+
+    auto const input_label = text_renderer.add_label(text, {20.f, 40.f}, 64.f, {0.f, 0.f, 0.f, 1.f});
+    auto const frame_time_label = text_renderer.add_label("", {20.f, 0.f}, 24.f, {0.2f, 0.2f, 0.5f, 1.f});
+    text_renderer.add_label("Type to edit the text, backspace to erase, tab to switch on demand rendering", {20.f, 120.f}, 24.f, {0.3f, 0.3f, 0.3f, 1.f});
+
+    // A file given on the command line is shown below, scrolled with the mouse wheel and the
+    // page keys; the job system is only needed to index it
+    std::optional<text_view> view;
+    if (argc > 1)
     {
-        int channels;
-        auto data = stbi_load(font.texture_path.c_str(), &texture_width, &texture_height, &channels, 4);
-        assert(data);
-
-        glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, texture_width, texture_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        stbi_image_free(data);
+        auto const start = std::chrono::high_resolution_clock::now();
+        job_system jobs;
+        view.emplace(text_renderer, argv[1], jobs, 20.f, glm::vec4(0.f, 0.f, 0.f, 1.f));
+        float const ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        std::cout << "Indexed " << view->line_count() << " lines of " << argv[1] << " (" << view->file_size() / (1024.f * 1024.f)
+            << " MB) in " << ms << " ms" << std::endl;
     }
 
+#ifdef RENDER_STATS
+    // Averages and maxima of the last frames, in the top right corner
+    auto const stats_label = text_renderer.add_label("", {0.f, 0.f}, 18.f, {0.4f, 0.1f, 0.1f, 1.f});
+#endif
+
+    float frame_time_sum = 0.f;
+    int frame_count = 0;
+
     auto last_frame_start = std::chrono::high_resolution_clock::now();
 
     float time = 0.f;
 
     SDL_StartTextInput();
 
-    std::map<SDL_Keycode, bool> button_down;
-
-    std::string text = "Hello, world!";
-    bool text_changed = true;
+    // A frame is drawn only after an event, an edit or while glyphs are being generated, so
+    // an idle editor sleeps in SDL_WaitEvent; the frame time label is left alone meanwhile,
+    // since it would only measure the waits
+    bool on_demand = true;
+    bool redraw = true;
+    text_renderer.set_text(frame_time_label, "on demand");
 
     bool running = true;
     while (running)
     {
-        for (SDL_Event event; SDL_PollEvent(&event);) switch (event.type)
+        if (on_demand && !redraw && !text_changed)
+        {
+            // Generated glyphs only show up through the atlas update in draw()
+            if (atlas.generating())
+                SDL_WaitEventTimeout(nullptr, 10);
+            else
+                SDL_WaitEvent(nullptr);
+        }
+
+        for (SDL_Event event; SDL_PollEvent(&event); redraw = true) switch (event.type)
         {
         case SDL_QUIT:
             running = false;
@@ -196,19 +206,31 @@ int main() try
                 break;
             }
             break;
+        case SDL_MOUSEWHEEL:
+            if (view)
+                view->scroll(-3 * event.wheel.y);
+            break;
         case SDL_KEYDOWN:
-            button_down[event.key.keysym.sym] = true;
             if (event.key.keysym.sym == SDLK_BACKSPACE && !text.empty())
             {
                 text.pop_back();
                 text_changed = true;
             }
+            if (view && event.key.keysym.sym == SDLK_PAGEUP)
+                view->scroll(-std::int64_t(view->rows()));
+            if (view && event.key.keysym.sym == SDLK_PAGEDOWN)
+                view->scroll(view->rows());
+            if (event.key.keysym.sym == SDLK_TAB)
+            {
+                on_demand = !on_demand;
+                frame_time_sum = 0.f;
+                frame_count = 0;
+                text_renderer.set_text(frame_time_label, on_demand ? "on demand" : "");
+            }
             break;
         case SDL_TEXTINPUT:
             text.append(event.text.text);
             text_changed = true;
-        case SDL_KEYUP:
-            button_down[event.key.keysym.sym] = false;
             break;
         }
 
@@ -219,16 +241,60 @@ int main() try
         float dt = std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count();
         last_frame_start = now;
 
+        time += dt;
+
+        if (on_demand && !redraw && !text_changed && !atlas.generating())
+            continue;
+        redraw = false;
+
+        frame_time_sum += dt;
+        ++frame_count;
+        if (!on_demand && frame_time_sum >= 1.f)
+        {
+            text_renderer.set_text(frame_time_label, std::to_string(frame_time_sum * 1000.f / frame_count) + " ms");
+            frame_time_sum = 0.f;
+            frame_count = 0;
+        }
+
+        if (text_changed)
+        {
+            text_renderer.set_text(input_label, text);
+            text_changed = false;
+        }
+
+        if (view)
+        {
+            view->set_viewport({20.f, 160.f}, {width - 40.f, height - 180.f});
+            view->update();
+        }
+
         glClearColor(0.8f, 0.8f, 1.f, 0.f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         glEnable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        RENDER_STATS_ADD(state_changes, 2);
+
+#ifdef RENDER_STATS
+        // Heap use by subsystem below the counters, in a build with ALLOCATION_TRACKING
+        auto stats_text = render_stats::global().overlay_text();
+        if (allocation_tracker::enabled())
+            stats_text += "\n" + allocation_tracker::global().overlay_text();
+        text_renderer.set_text(stats_label, stats_text);
+        text_renderer.set_position(stats_label, {width - 20.f - text_renderer.bounds(stats_label).x, 0.f});
+#endif
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture);
+        {
+            // Drawing the labels set up above should not touch the heap once the atlas is warm
+            frame_scope frame_allocations;
+
+            // Pixel coordinates with y going down, as the font metrics are
+            text_renderer.draw(glm::ortho(0.f, (float)width, (float)height, 0.f));
 
-        SDL_GL_SwapWindow(window);
+            SDL_GL_SwapWindow(window);
+        }
+        render_stats::global().end_frame();
+        allocation_tracker::global().end_frame();
     }
 
     SDL_GL_DeleteContext(gl_context);
@@ -1,42 +1,103 @@
 #include "msdf_loader.hpp"
+#include "json_arena.hpp"
 
 #include <rapidjson/document.h>
-#include <rapidjson/istreamwrapper.h>
 
 #include <fstream>
 #include <stdexcept>
 #include <filesystem>
+#include <vector>
+#include <algorithm>
+
+msdf_font::glyph & msdf_font::glyph_table::insert(char32_t code)
+{
+    if (code < latin1_.size())
+    {
+        if (!latin1_present_[code])
+        {
+            latin1_present_[code] = true;
+            ++latin1_count_;
+        }
+        return latin1_[code];
+    }
+
+    auto it = std::lower_bound(codes_.begin(), codes_.end(), code);
+    auto index = it - codes_.begin();
+    if (it == codes_.end() || *it != code)
+    {
+        codes_.insert(it, code);
+        others_.insert(others_.begin() + index, glyph{});
+    }
+    return others_[index];
+}
+
+void msdf_font::glyph_table::erase(char32_t code)
+{
+    if (code < latin1_.size())
+    {
+        if (latin1_present_[code])
+        {
+            latin1_present_[code] = false;
+            --latin1_count_;
+        }
+        return;
+    }
+
+    auto it = std::lower_bound(codes_.begin(), codes_.end(), code);
+    if (it == codes_.end() || *it != code)
+        return;
+
+    others_.erase(others_.begin() + (it - codes_.begin()));
+    codes_.erase(it);
+}
 
 msdf_font load_msdf_font(std::string const & path)
 {
-    rapidjson::Document document;
+    auto & arena = thread_json_arena();
+    auto const pool = arena.pool();
+    rapidjson::MemoryPoolAllocator<> allocator(pool.data(), pool.size());
+    rapidjson::Document document(&allocator);
 
     {
         std::ifstream input(path, std::ios::binary);
-        rapidjson::IStreamWrapper stream(input);
-        document.ParseStream(stream);
+        if (!input)
+            throw std::runtime_error("Failed to open " + path);
+
+        // Read in one go straight into the buffer it is parsed in
+        auto const size = std::filesystem::file_size(path);
+        char * const text = arena.text(size);
+        input.read(text, size);
+
+        document.ParseInsitu(text);
+        if (document.HasParseError())
+            throw std::runtime_error("Failed to parse " + path);
+
+        arena.record_pool_use(allocator.Capacity());
     }
 
     msdf_font result;
 
-    {
-        auto pages = document["pages"].GetArray();
-        assert(pages.Size() == 1);
-        result.texture_path = (std::filesystem::path(path).parent_path() / pages[0].GetString()).string();
-    }
+    for (auto const & page : document["pages"].GetArray())
+        result.texture_paths.push_back((std::filesystem::path(path).parent_path() / page.GetString()).string());
 
     {
         auto const & sdf = document["distanceField"];
         result.sdf_scale = sdf["distanceRange"].GetFloat();
     }
 
+    result.size = document["info"]["size"].GetFloat();
+    result.line_height = document["common"]["lineHeight"].GetFloat();
+    result.base = document["common"]["base"].GetFloat();
+    result.page_width = document["common"]["scaleW"].GetInt();
+    result.page_height = document["common"]["scaleH"].GetInt();
+
     auto chars = document["chars"].GetArray();
 
     for (auto const & charInfo : chars)
     {
         char32_t id = charInfo["id"].GetUint();
 
-        auto & data = result.glyphs[id];
+        auto & data = result.glyphs.insert(id);
         data.x = charInfo["x"].GetInt();
         data.y = charInfo["y"].GetInt();
         data.width = charInfo["width"].GetInt();
@@ -44,6 +105,8 @@ msdf_font load_msdf_font(std::string const & path)
         data.xoffset = charInfo["xoffset"].GetInt();
         data.yoffset = charInfo["yoffset"].GetInt();
         data.advance = charInfo["xadvance"].GetInt();
+        if (charInfo.HasMember("page"))
+            data.page = charInfo["page"].GetInt();
     }
 
     return result;
@@ -1,11 +1,15 @@
 #pragma once
 
 #include <string>
-#include <unordered_map>
+#include <vector>
+#include <array>
+#include <algorithm>
 
 struct msdf_font
 {
-    std::string texture_path;
+    // One atlas page per path, all of the same size
+    std::vector<std::string> texture_paths;
+    int page_width, page_height;
 
     struct glyph
     {
@@ -13,10 +17,59 @@ struct msdf_font
         int width, height;
         int xoffset, yoffset;
         int advance;
+        int page = 0;
+        // Index into the glyph metrics the atlas keeps on the GPU
+        int slot = 0;
     };
 
-    std::unordered_map<char32_t, glyph> glyphs;
+    // Latin-1 code points index a dense table directly, the rest are binary searched in
+    // a flat array sorted by code point, so layout never hashes or chases buckets
+    struct glyph_table
+    {
+        glyph const * find(char32_t code) const
+        {
+            if (code < latin1_.size())
+                return latin1_present_[code] ? &latin1_[code] : nullptr;
+
+            auto it = std::lower_bound(codes_.begin(), codes_.end(), code);
+            if (it == codes_.end() || *it != code)
+                return nullptr;
+            return &others_[it - codes_.begin()];
+        }
+
+        // Adds the glyph if missing; the reference is valid until the next insert
+        glyph & insert(char32_t code);
+        void erase(char32_t code);
+
+        std::size_t size() const { return latin1_count_ + others_.size(); }
+
+        template <typename Function>
+        void for_each(Function && function)
+        {
+            for (std::size_t code = 0; code < latin1_.size(); ++code)
+                if (latin1_present_[code])
+                    function(static_cast<char32_t>(code), latin1_[code]);
+            for (std::size_t i = 0; i < others_.size(); ++i)
+                function(codes_[i], others_[i]);
+        }
+
+    private:
+        std::array<glyph, 256> latin1_{};
+        std::array<bool, 256> latin1_present_{};
+        std::size_t latin1_count_ = 0;
+
+        std::vector<char32_t> codes_;
+        std::vector<glyph> others_;
+    };
+
+    glyph_table glyphs;
     float sdf_scale;
+
+    // Size the font was rasterized at, in the same units as the glyph metrics, the
+    // distance between baselines of two lines and from the top of a line to its baseline
+    float size;
+    float line_height;
+    float base;
 };
 
 msdf_font load_msdf_font(std::string const & path);
@@ -0,0 +1,461 @@
+#include "text_renderer.hpp"
+#include "render_stats.hpp"
+
+#include <algorithm>
+
+namespace
+{
+
+    // Atlas slots and palette indices are packed into one attribute, the quad corner comes
+    // from the vertex index of a four vertex strip
+    const char vertex_shader_source[] =
+R"(#version 330 core
+
+uniform mat4 transform;
+uniform float page_size;
+
+layout (std140) uniform glyph_metrics
+{
+    uvec4 glyphs[1024];
+};
+
+layout (std140) uniform text_palette
+{
+    vec4 colors[256];
+};
+
+layout (location = 0) in vec2 in_position;
+layout (location = 1) in uvec2 in_glyph_color;
+layout (location = 2) in float in_scale;
+
+out vec3 texcoord;
+out vec4 color;
+
+void main()
+{
+    uvec4 glyph = glyphs[in_glyph_color.x];
+    vec2 rect_position = vec2(glyph.x & 0xffffu, glyph.x >> 16);
+    vec2 rect_size = vec2(glyph.y & 0xffffu, glyph.y >> 16);
+    vec2 offset = vec2(ivec2(glyph.z & 0xffffu, glyph.z >> 16) - 32768);
+
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+
+    gl_Position = transform * vec4(in_position + (offset + corner * rect_size) * in_scale, 0.0, 1.0);
+    texcoord = vec3((rect_position + corner * rect_size) / page_size, float(glyph.w));
+    color = colors[in_glyph_color.y];
+}
+)";
+
+    // sdf_scale is the distance range in atlas texels; scaled by the screen pixels per
+    // texel it gives a one pixel wide edge at any size
+    const char fragment_shader_source[] =
+R"(#version 330 core
+
+uniform sampler2DArray sdf_texture;
+uniform float sdf_scale;
+
+in vec3 texcoord;
+in vec4 color;
+
+layout (location = 0) out vec4 out_color;
+
+float median(vec3 v)
+{
+    return max(min(v.r, v.g), min(max(v.r, v.g), v.b));
+}
+
+void main()
+{
+    vec2 texel_range = vec2(sdf_scale) / vec2(textureSize(sdf_texture, 0).xy);
+    float pixel_range = max(0.5 * dot(texel_range, vec2(1.0) / fwidth(texcoord.xy)), 1.0);
+
+    float sdf = median(texture(sdf_texture, texcoord).rgb) - 0.5;
+    float alpha = clamp(sdf * pixel_range + 0.5, 0.0, 1.0);
+
+    out_color = vec4(color.rgb, color.a * alpha);
+}
+)";
+
+    // Decodes the code point starting at text[i] and moves i past it; malformed
+    // sequences decode to U+FFFD one byte at a time
+    char32_t decode_utf8(std::string const & text, std::size_t & i)
+    {
+        unsigned char lead = text[i++];
+        if (lead < 0x80)
+            return lead;
+
+        int length;
+        char32_t result;
+        if ((lead & 0xe0) == 0xc0)
+        {
+            length = 1;
+            result = lead & 0x1f;
+        }
+        else if ((lead & 0xf0) == 0xe0)
+        {
+            length = 2;
+            result = lead & 0x0f;
+        }
+        else if ((lead & 0xf8) == 0xf0)
+        {
+            length = 3;
+            result = lead & 0x07;
+        }
+        else
+            return 0xfffd;
+
+        if (i + length > text.size())
+            return 0xfffd;
+
+        for (int j = 0; j < length; ++j)
+        {
+            unsigned char c = text[i + j];
+            if ((c & 0xc0) != 0x80)
+                return 0xfffd;
+            result = (result << 6) | (c & 0x3f);
+        }
+
+        i += length;
+        return result;
+    }
+
+}
+
+text_renderer::text_renderer(program_cache & programs, glyph_atlas & atlas)
+    : atlas_(atlas)
+{
+    program_ = programs.get({{GL_VERTEX_SHADER, vertex_shader_source}, {GL_FRAGMENT_SHADER, fragment_shader_source}});
+
+    transform_location_ = glGetUniformLocation(program_, "transform");
+    sdf_scale_location_ = glGetUniformLocation(program_, "sdf_scale");
+
+    glUseProgram(program_);
+    glUniform1i(glGetUniformLocation(program_, "sdf_texture"), 0);
+
+    page_size_location_ = glGetUniformLocation(program_, "page_size");
+    glUniformBlockBinding(program_, glGetUniformBlockIndex(program_, "glyph_metrics"), 0);
+    glUniformBlockBinding(program_, glGetUniformBlockIndex(program_, "text_palette"), 1);
+
+    glGenBuffers(1, &palette_buffer_);
+    glBindBuffer(GL_UNIFORM_BUFFER, palette_buffer_);
+    glBufferData(GL_UNIFORM_BUFFER, max_colors * sizeof(glm::vec4), nullptr, GL_DYNAMIC_DRAW);
+
+    glGenVertexArrays(1, &vao_);
+    glBindVertexArray(vao_);
+
+    glGenBuffers(1, &instance_buffer_);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_buffer_);
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(instance), (void*)offsetof(instance, position));
+    glVertexAttribDivisor(0, 1);
+    glEnableVertexAttribArray(1);
+    glVertexAttribIPointer(1, 2, GL_UNSIGNED_SHORT, sizeof(instance), (void*)offsetof(instance, glyph));
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(instance), (void*)offsetof(instance, scale));
+    glVertexAttribDivisor(2, 1);
+}
+
+text_renderer::~text_renderer()
+{
+    glDeleteBuffers(1, &instance_buffer_);
+    glDeleteBuffers(1, &palette_buffer_);
+    glDeleteVertexArrays(1, &vao_);
+}
+
+text_renderer::label_id text_renderer::add_label(std::string text, glm::vec2 const & position, float size, glm::vec4 const & color)
+{
+    auto & l = labels_.emplace_back();
+    l.text = std::move(text);
+    l.position = position;
+    l.size = size;
+    l.color = palette_index(color);
+    buffer_dirty_ = true;
+    return labels_.size() - 1;
+}
+
+void text_renderer::set_text(label_id label, std::string text)
+{
+    auto & l = labels_.at(label);
+    if (l.text == text)
+        return;
+
+    // The line holding the first changed byte is the last one starting at or before it
+    std::size_t const changed = std::mismatch(l.text.begin(), l.text.end(), text.begin(), text.end()).first - l.text.begin();
+    auto const it = std::upper_bound(l.lines.begin(), l.lines.end(), changed,
+        [](std::size_t offset, line const & entry){ return offset < entry.text_begin; });
+
+    l.text = std::move(text);
+    invalidate(l, it == l.lines.begin() ? 0 : it - l.lines.begin() - 1);
+}
+
+void text_renderer::set_position(label_id label, glm::vec2 const & position)
+{
+    auto & l = labels_.at(label);
+    if (l.position == position)
+        return;
+
+    // Instances are relative to the position, only the buffer needs refilling
+    l.position = position;
+    l.stale = 0;
+    buffer_dirty_ = true;
+}
+
+void text_renderer::set_color(label_id label, glm::vec4 const & color)
+{
+    auto & l = labels_.at(label);
+    auto index = palette_index(color);
+    if (l.color == index)
+        return;
+
+    l.color = index;
+    for (auto & i : l.instances)
+        i.color = index;
+    l.stale = 0;
+    buffer_dirty_ = true;
+}
+
+std::uint16_t text_renderer::palette_index(glm::vec4 const & color)
+{
+    glm::u8vec4 packed(glm::clamp(color, 0.f, 1.f) * 255.f + 0.5f);
+
+    auto it = std::find(palette_.begin(), palette_.end(), packed);
+    if (it != palette_.end())
+        return it - palette_.begin();
+
+    if (palette_.size() == max_colors)
+        throw std::runtime_error("Text uses more than " + std::to_string(max_colors) + " colors");
+
+    palette_.push_back(packed);
+    palette_dirty_ = true;
+    return palette_.size() - 1;
+}
+
+glm::vec2 text_renderer::bounds(label_id label)
+{
+    auto & l = labels_.at(label);
+    if (l.dirty)
+        layout(l);
+    return l.bounds;
+}
+
+float text_renderer::line_height(float size) const
+{
+    return atlas_.font().line_height * size / atlas_.font().size;
+}
+
+void text_renderer::invalidate(label & l, std::size_t line)
+{
+    l.dirty_line = l.dirty ? std::min(l.dirty_line, line) : line;
+    l.dirty = true;
+    buffer_dirty_ = true;
+}
+
+void text_renderer::layout(label & l)
+{
+    auto const & font = atlas_.font();
+    float const scale = l.size / font.size;
+    float const line_height = font.line_height * scale;
+
+    // Lines before the dirty one keep their glyphs, as neither their text nor anything before
+    // it changed; a text that was never laid out has no lines yet and starts from the beginning
+    std::size_t const first = l.lines.empty() ? 0 : std::min(l.dirty_line, l.lines.size() - 1);
+    line current = l.lines.empty() ? line{} : l.lines[first];
+    current.width = 0.f;
+    current.pages = 0;
+    current.missing = false;
+
+    l.lines.resize(first);
+    l.instances.resize(current.instance_begin);
+    l.stale = std::min(l.stale, current.instance_begin);
+
+    glm::vec2 pen(0.f, first * line_height);
+
+    for (std::size_t i = current.text_begin; i < l.text.size();)
+    {
+        // ASCII skips the decoder entirely
+        char32_t c = static_cast<unsigned char>(l.text[i]);
+        if (c < 0x80)
+            ++i;
+        else
+            c = decode_utf8(l.text, i);
+
+        if (c == U'\n')
+        {
+            l.lines.push_back(current);
+            current = line{i, l.instances.size()};
+            pen.x = 0.f;
+            pen.y += line_height;
+            continue;
+        }
+
+        auto const * found = atlas_.find(c);
+        if (!found)
+        {
+            current.missing |= atlas_.pending(c);
+            continue;
+        }
+
+        auto const & g = *found;
+
+        if (g.width > 0 && g.height > 0)
+            l.instances.push_back({pen, static_cast<std::uint16_t>(g.slot), l.color, scale});
+
+        pen.x += g.advance * scale;
+        current.pages |= 1u << g.page;
+        current.width = std::max(current.width, pen.x);
+    }
+
+    l.lines.push_back(current);
+
+    l.bounds = glm::vec2(0.f, l.lines.size() * line_height);
+    l.pages = 0;
+    l.missing = false;
+    for (auto const & entry : l.lines)
+    {
+        l.bounds.x = std::max(l.bounds.x, entry.width);
+        l.pages |= entry.pages;
+        l.missing |= entry.missing;
+    }
+
+    l.dirty = false;
+}
+
+void text_renderer::draw(glm::mat4 const & transform)
+{
+    std::uint32_t used = 0;
+    for (auto const & l : labels_)
+        used |= l.pages;
+    atlas_.touch(used);
+
+    if (auto changes = atlas_.update(); changes.added || changes.evicted)
+    {
+        for (auto & l : labels_)
+        {
+            if (!(changes.added && l.missing) && !(l.pages & changes.evicted))
+                continue;
+
+            for (std::size_t i = 0; i < l.lines.size(); ++i)
+            {
+                if ((changes.added && l.lines[i].missing) || (l.lines[i].pages & changes.evicted))
+                {
+                    invalidate(l, i);
+                    break;
+                }
+            }
+        }
+    }
+
+    if (buffer_dirty_)
+    {
+        for (auto & l : labels_)
+            if (l.dirty)
+                layout(l);
+
+        // A label that outgrows its slots gets twice as many and the labels after it move
+        // along, rewriting all their slots; a new label gets just as many as it needs
+        std::size_t offset = 0;
+        for (auto & l : labels_)
+        {
+            bool const grew = l.instances.size() > l.capacity;
+            if (grew || l.offset != offset)
+            {
+                if (grew && l.offset != none)
+                    l.capacity = std::max(l.instances.size(), 2 * l.capacity);
+                else
+                    l.capacity = std::max(l.instances.size(), l.capacity);
+                l.offset = offset;
+                l.uploaded = l.capacity;
+                l.stale = 0;
+            }
+            offset += l.capacity;
+        }
+
+        staging_.resize(offset);
+
+        // staging_ mirrors the buffer, only the range that changed in it is written
+        std::size_t first = offset;
+        std::size_t last = 0;
+        for (auto & l : labels_)
+        {
+            if (l.stale == none)
+                continue;
+
+            // Slots the label no longer uses get zero sized instances
+            std::size_t const end = std::max(l.instances.size(), l.uploaded);
+            for (std::size_t i = l.stale; i < end; ++i)
+            {
+                auto & slot = staging_[l.offset + i];
+                if (i < l.instances.size())
+                {
+                    slot = l.instances[i];
+                    slot.position += l.position;
+                }
+                else
+                    slot = instance{};
+            }
+
+            if (l.stale < end)
+            {
+                first = std::min(first, l.offset + l.stale);
+                last = std::max(last, l.offset + end);
+            }
+
+            l.uploaded = l.instances.size();
+            l.stale = none;
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, instance_buffer_);
+        if (staging_.size() > buffer_capacity_)
+        {
+            glBufferData(GL_ARRAY_BUFFER, staging_.size() * sizeof(instance), staging_.data(), GL_DYNAMIC_DRAW);
+            buffer_capacity_ = staging_.size();
+            RENDER_STATS_ADD(bytes_uploaded, staging_.size() * sizeof(instance));
+        }
+        else if (first < last)
+        {
+            glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(instance), (last - first) * sizeof(instance), staging_.data() + first);
+            RENDER_STATS_ADD(bytes_uploaded, (last - first) * sizeof(instance));
+        }
+
+        instance_count_ = staging_.size();
+        buffer_dirty_ = false;
+    }
+
+    if (palette_dirty_)
+    {
+        std::vector<glm::vec4> colors(palette_.begin(), palette_.end());
+        for (auto & c : colors)
+            c /= 255.f;
+
+        glBindBuffer(GL_UNIFORM_BUFFER, palette_buffer_);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, colors.size() * sizeof(colors[0]), colors.data());
+        RENDER_STATS_ADD(bytes_uploaded, colors.size() * sizeof(colors[0]));
+        palette_dirty_ = false;
+    }
+
+    if (instance_count_ == 0)
+        return;
+
+    glUseProgram(program_);
+    glUniformMatrix4fv(transform_location_, 1, GL_FALSE, reinterpret_cast<float const *>(&transform));
+    glUniform1f(sdf_scale_location_, atlas_.font().sdf_scale);
+    glUniform1f(page_size_location_, atlas_.page_size());
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, atlas_.metrics_buffer());
+    glBindBufferBase(GL_UNIFORM_BUFFER, 1, palette_buffer_);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, atlas_.texture());
+
+    glBindVertexArray(vao_);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instance_count_);
+
+    // Program, the two uniform blocks and the vertex array; a quad per glyph
+    RENDER_STATS_ADD(state_changes, 4);
+    RENDER_STATS_ADD(uniform_uploads, 3);
+    RENDER_STATS_ADD(texture_binds, 1);
+    RENDER_STATS_ADD(draw_calls, 1);
+    RENDER_STATS_ADD(triangles, 2 * instance_count_);
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#include "glyph_atlas.hpp"
+#include "program_cache.hpp"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Draws any number of text labels from an MSDF glyph atlas in one instanced draw call. Every
+// glyph is one 16 byte instance (position, atlas metrics slot, palette index, scale) that the
+// vertex shader expands into a quad from the atlas metrics buffer. Every label keeps its
+// instances laid out line by line, and an edit lays out again only from the first line it
+// changed, so typing at the end of a long text costs one line. Each label owns a range of
+// the shared instance buffer with room to grow, padded with zero sized instances, and only
+// the instances that changed are written to it, so static text costs nothing. Lines are laid
+// out again when glyphs they were missing arrive in the atlas or glyphs they use are evicted.
+struct text_renderer
+{
+    using label_id = std::size_t;
+
+    static constexpr int max_colors = 256;
+
+    // The atlas must outlive the renderer, and the program is owned by the cache
+    text_renderer(program_cache & programs, glyph_atlas & atlas);
+    ~text_renderer();
+
+    text_renderer(text_renderer const &) = delete;
+    text_renderer & operator = (text_renderer const &) = delete;
+
+    // UTF-8 text; position is the top-left corner of the first line, size the height of
+    // the font in the same units, so that in pixels with a pixel transform. At most
+    // max_colors different colors can be used at once.
+    label_id add_label(std::string text, glm::vec2 const & position, float size, glm::vec4 const & color);
+
+    // Lines before the first byte that differs from the current text keep their layout, and
+    // setting the same text again does nothing
+    void set_text(label_id label, std::string text);
+    void set_position(label_id label, glm::vec2 const & position);
+    void set_color(label_id label, glm::vec4 const & color);
+
+    // Extent of the laid out text from its position
+    glm::vec2 bounds(label_id label);
+
+    // Distance between the lines of text of that size
+    float line_height(float size) const;
+
+    // transform maps label positions to clip space; blending is left to the caller.
+    // Updates the atlas too.
+    void draw(glm::mat4 const & transform);
+
+private:
+    struct instance
+    {
+        // Pen position of the glyph, the font's metrics are applied in the shader
+        glm::vec2 position;
+        std::uint16_t glyph;
+        std::uint16_t color;
+        float scale;
+    };
+
+    static_assert(sizeof(instance) == 16);
+
+    static constexpr std::size_t none = -1;
+
+    struct line
+    {
+        // Where the line starts in the text and its glyphs in the instances
+        std::size_t text_begin = 0;
+        std::size_t instance_begin = 0;
+        float width = 0.f;
+
+        // Atlas layers its glyphs use, one bit each, and whether some glyph was not there yet
+        std::uint32_t pages = 0;
+        bool missing = false;
+    };
+
+    struct label
+    {
+        std::string text;
+        glm::vec2 position;
+        float size;
+        std::uint16_t color;
+
+        // Relative to position, with the color already written in
+        std::vector<instance> instances;
+        std::vector<line> lines;
+        glm::vec2 bounds{0.f};
+
+        // The lines from dirty_line on have to be laid out again
+        bool dirty = true;
+        std::size_t dirty_line = 0;
+
+        // Of all lines
+        std::uint32_t pages = 0;
+        bool missing = false;
+
+        // Slots of the instance buffer from offset on, the instances the buffer holds for the
+        // label, and the first of them that is out of date, none if it is not
+        std::size_t offset = none;
+        std::size_t capacity = 0;
+        std::size_t uploaded = 0;
+        std::size_t stale = 0;
+    };
+
+    void invalidate(label & l, std::size_t line);
+    void layout(label & l);
+    std::uint16_t palette_index(glm::vec4 const & color);
+
+    glyph_atlas & atlas_;
+
+    std::vector<label> labels_;
+    std::vector<instance> staging_;
+    bool buffer_dirty_ = true;
+    std::size_t instance_count_ = 0;
+    std::size_t buffer_capacity_ = 0;
+
+    // Quantized to 8 bits per channel so that nearly equal colors share an entry
+    std::vector<glm::u8vec4> palette_;
+    bool palette_dirty_ = false;
+
+    GLuint program_ = 0;
+    GLuint transform_location_ = 0;
+    GLuint sdf_scale_location_ = 0;
+    GLuint page_size_location_ = 0;
+    GLuint vao_ = 0;
+    GLuint instance_buffer_ = 0;
+    GLuint palette_buffer_ = 0;
+};
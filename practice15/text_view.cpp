@@ -0,0 +1,160 @@
+#include "text_view.hpp"
+#include "job_system.hpp"
+#include "render_stats.hpp"
+
+#include <bit>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXT_VIEW_SSE
+#endif
+
+namespace
+{
+
+    // Per thread, so that one that finishes early has some to steal
+    constexpr std::size_t chunks_per_thread = 4;
+
+    // Appends the offset past every line break in [begin, end) of text
+    void find_line_starts(char const * text, std::size_t begin, std::size_t end, std::vector<std::uint64_t> & starts)
+    {
+        std::size_t i = begin;
+
+#if defined(TEXT_VIEW_SSE)
+        // 16 bytes compared at once, then one bit per line break found
+        __m128i const newline = _mm_set1_epi8('\n');
+        for (; i + 16 <= end; i += 16)
+        {
+            __m128i const block = _mm_loadu_si128(reinterpret_cast<__m128i const *>(text + i));
+            for (unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)); mask != 0; mask &= mask - 1)
+                starts.push_back(i + std::countr_zero(mask) + 1);
+        }
+#endif
+
+        for (; i < end; ++i)
+            if (text[i] == '\n')
+                starts.push_back(i + 1);
+    }
+
+}
+
+std::vector<std::uint64_t> build_line_index(std::string_view text, job_system & jobs)
+{
+    std::size_t const chunk_count = std::max<std::size_t>(1, std::min(jobs.thread_count() * chunks_per_thread, text.size() >> 16));
+    std::vector<std::vector<std::uint64_t>> chunks(chunk_count);
+
+    jobs.parallel_for(chunk_count, [&](std::size_t i)
+    {
+        find_line_starts(text.data(), text.size() * i / chunk_count, text.size() * (i + 1) / chunk_count, chunks[i]);
+    });
+
+    // Where every chunk's starts go, after the first line's
+    std::vector<std::size_t> offsets(chunk_count + 1, 1);
+    for (std::size_t i = 0; i < chunk_count; ++i)
+        offsets[i + 1] = offsets[i] + chunks[i].size();
+
+    std::vector<std::uint64_t> result(offsets.back());
+    result[0] = 0;
+    jobs.parallel_for(chunk_count, [&](std::size_t i)
+    {
+        std::copy(chunks[i].begin(), chunks[i].end(), result.begin() + offsets[i]);
+    });
+
+    if (result.size() > 1 && result.back() == text.size())
+        result.pop_back();
+    return result;
+}
+
+text_view::text_view(text_renderer & renderer, std::filesystem::path const & path, job_system & jobs,
+    float size, glm::vec4 const & color, std::size_t max_line_bytes)
+    : renderer_(renderer)
+    , file_(path)
+    , line_starts_(build_line_index(file_.view(), jobs))
+    , size_(size)
+    , color_(color)
+    , max_line_bytes_(max_line_bytes)
+    , line_height_(renderer.line_height(size))
+{}
+
+void text_view::set_viewport(glm::vec2 const & position, glm::vec2 const & size)
+{
+    std::size_t const rows = std::max(0.f, std::floor(size.y / line_height_));
+    if (position == position_ && rows == rows_)
+        return;
+
+    position_ = position;
+    rows_ = rows;
+    dirty_ = true;
+    scroll_to(first_line_);
+}
+
+void text_view::scroll_to(std::int64_t line)
+{
+    std::int64_t const last = std::max<std::int64_t>(0, std::int64_t(line_count()) - std::int64_t(rows_));
+    std::size_t const first = std::clamp<std::int64_t>(line, 0, last);
+    if (first == first_line_)
+        return;
+
+    first_line_ = first;
+    dirty_ = true;
+}
+
+std::string_view text_view::line_text(std::size_t line) const
+{
+    std::size_t const begin = line_starts_[line];
+    std::size_t end = line + 1 < line_count() ? line_starts_[line + 1] : file_.size();
+    if (end > begin && file_.data()[end - 1] == '\n')
+        --end;
+    if (end > begin && file_.data()[end - 1] == '\r')
+        --end;
+
+    // Not in the middle of a UTF-8 sequence
+    if (end - begin > max_line_bytes_)
+    {
+        end = begin + max_line_bytes_;
+        while (end > begin && (static_cast<unsigned char>(file_.data()[end]) & 0xc0) == 0x80)
+            --end;
+    }
+
+    return file_.view().substr(begin, end - begin);
+}
+
+void text_view::update()
+{
+    // Lines are the objects, and the ones out of the viewport are never laid out
+    std::size_t const visible = std::min(rows_, line_count() - first_line_);
+    RENDER_STATS_ADD(visible_objects, visible);
+    RENDER_STATS_ADD(culled_objects, line_count() - visible);
+
+    if (!dirty_)
+        return;
+
+    while (ring_.size() < rows_)
+        ring_.push_back({renderer_.add_label("", position_, size_, color_)});
+
+    // Line numbers map to other labels once the ring changes size, but a label that gets the
+    // line it showed or the same text keeps its layout
+    for (std::size_t i = 0; i < ring_.size(); ++i)
+    {
+        std::size_t line = none;
+        if (i < rows_)
+        {
+            line = first_line_ + (i + rows_ - first_line_ % rows_) % rows_;
+            if (line >= first_line_ + visible)
+                line = none;
+        }
+
+        auto & r = ring_[i];
+        if (r.line != line)
+        {
+            renderer_.set_text(r.label, line == none ? std::string() : std::string(line_text(line)));
+            r.line = line;
+        }
+        if (line != none)
+            renderer_.set_position(r.label, position_ + glm::vec2(0.f, (line - first_line_) * line_height_));
+    }
+
+    dirty_ = false;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "text_renderer.hpp"
+#include "mapped_file.hpp"
+
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+
+#include <filesystem>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+struct job_system;
+
+// Byte offsets of the line starts of text, the first being 0; a line break at the very end
+// starts no line. Chunks of the text are scanned for line breaks on all threads.
+std::vector<std::uint64_t> build_line_index(std::string_view text, job_system & jobs);
+
+// A read-only view of a text file too large to lay out at once, like a log of a hundred
+// megabytes. The file is mapped rather than read and only the line index is kept; the view
+// lays out just the lines in its viewport, each into a text_renderer label of its own. Labels
+// are kept in a ring indexed by line number, so that while scrolling the lines that stay in
+// view only move and only the ones scrolled in are laid out, into the labels of the ones
+// scrolled out, whose instance buffer slots they reuse. What the view costs per frame and in
+// the instance buffer thus depends on the viewport, not on the file.
+struct text_view
+{
+    // The renderer must outlive the view; lines longer than max_line_bytes are cut there
+    text_view(text_renderer & renderer, std::filesystem::path const & path, job_system & jobs,
+        float size, glm::vec4 const & color, std::size_t max_line_bytes = 1024);
+
+    text_view(text_view const &) = delete;
+    text_view & operator = (text_view const &) = delete;
+
+    std::size_t line_count() const { return line_starts_.size(); }
+    std::size_t file_size() const { return file_.size(); }
+
+    // Top-left corner and size of the area the lines are drawn in, in the renderer's units
+    void set_viewport(glm::vec2 const & position, glm::vec2 const & size);
+
+    // Whole lines, so that no line is cut by the viewport; clamped to the file
+    std::size_t first_line() const { return first_line_; }
+    void scroll_to(std::int64_t line);
+    void scroll(std::int64_t lines) { scroll_to(std::int64_t(first_line_) + lines); }
+
+    // Lines that fit in the viewport
+    std::size_t rows() const { return rows_; }
+
+    // Points the labels at the visible lines; call before text_renderer::draw
+    void update();
+
+private:
+    static constexpr std::size_t none = -1;
+
+    struct row
+    {
+        text_renderer::label_id label;
+        std::size_t line = none;
+    };
+
+    std::string_view line_text(std::size_t line) const;
+
+    text_renderer & renderer_;
+    mapped_file file_;
+    std::vector<std::uint64_t> line_starts_;
+
+    float size_;
+    glm::vec4 color_;
+    std::size_t max_line_bytes_;
+    float line_height_;
+
+    glm::vec2 position_{0.f};
+    std::size_t rows_ = 0;
+    std::size_t first_line_ = 0;
+    bool dirty_ = true;
+
+    // All labels ever made, the first rows_ of them in use; labels cannot be removed, so the
+    // rest are kept empty for when the viewport grows again
+    std::vector<row> ring_;
+};
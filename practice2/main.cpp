@@ -11,7 +11,12 @@
 #include <stdexcept>
 #include <iostream>
 #include <chrono>
-#include <unordered_map>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+
+#include "vertex_pulling.hpp"
+#include "program_cache.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -28,83 +33,6 @@ void glew_fail(std::string_view message, GLenum error)
     throw std::runtime_error(to_string(message) + reinterpret_cast<const char *>(glewGetErrorString(error)));
 }
 
-const char vertex_shader_source[] =
-R"(#version 330 core
-
-const vec2 VERTICES[3] = vec2[3](
-    vec2(0.0, 1.0),
-    vec2(-sqrt(0.75), -0.5),
-    vec2( sqrt(0.75), -0.5)
-);
-
-const vec3 COLORS[3] = vec3[3](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
-
-out vec3 color;
-
-void main()
-{
-    vec2 position = VERTICES[gl_VertexID];
-    gl_Position = vec4(position, 0.0, 1.0);
-    color = COLORS[gl_VertexID];
-}
-)";
-
-const char fragment_shader_source[] =
-R"(#version 330 core
-
-in vec3 color;
-
-layout (location = 0) out vec4 out_color;
-
-void main()
-{
-    out_color = vec4(color, 1.0);
-}
-)";
-
-GLuint create_shader(GLenum type, const char * source)
-{
-    GLuint result = glCreateShader(type);
-    glShaderSource(result, 1, &source, nullptr);
-    glCompileShader(result);
-    GLint status;
-    glGetShaderiv(result, GL_COMPILE_STATUS, &status);
-    if (status != GL_TRUE)
-    {
-        GLint info_log_length;
-        glGetShaderiv(result, GL_INFO_LOG_LENGTH, &info_log_length);
-        std::string info_log(info_log_length, '\0');
-        glGetShaderInfoLog(result, info_log.size(), nullptr, info_log.data());
-        throw std::runtime_error("Shader compilation failed: " + info_log);
-    }
-    return result;
-}
-
-GLuint create_program(GLuint vertex_shader, GLuint fragment_shader)
-{
-    GLuint result = glCreateProgram();
-    glAttachShader(result, vertex_shader);
-    glAttachShader(result, fragment_shader);
-    glLinkProgram(result);
-
-    GLint status;
-    glGetProgramiv(result, GL_LINK_STATUS, &status);
-    if (status != GL_TRUE)
-    {
-        GLint info_log_length;
-        glGetProgramiv(result, GL_INFO_LOG_LENGTH, &info_log_length);
-        std::string info_log(info_log_length, '\0');
-        glGetProgramInfoLog(result, info_log.size(), nullptr, info_log.data());
-        throw std::runtime_error("Program linkage failed: " + info_log);
-    }
-
-    return result;
-}
-
 int main() try
 {
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
@@ -139,15 +67,42 @@ int main() try
 
     glClearColor(0.8f, 0.8f, 1.f, 0.f);
 
-    GLuint vertex_shader = create_shader(GL_VERTEX_SHADER, vertex_shader_source);
-    GLuint fragment_shader = create_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
+    program_cache programs(std::string(PROJECT_ROOT) + "/.program_binaries");
 
-    GLuint program = create_program(vertex_shader, fragment_shader);
+    // Three meshes of different layouts, all in one draw
+    pulled_meshes meshes(programs);
 
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
+    // A triangle of float vertices without indices
+    float const pi = std::acos(-1.f);
+    std::vector<pulled_meshes::float_vertex> triangle;
+    for (int i = 0; i < 3; ++i)
+    {
+        float const angle = pi / 2.f + 2.f * pi * i / 3.f;
+        triangle.push_back({{0.4f * std::cos(angle), 0.4f * std::sin(angle)}, {i == 0 ? 1.f : 0.f, i == 1 ? 1.f : 0.f, i == 2 ? 1.f : 0.f}});
+    }
+    meshes.add(triangle);
+
+    // A hexagon of quantized vertices, a fan around its centre with 16-bit indices
+    auto const snorm16 = [](float value){ return static_cast<std::int16_t>(std::round(value * 32767.f)); };
+    std::vector<pulled_meshes::packed_vertex> hexagon{{{snorm16(-0.6f), 0}, {255, 255, 255, 255}}};
+    std::vector<std::uint16_t> hexagon_indices;
+    for (int i = 0; i < 6; ++i)
+    {
+        float const angle = 2.f * pi * i / 6.f;
+        hexagon.push_back({{snorm16(-0.6f + 0.25f * std::cos(angle)), snorm16(0.25f * std::sin(angle))}, {255, static_cast<std::uint8_t>(40 * i), 0, 255}});
+        hexagon_indices.insert(hexagon_indices.end(), {0, std::uint16_t(1 + i), std::uint16_t(1 + (i + 1) % 6)});
+    }
+    meshes.add(hexagon, hexagon_indices);
+
+    // A square of float vertices with 32-bit indices
+    meshes.add(std::vector<pulled_meshes::float_vertex>{
+        {{0.4f, -0.2f}, {0.f, 0.f, 1.f}},
+        {{0.8f, -0.2f}, {0.f, 1.f, 1.f}},
+        {{0.8f, 0.2f}, {1.f, 1.f, 1.f}},
+        {{0.4f, 0.2f}, {1.f, 0.f, 1.f}},
+    }, {0, 1, 2, 0, 2, 3});
 
-    std::unordered_map<SDL_Keycode, bool> key_down;
+    meshes.upload();
 
     auto last_frame_start = std::chrono::high_resolution_clock::now();
 
@@ -168,12 +123,6 @@ int main() try
                 break;
             }
             break;
-        case SDL_KEYDOWN:
-            key_down[event.key.keysym.sym] = true;
-            break;
-        case SDL_KEYUP:
-            key_down[event.key.keysym.sym] = false;
-            break;
         }
 
         if (!running)
@@ -185,9 +134,7 @@ int main() try
 
         glClear(GL_COLOR_BUFFER_BIT);
 
-        glUseProgram(program);
-        glBindVertexArray(vao);
-        glDrawArrays(GL_TRIANGLES, 0, 3);
+        meshes.draw();
 
         SDL_GL_SwapWindow(window);
     }
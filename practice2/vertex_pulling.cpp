@@ -0,0 +1,202 @@
+#include "vertex_pulling.hpp"
+
+#include <stdexcept>
+#include <string>
+#include <cstring>
+
+namespace
+{
+
+    // Formats of the descriptor's second word, which has the index size in bytes above them
+    constexpr std::uint32_t float_format = 0;
+    constexpr std::uint32_t packed_format = 1;
+
+    constexpr std::size_t descriptor_words = 4;
+
+    static_assert(sizeof(pulled_meshes::float_vertex) == 5 * sizeof(std::uint32_t));
+    static_assert(sizeof(pulled_meshes::packed_vertex) == 2 * sizeof(std::uint32_t));
+
+    // Every mesh's descriptor is four words: its first corner, its format and index size,
+    // and the word offsets of its vertices and indices. Packed words are little endian, as
+    // the host wrote them.
+    const char vertex_shader_source[] =
+R"(#version 330 core
+
+uniform usamplerBuffer words;
+uniform int mesh_count;
+
+out vec3 color;
+
+uint word(int index)
+{
+    return texelFetch(words, index).x;
+}
+
+float snorm16(uint bits)
+{
+    return max(float(int(bits << 16u) >> 16) / 32767.0, -1.0);
+}
+
+void main()
+{
+    // The last mesh that starts at or before this corner
+    int low = 0;
+    int high = mesh_count - 1;
+    while (low < high)
+    {
+        int middle = (low + high + 1) / 2;
+        if (int(word(middle * 4)) <= gl_VertexID)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+
+    int descriptor = low * 4;
+    int corner = gl_VertexID - int(word(descriptor));
+    uint format = word(descriptor + 1);
+    int vertex_offset = int(word(descriptor + 2));
+    int index_offset = int(word(descriptor + 3));
+
+    int vertex = corner;
+    uint index_size = format >> 8u;
+    if (index_size == 2u)
+        vertex = int((word(index_offset + corner / 2) >> (16u * uint(corner % 2))) & 0xffffu);
+    else if (index_size == 4u)
+        vertex = int(word(index_offset + corner));
+
+    vec2 position;
+    if ((format & 0xffu) == 0u)
+    {
+        int base = vertex_offset + vertex * 5;
+        position = uintBitsToFloat(uvec2(word(base), word(base + 1)));
+        color = uintBitsToFloat(uvec3(word(base + 2), word(base + 3), word(base + 4)));
+    }
+    else
+    {
+        int base = vertex_offset + vertex * 2;
+        uint packed_position = word(base);
+        position = vec2(snorm16(packed_position), snorm16(packed_position >> 16u));
+        color = vec3((uvec3(word(base + 1)) >> uvec3(0u, 8u, 16u)) & 0xffu) / 255.0;
+    }
+
+    gl_Position = vec4(position, 0.0, 1.0);
+}
+)";
+
+    const char fragment_shader_source[] =
+R"(#version 330 core
+
+in vec3 color;
+
+layout (location = 0) out vec4 out_color;
+
+void main()
+{
+    out_color = vec4(color, 1.0);
+}
+)";
+
+}
+
+pulled_meshes::pulled_meshes(program_cache & programs)
+{
+    program_ = programs.get({{GL_VERTEX_SHADER, vertex_shader_source}, {GL_FRAGMENT_SHADER, fragment_shader_source}});
+
+    words_location_ = glGetUniformLocation(program_, "words");
+    mesh_count_location_ = glGetUniformLocation(program_, "mesh_count");
+
+    // Never given an attribute
+    glGenVertexArrays(1, &vao_);
+    glGenBuffers(1, &buffer_);
+
+    glGenTextures(1, &texture_);
+    glBindTexture(GL_TEXTURE_BUFFER, texture_);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, buffer_);
+}
+
+pulled_meshes::~pulled_meshes()
+{
+    glDeleteTextures(1, &texture_);
+    glDeleteBuffers(1, &buffer_);
+    glDeleteVertexArrays(1, &vao_);
+}
+
+void pulled_meshes::add(std::vector<float_vertex> const & vertices, std::vector<std::uint32_t> const & indices)
+{
+    add(float_format, vertices.data(), vertices.size() * 5, indices.empty() ? 0 : 4, indices.data(), indices.size(),
+        indices.empty() ? vertices.size() : indices.size());
+}
+
+void pulled_meshes::add(std::vector<packed_vertex> const & vertices, std::vector<std::uint16_t> const & indices)
+{
+    add(packed_format, vertices.data(), vertices.size() * 2, indices.empty() ? 0 : 2, indices.data(), indices.size(),
+        indices.empty() ? vertices.size() : indices.size());
+}
+
+void pulled_meshes::add(std::uint32_t format, void const * vertices, std::size_t vertex_words, std::uint32_t index_size, void const * indices, std::size_t index_count, std::uint32_t corner_count)
+{
+    if (corner_count % 3 != 0)
+        throw std::runtime_error("Mesh corners do not make whole triangles");
+
+    auto & result = meshes_.emplace_back();
+    result.format = format;
+    result.index_size = index_size;
+    result.corner_count = corner_count;
+
+    result.vertex_offset = data_.size();
+    data_.resize(data_.size() + vertex_words);
+    if (vertex_words > 0)
+        std::memcpy(data_.data() + result.vertex_offset, vertices, vertex_words * sizeof(std::uint32_t));
+
+    // 16-bit indices two to a word, the last one padded
+    result.index_offset = data_.size();
+    std::size_t const index_bytes = index_count * index_size;
+    data_.resize(data_.size() + (index_bytes + sizeof(std::uint32_t) - 1) / sizeof(std::uint32_t), 0);
+    if (index_bytes > 0)
+        std::memcpy(data_.data() + result.index_offset, indices, index_bytes);
+}
+
+void pulled_meshes::upload()
+{
+    std::size_t const header_words = meshes_.size() * descriptor_words;
+
+    std::vector<std::uint32_t> words;
+    words.reserve(header_words + data_.size());
+
+    corner_count_ = 0;
+    for (auto const & mesh : meshes_)
+    {
+        words.push_back(corner_count_);
+        words.push_back(mesh.format | (mesh.index_size << 8));
+        words.push_back(header_words + mesh.vertex_offset);
+        words.push_back(header_words + mesh.index_offset);
+        corner_count_ += mesh.corner_count;
+    }
+    words.insert(words.end(), data_.begin(), data_.end());
+
+    GLint max_texels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+    if (words.size() > static_cast<std::size_t>(max_texels))
+        throw std::runtime_error("Meshes do not fit a buffer texture");
+
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer_);
+    glBufferData(GL_TEXTURE_BUFFER, words.size() * sizeof(words[0]), words.data(), GL_STATIC_DRAW);
+
+    uploaded_meshes_ = meshes_.size();
+}
+
+void pulled_meshes::draw()
+{
+    if (corner_count_ == 0)
+        return;
+
+    glUseProgram(program_);
+    glUniform1i(words_location_, 0);
+    glUniform1i(mesh_count_location_, uploaded_meshes_);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, texture_);
+
+    glBindVertexArray(vao_);
+    glDrawArrays(GL_TRIANGLES, 0, corner_count_);
+}
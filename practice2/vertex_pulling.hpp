@@ -0,0 +1,77 @@
+#pragma once
+
+#include "program_cache.hpp"
+
+#include <GL/glew.h>
+
+#include <vector>
+#include <cstdint>
+
+// Meshes of different vertex layouts and index sizes packed into one buffer of 32-bit words and
+// drawn together by a single non-indexed draw from an empty vertex array. gl_VertexID counts
+// through the corners of every mesh's triangles; the vertex shader finds the mesh it is in, then
+// fetches the index if the mesh has them, and the vertex, decoding it by the mesh's layout. No
+// layout is described by a vertex array, so there is nothing to switch between meshes.
+//
+// The words are read through a buffer texture rather than a storage buffer, so GL 3.3 is enough;
+// they have to fit GL_MAX_TEXTURE_BUFFER_SIZE texels, at least 64K of them.
+struct pulled_meshes
+{
+    // Position as 2 floats, color as 3; 5 words
+    struct float_vertex
+    {
+        float position[2];
+        float color[3];
+    };
+
+    // Position as 2 snorm16 in the first word, color as 4 unorm8 in the second
+    struct packed_vertex
+    {
+        std::int16_t position[2];
+        std::uint8_t color[4];
+    };
+
+    // The program is owned by the cache
+    explicit pulled_meshes(program_cache & programs);
+    ~pulled_meshes();
+
+    pulled_meshes(pulled_meshes const &) = delete;
+    pulled_meshes & operator = (pulled_meshes const &) = delete;
+
+    // Without indices every three vertices are a triangle. The meshes are drawn after the next upload().
+    void add(std::vector<float_vertex> const & vertices, std::vector<std::uint32_t> const & indices = {});
+    void add(std::vector<packed_vertex> const & vertices, std::vector<std::uint16_t> const & indices = {});
+
+    void upload();
+
+    // One draw of every uploaded mesh; binds its own program, vertex array and texture unit 0
+    void draw();
+
+    // Triangle corners drawn
+    GLsizei corner_count() const { return corner_count_; }
+
+private:
+    struct mesh
+    {
+        std::uint32_t format;
+        std::uint32_t index_size;
+        std::uint32_t corner_count;
+        std::size_t vertex_offset;
+        std::size_t index_offset;
+    };
+
+    void add(std::uint32_t format, void const * vertices, std::size_t vertex_words, std::uint32_t index_size, void const * indices, std::size_t index_count, std::uint32_t corner_count);
+
+    // Vertices and indices of the added meshes, their descriptors are put in front by upload()
+    std::vector<std::uint32_t> data_;
+    std::vector<mesh> meshes_;
+    GLsizei corner_count_ = 0;
+    GLint uploaded_meshes_ = 0;
+
+    GLuint program_ = 0;
+    GLint words_location_ = -1;
+    GLint mesh_count_location_ = -1;
+    GLuint vao_ = 0;
+    GLuint buffer_ = 0;
+    GLuint texture_ = 0;
+};
@@ -0,0 +1,327 @@
+#include "bezier.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+    // 5 point Gauss-Legendre rule on [-1, 1], exact for polynomials up to degree 9
+    constexpr double gauss_nodes[5] = {-0.9061798459386640, -0.5384693101056831, 0.0, 0.5384693101056831, 0.9061798459386640};
+    constexpr double gauss_weights[5] = {0.2369268850561891, 0.4786286704993665, 0.5688888888888889, 0.4786286704993665, 0.2369268850561891};
+
+    // Steps of t in the table per degree; the speed is the square root of a polynomial of
+    // twice the degree, so that is what the steps have to keep within reach of the rule
+    constexpr std::size_t arc_length_steps_per_degree = 8;
+    constexpr std::size_t min_arc_length_steps = 16;
+
+    // Newton steps from the linear guess within a step of the table; the length is close to
+    // linear in t over a step, so they converge to float precision well before that
+    constexpr int newton_iterations = 3;
+
+}
+
+bezier_curve::bezier_curve(std::vector<vec2> const & control_points)
+{
+    set_control_points(control_points);
+}
+
+void bezier_curve::set_control_points(std::vector<vec2> const & control_points)
+{
+    auto const same = [](vec2 const & a, vec2 const & b){ return a.x == b.x && a.y == b.y; };
+    if (std::equal(control_points.begin(), control_points.end(), control_points_.begin(), control_points_.end(), same))
+        return;
+
+    control_points_.assign(control_points.begin(), control_points.end());
+    lengths_valid_ = false;
+
+    std::size_t const n = control_points.size();
+    x_.assign(n, 0.0);
+    y_.assign(n, 0.0);
+    vx_.assign(n > 0 ? n - 1 : 0, 0.0);
+    vy_.assign(n > 0 ? n - 1 : 0, 0.0);
+    if (n == 0)
+        return;
+
+    // c_k = C(n - 1, k) * sum_i (-1)^(k - i) C(k, i) P_i
+    double outer = 1.0;
+    for (std::size_t k = 0; k < n; ++k)
+    {
+        double inner = 1.0;
+        double sx = 0.0, sy = 0.0;
+        for (std::size_t i = 0; i <= k; ++i)
+        {
+            double const sign = ((k - i) & 1) ? -1.0 : 1.0;
+            sx += sign * inner * control_points[i].x;
+            sy += sign * inner * control_points[i].y;
+            inner = inner * (k - i) / (i + 1);
+        }
+
+        x_[k] = outer * sx;
+        y_[k] = outer * sy;
+        outer = outer * (n - 1 - k) / (k + 1);
+    }
+
+    for (std::size_t k = 1; k < n; ++k)
+    {
+        vx_[k - 1] = k * x_[k];
+        vy_[k - 1] = k * y_[k];
+    }
+}
+
+vec2 bezier_curve::operator()(float t) const
+{
+    double x = 0.0, y = 0.0;
+    for (std::size_t k = x_.size(); k-- > 0;)
+    {
+        x = x * t + x_[k];
+        y = y * t + y_[k];
+    }
+    return {static_cast<float>(x), static_cast<float>(y)};
+}
+
+void bezier_curve::tessellate(std::size_t count, std::vector<vec2> & output)
+{
+    output.resize(empty() ? 0 : count);
+    if (output.empty())
+        return;
+
+    if (count == 1)
+    {
+        output[0] = (*this)(0.f);
+        return;
+    }
+
+    std::size_t const n = x_.size();
+    double const step = 1.0 / (count - 1);
+
+    // Forward differences of every order at t = 0, straight from the coefficients:
+    // the j-th difference of (m h)^k at m = 0 is h^k j! S(k, j), with S the Stirling
+    // numbers of the second kind. Differencing sampled values instead cancels so badly
+    // that curves of degree 7 and up come apart.
+    stirling_.assign(n * n, 0.0);
+    stirling_[0] = 1.0;
+    for (std::size_t k = 1; k < n; ++k)
+        for (std::size_t j = 1; j <= k; ++j)
+            stirling_[k * n + j] = j * stirling_[(k - 1) * n + j] + stirling_[(k - 1) * n + j - 1];
+
+    dx_.assign(n, 0.0);
+    dy_.assign(n, 0.0);
+    double power = 1.0;
+    for (std::size_t k = 0; k < n; ++k)
+    {
+        double factorial = 1.0;
+        for (std::size_t j = 0; j <= k; ++j)
+        {
+            double const weight = power * factorial * stirling_[k * n + j];
+            dx_[j] += x_[k] * weight;
+            dy_[j] += y_[k] * weight;
+            factorial *= j + 1;
+        }
+        power *= step;
+    }
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        output[i] = {static_cast<float>(dx_[0]), static_cast<float>(dy_[0])};
+        for (std::size_t j = 0; j + 1 < n; ++j)
+        {
+            dx_[j] += dx_[j + 1];
+            dy_[j] += dy_[j + 1];
+        }
+    }
+}
+
+float bezier_curve::length()
+{
+    build_arc_length();
+    return lengths_.empty() ? 0.f : static_cast<float>(lengths_.back());
+}
+
+float bezier_curve::t_at_distance(float distance)
+{
+    build_arc_length();
+    if (lengths_.size() < 2)
+        return 0.f;
+
+    // The last step whose start is at most the distance
+    std::size_t const steps = lengths_.size() - 1;
+    std::size_t const step = std::upper_bound(lengths_.begin(), lengths_.end() - 1, distance) - lengths_.begin();
+    return static_cast<float>(t_at_distance(distance, step > 0 ? std::min(step - 1, steps - 1) : 0));
+}
+
+void bezier_curve::sample_evenly(std::size_t count, std::vector<vec2> & output)
+{
+    build_arc_length();
+    output.resize(empty() ? 0 : count);
+    if (output.empty())
+        return;
+
+    if (count == 1 || lengths_.size() < 2)
+    {
+        std::fill(output.begin(), output.end(), (*this)(0.f));
+        return;
+    }
+
+    std::size_t const steps = lengths_.size() - 1;
+    double const total = lengths_.back();
+
+    std::size_t step = 0;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        double const distance = total * i / (count - 1);
+        while (step + 1 < steps && lengths_[step + 1] <= distance)
+            ++step;
+        output[i] = (*this)(static_cast<float>(t_at_distance(distance, step)));
+    }
+}
+
+void bezier_curve::build_arc_length()
+{
+    if (lengths_valid_)
+        return;
+    lengths_valid_ = true;
+
+    lengths_.clear();
+    if (degree() == 0)
+        return;
+
+    std::size_t const steps = std::max(min_arc_length_steps, arc_length_steps_per_degree * degree());
+    lengths_.resize(steps + 1);
+    lengths_[0] = 0.0;
+    for (std::size_t i = 0; i < steps; ++i)
+        lengths_[i + 1] = lengths_[i] + length_between(double(i) / steps, double(i + 1) / steps);
+}
+
+double bezier_curve::speed(double t) const
+{
+    double x = 0.0, y = 0.0;
+    for (std::size_t k = vx_.size(); k-- > 0;)
+    {
+        x = x * t + vx_[k];
+        y = y * t + vy_[k];
+    }
+    return std::hypot(x, y);
+}
+
+double bezier_curve::length_between(double t0, double t1) const
+{
+    double const half = (t1 - t0) * 0.5;
+    double const middle = (t0 + t1) * 0.5;
+
+    double result = 0.0;
+    for (int i = 0; i < 5; ++i)
+        result += gauss_weights[i] * speed(middle + half * gauss_nodes[i]);
+    return result * half;
+}
+
+double bezier_curve::t_at_distance(double distance, std::size_t step) const
+{
+    std::size_t const steps = lengths_.size() - 1;
+    double const t0 = double(step) / steps;
+    double const t1 = double(step + 1) / steps;
+
+    double const start = lengths_[step];
+    double const span = lengths_[step + 1] - start;
+    double const target = std::clamp(distance - start, 0.0, span);
+    // A step the curve does not move over, e.g. at a point where it stops
+    if (span <= 0.0)
+        return t0;
+
+    // Newton's method on the length from the step's start, whose derivative is the speed;
+    // kept within the step, where the length only grows
+    double t = t0 + (t1 - t0) * target / span;
+    for (int i = 0; i < newton_iterations; ++i)
+    {
+        double const s = speed(t);
+        if (s <= 0.0)
+            break;
+        t = std::clamp(t - (length_between(t0, t) - target) / s, t0, t1);
+    }
+    return t;
+}
+
+void bezier_flattener::flatten(std::vector<vec2> const & control_points, float tolerance, std::size_t max_points, std::vector<vec2> & output)
+{
+    output.clear();
+    if (control_points.size() < 2)
+    {
+        output.assign(control_points.begin(), control_points.end());
+        return;
+    }
+
+    size_ = control_points.size();
+    pool_.assign(control_points.begin(), control_points.end());
+    heap_.clear();
+    heap_.push_back({0.f, 1.f, error(0), 0});
+
+    auto const by_error = [](piece const & a, piece const & b){ return a.error < b.error; };
+
+    // n pieces make n + 1 points
+    while (heap_.size() + 1 < max_points && heap_.front().error > tolerance)
+    {
+        std::pop_heap(heap_.begin(), heap_.end(), by_error);
+        piece const worst = heap_.back();
+        heap_.pop_back();
+
+        float const middle = (worst.t0 + worst.t1) * 0.5f;
+        if (middle <= worst.t0 || middle >= worst.t1)
+        {
+            // Out of float precision, it stays as it is
+            heap_.push_back({worst.t0, worst.t1, 0.f, worst.offset});
+            std::push_heap(heap_.begin(), heap_.end(), by_error);
+            continue;
+        }
+
+        // De Casteljau at the middle: the left half's control points are the first point of
+        // every level and the right half's the last, which are left in place by the averaging
+        std::size_t const left = pool_.size();
+        std::size_t const right = left + size_;
+        pool_.resize(right + size_);
+
+        vec2 * points = pool_.data();
+        std::copy(points + worst.offset, points + worst.offset + size_, points + right);
+
+        for (std::size_t k = 0; k < size_; ++k)
+        {
+            points[left + k] = points[right];
+            for (std::size_t i = 0; i + k + 1 < size_; ++i)
+            {
+                points[right + i].x = (points[right + i].x + points[right + i + 1].x) * 0.5f;
+                points[right + i].y = (points[right + i].y + points[right + i + 1].y) * 0.5f;
+            }
+        }
+
+        heap_.push_back({worst.t0, middle, error(left), left});
+        std::push_heap(heap_.begin(), heap_.end(), by_error);
+        heap_.push_back({middle, worst.t1, error(right), right});
+        std::push_heap(heap_.begin(), heap_.end(), by_error);
+    }
+
+    std::sort(heap_.begin(), heap_.end(), [](piece const & a, piece const & b){ return a.t0 < b.t0; });
+
+    for (auto const & p : heap_)
+        output.push_back(pool_[p.offset]);
+    output.push_back(control_points.back());
+}
+
+float bezier_flattener::error(std::size_t offset) const
+{
+    vec2 const a = pool_[offset];
+    vec2 const b = pool_[offset + size_ - 1];
+    float const dx = b.x - a.x;
+    float const dy = b.y - a.y;
+    float const length_squared = dx * dx + dy * dy;
+
+    // Distance to the chord segment rather than its line, so that control points past
+    // its ends count too
+    float result = 0.f;
+    for (std::size_t i = 1; i + 1 < size_; ++i)
+    {
+        vec2 const p = pool_[offset + i];
+        float t = length_squared > 0.f ? ((p.x - a.x) * dx + (p.y - a.y) * dy) / length_squared : 0.f;
+        t = std::clamp(t, 0.f, 1.f);
+        result = std::max(result, std::hypot(p.x - a.x - t * dx, p.y - a.y - t * dy));
+    }
+    return result;
+}
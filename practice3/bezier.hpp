@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+struct vec2
+{
+    float x;
+    float y;
+};
+
+// A Bezier curve converted once from its control points to power basis coefficients, so
+// that a point costs one Horner evaluation and a run of evenly spaced points one addition
+// per coefficient each, instead of De Casteljau's algorithm for every parameter value.
+//
+// Distances along the curve come from a table of its arc length at evenly spaced t, each
+// step integrated by Gauss-Legendre quadrature of the speed. Every control point moves the
+// whole curve, so the table is rebuilt whole, and only when the control points do change.
+struct bezier_curve
+{
+    bezier_curve() = default;
+    explicit bezier_curve(std::vector<vec2> const & control_points);
+
+    // Keeps the coefficient storage, so a curve edited every frame does not allocate; does
+    // nothing if the control points are the ones the curve already has
+    void set_control_points(std::vector<vec2> const & control_points);
+
+    std::size_t degree() const { return x_.empty() ? 0 : x_.size() - 1; }
+    bool empty() const { return x_.empty(); }
+
+    vec2 operator()(float t) const;
+
+    // Replaces output with count points at evenly spaced t from 0 to 1, found by forward
+    // differencing; output keeps its capacity, so nothing is allocated once it is large enough
+    void tessellate(std::size_t count, std::vector<vec2> & output);
+
+    // The arc length table is built by the first of these after the control points change
+    float length();
+
+    // The t at which the curve has gone distance along itself, clamped to the curve; a binary
+    // search of the table, then Newton steps within the step of t it found
+    float t_at_distance(float distance);
+
+    // Like tessellate(), but the points are evenly spaced along the curve rather than in t.
+    // The table is walked instead of searched, since the distances only grow.
+    void sample_evenly(std::size_t count, std::vector<vec2> & output);
+
+private:
+    void build_arc_length();
+    double speed(double t) const;
+    double length_between(double t0, double t1) const;
+    // Within the table's step, whose start is at most distance along the curve
+    double t_at_distance(double distance, std::size_t step) const;
+
+    std::vector<vec2> control_points_;
+
+    // Coefficient of t^k at index k. Forward differences of high degree curves lose
+    // precision quickly in float, so all of this is in double.
+    std::vector<double> x_, y_;
+    std::vector<double> dx_, dy_;
+    std::vector<double> stirling_;
+
+    // Coefficients of the derivative, of t^k at index k
+    std::vector<double> vx_, vy_;
+
+    // Length from t = 0 to t = i / (lengths_.size() - 1) at index i
+    std::vector<double> lengths_;
+    bool lengths_valid_ = false;
+};
+
+// Flattens a Bezier curve into a polyline within tolerance of it by De Casteljau subdivision.
+// A piece's error is the farthest distance of its control points from its chord, which
+// bounds how far the curve strays from it. The worst piece is always split first, so
+// straight spans get few points, tight bends many, and stopping at max_points leaves the
+// error as even as it can be.
+struct bezier_flattener
+{
+    // Replaces output with at most max_points points, but never fewer than the two ends;
+    // buffers are reused
+    void flatten(std::vector<vec2> const & control_points, float tolerance, std::size_t max_points, std::vector<vec2> & output);
+
+private:
+    struct piece
+    {
+        float t0, t1;
+        float error;
+        // Of the piece's control points in pool_
+        std::size_t offset;
+    };
+
+    float error(std::size_t offset) const;
+
+    std::size_t size_ = 0;
+    std::vector<vec2> pool_;
+    std::vector<piece> heap_;
+};
@@ -0,0 +1,219 @@
+#include "bezier_batch.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <cstdint>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define BEZIER_BATCH_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BEZIER_BATCH_SSE
+#endif
+
+namespace
+{
+
+    constexpr std::size_t lanes = bezier_batch::lanes;
+
+    // One block of the degree's curves: coefficients as packed by cull(), samples * 16 floats out
+    void evaluate_block(float const * coefficients, std::size_t degree, std::size_t samples, float * output)
+    {
+        float const * const x = coefficients;
+        float const * const y = coefficients + lanes;
+        std::size_t const stride = 2 * lanes;
+
+        for (std::size_t s = 0; s < samples; ++s, output += stride)
+        {
+            // Divided rather than stepped, so that the last sample is exactly the curve's end
+            float const t = float(s) / float(samples - 1);
+
+#if defined(BEZIER_BATCH_AVX)
+            __m256 const t8 = _mm256_set1_ps(t);
+            __m256 x8 = _mm256_loadu_ps(x + degree * stride);
+            __m256 y8 = _mm256_loadu_ps(y + degree * stride);
+            for (std::size_t k = degree; k-- > 0;)
+            {
+#if defined(__FMA__)
+                x8 = _mm256_fmadd_ps(x8, t8, _mm256_loadu_ps(x + k * stride));
+                y8 = _mm256_fmadd_ps(y8, t8, _mm256_loadu_ps(y + k * stride));
+#else
+                x8 = _mm256_add_ps(_mm256_mul_ps(x8, t8), _mm256_loadu_ps(x + k * stride));
+                y8 = _mm256_add_ps(_mm256_mul_ps(y8, t8), _mm256_loadu_ps(y + k * stride));
+#endif
+            }
+            _mm256_storeu_ps(output, x8);
+            _mm256_storeu_ps(output + lanes, y8);
+#elif defined(BEZIER_BATCH_SSE)
+            // The block as two halves of 4
+            __m128 const t4 = _mm_set1_ps(t);
+            for (std::size_t h = 0; h < lanes; h += 4)
+            {
+                __m128 x4 = _mm_loadu_ps(x + degree * stride + h);
+                __m128 y4 = _mm_loadu_ps(y + degree * stride + h);
+                for (std::size_t k = degree; k-- > 0;)
+                {
+                    x4 = _mm_add_ps(_mm_mul_ps(x4, t4), _mm_loadu_ps(x + k * stride + h));
+                    y4 = _mm_add_ps(_mm_mul_ps(y4, t4), _mm_loadu_ps(y + k * stride + h));
+                }
+                _mm_storeu_ps(output + h, x4);
+                _mm_storeu_ps(output + lanes + h, y4);
+            }
+#else
+            for (std::size_t i = 0; i < lanes; ++i)
+            {
+                float px = x[degree * stride + i];
+                float py = y[degree * stride + i];
+                for (std::size_t k = degree; k-- > 0;)
+                {
+                    px = px * t + x[k * stride + i];
+                    py = py * t + y[k * stride + i];
+                }
+                output[i] = px;
+                output[lanes + i] = py;
+            }
+#endif
+        }
+    }
+
+}
+
+void bezier_batch::clear()
+{
+    for (auto & group : groups_)
+    {
+        for (auto & c : group.x) c.clear();
+        for (auto & c : group.y) c.clear();
+        group.min_x.clear();
+        group.min_y.clear();
+        group.max_x.clear();
+        group.max_y.clear();
+    }
+
+    visible_.clear();
+    visible_blocks_ = 0;
+    packed_.clear();
+    packed_offsets_.clear();
+}
+
+void bezier_batch::add(std::vector<vec2> const & control_points)
+{
+    std::size_t const n = control_points.size();
+    if (n < 2 || n > max_degree + 1)
+        throw std::runtime_error("Batched curves need from 2 to " + std::to_string(max_degree + 1) + " control points");
+
+    auto & group = groups_[n - 2];
+
+    // Power basis as bezier_curve finds it, in double before rounding each coefficient once
+    double outer = 1.0;
+    for (std::size_t k = 0; k < n; ++k)
+    {
+        double inner = 1.0;
+        double sx = 0.0, sy = 0.0;
+        for (std::size_t i = 0; i <= k; ++i)
+        {
+            double const sign = ((k - i) & 1) ? -1.0 : 1.0;
+            sx += sign * inner * control_points[i].x;
+            sy += sign * inner * control_points[i].y;
+            inner = inner * (k - i) / (i + 1);
+        }
+
+        group.x[k].push_back(static_cast<float>(outer * sx));
+        group.y[k].push_back(static_cast<float>(outer * sy));
+        outer = outer * (n - 1 - k) / (k + 1);
+    }
+
+    vec2 min = control_points[0], max = control_points[0];
+    for (auto const & p : control_points)
+    {
+        min = {std::min(min.x, p.x), std::min(min.y, p.y)};
+        max = {std::max(max.x, p.x), std::max(max.y, p.y)};
+    }
+    group.min_x.push_back(min.x);
+    group.min_y.push_back(min.y);
+    group.max_x.push_back(max.x);
+    group.max_y.push_back(max.y);
+}
+
+std::size_t bezier_batch::size() const
+{
+    std::size_t result = 0;
+    for (auto const & group : groups_)
+        result += group.size();
+    return result;
+}
+
+std::size_t bezier_batch::visible_curves() const
+{
+    std::size_t result = 0;
+    for (auto const & range : visible_)
+        result += range.curve_count;
+    return result;
+}
+
+void bezier_batch::cull(vec2 const & min, vec2 const & max)
+{
+    visible_.clear();
+    visible_blocks_ = 0;
+    packed_.clear();
+    packed_offsets_.clear();
+
+    std::vector<std::uint32_t> indices;
+    for (std::size_t d = 1; d <= max_degree; ++d)
+    {
+        auto const & group = groups_[d - 1];
+
+        // Compacted without a branch, which would mispredict on every curve near the view's edges
+        indices.resize(group.size());
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < group.size(); ++i)
+        {
+            indices[count] = i;
+            count += (group.min_x[i] <= max.x) & (group.max_x[i] >= min.x) & (group.min_y[i] <= max.y) & (group.max_y[i] >= min.y);
+        }
+        if (count == 0)
+            continue;
+
+        std::size_t const blocks = (count + lanes - 1) / lanes;
+        std::size_t const block_floats = 2 * (d + 1) * lanes;
+        std::size_t const offset = packed_.size();
+        packed_.resize(offset + blocks * block_floats);
+
+        for (std::size_t b = 0; b < blocks; ++b)
+        {
+            float * const block = packed_.data() + offset + b * block_floats;
+            for (std::size_t lane = 0; lane < lanes; ++lane)
+            {
+                std::uint32_t const i = indices[std::min(b * lanes + lane, count - 1)];
+                for (std::size_t k = 0; k <= d; ++k)
+                {
+                    block[(2 * k) * lanes + lane] = group.x[k][i];
+                    block[(2 * k + 1) * lanes + lane] = group.y[k][i];
+                }
+            }
+        }
+
+        visible_.push_back({d, visible_blocks_, count});
+        packed_offsets_.push_back(offset);
+        visible_blocks_ += blocks;
+    }
+}
+
+void bezier_batch::evaluate(std::size_t samples, float * output) const
+{
+    if (samples < 2)
+        throw std::runtime_error("Batched curves need at least 2 samples");
+
+    std::size_t const block_output = samples * 2 * lanes;
+    for (std::size_t r = 0; r < visible_.size(); ++r)
+    {
+        auto const & range = visible_[r];
+        std::size_t const block_floats = 2 * (range.degree + 1) * lanes;
+        std::size_t const blocks = (range.curve_count + lanes - 1) / lanes;
+        for (std::size_t b = 0; b < blocks; ++b)
+            evaluate_block(packed_.data() + packed_offsets_[r] + b * block_floats, range.degree, samples,
+                output + (range.first_block + b) * block_output);
+    }
+}
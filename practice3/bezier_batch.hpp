@@ -0,0 +1,72 @@
+#pragma once
+
+#include "bezier.hpp"
+
+#include <vector>
+#include <array>
+#include <cstddef>
+
+// Many short curves evaluated together, a block of 8 of them at a time at the same t. The
+// curves are grouped by degree and kept as power basis coefficients, one array per
+// coefficient and coordinate, so that gathering the coefficient of 8 curves is a copy of
+// contiguous floats and evaluating them is one Horner step per coefficient for all 8 at once.
+//
+// Every curve also has the bounding box of its control points, which contains the curve, and
+// cull() keeps only the curves whose boxes overlap the view. The visible curves of a degree
+// are packed into blocks, the lanes past the last of them repeating it.
+struct bezier_batch
+{
+    static constexpr std::size_t lanes = 8;
+    static constexpr std::size_t max_degree = 7;
+
+    // The visible curves of a degree, written by evaluate() to the blocks from first_block on
+    struct range
+    {
+        std::size_t degree;
+        std::size_t first_block;
+        std::size_t curve_count;
+    };
+
+    void clear();
+
+    // From 2 to max_degree + 1 control points
+    void add(std::vector<vec2> const & control_points);
+
+    std::size_t size() const;
+
+    // Replaces the visible curves with those whose boxes overlap [min, max]
+    void cull(vec2 const & min, vec2 const & max);
+
+    std::vector<range> const & visible() const { return visible_; }
+    std::size_t visible_blocks() const { return visible_blocks_; }
+    std::size_t visible_curves() const;
+
+    // Evaluates the visible curves at samples evenly spaced t from 0 to 1, which has to be
+    // at least 2. A block takes samples * 16 floats of output: for every sample the x of its
+    // 8 curves, then their y. Nothing is read back, so output can be a write-only mapping.
+    void evaluate(std::size_t samples, float * output) const;
+
+    std::size_t output_floats(std::size_t samples) const { return visible_blocks_ * samples * 2 * lanes; }
+
+private:
+    struct degree_group
+    {
+        // Coefficient of t^k of every curve at index k
+        std::array<std::vector<float>, max_degree + 1> x, y;
+        std::vector<float> min_x, min_y, max_x, max_y;
+
+        std::size_t size() const { return min_x.size(); }
+    };
+
+    // Of degree d at index d - 1
+    std::array<degree_group, max_degree> groups_;
+
+    std::vector<range> visible_;
+    std::size_t visible_blocks_ = 0;
+
+    // The coefficients of the visible blocks: for a block of degree d, coefficient k of x of
+    // its 8 curves at (2 k) * 8, of y at (2 k + 1) * 8, and the next block after 2 (d + 1) * 8
+    std::vector<float> packed_;
+    // Where each visible range starts in packed_
+    std::vector<std::size_t> packed_offsets_;
+};
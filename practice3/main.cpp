@@ -12,6 +12,14 @@
 #include <iostream>
 #include <chrono>
 #include <vector>
+#include <cstdint>
+#include <cmath>
+#include <random>
+
+#include "bezier.hpp"
+#include "bezier_batch.hpp"
+#include "polyline.hpp"
+#include "frame_pacer.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -28,20 +36,73 @@ void glew_fail(std::string_view message, GLenum error)
     throw std::runtime_error(to_string(message) + reinterpret_cast<const char *>(glewGetErrorString(error)));
 }
 
-const char vertex_shader_source[] =
+// Evaluates the curve at t = gl_VertexID / (sample_count - 1) straight from the control
+// points vertex buffer, read as floats (x, y, packed color) through a buffer texture.
+// Bernstein polynomials are summed in powers of t / (1 - t), mirrored for t > 1/2 so that
+// the ratio stays at most 1.
+const char curve_vertex_shader_source[] =
 R"(#version 330 core
 
 uniform mat4 view;
+uniform samplerBuffer control_points;
+uniform int control_point_count;
+uniform int sample_count;
+uniform vec4 curve_color;
+
+out vec4 color;
+
+vec2 control_point(int i)
+{
+    return vec2(texelFetch(control_points, 3 * i).r, texelFetch(control_points, 3 * i + 1).r);
+}
+
+void main()
+{
+    int n = control_point_count - 1;
+    float t = float(gl_VertexID) / float(sample_count - 1);
+
+    bool mirrored = t > 0.5;
+    float u = mirrored ? 1.0 - t : t;
+    float ratio = u / (1.0 - u);
+
+    vec2 position = vec2(0.0);
+    float weight = 1.0;
+    for (int i = 0; i <= n; ++i)
+    {
+        position += weight * control_point(mirrored ? n - i : i);
+        weight *= ratio * float(n - i) / float(i + 1);
+    }
+    position *= pow(1.0 - u, float(n));
 
-layout (location = 0) in vec2 in_position;
-layout (location = 1) in vec4 in_color;
+    gl_Position = view * vec4(position, 0.0, 1.0);
+    color = curve_color;
+}
+)";
+
+// The map overlay's curves as lines between their samples, read from the batch output through
+// a buffer texture: a block of 8 curves is sample_count groups of 8 x and then 8 y
+const char map_vertex_shader_source[] =
+R"(#version 330 core
+
+uniform mat4 view;
+uniform samplerBuffer samples;
+uniform int first_block;
+uniform int sample_count;
+uniform vec4 map_color;
 
 out vec4 color;
 
 void main()
 {
-    gl_Position = view * vec4(in_position, 0.0, 1.0);
-    color = in_color;
+    int segment = gl_VertexID / 2;
+    int curve = segment / (sample_count - 1);
+    int sample = segment % (sample_count - 1) + gl_VertexID % 2;
+
+    int base = ((first_block + curve / 8) * sample_count + sample) * 16 + curve % 8;
+    vec2 position = vec2(texelFetch(samples, base).r, texelFetch(samples, base + 8).r);
+
+    gl_Position = view * vec4(position, 0.0, 1.0);
+    color = map_color;
 }
 )";
 
@@ -97,35 +158,12 @@ GLuint create_program(GLuint vertex_shader, GLuint fragment_shader)
     return result;
 }
 
-struct vec2
-{
-    float x;
-    float y;
-};
-
 struct vertex
 {
     vec2 position;
     std::uint8_t color[4];
 };
 
-vec2 bezier(std::vector<vertex> const & vertices, float t)
-{
-    std::vector<vec2> points(vertices.size());
-
-    for (std::size_t i = 0; i < vertices.size(); ++i)
-        points[i] = vertices[i].position;
-
-    // De Casteljau's algorithm
-    for (std::size_t k = 0; k + 1 < vertices.size(); ++k) {
-        for (std::size_t i = 0; i + k + 1 < vertices.size(); ++i) {
-            points[i].x = points[i].x * (1.f - t) + points[i + 1].x * t;
-            points[i].y = points[i].y * (1.f - t) + points[i + 1].y * t;
-        }
-    }
-    return points[0];
-}
-
 int main() try
 {
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
@@ -135,8 +173,6 @@ int main() try
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
     SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
-    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 1);
-    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 4);
 
     SDL_Window * window = SDL_CreateWindow("Graphics course practice 3",
         SDL_WINDOWPOS_CENTERED,
@@ -154,8 +190,6 @@ int main() try
     if (!gl_context)
         sdl2_fail("SDL_GL_CreateContext: ");
 
-    SDL_GL_SetSwapInterval(0);
-
     if (auto result = glewInit(); result != GLEW_NO_ERROR)
         glew_fail("glewInit: ", result);
 
@@ -164,20 +198,124 @@ int main() try
 
     glClearColor(0.8f, 0.8f, 1.f, 0.f);
 
-    auto vertex_shader = create_shader(GL_VERTEX_SHADER, vertex_shader_source);
     auto fragment_shader = create_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
-    auto program = create_program(vertex_shader, fragment_shader);
 
-    GLuint view_location = glGetUniformLocation(program, "view");
+    auto curve_vertex_shader = create_shader(GL_VERTEX_SHADER, curve_vertex_shader_source);
+    auto curve_program = create_program(curve_vertex_shader, fragment_shader);
+
+    GLuint curve_view_location = glGetUniformLocation(curve_program, "view");
+    GLuint control_point_count_location = glGetUniformLocation(curve_program, "control_point_count");
+    GLuint sample_count_location = glGetUniformLocation(curve_program, "sample_count");
+    GLuint curve_color_location = glGetUniformLocation(curve_program, "curve_color");
+
+    glUseProgram(curve_program);
+    glUniform1i(glGetUniformLocation(curve_program, "control_points"), 0);
+
+    auto map_vertex_shader = create_shader(GL_VERTEX_SHADER, map_vertex_shader_source);
+    auto map_program = create_program(map_vertex_shader, fragment_shader);
+
+    GLuint map_view_location = glGetUniformLocation(map_program, "view");
+    GLuint map_first_block_location = glGetUniformLocation(map_program, "first_block");
+    GLuint map_sample_count_location = glGetUniformLocation(map_program, "sample_count");
+    GLuint map_color_location = glGetUniformLocation(map_program, "map_color");
+
+    glUseProgram(map_program);
+    glUniform1i(glGetUniformLocation(map_program, "samples"), 0);
+
+    auto polyline_vertex_shader = create_shader(GL_VERTEX_SHADER, polyline_renderer::vertex_shader_source);
+    auto polyline_fragment_shader = create_shader(GL_FRAGMENT_SHADER, polyline_renderer::fragment_shader_source);
+    auto polyline_program = create_program(polyline_vertex_shader, polyline_fragment_shader);
+
+    GLuint points_vbo;
+    glGenBuffers(1, &points_vbo);
+
+    static_assert(sizeof(vertex) == 3 * sizeof(float));
+
+    // The GPU path reads the same buffer, so dragging a point uploads just that point
+    GLuint points_texture;
+    glGenTextures(1, &points_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, points_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, points_vbo);
+
+    GLuint empty_vao;
+    glGenVertexArrays(1, &empty_vao);
+
+    // V overlays a map of many short curves, like the roads of a vector map. They are culled
+    // and evaluated again every frame, straight into a streamed buffer.
+    bezier_batch map_curves;
+    bool map_enabled = false;
+    std::size_t const map_curve_count = 100000;
+    std::size_t const map_samples = 16;
+    float map_time = 0.f;
+
+    GLuint map_vbo;
+    glGenBuffers(1, &map_vbo);
+
+    GLuint map_texture;
+    glGenTextures(1, &map_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, map_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, map_vbo);
+
+    // Control polygon, control points and the CPU curve; strokes are rebuilt when they change
+    polyline_renderer lines(polyline_program);
+    bool lines_changed = true;
+
+    std::vector<vertex> points;
+    std::vector<vec2> control_positions;
+    std::vector<vec2> curve_points;
+    bezier_curve curve;
+
+    // Curve samples per control polygon segment
+    int quality = 4;
+    bool curve_changed = true;
+
+    // Adaptive flattening keeps the curve within this many pixels of the polyline drawn,
+    // with at most curve_point_budget points per frame
+    bezier_flattener flattener;
+    bool adaptive = true;
+    float pixel_tolerance = 0.25f;
+    std::size_t const curve_point_budget = 1 << 16;
+
+    // Evaluates the curve in the vertex shader instead, quality samples per segment
+    bool gpu_curve = false;
+
+    // Without adaptive flattening, E spaces the samples evenly along the curve rather than in t
+    bool even_spacing = false;
+
+    // M sends a dot along the curve at a constant speed in curve units per second
+    polyline_renderer marker(polyline_program);
+    bool marker_enabled = false;
+    float const marker_speed = 200.f;
+
+    // Left clicks this close to a control point, in pixels, drag it
+    float const pick_radius = 8.f;
+    int dragged_point = -1;
+
+    // Points are in pixels at zoom 1, pixel = (point - view_offset) * zoom
+    float zoom = 1.f;
+    vec2 view_offset{0.f, 0.f};
+
+    // Uncapped but limited, so that dragging stays responsive without spinning a core; P cycles present modes
+    frame_pacer pacer(present_mode::uncapped, 240.f);
+    float print_time = 0.f;
 
     auto last_frame_start = std::chrono::high_resolution_clock::now();
 
     float time = 0.f;
 
+    // Nothing moves on its own, so by default a frame is drawn only after an event; O draws continuously
+    bool on_demand = true;
+    bool redraw = true;
+
     bool running = true;
     while (running)
     {
-        for (SDL_Event event; SDL_PollEvent(&event);) switch (event.type)
+        if (on_demand && !redraw && !marker_enabled)
+            SDL_WaitEvent(nullptr);
+
+        pacer.begin_frame();
+
+        for (SDL_Event event; SDL_PollEvent(&event); redraw = true) switch (event.type)
         {
         case SDL_QUIT:
             running = false;
@@ -188,6 +326,7 @@ int main() try
                 width = event.window.data1;
                 height = event.window.data2;
                 glViewport(0, 0, width, height);
+                curve_changed = true;
                 break;
             }
             break;
@@ -196,20 +335,126 @@ int main() try
             {
                 int mouse_x = event.button.x;
                 int mouse_y = event.button.y;
+                vec2 position{view_offset.x + mouse_x / zoom, view_offset.y + mouse_y / zoom};
+
+                for (int i = 0; i < points.size(); ++i)
+                    if (std::hypot(points[i].position.x - position.x, points[i].position.y - position.y) * zoom <= pick_radius)
+                        dragged_point = i;
+
+                if (dragged_point < 0)
+                {
+                    points.push_back({position, {64, 64, 64, 255}});
+                    curve_changed = true;
+                }
             }
             else if (event.button.button == SDL_BUTTON_RIGHT)
             {
-
+                if (!points.empty() && dragged_point < 0)
+                {
+                    points.pop_back();
+                    curve_changed = true;
+                }
+            }
+            break;
+        case SDL_MOUSEBUTTONUP:
+            if (event.button.button == SDL_BUTTON_LEFT)
+                dragged_point = -1;
+            break;
+        case SDL_MOUSEMOTION:
+            if (dragged_point >= 0)
+            {
+                auto & position = points[dragged_point].position;
+                position = {view_offset.x + event.motion.x / zoom, view_offset.y + event.motion.y / zoom};
+
+                if (gpu_curve)
+                {
+                    glBindBuffer(GL_ARRAY_BUFFER, points_vbo);
+                    glBufferSubData(GL_ARRAY_BUFFER, dragged_point * sizeof(vertex), sizeof(position), &position);
+                    lines_changed = true;
+                }
+                else
+                    curve_changed = true;
+            }
+            break;
+        case SDL_MOUSEWHEEL:
+            {
+                // Zooms around the cursor, which the tolerance in curve units changes with
+                int mouse_x, mouse_y;
+                SDL_GetMouseState(&mouse_x, &mouse_y);
+                vec2 anchor{view_offset.x + mouse_x / zoom, view_offset.y + mouse_y / zoom};
+                zoom *= std::pow(1.25f, (float)event.wheel.y);
+                view_offset = {anchor.x - mouse_x / zoom, anchor.y - mouse_y / zoom};
+                curve_changed = true;
             }
             break;
         case SDL_KEYDOWN:
-            if (event.key.keysym.sym == SDLK_LEFT)
+            if (event.key.keysym.sym == SDLK_a)
             {
-
+                adaptive = !adaptive;
+                curve_changed = true;
+            }
+            else if (event.key.keysym.sym == SDLK_g)
+            {
+                gpu_curve = !gpu_curve;
+                curve_changed = true;
+            }
+            else if (event.key.keysym.sym == SDLK_e)
+            {
+                even_spacing = !even_spacing;
+                curve_changed = true;
+            }
+            else if (event.key.keysym.sym == SDLK_m)
+                marker_enabled = !marker_enabled;
+            else if (event.key.keysym.sym == SDLK_v)
+            {
+                map_enabled = !map_enabled;
+                if (map_enabled && map_curves.size() == 0)
+                {
+                    // Quadratics and cubics a few tens of pixels long over a 20000 pixel square
+                    std::default_random_engine rng{138};
+                    std::uniform_real_distribution<float> position_distribution{-10000.f, 10000.f};
+                    std::uniform_real_distribution<float> offset_distribution{-30.f, 30.f};
+
+                    std::vector<vec2> control_points;
+                    for (std::size_t i = 0; i < map_curve_count; ++i)
+                    {
+                        vec2 const start{position_distribution(rng), position_distribution(rng)};
+                        control_points.assign({start});
+                        for (std::size_t k = (i % 2) ? 2 : 3; k-- > 0;)
+                        {
+                            vec2 const & last = control_points.back();
+                            control_points.push_back({last.x + offset_distribution(rng), last.y + offset_distribution(rng)});
+                        }
+                        map_curves.add(control_points);
+                    }
+                }
+            }
+            else if (event.key.keysym.sym == SDLK_p)
+                pacer.next_mode();
+            else if (event.key.keysym.sym == SDLK_o)
+                on_demand = !on_demand;
+            else if (event.key.keysym.sym == SDLK_LEFT && adaptive && !gpu_curve)
+            {
+                pixel_tolerance *= 2.f;
+                curve_changed = true;
+            }
+            else if (event.key.keysym.sym == SDLK_RIGHT && adaptive && !gpu_curve)
+            {
+                pixel_tolerance *= 0.5f;
+                curve_changed = true;
+            }
+            else if (event.key.keysym.sym == SDLK_LEFT)
+            {
+                if (quality > 1)
+                {
+                    --quality;
+                    curve_changed = true;
+                }
             }
             else if (event.key.keysym.sym == SDLK_RIGHT)
             {
-
+                ++quality;
+                curve_changed = true;
             }
             break;
         }
@@ -222,20 +467,138 @@ int main() try
         last_frame_start = now;
         time += dt;
 
-        glClear(GL_COLOR_BUFFER_BIT);
+        print_time += dt;
+        if (print_time >= 1.f)
+        {
+            pacer.print_summary(std::cout);
+            if (map_enabled)
+                std::cout << "Map: " << map_curves.visible_curves() << " of " << map_curves.size() << " curves visible, "
+                    << map_time * 1000.f << " ms to cull and evaluate" << std::endl;
+            print_time = 0.f;
+        }
 
+        if (on_demand && !redraw && !marker_enabled)
+            continue;
+        redraw = false;
+
+        // Curve units through window pixels, y going down, to clip space
         float view[16] =
         {
-            1.f, 0.f, 0.f, 0.f,
-            0.f, 1.f, 0.f, 0.f,
+            2.f * zoom / width, 0.f, 0.f, -2.f * zoom * view_offset.x / width - 1.f,
+            0.f, -2.f * zoom / height, 0.f, 2.f * zoom * view_offset.y / height + 1.f,
             0.f, 0.f, 1.f, 0.f,
             0.f, 0.f, 0.f, 1.f,
         };
 
-        glUseProgram(program);
-        glUniformMatrix4fv(view_location, 1, GL_TRUE, view);
+        if (curve_changed || lines_changed)
+        {
+            control_positions.clear();
+            for (auto const & p : points)
+                control_positions.push_back(p.position);
+
+            // Does nothing when only the view changed, so the arc length table is kept
+            curve.set_control_points(control_positions);
+        }
+
+        if (curve_changed)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, points_vbo);
+            glBufferData(GL_ARRAY_BUFFER, points.size() * sizeof(vertex), points.data(), GL_DYNAMIC_DRAW);
+
+            if (gpu_curve)
+                curve_points.clear();
+            else if (adaptive)
+            {
+                // A pixel spans 2 / width in clip space, divided by how much the view scales x
+                float const tolerance = pixel_tolerance * 2.f / (width * std::hypot(view[0], view[4]));
+                flattener.flatten(control_positions, tolerance, curve_point_budget, curve_points);
+            }
+            else if (even_spacing)
+                curve.sample_evenly(points.size() < 2 ? 0 : quality * (points.size() - 1) + 1, curve_points);
+            else
+                curve.tessellate(points.size() < 2 ? 0 : quality * (points.size() - 1) + 1, curve_points);
+
+            curve_changed = false;
+            lines_changed = true;
+        }
+
+        if (lines_changed)
+        {
+            lines.clear();
+            lines.add(control_positions, 2.f, {64, 64, 64, 160}, polyline_renderer::join::miter);
+            lines.add(curve_points, 4.f, {204, 26, 26, 255});
+            for (auto const & p : points)
+                lines.add({p.position}, 10.f, {p.color[0], p.color[1], p.color[2], p.color[3]});
+
+            lines_changed = false;
+        }
+
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        if (map_enabled)
+        {
+            auto const cull_start = std::chrono::high_resolution_clock::now();
+            map_curves.cull(view_offset, {view_offset.x + width / zoom, view_offset.y + height / zoom});
+
+            // Orphaned and mapped write-only, so the evaluation neither waits for last
+            // frame's draw nor goes through a staging copy
+            glBindBuffer(GL_TEXTURE_BUFFER, map_vbo);
+            glBufferData(GL_TEXTURE_BUFFER, map_curves.output_floats(map_samples) * sizeof(float), nullptr, GL_STREAM_DRAW);
+            if (map_curves.visible_blocks() > 0)
+            {
+                auto * const output = static_cast<float *>(glMapBufferRange(GL_TEXTURE_BUFFER, 0,
+                    map_curves.output_floats(map_samples) * sizeof(float), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+                map_curves.evaluate(map_samples, output);
+                glUnmapBuffer(GL_TEXTURE_BUFFER);
+            }
+            map_time = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::high_resolution_clock::now() - cull_start).count();
+
+            glUseProgram(map_program);
+            glUniformMatrix4fv(map_view_location, 1, GL_TRUE, view);
+            glUniform1i(map_sample_count_location, map_samples);
+            glUniform4f(map_color_location, 0.3f, 0.3f, 0.3f, 1.f);
+
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_BUFFER, map_texture);
+            glBindVertexArray(empty_vao);
+
+            for (auto const & range : map_curves.visible())
+            {
+                glUniform1i(map_first_block_location, range.first_block);
+                glDrawArrays(GL_LINES, 0, range.curve_count * (map_samples - 1) * 2);
+            }
+        }
+
+        lines.draw(view, width, height);
+
+        if (marker_enabled && points.size() >= 2)
+        {
+            float const length = curve.length();
+            float const distance = length > 0.f ? std::fmod(time * marker_speed, length) : 0.f;
+
+            marker.clear();
+            marker.add({curve(curve.t_at_distance(distance))}, 14.f, {26, 80, 204, 255});
+            marker.draw(view, width, height);
+        }
+
+        if (gpu_curve && points.size() >= 2)
+        {
+            int const sample_count = quality * (points.size() - 1) + 1;
+
+            glUseProgram(curve_program);
+            glUniformMatrix4fv(curve_view_location, 1, GL_TRUE, view);
+            glUniform1i(control_point_count_location, points.size());
+            glUniform1i(sample_count_location, sample_count);
+            glUniform4f(curve_color_location, 0.1f, 0.6f, 0.1f, 1.f);
+
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_BUFFER, points_texture);
+
+            glBindVertexArray(empty_vao);
+            glDrawArrays(GL_LINE_STRIP, 0, sample_count);
+        }
 
-        SDL_GL_SwapWindow(window);
+        pacer.present(window);
     }
 
     SDL_GL_DeleteContext(gl_context);
@@ -0,0 +1,260 @@
+#include "polyline.hpp"
+
+#include <cstddef>
+
+// Flags of a segment: bit 0 and 1 for a joint at its start and end, bit 2 for round joins
+const char polyline_renderer::vertex_shader_source[] =
+R"(#version 330 core
+
+uniform mat4 view;
+uniform vec2 viewport_size;
+
+layout (location = 0) in vec4 in_previous_start;
+layout (location = 1) in vec4 in_end_next;
+layout (location = 2) in float in_width;
+layout (location = 3) in vec4 in_color;
+layout (location = 4) in uint in_flags;
+
+out vec2 pixel;
+
+flat out vec2 start;
+flat out vec2 end;
+flat out vec3 start_plane;
+flat out vec3 end_plane;
+flat out float half_width;
+flat out int end_modes;
+flat out vec4 color;
+
+const float miter_limit = 4.0;
+
+// End modes: 0 follows the edges to the clip plane (miter), 1 is round, 2 is a square cap
+// reaching half the width past the end
+const int mode_miter = 0;
+const int mode_round = 1;
+const int mode_square = 2;
+
+vec2 to_pixels(vec2 p)
+{
+    vec4 clip = view * vec4(p, 0.0, 1.0);
+    return (clip.xy / clip.w * 0.5 + 0.5) * viewport_size;
+}
+
+// Plane through the joint keeping the side dot(p, plane.xy) + plane.z >= 0, along the bisector
+// between the incoming and outgoing directions; returns the end mode
+int joint(vec2 point, vec2 incoming, vec2 outgoing, float side, bool rounded, out vec3 plane)
+{
+    vec2 tangent = incoming + outgoing;
+    if (dot(tangent, tangent) < 1e-6)
+    {
+        plane = vec3(0.0, 0.0, 1.0);
+        return mode_round;
+    }
+
+    tangent = normalize(tangent) * side;
+    plane = vec3(tangent, -dot(tangent, point));
+
+    // The miter tip is half_width / cos(half the turn) from the joint
+    bool too_sharp = abs(dot(tangent, incoming)) * miter_limit < 1.0;
+    return (rounded || too_sharp) ? mode_round : mode_miter;
+}
+
+void main()
+{
+    vec2 previous = to_pixels(in_previous_start.xy);
+    start = to_pixels(in_previous_start.zw);
+    end = to_pixels(in_end_next.xy);
+    vec2 next = to_pixels(in_end_next.zw);
+
+    half_width = max(in_width * 0.5, 0.5);
+    color = in_color;
+
+    vec2 direction = end - start;
+    direction = dot(direction, direction) > 0.0 ? normalize(direction) : vec2(1.0, 0.0);
+    vec2 normal = vec2(-direction.y, direction.x);
+
+    bool rounded = (in_flags & 4u) != 0u;
+    bool has_previous = (in_flags & 1u) != 0u && previous != start;
+    bool has_next = (in_flags & 2u) != 0u && next != end;
+
+    int start_mode = rounded ? mode_round : mode_square;
+    int end_mode = start_mode;
+    start_plane = vec3(0.0, 0.0, 1.0);
+    end_plane = vec3(0.0, 0.0, 1.0);
+
+    if (has_previous)
+        start_mode = joint(start, normalize(start - previous), direction, 1.0, rounded, start_plane);
+    if (has_next)
+        end_mode = joint(end, direction, normalize(next - end), -1.0, rounded, end_plane);
+
+    end_modes = start_mode | (end_mode << 2);
+
+    // One pixel more all around for the antialiased edge
+    float start_extent = (start_mode == mode_miter ? half_width * miter_limit : half_width) + 1.0;
+    float end_extent = (end_mode == mode_miter ? half_width * miter_limit : half_width) + 1.0;
+
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    pixel = mix(start - direction * start_extent, end + direction * end_extent, corner.x)
+        + normal * (half_width + 1.0) * (corner.y * 2.0 - 1.0);
+
+    gl_Position = vec4(pixel / viewport_size * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+const char polyline_renderer::fragment_shader_source[] =
+R"(#version 330 core
+
+in vec2 pixel;
+
+flat in vec2 start;
+flat in vec2 end;
+flat in vec3 start_plane;
+flat in vec3 end_plane;
+flat in float half_width;
+flat in int end_modes;
+flat in vec4 color;
+
+layout (location = 0) out vec4 out_color;
+
+const int mode_round = 1;
+const int mode_square = 2;
+
+void main()
+{
+    // Pixel centers on the other side of a joint belong to the neighbouring segment, those
+    // right on it to the segment starting there
+    if (dot(start_plane.xy, pixel) + start_plane.z < 0.0 || dot(end_plane.xy, pixel) + end_plane.z <= 0.0)
+        discard;
+
+    vec2 segment = end - start;
+    float segment_length = length(segment);
+    vec2 direction = segment_length > 0.0 ? segment / segment_length : vec2(1.0, 0.0);
+
+    vec2 offset = pixel - start;
+    float along = dot(offset, direction);
+    float across = abs(dot(offset, vec2(-direction.y, direction.x)));
+
+    int start_mode = end_modes & 3;
+    int end_mode = end_modes >> 2;
+
+    // Distance from the center line that is compared with the half width
+    float d = across;
+
+    if (start_mode == mode_square)
+        d = max(d, -along);
+    else if (start_mode == mode_round && along < 0.0)
+        d = length(offset);
+
+    if (end_mode == mode_square)
+        d = max(d, along - segment_length);
+    else if (end_mode == mode_round && along > segment_length)
+        d = length(pixel - end);
+
+    float coverage = clamp(half_width - d + 0.5, 0.0, 1.0);
+    if (coverage == 0.0)
+        discard;
+
+    out_color = vec4(color.rgb, color.a * coverage);
+}
+)";
+
+polyline_renderer::polyline_renderer(GLuint program)
+    : program_(program)
+{
+    view_location_ = glGetUniformLocation(program_, "view");
+    viewport_size_location_ = glGetUniformLocation(program_, "viewport_size");
+
+    glGenVertexArrays(1, &vao_);
+    glBindVertexArray(vao_);
+
+    glGenBuffers(1, &vbo_);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(segment), (void*)offsetof(segment, previous));
+    glVertexAttribDivisor(0, 1);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(segment), (void*)offsetof(segment, end));
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(segment), (void*)offsetof(segment, width));
+    glVertexAttribDivisor(2, 1);
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(segment), (void*)offsetof(segment, color));
+    glVertexAttribDivisor(3, 1);
+    glEnableVertexAttribArray(4);
+    glVertexAttribIPointer(4, 1, GL_UNSIGNED_INT, sizeof(segment), (void*)offsetof(segment, flags));
+    glVertexAttribDivisor(4, 1);
+}
+
+polyline_renderer::~polyline_renderer()
+{
+    glDeleteBuffers(1, &vbo_);
+    glDeleteVertexArrays(1, &vao_);
+}
+
+void polyline_renderer::clear()
+{
+    if (!segments_.empty())
+        changed_ = true;
+    segments_.clear();
+}
+
+void polyline_renderer::add(std::vector<vec2> const & points, float width, std::array<std::uint8_t, 4> const & color, join join)
+{
+    if (points.empty())
+        return;
+
+    std::uint32_t const round = (join == join::round) ? 4 : 0;
+
+    auto const same = [](vec2 const & a, vec2 const & b){ return a.x == b.x && a.y == b.y; };
+
+    // Repeated points would make zero length segments in the middle of the stroke
+    std::size_t const first = segments_.size();
+    vec2 last = points[0];
+    for (std::size_t i = 1; i < points.size(); ++i)
+    {
+        if (same(points[i], last))
+            continue;
+
+        segments_.push_back({last, last, points[i], points[i], width, {color[0], color[1], color[2], color[3]}, round});
+        last = points[i];
+    }
+
+    if (segments_.size() == first)
+        segments_.push_back({last, last, last, last, width, {color[0], color[1], color[2], color[3]}, round});
+
+    for (std::size_t i = first + 1; i < segments_.size(); ++i)
+    {
+        segments_[i].previous = segments_[i - 1].start;
+        segments_[i].flags |= 1;
+        segments_[i - 1].next = segments_[i].end;
+        segments_[i - 1].flags |= 2;
+    }
+
+    changed_ = true;
+}
+
+void polyline_renderer::draw(float const * view, int viewport_width, int viewport_height)
+{
+    if (changed_)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+        glBufferData(GL_ARRAY_BUFFER, segments_.size() * sizeof(segment), segments_.data(), GL_DYNAMIC_DRAW);
+        changed_ = false;
+    }
+
+    if (segments_.empty())
+        return;
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    glUseProgram(program_);
+    glUniformMatrix4fv(view_location_, 1, GL_TRUE, view);
+    glUniform2f(viewport_size_location_, viewport_width, viewport_height);
+
+    glBindVertexArray(vao_);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, segments_.size());
+
+    glDisable(GL_BLEND);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include "bezier.hpp"
+
+#include <vector>
+#include <array>
+#include <cstdint>
+
+// Thick antialiased strokes, all of them drawn with one instanced draw of a quad per segment.
+// The fragment shader computes coverage from the distance to the segment, so no MSAA is
+// needed. At a join each segment is clipped by the bisector of the two, so every pixel is
+// shaded by exactly one of them and translucent strokes don't darken at their corners.
+struct polyline_renderer
+{
+    enum class join
+    {
+        // Pointed corners and square ends; corners sharper than the miter limit are rounded
+        miter,
+        // Rounded corners and ends
+        round,
+    };
+
+    // Built by the caller from these, and shared by all of the renderers
+    static const char vertex_shader_source[];
+    static const char fragment_shader_source[];
+
+    explicit polyline_renderer(GLuint program);
+    ~polyline_renderer();
+
+    polyline_renderer(polyline_renderer const &) = delete;
+    polyline_renderer & operator = (polyline_renderer const &) = delete;
+
+    // Strokes stay until clear(), so unchanged strokes are not uploaded again
+    void clear();
+
+    // Width in pixels. A single point is drawn as a dot with round joins or a square with miter ones.
+    void add(std::vector<vec2> const & points, float width, std::array<std::uint8_t, 4> const & color, join join = join::round);
+
+    // view is row major, as practice3 passes it; draws with blending
+    void draw(float const * view, int viewport_width, int viewport_height);
+
+private:
+    struct segment
+    {
+        // Neighbours are equal to the segment's ends where there is no joint
+        vec2 previous, start;
+        vec2 end, next;
+        float width;
+        std::uint8_t color[4];
+        std::uint32_t flags;
+    };
+
+    std::vector<segment> segments_;
+    bool changed_ = false;
+
+    GLuint program_ = 0;
+    GLuint view_location_ = 0;
+    GLuint viewport_size_location_ = 0;
+    GLuint vao_ = 0;
+    GLuint vbo_ = 0;
+};
@@ -0,0 +1,111 @@
+#include "geometry_heap.hpp"
+
+#include <iterator>
+#include <cstdint>
+
+range_allocator::range_allocator(std::size_t capacity)
+    : capacity_(capacity)
+    , free_count_(capacity)
+{
+    if (capacity > 0)
+        free_blocks_[0] = capacity;
+}
+
+std::optional<std::size_t> range_allocator::allocate(std::size_t count)
+{
+    for (auto it = free_blocks_.begin(); it != free_blocks_.end(); ++it)
+    {
+        if (it->second < count)
+            continue;
+
+        std::size_t const first = it->first;
+        std::size_t const rest = it->second - count;
+        free_blocks_.erase(it);
+        if (rest > 0)
+            free_blocks_[first + count] = rest;
+        free_count_ -= count;
+        return first;
+    }
+    return std::nullopt;
+}
+
+void range_allocator::free(std::size_t first, std::size_t count)
+{
+    if (count == 0)
+        return;
+
+    free_count_ += count;
+    auto next = free_blocks_.lower_bound(first);
+
+    if (next != free_blocks_.begin())
+    {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == first)
+        {
+            first = previous->first;
+            count += previous->second;
+            free_blocks_.erase(previous);
+        }
+    }
+
+    if (next != free_blocks_.end() && first + count == next->first)
+    {
+        count += next->second;
+        free_blocks_.erase(next);
+    }
+
+    free_blocks_[first] = count;
+}
+
+geometry_heap::geometry_heap(std::size_t vertex_capacity, std::size_t index_capacity, std::size_t vertex_size)
+    : vertex_size_(vertex_size)
+    , vertices_(vertex_capacity)
+    , indices_(index_capacity)
+{
+    glGenBuffers(1, &vertex_buffer_);
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_);
+    glBufferData(GL_ARRAY_BUFFER, vertex_capacity * vertex_size, nullptr, GL_STATIC_DRAW);
+
+    glGenBuffers(1, &index_buffer_);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, index_buffer_);
+    glBufferData(GL_COPY_WRITE_BUFFER, index_capacity * sizeof(std::uint32_t), nullptr, GL_STATIC_DRAW);
+}
+
+geometry_heap::~geometry_heap()
+{
+    glDeleteBuffers(1, &vertex_buffer_);
+    glDeleteBuffers(1, &index_buffer_);
+}
+
+std::optional<geometry_heap::allocation> geometry_heap::allocate(std::size_t vertex_count, std::size_t index_count)
+{
+    auto const first_vertex = vertices_.allocate(vertex_count);
+    if (!first_vertex)
+        return std::nullopt;
+
+    auto const first_index = indices_.allocate(index_count);
+    if (!first_index)
+    {
+        vertices_.free(*first_vertex, vertex_count);
+        return std::nullopt;
+    }
+
+    return allocation{*first_vertex, vertex_count, *first_index, index_count};
+}
+
+void geometry_heap::free(allocation const & a)
+{
+    vertices_.free(a.first_vertex, a.vertex_count);
+    indices_.free(a.first_index, a.index_count);
+}
+
+std::size_t geometry_heap::capacity_bytes() const
+{
+    return vertices_.capacity() * vertex_size_ + indices_.capacity() * sizeof(std::uint32_t);
+}
+
+std::size_t geometry_heap::used_bytes() const
+{
+    return (vertices_.capacity() - vertices_.free_count()) * vertex_size_
+        + (indices_.capacity() - indices_.free_count()) * sizeof(std::uint32_t);
+}
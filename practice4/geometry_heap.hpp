@@ -0,0 +1,63 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <map>
+#include <optional>
+#include <cstddef>
+
+// First-fit sub-allocation of a fixed range of elements, neighbouring free blocks merged on free
+struct range_allocator
+{
+    explicit range_allocator(std::size_t capacity);
+
+    std::optional<std::size_t> allocate(std::size_t count);
+    void free(std::size_t first, std::size_t count);
+
+    std::size_t capacity() const { return capacity_; }
+    std::size_t free_count() const { return free_count_; }
+
+private:
+    std::size_t capacity_;
+    std::size_t free_count_;
+    // First element to count
+    std::map<std::size_t, std::size_t> free_blocks_;
+};
+
+// One vertex and one index buffer of a fixed size, sized once from the memory budget, that
+// meshes are sub-allocated from; geometry comes and goes without either buffer ever being
+// reallocated, and a single VAO draws all of it through base vertices and index offsets
+struct geometry_heap
+{
+    struct allocation
+    {
+        std::size_t first_vertex;
+        std::size_t vertex_count;
+        std::size_t first_index;
+        std::size_t index_count;
+    };
+
+    geometry_heap(std::size_t vertex_capacity, std::size_t index_capacity, std::size_t vertex_size);
+    ~geometry_heap();
+
+    geometry_heap(geometry_heap const &) = delete;
+    geometry_heap & operator = (geometry_heap const &) = delete;
+
+    // nullopt if either buffer has no free block large enough
+    std::optional<allocation> allocate(std::size_t vertex_count, std::size_t index_count);
+    void free(allocation const & a);
+
+    GLuint vertex_buffer() const { return vertex_buffer_; }
+    GLuint index_buffer() const { return index_buffer_; }
+    std::size_t vertex_size() const { return vertex_size_; }
+
+    std::size_t capacity_bytes() const;
+    std::size_t used_bytes() const;
+
+private:
+    std::size_t vertex_size_;
+    range_allocator vertices_;
+    range_allocator indices_;
+    GLuint vertex_buffer_;
+    GLuint index_buffer_;
+};
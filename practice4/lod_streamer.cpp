@@ -0,0 +1,194 @@
+#include "lod_streamer.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <limits>
+#include <chrono>
+#include <cstdint>
+
+lod_streamer::lod_streamer(mesh_lod_stream stream, geometry_heap & heap, std::size_t upload_bytes_per_frame)
+    : stream_(std::move(stream))
+    , heap_(heap)
+    , upload_bytes_per_frame_(upload_bytes_per_frame)
+{
+    if (heap_.vertex_size() != sizeof(obj_data::vertex))
+        throw std::runtime_error("The geometry heap holds another vertex format than the LOD chain");
+
+    for (auto const & info : stream_.levels())
+    {
+        levels_.push_back({info.vertex_count, info.index_count, {}, {}});
+        errors_.push_back(info.error);
+    }
+    if (levels_.empty())
+        throw std::runtime_error("Empty LOD chain");
+
+    std::size_t const coarsest = levels_.size() - 1;
+    auto & l = levels_[coarsest];
+    l.allocation = heap_.allocate(l.vertex_count, l.index_count);
+    if (!l.allocation)
+        throw std::runtime_error("The geometry budget does not fit even the coarsest level");
+    l.pending = stream_.read(coarsest).mesh;
+    upload(l, std::numeric_limits<std::size_t>::max());
+    ++reads_;
+}
+
+lod_streamer::~lod_streamer()
+{
+    if (read_.valid())
+        read_.wait();
+
+    for (auto const & l : levels_)
+        if (l.allocation)
+            heap_.free(*l.allocation);
+}
+
+lod_streamer::level_range lod_streamer::range(std::size_t level) const
+{
+    auto const & a = *levels_[level].allocation;
+    return {GLint(a.first_vertex), a.first_index, GLsizei(a.index_count)};
+}
+
+std::size_t lod_streamer::drawable(std::size_t wanted) const
+{
+    for (std::size_t i = wanted; i < levels_.size(); ++i)
+        if (levels_[i].resident)
+            return i;
+    return levels_.size() - 1;
+}
+
+void lod_streamer::begin_frame()
+{
+    for (auto & l : levels_)
+    {
+        l.priority = 0.f;
+        l.used = false;
+    }
+}
+
+void lod_streamer::request(std::size_t wanted, float error_pixels)
+{
+    levels_[wanted].used = true;
+    levels_[drawable(wanted)].used = true;
+    if (!levels_[wanted].resident)
+        levels_[wanted].priority = std::max(levels_[wanted].priority, error_pixels);
+}
+
+void lod_streamer::update()
+{
+    if (read_.valid() && read_.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+        try
+        {
+            auto data = read_.get();
+            auto & l = levels_[reading_];
+            // The view may have moved on while the level was read
+            if (l.used && make_room(reading_))
+                l.pending = std::move(data);
+        }
+        catch (std::exception const & e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    std::size_t budget = upload_bytes_per_frame_;
+    for (auto & l : levels_)
+        if (l.pending)
+            budget -= upload(l, budget);
+
+    if (read_.valid())
+        return;
+
+    // Levels that could not fit even after evicting everything unused are not read at all
+    std::uint64_t kept_bytes = 0;
+    for (std::size_t i = 0; i < levels_.size(); ++i)
+        if (levels_[i].allocation && (levels_[i].used || i + 1 == levels_.size()))
+            kept_bytes += level_bytes(i);
+
+    std::optional<std::size_t> next;
+    for (std::size_t i = 0; i < levels_.size(); ++i)
+    {
+        auto const & l = levels_[i];
+        if (l.allocation || l.priority <= 0.f || kept_bytes + level_bytes(i) > heap_.capacity_bytes())
+            continue;
+        if (!next || l.priority > levels_[*next].priority)
+            next = i;
+    }
+
+    if (!next)
+        return;
+
+    reading_ = *next;
+    ++reads_;
+    read_ = std::async(std::launch::async, [this, level = *next]{ return stream_.read(level).mesh; });
+}
+
+std::uint64_t lod_streamer::level_bytes(std::size_t index) const
+{
+    return levels_[index].vertex_count * heap_.vertex_size() + levels_[index].index_count * sizeof(std::uint32_t);
+}
+
+bool lod_streamer::make_room(std::size_t index)
+{
+    auto & target = levels_[index];
+    while (!(target.allocation = heap_.allocate(target.vertex_count, target.index_count)))
+    {
+        // The finest unused level goes first, it frees the most
+        std::optional<std::size_t> victim;
+        for (std::size_t i = 0; i + 1 < levels_.size(); ++i)
+            if (i != index && levels_[i].allocation && !levels_[i].used)
+            {
+                victim = i;
+                break;
+            }
+
+        if (!victim)
+            return false;
+
+        auto & l = levels_[*victim];
+        heap_.free(*l.allocation);
+        l.allocation.reset();
+        l.pending.reset();
+        l.uploaded_bytes = 0;
+        l.resident = false;
+    }
+    return true;
+}
+
+std::size_t lod_streamer::upload(level & l, std::size_t budget)
+{
+    auto const & a = *l.allocation;
+    std::size_t const vertex_bytes = l.vertex_count * heap_.vertex_size();
+    std::size_t const total_bytes = vertex_bytes + l.index_count * sizeof(std::uint32_t);
+    std::size_t const start = l.uploaded_bytes;
+    std::size_t const end = total_bytes - start > budget ? start + budget : total_bytes;
+
+    if (l.uploaded_bytes < std::min(end, vertex_bytes))
+    {
+        std::size_t const size = std::min(end, vertex_bytes) - l.uploaded_bytes;
+        glBindBuffer(GL_ARRAY_BUFFER, heap_.vertex_buffer());
+        glBufferSubData(GL_ARRAY_BUFFER, a.first_vertex * heap_.vertex_size() + l.uploaded_bytes, size,
+            reinterpret_cast<char const *>(l.pending->vertices.data()) + l.uploaded_bytes);
+        l.uploaded_bytes += size;
+    }
+
+    if (l.uploaded_bytes >= vertex_bytes && l.uploaded_bytes < end)
+    {
+        std::size_t const offset = l.uploaded_bytes - vertex_bytes;
+        // Not GL_ELEMENT_ARRAY_BUFFER, which would rebind the index buffer of whatever VAO is bound
+        glBindBuffer(GL_COPY_WRITE_BUFFER, heap_.index_buffer());
+        glBufferSubData(GL_COPY_WRITE_BUFFER, a.first_index * sizeof(std::uint32_t) + offset, end - l.uploaded_bytes,
+            reinterpret_cast<char const *>(l.pending->indices.data()) + offset);
+        l.uploaded_bytes = end;
+    }
+
+    if (l.uploaded_bytes == total_bytes)
+    {
+        l.pending.reset();
+        l.uploaded_bytes = 0;
+        l.resident = true;
+    }
+
+    return end - start;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "geometry_heap.hpp"
+#include "obj_cache.hpp"
+
+#include <GL/glew.h>
+
+#include <vector>
+#include <future>
+#include <optional>
+#include <cstddef>
+
+// The levels of a LOD chain paged into a geometry_heap as the view needs them. The coarsest
+// level is read and uploaded before the constructor returns, so the mesh can be drawn at once;
+// the finer ones are read from the cache on a worker thread one at a time, the one whose absence
+// costs the most pixels of error on screen first, then uploaded a slice per frame. Levels nothing
+// asked for are evicted when a wanted one does not fit the heap; the coarsest always stays.
+struct lod_streamer
+{
+    struct level_range
+    {
+        GLint base_vertex;
+        std::size_t first_index;
+        GLsizei index_count;
+    };
+
+    lod_streamer(mesh_lod_stream stream, geometry_heap & heap, std::size_t upload_bytes_per_frame);
+    ~lod_streamer();
+
+    lod_streamer(lod_streamer const &) = delete;
+    lod_streamer & operator = (lod_streamer const &) = delete;
+
+    std::size_t level_count() const { return levels_.size(); }
+    std::vector<float> const & errors() const { return errors_; }
+
+    bool resident(std::size_t level) const { return levels_[level].resident; }
+    level_range range(std::size_t level) const;
+
+    // The resident level closest to wanted among it and the coarser ones
+    std::size_t drawable(std::size_t wanted) const;
+
+    // Between begin_frame and update, every object that wants a level not resident reports how
+    // many pixels of error on screen it shows meanwhile; the largest is the level's priority
+    void begin_frame();
+    void request(std::size_t wanted, float error_pixels);
+
+    // Collects a finished read, uploads this frame's slice, and starts the next read
+    void update();
+
+    std::size_t reads() const { return reads_; }
+
+private:
+    struct level
+    {
+        std::uint64_t vertex_count;
+        std::uint64_t index_count;
+        std::optional<geometry_heap::allocation> allocation;
+        // Read but not completely uploaded yet
+        std::optional<obj_data> pending;
+        std::size_t uploaded_bytes = 0;
+        bool resident = false;
+        // Wanted or drawn by anything this frame
+        bool used = false;
+        float priority = 0.f;
+    };
+
+    std::uint64_t level_bytes(std::size_t index) const;
+    bool make_room(std::size_t index);
+    // Uploads up to budget bytes of a pending level, returns how many it did
+    std::size_t upload(level & l, std::size_t budget);
+
+    mesh_lod_stream stream_;
+    geometry_heap & heap_;
+    std::size_t upload_bytes_per_frame_;
+
+    std::vector<level> levels_;
+    std::vector<float> errors_;
+
+    std::future<obj_data> read_;
+    std::size_t reading_ = 0;
+    std::size_t reads_ = 0;
+};
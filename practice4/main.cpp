@@ -12,9 +12,19 @@
 #include <iostream>
 #include <chrono>
 #include <vector>
-#include <map>
+#include <cmath>
+#include <array>
+#include <algorithm>
+#include <cstdlib>
+#include <cstddef>
 
 #include "obj_parser.hpp"
+#include "obj_cache.hpp"
+#include "mesh_lod.hpp"
+#include "geometry_heap.hpp"
+#include "lod_streamer.hpp"
+#include "input_state.hpp"
+#include "replay_session.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -40,12 +50,13 @@ uniform mat4 projection;
 
 layout (location = 0) in vec3 in_position;
 layout (location = 1) in vec3 in_normal;
+layout (location = 2) in vec3 in_offset;
 
 out vec3 normal;
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(in_position, 1.0);
+    gl_Position = projection * view * (model * vec4(in_position, 1.0) + vec4(in_offset, 0.0));
     normal = normalize(mat3(model) * in_normal);
 }
 )";
@@ -119,8 +130,10 @@ GLuint create_program(GLuint vertex_shader, GLuint fragment_shader)
     return result;
 }
 
-int main() try
+int main(int argc, char ** argv) try
 {
+    replay_session replay(argc, argv);
+
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
         sdl2_fail("SDL_Init: ");
 
@@ -168,17 +181,101 @@ int main() try
     GLuint projection_location = glGetUniformLocation(program, "projection");
 
     std::string project_root = PROJECT_ROOT;
-    obj_data bunny = parse_obj(project_root + "/bunny.obj");
+
+    // --mesh PATH draws another OBJ instead of the bunny, --geometry-budget MB bounds the
+    // memory its levels may take on the GPU
+    std::string mesh_path = project_root + "/bunny.obj";
+    double geometry_budget_mb = 64.0;
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (std::string_view(argv[i]) == "--mesh")
+            mesh_path = argv[i + 1];
+        else if (std::string_view(argv[i]) == "--geometry-budget")
+        {
+            geometry_budget_mb = std::atof(argv[i + 1]);
+            if (!(geometry_budget_mb > 0.0))
+                throw std::runtime_error(std::string("Bad geometry budget ") + argv[i + 1]);
+        }
+    }
+
+    // Simplified levels are generated once into <mesh>.obj.lods, then streamed from it: only the
+    // coarsest is read before the first frame, the finer ones as the bunnies come close enough
+    // to need them
+    auto lod_stream = load_obj_lods_streamed(mesh_path);
+
+    // The budget is split between vertices and indices as the chain itself splits them, so the
+    // whole chain fits exactly if the budget allows
+    std::uint64_t chain_vertices = 0, chain_indices = 0;
+    for (auto const & level : lod_stream.levels())
+    {
+        chain_vertices += level.vertex_count;
+        chain_indices += level.index_count;
+    }
+    double const chain_bytes = chain_vertices * sizeof(obj_data::vertex) + chain_indices * sizeof(std::uint32_t);
+    double const budget_share = std::min(1.0, geometry_budget_mb * (1 << 20) / chain_bytes);
+
+    geometry_heap heap(std::size_t(chain_vertices * budget_share), std::size_t(chain_indices * budget_share), sizeof(obj_data::vertex));
+
+    // A slice of a level per frame, so that uploading a fine one does not stall a frame
+    std::size_t const upload_bytes_per_frame = 4 << 20;
+    lod_streamer lods(std::move(lod_stream), heap, upload_bytes_per_frame);
+    auto const & lod_errors = lods.errors();
+    std::cout << "Geometry heap: " << heap.capacity_bytes() / 1024 / 1024 << " MB for a chain of " << std::size_t(chain_bytes) / 1024 / 1024 << " MB" << std::endl;
+
+    // Every level is a range of the heap's buffers
+    GLuint vao;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, heap.vertex_buffer());
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, heap.index_buffer());
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), reinterpret_cast<void *>(offsetof(obj_data::vertex, position)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), reinterpret_cast<void *>(offsetof(obj_data::vertex, normal)));
+
+    // A field of bunnies; each keeps the level it wanted last frame for hysteresis
+    int const grid_size = 32;
+    float const grid_spacing = 3.f;
+
+    std::vector<std::array<float, 3>> offsets;
+    for (int z = 0; z < grid_size; ++z)
+        for (int x = 0; x < grid_size; ++x)
+            offsets.push_back({(x - (grid_size - 1) / 2.f) * grid_spacing, 0.f, -z * grid_spacing});
+
+    std::vector<std::size_t> instance_lods(offsets.size(), 0);
+
+    // Offsets grouped by level, uploaded every frame
+    std::vector<std::vector<std::array<float, 3>>> lod_offsets(lods.level_count());
+    std::vector<std::array<float, 3>> sorted_offsets;
+
+    GLuint instance_vbo;
+    glGenBuffers(1, &instance_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, offsets.size() * sizeof(offsets[0]), nullptr, GL_DYNAMIC_DRAW);
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1);
+
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+
+    lod_selection_settings lod_settings;
+    bool use_lods = true;
+
+    float camera_distance = 5.f;
+    float print_time = 0.f;
 
     auto last_frame_start = std::chrono::high_resolution_clock::now();
 
     float time = 0.f;
 
-    std::map<SDL_Keycode, bool> button_down;
+    input_state input;
 
     bool running = true;
     while (running)
     {
+        input.begin_frame();
+
         for (SDL_Event event; SDL_PollEvent(&event);) switch (event.type)
         {
         case SDL_QUIT:
@@ -194,22 +291,42 @@ int main() try
             }
             break;
         case SDL_KEYDOWN:
-            button_down[event.key.keysym.sym] = true;
+            input.handle_event(event);
+            // L switches between the LOD chain and the full mesh everywhere
+            if (event.key.keysym.sym == SDLK_l)
+                use_lods = !use_lods;
             break;
         case SDL_KEYUP:
-            button_down[event.key.keysym.sym] = false;
+            input.handle_event(event);
             break;
         }
 
         if (!running)
             break;
 
+        if (!replay.update(input))
+            break;
+
         auto now = std::chrono::high_resolution_clock::now();
-        float dt = std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count();
+        float dt = replay.frame_time(std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count());
         last_frame_start = now;
         time += dt;
 
-        glClear(GL_COLOR_BUFFER_BIT);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        if (input.down(SDL_SCANCODE_UP))
+            camera_distance = std::max(0.f, camera_distance - 10.f * dt);
+        if (input.down(SDL_SCANCODE_DOWN))
+            camera_distance += 10.f * dt;
+
+        float const near = 0.1f;
+        float const far = 200.f;
+        float const fov = 3.1415926f / 2.f;
+        float const aspect = float(width) / height;
+        float const top = near * std::tan(fov / 2.f);
+        float const right = top * aspect;
+
+        float const camera_position[3] = {0.f, 2.f, camera_distance};
 
         float model[16] =
         {
@@ -221,28 +338,97 @@ int main() try
 
         float view[16] =
         {
-            1.f, 0.f, 0.f, 0.f,
-            0.f, 1.f, 0.f, 0.f,
-            0.f, 0.f, 1.f, 0.f,
+            1.f, 0.f, 0.f, -camera_position[0],
+            0.f, 1.f, 0.f, -camera_position[1],
+            0.f, 0.f, 1.f, -camera_position[2],
             0.f, 0.f, 0.f, 1.f,
         };
 
         float projection[16] =
         {
-            1.f, 0.f, 0.f, 0.f,
-            0.f, 1.f, 0.f, 0.f,
-            0.f, 0.f, 1.f, 0.f,
-            0.f, 0.f, 0.f, 1.f,
+            near / right, 0.f, 0.f, 0.f,
+            0.f, near / top, 0.f, 0.f,
+            0.f, 0.f, -(far + near) / (far - near), -2.f * far * near / (far - near),
+            0.f, 0.f, -1.f, 0.f,
         };
 
+        // Pick a level per bunny from its projected error, then draw each level instanced; a
+        // bunny whose level is not streamed in yet draws the nearest coarser one meanwhile, and
+        // the error that shows on screen makes its level's priority
+        float const scale = pixels_per_unit(height, fov);
+        for (auto & level_offsets : lod_offsets)
+            level_offsets.clear();
+
+        lods.begin_frame();
+
+        for (std::size_t i = 0; i < offsets.size(); ++i)
+        {
+            float distance = 0.f;
+            for (int k = 0; k < 3; ++k)
+                distance += (offsets[i][k] - camera_position[k]) * (offsets[i][k] - camera_position[k]);
+            distance = std::sqrt(distance);
+
+            instance_lods[i] = use_lods ? select_lod(lod_errors, distance, scale, instance_lods[i], lod_settings) : 0;
+            std::size_t const drawn = lods.drawable(instance_lods[i]);
+            lods.request(instance_lods[i], lod_errors[drawn] * scale / std::max(distance, near));
+            lod_offsets[drawn].push_back(offsets[i]);
+        }
+
+        lods.update();
+
+        sorted_offsets.clear();
+        for (auto const & level_offsets : lod_offsets)
+            sorted_offsets.insert(sorted_offsets.end(), level_offsets.begin(), level_offsets.end());
+
+        glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sorted_offsets.size() * sizeof(sorted_offsets[0]), sorted_offsets.data());
+
         glUseProgram(program);
         glUniformMatrix4fv(model_location, 1, GL_TRUE, model);
         glUniformMatrix4fv(view_location, 1, GL_TRUE, view);
         glUniformMatrix4fv(projection_location, 1, GL_TRUE, projection);
 
+        glBindVertexArray(vao);
+
+        std::size_t first_instance = 0;
+        std::size_t triangle_count = 0;
+        for (std::size_t level = 0; level < lods.level_count(); ++level)
+        {
+            std::size_t const count = lod_offsets[level].size();
+            if (count == 0) continue;
+            auto const range = lods.range(level);
+
+            // Instanced attributes have no base instance before GL 4.2, so the offsets are rebound per level
+            glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, reinterpret_cast<void *>(first_instance * sizeof(sorted_offsets[0])));
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.index_count, GL_UNSIGNED_INT,
+                reinterpret_cast<void *>(range.first_index * sizeof(std::uint32_t)), count, range.base_vertex);
+
+            first_instance += count;
+            triangle_count += count * range.index_count / 3;
+        }
+
+        print_time += dt;
+        if (print_time >= 1.f)
+        {
+            std::cout << "triangles: " << triangle_count << ", bunnies per level:";
+            for (auto const & level_offsets : lod_offsets)
+                std::cout << ' ' << level_offsets.size();
+            std::cout << ", resident levels:";
+            for (std::size_t level = 0; level < lods.level_count(); ++level)
+                if (lods.resident(level))
+                    std::cout << ' ' << level;
+            std::cout << ", geometry heap " << heap.used_bytes() / 1024 / 1024 << " of " << heap.capacity_bytes() / 1024 / 1024
+                << " MB, " << lods.reads() << " levels read" << std::endl;
+            print_time = 0.f;
+        }
+
+        replay.end_frame();
+
         SDL_GL_SwapWindow(window);
     }
 
+    replay.finish();
+
     SDL_GL_DeleteContext(gl_context);
     SDL_DestroyWindow(window);
 }
@@ -12,11 +12,12 @@
 #include <iostream>
 #include <chrono>
 #include <vector>
-#include <map>
 #include <cmath>
 
 #include "obj_parser.hpp"
 #include "stb_image.h"
+#include "input_state.hpp"
+#include "replay_session.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -105,8 +106,10 @@ GLuint create_program(GLuint vertex_shader, GLuint fragment_shader)
     return result;
 }
 
-int main() try
+int main(int argc, char ** argv) try
 {
+    replay_session replay(argc, argv);
+
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
         sdl2_fail("SDL_Init: ");
 
@@ -163,11 +166,13 @@ int main() try
     float angle_y = M_PI;
     float offset_z = -2.f;
 
-    std::map<SDL_Keycode, bool> button_down;
+    input_state input;
 
     bool running = true;
     while (running)
     {
+        input.begin_frame();
+
         for (SDL_Event event; SDL_PollEvent(&event);) switch (event.type)
         {
         case SDL_QUIT:
@@ -183,25 +188,28 @@ int main() try
             }
             break;
         case SDL_KEYDOWN:
-            button_down[event.key.keysym.sym] = true;
+            input.handle_event(event);
             break;
         case SDL_KEYUP:
-            button_down[event.key.keysym.sym] = false;
+            input.handle_event(event);
             break;
         }
 
         if (!running)
             break;
 
+        if (!replay.update(input))
+            break;
+
         auto now = std::chrono::high_resolution_clock::now();
-        float dt = std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count();
+        float dt = replay.frame_time(std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count());
         last_frame_start = now;
         time += dt;
 
-        if (button_down[SDLK_UP]) offset_z -= 4.f * dt;
-        if (button_down[SDLK_DOWN]) offset_z += 4.f * dt;
-        if (button_down[SDLK_LEFT]) angle_y += 4.f * dt;
-        if (button_down[SDLK_RIGHT]) angle_y -= 4.f * dt;
+        if (input.down(SDL_SCANCODE_UP)) offset_z -= 4.f * dt;
+        if (input.down(SDL_SCANCODE_DOWN)) offset_z += 4.f * dt;
+        if (input.down(SDL_SCANCODE_LEFT)) angle_y += 4.f * dt;
+        if (input.down(SDL_SCANCODE_RIGHT)) angle_y -= 4.f * dt;
 
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         glEnable(GL_DEPTH_TEST);
@@ -231,9 +239,13 @@ int main() try
         glUniformMatrix4fv(viewmodel_location, 1, GL_TRUE, viewmodel);
         glUniformMatrix4fv(projection_location, 1, GL_TRUE, projection);
 
+        replay.end_frame();
+
         SDL_GL_SwapWindow(window);
     }
 
+    replay.finish();
+
     SDL_GL_DeleteContext(gl_context);
     SDL_DestroyWindow(window);
 }
@@ -12,10 +12,12 @@
 #include <iostream>
 #include <chrono>
 #include <vector>
-#include <map>
 #include <cmath>
 #include <fstream>
 #include <sstream>
+#include <random>
+#include <string>
+#include <optional>
 
 #define GLM_FORCE_SWIZZLE
 #define GLM_ENABLE_EXPERIMENTAL
@@ -26,7 +28,15 @@
 #include <glm/ext/scalar_constants.hpp>
 #include <glm/gtx/string_cast.hpp>
 
-#include "obj_parser.hpp"
+#include "obj_cache.hpp"
+#include "mesh_optimizer.hpp"
+#include "triangle_bvh.hpp"
+#include "index_buffer.hpp"
+#include "frame_graph.hpp"
+#include "profiler.hpp"
+#include "program_cache.hpp"
+#include "input_state.hpp"
+#include "replay_session.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -64,33 +74,188 @@ void main()
 }
 )";
 
-const char dragon_fragment_shader_source[] =
+// Shared by the forward shader and the deferred passes, which prepend it to their own source
+const char lighting_source[] =
 R"(#version 330 core
 
 uniform vec3 camera_position;
 
-in vec3 normal;
-in vec3 position;
+vec3 shade(vec3 position, vec3 normal, vec3 albedo, float roughness, vec3 light_direction, vec3 light_color)
+{
+    vec3 reflected = 2.0 * normal * dot(normal, light_direction) - light_direction;
+    vec3 camera_direction = normalize(camera_position - position);
+    float power = mix(256.0, 4.0, roughness);
 
-layout (location = 0) out vec4 out_color;
+    return albedo * light_color * (max(0.0, dot(normal, light_direction)) + pow(max(0.0, dot(camera_direction, reflected)), power));
+}
 
-void main()
+vec3 sun_and_ambient(vec3 position, vec3 normal, vec3 albedo, float roughness)
 {
     vec3 light_direction = vec3(normalize(vec3(1.0, 2.0, 3.0)));
     vec3 light_color = vec3(0.8, 0.3, 0.0);
     vec3 ambient_light = vec3(0.2, 0.2, 0.4);
 
-    vec3 reflected = 2.0 * normal * dot(normal, light_direction) - light_direction;
-    vec3 camera_direction = normalize(camera_position - position);
+    return albedo * ambient_light + shade(position, normal, albedo, roughness, light_direction, light_color);
+}
+
+vec3 point_light(vec3 position, vec3 normal, vec3 albedo, float roughness, vec4 light_position_radius, vec3 light_color)
+{
+    vec3 to_light = light_position_radius.xyz - position;
+    float d = length(to_light);
+    float falloff = clamp(1.0 - d * d / (light_position_radius.w * light_position_radius.w), 0.0, 1.0);
+    return shade(position, normal, albedo, roughness, to_light / max(d, 1e-6), light_color) * falloff * falloff;
+}
+)";
+
+const char dragon_fragment_shader_source[] =
+R"(
+uniform vec3 albedo;
+uniform float roughness;
 
-    vec3 albedo = vec3(1.0, 1.0, 1.0);
+// Two texels per light: position and radius, then color
+uniform samplerBuffer lights;
+uniform int light_count;
 
-    vec3 light = ambient_light + light_color * (max(0.0, dot(normal, light_direction)) + pow(max(0.0, dot(camera_direction, reflected)), 64.0));
-    vec3 color = albedo * light;
+in vec3 normal;
+in vec3 position;
+
+layout (location = 0) out vec4 out_color;
+
+void main()
+{
+    vec3 n = normalize(normal);
+    vec3 color = sun_and_ambient(position, n, albedo, roughness);
+    for (int i = 0; i < light_count; ++i)
+        color += point_light(position, n, albedo, roughness, texelFetch(lights, 2 * i), texelFetch(lights, 2 * i + 1).rgb);
     out_color = vec4(color, 1.0);
 }
 )";
 
+const char gbuffer_fragment_shader_source[] =
+R"(#version 330 core
+
+uniform vec3 albedo;
+uniform float roughness;
+
+in vec3 normal;
+in vec3 position;
+
+layout (location = 0) out vec4 out_albedo_roughness;
+layout (location = 1) out vec2 out_normal;
+
+vec2 encode_normal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.xy;
+    if (n.z < 0.0)
+        e = (1.0 - abs(n.yx)) * mix(vec2(-1.0), vec2(1.0), greaterThanEqual(n.xy, vec2(0.0)));
+    return e * 0.5 + vec2(0.5);
+}
+
+void main()
+{
+    out_albedo_roughness = vec4(albedo, roughness);
+    out_normal = encode_normal(normalize(normal));
+}
+)";
+
+// Reads the G-buffer at gl_FragCoord, for both the full-screen pass and the light volumes
+const char gbuffer_read_source[] =
+R"(
+uniform sampler2D gbuffer_albedo_roughness;
+uniform sampler2D gbuffer_normal;
+uniform sampler2D gbuffer_depth;
+
+uniform mat4 inverse_view_projection;
+uniform vec2 viewport_size;
+
+vec3 decode_normal(vec2 encoded)
+{
+    encoded = encoded * 2.0 - vec2(1.0);
+    vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+    return normalize(n);
+}
+
+// False where nothing was drawn
+bool read_gbuffer(out vec3 position, out vec3 normal, out vec3 albedo, out float roughness)
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gbuffer_depth, pixel, 0).r;
+    if (depth == 1.0)
+        return false;
+
+    vec4 ndc = vec4(gl_FragCoord.xy / viewport_size, depth, 1.0) * 2.0 - vec4(1.0);
+    vec4 world = inverse_view_projection * ndc;
+    position = world.xyz / world.w;
+
+    normal = decode_normal(texelFetch(gbuffer_normal, pixel, 0).rg);
+    vec4 albedo_roughness = texelFetch(gbuffer_albedo_roughness, pixel, 0);
+    albedo = albedo_roughness.rgb;
+    roughness = albedo_roughness.a;
+    return true;
+}
+)";
+
+const char deferred_ambient_fragment_shader_source[] =
+R"(
+layout (location = 0) out vec4 out_color;
+
+void main()
+{
+    vec3 position, normal, albedo;
+    float roughness;
+    if (!read_gbuffer(position, normal, albedo, roughness))
+        discard;
+
+    out_color = vec4(sun_and_ambient(position, normal, albedo, roughness), 1.0);
+}
+)";
+
+// One instance per light, scaled so that the low-poly sphere contains the light's range
+const char light_volume_vertex_shader_source[] =
+R"(#version 330 core
+
+uniform mat4 view_projection;
+
+layout (location = 0) in vec3 in_position;
+layout (location = 1) in vec4 in_light_position_radius;
+layout (location = 2) in vec4 in_light_color;
+
+flat out vec4 light_position_radius;
+flat out vec3 light_color;
+
+void main()
+{
+    gl_Position = view_projection * vec4(in_light_position_radius.xyz + in_position * in_light_position_radius.w * 1.1, 1.0);
+    light_position_radius = in_light_position_radius;
+    light_color = in_light_color.rgb;
+}
+)";
+
+const char light_volume_fragment_shader_source[] =
+R"(
+flat in vec4 light_position_radius;
+flat in vec3 light_color;
+
+layout (location = 0) out vec4 out_color;
+
+void main()
+{
+    vec3 position, normal, albedo;
+    float roughness;
+    if (!read_gbuffer(position, normal, albedo, roughness))
+        discard;
+
+    vec3 to_light = light_position_radius.xyz - position;
+    if (dot(to_light, to_light) >= light_position_radius.w * light_position_radius.w)
+        discard;
+
+    out_color = vec4(point_light(position, normal, albedo, roughness, light_position_radius, light_color), 1.0);
+}
+)";
+
 const char rectangle_vertex_shader_source[] =
 R"(#version 330 core
 
@@ -119,57 +284,56 @@ void main()
 const char rectangle_fragment_shader_source[] =
 R"(#version 330 core
 
+uniform sampler2D image;
+uniform bool is_depth;
+
 in vec2 texcoord;
 
 layout (location = 0) out vec4 out_color;
 
 void main()
 {
-    out_color = vec4(texcoord, 0.0, 1.0);
+    vec4 value = texture(image, texcoord);
+    // Perspective depth crowds towards 1, so stretch what is near
+    out_color = is_depth ? vec4(vec3(pow(value.r, 64.0)), 1.0) : vec4(value.rgb, 1.0);
 }
 )";
 
-GLuint create_shader(GLenum type, const char * source)
+// A unit icosphere, subdivided once, for the light volumes
+std::vector<glm::vec3> make_sphere_triangles()
 {
-    GLuint result = glCreateShader(type);
-    glShaderSource(result, 1, &source, nullptr);
-    glCompileShader(result);
-    GLint status;
-    glGetShaderiv(result, GL_COMPILE_STATUS, &status);
-    if (status != GL_TRUE)
+    float const t = (1.f + std::sqrt(5.f)) / 2.f;
+    std::vector<glm::vec3> const corners = {
+        {-1.f, t, 0.f}, {1.f, t, 0.f}, {-1.f, -t, 0.f}, {1.f, -t, 0.f},
+        {0.f, -1.f, t}, {0.f, 1.f, t}, {0.f, -1.f, -t}, {0.f, 1.f, -t},
+        {t, 0.f, -1.f}, {t, 0.f, 1.f}, {-t, 0.f, -1.f}, {-t, 0.f, 1.f},
+    };
+    int const faces[20][3] = {
+        {0, 11, 5}, {0, 5, 1}, {0, 1, 7}, {0, 7, 10}, {0, 10, 11},
+        {1, 5, 9}, {5, 11, 4}, {11, 10, 2}, {10, 7, 6}, {7, 1, 8},
+        {3, 9, 4}, {3, 4, 2}, {3, 2, 6}, {3, 6, 8}, {3, 8, 9},
+        {4, 9, 5}, {2, 4, 11}, {6, 2, 10}, {8, 6, 7}, {9, 8, 1},
+    };
+
+    std::vector<glm::vec3> result;
+    for (auto const & face : faces)
     {
-        GLint info_log_length;
-        glGetShaderiv(result, GL_INFO_LOG_LENGTH, &info_log_length);
-        std::string info_log(info_log_length, '\0');
-        glGetShaderInfoLog(result, info_log.size(), nullptr, info_log.data());
-        throw std::runtime_error("Shader compilation failed: " + info_log);
+        glm::vec3 const a = glm::normalize(corners[face[0]]);
+        glm::vec3 const b = glm::normalize(corners[face[1]]);
+        glm::vec3 const c = glm::normalize(corners[face[2]]);
+        glm::vec3 const ab = glm::normalize(a + b);
+        glm::vec3 const bc = glm::normalize(b + c);
+        glm::vec3 const ca = glm::normalize(c + a);
+        for (auto const & v : {a, ab, ca, ab, b, bc, ca, bc, c, ab, bc, ca})
+            result.push_back(v);
     }
     return result;
 }
 
-GLuint create_program(GLuint vertex_shader, GLuint fragment_shader)
+int main(int argc, char ** argv) try
 {
-    GLuint result = glCreateProgram();
-    glAttachShader(result, vertex_shader);
-    glAttachShader(result, fragment_shader);
-    glLinkProgram(result);
-
-    GLint status;
-    glGetProgramiv(result, GL_LINK_STATUS, &status);
-    if (status != GL_TRUE)
-    {
-        GLint info_log_length;
-        glGetProgramiv(result, GL_INFO_LOG_LENGTH, &info_log_length);
-        std::string info_log(info_log_length, '\0');
-        glGetProgramInfoLog(result, info_log.size(), nullptr, info_log.data());
-        throw std::runtime_error("Program linkage failed: " + info_log);
-    }
-
-    return result;
-}
+    replay_session replay(argc, argv);
 
-int main() try
-{
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
         sdl2_fail("SDL_Init: ");
 
@@ -206,19 +370,49 @@ int main() try
 
     glClearColor(0.8f, 0.8f, 1.f, 0.f);
 
-    auto dragon_vertex_shader = create_shader(GL_VERTEX_SHADER, dragon_vertex_shader_source);
-    auto dragon_fragment_shader = create_shader(GL_FRAGMENT_SHADER, dragon_fragment_shader_source);
-    auto dragon_program = create_program(dragon_vertex_shader, dragon_fragment_shader);
+    std::string project_root = PROJECT_ROOT;
 
-    GLuint model_location = glGetUniformLocation(dragon_program, "model");
-    GLuint view_location = glGetUniformLocation(dragon_program, "view");
-    GLuint projection_location = glGetUniformLocation(dragon_program, "projection");
+    program_cache programs(project_root + "/.program_binaries");
 
-    GLuint camera_position_location = glGetUniformLocation(dragon_program, "camera_position");
+    // All of them compile while the mesh loads; the frames skip what has not finished yet
+    std::string const deferred_header = std::string(lighting_source) + gbuffer_read_source;
+
+    auto dragon_program = programs.submit({
+        {GL_VERTEX_SHADER, dragon_vertex_shader_source},
+        {GL_FRAGMENT_SHADER, std::string(lighting_source) + dragon_fragment_shader_source}});
+
+    auto gbuffer_program = programs.submit({
+        {GL_VERTEX_SHADER, dragon_vertex_shader_source},
+        {GL_FRAGMENT_SHADER, gbuffer_fragment_shader_source}});
+
+    auto rectangle_program = programs.submit({
+        {GL_VERTEX_SHADER, rectangle_vertex_shader_source},
+        {GL_FRAGMENT_SHADER, rectangle_fragment_shader_source}});
+
+    auto deferred_ambient_program = programs.submit({
+        {GL_VERTEX_SHADER, rectangle_vertex_shader_source},
+        {GL_FRAGMENT_SHADER, deferred_header + deferred_ambient_fragment_shader_source}});
+
+    auto light_volume_program = programs.submit({
+        {GL_VERTEX_SHADER, light_volume_vertex_shader_source},
+        {GL_FRAGMENT_SHADER, deferred_header + light_volume_fragment_shader_source}});
 
-    std::string project_root = PROJECT_ROOT;
     std::string dragon_model_path = project_root + "/dragon.obj";
-    obj_data dragon = parse_obj(dragon_model_path);
+    obj_data dragon = load_obj_cached(dragon_model_path);
+
+    auto cache_stats_before = analyze_vertex_cache(dragon);
+    optimize_vertex_cache(dragon);
+    optimize_overdraw(dragon);
+    optimize_vertex_fetch(dragon);
+    auto cache_stats_after = analyze_vertex_cache(dragon);
+    std::cout << "Vertex cache ACMR " << cache_stats_before.acmr << " -> " << cache_stats_after.acmr
+        << ", ATVR " << cache_stats_before.atvr << " -> " << cache_stats_after.atvr << std::endl;
+
+    // A left click picks the dragon triangle under the cursor
+    auto const bvh_start = std::chrono::high_resolution_clock::now();
+    triangle_bvh const dragon_bvh(dragon);
+    std::cout << "Dragon BVH: " << dragon_bvh.node_count() << " nodes over " << dragon_bvh.triangle_count() << " triangles in "
+        << std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - bvh_start).count() << " ms" << std::endl;
 
     GLuint dragon_vao, dragon_vbo, dragon_ebo;
     glGenVertexArrays(1, &dragon_vao);
@@ -228,39 +422,114 @@ int main() try
     glBindBuffer(GL_ARRAY_BUFFER, dragon_vbo);
     glBufferData(GL_ARRAY_BUFFER, dragon.vertices.size() * sizeof(dragon.vertices[0]), dragon.vertices.data(), GL_STATIC_DRAW);
 
+    // The dragon has few enough vertices for 16-bit indices
+    auto const dragon_indices = pack_indices(dragon.indices, dragon.vertices.size());
+
     glGenBuffers(1, &dragon_ebo);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, dragon_ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, dragon.indices.size() * sizeof(dragon.indices[0]), dragon.indices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, dragon_indices.data.size(), dragon_indices.data.data(), GL_STATIC_DRAW);
 
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), (void*)(0));
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), (void*)(12));
 
-    auto rectangle_vertex_shader = create_shader(GL_VERTEX_SHADER, rectangle_vertex_shader_source);
-    auto rectangle_fragment_shader = create_shader(GL_FRAGMENT_SHADER, rectangle_fragment_shader_source);
-    auto rectangle_program = create_program(rectangle_vertex_shader, rectangle_fragment_shader);
-
-    GLuint center_location = glGetUniformLocation(rectangle_program, "center");
-    GLuint size_location = glGetUniformLocation(rectangle_program, "size");
-
     GLuint rectangle_vao;
     glGenVertexArrays(1, &rectangle_vao);
 
+    // Both deferred programs read the G-buffer the same way
+    auto set_gbuffer_uniforms = [&](GLuint program, glm::mat4 const & inverse_view_projection, glm::vec3 const & camera_position)
+    {
+        glUniform1i(glGetUniformLocation(program, "gbuffer_albedo_roughness"), 0);
+        glUniform1i(glGetUniformLocation(program, "gbuffer_normal"), 1);
+        glUniform1i(glGetUniformLocation(program, "gbuffer_depth"), 2);
+        glUniformMatrix4fv(glGetUniformLocation(program, "inverse_view_projection"), 1, GL_FALSE, reinterpret_cast<float const *>(&inverse_view_projection));
+        glUniform2f(glGetUniformLocation(program, "viewport_size"), width, height);
+        glUniform3fv(glGetUniformLocation(program, "camera_position"), 1, reinterpret_cast<float const *>(&camera_position));
+    };
+
+    // The G-buffer and any other screen-sized targets, declared by each frame's graph
+    render_target_pool targets;
+
+    // The same buffer is per-instance light data for the deferred light volumes and a
+    // texture buffer for the forward shader
+    struct light_data
+    {
+        glm::vec4 position_radius;
+        glm::vec4 color;
+    };
+
+    std::vector<light_data> lights;
+    std::vector<glm::vec3> light_orbit_centers;
+    std::vector<float> light_phases;
+    {
+        std::default_random_engine rng(6);
+        std::uniform_real_distribution<float> unit(0.f, 1.f);
+        for (int i = 0; i < 256; ++i)
+        {
+            light_orbit_centers.push_back({-0.3f + 0.6f * unit(rng), -0.3f + 0.75f * unit(rng), -0.5f + unit(rng)});
+            light_phases.push_back(unit(rng) * 2.f * glm::pi<float>());
+            lights.push_back({glm::vec4(0.f, 0.f, 0.f, 0.05f + 0.1f * unit(rng)),
+                glm::vec4(glm::vec3(unit(rng), unit(rng), unit(rng)) * 0.8f + glm::vec3(0.2f), 1.f)});
+        }
+    }
+
+    GLuint lights_buffer;
+    glGenBuffers(1, &lights_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, lights_buffer);
+    glBufferData(GL_ARRAY_BUFFER, lights.size() * sizeof(lights[0]), nullptr, GL_DYNAMIC_DRAW);
+
+    GLuint lights_texture;
+    glGenTextures(1, &lights_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, lights_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lights_buffer);
+
+    auto const sphere_vertices = make_sphere_triangles();
+
+    GLuint light_volume_vao, light_volume_vbo;
+    glGenVertexArrays(1, &light_volume_vao);
+    glBindVertexArray(light_volume_vao);
+
+    glGenBuffers(1, &light_volume_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, light_volume_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sphere_vertices.size() * sizeof(sphere_vertices[0]), sphere_vertices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)(0));
+
+    glBindBuffer(GL_ARRAY_BUFFER, lights_buffer);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(light_data), (void*)(0));
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(light_data), (void*)(16));
+    glVertexAttribDivisor(2, 1);
+
+    profiler frame_profiler;
+    float profile_print_time = 0.f;
+
+    bool deferred = true;
+    bool show_gbuffer = false;
+
     auto last_frame_start = std::chrono::high_resolution_clock::now();
 
     float time = 0.f;
 
-    std::map<SDL_Keycode, bool> button_down;
+    input_state input;
 
     float view_angle = 0.f;
     float camera_distance = 0.5f;
     float model_angle = glm::pi<float>() / 2.f;
     float model_scale = 1.f;
 
+    bool programs_reported = false;
+
+    std::optional<glm::vec2> pick;
+
     bool running = true;
     while (running)
     {
+        input.begin_frame();
+
         for (SDL_Event event; SDL_PollEvent(&event);) switch (event.type)
         {
         case SDL_QUIT:
@@ -272,38 +541,77 @@ int main() try
                 width = event.window.data1;
                 height = event.window.data2;
                 glViewport(0, 0, width, height);
+                targets.clear();
                 break;
             }
             break;
         case SDL_KEYDOWN:
-            button_down[event.key.keysym.sym] = true;
+            input.handle_event(event);
+            // D switches between deferred and forward shading, G shows the G-buffer
+            if (event.key.keysym.sym == SDLK_d)
+                deferred = !deferred;
+            if (event.key.keysym.sym == SDLK_g)
+                show_gbuffer = !show_gbuffer;
             break;
         case SDL_KEYUP:
-            button_down[event.key.keysym.sym] = false;
+            input.handle_event(event);
+            break;
+        case SDL_MOUSEBUTTONDOWN:
+            if (event.button.button == SDL_BUTTON_LEFT)
+                pick = glm::vec2(event.button.x, event.button.y);
             break;
         }
 
         if (!running)
             break;
 
+        if (!replay.update(input))
+            break;
+
+        frame_profiler.begin_frame();
+
         auto now = std::chrono::high_resolution_clock::now();
-        float dt = std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count();
+        float dt = replay.frame_time(std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count());
         last_frame_start = now;
         time += dt;
 
-        if (button_down[SDLK_UP])
+        profile_print_time += dt;
+        if (profile_print_time >= 1.f)
+        {
+            std::cout << (deferred ? "deferred" : "forward") << ", " << lights.size() << " lights" << std::endl;
+            frame_profiler.print_summary(std::cout);
+            profile_print_time = 0.f;
+        }
+
+        if (input.down(SDL_SCANCODE_UP))
             camera_distance -= 1.f * dt;
-        if (button_down[SDLK_DOWN])
+        if (input.down(SDL_SCANCODE_DOWN))
             camera_distance += 1.f * dt;
 
-        if (button_down[SDLK_LEFT])
+        if (input.down(SDL_SCANCODE_LEFT))
             model_angle -= 2.f * dt;
-        if (button_down[SDLK_RIGHT])
+        if (input.down(SDL_SCANCODE_RIGHT))
             model_angle += 2.f * dt;
 
+        // Every program is polled, so that they all get finished once compiled; a pass whose
+        // program is not ready is left out of this frame
+        bool const forward_ready = programs.ready(dragon_program);
+        bool deferred_ready = true;
+        for (GLuint program : {gbuffer_program, deferred_ambient_program, light_volume_program})
+            deferred_ready = programs.ready(program) && deferred_ready;
+        bool const rectangle_ready = programs.ready(rectangle_program);
+
+        if (!programs_reported && programs.pending() == 0)
+        {
+            std::cout << "Programs: " << programs.loaded() << " loaded from binaries, " << programs.compiled() << " compiled" << std::endl;
+            programs_reported = true;
+        }
+
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         glEnable(GL_DEPTH_TEST);
         glEnable(GL_CULL_FACE);
+        glDepthMask(GL_TRUE);
 
         float near = 0.1f;
         float far = 100.f;
@@ -320,25 +628,178 @@ int main() try
 
         glm::vec3 camera_position = (glm::inverse(view) * glm::vec4(0.f, 0.f, 0.f, 1.f)).xyz();
 
-        glUseProgram(dragon_program);
-        glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
-        glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
-        glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
+        glm::mat4 view_projection = projection * view;
+        glm::mat4 inverse_view_projection = glm::inverse(view_projection);
+
+        if (pick)
+        {
+            // The ray from the near to the far plane in the dragon's own space, where the BVH is
+            glm::mat4 const to_model = glm::inverse(view_projection * model);
+            glm::vec2 const ndc(2.f * pick->x / width - 1.f, 1.f - 2.f * pick->y / height);
+            glm::vec4 const near_point = to_model * glm::vec4(ndc, -1.f, 1.f);
+            glm::vec4 const far_point = to_model * glm::vec4(ndc, 1.f, 1.f);
+            glm::vec3 const origin = near_point.xyz() / near_point.w;
+            glm::vec3 const direction = far_point.xyz() / far_point.w - origin;
+
+            auto const pick_start = std::chrono::high_resolution_clock::now();
+            auto const hit = dragon_bvh.intersect({origin.x, origin.y, origin.z}, {direction.x, direction.y, direction.z}, 1.f);
+            float const pick_time = std::chrono::duration<float, std::micro>(std::chrono::high_resolution_clock::now() - pick_start).count();
+
+            if (hit)
+                std::cout << "Picked triangle " << hit->triangle << " at " << glm::to_string(origin + hit->distance * direction);
+            else
+                std::cout << "Picked nothing";
+            std::cout << " in " << pick_time << " us" << std::endl;
+            pick.reset();
+        }
+
+        for (std::size_t i = 0; i < lights.size(); ++i)
+        {
+            float const t = time * 0.5f + light_phases[i];
+            glm::vec3 const position = light_orbit_centers[i] + 0.1f * glm::vec3(std::cos(t), std::sin(t * 1.7f), std::sin(t));
+            lights[i].position_radius = glm::vec4(position, lights[i].position_radius.w);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, lights_buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, lights.size() * sizeof(lights[0]), lights.data());
+
+        glm::vec3 const albedo(1.f);
+        float const roughness = 0.3f;
+
+        // Written once by the geometry pass and read by every light: albedo and roughness in
+        // RGBA8, octahedral normals in RG16 mapped to [0, 1], since GL 3.3 does not require
+        // RG16_SNORM to be renderable, and depth in a texture so that lights can rebuild
+        // positions from it. Without a pass reading them the geometry pass is culled and the
+        // targets take no memory.
+        frame_graph graph(targets, width, height);
+        auto const gbuffer_albedo_roughness = graph.create_texture("albedo roughness", {width, height, GL_RGBA8});
+        auto const gbuffer_normal = graph.create_texture("normal", {width, height, GL_RG16});
+        auto const gbuffer_depth = graph.create_texture("depth", {width, height, GL_DEPTH_COMPONENT24});
+
+        auto bind_gbuffer = [&](frame_graph const & g)
+        {
+            GLuint const textures[] = {g.texture(gbuffer_albedo_roughness), g.texture(gbuffer_normal), g.texture(gbuffer_depth)};
+            for (int i = 0; i < 3; ++i)
+            {
+                glActiveTexture(GL_TEXTURE0 + i);
+                glBindTexture(GL_TEXTURE_2D, textures[i]);
+            }
+        };
+
+        // The dragon is shaded once per pixel however many of its triangles overlap there
+        if (deferred && programs.ready(gbuffer_program))
+        {
+            graph.add_pass("gbuffer", {}, {gbuffer_albedo_roughness, gbuffer_normal, gbuffer_depth}, [&](frame_graph const &)
+            {
+                profiler::gpu_scope scope(frame_profiler, "gbuffer");
+
+                glEnable(GL_DEPTH_TEST);
+                glDepthMask(GL_TRUE);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+                glUseProgram(gbuffer_program);
+                glUniformMatrix4fv(glGetUniformLocation(gbuffer_program, "model"), 1, GL_FALSE, reinterpret_cast<float *>(&model));
+                glUniformMatrix4fv(glGetUniformLocation(gbuffer_program, "view"), 1, GL_FALSE, reinterpret_cast<float *>(&view));
+                glUniformMatrix4fv(glGetUniformLocation(gbuffer_program, "projection"), 1, GL_FALSE, reinterpret_cast<float *>(&projection));
+                glUniform3fv(glGetUniformLocation(gbuffer_program, "albedo"), 1, reinterpret_cast<float const *>(&albedo));
+                glUniform1f(glGetUniformLocation(gbuffer_program, "roughness"), roughness);
+
+                glBindVertexArray(dragon_vao);
+                glDrawElements(GL_TRIANGLES, dragon_indices.count, dragon_indices.gl_type(), nullptr);
+            });
+        }
+
+        if (deferred && deferred_ready)
+        {
+            graph.add_pass("lighting", {gbuffer_albedo_roughness, gbuffer_normal, gbuffer_depth}, {frame_graph::backbuffer}, [&](frame_graph const & g)
+            {
+                profiler::gpu_scope scope(frame_profiler, "lighting");
+
+                bind_gbuffer(g);
+                glDisable(GL_DEPTH_TEST);
+                glDepthMask(GL_FALSE);
+
+                glUseProgram(deferred_ambient_program);
+                set_gbuffer_uniforms(deferred_ambient_program, inverse_view_projection, camera_position);
+                glUniform2f(glGetUniformLocation(deferred_ambient_program, "center"), 0.f, 0.f);
+                glUniform2f(glGetUniformLocation(deferred_ambient_program, "size"), 1.f, 1.f);
+                glBindVertexArray(rectangle_vao);
+                glDrawArrays(GL_TRIANGLES, 0, 6);
+
+                // Back faces, so that volumes around the camera still cover the screen; the depth
+                // texture is sampled rather than attached, so the range test is in the shader
+                glEnable(GL_BLEND);
+                glBlendFunc(GL_ONE, GL_ONE);
+                glCullFace(GL_FRONT);
+
+                glUseProgram(light_volume_program);
+                set_gbuffer_uniforms(light_volume_program, inverse_view_projection, camera_position);
+                glUniformMatrix4fv(glGetUniformLocation(light_volume_program, "view_projection"), 1, GL_FALSE, reinterpret_cast<float *>(&view_projection));
+                glBindVertexArray(light_volume_vao);
+                glDrawArraysInstanced(GL_TRIANGLES, 0, sphere_vertices.size(), lights.size());
+
+                glCullFace(GL_BACK);
+                glDisable(GL_BLEND);
+            });
+        }
+        else if (!deferred && forward_ready)
+        {
+            graph.add_pass("forward", {}, {frame_graph::backbuffer}, [&](frame_graph const &)
+            {
+                profiler::gpu_scope scope(frame_profiler, "forward");
 
-        glUniform3fv(camera_position_location, 1, (float*)(&camera_position));
+                glUseProgram(dragon_program);
+                glUniformMatrix4fv(glGetUniformLocation(dragon_program, "model"), 1, GL_FALSE, reinterpret_cast<float *>(&model));
+                glUniformMatrix4fv(glGetUniformLocation(dragon_program, "view"), 1, GL_FALSE, reinterpret_cast<float *>(&view));
+                glUniformMatrix4fv(glGetUniformLocation(dragon_program, "projection"), 1, GL_FALSE, reinterpret_cast<float *>(&projection));
 
-        glBindVertexArray(dragon_vao);
-        glDrawElements(GL_TRIANGLES, dragon.indices.size(), GL_UNSIGNED_INT, nullptr);
+                glUniform3fv(glGetUniformLocation(dragon_program, "camera_position"), 1, (float*)(&camera_position));
+                glUniform3fv(glGetUniformLocation(dragon_program, "albedo"), 1, reinterpret_cast<float const *>(&albedo));
+                glUniform1f(glGetUniformLocation(dragon_program, "roughness"), roughness);
+                glUniform1i(glGetUniformLocation(dragon_program, "lights"), 0);
+                glUniform1i(glGetUniformLocation(dragon_program, "light_count"), lights.size());
 
-        glUseProgram(rectangle_program);
-        glUniform2f(center_location, -0.5f, -0.5f);
-        glUniform2f(size_location, 0.5f, 0.5f);
-        glBindVertexArray(rectangle_vao);
-//        glDrawArrays(GL_TRIANGLES, 0, 6);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_BUFFER, lights_texture);
+
+                glBindVertexArray(dragon_vao);
+                glDrawElements(GL_TRIANGLES, dragon_indices.count, dragon_indices.gl_type(), nullptr);
+            });
+        }
+
+        if (show_gbuffer && deferred && rectangle_ready)
+        {
+            graph.add_pass("gbuffer view", {gbuffer_albedo_roughness, gbuffer_normal, gbuffer_depth}, {frame_graph::backbuffer}, [&](frame_graph const & g)
+            {
+                glDisable(GL_DEPTH_TEST);
+                glUseProgram(rectangle_program);
+                glUniform1i(glGetUniformLocation(rectangle_program, "image"), 0);
+                glBindVertexArray(rectangle_vao);
+
+                GLuint const textures[] = {g.texture(gbuffer_albedo_roughness), g.texture(gbuffer_normal), g.texture(gbuffer_depth)};
+                for (int i = 0; i < 3; ++i)
+                {
+                    glActiveTexture(GL_TEXTURE0);
+                    glBindTexture(GL_TEXTURE_2D, textures[i]);
+                    glUniform1i(glGetUniformLocation(rectangle_program, "is_depth"), i == 2);
+                    glUniform2f(glGetUniformLocation(rectangle_program, "center"), -0.75f + 0.5f * i, -0.75f);
+                    glUniform2f(glGetUniformLocation(rectangle_program, "size"), 0.2f, 0.2f);
+                    glDrawArrays(GL_TRIANGLES, 0, 6);
+                }
+            });
+        }
+
+        graph.execute();
+        frame_profiler.counter("passes culled", graph.passes_culled());
+        frame_profiler.counter("target MB", targets.texture_bytes() / (1024.0 * 1024.0));
+
+        replay.end_frame();
 
         SDL_GL_SwapWindow(window);
+        frame_profiler.end_frame();
     }
 
+    replay.finish();
+
     SDL_GL_DeleteContext(gl_context);
     SDL_DestroyWindow(window);
 }
@@ -0,0 +1,161 @@
+#include "light_clusters.hpp"
+
+#include <glm/vec4.hpp>
+#include <glm/common.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+light_clusters::light_clusters(int tiles_x, int tiles_y, int slices_z)
+    : tiles_x_(tiles_x)
+    , tiles_y_(tiles_y)
+    , slices_z_(slices_z)
+    , slice_indices_(slices_z)
+    , slice_counts_(slices_z)
+{}
+
+namespace
+{
+
+    struct view_light
+    {
+        glm::vec3 center;
+        float radius;
+        int first_slice, last_slice;
+    };
+
+    struct tile_range
+    {
+        std::uint32_t light;
+        int min_x, max_x, min_y, max_y;
+    };
+
+    int tile_of(float ndc, int tiles)
+    {
+        return std::clamp(static_cast<int>(std::floor((ndc * 0.5f + 0.5f) * tiles)), 0, tiles - 1);
+    }
+
+    float squared_distance_to_interval(float x, float min, float max)
+    {
+        float const d = x < min ? min - x : (x > max ? x - max : 0.f);
+        return d * d;
+    }
+
+}
+
+void light_clusters::build(job_system & jobs, std::vector<cluster_light> const & lights, glm::mat4 const & view,
+    float fov_y, float aspect, float near, float far)
+{
+    float const tan_y = std::tan(fov_y / 2.f);
+    float const tan_x = tan_y * aspect;
+    float const log_depth_ratio = std::log(far / near);
+
+    auto slice_depth = [&](int slice){ return near * std::exp(log_depth_ratio * slice / slices_z_); };
+    auto slice_of = [&](float depth){ return static_cast<int>(std::floor(std::log(depth / near) / log_depth_ratio * slices_z_)); };
+
+    std::vector<view_light> view_lights;
+    view_lights.reserve(lights.size());
+    for (auto const & light : lights)
+    {
+        glm::vec3 const center = glm::vec3(view * glm::vec4(light.position, 1.f));
+        float const depth = -center.z;
+        if (depth + light.radius < near || depth - light.radius > far)
+        {
+            view_lights.push_back({center, light.radius, 1, 0});
+            continue;
+        }
+
+        int const first = std::max(0, slice_of(std::max(depth - light.radius, near)));
+        int const last = std::min(slices_z_ - 1, slice_of(std::min(depth + light.radius, far)));
+        view_lights.push_back({center, light.radius, first, last});
+    }
+
+    int const tile_count = tiles_x_ * tiles_y_;
+
+    jobs.parallel_for(slices_z_, [&](std::size_t s)
+    {
+        int const slice = s;
+        float const slice_near = slice_depth(slice);
+        float const slice_far = slice_depth(slice + 1);
+
+        // Screen tiles that each light's sphere can cover within this slice; x / depth is
+        // monotonic in depth, so the extremes are at the ends of the clipped depth range
+        std::vector<tile_range> candidates;
+        for (std::uint32_t i = 0; i < view_lights.size(); ++i)
+        {
+            auto const & light = view_lights[i];
+            if (slice < light.first_slice || slice > light.last_slice)
+                continue;
+
+            float const depth = -light.center.z;
+            float const d0 = std::max(slice_near, depth - light.radius);
+            float const d1 = std::min(slice_far, depth + light.radius);
+
+            float const x0 = light.center.x - light.radius, x1 = light.center.x + light.radius;
+            float const y0 = light.center.y - light.radius, y1 = light.center.y + light.radius;
+
+            candidates.push_back({i,
+                tile_of(std::min(x0 / d0, x0 / d1) / tan_x, tiles_x_), tile_of(std::max(x1 / d0, x1 / d1) / tan_x, tiles_x_),
+                tile_of(std::min(y0 / d0, y0 / d1) / tan_y, tiles_y_), tile_of(std::max(y1 / d0, y1 / d1) / tan_y, tiles_y_)});
+        }
+
+        auto & indices = slice_indices_[slice];
+        auto & counts = slice_counts_[slice];
+        indices.clear();
+        counts.assign(tile_count, 0);
+
+        for (int ty = 0; ty < tiles_y_; ++ty)
+        {
+            float const ya = (2.f * ty / tiles_y_ - 1.f) * tan_y;
+            float const yb = (2.f * (ty + 1) / tiles_y_ - 1.f) * tan_y;
+
+            for (int tx = 0; tx < tiles_x_; ++tx)
+            {
+                float const xa = (2.f * tx / tiles_x_ - 1.f) * tan_x;
+                float const xb = (2.f * (tx + 1) / tiles_x_ - 1.f) * tan_x;
+
+                // View-space box around the cluster's frustum cell
+                float const min_x = std::min(xa * slice_near, xa * slice_far), max_x = std::max(xb * slice_near, xb * slice_far);
+                float const min_y = std::min(ya * slice_near, ya * slice_far), max_y = std::max(yb * slice_near, yb * slice_far);
+
+                std::uint32_t count = 0;
+                for (auto const & candidate : candidates)
+                {
+                    if (tx < candidate.min_x || tx > candidate.max_x || ty < candidate.min_y || ty > candidate.max_y)
+                        continue;
+
+                    auto const & light = view_lights[candidate.light];
+                    float const d2 = squared_distance_to_interval(light.center.x, min_x, max_x)
+                        + squared_distance_to_interval(light.center.y, min_y, max_y)
+                        + squared_distance_to_interval(-light.center.z, slice_near, slice_far);
+                    if (d2 > light.radius * light.radius)
+                        continue;
+
+                    indices.push_back(candidate.light);
+                    ++count;
+                }
+                counts[ty * tiles_x_ + tx] = count;
+            }
+        }
+    });
+
+    cluster_ranges_.resize(cluster_count() * 2);
+    light_indices_.clear();
+    max_cluster_lights_ = 0;
+
+    // Slices already hold their clusters' lights back to back, so ranges are running offsets
+    std::uint32_t offset = 0;
+    for (int slice = 0; slice < slices_z_; ++slice)
+    {
+        for (int tile = 0; tile < tile_count; ++tile)
+        {
+            std::size_t const cluster = static_cast<std::size_t>(slice) * tile_count + tile;
+            std::uint32_t const count = slice_counts_[slice][tile];
+            cluster_ranges_[cluster * 2 + 0] = offset;
+            cluster_ranges_[cluster * 2 + 1] = count;
+            max_cluster_lights_ = std::max(max_cluster_lights_, count);
+            offset += count;
+        }
+        light_indices_.insert(light_indices_.end(), slice_indices_[slice].begin(), slice_indices_[slice].end());
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "job_system.hpp"
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <vector>
+#include <cstdint>
+
+struct cluster_light
+{
+    glm::vec3 position;
+    // Light falls to zero at this distance
+    float radius;
+    glm::vec3 color;
+    // Cosine of the cone half-angle, -1 for a point light
+    float spot_cutoff = -1.f;
+    // Cone axis, pointing away from the light
+    glm::vec3 direction{0.f, -1.f, 0.f};
+};
+
+// Bins lights into a view-space grid of tiles_x * tiles_y screen tiles by slices_z depth
+// slices, the slices spaced exponentially between near and far so that clusters stay
+// roughly cubical. Each light is bounded by its sphere, which is conservative for spots.
+// Depth slices are binned in parallel, each against every light that reaches it.
+struct light_clusters
+{
+    light_clusters(int tiles_x, int tiles_y, int slices_z);
+
+    int tiles_x() const { return tiles_x_; }
+    int tiles_y() const { return tiles_y_; }
+    int slices_z() const { return slices_z_; }
+    std::size_t cluster_count() const { return static_cast<std::size_t>(tiles_x_) * tiles_y_ * slices_z_; }
+
+    void build(job_system & jobs, std::vector<cluster_light> const & lights, glm::mat4 const & view,
+        float fov_y, float aspect, float near, float far);
+
+    // Offset into light_indices() and light count per cluster, x fastest, then y, then slice
+    std::vector<std::uint32_t> const & cluster_ranges() const { return cluster_ranges_; }
+    std::vector<std::uint32_t> const & light_indices() const { return light_indices_; }
+
+    std::uint32_t max_cluster_lights() const { return max_cluster_lights_; }
+
+private:
+    int tiles_x_, tiles_y_, slices_z_;
+
+    std::vector<std::uint32_t> cluster_ranges_;
+    std::vector<std::uint32_t> light_indices_;
+    std::uint32_t max_cluster_lights_ = 0;
+
+    // Per slice, so that slices fill them without locking
+    std::vector<std::vector<std::uint32_t>> slice_indices_;
+    std::vector<std::vector<std::uint32_t>> slice_counts_;
+};
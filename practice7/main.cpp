@@ -14,10 +14,12 @@
 #include <iostream>
 #include <chrono>
 #include <vector>
-#include <map>
 #include <cmath>
 #include <fstream>
 #include <sstream>
+#include <random>
+#include <algorithm>
+#include <cstdint>
 
 #define GLM_FORCE_SWIZZLE
 #define GLM_ENABLE_EXPERIMENTAL
@@ -30,6 +32,13 @@
 #include <glm/gtx/string_cast.hpp>
 
 #include "obj_parser.hpp"
+#include "index_buffer.hpp"
+#include "triangle_bvh.hpp"
+#include "light_probes.hpp"
+#include "job_system.hpp"
+#include "light_clusters.hpp"
+#include "input_state.hpp"
+#include "replay_session.hpp"
 
 std::string to_string(std::string_view str) {
     return std::string(str.begin(), str.end());
@@ -55,12 +64,15 @@ layout (location = 1) in vec3 in_normal;
 
 out vec3 position;
 out vec3 normal;
+out float view_depth;
 
 void main()
 {
     position = (model * vec4(in_position, 1.0)).xyz;
-    gl_Position = projection * view * vec4(position, 1.0);
+    vec4 view_position = view * vec4(position, 1.0);
+    gl_Position = projection * view_position;
     normal = normalize(mat3(model) * in_normal);
+    view_depth = -view_position.z;
 }
 )";
 
@@ -73,15 +85,113 @@ uniform vec3 albedo;
 
 uniform vec3 ambient_light;
 
+// Baked indirect light, nine slabs of SH coefficients as light_probe_grid::texels() lays them out;
+// ambient_light stands in for it when use_light_probes is off
+uniform bool use_light_probes;
+uniform sampler3D light_probes;
+uniform vec3 light_probe_min;
+uniform vec3 light_probe_max;
+
+// Three texels per light: position and radius, color and spot cutoff, spot direction
+uniform samplerBuffer lights;
+uniform int light_count;
+
+// Offset and count into light_indices per cluster, laid out as in light_clusters
+uniform usamplerBuffer cluster_ranges;
+uniform usamplerBuffer light_indices;
+uniform ivec3 cluster_grid;
+uniform vec2 viewport_size;
+uniform float cluster_near;
+uniform float cluster_log_depth_ratio;
+
+uniform bool clustered;
+uniform bool show_clusters;
+
 in vec3 position;
 in vec3 normal;
+in float view_depth;
 
 layout (location = 0) out vec4 out_color;
 
+vec3 point_light(int index, vec3 n)
+{
+    vec4 position_radius = texelFetch(lights, index * 3 + 0);
+    vec4 color_cutoff = texelFetch(lights, index * 3 + 1);
+
+    vec3 to_light = position_radius.xyz - position;
+    float d = length(to_light);
+    float falloff = clamp(1.0 - d * d / (position_radius.w * position_radius.w), 0.0, 1.0);
+    if (falloff == 0.0)
+        return vec3(0.0);
+
+    vec3 direction = to_light / d;
+    float spot = 1.0;
+    if (color_cutoff.w > -1.0)
+    {
+        vec3 axis = texelFetch(lights, index * 3 + 2).xyz;
+        spot = smoothstep(color_cutoff.w, mix(color_cutoff.w, 1.0, 0.2), dot(-direction, axis));
+    }
+
+    vec3 reflected_direction = 2.0 * n * dot(n, direction) - direction;
+    vec3 view_direction = normalize(camera_position - position);
+    float diffuse = max(0.0, dot(n, direction));
+    float specular = pow(max(0.0, dot(reflected_direction, view_direction)), 32.0);
+    return color_cutoff.rgb * (albedo * diffuse + vec3(specular) * 0.3) * falloff * falloff * spot;
+}
+
+vec3 probe_irradiance(vec3 n)
+{
+    ivec3 size = textureSize(light_probes, 0);
+    vec3 grid = vec3(size.xy, size.z / 9);
+    vec3 spacing = (light_probe_max - light_probe_min) / (grid - vec3(1.0));
+
+    // Half a cell off the surface keeps the probes inside the monkeys out of the lookup;
+    // clamping to the texel centers keeps each lookup within its coefficient's slab
+    vec3 cell = clamp((position + n * spacing * 0.5 - light_probe_min) / spacing, vec3(0.0), grid - vec3(1.0)) + vec3(0.5);
+    vec3 texcoord = cell / vec3(size);
+    float slab = grid.z / float(size.z);
+
+    vec3 c[9];
+    for (int i = 0; i < 9; ++i)
+        c[i] = texture(light_probes, texcoord + vec3(0.0, 0.0, slab * float(i))).rgb;
+
+    vec3 result = c[0] * 0.282095
+        + (c[1] * n.y + c[2] * n.z + c[3] * n.x) * 0.488603
+        + (c[4] * n.x * n.y + c[5] * n.y * n.z + c[7] * n.x * n.z) * 1.092548
+        + c[6] * 0.315392 * (3.0 * n.z * n.z - 1.0)
+        + c[8] * 0.546274 * (n.x * n.x - n.y * n.y);
+    return max(result, vec3(0.0));
+}
+
 void main()
 {
-    vec3 ambient = albedo * ambient_light;
-    vec3 color = ambient;
+    vec3 n = normalize(normal);
+    vec3 color = albedo * (use_light_probes ? probe_irradiance(n) : ambient_light);
+
+    ivec3 cluster = ivec3(gl_FragCoord.xy / viewport_size * vec2(cluster_grid.xy),
+        int(floor(log(view_depth / cluster_near) / cluster_log_depth_ratio * float(cluster_grid.z))));
+    cluster = clamp(cluster, ivec3(0), cluster_grid - ivec3(1));
+
+    uvec2 range = texelFetch(cluster_ranges, (cluster.z * cluster_grid.y + cluster.y) * cluster_grid.x + cluster.x).rg;
+
+    if (show_clusters)
+    {
+        float heat = float(range.y) / 32.0;
+        out_color = vec4(mix(color, vec3(heat, 1.0 - abs(heat - 0.5) * 2.0, 1.0 - heat), 0.7), 1.0);
+        return;
+    }
+
+    if (clustered)
+    {
+        for (uint i = 0u; i < range.y; ++i)
+            color += point_light(int(texelFetch(light_indices, int(range.x + i)).r), n);
+    }
+    else
+    {
+        for (int i = 0; i < light_count; ++i)
+            color += point_light(i, n);
+    }
+
     out_color = vec4(color, 1.0);
 }
 )";
@@ -121,7 +231,9 @@ GLuint create_program(GLuint vertex_shader, GLuint fragment_shader) {
     return result;
 }
 
-int main() try {
+int main(int argc, char ** argv) try {
+    replay_session replay(argc, argv);
+
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
         sdl2_fail("SDL_Init: ");
 
@@ -168,6 +280,20 @@ int main() try {
     GLuint camera_position_location = glGetUniformLocation(program, "camera_position");
     GLuint albedo_location = glGetUniformLocation(program, "albedo");
     GLuint ambient_light_location = glGetUniformLocation(program, "ambient_light");
+    GLuint use_light_probes_location = glGetUniformLocation(program, "use_light_probes");
+    GLuint light_probes_location = glGetUniformLocation(program, "light_probes");
+    GLuint light_probe_min_location = glGetUniformLocation(program, "light_probe_min");
+    GLuint light_probe_max_location = glGetUniformLocation(program, "light_probe_max");
+    GLuint lights_location = glGetUniformLocation(program, "lights");
+    GLuint light_count_location = glGetUniformLocation(program, "light_count");
+    GLuint cluster_ranges_location = glGetUniformLocation(program, "cluster_ranges");
+    GLuint light_indices_location = glGetUniformLocation(program, "light_indices");
+    GLuint cluster_grid_location = glGetUniformLocation(program, "cluster_grid");
+    GLuint viewport_size_location = glGetUniformLocation(program, "viewport_size");
+    GLuint cluster_near_location = glGetUniformLocation(program, "cluster_near");
+    GLuint cluster_log_depth_ratio_location = glGetUniformLocation(program, "cluster_log_depth_ratio");
+    GLuint clustered_location = glGetUniformLocation(program, "clustered");
+    GLuint show_clusters_location = glGetUniformLocation(program, "show_clusters");
 
     std::string project_root = PROJECT_ROOT;
     std::string suzanne_model_path = project_root + "/suzanne.obj";
@@ -182,9 +308,32 @@ int main() try {
     glBufferData(GL_ARRAY_BUFFER, suzanne.vertices.size() * sizeof(suzanne.vertices[0]), suzanne.vertices.data(),
                  GL_STATIC_DRAW);
 
+    auto const suzanne_indices = pack_indices(suzanne.indices, suzanne.vertices.size());
+
     glGenBuffers(1, &suzanne_ebo);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, suzanne_ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, suzanne.indices.size() * sizeof(suzanne.indices[0]), suzanne.indices.data(),
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, suzanne_indices.data.size(), suzanne_indices.data.data(), GL_STATIC_DRAW);
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), (void *) (0));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), (void *) (12));
+
+    float const floor_size = 12.f;
+    std::vector<obj_data::vertex> floor_vertices = {
+            {{-floor_size, -1.f, -floor_size}, {0.f, 1.f, 0.f}, {0.f, 0.f}},
+            {{-floor_size, -1.f, floor_size}, {0.f, 1.f, 0.f}, {0.f, 1.f}},
+            {{floor_size, -1.f, -floor_size}, {0.f, 1.f, 0.f}, {1.f, 0.f}},
+            {{floor_size, -1.f, floor_size}, {0.f, 1.f, 0.f}, {1.f, 1.f}},
+    };
+
+    GLuint floor_vao, floor_vbo;
+    glGenVertexArrays(1, &floor_vao);
+    glBindVertexArray(floor_vao);
+
+    glGenBuffers(1, &floor_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, floor_vbo);
+    glBufferData(GL_ARRAY_BUFFER, floor_vertices.size() * sizeof(floor_vertices[0]), floor_vertices.data(),
                  GL_STATIC_DRAW);
 
     glEnableVertexAttribArray(0);
@@ -192,11 +341,125 @@ int main() try {
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), (void *) (12));
 
+    // Indirect light is baked once against the static scene: the floor and the field of
+    // monkeys drawn below, in world space
+    std::vector<float> scene_positions;
+    std::vector<std::uint32_t> scene_indices;
+    auto add_to_scene = [&](std::vector<obj_data::vertex> const &vertices, std::vector<std::uint32_t> const &indices,
+                            glm::vec3 const &offset) {
+        std::uint32_t const base = scene_positions.size() / 3;
+        for (auto const &v: vertices)
+            for (int i = 0; i < 3; ++i)
+                scene_positions.push_back(v.position[i] + offset[i]);
+        for (auto i: indices)
+            scene_indices.push_back(base + i);
+    };
+    add_to_scene(floor_vertices, {0, 1, 2, 2, 1, 3}, glm::vec3(0.f));
+    for (int x = -3; x <= 3; ++x)
+        for (int z = -3; z <= 3; ++z)
+            add_to_scene(suzanne.vertices, suzanne.indices, {x * 3.f, 0.f, z * 3.f});
+
+    auto bake_start = std::chrono::high_resolution_clock::now();
+    light_probe_settings probe_settings;
+    probe_settings.resolution = {25, 4, 25};
+    probe_settings.sky_zenith = {0.06f, 0.06f, 0.07f};
+    probe_settings.sky_horizon = {0.05f, 0.05f, 0.05f};
+    probe_settings.ground = {0.03f, 0.03f, 0.03f};
+    probe_settings.bounce = {0.02f, 0.015f, 0.01f};
+    // The lowest probes sit just above the floor rather than on it
+    auto const probes = bake_light_probes(triangle_bvh(scene_positions.data(), 3 * sizeof(float), scene_indices),
+                                          {-floor_size, -0.9f, -floor_size}, {floor_size, 2.f, floor_size}, probe_settings);
+    std::cout << "Baked " << probes.probe_count() << " light probes in "
+              << std::chrono::duration_cast<std::chrono::duration<float>>(
+                      std::chrono::high_resolution_clock::now() - bake_start).count() * 1000.f << " ms" << std::endl;
+
+    GLuint light_probes_texture;
+    glGenTextures(1, &light_probes_texture);
+    glBindTexture(GL_TEXTURE_3D, light_probes_texture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB16F, probes.resolution[0], probes.resolution[1], probes.resolution[2] * 9, 0,
+                 GL_RGB, GL_FLOAT, probes.texels().data());
+
+    // Lights and light lists reach the shader through texture buffers, resized every frame
+    auto create_texture_buffer = [](GLenum format, GLuint &buffer, GLuint &texture) {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+    };
+
+    GLuint lights_buffer, lights_texture;
+    GLuint cluster_ranges_buffer, cluster_ranges_texture;
+    GLuint light_indices_buffer, light_indices_texture;
+    create_texture_buffer(GL_RGBA32F, lights_buffer, lights_texture);
+    create_texture_buffer(GL_RG32UI, cluster_ranges_buffer, cluster_ranges_texture);
+    create_texture_buffer(GL_R32UI, light_indices_buffer, light_indices_texture);
+
+    auto upload = [](GLuint buffer, auto const &data) {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        // An empty store would make the texture buffer invalid, so keep at least one element
+        glBufferData(GL_TEXTURE_BUFFER, std::max<std::size_t>(data.size(), 1) * sizeof(data[0]), nullptr,
+                     GL_STREAM_DRAW);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, data.size() * sizeof(data[0]), data.data());
+    };
+
+    job_system jobs;
+    light_clusters clusters(16, 9, 24);
+    std::cout << "Binning lights on " << jobs.thread_count() << " threads" << std::endl;
+
+    // Lights wander over the floor with their own speed and phase
+    struct wandering_light {
+        cluster_light light;
+        glm::vec3 center;
+        float speed;
+        float phase;
+    };
+
+    std::vector<wandering_light> wandering_lights;
+    std::vector<cluster_light> lights;
+    std::vector<glm::vec4> light_texels;
+
+    auto make_lights = [&](std::size_t count) {
+        std::default_random_engine rng(count);
+        std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+        wandering_lights.clear();
+        for (std::size_t i = 0; i < count; ++i) {
+            wandering_light w;
+            w.center = {(unit(rng) * 2.f - 1.f) * floor_size, -0.5f + unit(rng) * 2.f, (unit(rng) * 2.f - 1.f) * floor_size};
+            w.speed = 0.2f + unit(rng) * 0.6f;
+            w.phase = unit(rng) * 2.f * glm::pi<float>();
+            w.light.radius = 1.f + unit(rng) * 2.f;
+            w.light.color = glm::vec3(unit(rng), unit(rng), unit(rng)) * 0.8f + glm::vec3(0.2f);
+            // Every fourth light is a spot pointing down
+            if (i % 4 == 0)
+                w.light.spot_cutoff = std::cos(0.4f + unit(rng) * 0.4f);
+            wandering_lights.push_back(w);
+        }
+    };
+
+    std::size_t const light_counts[] = {64, 256, 1024};
+    int light_count_index = 1;
+    make_lights(light_counts[light_count_index]);
+
+    bool clustered = true;
+    bool show_clusters = false;
+    bool use_light_probes = true;
+    float print_time = 0.f;
+    float binning_time = 0.f;
+    int binning_frames = 0;
+
     auto last_frame_start = std::chrono::high_resolution_clock::now();
 
     float time = 0.f;
 
-    std::map<SDL_Keycode, bool> button_down;
+    input_state input;
 
     bool transparent = false;
 
@@ -206,6 +469,8 @@ int main() try {
 
     bool running = true;
     while (running) {
+        input.begin_frame();
+
         for (SDL_Event event; SDL_PollEvent(&event);)
             switch (event.type) {
                 case SDL_QUIT:
@@ -220,36 +485,52 @@ int main() try {
                     }
                     break;
                 case SDL_KEYDOWN:
-                    button_down[event.key.keysym.sym] = true;
+                    input.handle_event(event);
                     if (event.key.keysym.sym == SDLK_SPACE)
                         transparent = !transparent;
+                    // C compares against looping over every light, H shows the lights per cluster,
+                    // N cycles the number of lights, P switches between the baked probes and
+                    // a constant ambient light
+                    if (event.key.keysym.sym == SDLK_c)
+                        clustered = !clustered;
+                    if (event.key.keysym.sym == SDLK_h)
+                        show_clusters = !show_clusters;
+                    if (event.key.keysym.sym == SDLK_n) {
+                        light_count_index = (light_count_index + 1) % std::size(light_counts);
+                        make_lights(light_counts[light_count_index]);
+                    }
+                    if (event.key.keysym.sym == SDLK_p)
+                        use_light_probes = !use_light_probes;
                     break;
                 case SDL_KEYUP:
-                    button_down[event.key.keysym.sym] = false;
+                    input.handle_event(event);
                     break;
             }
 
         if (!running)
             break;
 
+        if (!replay.update(input))
+            break;
+
         auto now = std::chrono::high_resolution_clock::now();
-        float dt = std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count();
+        float dt = replay.frame_time(std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count());
         last_frame_start = now;
         time += dt;
 
-        if (button_down[SDLK_UP])
+        if (input.down(SDL_SCANCODE_UP))
             camera_distance -= 4.f * dt;
-        if (button_down[SDLK_DOWN])
+        if (input.down(SDL_SCANCODE_DOWN))
             camera_distance += 4.f * dt;
 
-        if (button_down[SDLK_LEFT])
+        if (input.down(SDL_SCANCODE_LEFT))
             camera_angle += 2.f * dt;
-        if (button_down[SDLK_RIGHT])
+        if (input.down(SDL_SCANCODE_RIGHT))
             camera_angle -= 2.f * dt;
 
-        if (button_down[SDLK_KP_4])
+        if (input.down(SDL_SCANCODE_KP_4))
             camera_x -= 4.f * dt;
-        if (button_down[SDLK_KP_6])
+        if (input.down(SDL_SCANCODE_KP_6))
             camera_x += 4.f * dt;
 
         glViewport(0, 0, width, height);
@@ -274,20 +555,93 @@ int main() try {
 
         glm::vec3 camera_position = (glm::inverse(view) * glm::vec4(0.f, 0.f, 0.f, 1.f)).xyz();
 
+        lights.clear();
+        light_texels.clear();
+        for (auto &w : wandering_lights) {
+            float const t = time * w.speed + w.phase;
+            w.light.position = w.center + glm::vec3(std::cos(t), 0.f, std::sin(t * 1.3f)) * 1.5f;
+            lights.push_back(w.light);
+
+            light_texels.push_back(glm::vec4(w.light.position, w.light.radius));
+            light_texels.push_back(glm::vec4(w.light.color, w.light.spot_cutoff));
+            light_texels.push_back(glm::vec4(w.light.direction, 0.f));
+        }
+
+        float const fov_y = glm::pi<float>() / 3.f;
+        auto binning_start = std::chrono::high_resolution_clock::now();
+        clusters.build(jobs, lights, view, fov_y, (width * 1.f) / height, near, far);
+        binning_time += std::chrono::duration_cast<std::chrono::duration<float>>(
+                std::chrono::high_resolution_clock::now() - binning_start).count();
+        ++binning_frames;
+
+        upload(lights_buffer, light_texels);
+        upload(cluster_ranges_buffer, clusters.cluster_ranges());
+        upload(light_indices_buffer, clusters.light_indices());
+
         glUseProgram(program);
         glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
         glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
         glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
         glUniform3fv(camera_position_location, 1, (float *) (&camera_position));
         glUniform3f(albedo_location, 0.7f, 0.4f, 0.2f);
-        glUniform3f(ambient_light_location, 0.2f, 0.2f, 0.2f);
-
+        glUniform3f(ambient_light_location, 0.05f, 0.05f, 0.05f);
+        glUniform1i(use_light_probes_location, use_light_probes);
+        glUniform1i(light_probes_location, 3);
+        glUniform3fv(light_probe_min_location, 1, probes.min.data());
+        glUniform3fv(light_probe_max_location, 1, probes.max.data());
+
+        glUniform1i(lights_location, 0);
+        glUniform1i(cluster_ranges_location, 1);
+        glUniform1i(light_indices_location, 2);
+        glUniform1i(light_count_location, lights.size());
+        glUniform3i(cluster_grid_location, clusters.tiles_x(), clusters.tiles_y(), clusters.slices_z());
+        glUniform2f(viewport_size_location, width, height);
+        glUniform1f(cluster_near_location, near);
+        glUniform1f(cluster_log_depth_ratio_location, std::log(far / near));
+        glUniform1i(clustered_location, clustered);
+        glUniform1i(show_clusters_location, show_clusters);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_BUFFER, lights_texture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_BUFFER, cluster_ranges_texture);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_BUFFER, light_indices_texture);
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_3D, light_probes_texture);
+
+        glUniform3f(albedo_location, 0.5f, 0.5f, 0.5f);
+        glBindVertexArray(floor_vao);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+        // A field of monkeys gives the lights something to land on
+        glUniform3f(albedo_location, 0.7f, 0.4f, 0.2f);
         glBindVertexArray(suzanne_vao);
-        glDrawElements(GL_TRIANGLES, suzanne.indices.size(), GL_UNSIGNED_INT, nullptr);
+        for (int x = -3; x <= 3; ++x) {
+            for (int z = -3; z <= 3; ++z) {
+                glm::mat4 suzanne_model = glm::translate(model, {x * 3.f, 0.f, z * 3.f});
+                glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<float *>(&suzanne_model));
+                glDrawElements(GL_TRIANGLES, suzanne_indices.count, suzanne_indices.gl_type(), nullptr);
+            }
+        }
+
+        print_time += dt;
+        if (print_time >= 1.f) {
+            std::cout << "lights: " << lights.size() << ", binning " << binning_time / binning_frames * 1000.f
+                      << " ms, " << clusters.light_indices().size() << " cluster entries, at most "
+                      << clusters.max_cluster_lights() << " per cluster" << std::endl;
+            print_time = 0.f;
+            binning_time = 0.f;
+            binning_frames = 0;
+        }
+
+        replay.end_frame();
 
         SDL_GL_SwapWindow(window);
     }
 
+    replay.finish();
+
     SDL_GL_DeleteContext(gl_context);
     SDL_DestroyWindow(window);
 }
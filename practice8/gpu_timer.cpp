@@ -0,0 +1,60 @@
+#include "gpu_timer.hpp"
+
+gpu_timer::gpu_timer()
+{
+    glGenQueries(queries_.size(), queries_.data());
+}
+
+gpu_timer::~gpu_timer()
+{
+    glDeleteQueries(queries_.size(), queries_.data());
+}
+
+void gpu_timer::begin()
+{
+    // The query about to be reused has to be read first, which only waits when the GPU
+    // is more frames behind than there are queries
+    collect(pending_[next_]);
+    glBeginQuery(GL_TIME_ELAPSED, queries_[next_]);
+}
+
+void gpu_timer::end()
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    pending_[next_] = true;
+    next_ = (next_ + 1) % queries_.size();
+}
+
+float gpu_timer::take_average()
+{
+    collect(false);
+    float const result = count_ > 0 ? total_ / count_ : 0.f;
+    total_ = 0.0;
+    count_ = 0;
+    return result;
+}
+
+void gpu_timer::collect(bool wait_next)
+{
+    // Oldest first, which is the one after the last used
+    for (std::size_t i = 0; i < queries_.size(); ++i)
+    {
+        std::size_t const index = (next_ + i) % queries_.size();
+        if (!pending_[index])
+            continue;
+
+        if (!(wait_next && index == next_))
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(queries_[index], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                return;
+        }
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(queries_[index], GL_QUERY_RESULT, &elapsed);
+        total_ += elapsed / 1e6;
+        ++count_;
+        pending_[index] = false;
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <array>
+
+// GPU time spent between begin() and end(), measured with GL_TIME_ELAPSED queries whose
+// results are read a few frames late, so that reading them never stalls. GL allows one
+// elapsed time query at a time, so timers can follow each other but not nest.
+struct gpu_timer
+{
+    gpu_timer();
+    ~gpu_timer();
+
+    gpu_timer(gpu_timer const &) = delete;
+    gpu_timer & operator = (gpu_timer const &) = delete;
+
+    void begin();
+    void end();
+
+    // Average in milliseconds over the results collected since the last call, 0 if none were
+    float take_average();
+
+    struct scope
+    {
+        gpu_timer & timer;
+
+        explicit scope(gpu_timer & timer)
+            : timer(timer)
+        {
+            timer.begin();
+        }
+
+        ~scope()
+        {
+            timer.end();
+        }
+    };
+
+private:
+    std::array<GLuint, 4> queries_{};
+    std::array<bool, 4> pending_{};
+    std::size_t next_ = 0;
+
+    double total_ = 0.0;
+    int count_ = 0;
+
+    void collect(bool wait_next);
+};
@@ -0,0 +1,172 @@
+#include "hdr.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+
+namespace
+{
+
+    // Must match the tile of bloom_downsample.comp
+    constexpr int downsample_tile = 32;
+
+    void set_linear_clamped(GLuint texture)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+}
+
+hdr_renderer::hdr_renderer(int width, int height)
+{
+    glGenTextures(1, &scene_texture_);
+    set_linear_clamped(scene_texture_);
+    glGenRenderbuffers(1, &depth_renderbuffer_);
+    glGenFramebuffers(1, &scene_fbo_);
+
+    if (bloom_supported())
+    {
+        glGenTextures(bloom_textures_.size(), bloom_textures_.data());
+        for (GLuint texture : bloom_textures_)
+            set_linear_clamped(texture);
+        glGenFramebuffers(bloom_fbos_.size(), bloom_fbos_.data());
+
+        std::uint32_t const zero = 0;
+        glGenBuffers(1, &counter_buffer_);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, counter_buffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(zero), &zero, GL_DYNAMIC_COPY);
+    }
+
+    glGenVertexArrays(1, &fullscreen_vao_);
+
+    resize(width, height);
+}
+
+hdr_renderer::~hdr_renderer()
+{
+    glDeleteVertexArrays(1, &fullscreen_vao_);
+    if (bloom_supported())
+    {
+        glDeleteBuffers(1, &counter_buffer_);
+        glDeleteFramebuffers(bloom_fbos_.size(), bloom_fbos_.data());
+        glDeleteTextures(bloom_textures_.size(), bloom_textures_.data());
+    }
+    glDeleteFramebuffers(1, &scene_fbo_);
+    glDeleteRenderbuffers(1, &depth_renderbuffer_);
+    glDeleteTextures(1, &scene_texture_);
+}
+
+void hdr_renderer::resize(int width, int height)
+{
+    width_ = width;
+    height_ = height;
+
+    glBindTexture(GL_TEXTURE_2D, scene_texture_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width_, height_, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_renderbuffer_);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width_, height_);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, scene_fbo_);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, scene_texture_, 0);
+    glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_renderbuffer_);
+    if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        throw std::runtime_error("HDR scene framebuffer is incomplete");
+
+    if (bloom_supported())
+    {
+        // Sizes halve like mip levels do, the first being half the scene
+        for (int level = 0; level < bloom_levels; ++level)
+        {
+            level_widths_[level] = std::max(1, width_ >> (level + 1));
+            level_heights_[level] = std::max(1, height_ >> (level + 1));
+
+            glBindTexture(GL_TEXTURE_2D, bloom_textures_[level]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, level_widths_[level], level_heights_[level], 0, GL_RGBA, GL_FLOAT, nullptr);
+
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, bloom_fbos_[level]);
+            glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, bloom_textures_[level], 0);
+            if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                throw std::runtime_error("Bloom framebuffer is incomplete");
+        }
+    }
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+void hdr_renderer::begin_scene()
+{
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, scene_fbo_);
+    glViewport(0, 0, width_, height_);
+}
+
+void hdr_renderer::bloom(GLuint downsample_program, GLuint upsample_program)
+{
+    if (!bloom_supported())
+        return;
+
+    glUseProgram(downsample_program);
+    glUniform1i(glGetUniformLocation(downsample_program, "scene"), 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, scene_texture_);
+    for (int level = 0; level < bloom_levels; ++level)
+        glBindImageTexture(level, bloom_textures_[level], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA16F);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, counter_buffer_);
+
+    glDispatchCompute((level_widths_[0] + downsample_tile - 1) / downsample_tile, (level_heights_[0] + downsample_tile - 1) / downsample_tile, 1);
+
+    // The levels are sampled and blended into next
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glBindVertexArray(fullscreen_vao_);
+
+    // Looked up every frame, since the program may have been reloaded since the last one
+    glUseProgram(upsample_program);
+    glUniform1i(glGetUniformLocation(upsample_program, "source"), 0);
+    GLint const target_size = glGetUniformLocation(upsample_program, "target_size");
+
+    for (int level = bloom_levels - 2; level >= 0; --level)
+    {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, bloom_fbos_[level]);
+        glViewport(0, 0, level_widths_[level], level_heights_[level]);
+        glBindTexture(GL_TEXTURE_2D, bloom_textures_[level + 1]);
+        glUniform2f(target_size, level_widths_[level], level_heights_[level]);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    glDisable(GL_BLEND);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+void hdr_renderer::resolve(GLuint tonemap_program, float exposure, float bloom_strength)
+{
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glViewport(0, 0, width_, height_);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glBindVertexArray(fullscreen_vao_);
+
+    if (!bloom_supported())
+        bloom_strength = 0.f;
+
+    glUseProgram(tonemap_program);
+    glUniform1i(glGetUniformLocation(tonemap_program, "scene"), 0);
+    glUniform1i(glGetUniformLocation(tonemap_program, "bloom"), 1);
+    glUniform1f(glGetUniformLocation(tonemap_program, "exposure"), exposure);
+    // Every level of the chain was added into the first, each about as bright as the scene
+    glUniform1f(glGetUniformLocation(tonemap_program, "bloom_strength"), bloom_strength);
+    glUniform1f(glGetUniformLocation(tonemap_program, "bloom_scale"), 1.f / bloom_levels);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, scene_texture_);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, bloom_supported() ? bloom_textures_[0] : scene_texture_);
+
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
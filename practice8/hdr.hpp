@@ -0,0 +1,62 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <array>
+
+// An RGBA16F scene target, its bloom chain and the tonemapping resolve into the default
+// framebuffer.
+//
+// Bloom is a chain of half-resolution mips down from the scene. All of them are made by one
+// compute dispatch: every group reduces a 32x32 tile of the first mip down to a single texel
+// in shared memory, writing each level on the way, and the last group to finish builds the
+// remaining levels from the whole of the coarsest one. They are then added back up the chain,
+// each level upsampled with a tent filter into the one above, which is what the resolve mixes
+// into the scene. Without GL 4.3 there is no bloom, only the resolve.
+//
+// The programs are passed in rather than owned, so that they can be reloaded with the rest.
+struct hdr_renderer
+{
+    // Must match the images in bloom_downsample.comp
+    static constexpr int bloom_levels = 8;
+
+    static bool bloom_supported() { return GLEW_VERSION_4_3; }
+
+    hdr_renderer(int width, int height);
+    ~hdr_renderer();
+
+    hdr_renderer(hdr_renderer const &) = delete;
+    hdr_renderer & operator = (hdr_renderer const &) = delete;
+
+    void resize(int width, int height);
+
+    // Binds the scene target and its viewport
+    void begin_scene();
+
+    // Builds the bloom chain out of the scene drawn since begin_scene(); changes the viewport,
+    // blending and depth state
+    void bloom(GLuint downsample_program, GLuint upsample_program);
+
+    // Tonemaps into the default framebuffer, mixing in bloom_strength of the chain built by
+    // the last bloom() call; pass 0 if there was none this frame
+    void resolve(GLuint tonemap_program, float exposure, float bloom_strength);
+
+private:
+    int width_ = 0;
+    int height_ = 0;
+    std::array<int, bloom_levels> level_widths_{};
+    std::array<int, bloom_levels> level_heights_{};
+
+    GLuint scene_texture_ = 0;
+    GLuint depth_renderbuffer_ = 0;
+    GLuint scene_fbo_ = 0;
+
+    // Separate textures rather than the levels of one, so that upsampling a level into the
+    // one above never samples the texture it renders to
+    std::array<GLuint, bloom_levels> bloom_textures_{};
+    std::array<GLuint, bloom_levels> bloom_fbos_{};
+    // Groups of the downsample that are done, so that the last one knows it is; it resets it
+    GLuint counter_buffer_ = 0;
+
+    GLuint fullscreen_vao_ = 0;
+};
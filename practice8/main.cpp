@@ -14,10 +14,15 @@
 #include <iostream>
 #include <chrono>
 #include <vector>
-#include <map>
+#include <algorithm>
 #include <cmath>
 #include <fstream>
 #include <sstream>
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <utility>
 
 #define GLM_FORCE_SWIZZLE
 #define GLM_ENABLE_EXPERIMENTAL
@@ -29,7 +34,23 @@
 #include <glm/ext/scalar_constants.hpp>
 #include <glm/gtx/string_cast.hpp>
 
-#include "obj_parser.hpp"
+#include "obj_cache.hpp"
+#include "triangle_bvh.hpp"
+#include "light_probes.hpp"
+#include "program_cache.hpp"
+#include "shader_permutations.hpp"
+#include "mesh_optimizer.hpp"
+#include "vertex_quantization.hpp"
+#include "index_buffer.hpp"
+#include "meshlet.hpp"
+#include "meshlet_culling.hpp"
+#include "point_shadows.hpp"
+#include "ssao.hpp"
+#include "hdr.hpp"
+#include "gpu_timer.hpp"
+#include "input_state.hpp"
+#include "replay_session.hpp"
+#include "file_watcher.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -46,107 +67,135 @@ void glew_fail(std::string_view message, GLenum error)
     throw std::runtime_error(to_string(message) + reinterpret_cast<const char *>(glewGetErrorString(error)));
 }
 
-const char vertex_shader_source[] =
-    R"(#version 330 core
-
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-
-layout (location = 0) in vec3 in_position;
-layout (location = 1) in vec3 in_normal;
-
-out vec3 position;
-out vec3 normal;
-
-void main()
+std::string read_file(std::filesystem::path const & path)
 {
-    position = (model * vec4(in_position, 1.0)).xyz;
-    gl_Position = projection * view * vec4(position, 1.0);
-    normal = normalize(mat3(model) * in_normal);
-}
-)";
-
-const char fragment_shader_source[] =
-    R"(#version 330 core
-
-uniform vec3 camera_position;
-
-uniform vec3 albedo;
-
-uniform vec3 sun_direction;
-uniform vec3 sun_color;
-
-in vec3 position;
-in vec3 normal;
-
-layout (location = 0) out vec4 out_color;
-
-vec3 diffuse(vec3 direction) {
-    return albedo * max(0.0, dot(normal, direction));
-}
-
-vec3 specular(vec3 direction) {
-    float power = 64.0;
-    vec3 reflected_direction = 2.0 * normal * dot(normal, direction) - direction;
-    vec3 view_direction = normalize(camera_position - position);
-    return albedo * pow(max(0.0, dot(reflected_direction, view_direction)), power);
-}
-
-vec3 phong(vec3 direction) {
-    return diffuse(direction) + specular(direction);
+    std::ifstream input(path, std::ios::binary);
+    if (!input)
+        throw std::runtime_error("Failed to read " + path.string());
+    std::ostringstream result;
+    result << input.rdbuf();
+    return result.str();
 }
 
-void main()
+// A program made of shader files. When one of them changes the program is submitted again,
+// and the new one replaces it between frames once it links, so a shader with an error
+// leaves the old program drawing.
+struct reloadable_program
 {
-    float ambient_light = 0.2;
-    vec3 color = albedo * ambient_light + sun_color * phong(sun_direction);
-    out_color = vec4(color, 1.0);
-}
-)";
+    std::vector<std::pair<GLenum, std::filesystem::path>> files;
+    GLuint program = 0;
+    // Submitted and not linked yet, 0 if none
+    GLuint pending = 0;
+    // Macros defined in every file, after its #version line
+    std::vector<std::string> defines = {};
+
+    std::vector<shader_source> sources() const
+    {
+        std::vector<shader_source> result;
+        for (auto const & [type, path] : files)
+            result.push_back({type, define_features(read_file(path), defines, (1u << defines.size()) - 1)});
+        return result;
+    }
 
-GLuint create_shader(GLenum type, const char *source)
+    bool uses(std::filesystem::path const & file) const
+    {
+        return std::any_of(files.begin(), files.end(), [&](auto const & f){ return std::filesystem::absolute(f.second).lexically_normal() == file; });
+    }
+};
+
+// Indirect light around the scene under a plain sky, baked with the geometry so that a reload
+// bakes it again; the grid reaches a little past the mesh on every side
+light_probe_grid bake_scene_probes(obj_data const & scene)
 {
-    GLuint result = glCreateShader(type);
-    glShaderSource(result, 1, &source, nullptr);
-    glCompileShader(result);
-    GLint status;
-    glGetShaderiv(result, GL_COMPILE_STATUS, &status);
-    if (status != GL_TRUE)
+    light_probe_grid::vec3 min = scene.vertices[0].position;
+    light_probe_grid::vec3 max = min;
+    for (auto const & vertex : scene.vertices)
+        for (int i = 0; i < 3; ++i)
+        {
+            min[i] = std::min(min[i], vertex.position[i]);
+            max[i] = std::max(max[i], vertex.position[i]);
+        }
+    for (int i = 0; i < 3; ++i)
     {
-        GLint info_log_length;
-        glGetShaderiv(result, GL_INFO_LOG_LENGTH, &info_log_length);
-        std::string info_log(info_log_length, '\0');
-        glGetShaderInfoLog(result, info_log.size(), nullptr, info_log.data());
-        throw std::runtime_error("Shader compilation failed: " + info_log);
+        float const margin = (max[i] - min[i]) * 0.1f;
+        min[i] -= margin;
+        max[i] += margin;
     }
-    return result;
+
+    light_probe_settings settings;
+    settings.resolution = {8, 12, 8};
+    settings.sky_zenith = {0.22f, 0.22f, 0.26f};
+    settings.sky_horizon = {0.2f, 0.2f, 0.2f};
+    settings.ground = {0.12f, 0.11f, 0.1f};
+    settings.bounce = {0.08f, 0.07f, 0.06f};
+    return bake_light_probes(triangle_bvh(scene), min, max, settings);
 }
 
-GLuint create_program(GLuint vertex_shader, GLuint fragment_shader)
+// What the scene is drawn from, built without GL calls, so that a reload can run on another thread
+struct scene_geometry
 {
-    GLuint result = glCreateProgram();
-    glAttachShader(result, vertex_shader);
-    glAttachShader(result, fragment_shader);
-    glLinkProgram(result);
-
-    GLint status;
-    glGetProgramiv(result, GL_LINK_STATUS, &status);
-    if (status != GL_TRUE)
+    std::vector<meshlet> meshlets;
+    meshlet_bounds bounds;
+    // The buddha has a few more vertices than 16-bit indices reach, so it is drawn in chunks,
+    // each with its own base vertex; the triangle order and so the meshlet ranges stay the same
+    chunked_mesh chunks;
+    // With the 32-byte vertices the chunks are drawn as they are, and the quantization is the
+    // identity so that the shaders take the same position uniforms either way
+    vertex_quantization quantization;
+    // The packed 16-byte vertices, empty unless asked for
+    std::vector<quantized_vertex> vertices;
+    // Chunk holding the first index of every meshlet
+    std::vector<std::size_t> meshlet_chunks;
+    light_probe_grid probes;
+
+    // The optimizations done on the mesh keep neighbouring triangles together, so meshlets
+    // are just runs of the index buffer
+    scene_geometry(obj_data const & scene, bool quantized)
+        : meshlets(build_meshlets(scene))
+        , bounds(meshlets)
+        , chunks(split_for_16bit_indices(scene))
+        , quantization(quantized ? make_vertex_quantization(scene.vertices) : vertex_quantization{{0.f, 0.f, 0.f}, {1.f, 1.f, 1.f}})
+        , vertices(quantized ? quantize_vertices(chunks.vertices, chunks.occlusion, quantization) : std::vector<quantized_vertex>{})
+        , probes(bake_scene_probes(scene))
     {
-        GLint info_log_length;
-        glGetProgramiv(result, GL_INFO_LOG_LENGTH, &info_log_length);
-        std::string info_log(info_log_length, '\0');
-        glGetProgramInfoLog(result, info_log.size(), nullptr, info_log.data());
-        throw std::runtime_error("Program linkage failed: " + info_log);
+        for (auto const & m : meshlets)
+        {
+            std::size_t c = meshlet_chunks.empty() ? 0 : meshlet_chunks.back();
+            while (m.first_index >= chunks.chunks[c].first_index + chunks.chunks[c].index_count)
+                ++c;
+            meshlet_chunks.push_back(c);
+        }
     }
+};
 
+std::unique_ptr<scene_geometry> load_scene_geometry(std::filesystem::path const & path, bool quantized)
+{
+    // The buddha is static, so its ambient occlusion is baked once into the cache
+    obj_data scene = load_obj_cached(path, false, true);
+
+    auto cache_stats_before = analyze_vertex_cache(scene);
+    optimize_vertex_cache(scene);
+    optimize_overdraw(scene);
+    optimize_vertex_fetch(scene);
+    auto cache_stats_after = analyze_vertex_cache(scene);
+    std::cout << "Vertex cache ACMR " << cache_stats_before.acmr << " -> " << cache_stats_after.acmr
+        << ", ATVR " << cache_stats_before.atvr << " -> " << cache_stats_after.atvr << std::endl;
+
+    auto result = std::make_unique<scene_geometry>(scene, quantized);
+    std::cout << "Meshlets: " << result->meshlets.size() << std::endl;
+    std::cout << "16-bit index chunks: " << result->chunks.chunks.size() << ", " << scene.vertices.size() << " -> "
+        << result->chunks.vertices.size() << " vertices" << std::endl;
     return result;
 }
 
-int main()
+int main(int argc, char ** argv)
 try
 {
+    replay_session replay(argc, argv);
+
+    // Vertices stay 32 bytes unless packed into 16 with --quantized-vertices
+    bool const quantized_vertices = std::any_of(argv + 1, argv + argc, [](char const * arg){ return std::string_view(arg) == "--quantized-vertices"; });
+
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
         sdl2_fail("SDL_Init: ");
 
@@ -183,44 +232,313 @@ try
 
     glClearColor(0.8f, 0.8f, 1.f, 0.f);
 
-    auto vertex_shader = create_shader(GL_VERTEX_SHADER, vertex_shader_source);
-    auto fragment_shader = create_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
-    auto program = create_program(vertex_shader, fragment_shader);
+    std::string project_root = PROJECT_ROOT;
 
-    GLuint model_location = glGetUniformLocation(program, "model");
-    GLuint view_location = glGetUniformLocation(program, "view");
-    GLuint projection_location = glGetUniformLocation(program, "projection");
-    GLuint camera_position_location = glGetUniformLocation(program, "camera_position");
-    GLuint albedo_location = glGetUniformLocation(program, "albedo");
-    GLuint sun_direction_location = glGetUniformLocation(program, "sun_direction");
-    GLuint sun_color_location = glGetUniformLocation(program, "sun_color");
+    program_cache programs(project_root + "/.program_binaries");
 
-    std::string project_root = PROJECT_ROOT;
-    std::string scene_path = project_root + "/buddha.obj";
-    obj_data scene = parse_obj(scene_path);
+    // Shaders and the scene are reloaded when their files change, so both can be edited
+    // while the program runs
+    file_watcher watcher;
+
+    std::vector<std::string> const vertex_defines = quantized_vertices ? std::vector<std::string>{"QUANTIZED_VERTICES"} : std::vector<std::string>{};
 
-    GLuint scene_vao, scene_vbo, scene_ebo;
-    glGenVertexArrays(1, &scene_vao);
-    glBindVertexArray(scene_vao);
+    reloadable_program scene_program{{
+        {GL_VERTEX_SHADER, project_root + "/shaders/scene.vert"},
+        {GL_FRAGMENT_SHADER, project_root + "/shaders/scene.frag"}}, 0, 0, vertex_defines};
 
-    glGenBuffers(1, &scene_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, scene_vbo);
-    glBufferData(GL_ARRAY_BUFFER, scene.vertices.size() * sizeof(scene.vertices[0]), scene.vertices.data(), GL_STATIC_DRAW);
+    reloadable_program point_shadow_program{{
+        {GL_VERTEX_SHADER, project_root + "/shaders/point_shadow.vert"},
+        {GL_GEOMETRY_SHADER, project_root + "/shaders/point_shadow.geom"},
+        {GL_FRAGMENT_SHADER, project_root + "/shaders/point_shadow.frag"}}};
 
-    glGenBuffers(1, &scene_ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, scene_ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, scene.indices.size() * sizeof(scene.indices[0]), scene.indices.data(), GL_STATIC_DRAW);
+    reloadable_program ssao_prepass_program{{
+        {GL_VERTEX_SHADER, project_root + "/shaders/scene.vert"},
+        {GL_FRAGMENT_SHADER, project_root + "/shaders/ssao_prepass.frag"}}, 0, 0, vertex_defines};
 
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), (void *)(0));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), (void *)(12));
+    reloadable_program ssao_program{{
+        {GL_VERTEX_SHADER, project_root + "/shaders/fullscreen.vert"},
+        {GL_FRAGMENT_SHADER, project_root + "/shaders/ssao.frag"}}};
+
+    reloadable_program ssao_blur_program{{
+        {GL_VERTEX_SHADER, project_root + "/shaders/fullscreen.vert"},
+        {GL_FRAGMENT_SHADER, project_root + "/shaders/ssao_blur.frag"}}};
+
+    reloadable_program bloom_downsample_program{{
+        {GL_COMPUTE_SHADER, project_root + "/shaders/bloom_downsample.comp"}}};
+
+    reloadable_program bloom_upsample_program{{
+        {GL_VERTEX_SHADER, project_root + "/shaders/fullscreen.vert"},
+        {GL_FRAGMENT_SHADER, project_root + "/shaders/bloom_upsample.frag"}}};
+
+    reloadable_program tonemap_program{{
+        {GL_VERTEX_SHADER, project_root + "/shaders/fullscreen.vert"},
+        {GL_FRAGMENT_SHADER, project_root + "/shaders/tonemap.frag"}}};
+
+    std::vector<reloadable_program *> reloadable_programs{
+        &scene_program, &point_shadow_program, &ssao_prepass_program, &ssao_program, &ssao_blur_program, &tonemap_program};
+
+    // Bloom needs GL 4.3 for its compute pass; without it the scene is only tonemapped
+    bool const bloom_supported = hdr_renderer::bloom_supported();
+    if (bloom_supported)
+    {
+        reloadable_programs.push_back(&bloom_downsample_program);
+        reloadable_programs.push_back(&bloom_upsample_program);
+    }
+    else
+        std::cout << "No GL 4.3, bloom is disabled" << std::endl;
+
+    // Submitted together, so that the driver compiles them at once
+    for (auto * p : reloadable_programs)
+    {
+        p->program = programs.submit(p->sources());
+        for (auto const & [type, path] : p->files)
+            watcher.watch(path);
+    }
+
+    programs.wait();
+
+    std::cout << "Programs: " << programs.loaded() << " loaded from binaries, " << programs.compiled() << " compiled" << std::endl;
+
+    struct scene_uniforms
+    {
+        GLint model, view, projection, position_offset, position_scale, camera_position, albedo, sun_direction, sun_color;
+        GLint point_light_count, point_light_position, point_light_color, point_light_radius, point_light_slot;
+        GLint face_transforms, point_shadow_map;
+        GLint ambient_occlusion_enabled, ambient_occlusion_map, ambient_occlusion_depth, baked_occlusion_enabled;
+        GLint light_probes_enabled, light_probes, light_probe_min, light_probe_max;
+    };
+
+    auto get_scene_uniforms = [](GLuint program) -> scene_uniforms
+    {
+        return {
+            glGetUniformLocation(program, "model"),
+            glGetUniformLocation(program, "view"),
+            glGetUniformLocation(program, "projection"),
+            glGetUniformLocation(program, "position_offset"),
+            glGetUniformLocation(program, "position_scale"),
+            glGetUniformLocation(program, "camera_position"),
+            glGetUniformLocation(program, "albedo"),
+            glGetUniformLocation(program, "sun_direction"),
+            glGetUniformLocation(program, "sun_color"),
+            glGetUniformLocation(program, "point_light_count"),
+            glGetUniformLocation(program, "point_light_position"),
+            glGetUniformLocation(program, "point_light_color"),
+            glGetUniformLocation(program, "point_light_radius"),
+            glGetUniformLocation(program, "point_light_slot"),
+            glGetUniformLocation(program, "face_transforms"),
+            glGetUniformLocation(program, "point_shadow_map"),
+            glGetUniformLocation(program, "ambient_occlusion_enabled"),
+            glGetUniformLocation(program, "ambient_occlusion_map"),
+            glGetUniformLocation(program, "ambient_occlusion_depth"),
+            glGetUniformLocation(program, "baked_occlusion_enabled"),
+            glGetUniformLocation(program, "light_probes_enabled"),
+            glGetUniformLocation(program, "light_probes"),
+            glGetUniformLocation(program, "light_probe_min"),
+            glGetUniformLocation(program, "light_probe_max"),
+        };
+    };
+
+    struct point_shadow_uniforms
+    {
+        GLint position_offset, position_scale, face_transforms, light_position, light_radius, first_layer;
+    };
+
+    auto get_point_shadow_uniforms = [](GLuint program) -> point_shadow_uniforms
+    {
+        return {
+            glGetUniformLocation(program, "position_offset"),
+            glGetUniformLocation(program, "position_scale"),
+            glGetUniformLocation(program, "face_transforms"),
+            glGetUniformLocation(program, "light_position"),
+            glGetUniformLocation(program, "light_radius"),
+            glGetUniformLocation(program, "first_layer"),
+        };
+    };
+
+    // Looked up again whenever a reload swaps a program; the prepass shares the scene's vertex shader
+    auto uniforms = get_scene_uniforms(scene_program.program);
+    auto prepass_uniforms = get_scene_uniforms(ssao_prepass_program.program);
+    auto shadow_uniforms = get_point_shadow_uniforms(point_shadow_program.program);
+
+    std::filesystem::path const scene_path = std::filesystem::absolute(project_root + "/buddha.obj").lexically_normal();
+    auto scene = load_scene_geometry(scene_path, quantized_vertices);
+    watcher.watch(scene_path);
+
+    // Reloads are imported on another thread, through the OBJ cache, and swapped in between frames
+    std::future<std::unique_ptr<scene_geometry>> scene_reload;
+    bool scene_changed_again = false;
+
+    struct scene_buffers
+    {
+        GLuint vao, vbo, ebo;
+        // The baked occlusion of the 32-byte vertices, 0 with the quantized ones that carry it
+        GLuint occlusion_vbo;
+        GLuint probes;
+    };
+
+    auto upload_scene = [](scene_geometry const & geometry) -> scene_buffers
+    {
+        scene_buffers result;
+        glGenVertexArrays(1, &result.vao);
+        glBindVertexArray(result.vao);
+
+        glGenBuffers(1, &result.ebo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, result.ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, geometry.chunks.indices.size() * sizeof(geometry.chunks.indices[0]), geometry.chunks.indices.data(), GL_STATIC_DRAW);
+
+        glGenBuffers(1, &result.vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, result.vbo);
+        result.occlusion_vbo = 0;
+        if (!geometry.vertices.empty())
+        {
+            glBufferData(GL_ARRAY_BUFFER, geometry.vertices.size() * sizeof(geometry.vertices[0]), geometry.vertices.data(), GL_STATIC_DRAW);
+
+            glEnableVertexAttribArray(0);
+            // The fourth component is the baked occlusion
+            glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(quantized_vertex), (void *)(0));
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 2, GL_SHORT, GL_FALSE, sizeof(quantized_vertex), (void *)(8));
+        }
+        else
+        {
+            auto const & vertices = geometry.chunks.vertices;
+            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vertices[0]), vertices.data(), GL_STATIC_DRAW);
+
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), (void *)(0));
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), (void *)(12));
+
+            auto const & occlusion = geometry.chunks.occlusion;
+            glGenBuffers(1, &result.occlusion_vbo);
+            glBindBuffer(GL_ARRAY_BUFFER, result.occlusion_vbo);
+            glBufferData(GL_ARRAY_BUFFER, occlusion.size(), occlusion.data(), GL_STATIC_DRAW);
+
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 1, GL_UNSIGNED_BYTE, GL_TRUE, 1, (void *)(0));
+        }
+
+        auto const & probes = geometry.probes;
+        glGenTextures(1, &result.probes);
+        glBindTexture(GL_TEXTURE_3D, result.probes);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB16F, probes.resolution[0], probes.resolution[1], probes.resolution[2] * 9, 0,
+            GL_RGB, GL_FLOAT, probes.texels().data());
+        return result;
+    };
+
+    auto scene_gl = upload_scene(*scene);
+
+    // Core 3.3 has no indirect draws, glMultiDrawElements is the fallback
+    bool const use_indirect = GLEW_ARB_multi_draw_indirect;
+
+    struct draw_elements_indirect_command
+    {
+        std::uint32_t count;
+        std::uint32_t instance_count;
+        std::uint32_t first_index;
+        std::uint32_t base_vertex;
+        std::uint32_t base_instance;
+    };
+
+    GLuint indirect_buffer;
+    glGenBuffers(1, &indirect_buffer);
+
+    std::vector<std::uint32_t> visible_meshlets;
+    std::vector<draw_elements_indirect_command> commands;
+    std::vector<GLsizei> draw_counts;
+    std::vector<void const *> draw_offsets;
+    std::vector<GLint> draw_base_vertices;
+
+    // Meshlets are consecutive in the index buffer, so runs of visible ones within a chunk merge
+    // into one draw; a meshlet crossing a chunk boundary takes one draw per chunk
+    auto draw_meshlets = [&](std::vector<std::uint32_t> const & visible)
+    {
+        commands.clear();
+        for (auto i : visible)
+        {
+            auto const & m = scene->meshlets[i];
+            std::uint32_t first_index = m.first_index;
+            std::uint32_t const end_index = m.first_index + m.index_count;
+            for (std::size_t c = scene->meshlet_chunks[i]; first_index < end_index; ++c)
+            {
+                auto const & chunk = scene->chunks.chunks[c];
+                std::uint32_t const count = std::min(end_index, chunk.first_index + chunk.index_count) - first_index;
+                if (!commands.empty() && commands.back().first_index + commands.back().count == first_index
+                    && commands.back().base_vertex == chunk.base_vertex)
+                    commands.back().count += count;
+                else
+                    commands.push_back({count, 1, first_index, chunk.base_vertex, 0});
+                first_index += count;
+            }
+        }
+
+        if (use_indirect)
+        {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(commands[0]), commands.data(), GL_STREAM_DRAW);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, nullptr, commands.size(), 0);
+        }
+        else
+        {
+            draw_counts.clear();
+            draw_offsets.clear();
+            draw_base_vertices.clear();
+            for (auto const & command : commands)
+            {
+                draw_counts.push_back(command.count);
+                draw_offsets.push_back(reinterpret_cast<void const *>(command.first_index * sizeof(std::uint16_t)));
+                draw_base_vertices.push_back(command.base_vertex);
+            }
+            glMultiDrawElementsBaseVertex(GL_TRIANGLES, draw_counts.data(), GL_UNSIGNED_SHORT, draw_offsets.data(), draw_counts.size(),
+                draw_base_vertices.data());
+        }
+    };
+
+    // More lights than shadow slots, and fewer slot updates per frame than slots
+    int const max_point_lights = 8;
+    int const point_shadow_slots = 4;
+    int const point_shadow_updates_per_frame = 2;
+
+    point_shadow_atlas point_shadows(512, point_shadow_slots);
+    auto const face_transforms = point_shadow_atlas::face_transforms();
+
+    std::vector<point_light> point_lights(max_point_lights);
+    std::vector<std::uint32_t> light_meshlets;
+    std::vector<int> point_light_slots(max_point_lights);
+    bool point_lights_enabled = true;
+    bool point_lights_moving = true;
+    float point_light_time = 0.f;
+    int point_shadow_updates = 0;
+    std::size_t point_shadow_meshlets = 0;
+
+    ssao_renderer ssao(width, height);
+    gpu_timer ssao_timer;
+    // Off by default, the baked occlusion costs nothing; SSAO adds the contact shadows of what moves
+    bool ssao_enabled = false;
+    bool baked_occlusion_enabled = true;
+    bool light_probes_enabled = true;
+    float const ssao_radius = 0.05f;
+
+    hdr_renderer hdr(width, height);
+    gpu_timer bloom_timer;
+    bool bloom_enabled = bloom_supported;
+    float const exposure = 1.f;
+    float const bloom_strength = 0.05f;
+
+    bool cluster_culling = true;
+    bool cone_culling = true;
+    float print_time = 0.f;
 
     auto last_frame_start = std::chrono::high_resolution_clock::now();
 
     float time = 0.f;
 
-    std::map<SDL_Keycode, bool> button_down;
+    input_state input;
 
     float camera_distance = 1.5f;
     float camera_angle = glm::pi<float>();
@@ -228,6 +546,8 @@ try
     bool running = true;
     while (running)
     {
+        input.begin_frame();
+
         for (SDL_Event event; SDL_PollEvent(&event);)
             switch (event.type)
             {
@@ -240,44 +560,153 @@ try
                 case SDL_WINDOWEVENT_RESIZED:
                     width = event.window.data1;
                     height = event.window.data2;
+                    ssao.resize(width, height);
+                    hdr.resize(width, height);
                     break;
                 }
                 break;
             case SDL_KEYDOWN:
-                button_down[event.key.keysym.sym] = true;
+                input.handle_event(event);
+                // C toggles meshlet culling altogether, B only the normal cone test
+                if (event.key.keysym.sym == SDLK_c)
+                    cluster_culling = !cluster_culling;
+                if (event.key.keysym.sym == SDLK_b)
+                    cone_culling = !cone_culling;
+                // L toggles the point lights, M pauses them so that their shadows stop updating
+                if (event.key.keysym.sym == SDLK_l)
+                    point_lights_enabled = !point_lights_enabled;
+                if (event.key.keysym.sym == SDLK_m)
+                    point_lights_moving = !point_lights_moving;
+                // O toggles screen-space ambient occlusion, V the baked per-vertex one
+                if (event.key.keysym.sym == SDLK_o)
+                    ssao_enabled = !ssao_enabled;
+                if (event.key.keysym.sym == SDLK_v)
+                    baked_occlusion_enabled = !baked_occlusion_enabled;
+                // P switches the ambient term between the light probes and a constant
+                if (event.key.keysym.sym == SDLK_p)
+                    light_probes_enabled = !light_probes_enabled;
+                // G toggles bloom
+                if (event.key.keysym.sym == SDLK_g)
+                    bloom_enabled = bloom_supported && !bloom_enabled;
                 break;
             case SDL_KEYUP:
-                button_down[event.key.keysym.sym] = false;
+                input.handle_event(event);
                 break;
             }
 
         if (!running)
             break;
 
+        // Changed shaders are recompiled through the cache, the changed scene re-imported
+        for (auto const & file : watcher.poll())
+        {
+            for (auto * p : reloadable_programs)
+                if (p->uses(file))
+                {
+                    try
+                    {
+                        p->pending = programs.submit(p->sources());
+                    }
+                    catch (std::exception const & e)
+                    {
+                        std::cerr << e.what() << std::endl;
+                    }
+                }
+
+            if (file == scene_path)
+            {
+                if (scene_reload.valid())
+                    scene_changed_again = true;
+                else
+                    scene_reload = std::async(std::launch::async, load_scene_geometry, scene_path, quantized_vertices);
+            }
+        }
+
+        bool programs_swapped = false;
+        for (auto * p : reloadable_programs)
+        {
+            if (!p->pending)
+                continue;
+
+            try
+            {
+                if (!programs.ready(p->pending))
+                    continue;
+                p->program = p->pending;
+                programs_swapped = true;
+                std::cout << "Reloaded " << p->files.back().second.stem().string() << " program" << std::endl;
+            }
+            catch (std::exception const & e)
+            {
+                std::cerr << e.what() << std::endl;
+            }
+            p->pending = 0;
+        }
+        if (programs_swapped)
+        {
+            uniforms = get_scene_uniforms(scene_program.program);
+            prepass_uniforms = get_scene_uniforms(ssao_prepass_program.program);
+            shadow_uniforms = get_point_shadow_uniforms(point_shadow_program.program);
+        }
+
+        if (scene_reload.valid() && scene_reload.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        {
+            try
+            {
+                auto next = scene_reload.get();
+                auto next_gl = upload_scene(*next);
+
+                glDeleteVertexArrays(1, &scene_gl.vao);
+                glDeleteBuffers(1, &scene_gl.vbo);
+                glDeleteBuffers(1, &scene_gl.occlusion_vbo);
+                glDeleteBuffers(1, &scene_gl.ebo);
+                glDeleteTextures(1, &scene_gl.probes);
+                scene = std::move(next);
+                scene_gl = next_gl;
+
+                // The old shadows stay up until the new geometry is rendered into them
+                point_shadows.invalidate();
+                std::cout << "Reloaded " << scene_path.filename().string() << std::endl;
+            }
+            catch (std::exception const & e)
+            {
+                std::cerr << e.what() << std::endl;
+            }
+
+            if (std::exchange(scene_changed_again, false))
+                scene_reload = std::async(std::launch::async, load_scene_geometry, scene_path, quantized_vertices);
+        }
+
+        if (!replay.update(input))
+            break;
+
         auto now = std::chrono::high_resolution_clock::now();
-        float dt = std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count();
+        float dt = replay.frame_time(std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count());
         last_frame_start = now;
         time += dt;
 
-        if (button_down[SDLK_UP])
+        if (input.down(SDL_SCANCODE_UP))
             camera_distance -= 4.f * dt;
-        if (button_down[SDLK_DOWN])
+        if (input.down(SDL_SCANCODE_DOWN))
             camera_distance += 4.f * dt;
 
-        if (button_down[SDLK_LEFT])
+        if (input.down(SDL_SCANCODE_LEFT))
             camera_angle += 2.f * dt;
-        if (button_down[SDLK_RIGHT])
+        if (input.down(SDL_SCANCODE_RIGHT))
             camera_angle -= 2.f * dt;
 
-        glViewport(0, 0, width, height);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glClearColor(0.8f, 0.8f, 1.f, 0.f);
+        if (point_lights_moving)
+            point_light_time += dt;
 
-        glEnable(GL_DEPTH_TEST);
-        glEnable(GL_CULL_FACE);
-
-        float near = 0.1f;
-        float far = 100.f;
+        // Every other light circles the statue, the rest stand still and keep their shadows
+        for (int i = 0; i < max_point_lights; ++i)
+        {
+            float const angle = glm::pi<float>() * 2.f * i / max_point_lights + ((i % 2 == 0) ? point_light_time * 0.7f : 0.f);
+            float const light_height = 0.2f + 0.8f * (i % 4) / 3.f;
+            point_lights[i].position = {0.6f * std::cos(angle), light_height, 0.6f * std::sin(angle)};
+            point_lights[i].color = glm::vec3((i % 3) == 0, (i % 3) == 1, (i % 3) == 2) * 0.8f + glm::vec3(0.2f);
+            point_lights[i].radius = 1.2f;
+        }
 
         glm::mat4 model(1.f);
 
@@ -287,29 +716,180 @@ try
         view = glm::rotate(view, camera_angle, {0.f, 1.f, 0.f});
         view = glm::translate(view, {0.f, -0.5f, 0.f});
 
+        glm::vec3 camera_position = (glm::inverse(view) * glm::vec4(0.f, 0.f, 0.f, 1.f)).xyz();
+
+        glBindVertexArray(scene_gl.vao);
+        glEnable(GL_DEPTH_TEST);
+
+        point_light_slots.assign(max_point_lights, -1);
+        if (point_lights_enabled)
+        {
+            auto const updates = point_shadows.schedule(point_lights, camera_position, point_shadow_updates_per_frame);
+            point_shadow_updates += updates.size();
+
+            if (!updates.empty())
+            {
+                glUseProgram(point_shadow_program.program);
+                glUniform3fv(shadow_uniforms.position_offset, 1, scene->quantization.offset.data());
+                glUniform3fv(shadow_uniforms.position_scale, 1, scene->quantization.scale.data());
+                glUniformMatrix4fv(shadow_uniforms.face_transforms, 6, GL_FALSE, reinterpret_cast<float const *>(face_transforms.data()));
+
+                // Cube faces flip the winding differently, so both sides are drawn
+                glDisable(GL_CULL_FACE);
+                glDepthMask(GL_TRUE);
+
+                for (auto const & u : updates)
+                {
+                    auto const & light = point_lights[u.light];
+
+                    // Only meshlets within the light's range can shadow anything it lights
+                    light_meshlets.clear();
+                    cull_meshlets_sphere(light.position, light.radius, scene->bounds, light_meshlets);
+                    point_shadow_meshlets += light_meshlets.size();
+
+                    point_shadows.begin_slot(u.slot);
+                    glUniform3fv(shadow_uniforms.light_position, 1, reinterpret_cast<float const *>(&light.position));
+                    glUniform1f(shadow_uniforms.light_radius, light.radius);
+                    glUniform1i(shadow_uniforms.first_layer, u.slot * 6);
+                    draw_meshlets(light_meshlets);
+
+                    point_shadows.mark_rendered(u, light);
+                }
+
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+            }
+
+            for (int i = 0; i < max_point_lights; ++i)
+                point_light_slots[i] = point_shadows.slot_of(i);
+        }
+
+        float near = 0.1f;
+        float far = 100.f;
+
         float aspect = (float)height / (float)width;
         glm::mat4 projection = glm::perspective(glm::pi<float>() / 3.f, (width * 1.f) / height, near, far);
 
-        glm::vec3 camera_position = (glm::inverse(view) * glm::vec4(0.f, 0.f, 0.f, 1.f)).xyz();
+        // Culled once for both the prepass and the shading pass
+        if (cluster_culling)
+        {
+            visible_meshlets.clear();
+            cull_meshlets(frustum_planes(projection * view * model), camera_position, scene->bounds, cone_culling, visible_meshlets);
+        }
+
+        auto draw_scene = [&]
+        {
+            if (cluster_culling)
+                draw_meshlets(visible_meshlets);
+            else
+            {
+                for (auto const & chunk : scene->chunks.chunks)
+                    glDrawElementsBaseVertex(GL_TRIANGLES, chunk.index_count, GL_UNSIGNED_SHORT,
+                        reinterpret_cast<void const *>(chunk.first_index * sizeof(std::uint16_t)), chunk.base_vertex);
+            }
+        };
 
-        glm::vec3 sun_direction = glm::normalize(glm::vec3(std::sin(time * 0.5f), 2.f, std::cos(time * 0.5f)));
+        if (ssao_enabled)
+        {
+            gpu_timer::scope timing(ssao_timer);
+
+            ssao.begin_prepass();
+            glEnable(GL_DEPTH_TEST);
+            glEnable(GL_CULL_FACE);
+
+            glUseProgram(ssao_prepass_program.program);
+            glUniformMatrix4fv(prepass_uniforms.model, 1, GL_FALSE, reinterpret_cast<float *>(&model));
+            glUniformMatrix4fv(prepass_uniforms.view, 1, GL_FALSE, reinterpret_cast<float *>(&view));
+            glUniformMatrix4fv(prepass_uniforms.projection, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
+            glUniform3fv(prepass_uniforms.position_offset, 1, scene->quantization.offset.data());
+            glUniform3fv(prepass_uniforms.position_scale, 1, scene->quantization.scale.data());
+            draw_scene();
+
+            ssao.compute(ssao_program.program, ssao_blur_program.program, projection, ssao_radius);
+            glBindVertexArray(scene_gl.vao);
+        }
 
-        glUseProgram(program);
+        hdr.begin_scene();
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glClearColor(0.8f, 0.8f, 1.f, 0.f);
 
-        glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
-        glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
-        glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
-        glUniform3fv(camera_position_location, 1, (float *)(&camera_position));
-        glUniform3f(albedo_location, .8f, .7f, .6f);
-        glUniform3f(sun_color_location, 1.f, 1.f, 1.f);
-        glUniform3fv(sun_direction_location, 1, reinterpret_cast<float *>(&sun_direction));
+        glEnable(GL_DEPTH_TEST);
+        glEnable(GL_CULL_FACE);
 
-        glBindVertexArray(scene_vao);
-        glDrawElements(GL_TRIANGLES, scene.indices.size(), GL_UNSIGNED_INT, nullptr);
+        glm::vec3 sun_direction = glm::normalize(glm::vec3(std::sin(time * 0.5f), 2.f, std::cos(time * 0.5f)));
+
+        glUseProgram(scene_program.program);
+
+        glUniformMatrix4fv(uniforms.model, 1, GL_FALSE, reinterpret_cast<float *>(&model));
+        glUniformMatrix4fv(uniforms.view, 1, GL_FALSE, reinterpret_cast<float *>(&view));
+        glUniformMatrix4fv(uniforms.projection, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
+        glUniform3fv(uniforms.position_offset, 1, scene->quantization.offset.data());
+        glUniform3fv(uniforms.position_scale, 1, scene->quantization.scale.data());
+        glUniform3fv(uniforms.camera_position, 1, (float *)(&camera_position));
+        glUniform3f(uniforms.albedo, .8f, .7f, .6f);
+        glUniform3f(uniforms.sun_color, 1.f, 1.f, 1.f);
+        glUniform3fv(uniforms.sun_direction, 1, reinterpret_cast<float *>(&sun_direction));
+
+        glUniform1i(uniforms.point_light_count, point_lights_enabled ? max_point_lights : 0);
+        for (int i = 0; i < max_point_lights; ++i)
+        {
+            glUniform3fv(uniforms.point_light_position + i, 1, reinterpret_cast<float *>(&point_lights[i].position));
+            glUniform3fv(uniforms.point_light_color + i, 1, reinterpret_cast<float *>(&point_lights[i].color));
+            glUniform1f(uniforms.point_light_radius + i, point_lights[i].radius);
+        }
+        glUniform1iv(uniforms.point_light_slot, max_point_lights, point_light_slots.data());
+        glUniformMatrix4fv(uniforms.face_transforms, 6, GL_FALSE, reinterpret_cast<float const *>(face_transforms.data()));
+        glUniform1i(uniforms.point_shadow_map, 0);
+        glUniform1i(uniforms.ambient_occlusion_enabled, ssao_enabled);
+        glUniform1i(uniforms.ambient_occlusion_map, 1);
+        glUniform1i(uniforms.ambient_occlusion_depth, 2);
+        glUniform1i(uniforms.baked_occlusion_enabled, baked_occlusion_enabled);
+        glUniform1i(uniforms.light_probes_enabled, light_probes_enabled);
+        glUniform1i(uniforms.light_probes, 3);
+        glUniform3fv(uniforms.light_probe_min, 1, scene->probes.min.data());
+        glUniform3fv(uniforms.light_probe_max, 1, scene->probes.max.data());
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, point_shadows.texture());
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, ssao.ao_texture());
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, ssao.depth_texture());
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_3D, scene_gl.probes);
+
+        draw_scene();
+
+        if (bloom_enabled)
+        {
+            gpu_timer::scope timing(bloom_timer);
+            hdr.bloom(bloom_downsample_program.program, bloom_upsample_program.program);
+        }
+        hdr.resolve(tonemap_program.program, exposure, bloom_enabled ? bloom_strength : 0.f);
+
+        print_time += dt;
+        if (print_time >= 1.f)
+        {
+            if (cluster_culling)
+                std::cout << "meshlets: " << visible_meshlets.size() << " of " << scene->meshlets.size() << " visible, " << commands.size() << " draws" << std::endl;
+            if (point_lights_enabled)
+                std::cout << "point shadows: " << point_shadow_updates << " slot updates, "
+                    << point_shadow_meshlets / std::max(point_shadow_updates, 1) << " meshlets per update" << std::endl;
+            if (ssao_enabled)
+                std::cout << "ssao: " << ssao_timer.take_average() << " ms gpu" << std::endl;
+            if (bloom_enabled)
+                std::cout << "bloom: " << bloom_timer.take_average() << " ms gpu" << std::endl;
+            point_shadow_updates = 0;
+            point_shadow_meshlets = 0;
+            print_time = 0.f;
+        }
+
+        replay.end_frame();
 
         SDL_GL_SwapWindow(window);
     }
 
+    replay.finish();
+
     SDL_GL_DeleteContext(gl_context);
     SDL_DestroyWindow(window);
 }
@@ -0,0 +1,155 @@
+#include "meshlet_culling.hpp"
+
+#include <bit>
+#include <cmath>
+
+#include <glm/geometric.hpp>
+#include <glm/matrix.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CULLING_SSE
+#endif
+
+meshlet_bounds::meshlet_bounds(std::vector<meshlet> const & meshlets)
+{
+    for (auto const & m : meshlets)
+    {
+        center_x.push_back(m.center[0]);
+        center_y.push_back(m.center[1]);
+        center_z.push_back(m.center[2]);
+        radius.push_back(m.radius);
+        apex_x.push_back(m.cone_apex[0]);
+        apex_y.push_back(m.cone_apex[1]);
+        apex_z.push_back(m.cone_apex[2]);
+        axis_x.push_back(m.cone_axis[0]);
+        axis_y.push_back(m.cone_axis[1]);
+        axis_z.push_back(m.cone_axis[2]);
+        cutoff.push_back(m.cone_cutoff);
+    }
+}
+
+std::array<glm::vec4, 6> frustum_planes(glm::mat4 const & view_projection)
+{
+    auto const m = glm::transpose(view_projection);
+
+    std::array<glm::vec4, 6> result{m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], m[3] + m[2], m[3] - m[2]};
+    for (auto & plane : result)
+        plane /= glm::length(glm::vec3(plane));
+    return result;
+}
+
+namespace
+{
+
+    void append_visible(unsigned int mask, std::size_t base, std::vector<std::uint32_t> & visible)
+    {
+        for (; mask != 0; mask &= mask - 1)
+            visible.push_back(base + std::countr_zero(mask));
+    }
+
+}
+
+void cull_meshlets(std::array<glm::vec4, 6> const & planes, glm::vec3 const & camera_position, meshlet_bounds const & bounds,
+    bool cone_culling, std::vector<std::uint32_t> & visible)
+{
+    std::size_t const count = bounds.size();
+    std::size_t i = 0;
+
+#if defined(CULLING_SSE)
+    __m128 nx[6], ny[6], nz[6], d[6];
+    for (std::size_t p = 0; p < 6; ++p)
+    {
+        nx[p] = _mm_set1_ps(planes[p].x);
+        ny[p] = _mm_set1_ps(planes[p].y);
+        nz[p] = _mm_set1_ps(planes[p].z);
+        d[p] = _mm_set1_ps(planes[p].w);
+    }
+
+    __m128 const cx = _mm_set1_ps(camera_position.x);
+    __m128 const cy = _mm_set1_ps(camera_position.y);
+    __m128 const cz = _mm_set1_ps(camera_position.z);
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 const x = _mm_loadu_ps(bounds.center_x.data() + i);
+        __m128 const y = _mm_loadu_ps(bounds.center_y.data() + i);
+        __m128 const z = _mm_loadu_ps(bounds.center_z.data() + i);
+        __m128 const minus_radius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(bounds.radius.data() + i));
+
+        int culled = 0;
+        for (std::size_t p = 0; p < 6 && culled != 0xF; ++p)
+        {
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(nx[p], x), _mm_mul_ps(ny[p], y)),
+                _mm_add_ps(_mm_mul_ps(nz[p], z), d[p]));
+            culled |= _mm_movemask_ps(_mm_cmplt_ps(distance, minus_radius));
+        }
+
+        if (cone_culling && culled != 0xF)
+        {
+            // dot(normalize(v), axis) >= cutoff written as dot(v, axis) >= cutoff * length(v)
+            __m128 const vx = _mm_sub_ps(_mm_loadu_ps(bounds.apex_x.data() + i), cx);
+            __m128 const vy = _mm_sub_ps(_mm_loadu_ps(bounds.apex_y.data() + i), cy);
+            __m128 const vz = _mm_sub_ps(_mm_loadu_ps(bounds.apex_z.data() + i), cz);
+            __m128 const length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz)));
+            __m128 const projection = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(vx, _mm_loadu_ps(bounds.axis_x.data() + i)), _mm_mul_ps(vy, _mm_loadu_ps(bounds.axis_y.data() + i))),
+                _mm_mul_ps(vz, _mm_loadu_ps(bounds.axis_z.data() + i)));
+            culled |= _mm_movemask_ps(_mm_cmpge_ps(projection, _mm_mul_ps(_mm_loadu_ps(bounds.cutoff.data() + i), length)));
+        }
+
+        append_visible(~culled & 0xF, i, visible);
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        glm::vec3 const center{bounds.center_x[i], bounds.center_y[i], bounds.center_z[i]};
+
+        bool culled = false;
+        for (std::size_t p = 0; p < 6 && !culled; ++p)
+            culled = glm::dot(glm::vec3(planes[p]), center) + planes[p].w < -bounds.radius[i];
+
+        if (cone_culling && !culled)
+        {
+            glm::vec3 const v = glm::vec3{bounds.apex_x[i], bounds.apex_y[i], bounds.apex_z[i]} - camera_position;
+            glm::vec3 const axis{bounds.axis_x[i], bounds.axis_y[i], bounds.axis_z[i]};
+            culled = glm::dot(v, axis) >= bounds.cutoff[i] * glm::length(v);
+        }
+
+        if (!culled)
+            visible.push_back(i);
+    }
+}
+
+void cull_meshlets_sphere(glm::vec3 const & center, float radius, meshlet_bounds const & bounds, std::vector<std::uint32_t> & visible)
+{
+    std::size_t const count = bounds.size();
+    std::size_t i = 0;
+
+#if defined(CULLING_SSE)
+    __m128 const cx = _mm_set1_ps(center.x);
+    __m128 const cy = _mm_set1_ps(center.y);
+    __m128 const cz = _mm_set1_ps(center.z);
+    __m128 const r = _mm_set1_ps(radius);
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 const dx = _mm_sub_ps(_mm_loadu_ps(bounds.center_x.data() + i), cx);
+        __m128 const dy = _mm_sub_ps(_mm_loadu_ps(bounds.center_y.data() + i), cy);
+        __m128 const dz = _mm_sub_ps(_mm_loadu_ps(bounds.center_z.data() + i), cz);
+        __m128 const reach = _mm_add_ps(_mm_loadu_ps(bounds.radius.data() + i), r);
+        __m128 const distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        append_visible(_mm_movemask_ps(_mm_cmple_ps(distance2, _mm_mul_ps(reach, reach))), i, visible);
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        glm::vec3 const d = glm::vec3{bounds.center_x[i], bounds.center_y[i], bounds.center_z[i]} - center;
+        float const reach = bounds.radius[i] + radius;
+        if (glm::dot(d, d) <= reach * reach)
+            visible.push_back(i);
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "meshlet.hpp"
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <vector>
+#include <array>
+#include <cstdint>
+
+// Meshlet bounds with one array per component, so that 4 meshlets are tested per SSE instruction
+struct meshlet_bounds
+{
+    std::vector<float> center_x, center_y, center_z, radius;
+    std::vector<float> apex_x, apex_y, apex_z;
+    std::vector<float> axis_x, axis_y, axis_z, cutoff;
+
+    explicit meshlet_bounds(std::vector<meshlet> const & meshlets);
+
+    std::size_t size() const { return radius.size(); }
+};
+
+// Normalized planes with inward normals, such that dot(plane.xyz, p) + plane.w >= 0 inside
+std::array<glm::vec4, 6> frustum_planes(glm::mat4 const & view_projection);
+
+// Appends the indices of meshlets whose sphere is not entirely behind a frustum plane and
+// whose cone does not say that every triangle faces away from the camera
+void cull_meshlets(std::array<glm::vec4, 6> const & planes, glm::vec3 const & camera_position, meshlet_bounds const & bounds,
+    bool cone_culling, std::vector<std::uint32_t> & visible);
+
+// Appends the indices of meshlets whose sphere overlaps the given one, e.g. the range of a point light
+void cull_meshlets_sphere(glm::vec3 const & center, float radius, meshlet_bounds const & bounds, std::vector<std::uint32_t> & visible);
@@ -0,0 +1,175 @@
+#include "point_shadows.hpp"
+
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/scalar_constants.hpp>
+#include <glm/geometric.hpp>
+#include <glm/common.hpp>
+
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <stdexcept>
+
+point_shadow_atlas::point_shadow_atlas(int resolution, int slot_count)
+    : resolution_(resolution)
+    , slots_(slot_count)
+{
+    glGenTextures(1, &texture_);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture_);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, resolution, resolution, slot_count * 6, 0,
+        GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+
+    glGenFramebuffers(1, &layered_fbo_);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, layered_fbo_);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture_, 0);
+    if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        throw std::runtime_error("Point shadow framebuffer is incomplete");
+
+    layer_fbos_.resize(slot_count * 6);
+    glGenFramebuffers(layer_fbos_.size(), layer_fbos_.data());
+    for (std::size_t layer = 0; layer < layer_fbos_.size(); ++layer)
+    {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, layer_fbos_[layer]);
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture_, 0, layer);
+    }
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+point_shadow_atlas::~point_shadow_atlas()
+{
+    glDeleteFramebuffers(layer_fbos_.size(), layer_fbos_.data());
+    glDeleteFramebuffers(1, &layered_fbo_);
+    glDeleteTextures(1, &texture_);
+}
+
+std::array<glm::mat4, 6> point_shadow_atlas::face_transforms()
+{
+    // Far plane at 1 since positions are divided by the light radius; depth itself is written by the shader
+    glm::mat4 const projection = glm::perspective(glm::pi<float>() / 2.f, 1.f, 0.01f, 1.f);
+
+    glm::vec3 const zero(0.f);
+    return {
+        projection * glm::lookAt(zero, { 1.f,  0.f,  0.f}, {0.f, -1.f,  0.f}),
+        projection * glm::lookAt(zero, {-1.f,  0.f,  0.f}, {0.f, -1.f,  0.f}),
+        projection * glm::lookAt(zero, { 0.f,  1.f,  0.f}, {0.f,  0.f,  1.f}),
+        projection * glm::lookAt(zero, { 0.f, -1.f,  0.f}, {0.f,  0.f, -1.f}),
+        projection * glm::lookAt(zero, { 0.f,  0.f,  1.f}, {0.f, -1.f,  0.f}),
+        projection * glm::lookAt(zero, { 0.f,  0.f, -1.f}, {0.f, -1.f,  0.f}),
+    };
+}
+
+std::vector<point_shadow_atlas::update> point_shadow_atlas::schedule(std::vector<point_light> const & lights,
+    glm::vec3 const & camera_position, int max_updates)
+{
+    // Bright, large and close lights cast the shadows that are noticed
+    std::vector<float> importance(lights.size());
+    for (std::size_t i = 0; i < lights.size(); ++i)
+    {
+        auto const & light = lights[i];
+        float const brightness = std::max({light.color.r, light.color.g, light.color.b});
+        importance[i] = brightness * light.radius / std::max(glm::distance(light.position, camera_position), 0.1f);
+    }
+
+    std::vector<std::size_t> order(lights.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b){ return importance[a] > importance[b]; });
+    order.resize(std::min(order.size(), slots_.size()));
+
+    light_slots_.assign(lights.size(), -1);
+
+    // Lights that stay among the most important keep their slots and whatever is rendered there
+    for (std::size_t s = 0; s < slots_.size(); ++s)
+    {
+        auto & slot = slots_[s];
+        if (slot.light >= 0 && std::find(order.begin(), order.end(), slot.light) != order.end())
+            light_slots_[slot.light] = s;
+        else
+            slot = {};
+    }
+
+    for (auto i : order)
+    {
+        if (light_slots_[i] >= 0)
+            continue;
+
+        for (std::size_t s = 0; s < slots_.size(); ++s)
+            if (slots_[s].light < 0)
+            {
+                slots_[s].light = i;
+                light_slots_[i] = s;
+                break;
+            }
+    }
+
+    std::vector<update> result;
+    for (std::size_t s = 0; s < slots_.size(); ++s)
+    {
+        auto & slot = slots_[s];
+        if (slot.light < 0)
+            continue;
+
+        ++slot.age;
+
+        auto const & light = lights[slot.light];
+        if (!slot.rendered || slot.stale || slot.rendered_position != light.position || slot.rendered_radius != light.radius)
+            result.push_back({static_cast<std::size_t>(slot.light), static_cast<int>(s)});
+    }
+
+    auto priority = [&](update const & u)
+    {
+        auto const & slot = slots_[u.slot];
+        return slot.rendered ? importance[u.light] * slot.age : std::numeric_limits<float>::infinity();
+    };
+
+    std::sort(result.begin(), result.end(), [&](update const & a, update const & b){ return priority(a) > priority(b); });
+    if (result.size() > static_cast<std::size_t>(max_updates))
+        result.resize(max_updates);
+
+    return result;
+}
+
+void point_shadow_atlas::mark_rendered(update const & u, point_light const & light)
+{
+    auto & slot = slots_[u.slot];
+    slot.rendered = true;
+    slot.stale = false;
+    slot.rendered_position = light.position;
+    slot.rendered_radius = light.radius;
+    slot.age = 0;
+}
+
+void point_shadow_atlas::invalidate()
+{
+    for (auto & slot : slots_)
+        slot.stale = true;
+}
+
+int point_shadow_atlas::slot_of(std::size_t light) const
+{
+    if (light >= light_slots_.size())
+        return -1;
+
+    int const s = light_slots_[light];
+    // A slot that was never rendered holds another light's depth or nothing at all
+    return (s >= 0 && slots_[s].rendered) ? s : -1;
+}
+
+void point_shadow_atlas::begin_slot(int slot)
+{
+    for (int face = 0; face < 6; ++face)
+    {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, layer_fbos_[slot * 6 + face]);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, layered_fbo_);
+    glViewport(0, 0, resolution_, resolution_);
+}
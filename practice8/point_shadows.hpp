@@ -0,0 +1,84 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+struct point_light
+{
+    glm::vec3 position;
+    glm::vec3 color;
+    // Light falls to zero at this distance, and so does its shadow map's depth range
+    float radius;
+};
+
+// Cube shadow maps for point lights, six layers per slot of one depth texture array, so
+// a light's six faces are rendered in one pass with the geometry shader choosing gl_Layer.
+// Depth is the distance to the light divided by its radius. There are fewer slots than
+// lights and a per-frame budget of slot updates; schedule() decides who gets them.
+struct point_shadow_atlas
+{
+    point_shadow_atlas(int resolution, int slot_count);
+    ~point_shadow_atlas();
+
+    point_shadow_atlas(point_shadow_atlas const &) = delete;
+    point_shadow_atlas & operator = (point_shadow_atlas const &) = delete;
+
+    int resolution() const { return resolution_; }
+    GLuint texture() const { return texture_; }
+
+    // Light-relative view projections of the six faces, in +X, -X, +Y, -Y, +Z, -Z order, for
+    // a light of radius 1; lookups have to pick faces and texels the same way
+    static std::array<glm::mat4, 6> face_transforms();
+
+    struct update
+    {
+        std::size_t light;
+        int slot;
+    };
+
+    // Gives the slots to the most important lights, keeping the slots they already have, and
+    // returns up to max_updates of them to re-render: first the ones that never were, then by
+    // importance times the frames since their last update. Lights that did not move are skipped.
+    std::vector<update> schedule(std::vector<point_light> const & lights, glm::vec3 const & camera_position, int max_updates);
+
+    // Call after rendering an update
+    void mark_rendered(update const & u, point_light const & light);
+
+    // For when the geometry casting the shadows changed: every slot is updated again, and
+    // keeps its old shadow until then
+    void invalidate();
+
+    // -1 if the light has no shadow this frame
+    int slot_of(std::size_t light) const;
+
+    // Clears the six layers and leaves the layered framebuffer of the whole array bound;
+    // the geometry shader must offset gl_Layer by 6 * slot
+    void begin_slot(int slot);
+
+private:
+    struct slot
+    {
+        // Index of the owning light, or -1
+        std::int64_t light = -1;
+        bool rendered = false;
+        bool stale = false;
+        glm::vec3 rendered_position{0.f};
+        float rendered_radius = 0.f;
+        int age = 0;
+    };
+
+    int resolution_;
+    std::vector<slot> slots_;
+    std::vector<int> light_slots_;
+
+    GLuint texture_ = 0;
+    GLuint layered_fbo_ = 0;
+    // One per layer, since clearing a layered attachment clears all of its layers
+    std::vector<GLuint> layer_fbos_;
+};
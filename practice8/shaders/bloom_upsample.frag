@@ -0,0 +1,22 @@
+#version 330 core
+
+// The coarser level, linearly filtered; the result is added to the level being drawn
+uniform sampler2D source;
+uniform vec2 target_size;
+
+layout (location = 0) out vec4 out_color;
+
+// A 3x3 tent around the pixel, one source texel apart
+void main()
+{
+    vec2 uv = gl_FragCoord.xy / target_size;
+    vec2 d = 1.0 / vec2(textureSize(source, 0));
+
+    vec3 color = 4.0 * texture(source, uv).rgb;
+    color += 2.0 * (texture(source, uv + vec2(d.x, 0.0)).rgb + texture(source, uv - vec2(d.x, 0.0)).rgb
+        + texture(source, uv + vec2(0.0, d.y)).rgb + texture(source, uv - vec2(0.0, d.y)).rgb);
+    color += texture(source, uv + d).rgb + texture(source, uv - d).rgb
+        + texture(source, uv + vec2(d.x, -d.y)).rgb + texture(source, uv + vec2(-d.x, d.y)).rgb;
+
+    out_color = vec4(color / 16.0, 1.0);
+}
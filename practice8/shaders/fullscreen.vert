@@ -0,0 +1,8 @@
+#version 330 core
+
+// One triangle covering the screen
+void main()
+{
+    vec2 position = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 4.0 - vec2(1.0);
+    gl_Position = vec4(position, 0.0, 1.0);
+}
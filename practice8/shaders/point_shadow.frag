@@ -0,0 +1,9 @@
+#version 330 core
+
+in vec3 light_offset;
+
+void main()
+{
+    // Distance rather than projected depth, so that one comparison works across all six faces
+    gl_FragDepth = length(light_offset);
+}
@@ -0,0 +1,13 @@
+#version 330 core
+
+uniform vec3 position_offset;
+uniform vec3 position_scale;
+
+layout (location = 0) in vec3 in_position;
+
+out vec3 world_position;
+
+void main()
+{
+    world_position = position_offset + position_scale * in_position;
+}
@@ -0,0 +1,153 @@
+#version 330 core
+
+uniform vec3 camera_position;
+
+uniform vec3 albedo;
+
+uniform vec3 sun_direction;
+uniform vec3 sun_color;
+
+const int MAX_POINT_LIGHTS = 8;
+
+uniform int point_light_count;
+uniform vec3 point_light_position[MAX_POINT_LIGHTS];
+uniform vec3 point_light_color[MAX_POINT_LIGHTS];
+uniform float point_light_radius[MAX_POINT_LIGHTS];
+// Atlas slot of each light, -1 when it has no shadow this frame
+uniform int point_light_slot[MAX_POINT_LIGHTS];
+
+uniform mat4 face_transforms[6];
+uniform sampler2DArrayShadow point_shadow_map;
+
+uniform mat4 view;
+
+// Half-resolution occlusion and the linear view depth it was computed at
+uniform int ambient_occlusion_enabled;
+uniform sampler2D ambient_occlusion_map;
+uniform sampler2D ambient_occlusion_depth;
+
+// Per-vertex occlusion baked with the mesh cache
+uniform int baked_occlusion_enabled;
+
+// Indirect light baked around the scene, nine slabs of SH coefficients as
+// light_probe_grid::texels() lays them out; a constant ambient light when disabled
+uniform int light_probes_enabled;
+uniform sampler3D light_probes;
+uniform vec3 light_probe_min;
+uniform vec3 light_probe_max;
+
+in vec3 position;
+in vec3 normal;
+in float baked_occlusion;
+
+layout (location = 0) out vec4 out_color;
+
+// Must pick faces in the order of point_shadow_atlas::face_transforms
+int cube_face(vec3 d)
+{
+    vec3 a = abs(d);
+    if (a.x >= a.y && a.x >= a.z)
+        return d.x > 0.0 ? 0 : 1;
+    if (a.y >= a.z)
+        return d.y > 0.0 ? 2 : 3;
+    return d.z > 0.0 ? 4 : 5;
+}
+
+float point_shadow(int light)
+{
+    int slot = point_light_slot[light];
+    if (slot < 0)
+        return 1.0;
+
+    float radius = point_light_radius[light];
+    vec3 d = (position + normal * 0.005 - point_light_position[light]) / radius;
+    int face = cube_face(d);
+    vec4 clip = face_transforms[face] * vec4(d, 1.0);
+    vec2 texcoord = clip.xy / clip.w * 0.5 + vec2(0.5);
+    return texture(point_shadow_map, vec4(texcoord, float(slot * 6 + face), length(d) - 0.002));
+}
+
+// The four half-resolution texels around the pixel, weighted bilinearly and by how close
+// their depth is to this one's, so that silhouettes keep the occlusion of their own side
+float ambient_occlusion()
+{
+    if (ambient_occlusion_enabled == 0)
+        return 1.0;
+
+    float depth = -(view * vec4(position, 1.0)).z;
+    ivec2 size = textureSize(ambient_occlusion_map, 0);
+    vec2 p = gl_FragCoord.xy * 0.5 - vec2(0.5);
+    ivec2 base = ivec2(floor(p));
+    vec2 f = p - vec2(base);
+
+    float sum = 0.0;
+    float weight_sum = 0.0;
+    for (int i = 0; i < 4; ++i)
+    {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 texel = clamp(base + offset, ivec2(0), size - ivec2(1));
+        vec2 bilinear = mix(vec2(1.0) - f, f, vec2(offset));
+        float d = texelFetch(ambient_occlusion_depth, texel, 0).r;
+        float weight = bilinear.x * bilinear.y / (1e-4 + abs(d - depth));
+        sum += texelFetch(ambient_occlusion_map, texel, 0).r * weight;
+        weight_sum += weight;
+    }
+    return sum / max(weight_sum, 1e-8);
+}
+
+vec3 probe_irradiance()
+{
+    ivec3 size = textureSize(light_probes, 0);
+    vec3 grid = vec3(size.xy, size.z / 9);
+    vec3 spacing = (light_probe_max - light_probe_min) / (grid - vec3(1.0));
+
+    // Half a cell off the surface keeps the probes inside the mesh out of the lookup; clamping
+    // to the texel centers keeps each lookup within its coefficient's slab
+    vec3 cell = clamp((position + normal * spacing * 0.5 - light_probe_min) / spacing, vec3(0.0), grid - vec3(1.0)) + vec3(0.5);
+    vec3 texcoord = cell / vec3(size);
+    float slab = grid.z / float(size.z);
+
+    vec3 c[9];
+    for (int i = 0; i < 9; ++i)
+        c[i] = texture(light_probes, texcoord + vec3(0.0, 0.0, slab * float(i))).rgb;
+
+    vec3 n = normal;
+    vec3 result = c[0] * 0.282095
+        + (c[1] * n.y + c[2] * n.z + c[3] * n.x) * 0.488603
+        + (c[4] * n.x * n.y + c[5] * n.y * n.z + c[7] * n.x * n.z) * 1.092548
+        + c[6] * 0.315392 * (3.0 * n.z * n.z - 1.0)
+        + c[8] * 0.546274 * (n.x * n.x - n.y * n.y);
+    return max(result, vec3(0.0));
+}
+
+vec3 diffuse(vec3 direction) {
+    return albedo * max(0.0, dot(normal, direction));
+}
+
+vec3 specular(vec3 direction) {
+    float power = 64.0;
+    vec3 reflected_direction = 2.0 * normal * dot(normal, direction) - direction;
+    vec3 view_direction = normalize(camera_position - position);
+    return albedo * pow(max(0.0, dot(reflected_direction, view_direction)), power);
+}
+
+vec3 phong(vec3 direction) {
+    return diffuse(direction) + specular(direction);
+}
+
+void main()
+{
+    vec3 ambient_light = light_probes_enabled != 0 ? probe_irradiance() : vec3(0.2);
+    float occlusion = ambient_occlusion() * (baked_occlusion_enabled != 0 ? baked_occlusion : 1.0);
+    vec3 color = albedo * ambient_light * occlusion + sun_color * phong(sun_direction);
+
+    for (int i = 0; i < point_light_count; ++i)
+    {
+        vec3 to_light = point_light_position[i] - position;
+        float d = length(to_light);
+        float falloff = clamp(1.0 - d * d / (point_light_radius[i] * point_light_radius[i]), 0.0, 1.0);
+        if (falloff > 0.0)
+            color += point_light_color[i] * phong(to_light / d) * falloff * falloff * point_shadow(i);
+    }
+    out_color = vec4(color, 1.0);
+}
@@ -0,0 +1,44 @@
+#version 330 core
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+uniform vec3 position_offset;
+uniform vec3 position_scale;
+
+#ifdef QUANTIZED_VERTICES
+// w is the occlusion baked into the vertex
+layout (location = 0) in vec4 in_position;
+layout (location = 1) in vec2 in_normal;
+#else
+layout (location = 0) in vec3 in_position;
+layout (location = 1) in vec3 in_normal;
+layout (location = 2) in float in_occlusion;
+#endif
+
+out vec3 position;
+out vec3 normal;
+out float baked_occlusion;
+
+vec3 decode_normal(vec2 encoded)
+{
+    encoded = max(encoded / 32767.0, vec2(-1.0));
+    vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+    return normalize(n);
+}
+
+void main()
+{
+    position = (model * vec4(position_offset + position_scale * in_position.xyz, 1.0)).xyz;
+    gl_Position = projection * view * vec4(position, 1.0);
+#ifdef QUANTIZED_VERTICES
+    normal = normalize(mat3(model) * decode_normal(in_normal));
+    baked_occlusion = in_position.w;
+#else
+    normal = normalize(mat3(model) * in_normal);
+    baked_occlusion = in_occlusion;
+#endif
+}
@@ -0,0 +1,55 @@
+#version 330 core
+
+uniform sampler2D depth_texture;
+uniform sampler2D normal_texture;
+
+uniform mat4 projection;
+uniform float radius;
+
+// Must match ssao_renderer::kernel_size
+const int KERNEL_SIZE = 12;
+uniform vec3 kernel[KERNEL_SIZE];
+
+layout (location = 0) out float out_ao;
+
+void main()
+{
+    ivec2 size = textureSize(depth_texture, 0);
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+
+    float depth = texelFetch(depth_texture, texel, 0).r;
+    if (depth <= 0.0)
+    {
+        out_ao = 1.0;
+        return;
+    }
+
+    vec2 ndc = gl_FragCoord.xy / vec2(size) * 2.0 - vec2(1.0);
+    vec3 position = vec3(ndc * depth / vec2(projection[0][0], projection[1][1]), -depth);
+    vec3 normal = normalize(texelFetch(normal_texture, texel, 0).xyz * 2.0 - vec3(1.0));
+
+    // Interleaved gradient noise turns the kernel about the normal, different in neighbouring
+    // pixels, so that the few samples trade banding for noise the blur removes
+    float angle = 6.2831853 * fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+    vec3 helper = abs(normal.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+    vec3 tangent = normalize(cross(helper, normal));
+    vec3 bitangent = cross(normal, tangent);
+    tangent = tangent * cos(angle) + bitangent * sin(angle);
+    mat3 basis = mat3(tangent, cross(normal, tangent), normal);
+
+    float occlusion = 0.0;
+    for (int i = 0; i < KERNEL_SIZE; ++i)
+    {
+        vec3 sample_position = position + basis * kernel[i] * radius;
+        vec4 clip = projection * vec4(sample_position, 1.0);
+        ivec2 sample_texel = clamp(ivec2((clip.xy / clip.w * 0.5 + vec2(0.5)) * vec2(size)), ivec2(0), size - ivec2(1));
+
+        // The sample is occluded when the surface seen there is in front of it; the weight
+        // fades for surfaces far in front, which are something else passing by
+        float scene_depth = texelFetch(depth_texture, sample_texel, 0).r;
+        if (scene_depth > 0.0 && scene_depth < -sample_position.z - 0.02 * radius)
+            occlusion += smoothstep(0.0, 1.0, radius / abs(depth - scene_depth));
+    }
+
+    out_ao = 1.0 - occlusion / float(KERNEL_SIZE);
+}
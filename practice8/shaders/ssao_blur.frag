@@ -0,0 +1,37 @@
+#version 330 core
+
+uniform sampler2D depth_texture;
+uniform sampler2D ao_texture;
+
+// One texel along the axis being blurred
+uniform ivec2 direction;
+
+layout (location = 0) out float out_ao;
+
+void main()
+{
+    ivec2 size = textureSize(ao_texture, 0);
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+
+    float depth = texelFetch(depth_texture, texel, 0).r;
+    if (depth <= 0.0)
+    {
+        out_ao = 1.0;
+        return;
+    }
+
+    // Gaussian taps, each dropped as its depth strays more than a few percent from this
+    // one's, which keeps the occlusion of a surface off the one behind it
+    float sum = 0.0;
+    float weight_sum = 0.0;
+    for (int i = -4; i <= 4; ++i)
+    {
+        ivec2 t = clamp(texel + direction * i, ivec2(0), size - ivec2(1));
+        float d = texelFetch(depth_texture, t, 0).r;
+        float weight = exp(-float(i * i) / 8.0) * max(0.0, 1.0 - abs(d - depth) / (0.05 * depth));
+        sum += texelFetch(ao_texture, t, 0).r * weight;
+        weight_sum += weight;
+    }
+
+    out_ao = sum / weight_sum;
+}
@@ -0,0 +1,15 @@
+#version 330 core
+
+uniform mat4 view;
+
+in vec3 position;
+in vec3 normal;
+
+layout (location = 0) out float out_depth;
+layout (location = 1) out vec4 out_normal;
+
+void main()
+{
+    out_depth = -(view * vec4(position, 1.0)).z;
+    out_normal = vec4(normalize(mat3(view) * normal) * 0.5 + vec3(0.5), 0.0);
+}
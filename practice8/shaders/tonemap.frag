@@ -0,0 +1,24 @@
+#version 330 core
+
+uniform sampler2D scene;
+uniform sampler2D bloom;
+
+uniform float exposure;
+uniform float bloom_strength;
+// Brings the sum of the bloom levels back to the scene's brightness
+uniform float bloom_scale;
+
+layout (location = 0) out vec4 out_color;
+
+// Narkowicz's fit of the ACES filmic curve
+vec3 tonemap(vec3 x)
+{
+    return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+}
+
+void main()
+{
+    vec3 color = texelFetch(scene, ivec2(gl_FragCoord.xy), 0).rgb;
+    vec3 glow = texture(bloom, gl_FragCoord.xy / vec2(textureSize(scene, 0))).rgb * bloom_scale;
+    out_color = vec4(tonemap(mix(color, glow, bloom_strength) * exposure), 1.0);
+}
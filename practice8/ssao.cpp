@@ -0,0 +1,147 @@
+#include "ssao.hpp"
+
+#include <glm/ext/scalar_constants.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cmath>
+#include <stdexcept>
+
+ssao_renderer::ssao_renderer(int width, int height)
+{
+    // Directions spiral down the hemisphere by the golden angle, staying off the tangent plane
+    // so that flat surfaces do not occlude themselves; lengths grow towards the radius, shuffled
+    // against the directions, so that most samples stay close to the point
+    float const golden_angle = glm::pi<float>() * (3.f - std::sqrt(5.f));
+    for (int i = 0; i < kernel_size; ++i)
+    {
+        float const z = 1.f - 0.85f * (i + 0.5f) / kernel_size;
+        float const r = std::sqrt(1.f - z * z);
+        float const phi = golden_angle * i;
+        float const t = float((i * 5) % kernel_size + 1) / kernel_size;
+        kernel_[i] = glm::vec3(r * std::cos(phi), r * std::sin(phi), z) * (0.1f + 0.9f * t * t);
+    }
+
+    glGenTextures(1, &depth_texture_);
+    glGenTextures(1, &normal_texture_);
+    glGenTextures(ao_textures_.size(), ao_textures_.data());
+    for (GLuint texture : {depth_texture_, normal_texture_, ao_textures_[0], ao_textures_[1]})
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    glGenRenderbuffers(1, &depth_renderbuffer_);
+    glGenFramebuffers(1, &prepass_fbo_);
+    glGenFramebuffers(ao_fbos_.size(), ao_fbos_.data());
+
+    glGenVertexArrays(1, &fullscreen_vao_);
+
+    resize(width, height);
+}
+
+ssao_renderer::~ssao_renderer()
+{
+    glDeleteVertexArrays(1, &fullscreen_vao_);
+    glDeleteFramebuffers(ao_fbos_.size(), ao_fbos_.data());
+    glDeleteFramebuffers(1, &prepass_fbo_);
+    glDeleteRenderbuffers(1, &depth_renderbuffer_);
+    glDeleteTextures(ao_textures_.size(), ao_textures_.data());
+    glDeleteTextures(1, &normal_texture_);
+    glDeleteTextures(1, &depth_texture_);
+}
+
+void ssao_renderer::resize(int width, int height)
+{
+    // Rounded up, so that the last full-resolution row and column still have a texel
+    width_ = (width + 1) / 2;
+    height_ = (height + 1) / 2;
+
+    glBindTexture(GL_TEXTURE_2D, depth_texture_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width_, height_, 0, GL_RED, GL_FLOAT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, normal_texture_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB10_A2, width_, height_, 0, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, nullptr);
+    for (GLuint texture : ao_textures_)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width_, height_, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+    }
+
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_renderbuffer_);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width_, height_);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, prepass_fbo_);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, depth_texture_, 0);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, normal_texture_, 0);
+    glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_renderbuffer_);
+    GLenum const draw_buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, draw_buffers);
+    if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        throw std::runtime_error("SSAO prepass framebuffer is incomplete");
+
+    for (std::size_t i = 0; i < ao_fbos_.size(); ++i)
+    {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, ao_fbos_[i]);
+        glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, ao_textures_[i], 0);
+        if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            throw std::runtime_error("SSAO framebuffer is incomplete");
+    }
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+void ssao_renderer::begin_prepass()
+{
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, prepass_fbo_);
+    glViewport(0, 0, width_, height_);
+
+    float const no_depth[4] = {0.f, 0.f, 0.f, 0.f};
+    float const no_normal[4] = {0.5f, 0.5f, 1.f, 0.f};
+    glClearBufferfv(GL_COLOR, 0, no_depth);
+    glClearBufferfv(GL_COLOR, 1, no_normal);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void ssao_renderer::compute(GLuint ao_program, GLuint blur_program, glm::mat4 const & projection, float radius)
+{
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glViewport(0, 0, width_, height_);
+    glBindVertexArray(fullscreen_vao_);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, depth_texture_);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, normal_texture_);
+
+    // Looked up every frame, since either program may have been reloaded since the last one
+    glUseProgram(ao_program);
+    glUniform1i(glGetUniformLocation(ao_program, "depth_texture"), 0);
+    glUniform1i(glGetUniformLocation(ao_program, "normal_texture"), 1);
+    glUniformMatrix4fv(glGetUniformLocation(ao_program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    glUniform1f(glGetUniformLocation(ao_program, "radius"), radius);
+    glUniform3fv(glGetUniformLocation(ao_program, "kernel"), kernel_size, glm::value_ptr(kernel_[0]));
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, ao_fbos_[0]);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glUseProgram(blur_program);
+    glUniform1i(glGetUniformLocation(blur_program, "depth_texture"), 0);
+    glUniform1i(glGetUniformLocation(blur_program, "ao_texture"), 1);
+    GLint const direction = glGetUniformLocation(blur_program, "direction");
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, ao_textures_[0]);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, ao_fbos_[1]);
+    glUniform2i(direction, 1, 0);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glBindTexture(GL_TEXTURE_2D, ao_textures_[1]);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, ao_fbos_[0]);
+    glUniform2i(direction, 0, 1);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <array>
+
+// Screen-space ambient occlusion at half resolution. The scene is drawn once more at half
+// size into linear view depth and view-space normals; occlusion is estimated from those with
+// a small hemisphere kernel around the normal, rotated differently in every pixel, and then
+// blurred horizontally and vertically with taps weighted by how close they are in depth, so
+// that it does not leak across silhouettes. The shading pass upsamples it the same way.
+//
+// The programs are passed in rather than owned, so that they can be reloaded with the rest.
+struct ssao_renderer
+{
+    // Must match KERNEL_SIZE in ssao.frag
+    static constexpr int kernel_size = 12;
+
+    ssao_renderer(int width, int height);
+    ~ssao_renderer();
+
+    ssao_renderer(ssao_renderer const &) = delete;
+    ssao_renderer & operator = (ssao_renderer const &) = delete;
+
+    // Takes the full resolution
+    void resize(int width, int height);
+
+    GLuint ao_texture() const { return ao_textures_[0]; }
+    // Linear view depth of the half-resolution pixels, 0 where nothing was drawn
+    GLuint depth_texture() const { return depth_texture_; }
+
+    // Clears and binds the half-resolution framebuffer and its viewport; the scene is then
+    // drawn into it with a program writing linear depth to output 0 and normals to output 1
+    void begin_prepass();
+
+    // Radius is in world units. Leaves the default framebuffer bound, depth testing disabled
+    void compute(GLuint ao_program, GLuint blur_program, glm::mat4 const & projection, float radius);
+
+private:
+    int width_ = 0;
+    int height_ = 0;
+
+    std::array<glm::vec3, kernel_size> kernel_;
+
+    GLuint depth_texture_ = 0;
+    GLuint normal_texture_ = 0;
+    GLuint depth_renderbuffer_ = 0;
+    GLuint prepass_fbo_ = 0;
+
+    // The blur goes from the first to the second and back
+    std::array<GLuint, 2> ao_textures_{};
+    std::array<GLuint, 2> ao_fbos_{};
+
+    GLuint fullscreen_vao_ = 0;
+};
@@ -8,14 +8,17 @@
 #include <GL/glew.h>
 
 #include <string_view>
+#include <cstdlib>
 #include <stdexcept>
 #include <iostream>
 #include <chrono>
 #include <vector>
-#include <map>
 #include <cmath>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
+#include <future>
+#include <optional>
 
 #define GLM_FORCE_SWIZZLE
 #define GLM_ENABLE_EXPERIMENTAL
@@ -27,6 +30,21 @@
 #include <glm/gtx/string_cast.hpp>
 
 #include "obj_parser.hpp"
+#include "obj_cache.hpp"
+#include "vertex_quantization.hpp"
+#include "profiler.hpp"
+#include "program_cache.hpp"
+#include "frustum.hpp"
+#include "shadow_cascades.hpp"
+#include "shadow_cache.hpp"
+#include "variance_shadows.hpp"
+#include "stream_buffer.hpp"
+#include "point_splats.hpp"
+#include "stereo_views.hpp"
+#include "input_state.hpp"
+#include "replay_session.hpp"
+#include "startup_trace.hpp"
+#include "shader_permutations.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -43,54 +61,179 @@ void glew_fail(std::string_view message, GLenum error)
     throw std::runtime_error(to_string(message) + reinterpret_cast<const char *>(glewGetErrorString(error)));
 }
 
-const char vertex_shader_source[] =
+// Shared by every program: frame_data is written once per frame and bound at binding 0, and
+// object_data is one block per draw in the same ring, bound by offset at binding 1. With two
+// views the scene is drawn with two instances, one per eye, and views[gl_InstanceID] picks its
+// camera; with one only the first of each pair is used.
+const char uniform_blocks_source[] =
 R"(#version 330 core
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+const int max_cascades = 4;
+
+layout (std140) uniform frame_data
+{
+    mat4 views[2];
+    mat4 projections[2];
+    mat4 transforms[max_cascades];
+    vec4 cascade_splits;
+    vec3 light_direction;
+    int cascade_count;
+    vec3 light_color;
+    int view_count;
+    vec3 ambient;
+};
+
+layout (std140) uniform object_data
+{
+    mat4 model;
+    vec3 position_offset;
+    vec3 position_scale;
+};
+)";
 
+const char vertex_shader_source[] =
+R"(
 layout (location = 0) in vec3 in_position;
+#ifdef QUANTIZED_VERTICES
+layout (location = 1) in vec2 in_normal;
+#else
 layout (location = 1) in vec3 in_normal;
+#endif
 
 out vec3 position;
 out vec3 normal;
+out float view_depth;
 
-void main()
+vec3 decode_normal(vec2 encoded)
 {
-    gl_Position = projection * view * model * vec4(in_position, 1.0);
-    position = (model * vec4(in_position, 1.0)).xyz;
-    normal = normalize((model * vec4(in_normal, 0.0)).xyz);
+    encoded = max(encoded / 32767.0, vec2(-1.0));
+    vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+    return normalize(n);
 }
-)";
 
-const char fragment_shader_source[] =
-R"(#version 330 core
+void main()
+{
+    int eye = gl_InstanceID;
+
+#ifdef QUANTIZED_VERTICES
+    vec3 object_position = position_offset + position_scale * in_position;
+    vec3 object_normal = decode_normal(in_normal);
+#else
+    vec3 object_position = in_position;
+    vec3 object_normal = in_normal;
+#endif
+    vec4 view_position = views[eye] * model * vec4(object_position, 1.0);
+    vec4 clip_position = projections[eye] * view_position;
 
-uniform vec3 ambient;
+    // Each eye is squeezed into its half of the window and clipped where it ends, so that one
+    // draw over the whole window fills both
+    if (view_count == 2)
+    {
+        gl_ClipDistance[0] = (eye == 0) ? clip_position.w - clip_position.x : clip_position.w + clip_position.x;
+        clip_position.x = 0.5 * clip_position.x + ((eye == 0) ? -0.5 : 0.5) * clip_position.w;
+    }
+    else
+        gl_ClipDistance[0] = 1.0;
 
-uniform vec3 light_direction;
-uniform vec3 light_color;
+    gl_Position = clip_position;
+    view_depth = -view_position.z;
+    position = (model * vec4(object_position, 1.0)).xyz;
+    normal = normalize((model * vec4(object_normal, 0.0)).xyz);
+}
+)";
 
-uniform mat4 transform;
+const char fragment_shader_source[] =
+R"(
+// Compares against the reference depth and filters the four results bilinearly
+uniform sampler2DArrayShadow shadow_map;
+uniform bool poisson_filter;
+uniform float filter_radius;
 
-uniform sampler2D shadow_map;
+// Blurred, mipmapped depth moments, used instead of the depth comparison when set
+uniform bool variance_shadows;
+uniform sampler2DArray moment_map;
+uniform float warp_exponent;
 
 in vec3 position;
 in vec3 normal;
+in float view_depth;
+
+const float PI = 3.1415926535;
+
+const int poisson_tap_count = 12;
+const vec2 poisson_disk[poisson_tap_count] = vec2[poisson_tap_count](
+    vec2(-0.326212, -0.405810),
+    vec2(-0.840144, -0.073580),
+    vec2(-0.695914,  0.457137),
+    vec2(-0.203345,  0.620716),
+    vec2( 0.962340, -0.194983),
+    vec2( 0.473434, -0.480026),
+    vec2( 0.519456,  0.767022),
+    vec2( 0.185461, -0.893124),
+    vec2( 0.507431,  0.064425),
+    vec2( 0.896420,  0.412458),
+    vec2(-0.321940, -0.932615),
+    vec2(-0.791559, -0.597710)
+);
 
 layout (location = 0) out vec4 out_color;
 
+// Chebyshev's upper bound on the lit fraction, with the low end cut off against light bleeding
+float variance_shadow(vec3 texcoord, float depth)
+{
+    const float bleeding_reduction = 0.2;
+    const float depth_epsilon = 1e-3;
+
+    float slope = 1.0;
+    if (warp_exponent > 0.0)
+    {
+        depth = exp(warp_exponent * depth);
+        slope = warp_exponent * depth;
+    }
+
+    vec2 moments = texture(moment_map, texcoord).rg;
+    if (depth <= moments.x)
+        return 1.0;
+
+    float variance = max(moments.y - moments.x * moments.x, (slope * depth_epsilon) * (slope * depth_epsilon));
+    float d = depth - moments.x;
+    float p = variance / (variance + d * d);
+    return clamp((p - bleeding_reduction) / (1.0 - bleeding_reduction), 0.0, 1.0);
+}
+
 void main()
 {
-    vec4 shadow_pos = transform * vec4(position, 1.0);
+    int cascade = 0;
+    while (cascade + 1 < cascade_count && view_depth > cascade_splits[cascade])
+        ++cascade;
+
+    vec4 shadow_pos = transforms[cascade] * vec4(position, 1.0);
     shadow_pos /= shadow_pos.w;
     shadow_pos = shadow_pos * 0.5 + vec4(0.5);
 
     bool in_shadow_texture = (shadow_pos.x > 0.0) && (shadow_pos.x < 1.0) && (shadow_pos.y > 0.0) && (shadow_pos.y < 1.0) && (shadow_pos.z > 0.0) && (shadow_pos.z < 1.0);
     float shadow_factor = 1.0;
     if (in_shadow_texture)
-        shadow_factor = (texture(shadow_map, shadow_pos.xy).r < shadow_pos.z) ? 0.0 : 1.0;
+    {
+        if (variance_shadows)
+            shadow_factor = variance_shadow(vec3(shadow_pos.xy, float(cascade)), shadow_pos.z);
+        else if (poisson_filter)
+        {
+            // Rotating the disk per pixel turns the banding of a fixed kernel into noise
+            float angle = 2.0 * PI * fract(sin(dot(gl_FragCoord.xy, vec2(12.9898, 78.233))) * 43758.5453);
+            mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+            vec2 texel = filter_radius / vec2(textureSize(shadow_map, 0).xy);
+
+            shadow_factor = 0.0;
+            for (int i = 0; i < poisson_tap_count; ++i)
+                shadow_factor += texture(shadow_map, vec4(shadow_pos.xy + rotation * poisson_disk[i] * texel, float(cascade), shadow_pos.z));
+            shadow_factor /= float(poisson_tap_count);
+        }
+        else
+            shadow_factor = texture(shadow_map, vec4(shadow_pos.xy, float(cascade), shadow_pos.z));
+    }
 
     vec3 albedo = vec3(1.0, 1.0, 1.0);
 
@@ -115,41 +258,43 @@ vec2 vertices[6] = vec2[6](
 );
 
 out vec2 texcoord;
+flat out int layer;
 
+// One instance per cascade, left to right along the bottom of the screen
 void main()
 {
     vec2 position = vertices[gl_VertexID];
-    gl_Position = vec4(position * 0.25 + vec2(-0.75, -0.75), 0.0, 1.0);
+    gl_Position = vec4(position * 0.2 + vec2(-0.78 + 0.42 * float(gl_InstanceID), -0.75), 0.0, 1.0);
     texcoord = position * 0.5 + vec2(0.5);
+    layer = gl_InstanceID;
 }
 )";
 
 const char debug_fragment_shader_source[] =
 R"(#version 330 core
 
-uniform sampler2D shadow_map;
+uniform sampler2DArray shadow_map;
 
 in vec2 texcoord;
+flat in int layer;
 
 layout (location = 0) out vec4 out_color;
 
 void main()
 {
-    out_color = vec4(texture(shadow_map, texcoord).rrr, 1.0);
+    out_color = vec4(texture(shadow_map, vec3(texcoord, float(layer))).rrr, 1.0);
 }
 )";
 
 const char shadow_vertex_shader_source[] =
-R"(#version 330 core
-
-uniform mat4 model;
-uniform mat4 transform;
+R"(
+uniform int cascade;
 
 layout (location = 0) in vec3 in_position;
 
 void main()
 {
-    gl_Position = transform * model * vec4(in_position, 1.0);
+    gl_Position = transforms[cascade] * model * vec4(position_offset + position_scale * in_position, 1.0);
 }
 )";
 
@@ -160,47 +305,112 @@ void main()
 {}
 )";
 
-GLuint create_shader(GLenum type, const char * source)
+// std140 layouts of frame_data and object_data in uniform_blocks_source
+struct frame_uniforms
 {
-    GLuint result = glCreateShader(type);
-    glShaderSource(result, 1, &source, nullptr);
-    glCompileShader(result);
-    GLint status;
-    glGetShaderiv(result, GL_COMPILE_STATUS, &status);
-    if (status != GL_TRUE)
-    {
-        GLint info_log_length;
-        glGetShaderiv(result, GL_INFO_LOG_LENGTH, &info_log_length);
-        std::string info_log(info_log_length, '\0');
-        glGetShaderInfoLog(result, info_log.size(), nullptr, info_log.data());
-        throw std::runtime_error("Shader compilation failed: " + info_log);
-    }
-    return result;
+    glm::mat4 views[2];
+    glm::mat4 projections[2];
+    glm::mat4 transforms[4];
+    glm::vec4 cascade_splits;
+    glm::vec3 light_direction;
+    std::int32_t cascade_count;
+    glm::vec3 light_color;
+    std::int32_t view_count;
+    glm::vec3 ambient;
+    float padding0;
+};
+
+struct object_uniforms
+{
+    glm::mat4 model;
+    glm::vec3 position_offset;
+    float padding0;
+    glm::vec3 position_scale;
+    float padding1;
+};
+
+static_assert(sizeof(frame_uniforms) == 576);
+static_assert(sizeof(object_uniforms) == 96);
+
+GLuint const frame_data_binding = 0;
+GLuint const object_data_binding = 1;
+
+// Everything the scene is drawn from, built without a GL call so that it can load on another
+// thread while the window is already up
+struct scene_data
+{
+    vertex_quantization quantization;
+    // Only one of the two is filled, the 16-byte vertices if asked for
+    std::vector<obj_data::vertex> vertices;
+    std::vector<quantized_vertex> quantized_vertices;
+    std::vector<std::uint32_t> indices;
+    glm::vec3 min, max;
+    std::vector<caster_chunk> caster_chunks;
+    // The shadow pass fetches 8-byte positions from a stream of its own, with its own indices;
+    // the triangle order is the same, so the caster chunk ranges apply to both
+    position_stream depth_stream;
+};
+
+scene_data load_scene(std::string const & path, bool quantized)
+{
+    // Quantized batch by batch while the file is still being parsed if asked to, relative to the
+    // bounding box found by the pre-pass; positions are also kept to build the shadow caster chunks
+    scene_data scene;
+    std::vector<glm::vec3> positions;
+    stream_obj(path, 65536,
+        [&](obj_stream_info const & info)
+        {
+            scene.quantization = make_vertex_quantization(info.position_min, info.position_max);
+            scene.min = {info.position_min[0], info.position_min[1], info.position_min[2]};
+            scene.max = {info.position_max[0], info.position_max[1], info.position_max[2]};
+            if (quantized)
+                scene.quantized_vertices.reserve(info.max_counts.vertex_count);
+            else
+                scene.vertices.reserve(info.max_counts.vertex_count);
+            scene.indices.reserve(info.max_counts.index_count);
+            positions.reserve(info.max_counts.vertex_count);
+        },
+        [&](obj_batch const & batch)
+        {
+            if (quantized)
+            {
+                auto const batch_vertices = quantize_vertices(batch.vertices, scene.quantization);
+                scene.quantized_vertices.resize(batch.vertex_offset + batch_vertices.size());
+                std::copy(batch_vertices.begin(), batch_vertices.end(), scene.quantized_vertices.begin() + batch.vertex_offset);
+            }
+            else
+            {
+                scene.vertices.resize(batch.vertex_offset + batch.vertices.size());
+                std::copy(batch.vertices.begin(), batch.vertices.end(), scene.vertices.begin() + batch.vertex_offset);
+            }
+            positions.resize(batch.vertex_offset + batch.vertices.size());
+            for (std::size_t i = 0; i < batch.vertices.size(); ++i)
+                positions[batch.vertex_offset + i] = {batch.vertices[i].position[0], batch.vertices[i].position[1], batch.vertices[i].position[2]};
+            scene.indices.resize(batch.index_offset + batch.indices.size());
+            std::copy(batch.indices.begin(), batch.indices.end(), scene.indices.begin() + batch.index_offset);
+        });
+
+    scene.caster_chunks = build_caster_chunks(positions, scene.indices);
+    // The depth stream is quantized either way
+    scene.depth_stream = make_position_stream(quantized ? scene.quantized_vertices : quantize_vertices(scene.vertices, scene.quantization), scene.indices);
+    return scene;
 }
 
-GLuint create_program(GLuint vertex_shader, GLuint fragment_shader)
+// The window comes up and presents a first frame before anything else; programs compile and
+// the scene and its point octree load meanwhile, and frames only clear until the programs and
+// the scene are ready. The wall time of every stage goes to the console and, as a Chrome trace,
+// to practice9_startup.json once the first complete frame is drawn.
+int main(int argc, char ** argv) try
 {
-    GLuint result = glCreateProgram();
-    glAttachShader(result, vertex_shader);
-    glAttachShader(result, fragment_shader);
-    glLinkProgram(result);
-
-    GLint status;
-    glGetProgramiv(result, GL_LINK_STATUS, &status);
-    if (status != GL_TRUE)
-    {
-        GLint info_log_length;
-        glGetProgramiv(result, GL_INFO_LOG_LENGTH, &info_log_length);
-        std::string info_log(info_log_length, '\0');
-        glGetProgramInfoLog(result, info_log.size(), nullptr, info_log.data());
-        throw std::runtime_error("Program linkage failed: " + info_log);
-    }
+    startup_trace startup;
 
-    return result;
-}
+    replay_session replay(argc, argv);
+
+    // Vertices stay 32 bytes unless packed into 16 with --quantized-vertices
+    bool const quantized_vertices = std::any_of(argv + 1, argv + argc, [](char const * arg){ return std::string_view(arg) == "--quantized-vertices"; });
+
+    auto const window_stage = startup.begin("window");
 
-int main() try
-{
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
         sdl2_fail("SDL_Init: ");
 
@@ -225,6 +435,9 @@ int main() try
     int width, height;
     SDL_GetWindowSize(window, &width, &height);
 
+    startup.end(window_stage);
+    auto const context_stage = startup.begin("GL context");
+
     SDL_GLContext gl_context = SDL_GL_CreateContext(window);
     if (!gl_context)
         sdl2_fail("SDL_GL_CreateContext: ");
@@ -235,89 +448,245 @@ int main() try
     if (!GLEW_VERSION_3_3)
         throw std::runtime_error("OpenGL 3.3 is not supported");
 
-    auto vertex_shader = create_shader(GL_VERTEX_SHADER, vertex_shader_source);
-    auto fragment_shader = create_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
-    auto program = create_program(vertex_shader, fragment_shader);
+    startup.end(context_stage);
 
-    GLuint model_location = glGetUniformLocation(program, "model");
-    GLuint view_location = glGetUniformLocation(program, "view");
-    GLuint projection_location = glGetUniformLocation(program, "projection");
-    GLuint transform_location = glGetUniformLocation(program, "transform");
+    glClearColor(0.8f, 0.8f, 0.9f, 0.f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    SDL_GL_SwapWindow(window);
+    startup.mark("first frame presented");
 
-    GLuint ambient_location = glGetUniformLocation(program, "ambient");
-    GLuint light_direction_location = glGetUniformLocation(program, "light_direction");
-    GLuint light_color_location = glGetUniformLocation(program, "light_color");
+    std::string project_root = PROJECT_ROOT;
 
-    GLuint shadow_map_location = glGetUniformLocation(program, "shadow_map");
+    // Both load on workers while the programs compile
+    std::string scene_path = project_root + "/bunny.obj";
 
-    glUseProgram(program);
-    glUniform1i(shadow_map_location, 0);
+    auto scene_loading = std::async(std::launch::async, [&]
+    {
+        startup_trace::scope stage(startup, "load scene");
+        return load_scene(scene_path, quantized_vertices);
+    });
 
-    auto debug_vertex_shader = create_shader(GL_VERTEX_SHADER, debug_vertex_shader_source);
-    auto debug_fragment_shader = create_shader(GL_FRAGMENT_SHADER, debug_fragment_shader_source);
-    auto debug_program = create_program(debug_vertex_shader, debug_fragment_shader);
+    auto octree_loading = std::async(std::launch::async, [&]
+    {
+        startup_trace::scope stage(startup, "load point octree");
+        return load_point_octree_cached(scene_path);
+    });
 
-    GLuint debug_shadow_map_location = glGetUniformLocation(debug_program, "shadow_map");
+    auto const programs_stage = startup.begin("compile programs");
 
-    glUseProgram(debug_program);
-    glUniform1i(debug_shadow_map_location, 0);
+    program_cache programs(project_root + "/.program_binaries");
 
-    auto shadow_vertex_shader = create_shader(GL_VERTEX_SHADER, shadow_vertex_shader_source);
-    auto shadow_fragment_shader = create_shader(GL_FRAGMENT_SHADER, shadow_fragment_shader_source);
-    auto shadow_program = create_program(shadow_vertex_shader, shadow_fragment_shader);
+    // Submitted together, so that the driver compiles them at once
+    std::string const uniform_blocks = uniform_blocks_source;
 
-    GLuint shadow_model_location = glGetUniformLocation(shadow_program, "model");
-    GLuint shadow_transform_location = glGetUniformLocation(shadow_program, "transform");
+    auto program = programs.submit({
+        {GL_VERTEX_SHADER, define_features(uniform_blocks + vertex_shader_source, {"QUANTIZED_VERTICES"}, quantized_vertices ? 1 : 0)},
+        {GL_FRAGMENT_SHADER, uniform_blocks + fragment_shader_source}});
 
-    std::string project_root = PROJECT_ROOT;
-    std::string scene_path = project_root + "/bunny.obj";
-    obj_data scene = parse_obj(scene_path);
+    auto debug_program = programs.submit({
+        {GL_VERTEX_SHADER, debug_vertex_shader_source},
+        {GL_FRAGMENT_SHADER, debug_fragment_shader_source}});
+
+    auto shadow_program = programs.submit({
+        {GL_VERTEX_SHADER, uniform_blocks + shadow_vertex_shader_source},
+        {GL_FRAGMENT_SHADER, shadow_fragment_shader_source}});
+
+    GLuint shadow_map_location = 0;
+    GLuint poisson_filter_location = 0;
+    GLuint filter_radius_location = 0;
+    GLuint variance_shadows_location = 0;
+    GLuint moment_map_location = 0;
+    GLuint warp_exponent_location = 0;
+    GLuint debug_shadow_map_location = 0;
+    GLuint shadow_cascade_location = 0;
+
+    // Called from the frame loop once all three programs are linked
+    bool programs_ready = false;
+    auto setup_programs = [&]
+    {
+        std::cout << "Programs: " << programs.loaded() << " loaded from binaries, " << programs.compiled() << " compiled" << std::endl;
+
+        // Block bindings are set after linking, whether the program was compiled or loaded
+        for (GLuint p : {program, shadow_program})
+        {
+            glUniformBlockBinding(p, glGetUniformBlockIndex(p, "frame_data"), frame_data_binding);
+            glUniformBlockBinding(p, glGetUniformBlockIndex(p, "object_data"), object_data_binding);
+        }
+
+        shadow_map_location = glGetUniformLocation(program, "shadow_map");
+        poisson_filter_location = glGetUniformLocation(program, "poisson_filter");
+        filter_radius_location = glGetUniformLocation(program, "filter_radius");
+        variance_shadows_location = glGetUniformLocation(program, "variance_shadows");
+        moment_map_location = glGetUniformLocation(program, "moment_map");
+        warp_exponent_location = glGetUniformLocation(program, "warp_exponent");
 
-    GLuint vao, vbo, ebo;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+        glUseProgram(program);
+        glUniform1i(shadow_map_location, 0);
+        glUniform1i(moment_map_location, 1);
+
+        debug_shadow_map_location = glGetUniformLocation(debug_program, "shadow_map");
+
+        glUseProgram(debug_program);
+        glUniform1i(debug_shadow_map_location, 0);
+
+        shadow_cascade_location = glGetUniformLocation(shadow_program, "cascade");
+    };
+
+    // Every frame takes the frame block and one object block per draw from its region
+    GLint uniform_alignment;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniform_alignment);
+    stream_buffer uniforms(GL_UNIFORM_BUFFER, 16 << 10);
 
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, scene.vertices.size() * sizeof(scene.vertices[0]), scene.vertices.data(), GL_STATIC_DRAW);
+    // Created by upload_scene once the scene has loaded
+    std::optional<scene_data> scene;
+    GLuint vao = 0, vbo = 0, ebo = 0;
+    GLuint depth_vao = 0, depth_vbo = 0, depth_ebo = 0;
 
-    glGenBuffers(1, &ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, scene.indices.size() * sizeof(scene.indices[0]), scene.indices.data(), GL_STATIC_DRAW);
+    auto upload_scene = [&]
+    {
+        startup_trace::scope stage(startup, "upload scene");
+
+        glGenVertexArrays(1, &vao);
+        glBindVertexArray(vao);
 
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), (void*)(0));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), (void*)(12));
+        glGenBuffers(1, &vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        if (quantized_vertices)
+            glBufferData(GL_ARRAY_BUFFER, scene->quantized_vertices.size() * sizeof(quantized_vertex), scene->quantized_vertices.data(), GL_STATIC_DRAW);
+        else
+            glBufferData(GL_ARRAY_BUFFER, scene->vertices.size() * sizeof(obj_data::vertex), scene->vertices.data(), GL_STATIC_DRAW);
+
+        glGenBuffers(1, &ebo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, scene->indices.size() * sizeof(std::uint32_t), scene->indices.data(), GL_STATIC_DRAW);
+
+        glEnableVertexAttribArray(0);
+        glEnableVertexAttribArray(1);
+        if (quantized_vertices)
+        {
+            glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(quantized_vertex), (void*)(0));
+            glVertexAttribPointer(1, 2, GL_SHORT, GL_FALSE, sizeof(quantized_vertex), (void*)(8));
+        }
+        else
+        {
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), (void*)(0));
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), (void*)(12));
+        }
+
+        auto const & depth_stream = scene->depth_stream;
+
+        glGenVertexArrays(1, &depth_vao);
+        glBindVertexArray(depth_vao);
+
+        glGenBuffers(1, &depth_vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, depth_vbo);
+        glBufferData(GL_ARRAY_BUFFER, depth_stream.positions.size() * sizeof(depth_stream.positions[0]), depth_stream.positions.data(), GL_STATIC_DRAW);
+
+        glGenBuffers(1, &depth_ebo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, depth_ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, depth_stream.indices.size() * sizeof(depth_stream.indices[0]), depth_stream.indices.data(), GL_STATIC_DRAW);
+
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(depth_stream.positions[0]), (void*)(0));
+
+        glBindVertexArray(0);
+
+        std::cout << "Shadow caster chunks: " << scene->caster_chunks.size() << std::endl;
+        std::cout << "Depth-only vertices: " << depth_stream.positions.size() << " of " << (quantized_vertices ? scene->quantized_vertices.size() : scene->vertices.size()) << std::endl;
+    };
 
     GLuint debug_vao;
     glGenVertexArrays(1, &debug_vao);
 
+    // One layer per cascade. The tight fit covers the same receivers with fewer texels, so
+    // --shadow-resolution N can trade its sharper shadows for a smaller map
     GLsizei shadow_map_resolution = 1024;
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (std::string_view(argv[i]) != "--shadow-resolution")
+            continue;
+        shadow_map_resolution = std::atoi(argv[i + 1]);
+        if (shadow_map_resolution <= 0)
+            throw std::runtime_error(std::string("Bad shadow map resolution ") + argv[i + 1]);
+    }
+    int const cascade_count = 4;
 
     GLuint shadow_map;
     glGenTextures(1, &shadow_map);
-    glBindTexture(GL_TEXTURE_2D, shadow_map);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, shadow_map_resolution, shadow_map_resolution, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
-
-    GLuint shadow_fbo;
-    glGenFramebuffers(1, &shadow_fbo);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadow_fbo);
-    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadow_map, 0);
-    if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-        throw std::runtime_error("Incomplete framebuffer!");
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, shadow_map);
+    glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, shadow_map_resolution, shadow_map_resolution, cascade_count, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+
+    // Every caster in this scene is static, so the cache is all there is to the shadow map;
+    // X turns it off to compare against rendering every cascade every frame
+    shadow_cache cascade_cache(shadow_map, shadow_map_resolution, cascade_count);
+    bool cache_shadows = true;
+
+    // F switches the cascades between the stable fit, which the cache keeps for as long as
+    // the camera only moves, and the tight one around the receivers
+    shadow_fit cascade_fit = shadow_fit::stable;
+
+    // The lighting pass reads the shadow map through depth comparison with linear filtering,
+    // which gives 2x2 PCF per fetch; the debug view keeps the texture's own raw-depth state
+    GLuint shadow_sampler;
+    glGenSamplers(1, &shadow_sampler);
+    glSamplerParameteri(shadow_sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glSamplerParameteri(shadow_sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glSamplerParameteri(shadow_sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(shadow_sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(shadow_sampler, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glSamplerParameteri(shadow_sampler, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+    // V switches to variance shadows, whose moments are rebuilt only for the layers the cache redrew
+    variance_shadow_map cascade_moments(programs, shadow_map_resolution, cascade_count);
+    bool variance_shadows = false;
+    bool moments_valid[cascade_count] = {};
+
+    // P switches from a single PCF fetch to a rotated Poisson disk of them
+    bool poisson_filter = false;
+    float const filter_radius = 2.5f;
+
+    // K draws the scene as a point cloud instead: its vertices, out of a point octree paged in
+    // under a point budget, as splats; they are lit but not shadowed
+    // Not there until the octree has loaded; K draws the scene as usual meanwhile
+    std::optional<point_splat_renderer> splats;
+    bool point_splats = false;
+    point_splat_renderer::stats splat_stats{};
+
+    // M renders both eyes of a headset side by side in a single pass, --stereo starts with it:
+    // every draw is instanced once per eye and culled once, against a frustum around both.
+    // Point splats keep drawing a single view.
+    bool stereo = std::any_of(argv + 1, argv + argc, [](char const * arg){ return std::string_view(arg) == "--stereo"; });
+    float const eye_separation = 0.064f;
+
+    // Index ranges of the chunks that survive culling, merged where they are adjacent
+    std::vector<GLsizei> caster_counts;
+    std::vector<void const *> caster_offsets;
+    std::size_t casters_drawn[cascade_count] = {};
+    std::size_t chunks_drawn = 0;
+    std::size_t texels_drawn = 0;
+    std::size_t stats_frames = 0;
+
+    profiler frame_profiler;
+    float profile_print_time = 0.f;
 
     auto last_frame_start = std::chrono::high_resolution_clock::now();
 
     float time = 0.f;
     bool paused = false;
 
-    std::map<SDL_Keycode, bool> button_down;
+    input_state input;
+
+    // A replay benchmarks complete frames, and its load time is the time to the first of them
+    if (replay.replaying())
+    {
+        programs.wait();
+        scene_loading.wait();
+        octree_loading.wait();
+    }
 
     float view_elevation = glm::radians(45.f);
     float view_azimuth = 0.f;
@@ -325,6 +694,8 @@ int main() try
     bool running = true;
     while (running)
     {
+        input.begin_frame();
+
         for (SDL_Event event; SDL_PollEvent(&event);) switch (event.type)
         {
         case SDL_QUIT:
@@ -336,46 +707,177 @@ int main() try
                 width = event.window.data1;
                 height = event.window.data2;
                 glViewport(0, 0, width, height);
+                if (splats)
+                    splats->resize(width, height);
                 break;
             }
             break;
         case SDL_KEYDOWN:
-            button_down[event.key.keysym.sym] = true;
+            input.handle_event(event);
 
             if (event.key.keysym.sym == SDLK_SPACE)
                 paused = !paused;
+            if (event.key.keysym.sym == SDLK_p)
+                poisson_filter = !poisson_filter;
+            if (event.key.keysym.sym == SDLK_x)
+                cache_shadows = !cache_shadows;
+            if (event.key.keysym.sym == SDLK_v)
+                variance_shadows = !variance_shadows;
+            if (event.key.keysym.sym == SDLK_k)
+                point_splats = !point_splats;
+            if (event.key.keysym.sym == SDLK_m)
+            {
+                stereo = !stereo;
+                std::cout << (stereo ? "Stereo" : "Mono") << std::endl;
+            }
+            if (event.key.keysym.sym == SDLK_f)
+            {
+                cascade_fit = (cascade_fit == shadow_fit::stable) ? shadow_fit::tight : shadow_fit::stable;
+                std::cout << "Cascades fit " << (cascade_fit == shadow_fit::stable ? "stable" : "tight") << std::endl;
+            }
 
             break;
         case SDL_KEYUP:
-            button_down[event.key.keysym.sym] = false;
+            input.handle_event(event);
             break;
         }
 
         if (!running)
             break;
 
+        if (!programs_ready && programs.ready(program) && programs.ready(debug_program) && programs.ready(shadow_program))
+        {
+            setup_programs();
+            programs_ready = true;
+            startup.end(programs_stage);
+        }
+
+        if (!scene && scene_loading.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        {
+            scene = scene_loading.get();
+            upload_scene();
+        }
+
+        if (!splats && octree_loading.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        {
+            startup_trace::scope stage(startup, "upload point octree");
+            splats.emplace(programs, octree_loading.get(), width, height, point_splat_renderer::settings{});
+        }
+
+        if (!replay.update(input))
+            break;
+
+        frame_profiler.begin_frame();
+
         auto now = std::chrono::high_resolution_clock::now();
-        float dt = std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count();
+        float dt = replay.frame_time(std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame_start).count());
         last_frame_start = now;
         if (!paused)
             time += dt;
 
-        if (button_down[SDLK_UP])
+        profile_print_time += dt;
+        if (profile_print_time >= 1.f)
+        {
+            frame_profiler.print_summary(std::cout);
+            std::cout << "Shadow casters per cascade:";
+            for (int i = 0; i < cascade_count; ++i)
+                std::cout << ' ' << casters_drawn[i] / std::max<std::size_t>(1, stats_frames);
+            std::cout << " of " << (scene ? scene->caster_chunks.size() : 0) << ", shadow texels rendered: "
+                << 100.0 * texels_drawn / std::max<std::size_t>(1, stats_frames) / (cascade_count * shadow_map_resolution * shadow_map_resolution) << '%' << std::endl;
+            std::cout << "Scene chunks drawn: " << chunks_drawn / std::max<std::size_t>(1, stats_frames) << " of " << (scene ? scene->caster_chunks.size() : 0)
+                << (stereo ? ", for both eyes" : "") << std::endl;
+            if (point_splats && splats)
+                std::cout << "Splats: " << splat_stats.points << " points in " << splat_stats.nodes << " nodes, "
+                    << splat_stats.resident << " nodes resident, " << splat_stats.uploads << " uploaded" << std::endl;
+            std::fill(std::begin(casters_drawn), std::end(casters_drawn), 0);
+            texels_drawn = 0;
+            chunks_drawn = 0;
+            stats_frames = 0;
+            profile_print_time = 0.f;
+        }
+
+        if (input.down(SDL_SCANCODE_UP))
             camera_distance -= 1.f * dt;
-        if (button_down[SDLK_DOWN])
+        if (input.down(SDL_SCANCODE_DOWN))
             camera_distance += 1.f * dt;
 
-        if (button_down[SDLK_LEFT])
+        if (input.down(SDL_SCANCODE_LEFT))
             view_azimuth -= 2.f * dt;
-        if (button_down[SDLK_RIGHT])
+        if (input.down(SDL_SCANCODE_RIGHT))
             view_azimuth += 2.f * dt;
 
+        // Until they are ready a frame is just the clear, so that the window keeps presenting
+        if (!programs_ready || !scene)
+        {
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+            glViewport(0, 0, width, height);
+            glClearColor(0.8f, 0.8f, 0.9f, 0.f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            replay.end_frame();
+            SDL_GL_SwapWindow(window);
+            frame_profiler.end_frame();
+            continue;
+        }
+
         glm::mat4 model(1.f);
 
         glm::vec3 light_direction = glm::normalize(glm::vec3(std::cos(time * 0.5f), 1.f, std::sin(time * 0.5f)));
 
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadow_fbo);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        float near = 0.01f;
+        float far = 10.f;
+        float const fov_y = glm::pi<float>() / 2.f;
+
+        glm::mat4 view(1.f);
+        view = glm::translate(view, {0.f, 0.f, -camera_distance});
+        view = glm::rotate(view, view_elevation, {1.f, 0.f, 0.f});
+        view = glm::rotate(view, view_azimuth, {0.f, 1.f, 0.f});
+
+        glm::mat4 projection = glm::mat4(1.f);
+        projection = glm::perspective(fov_y, (1.f * width) / height, near, far);
+
+        // The eyes look the same way as the head, so their view depths, which pick the cascade,
+        // are the head's; the whole window's aspect covers both of them but for the first few
+        // centimetres in front
+        auto const cascades = fit_shadow_cascades(view, fov_y, (1.f * width) / height, near, far, light_direction, aabb(scene->min, scene->max), cascade_count, shadow_map_resolution, cascade_fit);
+
+        int const view_count = stereo ? 2 : 1;
+        auto const eyes = make_stereo_views(view, fov_y, (0.5f * width) / height, near, far, eye_separation);
+
+        // Written once and bound for the whole frame; the scene is the only object, and the
+        // same block serves both of its passes
+        uniforms.begin_frame();
+
+        frame_uniforms frame{};
+        for (int eye = 0; eye < view_count; ++eye)
+        {
+            frame.views[eye] = stereo ? eyes.views[eye] : view;
+            frame.projections[eye] = stereo ? eyes.projections[eye] : projection;
+        }
+        for (int i = 0; i < cascade_count; ++i)
+        {
+            frame.transforms[i] = cascades[i].transform;
+            frame.cascade_splits[i] = cascades[i].split;
+        }
+        frame.light_direction = light_direction;
+        frame.cascade_count = cascade_count;
+        frame.light_color = glm::vec3(0.8f);
+        frame.view_count = view_count;
+        frame.ambient = glm::vec3(0.2f);
+
+        std::size_t const frame_offset = uniforms.write(&frame, sizeof(frame), uniform_alignment);
+        glBindBufferRange(GL_UNIFORM_BUFFER, frame_data_binding, uniforms.buffer(), frame_offset, sizeof(frame));
+
+        object_uniforms scene_object{};
+        scene_object.model = model;
+        scene_object.position_offset = {scene->quantization.offset[0], scene->quantization.offset[1], scene->quantization.offset[2]};
+        scene_object.position_scale = {scene->quantization.scale[0], scene->quantization.scale[1], scene->quantization.scale[2]};
+
+        std::size_t const object_offset = uniforms.write(&scene_object, sizeof(scene_object), uniform_alignment);
+        glBindBufferRange(GL_UNIFORM_BUFFER, object_data_binding, uniforms.buffer(), object_offset, sizeof(scene_object));
+
+        frame_profiler.begin_gpu("shadow");
+
         glViewport(0, 0, shadow_map_resolution, shadow_map_resolution);
 
         glEnable(GL_DEPTH_TEST);
@@ -384,28 +886,84 @@ int main() try
         glEnable(GL_CULL_FACE);
         glCullFace(GL_BACK);
 
-        glm::vec3 light_z = -light_direction;
-        glm::vec3 light_x = glm::normalize(glm::cross(light_z, {0.f, 1.f, 0.f}));
-        glm::vec3 light_y = glm::cross(light_x, light_z);
-        float shadow_scale = 2.f;
+        glUseProgram(shadow_program);
+
+        glBindVertexArray(depth_vao);
 
-        glm::mat4 transform = glm::mat4(1.f);
-        for (size_t i = 0; i < 3; ++i)
+        if (!cache_shadows)
+            cascade_cache.invalidate();
+
+        // Index ranges of the chunks inside the frustum into caster_counts and caster_offsets;
+        // returns how many chunks there were
+        auto gather_chunks = [&](frustum const & bounds)
         {
-            transform[i][0] = shadow_scale * light_x[i];
-            transform[i][1] = shadow_scale * light_y[i];
-            transform[i][2] = shadow_scale * light_z[i];
-        }
+            caster_counts.clear();
+            caster_offsets.clear();
+            std::size_t count = 0;
+            std::uint32_t range_end = 0;
+            for (auto const & chunk : scene->caster_chunks)
+            {
+                if (!bounds.intersects(chunk.bounds))
+                    continue;
+
+                ++count;
+                if (!caster_counts.empty() && chunk.first_index == range_end)
+                    caster_counts.back() += chunk.index_count;
+                else
+                {
+                    caster_counts.push_back(chunk.index_count);
+                    caster_offsets.push_back(reinterpret_cast<void const *>(std::uintptr_t(chunk.first_index) * sizeof(std::uint32_t)));
+                }
+                range_end = chunk.first_index + chunk.index_count;
+            }
+            return count;
+        };
 
-        glUseProgram(shadow_program);
-        glUniformMatrix4fv(shadow_model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
-        glUniformMatrix4fv(shadow_transform_location, 1, GL_FALSE, reinterpret_cast<float *>(&transform));
+        for (int i = 0; i < cascade_count; ++i)
+        {
+            glm::mat4 transform = cascades[i].transform;
+            glUniform1i(shadow_cascade_location, i);
 
-        glBindVertexArray(vao);
-        glDrawElements(GL_TRIANGLES, scene.indices.size(), GL_UNSIGNED_INT, nullptr);
+            // Blits in update() would be scissored too
+            glDisable(GL_SCISSOR_TEST);
+            auto const regions = cascade_cache.update(i, transform);
+            glEnable(GL_SCISSOR_TEST);
+            if (!regions.empty())
+                moments_valid[i] = false;
+
+            for (auto const & region : regions)
+            {
+                glScissor(region.min.x, region.min.y, region.max.x - region.min.x, region.max.y - region.min.y);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                texels_drawn += std::size_t(region.max.x - region.min.x) * (region.max.y - region.min.y);
+
+                // The model matrix is the identity, so the chunk boxes are already in world space
+                casters_drawn[i] += gather_chunks(frustum(cascade_cache.region_transform(region, transform)));
+
+                if (!caster_counts.empty())
+                    glMultiDrawElements(GL_TRIANGLES, caster_counts.data(), GL_UNSIGNED_INT, caster_offsets.data(), caster_counts.size());
+            }
+        }
+        glDisable(GL_SCISSOR_TEST);
+        ++stats_frames;
+
+        if (variance_shadows)
+        {
+            bool moments_updated = false;
+            for (int i = 0; i < cascade_count; ++i)
+            {
+                if (moments_valid[i])
+                    continue;
+                cascade_moments.update(shadow_map, i);
+                moments_valid[i] = true;
+                moments_updated = true;
+            }
+            if (moments_updated)
+                cascade_moments.generate_mipmaps();
+        }
 
-        glBindTexture(GL_TEXTURE_2D, shadow_map);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        frame_profiler.end_gpu();
+        frame_profiler.begin_gpu("main");
 
         glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
         glViewport(0, 0, width, height);
@@ -419,40 +977,65 @@ int main() try
         glEnable(GL_CULL_FACE);
         glCullFace(GL_BACK);
 
-        float near = 0.01f;
-        float far = 10.f;
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, cascade_moments.texture());
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, shadow_map);
+        glBindSampler(0, shadow_sampler);
 
-        glm::mat4 view(1.f);
-        view = glm::translate(view, {0.f, 0.f, -camera_distance});
-        view = glm::rotate(view, view_elevation, {1.f, 0.f, 0.f});
-        view = glm::rotate(view, view_azimuth, {0.f, 1.f, 0.f});
+        glUseProgram(program);
+        glUniform1i(poisson_filter_location, poisson_filter ? 1 : 0);
+        glUniform1f(filter_radius_location, filter_radius);
+        glUniform1i(variance_shadows_location, variance_shadows ? 1 : 0);
+        glUniform1f(warp_exponent_location, cascade_moments.warp_exponent());
+
+        if (point_splats && splats)
+            splat_stats = splats->draw(view, projection, light_direction, frame.light_color, frame.ambient);
+        else
+        {
+            // The chunks are runs of the same triangles in the same order as the shadow pass's,
+            // so their ranges serve the full vertex format too; visible ones that are adjacent
+            // merge into a single draw
+            chunks_drawn += gather_chunks(frustum(stereo ? eyes.culling_view_projection : projection * view));
+
+            glEnable(GL_CLIP_DISTANCE0);
+            glBindVertexArray(vao);
+            for (std::size_t r = 0; r < caster_counts.size(); ++r)
+                glDrawElementsInstanced(GL_TRIANGLES, caster_counts[r], GL_UNSIGNED_INT, caster_offsets[r], view_count);
+            glDisable(GL_CLIP_DISTANCE0);
+        }
 
-        glm::mat4 projection = glm::mat4(1.f);
-        projection = glm::perspective(glm::pi<float>() / 2.f, (1.f * width) / height, near, far);
+        glUseProgram(debug_program);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, shadow_map);
+        glBindSampler(0, 0);
+        glBindVertexArray(debug_vao);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, cascade_count);
 
-        glBindTexture(GL_TEXTURE_2D, shadow_map);
+        uniforms.end_frame();
 
-        glUseProgram(program);
-        glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
-        glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
-        glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
-        glUniformMatrix4fv(transform_location, 1, GL_FALSE, reinterpret_cast<float *>(&transform));
+        frame_profiler.end_gpu();
 
-        glUniform3f(ambient_location, 0.2f, 0.2f, 0.2f);
-        glUniform3fv(light_direction_location, 1, reinterpret_cast<float *>(&light_direction));
-        glUniform3f(light_color_location, 0.8f, 0.8f, 0.8f);
+        replay.end_frame();
 
-        glBindVertexArray(vao);
-        glDrawElements(GL_TRIANGLES, scene.indices.size(), GL_UNSIGNED_INT, nullptr);
+        {
+            profiler::cpu_scope swap_scope(frame_profiler, "swap");
+            SDL_GL_SwapWindow(window);
+        }
 
-        glUseProgram(debug_program);
-        glBindTexture(GL_TEXTURE_2D, shadow_map);
-        glBindVertexArray(debug_vao);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+        frame_profiler.end_frame();
 
-        SDL_GL_SwapWindow(window);
+        if (!startup.marked("first complete frame"))
+        {
+            startup.mark("first complete frame");
+            startup.print(std::cout);
+            startup.write_chrome_trace("practice9_startup.json");
+        }
     }
 
+    frame_profiler.write_chrome_trace("practice9_trace.json");
+
+    replay.finish();
+
     SDL_GL_DeleteContext(gl_context);
     SDL_DestroyWindow(window);
 }
@@ -0,0 +1,384 @@
+#include "point_splats.hpp"
+#include "frustum.hpp"
+
+#include <glm/geometric.hpp>
+#include <glm/matrix.hpp>
+
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+#include <cstddef>
+
+namespace
+{
+
+    const char splat_vertex_shader_source[] =
+R"(#version 330 core
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform float radius;
+uniform float pixel_scale;
+uniform float max_point_size;
+
+layout (location = 0) in vec3 in_position;
+layout (location = 1) in vec2 in_normal;
+
+// In view space, but for world_normal
+flat out vec3 center;
+flat out vec3 normal;
+flat out vec3 world_normal;
+flat out float point_size;
+
+vec3 decode_normal(vec2 encoded)
+{
+    encoded = max(encoded / 32767.0, vec2(-1.0));
+    vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+    return normalize(n);
+}
+
+void main()
+{
+    world_normal = decode_normal(in_normal);
+    normal = mat3(view) * world_normal;
+    center = (view * vec4(in_position, 1.0)).xyz;
+    gl_Position = projection * vec4(center, 1.0);
+
+    // Discs facing away are moved out of the clip volume, which drops the point
+    if (dot(normal, center) > 0.0)
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+
+    point_size = clamp(2.0 * radius * pixel_scale / max(-center.z, 1e-4), 1.0, max_point_size);
+    gl_PointSize = point_size;
+}
+)";
+
+    // Every pixel of the sprite casts its view ray at the disc, so the depth is that of the
+    // disc where the pixel sees it rather than of its center
+    const char splat_fragment_shader_source[] =
+R"(#version 330 core
+
+uniform mat4 projection;
+uniform vec2 viewport_size;
+uniform float radius;
+uniform bool visibility;
+
+flat in vec3 center;
+flat in vec3 normal;
+flat in vec3 world_normal;
+flat in float point_size;
+
+layout (location = 0) out vec4 out_accumulation;
+
+void main()
+{
+    vec2 ndc = gl_FragCoord.xy / viewport_size * 2.0 - 1.0;
+    vec3 ray = vec3(ndc.x / projection[0][0], ndc.y / projection[1][1], -1.0);
+
+    float facing = dot(ray, normal);
+    if (abs(facing) < 1e-4)
+        discard;
+
+    vec3 position = ray * (dot(center, normal) / facing);
+    vec3 offset = position - center;
+    float d2 = dot(offset, offset) / (radius * radius);
+    if (d2 > 1.0)
+        discard;
+
+    // Pushed back by the radius, so that accumulation takes every disc near the nearest one
+    float z = visibility ? position.z - radius : position.z;
+    gl_FragDepth = (projection[2][2] * z + projection[3][2]) / -z * 0.5 + 0.5;
+
+    // Larger splats on screen weigh less, so that finer nodes win over the coarser ones they refine
+    float weight = exp(-2.0 * d2) / (point_size * point_size);
+    out_accumulation = vec4(world_normal * weight, weight);
+}
+)";
+
+    const char fullscreen_vertex_shader_source[] =
+R"(#version 330 core
+
+void main()
+{
+    vec2 position = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 4.0 - 1.0;
+    gl_Position = vec4(position, 0.0, 1.0);
+}
+)";
+
+    const char resolve_fragment_shader_source[] =
+R"(#version 330 core
+
+uniform sampler2D accumulation;
+uniform sampler2D visibility_depth;
+
+uniform vec3 light_direction;
+uniform vec3 light_color;
+uniform vec3 ambient;
+
+layout (location = 0) out vec4 out_color;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+
+    vec4 sum = texelFetch(accumulation, pixel, 0);
+    if (sum.a <= 0.0 || dot(sum.rgb, sum.rgb) == 0.0)
+        discard;
+
+    vec3 normal = normalize(sum.rgb);
+    vec3 color = ambient + light_color * max(0.0, dot(normal, light_direction));
+
+    out_color = vec4(color, 1.0);
+    gl_FragDepth = texelFetch(visibility_depth, pixel, 0).r;
+}
+)";
+
+}
+
+point_splat_renderer::point_splat_renderer(program_cache & programs, point_octree octree, int width, int height, settings const & s)
+    : octree_(std::move(octree))
+    , settings_(s)
+    , node_slots_(octree_.nodes.size(), -1)
+{
+    for (auto const & node : octree_.nodes)
+        slot_points_ = std::max(slot_points_, node.point_count);
+    slot_points_ = std::max<std::uint32_t>(1, slot_points_);
+
+    // Room for twice what a frame draws, so that nodes stay resident while the view moves
+    // around, but no more than the whole tree
+    std::size_t const slot_count = std::clamp<std::size_t>(2 * settings_.point_budget / slot_points_, 1, std::max<std::size_t>(1, octree_.nodes.size()));
+    slots_.resize(slot_count);
+
+    splat_program_ = programs.get({{GL_VERTEX_SHADER, splat_vertex_shader_source}, {GL_FRAGMENT_SHADER, splat_fragment_shader_source}});
+    resolve_program_ = programs.get({{GL_VERTEX_SHADER, fullscreen_vertex_shader_source}, {GL_FRAGMENT_SHADER, resolve_fragment_shader_source}});
+
+    glGenVertexArrays(1, &fullscreen_vao_);
+
+    // GL_ALIASED_POINT_SIZE_RANGE is not in the core profile
+    GLfloat point_size_range[2] = {1.f, 1.f};
+    glGetFloatv(GL_POINT_SIZE_RANGE, point_size_range);
+    max_point_size_ = std::min(64.f, point_size_range[1]);
+
+    glGenVertexArrays(1, &vao_);
+    glBindVertexArray(vao_);
+    glGenBuffers(1, &vbo_);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+    glBufferData(GL_ARRAY_BUFFER, slot_count * slot_points_ * sizeof(splat_point), nullptr, GL_DYNAMIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(splat_point), reinterpret_cast<void *>(offsetof(splat_point, position)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_SHORT, GL_FALSE, sizeof(splat_point), reinterpret_cast<void *>(offsetof(splat_point, normal)));
+
+    glGenFramebuffers(1, &fbo_);
+    glGenTextures(1, &depth_texture_);
+    glGenTextures(1, &accumulation_texture_);
+
+    resize(width, height);
+}
+
+point_splat_renderer::~point_splat_renderer()
+{
+    glDeleteFramebuffers(1, &fbo_);
+    glDeleteTextures(1, &depth_texture_);
+    glDeleteTextures(1, &accumulation_texture_);
+    glDeleteBuffers(1, &vbo_);
+    glDeleteVertexArrays(1, &vao_);
+    glDeleteVertexArrays(1, &fullscreen_vao_);
+}
+
+void point_splat_renderer::resize(int width, int height)
+{
+    width_ = std::max(1, width);
+    height_ = std::max(1, height);
+
+    glBindTexture(GL_TEXTURE_2D, depth_texture_);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width_, height_, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+
+    glBindTexture(GL_TEXTURE_2D, accumulation_texture_);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width_, height_, 0, GL_RGBA, GL_FLOAT, nullptr);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo_);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_texture_, 0);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, accumulation_texture_, 0);
+    if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        throw std::runtime_error("Incomplete splat framebuffer");
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+void point_splat_renderer::select(glm::mat4 const & view, glm::mat4 const & projection)
+{
+    selected_.clear();
+    missing_.clear();
+    heap_.clear();
+    if (octree_.nodes.empty())
+        return;
+
+    frustum const view_frustum(projection * view);
+    glm::vec3 const camera(glm::inverse(view)[3]);
+    float const pixel_scale = projection[1][1] * height_ / 2.f;
+
+    // Keyed by how many pixels apart the node's points land, measured from the nearest
+    // point of its bounding sphere
+    auto push = [&](std::uint32_t index)
+    {
+        auto const & node = octree_.nodes[index];
+        glm::vec3 const min(node.min[0], node.min[1], node.min[2]);
+        glm::vec3 const max = min + glm::vec3(node.size);
+        if (!view_frustum.intersects(aabb(min, max)))
+            return;
+
+        float const distance = std::max(glm::distance(camera, (min + max) / 2.f) - node.size * 0.8660254f, 1e-3f);
+        heap_.push_back({node.spacing * pixel_scale / distance, index});
+        std::push_heap(heap_.begin(), heap_.end());
+    };
+
+    push(0);
+
+    std::size_t points = 0;
+    while (!heap_.empty())
+    {
+        std::pop_heap(heap_.begin(), heap_.end());
+        auto const [pixels, index] = heap_.back();
+        heap_.pop_back();
+
+        // A smaller node further down the heap may still fit
+        auto const & node = octree_.nodes[index];
+        if (points + node.point_count > settings_.point_budget)
+            continue;
+
+        if (node_slots_[index] < 0)
+        {
+            missing_.push_back(index);
+            continue;
+        }
+
+        selected_.push_back(index);
+        points += node.point_count;
+        slots_[node_slots_[index]].last_used = frame_;
+
+        if (pixels > settings_.target_spacing)
+            for (std::uint32_t i = 0; i < node.child_count; ++i)
+                push(node.first_child + i);
+    }
+}
+
+std::size_t point_splat_renderer::upload()
+{
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+
+    // Coarsest first, as they were missed; they are drawn from next frame on
+    std::size_t i = 0;
+    for (; i < missing_.size() && i < settings_.uploads_per_frame; ++i)
+    {
+        // A free slot has never been used, so it goes before any the view has left behind;
+        // slots drawn this frame are never taken
+        auto it = std::min_element(slots_.begin(), slots_.end(), [](slot const & a, slot const & b){ return a.last_used < b.last_used; });
+        if (it->last_used >= frame_)
+            break;
+
+        if (it->node >= 0)
+            node_slots_[it->node] = -1;
+
+        std::size_t const slot_index = it - slots_.begin();
+        it->node = missing_[i];
+        it->last_used = frame_;
+        node_slots_[missing_[i]] = slot_index;
+
+        auto const points = octree_.node_points(octree_.nodes[missing_[i]]);
+        glBufferSubData(GL_ARRAY_BUFFER, slot_index * slot_points_ * sizeof(splat_point), points.size_bytes(), points.data());
+    }
+    return i;
+}
+
+void point_splat_renderer::draw_splats(glm::mat4 const & view, glm::mat4 const & projection, bool visibility)
+{
+    glUseProgram(splat_program_);
+    glUniformMatrix4fv(glGetUniformLocation(splat_program_, "view"), 1, GL_FALSE, reinterpret_cast<float const *>(&view));
+    glUniformMatrix4fv(glGetUniformLocation(splat_program_, "projection"), 1, GL_FALSE, reinterpret_cast<float const *>(&projection));
+    glUniform1f(glGetUniformLocation(splat_program_, "pixel_scale"), projection[1][1] * height_ / 2.f);
+    glUniform1f(glGetUniformLocation(splat_program_, "max_point_size"), max_point_size_);
+    glUniform2f(glGetUniformLocation(splat_program_, "viewport_size"), width_, height_);
+    glUniform1i(glGetUniformLocation(splat_program_, "visibility"), visibility ? 1 : 0);
+    GLint const radius_location = glGetUniformLocation(splat_program_, "radius");
+
+    glBindVertexArray(vao_);
+    for (auto index : selected_)
+    {
+        auto const & node = octree_.nodes[index];
+        glUniform1f(radius_location, node.spacing);
+        glDrawArrays(GL_POINTS, node_slots_[index] * slot_points_, node.point_count);
+    }
+}
+
+point_splat_renderer::stats point_splat_renderer::draw(glm::mat4 const & view, glm::mat4 const & projection,
+    glm::vec3 const & light_direction, glm::vec3 const & light_color, glm::vec3 const & ambient)
+{
+    ++frame_;
+
+    select(view, projection);
+
+    stats result{selected_.size(), 0, upload(), 0};
+    for (auto index : selected_)
+        result.points += octree_.nodes[index].point_count;
+    for (auto const & s : slots_)
+        if (s.node >= 0)
+            ++result.resident;
+
+    GLint target_framebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target_framebuffer);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo_);
+    glViewport(0, 0, width_, height_);
+    GLfloat const zero[4] = {0.f, 0.f, 0.f, 0.f};
+    GLfloat const one = 1.f;
+    glClearBufferfv(GL_COLOR, 0, zero);
+    glClearBufferfv(GL_DEPTH, 0, &one);
+
+    glEnable(GL_PROGRAM_POINT_SIZE);
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_DEPTH_TEST);
+
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDisable(GL_BLEND);
+    draw_splats(view, projection, true);
+
+    glDepthFunc(GL_LEQUAL);
+    glDepthMask(GL_FALSE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    draw_splats(view, projection, false);
+
+    glDisable(GL_BLEND);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_PROGRAM_POINT_SIZE);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target_framebuffer);
+
+    glUseProgram(resolve_program_);
+    glUniform1i(glGetUniformLocation(resolve_program_, "accumulation"), 0);
+    glUniform1i(glGetUniformLocation(resolve_program_, "visibility_depth"), 1);
+    glUniform3fv(glGetUniformLocation(resolve_program_, "light_direction"), 1, &light_direction[0]);
+    glUniform3fv(glGetUniformLocation(resolve_program_, "light_color"), 1, &light_color[0]);
+    glUniform3fv(glGetUniformLocation(resolve_program_, "ambient"), 1, &ambient[0]);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindSampler(1, 0);
+    glBindTexture(GL_TEXTURE_2D, depth_texture_);
+    glActiveTexture(GL_TEXTURE0);
+    glBindSampler(0, 0);
+    glBindTexture(GL_TEXTURE_2D, accumulation_texture_);
+
+    glBindVertexArray(fullscreen_vao_);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    return result;
+}
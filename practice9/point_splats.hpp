@@ -0,0 +1,98 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+#include "point_octree.hpp"
+#include "program_cache.hpp"
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+// Draws a point_octree as oriented discs, each sized by the spacing of its node, in two
+// passes so that the overlapping splats of one surface blend instead of fighting for depth:
+// the visibility pass keeps the depth of the nearest disc pushed back by its radius, and the
+// accumulation pass adds up the Gaussian-weighted normals of every disc in front of that,
+// which the resolve pass normalizes and shades.
+//
+// Nodes are picked every frame by how far apart their points land on screen, the coarsest
+// first, refining until that is under target_spacing pixels or the point budget is spent, so
+// the frame never draws more than point_budget points. Their points are paged from the
+// octree into fixed-size slots of one vertex buffer, a few nodes per frame, evicting the
+// least recently drawn; a node that is not resident yet is drawn as its ancestors.
+struct point_splat_renderer
+{
+    struct settings
+    {
+        std::size_t point_budget = 1 << 20;
+        float target_spacing = 1.5f;
+        std::size_t uploads_per_frame = 8;
+    };
+
+    // The programs are owned by the cache
+    point_splat_renderer(program_cache & programs, point_octree octree, int width, int height, settings const & s);
+    ~point_splat_renderer();
+
+    point_splat_renderer(point_splat_renderer const &) = delete;
+    point_splat_renderer & operator = (point_splat_renderer const &) = delete;
+
+    void resize(int width, int height);
+
+    struct stats
+    {
+        std::size_t nodes;
+        std::size_t points;
+        std::size_t uploads;
+        std::size_t resident;
+    };
+
+    // Positions are in world space. Shades into the framebuffer bound at the call, writing
+    // its depth; changes the viewport, blending and depth state
+    stats draw(glm::mat4 const & view, glm::mat4 const & projection, glm::vec3 const & light_direction, glm::vec3 const & light_color, glm::vec3 const & ambient);
+
+private:
+    struct slot
+    {
+        std::int32_t node = -1;
+        std::uint64_t last_used = 0;
+    };
+
+    point_octree octree_;
+    settings settings_;
+
+    int width_ = 0;
+    int height_ = 0;
+
+    std::uint32_t slot_points_ = 0;
+    std::vector<slot> slots_;
+    std::vector<std::int32_t> node_slots_;
+    std::uint64_t frame_ = 0;
+
+    // Per frame, kept to reuse their storage
+    std::vector<std::uint32_t> selected_;
+    std::vector<std::uint32_t> missing_;
+    std::vector<std::pair<float, std::uint32_t>> heap_;
+
+    GLuint vao_ = 0;
+    GLuint vbo_ = 0;
+
+    GLuint fbo_ = 0;
+    GLuint depth_texture_ = 0;
+    GLuint accumulation_texture_ = 0;
+
+    // Both splat passes run the same program, told apart by its visibility uniform
+    GLuint splat_program_ = 0;
+    GLuint resolve_program_ = 0;
+    GLuint fullscreen_vao_ = 0;
+
+    // The largest point size the implementation rasterizes, queried once
+    float max_point_size_ = 1.f;
+
+    void select(glm::mat4 const & view, glm::mat4 const & projection);
+    // Returns the number of nodes uploaded
+    std::size_t upload();
+    void draw_splats(glm::mat4 const & view, glm::mat4 const & projection, bool visibility);
+};
@@ -0,0 +1,126 @@
+#include "shadow_cache.hpp"
+
+#include <glm/common.hpp>
+
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace
+{
+
+    // How far a translation may be from whole texels and still count as them
+    constexpr float snap_tolerance = 1e-2f;
+
+}
+
+shadow_cache::shadow_cache(GLuint shadow_map, int resolution, int layer_count)
+    : resolution_(resolution)
+    , layers_(layer_count)
+{
+    for (int i = 0; i < layer_count; ++i)
+    {
+        glGenFramebuffers(1, &layers_[i].fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, layers_[i].fbo);
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadow_map, 0, i);
+        if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            throw std::runtime_error("Incomplete framebuffer!");
+    }
+
+    glGenTextures(1, &scratch_texture_);
+    glBindTexture(GL_TEXTURE_2D, scratch_texture_);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, resolution, resolution, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+
+    glGenFramebuffers(1, &scratch_fbo_);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, scratch_fbo_);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, scratch_texture_, 0);
+    if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        throw std::runtime_error("Incomplete framebuffer!");
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+shadow_cache::~shadow_cache()
+{
+    for (auto & l : layers_)
+        glDeleteFramebuffers(1, &l.fbo);
+    glDeleteFramebuffers(1, &scratch_fbo_);
+    glDeleteTextures(1, &scratch_texture_);
+}
+
+void shadow_cache::invalidate()
+{
+    for (auto & l : layers_)
+        l.valid = false;
+}
+
+std::vector<shadow_cache::region> shadow_cache::update(int index, glm::mat4 const & transform)
+{
+    auto & l = layers_[index];
+    region const whole{{0, 0}, {resolution_, resolution_}};
+
+    bool same_projection = l.valid;
+    for (int c = 0; c < 3 && same_projection; ++c)
+        same_projection = (l.transform[c] == transform[c]);
+    same_projection = same_projection && (l.transform[3][2] == transform[3][2]);
+
+    // Content at texel u moves to u + shift
+    float const shift_x = (transform[3][0] - l.transform[3][0]) * resolution_ / 2.f;
+    float const shift_y = (transform[3][1] - l.transform[3][1]) * resolution_ / 2.f;
+    glm::ivec2 const shift(std::lround(shift_x), std::lround(shift_y));
+
+    bool const scrollable = same_projection
+        && std::abs(shift_x - shift.x) < snap_tolerance && std::abs(shift_y - shift.y) < snap_tolerance
+        && std::abs(shift.x) < resolution_ && std::abs(shift.y) < resolution_;
+
+    l.valid = true;
+    l.transform = transform;
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, l.fbo);
+
+    if (!scrollable)
+        return {whole};
+    if (shift == glm::ivec2(0))
+        return {};
+
+    // The overlap, in the old texel coordinates
+    glm::ivec2 const src_min = glm::max(glm::ivec2(0), -shift);
+    glm::ivec2 const src_max = glm::min(glm::ivec2(resolution_), glm::ivec2(resolution_) - shift);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, l.fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, scratch_fbo_);
+    glBlitFramebuffer(src_min.x, src_min.y, src_max.x, src_max.y, src_min.x, src_min.y, src_max.x, src_max.y, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, scratch_fbo_);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, l.fbo);
+    glBlitFramebuffer(src_min.x, src_min.y, src_max.x, src_max.y,
+        src_min.x + shift.x, src_min.y + shift.y, src_max.x + shift.x, src_max.y + shift.y, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+    // A column strip and a row strip uncovered by the shift
+    std::vector<region> result;
+    if (shift.x > 0)
+        result.push_back({{0, 0}, {shift.x, resolution_}});
+    else if (shift.x < 0)
+        result.push_back({{resolution_ + shift.x, 0}, {resolution_, resolution_}});
+    if (shift.y > 0)
+        result.push_back({{0, 0}, {resolution_, shift.y}});
+    else if (shift.y < 0)
+        result.push_back({{0, resolution_ + shift.y}, {resolution_, resolution_}});
+    return result;
+}
+
+glm::mat4 shadow_cache::region_transform(region const & r, glm::mat4 const & transform) const
+{
+    glm::vec2 const min = glm::vec2(r.min) * 2.f / float(resolution_) - 1.f;
+    glm::vec2 const max = glm::vec2(r.max) * 2.f / float(resolution_) - 1.f;
+
+    glm::mat4 crop(1.f);
+    crop[0][0] = 2.f / (max.x - min.x);
+    crop[1][1] = 2.f / (max.y - min.y);
+    crop[3][0] = -(max.x + min.x) / (max.x - min.x);
+    crop[3][1] = -(max.y + min.y) / (max.y - min.y);
+    return crop * transform;
+}
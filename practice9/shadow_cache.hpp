@@ -0,0 +1,56 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm/vec2.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <vector>
+
+// Keeps the depth of static casters in every layer of a shadow map array between frames.
+// A cascade whose transform is unchanged needs no rendering; one that only moved by whole
+// texels, as snapped cascades do when the camera moves, has its depth shifted over and
+// only the newly exposed strips rendered. Anything else, like a turning light, needs the
+// whole layer again.
+struct shadow_cache
+{
+    // A texel rectangle of a layer, [min, max)
+    struct region
+    {
+        glm::ivec2 min;
+        glm::ivec2 max;
+    };
+
+    shadow_cache(GLuint shadow_map, int resolution, int layer_count);
+    ~shadow_cache();
+
+    shadow_cache(shadow_cache const &) = delete;
+    shadow_cache & operator = (shadow_cache const &) = delete;
+
+    // For when static geometry changes
+    void invalidate();
+
+    // Returns the regions of the layer that have to be rendered with the new transform; the
+    // caller renders them, scissored, into framebuffer(layer). Leaves that framebuffer bound.
+    std::vector<region> update(int layer, glm::mat4 const & transform);
+
+    GLuint framebuffer(int layer) const { return layers_[layer].fbo; }
+
+    // Maps the region to the whole clip space, for culling casters against just that region
+    glm::mat4 region_transform(region const & r, glm::mat4 const & transform) const;
+
+private:
+    struct layer
+    {
+        GLuint fbo = 0;
+        bool valid = false;
+        glm::mat4 transform{1.f};
+    };
+
+    int resolution_;
+    std::vector<layer> layers_;
+
+    // Scrolling goes through here, as a blit within one texture may not overlap
+    GLuint scratch_texture_ = 0;
+    GLuint scratch_fbo_ = 0;
+};
@@ -0,0 +1,202 @@
+#include "shadow_cascades.hpp"
+
+#include <glm/geometric.hpp>
+#include <glm/matrix.hpp>
+#include <glm/common.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+namespace
+{
+
+    // Planes as (n, d) with dot(n, p) + d >= 0 on the inside
+    std::vector<glm::vec3> clip_polygon(std::vector<glm::vec3> polygon, glm::vec4 const * planes, int plane_count)
+    {
+        std::vector<glm::vec3> clipped;
+        for (int p = 0; p < plane_count && !polygon.empty(); ++p)
+        {
+            clipped.clear();
+            for (std::size_t i = 0; i < polygon.size(); ++i)
+            {
+                glm::vec3 const & a = polygon[i];
+                glm::vec3 const & b = polygon[(i + 1) % polygon.size()];
+                float const da = glm::dot(glm::vec3(planes[p]), a) + planes[p].w;
+                float const db = glm::dot(glm::vec3(planes[p]), b) + planes[p].w;
+                if (da >= 0.f)
+                    clipped.push_back(a);
+                if ((da >= 0.f) != (db >= 0.f))
+                    clipped.push_back(glm::mix(a, b, da / (da - db)));
+            }
+            std::swap(polygon, clipped);
+        }
+        return polygon;
+    }
+
+    // Corner bits are x, y and z of the box, or x, y and far of a frustum slice
+    int const box_faces[6][4] = {{0, 2, 3, 1}, {4, 5, 7, 6}, {0, 4, 6, 2}, {1, 3, 7, 5}, {0, 1, 5, 4}, {2, 6, 7, 3}};
+
+    // The vertices of the intersection of two convex hexahedra: each one's faces clipped by
+    // the other's planes
+    std::vector<glm::vec3> intersect_hexahedra(glm::vec3 const (& a)[8], glm::vec3 const (& b)[8])
+    {
+        auto planes_of = [](glm::vec3 const (& corners)[8], glm::vec4 (& planes)[6])
+        {
+            glm::vec3 center(0.f);
+            for (auto const & c : corners)
+                center += c / 8.f;
+            for (int f = 0; f < 6; ++f)
+            {
+                glm::vec3 const & p0 = corners[box_faces[f][0]];
+                glm::vec3 n = glm::normalize(glm::cross(corners[box_faces[f][1]] - p0, corners[box_faces[f][3]] - p0));
+                if (glm::dot(n, center - p0) < 0.f)
+                    n = -n;
+                planes[f] = glm::vec4(n, -glm::dot(n, p0));
+            }
+        };
+
+        glm::vec4 a_planes[6], b_planes[6];
+        planes_of(a, a_planes);
+        planes_of(b, b_planes);
+
+        std::vector<glm::vec3> result;
+        for (int f = 0; f < 6; ++f)
+        {
+            for (auto const & [corners, planes] : {std::pair{&a, b_planes}, std::pair{&b, a_planes}})
+            {
+                auto const polygon = clip_polygon({(*corners)[box_faces[f][0]], (*corners)[box_faces[f][1]], (*corners)[box_faces[f][2]], (*corners)[box_faces[f][3]]}, planes, 6);
+                result.insert(result.end(), polygon.begin(), polygon.end());
+            }
+        }
+        return result;
+    }
+
+}
+
+std::vector<shadow_cascade> fit_shadow_cascades(glm::mat4 const & view, float fov_y, float aspect, float near, float far,
+    glm::vec3 const & light_direction, aabb const & scene_bounds, int cascade_count, int resolution, shadow_fit fit, float split_lambda)
+{
+    glm::mat4 const view_inverse = glm::inverse(view);
+    float const tan_y = std::tan(fov_y / 2.f);
+    float const tan_x = tan_y * aspect;
+
+    // Same light basis as the single shadow map used
+    glm::vec3 const light_z = -light_direction;
+    glm::vec3 const light_x = glm::normalize(glm::cross(light_z, {0.f, 1.f, 0.f}));
+    glm::vec3 const light_y = glm::cross(light_x, light_z);
+
+    float depth_min = std::numeric_limits<float>::infinity();
+    float depth_max = -depth_min;
+    glm::vec3 scene_corners[8];
+    for (int c = 0; c < 8; ++c)
+    {
+        scene_corners[c] = glm::vec3(c & 1 ? scene_bounds.max.x : scene_bounds.min.x, c & 2 ? scene_bounds.max.y : scene_bounds.min.y, c & 4 ? scene_bounds.max.z : scene_bounds.min.z);
+        depth_min = std::min(depth_min, glm::dot(scene_corners[c], light_z));
+        depth_max = std::max(depth_max, glm::dot(scene_corners[c], light_z));
+    }
+
+    std::vector<shadow_cascade> result;
+
+    float slice_near = near;
+    for (int i = 0; i < cascade_count; ++i)
+    {
+        float const t = float(i + 1) / cascade_count;
+        float const slice_far = split_lambda * near * std::pow(far / near, t) + (1.f - split_lambda) * (near + (far - near) * t);
+
+        glm::vec3 corners[8];
+        for (int c = 0; c < 8; ++c)
+        {
+            float const d = (c & 4) ? slice_far : slice_near;
+            glm::vec4 const p((c & 1 ? 1.f : -1.f) * tan_x * d, (c & 2 ? 1.f : -1.f) * tan_y * d, -d, 1.f);
+            corners[c] = glm::vec3(view_inverse * p);
+        }
+
+        // Light space rectangle as a center and half sizes, and the far end of the depth range
+        glm::vec2 center_xy;
+        glm::vec2 half_size;
+        float receiver_depth_max = depth_max;
+
+        auto const receivers = fit == shadow_fit::tight ? intersect_hexahedra(corners, scene_corners) : std::vector<glm::vec3>{};
+        if (!receivers.empty())
+        {
+            glm::vec2 min(std::numeric_limits<float>::infinity());
+            glm::vec2 max(-std::numeric_limits<float>::infinity());
+            receiver_depth_max = -std::numeric_limits<float>::infinity();
+            for (auto const & p : receivers)
+            {
+                glm::vec2 const q(glm::dot(p, light_x), glm::dot(p, light_y));
+                min = glm::min(min, q);
+                max = glm::max(max, q);
+                receiver_depth_max = std::max(receiver_depth_max, glm::dot(p, light_z));
+            }
+
+            // A texel of margin for the snapping, then rounded up like the radius below
+            center_xy = (min + max) / 2.f;
+            half_size = glm::max(glm::ceil((max - min) / 2.f * (1.f + 2.f / resolution) * 64.f) / 64.f, glm::vec2(1.f / 64.f));
+        }
+        else
+        {
+            // The sphere through the slice depends only on the slice, not on the camera orientation;
+            // the centre lies on the view axis, where it is equidistant to the near and far corners
+            float const diagonal2 = tan_x * tan_x + tan_y * tan_y;
+            float const center_depth = std::min(slice_far, (slice_near + slice_far) / 2.f * (1.f + diagonal2));
+            glm::vec3 const center = glm::vec3(view_inverse * glm::vec4(0.f, 0.f, -center_depth, 1.f));
+
+            float radius = 0.f;
+            for (auto const & corner : corners)
+                radius = std::max(radius, glm::length(corner - center));
+            // Rounding keeps float noise from changing the texel size from frame to frame
+            radius = std::ceil(radius * 64.f) / 64.f;
+
+            center_xy = glm::vec2(glm::dot(center, light_x), glm::dot(center, light_y));
+            half_size = glm::vec2(radius);
+        }
+
+        glm::vec2 const texel = 2.f * half_size / float(resolution);
+        glm::vec2 const snapped = glm::floor(center_xy / texel) * texel;
+
+        float const depth_center = (depth_min + receiver_depth_max) / 2.f;
+        float const depth_half = std::max((receiver_depth_max - depth_min) / 2.f, 1e-4f);
+
+        glm::mat4 transform(1.f);
+        for (int k = 0; k < 3; ++k)
+        {
+            transform[k][0] = light_x[k] / half_size.x;
+            transform[k][1] = light_y[k] / half_size.y;
+            transform[k][2] = light_z[k] / depth_half;
+        }
+        transform[3][0] = -snapped.x / half_size.x;
+        transform[3][1] = -snapped.y / half_size.y;
+        transform[3][2] = -depth_center / depth_half;
+
+        result.push_back({transform, slice_far});
+        slice_near = slice_far;
+    }
+
+    return result;
+}
+
+std::vector<caster_chunk> build_caster_chunks(std::vector<glm::vec3> const & positions, std::vector<std::uint32_t> const & indices, std::size_t triangles_per_chunk)
+{
+    std::vector<caster_chunk> result;
+
+    std::size_t const chunk_indices = triangles_per_chunk * 3;
+    for (std::size_t first = 0; first < indices.size(); first += chunk_indices)
+    {
+        std::size_t const last = std::min(indices.size(), first + chunk_indices);
+
+        glm::vec3 min(std::numeric_limits<float>::infinity());
+        glm::vec3 max(-std::numeric_limits<float>::infinity());
+        for (std::size_t i = first; i < last; ++i)
+        {
+            min = glm::min(min, positions[indices[i]]);
+            max = glm::max(max, positions[indices[i]]);
+        }
+
+        result.push_back({std::uint32_t(first), std::uint32_t(last - first), aabb(min, max)});
+    }
+
+    return result;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "aabb.hpp"
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <vector>
+#include <cstdint>
+
+struct shadow_cascade
+{
+    // World space to the cascade's shadow clip space
+    glm::mat4 transform;
+    // View-space distance where the next cascade takes over
+    float split;
+};
+
+enum class shadow_fit
+{
+    // Sized by the slice's bounding sphere, so it never changes size when the camera turns
+    stable,
+    // Just the part of the slice inside scene_bounds, where receivers can be; more texels
+    // land on them, but the size follows the camera, so edges shimmer as it turns and the
+    // shadow cache has to render the whole layer again
+    tight,
+};
+
+// Splits [near, far] between a logarithmic and a uniform distribution, weighted by split_lambda,
+// and fits an orthographic light frustum around every slice of the view frustum, its offset
+// snapped to whole shadow map texels so that it does not shimmer when the camera moves.
+// Along the light it reaches back to the end of scene_bounds towards the light, so casters
+// outside the slice still count; the stable fit reaches past the receivers to the far end
+// of the scene too, the tight one stops at the farthest receiver.
+std::vector<shadow_cascade> fit_shadow_cascades(glm::mat4 const & view, float fov_y, float aspect, float near, float far,
+    glm::vec3 const & light_direction, aabb const & scene_bounds, int cascade_count, int resolution,
+    shadow_fit fit = shadow_fit::stable, float split_lambda = 0.75f);
+
+// A run of consecutive triangles with their bounding box, culled as one shadow caster
+struct caster_chunk
+{
+    std::uint32_t first_index;
+    std::uint32_t index_count;
+    aabb bounds;
+};
+
+std::vector<caster_chunk> build_caster_chunks(std::vector<glm::vec3> const & positions, std::vector<std::uint32_t> const & indices, std::size_t triangles_per_chunk = 512);
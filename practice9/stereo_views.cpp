@@ -0,0 +1,30 @@
+#include "stereo_views.hpp"
+
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/ext/matrix_clip_space.hpp>
+
+#include <cmath>
+
+stereo_views make_stereo_views(glm::mat4 const & head_view, float fov_y, float eye_aspect, float near, float far, float eye_separation)
+{
+    stereo_views result;
+
+    float const half_separation = eye_separation / 2.f;
+    glm::mat4 const projection = glm::perspective(fov_y, eye_aspect, near, far);
+
+    // The left eye sits at -x in head space, so the world moves the other way in its view
+    result.views[0] = glm::translate(glm::mat4(1.f), {half_separation, 0.f, 0.f}) * head_view;
+    result.views[1] = glm::translate(glm::mat4(1.f), {-half_separation, 0.f, 0.f}) * head_view;
+    result.projections[0] = projection;
+    result.projections[1] = projection;
+
+    // The left plane of the left eye is x = -half_separation - tan_x * depth, which passes
+    // through the head's axis at depth -half_separation / tan_x, behind the eyes
+    float const tan_x = std::tan(fov_y / 2.f) * eye_aspect;
+    float const apex_offset = half_separation / tan_x;
+
+    glm::mat4 const culling_view = glm::translate(glm::mat4(1.f), {0.f, 0.f, -apex_offset}) * head_view;
+    result.culling_view_projection = glm::perspective(fov_y, eye_aspect, near + apex_offset, far + apex_offset) * culling_view;
+
+    return result;
+}
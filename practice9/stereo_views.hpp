@@ -0,0 +1,20 @@
+#pragma once
+
+#include <glm/mat4x4.hpp>
+
+// The two eyes of a head-mounted display, as parallel cameras eye_separation apart along the
+// head's x axis, each with a symmetric projection of its own half of the window.
+struct stereo_views
+{
+    // Left, then right
+    glm::mat4 views[2];
+    glm::mat4 projections[2];
+
+    // One frustum around both eyes' ones, for culling once for the two of them: the apex moves
+    // back behind the head until the outer planes of the eyes' frusta become its side planes,
+    // and its near and far planes stay where theirs are
+    glm::mat4 culling_view_projection;
+};
+
+// eye_aspect is the aspect ratio of one eye's half of the window
+stereo_views make_stereo_views(glm::mat4 const & head_view, float fov_y, float eye_aspect, float near, float far, float eye_separation);
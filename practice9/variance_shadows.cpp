@@ -0,0 +1,172 @@
+#include "variance_shadows.hpp"
+
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+
+    const char fullscreen_vertex_shader_source[] =
+R"(#version 330 core
+
+void main()
+{
+    vec2 position = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 4.0 - 1.0;
+    gl_Position = vec4(position, 0.0, 1.0);
+}
+)";
+
+    // Each moments texel covers 2x2 depth texels
+    const char moments_fragment_shader_source[] =
+R"(#version 330 core
+
+uniform sampler2DArray depth_map;
+uniform int layer;
+uniform float warp_exponent;
+
+layout (location = 0) out vec2 out_moments;
+
+void main()
+{
+    ivec2 base = ivec2(gl_FragCoord.xy) * 2;
+    vec2 moments = vec2(0.0);
+    for (int y = 0; y < 2; ++y)
+        for (int x = 0; x < 2; ++x)
+        {
+            float depth = texelFetch(depth_map, ivec3(base + ivec2(x, y), layer), 0).r;
+            if (warp_exponent > 0.0)
+                depth = exp(warp_exponent * depth);
+            moments += vec2(depth, depth * depth);
+        }
+    out_moments = moments / 4.0;
+}
+)";
+
+    const char blur_fragment_shader_source[] =
+R"(#version 330 core
+
+uniform sampler2DArray source;
+uniform int layer;
+uniform ivec2 direction;
+uniform int radius;
+
+layout (location = 0) out vec2 out_moments;
+
+void main()
+{
+    ivec2 size = textureSize(source, 0).xy;
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+
+    float sigma = max(float(radius) / 2.0, 0.5);
+    vec2 sum = vec2(0.0);
+    float total = 0.0;
+    for (int i = -radius; i <= radius; ++i)
+    {
+        float weight = exp(-float(i * i) / (2.0 * sigma * sigma));
+        sum += weight * texelFetch(source, ivec3(clamp(pixel + direction * i, ivec2(0), size - 1), layer), 0).rg;
+        total += weight;
+    }
+    out_moments = sum / total;
+}
+)";
+
+    void attach_layer(GLuint fbo, GLuint texture, int layer)
+    {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0, layer);
+        if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            throw std::runtime_error("Incomplete framebuffer!");
+    }
+
+}
+
+variance_shadow_map::variance_shadow_map(program_cache & programs, int depth_resolution, int layer_count, int blur_radius, float warp_exponent)
+    : resolution_(depth_resolution / 2)
+    , blur_radius_(blur_radius)
+    , warp_exponent_(warp_exponent)
+    , layer_fbos_(layer_count)
+{
+    moments_program_ = programs.get({{GL_VERTEX_SHADER, fullscreen_vertex_shader_source}, {GL_FRAGMENT_SHADER, moments_fragment_shader_source}});
+    blur_program_ = programs.get({{GL_VERTEX_SHADER, fullscreen_vertex_shader_source}, {GL_FRAGMENT_SHADER, blur_fragment_shader_source}});
+
+    glGenVertexArrays(1, &vao_);
+
+    glGenTextures(1, &moments_);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, moments_);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RG32F, resolution_, resolution_, layer_count, 0, GL_RG, GL_FLOAT, nullptr);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+    // A one-layer array, so that both blur passes read through the same sampler type
+    glGenTextures(1, &scratch_);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, scratch_);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RG32F, resolution_, resolution_, 1, 0, GL_RG, GL_FLOAT, nullptr);
+
+    glGenFramebuffers(layer_count, layer_fbos_.data());
+    for (int i = 0; i < layer_count; ++i)
+        attach_layer(layer_fbos_[i], moments_, i);
+
+    glGenFramebuffers(1, &scratch_fbo_);
+    attach_layer(scratch_fbo_, scratch_, 0);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+variance_shadow_map::~variance_shadow_map()
+{
+    glDeleteFramebuffers(layer_fbos_.size(), layer_fbos_.data());
+    glDeleteFramebuffers(1, &scratch_fbo_);
+    glDeleteTextures(1, &moments_);
+    glDeleteTextures(1, &scratch_);
+    glDeleteVertexArrays(1, &vao_);
+}
+
+void variance_shadow_map::update(GLuint depth_map, int layer)
+{
+    glViewport(0, 0, resolution_, resolution_);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_SCISSOR_TEST);
+    glBindVertexArray(vao_);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindSampler(0, 0);
+
+    glUseProgram(moments_program_);
+    glUniform1i(glGetUniformLocation(moments_program_, "depth_map"), 0);
+    glUniform1i(glGetUniformLocation(moments_program_, "layer"), layer);
+    glUniform1f(glGetUniformLocation(moments_program_, "warp_exponent"), warp_exponent_);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, depth_map);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, layer_fbos_[layer]);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glUseProgram(blur_program_);
+    glUniform1i(glGetUniformLocation(blur_program_, "source"), 0);
+    glUniform1i(glGetUniformLocation(blur_program_, "radius"), blur_radius_);
+
+    // Neither pass reads the texture it writes to
+    glUniform1i(glGetUniformLocation(blur_program_, "layer"), layer);
+    glUniform2i(glGetUniformLocation(blur_program_, "direction"), 1, 0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, moments_);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, scratch_fbo_);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glUniform1i(glGetUniformLocation(blur_program_, "layer"), 0);
+    glUniform2i(glGetUniformLocation(blur_program_, "direction"), 0, 1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, scratch_);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, layer_fbos_[layer]);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+void variance_shadow_map::generate_mipmaps()
+{
+    glBindTexture(GL_TEXTURE_2D_ARRAY, moments_);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "program_cache.hpp"
+
+#include <GL/glew.h>
+
+#include <vector>
+
+// Moments of the (optionally exponentially warped) shadow depth, kept at half the depth map
+// resolution in an RG32F array with mipmaps. Blurring the moments gives soft shadows whose
+// lookup cost does not depend on the penumbra width: a single filtered fetch and Chebyshev's
+// inequality stand in for a PCF kernel of any size.
+struct variance_shadow_map
+{
+    // warp_exponent > 0 stores moments of exp(warp_exponent * depth), which reduces light bleeding.
+    // The programs are owned by the cache
+    variance_shadow_map(program_cache & programs, int depth_resolution, int layer_count, int blur_radius = 4, float warp_exponent = 40.f);
+    ~variance_shadow_map();
+
+    variance_shadow_map(variance_shadow_map const &) = delete;
+    variance_shadow_map & operator = (variance_shadow_map const &) = delete;
+
+    // Recomputes one layer from the same layer of a depth array; call generate_mipmaps()
+    // after the last layer of the frame. Changes the viewport and the bound framebuffer.
+    void update(GLuint depth_map, int layer);
+    void generate_mipmaps();
+
+    GLuint texture() const { return moments_; }
+    float warp_exponent() const { return warp_exponent_; }
+
+private:
+    int resolution_;
+    int blur_radius_;
+    float warp_exponent_;
+
+    GLuint moments_ = 0;
+    std::vector<GLuint> layer_fbos_;
+
+    // Holds the horizontally blurred layer between the two blur passes
+    GLuint scratch_ = 0;
+    GLuint scratch_fbo_ = 0;
+
+    GLuint moments_program_ = 0;
+    GLuint blur_program_ = 0;
+    GLuint vao_ = 0;
+};
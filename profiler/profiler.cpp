@@ -0,0 +1,354 @@
+#include "profiler.hpp"
+#include "debug_output.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+
+    // Bounds the memory used by the trace on long runs
+    constexpr std::size_t max_trace_events = 1 << 20;
+
+    struct statistic
+    {
+        GLenum target;
+        char const * suffix;
+    };
+
+    constexpr std::array<statistic, 3> statistics = {{
+        {GL_VERTEX_SHADER_INVOCATIONS_ARB, " vertices"},
+        {GL_CLIPPING_OUTPUT_PRIMITIVES_ARB, " clipped primitives"},
+        {GL_FRAGMENT_SHADER_INVOCATIONS_ARB, " fragments"},
+    }};
+
+    // Scope and counter names are arbitrary strings, which a JSON string may not hold as is
+    struct json_string
+    {
+        std::string_view text;
+    };
+
+    std::ostream & operator << (std::ostream & os, json_string s)
+    {
+        os << '"';
+        for (char c : s.text)
+        {
+            switch (c)
+            {
+            case '"': os << "\\\""; break;
+            case '\\': os << "\\\\"; break;
+            case '\n': os << "\\n"; break;
+            case '\t': os << "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20)
+                    os << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec << std::setfill(' ');
+                else
+                    os << c;
+            }
+        }
+        return os << '"';
+    }
+
+}
+
+profiler::profiler(std::size_t frames_in_flight)
+    : start_(clock::now())
+    , frames_(frames_in_flight)
+{
+    if (frames_in_flight == 0)
+        throw std::runtime_error("Profiler needs at least one frame in flight");
+
+    statistics_supported_ = GLEW_ARB_pipeline_statistics_query;
+}
+
+void profiler::begin_frame()
+{
+    auto & f = frames_[frame_index_];
+    if (f.pending)
+        collect(f);
+
+    GLint64 gpu_now;
+    glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+    f.gpu_to_cpu_offset = now_ns() - gpu_now;
+
+    begin_cpu("frame");
+}
+
+void profiler::end_frame()
+{
+    end_cpu();
+
+    std::vector<event> jobs;
+    {
+        std::lock_guard lock(job_mutex_);
+        jobs.swap(jobs_);
+    }
+    for (auto & e : jobs)
+        record(std::move(e));
+
+    frames_[frame_index_].pending = true;
+    frame_index_ = (frame_index_ + 1) % frames_.size();
+}
+
+void profiler::begin_cpu(std::string_view name)
+{
+    open_cpu_.push_back({std::string(name), false, now_ns(), 0});
+}
+
+void profiler::end_cpu()
+{
+    auto e = std::move(open_cpu_.back());
+    open_cpu_.pop_back();
+    e.end_ns = now_ns();
+    record(std::move(e));
+}
+
+void profiler::begin_gpu(std::string_view name)
+{
+    push_debug_group(name);
+
+    auto & f = frames_[frame_index_];
+    GLuint query = acquire_query();
+    glQueryCounter(query, GL_TIMESTAMP);
+    f.last_query = query;
+
+    gpu_query q{std::string(name), query, 0};
+    if (statistics_supported_ && open_gpu_.empty())
+    {
+        for (std::size_t i = 0; i < statistics.size(); ++i)
+        {
+            q.statistics_queries[i] = acquire_query();
+            glBeginQuery(statistics[i].target, q.statistics_queries[i]);
+        }
+    }
+
+    open_gpu_.push_back(f.queries.size());
+    f.queries.push_back(std::move(q));
+}
+
+void profiler::end_gpu()
+{
+    auto & f = frames_[frame_index_];
+    auto & q = f.queries[open_gpu_.back()];
+    if (q.statistics_queries[0] != 0)
+        for (auto const & s : statistics)
+            glEndQuery(s.target);
+
+    GLuint query = acquire_query();
+    glQueryCounter(query, GL_TIMESTAMP);
+    f.last_query = query;
+    q.end_query = query;
+    open_gpu_.pop_back();
+
+    pop_debug_group();
+}
+
+void profiler::job(std::string_view name, unsigned int thread, clock::time_point begin, clock::time_point end)
+{
+    auto const to_ns = [this](clock::time_point t){ return std::chrono::duration_cast<std::chrono::nanoseconds>(t - start_).count(); };
+
+    std::lock_guard lock(job_mutex_);
+    if (jobs_.size() < max_trace_events)
+        jobs_.push_back({std::string(name), false, to_ns(begin), to_ns(end), true, thread});
+}
+
+void profiler::counter(std::string_view name, double value)
+{
+    auto & entry = counter_summary_[std::string(name)];
+    entry.total += value;
+    ++entry.count;
+
+    if (counter_events_.size() < max_trace_events)
+        counter_events_.push_back({std::string(name), now_ns(), value});
+}
+
+void profiler::begin_samples(std::string_view name)
+{
+    auto & f = frames_[frame_index_];
+    GLuint query = acquire_query();
+    glBeginQuery(GL_SAMPLES_PASSED, query);
+    f.sample_queries.push_back({std::string(name), query});
+}
+
+void profiler::end_samples()
+{
+    glEndQuery(GL_SAMPLES_PASSED);
+}
+
+std::optional<double> profiler::collected(std::string_view name) const
+{
+    if (auto it = collected_.find(name); it != collected_.end())
+        return it->second;
+    return std::nullopt;
+}
+
+void profiler::print_summary(std::ostream & os)
+{
+    os << "Profile (average ms):";
+    for (auto const & [name, entry] : summary_)
+        os << "  " << name << " " << std::fixed << std::setprecision(3) << entry.total_ms / entry.count;
+    if (dropped_frames_ > 0)
+        os << "  (" << dropped_frames_ << " GPU frames dropped)";
+    os << std::defaultfloat << std::endl;
+
+    if (!counter_summary_.empty())
+    {
+        os << "Counters (average):";
+        for (auto const & [name, entry] : counter_summary_)
+            os << "  " << name << " " << entry.total / entry.count;
+        os << std::endl;
+    }
+
+    summary_.clear();
+    counter_summary_.clear();
+    dropped_frames_ = 0;
+}
+
+void profiler::write_chrome_trace(std::filesystem::path const & path) const
+{
+    std::ofstream os(path);
+    if (!os)
+        throw std::runtime_error("Failed to open " + path.string());
+
+    os << "{\"traceEvents\":[\n";
+    for (std::size_t i = 0; i < events_.size(); ++i)
+    {
+        auto const & e = events_[i];
+        // The main thread, the GPU, then one track per job thread
+        os << "{\"name\":" << json_string{e.name} << ",\"cat\":\"" << (e.gpu ? "gpu" : e.job ? "job" : "cpu")
+            << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << (e.gpu ? 1 : e.job ? 2 + e.thread : 0)
+            << ",\"ts\":" << e.begin_ns / 1000.0
+            << ",\"dur\":" << (e.end_ns - e.begin_ns) / 1000.0 << "}"
+            << (i + 1 < events_.size() || !counter_events_.empty() ? ",\n" : "\n");
+    }
+    for (std::size_t i = 0; i < counter_events_.size(); ++i)
+    {
+        auto const & e = counter_events_[i];
+        os << "{\"name\":" << json_string{e.name} << ",\"ph\":\"C\",\"pid\":0"
+            << ",\"ts\":" << e.time_ns / 1000.0
+            << ",\"args\":{\"value\":" << e.value << "}}"
+            << (i + 1 < counter_events_.size() ? ",\n" : "\n");
+    }
+    os << "]}\n";
+}
+
+std::int64_t profiler::now_ns() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start_).count();
+}
+
+GLuint profiler::acquire_query()
+{
+    if (free_queries_.empty())
+    {
+        // Grow the pool geometrically
+        std::size_t count = std::max<std::size_t>(16, query_count_);
+        free_queries_.resize(count);
+        glGenQueries(count, free_queries_.data());
+        query_count_ += count;
+    }
+
+    GLuint query = free_queries_.back();
+    free_queries_.pop_back();
+    return query;
+}
+
+void profiler::collect(frame & f)
+{
+    // Queries complete in order, so the last one being ready means all of them are
+    GLint available = GL_TRUE;
+    if (!f.queries.empty())
+        glGetQueryObjectiv(f.last_query, GL_QUERY_RESULT_AVAILABLE, &available);
+    else if (!f.sample_queries.empty())
+        glGetQueryObjectiv(f.sample_queries.back().query, GL_QUERY_RESULT_AVAILABLE, &available);
+
+    if (!available)
+        ++dropped_frames_;
+
+    collected_.clear();
+    for (auto & q : f.queries)
+    {
+        // Statistics queries end before the scope's end timestamp, so they are ready with it
+        if (q.statistics_queries[0] != 0)
+        {
+            for (std::size_t i = 0; i < statistics.size(); ++i)
+            {
+                if (available)
+                {
+                    GLuint64 value;
+                    glGetQueryObjectui64v(q.statistics_queries[i], GL_QUERY_RESULT, &value);
+                    auto name = q.name + statistics[i].suffix;
+                    counter(name, value);
+                    collected_[std::move(name)] = value;
+                }
+                free_queries_.push_back(q.statistics_queries[i]);
+            }
+        }
+
+        if (available)
+        {
+            GLuint64 begin, end;
+            glGetQueryObjectui64v(q.begin_query, GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(q.end_query, GL_QUERY_RESULT, &end);
+            record({std::move(q.name), true, std::int64_t(begin) + f.gpu_to_cpu_offset, std::int64_t(end) + f.gpu_to_cpu_offset});
+        }
+
+        free_queries_.push_back(q.begin_query);
+        free_queries_.push_back(q.end_query);
+    }
+
+    f.queries.clear();
+
+    for (auto & q : f.sample_queries)
+    {
+        // Sample queries end before the frame's last timestamp, so they are ready whenever the timestamps are
+        if (available)
+        {
+            GLuint64 samples;
+            glGetQueryObjectui64v(q.query, GL_QUERY_RESULT, &samples);
+            counter(q.name, samples);
+            collected_[q.name] = samples;
+        }
+
+        free_queries_.push_back(q.query);
+    }
+
+    f.sample_queries.clear();
+    f.pending = false;
+}
+
+void profiler::record(event e)
+{
+    auto & entry = summary_[(e.gpu ? "gpu:" : e.job ? "job:" : "cpu:") + e.name];
+    entry.total_ms += (e.end_ns - e.begin_ns) / 1e6;
+    ++entry.count;
+
+    if (events_.size() < max_trace_events)
+        events_.push_back(std::move(e));
+}
+
+driver_memory query_driver_memory()
+{
+    driver_memory result;
+
+    // Both report KB
+    if (GLEW_NVX_gpu_memory_info)
+    {
+        GLint total, available;
+        glGetIntegerv(GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX, &total);
+        glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &available);
+        result.total_mb = total / 1024.0;
+        result.available_mb = available / 1024.0;
+    }
+    else if (GLEW_ATI_meminfo)
+    {
+        // Total free, largest free block, then the same for auxiliary memory
+        GLint free[4];
+        glGetIntegerv(GL_TEXTURE_FREE_MEMORY_ATI, free);
+        result.available_mb = free[0] / 1024.0;
+    }
+
+    return result;
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <map>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <filesystem>
+#include <mutex>
+
+// Records named CPU and GPU scopes and counters on a common timeline. GPU scopes are bracketed
+// by GL_TIMESTAMP queries that are read back frames_in_flight frames later, so
+// collecting results never waits for the GPU; frames whose queries are still
+// not ready by then are dropped. Sample scopes count the samples that pass the
+// depth test with GL_SAMPLES_PASSED and are read back the same way. With
+// ARB_pipeline_statistics_query, GPU scopes that are not nested in another also count
+// vertex shader invocations, primitives out of clipping and fragment shader invocations,
+// which become the counters "<scope> vertices", "<scope> clipped primitives" and
+// "<scope> fragments"; the same query targets cannot be active twice, so nested scopes
+// count within their parent's. GPU scopes are debug groups of the same names too, so that
+// debuggers and KHR_debug messages show the same structure.
+struct profiler
+{
+    explicit profiler(std::size_t frames_in_flight = 4);
+
+    profiler(profiler const &) = delete;
+    profiler & operator = (profiler const &) = delete;
+
+    void begin_frame();
+    void end_frame();
+
+    void begin_cpu(std::string_view name);
+    void end_cpu();
+
+    void begin_gpu(std::string_view name);
+    void end_gpu();
+
+    // A job that ran on the given job_system thread, for job_system::set_trace; unlike the
+    // rest this can be called from any thread, and the job shows up at the next end_frame
+    void job(std::string_view name, unsigned int thread, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end);
+
+    // Records a value such as a number of tests done this frame
+    void counter(std::string_view name, double value);
+
+    // Becomes a counter once the GPU is done; sample scopes cannot nest
+    void begin_samples(std::string_view name);
+    void end_samples();
+
+    // Count of a sample scope or a pipeline statistics counter in the frame collected by the
+    // last begin_frame, if it had one
+    std::optional<double> collected(std::string_view name) const;
+
+    struct cpu_scope
+    {
+        cpu_scope(profiler & p, std::string_view name) : p_(p) { p_.begin_cpu(name); }
+        ~cpu_scope() { p_.end_cpu(); }
+
+    private:
+        profiler & p_;
+    };
+
+    struct gpu_scope
+    {
+        gpu_scope(profiler & p, std::string_view name) : p_(p) { p_.begin_gpu(name); }
+        ~gpu_scope() { p_.end_gpu(); }
+
+    private:
+        profiler & p_;
+    };
+
+    // Average duration of every scope and average value of every counter since the previous call
+    void print_summary(std::ostream & os);
+
+    // Writes the recorded events in the Chrome trace event format (chrome://tracing, Perfetto)
+    void write_chrome_trace(std::filesystem::path const & path) const;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct event
+    {
+        std::string name;
+        bool gpu;
+        std::int64_t begin_ns;
+        std::int64_t end_ns;
+        bool job = false;
+        unsigned int thread = 0;
+    };
+
+    struct gpu_query
+    {
+        std::string name;
+        GLuint begin_query;
+        GLuint end_query;
+        // Pipeline statistics queries, 0 when the scope has none
+        std::array<GLuint, 3> statistics_queries{};
+    };
+
+    struct sample_query
+    {
+        std::string name;
+        GLuint query;
+    };
+
+    struct frame
+    {
+        std::vector<gpu_query> queries;
+        std::vector<sample_query> sample_queries;
+        GLuint last_query = 0;
+        // Converts GPU timestamps to the CPU timeline of this frame
+        std::int64_t gpu_to_cpu_offset = 0;
+        bool pending = false;
+    };
+
+    struct summary_entry
+    {
+        double total_ms = 0.0;
+        std::size_t count = 0;
+    };
+
+    std::int64_t now_ns() const;
+    GLuint acquire_query();
+    void collect(frame & f);
+    void record(event e);
+
+    clock::time_point start_;
+    bool statistics_supported_ = false;
+    std::vector<frame> frames_;
+    std::size_t frame_index_ = 0;
+    std::vector<GLuint> free_queries_;
+    std::size_t query_count_ = 0;
+
+    std::vector<event> open_cpu_;
+    std::vector<std::size_t> open_gpu_;
+
+    std::vector<event> events_;
+
+    std::mutex job_mutex_;
+    std::vector<event> jobs_;
+    struct counter_event
+    {
+        std::string name;
+        std::int64_t time_ns;
+        double value;
+    };
+
+    std::map<std::string, summary_entry> summary_;
+    struct counter_entry
+    {
+        double total = 0.0;
+        std::size_t count = 0;
+    };
+
+    std::map<std::string, counter_entry> counter_summary_;
+    std::map<std::string, double, std::less<>> collected_;
+    std::vector<counter_event> counter_events_;
+    std::size_t dropped_frames_ = 0;
+};
+
+// What the driver reports of its video memory through NVX_gpu_memory_info or ATI_meminfo,
+// in MB; either is missing where the extensions are, and ATI_meminfo has no total. Only counts
+// the driver sees, unlike the per-category totals of render_stats.
+struct driver_memory
+{
+    std::optional<double> total_mb;
+    std::optional<double> available_mb;
+};
+
+driver_memory query_driver_memory();
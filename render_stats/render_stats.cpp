@@ -0,0 +1,106 @@
+#include "render_stats.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+char const * render_counter_name(render_counter counter)
+{
+    switch (counter)
+    {
+    case render_counter::draw_calls: return "draw calls";
+    case render_counter::triangles: return "triangles";
+    case render_counter::state_changes: return "state changes";
+    case render_counter::uniform_uploads: return "uniform uploads";
+    case render_counter::bytes_uploaded: return "bytes uploaded";
+    case render_counter::texture_binds: return "texture binds";
+    case render_counter::visible_objects: return "visible objects";
+    case render_counter::culled_objects: return "culled objects";
+    case render_counter::count: break;
+    }
+    return "unknown";
+}
+
+render_stats & render_stats::global()
+{
+    static render_stats result;
+    return result;
+}
+
+void render_stats::end_frame()
+{
+    auto & frame = history_[history_index_];
+    for (std::size_t i = 0; i < counter_count; ++i)
+    {
+        std::uint64_t const value = current_[i].exchange(0, std::memory_order_relaxed);
+        history_sum_[i] += value - frame[i];
+        frame[i] = value;
+    }
+
+    history_index_ = (history_index_ + 1) % history_size;
+    history_frames_ = std::min(history_frames_ + 1, history_size);
+}
+
+std::uint64_t render_stats::current(render_counter counter) const
+{
+    return current_[static_cast<std::size_t>(counter)].load(std::memory_order_relaxed);
+}
+
+double render_stats::average(render_counter counter) const
+{
+    if (history_frames_ == 0)
+        return 0.0;
+    return double(history_sum_[static_cast<std::size_t>(counter)]) / history_frames_;
+}
+
+std::uint64_t render_stats::max(render_counter counter) const
+{
+    // Frames not recorded yet are zero
+    std::uint64_t result = 0;
+    for (auto const & frame : history_)
+        result = std::max(result, frame[static_cast<std::size_t>(counter)]);
+    return result;
+}
+
+void render_stats::gpu_allocated(std::string_view category, std::int64_t bytes)
+{
+    std::lock_guard lock(gpu_memory_mutex_);
+    if (auto it = gpu_memory_.find(category); it != gpu_memory_.end())
+        it->second += bytes;
+    else
+        gpu_memory_.emplace(category, bytes);
+}
+
+std::map<std::string, std::int64_t, std::less<>> render_stats::gpu_memory() const
+{
+    std::lock_guard lock(gpu_memory_mutex_);
+    return gpu_memory_;
+}
+
+std::string render_stats::overlay_text() const
+{
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(1);
+    for (std::size_t i = 0; i < counter_count; ++i)
+    {
+        auto const counter = static_cast<render_counter>(i);
+        if (i != 0)
+            os << '\n';
+        os << render_counter_name(counter) << ": " << average(counter) << " (" << max(counter) << ")";
+    }
+    for (auto const & [category, bytes] : gpu_memory())
+        os << '\n' << category << " memory: " << bytes / (1024.0 * 1024.0) << " MB";
+    return os.str();
+}
+
+void render_stats::print_summary(std::ostream & os) const
+{
+    os << "Render stats over " << history_frames_ << " frames, average (max):\n" << std::fixed << std::setprecision(1);
+    for (std::size_t i = 0; i < counter_count; ++i)
+    {
+        auto const counter = static_cast<render_counter>(i);
+        os << "  " << render_counter_name(counter) << " " << average(counter) << " (" << max(counter) << ")\n";
+    }
+    for (auto const & [category, bytes] : gpu_memory())
+        os << "  " << category << " memory " << bytes / (1024.0 * 1024.0) << " MB\n";
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <ostream>
+#include <cstdint>
+
+enum class render_counter
+{
+    draw_calls,
+    triangles,
+    // Program, vertex array, framebuffer and fixed function state
+    state_changes,
+    uniform_uploads,
+    // Through glBufferData, glBufferSubData and glTexImage*/glTexSubImage*
+    bytes_uploaded,
+    texture_binds,
+    visible_objects,
+    culled_objects,
+    count,
+};
+
+char const * render_counter_name(render_counter counter);
+
+// Per-frame counts of the work a frame hands to the driver, with averages and maxima over the
+// last frames. Counting goes through RENDER_STATS_ADD at the call sites, which expands to
+// nothing unless the build defines RENDER_STATS, so a build without it does not even evaluate
+// the counts. Adding can happen on any thread, like an upload thread's; the rest belongs to the
+// thread that ends frames. Next to the per-frame counts it keeps a running total of the GPU
+// memory the samples allocate, by category, counted through RENDER_STATS_GPU_MEMORY.
+struct render_stats
+{
+    static constexpr std::size_t history_size = 60;
+    static constexpr std::size_t counter_count = static_cast<std::size_t>(render_counter::count);
+
+    // The one the macros count into
+    static render_stats & global();
+
+    void add(render_counter counter, std::uint64_t value)
+    {
+        current_[static_cast<std::size_t>(counter)].fetch_add(value, std::memory_order_relaxed);
+    }
+
+    // Moves the counts of the frame into the history and starts the next one from zero
+    void end_frame();
+
+    // Of the frame being counted
+    std::uint64_t current(render_counter counter) const;
+
+    // Over the frames in the history, zero before the first end_frame
+    double average(render_counter counter) const;
+    std::uint64_t max(render_counter counter) const;
+
+    // Bytes of buffers and textures by category, such as "mesh" or "texture"; freeing counts
+    // negative. Any thread.
+    void gpu_allocated(std::string_view category, std::int64_t bytes);
+    std::map<std::string, std::int64_t, std::less<>> gpu_memory() const;
+
+    // One "name: average (max)" line per counter, for an overlay
+    std::string overlay_text() const;
+    void print_summary(std::ostream & os) const;
+
+private:
+    std::array<std::atomic<std::uint64_t>, counter_count> current_{};
+
+    std::array<std::array<std::uint64_t, counter_count>, history_size> history_{};
+    std::array<std::uint64_t, counter_count> history_sum_{};
+    std::size_t history_frames_ = 0;
+    std::size_t history_index_ = 0;
+
+    mutable std::mutex gpu_memory_mutex_;
+    std::map<std::string, std::int64_t, std::less<>> gpu_memory_;
+};
+
+#ifdef RENDER_STATS
+#define RENDER_STATS_ADD(counter, value) (::render_stats::global().add(render_counter::counter, (value)))
+#define RENDER_STATS_GPU_MEMORY(category, bytes) (::render_stats::global().gpu_allocated((category), (bytes)))
+#else
+#define RENDER_STATS_ADD(counter, value) ((void)0)
+#define RENDER_STATS_GPU_MEMORY(category, bytes) ((void)0)
+#endif
@@ -0,0 +1,222 @@
+#include "replay_session.hpp"
+#include "process_memory.hpp"
+
+#include <string_view>
+#include <stdexcept>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <numeric>
+#include <cstdlib>
+
+namespace
+{
+
+    float percentile(std::vector<float> const & sorted, float p)
+    {
+        return sorted[std::min<std::size_t>(sorted.size() - 1, p * sorted.size())];
+    }
+
+    void print_times(std::ostream & out, char const * name, std::vector<float> times)
+    {
+        out << name << " ms:";
+        if (times.empty())
+        {
+            out << " none" << std::endl;
+            return;
+        }
+
+        std::sort(times.begin(), times.end());
+        float const average = std::accumulate(times.begin(), times.end(), 0.f) / times.size();
+
+        out << std::fixed << std::setprecision(3)
+            << " avg " << average
+            << " p50 " << percentile(times, 0.5f)
+            << " p95 " << percentile(times, 0.95f)
+            << " p99 " << percentile(times, 0.99f)
+            << " max " << times.back() << std::endl;
+        out.unsetf(std::ios::floatfield);
+    }
+
+    void write_percentiles(std::ostream & out, char const * name, std::vector<float> times)
+    {
+        if (times.empty())
+            return;
+
+        std::sort(times.begin(), times.end());
+        out << name << "_p50_ms " << percentile(times, 0.5f) << "\n";
+        out << name << "_p95_ms " << percentile(times, 0.95f) << "\n";
+    }
+
+}
+
+replay_session::replay_session(int argc, char ** argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string_view const arg = argv[i];
+        auto const value = [&]
+        {
+            if (i + 1 == argc)
+                throw std::runtime_error(std::string(arg) + " needs a value");
+            return argv[++i];
+        };
+
+        if (arg == "--record")
+        {
+            mode_ = mode::record;
+            path_ = value();
+        }
+        else if (arg == "--replay")
+        {
+            mode_ = mode::replay;
+            path_ = value();
+        }
+        else if (arg == "--frames")
+            frame_count_ = std::max(1, std::atoi(value()));
+        else if (arg == "--results")
+            results_path_ = value();
+        else if (arg == "--hidden")
+            hidden_ = true;
+    }
+
+    if (mode_ != mode::replay)
+        return;
+
+    std::ifstream input(path_);
+    std::string header;
+    std::uint32_t recorded_frames = 0;
+    if (!(input >> header >> recorded_frames) || header != "frames")
+        throw std::runtime_error("Not an input recording: " + path_.string());
+
+    std::uint32_t frame;
+    int key, down;
+    while (input >> frame >> key >> down)
+        edges_.push_back({frame, {SDL_Scancode(key), down != 0}});
+
+    if (frame_count_ == 0)
+        frame_count_ = recorded_frames;
+    cpu_times_.reserve(frame_count_);
+    gpu_times_.reserve(frame_count_);
+}
+
+bool replay_session::update(input_state & input)
+{
+    if (mode_ == mode::record)
+    {
+        for (auto const & e : input.edges())
+            edges_.push_back({frame_, e});
+        ++frame_;
+        return true;
+    }
+
+    if (mode_ != mode::replay)
+        return true;
+
+    if (frame_ == 0)
+    {
+        load_time_ = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - created_).count();
+        input.begin_replay();
+        SDL_GL_SetSwapInterval(0);
+        if (hidden_)
+            SDL_HideWindow(SDL_GL_GetCurrentWindow());
+    }
+
+    if (frame_ == frame_count_)
+        return false;
+
+    for (; next_edge_ < edges_.size() && edges_[next_edge_].frame <= frame_; ++next_edge_)
+        input.replay_edge(edges_[next_edge_].edge);
+
+    auto & timer = gpu_timers_[next_timer_];
+    collect_gpu_times(timer.pending);
+    if (!timer.queries[0])
+        glGenQueries(timer.queries.size(), timer.queries.data());
+    glQueryCounter(timer.queries[0], GL_TIMESTAMP);
+
+    frame_start_ = std::chrono::high_resolution_clock::now();
+    ++frame_;
+    return true;
+}
+
+void replay_session::end_frame()
+{
+    if (mode_ != mode::replay || frame_ == 0)
+        return;
+
+    cpu_times_.push_back(std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - frame_start_).count());
+
+    auto & timer = gpu_timers_[next_timer_];
+    glQueryCounter(timer.queries[1], GL_TIMESTAMP);
+    timer.pending = true;
+    next_timer_ = (next_timer_ + 1) % gpu_timers_.size();
+}
+
+void replay_session::finish()
+{
+    if (mode_ == mode::record)
+    {
+        std::ofstream output(path_);
+        output << "frames " << frame_ << "\n";
+        for (auto const & e : edges_)
+            output << e.frame << " " << int(e.edge.key) << " " << int(e.edge.down) << "\n";
+        if (!output)
+            throw std::runtime_error("Failed to write " + path_.string());
+        std::cout << "Recorded " << frame_ << " frames to " << path_.string() << std::endl;
+        return;
+    }
+
+    if (mode_ != mode::replay)
+        return;
+
+    while (std::any_of(gpu_timers_.begin(), gpu_timers_.end(), [](gpu_timer const & t){ return t.pending; }))
+        collect_gpu_times(true);
+    for (auto & timer : gpu_timers_)
+        if (timer.queries[0])
+            glDeleteQueries(timer.queries.size(), timer.queries.data());
+
+    std::size_t const peak_memory = peak_rss();
+
+    std::cout << "replay of " << path_.string() << ": " << cpu_times_.size() << " frames, loaded in "
+        << load_time_ << " ms, " << peak_memory / (1024 * 1024) << " MB peak memory" << std::endl;
+    print_times(std::cout, "cpu", cpu_times_);
+    print_times(std::cout, "gpu", gpu_times_);
+
+    if (results_path_)
+    {
+        std::ofstream output(*results_path_);
+        write_percentiles(output, "cpu", cpu_times_);
+        write_percentiles(output, "gpu", gpu_times_);
+        output << "load_ms " << load_time_ << "\n";
+        output << "peak_memory_mb " << peak_memory / (1024.0 * 1024.0) << "\n";
+        if (!output)
+            throw std::runtime_error("Failed to write " + results_path_->string());
+    }
+}
+
+void replay_session::collect_gpu_times(bool wait_oldest)
+{
+    // Oldest first, so that the times stay in frame order
+    for (std::size_t i = 0; i < gpu_timers_.size(); ++i)
+    {
+        auto & timer = gpu_timers_[(next_timer_ + i) % gpu_timers_.size()];
+        if (!timer.pending)
+            continue;
+
+        if (!wait_oldest)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(timer.queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                return;
+        }
+        wait_oldest = false;
+
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(timer.queries[0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(timer.queries[1], GL_QUERY_RESULT, &end);
+        gpu_times_.push_back((end - begin) / 1e6f);
+        timer.pending = false;
+    }
+}
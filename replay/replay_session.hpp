@@ -0,0 +1,93 @@
+#pragma once
+
+#include "input_state.hpp"
+
+#include <GL/glew.h>
+
+#include <filesystem>
+#include <optional>
+#include <vector>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+// Recording and deterministic replay of a sample's keyboard input, for benchmarks that can be
+// diffed between builds and machines:
+//   --record FILE                                 writes the keys pressed and released on every frame
+//   --replay FILE [--frames N] [--results FILE] [--hidden]
+//                                                 plays them back and reports the frame times
+// Both run with a fixed time step, so a replay retraces the recorded camera path exactly, and
+// a replay runs without vsync, so the frame times are the frame's own. --hidden hides the
+// window for the replay, for unattended runs; the frames are still drawn. Other arguments are
+// left to the sample.
+//
+// The results file has one "metric value" line per metric, for perf_regression to compare
+// against a baseline: p50 and p95 of the CPU and GPU frame times, the load time from the
+// session's construction to the first frame, and the peak resident memory of the process.
+struct replay_session
+{
+    static constexpr float time_step = 1.f / 60.f;
+
+    replay_session(int argc, char ** argv);
+
+    replay_session(replay_session const &) = delete;
+    replay_session & operator = (replay_session const &) = delete;
+
+    bool recording() const { return mode_ == mode::record; }
+    bool replaying() const { return mode_ == mode::replay; }
+
+    // Call after polling the frame's events: records the frame's input, or replaces it with the
+    // recorded one. Starts timing the frame. False once a replay has run all its frames.
+    bool update(input_state & input);
+
+    // The wall clock dt when neither recording nor replaying, the fixed time step otherwise
+    float frame_time(float dt) const { return mode_ == mode::live ? dt : time_step; }
+
+    // Call right before the swap; stops timing the frame
+    void end_frame();
+
+    // Saves the recording, or prints the replay's average, p50, p95 and p99 CPU and GPU frame
+    // times and writes the metrics to the results file. Needs the GL context.
+    void finish();
+
+private:
+    enum class mode
+    {
+        live,
+        record,
+        replay,
+    };
+
+    struct recorded_edge
+    {
+        std::uint32_t frame;
+        input_state::edge edge;
+    };
+
+    struct gpu_timer
+    {
+        std::array<GLuint, 2> queries{};
+        bool pending = false;
+    };
+
+    void collect_gpu_times(bool wait);
+
+    mode mode_ = mode::live;
+    std::filesystem::path path_;
+    std::optional<std::filesystem::path> results_path_;
+    bool hidden_ = false;
+    std::uint32_t frame_count_ = 0;
+    std::uint32_t frame_ = 0;
+
+    std::vector<recorded_edge> edges_;
+    std::size_t next_edge_ = 0;
+
+    std::chrono::high_resolution_clock::time_point created_ = std::chrono::high_resolution_clock::now();
+    float load_time_ = 0.f;
+    std::chrono::high_resolution_clock::time_point frame_start_;
+    std::vector<float> cpu_times_;
+    std::vector<float> gpu_times_;
+    // Timestamps are read a few frames late, so that reading them never stalls
+    std::array<gpu_timer, 4> gpu_timers_;
+    std::size_t next_timer_ = 0;
+};
@@ -0,0 +1,315 @@
+#include "program_cache.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <cstring>
+#include <system_error>
+
+namespace
+{
+
+    constexpr char binary_magic[4] = {'P', 'R', 'G', 'B'};
+    constexpr std::uint32_t binary_version = 1;
+
+    // Followed by size bytes of program binary in the given format
+    struct binary_header
+    {
+        char magic[4];
+        std::uint32_t version;
+        std::uint64_t key;
+        std::uint32_t format;
+        std::uint32_t size;
+    };
+
+    // FNV-1a
+    void hash(std::uint64_t & state, void const * data, std::size_t size)
+    {
+        auto bytes = static_cast<unsigned char const *>(data);
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            state ^= bytes[i];
+            state *= 1099511628211ull;
+        }
+    }
+
+    std::string gl_string(GLenum name)
+    {
+        auto result = reinterpret_cast<char const *>(glGetString(name));
+        return result ? result : "";
+    }
+
+    std::string shader_info_log(GLuint shader)
+    {
+        GLint info_log_length;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &info_log_length);
+        std::string info_log(info_log_length, '\0');
+        glGetShaderInfoLog(shader, info_log.size(), nullptr, info_log.data());
+        return info_log;
+    }
+
+    bool link_status(GLuint program)
+    {
+        GLint status;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        return status == GL_TRUE;
+    }
+
+    std::string program_info_log(GLuint program)
+    {
+        GLint info_log_length;
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &info_log_length);
+        std::string info_log(info_log_length, '\0');
+        glGetProgramInfoLog(program, info_log.size(), nullptr, info_log.data());
+        return info_log;
+    }
+
+}
+
+program_cache::program_cache(std::filesystem::path directory)
+    : directory_(std::move(directory))
+{
+    if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)
+    {
+        GLint format_count = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+        binaries_supported_ = format_count > 0;
+    }
+
+    if (GLEW_KHR_parallel_shader_compile)
+    {
+        // As many compiler threads as the driver likes
+        glMaxShaderCompilerThreadsKHR(0xffffffffu);
+        parallel_compile_ = true;
+    }
+
+    driver_ = gl_string(GL_VENDOR) + '\n' + gl_string(GL_RENDERER) + '\n' + gl_string(GL_VERSION);
+}
+
+program_cache::~program_cache()
+{
+    for (auto & [program, pending] : pending_)
+        for (GLuint object : pending.objects)
+            glDeleteShader(object);
+
+    for (auto const & [key, program] : programs_)
+        glDeleteProgram(program);
+}
+
+GLuint program_cache::submit(std::vector<shader_source> shaders, std::vector<std::string> feedback_varyings)
+{
+    std::uint64_t const k = key(shaders, feedback_varyings);
+    if (auto it = programs_.find(k); it != programs_.end())
+        return it->second;
+
+    GLuint const program = glCreateProgram();
+    auto & pending = pending_[program];
+    pending.key = k;
+    pending.shaders = std::move(shaders);
+    pending.feedback_varyings = std::move(feedback_varyings);
+
+    // Nothing is checked here; any status query would wait for the driver's compiler threads
+    pending.from_binary = load_binary(program, k);
+    if (!pending.from_binary)
+        compile(program, pending);
+
+    programs_[k] = program;
+    return program;
+}
+
+bool program_cache::ready(GLuint program)
+{
+    if (!pending_.contains(program))
+        return true;
+
+    if (parallel_compile_)
+    {
+        GLint completed;
+        glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &completed);
+        if (completed != GL_TRUE)
+            return false;
+    }
+
+    return finish(program);
+}
+
+void program_cache::wait()
+{
+    // A rejected binary comes back compiling from source, so it may take two rounds
+    while (!pending_.empty())
+        finish(pending_.begin()->first);
+}
+
+GLuint program_cache::get(std::vector<shader_source> shaders, std::vector<std::string> feedback_varyings)
+{
+    GLuint const program = submit(std::move(shaders), std::move(feedback_varyings));
+    while (pending_.contains(program) && !finish(program));
+    return program;
+}
+
+void program_cache::compile(GLuint program, pending_program & pending)
+{
+    for (auto const & shader : pending.shaders)
+    {
+        GLuint const object = glCreateShader(shader.type);
+        char const * data = shader.source.c_str();
+        glShaderSource(object, 1, &data, nullptr);
+        glCompileShader(object);
+        glAttachShader(program, object);
+        pending.objects.push_back(object);
+    }
+
+    // Has to be set before linking; a binary keeps it
+    if (!pending.feedback_varyings.empty())
+    {
+        std::vector<char const *> names;
+        for (auto const & name : pending.feedback_varyings)
+            names.push_back(name.c_str());
+        glTransformFeedbackVaryings(program, names.size(), names.data(), GL_INTERLEAVED_ATTRIBS);
+    }
+
+    if (binaries_supported_)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+    glLinkProgram(program);
+}
+
+bool program_cache::finish(GLuint program)
+{
+    auto it = pending_.find(program);
+    auto & pending = it->second;
+
+    if (!link_status(program))
+    {
+        if (pending.from_binary)
+        {
+            // The program object is already handed out, so it is linked again from source
+            pending.from_binary = false;
+            compile(program, pending);
+            return false;
+        }
+
+        std::string error;
+        for (GLuint object : pending.objects)
+        {
+            GLint status;
+            glGetShaderiv(object, GL_COMPILE_STATUS, &status);
+            if (status != GL_TRUE && error.empty())
+                error = "Shader compilation failed: " + shader_info_log(object);
+        }
+        if (error.empty())
+            error = "Program linkage failed: " + program_info_log(program);
+
+        for (GLuint object : pending.objects)
+            glDeleteShader(object);
+        programs_.erase(pending.key);
+        pending_.erase(it);
+        glDeleteProgram(program);
+        throw std::runtime_error(error);
+    }
+
+    if (pending.from_binary)
+        ++loaded_;
+    else
+    {
+        save_binary(program, pending.key);
+        ++compiled_;
+    }
+
+    for (GLuint object : pending.objects)
+    {
+        glDetachShader(program, object);
+        glDeleteShader(object);
+    }
+
+    pending_.erase(it);
+    return true;
+}
+
+std::uint64_t program_cache::key(std::vector<shader_source> const & shaders, std::vector<std::string> const & feedback_varyings) const
+{
+    std::uint64_t state = 14695981039346656037ull;
+    hash(state, driver_.data(), driver_.size() + 1);
+    for (auto const & shader : shaders)
+    {
+        hash(state, &shader.type, sizeof(shader.type));
+        hash(state, shader.source.data(), shader.source.size() + 1);
+    }
+    for (auto const & name : feedback_varyings)
+        hash(state, name.data(), name.size() + 1);
+    return state;
+}
+
+std::filesystem::path program_cache::binary_path(std::uint64_t key) const
+{
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << key << ".program";
+    return directory_ / name.str();
+}
+
+bool program_cache::load_binary(GLuint program, std::uint64_t key) const
+{
+    if (!binaries_supported_)
+        return false;
+
+    std::ifstream input(binary_path(key), std::ios::binary);
+    if (!input)
+        return false;
+
+    binary_header header;
+    if (!input.read(reinterpret_cast<char *>(&header), sizeof(header)))
+        return false;
+
+    if (std::memcmp(header.magic, binary_magic, sizeof(binary_magic)) != 0 || header.version != binary_version || header.key != key)
+        return false;
+
+    std::vector<char> binary(header.size);
+    if (!input.read(binary.data(), binary.size()))
+        return false;
+
+    glProgramBinary(program, header.format, binary.data(), binary.size());
+    return true;
+}
+
+void program_cache::save_binary(GLuint program, std::uint64_t key) const
+{
+    if (!binaries_supported_)
+        return;
+
+    GLint size = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0)
+        return;
+
+    std::vector<char> binary(size);
+    GLenum format = 0;
+    glGetProgramBinary(program, size, &size, &format, binary.data());
+
+    binary_header header{};
+    std::memcpy(header.magic, binary_magic, sizeof(binary_magic));
+    header.version = binary_version;
+    header.key = key;
+    header.format = format;
+    header.size = size;
+
+    std::error_code error;
+    std::filesystem::create_directories(directory_, error);
+
+    // Write to a temporary file first so that a concurrent reader never sees a partial binary
+    auto const path = binary_path(key);
+    auto temp_path = path;
+    temp_path += ".tmp";
+
+    {
+        std::ofstream output(temp_path, std::ios::binary);
+        output.write(reinterpret_cast<char const *>(&header), sizeof(header));
+        output.write(binary.data(), size);
+        if (!output)
+            return;
+    }
+
+    std::filesystem::rename(temp_path, path, error);
+    if (error)
+        std::filesystem::remove(temp_path, error);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <filesystem>
+#include <cstdint>
+
+struct shader_source
+{
+    GLenum type;
+    std::string source;
+};
+
+// Links programs from GLSL sources and saves their glGetProgramBinary output in directory,
+// so that later runs load them with glProgramBinary instead of compiling. A binary is keyed
+// by a hash of the sources and of the GL vendor, renderer and version strings, so a driver
+// update makes new ones rather than feeding old ones to it; a binary the driver rejects
+// anyway is compiled from source again and overwritten. Without ARB_get_program_binary,
+// or when the driver offers no binary formats, every program is compiled.
+//
+// Programs are submitted without waiting for them, so that the driver can compile many at
+// once, and with KHR_parallel_shader_compile ready() tells whether one is done without
+// blocking; a frame that finds a program not ready skips what it draws with it.
+struct program_cache
+{
+    explicit program_cache(std::filesystem::path directory);
+    ~program_cache();
+
+    program_cache(program_cache const &) = delete;
+    program_cache & operator = (program_cache const &) = delete;
+
+    // Starts loading or compiling the program and returns it right away; it must not be used
+    // before ready() says so. The same sources give the same program, which the cache owns.
+    // Outputs named in feedback_varyings are captured, interleaved, by transform feedback.
+    GLuint submit(std::vector<shader_source> shaders, std::vector<std::string> feedback_varyings = {});
+
+    // Whether the program is linked. Does not block with KHR_parallel_shader_compile, and
+    // otherwise waits for this program. Throws with the info log if a shader failed to
+    // compile or the program to link.
+    bool ready(GLuint program);
+
+    // Waits for every submitted program, throwing like ready()
+    void wait();
+
+    // submit() and waiting for that program
+    GLuint get(std::vector<shader_source> shaders, std::vector<std::string> feedback_varyings = {});
+
+    // Submitted programs that are not ready yet
+    std::size_t pending() const { return pending_.size(); }
+
+    // Programs of this run that came from a binary and that had to be compiled
+    int loaded() const { return loaded_; }
+    int compiled() const { return compiled_; }
+
+private:
+    struct pending_program
+    {
+        std::uint64_t key;
+        std::vector<shader_source> shaders;
+        std::vector<std::string> feedback_varyings;
+        std::vector<GLuint> objects;
+        bool from_binary = false;
+    };
+
+    void compile(GLuint program, pending_program & pending);
+    // Checks a program whose compilation has completed; false if its binary was rejected
+    // and it is being compiled from source instead
+    bool finish(GLuint program);
+
+    std::uint64_t key(std::vector<shader_source> const & shaders, std::vector<std::string> const & feedback_varyings) const;
+    std::filesystem::path binary_path(std::uint64_t key) const;
+
+    bool load_binary(GLuint program, std::uint64_t key) const;
+    void save_binary(GLuint program, std::uint64_t key) const;
+
+    std::filesystem::path directory_;
+    bool binaries_supported_ = false;
+    bool parallel_compile_ = false;
+    // Vendor, renderer and version, hashed into every key
+    std::string driver_;
+
+    std::map<std::uint64_t, GLuint> programs_;
+    std::map<GLuint, pending_program> pending_;
+    int loaded_ = 0;
+    int compiled_ = 0;
+};
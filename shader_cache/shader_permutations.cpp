@@ -0,0 +1,66 @@
+#include "shader_permutations.hpp"
+
+#include <stdexcept>
+
+shader_permutations::shader_permutations(program_cache & cache, std::vector<shader_source> sources, std::vector<std::string> feature_names)
+    : cache_(cache)
+    , sources_(std::move(sources))
+    , feature_names_(std::move(feature_names))
+{
+    if (feature_names_.size() > 32)
+        throw std::runtime_error("Too many shader features");
+}
+
+void shader_permutations::submit(features key)
+{
+    if (!programs_.contains(key))
+        programs_[key] = cache_.submit(sources(key));
+}
+
+GLuint shader_permutations::get(features key)
+{
+    submit(key);
+    GLuint const program = programs_[key];
+    // The same sources give the same program, which get() waits for without spinning
+    if (!cache_.ready(program))
+        cache_.get(sources(key));
+    return program;
+}
+
+std::vector<shader_source> shader_permutations::sources(features key) const
+{
+    std::vector<shader_source> result;
+    for (auto const & source : sources_)
+        result.push_back({source.type, define_features(source.source, feature_names_, key)});
+    return result;
+}
+
+std::string define_features(std::string_view source, std::vector<std::string> const & feature_names, shader_permutations::features key)
+{
+    // Past the #version line and the #extension lines after it, which have to come before
+    // anything else that is not a preprocessor directive
+    std::size_t position = 0;
+    bool version = false;
+    while (position < source.size())
+    {
+        std::size_t end = source.find('\n', position);
+        end = (end == std::string_view::npos) ? source.size() : end + 1;
+
+        auto const line = source.substr(position, end - position);
+        if (line.starts_with("#version"))
+            version = true;
+        else if (!version || !line.starts_with("#extension"))
+            break;
+        position = end;
+    }
+
+    std::string defines;
+    for (std::size_t i = 0; i < feature_names.size(); ++i)
+        if (key & (1u << i))
+            defines += "#define " + feature_names[i] + "\n";
+
+    std::string result(source.substr(0, position));
+    result += defines;
+    result += source.substr(position);
+    return result;
+}
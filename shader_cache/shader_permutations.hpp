@@ -0,0 +1,50 @@
+#pragma once
+
+#include "program_cache.hpp"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+// Variants of one program, each compiled with a #define for every feature it has, so that
+// what a material does or does not use is decided by the preprocessor rather than by
+// uniform branches in every vertex and fragment. Variants come from the program cache,
+// compiled the first time their feature set is asked for, and binaries of them are kept
+// across runs like those of any other program.
+//
+// Features are bits; the names passed in give the macro of each bit, in order.
+struct shader_permutations
+{
+    using features = std::uint32_t;
+
+    // Sources have to start with their #version line; extensions may follow it
+    shader_permutations(program_cache & cache, std::vector<shader_source> sources, std::vector<std::string> feature_names);
+
+    shader_permutations(shader_permutations const &) = delete;
+    shader_permutations & operator = (shader_permutations const &) = delete;
+
+    // Starts compiling the variant without waiting for it, so that all the ones a scene
+    // uses can be compiled at once when it loads
+    void submit(features key);
+
+    // The variant, waiting for it to be linked
+    GLuint get(features key);
+
+    // Variants made so far
+    std::size_t size() const { return programs_.size(); }
+
+    // The sources of a variant
+    std::vector<shader_source> sources(features key) const;
+
+private:
+    program_cache & cache_;
+    std::vector<shader_source> sources_;
+    std::vector<std::string> feature_names_;
+    std::map<features, GLuint> programs_;
+};
+
+// The source with a #define line for every feature set in key, put after the #version line
+// and any #extension lines that directly follow it
+std::string define_features(std::string_view source, std::vector<std::string> const & feature_names, shader_permutations::features key);
@@ -0,0 +1,107 @@
+#include "startup_trace.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+startup_trace::startup_trace()
+    : start_(clock::now())
+{}
+
+std::size_t startup_trace::begin(std::string_view name)
+{
+    auto const time = now_ns();
+    std::lock_guard lock(mutex_);
+    entries_.push_back({std::string(name), thread_index(), time, -1, false});
+    return entries_.size() - 1;
+}
+
+void startup_trace::end(std::size_t stage)
+{
+    auto const time = now_ns();
+    std::lock_guard lock(mutex_);
+    entries_[stage].end_ns = time;
+}
+
+void startup_trace::mark(std::string_view name)
+{
+    auto const time = now_ns();
+    std::lock_guard lock(mutex_);
+    for (auto const & e : entries_)
+        if (e.milestone && e.name == name)
+            return;
+    entries_.push_back({std::string(name), thread_index(), time, time, true});
+}
+
+bool startup_trace::marked(std::string_view name) const
+{
+    std::lock_guard lock(mutex_);
+    return std::any_of(entries_.begin(), entries_.end(), [&](entry const & e){ return e.milestone && e.name == name; });
+}
+
+double startup_trace::now_ms() const
+{
+    return now_ns() / 1e6;
+}
+
+void startup_trace::print(std::ostream & os) const
+{
+    std::lock_guard lock(mutex_);
+
+    auto sorted = entries_;
+    std::stable_sort(sorted.begin(), sorted.end(), [](entry const & a, entry const & b){ return a.begin_ns < b.begin_ns; });
+
+    auto const flags = os.flags();
+    auto const precision = os.precision();
+
+    os << "Startup:" << std::fixed << std::setprecision(1) << '\n';
+    for (auto const & e : sorted)
+    {
+        os << "  " << std::setw(8) << e.begin_ns / 1e6 << " ms  ";
+        if (e.milestone)
+            os << "   milestone ";
+        else if (e.end_ns < 0)
+            os << "     running ";
+        else
+            os << std::setw(9) << (e.end_ns - e.begin_ns) / 1e6 << " ms ";
+        os << e.name << " (thread " << e.thread << ")\n";
+    }
+    os.flags(flags);
+    os.precision(precision);
+    os << std::flush;
+}
+
+void startup_trace::write_chrome_trace(std::filesystem::path const & path) const
+{
+    std::lock_guard lock(mutex_);
+
+    std::ofstream os(path);
+    os << "{\"traceEvents\":[\n";
+    for (std::size_t i = 0; i < entries_.size(); ++i)
+    {
+        auto const & e = entries_[i];
+        os << "{\"name\":\"" << e.name << "\",\"cat\":\"startup\",\"pid\":0,\"tid\":" << e.thread
+            << ",\"ts\":" << e.begin_ns / 1000.0;
+        if (e.milestone)
+            os << ",\"ph\":\"i\",\"s\":\"g\"}";
+        else
+            os << ",\"ph\":\"X\",\"dur\":" << (std::max(e.end_ns, e.begin_ns) - e.begin_ns) / 1000.0 << "}";
+        os << (i + 1 < entries_.size() ? ",\n" : "\n");
+    }
+    os << "]}\n";
+}
+
+std::int64_t startup_trace::now_ns() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start_).count();
+}
+
+std::size_t startup_trace::thread_index()
+{
+    auto const id = std::this_thread::get_id();
+    auto const it = std::find(threads_.begin(), threads_.end(), id);
+    if (it != threads_.end())
+        return it - threads_.begin();
+    threads_.push_back(id);
+    return threads_.size() - 1;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <ostream>
+#include <filesystem>
+#include <cstdint>
+
+// Wall times of the stages of a program's startup, measured from when the trace is
+// constructed, which should be the first thing main does. Stages may overlap and begin and end
+// on any thread: the render thread brings the window up and presents while programs compile
+// and assets load elsewhere. Milestones mark single instants, such as the first frame
+// presented and the first one with everything in it.
+struct startup_trace
+{
+    startup_trace();
+
+    startup_trace(startup_trace const &) = delete;
+    startup_trace & operator = (startup_trace const &) = delete;
+
+    // Returns the stage to pass to end()
+    std::size_t begin(std::string_view name);
+    void end(std::size_t stage);
+
+    struct scope
+    {
+        scope(startup_trace & t, std::string_view name) : t_(t), stage_(t.begin(name)) {}
+        ~scope() { t_.end(stage_); }
+
+    private:
+        startup_trace & t_;
+        std::size_t stage_;
+    };
+
+    // Only the first mark of a name counts, so a frame loop can mark a milestone every frame
+    void mark(std::string_view name);
+    bool marked(std::string_view name) const;
+
+    // Milliseconds since construction
+    double now_ms() const;
+
+    // Every stage and milestone in order of start, with the thread it ran on
+    void print(std::ostream & os) const;
+
+    // The Chrome trace event format (chrome://tracing, Perfetto), a track per thread
+    void write_chrome_trace(std::filesystem::path const & path) const;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct entry
+    {
+        std::string name;
+        // Numbered in order of the first entry made on each
+        std::size_t thread;
+        std::int64_t begin_ns;
+        // -1 while the stage runs; milestones end where they begin
+        std::int64_t end_ns;
+        bool milestone;
+    };
+
+    std::int64_t now_ns() const;
+    std::size_t thread_index();
+
+    clock::time_point start_;
+    mutable std::mutex mutex_;
+    std::vector<entry> entries_;
+    std::vector<std::thread::id> threads_;
+};